@@ -5,6 +5,18 @@
 #include"fdtparser.h"
 #include"comp_libfdt.h"
 
+typedef struct _KERNEL_FDT_REGION {
+	//
+	// Region physical base address
+	//
+	UINT64 Base;
+
+	//
+	// Region size in bytes
+	//
+	UINT64 Size;
+} KERNEL_FDT_REGION;
+
 typedef struct _KERNEL_FDT_PROTOCOL {
 	//
 	// Device Tree pointer
@@ -15,6 +27,19 @@ typedef struct _KERNEL_FDT_PROTOCOL {
 	// Device Tree size
 	//
 	UINTN FdtSize;
+
+	//
+	// System memory regions (device_type = "memory" nodes)
+	//
+	KERNEL_FDT_REGION *Memory;
+	UINTN MemoryCount;
+
+	//
+	// Reserved regions (/memreserve/ and /reserved-memory),
+	// already reserved in the UEFI memory map
+	//
+	KERNEL_FDT_REGION *Reserved;
+	UINTN ReservedCount;
 } KERNEL_FDT_PROTOCOL;
 
 extern EFI_GUID gKernelFdtProtocolGuid;
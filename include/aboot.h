@@ -22,21 +22,57 @@
 // android boot image struct
 typedef struct aboot_image aboot_image;
 
+// vendor ramdisk types in a vendor_boot v4 ramdisk table
+#define ABOOT_VENDOR_RAMDISK_NONE     0
+#define ABOOT_VENDOR_RAMDISK_PLATFORM 1
+#define ABOOT_VENDOR_RAMDISK_RECOVERY 2
+#define ABOOT_VENDOR_RAMDISK_DLKM     3
+
+// one entry of a vendor_boot v4 ramdisk table
+typedef struct aboot_vendor_ramdisk{
+	uint32_t size;
+	uint32_t offset;
+	uint32_t type;
+	char name[32];
+	uint32_t board_id[16];
+}aboot_vendor_ramdisk;
+
 // src/lib/aboot.c: is an empty image without any parts
 extern bool abootimg_is_empty(aboot_image*img);
 
-// src/lib/aboot.c: is an invalid image has invalid header or no kernel
+// src/lib/aboot.c: is an invalid image has invalid header or no kernel (vendor_boot: no ramdisk and dtb)
 extern bool abootimg_is_invalid(aboot_image*img);
 
 // src/lib/aboot.c: check page size is valid
 extern bool abootimg_check_page(size_t p);
 
-// src/lib/aboot.c: get image theoretical size (head + kernel size + ramdisk size + second size)
+// src/lib/aboot.c: get image theoretical size (head + all parts of its header version)
 extern uint32_t abootimg_get_image_size(aboot_image*img);
 
 // src/lib/aboot.c: allocate an empty image
 extern aboot_image*abootimg_new_image();
 
+// src/lib/aboot.c: allocate an empty vendor_boot image
+extern aboot_image*abootimg_new_vendor_image();
+
+// src/lib/aboot.c: is a vendor_boot image
+extern bool abootimg_is_vendor(aboot_image*img);
+
+// src/lib/aboot.c: get header version (boot 0-4, vendor_boot 3-4)
+extern uint32_t abootimg_get_header_version(aboot_image*img);
+
+// src/lib/aboot.c: set header version, this changes which parts are saved
+extern bool abootimg_set_header_version(aboot_image*img,uint32_t version);
+
+// src/lib/aboot.c: get count of vendor ramdisks in ramdisk table
+extern size_t abootimg_get_vendor_ramdisk_count(aboot_image*img);
+
+// src/lib/aboot.c: get a vendor ramdisk from ramdisk table, points into ramdisk
+extern void*abootimg_get_vendor_ramdisk(aboot_image*img,size_t idx,aboot_vendor_ramdisk*info);
+
+// src/lib/aboot.c: append a vendor ramdisk to ramdisk and ramdisk table
+extern bool abootimg_add_vendor_ramdisk(aboot_image*img,void*data,uint32_t len,uint32_t type,const char*name);
+
 // src/lib/aboot.c: deallocate image
 extern void abootimg_free(aboot_image*img);
 
@@ -143,6 +179,9 @@ extern bool abootimg_save_to_file(aboot_image*img,int cfd,const char*file);
 DECL_ABOOTIMG_GET_SET(kernel)
 DECL_ABOOTIMG_GET_SET(ramdisk)
 DECL_ABOOTIMG_GET_SET(second)
+DECL_ABOOTIMG_GET_SET(recovery_dtbo)
+DECL_ABOOTIMG_GET_SET(dtb)
+DECL_ABOOTIMG_GET_SET(bootconfig)
 DECL_ABOOTIMG_GETSET_VAR(const char*,name,NULL)
 DECL_ABOOTIMG_GETSET_VAR(const char*,cmdline,NULL)
 DECL_ABOOTIMG_GETSET_VAR(uint32_t,kernel_size,0)
@@ -153,6 +192,11 @@ DECL_ABOOTIMG_GETSET_VAR(uint32_t,second_size,0)
 DECL_ABOOTIMG_GETSET_VAR(uint32_t,second_address,0)
 DECL_ABOOTIMG_GETSET_VAR(uint32_t,tags_address,0)
 DECL_ABOOTIMG_GETSET_VAR(uint32_t,page_size,0)
+DECL_ABOOTIMG_GETSET_VAR(uint32_t,os_version,0)
+DECL_ABOOTIMG_GETSET_VAR(uint32_t,recovery_dtbo_size,0)
+DECL_ABOOTIMG_GETSET_VAR(uint32_t,dtb_size,0)
+DECL_ABOOTIMG_GETSET_VAR(uint64_t,dtb_address,0)
+DECL_ABOOTIMG_GETSET_VAR(uint32_t,bootconfig_size,0)
 
 #undef DECL_ABOOTIMG_GETSET_VAR
 #undef DECL_ABOOTIMG_GET_SET
@@ -12,8 +12,9 @@
 #define LOCAL_CLIENT_PREFIX "linux-systemd-"
 enum adb_proto{
 	PROTO_NONE=0,
-	PROTO_USB,
-	PROTO_TCP
+	PROTO_USB=1<<0,
+	PROTO_TCP=1<<1,
+	PROTO_ALL=PROTO_USB|PROTO_TCP,
 };
 struct adb_data{
 	char shell[512];
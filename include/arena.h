@@ -0,0 +1,43 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+/*
+ * Bump allocator for objects that are freed all at once
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+#include<stddef.h>
+
+typedef struct arena arena;
+
+// src/lib/arena.c: create an arena taking memory in blocks of block bytes (0 for default)
+extern arena*arena_new(size_t block);
+
+// src/lib/arena.c: allocate memory from an arena
+extern void*arena_alloc(arena*a,size_t size);
+
+// src/lib/arena.c: allocate zeroed memory from an arena
+extern void*arena_zalloc(arena*a,size_t size);
+
+// src/lib/arena.c: duplicate memory into an arena
+extern void*arena_memdup(arena*a,const void*mem,size_t len);
+
+// src/lib/arena.c: duplicate a string into an arena
+extern char*arena_strdup(arena*a,const char*str);
+
+// src/lib/arena.c: duplicate up to len chars of a string into an arena
+extern char*arena_strndup(arena*a,const char*str,size_t len);
+
+// src/lib/arena.c: drop everything allocated, keep the blocks for reuse
+extern void arena_reset(arena*a);
+
+// src/lib/arena.c: free an arena and everything allocated from it
+extern void arena_free(arena*a);
+
+#endif
@@ -8,6 +8,7 @@
 
 #ifndef ASSETS_H
 #define ASSETS_H
+#include<stdint.h>
 #include<stdbool.h>
 #include<sys/types.h>
 #ifndef uid_t
@@ -36,6 +37,10 @@ struct entry_file{
 	char*content;
 	size_t offset;
 	size_t length;
+	bool compressed;
+	size_t stored;
+	uint32_t crc;
+	unsigned holds;
 };
 typedef struct entry_dir entry_dir;
 
@@ -44,9 +49,33 @@ struct entry_dir{
 	struct entry info;
 	struct entry_dir**subdirs;
 	struct entry_file**subfiles;
+	struct assets_index*index;
 };
 typedef struct entry_file entry_file;
 
+// path index slot, path is relative to the root without leading slash
+struct entry_index{
+	uint32_t hash;
+	const char*path;
+	struct entry_dir*dir;
+	struct entry_file*file;
+};
+typedef struct entry_index entry_index;
+
+// hash table of every entry, generated with the tree and set on its root
+struct assets_index{
+	size_t size;
+	struct entry_index*table;
+};
+typedef struct assets_index assets_index;
+
+// fnv-1a of a path in an assets index
+static inline uint32_t assets_path_hash(const char*path,size_t len){
+	uint32_t h=0x811C9DC5;
+	for(size_t i=0;i<len;i++)h=(h^(unsigned char)path[i])*0x01000193;
+	return h;
+}
+
 // BUILD/rootfs.c: generic rootfs
 extern entry_dir assets_rootfs;
 
@@ -65,6 +94,18 @@ extern int create_assets_dir(int dfd,entry_dir*dir,bool override);
 // src/assets/assets.c: get file by path in an assets
 extern entry_file*get_assets_file(entry_dir*dir,const char*path);
 
+// src/assets/assets.c: decompress file content if needed, get_assets_file does this
+extern bool asset_file_load(entry_file*file);
+
+// src/assets/assets.c: keep decompressed content until asset_file_release
+extern void asset_file_hold(entry_file*file);
+
+// src/assets/assets.c: let decompressed content be dropped again
+extern void asset_file_release(entry_file*file);
+
+// src/assets/assets.c: get the gzip data a compressed file is stored as
+extern const void*asset_file_get_stored(entry_file*file,size_t*len);
+
 // src/assets/assets.c: get folder by path in an assets
 extern entry_dir*get_assets_dir(entry_dir*dir,const char*path);
 
@@ -64,6 +64,9 @@ extern void parse_params(keyval**params);
 // src/cmdline/cmdline.c: convert cmdline to keyval array
 extern int parse_cmdline(int fd);
 
-// src/cmdline/cmdline.c: auto parse cmdline from /proc/cmdline
+// src/cmdline/cmdline.c: parse bootconfig from fd, init.* keys lose their prefix, kernel.* keys are skipped
+extern int parse_bootconfig(int fd);
+
+// src/cmdline/cmdline.c: auto parse bootconfig, /proc/cmdline and device tree android firmware
 extern int load_cmdline(void);
 #endif
@@ -8,9 +8,11 @@
 
 #ifndef _COMPRESS_H
 #define _COMPRESS_H
+#include<stdbool.h>
 #include<sys/types.h>
 
 typedef struct compressor compressor;
+typedef struct compress_stream compress_stream;
 
 // src/compress/compress.c: get compressor name
 extern const char*compressor_get_name(compressor*c);
@@ -21,6 +23,9 @@ extern const char*compressor_get_mime(compressor*c);
 // src/compress/compress.c: get compressor supported file ext name
 extern const char*compressor_get_ext(compressor*c);
 
+// src/compress/compress.c: check decompress runs without allocating or logging
+extern bool compressor_is_standalone(compressor*c);
+
 // src/compress/compress.c: get compressor by compressor name
 extern compressor*compressor_get_by_name(const char*name);
 
@@ -54,6 +59,22 @@ extern int compressor_decompress(
 	unsigned char*out,size_t out_len,
 	size_t*pos,size_t*len
 );
+// src/compress/compress.c: start a streaming decompress
+extern compress_stream*compressor_decompress_init(compressor*c);
+
+// src/compress/compress.c: feed input to a streaming decompress and take output
+extern int compressor_decompress_update(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+);
+
+// src/compress/compress.c: check streaming decompress reached the end of data
+extern bool compressor_decompress_is_end(compress_stream*s);
+
+// src/compress/compress.c: free a streaming decompress, fails if data was incomplete
+extern int compressor_decompress_finish(compress_stream*s);
 #define DECL_INLINE(suffix,param...)\
 	extern int compressor_compress_##suffix(\
 		param\
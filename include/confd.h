@@ -23,6 +23,30 @@ enum conf_type{
 	TYPE_BOOLEAN =0xAF04,
 };
 
+// config batch item
+struct confd_item{
+	const char*path;
+	enum conf_type type;
+	int code;
+	union{
+		char*string;
+		int64_t integer;
+		bool boolean;
+	}value;
+};
+
+// confd client benchmark settings and results, latencies are in ns
+struct confd_bench{
+	size_t threads,ops,keys;
+	unsigned int get,set,ls;
+	size_t done,errors;
+	double elapsed;
+	uint64_t p50,p99,p999,max;
+};
+
+// config change callback, type is 0 when the item was removed
+typedef void(*confd_watch_cb)(const char*path,enum conf_type type,void*data);
+
 // src/confd/client.c: open confd socket
 extern int open_confd_socket(bool quiet,char*tag,char*path);
 
@@ -41,6 +65,12 @@ extern int confd_init();
 #else
 // src/confd/client.c: start a config daemon in protect mode
 extern int start_confd(char*tag,pid_t*p);
+
+// src/confd/server.c: start a config daemon as a thread of this process
+extern int start_confd_thread(char*tag);
+
+// src/confd/bench.c: run concurrent get/set/ls clients against confd at sock
+extern int confd_bench_run(const char*sock,struct confd_bench*b);
 #endif
 
 // src/confd/client.c: terminate remote confd
@@ -61,6 +91,43 @@ extern int confd_include_file(const char*file);
 // src/confd/client.c: set default config file path
 extern int confd_set_default_config(const char*file);
 
+// src/confd/file.c: convert a config file to another format in this process
+extern int conf_convert_file(const char*from,const char*to);
+
+// src/confd/client.c: get many config items in one request
+// type is the wanted type (0 for any) and receives the real type,
+// code receives the item errno, string values must be freed
+extern int confd_get_many(struct confd_item*items,size_t cnt);
+
+// src/confd/client.c: set many config items in one request
+// code receives the item errno
+extern int confd_set_many(struct confd_item*items,size_t cnt);
+
+// src/confd/client.c: hash names, types and values of a config item and all children
+extern int confd_tree_hash(const char*path,uint64_t*hash);
+
+// src/confd/client.c: get a config item and all children in one request
+// paths are relative to path ("" for path itself), parents come first,
+// the items and all strings are one block to free
+extern struct confd_item*confd_get_tree(const char*path,size_t*cnt);
+
+// src/confd/client.c: open a connection receiving changes under prefix
+extern int confd_watch_open(const char*prefix);
+
+// src/confd/client.c: wait up to timeout ms for a change from a watch connection
+// returns 1 when an event was read, 0 on timeout
+extern int confd_watch_read(int fd,char*path,size_t len,enum conf_type*type,int timeout);
+
+// src/confd/client.c: close a connection from confd_watch_open
+extern void confd_watch_close(int fd);
+
+// src/confd/client.c: call cb for every change under prefix, returns a watch id
+// cb is called from another thread (synchronously from the store on uefi)
+extern int confd_watch(const char*prefix,confd_watch_cb cb,void*data);
+
+// src/confd/client.c: stop a watch created by confd_watch
+extern void confd_unwatch(int id);
+
 #define DECLARE_FUNC(func,ret,...) \
 	extern ret func(const char*path __VA_ARGS__); \
 	extern ret func##_base(const char*base,const char*path __VA_ARGS__);\
@@ -47,6 +47,9 @@ extern int devd_call_modalias(void);
 // src/devd/devd.c: call DEV_MODLOAD to load modules from list config
 extern int devd_call_modload(void);
 
+// src/devd/devd.c: call DEV_MODPROBE to insert modules of aliases with the context of devd
+extern int devd_call_modprobe(char**aliases,size_t cnt);
+
 // src/devd/devd.c: call DEV_QUIT to terminate devd
 extern int devd_call_quit(void);
 
@@ -62,6 +65,27 @@ extern int mods_conf_parse_folder(const char*dir);
 // src/devd/modules_load.c: search modules-load.d and call mods_conf_parse_folder
 extern int mods_conf_parse(void);
 
+// src/devd/blkindex.c: update /dev/disk/by-* links of a block uevent
+extern int blkindex_process(uevent*event);
+
+// src/devd/blkindex.c: probe all block devices and create /dev/disk/by-* links
+extern int blkindex_scan(void);
+
+// src/devd/blkindex.c: find device of LABEL= UUID= PARTLABEL= PARTUUID= TYPE= tag
+extern char*blkindex_find(const char*tag);
+
+// src/devd/blkindex.c: get tag value of a device
+extern char*blkindex_value(const char*dev,const char*key);
+
+// src/devd/devd.c: ask devd for the device of a tag
+extern char*devd_find_tag(const char*tag);
+
+// src/devd/devd.c: ask devd for a tag value of a device
+extern char*devd_tag_value(const char*dev,const char*key);
+
+// src/devd/devd.c: get tag value of a device from devd, blkid without devd
+extern char*blk_get_tag_value(const char*dev,const char*key);
+
 // src/devd/modalias.c: search modalias in /sys/devices to load all modules
 extern int load_modalias(void);
 
@@ -25,11 +25,14 @@ typedef struct fsdrv fsdrv;
 typedef struct fsvol fsvol;
 typedef struct fs_file_info fs_file_info;
 typedef struct fsvol_info fsvol_info;
+typedef struct fs_iovec fs_iovec;
+typedef struct fs_io fs_io;
 typedef enum fs_type fs_type;
 typedef enum fs_feature fs_feature;
 typedef enum fs_ioctl_id fs_ioctl_id;
 typedef enum fs_file_flag fs_file_flag;
 typedef enum fs_wait_flag fs_wait_flag;
+typedef enum fs_io_op fs_io_op;
 typedef enum fsvol_feature fsvol_feature;
 typedef void fs_handle_close(const char*name,fsh*f,void*data);
 
@@ -76,6 +79,7 @@ enum fs_file_flag{
 	FILE_FLAG_SHARED     = 0x0000000008000000,
 	FILE_FLAG_PRIVATE    = 0x0000000010000000,
 	FILE_FLAG_FIXED      = 0x0000000020000000,
+	FILE_FLAG_BUFFERED   = 0x0000000040000000,
 	_FILE_FLAG_MAX       = UINT64_MAX
 };
 
@@ -107,11 +111,20 @@ enum fs_wait_flag{
 	_FILE_WAIT_MAX       = UINT64_MAX
 };
 
+enum fs_io_op{
+	FS_IO_NONE  = 0,
+	FS_IO_READ  = 1,
+	FS_IO_WRITE = 2,
+};
+
 enum fs_ioctl_id{
 	_FS_IOCTL_NONE  = 0,
 	FS_IOCTL_UEFI_GET_HANDLE,
 	FS_IOCTL_UEFI_GET_FILE_PROTOCOL,
 	FS_IOCTL_UEFI_GET_DEVICE_PATH,
+	FS_IOCTL_CURL_SET_READAHEAD,
+	FS_IOCTL_CURL_SET_CHUNK,
+	FS_IOCTL_CURL_SET_PARALLEL,
 	_FS_IOCTL_MAX   = UINT64_MAX,
 };
 
@@ -159,6 +172,28 @@ struct fs_file_info{
 	];
 };
 
+struct fs_iovec{
+	void*buffer;
+	size_t length;
+};
+
+// positional request for fs_submit, the file position is left untouched
+struct fs_io{
+	fsh*file;
+	fs_io_op op;
+	void*buffer;
+	size_t size;
+	size_t offset;
+
+	// set when the request finished
+	bool finished;
+	int result;
+	size_t done;
+
+	// owned by the driver while in flight
+	void*priv;
+};
+
 struct fsvol_info{
 	char magic[8];
 	fsvol_feature features;
@@ -202,7 +237,12 @@ extern int fs_open_uri(fsh**nf,url*uri,fs_file_flag flag);
 extern int fs_read(fsh*f,void*buffer,size_t btr,size_t*br);
 extern int fs_read_alloc(fsh*f,void**buffer,size_t btr,size_t*br);
 extern int fs_readdir(fsh*f,fs_file_info*info);
+extern int fs_readdir_batch(fsh*f,fs_file_info*infos,size_t max,size_t*cnt);
 extern int fs_write(fsh*f,void*buffer,size_t btw,size_t*bw);
+extern int fs_readv(fsh*f,const fs_iovec*iov,size_t cnt,size_t*br);
+extern int fs_writev(fsh*f,const fs_iovec*iov,size_t cnt,size_t*bw);
+extern int fs_submit(fs_io**ios,size_t cnt);
+extern int fs_complete(fs_io**ios,size_t cnt,long timeout);
 extern int fs_printf(fsh*f,const char*format,...) __attribute__((format(printf,2,3)));
 extern int fs_print(fsh*f,const char*str);
 extern int fs_println(fsh*f,const char*str);
@@ -222,6 +262,7 @@ extern int fs_get_type(fsh*f,fs_type*type);
 extern int fs_get_size(fsh*f,size_t*out);
 extern int fs_get_name(fsh*f,char*buff,size_t buff_len);
 extern int fs_set_size(fsh*f,size_t size);
+extern int fs_set_buffer(fsh*f,size_t size);
 extern int fs_write_file_uri(url*uri,void*buffer,size_t len);
 extern int fs_write_file(fsh*f,const char*path,void*buffer,size_t len);
 extern int fs_printf_file_uri(url*uri,const char*format,...) __attribute__((format(printf,2,3)));
@@ -259,6 +300,7 @@ extern const char*fs_type_to_name(const fs_type);
 extern bool fs_string_to_file_type(const char*string,fs_type*);
 extern bool fs_name_to_file_type(const char*name,fs_type*);
 extern int fs_register_zip(fsh*f,const char*name);
+extern int fs_register_decompress(fsh*f,const char*name);
 extern void fsvol_rescan();
 extern void fsvol_update();
 extern fsvol_info*fsvol_lookup_by_id(const char*id);
@@ -268,6 +310,7 @@ extern fsvol_info*fsvol_lookup_by_fs_label(const char*name);
 extern fsvol_info*fsvol_lookup_by_part_label(const char*name);
 extern fsvol_info**fsvol_get_by_driver_name(const char*name);
 extern fsvol_info**fsvol_get_volumes();
+extern uint64_t fsvol_get_generation();
 extern int fsvol_open_volume(fsvol_info*info,fsh**nf);
 #define fs_read_to_stdout(f,size,sent)fs_read_to_fd(f,STDOUT_FILENO,size,sent)
 #define fs_read_to_stderr(f,size,sent)fs_read_to_fd(f,STDERR_FILENO,size,sent)
@@ -0,0 +1,80 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef FONT_BIN_H
+#define FONT_BIN_H
+#include<stdint.h>
+#include<stddef.h>
+
+/*
+ * prerendered default font, generated by src/host/fontbin.c.
+ * this is the lvgl binary font format (lv_font_load), restricted to
+ * what the generator writes: 8 bpp plain bitmaps, sparse cmaps, u32 loca,
+ * byte aligned glyph headers and no kerning. a table is a u32 length
+ * that includes its own label, the label and the table body.
+ * all numbers are little endian.
+ *
+ * layout: head | cmap | loca | glyf
+ */
+
+#define FONT_BIN_VERSION   1
+#define FONT_BIN_BPP       8
+#define FONT_BIN_ADV_BITS  8
+#define FONT_BIN_XY_BITS   8
+#define FONT_BIN_WH_BITS   8
+#define FONT_BIN_GLYPH_HDR ((FONT_BIN_ADV_BITS+FONT_BIN_XY_BITS*2+FONT_BIN_WH_BITS*2)/8)
+#define FONT_BIN_ASSET     "/usr/share/fonts/default-%d.bin"
+
+// lvgl cmap type and loca format
+#define FONT_BIN_CMAP_SPARSE_TINY 3
+#define FONT_BIN_LOCA_U32 1
+
+struct font_bin_label{
+	uint32_t length;
+	char label[4];
+};
+
+struct font_bin_head{
+	uint32_t version;
+	uint16_t tables_count;
+	uint16_t font_size;
+	uint16_t ascent;
+	int16_t descent;
+	uint16_t typo_ascent;
+	int16_t typo_descent;
+	uint16_t typo_line_gap;
+	int16_t min_y;
+	int16_t max_y;
+	uint16_t default_advance_width;
+	uint16_t kerning_scale;
+	uint8_t index_to_loc_format;
+	uint8_t glyph_id_format;
+	uint8_t advance_width_format;
+	uint8_t bits_per_pixel;
+	uint8_t xy_bits;
+	uint8_t wh_bits;
+	uint8_t advance_width_bits;
+	uint8_t compression_id;
+	uint8_t subpixels_mode;
+	uint8_t padding;
+	int16_t underline_position;
+	uint16_t underline_thickness;
+};
+
+// data_offset counts from the start of the cmap table
+struct font_bin_cmap{
+	uint32_t data_offset;
+	uint32_t range_start;
+	uint16_t range_length;
+	uint16_t glyph_id_start;
+	uint16_t data_entries_count;
+	uint8_t format_type;
+	uint8_t padding;
+};
+
+#endif
@@ -19,6 +19,7 @@ typedef enum frame_type{
 	TYPE_BMP,
 	TYPE_JPG,
 	TYPE_PNG,
+	TYPE_TILE,
 	TYPE_LAST,
 	TYPE_MAX=0xFF
 }frame_type;
@@ -36,6 +37,9 @@ typedef enum frame_pixel{
 typedef struct frame_data{
 	char magic[7];
 	bool compressed:1;
+	// compressed by the deflate stream of the connection, reset starts it over
+	bool stream:1;
+	bool reset:1;
 	uint32_t version;
 	uint32_t cost_time;
 	uint64_t gen_time;
@@ -46,6 +50,26 @@ typedef struct frame_data{
 	frame_pixel pixel:16;
 	char frame[];
 }frame_data;
+
+/*
+ * a TYPE_TILE frame carries only the tiles that changed since the last
+ * one, each record is a frame_tile followed by its data padded to 4
+ * bytes. RLE data is a list of (count-1, pixel), SOLID is one pixel.
+ */
+#define FRAME_TILE_SIZE 64
+#define FRAME_TILE_ALIGN(s) (((s)+3)&~(size_t)3)
+typedef enum frame_tile_enc{
+	TILE_RAW=0,
+	TILE_SOLID,
+	TILE_RLE,
+}frame_tile_enc;
+typedef struct frame_tile{
+	uint16_t x,y,w,h;
+	uint8_t enc;
+	uint8_t reserved[3];
+	uint32_t size;
+	char data[];
+}frame_tile;
 static inline uint8_t pixel_size(frame_pixel mode){
 	switch(mode){
 		case PIXEL_RGB24:
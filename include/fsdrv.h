@@ -21,6 +21,7 @@ extern mutex_t fsvol_info_lock;
 extern list*fs_drivers;
 extern list*fs_volumes;
 extern list*fs_volume_infos;
+extern uint64_t fsvol_generation;
 extern fs_initiator_function*fs_initiator[];
 extern const fsdrv fsdrv_template;
 extern bool fsvol_private_info_check(const fsvol_private_info*info);
@@ -31,8 +32,12 @@ extern int fs_flush_locked(fsh*f);
 extern int fs_exists_locked(fsh*f,const char*uri,bool*exists,bool lock);
 extern int fs_open_locked(fsh*f,fsh**nf,const char*uri,fs_file_flag flag,bool lock);
 extern int fs_readdir_locked(fsh*f,fs_file_info*info);
+extern int fs_readdir_batch_locked(fsh*f,fs_file_info*infos,size_t max,size_t*cnt);
 extern int fs_read_locked(fsh*f,void*buffer,size_t btr,size_t*br);
 extern int fs_write_locked(fsh*f,void*buffer,size_t btw,size_t*bw);
+extern int fs_readv_locked(fsh*f,const fs_iovec*iov,size_t cnt,size_t*br);
+extern int fs_writev_locked(fsh*f,const fs_iovec*iov,size_t cnt,size_t*bw);
+extern int fs_copy_to_locked(fsh*f,int fd,size_t size,size_t*sent);
 extern int fs_wait_locked(fsh**gots,fsh**waits,size_t cnt,long timeout,fs_wait_flag flag,bool lock);
 extern int fs_seek_locked(fsh*f,size_t pos,int whence);
 extern int fs_tell_locked(fsh*f,size_t*pos);
@@ -43,6 +48,7 @@ extern int fs_get_type_locked(fsh*f,fs_type*type);
 extern int fs_get_size_locked(fsh*f,size_t*out);
 extern int fs_get_name_locked(fsh*f,char*buff,size_t buff_len);
 extern int fs_set_size_locked(fsh*f,size_t size);
+extern int fs_set_buffer_locked(fsh*f,size_t size);
 extern int fs_get_url_locked(fsh*f,url**out);
 extern int fs_get_path_locked(fsh*f,char*buff,size_t len);
 extern int fs_get_path_alloc_locked(fsh*f,char**buff);
@@ -99,6 +105,11 @@ typedef int(*fs_drv_read)(const fsdrv*drv,fsh*f,void*buffer,size_t btr,size_t*br
 typedef int(*fs_drv_read_all)(const fsdrv*drv,fsh*f,void**buffer,size_t*br);
 typedef int(*fs_drv_readdir)(const fsdrv*drv,fsh*f,fs_file_info*info);
 typedef int(*fs_drv_write)(const fsdrv*drv,fsh*f,void*buffer,size_t btw,size_t*bw);
+typedef int(*fs_drv_readv)(const fsdrv*drv,fsh*f,const fs_iovec*iov,size_t cnt,size_t*br);
+typedef int(*fs_drv_writev)(const fsdrv*drv,fsh*f,const fs_iovec*iov,size_t cnt,size_t*bw);
+typedef int(*fs_drv_submit)(const fsdrv*drv,fsh*f,fs_io*io);
+typedef int(*fs_drv_complete)(const fsdrv*drv,fs_io*io,long timeout);
+typedef int(*fs_drv_copy_to)(const fsdrv*drv,fsh*f,int fd,size_t size,size_t*sent);
 typedef int(*fs_drv_seek)(const fsdrv*drv,fsh*f,size_t pos,int whence);
 typedef int(*fs_drv_tell)(const fsdrv*drv,fsh*f,size_t*pos);
 typedef int(*fs_drv_map)(const fsdrv*drv,fsh*f,void**buffer,size_t off,size_t*size,fs_file_flag flag);
@@ -136,6 +147,11 @@ struct fsdrv{
 	fs_drv_read_all read_all;
 	fs_drv_readdir readdir;
 	fs_drv_write write;
+	fs_drv_readv readv;
+	fs_drv_writev writev;
+	fs_drv_submit submit;
+	fs_drv_complete complete;
+	fs_drv_copy_to copy_to;
 	fs_drv_seek seek;
 	fs_drv_tell tell;
 	fs_drv_map map;
@@ -187,5 +203,9 @@ struct fsh{
 	list*on_close;
 	url*uri;
 	char*url;
+	struct fsh_buffer*buffer;
+	struct map_info*maps;
+	struct dir_cache*dir;
+	size_t dir_pos;
 };
 #endif
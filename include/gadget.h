@@ -8,6 +8,8 @@
 
 #ifndef _GADGET_H
 #define _GADGET_H
+#include<stdbool.h>
+#include<stddef.h>
 #include"keyval.h"
 #define wr_file(fd,file,str)write_file(fd,file,str,strlen(str),0644,false,true,true)
 
@@ -121,6 +123,15 @@ extern int gadget_start(gadget*gadget,const char*udc);
 // src/gadget/general.c: search an available usb gadget controller
 extern char*gadget_find_udc(void);
 
+// src/gadget/udc.c: search the first usb gadget controller matches sel (fnmatch pattern, NULL for any)
+extern char*gadget_select_udc(char*buff,size_t len,const char*sel);
+
+// src/gadget/udc.c: bind gadget to udc and record bind latency
+extern int gadget_bind_udc(int fd,const char*name,const char*udc);
+
+// src/gadget/udc.c: handle a udc appears (or changes) and disappears
+extern int gadget_udc_event(const char*udc,bool present);
+
 // src/gadget/general.c: set udc
 extern int gadget_write_udc(int fd,const char*udc);
 
@@ -35,9 +35,20 @@ extern int gui_init(void);
 extern int gui_main(void);
 extern int gui_draw(void);
 extern void gui_quit_sleep(void);
+#ifdef ENABLE_UEFI
+extern int gui_watch_event(void*event);
+extern void gui_unwatch_event(void*event);
+#else
+typedef void(*gui_fd_cb)(int fd,void*data);
+extern int gui_watch_fd(int fd,gui_fd_cb cb,void*data);
+extern void gui_unwatch_fd(int fd);
+extern void gui_wakeup(void);
+#endif
 extern void gui_do_quit(void);
 extern void gui_set_run_exit(runnable_t*run);
 extern void gui_run_and_exit(runnable_t*run);
 extern uint32_t custom_tick_get(void);
+extern void gui_set_fixed_tick(bool fixed);
+extern void gui_advance_tick(uint32_t ms);
 extern int register_guiapp(void);
 #endif
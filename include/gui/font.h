@@ -17,10 +17,23 @@ typedef enum{
 extern void lv_ft_destroy(lv_font_t*font);
 extern bool lv_freetype_init(uint16_t max_faces, uint16_t max_sizes, uint32_t max_bytes);
 extern void lv_freetype_destroy(void);
+extern size_t lv_freetype_trim(bool all);
 extern lv_font_t*lv_ft_init(const char*name,int weight,lv_ft_style style);
 extern lv_font_t*lv_ft_init_data(unsigned char*data,long size,int weight,lv_ft_style style);
 #ifdef ASSETS_H
 extern lv_font_t*lv_ft_init_assets(entry_dir*assets,char*path,int weight,lv_ft_style style);
 #endif
 extern lv_font_t*lv_ft_init_rootfs(char*path,int weight,lv_ft_style style);
+
+// src/gui/decoders/fontbin.c: load prerendered font from memory, data must stay
+extern lv_font_t*lv_font_bin_init_data(const unsigned char*data,size_t len);
+#ifdef ASSETS_H
+// src/gui/decoders/fontbin.c: load prerendered font from assets
+extern lv_font_t*lv_font_bin_init_assets(entry_dir*assets,const char*path);
+#endif
+// src/gui/decoders/fontbin.c: load prerendered font from builtin rootfs
+extern lv_font_t*lv_font_bin_init_rootfs(const char*path);
+
+// src/gui/decoders/fontbin.c: release prerendered font
+extern void lv_font_bin_destroy(lv_font_t*font);
 #endif
@@ -108,4 +108,34 @@ extern struct gui_driver*guidrv_get_driver(void);
 
 // src/gui/guidrv.c: init input drivers
 extern int indrv_init(void);
+
+// src/gui/drivers/pixel.c: swap red and blue of 32bpp pixels (bgra to rgba)
+extern void pixel_swap_rb(uint32_t*dst,const uint32_t*src,size_t cnt);
+
+// src/gui/drivers/pixel.c: pack 32bpp pixels into rgb565
+extern void pixel_pack_565(uint16_t*dst,const uint32_t*src,size_t cnt);
+
+// src/gui/drivers/pixel.c: pack 32bpp pixels into 24bpp, bgr order or rgb when swap
+extern void pixel_pack_24(uint8_t*dst,const uint32_t*src,size_t cnt,bool swap);
+
+// src/gui/drivers/pixel.c: pack 32bpp pixels into 1bpp by brightness, lsb first from bit
+extern void pixel_pack_mono(uint8_t*dst,size_t bit,const uint32_t*src,size_t cnt);
+
+// src/gui/drivers/pixel.c: rotate packed w*h 32bpp pixels into packed dst
+extern void pixel_rotate(uint32_t*dst,const uint32_t*src,size_t w,size_t h,lv_disp_rot_t rot);
+
+// src/gui/drivers/pixel.c: rotate an area on a w*h native screen
+extern void pixel_rotate_area(lv_area_t*out,const lv_area_t*in,lv_coord_t w,lv_coord_t h,lv_disp_rot_t rot);
+
+// src/gui/drivers/pixel.c: rotate flushed pixels and area to the native orientation of drv
+extern const uint32_t*pixel_flush_rotate(lv_disp_drv_t*drv,lv_area_t*area,const lv_color_t*color_p);
+
+// src/gui/drivers/pixel.c: get lvgl rotation of gui_rotate angle
+extern lv_disp_rot_t pixel_get_rotation(uint16_t angle);
+
+// src/gui/drivers/draw.c: init lvgl software draw context, striping large blends over threads
+extern void gui_draw_init_ctx(lv_disp_drv_t*drv,lv_draw_ctx_t*draw_ctx);
+
+// src/gui/drivers/draw.c: deinit lvgl software draw context
+extern void gui_draw_deinit_ctx(lv_disp_drv_t*drv,lv_draw_ctx_t*draw_ctx);
 #endif
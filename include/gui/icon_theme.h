@@ -12,6 +12,7 @@
 #include"regexp.h"
 #include"filesystem.h"
 #define ICON_THEME_COMPATIBLE_LEVEL 0x00000001
+#define ICON_THEME_INDEX_SIZE 128
 
 typedef struct icon_theme_search_path{
 	fsh*folder;
@@ -27,6 +28,16 @@ typedef struct icon_theme_name_mapping{
 	char*search;
 }icon_theme_name_mapping;
 
+// an icon name already resolved in a theme, map is null for plain paths
+typedef struct icon_theme_resolved{
+	struct icon_theme_resolved*next;
+	uint32_t hash;
+	bool found;
+	icon_theme_search_path*search;
+	icon_theme_name_mapping*map;
+	char name[];
+}icon_theme_resolved;
+
 typedef struct icon_theme{
 	char zid[32];
 	fsh*root;
@@ -39,6 +50,7 @@ typedef struct icon_theme{
 	bool zip;
 	list*search_path;
 	list*name_mapping;
+	icon_theme_resolved*index[ICON_THEME_INDEX_SIZE];
 }icon_theme;
 
 extern list*gui_icon_themes;
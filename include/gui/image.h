@@ -21,24 +21,40 @@ typedef struct image_data{
 	uint32_t height;
 	uint32_t format;
 	uint8_t*pixels;
+	// wanted size for decoders that can scale while decoding, 0 for full
+	uint32_t hint_w,hint_h;
+	// cache bookkeeping, owned by src/gui/decoders/image.c
+	uint32_t hash;
+	size_t size;
+	int pins;
+	struct image_data*hnext,*prev,*next;
 }image_data;
 typedef int(*image_decode_cb)(unsigned char*data,size_t len,image_data*img);
+typedef void(*image_async_cb)(lv_obj_t*obj,bool ok,void*data);
 typedef struct image_decoder{
 	image_decode_cb decode_cb;
 	char**types;
+	// decoder writes into data, it cannot decode a read only map
+	bool modify_data;
 }image_decoder;
 
 extern image_decoder*image_get_decoder(char*ext);
 extern void image_decoder_init(void);
 extern void image_set_cache_time(time_t time);
+extern void image_set_cache_size(size_t size);
 extern void image_cache_clean(void);
 extern int image_cache_gc(void);
+extern size_t image_cache_trim(bool all);
 extern long image_get_cache_hits();
 extern long image_get_cache_misses();
 extern long image_get_load_fails();
+extern long image_get_cache_evictions();
 static inline long image_get_process_count(){return image_get_cache_hits()+image_get_cache_misses()+image_get_load_fails();}
 static inline float image_get_cache_hit_percent(){return (float)image_get_cache_hits()/image_get_process_count()*100;}
 static inline float image_get_cache_miss_percent(){return (float)image_get_cache_misses()/image_get_process_count()*100;}
 static inline float image_get_load_fail_percent(){return (float)image_get_load_fails()/image_get_process_count()*100;}
 extern void image_print_stat();
+
+// src/gui/decoders/image.c: set an image source decoded in background, at least w*h when set
+extern void image_set_src_async(lv_obj_t*obj,const char*path,uint32_t w,uint32_t h,image_async_cb cb,void*data);
 #endif
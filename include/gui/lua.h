@@ -95,4 +95,5 @@ extern void lvgl_obj_to_lua(lua_State*L,lv_obj_t*obj);
 extern void guiact_to_lua(lua_State*L,struct gui_activity*act);
 extern void guireg_to_lua(lua_State*L,struct gui_register*reg);
 extern void lua_gui_init(lua_State*L);
+extern void lua_gui_init_table(lua_State*L);
 #endif
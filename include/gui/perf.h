@@ -0,0 +1,53 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _GUI_PERF_H
+#define _GUI_PERF_H
+#include<stdint.h>
+#include<stdbool.h>
+#include"gui.h"
+
+struct gui_perf_value{
+	uint64_t sum;
+	uint32_t cnt,last,max;
+};
+
+// times are microseconds, areas are pixels
+struct gui_perf{
+	uint64_t start,end;
+	uint32_t frames;
+	struct gui_perf_value render,flush,area,latency;
+};
+
+// src/gui/perf.c: average of a perf value
+#define gui_perf_avg(v) ((uint32_t)((v).cnt>0?(v).sum/(v).cnt:0))
+
+// src/gui/perf.c: hook the default display and input devices
+extern void gui_perf_init(void);
+
+// src/gui/perf.c: get stats of the last full period
+extern void gui_perf_get(struct gui_perf*perf);
+
+// src/gui/perf.c: get stats since the previous collect and start again
+extern void gui_perf_collect(struct gui_perf*perf);
+
+// src/gui/perf.c: set the monitor callback of the display, fails if one is set
+extern int gui_perf_set_monitor(void(*cb)(lv_disp_drv_t*,uint32_t,uint32_t));
+
+// src/gui/perf.c: call cb with the times of every drawn frame, NULL to stop
+extern void gui_perf_set_frame_hook(void(*cb)(uint32_t render,uint32_t flush,uint32_t area));
+
+// src/gui/perf.c: show or hide profiler overlay
+extern void gui_perf_set_overlay(bool show);
+
+// src/gui/perf.c: get profiler overlay shown
+extern bool gui_perf_get_overlay(void);
+
+// src/gui/perf.c: frames per second of a perf stats
+extern uint32_t gui_perf_fps(struct gui_perf*perf);
+#endif
@@ -18,6 +18,7 @@ extern "C" {
 #if LV_USE_CANVAS==0
 #error "lv_termview: lv_canvas is required. Enable it in lv_conf.h (LV_USE_CANVAS 1)"
 #endif
+struct term_cache;
 typedef void(*termview_write_cb)(lv_obj_t*tv,const char *u8,size_t len);
 typedef void(*termview_osc_cb)(lv_obj_t*tv,const char *u8,size_t len);
 typedef void(*termview_resize_cb)(lv_obj_t*tv,uint32_t cols,uint32_t rows);
@@ -36,6 +37,7 @@ typedef struct{
 	tsm_age_t age;
 	size_t mem_size;
 	lv_color_t*buffer;
+	struct term_cache*cache;
 	lv_obj_t*virt_input;
 	struct tsm_screen*screen;
 	struct tsm_vte*vte;
@@ -0,0 +1,54 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _VLIST_H
+#define _VLIST_H
+#include<stddef.h>
+#include<sys/types.h>
+#include"gui.h"
+struct vlist;
+
+// create an empty row object in parent, rows are reused for any item
+typedef lv_obj_t*(*vlist_create_row)(struct vlist*vl,lv_obj_t*parent);
+
+// fill a row with the item at index
+typedef void(*vlist_bind_row)(struct vlist*vl,lv_obj_t*row,size_t idx);
+
+// src/gui/interface/widgets/vlist.c: create virtual list in a scrollable container
+extern struct vlist*vlist_create(lv_obj_t*cont,vlist_create_row create,vlist_bind_row bind);
+
+// src/gui/interface/widgets/vlist.c: set virtual list user data
+extern void vlist_set_data(struct vlist*vl,void*data);
+
+// src/gui/interface/widgets/vlist.c: get virtual list user data
+extern void*vlist_get_data(struct vlist*vl);
+
+// src/gui/interface/widgets/vlist.c: set items count and bind all visible rows again
+extern void vlist_set_count(struct vlist*vl,size_t cnt);
+
+// src/gui/interface/widgets/vlist.c: get items count
+extern size_t vlist_get_count(struct vlist*vl);
+
+// src/gui/interface/widgets/vlist.c: bind the row of an item again if visible
+extern void vlist_refresh_item(struct vlist*vl,size_t idx);
+
+// src/gui/interface/widgets/vlist.c: drop all rows, the next layout creates them
+extern void vlist_reset(struct vlist*vl);
+
+// src/gui/interface/widgets/vlist.c: get item index of a row, -1 if not bound
+extern ssize_t vlist_get_row_index(struct vlist*vl,lv_obj_t*row);
+
+// src/gui/interface/widgets/vlist.c: scroll an item and its neighbours into view
+extern void vlist_scroll_to(struct vlist*vl,size_t idx);
+
+// src/gui/interface/widgets/vlist.c: add rows to group, NULL to remove
+extern void vlist_set_group(struct vlist*vl,lv_group_t*grp);
+
+// src/gui/interface/widgets/vlist.c: release virtual list and all rows
+extern void vlist_free(struct vlist*vl);
+#endif
@@ -8,6 +8,7 @@
 
 #ifndef HARDWARE_H
 #define HARDWARE_H
+#include<stddef.h>
 #include<stdbool.h>
 enum power_supply_status{
 	STATUS_UNKNOWN=0,
@@ -69,6 +70,21 @@ extern int led_set_brightness(int fd,int value);
 // src/hardware/led.c: get LED current brightness by percent (0-100)
 extern int led_get_brightness_percent(int fd);
 
+// src/hardware/led.c: check LED supports a trigger
+extern bool led_has_trigger(int fd,const char*trigger);
+
+// src/hardware/led.c: set LED trigger
+extern int led_set_trigger(int fd,const char*trigger);
+
+// src/hardware/led.c: blink LED by kernel timer trigger
+extern int led_set_timer(int fd,int on,int off);
+
+// src/hardware/led.c: blink LED by kernel heartbeat trigger
+extern int led_set_heartbeat(int fd);
+
+// src/hardware/led.c: play "<brightness> <ms> ..." by kernel pattern trigger, repeat -1 loops
+extern int led_set_pattern(int fd,const char*pattern,int repeat);
+
 // src/hardware/led.c: set LED current brightness by percent (0-100)
 extern int led_set_brightness_percent(int fd,int percent);
 
@@ -126,6 +142,12 @@ extern const char*pwr_status2chars(enum power_supply_status status);
 // src/hardware/battery.c: convert power supply type to string
 extern const char*pwr_type2chars(enum power_supply_type type);
 
-// src/hardware/vibrate.c: vibrate device
-extern void vibrate(int time);
+// src/hardware/vibrate.c: vibrate device for time ms, returns at once
+extern int vibrate(int time);
+
+// src/hardware/vibrate.c: play ms durations alternating on and off in background, repeat <0 loops
+extern int vibrate_pattern(const int*pattern,size_t cnt,int repeat);
+
+// src/hardware/vibrate.c: stop the playing pattern and vibration
+extern void vibrate_stop(void);
 #endif
@@ -0,0 +1,64 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+/*
+ * Open addressing hash map with string or pointer keys
+ */
+
+#ifndef _HASHMAP_H
+#define _HASHMAP_H
+#include"defines.h"
+#include<stdint.h>
+#include<stddef.h>
+#include<stdbool.h>
+
+typedef struct hashmap hashmap;
+
+enum hashmap_flags{
+	// keys are compared as pointers instead of strings
+	HASHMAP_POINTER = (1<<0),
+	// string keys are kept by pointer, they must live as long as the entry
+	HASHMAP_NOCOPY  = (1<<1),
+	// string keys are compared without case
+	HASHMAP_NOCASE  = (1<<2),
+};
+
+// src/lib/hashmap.c: create a new hash map
+extern hashmap*hashmap_new(int flags);
+
+// src/lib/hashmap.c: free a hash map and call datafree for every value
+extern void hashmap_free(hashmap*map,runnable_t*datafree);
+
+// src/lib/hashmap.c: drop all entries and call datafree for every value
+extern void hashmap_clear(hashmap*map,runnable_t*datafree);
+
+// src/lib/hashmap.c: add or replace a value, old value goes to *old when not NULL
+extern int hashmap_set(hashmap*map,const void*key,void*value,void**old);
+
+// src/lib/hashmap.c: add a value, fail with EEXIST when the key exists
+extern int hashmap_add(hashmap*map,const void*key,void*value);
+
+// src/lib/hashmap.c: lookup a value, false when the key does not exist
+extern bool hashmap_lookup(hashmap*map,const void*key,void**value);
+
+// src/lib/hashmap.c: lookup a value, NULL when the key does not exist
+extern void*hashmap_get(hashmap*map,const void*key);
+
+// src/lib/hashmap.c: remove a key, its value goes to *old when not NULL
+extern int hashmap_del(hashmap*map,const void*key,void**old);
+
+// src/lib/hashmap.c: count entries
+extern size_t hashmap_count(hashmap*map);
+
+// src/lib/hashmap.c: walk entries in insertion order, *iter starts at 0
+extern bool hashmap_next(hashmap*map,size_t*iter,const void**key,void**value);
+
+// src/lib/hashmap.c: hash a buffer with the keyed hash of the maps
+extern uint64_t hashmap_hash(const void*buf,size_t len);
+
+#endif
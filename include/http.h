@@ -52,6 +52,7 @@ struct http_hand_assets_file{
 		const char*path;
 	}by_path;
 };
+struct ws_frame;
 struct http_hand_websocket_data{
 	bool connected;
 	mutex_t lock;
@@ -59,6 +60,12 @@ struct http_hand_websocket_data{
 	struct http_hand*info;
 	struct MHD_WebSocketStream*ws;
 	int fd;
+	// frames waiting for the sender that is writing, under lock
+	struct ws_frame*queue,**queue_tail;
+	pthread_cond_t sent;
+	bool writing;
+	// received packets not acknowledged yet
+	size_t acks;
 };
 struct ws_cmd_proc;
 struct ws_data_hand;
@@ -131,9 +138,11 @@ extern void http_add_range(struct MHD_Response*r,int code,size_t start,size_t en
 extern bool http_parse_range(struct http_hand_info*i,int*code,size_t len,size_t*start,size_t*end);
 extern bool http_check_can_deflate(struct http_hand_info*i,size_t len,const char*mime);
 extern bool http_has_deflate(struct http_hand_info*i);
+extern bool http_has_encoding(struct http_hand_info*i,const char*enc);
 extern list*http_get_encodings(struct http_hand_info*i);
 extern struct MHD_Response*http_create_zlib_response(void*buf,size_t len,enum MHD_ResponseMemoryMode m);
 extern enum MHD_Result http_check_last_modify(struct http_hand_info*i,time_t time);
+extern enum MHD_Result http_check_etag(struct http_hand_info*i,const char*etag);
 extern enum MHD_Result http_ret_code(struct http_hand_info*i,int code);
 extern enum MHD_Result http_ret_code_headers(struct http_hand_info*i,int code,keyval**kvs);
 extern enum MHD_Result http_ret_redirect(struct http_hand_info*i,int code,const char*path);
@@ -148,6 +157,7 @@ extern enum MHD_Result http_hand_code(struct http_hand_info*);
 extern enum MHD_Result http_hand_file(struct http_hand_info*);
 extern enum MHD_Result http_hand_folder(struct http_hand_info*);
 extern enum MHD_Result http_hand_assets(struct http_hand_info*);
+extern enum MHD_Result http_hand_metrics(struct http_hand_info*);
 extern enum MHD_Result http_hand_assets_file(struct http_hand_info*);
 extern enum MHD_Result http_hand_websocket(struct http_hand_info*);
 extern enum MHD_Result http_conn_handler(void*,struct MHD_Connection*,const char*,const char*,const char*,const char*,size_t*,void**);
@@ -54,6 +54,9 @@ extern int wait_cmd(pid_t p);
 // src/initd/signal.c: init setup signals to signal_handlers
 extern void setup_signals(void);
 
+// src/initd/signal.c: eventfd readable after a SIGCHLD, -1 when unavailable
+extern int init_sigchld_fd(void);
+
 // src/initd/signal.c: disable init signal handlers
 extern void disable_signals(void);
 
@@ -66,6 +69,11 @@ extern int umount_all(void);
 // src/initd/preinit.c: simple-init preinit
 extern int preinit(void);
 
+#ifdef ENABLE_ROOTFS_IMAGE
+// src/initd/rootimg.c: mount embedded rootfs image with a tmpfs overlay
+extern int mount_rootfs_image(int dfd);
+#endif
+
 // src/initd/logfs.c: setup logfs
 extern int setup_logfs(void);
 
@@ -78,12 +86,30 @@ extern int setup_conffs(void);
 // src/initd/conffs.c: wait conffs setup done
 extern int wait_conffs(void);
 
+// src/initd/readahead.c: start boot readahead worker, it waits for the conffs
+extern int readahead_start(void);
+
+// src/initd/readahead.c: conffs mount point holding the readahead list, NULL when there is none
+extern void readahead_set_conffs(const char*point);
+
 // src/initd/reboot.c: init call reboot
 extern int call_reboot(enum reboot_cmd rb,char*cmd);
 
 // src/initd/reboot.c: init kill all processes
 extern int kill_all(void);
 
+// src/initd/reboot.c: start the shutdown deadline, once
+extern void shutdown_begin(void);
+
+// src/initd/reboot.c: milliseconds left before the shutdown deadline, keeping reserve
+extern long shutdown_remaining(long reserve);
+
+// src/initd/reboot.c: stop all services within the shutdown deadline
+extern int shutdown_services(void);
+
+// src/initd/reboot.c: end the current shutdown phase and log its time, NULL ends shutdown
+extern void shutdown_phase(const char*name);
+
 // src/initd/client.c: init control socket fd
 extern int initfd;
 
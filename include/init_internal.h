@@ -8,6 +8,7 @@
 
 #ifndef INIT_INTERNAL_H
 #define INIT_INTERNAL_H
+#include<stdint.h>
 #include<stdbool.h>
 #include<sys/socket.h>
 #define DEFAULT_INITD _PATH_RUN"/initd.sock"
@@ -39,6 +40,8 @@ enum init_action{
 	ACTION_SVC_RELOAD =0xBE12,
 	ACTION_SVC_DUMP   =0xBE13,
 	ACTION_SVC_STATUS =0xBE14,
+	ACTION_BOOTCHART  =0xBE15,
+	ACTION_SVC_USAGE  =0xBE16,
 };
 extern enum init_action action;
 
@@ -60,9 +63,11 @@ union action_data{
 };
 extern union action_data actiondata;
 
+// replies carry the id of their request, so clients may send many before reading
 struct init_msg{
 	unsigned char magic0,magic1;
 	enum init_action action;
+	uint32_t id;
 	union action_data data;
 };
 
@@ -70,7 +75,11 @@ struct init_msg{
 struct init_client{
 	bool server;
 	struct ucred cred;
+	char peer[256];
+	struct service*svc;
 	int fd;
+	size_t rlen;
+	char rbuf[sizeof(struct init_msg)];
 };
 #endif
 extern int(*register_services[])(void);
@@ -100,6 +109,9 @@ extern int init_send_data(int fd,struct init_msg*send);
 // src/initd/protocol.c: receive init_msg
 extern int init_recv_data(int fd,struct init_msg*response);
 
+// src/initd/client.c: send many requests without waiting each reply, res[i] is the status of reqs[i]
+extern int init_send_batch(struct init_msg*reqs,struct init_msg*res,size_t cnt);
+
 // src/initd/protocol.c: convert init_action to string
 extern const char*action2string(enum init_action action);
 
@@ -0,0 +1,83 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _IPC_H
+#define _IPC_H
+#include<stdint.h>
+#include<stdbool.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+
+/*
+ * shared message transport of the daemons
+ * a frame is a fixed header followed by len bytes of payload, one frame is
+ * one packet on SOCK_SEQPACKET, on SOCK_STREAM the payload follows the header
+ * a reply copies the id of its request, so a client may send many requests
+ * before reading, the server answers a connection in request order
+ */
+
+// most payload bytes of one frame
+#define IPC_MAX_PAYLOAD 65536
+
+// how long a frame may take to arrive completely (ms)
+#define IPC_TIMEOUT 5000
+
+// frame header
+struct ipc_hdr{
+	uint8_t magic0,magic1;
+	uint16_t action;
+	uint32_t id;
+	int32_t code;
+	uint32_t len;
+};
+
+// one end of a connection
+struct ipc_conn{
+	int fd,type;
+	uint8_t magic0,magic1;
+	uint32_t next_id;
+	bool have_cred;
+	struct ucred cred;
+};
+
+// src/lib/ipc.c: wrap a connected fd, socket type is detected
+extern int ipc_conn_init(struct ipc_conn*c,int fd,uint8_t magic0,uint8_t magic1);
+
+// src/lib/ipc.c: close a connection
+extern void ipc_conn_close(struct ipc_conn*c);
+
+// src/lib/ipc.c: connect to path with SOCK_SEQPACKET, SOCK_STREAM for stream listeners
+extern int ipc_connect(struct ipc_conn*c,const char*path,uint8_t magic0,uint8_t magic1);
+
+// src/lib/ipc.c: create a non-blocking listening socket on path
+extern int ipc_listen(const char*path,int type,int backlog,mode_t mode);
+
+// src/lib/ipc.c: accept a non-blocking connection
+extern int ipc_accept(struct ipc_conn*c,int lfd,uint8_t magic0,uint8_t magic1);
+
+// src/lib/ipc.c: peer credentials, read once per connection
+extern struct ucred*ipc_get_cred(struct ipc_conn*c);
+
+// src/lib/ipc.c: send a frame
+extern int ipc_send(struct ipc_conn*c,uint16_t action,uint32_t id,int32_t code,const void*data,size_t len);
+
+// src/lib/ipc.c: send a request with a new id, returns the id or 0
+extern uint32_t ipc_request(struct ipc_conn*c,uint16_t action,int32_t code,const void*data,size_t len);
+
+// src/lib/ipc.c: answer a request with the same id
+extern int ipc_reply(struct ipc_conn*c,struct ipc_hdr*req,uint16_t action,int32_t code,const void*data,size_t len);
+
+// src/lib/ipc.c: read a frame, payload terminated by zero, returns 1, 0 when nothing to read, negative on error (EOF with errno 0)
+extern int ipc_recv(struct ipc_conn*c,struct ipc_hdr*hdr,void*buf,size_t size);
+
+// src/lib/ipc.c: read frames until the reply of id
+extern int ipc_wait(struct ipc_conn*c,uint32_t id,struct ipc_hdr*hdr,void*buf,size_t size);
+
+// src/lib/ipc.c: send a request and wait for its reply
+extern int ipc_call(struct ipc_conn*c,uint16_t action,int32_t code,const void*data,size_t len,struct ipc_hdr*hdr,void*buf,size_t size);
+#endif
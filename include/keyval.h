@@ -9,6 +9,7 @@
 #ifndef kv_H
 #define kv_H
 #include"list.h"
+#include"arena.h"
 #include<sys/types.h>
 
 // keyval struct
@@ -171,6 +172,20 @@ extern char*kvlst_get_value_by_key(list*kvs,char*key,char*def);
 // src/lib/keyval.c: get a key in keyval list by value, return def if not found
 extern char*kvlst_get_key_by_value(list*kvs,char*value,char*def);
 
+// keyval in arena usage, nothing here is freed alone, free the arena instead
+
+// src/lib/keyval.c: create a keyval from a line in an arena (like kv_new_parse)
+extern keyval*arena_kv_new_parse(arena*a,const char*line,size_t len,char del);
+
+// src/lib/keyval.c: create a keyval array from a string in an arena (like kvarr_new_parse)
+extern keyval**arena_kvarr_new_parse(arena*a,const char*lines,char ldel,char del);
+
+// src/lib/keyval.c: create a keyval array from a string array in an arena (like kvarr_new_parse_arr)
+extern keyval**arena_kvarr_new_parse_arr(arena*a,char**lines,char del);
+
+// src/lib/keyval.c: convert string to keyval list in an arena (like kvlst_parse)
+extern list*arena_kvlst_parse(arena*a,list*kvs,size_t s,const char*lines,char ldel,char del);
+
 // declare a keyval
 #define KV(_key,_value)(keyval){.key=(_key),.value=(_value)}
 
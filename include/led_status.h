@@ -0,0 +1,14 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _LED_STATUS_H
+#define _LED_STATUS_H
+
+// src/hardware/led_status.c: show a system state by leds configured in led.status.<state>
+extern int led_status(const char*state);
+#endif
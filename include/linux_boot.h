@@ -111,9 +111,11 @@ typedef struct linux_config{
 	bool pass_kfdt_dtb:1;
 	bool use_kfdt_ramdisk_kernel:1;
 	bool use_kfdt_ramdisk_abootimg:1;
+	bool decompress_initrd:1;
 	linux_load_from kernel;
 	linux_load_from dtb;
 	linux_load_from abootimg;
+	linux_load_from vendor_boot;
 	list*initrd;
 	list*dtbo;
 	linux_mem_region memory[8];
@@ -25,9 +25,25 @@ struct list{
 };
 typedef struct list list;
 
+/*
+ * head of a list that knows both ends and the count, a push or unshift
+ * through it does not walk the items. items stay plain list items, so
+ * every list_* helper still works on head->first, change the chain only
+ * through list_head_* while a head owns it.
+ */
+struct list_head{
+	list*first;
+	list*last;
+	size_t count;
+};
+#define LIST_HEAD_INIT {NULL,NULL,0}
+
 typedef bool(*list_sorter)(list*f1,list*f2);
 typedef bool(*list_comparator)(list*f,void*data);
 
+// qsort style, gets pointers to the data pointers of two items
+typedef int(*list_compar)(const void*d1,const void*d2);
+
 // src/lib/list.c: add new after point
 extern int list_add(list*point,list*new);
 
@@ -112,9 +128,12 @@ extern int list_obj_del(list**lst,list*item,runnable_t*datafree);
 // src/lib/list.c: lookup item and delete from a list
 extern int list_obj_del_data(list**lst,void*data,runnable_t*datafree);
 
-// src/lib/list.c: sort a list
+// src/lib/list.c: sort a list, stable and in place
 extern int list_sort(list*lst,list_sorter sorter);
 
+// src/lib/list.c: sort a list with qsort, not stable
+extern int list_sort_array(list*lst,list_compar compar);
+
 // src/lib/list.c: search a list object
 extern list*list_search_one(list*lst,list_comparator comparator,void*data);
 
@@ -145,6 +164,39 @@ extern int list_reverse(list*lst);
 // src/lib/list.c: convert list to string
 extern char*list_string_append(list*lst,char*buff,size_t len,char*sep);
 
+// src/lib/list.c: add items to the end of a list head
+extern int list_head_push(struct list_head*head,list*new);
+
+// src/lib/list.c: new and add item to the end of a list head
+extern int list_head_push_new(struct list_head*head,void*data);
+
+// src/lib/list.c: add items to the start of a list head
+extern int list_head_unshift(struct list_head*head,list*new);
+
+// src/lib/list.c: new and add item to the start of a list head
+extern int list_head_unshift_new(struct list_head*head,void*data);
+
+// src/lib/list.c: strip item from a list head
+extern int list_head_remove(struct list_head*head,list*item);
+
+// src/lib/list.c: delete item from a list head
+extern int list_head_del(struct list_head*head,list*item,runnable_t*datafree);
+
+// src/lib/list.c: free all items of a list head
+extern int list_head_free_all(struct list_head*head,runnable_t*datafree);
+
+// src/lib/list.c: sort a list head
+extern int list_head_sort(struct list_head*head,list_sorter sorter);
+
+// src/lib/list.c: take over an existing list
+extern int list_head_attach(struct list_head*head,list*lst);
+
+// src/lib/list.c: give the list away and empty the head
+extern list*list_head_detach(struct list_head*head);
+
+// count items of a list head
+static inline size_t list_head_count(struct list_head*head){return head?head->count:0;}
+
 // require not null
 extern void*_memdup(void*mem,size_t len);
 #define memdup _memdup
@@ -163,6 +215,8 @@ _DECLARE_NX_NOT_NULL(list_insert_new_notnull,list_insert_new)
 _DECLARE_NX_NOT_NULL(list_unshift_new_notnull,list_unshift_new)
 _DECLARE_N_NOT_NULL(list_obj_add_new_notnull,list_obj_add_new(point,data),list**point,)
 _DECLARE_NOT_NULL(list_new_notnull,list_new(data),list*,_P_NOTNULL,)
+_DECLARE_N_NOT_NULL(list_head_push_new_notnull,list_head_push_new(point,data),struct list_head*point,)
+_DECLARE_N_NOT_NULL(list_head_unshift_new_notnull,list_head_unshift_new(point,data),struct list_head*point,)
 
 // duplicate and new
 #define _DECLARE_DUP(_name,_base,_ret,_dups,_arg,_if,...)_IN _ret _name(__VA_ARGS__){void*dup=(void*)_dups;_ret ret=_base _arg;if(_if)free(dup);return ret;}
@@ -177,11 +231,15 @@ _DECLARE_PX_DUP(list_push_new)
 _DECLARE_PX_DUP(list_insert_new)
 _DECLARE_PX_DUP(list_unshift_new)
 _DECLARE_X_DUP(list_obj_add_new,int,(point,dup),ret<0,list**point,)
+_DECLARE_X_DUP(list_head_push_new,int,(point,dup),ret<0,struct list_head*point,)
+_DECLARE_X_DUP(list_head_unshift_new,int,(point,dup),ret<0,struct list_head*point,)
 
 // use default free
 #define list_free_item_def(point)list_free_item(point,list_default_free)
 #define list_free_all_def(point)list_free_all(point,list_default_free)
 #define list_remove_free_def(point)list_remove_free(point,list_default_free)
+#define list_head_free_all_def(head)list_head_free_all(head,list_default_free)
+#define list_head_del_def(head,item)list_head_del(head,item,list_default_free)
 
 // get item data with type
 #define LIST_DATA(_list,_type)((_type)((_list)->data))
@@ -11,13 +11,22 @@
 #ifndef ENABLE_UEFI
 #include<pthread.h>
 typedef pthread_mutex_t mutex_t;
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
 #define MUTEX_INIT(lock) pthread_mutex_init(&(lock),NULL)
 #define MUTEX_LOCK(lock) pthread_mutex_lock(&(lock))
 #define MUTEX_UNLOCK(lock) pthread_mutex_unlock(&(lock))
 #define MUTEX_TRYLOCK(lock) pthread_mutex_trylock(&(lock))
 #define MUTEX_DESTROY(lock) pthread_mutex_destroy(&(lock))
+typedef pthread_rwlock_t rwlock_t;
+#define RWLOCK_INITIALIZER PTHREAD_RWLOCK_INITIALIZER
+#define RWLOCK_INIT(lock) pthread_rwlock_init(&(lock),NULL)
+#define RWLOCK_RDLOCK(lock) pthread_rwlock_rdlock(&(lock))
+#define RWLOCK_WRLOCK(lock) pthread_rwlock_wrlock(&(lock))
+#define RWLOCK_UNLOCK(lock) pthread_rwlock_unlock(&(lock))
+#define RWLOCK_DESTROY(lock) pthread_rwlock_destroy(&(lock))
 #else
 typedef char mutex_t;
+#define MUTEX_INITIALIZER 0
 static inline __attribute__((used)) int dumb_lock_init(mutex_t*lock){(void)lock;return 0;}
 static inline __attribute__((used)) int dumb_lock_lock(mutex_t*lock){(void)lock;return 0;}
 static inline __attribute__((used)) int dumb_lock_unlock(mutex_t*lock){(void)lock;return 0;}
@@ -28,5 +37,12 @@ static inline __attribute__((used)) int dumb_lock_destroy(mutex_t*lock){(void)lo
 #define MUTEX_UNLOCK(lock) dumb_lock_unlock(&(lock))
 #define MUTEX_TRYLOCK(lock) dumb_lock_trylock(&(lock))
 #define MUTEX_DESTROY(lock) dumb_lock_destroy(&(lock))
+typedef char rwlock_t;
+#define RWLOCK_INITIALIZER 0
+#define RWLOCK_INIT(lock) dumb_lock_init(&(lock))
+#define RWLOCK_RDLOCK(lock) dumb_lock_lock(&(lock))
+#define RWLOCK_WRLOCK(lock) dumb_lock_lock(&(lock))
+#define RWLOCK_UNLOCK(lock) dumb_lock_unlock(&(lock))
+#define RWLOCK_DESTROY(lock) dumb_lock_destroy(&(lock))
 #endif
 #endif
@@ -9,9 +9,15 @@
 #ifndef _LOGGER_H
 #define _LOGGER_H
 #include<time.h>
+#include<stddef.h>
+#include<stdint.h>
 #include<stdbool.h>
+#ifndef ENABLE_UEFI
+#include<sys/types.h>
+#endif
 #include"pathnames.h"
 #define DEFAULT_LOGGER _PATH_RUN"/loggerd.sock"
+#define DEFAULT_LOG_STORE _PATH_DEV"/logger.store"
 
 // logger level
 enum log_level{
@@ -40,18 +46,20 @@ struct log_item{
 	];
 };
 
-// log storage item
-struct log_buff{
-	enum log_level level;
-	char*tag,*content;
-	time_t time;
-	pid_t pid;
+// what to do with a new log when the async ring is full
+enum log_drop{
+	LOG_DROP_NONE=0,
+	LOG_DROP_NEW,
+	LOG_DROP_OLD,
+	LOG_DROP_BLOCK,
 };
 
-#ifdef _LIST_H
-// src/loggerd/buffer.c: log storage
-extern list*logbuffer;
-#endif
+// position of a reader in the in-memory log history
+struct log_cursor{
+	uint64_t seq;
+	uint64_t lost;
+	size_t off;
+};
 
 #ifndef ENABLE_UEFI
 // src/loggerd/client.c: current logfd
@@ -89,6 +97,63 @@ extern int logger_open_console(void);
 
 // src/loggerd/client.c: launch loggerd
 extern int start_loggerd(pid_t*p);
+
+// src/loggerd/client.c: resize the log history kept by loggerd
+extern int logger_set_buffer_size(size_t size);
+
+// src/loggerd/client.c: queue logs and send them in background, LOG_DROP_NONE to disable
+extern int logger_set_async(enum log_drop drop);
+
+// src/loggerd/client.c: send all queued async logs now
+extern void logger_flush(void);
+
+// src/loggerd/client.c: get count of async logs dropped by a full ring
+extern size_t logger_get_drops(void);
+
+// src/loggerd/client.c: parse async drop policy string
+extern enum log_drop logger_parse_drop(const char*v);
+
+// src/loggerd/client.c: set per tag levels of all loggerd clients, see logger_set_filter
+extern int logger_send_filter(const char*spec);
+
+// src/loggerd/client.c: rotate file outputs at size, keep compressed segments, size 0 to disable
+extern int logger_set_rotate(size_t size,int keep,const char*comp);
+
+// src/loggerd/client.c: get "name depth drops written" lines of every loggerd output
+extern int logger_get_stats(char*buff,size_t len);
+
+// src/loggerd/client.c: controll loggerd open new binary log store
+extern int logger_open_store(char*file);
+
+// binary log store reader
+struct log_store;
+
+// called for every log read by log_store_page, non zero to stop
+typedef int log_store_cb(struct log_item*item,void*data);
+
+// src/loggerd/store.c: open a binary log store for reading
+extern struct log_store*log_store_open(const char*path);
+
+// src/loggerd/store.c: close a binary log store reader
+extern void log_store_close(struct log_store*s);
+
+// src/loggerd/store.c: pick up new records and get records count
+extern size_t log_store_count(struct log_store*s);
+
+// src/loggerd/store.c: only read logs at or above min_level, and with tag if not NULL
+extern void log_store_filter(struct log_store*s,enum log_level min_level,const char*tag);
+
+// src/loggerd/store.c: move reader to record number n
+extern int log_store_seek(struct log_store*s,size_t n);
+
+// src/loggerd/store.c: move reader to first record not older than time
+extern int log_store_seek_time(struct log_store*s,time_t time);
+
+// src/loggerd/store.c: read next log passing the filter
+extern bool log_store_next(struct log_store*s,struct log_item*item);
+
+// src/loggerd/store.c: read one page of logs passing the filter, returns logs count
+extern ssize_t log_store_page(struct log_store*s,size_t page,size_t per_page,log_store_cb*cb,void*data);
 #else
 static inline int set_logfd(int fd __attribute__((unused))){return -1;}
 static inline void close_logfd(void){};
@@ -100,13 +165,35 @@ static inline int logger_exit(void){return -1;}
 static inline int logger_klog(void){return -1;}
 static inline int logger_syslog(void){return -1;}
 static inline int start_loggerd(int*p __attribute__((unused))){return -1;}
+static inline int logger_set_buffer_size(size_t size __attribute__((unused))){return -1;}
+static inline int logger_set_async(enum log_drop drop __attribute__((unused))){return -1;}
+static inline void logger_flush(void){}
+static inline size_t logger_get_drops(void){return 0;}
+static inline int logger_send_filter(const char*spec __attribute__((unused))){return -1;}
+static inline int logger_set_rotate(size_t size __attribute__((unused)),int keep __attribute__((unused)),const char*comp __attribute__((unused))){return -1;}
+static inline int logger_get_stats(char*buff __attribute__((unused)),size_t len __attribute__((unused))){return -1;}
 extern void logger_set_console(bool enabled);
 extern void logger_init(void);
 #endif
 
+// src/loggerd/buffer.c: start a cursor at the oldest log in history
+extern void logger_buffer_cursor(struct log_cursor*c);
+
+// src/loggerd/buffer.c: read the log at cursor into item and advance, false when no more
+extern bool logger_buffer_read(struct log_cursor*c,struct log_item*item);
+
+// src/loggerd/buffer.c: resize this process log history, keeps the newest logs
+extern int logger_buffer_set_size(size_t size);
+
 // src/loggerd/client.c: set local logger level
 extern void logger_set_level(enum log_level level);
 
+// src/loggerd/client.c: set local per tag levels, like "devd=debug,*=info"
+extern int logger_set_filter(const char*spec);
+
+// src/loggerd/client.c: check whether a log of tag at level would be sent
+extern bool logger_enabled(enum log_level level,const char*tag);
+
 // src/loggerd/client.c: send raw log
 extern int logger_write(struct log_item*log);
 
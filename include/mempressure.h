@@ -0,0 +1,58 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _MEMPRESSURE_H
+#define _MEMPRESSURE_H
+#include<stddef.h>
+
+/*
+ * process local low memory notifier
+ * caches register a shrink callback with a priority, on memory pressure
+ * all callbacks run in priority order, lowest first
+ * linux watches psi (/proc/pressure/memory) or cgroup memory.events in a
+ * thread, uefi compares the free conventional memory against a watermark
+ * callbacks may be called from any thread and must take their own locks,
+ * they must not add or remove shrinkers
+ */
+
+#define MEM_PRIO_CACHE   10
+#define MEM_PRIO_BUFFER  50
+#define MEM_PRIO_STORE   90
+
+enum mem_pressure{
+	MEM_PRESSURE_NONE=0,
+	MEM_PRESSURE_LOW,      // trim caches, keep the hot half
+	MEM_PRESSURE_CRITICAL, // drop everything that can be rebuilt
+};
+
+// returns bytes released, an estimate is fine
+typedef size_t mem_shrink_cb(enum mem_pressure level,void*data);
+
+// src/lib/mempressure.c: add a shrinker, name must stay valid, returns its id
+extern int mem_shrinker_add(const char*name,int prio,mem_shrink_cb*cb,void*data);
+
+// src/lib/mempressure.c: remove a shrinker, waits for a running shrink
+extern void mem_shrinker_del(int id);
+
+// src/lib/mempressure.c: run all shrinkers for level, returns bytes released
+extern size_t mem_shrink(enum mem_pressure level);
+
+// src/lib/mempressure.c: convert pressure level to string
+extern const char*mem_pressure2string(enum mem_pressure level);
+
+#ifdef ENABLE_UEFI
+// src/lib/mempressure.c: set free memory watermark in bytes, critical is a quarter of it
+extern void mem_set_watermark(size_t low);
+
+// src/lib/mempressure.c: shrink when free memory is below the watermark, call it about once a second
+extern enum mem_pressure mem_check(void);
+#else
+// src/lib/mempressure.c: watch memory pressure of this process in a thread
+extern int mem_monitor_start(void);
+#endif
+#endif
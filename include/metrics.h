@@ -0,0 +1,82 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+#include<stdio.h>
+#include<stdint.h>
+#include<stdbool.h>
+#include"pathnames.h"
+
+/*
+ * process local metrics registry
+ * a metric is a static variable, it is registered on its first update
+ * counters and histograms are split into per thread shards, updates are
+ * relaxed atomic adds without any lock, the shards are summed on output
+ * histograms take microseconds and use power of two buckets
+ * every process serves its registry on a socket in _PATH_RUN/metrics,
+ * metrics_collect reads all of them and labels each with its process
+ */
+
+#define METRICS_DIR _PATH_RUN"/metrics"
+#define METRIC_SHARDS 8
+#define METRIC_BUCKETS 24
+
+enum metric_type{
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+struct metric_shard{
+	uint64_t count,sum;
+	uint64_t buckets[METRIC_BUCKETS];
+}__attribute__((aligned(64)));
+
+struct metric{
+	const char*name,*help;
+	enum metric_type type;
+	bool registered;
+	int64_t gauge;
+	struct metric*next;
+	struct metric_shard shards[METRIC_SHARDS];
+};
+
+// define a metric variable
+#define METRIC_DEFINE(_var,_type,_name,_help) \
+	static struct metric _var={.name=(_name),.help=(_help),.type=(_type)}
+#define METRIC_COUNTER(_var,_name,_help)   METRIC_DEFINE(_var,METRIC_COUNTER,_name,_help)
+#define METRIC_GAUGE(_var,_name,_help)     METRIC_DEFINE(_var,METRIC_GAUGE,_name,_help)
+#define METRIC_HISTOGRAM(_var,_name,_help) METRIC_DEFINE(_var,METRIC_HISTOGRAM,_name,_help)
+
+// src/lib/metrics.c: add to a counter
+extern void metric_add(struct metric*m,uint64_t val);
+
+// src/lib/metrics.c: set a gauge
+extern void metric_set(struct metric*m,int64_t val);
+
+// src/lib/metrics.c: add to a gauge, val may be negative
+extern void metric_gauge_add(struct metric*m,int64_t val);
+
+// src/lib/metrics.c: record a histogram sample in microseconds
+extern void metric_observe(struct metric*m,uint64_t us);
+
+// src/lib/metrics.c: monotonic clock in microseconds, for metric_observe
+extern uint64_t metric_now_us(void);
+
+// src/lib/metrics.c: write the local registry as prometheus text, label is the process name or NULL
+extern int metrics_write(FILE*f,const char*process);
+
+// src/lib/metrics.c: serve the local registry on METRICS_DIR/<process>.sock in a thread
+extern int metrics_serve(const char*process);
+
+// src/lib/metrics.c: write the registries of all serving processes
+extern int metrics_collect(FILE*f);
+
+#define metric_inc(m) metric_add((m),1)
+#endif
@@ -0,0 +1,60 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef MODALIAS_INDEX_H
+#define MODALIAS_INDEX_H
+#include<stdint.h>
+#include<stddef.h>
+
+/*
+ * precomputed modalias index, generated by src/host/modalias.c.
+ * a trie over the literal prefix of every alias pattern (before the first
+ * wildcard), each node holds the patterns ending there with the rest of the
+ * pattern for fnmatch. all numbers are little endian u32, strings are offsets
+ * into the string pool at the end.
+ *
+ * layout: header | nodes[] | edges[] | values[] | strings
+ */
+
+#define MODALIAS_INDEX_MAGIC   0x414D4953
+#define MODALIAS_INDEX_VERSION 1
+#define MODALIAS_INDEX_NAME    "modalias.idx"
+#define MODALIAS_INDEX_ASSET   "/usr/share/simple-init/"MODALIAS_INDEX_NAME
+
+struct modalias_index_header{
+	uint32_t magic,version;
+	uint32_t nodes,edges,values,strings;
+};
+
+// children are edges[edge..edge+edges] sorted by ch, node 0 is root
+struct modalias_index_node{
+	uint32_t edge,edges;
+	uint32_t value,values;
+};
+
+struct modalias_index_edge{
+	uint32_t ch,node;
+};
+
+// pattern is the part after the literal prefix
+struct modalias_index_value{
+	uint32_t pattern,module;
+};
+
+#ifndef HOST_TOOL
+// src/lib/modalias_index.c: load index from modules folder or rootfs assets
+extern int modalias_index_load(const char*modsdir);
+
+// src/lib/modalias_index.c: find modules of alias, -ENOENT when no index loaded
+extern int modalias_index_lookup(const char*alias,void(*cb)(const char*module,void*data),void*data);
+
+// src/lib/modalias_index.c: release loaded index
+extern void modalias_index_unload(void);
+#endif
+
+#endif
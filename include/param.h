@@ -14,6 +14,12 @@
 // src/lib/param.c: read string from fd and convert to keyval array
 extern keyval**read_params(int fd);
 
+// src/lib/param.c: read bootconfig from fd and convert to keyval array
+extern keyval**read_bootconfig(int fd);
+
+// src/lib/param.c: parse bootconfig items from string with length in place
+extern keyval**param_s_parse_bootconfig(char*conf,size_t len,size_t*length);
+
 // src/lib/param.c: parse cmdline items from string with length
 extern keyval**param_s_parse_items(char*cmdline,size_t len,size_t*length);
 
@@ -123,6 +123,7 @@
 #define _PATH_SYS_FIRMWARE	_PATH_SYS"/firmware"
 #define _PATH_PROC_PARTITIONS	_PATH_PROC"/partitions"
 #define _PATH_PROC_CMDLINE	_PATH_PROC"/cmdline"
+#define _PATH_PROC_BOOTCONFIG	_PATH_PROC"/bootconfig"
 #define _PATH_PROC_FILESYSTEMS	_PATH_PROC"/filesystems"
 #define _PATH_PROC_DEVICES	_PATH_PROC"/devices"
 #define _PATH_PROC_MOUNTS	_PATH_PROC"/mounts"
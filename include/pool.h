@@ -8,35 +8,53 @@
 
 #ifndef _POOL_H
 #define _POOL_H
+#include<stdint.h>
+#include<stddef.h>
 #include<stdbool.h>
 #include<pthread.h>
 
-// job struct
-struct job{
-	void*(*callback)(void *arg);
-	void*arg;
-	struct job*next;
-};
-
 // pool struct
-struct pool{
-	int t_size,q_max,q_cur;
-	bool q_closed,p_closed;
-	struct job *first,*last;
-	pthread_t *pthreads;
-	pthread_mutex_t mutex;
-	pthread_cond_t q_empty,q_nempty,q_nfull;
+struct pool;
+
+// result of a job added by pool_submit
+struct pool_future;
+
+// pool counters
+struct pool_stats{
+	int threads,idle,peak_threads;
+	size_t queued,peak_queued;
+	uint64_t jobs,steals;
+	uint64_t wait_ns,wait_max_ns;
+	uint64_t run_ns,run_max_ns;
 };
 
 // src/lib/pool.c: init a thread pool
 extern struct pool*pool_init(int t_size,int q_max);
 
-// src/lib/pool.c: init a thread pool with CPUs*2
+// src/lib/pool.c: init a thread pool up to CPUs*2 threads
 extern struct pool*pool_init_cpus(int q_max);
 
+// src/lib/pool.c: set how many threads stay and how long others idle before exit
+extern void pool_set_idle(struct pool*pool,int t_min,int timeout_ms);
+
 // src/lib/pool.c: add to thread pool
 extern int pool_add(struct pool*pool,void*(*callback)(void*arg),void*arg);
 
+// src/lib/pool.c: add one callback for many args to thread pool
+extern int pool_add_many(struct pool*pool,void*(*callback)(void*arg),void**args,size_t cnt);
+
+// src/lib/pool.c: add to thread pool and get a future for the result
+extern struct pool_future*pool_submit(struct pool*pool,void*(*callback)(void*arg),void*arg);
+
+// src/lib/pool.c: wait for a future, free it and return the result
+extern void*pool_future_wait(struct pool_future*future);
+
+// src/lib/pool.c: add to thread pool and wait for the result
+extern int pool_add_wait(struct pool*pool,void*(*callback)(void*arg),void*arg,void**result);
+
+// src/lib/pool.c: get pool counters
+extern void pool_get_stats(struct pool*pool,struct pool_stats*stats);
+
 // src/lib/pool.c: destroy thread pool
 extern int pool_destroy(struct pool*pool);
 
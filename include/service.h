@@ -9,6 +9,7 @@
 #ifndef SERVICE_H
 #define SERVICE_H
 #include<time.h>
+#include<stdint.h>
 #include<stdbool.h>
 #include<sys/types.h>
 #include"lock.h"
@@ -39,6 +40,12 @@ enum svc_exec_type{
 	TYPE_LIBRARY,
 };
 
+enum svc_timer_kind{
+	TIMER_RESTART,
+	TIMER_RETRY,
+	TIMER_EXEC,
+};
+
 struct service;
 typedef int svc_main(struct service*);
 
@@ -53,6 +60,15 @@ struct proc_status{
 	int exit_signal;
 };
 
+// resource usage of a service cgroup
+struct svc_usage{
+	bool valid,populated;
+	uint64_t cpu_usec,cpu_user_usec,cpu_system_usec;
+	uint64_t mem_current,mem_peak;
+	uint64_t io_rbytes,io_wbytes;
+	uint64_t oom_kills;
+};
+
 struct svc_exec{
 	struct{
 		char*name;
@@ -75,6 +91,7 @@ struct svc_exec{
 			char*symbol;
 		}lib;
 	}exec;
+	unsigned int timer;
 	mutex_t lock;
 };
 
@@ -82,6 +99,9 @@ struct service{
 	char*name;
 	char*description;
 	char*pid_file;
+	char*socket;
+	int socket_fd;
+	bool activated;
 	bool terminal_output_signal;
 	bool stop_on_shutdown;
 	bool auto_restart;
@@ -96,6 +116,13 @@ struct service{
 	enum svc_status status;
 	list*depends_on;
 	list*depends_of;
+	int level;
+	bool queued;
+	int64_t memory_max;
+	int cpu_max;
+	int cgroup_wd[2];
+	struct svc_usage usage;
+	unsigned int restart_timer,retry_timer;
 	struct svc_exec*start;
 	struct svc_exec*stop;
 	struct svc_exec*restart;
@@ -226,12 +253,73 @@ extern int svc_stop_service(struct service*svc);
 // src/service/stop.c: direct stop service by name
 extern int svc_stop_service_by_name(char*name);
 
+// src/service/graph.c: mark depends graph outdated after services or depends changed
+extern void svc_graph_invalidate(void);
+// src/service/graph.c: rebuild depends graph levels if outdated, services in a loop get level -1
+extern int svc_graph_update(void);
+// src/service/graph.c: check service depends on itself, directly or through other services
+extern bool svc_in_loop(struct service*svc);
+
+// src/service/timer.c: schedule a service (or execute for TIMER_EXEC) deadline after delay_ms, replaces the previous one
+extern int svc_timer_arm(enum svc_timer_kind kind,void*owner,time_t delay_ms);
+
+// src/service/timer.c: drop the pending deadline
+extern void svc_timer_cancel(enum svc_timer_kind kind,void*owner);
+
+// src/service/timer.c: remove all deadlines of a freed service or execute
+extern void svc_timer_forget(void*owner);
+
+// src/service/timer.c: milliseconds until the first deadline, -1 if there is none
+extern long svc_timer_next(void);
+
+// src/service/timer.c: run all due deadlines
+extern int svc_timer_run(void);
+
+// src/service/cache.c: save services parsed from config with the config hash
+extern int svc_cache_save(const char*path,uint64_t hash,list*svcs);
+
+// src/service/cache.c: load services saved by svc_cache_save, fails when hash changed
+extern int svc_cache_load(const char*path,uint64_t hash);
+
+// src/service/cgroup.c: enable cgroup controllers for services
+extern int svc_cgroup_init(void);
+
+// src/service/cgroup.c: inotify fd of cgroup events, -1 if not available
+extern int svc_cgroup_fd(void);
+
+// src/service/cgroup.c: create service cgroup, apply limits and open its cgroup.procs
+extern int svc_cgroup_open(struct service*svc);
+
+// src/service/cgroup.c: read service cgroup usage into svc->usage
+extern int svc_cgroup_update(struct service*svc);
+
+// src/service/cgroup.c: process pending cgroup events
+extern int svc_cgroup_events(void);
+
+// src/service/execute.c: handle execute timeout deadline
+extern int svc_check_exec_timeout(struct svc_exec*exec);
+
 // src/service/service.c: set service name
 extern int svc_set_name(struct service*svc,char*name);
 
 // src/service/service.c: set service description
 extern int svc_set_desc(struct service*svc,char*desc);
 
+// src/service/service.c: set unix socket path, initd listens on it and starts service on first connection
+extern int svc_set_socket(struct service*svc,char*path);
+
+// src/service/activate.c: bind and listen activation socket of service
+extern int svc_listen_socket(struct service*svc);
+
+// src/service/activate.c: bind and listen activation sockets of all services
+extern int svc_listen_all_sockets(void);
+
+// src/service/activate.c: service is listening and waits for first connection
+extern bool svc_socket_pending(struct service*svc);
+
+// src/service/activate.c: start service after first connection on activation socket
+extern int svc_activate(struct service*svc);
+
 // src/service/service.c: add service to service storage
 extern int svc_add_service(struct service*svc);
 
@@ -241,6 +329,9 @@ extern int svc_add_depend(struct service*svc,struct service*depend);
 // src/service/service.c: stop all services and wait all services stopped
 extern int service_wait_all_stop(void);
 
+// src/service/service.c: stop all services and wait until stopped or ms passed
+extern int service_wait_all_stop_timeout(long ms);
+
 // src/service/service.c: init service framework
 extern int service_init(void);
 
@@ -22,6 +22,7 @@ enum scheduler_action{
 	SCHED_RELOAD,
 	SCHED_RESTART,
 	SCHED_STOP_ALL,
+	SCHED_TIMER,
 };
 
 struct scheduler_msg{
@@ -39,6 +40,7 @@ struct scheduler_msg{
 struct scheduler_work{
 	enum scheduler_action action;
 	struct service*service;
+	bool dispatched;
 };
 
 // src/service/scheduler.c: service workers thread pool
@@ -53,6 +55,9 @@ extern list*queue;
 // src/service/scheduler.c: send scheduler command
 extern int oper_scheduler(struct scheduler_msg*data);
 
+// src/service/scheduler.c: wake scheduler to recompute its sleep after a deadline changed
+extern int scheduler_wakeup(void);
+
 // src/service/scheduler.c: scheduler service worker
 extern void*scheduler_worker(void*data);
 
@@ -221,18 +221,54 @@ extern size_t _strlcpy(char*buf,const char*src,size_t len);
 #ifdef b64_pton
 #undef b64_pton
 #endif
+#ifdef b64_ntop
+#undef b64_ntop
+#endif
+
+// base64 length of n bytes, without the terminating zero
+#define B64_ENCODE_LEN(n) (((n)+2)/3*4)
+
+// most bytes n base64 characters decode to
+#define B64_DECODE_LEN(n) (((n)+3)/4*3)
 
-// src/lib/base64.c: base64 encode
+// base64 stream state, keeps the unfinished group between calls
+struct b64_state{
+	unsigned char buf[4];
+	int cnt,pad;
+};
+
+// src/lib/base64.c: base64 decode
 extern int b64_pton(char const*src,unsigned char*target,size_t targsize);
 
+// src/lib/base64.c: base64 encode, target gets a terminating zero
+extern int b64_ntop(unsigned char const*src,size_t srclength,char*target,size_t targsize);
+
+// src/lib/base64.c: reset a base64 stream state
+extern void b64_state_init(struct b64_state*st);
+
+// src/lib/base64.c: base64 encode a piece, out needs B64_ENCODE_LEN bytes of the piece
+extern ssize_t b64_encode_update(struct b64_state*st,const void*src,size_t len,char*out,size_t outsize);
+
+// src/lib/base64.c: base64 encode the rest with padding, up to 4 characters
+extern ssize_t b64_encode_final(struct b64_state*st,char*out,size_t outsize);
+
+// src/lib/base64.c: base64 decode a piece, out needs B64_DECODE_LEN bytes of the piece
+extern ssize_t b64_decode_update(struct b64_state*st,const char*src,size_t len,void*out,size_t outsize);
+
+// src/lib/base64.c: base64 decode the rest and check the padding, up to 2 bytes
+extern ssize_t b64_decode_final(struct b64_state*st,void*out,size_t outsize);
+
 // src/lib/random.c: get random number in range
 extern int rand_get_number(int low_n,int high_n);
 
 // src/lib/random.c: open random device
 extern int random_get_fd(void);
 
-// src/lib/random.c: generate random bytes
-extern int random_get_bytes(void *buf, size_t nbytes);
+// src/lib/random.c: generate random bytes, returns 1 when weak
+extern int random_get_bytes(void*buf,size_t nbytes);
+
+// src/lib/random.c: tell where random bytes came from
+extern const char*random_tell_source(void);
 
 // src/lib/mime.c: lookup by file ext name
 extern char*mime_get_by_ext(char*buff,size_t bs,const char*ext);
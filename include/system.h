@@ -47,6 +47,9 @@ extern bool is_invalid_path(char*path);
 // src/lib/file.c: wait for a file exists
 extern int wait_exists(char*path,long time,long step);
 
+// src/lib/file.c: wait for all files exist
+extern int wait_exists_many(char**paths,size_t cnt,long time,long step);
+
 // src/lib/file.c: recursive mkdir (mkdir -p)
 extern int mkdir_res(char*path);
 
@@ -73,6 +76,15 @@ extern char*ucred2string(struct ucred*c,char*buff,size_t size,bool with_pid);
 
 // src/lib/modules.c: lookup and load module by alias
 extern int insmod(const char*alias,bool log);
+
+// src/lib/modules.c: resolve many aliases and insert modules in parallel
+extern int insmod_batch(char**list,size_t cnt,bool log);
+
+// src/lib/modules.c: insert modules of aliases like modprobe, nothing is taken from earlier calls
+extern int modprobe_batch(char**list,size_t cnt,bool log);
+
+// src/lib/modules.c: drop shared kmod context and loaded modules cache
+extern void insmod_reset(void);
 #endif
 
 // src/lib/file.c: remove all sub folders (depth 1)
@@ -150,6 +162,15 @@ extern int simple_file_write(char*file,char*content);
 // src/lib/file.c: one line simple append file
 extern int simple_file_append(char*file,char*content);
 
+// src/lib/file.c: escape a tag value for /dev/disk/by-* names
+extern char*blk_tag_escape(const char*value,char*buf,size_t len);
+
+// src/lib/file.c: get /dev/disk/by-* link of LABEL= UUID= PARTLABEL= PARTUUID= tag
+extern char*blk_tag_path(const char*tag,char*buf,size_t len);
+
+// src/lib/file.c: resolve tag to block path by /dev/disk/by-* or blkid
+extern char*blk_resolve_tag(const char*tag);
+
 // src/lib/file.c: check block or tag is exists
 extern int has_block(char*block);
 
@@ -0,0 +1,54 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+#include<stdio.h>
+#include<stdint.h>
+#include<stdbool.h>
+
+// default events of the boot timeline buffer
+#define TRACE_EVENTS 8192
+
+// one timeline event, ph uses chrome trace phases (B/E span, b/e async span, i instant)
+struct trace_event{
+	uint64_t ts;
+	int32_t pid,tid;
+	uint64_t id;
+	char ph;
+	char cat[15];
+	char name[48];
+};
+
+#ifndef ENABLE_UEFI
+// src/lib/trace.c: allocate timeline buffer, shared with all processes forked later
+extern int trace_init(size_t events);
+
+// src/lib/trace.c: check timeline buffer is allocated
+extern bool trace_enabled(void);
+
+// src/lib/trace.c: record a timeline event
+extern void trace_point(char ph,uint64_t id,const char*cat,const char*fmt,...)
+	__attribute__((format(printf,4,5)));
+
+// src/lib/trace.c: dump timeline as chrome trace json
+extern int trace_dump_json(FILE*f);
+#else
+static inline int trace_init(size_t events __attribute__((unused))){return 0;}
+static inline bool trace_enabled(void){return false;}
+#define trace_point(...) do{}while(0)
+static inline int trace_dump_json(FILE*f __attribute__((unused))){return -1;}
+#endif
+
+#define trace_begin(cat,...)          trace_point('B',0,cat,__VA_ARGS__)
+#define trace_end(cat,...)            trace_point('E',0,cat,__VA_ARGS__)
+#define trace_async_begin(id,cat,...) trace_point('b',id,cat,__VA_ARGS__)
+#define trace_async_end(id,cat,...)   trace_point('e',id,cat,__VA_ARGS__)
+#define trace_instant(cat,...)        trace_point('i',0,cat,__VA_ARGS__)
+
+#endif
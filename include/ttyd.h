@@ -32,6 +32,12 @@ extern int ttyd_quit(void);
 // src/ttyd/client.c: call ttyd reload all tty from confd
 extern int ttyd_reload(void);
 
+// src/ttyd/client.c: tell ttyd a tty appeared
+extern int ttyd_add_tty(const char*name);
+
+// src/ttyd/client.c: tell ttyd a tty is gone
+extern int ttyd_remove_tty(const char*name);
+
 // src/ttyd/client.c: call ttyd reopen all tty
 extern int ttyd_reopen(void);
 
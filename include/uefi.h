@@ -40,6 +40,24 @@ extern EFIAPI EFI_STATUS efi_file_read_dir(EFI_FILE_PROTOCOL*file,EFI_FILE_INFO*
 // src/lib/uefi.c: auto allocate buffer and read whole file
 extern EFIAPI EFI_STATUS efi_file_read_whole(EFI_FILE_PROTOCOL*file,VOID**data,UINTN*read);
 
+// src/lib/boottime.c: record the time a boot phase was reached
+extern void boottime_mark(const char*name);
+
+// src/lib/boottime.c: get recorded boot phases count
+extern UINTN boottime_count(void);
+
+// src/lib/boottime.c: get boot phase name and microseconds since counter start
+extern const char*boottime_get(UINTN idx,UINT64*us);
+
+// src/lib/boottime.c: microseconds passed since a performance counter value
+extern UINT64 boottime_elapsed_us(UINT64 start);
+
+// src/lib/boottime.c: write boot phases as nul separated "name=usec" strings
+extern UINTN boottime_dump(CHAR8*buf,UINTN len);
+
+// src/lib/boottime.c: save boot phases into BootTime efi var
+extern EFI_STATUS boottime_save(void);
+
 extern BOOLEAN uefi_str_to_tpl(IN CONST CHAR8*str,OUT EFI_TPL*tpl);
 extern BOOLEAN uefi_str_to_event_type(IN CONST CHAR8*str,OUT UINT32*type);
 extern BOOLEAN uefi_str_to_reset_type(IN CONST CHAR8*str,OUT EFI_RESET_TYPE*type);
@@ -8,7 +8,7 @@
 
 #ifndef UEVENT_H
 #define UEVENT_H
-#include"keyval.h"
+#include<stddef.h>
 
 // uevent action (from kernel)
 enum uevent_action{
@@ -24,7 +24,7 @@ enum uevent_action{
 };
 typedef enum uevent_action uevent_action;
 
-// uevent data
+// uevent data, all strings point into the parsed buffer
 struct uevent{
 	uevent_action action;
 	char*devpath;
@@ -34,8 +34,13 @@ struct uevent{
 	char*devtype;
 	char*driver;
 	char*modalias;
+	char*firmware;
 	long seqnum;
-	keyval**environs;
+
+	// KEY=VALUE entries split by NUL, or an environ array
+	char*buf;
+	size_t len;
+	char**envs;
 };
 typedef struct uevent uevent;
 
@@ -45,7 +50,7 @@ extern const char *uevent_actions[];
 // src/devd/uevent.c: convert environ to struct uevent
 extern uevent*uevent_parse_x(char**envs,uevent*data);
 
-// src/devd/uevent.c: convert environ string to struct uevent
+// src/devd/uevent.c: convert environ string to struct uevent in place
 extern uevent*uevent_parse(char*envs,uevent*data);
 
 // src/devd/uevent.c: convert string to uevent_action
@@ -57,4 +62,10 @@ extern const char*uevent_action2char(enum uevent_action act);
 // src/devd/uevent.c: auto fill summary from environs
 extern uevent*uevent_fill_summary(uevent*data);
 
+// src/devd/uevent.c: iterate KEY=VALUE entries, iter starts at 0
+extern char*uevent_next(uevent*data,size_t*iter);
+
+// src/devd/uevent.c: get value of a key
+extern char*uevent_get(uevent*data,const char*key);
+
 #endif
@@ -24,6 +24,34 @@ typedef struct url{
 	char*fragment;
 }url;
 
+// part of a string, not terminated
+struct url_view{
+	const char*ptr;
+	size_t len;
+};
+
+// url components pointing into the parsed string, nothing decoded
+struct url_parts{
+	struct url_view scheme;
+	struct url_view username;
+	struct url_view password;
+	struct url_view host;
+	struct url_view port_str;
+	struct url_view path;
+	struct url_view query;
+	struct url_view fragment;
+	int port;
+};
+
+// src/lib/url.c: split url into components without copying
+extern bool url_split(struct url_parts*parts,const char*url,size_t len);
+
+// src/lib/url.c: walk a query string, *pos starts at the query and moves to the next pair
+extern bool url_query_next(const char**pos,const char*end,struct url_view*key,struct url_view*value);
+
+// src/lib/url.c: get encoded (escaped) url length including the terminator
+extern size_t url_encode_len(const char*src,size_t src_len,const char*map);
+
 // src/lib/url.c: encode (escape) url
 extern char*url_encode(const char*src,size_t src_len,char*out,size_t out_len);
 
@@ -111,6 +139,9 @@ extern bool url_is_on_top(url*u);
 // src/lib/url.c: generate url from url struct
 extern char*url_generate(char*buf,size_t len,url*u);
 
+// src/lib/url.c: get generated url length including the terminator
+extern size_t url_generate_len(url*u);
+
 // src/lib/url.c: generate url from url struct and return allocated buffer
 extern char*url_generate_alloc(url*u);
 
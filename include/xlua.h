@@ -37,11 +37,13 @@ struct lua_data{
 	#endif
 	void*data;
 	size_t size;
+	size_t counted;
 	struct lua_data*parent;
 	list*refs;
 };
 extern const luaL_Reg lua_core_libs[];
 extern const luaL_Reg simple_init_lua_libs[];
+extern const luaL_Reg simple_init_lua_lazy_libs[];
 extern const luaL_Reg simple_init_lua_regs[];
 LUAMOD_API int luaopen_fs(lua_State*L);
 LUAMOD_API int luaopen_stb(lua_State*L);
@@ -63,7 +65,13 @@ LUAMOD_API int luaopen_xml_render(lua_State*L);
 LUAMOD_API int lua_feature(lua_State*L);
 extern lua_State*xlua_init();
 extern lua_State*xlua_math();
+extern lua_State*xlua_shared();
+extern int xlua_new_env(lua_State*L);
+extern void xlua_free_env(lua_State*L,int env);
+extern void xlua_push_env(lua_State*L,int env);
+extern void xlua_set_env(lua_State*L,int env);
 extern int xlua_eval_string(lua_State*L,const char*expr);
+extern int xlua_eval_string_env(lua_State*L,int env,const char*expr);
 extern int xlua_return_string(lua_State*L,const char*expr);
 extern void xlua_show_error(lua_State*L,char*tag);
 extern int xlua_loadfile(lua_State*L,fsh*f,const char*name);
@@ -84,5 +92,7 @@ extern void lua_fs_file_info_to_lua(lua_State*L,fs_file_info*info);
 extern void lua_arg_get_data(lua_State*L,int idx,bool nil,void**data,size_t*size);
 extern void lua_data_to_lua(lua_State*L,bool allocated,void*data,size_t size);
 extern void lua_data_dup_to_lua(lua_State*L,void*data,size_t size);
+extern void*lua_arg_get_data_dst(lua_State*L,int idx,size_t size);
+extern void lua_data_usage(size_t*bytes,size_t*count,size_t*peak);
 extern void xlua_dump_stack(lua_State*L);
 #endif
@@ -0,0 +1,194 @@
+/* crc32_simd.c -- vectorized crc32 for the bundled zlib
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * x86 folds 64 bytes at a time with carry-less multiplication, following
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * (Intel, 2009), the same method as chromium-zlib and zlib-ng. ARMv8 uses the
+ * crc32 instructions. Both are picked at run time, cpus without them keep
+ * using the tables in crc32.c.
+ */
+
+#include <stdint.h>
+#include "zutil.h"
+#include "crc32_simd.h"
+
+#ifdef CRC32_SIMD_PCLMUL
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define TARGET __attribute__((target("pclmul,sse4.1")))
+
+local int simd_state = -1;
+
+int ZLIB_INTERNAL crc32_simd_available()
+{
+    unsigned a, b, c, d;
+
+    if (simd_state < 0)
+        simd_state = __get_cpuid(1, &a, &b, &c, &d) &&
+            (c & bit_PCLMUL) && (c & bit_SSE4_1);
+    return simd_state;
+}
+
+TARGET local uint32_t crc32_pclmul(buf, len, crc)
+    const unsigned char FAR *buf;
+    z_size_t len;
+    uint32_t crc;
+{
+    static const uint64_t __attribute__((aligned(16)))
+        k1k2[] = { 0x0154442bd4, 0x01c6e41596 },
+        k3k4[] = { 0x01751997d0, 0x00ccaa009e },
+        k5k0[] = { 0x0163cd6124, 0x0000000000 },
+        poly[] = { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    buf += 64;
+    len -= 64;
+
+    /* fold four lanes in parallel */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold the lanes into one */
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* then single blocks of 16 */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+z_size_t ZLIB_INTERNAL crc32_simd(crc, buf, len)
+    unsigned long *crc;
+    const unsigned char FAR *buf;
+    z_size_t len;
+{
+    len &= ~(z_size_t)15;
+    *crc = ~crc32_pclmul(buf, len, ~(uint32_t)*crc) & 0xffffffffUL;
+    return len;
+}
+#endif /* CRC32_SIMD_PCLMUL */
+
+#ifdef CRC32_SIMD_ARMV8
+#include <arm_acle.h>
+#ifndef ENABLE_UEFI
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#ifdef __clang__
+#  define TARGET __attribute__((target("crc")))
+#else
+#  define TARGET __attribute__((target("+crc")))
+#endif
+
+local int simd_state = -1;
+
+int ZLIB_INTERNAL crc32_simd_available()
+{
+#ifdef ENABLE_UEFI
+    uint64_t isar0;
+#endif
+
+    if (simd_state < 0) {
+#ifdef ENABLE_UEFI
+        /* firmware runs at EL1 or above, the id registers are readable */
+        __asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+        simd_state = ((isar0 >> 16) & 0xf) != 0;
+#else
+        simd_state = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+    }
+    return simd_state;
+}
+
+TARGET z_size_t ZLIB_INTERNAL crc32_simd(crc, buf, len)
+    unsigned long *crc;
+    const unsigned char FAR *buf;
+    z_size_t len;
+{
+    uint64_t v;
+    uint32_t c = ~(uint32_t)*crc;
+    z_size_t left = len;
+
+    while (left && ((uintptr_t)buf & 7)) {
+        c = __crc32b(c, *buf++);
+        left--;
+    }
+    while (left >= 32) {
+        __builtin_memcpy(&v, buf, 8); c = __crc32d(c, v);
+        __builtin_memcpy(&v, buf + 8, 8); c = __crc32d(c, v);
+        __builtin_memcpy(&v, buf + 16, 8); c = __crc32d(c, v);
+        __builtin_memcpy(&v, buf + 24, 8); c = __crc32d(c, v);
+        buf += 32;
+        left -= 32;
+    }
+    while (left >= 8) {
+        __builtin_memcpy(&v, buf, 8); c = __crc32d(c, v);
+        buf += 8;
+        left -= 8;
+    }
+    while (left--)
+        c = __crc32b(c, *buf++);
+    *crc = ~c & 0xffffffffUL;
+    return len;
+}
+#endif /* CRC32_SIMD_ARMV8 */
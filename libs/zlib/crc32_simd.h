@@ -0,0 +1,29 @@
+/* crc32_simd.h -- vectorized crc32 for the bundled zlib
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifdef ENABLE_ZLIB_SIMD
+#  if defined(__x86_64__) || defined(__i386__)
+#    define CRC32_SIMD_PCLMUL
+#    define CRC32_SIMD_MIN 64
+#  elif defined(__aarch64__)
+#    define CRC32_SIMD_ARMV8
+#    define CRC32_SIMD_MIN 16
+#  endif
+#endif
+
+#ifdef CRC32_SIMD_MIN
+/* nonzero when the running cpu has the instructions, checked once */
+int ZLIB_INTERNAL crc32_simd_available OF((void));
+
+/* crc is the plain (not inverted) zlib crc, buffer length is at least
+   CRC32_SIMD_MIN, returns the count of bytes that were consumed */
+z_size_t ZLIB_INTERNAL crc32_simd OF((unsigned long *crc,
+                                      const unsigned char FAR *buf,
+                                      z_size_t len));
+#endif
@@ -24,7 +24,7 @@
 
         state->mode == LEN
         strm->avail_in >= 6
-        strm->avail_out >= 258
+        strm->avail_out >= INFLATE_FAST_MIN_OUTPUT
         start >= strm->avail_out
         state->bits < 8
 
@@ -83,7 +83,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     last = in + (strm->avail_in - 5);
     out = strm->next_out;
     beg = out - (start - strm->avail_out);
-    end = out + (strm->avail_out - 257);
+    end = out + (strm->avail_out - (INFLATE_FAST_MIN_OUTPUT - 1));
 #ifdef INFLATE_STRICT
     dmax = state->dmax;
 #endif
@@ -248,6 +248,22 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                             *out++ = *from++;
                     }
                 }
+#ifdef ENABLE_ZLIB_SIMD
+                else if (dist >= INFLATE_FAST_CHUNK) {
+                    unsigned char FAR *stop = out + len;
+                    from = out - dist;          /* whole chunks from output */
+                    do {                        /* may run past stop */
+                        __builtin_memcpy(out, from, INFLATE_FAST_CHUNK);
+                        out += INFLATE_FAST_CHUNK;
+                        from += INFLATE_FAST_CHUNK;
+                    } while (out < stop);
+                    out = stop;
+                }
+                else if (dist == 1) {           /* run of one byte */
+                    __builtin_memset(out, out[-1], len);
+                    out += len;
+                }
+#endif
                 else {
                     from = out - dist;          /* copy direct from output */
                     do {                        /* minimum length is three */
@@ -300,7 +316,8 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     strm->next_out = out;
     strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
     strm->avail_out = (unsigned)(out < end ?
-                                 257 + (end - out) : 257 - (out - end));
+                                 (INFLATE_FAST_MIN_OUTPUT - 1) + (end - out) :
+                                 (INFLATE_FAST_MIN_OUTPUT - 1) - (out - end));
     state->hold = hold;
     state->bits = bits;
     return;
@@ -8,4 +8,15 @@
    subject to change. Applications should only use zlib.h.
  */
 
+/* With ENABLE_ZLIB_SIMD set, matches are copied in whole chunks and may write
+   up to INFLATE_FAST_CHUNK - 1 bytes past their end, so inflate_fast() needs
+   that much more free output space on entry.
+ */
+#ifdef ENABLE_ZLIB_SIMD
+#  define INFLATE_FAST_CHUNK 16
+#else
+#  define INFLATE_FAST_CHUNK 0
+#endif
+#define INFLATE_FAST_MIN_OUTPUT (258 + INFLATE_FAST_CHUNK)
+
 void ZLIB_INTERNAL inflate_fast OF((z_streamp strm, unsigned start));
@@ -9,6 +9,7 @@ add_library(
 	libs/zlib/deflate.c
 	libs/zlib/compress.c
 	libs/zlib/crc32.c
+	libs/zlib/crc32_simd.c
 	libs/zlib/gzlib.c
 	libs/zlib/gzread.c
 	libs/zlib/gzwrite.c
@@ -0,0 +1,22 @@
+#!/bin/bash
+# build modalias index from modules.alias into rootfs assets
+WORKSPACE="$(realpath "$(dirname $0)"/..)"
+BUILD="/tmp"
+ALIAS="${1}"
+ROOT="${WORKSPACE}/root"
+[ -n "${2}" ]&&ROOT="${2}"
+[ -n "${3}" ]&&BUILD="${3}"
+if [ -z "${ALIAS}" ]
+then	echo "Usage: gen-modalias-index.sh <MODULES_ALIAS> [ROOT] [BUILD]" >&2
+	exit 1
+fi
+set -e
+"${HOSTCC:-gcc}" \
+	-Wall -Wextra -Werror -g \
+	-I"${WORKSPACE}/include" \
+	"${WORKSPACE}/src/host/modalias.c" \
+	-o "${BUILD}/modalias"
+mkdir -p "${ROOT}/usr/share/simple-init"
+"${BUILD}/modalias" \
+	"${ALIAS}" \
+	"${ROOT}/usr/share/simple-init/modalias.idx"
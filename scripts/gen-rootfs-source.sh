@@ -6,15 +6,79 @@ ROOT="${WORKSPACE}/root"
 [ -n "${2}" ]&&BUILD="${2}"
 [ -n "${3}" ]&&ROOT="${3}"
 set -e
+COMPRESS=-z
+[ -n "${NOCOMPRESS}" ]&&COMPRESS=
+ZLIB="${WORKSPACE}/libs/zlib"
 "${HOSTCC:-gcc}" \
 	-Wall -Wextra -Werror -g \
+	-Wno-implicit-fallthrough \
 	-I"${WORKSPACE}/include" \
+	-I"${ZLIB}" \
 	"${WORKSPACE}/src/host/rootfs.c" \
+	"${ZLIB}/deflate.c" \
+	"${ZLIB}/trees.c" \
+	"${ZLIB}/zutil.c" \
+	"${ZLIB}/adler32.c" \
+	"${ZLIB}/crc32.c" \
 	-o "${BUILD}/assets"
+STAGED=
+stage_root(){
+	[ -n "${STAGED}" ]&&return
+	STAGED="${BUILD}/rootfs-stage"
+	rm -rf "${STAGED}"
+	mkdir -p "${STAGED}"
+	tar -C "${ROOT}" --exclude='.git*' -cf - . | tar -C "${STAGED}" -xf -
+	ROOT="${STAGED}"
+}
+if [ -n "${FONT_SIZES}" ]
+then	"${HOSTCC:-gcc}" \
+		-Wall -Wextra -Werror -g \
+		-I"${WORKSPACE}/include" \
+		$(pkg-config --cflags freetype2) \
+		"${WORKSPACE}/src/host/fontbin.c" \
+		$(pkg-config --libs freetype2) \
+		-o "${BUILD}/fontbin"
+	stage_root
+	for size in ${FONT_SIZES//,/ }
+	do	"${BUILD}/fontbin" \
+			"${ROOT}/etc/default.ttf" "${size}" \
+			"${ROOT}/usr/share/fonts/default-${size}.bin" \
+			"${WORKSPACE}"/po/*.po
+	done
+fi
+if [ -n "${LUA_BYTECODE}" ]
+then	LUA="${WORKSPACE}/libs/lua"
+	"${HOSTCC:-gcc}" \
+		-Wall -Wextra -Werror -g \
+		-I"${LUA}" \
+		"${WORKSPACE}/src/host/luac.c" \
+		"${LUA}"/l{api,auxlib,code,ctype,debug,do,dump,func,gc,lex,mem}.c \
+		"${LUA}"/l{object,opcodes,parser,state,string,table,tm,undump,vm,zio}.c \
+		-lm \
+		-o "${BUILD}/luac"
+	stage_root
+	find "${ROOT}" -type f -name '*.lua' | while read -r src
+	do	"${BUILD}/luac" "${src}" "${src}c"
+	done
+fi
 "${BUILD}/assets" \
+	${COMPRESS} \
 	"${ROOT}" \
 	"${BUILD}" \
 	assets_rootfs
+if [ -n "${ROOTFS_IMAGE}" ]
+then	STAGE="${BUILD}/rootfs-image"
+	rm -rf "${STAGE}"
+	mkdir -p "${STAGE}"
+	tar -C "${ROOT}" --exclude='.git*' -cf - . | tar -C "${STAGE}" -xf -
+	case "${ROOTFS_IMAGE}" in
+		erofs)mkfs.erofs -zlz4hc "${BUILD}/rootfs.img" "${STAGE}" >/dev/null;;
+		cramfs)mkfs.cramfs "${STAGE}" "${BUILD}/rootfs.img" >/dev/null;;
+		*)echo "unknown rootfs image type ${ROOTFS_IMAGE}" >&2;exit 1;;
+	esac
+	rm -rf "${STAGE}"
+fi
+[ -n "${STAGED}" ]&&rm -rf "${STAGED}"
 if [ -z "${NOBUILD}" ]
 then	pushd "${BUILD}" >/dev/null
 	"${CC:-${CROSS_COMPILE}gcc}" \
@@ -6,6 +6,8 @@
 
 #define _GNU_SOURCE
 #include<stdio.h>
+#include<stdint.h>
+#include<stdbool.h>
 #include<stdlib.h>
 #include<stddef.h>
 #include<string.h>
@@ -36,16 +38,85 @@ void adbd_send_ok(){
 		data->notifyfd=-1;
 	}
 }
-apacket*get_apacket(void){
-	apacket*p=malloc(sizeof(apacket));
-	if(!p){
+/*
+ * packets come in two sizes, the v1 payload for control messages and
+ * the largest payload a transport may negotiate for data. each size has
+ * a slab of slots taken by a bit in a mask, so get and put never lock.
+ * a slot keeps its buffer once allocated, a few large ones are enough
+ * since every socket waits for an okay after each write. packets past
+ * the slab come from malloc and are counted, a new high-water mark of
+ * packets in use is logged.
+ */
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define CAS(v,o,n) __atomic_compare_exchange_n(&(v),&(o),(n),false,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED)
+#define ADD(v,n) __atomic_add_fetch(&(v),(n),__ATOMIC_ACQ_REL)
+#define POOL_SLOTS 64
+static struct packet_pool{
+	apacket*slot[POOL_SLOTS];
+	uint64_t busy;
+	unsigned max,size,used,peak,overflow;
+}pools[]={
+	{.max=64,.size=MAX_PAYLOAD_V1},
+	{.max=16,.size=MAX_PAYLOAD},
+};
+#define PACKET_POOL(size) (&pools[(size)>MAX_PAYLOAD_V1?1:0])
+static int pool_take(struct packet_pool*pool){
+	int i;
+	uint64_t busy=LOAD(pool->busy),full;
+	full=pool->max>=POOL_SLOTS?UINT64_MAX:(UINT64_C(1)<<pool->max)-1;
+	do{
+		if((busy&full)==full)return -1;
+		i=__builtin_ctzll(~busy);
+	}while(!CAS(pool->busy,busy,busy|(UINT64_C(1)<<i)));
+	return i;
+}
+static void pool_account(struct packet_pool*pool){
+	unsigned used=ADD(pool->used,1),peak=LOAD(pool->peak);
+	do{if(used<=peak)return;}while(!CAS(pool->peak,peak,used));
+	tlog_debug(
+		"packet pool %u bytes high-water %u (%u from heap)",
+		pool->size,used,LOAD(pool->overflow)
+	);
+}
+apacket*get_apacket_size(size_t size){
+	int i;
+	apacket*p=NULL;
+	struct packet_pool*pool=PACKET_POOL(size);
+	if((i=pool_take(pool))>=0)p=pool->slot[i];
+	else ADD(pool->overflow,1);
+	if(!p&&!(p=malloc(sizeof(apacket)+pool->size))){
 		telog_error("failed to allocate an apacket");
 		exit(-1);
 		return NULL;
 	}
-	memset(p,0,sizeof(apacket)-MAX_PAYLOAD);
+	if(i>=0)pool->slot[i]=p;
+	memset(p,0,sizeof(apacket));
+	p->size=pool->size,p->slot=i;
+	pool_account(pool);
 	return p;
 }
+void dump_packet_pools(int fd){
+	struct packet_pool*pool;
+	for(size_t i=0;i<sizeof(pools)/sizeof(pools[0]);i++){
+		pool=&pools[i];
+		dprintf(
+			fd,"packet pool %u bytes: %u in use, high-water %u, %u slots, %u from heap\n",
+			pool->size,LOAD(pool->used),LOAD(pool->peak),
+			pool->max,LOAD(pool->overflow)
+		);
+	}
+}
+apacket*get_apacket(void){
+	return get_apacket_size(MAX_PAYLOAD_V1);
+}
+void put_apacket(apacket*p){
+	struct packet_pool*pool;
+	if(!p)return;
+	pool=PACKET_POOL(p->size);
+	ADD(pool->used,-1);
+	if(p->slot<0)free(p);
+	else __atomic_and_fetch(&pool->busy,~(UINT64_C(1)<<p->slot),__ATOMIC_RELEASE);
+}
 void handle_online(atransport*t){
 	tlog_info("status change to online");
 	t->online=1;
@@ -91,10 +162,10 @@ static void send_connect(atransport*t){
 	apacket*cp=get_apacket();
 	cp->msg.command=A_CNXN;
 	cp->msg.arg0=A_VERSION;
-	cp->msg.arg1=MAX_PAYLOAD;
+	cp->msg.arg1=t->max_payload;
 	cp->msg.data_length=fill_connect_data(
 		(char*)cp->data,
-		sizeof(cp->data)
+		cp->size
 	);
 	send_packet(cp,t);
 }
@@ -117,7 +188,7 @@ static void send_auth_request(atransport*t){
 }
 static void send_auth_publickey(atransport*t __attribute__((unused))){
 	apacket*p=get_apacket();
-	free(p);
+	put_apacket(p);
 }
 void adb_auth_verified(atransport*t){
 	handle_online(t);
@@ -203,6 +274,14 @@ void handle_packet(apacket*p,atransport*t){
 				t->connection_state=CS_OFFLINE;
 				handle_offline(t);
 			}
+			// both sides use the lower version and payload
+			t->protocol_version=MIN(p->msg.arg0,A_VERSION);
+			t->max_payload=MIN(p->msg.arg1,MAX_PAYLOAD);
+			if(t->max_payload<=0)t->max_payload=MAX_PAYLOAD_V1;
+			tlog_debug(
+				"protocol version %08x max payload %zu",
+				t->protocol_version,t->max_payload
+			);
 			parse_banner((char*)p->data,t);
 			if(!data->auth_enabled){
 				handle_online(t);
@@ -253,7 +332,7 @@ void handle_packet(apacket*p,atransport*t){
 		return;
 		default:tlog_warn("handle_packet what is %08x?!",p->msg.command);
 	}
-	free(p);
+	put_apacket(p);
 }
 alistener listener_list={
 	.next=&listener_list,
@@ -467,7 +546,7 @@ void build_local_name(char*target_str,size_t target_size,int server_port){
 	snprintf(target_str,target_size,"tcp:%d",server_port);
 }
 int init_adb_data(struct adb_data*d){
-	char*shell=getenv("SHELL");
+	char*shell=getenv("SHELL"),features[256];
 	struct utsname u;
 	uname(&u);
 	memset(d,0,sizeof(struct adb_data));
@@ -477,6 +556,8 @@ int init_adb_data(struct adb_data*d){
 	d->prop=kvlst_set(d->prop,"ro.product.device",NAME);
 	d->prop=kvlst_set(d->prop,"ro.product.name",u.sysname);
 	d->prop=kvlst_set(d->prop,"ro.product.model",u.version);
+	snprintf(features,sizeof(features),"shell_v2,%s",file_sync_features());
+	d->prop=kvlst_set(d->prop,"features",features);
 	d->local_port=5038;
 	d->notifyfd=-1;
 	d->port=5555;
@@ -504,27 +585,27 @@ int adbd_init(struct adb_data*d){
 	signal(SIGINT,adbd_signal);
 	signal(SIGTERM,adbd_signal);
 	signal(SIGQUIT,adbd_signal);
-	signal(SIGPIPE,adbd_signal);
+	// a stream the host closed fails the write, it must not end adbd
+	signal(SIGPIPE,SIG_IGN);
 	init_transport_registration();
 	if(d->auth_enabled)adb_auth_init();
 	char local_name[30];
 	build_local_name(local_name,sizeof(local_name),data->port);
 	if(install_listener(local_name,"*smartsocket*",NULL,0))exit(1);
-	switch(data->proto){
-		case PROTO_TCP:
-			tlog_info("using Local Port");
-			local_init(data->local_port);
-		break;
-		case PROTO_USB:
-			if(access(data->ffs,F_OK)!=0)return terlog_error(
-				errno,
-				"access adb ffs %s",
-				data->ffs
-			);
-			tlog_info("using USB");
-			usb_init(data->ffs);
-		break;
-		default:return trlog_error(-1,"unknown adb protocol");
+	// every transport has its own threads, usb and tcp run side by side
+	if(!(data->proto&PROTO_ALL))return trlog_error(-1,"unknown adb protocol");
+	if(data->proto&PROTO_USB){
+		if(access(data->ffs,F_OK)!=0)return terlog_error(
+			errno,
+			"access adb ffs %s",
+			data->ffs
+		);
+		tlog_info("using USB");
+		usb_init(data->ffs);
+	}
+	if(data->proto&PROTO_TCP){
+		tlog_info("using Local Port");
+		local_init(data->local_port);
 	}
 	confd_set_integer("runtime.pid.adbd",getpid());
 	fdevent_loop();
@@ -41,7 +41,7 @@ static void adb_auth_event(int fd,unsigned events,void *data){
 	}
 }
 void adb_auth_confirm_key(unsigned char *key,size_t len,atransport *t){
-	char msg[MAX_PAYLOAD];
+	char msg[MAX_PAYLOAD_V1];
 	int ret;
 	if(framework_fd<0){
 		tlog_warn("auth: client not connected");
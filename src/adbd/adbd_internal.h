@@ -12,7 +12,8 @@
 #define ANDROID_SOCKET_NAMESPACE_ABSTRACT 0
 #define ANDROID_SOCKET_NAMESPACE_RESERVED 1
 #define ANDROID_SOCKET_NAMESPACE_FILESYSTEM 2
-#define MAX_PAYLOAD 4096
+#define MAX_PAYLOAD_V1 (4*1024)
+#define MAX_PAYLOAD (256*1024)
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
 #define A_OPEN 0x4e45504f
@@ -20,7 +21,9 @@
 #define A_CLSE 0x45534c43
 #define A_WRTE 0x45545257
 #define A_AUTH 0x48545541
-#define A_VERSION 0x01000000
+#define A_VERSION_MIN 0x01000000
+#define A_VERSION_SKIP_CHECKSUM 0x01000001
+#define A_VERSION 0x01000001
 #define ADB_AUTH_TOKEN         1
 #define ADB_AUTH_SIGNATURE     2
 #define ADB_AUTH_RSAPUBLICKEY  3
@@ -43,9 +46,17 @@
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+#define ID_SEND_V2 MKID('S','N','D','2')
+#define ID_RECV_V2 MKID('R','C','V','2')
+#define SYNC_FLAG_BROTLI  0x00000001
+#define SYNC_FLAG_LZ4     0x00000002
+#define SYNC_FLAG_ZSTD    0x00000004
+#define SYNC_FLAG_DRY_RUN 0x80000000
 #define MAX_PACKET_SIZE_FS 64
 #define MAX_PACKET_SIZE_HS 512
 #define SYNC_DATA_MAX (64*1024)
+#define ADB_TCP_BUFFER (4*MAX_PAYLOAD)
+#define STAT_ADD(v,n) __atomic_add_fetch(&(v),(n),__ATOMIC_RELAXED)
 #define CS_ANY -1
 #define CS_OFFLINE 0
 #define CS_BOOTLOADER 1
@@ -77,6 +88,8 @@ typedef union{
 	struct{unsigned id,mode,size,time,namelen;}dent;
 	struct{unsigned id,size;}data;
 	struct{unsigned id,msglen;}status;
+	struct{unsigned id,mode,flags;}send_v2;
+	struct{unsigned id,flags;}recv_v2;
 }syncmsg;
 struct logger_entry{
 	uint16_t len,__pad;
@@ -104,10 +117,11 @@ enum usb_functionfs_event_type {
 struct amessage{unsigned command,arg0,arg1,data_length,data_check,magic;};
 struct apacket{
 	apacket*next;
-	unsigned len;
+	unsigned len,size;
+	int slot;
 	unsigned char*ptr;
 	amessage msg;
-	unsigned char data[MAX_PAYLOAD];
+	unsigned char data[];
 };
 struct asocket{
 	asocket*next,*prev;
@@ -121,6 +135,7 @@ struct asocket{
 	void(*ready)(asocket*s),(*close)(asocket*s);
 	void*extra;
 	atransport*transport;
+	uint64_t rx_bytes,tx_bytes;
 };
 struct adisconnect{
 	void(*func)(void*opaque,atransport*t);
@@ -147,6 +162,9 @@ struct atransport{
 	unsigned char token[TOKEN_SIZE];
 	fdevent auth_fde;
 	unsigned failed_auth_attempts;
+	unsigned protocol_version;
+	size_t max_payload;
+	uint64_t rx_bytes,tx_bytes,rx_packets,tx_packets;
 };
 struct alistener{
 	alistener*next,*prev;
@@ -163,7 +181,13 @@ struct usb_endpoint_descriptor_no_audio{
 }__attribute__((packed));
 struct usb_functionfs_descs_head{__le32 magic,length,fs_count,hs_count;}__attribute__((packed));
 struct usb_functionfs_strings_head{__le32 magic,length,str_count,lang_count;}__attribute__((packed));
-extern int shell_exit_notify_fd;
+extern void fdevent_subproc_exit(int fd);
+extern void dump_packet_pools(int fd);
+extern void dump_transports(int fd);
+extern void dump_sockets(int fd);
+extern void dump_usb(int fd);
+extern void stats_service(int fd,void*cookie);
+extern void speedtest_service(int fd,void*cookie);
 extern pthread_mutex_t socket_list_lock;
 extern pthread_mutex_t transport_lock;
 extern pthread_mutex_t D_lock;
@@ -201,8 +225,10 @@ extern void register_usb_transport(usb_handle*h,const char*serial,const char*dev
 extern void unregister_usb_transport(usb_handle*usb);
 extern int service_to_fd(const char*name);
 extern apacket*get_apacket(void);
+extern apacket*get_apacket_size(size_t size);
+extern void put_apacket(apacket*p);
 extern int check_header(apacket*p);
-extern int check_data(apacket*p);
+extern int check_data(apacket*p,atransport*t);
 extern void local_init(int port);
 extern int local_connect(int port);
 extern int local_connect_arbitrary_ports(int console_port,int adb_port);
@@ -231,6 +257,7 @@ extern int socket_make_sockaddr_un(const char*name,int namespaceId,struct sockad
 extern int android_get_control_socket(const char*name);
 extern char*adbd_get_shell(void);
 extern void adbd_send_ok(void);
+extern const char*file_sync_features(void);
 static __inline__ int adb_open_mode(const char*pathname,int options,int mode){return TEMP_FAILURE_RETRY(open(pathname,options,mode));}
 static __inline__ int adb_open(const char*pathname,int options){
 	int fd=TEMP_FAILURE_RETRY(open(pathname,options));
@@ -254,8 +281,19 @@ static __inline__ int adb_thread_create(pthread_t*pthread,adb_thread_func_t star
 	return pthread_create(pthread,&attr,start,arg);
 }
 static __inline__ void disable_tcp_nagle(int fd){int on=1;setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(void*)&on,sizeof(on));}
+// a full payload and its header leave in one segment train, dead peers get reaped
+static __inline__ void tune_tcp_socket(int fd){
+	int on=1,size=ADB_TCP_BUFFER;
+	disable_tcp_nagle(fd);
+	setsockopt(fd,SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+	setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+	setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,&on,sizeof(on));
+}
 static __inline__ int adb_socketpair(int sv[2]){
+	int size=MAX_PAYLOAD;
 	if(socketpair(AF_UNIX,SOCK_STREAM,0,sv)<0)return -1;
+	setsockopt(sv[0],SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+	setsockopt(sv[1],SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
 	fcntl(sv[0],F_SETFD,FD_CLOEXEC);
 	fcntl(sv[1],F_SETFD,FD_CLOEXEC);
 	return 0;
@@ -6,54 +6,80 @@
 
 #include<errno.h>
 #include<fcntl.h>
+#include<stdint.h>
+#include<stdbool.h>
 #include<stdlib.h>
 #include<string.h>
 #include<stddef.h>
 #include<unistd.h>
+#include<pthread.h>
 #include<sys/ioctl.h>
 #include<sys/epoll.h>
+#include<sys/eventfd.h>
 #include"adbd_internal.h"
 #include"logger.h"
 #define TAG "adbd"
-int shell_exit_notify_fd=-1;
 #define dump_fde(fde,info) do{}while(0)
 #define FDE_EVENTMASK  0x00ff
 #define FDE_STATEMASK  0xff00
 #define FDE_ACTIVE     0x0100
 #define FDE_PENDING    0x0200
 #define FDE_CREATED    0x0400
+#define FDE_EPOLL      0x0800
+
+/*
+ * fds are found in a table of pages, a page of FDE_PAGE slots is
+ * allocated when the first fd in it is registered and never moves, so
+ * growing the table is a single allocation. the fds stay level
+ * triggered, a handler takes one packet per call and expects another
+ * call while more is left. a batch of up to FDE_BATCH events is queued
+ * before any handler runs, so a handler may remove any fdevent. other
+ * threads wake the loop through an edge triggered eventfd, shell exits
+ * are handed over that way.
+ */
+#define FDE_PAGE  256
+#define FDE_PAGES 1024
+#define FDE_BATCH 256
 static void fdevent_plist_enqueue(fdevent*node);
 static void fdevent_plist_remove(fdevent*node);
 static fdevent*fdevent_plist_dequeue(void);
-static void fdevent_subproc_event_func(int fd,unsigned events,void*userdata);
+static void fdevent_call_fdfunc(fdevent*fde);
 static fdevent list_pending={.next=&list_pending,.prev=&list_pending,};
-static fdevent**fd_table=0;
-static int fd_table_max=0;
-static int epoll_fd=-1;
+static fdevent**fd_pages[FDE_PAGES];
+static int epoll_fd=-1,wake_fd=-1;
+static pthread_mutex_t exit_lock=PTHREAD_MUTEX_INITIALIZER;
+static int*exit_fds=NULL;
+static size_t exit_cnt=0,exit_max=0;
 static void fdevent_init(){
-	if((epoll_fd=epoll_create(256))<0){
+	if((epoll_fd=epoll_create1(EPOLL_CLOEXEC))<0){
 		telog_error("epoll_create");
 		exit(1);
 	}
-	fcntl(epoll_fd,F_SETFD,FD_CLOEXEC);
 }
-static void fdevent_connect(fdevent*fde){
-	struct epoll_event ev;
-	memset(&ev,0,sizeof(ev));
-	ev.events=0;
-	ev.data.ptr=fde;
-
+static fdevent**fd_slot(int fd,bool alloc){
+	fdevent***page;
+	if(fd<0||fd>=FDE_PAGE*FDE_PAGES)return NULL;
+	page=&fd_pages[fd/FDE_PAGE];
+	if(!*page){
+		if(!alloc)return NULL;
+		if(!(*page=calloc(FDE_PAGE,sizeof(fdevent*))))return NULL;
+	}
+	return &(*page)[fd%FDE_PAGE];
+}
+static fdevent*fd_get(int fd){
+	fdevent**slot=fd_slot(fd,false);
+	return slot?*slot:NULL;
 }
 static void fdevent_disconnect(fdevent*fde){
 	struct epoll_event ev;
+	if(!(fde->state&FDE_EPOLL))return;
 	memset(&ev,0,sizeof(ev));
-	ev.events=0;
-	ev.data.ptr=fde;
 	epoll_ctl(epoll_fd,EPOLL_CTL_DEL,fde->fd,&ev);
+	fde->state&=~FDE_EPOLL;
 }
 static void fdevent_update(fdevent*fde,unsigned events){
 	struct epoll_event ev;
-	int active=(fde->state&FDE_EVENTMASK)!=0;
+	int x;
 	memset(&ev,0,sizeof(ev));
 	ev.events=0;
 	ev.data.ptr=fde;
@@ -61,27 +87,57 @@ static void fdevent_update(fdevent*fde,unsigned events){
 	if(events&FDE_WRITE)ev.events|=EPOLLOUT;
 	if(events&FDE_ERROR)ev.events|=(EPOLLERR|EPOLLHUP);
 	fde->state=(fde->state&FDE_STATEMASK)|events;
-	int x;
-	if(ev.events)x=active?EPOLL_CTL_MOD:EPOLL_CTL_ADD;
-	else if(active)x=EPOLL_CTL_DEL;
+	if(ev.events)x=(fde->state&FDE_EPOLL)?EPOLL_CTL_MOD:EPOLL_CTL_ADD;
+	else if(fde->state&FDE_EPOLL)x=EPOLL_CTL_DEL;
 	else return;
 	if(epoll_ctl(epoll_fd,x,fde->fd,&ev)){
 		telog_error("epoll_ctl");
 		exit(1);
 	}
+	if(x==EPOLL_CTL_DEL)fde->state&=~FDE_EPOLL;
+	else fde->state|=FDE_EPOLL;
+}
+static void fdevent_subproc_exited(int fd){
+	fdevent*subproc_fde;
+	int rcount=0;
+	if(!(subproc_fde=fd_get(fd)))return;
+	if(subproc_fde->fd!=fd)return;
+	subproc_fde->force_eof=1;
+	ioctl(fd,FIONREAD,&rcount);
+	if(rcount)return;
+	subproc_fde->events|=FDE_READ;
+	if(subproc_fde->state&FDE_PENDING)return;
+	subproc_fde->state|=FDE_PENDING;
+	fdevent_call_fdfunc(subproc_fde);
+}
+static void fdevent_wakeup(){
+	uint64_t v;
+	int*fds;
+	size_t cnt;
+	while(read(wake_fd,&v,sizeof(v))>0);
+	pthread_mutex_lock(&exit_lock);
+	fds=exit_fds,cnt=exit_cnt;
+	exit_fds=NULL,exit_cnt=0,exit_max=0;
+	pthread_mutex_unlock(&exit_lock);
+	for(size_t i=0;i<cnt;i++)fdevent_subproc_exited(fds[i]);
+	if(fds)free(fds);
 }
 static void fdevent_process(){
-	struct epoll_event events[256];
+	struct epoll_event events[FDE_BATCH];
 	fdevent*fde;
+	bool woken=false;
 	int i,n;
-	if((n=epoll_wait(epoll_fd,events,256,-1))<0){
+	if((n=epoll_wait(epoll_fd,events,FDE_BATCH,-1))<0){
 		if(errno==EINTR)return;
 		telog_error("epoll_wait");
 		exit(1);
 	}
 	for(i=0;i<n;i++){
 		struct epoll_event*ev=events+i;
-		fde=ev->data.ptr;
+		if(!(fde=ev->data.ptr)){
+			woken=true;
+			continue;
+		}
 		if(ev->events&EPOLLIN)fde->events|=FDE_READ;
 		if(ev->events&EPOLLOUT)fde->events|=FDE_WRITE;
 		if(ev->events&(EPOLLERR|EPOLLHUP))fde->events|=FDE_ERROR;
@@ -91,42 +147,32 @@ static void fdevent_process(){
 			fdevent_plist_enqueue(fde);
 		}
 	}
+	if(woken)fdevent_wakeup();
 }
 static void fdevent_register(fdevent*fde){
+	fdevent**slot;
 	if(fde->fd<0){
 		telog_error("fdevent_register: bogus negative fd (%d)",fde->fd);
 		abort();
 	}
-	if(fde->fd>=fd_table_max){
-		int oldmax=fd_table_max;
-		if(fde->fd>32000){
-			telog_error("fdevent_register: bogus huge fd (%d)",fde->fd);
-			abort();
-		}
-		if(fd_table_max==0){
-			fdevent_init();
-			fd_table_max=256;
-		}
-		while(fd_table_max<=fde->fd)fd_table_max*=2;
-		fd_table=realloc(fd_table,sizeof(fdevent*)*fd_table_max);
-		if(fd_table==0){
-			telog_error("fdevent_register: could not expand fd_table to %d entries",fd_table_max);
-			abort();
-		}
-		memset(fd_table+oldmax,0,sizeof(int)*(fd_table_max-oldmax));
+	if(epoll_fd<0)fdevent_init();
+	if(!(slot=fd_slot(fde->fd,true))){
+		telog_error("fdevent_register: no slot for fd %d",fde->fd);
+		abort();
 	}
-	fd_table[fde->fd]=fde;
+	*slot=fde;
 }
 static void fdevent_unregister(fdevent*fde){
-	if((fde->fd<0)||(fde->fd>=fd_table_max)){
+	fdevent**slot=fd_slot(fde->fd,false);
+	if(!slot){
 		telog_error("fdevent_unregister: fd out of range (%d)\n",fde->fd);
 		abort();
 	}
-	if(fd_table[fde->fd]!=fde){
+	if(*slot!=fde){
 		telog_error("fdevent_unregister: fd_table out of sync [%d]\n",fde->fd);
 		abort();
 	}
-	fd_table[fde->fd]=0;
+	*slot=0;
 	if(!(fde->state&FDE_DONT_CLOSE)){
 		dump_fde(fde,"close");
 		close(fde->fd);
@@ -163,37 +209,6 @@ static void fdevent_call_fdfunc(fdevent*fde){
 	dump_fde(fde,"callback");
 	fde->func(fde->fd,events,fde->arg);
 }
-static void fdevent_subproc_event_func(
-	int fd,
-	unsigned ev,
-	void*userdata __attribute__((unused))
-){
-	if((fd<0)||(fd>=fd_table_max)){
-		telog_error("fdevent_subproc_event_func: fd %d out of range for fd_table",fd);
-		abort();
-	}
-	fdevent*fde=fd_table[fd];
-	fdevent_add(fde,FDE_READ);
-	if(ev&FDE_READ){
-		int subproc_fd;
-		if(readx(fd,&subproc_fd,sizeof(subproc_fd))){
-			telog_error("fdevent_subproc_event_func: Failed to read the subproc's fd from fd %d",fd);
-			abort();
-		}
-		if((subproc_fd<0)||(subproc_fd>=fd_table_max))return;
-		fdevent*subproc_fde=fd_table[subproc_fd];
-		if(!subproc_fde)return;
-		if(subproc_fde->fd!=subproc_fd)return;
-		subproc_fde->force_eof=1;
-		int rcount=0;
-		ioctl(subproc_fd,FIONREAD,&rcount);
-		if(rcount)return;
-		subproc_fde->events|=FDE_READ;
-		if(subproc_fde->state&FDE_PENDING)return;
-		subproc_fde->state|=FDE_PENDING;
-		fdevent_call_fdfunc(subproc_fde);
-	}
-}
 fdevent*fdevent_create(int fd,fd_func func,void*arg){
 	fdevent*fde=(fdevent*)malloc(sizeof(fdevent));
 	if(fde==0)return 0;
@@ -219,8 +234,6 @@ void fdevent_install(fdevent*fde,int fd,fd_func func,void*arg){
 	fcntl(fd,F_SETFL,O_NONBLOCK);
 	fdevent_register(fde);
 	dump_fde(fde,"connect");
-	fdevent_connect(fde);
-	fde->state|=FDE_ACTIVE;
 }
 void fdevent_remove(fdevent*fde){
 	if(fde->state&FDE_PENDING)fdevent_plist_remove(fde);
@@ -250,19 +263,37 @@ void fdevent_set(fdevent*fde,unsigned events){
 }
 void fdevent_add(fdevent*fde,unsigned events){fdevent_set(fde,(fde->state&FDE_EVENTMASK)|(events&FDE_EVENTMASK));}
 void fdevent_del(fdevent*fde,unsigned events){fdevent_set(fde,(fde->state&FDE_EVENTMASK)&(~(events & FDE_EVENTMASK)));}
-void fdevent_subproc_setup(){
-	int s[2];
-	if(adb_socketpair(s)){
-		telog_error("fdevent_subproc_setup: cannot create shell-exit socket-pair");
+void fdevent_subproc_exit(int fd){
+	int*fds;
+	uint64_t v=1;
+	pthread_mutex_lock(&exit_lock);
+	if(exit_cnt>=exit_max){
+		if(!(fds=realloc(exit_fds,sizeof(int)*(exit_max+16)))){
+			pthread_mutex_unlock(&exit_lock);
+			telog_warn("cannot queue shell exit of fd %d",fd);
+			return;
+		}
+		exit_fds=fds,exit_max+=16;
+	}
+	exit_fds[exit_cnt++]=fd;
+	pthread_mutex_unlock(&exit_lock);
+	if(wake_fd>=0&&write(wake_fd,&v,sizeof(v))<0)
+		telog_warn("wake up event loop failed");
+}
+static void fdevent_subproc_setup(){
+	struct epoll_event ev;
+	if(epoll_fd<0)fdevent_init();
+	if((wake_fd=eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK))<0){
+		telog_error("fdevent_subproc_setup: cannot create wakeup eventfd");
 		abort();
 	}
-	shell_exit_notify_fd=s[0];
-	fdevent*fde;
-	if(!(fde=fdevent_create(s[1],fdevent_subproc_event_func,NULL))){
-		telog_error("fdevent_subproc_setup: cannot create fdevent for shell-exit handler");
+	memset(&ev,0,sizeof(ev));
+	ev.events=EPOLLIN|EPOLLET;
+	ev.data.ptr=NULL;
+	if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,wake_fd,&ev)){
+		telog_error("fdevent_subproc_setup: cannot watch wakeup eventfd");
 		abort();
 	}
-	fdevent_add(fde,FDE_READ);
 }
 _Noreturn void fdevent_loop(){
 	fdevent*fde;
@@ -6,15 +6,53 @@
 
 #define _GNU_SOURCE
 #include<utime.h>
+#include<fcntl.h>
 #include<errno.h>
 #include<stdlib.h>
 #include<string.h>
 #include<dirent.h>
+#include<stdbool.h>
 #include<sys/stat.h>
 #include<sys/types.h>
+#ifdef ENABLE_ZSTD
+#include<zstd.h>
+#endif
 #include"adbd_internal.h"
 #include"logger.h"
 #define TAG "adbd"
+
+/*
+ * file data goes through a pipe with splice when the kernel can, so it
+ * is never copied into this process. the pipe also gathers many data
+ * messages into one write to the file. otherwise data is read into a
+ * buffer that is written out once full. sendrecv v2 sends mode and
+ * flags in a message of their own. a dry run reads all data and writes
+ * nothing. zstd streams work when built with libzstd.
+ */
+#define SYNC_PIPE_SIZE (4*SYNC_DATA_MAX)
+#define SYNC_OUT_MAX   (4*SYNC_DATA_MAX)
+#ifdef ENABLE_ZSTD
+#define SYNC_FLAG_COMPRESS SYNC_FLAG_ZSTD
+#else
+#define SYNC_FLAG_COMPRESS 0
+#endif
+struct sync{
+	int s,pipe[2];
+	size_t pipe_size,piped,used;
+	char*data,*out;
+	bool zstd;
+	#ifdef ENABLE_ZSTD
+	ZSTD_DCtx*dctx;
+	ZSTD_CCtx*cctx;
+	#endif
+};
+const char*file_sync_features(void){
+	return "sendrecv_v2,sendrecv_v2_dry_run_send"
+	#ifdef ENABLE_ZSTD
+	",sendrecv_v2_zstd"
+	#endif
+	;
+}
 static int mkdirs(char*name){
 	int ret;
 	char*x=name + 1;
@@ -92,20 +130,135 @@ static int fail_message(int s,const char*reason){
 	return(writex(s,&msg.data,sizeof(msg.data))||writex(s,reason,len))?-1:0;
 }
 static int fail_errno(int s){return fail_message(s,strerror(errno));}
-static int handle_send_file(int s,char*path,mode_t mode,char*buffer){
+static void pipe_close(struct sync*sc){
+	if(sc->pipe[0]>=0)close(sc->pipe[0]);
+	if(sc->pipe[1]>=0)close(sc->pipe[1]);
+	sc->pipe[0]=sc->pipe[1]=-1;
+}
+static void pipe_open(struct sync*sc){
+	int size;
+	sc->pipe[0]=sc->pipe[1]=-1,sc->piped=0;
+	if(pipe2(sc->pipe,O_CLOEXEC)<0)return;
+	fcntl(sc->pipe[1],F_SETPIPE_SZ,SYNC_PIPE_SIZE);
+	if((size=fcntl(sc->pipe[1],F_GETPIPE_SZ))<SYNC_DATA_MAX)pipe_close(sc);
+	else sc->pipe_size=size;
+}
+// copy n bytes out of the pipe for a peer that does not take splice, drop them without one
+static int pipe_copy(struct sync*sc,int fd,size_t n){
+	int r;
+	while(n>0){
+		if((r=adb_read(sc->pipe[0],sc->data,MIN(n,SYNC_DATA_MAX)))<=0)return -1;
+		if(fd>=0&&writex(fd,sc->data,r))return -1;
+		n-=r,sc->piped-=r;
+	}
+	return 0;
+}
+static ssize_t pipe_splice(int in,int out,size_t len){
+	return TEMP_FAILURE_RETRY(splice(in,NULL,out,NULL,len,SPLICE_F_MOVE|SPLICE_F_MORE));
+}
+// forget everything gathered for a file that failed
+static void sync_drop(struct sync*sc){
+	while(sc->piped>0&&pipe_copy(sc,-1,sc->piped)<0){
+		pipe_close(sc);
+		break;
+	}
+	sc->piped=0,sc->used=0;
+}
+// write out everything gathered for fd, fails with errno of the file
+static int sync_flush(struct sync*sc,int fd){
+	ssize_t r;
+	while(sc->piped>0){
+		if((r=pipe_splice(sc->pipe[0],fd,sc->piped))>0)sc->piped-=r;
+		else if(r<0&&errno==EINVAL){
+			if(pipe_copy(sc,fd,sc->piped))return -1;
+		}else{
+			if(r==0)errno=EIO;
+			return -1;
+		}
+	}
+	if(sc->used>0){
+		if(writex(fd,sc->out,sc->used))return -1;
+		sc->used=0;
+	}
+	return 0;
+}
+#ifdef ENABLE_ZSTD
+static int sync_data_zstd(struct sync*sc,int fd,size_t len){
+	size_t r;
+	ZSTD_inBuffer in={sc->data,len,0};
+	ZSTD_outBuffer out={sc->out,SYNC_OUT_MAX,0};
+	if(readx(sc->s,sc->data,len))return -1;
+	do{
+		if(sc->used>=SYNC_OUT_MAX&&sync_flush(sc,fd))return -2;
+		out.pos=sc->used;
+		r=ZSTD_decompressStream(sc->dctx,&out,&in);
+		sc->used=out.pos;
+		if(ZSTD_isError(r)){
+			telog_warn("zstd decompress failed: %s",ZSTD_getErrorName(r));
+			errno=EINVAL;
+			return -2;
+		}
+	}while(in.pos<in.size||out.pos>=out.size);
+	return 0;
+}
+#endif
+/*
+ * take a data message of len bytes from the socket for fd,
+ * -1 when the socket failed, -2 with errno when the file failed
+ */
+static int sync_data(struct sync*sc,int fd,size_t len){
+	ssize_t r;
+	if(fd<0)return readx(sc->s,sc->data,len);
+	#ifdef ENABLE_ZSTD
+	if(sc->zstd)return sync_data_zstd(sc,fd,len);
+	#endif
+	if(sc->pipe[0]>=0){
+		if(sc->piped+len>sc->pipe_size&&sync_flush(sc,fd))return -2;
+		while(len>0){
+			if((r=pipe_splice(sc->s,sc->pipe[1],len))>0){
+				len-=r,sc->piped+=r;
+				continue;
+			}
+			if(r==0||errno!=EINVAL)return -1;
+			if(sync_flush(sc,fd))return -2;
+			pipe_close(sc);
+			break;
+		}
+		if(len<=0)return 0;
+	}
+	if(sc->used+len>SYNC_OUT_MAX&&sync_flush(sc,fd))return -2;
+	if(readx(sc->s,sc->out+sc->used,len))return -1;
+	sc->used+=len;
+	return 0;
+}
+static int handle_send_file(struct sync*sc,char*path,mode_t mode,unsigned flags){
 	syncmsg msg;
 	unsigned int timestamp;
-	int fd;
-	fd=adb_open_mode(path,O_WRONLY|O_CREAT|O_EXCL,mode);
-	if(fd < 0 && errno==ENOENT){
-		mkdirs(path);
+	int fd=-1,s=sc->s,r,saved_errno;
+	bool dry=flags&SYNC_FLAG_DRY_RUN;
+	if(!dry){
 		fd=adb_open_mode(path,O_WRONLY|O_CREAT|O_EXCL,mode);
+		if(fd < 0 && errno==ENOENT){
+			mkdirs(path);
+			fd=adb_open_mode(path,O_WRONLY|O_CREAT|O_EXCL,mode);
+		}
+		if(fd<0&&errno==EEXIST)fd=adb_open_mode(path,O_WRONLY,mode);
+		if(fd<0){
+			if(fail_errno(s))return -1;
+			fd=-1;
+		}
 	}
-	if(fd<0&&errno==EEXIST)fd=adb_open_mode(path,O_WRONLY,mode);
-	if(fd<0){
-		if(fail_errno(s))return -1;
-		fd=-1;
+	sc->zstd=false,sc->piped=0,sc->used=0;
+	#ifdef ENABLE_ZSTD
+	if(flags&SYNC_FLAG_ZSTD){
+		if(!sc->dctx&&!(sc->dctx=ZSTD_createDCtx())){
+			fail_message(s,"zstd init failed");
+			goto fail;
+		}
+		ZSTD_DCtx_reset(sc->dctx,ZSTD_reset_session_only);
+		sc->zstd=true;
 	}
+	#endif
 	for(;;){
 		unsigned int len;
 		if(readx(s,&msg.data,sizeof(msg.data)))goto fail;
@@ -121,10 +274,10 @@ static int handle_send_file(int s,char*path,mode_t mode,char*buffer){
 			fail_message(s,"oversize data message");
 			goto fail;
 		}
-		if(readx(s,buffer,len))goto fail;
-		if(fd<0)continue;
-		if(writex(fd,buffer,len)){
-			int saved_errno=errno;
+		if((r=sync_data(sc,fd,len))==-1)goto fail;
+		if(r<0){
+			saved_errno=errno;
+			sync_drop(sc);
 			close(fd);
 			unlink(path);
 			fd=-1;
@@ -132,37 +285,50 @@ static int handle_send_file(int s,char*path,mode_t mode,char*buffer){
 			if(fail_errno(s))return -1;
 		}
 	}
+	if(fd>=0&&sync_flush(sc,fd)){
+		saved_errno=errno;
+		sync_drop(sc);
+		close(fd);
+		unlink(path);
+		errno=saved_errno;
+		return fail_errno(s);
+	}
 	if(fd>=0){
 		struct utimbuf u;
 		close(fd);
 		u.actime=timestamp;
 		u.modtime=timestamp;
 		utime(path,&u);
+	}
+	if(fd>=0||dry){
 		msg.status.id=ID_OKAY;
 		msg.status.msglen=0;
 		if(writex(s,&msg.status,sizeof(msg.status)))return -1;
 	}
 	return 0;
 fail:
+	sync_drop(sc);
 	if(fd >=0)close(fd);
-	unlink(path);
+	if(!dry)unlink(path);
 	return -1;
 }
-static int handle_send_link(int s,char*path,char*buffer){
+static int handle_send_link(struct sync*sc,char*path,bool dry){
 	syncmsg msg;
 	unsigned int len;
-	int ret;
+	int ret=0,s=sc->s;
+	char*buffer=sc->data;
 	if(readx(s,&msg.data,sizeof(msg.data)))return -1;
 	if(msg.data.id !=ID_DATA){
 		fail_message(s,"invalid data message: expected ID_DATA");
 		return -1;
 	}
-	if((len=msg.data.size)>SYNC_DATA_MAX){
+	if((len=msg.data.size)>=SYNC_DATA_MAX){
 		fail_message(s,"oversize data message");
 		return -1;
 	}
 	if(readx(s,buffer,len))return -1;
-	if((ret=symlink(buffer,path))&&errno==ENOENT){
+	buffer[len]=0;
+	if(!dry&&(ret=symlink(buffer,path))&&errno==ENOENT){
 		mkdirs(path);
 		ret=symlink(buffer,path);
 	}
@@ -178,51 +344,112 @@ static int handle_send_link(int s,char*path,char*buffer){
 	}
 	return 0;
 }
-static int do_send(int s,char*path,char*buffer){
+static int do_send(struct sync*sc,char*path,mode_t mode,unsigned flags){
+	bool is_link=S_ISLNK(mode),dry=flags&SYNC_FLAG_DRY_RUN;
+	if(flags&~(SYNC_FLAG_DRY_RUN|SYNC_FLAG_COMPRESS)){
+		fail_message(sc->s,"unsupported send flags");
+		return -1;
+	}
+	mode&=0777;
+	if(!dry)unlink(path);
+	if(is_link)return handle_send_link(sc,path,dry);
+	mode|=((mode>>3)&0070);
+	mode|=((mode>>3)&0007);
+	return handle_send_file(sc,path,mode,flags);
+}
+static int do_send_v1(struct sync*sc,char*path){
 	char*tmp;
 	mode_t mode;
-	int is_link,ret;
 	tmp=strrchr(path,',');
 	if(tmp){
 		*tmp=0;
 		errno=0;
 		mode=strtoul(tmp+1,NULL,0);
-		is_link=S_ISLNK(mode);
-		mode&=0777;
-	}
-	if(!tmp||errno){mode=0644;is_link=0;}
-	unlink(path);
-	if(is_link)ret=handle_send_link(s,path,buffer);
-	else{
-		mode|=((mode>>3)&0070);
-		mode|=((mode>>3)&0007);
-		ret=handle_send_file(s,path,mode,buffer);
 	}
-	return ret;
+	if(!tmp||errno)mode=S_IFREG|0644;
+	return do_send(sc,path,mode,0);
 }
-static int do_recv(int s,const char*path,char*buffer){
+static int send_data(int s,const void*buf,size_t len){
 	syncmsg msg;
-	int fd,r;
-	if((fd=adb_open(path,O_RDONLY))<0){
-		if(fail_errno(s))return -1;
-		return 0;
+	msg.data.id=ID_DATA;
+	msg.data.size=len;
+	return writex(s,&msg.data,sizeof(msg.data))||writex(s,buf,len);
+}
+#ifdef ENABLE_ZSTD
+static int recv_zstd(struct sync*sc,int fd){
+	int r;
+	size_t z;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out={sc->out,SYNC_DATA_MAX,0};
+	ZSTD_EndDirective end=ZSTD_e_continue;
+	if(!sc->cctx&&!(sc->cctx=ZSTD_createCCtx())){
+		errno=ENOMEM;
+		return -2;
 	}
+	ZSTD_CCtx_reset(sc->cctx,ZSTD_reset_session_only);
+	do{
+		if((r=adb_read(fd,sc->data,SYNC_DATA_MAX))<0)return -2;
+		if(r==0)end=ZSTD_e_end;
+		in.src=sc->data,in.size=r,in.pos=0;
+		do{
+			z=ZSTD_compressStream2(sc->cctx,&out,&in,end);
+			if(ZSTD_isError(z)){
+				telog_warn("zstd compress failed: %s",ZSTD_getErrorName(z));
+				errno=EINVAL;
+				return -2;
+			}
+			if(out.pos>=out.size||(end==ZSTD_e_end&&z==0&&out.pos>0)){
+				if(send_data(sc->s,out.dst,out.pos))return -1;
+				out.pos=0;
+			}
+		}while(end==ZSTD_e_end?z>0:in.pos<in.size);
+	}while(end!=ZSTD_e_end);
+	return 0;
+}
+#endif
+// -1 when the socket failed, -2 with errno when the file failed
+static int recv_splice(struct sync*sc,int fd){
+	ssize_t r,n;
+	syncmsg msg;
 	msg.data.id=ID_DATA;
 	for(;;){
-		if((r=adb_read(fd,buffer,SYNC_DATA_MAX))<=0){
-			if(r==0)break;
-			if(errno==EINTR)continue;
-			r=fail_errno(s);
-			close(fd);
-			return r;
-		}
-		msg.data.size=r;
-		if(writex(s,&msg.data,sizeof(msg.data))||writex(s,buffer,r)){
-			close(fd);
-			return -1;
+		if((r=pipe_splice(fd,sc->pipe[1],SYNC_DATA_MAX))==0)return 0;
+		if(r<0)return errno==EINVAL?1:-2;
+		msg.data.size=r,sc->piped=r;
+		if(writex(sc->s,&msg.data,sizeof(msg.data)))return -1;
+		while(sc->piped>0){
+			if((n=pipe_splice(sc->pipe[0],sc->s,sc->piped))>0)sc->piped-=n;
+			else if(n<0&&errno==EINVAL){
+				if(pipe_copy(sc,sc->s,sc->piped))return -1;
+			}else return -1;
 		}
 	}
+}
+static int recv_copy(struct sync*sc,int fd){
+	int r;
+	for(;;){
+		if((r=adb_read(fd,sc->data,SYNC_DATA_MAX))==0)return 0;
+		if(r<0)return -2;
+		if(send_data(sc->s,sc->data,r))return -1;
+	}
+}
+static int do_recv(struct sync*sc,const char*path,unsigned flags){
+	syncmsg msg;
+	int fd,r=1,s=sc->s;
+	if(flags&~SYNC_FLAG_COMPRESS)return fail_message(s,"unsupported recv flags");
+	if((fd=adb_open(path,O_RDONLY))<0){
+		if(fail_errno(s))return -1;
+		return 0;
+	}
+	#ifdef ENABLE_ZSTD
+	if(flags&SYNC_FLAG_ZSTD)r=recv_zstd(sc,fd);
+	#endif
+	// a file that does not take splice goes on with read from where it stopped
+	if(r>0&&sc->pipe[0]>=0)r=recv_splice(sc,fd);
+	if(r>0)r=recv_copy(sc,fd);
 	close(fd);
+	if(r==-2)return fail_errno(s);
+	if(r<0)return -1;
 	msg.data.id=ID_DONE;
 	msg.data.size=0;
 	if(writex(s,&msg.data,sizeof(msg.data)))return -1;
@@ -232,8 +459,13 @@ void file_sync_service(int fd,void*cookie __attribute__((unused))){
 	syncmsg msg;
 	char name[1025];
 	unsigned namelen;
-	char*buffer=malloc(SYNC_DATA_MAX);
-	if(buffer==0)goto fail;
+	struct sync sc;
+	memset(&sc,0,sizeof(sc));
+	sc.s=fd;
+	pipe_open(&sc);
+	sc.data=malloc(SYNC_DATA_MAX);
+	sc.out=malloc(SYNC_OUT_MAX);
+	if(!sc.data||!sc.out)goto fail;
 	for(;;){
 		if(readx(fd,&msg.req,sizeof(msg.req))){
 			fail_message(fd,"command read failure");
@@ -254,14 +486,34 @@ void file_sync_service(int fd,void*cookie __attribute__((unused))){
 		switch(msg.req.id){
 			case ID_STAT:if(do_stat(fd,name))goto fail;break;
 			case ID_LIST:if(do_list(fd,name))goto fail;break;
-			case ID_SEND:if(do_send(fd,name,buffer))goto fail;break;
-			case ID_RECV:if(do_recv(fd,name,buffer))goto fail;break;
+			case ID_SEND:if(do_send_v1(&sc,name))goto fail;break;
+			case ID_RECV:if(do_recv(&sc,name,0))goto fail;break;
+			case ID_SEND_V2:
+				if(readx(fd,&msg.send_v2,sizeof(msg.send_v2))||msg.send_v2.id!=ID_SEND_V2){
+					fail_message(fd,"invalid send v2 setup");
+					goto fail;
+				}
+				if(do_send(&sc,name,msg.send_v2.mode,msg.send_v2.flags))goto fail;
+			break;
+			case ID_RECV_V2:
+				if(readx(fd,&msg.recv_v2,sizeof(msg.recv_v2))||msg.recv_v2.id!=ID_RECV_V2){
+					fail_message(fd,"invalid recv v2 setup");
+					goto fail;
+				}
+				if(do_recv(&sc,name,msg.recv_v2.flags))goto fail;
+			break;
 			case ID_QUIT:goto fail;
 			default:fail_message(fd,"unknown command");goto fail;
 		}
 	}
 fail:
-	if(buffer !=0)free(buffer);
+	if(sc.data)free(sc.data);
+	if(sc.out)free(sc.out);
+	#ifdef ENABLE_ZSTD
+	if(sc.dctx)ZSTD_freeDCtx(sc.dctx);
+	if(sc.cctx)ZSTD_freeCCtx(sc.cctx);
+	#endif
+	pipe_close(&sc);
 	telog_info("sync done");
 	close(fd);
 }
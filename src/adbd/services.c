@@ -7,12 +7,18 @@
  */
 
 #define _GNU_SOURCE
+#include<time.h>
+#include<poll.h>
 #include<errno.h>
 #include<stdio.h>
+#include<signal.h>
+#include<stdint.h>
 #include<stdlib.h>
 #include<string.h>
 #include<unistd.h>
+#include<stdbool.h>
 #include<sys/wait.h>
+#include<sys/ioctl.h>
 #include"str.h"
 #include"shell.h"
 #include"logger.h"
@@ -86,28 +92,56 @@ void reboot_service(int fd,void*arg){
 	done:
 	close(fd);
 }
-static int create_service_thread(void(*func)(int,void*),void*cookie){
+static int run_service_thread(void(*func)(int,void*),int fd,void*cookie){
 	stinfo *sti;
 	pthread_t t;
-	int s[2];
-	if(adb_socketpair(s))
-		return terlog_warn(-1,"cannot create service socket pair");
 	if(!(sti=malloc(sizeof(stinfo)))){
 		telog_error("cannot allocate stinfo");
 		exit(-1);
 	}
 	sti->func=func;
 	sti->cookie=cookie;
-	sti->fd=s[1];
+	sti->fd=fd;
 	if(adb_thread_create(&t,service_bootstrap_func,sti)!=0){
 		free(sti);
+		return terlog_warn(-1,"cannot create service thread");
+	}
+	return 0;
+}
+static int create_service_thread(void(*func)(int,void*),void*cookie){
+	int s[2];
+	if(adb_socketpair(s))
+		return terlog_warn(-1,"cannot create service socket pair");
+	if(run_service_thread(func,s[1],cookie)){
 		close(s[0]);
 		close(s[1]);
-		return terlog_warn(-1,"cannot create service thread");
+		return -1;
 	}
 	return s[0];
 }
-static int create_subprocess(const char *cmd,const char *arg0,const char *arg1,pid_t *pid){
+static void exec_shell(const char*cmd,const char*arg0,const char*arg1,const char*term){
+	char text[64];
+	int fd;
+	snprintf(text,sizeof text,"/proc/%d/oom_score_adj",getpid());
+	if((fd=adb_open(text,O_WRONLY))>=0){
+		adb_write(fd,"0",1);
+		close(fd);
+	}else telog_warn("cannot open %s",text);
+	char*g;
+	if(term)setenv("TERM",term,1);
+	else if(!getenv("TERM"))setenv("TERM","xterm-256color",0);
+	if((g=getenv("HOME"))&&chdir(g)<0)telog_warn("chdir to %s failed",g);
+	char*exe=(char*)cmd,*name=(char*)cmd;
+	#ifdef ENABLE_READLINE
+	if(!cmd||strlen(cmd)==0)exe=_PATH_PROC_SELF"/exe",name="initshell";
+	#else
+	exe="/bin/sh",name="sh";
+	#endif
+	execl(exe,name,arg0,arg1,NULL);
+	if(errno>0)telog_error("exec '%s' failed",name);
+	exit(-1);
+}
+static int create_subprocess(const char *cmd,const char *arg0,const char *arg1,const char*term,pid_t *pid){
 	char *devname;
 	int ptm;
 	if((ptm=adb_open(_PATH_DEV"/ptmx",O_RDWR))<0)
@@ -140,26 +174,40 @@ static int create_subprocess(const char *cmd,const char *arg0,const char *arg1,p
 		dup2(pts,2);
 		close(pts);
 		close(ptm);
-		char text[64];
-		snprintf(text,sizeof text,"/proc/%d/oom_score_adj",getpid());
-		int fd;
-		if((fd=adb_open(text,O_WRONLY))>=0){
-			adb_write(fd,"0",1);
-			close(fd);
-		}else telog_warn("cannot open %s",text);
-		char*g;
-		if(!getenv("TERM"))setenv("TERM","xterm-256color",0);
-		if((g=getenv("HOME"))&&chdir(g)<0)telog_warn("chdir to %s failed",g);
-		char*exe=(char*)cmd,*name=(char*)cmd;
-		#ifdef ENABLE_READLINE
-		if(!cmd||strlen(cmd)==0)exe=_PATH_PROC_SELF"/exe",name="initshell";
-		#else
-		exe="/bin/sh",name="sh";
-		#endif
-		execl(exe,name,arg0,arg1,NULL);
-		if(errno>0)telog_error("exec '%s' failed",name);
-		exit(-1);
-	}else return ptm;
+		exec_shell(cmd,arg0,arg1,term);
+	}
+	return ptm;
+}
+// raw mode for shell v2, stdin stdout and stderr are pipes of their own
+static int create_subprocess_raw(const char *cmd,const char *arg0,const char *arg1,int fds[3],pid_t *pid){
+	int p[3][2];
+	for(int i=0;i<3;i++)p[i][0]=p[i][1]=-1;
+	for(int i=0;i<3;i++)if(pipe2(p[i],O_CLOEXEC)<0){
+		telog_warn("cannot create pipe");
+		goto fail;
+	}
+	if((*pid=fork())<0){
+		telog_warn("fork failed");
+		goto fail;
+	}
+	if(*pid==0){
+		setsid();
+		dup2(p[0][0],0);
+		dup2(p[1][1],1);
+		dup2(p[2][1],2);
+		exec_shell(cmd,arg0,arg1,NULL);
+	}
+	close(p[0][0]);
+	close(p[1][1]);
+	close(p[2][1]);
+	fds[0]=p[0][1],fds[1]=p[1][0],fds[2]=p[2][0];
+	return 0;
+	fail:
+	for(int i=0;i<3;i++){
+		if(p[i][0]>=0)close(p[i][0]);
+		if(p[i][1]>=0)close(p[i][1]);
+	}
+	return -1;
 }
 static void subproc_waiter_service(int fd,void *cookie){
 	pid_t pid=*(pid_t*)cookie;
@@ -178,10 +226,8 @@ static void subproc_waiter_service(int fd,void *cookie){
 		}
 	}
 	telog_debug("shell exited pid %d",pid);
-	if(shell_exit_notify_fd>=0){
-		writex(shell_exit_notify_fd,&fd,sizeof(fd));
-		telog_debug("notified shell exit pid %d",pid);
-	}
+	fdevent_subproc_exit(fd);
+	telog_debug("notified shell exit pid %d",pid);
 }
 static int create_subproc_thread(const char*name){
 	stinfo *sti;
@@ -189,7 +235,7 @@ static int create_subproc_thread(const char*name){
 	int ret_fd;
 	pid_t pid=0;
 	char*shell=adbd_get_shell();
-	ret_fd=name?create_subprocess(shell,"-c",name,&pid):create_subprocess(shell,"-",0,&pid);
+	ret_fd=name?create_subprocess(shell,"-c",name,NULL,&pid):create_subprocess(shell,"-",0,NULL,&pid);
 	if(ret_fd<0||pid<=0)return ret_fd;
 	if(!(sti=malloc(sizeof(stinfo)))){
 		telog_error("cannot allocate stinfo");
@@ -213,30 +259,337 @@ static int create_subproc_thread(const char*name){
 	}
 	return ret_fd;
 }
-static int tcp_svc(char*arg){
+
+/*
+ * shell v2 puts every stream in packets of a one byte id, a little
+ * endian length and the data. a thread per shell moves data between the
+ * adb socket and the child, in raw mode stdout and stderr come from
+ * pipes of their own. output waits SHELL_DELAY ms for more, so a burst
+ * of small writes leaves as one packet. stdin is written without
+ * blocking, the socket is only read again once the child took it all.
+ * the exit code is the last packet before the socket closes.
+ */
+enum shell_id{
+	SHELL_STDIN        =0,
+	SHELL_STDOUT       =1,
+	SHELL_STDERR       =2,
+	SHELL_EXIT         =3,
+	SHELL_CLOSE_STDIN  =4,
+	SHELL_WINDOW_SIZE  =5,
+};
+#define SHELL_HEADER 5
+#define SHELL_BUFFER (32*1024)
+#define SHELL_DELAY  2
+struct shell_out{
+	int fd;
+	uint8_t id;
+	size_t len;
+	uint64_t since;
+	unsigned char buf[SHELL_HEADER+SHELL_BUFFER];
+};
+struct shell_v2{
+	int s,in;
+	bool pty;
+	pid_t pid;
+	struct shell_out out[2];
+	unsigned char input[SHELL_BUFFER];
+	size_t ipos,ilen;
+	unsigned char hdr[SHELL_HEADER];
+	size_t hlen,left;
+	char winsize[64];
+	size_t wlen;
+};
+static uint64_t shell_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+static int shell_send(struct shell_v2*sh,uint8_t id,unsigned char*buf,size_t len){
+	buf[0]=id;
+	buf[1]=len&0xFF,buf[2]=(len>>8)&0xFF;
+	buf[3]=(len>>16)&0xFF,buf[4]=(len>>24)&0xFF;
+	return writex(sh->s,buf,SHELL_HEADER+len);
+}
+static int shell_flush(struct shell_v2*sh,struct shell_out*o){
+	if(o->len<=0)return 0;
+	if(shell_send(sh,o->id,o->buf,o->len))return -1;
+	o->len=0;
+	return 0;
+}
+static void shell_window_size(struct shell_v2*sh){
+	struct winsize ws;
+	memset(&ws,0,sizeof(ws));
+	sh->winsize[sh->wlen]=0;
+	if(sscanf(
+		sh->winsize,"%hux%hu,%hux%hu",
+		&ws.ws_row,&ws.ws_col,&ws.ws_xpixel,&ws.ws_ypixel
+	)!=4)return;
+	if(sh->pty&&ioctl(sh->in,TIOCSWINSZ,&ws)<0)telog_warn("set window size failed");
+}
+static void shell_packet_done(struct shell_v2*sh){
+	switch(sh->hdr[0]){
+		case SHELL_CLOSE_STDIN:
+			// a terminal has no end of its own, the child reads until hangup
+			if(sh->pty||sh->in<0)break;
+			if(sh->pid<=0)shutdown(sh->in,SHUT_WR);
+			close(sh->in),sh->in=-1;
+		break;
+		case SHELL_WINDOW_SIZE:shell_window_size(sh);break;
+		default:;
+	}
+	sh->hlen=0,sh->wlen=0;
+}
+// consume the input buffer, false when stdin is full
+static bool shell_input(struct shell_v2*sh){
+	ssize_t r;
+	size_t n;
+	while(sh->ipos<sh->ilen){
+		if(sh->hlen<SHELL_HEADER){
+			sh->hdr[sh->hlen++]=sh->input[sh->ipos++];
+			if(sh->hlen<SHELL_HEADER)continue;
+			sh->left=sh->hdr[1]|(sh->hdr[2]<<8)|(sh->hdr[3]<<16)|((size_t)sh->hdr[4]<<24);
+			if(sh->left==0)shell_packet_done(sh);
+			continue;
+		}
+		n=MIN(sh->left,sh->ilen-sh->ipos);
+		switch(sh->hdr[0]){
+			case SHELL_STDIN:
+				if(sh->in<0)break;
+				if((r=write(sh->in,sh->input+sh->ipos,n))<0){
+					if(errno==EAGAIN||errno==EINTR)return false;
+					telog_warn("write shell stdin failed");
+					close(sh->in),sh->in=-1;
+					break;
+				}
+				n=r;
+			break;
+			case SHELL_WINDOW_SIZE:
+				memcpy(sh->winsize+sh->wlen,sh->input+sh->ipos,MIN(n,sizeof(sh->winsize)-1-sh->wlen));
+				sh->wlen+=MIN(n,sizeof(sh->winsize)-1-sh->wlen);
+			break;
+			default:;
+		}
+		sh->ipos+=n,sh->left-=n;
+		if(sh->left==0)shell_packet_done(sh);
+	}
+	return true;
+}
+// false when the stream ended
+static bool shell_output(struct shell_v2*sh,struct shell_out*o){
+	ssize_t r;
+	r=read(o->fd,o->buf+SHELL_HEADER+o->len,SHELL_BUFFER-o->len);
+	if(r<0&&(errno==EAGAIN||errno==EINTR))return true;
+	if(r<=0)return false;
+	if(o->len==0)o->since=shell_now();
+	o->len+=r;
+	if(o->len>=SHELL_BUFFER&&shell_flush(sh,o))return false;
+	return true;
+}
+static int shell_exit_code(pid_t pid){
+	int st;
+	if(pid<=0)return 0;
+	while(waitpid(pid,&st,0)<0)if(errno!=EINTR)return -1;
+	if(WIFSIGNALED(st))return 128+WTERMSIG(st);
+	return WIFEXITED(st)?WEXITSTATUS(st):-1;
+}
+static void shell_v2_service(int fd,void*cookie){
+	struct shell_v2*sh=cookie;
+	struct pollfd pfd[4];
+	int n,r,is,ii,io[2],timeout;
+	uint64_t now;
+	bool hangup=false;
+	unsigned char code[SHELL_HEADER+1];
+	sh->s=fd;
+	if(sh->in>=0)fcntl(sh->in,F_SETFL,fcntl(sh->in,F_GETFL)|O_NONBLOCK);
+	while(!hangup&&(sh->out[0].fd>=0||sh->out[1].fd>=0)){
+		n=0,is=ii=-1,timeout=-1,now=shell_now();
+		if(sh->ipos>=sh->ilen)pfd[is=n++]=(struct pollfd){.fd=sh->s,.events=POLLIN};
+		else if(sh->in>=0)pfd[ii=n++]=(struct pollfd){.fd=sh->in,.events=POLLOUT};
+		for(int i=0;i<2;i++){
+			struct shell_out*o=&sh->out[i];
+			io[i]=-1;
+			if(o->fd>=0)pfd[io[i]=n++]=(struct pollfd){.fd=o->fd,.events=POLLIN};
+			if(o->len>0){
+				r=o->since+SHELL_DELAY>now?(int)(o->since+SHELL_DELAY-now):0;
+				if(timeout<0||r<timeout)timeout=r;
+			}
+		}
+		if(poll(pfd,n,timeout)<0&&errno!=EINTR)break;
+		if(is>=0&&pfd[is].revents){
+			if((r=adb_read(sh->s,sh->input,sizeof(sh->input)))<=0)hangup=true;
+			else sh->ipos=0,sh->ilen=r;
+		}
+		if(sh->ipos<sh->ilen)shell_input(sh);
+		now=shell_now();
+		for(int i=0;i<2;i++){
+			struct shell_out*o=&sh->out[i];
+			if(io[i]>=0&&pfd[io[i]].revents&&!shell_output(sh,o)){
+				close(o->fd),o->fd=-1;
+				if(shell_flush(sh,o))hangup=true;
+			}
+			if(o->len>0&&o->since+SHELL_DELAY<=now&&shell_flush(sh,o))hangup=true;
+		}
+	}
+	for(int i=0;i<2;i++)if(sh->out[i].fd>=0)close(sh->out[i].fd);
+	if(sh->in>=0)close(sh->in);
+	if(hangup&&sh->pid>0){
+		telog_debug("shell v2 socket closed, hangup pid %d",sh->pid);
+		kill(sh->pid,SIGHUP);
+	}
+	code[SHELL_HEADER]=(unsigned char)shell_exit_code(sh->pid);
+	telog_debug("shell v2 pid %d exit code %d",sh->pid,code[SHELL_HEADER]);
+	if(!hangup)shell_send(sh,SHELL_EXIT,code,1);
+	close(fd);
+	free(sh);
+}
+static int start_shell_v2(struct shell_v2*sh){
+	int s[2];
+	if(adb_socketpair(s))
+		return terlog_warn(-1,"cannot create shell socket pair");
+	if(run_service_thread(shell_v2_service,s[1],sh)){
+		close(s[0]);
+		close(s[1]);
+		return -1;
+	}
+	return s[0];
+}
+static struct shell_v2*alloc_shell_v2(bool pty){
+	struct shell_v2*sh;
+	if(!(sh=malloc(sizeof(struct shell_v2))))return NULL;
+	memset(sh,0,sizeof(struct shell_v2));
+	sh->pty=pty;
+	sh->out[0].id=SHELL_STDOUT,sh->out[1].id=SHELL_STDERR;
+	return sh;
+}
+static int create_shell_v2(const char*name,bool pty,const char*term){
+	int fds[3],ret;
+	struct shell_v2*sh;
+	char*shell=adbd_get_shell();
+	if(!(sh=alloc_shell_v2(pty)))
+		return terlog_warn(-1,"cannot allocate shell");
+	if(pty){
+		fds[0]=name?
+			create_subprocess(shell,"-c",name,term,&sh->pid):
+			create_subprocess(shell,"-",0,term,&sh->pid);
+		if(fds[0]<0)goto fail;
+		if((fds[1]=dup(fds[0]))<0){
+			close(fds[0]);
+			goto fail_child;
+		}
+		fcntl(fds[1],F_SETFD,FD_CLOEXEC);
+		fds[2]=-1;
+	}else if((name?
+		create_subprocess_raw(shell,"-c",name,fds,&sh->pid):
+		create_subprocess_raw(shell,"-",0,fds,&sh->pid)
+	)<0)goto fail;
+	sh->in=fds[0],sh->out[0].fd=fds[1],sh->out[1].fd=fds[2];
+	if((ret=start_shell_v2(sh))>=0)return ret;
+	for(int i=0;i<3;i++)if(fds[i]>=0)close(fds[i]);
+	fail_child:
+	kill(sh->pid,SIGHUP);
+	shell_exit_code(sh->pid);
+	fail:
+	free(sh);
+	return -1;
+}
+static int tcp_svc(char*arg,char*opts __attribute__((unused))){
 	int ret;
 	int port=parse_int(arg,0);
 	if(strchr(arg,':')!=0)ret=-1;
 	else if((ret=socket_loopback_client(port,SOCK_STREAM))>=0)disable_tcp_nagle(ret);
 	return ret;
 }
-static int tcpip_svc(char*arg){
+static int tcpip_svc(char*arg,char*opts __attribute__((unused))){
 	int port;
 	if((port=parse_int(arg,0))==0)port=0;
 	return create_service_thread(restart_tcp_service,&port);
 }
-static int local_svc(char*arg){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_RESERVED,SOCK_STREAM);}
-static int local_reserved_svc(char*arg){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_RESERVED,SOCK_STREAM);}
-static int local_abstract_svc(char*arg){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_ABSTRACT,SOCK_STREAM);}
-static int local_filesystem_svc(char*arg){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_FILESYSTEM,SOCK_STREAM);}
-static int sync_svc(char*arg __attribute__((unused))){return create_service_thread(file_sync_service,NULL);}
-static int usb_svc(char*arg __attribute__((unused))){return create_service_thread(restart_usb_service,NULL);}
-static int reboot_svc(char*arg){return create_service_thread(reboot_service,arg);}
-static int shell_svc(char*arg){return create_subproc_thread((arg&&*arg)?arg:NULL);}
-static int dev_svc(char*arg){return adb_open(arg,O_RDWR);}
+static int local_svc(char*arg,char*opts __attribute__((unused))){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_RESERVED,SOCK_STREAM);}
+static int local_reserved_svc(char*arg,char*opts __attribute__((unused))){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_RESERVED,SOCK_STREAM);}
+static int local_abstract_svc(char*arg,char*opts __attribute__((unused))){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_ABSTRACT,SOCK_STREAM);}
+static int local_filesystem_svc(char*arg,char*opts __attribute__((unused))){return socket_local_client(arg,ANDROID_SOCKET_NAMESPACE_FILESYSTEM,SOCK_STREAM);}
+static int sync_svc(char*arg __attribute__((unused)),char*opts __attribute__((unused))){return create_service_thread(file_sync_service,NULL);}
+static int usb_svc(char*arg __attribute__((unused)),char*opts __attribute__((unused))){return create_service_thread(restart_usb_service,NULL);}
+static int reboot_svc(char*arg,char*opts __attribute__((unused))){return create_service_thread(reboot_service,arg);}
+
+// commands adbd answers itself, so adb shell adbd-stats works with any host
+static struct adb_builtin{
+	const char*name;
+	void(*func)(int fd,void*args);
+}builtins[]={
+	{"adbd-stats",     stats_service     },
+	{"adbd-speedtest", speedtest_service },
+	{NULL,NULL}
+};
+static struct adb_builtin*find_builtin(const char*cmd){
+	size_t len;
+	if(!cmd)return NULL;
+	for(int i=0;builtins[i].name;i++){
+		len=strlen(builtins[i].name);
+		if(strncmp(cmd,builtins[i].name,len)!=0)continue;
+		if(cmd[len]&&cmd[len]!=' ')continue;
+		return &builtins[i];
+	}
+	return NULL;
+}
+static int create_builtin(struct adb_builtin*b,const char*cmd,bool v2){
+	int s[2];
+	struct shell_v2*sh=NULL;
+	char*args=NULL;
+	if(cmd[strlen(b->name)]&&!(args=strdup(cmd+strlen(b->name)+1)))
+		return terlog_warn(-1,"cannot allocate arguments");
+	if(!v2)return create_service_thread(b->func,args);
+
+	// shell v2 frames the stream of the builtin as stdout of a child
+	if(!(sh=alloc_shell_v2(false))||adb_socketpair(s)){
+		telog_warn("cannot create builtin %s",b->name);
+		goto fail;
+	}
+	sh->out[0].fd=s[0],sh->out[1].fd=-1;
+	if((sh->in=dup(s[0]))<0||run_service_thread(b->func,s[1],args)){
+		if(sh->in>=0)close(sh->in);
+		close(s[0]);
+		close(s[1]);
+		goto fail;
+	}
+	fcntl(sh->in,F_SETFD,FD_CLOEXEC);
+	if((s[1]=start_shell_v2(sh))>=0)return s[1];
+	close(sh->in);
+	close(s[0]);
+	free(sh);
+	return -1;
+	fail:
+	if(sh)free(sh);
+	if(args)free(args);
+	return -1;
+}
+// options are shell,v2,TERM=xterm,pty:command, a command defaults to raw
+static int shell_svc(char*arg,char*opts){
+	struct adb_builtin*b;
+	char*o,*term=NULL;
+	bool v2=false,pty=!arg||!*arg;
+	if(opts)while((o=strsep(&opts,","))){
+		if(strcmp(o,"v2")==0)v2=true;
+		else if(strcmp(o,"pty")==0)pty=true;
+		else if(strcmp(o,"raw")==0)pty=false;
+		else if(strncmp(o,"TERM=",5)==0)term=o+5;
+	}
+	if((b=find_builtin(arg)))return create_builtin(b,arg,v2);
+	if(!v2)return create_subproc_thread((arg&&*arg)?arg:NULL);
+	return create_shell_v2((arg&&*arg)?arg:NULL,pty,term);
+}
+static int stats_svc(char*arg __attribute__((unused)),char*opts __attribute__((unused))){
+	return create_service_thread(stats_service,NULL);
+}
+static int speedtest_svc(char*arg,char*opts __attribute__((unused))){
+	char*args=NULL;
+	if(arg&&*arg&&!(args=strdup(arg)))return -1;
+	return create_service_thread(speedtest_service,args);
+}
+static int dev_svc(char*arg,char*opts __attribute__((unused))){return adb_open(arg,O_RDWR);}
 static struct adb_service{
 	char name[128];
-	int(*handle)(char*);
+	int(*handle)(char*,char*);
 }services[]={
 	{"tcp",             &tcp_svc              },
 	{"tcpip",           &tcpip_svc            },
@@ -248,19 +601,22 @@ static struct adb_service{
 	{"shell",           &shell_svc            },
 	{"sync",            &sync_svc             },
 	{"reboot",          &reboot_svc           },
+	{"stats",           &stats_svc            },
+	{"speedtest",       &speedtest_svc        },
 	{"usb",             &usb_svc              },
 	{}
 };
 int service_to_fd(const char *value){
-	char*val,*arg,*name;
+	char*val,*arg,*name,*opts;
 	tlog_debug("request service %s",value);
 	if(!(val=strdup(value)))
 		return terlog_warn(-1,"cannot allocate name");
 	if((arg=strchr(val,':')))*arg++=0;
+	if((opts=strchr(val,',')))*opts++=0;
 	name=val;
 	for(int i=0;services[i].handle;i++){
 		if(strcmp(services[i].name,name)!=0)continue;
-		int ret=services[i].handle(arg);
+		int ret=services[i].handle(arg,opts);
 		if(ret>=0)fcntl(ret,F_SETFD,FD_CLOEXEC);
 		free(val);
 		return ret;
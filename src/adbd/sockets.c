@@ -35,6 +35,22 @@ asocket*find_local_socket(unsigned id){
 	pthread_mutex_unlock(&socket_list_lock);
 	return result;
 }
+void dump_sockets(int fd){
+	asocket*s;
+	apacket*p;
+	unsigned queued;
+	pthread_mutex_lock(&socket_list_lock);
+	for(s=local_socket_list.next;s!=&local_socket_list;s=s->next){
+		for(queued=0,p=s->pkt_first;p;p=p->next)queued++;
+		dprintf(
+			fd,"socket %u fd %d peer %u: rx %llu bytes, tx %llu bytes, %u queued\n",
+			s->id,s->fd,s->peer?s->peer->id:0,
+			(unsigned long long)s->rx_bytes,
+			(unsigned long long)s->tx_bytes,queued
+		);
+	}
+	pthread_mutex_unlock(&socket_list_lock);
+}
 static void insert_local_socket(asocket*s,asocket*list){
 	s->next=list;
 	s->prev=s->next->prev;
@@ -67,6 +83,7 @@ restart:
 }
 static int local_socket_enqueue(asocket*s,apacket*p){
 	p->ptr=p->data;
+	STAT_ADD(s->rx_bytes,p->len);
 	if(s->pkt_first)goto enqueue;
 	while(p->len>0){
 		int r=adb_write(s->fd,p->ptr,p->len);
@@ -78,7 +95,7 @@ static int local_socket_enqueue(asocket*s,apacket*p){
 		if((r==0)||(errno!=EAGAIN)){s->close(s);return 1;}else break;
 	}
 	if(p->len==0){
-		free(p);
+		put_apacket(p);
 		return 0;
 	}
 enqueue:
@@ -101,7 +118,7 @@ static void local_socket_destroy(asocket*s){
 	fdevent_remove(&s->fde);
 	for(p=s->pkt_first;p;p=n){
 		n=p->next;
-		free(p);
+		put_apacket(p);
 	}
 	remove_socket(s);
 	free(s);
@@ -144,7 +161,7 @@ static void local_socket_event_func(int fd,unsigned ev,void*_s){
 			if(p->len==0){
 				s->pkt_first=p->next;
 				if(s->pkt_first==0)s->pkt_last=0;
-				free(p);
+				put_apacket(p);
 			}
 		}
 		if(s->closing){s->close(s);return;}
@@ -152,9 +169,12 @@ static void local_socket_event_func(int fd,unsigned ev,void*_s){
 		s->peer->ready(s->peer);
 	}
 	if(ev&FDE_READ){
-		apacket*p=get_apacket();
+		// as much as the transport takes in one packet
+		size_t max=s->peer&&s->peer->transport?
+			s->peer->transport->max_payload:MAX_PAYLOAD_V1;
+		apacket*p=get_apacket_size(max);
 		unsigned char*x=p->data;
-		size_t avail=MAX_PAYLOAD;
+		size_t avail=max;
 		int r,is_eof=0;
 		while(avail>0){
 			r=adb_read(fd,x,avail);
@@ -168,9 +188,10 @@ static void local_socket_event_func(int fd,unsigned ev,void*_s){
 			is_eof=1;
 			break;
 		}
-		if((avail==MAX_PAYLOAD)||(s->peer==0))free(p);
+		if((avail==max)||(s->peer==0))put_apacket(p);
 		else{
-			p->len=MAX_PAYLOAD-avail;
+			p->len=max-avail;
+			STAT_ADD(s->tx_bytes,p->len);
 			r=s->peer->enqueue(s->peer,p);
 			if(r<0)return;
 			else if(r>0)fdevent_del(&s->fde,FDE_READ);
@@ -256,7 +277,7 @@ asocket*create_remote_socket(unsigned id,atransport*t){
 void connect_to_remote(asocket*s,const char*destination){
 	apacket*p=get_apacket();
 	int len=strlen(destination)+ 1;
-	if(len>(MAX_PAYLOAD-1)){
+	if(len>(int)p->size-1){
 		tlog_error("destination oversized");
 		exit(-1);
 	}
@@ -319,13 +340,13 @@ static int smart_socket_enqueue(asocket*s,apacket*p){
 		s->pkt_first=p;
 		s->pkt_last=p;
 	}else{
-		if((s->pkt_first->len + p->len)>MAX_PAYLOAD){
-			free(p);
+		if((s->pkt_first->len + p->len)>=s->pkt_first->size){
+			put_apacket(p);
 			goto fail;
 		}
 		memcpy(s->pkt_first->data + s->pkt_first->len,p->data,p->len);
 		s->pkt_first->len +=p->len;
-		free(p);
+		put_apacket(p);
 		p=s->pkt_first;
 	}
 	if(p->len<4)return 0;
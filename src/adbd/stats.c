@@ -0,0 +1,115 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<poll.h>
+#include<errno.h>
+#include<stdio.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<strings.h>
+#include<stdbool.h>
+#include"logger.h"
+#include"defines.h"
+#include"adbd_internal.h"
+#define TAG "adbd"
+
+/*
+ * both services run on a thread of their own with the stream of the
+ * host as fd. stats prints a snapshot of the counters, the packet pools
+ * and the usb queues. speedtest sends zeros and eats everything the host
+ * sends, "[down|up|both] [MiB]", the default is both ways with 64 MiB.
+ * a summary line follows the data sent, so the host can take it from the
+ * end of the stream.
+ */
+#define SPEEDTEST_DEFAULT 64
+#define SPEEDTEST_CHUNK   (64*1024)
+
+void stats_service(int fd,void*cookie){
+	if(cookie)free(cookie);
+	dump_transports(fd);
+	dump_sockets(fd);
+	dump_packet_pools(fd);
+	dump_usb(fd);
+	close(fd);
+}
+
+static uint64_t speedtest_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+static unsigned speedtest_rate(uint64_t bytes,uint64_t ms){
+	return ms>0?(unsigned)(bytes*1000/ms/(1024*1024)):0;
+}
+
+void speedtest_service(int fd,void*cookie){
+	char*args=cookie,*arg,*p=args;
+	bool down=true,up=true;
+	uint64_t size=SPEEDTEST_DEFAULT,sent=0,recv=0,start,time;
+	char*buf;
+	ssize_t r;
+	struct pollfd pfd;
+	if(p)while((arg=strsep(&p," ,:"))){
+		if(!*arg)continue;
+		if(strcasecmp(arg,"down")==0)down=true,up=false;
+		else if(strcasecmp(arg,"up")==0)down=false,up=true;
+		else if(strcasecmp(arg,"both")==0)down=true,up=true;
+		else if((size=strtoull(arg,NULL,0))<=0)size=SPEEDTEST_DEFAULT;
+	}
+	if(args)free(args);
+	size*=1024*1024;
+	if(!(buf=calloc(1,SPEEDTEST_CHUNK))){
+		close(fd);
+		return;
+	}
+	tlog_info(
+		"speedtest %s %llu MiB",
+		down&&up?"both":down?"down":"up",
+		(unsigned long long)size/(1024*1024)
+	);
+	start=speedtest_now();
+	while((down&&sent<size)||(up&&recv<size)){
+		pfd.fd=fd,pfd.revents=0;
+		pfd.events=(down&&sent<size?POLLOUT:0)|(up&&recv<size?POLLIN:0);
+		if(poll(&pfd,1,-1)<0){
+			if(errno==EINTR)continue;
+			break;
+		}
+		if(pfd.revents&POLLIN){
+			if((r=read(fd,buf,SPEEDTEST_CHUNK))<=0)break;
+			recv+=r;
+			memset(buf,0,r);
+		}
+		if(pfd.revents&POLLOUT){
+			if((r=write(fd,buf,MIN(size-sent,SPEEDTEST_CHUNK)))<=0)break;
+			sent+=r;
+		}
+		if(pfd.revents&(POLLHUP|POLLERR)&&!(pfd.revents&POLLIN))break;
+	}
+	time=speedtest_now()-start;
+	if(time<=0)time=1;
+	tlog_info(
+		"speedtest sent %llu bytes (%u MiB/s) received %llu bytes (%u MiB/s) in %llu ms",
+		(unsigned long long)sent,speedtest_rate(sent,time),
+		(unsigned long long)recv,speedtest_rate(recv,time),
+		(unsigned long long)time
+	);
+	dprintf(
+		fd,"\nspeedtest: sent %llu bytes (%u MiB/s), received %llu bytes (%u MiB/s), %llu ms\n",
+		(unsigned long long)sent,speedtest_rate(sent,time),
+		(unsigned long long)recv,speedtest_rate(recv,time),
+		(unsigned long long)time
+	);
+	free(buf);
+	close(fd);
+}
@@ -10,13 +10,18 @@
 #include<unistd.h>
 #include<string.h>
 #include<errno.h>
+#include<stdint.h>
 #include<sys/types.h>
+#include<arpa/inet.h>
 #include"logger.h"
 #include"adbd_internal.h"
+#include"metrics.h"
 #define TAG "adbd"
 static void transport_unref(atransport*t);
 static atransport transport_list={.next=&transport_list,.prev=&transport_list,};
 pthread_mutex_t transport_lock=PTHREAD_MUTEX_INITIALIZER;
+METRIC_COUNTER(m_rx,"adbd_rx_bytes_total","bytes adbd received from hosts");
+METRIC_COUNTER(m_tx,"adbd_tx_bytes_total","bytes adbd sent to hosts");
 void kick_transport(atransport*t){
 	if(t&&!t->kicked){
 		int kicked;
@@ -82,10 +87,17 @@ void send_packet(apacket*p,atransport*t){
 	unsigned char*x;
 	unsigned sum,count;
 	p->msg.magic=p->msg.command^0xffffffff;
-	count=p->msg.data_length;
-	x=(unsigned char*)p->data;
 	sum=0;
-	while(count-->0)sum+=*x++;
+
+	// v2 peers ignore the checksum, connect and auth keep it for older ones
+	if(
+		t->protocol_version<A_VERSION_SKIP_CHECKSUM||
+		p->msg.command==A_CNXN||p->msg.command==A_AUTH
+	){
+		count=p->msg.data_length;
+		x=(unsigned char*)p->data;
+		while(count-->0)sum+=*x++;
+	}
 	p->msg.data_check=sum;
 	if(write_packet(t->transport_socket,t->serial,&p)){
 		telog_error("cannot enqueue packet on transport socket");
@@ -101,17 +113,20 @@ static void*output_thread(void*_t){
 	p->msg.arg1=++(t->sync_token);
 	p->msg.magic=A_SYNC ^ 0xffffffff;
 	if(write_packet(t->fd,t->serial,&p)){
-		free(p);
+		put_apacket(p);
 		goto oops;
 	}
 	for(;;){
-		if(t->read_from_remote((p=get_apacket()),t)==0){
+		if(t->read_from_remote((p=get_apacket_size(t->max_payload)),t)==0){
+			STAT_ADD(t->rx_packets,1);
+			STAT_ADD(t->rx_bytes,sizeof(amessage)+p->msg.data_length);
+			metric_add(&m_rx,sizeof(amessage)+p->msg.data_length);
 			if(write_packet(t->fd,t->serial,&p)){
-				free(p);
+				put_apacket(p);
 				goto oops;
 			}
 		}else{
-			free(p);
+			put_apacket(p);
 			break;
 		}
 	}
@@ -120,7 +135,7 @@ static void*output_thread(void*_t){
 	p->msg.arg0=0;
 	p->msg.arg1=0;
 	p->msg.magic=A_SYNC ^ 0xffffffff;
-	if(write_packet(t->fd,t->serial,&p))free(p);
+	if(write_packet(t->fd,t->serial,&p))put_apacket(p);
 oops:
 	kick_transport(t);
 	transport_unref(t);
@@ -134,11 +149,15 @@ static void*input_thread(void*_t){
 		if(read_packet(t->fd,t->serial,&p))break;
 		if(p->msg.command==A_SYNC){
 			if(p->msg.arg0==0){
-				free(p);
+				put_apacket(p);
 				break;
 			}else if(p->msg.arg1==t->sync_token)active=1;
-		}else if(active)t->write_to_remote(p,t);
-		free(p);
+		}else if(active&&t->write_to_remote(p,t)==0){
+			STAT_ADD(t->tx_packets,1);
+			STAT_ADD(t->tx_bytes,sizeof(amessage)+p->msg.data_length);
+			metric_add(&m_tx,sizeof(amessage)+p->msg.data_length);
+		}
+		put_apacket(p);
 	}
 	close_all_sockets(t);
 	kick_transport(t);
@@ -245,6 +264,8 @@ void init_transport_registration(void){
 }
 static void register_transport(atransport*transport){
 	tmsg m;
+	transport->protocol_version=A_VERSION_MIN;
+	transport->max_payload=MAX_PAYLOAD_V1;
 	m.transport=transport;
 	m.action=1;
 	if(transport_write_action(transport_registration_send,&m)!=0){
@@ -414,6 +435,31 @@ void unregister_usb_transport(usb_handle*usb){
 	}
 	pthread_mutex_unlock(&transport_lock);
 }
+void dump_transports(int fd){
+	atransport*t;
+	struct tcp_info ti;
+	socklen_t len;
+	pthread_mutex_lock(&transport_lock);
+	for(t=transport_list.next;t!=&transport_list;t=t->next){
+		dprintf(
+			fd,"transport %s (%s) state %d version %08x payload %zu\n",
+			t->serial?t->serial:"unknown",
+			t->type==kTransportUsb?"usb":"tcp",
+			t->connection_state,t->protocol_version,t->max_payload
+		);
+		dprintf(
+			fd,"  rx %llu bytes %llu packets, tx %llu bytes %llu packets\n",
+			(unsigned long long)t->rx_bytes,(unsigned long long)t->rx_packets,
+			(unsigned long long)t->tx_bytes,(unsigned long long)t->tx_packets
+		);
+		len=sizeof(ti);
+		if(t->type==kTransportLocal&&t->sfd>=0&&getsockopt(t->sfd,IPPROTO_TCP,TCP_INFO,&ti,&len)==0)dprintf(
+			fd,"  tcp rtt %uus retransmits %u lost %u\n",
+			ti.tcpi_rtt,ti.tcpi_total_retrans,ti.tcpi_lost
+		);
+	}
+	pthread_mutex_unlock(&transport_lock);
+}
 int readx(int fd,void*ptr,size_t len){
 	char*p=ptr;
 	int r;
@@ -438,12 +484,13 @@ int writex(int fd,const void*ptr,size_t len){
 }
 int check_header(apacket*p){
 	if(p->msg.magic!=(p->msg.command^0xffffffff))return -1;
-	if(p->msg.data_length>MAX_PAYLOAD)return -1;
+	if(p->msg.data_length>p->size)return -1;
 	return 0;
 }
-int check_data(apacket*p){
+int check_data(apacket*p,atransport*t){
 	unsigned count,sum;
 	unsigned char*x;
+	if(t->protocol_version>=A_VERSION_SKIP_CHECKSUM)return 0;
 	count=p->msg.data_length;
 	x=p->data;
 	sum=0;
@@ -454,7 +501,7 @@ static int local_remote_read(apacket*p,atransport*t){
 	if(readx(t->sfd,&p->msg,sizeof(amessage)))return -1;
 	if(check_header(p))return -1;
 	if(readx(t->sfd,p->data,p->msg.data_length))return -1;
-	if(check_data(p))return -1;
+	if(check_data(p,t))return -1;
 	return 0;
 }
 static int local_remote_write(apacket *p,atransport *t){
@@ -469,18 +516,30 @@ int local_connect_arbitrary_ports(int console_port,int adb_port){
 	if(fd<0)fd=socket_loopback_client(adb_port,SOCK_STREAM);
 	if(fd>=0){
 		fcntl(fd,F_SETFD,FD_CLOEXEC);
-		disable_tcp_nagle(fd);
+		tune_tcp_socket(fd);
 		snprintf(buf,sizeof buf,"%s%d",LOCAL_CLIENT_PREFIX,console_port);
 		register_socket_transport(fd,buf,adb_port,1);
 		return 0;
 	}
 	return -1;
 }
+// every host gets a serial of its own, so concurrent connections stay apart
+static void peer_serial(struct sockaddr_storage*addr,char*buf,size_t len){
+	char ip[INET6_ADDRSTRLEN];
+	struct sockaddr_in*in=(struct sockaddr_in*)addr;
+	struct sockaddr_in6*in6=(struct sockaddr_in6*)addr;
+	if(addr->ss_family==AF_INET&&inet_ntop(AF_INET,&in->sin_addr,ip,sizeof(ip)))
+		snprintf(buf,len,"host-%s:%d",ip,ntohs(in->sin_port));
+	else if(addr->ss_family==AF_INET6&&inet_ntop(AF_INET6,&in6->sin6_addr,ip,sizeof(ip)))
+		snprintf(buf,len,"host-[%s]:%d",ip,ntohs(in6->sin6_port));
+	else snprintf(buf,len,"host");
+}
 static _Noreturn void*server_socket_thread(void*arg){
 	int serverfd,fd;
-	struct sockaddr addr;
+	struct sockaddr_storage addr;
 	socklen_t alen;
-	int port=*(int*)arg;
+	char serial[INET6_ADDRSTRLEN+16];
+	int port=(int)(intptr_t)arg;
 	serverfd=-1;
 	for(;;){
 		if(serverfd==-1){
@@ -492,16 +551,17 @@ static _Noreturn void*server_socket_thread(void*arg){
 			adbd_send_ok();
 		}
 		alen=sizeof(addr);
-		if((fd=adb_socket_accept(serverfd,&addr,&alen))>=0){
+		if((fd=adb_socket_accept(serverfd,(struct sockaddr*)&addr,&alen))>=0){
 			fcntl(fd,F_SETFD,FD_CLOEXEC);
-			disable_tcp_nagle(fd);
-			register_socket_transport(fd,"host",port,1);
+			tune_tcp_socket(fd);
+			peer_serial(&addr,serial,sizeof(serial));
+			register_socket_transport(fd,serial,port,1);
 		}
 	}
 }
 void local_init(int port){
 	pthread_t thr;
-	if(adb_thread_create(&thr,server_socket_thread,&port)!=0){
+	if(adb_thread_create(&thr,server_socket_thread,(void*)(intptr_t)port)!=0){
 		telog_error("cannot create local socket server thread");
 		exit(-1);
 	}
@@ -535,14 +595,14 @@ static int usb_remote_read(apacket*p,atransport*t){
 	if(usb_read(t->usb,&p->msg,sizeof(amessage)))return -1;
 	if(check_header(p))return -1;
 	if(p->msg.data_length&&usb_read(t->usb,p->data,p->msg.data_length))return -1;
-	if(check_data(p))return -1;
+	if(check_data(p,t))return -1;
 	return 0;
 }
 static int usb_remote_write(apacket*p,atransport*t){
 	unsigned size=p->msg.data_length;
 	if(usb_write(t->usb,&p->msg,sizeof(amessage)))return -1;
 	if(p->msg.data_length==0)return 0;
-	if(usb_write(t->usb,&p->data,size))return -1;
+	if(usb_write(t->usb,p->data,size))return -1;
 	return 0;
 }
 static void usb_remote_close(atransport*t){usb_close(t->usb);t->usb=0;}
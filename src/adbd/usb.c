@@ -9,9 +9,11 @@
 #include<stdlib.h>
 #include<unistd.h>
 #include<string.h>
+#include<linux/aio_abi.h>
 #include<linux/usb/ch9.h>
 #include<sys/ioctl.h>
 #include<sys/types.h>
+#include<sys/syscall.h>
 #include<errno.h>
 #include"logger.h"
 #include"defines.h"
@@ -20,6 +22,31 @@
 #define ADB_CLASS 0xff
 #define ADB_SUBCLASS 0x42
 #define ADB_PROTOCOL 0x01
+
+// large payloads go to functionfs in pieces the kernel can allocate
+#define USB_FFS_MAX_IO (64*1024)
+#define USB_FFS_AIO_NUM 8
+
+/*
+ * each direction keeps a ring of transfers in flight, so the controller
+ * always has the next one queued. writes are copied into a free slot
+ * and submitted, only a full ring waits for the oldest, an error shows
+ * up on a later write. reads are submitted ahead and give a byte stream,
+ * a transfer ends at a short packet so every completion is whole data.
+ * transfers finish in queue order. without kernel aio the blocking loops
+ * are used.
+ */
+struct usb_aio{
+	aio_context_t ctx;
+	struct iocb cb[USB_FFS_AIO_NUM];
+	long res[USB_FFS_AIO_NUM];
+	bool busy[USB_FFS_AIO_NUM];
+	char*buf;
+	unsigned head,cnt,peak;
+	size_t off;
+	int err;
+	uint64_t submitted;
+};
 struct usb_handle{
 	char*path;
 	pthread_cond_t notify;
@@ -28,6 +55,8 @@ struct usb_handle{
 	int (*read)(usb_handle*h,void*data,int len);
 	void (*kick)(usb_handle*h);
 	int fd,control,bulk_out,bulk_in;
+	bool aio;
+	struct usb_aio rx,tx;
 };
 static const struct{
 	struct usb_functionfs_descs_head header;
@@ -114,6 +143,128 @@ static const struct{
 		STR_INTERFACE_,
 	},
 };
+static int bulk_write(int bulk_in,const char*buf,size_t length){
+	size_t count=0;
+	int ret;
+	do{
+		if((ret=adb_write(bulk_in,buf+count,MIN(length-count,USB_FFS_MAX_IO)))>=0)count+=ret;
+		else if(errno!=EINTR)return terlog_warn(
+			-1,"bulk write failed fd %d length %ld count %ld",
+			bulk_in,length,count
+		);
+	}while(count<length);
+	return count;
+}
+static int usb_ffs_write(usb_handle*h,const void*data,int len){
+	int n;
+	if((n=bulk_write(h->bulk_in,data,len))==len)return 0;
+	telog_warn("usb ffs fd %d write %d",h->bulk_out,n);
+	return -1;
+}
+static int bulk_read(int bulk_out,char*buf,size_t length){
+	size_t count=0;
+	int ret;
+	do{
+		if((ret=adb_read(bulk_out,buf+count,MIN(length-count,USB_FFS_MAX_IO)))>=0)count+=ret;
+		else if(errno!=EINTR)return terlog_warn(
+			-1,"bulk read failed fd %d length %ld count %ld",
+			bulk_out,length,count
+		);
+	}while(count<length);
+	return count;
+}
+static int usb_ffs_read(usb_handle*h,void*data,int len){
+	int n;
+	if((n=bulk_read(h->bulk_out,data,len))==len)return 0;
+	telog_warn("usb ffs fd %d read %d",h->bulk_out,n);
+	return -1;
+}
+static inline long sys_io_setup(unsigned nr,aio_context_t*ctx){return syscall(__NR_io_setup,nr,ctx);}
+static inline long sys_io_destroy(aio_context_t ctx){return syscall(__NR_io_destroy,ctx);}
+static inline long sys_io_submit(aio_context_t ctx,long nr,struct iocb**cbp){return syscall(__NR_io_submit,ctx,nr,cbp);}
+static inline long sys_io_getevents(aio_context_t ctx,long min,long max,struct io_event*ev){
+	return syscall(__NR_io_getevents,ctx,min,max,ev,NULL);
+}
+static bool aio_init(struct usb_aio*a){
+	if(!a->buf&&!(a->buf=malloc(USB_FFS_AIO_NUM*USB_FFS_MAX_IO)))return false;
+	memset(a->cb,0,sizeof(a->cb));
+	memset(a->busy,0,sizeof(a->busy));
+	a->ctx=0,a->head=0,a->cnt=0,a->off=0,a->err=0;
+	if(sys_io_setup(USB_FFS_AIO_NUM,&a->ctx)<0){
+		a->ctx=0;
+		return false;
+	}
+	return true;
+}
+static void aio_exit(struct usb_aio*a){
+	if(a->ctx)sys_io_destroy(a->ctx);
+	a->ctx=0,a->cnt=0;
+}
+static int aio_submit(struct usb_aio*a,int fd,unsigned cmd,size_t len){
+	unsigned slot=(a->head+a->cnt)%USB_FFS_AIO_NUM;
+	struct iocb*cb=&a->cb[slot];
+	memset(cb,0,sizeof(struct iocb));
+	cb->aio_data=slot;
+	cb->aio_fildes=fd;
+	cb->aio_lio_opcode=cmd;
+	cb->aio_buf=(uintptr_t)(a->buf+slot*USB_FFS_MAX_IO);
+	cb->aio_nbytes=len;
+	if(sys_io_submit(a->ctx,1,&cb)!=1)
+		return terlog_warn(-1,"usb ffs fd %d submit failed",fd);
+	a->busy[slot]=true,a->res[slot]=0,a->cnt++;
+	a->submitted++;
+	if(a->cnt>a->peak)a->peak=a->cnt;
+	return 0;
+}
+static int aio_wait(struct usb_aio*a){
+	long r;
+	struct io_event ev;
+	do{r=sys_io_getevents(a->ctx,1,1,&ev);}while(r<0&&errno==EINTR);
+	if(r!=1)return terlog_warn(-1,"usb ffs wait transfer failed");
+	a->busy[ev.data]=false,a->res[ev.data]=ev.res;
+	return 0;
+}
+static int usb_ffs_aio_write(usb_handle*h,const void*data,int len){
+	struct usb_aio*a=&h->tx;
+	size_t n;
+	while(len>0){
+		if(a->cnt>=USB_FFS_AIO_NUM){
+			while(a->busy[a->head])if(aio_wait(a)<0)return -1;
+			if(a->res[a->head]!=(long)a->cb[a->head].aio_nbytes)a->err=1;
+			a->head=(a->head+1)%USB_FFS_AIO_NUM,a->cnt--;
+		}
+		if(a->err){
+			telog_warn("usb ffs fd %d write failed",h->bulk_in);
+			return -1;
+		}
+		n=MIN((size_t)len,USB_FFS_MAX_IO);
+		memcpy(a->buf+((a->head+a->cnt)%USB_FFS_AIO_NUM)*USB_FFS_MAX_IO,data,n);
+		if(aio_submit(a,h->bulk_in,IOCB_CMD_PWRITE,n)<0)return -1;
+		data=(const char*)data+n,len-=n;
+	}
+	return 0;
+}
+static int usb_ffs_aio_read(usb_handle*h,void*data,int len){
+	struct usb_aio*a=&h->rx;
+	size_t n;
+	while(len>0){
+		while(a->cnt<USB_FFS_AIO_NUM)
+			if(aio_submit(a,h->bulk_out,IOCB_CMD_PREAD,USB_FFS_MAX_IO)<0)return -1;
+		while(a->busy[a->head])if(aio_wait(a)<0)return -1;
+		if(a->res[a->head]<0){
+			errno=-a->res[a->head];
+			return terlog_warn(-1,"usb ffs fd %d read failed",h->bulk_out);
+		}
+		n=MIN((size_t)len,a->res[a->head]-a->off);
+		memcpy(data,a->buf+a->head*USB_FFS_MAX_IO+a->off,n);
+		data=(char*)data+n,len-=n,a->off+=n;
+		if(a->off>=(size_t)a->res[a->head]){
+			a->head=(a->head+1)%USB_FFS_AIO_NUM;
+			a->cnt--,a->off=0;
+		}
+	}
+	return 0;
+}
 static void init_functionfs(struct usb_handle*h){
 	char ep0[PATH_MAX]={0},out[PATH_MAX]={0},in[PATH_MAX]={0};
 	snprintf(ep0,sizeof(ep0)-1,"%s/ep0",h->path);
@@ -139,6 +290,16 @@ static void init_functionfs(struct usb_handle*h){
 		telog_error("%s cannot open bulk-in ep",h->path);
 		goto err;
 	}
+	if((h->aio=aio_init(&h->rx)&&aio_init(&h->tx))){
+		h->write=usb_ffs_aio_write;
+		h->read=usb_ffs_aio_read;
+	}else{
+		tlog_notice("%s no kernel aio, use blocking transfers",h->path);
+		aio_exit(&h->rx);
+		aio_exit(&h->tx);
+		h->write=usb_ffs_write;
+		h->read=usb_ffs_read;
+	}
 	return;
 err:
 	if(h->bulk_in>0)close(h->bulk_in);
@@ -161,47 +322,18 @@ static _Noreturn void*usb_ffs_open_thread(void*x){
 		register_usb_transport(usb,0,0,1);
 	}
 }
-static int bulk_write(int bulk_in,const char*buf,size_t length){
-	size_t count=0;
-	int ret;
-	do{
-		if((ret=adb_write(bulk_in,buf+count,length-count))>=0)count+=ret;
-		else if(errno!=EINTR)return terlog_warn(
-			-1,"bulk write failed fd %d length %ld count %ld",
-			bulk_in,length,count
-		);
-	}while(count<length);
-	return count;
-}
-static int usb_ffs_write(usb_handle*h,const void*data,int len){
-	int n;
-	if((n=bulk_write(h->bulk_in,data,len))==len)return 0;
-	telog_warn("usb ffs fd %d write %d",h->bulk_out,n);
-	return -1;
-}
-static int bulk_read(int bulk_out,char*buf,size_t length){
-	size_t count=0;
-	int ret;
-	do{
-		if((ret=adb_read(bulk_out,buf+count,length-count))>=0)count+=ret;
-		else if(errno!=EINTR)return terlog_warn(
-			-1,"bulk read failed fd %d length %ld count %ld",
-			bulk_out,length,count
-		);
-	}while(count<length);
-	return count;
-}
-static int usb_ffs_read(usb_handle*h,void*data,int len){
-	int n;
-	if((n=bulk_read(h->bulk_out,data,len))==len)return 0;
-	telog_warn("usb ffs fd %d read %d",h->bulk_out,n);
-	return -1;
-}
 static void usb_ffs_kick(usb_handle*h){
 	if(ioctl(h->bulk_in,FUNCTIONFS_CLEAR_HALT)<0)
 		telog_warn("usb ffs kick source fd %d clear halt failed",h->bulk_in);
 	if(ioctl(h->bulk_out,FUNCTIONFS_CLEAR_HALT)<0)
 		telog_warn("usb ffs kick sink fd %d clear halt failed",h->bulk_out);
+
+	// cancels the transfers in flight and wakes up their waiters
+	if(h->aio){
+		aio_exit(&h->rx);
+		aio_exit(&h->tx);
+		h->aio=false;
+	}
 	pthread_mutex_lock(&h->lock);
 	close(h->control);
 	close(h->bulk_out);
@@ -210,6 +342,21 @@ static void usb_ffs_kick(usb_handle*h){
 	pthread_cond_signal(&h->notify);
 	pthread_mutex_unlock(&h->lock);
 }
+static usb_handle*usb_handles=NULL;
+void dump_usb(int fd){
+	usb_handle*h=usb_handles;
+	if(!h)return;
+	dprintf(fd,"usb %s: %s\n",h->path,h->aio?"aio":"blocking");
+	if(!h->aio)return;
+	dprintf(
+		fd,"  rx %u in flight (peak %u) %llu submitted\n",
+		h->rx.cnt,h->rx.peak,(unsigned long long)h->rx.submitted
+	);
+	dprintf(
+		fd,"  tx %u in flight (peak %u) %llu submitted\n",
+		h->tx.cnt,h->tx.peak,(unsigned long long)h->tx.submitted
+	);
+}
 void usb_init(char*path){
 	usb_handle*h;
 	pthread_t tid;
@@ -224,6 +371,7 @@ void usb_init(char*path){
 	h->control =-1;
 	h->bulk_out=-1;
 	h->bulk_out=-1;
+	usb_handles=h;
 	pthread_cond_init(&h->notify,0);
 	pthread_mutex_init(&h->lock,0);
 	if(adb_thread_create(&tid,usb_ffs_open_thread,h)!=0){
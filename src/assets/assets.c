@@ -12,34 +12,127 @@
 #include<errno.h>
 #include<sys/stat.h>
 #include<fcntl.h>
+#include<stdlib.h>
+#ifndef ENABLE_UEFI
+#include<pthread.h>
+#include<sys/statfs.h>
+#endif
 #include<string.h>
 #define TAG "assets"
 #include"str.h"
+#include"lock.h"
 #include"assets.h"
 #include"defines.h"
+#include"compress.h"
+
+/*
+ * compressed files are decoded on first use. contents nobody holds stay
+ * in a small LRU, the oldest is dropped and decoded again when needed.
+ */
+#define ASSETS_CACHE_MAX 8
+#define EXTRACT_THREADS 4
+#define STATFS_TMPFS_MAGIC 0x01021994
+#define STATFS_RAMFS_MAGIC 0x858458F6
 
 static bool rootfs_inited=false;
+static mutex_t cache_lock;
+static entry_file*cache[ASSETS_CACHE_MAX];
 extern char _binary_rootfs_bin_start;
 
-static void fill_assets_info(entry_dir*dir){
-	entry_dir*d=NULL;
-	entry_file*f=NULL;
-	if(!dir){
-		if(rootfs_inited)return;
-		fill_assets_info(&assets_rootfs);
-		rootfs_inited=true;
-		return;
+enum index_result{
+	INDEX_MISS,
+	INDEX_FOUND,
+	INDEX_UNKNOWN,
+};
+
+// parents and contents of the generated tree are set at build time
+static void fill_assets_info(){
+	if(rootfs_inited)return;
+	MUTEX_INIT(cache_lock);
+	rootfs_inited=true;
+}
+
+// caller holds cache_lock
+static void cache_remove(entry_file*f){
+	for(size_t i=0;i<ASSETS_CACHE_MAX;i++)if(cache[i]==f){
+		memmove(&cache[i],&cache[i+1],sizeof(*cache)*(ASSETS_CACHE_MAX-i-1));
+		cache[ASSETS_CACHE_MAX-1]=NULL;
+		break;
 	}
-	if(dir->subdirs)for(size_t s=0;(d=dir->subdirs[s]);s++){
-		d->info.parent=dir;
-		fill_assets_info(d);
+}
+
+static void cache_add(entry_file*f){
+	entry_file*old;
+	cache_remove(f);
+	if((old=cache[ASSETS_CACHE_MAX-1])){
+		free(old->content);
+		old->content=NULL;
 	}
-	if(dir->subfiles)for(size_t s=0;(f=dir->subfiles[s]);s++){
-		f->info.parent=dir;
-		if(!f->content&&f->length>0)
-			f->content=&_binary_rootfs_bin_start+f->offset;
+	memmove(&cache[1],&cache[0],sizeof(*cache)*(ASSETS_CACHE_MAX-1));
+	cache[0]=f;
+}
+
+static char*decompress_content(entry_file*f){
+	char*buf;
+	size_t pos=0,len=0;
+	unsigned char*inp=(unsigned char*)&_binary_rootfs_bin_start+f->offset;
+	if(!(buf=malloc(f->length+1)))return NULL;
+	if(compressor_decompress_auto(
+		inp,f->stored,
+		(unsigned char*)buf,f->length+1,
+		&pos,&len
+	)!=0||len!=f->length){
+		free(buf);
+		errno=EIO;
+		return NULL;
 	}
+	buf[len]=0;
+	return buf;
+}
 
+// caller holds cache_lock, it is dropped while decoding so loads run in parallel
+static bool load_content(entry_file*f){
+	char*buf;
+	if(f->content)return true;
+	MUTEX_UNLOCK(cache_lock);
+	buf=decompress_content(f);
+	MUTEX_LOCK(cache_lock);
+	if(!buf)return false;
+	if(f->content)free(buf);
+	else f->content=buf;
+	return true;
+}
+
+bool asset_file_load(entry_file*file){
+	bool r=true;
+	if(!file)return false;
+	if(!file->compressed)return true;
+	fill_assets_info();
+	MUTEX_LOCK(cache_lock);
+	if((r=load_content(file))&&file->holds<=0)cache_add(file);
+	MUTEX_UNLOCK(cache_lock);
+	return r;
+}
+
+void asset_file_hold(entry_file*file){
+	if(!file||!file->compressed)return;
+	fill_assets_info();
+	MUTEX_LOCK(cache_lock);
+	if(load_content(file)&&file->holds++<=0)cache_remove(file);
+	MUTEX_UNLOCK(cache_lock);
+}
+
+void asset_file_release(entry_file*file){
+	if(!file||!file->compressed)return;
+	MUTEX_LOCK(cache_lock);
+	if(file->holds>0&&--file->holds<=0&&file->content)cache_add(file);
+	MUTEX_UNLOCK(cache_lock);
+}
+
+const void*asset_file_get_stored(entry_file*file,size_t*len){
+	if(!file||!file->compressed)return NULL;
+	if(len)*len=file->stored;
+	return &_binary_rootfs_bin_start+file->offset;
 }
 
 #ifndef ENABLE_UEFI
@@ -52,12 +145,15 @@ int set_assets_file_info(int fd,entry_file*file){
 }
 
 int write_assets_file(int fd,entry_file*file,bool pres){
-	fill_assets_info(NULL);
+	int r=0;
+	fill_assets_info();
+	asset_file_hold(file);
 	if(file->content){
 		if(file->length==0)file->length=strlen(file->content);
-		if(write(fd,file->content,file->length)<0)return -errno;
-		fsync(fd);
+		if(write(fd,file->content,file->length)<0)r=-errno;
 	}
+	asset_file_release(file);
+	if(r<0)return r;
 	return pres?set_assets_file_info(fd,file):0;
 }
 
@@ -101,32 +197,172 @@ int create_assets_file(int dfd,entry_file*file,bool pres,bool override){
 	return 0;
 }
 
-int create_assets_dir(int dfd,entry_dir*dir,bool override){
-	if(!dir||dfd<0)ERET(EINVAL);
+struct extract_dir{
+	int pfd,fd;
+	entry_dir*dir;
+};
+
+struct extract{
+	struct extract_dir*dirs;
+	size_t cnt,size,next;
+	bool override;
+	int ret;
+};
+
+// folders are made first in one pass, workers fill them in afterwards
+static int extract_dirs(int dfd,entry_dir*dir,struct extract*ex){
 	int fd=dfd,r=0;
+	struct extract_dir*n;
 	if(dir->info.name[0]){
 		if(mkdirat(dfd,dir->info.name,dir->info.mode)<0&&errno!=EEXIST)return -errno;
 		if((fd=openat(dfd,dir->info.name,O_RDONLY|O_DIRECTORY))<0)return -errno;
-		struct timespec t[2]={dir->info.atime,dir->info.mtime};
-		if(!is_zero_time(&t[0])||!is_zero_time(&t[1])){
+	}
+	if(ex->cnt>=ex->size){
+		ex->size=ex->size?ex->size*2:64;
+		if(!(n=realloc(ex->dirs,sizeof(struct extract_dir)*ex->size))){
+			if(fd!=dfd)close(fd);
+			return -ENOMEM;
+		}
+		ex->dirs=n;
+	}
+	ex->dirs[ex->cnt].pfd=dfd;
+	ex->dirs[ex->cnt].fd=fd;
+	ex->dirs[ex->cnt++].dir=dir;
+	if(dir->subdirs)for(size_t s=0;dir->subdirs[s];s++)
+		r+=extract_dirs(fd,dir->subdirs[s],ex);
+	return r;
+}
+
+static void*extract_worker(void*data){
+	int r=0;
+	size_t i;
+	entry_dir*dir;
+	struct extract*ex=data;
+	while((i=__atomic_fetch_add(&ex->next,1,__ATOMIC_RELAXED))<ex->cnt){
+		dir=ex->dirs[i].dir;
+		if(dir->subfiles)for(size_t s=0;dir->subfiles[s];s++)
+			r+=create_assets_file(ex->dirs[i].fd,dir->subfiles[s],true,ex->override);
+	}
+	__atomic_add_fetch(&ex->ret,r,__ATOMIC_RELAXED);
+	return NULL;
+}
+
+static bool is_volatile_fs(int fd){
+	struct statfs st;
+	if(fstatfs(fd,&st)!=0)return false;
+	return st.f_type==STATFS_TMPFS_MAGIC||st.f_type==STATFS_RAMFS_MAGIC;
+}
+
+int create_assets_dir(int dfd,entry_dir*dir,bool override){
+	long cpus;
+	size_t i,cnt=0;
+	struct extract_dir*d;
+	pthread_t threads[EXTRACT_THREADS];
+	struct extract ex={.override=override};
+	if(!dir||dfd<0)ERET(EINVAL);
+	ex.ret=extract_dirs(dfd,dir,&ex);
+
+	// files are written out per folder by up to EXTRACT_THREADS workers
+	if((cpus=sysconf(_SC_NPROCESSORS_ONLN))<1)cpus=1;
+	while(cnt<MIN((size_t)cpus,(size_t)EXTRACT_THREADS)-1&&cnt<ex.cnt&&pthread_create(
+		&threads[cnt],NULL,extract_worker,&ex
+	)==0)cnt++;
+	extract_worker(&ex);
+	for(i=0;i<cnt;i++)pthread_join(threads[i],NULL);
+
+	// children are done, so nothing moves the times of a folder anymore
+	for(i=ex.cnt;i>0;i--){
+		d=&ex.dirs[i-1];
+		struct timespec t[2]={d->dir->info.atime,d->dir->info.mtime};
+		if(d->dir->info.name[0]&&(!is_zero_time(&t[0])||!is_zero_time(&t[1]))){
 			if(is_zero_time(&t[0]))t[0]=t[1];
 			if(is_zero_time(&t[1]))t[1]=t[0];
-			utimensat(dfd,dir->info.name,t,0);
+			utimensat(d->pfd,d->dir->info.name,t,0);
 		}
+		fchown(d->fd,d->dir->info.owner,d->dir->info.group);
+		if(d->dir->info.mode>0)fchmod(d->fd,d->dir->info.mode);
+		if(d->fd!=dfd)close(d->fd);
 	}
+	if(ex.dirs)free(ex.dirs);
 
-	if(dir->subdirs)for(size_t s=0;dir->subdirs[s];s++)
-		r+=create_assets_dir(fd,dir->subdirs[s],override);
+	// one flush for the whole tree, memory backed ones have nothing to flush
+	if(!is_volatile_fs(dfd))syncfs(dfd);
+	return ex.ret;
+}
+#endif
+
+static entry_index*index_probe(assets_index*idx,const char*key,size_t len){
+	entry_index*e;
+	uint32_t h=assets_path_hash(key,len);
+	for(size_t i=h&(idx->size-1);(e=&idx->table[i])->path;i=(i+1)&(idx->size-1))
+		if(e->hash==h&&strncmp(e->path,key,len)==0&&!e->path[len])return e;
+	return NULL;
+}
 
-	if(dir->subfiles)for(size_t s=0;dir->subfiles[s];s++)
-		r+=create_assets_file(fd,dir->subfiles[s],true,override);
+/*
+ * resolve a plain path with one probe of the index on the root.
+ * anything the index can not answer alone (dot components, trailing
+ * slashes, folders behind a symbolic link) goes the slow way.
+ */
+static enum index_result index_lookup(
+	entry_dir*dir,
+	const char*path,
+	entry_dir**od,
+	entry_file**of
+){
+	entry_index*e;
+	entry_dir*root,*p;
+	size_t len=0,pos,l;
+	char key[PATH_MAX],*c;
+	*od=NULL,*of=NULL;
+	if(!(root=asset_dir_get_root(dir))||!root->index)return INDEX_UNKNOWN;
+	l=strlen(path);
+	if(l>0&&(path[l-1]=='/'||path[l-1]=='\\'))return INDEX_UNKNOWN;
 
-	fchown(fd,dir->info.owner,dir->info.group);
-	if(dir->info.mode>0)fchmod(fd,dir->info.mode);
-	close(fd);
-	return r;
+	// full key of dir, written backwards from its own name
+	if(path[0]!='/'&&path[0]!='\\'){
+		for(p=dir;p->info.parent;p=p->info.parent)
+			len+=strlen(p->info.name)+1;
+		if(len+l>=sizeof(key))return INDEX_UNKNOWN;
+		for(p=dir,pos=len;p->info.parent;p=p->info.parent){
+			key[--pos]='/',pos-=strlen(p->info.name);
+			memcpy(key+pos,p->info.name,strlen(p->info.name));
+		}
+	}else if(l>=sizeof(key))return INDEX_UNKNOWN;
+	for(size_t i=0;i<l;i++){
+		if(path[i]=='/'||path[i]=='\\'){
+			if(len>0&&key[len-1]!='/')key[len++]='/';
+		}else key[len++]=path[i];
+	}
+	if(len>0&&key[len-1]=='/')len--;
+	key[len]=0;
+	for(c=key;c;c=strchr(c,'/')){
+		if(*c=='/')c++;
+		if(c[0]=='.'&&(!c[1]||c[1]=='/'||(c[1]=='.'&&(!c[2]||c[2]=='/'))))
+			return INDEX_UNKNOWN;
+	}
+	if(len==0){
+		*od=root;
+		return INDEX_FOUND;
+	}
+	if((e=index_probe(root->index,key,len))){
+		*od=e->dir,*of=e->file;
+		return INDEX_FOUND;
+	}
+
+	// missing, unless the nearest existing parent is a link
+	while(len>0){
+		while(len>0&&key[len-1]!='/')len--;
+		if(len<=0)break;
+		if(!(e=index_probe(root->index,key,--len)))continue;
+		if(e->dir)errno=ENOENT;
+		else if(S_ISLNK(e->file->info.mode))return INDEX_UNKNOWN;
+		else errno=ENOTDIR;
+		return INDEX_MISS;
+	}
+	errno=ENOENT;
+	return INDEX_MISS;
 }
-#endif
 
 static entry_file*_get_assets_subfile(entry_dir*dir,const char*name){
 	if(!dir->subfiles)EPRET(ENOENT);
@@ -149,9 +385,24 @@ entry_dir*get_assets_dir(entry_dir*dir,const char*path){
 	entry_file*f=NULL;
 	entry_dir*d=dir,*x;
 	if(!dir||!path)return NULL;
+	fill_assets_info();
+	switch(index_lookup(dir,path,&x,&f)){
+		case INDEX_MISS:return NULL;
+		case INDEX_FOUND:
+			if(x){
+				errno=0;
+				return x;
+			}
+			if(!S_ISLNK(f->info.mode)){
+				errno=ENOTDIR;
+				return NULL;
+			}
+		break;
+		case INDEX_UNKNOWN:break;
+	}
+	f=NULL;
 	char*p=strdup(path),*xp=p,*n=NULL;
 	if(!p)return NULL;
-	fill_assets_info(NULL);
 	for(size_t i=0;p[i];i++)if(p[i]=='\\')p[i]='/';
 	if(path[0]=='/')
 		while(d->info.parent)
@@ -181,11 +432,28 @@ entry_dir*get_assets_dir(entry_dir*dir,const char*path){
 
 entry_file*get_assets_file(entry_dir*dir,const char*path){
 	int cnt=0;
+	entry_dir*d;
 	entry_file*f=NULL;
 	if(!dir||!path)return NULL;
+	fill_assets_info();
+	switch(index_lookup(dir,path,&d,&f)){
+		case INDEX_MISS:return NULL;
+		case INDEX_FOUND:
+			if(d){
+				errno=ENOENT;
+				return NULL;
+			}
+			if(!S_ISLNK(f->info.mode)){
+				if(!asset_file_load(f))return NULL;
+				errno=0;
+				return f;
+			}
+		break;
+		case INDEX_UNKNOWN:break;
+	}
+	f=NULL;
 	char*p=strdup(path),*xp=p,*n=NULL;
 	if(!p)return NULL;
-	fill_assets_info(NULL);
 	for(size_t i=0;p[i];i++)if(p[i]=='\\')p[i]='/';
 	if((n=strrchr(xp,'/'))){
 		*n=0,dir=get_assets_dir(dir,xp);
@@ -204,6 +472,7 @@ entry_file*get_assets_file(entry_dir*dir,const char*path){
 		}
 	}else errno=ENOENT;
 	free(p);
+	if(f&&!asset_file_load(f))f=NULL;
 	if(f)errno=0;
 	return f;
 }
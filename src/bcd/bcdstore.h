@@ -13,6 +13,7 @@
 #include<uuid/uuid.h>
 #include"bcd.h"
 #include"list.h"
+#include"hashmap.h"
 typedef union{
 	int32_t value;
 	struct{
@@ -61,20 +62,24 @@ struct bcd_store{
 	hive_h*reg;
 	hive_node_h root;
 	hive_node_h objs;
-	list*objects;
-	list*to_free;
+	hashmap*by_uuid;
+	hashmap*by_node;
+	bcd_object*view;
+	bcd_object*menu;
 };
 struct bcd_object{
 	struct bcd_store*bcd;
 	uuid_t uuid;
+	char uuid_str[40];
 	char alias[64];
 	hive_node_h node;
 	hive_node_h desc;
 	hive_node_h eles;
 	int32_t type;
 	struct bcd_object_type_table*id;
-	list*elements;
-	list*to_free;
+	hashmap*by_type;
+	hashmap*by_node;
+	bcd_element*view;
 };
 struct bcd_element{
 	struct bcd_store*bcd;
@@ -96,5 +101,6 @@ extern uuid_t*guid2uuid(uuid_t*uuid,guid_t guid);
 extern guid_t*uuid2guid(guid_t*guid,uuid_t uuid);
 extern bool bcd_get_guid_by_name(const char*name,uuid_t uuid);
 extern const char*bcd_get_name_by_guid(uuid_t uuid);
+extern void**bcd_map_view(hashmap*map);
 #endif
 #endif
@@ -11,15 +11,18 @@
 #include<hivex.h>
 #include<string.h>
 #include"keyval.h"
+#include"lock.h"
 #include"bcdstore.h"
 
-bcd_element bcd_get_element_by_node(bcd_object obj,hive_node_h node){
-	if(!obj||!bcd_object_get_store(obj)||node<=0)EPRET(EINVAL);
-	list*l=list_first(obj->elements);
-	if(l)do{
-		LIST_DATA_DECLARE(v,l,bcd_element);
-		if(v&&v->node==node)return v;
-	}while((l=l->next));
+/*
+ * elements of an object are indexed by hive node and by element type,
+ * element names resolve through a shared name to type map built once
+ */
+
+static mutex_t names_lock=MUTEX_INITIALIZER;
+static hashmap*names=NULL;
+
+static bcd_element element_load(bcd_object obj,hive_node_h node){
 	char*end,*key;
 	bcd_element ele=malloc(sizeof(struct bcd_element));
 	if(!ele)EPRET(ENOMEM);
@@ -60,64 +63,63 @@ bcd_element bcd_get_element_by_node(bcd_object obj,hive_node_h node){
 		if(found)break;
 	}
 	if(!found)ele->id=NULL;
-	list_obj_add_new(&obj->elements,ele);
 	errno=0;
 	return ele;
 	fail:
-	bcd_element_free(ele);
+	free(ele);
 	return NULL;
 }
 
+bcd_element bcd_get_element_by_node(bcd_object obj,hive_node_h node){
+	if(!obj||!bcd_object_get_store(obj)||node<=0)EPRET(EINVAL);
+	bcd_element ele=hashmap_get(obj->by_node,(void*)node);
+	if(ele)return ele;
+	if(!(ele=element_load(obj,node)))return NULL;
+	if(hashmap_set(obj->by_node,(void*)node,ele,NULL)!=0){
+		free(ele);
+		EPRET(ENOMEM);
+	}
+	hashmap_add(obj->by_type,(void*)(uintptr_t)(uint32_t)ele->et.value,ele);
+	if(obj->view)free(obj->view);
+	obj->view=NULL;
+	errno=0;
+	return ele;
+}
+
 bcd_element bcd_get_element_by_key(bcd_object obj,const char*key){
 	if(!obj||!bcd_object_get_store(obj)||!key)EPRET(EINVAL);
-	return bcd_get_element_by_node(obj,hivex_node_get_child(
-		bcd_object_get_hive(obj),obj->eles,key
-	));
+	char*end=NULL;
+	errno=0;
+	int32_t id=strtoul(key,&end,16);
+	if(*end||key==end||errno!=0||id==0)EPRET(ENOENT);
+	return bcd_get_element_by_id(obj,id);
 }
 
 bcd_element bcd_get_element_by_id(bcd_object obj,int32_t id){
-	if(!obj||!bcd_object_get_store(obj))EPRET(EINVAL);
-	char key[16]={0};
-	snprintf(key,15,"%x",id);
-	return bcd_get_element_by_key(obj,key);
+	if(!obj||!bcd_object_get_store(obj)||id==0)EPRET(EINVAL);
+	bcd_element ele=hashmap_get(obj->by_type,(void*)(uintptr_t)(uint32_t)id);
+	if(!ele)EPRET(ENOENT);
+	return ele;
 }
 
 bcd_element bcd_get_element_by_name(bcd_object obj,const char*name){
 	if(!obj||!name)EPRET(EINVAL);
-	for(size_t s=0;BcdElementType[s].name;s++){
-		if(strcasecmp(name,BcdElementType[s].name)!=0)continue;
-		return bcd_get_element_by_id(obj,BcdElementType[s].type);
-	}
-	EPRET(ENOENT);
+	MUTEX_LOCK(names_lock);
+	if(!names&&(names=hashmap_new(HASHMAP_NOCOPY|HASHMAP_NOCASE)))
+		for(size_t s=0;BcdElementType[s].name;s++)hashmap_add(
+			names,BcdElementType[s].name,
+			(void*)(uintptr_t)(uint32_t)BcdElementType[s].type
+		);
+	MUTEX_UNLOCK(names_lock);
+	uintptr_t id=(uintptr_t)hashmap_get(names,name);
+	if(id==0)EPRET(ENOENT);
+	return bcd_get_element_by_id(obj,(int32_t)id);
 }
 
 bcd_element*bcd_get_all_elements(bcd_object obj){
-	size_t cnt,size;
-	hive_node_h*cs;
-	bcd_element*eles=NULL;
-	if(!obj)return NULL;
-
-	if(!(cs=hivex_node_children(
-		bcd_object_get_hive(obj),obj->eles
-	)))goto fail;
-
-	for(cnt=0;cs[cnt];cnt++);
-	size=sizeof(bcd_element)*(cnt+1);
-	if(!(eles=malloc(size)))goto fail;
-	memset(eles,0,size);
-
-	for(size_t i=0;i<cnt;i++){
-		eles[i]=bcd_get_element_by_node(obj,cs[i]);
-		if(!eles[i])goto fail;
-	}
-
-	list_obj_add_new_notnull(&obj->to_free,eles);
-	free(cs);
-	return eles;
-	fail:
-	if(cs)free(cs);
-	bcd_elements_free(eles);
-	return NULL;
+	if(!obj)EPRET(EINVAL);
+	if(!obj->view)obj->view=(bcd_element*)bcd_map_view(obj->by_node);
+	return obj->view;
 }
 
 const char*bcd_element_get_type_name(bcd_element ele){
@@ -178,28 +180,20 @@ hive_h*bcd_element_get_hive(bcd_element ele){
 
 void bcd_element_free(bcd_element ele){
 	if(!ele)return;
-	if(bcd_element_get_object(ele)){
-		list*l=list_first(bcd_element_get_object(ele)->elements),*n;
-		if(l)do{
-			n=l->next;
-			LIST_DATA_DECLARE(v,l,bcd_element);
-			if(!v||v->node!=ele->node)continue;
-			list_obj_del(&bcd_element_get_object(ele)->elements,l,NULL);
-		}while((l=n));
+	bcd_object obj=bcd_element_get_object(ele);
+	if(obj&&ele->node>0&&hashmap_get(obj->by_node,(void*)ele->node)==ele){
+		hashmap_del(obj->by_node,(void*)ele->node,NULL);
+		void*key=(void*)(uintptr_t)(uint32_t)ele->et.value;
+		if(hashmap_get(obj->by_type,key)==ele)
+			hashmap_del(obj->by_type,key,NULL);
+		if(obj->view)free(obj->view);
+		obj->view=NULL;
 	}
 	free(ele);
 }
 
-void bcd_elements_free(bcd_element*eles){
-	if(!eles||!*eles||!bcd_element_get_object(*eles))return;
-	list*l,*n;
-	if((l=list_first(bcd_element_get_object(*eles)->to_free)))do{
-		n=l->next;
-		LIST_DATA_DECLARE(v,l,bcd_element*);
-		if(eles!=v)continue;
-		list_obj_del(&bcd_element_get_object(*eles)->to_free,l,NULL);
-	}while((l=n));
-	free(eles);
+void bcd_elements_free(bcd_element*eles __attribute__((unused))){
+	// views are owned by the object
 }
 
 #endif
@@ -51,4 +51,13 @@ const char*bcd_get_name_by_guid(uuid_t uuid){
 	return NULL;
 }
 
+void**bcd_map_view(hashmap*map){
+	void*v,**view;
+	size_t i=0,iter=0,cnt=hashmap_count(map);
+	if(!(view=malloc(sizeof(void*)*(cnt+1))))EPRET(ENOMEM);
+	while(i<cnt&&hashmap_next(map,&iter,NULL,&v))view[i++]=v;
+	view[i]=NULL;
+	return view;
+}
+
 #endif
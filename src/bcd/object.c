@@ -13,13 +13,30 @@
 #include"keyval.h"
 #include"bcdstore.h"
 
-bcd_object bcd_get_object_by_node(bcd_store bcd,hive_node_h node){
-	if(!bcd||node<=0)EPRET(EINVAL);
-	list*l=list_first(bcd->objects);
-	if(l)do{
-		LIST_DATA_DECLARE(v,l,bcd_object);
-		if(v&&v->node==node)return v;
-	}while((l=l->next));
+/*
+ * objects are loaded once when the store opens and kept in two indexes,
+ * by hive node and by lowercase uuid string, enumerations are cached
+ * views owned by the store and dropped when an object goes away
+ */
+
+static void drop_views(bcd_store bcd){
+	if(bcd->view)free(bcd->view);
+	if(bcd->menu)free(bcd->menu);
+	bcd->view=NULL,bcd->menu=NULL;
+}
+
+static bool load_elements(bcd_object obj){
+	hive_node_h*cs;
+	if(!(cs=hivex_node_children(
+		bcd_object_get_hive(obj),obj->eles
+	)))return false;
+	for(size_t i=0;cs[i];i++)
+		bcd_get_element_by_node(obj,cs[i]);
+	free(cs);
+	return true;
+}
+
+static bcd_object object_load(bcd_store bcd,hive_node_h node){
 	hive_type t;
 	hive_value_h type;
 	char*key=NULL,*alias;
@@ -60,13 +77,18 @@ bcd_object bcd_get_object_by_node(bcd_store bcd,hive_node_h node){
 	if(!(key=hivex_node_name(bcd_object_get_hive(obj),node)))goto fail;
 	if(key[0]!='{'||strlen(key)!=38||key[37]!='}')goto fail;
 	key[37]=0;
-	uuid_parse(key+1,obj->uuid);
+	if(uuid_parse(key+1,obj->uuid)!=0)goto fail;
+	uuid_unparse_lower(obj->uuid,obj->uuid_str);
 
 	if((alias=(char*)bcd_get_name_by_guid(obj->uuid)))
 		strncpy(obj->alias,alias,sizeof(obj->alias)-1);
 
 	free(key);
-	list_obj_add_new(&bcd->objects,obj);
+	key=NULL;
+	errno=ENOMEM;
+	if(!(obj->by_type=hashmap_new(HASHMAP_POINTER)))goto fail;
+	if(!(obj->by_node=hashmap_new(HASHMAP_POINTER)))goto fail;
+	if(!load_elements(obj))goto fail;
 	errno=0;
 	return obj;
 	fail:
@@ -75,18 +97,42 @@ bcd_object bcd_get_object_by_node(bcd_store bcd,hive_node_h node){
 	return NULL;
 }
 
+bcd_object bcd_get_object_by_node(bcd_store bcd,hive_node_h node){
+	if(!bcd||node<=0)EPRET(EINVAL);
+	bcd_object obj=hashmap_get(bcd->by_node,(void*)node);
+	if(obj)return obj;
+	if(!(obj=object_load(bcd,node)))return NULL;
+	if(hashmap_set(bcd->by_node,(void*)node,obj,NULL)!=0){
+		bcd_object_free(obj);
+		EPRET(ENOMEM);
+	}
+	hashmap_add(bcd->by_uuid,obj->uuid_str,obj);
+	drop_views(bcd);
+	errno=0;
+	return obj;
+}
+
 bcd_object bcd_get_object_by_key(bcd_store bcd,const char*key){
 	if(!bcd||!key)EPRET(EINVAL);
+	char buf[40]={0};
+	bcd_object obj;
+	if(key[0]=='{'&&strlen(key)==38&&key[37]=='}'){
+		memcpy(buf,key+1,36);
+		if(!(obj=hashmap_get(bcd->by_uuid,buf)))EPRET(ENOENT);
+		return obj;
+	}
 	return bcd_get_object_by_node(bcd,hivex_node_get_child(
 		bcd_store_get_hive(bcd),bcd->objs,key
 	));
 }
 
 bcd_object bcd_get_object_by_uuid(bcd_store bcd,uuid_t uuid){
-	char uuid_str[40]={0},key[64];
-	uuid_unparse(uuid,uuid_str);
-	snprintf(key,63,"{%s}",uuid_str);
-	return bcd_get_object_by_key(bcd,key);
+	if(!bcd||!uuid)EPRET(EINVAL);
+	char uuid_str[40]={0};
+	bcd_object obj;
+	uuid_unparse_lower(uuid,uuid_str);
+	if(!(obj=hashmap_get(bcd->by_uuid,uuid_str)))EPRET(ENOENT);
+	return obj;
 }
 
 bcd_object bcd_get_object_by_name(bcd_store bcd,const char*name){
@@ -97,40 +143,18 @@ bcd_object bcd_get_object_by_name(bcd_store bcd,const char*name){
 }
 
 bcd_object*bcd_get_all_objects(bcd_store bcd){
-	size_t cnt,size;
-	hive_node_h*cs;
-	bcd_object*objs=NULL;
-	if(!bcd)return NULL;
-
-	if(!(cs=hivex_node_children(
-		bcd_store_get_hive(bcd),bcd->objs
-	)))goto fail;
-
-	for(cnt=0;cs[cnt];cnt++);
-	size=sizeof(bcd_object)*(cnt+1);
-	if(!(objs=malloc(size)))goto fail;
-	memset(objs,0,size);
-
-	for(size_t i=0;i<cnt;i++){
-		objs[i]=bcd_get_object_by_node(bcd,cs[i]);
-		if(!objs[i])goto fail;
-	}
-
-	list_obj_add_new_notnull(&bcd->to_free,objs);
-	free(cs);
-	return objs;
-	fail:
-	if(cs)free(cs);
-	bcd_objects_free(objs);
-	return NULL;
+	if(!bcd)EPRET(EINVAL);
+	if(!bcd->view)bcd->view=(bcd_object*)bcd_map_view(bcd->by_node);
+	return bcd->view;
 }
 
 bcd_object*bcd_get_boot_menu_objects(bcd_store bcd){
-	size_t cnt,size;
+	size_t cnt=0,size;
 	bcd_element menu;
 	bcd_object*objs=NULL,*buf,mgr;
 	uuid_t*us=NULL;
-	if(!bcd)return NULL;
+	if(!bcd)EPRET(EINVAL);
+	if(bcd->menu)return bcd->menu;
 
 	if(
 		(mgr=bcd_get_object_by_name(bcd,"BOOTMGR"))&&
@@ -149,20 +173,17 @@ bcd_object*bcd_get_boot_menu_objects(bcd_store bcd){
 		size=sizeof(bcd_object)*(cnt+1);
 		if(!(objs=malloc(size)))goto fail;
 		memset(objs,0,size);
-
-		for(size_t i=0,k=0;i<cnt;i++){
-			if(!buf[i])goto fail;
-			objs[k++]=buf[i];
-		}
-		bcd_objects_free(buf);
+		for(size_t i=0,k=0;buf[i];i++)
+			if(bcd_object_is_type_name(buf[i],"Boot-OSLoader"))
+				objs[k++]=buf[i];
 	}
 
 	if(us)free(us);
-	list_obj_add_new_notnull(&bcd->to_free,objs);
+	bcd->menu=objs;
 	return objs;
 	fail:
 	if(us)free(us);
-	bcd_objects_free(objs);
+	if(objs)free(objs);
 	return NULL;
 }
 
@@ -230,35 +251,27 @@ hive_h*bcd_object_get_hive(bcd_object obj){
 
 void bcd_object_free(bcd_object obj){
 	if(!obj)return;
-	list*l,*n;
-	if(
-		bcd_object_get_store(obj)&&
-		(l=list_first(bcd_object_get_store(obj)->objects))
-	)do{
-		n=l->next;
-		LIST_DATA_DECLARE(v,l,bcd_object);
-		if(!v||v->node!=obj->node)continue;
-		list_obj_del(&obj->bcd->objects,l,NULL);
-	}while((l=n));
-	if((l=list_first(obj->elements)))do{
-		n=l->next;
-		LIST_DATA_DECLARE(v,l,bcd_element);
-		bcd_element_free(v);
-	}while((l=n));
-	list_free_all_def(obj->to_free);
+	bcd_store bcd=bcd_object_get_store(obj);
+	if(bcd&&obj->node>0&&hashmap_get(bcd->by_node,(void*)obj->node)==obj){
+		hashmap_del(bcd->by_node,(void*)obj->node,NULL);
+		if(hashmap_get(bcd->by_uuid,obj->uuid_str)==obj)
+			hashmap_del(bcd->by_uuid,obj->uuid_str,NULL);
+		drop_views(bcd);
+	}
+	if(obj->by_node){
+		void*v;
+		size_t iter=0;
+		while(hashmap_next(obj->by_node,&iter,NULL,&v))
+			bcd_element_free(v);
+	}
+	hashmap_free(obj->by_type,NULL);
+	hashmap_free(obj->by_node,NULL);
+	if(obj->view)free(obj->view);
 	free(obj);
 }
 
-void bcd_objects_free(bcd_object*objs){
-	if(!objs||!*objs||!bcd_object_get_store(*objs))return;
-	list*l,*n;
-	if((l=list_first(bcd_object_get_store(*objs)->to_free)))do{
-		n=l->next;
-		LIST_DATA_DECLARE(v,l,bcd_object*);
-		if(objs!=v)continue;
-		list_obj_del(&bcd_object_get_store(*objs)->to_free,l,NULL);
-	}while((l=n));
-	free(objs);
+void bcd_objects_free(bcd_object*objs __attribute__((unused))){
+	// views are owned by the store
 }
 
 #endif
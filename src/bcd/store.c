@@ -15,6 +15,7 @@
 
 bcd_store bcd_store_open(const char*path,int flags){
 	if(!path||!path[0])EPRET(EINVAL);
+	hive_node_h*cs;
 	bcd_store bcd=malloc(sizeof(struct bcd_store));
 	if(!bcd)goto fail;
 	memset(bcd,0,sizeof(struct bcd_store));
@@ -25,6 +26,14 @@ bcd_store bcd_store_open(const char*path,int flags){
 	if((bcd->objs=hivex_node_get_child(
 		bcd->reg,bcd->root,"Objects"
 	))<=0)goto fail;
+	errno=ENOMEM;
+	if(!(bcd->by_uuid=hashmap_new(HASHMAP_NOCOPY|HASHMAP_NOCASE)))goto fail;
+	if(!(bcd->by_node=hashmap_new(HASHMAP_POINTER)))goto fail;
+	if((cs=hivex_node_children(bcd->reg,bcd->objs))){
+		for(size_t i=0;cs[i];i++)
+			bcd_get_object_by_node(bcd,cs[i]);
+		free(cs);
+	}
 	errno=0;
 	return bcd;
 	fail:
@@ -43,13 +52,17 @@ hive_h*bcd_store_get_hive(bcd_store store){
 void bcd_store_free(bcd_store store){
 	if(!store)return;
 	if(store->reg)hivex_close(store->reg);
-	list*l,*n;
-	if((l=list_first(store->objects)))do{
-		n=l->next;
-		LIST_DATA_DECLARE(v,l,bcd_object);
-		bcd_object_free(v);
-	}while((l=n));
-	list_free_all_def(store->to_free);
+	hashmap_free(store->by_uuid,NULL);
+	store->by_uuid=NULL;
+	if(store->by_node){
+		void*v;
+		size_t iter=0;
+		while(hashmap_next(store->by_node,&iter,NULL,&v))
+			bcd_object_free(v);
+	}
+	hashmap_free(store->by_node,NULL);
+	if(store->view)free(store->view);
+	if(store->menu)free(store->menu);
 	free(store);
 }
 
@@ -17,6 +17,7 @@
 #include"defines.h"
 #ifdef ENABLE_UEFI
 #include<Library/UefiBootServicesTableLib.h>
+#include"uefi.h"
 #else
 #include"service.h"
 #include"init_internal.h"
@@ -197,6 +198,7 @@ int boot(boot_config*boot){
 	if(!boot)x=boot=boot_get_config(NULL);
 	if(!boot)return -1;
 	#ifdef ENABLE_UEFI
+	boottime_mark("boot");
 	gST->ConOut->ClearScreen(gST->ConOut);
 	logger_set_console(confd_get_boolean(
 		"boot.console_log",
@@ -7,11 +7,13 @@
  */
 
 #ifdef ENABLE_UEFI
+#include<Library/TimerLib.h>
 #include<Library/MemoryAllocationLib.h>
 #include<Library/UefiBootServicesTableLib.h>
 #include<Protocol/DevicePath.h>
 #include<Protocol/LoadedImage.h>
 #include"boot.h"
+#include"uefi.h"
 #include"confd.h"
 #include"logger.h"
 #include"locate.h"
@@ -22,7 +24,7 @@
 
 bool boot_load_driver(EFI_DEVICE_PATH_PROTOCOL*p){
 	EFI_STATUS st;
-	EFI_HANDLE ih;
+	EFI_HANDLE ih=NULL;
 	EFI_LOADED_IMAGE_PROTOCOL*li;
 	st=gBS->LoadImage(FALSE,gImageHandle,p,NULL,0,&ih);
 	if(EFI_ERROR(st)){
@@ -51,12 +53,40 @@ bool boot_load_driver(EFI_DEVICE_PATH_PROTOCOL*p){
 	if(EFI_ERROR(st)){
 		if(ih)gBS->UnloadImage(ih);
 		tlog_error("start dxe failed: %s",efi_status_to_string(st));
+		return false;
 	}
 	return true;
 }
 
+// bind every controller to the drivers started so far
+static void connect_all(){
+	UINTN cnt=0;
+	UINT64 start;
+	EFI_HANDLE*hands=NULL;
+	start=GetPerformanceCounter();
+	if(EFI_ERROR(gBS->LocateHandleBuffer(
+		AllHandles,NULL,NULL,&cnt,&hands
+	)))return;
+	for(UINTN i=0;i<cnt;i++)
+		gBS->ConnectController(hands[i],NULL,NULL,TRUE);
+	FreePool(hands);
+	tlog_debug(
+		"connected %llu handles in %llu us",
+		(unsigned long long)cnt,
+		(unsigned long long)boottime_elapsed_us(start)
+	);
+}
+
+/*
+ * drivers are all started first and controllers are connected in one
+ * recursive pass at the end. a driver listed in uefi.drivers_connect
+ * gets the pass right after it started, for drivers it publishes
+ * devices to.
+ */
 void boot_load_drivers(){
 	fsh*f=NULL;
+	UINT64 start;
+	size_t pending=0;
 	EFI_DEVICE_PATH_PROTOCOL*dp=NULL;
 	char*d,**ds=NULL,*b="uefi.drivers";
 	if(!(ds=confd_ls(b)))return;
@@ -68,13 +98,21 @@ void boot_load_drivers(){
 			EDONE(telog_warn("open %s failed",d));
 		if(fs_ioctl(f,FS_IOCTL_UEFI_GET_DEVICE_PATH,&dp)!=0)
 			EDONE(telog_warn("get device path of %s failed",d));
-		if(boot_load_driver(dp))
-			tlog_debug("loaded dxe driver %s",d);
+		start=GetPerformanceCounter();
+		if(!boot_load_driver(dp))goto done;
+		tlog_debug(
+			"loaded dxe driver %s in %llu us",d,
+			(unsigned long long)boottime_elapsed_us(start)
+		);
+		pending++;
+		if(confd_get_boolean_base("uefi.drivers_connect",ds[i],false))
+			connect_all(),pending=0;
 		done:
 		if(f)fs_close(&f);
 		if(d)free(d);
-		d=NULL,d=NULL,dp=NULL;
+		d=NULL,dp=NULL;
 	}
+	if(pending>0)connect_all();
 	if(ds[0])free(ds[0]);
 	free(ds);
 }
@@ -7,6 +7,8 @@
  */
 
 #ifdef ENABLE_UEFI
+#include<ctype.h>
+#include<stdint.h>
 #include"str.h"
 #include"boot.h"
 #include"list.h"
@@ -23,46 +25,98 @@ static struct boot_config def={
 	.show=true,.enabled=true
 };
 
-typedef struct prober_cache{
+/*
+ * probed paths share one trie per volume, children hashed by their case
+ * folded name. a folder is listed once when first walked into, every
+ * child is known from then on, so a missing file costs no fs_open.
+ * UEFI file protocols may only be called on the BSP, so volumes are
+ * still probed one after another.
+ */
+#define PROBER_BUCKETS 16
+#define PROBER_BATCH 32
+
+typedef struct prober_cache prober_cache;
+struct prober_cache{
 	char node[255];
+	uint32_t hash;
 	fsh*hand;
-	list*sub;
-}prober_cache;
+	bool dir,opened,listed;
+	prober_cache*next;
+	prober_cache*sub[PROBER_BUCKETS];
+};
+
+static uint32_t prober_hash(const char*name){
+	uint32_t h=0x811C9DC5;
+	for(;*name;name++)h=(h^(unsigned char)tolower(*name))*0x01000193;
+	return h;
+}
+
+static prober_cache*prober_lookup(prober_cache*p,const char*name,uint32_t h){
+	prober_cache*c;
+	for(c=p->sub[h%PROBER_BUCKETS];c;c=c->next)
+		if(c->hash==h&&strcasecmp(c->node,name)==0)return c;
+	return NULL;
+}
 
-static bool prober_cache_cmp(list*l,void*d){
-	LIST_DATA_DECLARE(c,l,prober_cache*);
-	return c&&d&&strcasecmp(c->node,d)==0;
+static prober_cache*prober_add(prober_cache*p,const char*name,uint32_t h,bool dir){
+	prober_cache*c;
+	if(!(c=malloc(sizeof(prober_cache))))return NULL;
+	memset(c,0,sizeof(prober_cache));
+	strncpy(c->node,name,sizeof(c->node)-1);
+	c->hash=h,c->dir=dir;
+	c->next=p->sub[h%PROBER_BUCKETS];
+	p->sub[h%PROBER_BUCKETS]=c;
+	return c;
+}
+
+// takes in every child, a failed listing leaves the folder unknown
+static void prober_list(prober_cache*p){
+	int r;
+	uint32_t h;
+	size_t cnt=0;
+	fs_file_info*infos;
+	if(p->listed||!p->hand)return;
+	if(!(infos=malloc(sizeof(fs_file_info)*PROBER_BATCH)))return;
+	while((r=fs_readdir_batch(p->hand,infos,PROBER_BATCH,&cnt))==0){
+		for(size_t i=0;i<cnt;i++){
+			if(!infos[i].name[0])continue;
+			h=prober_hash(infos[i].name);
+			if(prober_lookup(p,infos[i].name,h))continue;
+			prober_add(p,infos[i].name,h,infos[i].type==FS_TYPE_FILE_FOLDER);
+		}
+	}
+	p->listed=r==EOF;
+	free(infos);
 }
 
 static prober_cache*get_component(prober_cache*p,const char*name,bool dir){
-	list*c;
+	uint32_t h;
 	prober_cache*child;
-	static const size_t size=sizeof(prober_cache);
-	if(!p||!name)return NULL;
-	if(!(c=list_search_one(p->sub,prober_cache_cmp,(void*)name))){
-		if(!(child=malloc(size)))return NULL;
-		memset(child,0,size);
+	if(!p||!name||!p->hand)return NULL;
+	prober_list(p);
+	h=prober_hash(name);
+	if(!(child=prober_lookup(p,name,h))){
+		if(p->listed)return NULL;
+		if(!(child=prober_add(p,name,h,dir)))return NULL;
+	}
+	if(p->listed&&child->dir!=dir)return NULL;
+	if(!child->opened){
+		child->opened=true;
 		fs_open(
-			p->hand,&child->hand,name,
+			p->hand,&child->hand,child->node,
 			dir?FILE_FLAG_FOLDER:FILE_FLAG_READ
 		);
-		strncpy(child->node,name,sizeof(child->node)-1);
-		if(list_obj_add_new(&p->sub,child)!=0){
-			free(child);
-			child=NULL;
-		}
-	}else child=LIST_DATA(c,prober_cache*);
+	}
 	return child;
 }
 
-static int free_cache(void*d){
-	prober_cache*cache=d;
-	if(!cache)return 0;
-	list_free_all(cache->sub,free_cache);
-	fs_close(&cache->hand);
-	memset(cache,0,sizeof(prober_cache));
-	free(cache);
-	return 0;
+static void free_cache(prober_cache*cache){
+	prober_cache*c,*n;
+	if(!cache)return;
+	for(size_t i=0;i<PROBER_BUCKETS;i++)
+		for(c=cache->sub[i];c;c=n)n=c->next,free_cache(c),free(c);
+	if(cache->opened)fs_close(&cache->hand);
+	memset(cache->sub,0,sizeof(cache->sub));
 }
 
 static bool add_item(fsh*f,struct efi_path*ep,char*path,int id,int part){
@@ -93,16 +147,18 @@ static bool boot_scan_part(int part,int*id,fsh*root){
 	bool found=false;
 	struct efi_path*ep;
 	char path[PATH_MAX];
-	prober_cache*c,cr={.node="",.hand=root,.sub=NULL,};
+	prober_cache*c,cr;
+	memset(&cr,0,sizeof(cr));
+	cr.hand=root,cr.dir=true;
 	for(size_t p=0;(ep=&boot_efi_paths[p])&&ep->title;p++){
 		if(!ep->enable||!ep->name||!ep->title)continue;
 		if(ep->cpu!=CPU_ANY&&ep->cpu!=current_cpu)continue;
-		for(size_t d=0;ep->dir[d];d++)for(size_t d=0;ep->name[d];d++){
+		for(size_t d=0;ep->dir[d];d++)for(size_t n=0;ep->name[n];n++){
 			nf=NULL,c=&cr;
 			memset(path,0,sizeof(path));
 			snprintf(
 				path,sizeof(path)-1,"%s%s",
-				ep->dir[d],ep->name[d]
+				ep->dir[d],ep->name[n]
 			);
 			if(!(px=path2list(path,false)))continue;
 			if((l1=list_first(px)))do{
@@ -112,11 +168,10 @@ static bool boot_scan_part(int part,int*id,fsh*root){
 			if(c&&c->hand)nf=c->hand;
 			list_free_all_def(px);
 			if(!add_item(nf,ep,path,*id,part))continue;
-			fs_close(&nf);
 			(*id)++,found=true;
 		}
 	}
-	list_free_all(cr.sub,free_cache);
+	free_cache(&cr);
 	return found;
 }
 
@@ -15,17 +15,16 @@
 #include<sys/stat.h>
 #include<sys/ioctl.h>
 #include<linux/loop.h>
-#include<blkid/blkid.h>
 #include"str.h"
 #include"boot.h"
 #include"confd.h"
+#include"devd.h"
 #include"logger.h"
 #include"system.h"
 #include"defines.h"
 #include"init_internal.h"
 #define TAG "switchroot"
 #define EGOTO(_num){e=(_num);goto fail;}
-static blkid_cache cache=NULL;
 
 static char*get_block(char*path,int wait){
 	struct stat st;
@@ -41,7 +40,7 @@ static char*get_block(char*path,int wait){
 
 	// resolve root block tag
 	if(block[0]!='/'){
-		char*x=blkid_evaluate_tag(block,NULL,NULL);
+		char*x=blk_resolve_tag(block);
 		free(block);
 		if(!x){
 			telog_error("resolve tag %s",path);
@@ -76,8 +75,7 @@ static char*get_fstype(boot_config*boot,const char*path,char*key,char*buf,size_t
 
 	// fstype not set, auto detect
 	errno=0;
-	if(!cache)blkid_get_cache(&cache,NULL);
-	if((t2=blkid_get_tag_value(cache,"TYPE",path)))goto success;
+	if((t2=blk_get_tag_value(path,"TYPE")))goto success;
 	else telog_warn("cannot determine fstype in %s",path);
 
 	EPRET(ENOTSUP);
@@ -328,7 +326,6 @@ int run_boot_root(boot_config*boot){
 
 	done:
 	if(path)free(path);
-	if(cache)blkid_put_cache(cache);
 	return e;
 	fail:
 	if(errno==0)errno=e==0?ENOTSUP:0;
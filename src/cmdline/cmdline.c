@@ -6,42 +6,61 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<stdio.h>
 #include<fcntl.h>
+#include<dirent.h>
 #include<unistd.h>
 #include<string.h>
+#include"system.h"
 #include"logger.h"
 #include"keyval.h"
+#include"hashmap.h"
 #include"cmdline.h"
 #include"param.h"
 #define TAG "cmdline"
+#define DT_ANDROID _PATH_PROC"/device-tree/firmware/android"
+
+/*
+ * options come from three sources, a later one overrides an earlier one:
+ *   /proc/bootconfig (androidboot.* on gki, init.* keys without prefix)
+ *   /proc/cmdline
+ *   device tree /firmware/android (androidboot.* for each property)
+ * option names are looked up in a hashmap built from cmdline_options once
+ */
+static hashmap*options=NULL;
 
 static struct cmdline_option*find_option(char*name){
+	struct cmdline_option*co;
 	if(!name)return NULL;
+	if(!options){
+		if(!(options=hashmap_new(HASHMAP_NOCOPY)))return NULL;
+		for(int i=0;(co=cmdline_options[i]);i++)
+			if(co->name&&co->handler)
+				hashmap_add(options,co->name,co);
+	}
+	return hashmap_get(options,name);
+}
+
+static void parse_param(char*key,char*value){
+	size_t s;
 	struct cmdline_option*co;
-	for(int i=0;(co=cmdline_options[i]);i++){
-		if(!co->name||!co->handler)continue;
-		if(strcmp(name,co->name)==0)return co;
+	if(!key||!(co=find_option(key)))return;
+	s=value?strlen(value):0;
+	if(co->type==NO_VALUE&&s>0){
+		tlog_warn("param %s should not have an argument.",key);
+		return;
+	}else if(co->type==REQUIRED_VALUE&&s<=0){
+		tlog_warn("param %s need an argument.",key);
+		return;
 	}
-	return NULL;
+	if(boot_options.end&&!co->always)return;
+	co->handler(key,value);
 }
 
 void parse_params(keyval**params){
 	if(!params)return;
-	size_t s;
-	KVARR_FOREACH(params,t,i){
-		struct cmdline_option*co=find_option(t->key);
-		if(!co||!t->key)continue;
-		s=t->value?strlen(t->value):0;
-		if(co->type==NO_VALUE&&s>0){
-			tlog_warn("param %s should not have an argument.",t->key);
-			continue;
-		}else if(co->type==REQUIRED_VALUE&&s<=0){
-			tlog_warn("param %s need an argument.",t->key);
-			continue;
-		}
-		if(boot_options.end&&!co->always)continue;
-		co->handler(t->key,t->value);
-	}
+	KVARR_FOREACH(params,t,i)parse_param(t->key,t->value);
 }
 
 int parse_cmdline(int fd){
@@ -52,13 +71,61 @@ int parse_cmdline(int fd){
 	return 0;
 }
 
+int parse_bootconfig(int fd){
+	keyval**kvs=read_bootconfig(fd);
+	if(!kvs)return trlog_warn(-1,"failed to parse bootconfig.");
+	KVARR_FOREACH(kvs,t,i){
+		if(strncmp(t->key,"kernel.",7)==0)continue;
+		parse_param(strncmp(t->key,"init.",5)==0?t->key+5:t->key,t->value);
+	}
+	tlog_info("load bootconfig done");
+	return 0;
+}
+
+static int load_bootconfig(){
+	int fd,r;
+	if((fd=open(_PATH_PROC_BOOTCONFIG,O_RDONLY|O_CLOEXEC))<0){
+		if(errno==ENOENT)return 0;
+		return terlog_warn(-1,"open "_PATH_PROC_BOOTCONFIG);
+	}
+	r=parse_bootconfig(fd);
+	close(fd);
+	return r;
+}
+
+static int load_android_dt(){
+	DIR*d;
+	struct dirent*e;
+	int dfd;
+	char key[256],value[256];
+	if((dfd=open(DT_ANDROID,O_DIR|O_CLOEXEC))<0)return 0;
+	if(!(d=fdopendir(dfd))){
+		close(dfd);
+		return -1;
+	}
+	while((e=readdir(d))){
+		if(e->d_type!=DT_REG)continue;
+		if(strcmp(e->d_name,"name")==0)continue;
+		if(strcmp(e->d_name,"phandle")==0)continue;
+		if(strcmp(e->d_name,"compatible")==0)continue;
+		if(fd_read_file(dfd,value,sizeof(value),false,"%s",e->d_name)<0)continue;
+		snprintf(key,sizeof(key),"androidboot.%s",e->d_name);
+		parse_param(key,value);
+	}
+	closedir(d);
+	tlog_info("load device tree android firmware done");
+	return 0;
+}
+
 int load_cmdline(){
 	tlog_debug("loading kernel cmdline");
 	int fd,r;
+	load_bootconfig();
 	if((fd=open(_PATH_PROC_CMDLINE,O_RDONLY))<0)
 		return telog_error("open "_PATH_PROC_CMDLINE);
 	r=parse_cmdline(fd);
 	close(fd);
+	load_android_dt();
 	return r;
 }
 
@@ -17,6 +17,7 @@
 #include"output.h"
 #include"keyval.h"
 #include"adbd.h"
+#include"metrics.h"
 static struct adb_data data;
 static int usage(){
 	return re_printf(2,
@@ -40,13 +41,13 @@ static int usage(){
 		"  DEVMODEL   : string (A-Z, a-z, 0-9, '-', '_')\n"
 		"  DEVPRODUCT : string (A-Z, a-z, 0-9, '-', '_')\n"
 		"  SHELL      : executable file path. (null for initshell)\n"
-		"  PROTOCOL   : force protocol. (usb or tcp)\n"
+		"  PROTOCOL   : force protocol. (usb, tcp or all)\n"
 		"\n"
 		"Options: \n"
 		"\t --help                  , -h            : show this help.\n"
 		"\t --protocol PROTOCOL     , -P PROTOCOL   : set protocol.\n"
-		"\t --usb                   , -u            : set to USB protocol.\n"
-		"\t --tcp                   , -t            : set to TCP protocol.\n"
+		"\t --usb                   , -u            : enable USB protocol.\n"
+		"\t --tcp                   , -t            : enable TCP protocol.\n"
 		"\t --daemon                , -d            : run in daemon mode.\n"
 		"\t --auth                  , -a            : turn on adbd need auth.\n"
 		"\t --devname DEVNAME       , -n DEVNAME    : device name. (ro.product.name)\n"
@@ -55,7 +56,7 @@ static int usage(){
 		"\t --banner BANNER         , -b BANNER     : device banner show in 'adb devices'.\n"
 		"\t --shell SHELL           , -s SHELL      : system shell. (adb shell)\n"
 		"\n"
-		"Support Protocols: usb, tcp",
+		"Support Protocols: usb, tcp, all (usb and tcp at the same time)",
 		data.banner,
 		kvlst_get(data.prop,"ro.product.name","unknown"),
 		kvlst_get(data.prop,"ro.product.model","unknown"),
@@ -102,11 +103,12 @@ int adbd_main(int argc,char**argv){
 		case 'n':data.prop=kvlst_set(data.prop,"ro.product.name",b_optarg);break;
 		case 'm':data.prop=kvlst_set(data.prop,"ro.product.model",b_optarg);break;
 		case 'p':data.prop=kvlst_set(data.prop,"ro.product.device",b_optarg);break;
-		case 'u':data.proto=PROTO_USB;break;
-		case 't':data.proto=PROTO_TCP;break;
+		case 'u':data.proto|=PROTO_USB;break;
+		case 't':data.proto|=PROTO_TCP;break;
 		case 'P':
 			if(strcasecmp(b_optarg,"tcp")==0)data.proto=PROTO_TCP;
 			else if(strcasecmp(b_optarg,"usb")==0)data.proto=PROTO_USB;
+			else if(strcasecmp(b_optarg,"all")==0)data.proto=PROTO_ALL;
 			else return re_printf(2,"Invalid argument '%s' for --%s\n",b_optarg,"protocol");
 		break;
 		default:return re_printf(2,"Unknown argument: %c\n",(char)o);
@@ -122,5 +124,6 @@ int adbd_main(int argc,char**argv){
 		else if(p==0)setsid();
 		else if(p<0)return re_err(1,"fork");
 	}
+	metrics_serve("adbd");
 	return adbd_init(&data);
 }
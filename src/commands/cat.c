@@ -6,9 +6,16 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<errno.h>
 #include<fcntl.h>
 #include<stdio.h>
+#include<stdlib.h>
 #include<string.h>
+#include<unistd.h>
+#include<stdbool.h>
+#include<sys/stat.h>
+#include<sys/sendfile.h>
 #include"getopt.h"
 #include"defines.h"
 #include"output.h"
@@ -21,15 +28,88 @@ static int usage(int e){
 		"\t-h, --help           show this help\n"
 	);
 }
+/*
+ * the kernel copies when it can, copy_file_range between regular files,
+ * sendfile from a regular file and splice when one side is a pipe. a
+ * method that is refused before it moved anything falls to the next,
+ * the last is a read and write loop with a big buffer.
+ */
+#define CAT_BUFFER (128*1024)
+#define CAT_CHUNK  (1024*1024*1024)
+
+enum cat_method{
+	CAT_COPY_RANGE,
+	CAT_SENDFILE,
+	CAT_SPLICE,
+	CAT_BUFFERED,
+};
+
+static bool cat_refused(int e){
+	switch(e){
+		case EINVAL:case ENOSYS:case EXDEV:
+		case EBADF:case EOPNOTSUPP:case ESPIPE:return true;
+		default:return false;
+	}
+}
+
+static ssize_t cat_kernel(enum cat_method m,int fd){
+	switch(m){
+		case CAT_COPY_RANGE:return copy_file_range(fd,NULL,STDOUT_FILENO,NULL,CAT_CHUNK,0);
+		case CAT_SENDFILE:return sendfile(STDOUT_FILENO,fd,NULL,CAT_CHUNK);
+		case CAT_SPLICE:return splice(fd,NULL,STDOUT_FILENO,NULL,CAT_CHUNK,SPLICE_F_MOVE|SPLICE_F_MORE);
+		default:ERET(EINVAL);
+	}
+}
+
+static int cat_buffered(int fd){
+	ssize_t r,w;
+	char sbuf[BUFSIZ],*buf=malloc(CAT_BUFFER);
+	size_t size=buf?CAT_BUFFER:sizeof(sbuf);
+	if(!buf)buf=sbuf;
+	while((r=read(fd,buf,size))!=0){
+		if(r<0){
+			if(errno==EINTR)continue;
+			break;
+		}
+		for(ssize_t o=0;o<r;o+=w)if((w=write(STDOUT_FILENO,buf+o,r-o))<=0){
+			if(w<0&&errno==EINTR){
+				w=0;
+				continue;
+			}
+			r=-1;
+			break;
+		}
+		if(r<0)break;
+	}
+	if(buf!=sbuf)free(buf);
+	return r<0?-1:0;
+}
+
 int cat_fd(int fd){
+	struct stat in,out;
+	enum cat_method m=CAT_BUFFERED;
+	bool moved=false;
 	ssize_t r;
-	char buf[BUFSIZ];
-	while(1){
-		memset(buf,0,BUFSIZ);
-		if((r=read(fd,buf,BUFSIZ-1))<=0)break;
-		if(write(STDOUT_FILENO,buf,(size_t)r)!=r)break;
+	fflush(stdout);
+	if(fstat(fd,&in)==0&&fstat(STDOUT_FILENO,&out)==0){
+		// pseudo files tell no size, the kernel may copy nothing of them
+		if(S_ISREG(in.st_mode)&&in.st_size>0)
+			m=S_ISREG(out.st_mode)?CAT_COPY_RANGE:CAT_SENDFILE;
+		else if(S_ISFIFO(in.st_mode)||S_ISFIFO(out.st_mode))m=CAT_SPLICE;
 	}
-	return 0;
+	while(m!=CAT_BUFFERED){
+		if((r=cat_kernel(m,fd))>0){
+			moved=true;
+			continue;
+		}
+		if(r==0)return 0;
+		if(errno==EINTR)continue;
+		if(moved||!cat_refused(errno))return -1;
+		if(m==CAT_COPY_RANGE)m=CAT_SENDFILE;
+		else if(m==CAT_SENDFILE&&(S_ISFIFO(in.st_mode)||S_ISFIFO(out.st_mode)))m=CAT_SPLICE;
+		else m=CAT_BUFFERED;
+	}
+	return cat_buffered(fd);
 }
 int cat_file(char*file){
 	if(!file)return -1;
@@ -0,0 +1,107 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<errno.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include"defines.h"
+#include"output.h"
+#include"confd.h"
+#include"str.h"
+#include"getopt.h"
+
+static int usage(int e){
+	return return_printf(
+		e,e==0?STDOUT_FILENO:STDERR_FILENO,
+		"Usage: confbench [OPTION]...\n"
+		"Benchmark init config daemon throughput and latency.\n\n"
+		"Options:\n"
+		"\t-s, --socket <SOCKET>  Use custom control socket (default is %s)\n"
+		"\t-t, --threads <N>      Concurrent client connections (default 4)\n"
+		"\t-n, --ops <N>          Requests per client (default 10000)\n"
+		"\t-k, --keys <N>         Synthetic keys to operate on (default 1000)\n"
+		"\t-m, --mix <G:S:L>      Get, set and list weights (default 80:15:5)\n"
+		"\t-h, --help             Display this help and exit\n",
+		DEFAULT_CONFD
+	);
+}
+
+static int parse_mix(char*mix,struct confd_bench*b){
+	char*end;
+	unsigned long v[3];
+	for(int i=0;i<3;i++){
+		errno=0;
+		v[i]=strtoul(mix,&end,10);
+		if(errno!=0||end==mix)return -1;
+		if(i<2&&*end++!=':')return -1;
+		mix=end;
+	}
+	if(*mix||v[0]+v[1]+v[2]==0)return -1;
+	b->get=v[0],b->set=v[1],b->ls=v[2];
+	return 0;
+}
+
+int confbench_main(int argc,char**argv){
+	static const struct option lo[]={
+		{"help",    no_argument,       NULL,'h'},
+		{"socket",  required_argument, NULL,'s'},
+		{"threads", required_argument, NULL,'t'},
+		{"ops",     required_argument, NULL,'n'},
+		{"keys",    required_argument, NULL,'k'},
+		{"mix",     required_argument, NULL,'m'},
+		{NULL,0,NULL,0}
+	};
+	int o;
+	long l;
+	char*socket=DEFAULT_CONFD;
+	struct confd_bench b={
+		.threads=4,.ops=10000,.keys=1000,
+		.get=80,.set=15,.ls=5,
+	};
+	while((o=b_getlopt(argc,argv,"hs:t:n:k:m:",lo,NULL))>0)switch(o){
+		case 'h':return usage(0);
+		case 's':socket=b_optarg;break;
+		case 't':
+			if((l=parse_long(b_optarg,0))<=0||l>1024)
+				return re_printf(2,"invalid threads: %s\n",b_optarg);
+			b.threads=l;
+		break;
+		case 'n':
+			if((l=parse_long(b_optarg,0))<=0)
+				return re_printf(2,"invalid ops: %s\n",b_optarg);
+			b.ops=l;
+		break;
+		case 'k':
+			if((l=parse_long(b_optarg,0))<=0)
+				return re_printf(2,"invalid keys: %s\n",b_optarg);
+			b.keys=l;
+		break;
+		case 'm':
+			if(parse_mix(b_optarg,&b)!=0)
+				return re_printf(2,"invalid mix: %s\n",b_optarg);
+		break;
+		default:return 1;
+	}
+	if(b_optind<argc)return re_printf(2,"too many arguments\n");
+	if(open_confd_socket(false,"confbench",socket)<0)return 2;
+	printf(
+		"clients: %zu, requests: %zu each, keys: %zu, mix: %u:%u:%u\n",
+		b.threads,b.ops,b.keys,b.get,b.set,b.ls
+	);
+	if(confd_bench_run(socket,&b)!=0)return re_err(1,"benchmark failed");
+	printf(
+		"requests: %zu in %.3fs (%.0f ops/s), %zu errors\n",
+		b.done,b.elapsed,b.elapsed>0?b.done/b.elapsed:0,b.errors
+	);
+	printf(
+		"latency: p50 %.1fus, p99 %.1fus, p999 %.1fus, max %.1fus\n",
+		b.p50/1e3,b.p99/1e3,b.p999/1e3,b.max/1e3
+	);
+	return b.errors>0?1:0;
+}
@@ -35,6 +35,7 @@ enum ctl_oper{
 	OPER_GETGRP,
 	OPER_GETMOD,
 	OPER_RENAME,
+	OPER_CONVERT,
 };
 
 static int usage(int e){
@@ -56,6 +57,7 @@ static int usage(int e){
 		"\t-S, --save <PATH>      Save config to a file\n"
 		"\t-x, --path <PATH>      Set default config path\n"
 		"\t-r, --rename           Rename config item\n"
+		"\t-C, --convert          Convert config file IN to OUT without confd\n"
 		"\t-q, --quit             Terminate confd\n"
 		"\t-D, --dump             Dump config store\n"
 		"\t-h, --help             Display this help and exit\n",
@@ -200,12 +202,13 @@ int confctl_main(int argc,char**argv){
 		{"getgrp",  no_argument,       NULL,'g'},
 		{"getmod",  no_argument,       NULL,'m'},
 		{"rename",  no_argument,       NULL,'r'},
+		{"convert", no_argument,       NULL,'C'},
 		{NULL,0,NULL,0}
 	};
 	char*socket=NULL,*key=NULL;
 	enum ctl_oper op=OPER_NONE;
 	int o;
-	while((o=b_getlopt(argc,argv,"hqDS:L:p:d:l:s:OGMogmr",lo,NULL))>0)switch(o){
+	while((o=b_getlopt(argc,argv,"hqDS:L:p:d:l:s:OGMogmrC",lo,NULL))>0)switch(o){
 		case 'h':return usage(0);
 		case 'q':
 			if(op!=OPER_NONE)goto conflict;
@@ -263,6 +266,10 @@ int confctl_main(int argc,char**argv){
 			if(op!=OPER_NONE)goto conflict;
 			op=OPER_RENAME;
 		break;
+		case 'C':
+			if(op!=OPER_NONE)goto conflict;
+			op=OPER_CONVERT;
+		break;
 		case 's':
 			if(socket)goto conflict;
 			socket=b_optarg;
@@ -271,6 +278,14 @@ int confctl_main(int argc,char**argv){
 	}
 	int ac=argc-b_optind;
 	char**av=argv+b_optind;
+	if(op==OPER_CONVERT){
+		if(ac<2)return re_printf(2,"missing arguments\n");
+		if(ac>2)return re_printf(2,"too many arguments\n");
+		errno=0;
+		if(conf_convert_file(av[0],av[1])!=0||errno!=0)
+			return re_err(1,"convert %s to %s failed",av[0],av[1]);
+		return 0;
+	}
 	if(!socket)socket=DEFAULT_CONFD;
 	if(open_confd_socket(false,"confctl",socket)<0)return 2;
 	int r;
@@ -323,6 +338,7 @@ int confctl_main(int argc,char**argv){
 			r=confd_rename(av[0],av[1]);
 			if(errno>0)perror(_("rename config item failed"));
 		break;
+		case OPER_CONVERT:r=2;break;
 		case OPER_NONE:{
 			if(ac<=0)return usage(1);
 			if(ac>2)return re_printf(2,"too many arguments\n");
@@ -6,19 +6,107 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<poll.h>
+#include<errno.h>
+#include<fcntl.h>
 #include<stdlib.h>
 #include<stdio.h>
+#include<string.h>
+#include<unistd.h>
 #include<sys/klog.h>
 #include"str.h"
 #include"output.h"
 #include"getopt.h"
+#include"defines.h"
 #include"kloglevel.h"
 
 static struct{
-	bool raw,clear;
+	bool raw,clear,follow;
 	int size;
 }opts;
 
+/*
+ * --follow reads /dev/kmsg, a read gives one record. records are read
+ * until none is left and written out in one go, then it sleeps in poll.
+ * records that were overwritten before they were read are skipped.
+ */
+#define KMSG_RECORD 8192
+#define KMSG_BUFFER (256*1024)
+
+static bool kmsg_flush(char*out,size_t*len){
+	ssize_t w;
+	for(size_t o=0;o<*len;o+=w)if((w=write(STDOUT_FILENO,out+o,*len-o))<=0){
+		if(w<0&&errno==EINTR){
+			w=0;
+			continue;
+		}
+		return false;
+	}
+	*len=0;
+	return true;
+}
+
+// "pri,seq,usec,flags;text\n" with " KEY=value" lines after it
+static size_t kmsg_format(char*rec,ssize_t len,char*out,size_t size){
+	char*text,*end;
+	unsigned long long usec=0;
+	int pri=0;
+	if(!(text=memchr(rec,';',len)))return 0;
+	text++;
+	if(!(end=memchr(text,'\n',rec+len-text)))end=rec+len;
+	sscanf(rec,"%d,%*u,%llu",&pri,&usec);
+	if(opts.raw)return snprintf(
+		out,size,"<%d>[%5llu.%06llu] %.*s\n",
+		pri,usec/1000000,usec%1000000,(int)(end-text),text
+	);
+	return snprintf(
+		out,size,"[%5llu.%06llu] %.*s\n",
+		usec/1000000,usec%1000000,(int)(end-text),text
+	);
+}
+
+static int dmesg_follow(void){
+	int fd,r=0;
+	ssize_t l;
+	size_t len=0,n;
+	char rec[KMSG_RECORD],*out;
+	struct pollfd pfd;
+	if((fd=open("/dev/kmsg",O_RDONLY|O_NONBLOCK|O_CLOEXEC))<0)
+		return re_err(1,"open /dev/kmsg");
+	if(!(out=malloc(KMSG_BUFFER))){
+		close(fd);
+		return re_printf(1,"malloc\n");
+	}
+	if(opts.clear){
+		if(klogctl(SYSLOG_ACTION_CLEAR,NULL,0)<0)r=re_err(1,"klogctl");
+		lseek(fd,0,SEEK_DATA);
+	}
+	pfd.fd=fd,pfd.events=POLLIN;
+	while(r==0){
+		if((l=read(fd,rec,sizeof(rec)-1))>0){
+			if(len+KMSG_RECORD+64>KMSG_BUFFER&&!kmsg_flush(out,&len))break;
+			n=kmsg_format(rec,l,out+len,KMSG_BUFFER-len);
+			len+=MIN(n,KMSG_BUFFER-len-1);
+			continue;
+		}
+		if(l<0&&errno==EPIPE)continue;
+		if(l<0&&errno==EINTR)continue;
+		if(l<0&&errno!=EAGAIN){
+			r=re_err(1,"read /dev/kmsg");
+			break;
+		}
+		if(len>0&&!kmsg_flush(out,&len))break;
+		if(poll(&pfd,1,-1)<0&&errno!=EINTR){
+			r=re_err(1,"poll");
+			break;
+		}
+	}
+	free(out);
+	close(fd);
+	return r;
+}
+
 static int usage(int e){
 	return return_printf(
 		e,e==0?STDOUT_FILENO:STDERR_FILENO,
@@ -29,6 +117,7 @@ static int usage(int e){
 		"\t-n, --level <LEVEL>  set console logging level\n"
 		"\t-c, --clear          clear ring buffer after printing\n"
 		"\t-r, --raw            print raw message buffer\n"
+		"\t-w, --follow         wait for new messages\n"
 		"\t-h, --help           show this help\n"
 	);
 }
@@ -41,20 +130,24 @@ int dmesg_main(int argc,char **argv){
 		{"level", required_argument,NULL,'n'},
 		{"clear", no_argument,      NULL,'c'},
 		{"raw",   no_argument,      NULL,'r'},
+		{"follow",no_argument,      NULL,'w'},
 		{"help",  no_argument,      NULL,'h'},
 		{NULL,0,NULL,0}
 	};
-	while((o=b_getlopt(argc,argv,"cs:n:r",lo,NULL))>0)switch(o){
+	while((o=b_getlopt(argc,argv,"cs:n:rwh",lo,NULL))>0)switch(o){
 		case 'n':return klogctl(
 			SYSLOG_ACTION_CONSOLE_LEVEL,
 			NULL,
 			parse_int(b_optarg,DEFAULT_KERN_LEVEL)
 		)?re_err(1,"klogctl"):0;
 		case 'c':opts.clear=true;break;
+		case 's':opts.size=parse_int(b_optarg,0);break;
 		case 'r':opts.raw=true;break;
+		case 'w':opts.follow=true;break;
 		case 'h':return usage(0);
 		default:return 1;
 	}
+	if(opts.follow)return dmesg_follow();
 	if(opts.size==0)opts.size=klogctl(SYSLOG_ACTION_SIZE_BUFFER,NULL,0);
 	if(opts.size<16*1024)opts.size=16*1024;
 	if(opts.size>16*1024*1024)opts.size=16*1024*1024;
@@ -259,7 +259,7 @@ static int read_netlink(struct poll_device*dev){
 	for(ssize_t x=0;x<s;x++)if(buf[x]==0)buf[x]='\n';
 	if(!(v=strchr(buf,'\n')))return 0;
 	v++;
-	uevent_parse(v,&event);
+	if(!uevent_parse(v,&event))return 0;
 	if(!event.subsystem||!event.devname)goto done;
 	if(strcmp(event.subsystem,"input")!=0)goto done;
 	memset(path,0,sizeof(path));
@@ -274,8 +274,7 @@ static int read_netlink(struct poll_device*dev){
 		}break;
 		default:;
 	}
-	done:kvarr_free(event.environs);
-	return 0;
+	done:return 0;
 }
 
 static int process_device(struct poll_device*dev){
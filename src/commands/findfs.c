@@ -8,9 +8,12 @@
 
 #include<stdio.h>
 #include<stdlib.h>
-#include<blkid/blkid.h>
+#include<unistd.h>
 #include"getopt.h"
 #include"output.h"
+#include"system.h"
+#include"pathnames.h"
+#include"devd.h"
 
 static int usage(int e){
 	return return_printf(
@@ -31,7 +34,12 @@ int findfs_main(int argc,char**argv){
 		case 'h':return usage(0);
 		default:return -1;
 	}
-	char*dev=blkid_evaluate_tag(argv[1],NULL,NULL);
+
+	// devd probed every block once, ask it before blkid probes again
+	char*dev=NULL;
+	if(access(DEFAULT_DEVD,F_OK)==0&&open_default_devd_socket("findfs")>=0)
+		dev=devd_find_tag(argv[1]);
+	if(!dev)dev=blk_resolve_tag(argv[1]);
 	if(!dev)return re_printf(1,"findfs: unable to resolve '%s'\n",argv[1]);
 	puts(dev);
 	free(dev);
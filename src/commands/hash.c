@@ -0,0 +1,46 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include"output.h"
+#include"defines.h"
+#include"pathnames.h"
+#include"../shell/shell_internal.h"
+
+static void print_hash(const char*name __attribute__((unused)),const char*path,unsigned int hits){
+	dprintf(STDOUT_FILENO,"%4u\t%s\n",hits,path);
+}
+
+int hash_main(int argc,char**argv){
+	int r=0;
+	char cp[PATH_MAX];
+	if(argc==1){
+		dprintf(STDOUT_FILENO,"hits\tcommand\n");
+		shell_hash_foreach(print_hash);
+		return 0;
+	}
+	if(strcmp(argv[1],"-r")==0){
+		if(argc!=2)return re_printf(1,"Usage: hash [-r] [-d NAME...] [NAME...]\n");
+		shell_hash_clear();
+		return 0;
+	}
+	if(strcmp(argv[1],"-d")==0){
+		for(int i=2;i<argc;i++)shell_hash_forget(argv[i]);
+		return 0;
+	}
+	for(int i=1;i<argc;i++){
+		if(strchr(argv[i],'/'))continue;
+		if(shell_hash_lookup(argv[i],cp,false)==0)continue;
+		dprintf(STDERR_FILENO,"hash: %s: not found\n",argv[i]);
+		r=1;
+	}
+	return r;
+}
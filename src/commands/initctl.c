@@ -7,11 +7,15 @@
  */
 
 #include<errno.h>
+#include<fcntl.h>
 #include<stdio.h>
+#include<stdlib.h>
 #include<string.h>
+#include<unistd.h>
 #include"output.h"
 #include"logger.h"
 #include"getopt.h"
+#include"array.h"
 #include"init_internal.h"
 
 static int usage(int e){
@@ -27,11 +31,14 @@ static int usage(int e){
 		"\tsetenv <KEY> <VALUE>      Add environment variable\n"
 		"\taddenv <KEY>=<VALUE>      Add environment variable\n"
 		"\tlanguage <LANGUAGE>       Set system current language\n"
-		"\tstart <SERVICE>           Start service\n"
-		"\tstop <SERVICE>            Stop service\n"
-		"\trestart <SERVICE>         Re-Start service\n"
-		"\treload <SERVICE>          Re-Load service\n"
+		"\tstart <SERVICE>...        Start services\n"
+		"\tstop <SERVICE>...         Stop services\n"
+		"\trestart <SERVICE>...      Re-Start services\n"
+		"\treload <SERVICE>...       Re-Load services\n"
+		"\tbatch [FILE]              Send commands from FILE or stdin, one per line\n"
 		"\tdump                      Dump all service to loggerd\n"
+		"\tbootchart [FILE]          Dump boot timeline as chrome trace json\n"
+		"\tstats [SERVICE]           Show cpu, memory and io usage of services\n"
 		"Options:\n"
 		"\t-s, --socket <SOCKET>     Use custom initd socket\n"
 		"\t-h, --help                Display this help and exit\n"
@@ -98,13 +105,12 @@ static int cmd_switchroot(int argc,char**argv){
 	return cmd_wrapper(&msg,argv[0]);
 }
 
-static int cmd_setenv(int argc,char**argv){
+static int build_setenv(struct init_msg*msg,int argc,char**argv){
 	if(argc>3)return re_printf(2,"too many arguments\n");
 	if(argc<2)return re_printf(2,"missing arguments\n");
-	#define xkey msg.data.env.key
-	#define xvalue msg.data.env.value
+	#define xkey msg->data.env.key
+	#define xvalue msg->data.env.value
 	char*key,*value;
-	struct init_msg msg;
 	size_t klen=0,vlen=0;
 	size_t s1=sizeof(xkey),s2=sizeof(xvalue);
 	switch(argc){
@@ -120,10 +126,16 @@ static int cmd_setenv(int argc,char**argv){
 	}
 	if(klen<=0)return re_printf(2,"invalid environ name\n");
 	if(klen>=s1||vlen>=s2)return re_printf(2,"arguments too long\n");
-	init_initialize_msg(&msg,ACTION_ADDENV);
+	init_initialize_msg(msg,ACTION_ADDENV);
 	strncpy(xkey,key,klen);
 	strncpy(xvalue,value,vlen);
-	return cmd_wrapper(&msg,argv[0]);
+	return 0;
+}
+
+static int cmd_setenv(int argc,char**argv){
+	struct init_msg msg;
+	int r=build_setenv(&msg,argc,argv);
+	return r!=0?r:cmd_wrapper(&msg,argv[0]);
 }
 
 static int cmd_language(int argc,char**argv){
@@ -135,20 +147,110 @@ static int cmd_language(int argc,char**argv){
 	return cmd_wrapper(&msg,argv[0]);
 }
 
+static int build_service(struct init_msg*msg,char*act,char*name){
+	init_initialize_msg(msg,ACTION_NONE);
+	if(!name||strlen(name)<=0)return re_printf(2,"invalid service name\n");
+	if(strlen(name)>=sizeof(msg->data.data))return re_printf(2,"arguments too long\n");
+	if(strcmp(act,"start")==0)msg->action=ACTION_SVC_START;
+	else if(strcmp(act,"stop")==0)msg->action=ACTION_SVC_STOP;
+	else if(strcmp(act,"reload")==0)msg->action=ACTION_SVC_RELOAD;
+	else if(strcmp(act,"restart")==0)msg->action=ACTION_SVC_RESTART;
+	else return re_printf(2,"invalid action %s\n",act);
+	strncpy(msg->data.data,name,sizeof(msg->data.data)-1);
+	return 0;
+}
+
+// send all requests at once, then report every failed one
+static int send_batch(struct init_msg*msgs,char**names,size_t cnt){
+	int r=0;
+	struct init_msg*res;
+	if(!(res=malloc(sizeof(struct init_msg)*cnt)))
+		return re_printf(1,"alloc failed\n");
+	if(init_send_batch(msgs,res,cnt)!=0){
+		perror(_("send command"));
+		free(res);
+		return 1;
+	}
+	for(size_t i=0;i<cnt;i++){
+		if(res[i].data.status.ret==0)continue;
+		fprintf(
+			stderr,_("execute %s: %s\n"),
+			names[i],strerror(res[i].data.status.ret)
+		);
+		if(r==0)r=res[i].data.status.ret;
+	}
+	free(res);
+	return r;
+}
+
 static int cmd_service(int argc,char**argv){
-	if(argc>2)return re_printf(2,"too many arguments\n");
+	int r;
+	struct init_msg*msgs;
 	if(argc<2)return re_printf(2,"missing arguments\n");
-	struct init_msg msg;
-	init_initialize_msg(&msg,ACTION_NONE);
-	if(!argv[1]||strlen(argv[1])<=0)return re_printf(2,"invalid service name\n");
-	if(strlen(argv[1])>=sizeof(msg.data.data))return re_printf(2,"arguments too long\n");
-	if(strcmp(argv[0],"start")==0)msg.action=ACTION_SVC_START;
-	else if(strcmp(argv[0],"stop")==0)msg.action=ACTION_SVC_STOP;
-	else if(strcmp(argv[0],"reload")==0)msg.action=ACTION_SVC_RELOAD;
-	else if(strcmp(argv[0],"restart")==0)msg.action=ACTION_SVC_RESTART;
-	else return re_printf(2,"invalid action %s\n",argv[1]);
-	strncpy(msg.data.data,argv[1],sizeof(msg.data.data)-1);
-	return cmd_wrapper(&msg,argv[0]);
+	if(!(msgs=malloc(sizeof(struct init_msg)*(argc-1))))
+		return re_printf(1,"alloc failed\n");
+	for(int i=1;i<argc;i++)if((r=build_service(&msgs[i-1],argv[0],argv[i]))!=0){
+		free(msgs);
+		return r;
+	}
+	r=send_batch(msgs,argv+1,argc-1);
+	free(msgs);
+	return r;
+}
+
+static int build_line(struct init_msg*msg,int argc,char**argv){
+	if(argc<1)return re_printf(2,"missing arguments\n");
+	if(strcmp(argv[0],"setenv")==0||strcmp(argv[0],"addenv")==0)
+		return build_setenv(msg,argc,argv);
+	if(strcmp(argv[0],"language")==0||strcmp(argv[0],"lang")==0){
+		if(argc!=2)return re_printf(2,"invalid arguments\n");
+		init_initialize_msg(msg,ACTION_LANGUAGE);
+		strncpy(msg->data.data,argv[1],sizeof(msg->data.data)-1);
+		return 0;
+	}
+	if(argc!=2)return re_printf(2,"invalid arguments for %s\n",argv[0]);
+	return build_service(msg,argv[0],argv[1]);
+}
+
+static int cmd_batch(int argc,char**argv){
+	FILE*f=stdin;
+	int r=0;
+	size_t cnt=0,size=0,n=0;
+	char*line=NULL,**args,**names=NULL,**nn;
+	struct init_msg*msgs=NULL,*nm;
+	if(argc>2)return re_printf(2,"too many arguments\n");
+	if(argc==2&&strcmp(argv[1],"-")!=0&&!(f=fopen(argv[1],"r")))
+		return re_printf(1,"open %s failed: %m\n",argv[1]);
+	while(r==0&&getline(&line,&n,f)>=0){
+		char*p=line+strspn(line," \t");
+		p[strcspn(p,"#\r\n")]=0;
+		if(!*p)continue;
+		if(cnt>=size){
+			size=size?size*2:64;
+			if((nm=realloc(msgs,sizeof(struct init_msg)*size)))msgs=nm;
+			if((nn=realloc(names,sizeof(char*)*size)))names=nn;
+			if(!nm||!nn){
+				r=re_printf(1,"alloc failed\n");
+				break;
+			}
+		}
+		if(!(args=args2array(p,0))){
+			r=re_printf(2,"invalid line: %s\n",p);
+			break;
+		}
+		int ac=0;
+		while(args[ac])ac++;
+		if((r=build_line(&msgs[cnt],ac,args))==0)
+			names[cnt++]=strdup(args[0]);
+		free_args_array(args);
+	}
+	if(r==0&&cnt>0)r=send_batch(msgs,names,cnt);
+	for(size_t i=0;i<cnt;i++)if(names[i])free(names[i]);
+	if(names)free(names);
+	if(msgs)free(msgs);
+	if(line)free(line);
+	if(f!=stdin)fclose(f);
+	return r;
 }
 
 static int cmd_service_dump(int argc,char**argv){
@@ -158,6 +260,55 @@ static int cmd_service_dump(int argc,char**argv){
 	return cmd_wrapper(&msg,argv[0]);
 }
 
+// write reply chunks of msg->action to fd until the final status
+static int recv_chunks(struct init_msg*msg,int fd,char*name){
+	int r=0;
+	struct init_msg response;
+	if(init_send_raw(msg)!=0)r=-errno;
+	else while(true){
+		if(init_recv_raw(&response)!=0){
+			r=-errno;
+			break;
+		}
+		if(response.action==msg->action){
+			size_t len=strnlen(response.data.data,sizeof(response.data.data));
+			if(write(fd,response.data.data,len)!=(ssize_t)len){
+				r=-errno;
+				break;
+			}
+		}else if(response.action==ACTION_OK||response.action==ACTION_FAIL){
+			r=response.data.status.ret;
+			break;
+		}
+	}
+	if(r<0)perror(_("send command"));
+	else if(r>0)fprintf(stderr,_("execute %s: %s\n"),name,strerror(r));
+	return r<0?-r:r;
+}
+
+static int cmd_bootchart(int argc,char**argv){
+	if(argc>2)return re_printf(2,"too many arguments\n");
+	int fd=STDOUT_FILENO,r;
+	struct init_msg msg;
+	if(argc==2&&(fd=open(argv[1],O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644))<0)
+		return re_printf(1,"open %s failed: %m\n",argv[1]);
+	init_initialize_msg(&msg,ACTION_BOOTCHART);
+	r=recv_chunks(&msg,fd,argv[0]);
+	if(fd!=STDOUT_FILENO)close(fd);
+	return r;
+}
+
+static int cmd_usage(int argc,char**argv){
+	if(argc>2)return re_printf(2,"too many arguments\n");
+	struct init_msg msg;
+	init_initialize_msg(&msg,ACTION_SVC_USAGE);
+	if(argc==2){
+		if(strlen(argv[1])>=sizeof(msg.data.data))return re_printf(2,"arguments too long\n");
+		strncpy(msg.data.data,argv[1],sizeof(msg.data.data)-1);
+	}
+	return recv_chunks(&msg,STDOUT_FILENO,argv[0]);
+}
+
 struct{
 	char*name;
 	int(*cmd_handle)(int,char**);
@@ -178,6 +329,9 @@ struct{
 	{"restart",       cmd_service},
 	{"reload",        cmd_service},
 	{"dump",          cmd_service_dump},
+	{"batch",         cmd_batch},
+	{"bootchart",     cmd_bootchart},
+	{"stats",         cmd_usage},
 	{NULL,NULL}
 };
 
@@ -21,6 +21,8 @@ enum ctl_oper{
 	OPER_OPEN,
 	OPER_LISTEN,
 	OPER_ADD,
+	OPER_FILTER,
+	OPER_STATS,
 	OPER_QUIT
 };
 
@@ -37,6 +39,8 @@ static int usage(int e){
 		"\t-l, --listen <SOCKET>    listen to new socket\n"
 		"\t-o, --output <OUTPUT>    write log to new file\n"
 		"\t-a, --add                send log to loggerd\n"
+		"\t-f, --filter <FILTER>    set per tag levels (e.g. devd=debug,*=info)\n"
+		"\t-S, --stats              show queue depth and drops of every output\n"
 		"\t-q, --quit               terminate loggerd\n"
 		"\t-h, --help               display this help and exit\n",
 		DEFAULT_LOGGER
@@ -87,12 +91,14 @@ int loggerctl_main(int argc,char**argv){
 	static const struct option lo[]={
 		{"help",    no_argument,       NULL,'h'},
 		{"quit",    no_argument,       NULL,'q'},
+		{"stats",   no_argument,       NULL,'S'},
 		{"add",     no_argument,       NULL,'a'},
 		{"pid",     required_argument, NULL,'p'},
 		{"tag",     required_argument, NULL,'t'},
 		{"level",   required_argument, NULL,'n'},
 		{"listen",  required_argument, NULL,'l'},
 		{"output",  required_argument, NULL,'o'},
+		{"filter",  required_argument, NULL,'f'},
 		{"socket",  required_argument, NULL,'s'},
 		{NULL,0,NULL,0}
 	};
@@ -101,12 +107,16 @@ int loggerctl_main(int argc,char**argv){
 	enum log_level level=0;
 	pid_t pid=-1;
 	int o;
-	while((o=b_getlopt(argc,argv,"hqap:t:n:l:o:s:",lo,NULL))>0)switch(o){
+	while((o=b_getlopt(argc,argv,"hqSap:t:n:l:o:f:s:",lo,NULL))>0)switch(o){
 		case 'h':return usage(0);
 		case 'q':
 			if(op!=OPER_NONE)goto conflict;
 			op=OPER_QUIT;
 		break;
+		case 'S':
+			if(op!=OPER_NONE)goto conflict;
+			op=OPER_STATS;
+		break;
 		case 'a':
 			if(op!=OPER_NONE)goto conflict;
 			op=OPER_ADD;
@@ -138,6 +148,11 @@ int loggerctl_main(int argc,char**argv){
 			op=OPER_OPEN;
 			data=b_optarg;
 		break;
+		case 'f':
+			if(op!=OPER_NONE)goto conflict;
+			op=OPER_FILTER;
+			data=b_optarg;
+		break;
 		case 's':
 			if(socket)goto conflict;
 			socket=b_optarg;
@@ -169,6 +184,24 @@ int loggerctl_main(int argc,char**argv){
 			r=logger_listen(data);
 			if(errno>0)stderr_perror("listen new socket %s",data);
 		break;
+		case OPER_FILTER:
+			r=logger_send_filter(data);
+			if(errno>0)stderr_perror("set log filter %s",data);
+		break;
+		case OPER_STATS:{
+			char name[PATH_MAX],buff[16384],*p=buff;
+			unsigned long long depth,drops,written;
+			if((r=logger_get_stats(buff,sizeof(buff)))!=0){
+				if(errno>0)perror(_("get loggerd stats"));
+				break;
+			}
+			printf("%-32s %8s %8s %12s\n","OUTPUT","DEPTH","DROPS","WRITTEN");
+			while(sscanf(p,"%4095s %llu %llu %llu",name,&depth,&drops,&written)==4){
+				printf("%-32s %8llu %8llu %12llu\n",name,depth,drops,written);
+				if(!(p=strchr(p,'\n')))break;
+				p++;
+			}
+		}break;
 		default:r=re_printf(2,"no action specified\n");break;
 	}
 	return r;
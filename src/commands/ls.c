@@ -14,7 +14,11 @@
 #include<errno.h>
 #include<string.h>
 #include<dirent.h>
+#include<unistd.h>
+#include<pthread.h>
 #include<sys/stat.h>
+#include<sys/vfs.h>
+#include<sys/syscall.h>
 #include<sys/sysmacros.h>
 #include<stdlib.h>
 #include"str.h"
@@ -33,6 +37,7 @@ static struct{
 	bool list,all,directory,inode,type;
 	bool numeric,size,nogroup,human;
 	bool fulltime,atime,ctime,color;
+	bool unsorted;
 	int perline;
 	time_t curtime;
 	char whencolor[32];
@@ -61,107 +66,296 @@ static char append_char(mode_t mode){
 	return APPCHAR(mode);
 }
 
-static void display_single(int fd,int dfd,char*op,char*name){
+/*
+ * entries come from getdents64 with a big buffer and are sorted by name
+ * unless -U. statx only asks for what the format prints, a plain list
+ * stats nothing and -F or colors take the type from d_type, only regular
+ * files need their mode there. -U with one entry per line prints every
+ * buffer as soon as it is read. on network filesystems big directories
+ * are stated by several threads, every stat is a round trip there.
+ */
+#define DENTS_BUFFER   (128*1024)
+#define PARALLEL_MIN   64
+#define PARALLEL_MAX   16
+
+struct linux_dirent64{
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct ls_ent{
+	char*name,*link;
+	unsigned char type;
+	int err;
+	bool stated;
+	struct statx st;
+};
+
+struct ls_dir{
+	int dfd;
+	char*path;
+	unsigned int mask;
+	struct ls_ent*ents;
+	size_t cnt,size,next;
+};
+
+static unsigned int stat_mask(void){
+	unsigned int m=0;
+	if(opts.list){
+		m|=STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_UID|STATX_GID|STATX_SIZE;
+		m|=opts.atime?STATX_ATIME:opts.ctime?STATX_CTIME:STATX_MTIME;
+	}
+	if(opts.inode)m|=STATX_INO;
+	if(opts.size)m|=STATX_BLOCKS;
+	if(opts.color||opts.type)m|=STATX_TYPE|STATX_MODE;
+	return m;
+}
+
+static int ls_statx(int dfd,const char*name,unsigned int mask,struct statx*stx){
+	static bool nostatx=false;
 	struct stat st;
-	char lpath[PATH_MAX]={0},nb[128]={0};
-	if(fstatat(dfd,name,&st,AT_SYMLINK_NOFOLLOW)>=0){
-		if(
-			S_ISLNK(st.st_mode)&&
-			readlinkat(dfd,name,lpath,PATH_MAX-1)<0
-		)stderr_perror("%s: cannot readlink %s%s%s",progname,op?op:"",op?"/":"",name);
-		if(opts.inode)dprintf(fd,"%7llu ",(long long)st.st_ino);
-		if(opts.size)dprintf(fd,"%6llu ",(long long)(st.st_blocks>>1));
-		if(opts.list){
-			dprintf(fd,"%-10s ",(char*)mode_string(st.st_mode));
-			dprintf(fd,"%4lu ",(long)st.st_nlink);
-			if(opts.numeric){
-				dprintf(fd,"%-8u ",(int)st.st_uid);
-				if(!opts.nogroup)dprintf(
-					fd,"%-8u ",
-					(int)st.st_gid
-				);
-			}else{
-				dprintf(fd,"%-8.8s ",get_username(st.st_uid,nb,128));
-				if(!opts.nogroup)dprintf(
-					fd,"%-8.8s ",
-					get_groupname(st.st_gid,nb,128)
-				);
-			}
-			if(
-				S_ISBLK(st.st_mode)||
-				S_ISCHR(st.st_mode)
-			)dprintf(fd,"%4u,%4u ",major(st.st_rdev),minor(st.st_rdev));
-			else if (opts.human)dprintf(fd,"%9s ",make_readable_str(st.st_size,1,0));
-			else dprintf(fd,"%9llu ",(unsigned long long)st.st_size);
-			time_t stime=st.st_mtime;
-			if(opts.atime)stime=st.st_atime;
-			if(opts.ctime)stime=st.st_ctime;
-			if(opts.fulltime){
-				char buf[32]={0};
-				strftime(buf,31,"%Y-%m-%d %H:%M:%S %z",localtime(&stime));
-				dprintf(fd,"%s ",buf);
-			}else{
-				char*ft=ctime(&stime);
-				time_t age=opts.curtime-stime;
-				if(age<3600L*24*365/2&&age>-15*60)dprintf(fd,"%.12s ",ft+4);
-				else{
-					strchr(ft+20,'\n')[0]=' ';
-					dprintf(fd,"%.7s%6s",ft+4,ft+20);
-				}
-			}
+	if(!nostatx){
+		if(statx(dfd,name,AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT,mask,stx)==0)return 0;
+		if(errno!=ENOSYS)return -1;
+		nostatx=true;
+	}
+	if(fstatat(dfd,name,&st,AT_SYMLINK_NOFOLLOW)<0)return -1;
+	memset(stx,0,sizeof(struct statx));
+	stx->stx_mode=st.st_mode,stx->stx_nlink=st.st_nlink;
+	stx->stx_uid=st.st_uid,stx->stx_gid=st.st_gid;
+	stx->stx_ino=st.st_ino,stx->stx_size=st.st_size;
+	stx->stx_blocks=st.st_blocks;
+	stx->stx_rdev_major=major(st.st_rdev);
+	stx->stx_rdev_minor=minor(st.st_rdev);
+	stx->stx_atime.tv_sec=st.st_atime;
+	stx->stx_mtime.tv_sec=st.st_mtime;
+	stx->stx_ctime.tv_sec=st.st_ctime;
+	return 0;
+}
+
+static void stat_ent(int dfd,unsigned int mask,struct ls_ent*e){
+	char lpath[PATH_MAX];
+	ssize_t l;
+	e->stated=false;
+	if(mask==0)return;
+
+	// colors and -F only need the mode of regular files
+	if(
+		(mask&~(STATX_TYPE|STATX_MODE))==0&&
+		e->type!=DT_UNKNOWN&&e->type!=DT_REG
+	){
+		memset(&e->st,0,sizeof(e->st));
+		e->st.stx_mode=DTTOIF(e->type);
+		e->stated=true;
+		return;
+	}
+	if(ls_statx(dfd,e->name,mask,&e->st)<0){
+		e->err=errno;
+		return;
+	}
+	e->stated=true;
+	if(opts.list&&S_ISLNK(e->st.stx_mode)){
+		if((l=readlinkat(dfd,e->name,lpath,sizeof(lpath)-1))<0)e->err=errno;
+		else lpath[l]=0,e->link=strdup(lpath);
+	}
+}
+
+static void*stat_worker(void*data){
+	size_t i;
+	struct ls_dir*d=data;
+	while((i=__atomic_fetch_add(&d->next,1,__ATOMIC_RELAXED))<d->cnt)
+		stat_ent(d->dfd,d->mask,&d->ents[i]);
+	return NULL;
+}
+
+static bool is_network_fs(int dfd){
+	struct statfs sf;
+	if(fstatfs(dfd,&sf)<0)return false;
+	switch((unsigned long)sf.f_type){
+		case 0x6969:     // nfs
+		case 0x517B:     // smb
+		case 0xFF534D42: // cifs
+		case 0xFE534D42: // smb2
+		case 0x65735546: // fuse
+		case 0x01021997: // 9p
+		case 0x73757245: // coda
+		case 0x564C:     // ncp
+			return true;
+		default:return false;
+	}
+}
+
+static void stat_ents(struct ls_dir*d){
+	pthread_t ts[PARALLEL_MAX];
+	size_t n=0,want;
+	d->next=0;
+	if(d->mask!=0&&d->cnt>=PARALLEL_MIN&&is_network_fs(d->dfd)){
+		want=MIN((size_t)PARALLEL_MAX,d->cnt/PARALLEL_MIN+1);
+		while(n<want&&pthread_create(&ts[n],NULL,stat_worker,d)==0)n++;
+	}
+	stat_worker(d);
+	for(size_t i=0;i<n;i++)pthread_join(ts[i],NULL);
+}
+
+static void display_single(FILE*out,struct ls_ent*e,char*op){
+	char nb[128]={0};
+	struct statx*st=&e->st;
+	mode_t mode=st->stx_mode;
+	if(e->err){
+		errno=e->err;
+		stderr_perror(
+			"%s: cannot %s %s%s%s",progname,
+			e->stated?"readlink":"stat",
+			op?op:"",op?"/":"",e->name
+		);
+	}
+	if(!e->stated){
+		fputs(e->name,out);
+		return;
+	}
+	if(opts.inode)fprintf(out,"%7llu ",(unsigned long long)st->stx_ino);
+	if(opts.size)fprintf(out,"%6llu ",(unsigned long long)(st->stx_blocks>>1));
+	if(opts.list){
+		fprintf(out,"%-10s ",(char*)mode_string(mode));
+		fprintf(out,"%4lu ",(unsigned long)st->stx_nlink);
+		if(opts.numeric){
+			fprintf(out,"%-8u ",(unsigned int)st->stx_uid);
+			if(!opts.nogroup)fprintf(out,"%-8u ",(unsigned int)st->stx_gid);
+		}else{
+			fprintf(out,"%-8.8s ",get_username(st->stx_uid,nb,128));
+			if(!opts.nogroup)fprintf(out,"%-8.8s ",get_groupname(st->stx_gid,nb,128));
 		}
-		if(opts.color)dprintf(fd,"\033[%u;%um",bold(st.st_mode),fgcolor(st.st_mode));
-		dprintf(fd,"%s",name);
-		if(opts.color)dprintf(fd,"\033[m");
-		if(opts.list){
-			if(lpath[0])dprintf(fd," -> %s",lpath);
-			if(opts.type)dprintf(fd,"%c",append_char(st.st_mode));
+		if(S_ISBLK(mode)||S_ISCHR(mode))
+			fprintf(out,"%4u,%4u ",st->stx_rdev_major,st->stx_rdev_minor);
+		else if(opts.human)fprintf(out,"%9s ",make_readable_str(st->stx_size,1,0));
+		else fprintf(out,"%9llu ",(unsigned long long)st->stx_size);
+		time_t stime=st->stx_mtime.tv_sec;
+		if(opts.atime)stime=st->stx_atime.tv_sec;
+		if(opts.ctime)stime=st->stx_ctime.tv_sec;
+		if(opts.fulltime){
+			char buf[32]={0};
+			strftime(buf,31,"%Y-%m-%d %H:%M:%S %z",localtime(&stime));
+			fprintf(out,"%s ",buf);
+		}else{
+			char*ft=ctime(&stime);
+			time_t age=opts.curtime-stime;
+			if(age<3600L*24*365/2&&age>-15*60)fprintf(out,"%.12s ",ft+4);
+			else{
+				strchr(ft+20,'\n')[0]=' ';
+				fprintf(out,"%.7s%6s",ft+4,ft+20);
+			}
 		}
-	}else{
-		stderr_perror("%s: cannot stat %s%s%s",progname,op?op:"",op?"/":"",name);
-		dprintf(fd,"%s",name);
 	}
-	fsync(fd);
+	if(opts.color)fprintf(out,"\033[%u;%um",bold(mode),fgcolor(mode));
+	fputs(e->name,out);
+	if(opts.color)fputs("\033[m",out);
+	if(opts.list){
+		if(e->link)fprintf(out," -> %s",e->link);
+		if(opts.type&&append_char(mode))fputc(append_char(mode),out);
+	}
+}
+
+static void free_ents(struct ls_dir*d){
+	for(size_t i=0;i<d->cnt;i++){
+		free(d->ents[i].name);
+		if(d->ents[i].link)free(d->ents[i].link);
+	}
+	d->cnt=0;
 }
 
-static int do_list(int fd,char*path){
+static bool add_ent(struct ls_dir*d,struct linux_dirent64*de){
+	struct ls_ent*n;
+	if(d->cnt>=d->size){
+		size_t ns=d->size?d->size*2:256;
+		if(!(n=realloc(d->ents,sizeof(struct ls_ent)*ns)))return false;
+		d->ents=n,d->size=ns;
+	}
+	n=&d->ents[d->cnt];
+	memset(n,0,sizeof(struct ls_ent));
+	if(!(n->name=strdup(de->d_name)))return false;
+	n->type=de->d_type;
+	d->cnt++;
+	return true;
+}
+
+static int ent_cmp(const void*a,const void*b){
+	return strcmp(((struct ls_ent*)a)->name,((struct ls_ent*)b)->name);
+}
+
+static void print_ents(FILE*out,struct ls_dir*d){
+	size_t max=0,p;
+	int s=MAX(get_term_width(STDOUT_FILENO,40),40),c=s,x=0;
+	for(size_t i=0;i<d->cnt;i++)max=MAX(max,strlen(d->ents[i].name));
+	for(size_t i=0;i<d->cnt;i++){
+		display_single(out,&d->ents[i],d->path);
+		x++;
+		if((x<opts.perline||opts.perline<=0)&&!opts.list){
+			p=strlen(d->ents[i].name),c-=p;
+			p=max-p+2,c-=p;
+			if(c>0)fprintf(out,"%*s",(int)p,"");
+			else{
+				fputc('\n',out);
+				c=s,x=0;
+			}
+		}else fputc('\n',out);
+	}
+	if(c!=s)fputc('\n',out);
+}
+
+static int do_list(FILE*out,char*path){
 	static char*op;
 	op=path;
 	if(!path)op=".";
 	size_t ss=strlen(op);
 	if(ss==0)return EINVAL;
 	if(ss-1>0&&op[ss-1]=='/')op[ss-1]=0;
-	int dfd=open(op,O_RDONLY|O_DIRECTORY);
-	if(dfd<0)return re_err(2,"ls: opening directory %s",op);
-	DIR*d=fdopendir(dfd);
-	if(!d){
-		close(dfd);
+	struct ls_dir d={.path=op,.mask=stat_mask()};
+	bool stream=opts.unsorted&&(opts.list||opts.perline==1);
+	char*buf;
+	long r;
+	int ret=0;
+	if((d.dfd=open(op,O_RDONLY|O_DIRECTORY|O_CLOEXEC))<0)
+		return re_err(2,"ls: opening directory %s",op);
+	if(!(buf=malloc(DENTS_BUFFER))){
+		close(d.dfd);
 		return re_err(2,"ls: reading directory %s",op);
 	}
-	size_t max=0,p;
-	int s=MAX(get_term_width(fd,40),40),c=s,x=0;
-	struct dirent*r=NULL;
-	while((r=readdir(d)))if(r->d_name[0]!='.'||opts.all){
-		max=MAX(max,strlen(r->d_name));
-	}
-	seekdir(d,0);
-	while((r=readdir(d))){
-		if(r->d_name[0]=='.'&&!opts.all)continue;
-		display_single(fd,dfd,op,r->d_name);
-		x++;
-		if((x<opts.perline||opts.perline<=0)&&!opts.list){
-			p=strlen(r->d_name),c-=p;
-			p=max-p+2,c-=p;
-			if(c>0)repeat(fd,' ',p);
-			else{
-				dprintf(fd,"\n");
-				c=s,x=0;
+	while((r=syscall(SYS_getdents64,d.dfd,buf,DENTS_BUFFER))>0){
+		for(long o=0;o<r;){
+			struct linux_dirent64*de=(struct linux_dirent64*)(buf+o);
+			o+=de->d_reclen;
+			if(de->d_name[0]=='.'&&!opts.all)continue;
+			if(!add_ent(&d,de)){
+				ret=re_err(2,"ls: reading directory %s",op);
+				goto done;
 			}
-		}else dprintf(fd,"\n");
+		}
+		if(stream&&d.cnt>0){
+			stat_ents(&d);
+			print_ents(out,&d);
+			free_ents(&d);
+		}
 	}
-	if(c!=s)dprintf(fd,"\n");
-	closedir(d);
-	return 0;
+	if(r<0)ret=re_err(2,"ls: reading directory %s",op);
+	if(!opts.unsorted)qsort(d.ents,d.cnt,sizeof(struct ls_ent),ent_cmp);
+	stat_ents(&d);
+	print_ents(out,&d);
+	done:
+	free_ents(&d);
+	if(d.ents)free(d.ents);
+	free(buf);
+	close(d.dfd);
+	return ret;
+}
+
+static void display_path(FILE*out,char*path){
+	struct ls_ent e={.name=path,.type=DT_UNKNOWN};
+	stat_ent(AT_FDCWD,stat_mask(),&e);
+	display_single(out,&e,NULL);
+	if(e.link)free(e.link);
 }
 
 static int usage(int e){
@@ -183,13 +377,15 @@ static int usage(int e){
 		"\t-g, --no-group        in a long listing, don't print group names\n"
 		"\t-1, --oneline         list one file per line.\n"
 		"\t-F, --classify        append indicator (one of */=>@|) to entries\n"
+		"\t-U                    do not sort, list entries in directory order\n"
+		"\t-f                    like -aU, without -l -s and colors\n"
 		"\t-C, --color[=WHEN]    colorize the output, WHEN can be always, auto, never, force\n"
 		"\t-H, --help            display this help and exit\n"
 	);
 }
 
 int ls_main(int argc,char**argv){
-	const char*so="ladinshgeucFC1H";
+	const char*so="ladinshgeucFC1UfH";
 	const struct option lo[]={
 		{"list",           no_argument,      NULL,'l'},
 		{"all",            no_argument,      NULL,'a'},
@@ -205,10 +401,12 @@ int ls_main(int argc,char**argv){
 		{"color",          optional_argument,NULL,'C'},
 		{"oneline",        no_argument,      NULL,'1'},
 		{"classify",       no_argument,      NULL,'F'},
+		{"unsorted",       no_argument,      NULL,'U'},
 		{"help",           no_argument,      NULL,'H'},
 		{NULL,0,NULL,0}
 	};
 	int o;
+	bool f=false;
 	strcpy(opts.whencolor,"auto");
 	if(!isatty(STDOUT_FILENO))opts.perline=1;
 	while((o=b_getlopt(argc,argv,so,lo,NULL))!=-1)switch(o){
@@ -230,6 +428,8 @@ int ls_main(int argc,char**argv){
 			strncpy(opts.whencolor,b_optarg,31);
 		break;
 		case 'F':opts.type=true;break;
+		case 'U':opts.unsorted=true;break;
+		case 'f':f=true;break;
 		case 'g':opts.list=opts.nogroup=true;break;
 		case 'H':return usage(0);
 		default:return 2;
@@ -245,16 +445,20 @@ int ls_main(int argc,char**argv){
 		      strncmp(term,"xterm",5)==0
 		)&&isatty(STDOUT_FILENO)
 	)opts.color=true;
-	if(b_optind==argc)do_list(STDOUT_FILENO,NULL);
+	if(f){
+		opts.all=opts.unsorted=true;
+		opts.list=opts.size=opts.color=false;
+	}
+	if(b_optind==argc)do_list(stdout,NULL);
 	else for(int i=b_optind;i<argc;i++)if(argv[i]){
 		struct stat st;
 		if(stat(argv[i],&st)<0)return re_err(2,"ls: stat %s",argv[i]);
 		if(S_ISDIR(st.st_mode)){
 			if(argc-b_optind>1)printf("%s:\n",argv[i]);
-			do_list(STDOUT_FILENO,argv[i]);
+			do_list(stdout,argv[i]);
 			if(i<argc-1)putchar('\n');
 		}else{
-			display_single(STDOUT_FILENO,AT_FDCWD,NULL,argv[i]);
+			display_path(stdout,argv[i]);
 			putchar('\n');
 		}
 	}
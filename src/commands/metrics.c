@@ -0,0 +1,24 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<stdio.h>
+#include<errno.h>
+#include<string.h>
+#include"output.h"
+#include"metrics.h"
+#include"defines.h"
+
+int metrics_main(int argc,char**argv __attribute__((unused))){
+	if(argc!=1)return re_printf(1,"Usage: metrics\n");
+	if(metrics_collect(stdout)<0){
+		fprintf(stderr,"metrics: read %s: %s\n",METRICS_DIR,strerror(errno));
+		return 1;
+	}
+	fflush(stdout);
+	return 0;
+}
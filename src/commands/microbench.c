@@ -0,0 +1,782 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fnmatch.h>
+#include<pthread.h>
+#include<sys/stat.h>
+#include<sys/socket.h>
+#include"str.h"
+#include"getopt.h"
+#include"pool.h"
+#include"array.h"
+#include"list.h"
+#include"keyval.h"
+#include"uevent.h"
+#include"logger.h"
+#include"output.h"
+#include"system.h"
+#include"defines.h"
+#include"compress.h"
+#include"filesystem.h"
+#include"fsdrv.h"
+#include"pathnames.h"
+#include"../confd/confd_internal.h"
+#include"../devd/devd_internal.h"
+#ifdef ENABLE_JSONC
+#include<json.h>
+#endif
+#ifdef ENABLE_LIBZIP
+#include<zip.h>
+#endif
+#define BENCH_BASE "microbench"
+#define MAX_RESULTS 64
+#define DATA_SIZE (16*1024*1024)
+#define READ_CHUNK (64*1024)
+
+/*
+ * a fixed set of in-process microbenchmarks of the daemon hot paths
+ * every op is timed in small batches, the batch time divided by its size
+ * is one latency sample, so clock overhead stays out of ns-level ops
+ * results are printed as a table or json, with a baseline json every
+ * result is compared by name and a regression over the threshold fails
+ */
+
+struct result{
+	char name[48];
+	const char*skip;
+	size_t ops;
+	double secs,bytes;
+	uint64_t p50,p99,p999,max;
+};
+
+struct lat{
+	uint64_t*v;
+	size_t cnt,cap;
+};
+
+struct bench{
+	const char*name;
+	void(*run)(size_t arg);
+	size_t arg;
+};
+
+static struct result results[MAX_RESULTS];
+static size_t nresults=0;
+static size_t scale=1;
+static const char*replay=NULL;
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL+(uint64_t)ts.tv_nsec;
+}
+
+static bool lat_init(struct lat*l,size_t cap){
+	l->cnt=0,l->cap=MAX(cap,1);
+	return (l->v=malloc(l->cap*sizeof(uint64_t)))!=NULL;
+}
+
+static void lat_add(struct lat*l,uint64_t ns){
+	if(l->cnt<l->cap)l->v[l->cnt++]=ns;
+}
+
+static int cmp_u64(const void*a,const void*b){
+	uint64_t x=*(const uint64_t*)a,y=*(const uint64_t*)b;
+	return x<y?-1:x>y?1:0;
+}
+
+static uint64_t pct(struct lat*l,double q){
+	size_t i=(size_t)(q*(double)l->cnt);
+	return l->cnt>0?l->v[MIN(i,l->cnt-1)]:0;
+}
+
+static struct result*new_result(const char*name){
+	struct result*r;
+	if(nresults>=MAX_RESULTS)return NULL;
+	r=&results[nresults++];
+	memset(r,0,sizeof(struct result));
+	strlcpy(r->name,name,sizeof(r->name));
+	return r;
+}
+
+static void skip_result(const char*name,const char*why){
+	struct result*r=new_result(name);
+	if(r)r->skip=why;
+}
+
+// takes the samples, frees them
+static void add_result(const char*name,size_t ops,double secs,double bytes,struct lat*l){
+	struct result*r=new_result(name);
+	if(r){
+		qsort(l->v,l->cnt,sizeof(uint64_t),cmp_u64);
+		r->ops=ops,r->secs=secs,r->bytes=bytes;
+		r->p50=pct(l,0.50),r->p99=pct(l,0.99),r->p999=pct(l,0.999);
+		r->max=l->cnt>0?l->v[l->cnt-1]:0;
+	}
+	free(l->v);
+	l->v=NULL;
+}
+
+typedef void bench_op(size_t i,void*d);
+
+static void run_loop(const char*name,size_t ops,size_t batch,bench_op*op,void*d){
+	struct lat l;
+	size_t n;
+	uint64_t start,b;
+	if(!lat_init(&l,ops/batch+1))return;
+	start=now_ns();
+	for(size_t i=0;i<ops;i+=n){
+		n=MIN(batch,ops-i);
+		b=now_ns();
+		for(size_t j=0;j<n;j++)op(i+j,d);
+		lat_add(&l,(now_ns()-b)/n);
+	}
+	add_result(name,ops,(double)(now_ns()-start)/1e9,0,&l);
+}
+
+// pseudo random text, compresses like logs and configs do
+static unsigned char*gen_data(size_t len){
+	static const char*words[]={
+		"init","service","device","mount","config","logger",
+		"started","stopped","failed","value","/dev/block","=",
+		"\n"," "," "," ","0","1","true","false","sda1","usb"
+	};
+	size_t wl,o=0;
+	uint32_t seed=0x12345678;
+	unsigned char*d=malloc(len);
+	if(!d)return NULL;
+	while(o<len){
+		seed^=seed<<13,seed^=seed>>17,seed^=seed<<5;
+		const char*w=words[seed%ARRLEN(words)];
+		wl=MIN(strlen(w),len-o);
+		memcpy(d+o,w,wl);
+		o+=wl;
+	}
+	return d;
+}
+
+static char**conf_keys=NULL;
+static size_t conf_nkeys=0;
+
+static void op_conf_set(size_t i,void*d __attribute__((unused))){
+	conf_set_integer(conf_keys[i],(int64_t)i,0,0);
+}
+
+static void op_conf_get(size_t i,void*d){
+	size_t*miss=d;
+	i=(i*7919)%conf_nkeys;
+	if(conf_get_integer(conf_keys[i],-1,0,0)!=(int64_t)i)(*miss)++;
+}
+
+static void bench_conf(size_t keys){
+	char name[48],key[128];
+	size_t miss=0;
+	if(!(conf_keys=malloc(keys*sizeof(char*))))return;
+	for(size_t i=0;i<keys;i++){
+		snprintf(key,sizeof(key),BENCH_BASE".group%zu.key%zu",i%16,i);
+		if(!(conf_keys[i]=strdup(key))){
+			while(i>0)free(conf_keys[--i]);
+			free(conf_keys);
+			return;
+		}
+	}
+	conf_nkeys=keys;
+	conf_del(BENCH_BASE,0,0);
+	snprintf(name,sizeof(name),"conf_set.%zuk",keys/1000);
+	run_loop(name,keys,16,op_conf_set,NULL);
+	snprintf(name,sizeof(name),"conf_get.%zuk",keys/1000);
+	run_loop(name,MAX(keys,1000000*scale),16,op_conf_get,&miss);
+	if(miss>0)fprintf(stderr,"microbench: conf_get missed %zu keys\n",miss);
+	conf_del(BENCH_BASE,0,0);
+	for(size_t i=0;i<keys;i++)free(conf_keys[i]);
+	free(conf_keys);
+	conf_keys=NULL;
+}
+
+struct log_thread{
+	pthread_t tid;
+	size_t msgs;
+	struct lat lat;
+};
+
+static void*log_worker(void*d){
+	struct log_thread*t=d;
+	uint64_t b;
+	for(size_t i=0;i<t->msgs;i+=16){
+		b=now_ns();
+		for(size_t j=i;j<MIN(i+16,t->msgs);j++)
+			logger_print(LEVEL_INFO,"microbench","benchmark log message with some payload");
+		lat_add(&t->lat,(now_ns()-b)/MIN(16,t->msgs-i));
+	}
+	return NULL;
+}
+
+// stands in for loggerd, the async sender wants no replies
+static void*log_drain(void*d){
+	char buf[65536];
+	ssize_t r;
+	while((r=read((int)(intptr_t)d,buf,sizeof(buf)))>0||(r<0&&errno==EINTR));
+	return NULL;
+}
+
+static void bench_logger(size_t threads){
+	char name[48];
+	int sv[2],old=logfd;
+	size_t msgs=200000*scale;
+	uint64_t start;
+	pthread_t dt;
+	struct lat all;
+	struct log_thread*t;
+	if(!(t=calloc(threads,sizeof(struct log_thread))))return;
+	if(socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,sv)<0){
+		free(t);
+		return;
+	}
+	pthread_create(&dt,NULL,log_drain,(void*)(intptr_t)sv[1]);
+	logfd=sv[0];
+	logger_set_async(LOG_DROP_BLOCK);
+	if(!lat_init(&all,msgs/16+threads))goto done;
+	start=now_ns();
+	for(size_t i=0;i<threads;i++){
+		t[i].msgs=msgs/threads;
+		lat_init(&t[i].lat,t[i].msgs/16+1);
+		pthread_create(&t[i].tid,NULL,log_worker,&t[i]);
+	}
+	for(size_t i=0;i<threads;i++){
+		pthread_join(t[i].tid,NULL);
+		for(size_t j=0;j<t[i].lat.cnt;j++)lat_add(&all,t[i].lat.v[j]);
+		free(t[i].lat.v);
+	}
+	logger_flush();
+	snprintf(name,sizeof(name),"logger_write.t%zu",threads);
+	add_result(name,msgs/threads*threads,(double)(now_ns()-start)/1e9,0,&all);
+	done:
+	logger_set_async(LOG_DROP_NONE);
+	logfd=old;
+	close(sv[0]);
+	pthread_join(dt,NULL);
+	close(sv[1]);
+	free(t);
+}
+
+struct uevent_item{
+	uint64_t queued;
+	struct lat*lat;
+	size_t idx;
+	char buf[];
+};
+
+static size_t uevents_parsed=0;
+
+static void uevent_handler(void*data){
+	uevent ev;
+	struct uevent_item*it=data;
+	if(uevent_parse(it->buf,&ev)&&ev.devpath&&ev.action!=ACTION_UNKNOWN)
+		__atomic_add_fetch(&uevents_parsed,1,__ATOMIC_RELAXED);
+	it->lat->v[it->idx]=now_ns()-it->queued;
+	free(it);
+}
+
+// uevents from a replay file, separated by empty lines
+static size_t load_replay(char***evs){
+	int fd;
+	char*buf,*p,*e;
+	size_t cnt=0,cap=0;
+	struct stat st;
+	void*n;
+	*evs=NULL;
+	if((fd=open(replay,O_RDONLY|O_CLOEXEC))<0)return 0;
+	if(fstat(fd,&st)<0||!(buf=calloc(st.st_size+1,1))){
+		close(fd);
+		return 0;
+	}
+	if(read(fd,buf,st.st_size)!=st.st_size)st.st_size=0;
+	close(fd);
+	for(p=buf;st.st_size>0&&*p;p=e){
+		while(*p=='\n')p++;
+		if(!*p)break;
+		if((e=strstr(p,"\n\n")))*e++=0;
+		else e=p+strlen(p);
+		if(cnt>=cap){
+			cap=cap?cap*2:64;
+			if(!(n=realloc(*evs,cap*sizeof(char*))))break;
+			*evs=n;
+		}
+		if(!((*evs)[cnt]=strdup(p)))break;
+		cnt++;
+	}
+	free(buf);
+	return cnt;
+}
+
+static void bench_devd(size_t ops __attribute__((unused))){
+	char**evs=NULL,buf[512];
+	size_t cnt=0,len,events=100000*scale;
+	uint64_t start;
+	struct lat l;
+	struct uevent_item*it;
+	if(replay&&(cnt=load_replay(&evs))==0){
+		fprintf(stderr,"microbench: no uevents in replay file %s\n",replay);
+		return;
+	}
+	if(!lat_init(&l,events))goto done;
+	uevents_parsed=0;
+	if(devd_pipeline_start(uevent_handler)!=0){
+		free(l.v);
+		goto done;
+	}
+	start=now_ns();
+	for(size_t i=0;i<events;i++){
+		if(cnt>0)len=strlcpy(buf,evs[i%cnt],sizeof(buf));
+		else len=snprintf(
+			buf,sizeof(buf),
+			"ACTION=add\nDEVPATH=/devices/virtual/bench/dev%zu\n"
+			"SUBSYSTEM=block\nMAJOR=7\nMINOR=%zu\n"
+			"DEVNAME=bench%zu\nDEVTYPE=disk\nSEQNUM=%zu",
+			i%256,i%256,i%256,i
+		);
+		len=MIN(len,sizeof(buf)-1);
+		if(!(it=malloc(sizeof(struct uevent_item)+len+1)))break;
+		memcpy(it->buf,buf,len+1);
+		it->lat=&l,it->idx=i,it->queued=now_ns();
+		if(devd_pipeline_push(it->buf,len,it)!=0){
+			free(it);
+			break;
+		}
+		l.cnt=i+1;
+	}
+	devd_pipeline_stop();
+	if(uevents_parsed!=l.cnt)
+		fprintf(stderr,"microbench: only %zu of %zu uevents parsed\n",uevents_parsed,l.cnt);
+	add_result(replay?"devd_uevent.replay":"devd_uevent",l.cnt,(double)(now_ns()-start)/1e9,0,&l);
+	done:
+	for(size_t i=0;i<cnt;i++)free(evs[i]);
+	free(evs);
+}
+
+static size_t pool_done=0;
+
+static void*pool_noop(void*d __attribute__((unused))){
+	__atomic_add_fetch(&pool_done,1,__ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void op_pool_add(size_t i __attribute__((unused)),void*d){
+	pool_add(d,pool_noop,NULL);
+}
+
+static void bench_pool(size_t ops __attribute__((unused))){
+	struct pool*p;
+	size_t jobs=200000*scale;
+	uint64_t start;
+	if(!(p=pool_init_cpus(65536)))return;
+	pool_done=0;
+	start=now_ns();
+	run_loop("pool_add",jobs,16,op_pool_add,p);
+	while(__atomic_load_n(&pool_done,__ATOMIC_RELAXED)<jobs)usleep(100);
+	if(nresults>0)results[nresults-1].secs=(double)(now_ns()-start)/1e9;
+	pool_destroy(p);
+}
+
+static bool list_cmp_ptr(list*f,void*data){
+	return LIST_DATA(f,void*)==data;
+}
+
+static void op_list_add(size_t i,void*d){
+	list_obj_add_new(d,(void*)(i+1));
+}
+
+static void op_list_search(size_t i,void*d){
+	list_search_one(*(list**)d,list_cmp_ptr,(void*)((i*7919)%1000+1));
+}
+
+static void bench_list(size_t ops __attribute__((unused))){
+	list*lst=NULL;
+	run_loop("list_add.1k",1000,16,op_list_add,&lst);
+	run_loop("list_search.1k",100000*scale,16,op_list_search,&lst);
+	list_free_all(lst,NULL);
+}
+
+static void op_kv_parse(size_t i __attribute__((unused)),void*d __attribute__((unused))){
+	char line[]="ro.build.version.release=11";
+	kv_free(kv_new_parse(line,'='));
+}
+
+static void op_kv_lookup(size_t i,void*d){
+	char key[32];
+	snprintf(key,sizeof(key),"key%zu",i%64);
+	kvarr_get_by_key(d,key,NULL);
+}
+
+static void bench_keyval(size_t ops __attribute__((unused))){
+	char line[64];
+	keyval*kvs[65]={0};
+	for(size_t i=0;i<64;i++){
+		snprintf(line,sizeof(line),"key%zu=value%zu",i,i);
+		if(!(kvs[i]=kv_new_parse(line,'=')))goto done;
+	}
+	run_loop("keyval_parse",200000*scale,16,op_kv_parse,NULL);
+	run_loop("keyval_lookup.64",200000*scale,16,op_kv_lookup,kvs);
+	done:
+	for(size_t i=0;i<64;i++)if(kvs[i])kv_free(kvs[i]);
+}
+
+#ifdef ENABLE_ZLIB
+static unsigned char*gzip_data(unsigned char*data,size_t len,size_t*gz_len){
+	unsigned char*gz;
+	size_t cap=len+len/100+4096;
+	compressor*c=compressor_get_by_name("gzip");
+	if(!c||!(gz=malloc(cap)))return NULL;
+	if(compressor_compress(c,data,len,gz,cap,NULL,gz_len)!=0){
+		free(gz);
+		return NULL;
+	}
+	return gz;
+}
+
+static void bench_gzip(size_t ops __attribute__((unused))){
+	struct lat l;
+	size_t gz_len=0,out_len,reps=4*scale;
+	uint64_t start,b;
+	unsigned char*data,*gz=NULL,*out=NULL;
+	compressor*c=compressor_get_by_name("gzip");
+	if(!c||!(data=gen_data(DATA_SIZE)))return;
+	if(!(gz=gzip_data(data,DATA_SIZE,&gz_len)))goto done;
+	if(!(out=malloc(DATA_SIZE))||!lat_init(&l,reps))goto done;
+	start=now_ns();
+	for(size_t i=0;i<reps;i++){
+		b=now_ns();
+		if(compressor_decompress(c,gz,gz_len,out,DATA_SIZE,NULL,&out_len)!=0||out_len!=DATA_SIZE){
+			fprintf(stderr,"microbench: gzip decode failed\n");
+			break;
+		}
+		lat_add(&l,now_ns()-b);
+	}
+	add_result("gzip_decode",l.cnt,(double)(now_ns()-start)/1e9,(double)DATA_SIZE*l.cnt,&l);
+	done:
+	free(data);
+	free(gz);
+	free(out);
+}
+#endif
+
+// read a whole file in READ_CHUNK steps, one sample per chunk
+static void read_file_uri(const char*name,const char*uri){
+	fsh*f=NULL;
+	size_t br,total=0,reps=4*scale;
+	uint64_t start,b;
+	struct lat l;
+	void*buf=malloc(READ_CHUNK);
+	if(!buf||!lat_init(&l,reps*(DATA_SIZE/READ_CHUNK)+reps))goto done;
+	start=now_ns();
+	for(size_t i=0;i<reps;i++){
+		if(fs_open(NULL,&f,uri,FILE_FLAG_READ)!=0){
+			fprintf(stderr,"microbench: open %s failed: %s\n",uri,strerror(errno));
+			free(l.v);
+			goto done;
+		}
+		do{
+			br=0,b=now_ns();
+			if(fs_read(f,buf,READ_CHUNK,&br)!=0)br=0;
+			lat_add(&l,now_ns()-b);
+			total+=br;
+		}while(br>0);
+		fs_close(&f);
+	}
+	add_result(name,l.cnt,(double)(now_ns()-start)/1e9,(double)total,&l);
+	done:
+	free(buf);
+}
+
+static bool write_data(const char*path,const void*data,size_t len){
+	int fd;
+	bool ok;
+	if((fd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0600))<0)return false;
+	ok=full_write(fd,(void*)data,len)==(ssize_t)len;
+	close(fd);
+	return ok;
+}
+
+static void bench_fs(size_t ops __attribute__((unused))){
+	fsh*dir=NULL;
+	char tmp[]=_PATH_TMP"/microbench.XXXXXX";
+	char path[PATH_MAX],uri[PATH_MAX+16];
+	unsigned char*data;
+	if(!(data=gen_data(DATA_SIZE)))return;
+	if(!mkdtemp(tmp)){
+		free(data);
+		return;
+	}
+	fsdrv_initialize();
+
+	// posix layer
+	snprintf(path,sizeof(path),"%s/plain.bin",tmp);
+	if(!write_data(path,data,DATA_SIZE))goto done;
+	snprintf(uri,sizeof(uri),"file://%s",path);
+	read_file_uri("fs_read.file",uri);
+
+	// decompress layer over the posix layer
+	#ifdef ENABLE_ZLIB
+	unsigned char*gz;
+	size_t gz_len=0;
+	snprintf(path,sizeof(path),"%s/plain.gz",tmp);
+	if((gz=gzip_data(data,DATA_SIZE,&gz_len))){
+		bool ok=write_data(path,gz,gz_len);
+		free(gz);
+		snprintf(uri,sizeof(uri),"file://%s",tmp);
+		if(ok&&fs_open(NULL,&dir,uri,FILE_FLAG_FOLDER)==0){
+			if(fs_register_decompress(dir,"microbench")==0)
+				read_file_uri("fs_read.decompress","microbench:///plain.gz");
+			fs_close(&dir);
+		}
+	}
+	unlink(path);
+	#else
+	skip_result("fs_read.decompress","built without zlib");
+	#endif
+
+	// zip layer over the posix layer
+	#ifdef ENABLE_LIBZIP
+	int err;
+	zip_t*z;
+	zip_source_t*src;
+	snprintf(path,sizeof(path),"%s/plain.zip",tmp);
+	if((z=zip_open(path,ZIP_CREATE|ZIP_TRUNCATE,&err))){
+		if(!(src=zip_source_buffer(z,data,DATA_SIZE,0))||
+			zip_file_add(z,"plain.bin",src,ZIP_FL_OVERWRITE)<0){
+			if(src)zip_source_free(src);
+			zip_discard(z);
+		}else if(zip_close(z)==0){
+			snprintf(uri,sizeof(uri),"file://%s",path);
+			if(fs_open(NULL,&dir,uri,FILE_FLAG_READ)==0){
+				if(fs_register_zip(dir,"microbench-zip")==0)
+					read_file_uri("fs_read.zip","zip://microbench-zip/plain.bin");
+				fs_close(&dir);
+			}
+		}else zip_discard(z);
+	}
+	unlink(path);
+	#else
+	skip_result("fs_read.zip","built without libzip");
+	#endif
+	done:
+	snprintf(path,sizeof(path),"%s/plain.bin",tmp);
+	unlink(path);
+	rmdir(tmp);
+	free(data);
+}
+
+static void bench_adbd(size_t ops __attribute__((unused))){
+	skip_result("adbd_transfer","adbd runs only on a usb gadget");
+}
+
+static const struct bench benches[]={
+	{"conf",         bench_conf,   1000},
+	{"conf",         bench_conf,   100000},
+	{"logger",       bench_logger, 1},
+	{"logger",       bench_logger, 4},
+	{"logger",       bench_logger, 16},
+	{"logger",       bench_logger, 64},
+	{"devd",         bench_devd,   0},
+	{"pool",         bench_pool,   0},
+	{"list",         bench_list,   0},
+	{"keyval",       bench_keyval, 0},
+	{"fs",           bench_fs,     0},
+	#ifdef ENABLE_ZLIB
+	{"gzip",         bench_gzip,   0},
+	#endif
+	{"adbd",         bench_adbd,   0},
+	{NULL,NULL,0}
+};
+
+static double ops_per_sec(struct result*r){
+	return r->secs>0?(double)r->ops/r->secs:0;
+}
+
+static void print_table(){
+	printf("%-24s %10s %12s %10s %10s %10s %10s\n","NAME","OPS","OPS/S","P50","P99","P999","MB/S");
+	for(size_t i=0;i<nresults;i++){
+		struct result*r=&results[i];
+		if(r->skip){
+			printf("%-24s skipped: %s\n",r->name,r->skip);
+			continue;
+		}
+		printf(
+			"%-24s %10zu %12.0f %8lluns %8lluns %8lluns",
+			r->name,r->ops,ops_per_sec(r),
+			(unsigned long long)r->p50,
+			(unsigned long long)r->p99,
+			(unsigned long long)r->p999
+		);
+		if(r->bytes>0)printf(" %10.1f",r->bytes/r->secs/1048576);
+		putchar('\n');
+	}
+}
+
+#ifdef ENABLE_JSONC
+static json_object*results_json(){
+	json_object*root,*arr,*o;
+	if(!(root=json_object_new_object()))return NULL;
+	arr=json_object_new_array();
+	json_object_object_add(root,"results",arr);
+	for(size_t i=0;i<nresults;i++){
+		struct result*r=&results[i];
+		if(!(o=json_object_new_object()))continue;
+		json_object_object_add(o,"name",json_object_new_string(r->name));
+		if(r->skip)json_object_object_add(o,"skipped",json_object_new_string(r->skip));
+		else{
+			json_object_object_add(o,"ops",json_object_new_int64(r->ops));
+			json_object_object_add(o,"seconds",json_object_new_double(r->secs));
+			json_object_object_add(o,"ops_per_sec",json_object_new_double(ops_per_sec(r)));
+			json_object_object_add(o,"p50_ns",json_object_new_int64(r->p50));
+			json_object_object_add(o,"p99_ns",json_object_new_int64(r->p99));
+			json_object_object_add(o,"p999_ns",json_object_new_int64(r->p999));
+			json_object_object_add(o,"max_ns",json_object_new_int64(r->max));
+			if(r->bytes>0)json_object_object_add(o,"bytes_per_sec",json_object_new_double(r->bytes/r->secs));
+		}
+		json_object_array_add(arr,o);
+	}
+	return root;
+}
+
+static int write_json(const char*file){
+	json_object*j=results_json();
+	int r=0;
+	if(!j)return re_printf(1,"build json failed\n");
+	if(strcmp(file,"-")==0)
+		printf("%s\n",json_object_to_json_string_ext(j,JSON_C_TO_STRING_PRETTY));
+	else if(json_object_to_file_ext(file,j,JSON_C_TO_STRING_PRETTY)!=0)
+		r=re_printf(1,"write %s failed: %s\n",file,json_util_get_last_err());
+	json_object_put(j);
+	return r;
+}
+
+static double json_num(json_object*o,const char*key){
+	json_object*v;
+	return json_object_object_get_ex(o,key,&v)?json_object_get_double(v):0;
+}
+
+/*
+ * throughput must not drop and p99 must not rise more than threshold percent
+ * p99 under one microsecond is within scheduler noise, only throughput counts
+ */
+static int compare_baseline(const char*file,double th){
+	int bad=0;
+	size_t cnt;
+	const char*name;
+	double base,cur;
+	json_object*j,*arr,*o,*v;
+	if(!(j=json_object_from_file(file)))
+		return re_printf(2,"load baseline %s failed: %s\n",file,json_util_get_last_err());
+	if(!json_object_object_get_ex(j,"results",&arr)||!json_object_is_type(arr,json_type_array)){
+		json_object_put(j);
+		return re_printf(2,"bad baseline %s\n",file);
+	}
+	cnt=json_object_array_length(arr);
+	for(size_t i=0;i<nresults;i++){
+		struct result*r=&results[i];
+		if(r->skip)continue;
+		for(size_t k=0;k<cnt;k++){
+			o=json_object_array_get_idx(arr,k);
+			if(!json_object_object_get_ex(o,"name",&v))continue;
+			if(!(name=json_object_get_string(v))||strcmp(name,r->name)!=0)continue;
+			if(json_object_object_get_ex(o,"skipped",&v))break;
+			base=json_num(o,"ops_per_sec"),cur=ops_per_sec(r);
+			if(base>0&&cur<base*(1-th/100)){
+				fprintf(stderr,"regression: %s %.0f ops/s, baseline %.0f ops/s\n",r->name,cur,base);
+				bad++;
+			}
+			base=json_num(o,"p99_ns"),cur=(double)r->p99;
+			if(base>=1000&&cur>base*(1+th/100)){
+				fprintf(stderr,"regression: %s p99 %.0fns, baseline %.0fns\n",r->name,cur,base);
+				bad++;
+			}
+			break;
+		}
+	}
+	json_object_put(j);
+	if(bad>0)fprintf(stderr,"%d regressions over %.0f%%\n",bad,th);
+	return bad>0?1:0;
+}
+#endif
+
+static int usage(int e){
+	return return_printf(
+		e,e==0?STDOUT_FILENO:STDERR_FILENO,
+		"Usage: microbench [OPTION]...\n"
+		"Run microbenchmarks of the daemon hot paths.\n\n"
+		"Options:\n"
+		"\t-f, --filter PATTERN    only run benchmarks matching PATTERN\n"
+		"\t-s, --scale N           multiply the op counts by N\n"
+		"\t-r, --replay FILE       replay uevents from FILE (empty line separated)\n"
+		#ifdef ENABLE_JSONC
+		"\t-j, --json FILE         write results as json to FILE (- for stdout)\n"
+		"\t-b, --baseline FILE     fail on regressions against a json baseline\n"
+		"\t-t, --threshold PCT     allowed regression in percent (default 10)\n"
+		#endif
+		"\t-h, --help              display this help and exit\n"
+		"Benchmarks: conf logger devd pool list keyval fs gzip adbd\n"
+	);
+}
+
+int microbench_main(int argc,char**argv){
+	int o,r=0;
+	double th=10;
+	const char*filter=NULL,*json_file=NULL,*baseline=NULL;
+	static const struct option lo[]={
+		{"filter",    required_argument, NULL,'f'},
+		{"scale",     required_argument, NULL,'s'},
+		{"replay",    required_argument, NULL,'r'},
+		{"json",      required_argument, NULL,'j'},
+		{"baseline",  required_argument, NULL,'b'},
+		{"threshold", required_argument, NULL,'t'},
+		{"help",      no_argument,       NULL,'h'},
+		{NULL,0,NULL,0}
+	};
+	scale=1,replay=NULL,nresults=0;
+	while((o=b_getlopt(argc,argv,"f:s:r:j:b:t:h",lo,NULL))!=-1)switch(o){
+		case 'f':filter=b_optarg;break;
+		case 's':
+			if((scale=parse_long(b_optarg,0))<=0)
+				return re_printf(2,"invalid scale: %s\n",b_optarg);
+		break;
+		case 'r':replay=b_optarg;break;
+		case 'j':json_file=b_optarg;break;
+		case 'b':baseline=b_optarg;break;
+		case 't':
+			if((th=parse_long(b_optarg,-1))<0)
+				return re_printf(2,"invalid threshold: %s\n",b_optarg);
+		break;
+		case 'h':return usage(0);
+		default:return usage(2);
+	}
+	if(b_optind!=argc)return usage(2);
+	#ifndef ENABLE_JSONC
+	if(json_file||baseline)return re_printf(2,"json support not enabled\n");
+	#endif
+	for(const struct bench*b=benches;b->name;b++){
+		if(filter&&fnmatch(filter,b->name,0)!=0)continue;
+		if(!json_file||strcmp(json_file,"-")!=0)
+			fprintf(stderr,"running %s...\n",b->name);
+		b->run(b->arg);
+	}
+	if(!json_file||strcmp(json_file,"-")!=0)print_table();
+	#ifdef ENABLE_JSONC
+	if(json_file&&(r=write_json(json_file))!=0)return r;
+	if(baseline)r=compare_baseline(baseline,th);
+	#endif
+	return r;
+}
@@ -31,6 +31,8 @@
 #include"kloglevel.h"
 #include"output.h"
 #include"defines.h"
+#include"pathnames.h"
+#include"devd.h"
 #define DEFAULT_VERBOSE KERN_WARNING
 static int first_time=0,ignore_commands=0,use_blacklist=0,force=0;
 static int verbose=DEFAULT_VERBOSE,do_show=0,dry_run=0,ignore_loaded=0,lookup_only=0;
@@ -367,6 +369,26 @@ static int insmod_all(struct kmod_ctx*ctx,char**args,int nargs){
 	return err;
 }
 
+/*
+ * a plain insert goes to devd when it runs, its kmod context has the
+ * index files and config loaded already and it inserts independent
+ * modules on several threads. anything else, or a failure there, is
+ * done here with an own context, so errors are printed like before.
+ */
+static bool devd_insmod(char**args,int nargs,bool all){
+	if(
+		lookup_only||dry_run||do_show||first_time||
+		force||strip_modversion||strip_vermagic||ignore_commands||
+		ignore_loaded||use_blacklist||verbose>DEFAULT_VERBOSE||
+		(!all&&nargs!=1)
+	)return false;
+	if(devfd<0&&(
+		access(DEFAULT_DEVD,F_OK)!=0||
+		open_default_devd_socket("modprobe")<0
+	))return false;
+	return devd_call_modprobe(args,nargs)==0;
+}
+
 static void env_modprobe_options_append(const char*value){
 	const char*old=getenv("MODPROBE_OPTIONS");
 	char*env;
@@ -472,6 +494,7 @@ int modprobe_main(int argc,char**orig_argv){
 		int c,idx=0;
 		if((c=b_getlopt(argc,argv,cmdopts_s,cmdopts,&idx))==-1)break;
 		switch(c){
+			case 'a':use_all=1;break;
 			case 'r':do_remove=1;break;
 			case 5:remove_dependencies=1;break;
 			case 'R':lookup_only=1;break;
@@ -524,6 +547,13 @@ int modprobe_main(int argc,char**orig_argv){
 		);
 		dirname=dirname_buf;
 	}
+	if(
+		!dirname&&!do_remove&&!do_show_modversions&&
+		!do_show_exports&&devd_insmod(args,nargs,use_all)
+	){
+		err=0;
+		goto done;
+	}
 	if(!(ctx=kmod_new(dirname,NULL))){
 		fprintf(stderr,_("error: kmod_new failed!\n"));
 		err=-1;
@@ -6,14 +6,515 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<fcntl.h>
+#include<stdlib.h>
 #include<unistd.h>
+#include<pthread.h>
+#include<semaphore.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<linux/fs.h>
 #include"str.h"
+#include"sha1.h"
+#include"array.h"
 #include"xlua.h"
 #include"output.h"
 #include"version.h"
+#include"defines.h"
 #include"recovery.h"
+#include"led_status.h"
 #include"filesystem.h"
 
+/*
+ * streaming extraction of large package entries to block devices
+ * the zip layer inflates big reads straight into the caller buffer, the
+ * buffers here are aligned for O_DIRECT and handed to a writer thread,
+ * so inflating the next chunk overlaps with writing the previous one
+ * the sha1 of the data is computed while it passes through
+ */
+#define BLK_SIZE 4096
+#define STREAM_BUF 0x100000
+#define STREAM_STOP ((size_t)-1)
+
+struct blk_out{
+	int fd,err,cur,pct;
+	bool direct;
+	pthread_t thread;
+	sem_t full[2],empty[2];
+	char*buf[2];
+	size_t len[2];
+	uint64_t off[2];
+	uint64_t done,total;
+};
+
+static void sem_wait_intr(sem_t*s){
+	while(sem_wait(s)!=0&&errno==EINTR);
+}
+
+static void set_direct(struct blk_out*o,bool direct){
+	int fl=fcntl(o->fd,F_GETFL);
+	if(fl<0)return;
+	if(fcntl(o->fd,F_SETFL,direct?fl|O_DIRECT:fl&~O_DIRECT)==0)o->direct=direct;
+}
+
+static int write_at(struct blk_out*o,const char*buf,size_t len,uint64_t off){
+	ssize_t r;
+	size_t n;
+	while(len>0){
+		n=len;
+
+		// an unaligned tail cannot go through O_DIRECT
+		if(o->direct&&n%BLK_SIZE!=0){
+			if(n>BLK_SIZE)n-=n%BLK_SIZE;
+			else set_direct(o,false);
+		}
+		if((r=pwrite(o->fd,buf,n,(off_t)off))<0){
+			if(errno==EINTR)continue;
+			if(errno==EINVAL&&o->direct){
+				set_direct(o,false);
+				continue;
+			}
+			return -errno;
+		}
+		if(r==0)ERET(EIO);
+		buf+=r,len-=r,off+=r;
+	}
+	return 0;
+}
+
+static void*writer_thread(void*d){
+	struct blk_out*o=d;
+	for(int i=0;;i^=1){
+		sem_wait_intr(&o->full[i]);
+		if(o->len[i]==STREAM_STOP)break;
+		if(o->err==0)o->err=write_at(o,o->buf[i],o->len[i],o->off[i]);
+		sem_post(&o->empty[i]);
+	}
+	return NULL;
+}
+
+static void blk_progress(struct blk_out*o,uint64_t len){
+	int pct;
+	o->done+=len;
+	if(o->total==0)return;
+	pct=(int)(MIN(o->done,o->total)*100/o->total);
+	if(pct==o->pct)return;
+	o->pct=pct;
+	recovery_set_progress((float)pct/100);
+}
+
+static int blk_open(struct blk_out*o,const char*dev,uint64_t total){
+	int e;
+	memset(o,0,sizeof(struct blk_out));
+	o->total=total,o->pct=-1,o->direct=true;
+	if((o->fd=open(dev,O_WRONLY|O_DIRECT|O_CLOEXEC))<0){
+
+		// tmpfs and friends have no O_DIRECT
+		if(errno!=EINVAL)return -errno;
+		o->direct=false;
+		if((o->fd=open(dev,O_WRONLY|O_CLOEXEC))<0)return -errno;
+	}
+	for(int i=0;i<2;i++){
+		if(posix_memalign((void**)&o->buf[i],BLK_SIZE,STREAM_BUF)!=0)
+			EDONE(errno=ENOMEM);
+		sem_init(&o->full[i],0,0);
+		sem_init(&o->empty[i],0,1);
+	}
+	if((errno=pthread_create(&o->thread,NULL,writer_thread,o))!=0)goto done;
+	return 0;
+	done:e=errno;
+	for(int i=0;i<2;i++)if(o->buf[i])free(o->buf[i]);
+	close(o->fd);
+	ERET(e);
+}
+
+// next free buffer, NULL once the writer failed
+static char*blk_buf(struct blk_out*o){
+	sem_wait_intr(&o->empty[o->cur]);
+	if(o->err!=0){
+		sem_post(&o->empty[o->cur]);
+		return NULL;
+	}
+	return o->buf[o->cur];
+}
+
+static void blk_submit(struct blk_out*o,size_t len,uint64_t off){
+	o->len[o->cur]=len,o->off[o->cur]=off;
+	sem_post(&o->full[o->cur]);
+	o->cur^=1;
+	blk_progress(o,len);
+}
+
+// wait for all queued writes
+static int blk_flush(struct blk_out*o){
+	for(int i=0;i<2;i++)sem_wait_intr(&o->empty[i]);
+	for(int i=0;i<2;i++)sem_post(&o->empty[i]);
+	return o->err;
+}
+
+static int blk_close(struct blk_out*o){
+	int r;
+	blk_flush(o);
+	sem_wait_intr(&o->empty[o->cur]);
+	o->len[o->cur]=STREAM_STOP;
+	sem_post(&o->full[o->cur]);
+	pthread_join(o->thread,NULL);
+	r=o->err;
+	if(r==0&&fdatasync(o->fd)!=0)r=-errno;
+	close(o->fd);
+	for(int i=0;i<2;i++){
+		free(o->buf[i]);
+		sem_destroy(&o->full[i]);
+		sem_destroy(&o->empty[i]);
+	}
+	return r;
+}
+
+// fill len bytes from a stream, short data is an error
+static int read_fill(fsh*f,char*buf,size_t len){
+	int r;
+	size_t n,off=0;
+	while(off<len){
+		if((r=fs_read(f,buf+off,len-off,&n))!=0)ERET(r);
+		if(n==0)ERET(ENODATA);
+		off+=n;
+	}
+	return 0;
+}
+
+// finish the digest as lowercase hex, package hashes may be in any case
+static char*sha1_hex(SHA1_CTX*sha,char hex[SHA1_DIGEST_STRING_LENGTH]){
+	uint8_t dig[SHA1_DIGEST_LENGTH];
+	SHA1Final(dig,sha);
+	return bin2hexstr(hex,dig,sizeof(dig),false);
+}
+
+static int stream_to(struct blk_out*o,fsh*f,uint64_t off,uint64_t len,SHA1_CTX*sha){
+	int r;
+	char*buf;
+	size_t n;
+	while(len>0){
+		if(!(buf=blk_buf(o)))return o->err;
+		n=MIN(len,STREAM_BUF);
+		if((r=read_fill(f,buf,n))!=0){
+			sem_post(&o->empty[o->cur]);
+			return r;
+		}
+		if(sha)SHA1Update(sha,(uint8_t*)buf,n);
+		blk_submit(o,n,off);
+		off+=n,len-=n;
+	}
+	return 0;
+}
+
+static uint64_t dev_size(const char*dev){
+	int fd;
+	struct stat st;
+	uint64_t size=0;
+	if((fd=open(dev,O_RDONLY|O_CLOEXEC))<0)return 0;
+	if(fstat(fd,&st)==0&&S_ISBLK(st.st_mode))
+		if(ioctl(fd,BLKGETSIZE64,&size)!=0)size=0;
+	close(fd);
+	return size;
+}
+
+static int extract_to_block(fsh*root,const char*entry,const char*dev,const char*sha1){
+	int r,e;
+	fsh*f=NULL;
+	size_t size=0;
+	uint64_t ds;
+	struct blk_out o;
+	SHA1_CTX sha;
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	if(!entry||!dev)ERET(EINVAL);
+	if((r=fs_open(root,&f,entry,FILE_FLAG_READ))!=0)ERET(r);
+	if((r=fs_get_size(f,&size))!=0)EDONE(errno=r);
+	if((ds=dev_size(dev))>0&&size>ds)EDONE(errno=ENOSPC);
+	if((r=blk_open(&o,dev,size))!=0)EDONE(errno=-r);
+	SHA1Init(&sha);
+	r=stream_to(&o,f,0,size,&sha);
+	e=blk_close(&o);
+	if(r==0)r=e;
+	if(r!=0)EDONE(errno=-r);
+	recovery_logf("%s: %zu bytes to %s, sha1 %s",entry,size,dev,sha1_hex(&sha,hex));
+	if(sha1&&strcasecmp(hex,sha1)!=0)EDONE(errno=EUCLEAN);
+	fs_close(&f);
+	return 0;
+	done:e=errno;
+	if(f)fs_close(&f);
+	ERET(e);
+}
+
+/*
+ * android block_image_update transfer lists (version 1 to 4)
+ * erase, zero, new and move with its sources on the device are done here,
+ * the patch and stash commands need the diff engines and are refused
+ */
+struct rangeset{
+	size_t cnt;
+	uint64_t blocks;
+	uint64_t*pos;
+};
+
+static int parse_rangeset(const char*str,struct rangeset*rs){
+	char*end;
+	size_t cnt;
+	memset(rs,0,sizeof(struct rangeset));
+	if(!str)ERET(EINVAL);
+	errno=0;
+
+	// count of numbers first, then begin and end (exclusive) of every range
+	cnt=strtoull(str,&end,10);
+	if(errno!=0||*end!=','||cnt==0||cnt%2!=0||cnt>0x10000)ERET(EBADMSG);
+	rs->cnt=cnt/2;
+	if(!(rs->pos=malloc(sizeof(uint64_t)*cnt)))ERET(ENOMEM);
+	for(size_t i=0;i<cnt;i++){
+		str=end+1;
+		rs->pos[i]=strtoull(str,&end,10);
+		if(end==str||(*end!=','&&*end!=0)||(*end==0)!=(i==cnt-1))goto fail;
+		if(i%2==1){
+			if(rs->pos[i]<=rs->pos[i-1])goto fail;
+			rs->blocks+=rs->pos[i]-rs->pos[i-1];
+		}
+	}
+	return 0;
+	fail:
+	free(rs->pos);
+	rs->pos=NULL;
+	ERET(EBADMSG);
+}
+
+static int range_discard(int fd,struct rangeset*rs,unsigned long req){
+	uint64_t range[2];
+	for(size_t i=0;i<rs->cnt;i++){
+		range[0]=rs->pos[i*2]*BLK_SIZE;
+		range[1]=(rs->pos[i*2+1]-rs->pos[i*2])*BLK_SIZE;
+		if(ioctl(fd,req,&range)!=0)return -errno;
+	}
+	return 0;
+}
+
+static int cmd_zero(struct blk_out*o,struct rangeset*rs,bool erase){
+	char*buf;
+	size_t n;
+	uint64_t off,len;
+	int r;
+	if((r=blk_flush(o))!=0)return r;
+
+	// the kernel zeroes or discards a block device without data going through us
+	if(range_discard(o->fd,rs,erase?BLKDISCARD:BLKZEROOUT)==0){
+		if(!erase)blk_progress(o,rs->blocks*BLK_SIZE);
+		return 0;
+	}
+	if(erase)return 0;
+	for(size_t i=0;i<rs->cnt;i++){
+		off=rs->pos[i*2]*BLK_SIZE;
+		len=(rs->pos[i*2+1]-rs->pos[i*2])*BLK_SIZE;
+		for(;len>0;off+=n,len-=n){
+			if(!(buf=blk_buf(o)))return o->err;
+			n=MIN(len,STREAM_BUF);
+			memset(buf,0,n);
+			blk_submit(o,n,off);
+		}
+	}
+	return 0;
+}
+
+static int cmd_new(struct blk_out*o,struct rangeset*rs,fsh*data){
+	int r;
+	if(!data)ERET(ENOENT);
+	for(size_t i=0;i<rs->cnt;i++)if((r=stream_to(
+		o,data,rs->pos[i*2]*BLK_SIZE,
+		(rs->pos[i*2+1]-rs->pos[i*2])*BLK_SIZE,NULL
+	))!=0)return r;
+	return 0;
+}
+
+static int range_read(int fd,struct rangeset*rs,char*buf){
+	ssize_t r;
+	size_t len;
+	uint64_t off;
+	for(size_t i=0;i<rs->cnt;i++){
+		off=rs->pos[i*2]*BLK_SIZE;
+		len=(rs->pos[i*2+1]-rs->pos[i*2])*BLK_SIZE;
+		while(len>0){
+			if((r=pread(fd,buf,len,(off_t)off))<0){
+				if(errno==EINTR)continue;
+				return -errno;
+			}
+			if(r==0)ERET(ENODATA);
+			buf+=r,off+=r,len-=r;
+		}
+	}
+	return 0;
+}
+
+static bool range_hash_match(const char*buf,uint64_t blocks,const char*hash){
+	SHA1_CTX sha;
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	SHA1Init(&sha);
+	SHA1Update(&sha,(uint8_t*)buf,blocks*BLK_SIZE);
+	return strcasecmp(sha1_hex(&sha,hex),hash)==0;
+}
+
+static int cmd_move(struct blk_out*o,int rfd,int ver,char**args,int argc){
+	int r;
+	char*buf=NULL,*p,*w;
+	const char*hash=NULL,*src_s,*tgt_s;
+	struct rangeset src={0},tgt={0};
+	uint64_t off,len;
+
+	// v1: <src> <tgt>, v2: <tgt> <blocks> <src>, v3+: <sha1> <tgt> <blocks> <src>
+	if(ver==1&&argc==2)src_s=args[0],tgt_s=args[1];
+	else if(ver==2&&argc==3)tgt_s=args[0],src_s=args[2];
+	else if(ver>=3&&argc==4)hash=args[0],tgt_s=args[1],src_s=args[3];
+	else ERET(ENOTSUP);
+	if(strcmp(src_s,"-")==0)ERET(ENOTSUP);
+	if((r=parse_rangeset(src_s,&src))!=0)goto done;
+	if((r=parse_rangeset(tgt_s,&tgt))!=0)goto done;
+	if(src.blocks!=tgt.blocks)EDONE(r=ENUM(EBADMSG));
+	if(!(buf=malloc(src.blocks*BLK_SIZE)))EDONE(r=ENUM(ENOMEM));
+
+	// sources and targets may overlap, everything queued must be on disk
+	if((r=blk_flush(o))!=0)goto done;
+	if((r=range_read(rfd,&src,buf))!=0)goto done;
+	if(hash&&!range_hash_match(buf,src.blocks,hash)){
+
+		// resumed update, this move was done already
+		if((r=range_read(rfd,&tgt,buf))!=0)goto done;
+		if(range_hash_match(buf,tgt.blocks,hash)){
+			blk_progress(o,tgt.blocks*BLK_SIZE);
+			goto done;
+		}
+		EDONE(r=ENUM(EUCLEAN));
+	}
+	p=buf;
+	for(size_t i=0;i<tgt.cnt;i++){
+		off=tgt.pos[i*2]*BLK_SIZE;
+		len=(tgt.pos[i*2+1]-tgt.pos[i*2])*BLK_SIZE;
+		for(size_t n;len>0;off+=n,len-=n,p+=n){
+			if(!(w=blk_buf(o)))EDONE(r=o->err);
+			n=MIN(len,STREAM_BUF);
+			memcpy(w,p,n);
+			blk_submit(o,n,off);
+		}
+	}
+	r=0;
+	done:
+	if(buf)free(buf);
+	if(src.pos)free(src.pos);
+	if(tgt.pos)free(tgt.pos);
+	return r;
+}
+
+static int run_transfer(struct blk_out*o,int rfd,int ver,char*line,fsh*data){
+	int argc=0,r;
+	char*args[8],*cmd,*sp=NULL;
+	struct rangeset rs;
+	if(!(cmd=strtok_r(line," ",&sp)))return 0;
+	while(argc<(int)ARRLEN(args)&&(args[argc]=strtok_r(NULL," ",&sp)))argc++;
+	if(strcmp(cmd,"free")==0)return 0;
+	if(strcmp(cmd,"move")==0)return cmd_move(o,rfd,ver,args,argc);
+	if(
+		strcmp(cmd,"erase")!=0&&
+		strcmp(cmd,"zero")!=0&&
+		strcmp(cmd,"new")!=0
+	){
+		recovery_logf("unsupported transfer command %s",cmd);
+		ERET(ENOTSUP);
+	}
+	if(argc!=1)ERET(EBADMSG);
+	if((r=parse_rangeset(args[0],&rs))!=0)return r;
+	if(strcmp(cmd,"new")==0)r=cmd_new(o,&rs,data);
+	else r=cmd_zero(o,&rs,strcmp(cmd,"erase")==0);
+	free(rs.pos);
+	return r;
+}
+
+static int block_image_update(fsh*root,const char*dev,const char*list,const char*new_data){
+	int r=0,e,ver,rfd=-1,ln=0;
+	fsh*data=NULL;
+	bool opened=false;
+	struct blk_out o;
+	size_t size=0;
+	char*text=NULL,*line,*sp=NULL,*p;
+	unsigned long long total;
+	if(!dev||!list)ERET(EINVAL);
+	if((r=fs_read_whole_file(root,list,(void**)&text,&size))!=0)EDONE(errno=r);
+	if(!(p=realloc(text,size+1)))EDONE(errno=ENOMEM);
+	text=p,text[size]=0;
+	if(new_data&&(r=fs_open(root,&data,new_data,FILE_FLAG_READ))!=0)EDONE(errno=r);
+
+	// header: version, total blocks, v2+ adds two stash limits
+	if(!(line=strtok_r(text,"\n",&sp)))EDONE(errno=EBADMSG);
+	if((ver=parse_int(line,0))<1||ver>4)EDONE(errno=ENOTSUP);
+	if(!(line=strtok_r(NULL,"\n",&sp)))EDONE(errno=EBADMSG);
+	total=strtoull(line,NULL,10);
+	if(ver>=2)for(int i=0;i<2;i++)
+		if(!strtok_r(NULL,"\n",&sp))EDONE(errno=EBADMSG);
+	if((rfd=open(dev,O_RDONLY|O_CLOEXEC))<0)goto done;
+	if((r=blk_open(&o,dev,total*BLK_SIZE))!=0)EDONE(errno=-r);
+	opened=true;
+	while((line=strtok_r(NULL,"\n",&sp))){
+		ln++;
+		if((r=run_transfer(&o,rfd,ver,line,data))!=0){
+			recovery_logf("transfer %d of %s failed: %s",ln,list,strerror(-r));
+			EDONE(errno=-r);
+		}
+	}
+	opened=false;
+	if((r=blk_close(&o))!=0)EDONE(errno=-r);
+	recovery_logf("%s: %d transfers to %s done",list,ln,dev);
+	close(rfd);
+	if(data)fs_close(&data);
+	free(text);
+	return 0;
+	done:e=errno;
+	if(opened)blk_close(&o);
+	if(rfd>=0)close(rfd);
+	if(data)fs_close(&data);
+	if(text)free(text);
+	ERET(e?:EIO);
+}
+
+static int lua_package_extract_to_block(lua_State*L){
+	int r;
+	fsh*root=lua_touserdata(L,lua_upvalueindex(1));
+	const char*entry=luaL_checkstring(L,1);
+	const char*dev=luaL_checkstring(L,2);
+	const char*sha1=luaL_optstring(L,3,NULL);
+	recovery_ui_printf("extracting %s to %s",entry,dev);
+	if((r=extract_to_block(root,entry,dev,sha1))!=0)
+		recovery_ui_printf("extract %s to %s failed: %s",entry,dev,strerror(-r));
+	lua_pushboolean(L,r==0);
+	lua_pushinteger(L,-r);
+	return 2;
+}
+
+static int lua_block_image_update(lua_State*L){
+	int r;
+	fsh*root=lua_touserdata(L,lua_upvalueindex(1));
+	const char*dev=luaL_checkstring(L,1);
+	const char*list=luaL_checkstring(L,2);
+	const char*data=luaL_optstring(L,3,NULL);
+	recovery_ui_printf("patching %s",dev);
+	if((r=block_image_update(root,dev,list,data))!=0)
+		recovery_ui_printf("update %s failed: %s",dev,strerror(-r));
+	lua_pushboolean(L,r==0);
+	lua_pushinteger(L,-r);
+	return 2;
+}
+
+static void register_block_funcs(lua_State*L,fsh*root){
+	lua_pushlightuserdata(L,root);
+	lua_pushcclosure(L,lua_package_extract_to_block,1);
+	lua_setglobal(L,"package_extract_to_block");
+	lua_pushlightuserdata(L,root);
+	lua_pushcclosure(L,lua_block_image_update,1);
+	lua_setglobal(L,"block_image_update");
+}
+
 static int usage(int e){
 	return r_printf(
 		e,e==0?STDOUT_FILENO:STDERR_FILENO,
@@ -35,6 +536,7 @@ int update_binary_main(int argc,char**argv){
 	if(ver!=1&&ver!=2&&ver!=3)return usage(2);
 	if(access(argv[3],F_OK)!=0)return re_err(3,"access zip failed");
 	recovery_out_fd=fd;
+	led_status("recovery");
 	recovery_ui_print(PRODUCT" starting");
 	recovery_ui_printf("target package: %s",argv[3]);
 	if((r=fs_open(NULL,&zip,argv[3],FILE_FLAG_READ))!=0)
@@ -54,6 +556,7 @@ int update_binary_main(int argc,char**argv){
 		EDONE(recovery_ui_printf("open package %s root failed: %m",argv[3]));
 	lua_fsh_to_lua(lua,root);
 	lua_setglobal(lua,"package");
+	register_block_funcs(lua,root);
 	recovery_ui_printf("starting flash script...");
 	if((r=xlua_run_by(lua,"updater",root,"flash.lua"))!=LUA_OK)
 		EDONE(recovery_ui_printf("run lua failed: %d",r));
@@ -7,6 +7,7 @@
  */
 
 #include<errno.h>
+#include<stdlib.h>
 #include<string.h>
 #include<strings.h>
 #include"internal.h"
@@ -24,11 +25,15 @@ const char*compressor_get_ext(compressor*c){
 	return c?c->ext:NULL;
 }
 
+bool compressor_is_standalone(compressor*c){
+	return c?c->standalone:false;
+}
+
 compressor*compressor_get_by_name(const char*name){
 	compressor*c=NULL;
 	if(!name||!name[0])EPRET(EINVAL);
 	for(size_t i=0;(c=compressors[i]);i++)
-		if(strncasecmp(c->name,name,sizeof(c->name)-1))
+		if(strncasecmp(c->name,name,sizeof(c->name)-1)==0)
 			return c;
 	EPRET(ENOENT);
 }
@@ -37,7 +42,7 @@ compressor*compressor_get_by_ext(const char*ext){
 	compressor*c=NULL;
 	if(!ext||!ext[0])EPRET(EINVAL);
 	for(size_t i=0;(c=compressors[i]);i++)
-		if(strncasecmp(c->ext,ext,sizeof(c->ext)-1))
+		if(strncasecmp(c->ext,ext,sizeof(c->ext)-1)==0)
 			return c;
 	EPRET(ENOENT);
 }
@@ -52,7 +57,7 @@ compressor*compressor_get_by_mime(const char*mime){
 	compressor*c=NULL;
 	if(!mime||!mime[0])EPRET(EINVAL);
 	for(size_t i=0;(c=compressors[i]);i++)
-		if(strncasecmp(c->mime,mime,sizeof(c->mime)-1))
+		if(strncasecmp(c->mime,mime,sizeof(c->mime)-1)==0)
 			return c;
 	EPRET(ENOENT);
 }
@@ -97,6 +102,57 @@ int compressor_decompress(
 	return c->decompress(inp,inp_len,out,out_len,pos,len);
 }
 
+compress_stream*compressor_decompress_init(compressor*c){
+	compress_stream*s;
+	if(!c)EPRET(EINVAL);
+	if(!c->decompress_init||!c->decompress_update)EPRET(ENOSYS);
+	if(!(s=malloc(sizeof(compress_stream))))EPRET(ENOMEM);
+	memset(s,0,sizeof(compress_stream));
+	s->comp=c;
+	if(c->stream_data_size>0){
+		if(!(s->data=malloc(c->stream_data_size))){
+			free(s);
+			EPRET(ENOMEM);
+		}
+		memset(s->data,0,c->stream_data_size);
+	}
+	if(c->decompress_init(s)!=0){
+		if(s->data)free(s->data);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+int compressor_decompress_update(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+){
+	if(used)*used=0;
+	if(len)*len=0;
+	if(!s||!s->comp||(!inp&&inp_len>0)||!out||out_len<=0)ERET(EINVAL);
+	if(s->end)return 0;
+	return s->comp->decompress_update(s,inp,inp_len,out,out_len,used,len);
+}
+
+bool compressor_decompress_is_end(compress_stream*s){
+	return s&&s->end;
+}
+
+int compressor_decompress_finish(compress_stream*s){
+	bool end;
+	if(!s)ERET(EINVAL);
+	end=s->end;
+	if(s->comp&&s->comp->decompress_finish)
+		s->comp->decompress_finish(s);
+	if(s->data)free(s->data);
+	free(s);
+	if(!end)ERET(EPIPE);
+	return 0;
+}
+
 #define IMPL_INLINE(suffix,by,arg,param...)\
 	int compressor_compress_##suffix(\
 		param\
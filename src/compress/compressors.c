@@ -10,9 +10,21 @@
 #include"internal.h"
 
 extern compressor compressor_gzip;
+extern compressor compressor_lz4;
+extern compressor compressor_zstd;
+extern compressor compressor_xz;
+extern compressor compressor_lzma;
 compressor*compressors[]={
 	#ifdef ENABLE_ZLIB
 	&compressor_gzip,
 	#endif
+	&compressor_lz4,
+	#ifdef ENABLE_ZSTD
+	&compressor_zstd,
+	#endif
+	#ifdef ENABLE_LZMA
+	&compressor_xz,
+	&compressor_lzma,
+	#endif
 	NULL
 };
@@ -79,6 +79,87 @@ static int gunzip(
 	return ret;
 }
 
+static int gzip(
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*pos,size_t*len
+){
+	int ret=0;
+	struct z_stream_s zs;
+	memset(&zs,0,sizeof(zs));
+	zs.zalloc=zalloc;
+	zs.zfree=zfree;
+	zs.next_out=(Bytef*)out;
+	zs.avail_out=(uInt)out_len;
+	zs.next_in=(Bytef*)inp;
+	zs.avail_in=(uInt)inp_len;
+	if((deflateInit2(
+		&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,
+		MAX_WBITS+16,8,Z_DEFAULT_STRATEGY
+	))!=Z_OK){
+		tlog_error("zlib deflate init failed!");
+		return -1;
+	}
+	switch(deflate(&zs,Z_FINISH)){
+		case Z_STREAM_END:break;
+		case Z_OK:case Z_BUF_ERROR:
+			tlog_error("zlib output buffer full");
+			ret=-1;
+		break;
+		default:
+			tlog_error("zlib unknown error");
+			ret=-1;
+		break;
+	}
+	deflateEnd(&zs);
+	if(pos)*pos=zs.total_in;
+	if(len)*len=zs.total_out;
+	return ret;
+}
+
+static int gunzip_init(compress_stream*s){
+	struct z_stream_s*zs=s->data;
+	zs->zalloc=zalloc;
+	zs->zfree=zfree;
+
+	// zlib parses the gzip header and checks the trailer itself
+	if(inflateInit2(zs,MAX_WBITS+16)!=Z_OK){
+		tlog_error("zlib inflate init failed!");
+		return -1;
+	}
+	return 0;
+}
+
+static int gunzip_update(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+){
+	int r;
+	struct z_stream_s*zs=s->data;
+	if(inp_len>0x40000000)inp_len=0x40000000;
+	if(out_len>0x40000000)out_len=0x40000000;
+	zs->next_in=(Bytef*)inp;
+	zs->avail_in=(uInt)inp_len;
+	zs->next_out=(Bytef*)out;
+	zs->avail_out=(uInt)out_len;
+	r=inflate(zs,Z_NO_FLUSH);
+	if(used)*used=inp_len-zs->avail_in;
+	if(len)*len=out_len-zs->avail_out;
+	switch(r){
+		case Z_STREAM_END:s->end=true;//fallthrough
+		case Z_OK:case Z_BUF_ERROR:return 0;
+		default:
+			tlog_error("zlib inflate failed: %s",zs->msg?:"unknown error");
+			return -1;
+	}
+}
+
+static void gunzip_finish(compress_stream*s){
+	inflateEnd(s->data);
+}
+
 static bool is_gzip(unsigned char*inp,size_t inp_len){
 	return inp_len>10&&inp[0]==0x1f&&inp[1]==0x8b&&inp[2]==0x08;
 }
@@ -88,7 +169,11 @@ compressor compressor_gzip={
 	.ext="gz",
 	.mime="application/gzip",
 	.is_format=is_gzip,
-	.compress=NULL,
-	.decompress=gunzip
+	.compress=gzip,
+	.decompress=gunzip,
+	.stream_data_size=sizeof(struct z_stream_s),
+	.decompress_init=gunzip_init,
+	.decompress_update=gunzip_update,
+	.decompress_finish=gunzip_finish,
 };
 #endif
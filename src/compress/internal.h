@@ -20,6 +20,23 @@ typedef int(*compress_func)(
 
 typedef bool(*check_func)(unsigned char*inp,size_t inp_len);
 
+typedef int(*stream_init_func)(compress_stream*s);
+
+typedef int(*stream_update_func)(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+);
+
+typedef void(*stream_finish_func)(compress_stream*s);
+
+struct compress_stream{
+	compressor*comp;
+	void*data;
+	bool end;
+};
+
 struct compressor{
 	const char name[256];
 	const char ext[32];
@@ -27,6 +44,11 @@ struct compressor{
 	check_func is_format;
 	compress_func compress;
 	compress_func decompress;
+	bool standalone;
+	size_t stream_data_size;
+	stream_init_func decompress_init;
+	stream_update_func decompress_update;
+	stream_finish_func decompress_finish;
 };
 
 extern compressor*compressors[];
@@ -0,0 +1,328 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include"defines.h"
+#include"internal.h"
+#include"logger.h"
+#define TAG "lz4"
+
+/*
+ * lz4 frame and legacy (lz4 -l, used by kbuild) decoder.
+ * checksums are not verified, the frame header is parsed only far
+ * enough to walk blocks. blocks of a frame may reference up to 64K of
+ * the data before them, legacy blocks are always independent.
+ */
+#define LZ4_MAGIC        0x184D2204
+#define LZ4_LEGACY_MAGIC 0x184C2102
+#define LZ4_LEGACY_BLOCK 0x800000
+#define LZ4_HISTORY      0x10000
+#define LZ4_BOUND(s)     ((s)+(s)/255+16)
+#define FLG_INDEPENDENT  0x20
+#define FLG_BLOCK_SUM    0x10
+#define FLG_SIZE         0x08
+#define FLG_CONTENT_SUM  0x04
+#define FLG_DICT_ID      0x01
+
+struct lz4_frame{
+	bool legacy;
+	uint8_t flg;
+	size_t max_block;
+};
+
+static inline uint32_t rd32(const unsigned char*p){
+	return p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24);
+}
+
+// base is the lowest address a match may point to
+static int lz4_block(
+	const unsigned char*src,size_t slen,
+	unsigned char*base,unsigned char*dst,
+	size_t cap,size_t*dlen
+){
+	unsigned b;
+	size_t lit,ml,off;
+	const unsigned char*ip=src,*iend=src+slen;
+	unsigned char*op=dst,*oend=dst+cap,*m;
+	while(ip<iend){
+		unsigned token=*ip++;
+		if((lit=token>>4)==15)do{
+			if(ip>=iend)return -1;
+			lit+=(b=*ip++);
+		}while(b==255);
+		if(lit>(size_t)(iend-ip)||lit>(size_t)(oend-op))return -1;
+		memcpy(op,ip,lit);
+		op+=lit,ip+=lit;
+
+		// the last sequence has literals only
+		if(ip>=iend)break;
+		if(iend-ip<2)return -1;
+		off=ip[0]|(ip[1]<<8),ip+=2;
+		if(off==0||off>(size_t)(op-base))return -1;
+		if((ml=token&15)==15)do{
+			if(ip>=iend)return -1;
+			ml+=(b=*ip++);
+		}while(b==255);
+		ml+=4;
+		if(ml>(size_t)(oend-op))return -1;
+		m=op-off;
+		if(off>=ml)memcpy(op,m,ml),op+=ml;
+		else while(ml--)*op++=*m++;
+	}
+	*dlen=op-dst;
+	return 0;
+}
+
+// returns header length, 0 when more data is needed
+static ssize_t lz4_header(const unsigned char*p,size_t len,struct lz4_frame*fr){
+	size_t hl=7;
+	if(len<4)return 0;
+	memset(fr,0,sizeof(struct lz4_frame));
+	if(rd32(p)==LZ4_LEGACY_MAGIC){
+		fr->legacy=true,fr->max_block=LZ4_LEGACY_BLOCK;
+		return 4;
+	}
+	if(rd32(p)!=LZ4_MAGIC)return -1;
+	if(len<6)return 0;
+	fr->flg=p[4];
+	if((fr->flg>>6)!=1)return -1;
+	switch((p[5]>>4)&7){
+		case 4:fr->max_block=0x10000;break;
+		case 5:fr->max_block=0x40000;break;
+		case 6:fr->max_block=0x100000;break;
+		case 7:fr->max_block=0x400000;break;
+		default:return -1;
+	}
+	if(fr->flg&FLG_SIZE)hl+=8;
+	if(fr->flg&FLG_DICT_ID)hl+=4;
+	return len<hl?0:(ssize_t)hl;
+}
+
+// legacy streams end at the end of data or at anything not a block size
+static bool legacy_end(uint32_t size){
+	return size==0||size==LZ4_LEGACY_MAGIC||size>LZ4_BOUND(LZ4_LEGACY_BLOCK);
+}
+
+// stored blocks are copied as they are, so they must fit the window
+static bool block_size_ok(const struct lz4_frame*fr,uint32_t bs){
+	size_t size=bs&0x7FFFFFFF;
+	if(!fr->legacy&&(bs&0x80000000))return size<=fr->max_block;
+	return size<=LZ4_BOUND(fr->max_block);
+}
+
+// stays quiet and allocation free, callers may run it on any processor
+static int unlz4(
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*pos,size_t*len
+){
+	ssize_t hl;
+	uint32_t bs;
+	size_t ip,op=0,dl,size;
+	struct lz4_frame fr;
+	if((hl=lz4_header(inp,inp_len,&fr))<=0)return -1;
+	for(ip=hl;;){
+		if(inp_len-ip<4){
+			if(fr.legacy&&ip==inp_len)break;
+			return -1;
+		}
+		bs=rd32(inp+ip);
+		if(fr.legacy&&legacy_end(bs))break;
+		ip+=4;
+		if(!fr.legacy&&bs==0){
+			if(fr.flg&FLG_CONTENT_SUM)ip+=4;
+			break;
+		}
+		size=bs&0x7FFFFFFF;
+		if(size>inp_len-ip||!block_size_ok(&fr,bs))
+			return -1;
+		if(!fr.legacy&&(bs&0x80000000)){
+			if(size>out_len-op)
+				return -1;
+			memcpy(out+op,inp+ip,dl=size);
+		}else if(lz4_block(
+			inp+ip,size,
+			fr.legacy||(fr.flg&FLG_INDEPENDENT)?out+op:out,
+			out+op,MIN(out_len-op,fr.max_block),&dl
+		)!=0)return -1;
+		ip+=size,op+=dl;
+		if(!fr.legacy&&(fr.flg&FLG_BLOCK_SUM))ip+=4;
+	}
+	if(ip>inp_len)return -1;
+	if(pos)*pos=ip;
+	if(len)*len=op;
+	return 0;
+}
+
+enum lz4_state{
+	LZ4_HEADER=0,
+	LZ4_SIZE,
+	LZ4_DATA,
+	LZ4_SUM,
+	LZ4_OUTPUT,
+	LZ4_TRAILER,
+};
+
+struct lz4_stream{
+	enum lz4_state state;
+	struct lz4_frame fr;
+	unsigned char hdr[19];
+	size_t hdr_len,need,got;
+	uint32_t bs;
+	unsigned char*blk,*win;
+	size_t hist,out_pos,out_len;
+};
+
+static int unlz4_init(compress_stream*s){
+	struct lz4_stream*ls=s->data;
+	memset(ls,0,sizeof(struct lz4_stream));
+	return 0;
+}
+
+// gather need bytes into dst, returns true once complete
+static bool gather(
+	unsigned char*dst,size_t need,size_t*got,
+	unsigned char**inp,size_t*inp_len
+){
+	size_t n=MIN(need-*got,*inp_len);
+	memcpy(dst+*got,*inp,n);
+	*got+=n,*inp+=n,*inp_len-=n;
+	return *got>=need;
+}
+
+static int stream_block(struct lz4_stream*ls){
+	size_t dl=0,size=ls->bs&0x7FFFFFFF;
+	bool indep=ls->fr.legacy||(ls->fr.flg&FLG_INDEPENDENT);
+
+	// keep the last 64K of output in front of the block for matches
+	if(indep)ls->hist=0;
+	else if(ls->hist+ls->out_len>LZ4_HISTORY){
+		size_t keep=MIN(ls->hist+ls->out_len,(size_t)LZ4_HISTORY);
+		memmove(ls->win,ls->win+ls->hist+ls->out_len-keep,keep);
+		ls->hist=keep;
+	}else ls->hist+=ls->out_len;
+	if(!ls->fr.legacy&&(ls->bs&0x80000000))
+		memcpy(ls->win+ls->hist,ls->blk,dl=size);
+	else if(lz4_block(
+		ls->blk,size,ls->win,ls->win+ls->hist,
+		ls->fr.max_block,&dl
+	)!=0)return trlog_error(-1,"bad lz4 block");
+	ls->out_pos=0,ls->out_len=dl;
+	return 0;
+}
+
+static int unlz4_update(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+){
+	ssize_t hl;
+	size_t n,done=0,left=inp_len;
+	struct lz4_stream*ls=s->data;
+	while(!s->end)switch(ls->state){
+		case LZ4_HEADER:
+			if(left<=0)goto need;
+			n=MIN(sizeof(ls->hdr)-ls->hdr_len,left);
+			memcpy(ls->hdr+ls->hdr_len,inp,n);
+			if((hl=lz4_header(ls->hdr,ls->hdr_len+n,&ls->fr))<0)
+				return trlog_error(-1,"bad lz4 header");
+			if(hl==0){
+				ls->hdr_len+=n,inp+=n,left-=n;
+				break;
+			}
+			n=hl-ls->hdr_len,inp+=n,left-=n;
+			if(!(ls->blk=malloc(LZ4_BOUND(ls->fr.max_block))))return -1;
+			if(!(ls->win=malloc(LZ4_HISTORY+ls->fr.max_block)))return -1;
+			ls->state=LZ4_SIZE,ls->got=0;
+		break;
+		case LZ4_SIZE:
+			if(left<=0){
+				// a legacy stream may simply stop after any block
+				if(!inp&&ls->fr.legacy&&ls->got==0)s->end=true;
+				goto need;
+			}
+			n=left;
+			if(!gather(ls->hdr,4,&ls->got,&inp,&left))break;
+			ls->bs=rd32(ls->hdr),ls->got=0;
+			if(ls->fr.legacy&&legacy_end(ls->bs)){
+				// not ours, hand back what this call took of it
+				n-=left,inp-=n,left+=n;
+				s->end=true;
+				break;
+			}
+			if(!ls->fr.legacy&&ls->bs==0){
+				ls->need=ls->fr.flg&FLG_CONTENT_SUM?4:0;
+				ls->state=LZ4_TRAILER;
+				break;
+			}
+			if(!block_size_ok(&ls->fr,ls->bs))
+				return trlog_error(-1,"bad lz4 block size");
+			ls->state=LZ4_DATA;
+		break;
+		case LZ4_DATA:
+			if(left<=0)goto need;
+			if(!gather(ls->blk,ls->bs&0x7FFFFFFF,&ls->got,&inp,&left))break;
+			if(stream_block(ls)!=0)return -1;
+			ls->got=0;
+			ls->need=!ls->fr.legacy&&(ls->fr.flg&FLG_BLOCK_SUM)?4:0;
+			ls->state=ls->need>0?LZ4_SUM:LZ4_OUTPUT;
+		break;
+		case LZ4_SUM:
+			if(left<=0)goto need;
+			n=MIN(ls->need,left);
+			ls->need-=n,inp+=n,left-=n;
+			if(ls->need<=0)ls->state=LZ4_OUTPUT;
+		break;
+		case LZ4_OUTPUT:
+			if(done>=out_len)goto need;
+			n=MIN(ls->out_len-ls->out_pos,out_len-done);
+			memcpy(out+done,ls->win+ls->hist+ls->out_pos,n);
+			ls->out_pos+=n,done+=n;
+			if(ls->out_pos>=ls->out_len)ls->state=LZ4_SIZE;
+		break;
+		case LZ4_TRAILER:
+			n=MIN(ls->need,left);
+			ls->need-=n,inp+=n,left-=n;
+			if(ls->need>0)goto need;
+			s->end=true;
+		break;
+	}
+	need:
+	if(used)*used=inp_len-left;
+	if(len)*len=done;
+	return 0;
+}
+
+static void unlz4_finish(compress_stream*s){
+	struct lz4_stream*ls=s->data;
+	if(ls->blk)free(ls->blk);
+	if(ls->win)free(ls->win);
+}
+
+static bool is_lz4(unsigned char*inp,size_t inp_len){
+	return inp_len>=8&&(
+		rd32(inp)==LZ4_MAGIC||
+		rd32(inp)==LZ4_LEGACY_MAGIC
+	);
+}
+
+compressor compressor_lz4={
+	.name="lz4",
+	.ext="lz4",
+	.mime="application/x-lz4",
+	.is_format=is_lz4,
+	.decompress=unlz4,
+	.standalone=true,
+	.stream_data_size=sizeof(struct lz4_stream),
+	.decompress_init=unlz4_init,
+	.decompress_update=unlz4_update,
+	.decompress_finish=unlz4_finish,
+};
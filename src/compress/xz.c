@@ -0,0 +1,137 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_LZMA
+#include<lzma.h>
+#include<stdlib.h>
+#include<string.h>
+#include"internal.h"
+#include"logger.h"
+#define TAG "lzma"
+
+// xz containers and raw lzma_alone data share the liblzma stream
+static int decoder_init(lzma_stream*ls,bool alone){
+	lzma_ret r;
+	lzma_stream init=LZMA_STREAM_INIT;
+	memcpy(ls,&init,sizeof(lzma_stream));
+	r=alone?
+		lzma_alone_decoder(ls,UINT64_MAX):
+		lzma_stream_decoder(ls,UINT64_MAX,0);
+	if(r!=LZMA_OK)return trlog_error(-1,"lzma decoder init failed: %d",r);
+	return 0;
+}
+
+static int decode(
+	lzma_stream*ls,lzma_action act,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len,bool*end
+){
+	lzma_ret r;
+	ls->next_in=inp,ls->avail_in=inp_len;
+	ls->next_out=out,ls->avail_out=out_len;
+	r=lzma_code(ls,act);
+	if(used)*used=inp_len-ls->avail_in;
+	if(len)*len=out_len-ls->avail_out;
+	switch(r){
+		case LZMA_STREAM_END:*end=true;//fallthrough
+		case LZMA_OK:case LZMA_BUF_ERROR:return 0;
+		default:return trlog_error(-1,"lzma decompress failed: %d",r);
+	}
+}
+
+static int unlzma_common(
+	bool alone,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*pos,size_t*len
+){
+	int r;
+	bool end=false;
+	lzma_stream ls;
+	if(decoder_init(&ls,alone)!=0)return -1;
+	r=decode(&ls,LZMA_FINISH,inp,inp_len,out,out_len,pos,len,&end);
+	lzma_end(&ls);
+	if(r==0&&!end)r=trlog_error(-1,"lzma output buffer full or data truncated");
+	return r;
+}
+
+static int unxz(
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*pos,size_t*len
+){
+	return unlzma_common(false,inp,inp_len,out,out_len,pos,len);
+}
+
+static int unlzma(
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*pos,size_t*len
+){
+	return unlzma_common(true,inp,inp_len,out,out_len,pos,len);
+}
+
+static int unxz_init(compress_stream*s){
+	return decoder_init(s->data,false);
+}
+
+static int unlzma_init(compress_stream*s){
+	return decoder_init(s->data,true);
+}
+
+static int unxz_update(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+){
+	// no more input means everything left must come out now
+	return decode(
+		s->data,inp?LZMA_RUN:LZMA_FINISH,
+		inp,inp_len,out,out_len,
+		used,len,&s->end
+	);
+}
+
+static void unxz_finish(compress_stream*s){
+	lzma_end(s->data);
+}
+
+static bool is_xz(unsigned char*inp,size_t inp_len){
+	return inp_len>=6&&memcmp(inp,"\xfd""7zXZ\x00",6)==0;
+}
+
+static bool is_lzma(unsigned char*inp,size_t inp_len){
+	return inp_len>=13&&inp[0]==0x5d&&inp[1]==0x00&&inp[2]==0x00;
+}
+
+compressor compressor_xz={
+	.name="xz",
+	.ext="xz",
+	.mime="application/x-xz",
+	.is_format=is_xz,
+	.decompress=unxz,
+	.stream_data_size=sizeof(lzma_stream),
+	.decompress_init=unxz_init,
+	.decompress_update=unxz_update,
+	.decompress_finish=unxz_finish,
+};
+
+compressor compressor_lzma={
+	.name="lzma",
+	.ext="lzma",
+	.mime="application/x-lzma",
+	.is_format=is_lzma,
+	.decompress=unlzma,
+	.stream_data_size=sizeof(lzma_stream),
+	.decompress_init=unlzma_init,
+	.decompress_update=unxz_update,
+	.decompress_finish=unxz_finish,
+};
+#endif
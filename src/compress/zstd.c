@@ -0,0 +1,85 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_ZSTD
+#include<zstd.h>
+#include<stdlib.h>
+#include<string.h>
+#include"internal.h"
+#include"logger.h"
+#define TAG "zstd"
+
+static int unzstd(
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*pos,size_t*len
+){
+	size_t fs,r;
+	ZSTD_DCtx*ctx;
+
+	// only the first frame, data after it is for the caller
+	fs=ZSTD_findFrameCompressedSize(inp,inp_len);
+	if(ZSTD_isError(fs))return trlog_error(
+		-1,"bad zstd frame: %s",ZSTD_getErrorName(fs)
+	);
+	if(!(ctx=ZSTD_createDCtx()))return -1;
+	r=ZSTD_decompressDCtx(ctx,out,out_len,inp,fs);
+	ZSTD_freeDCtx(ctx);
+	if(ZSTD_isError(r))return trlog_error(
+		-1,"zstd decompress failed: %s",ZSTD_getErrorName(r)
+	);
+	if(pos)*pos=fs;
+	if(len)*len=r;
+	return 0;
+}
+
+static int unzstd_init(compress_stream*s){
+	if(!(s->data=ZSTD_createDStream()))return -1;
+	ZSTD_initDStream(s->data);
+	return 0;
+}
+
+static int unzstd_update(
+	compress_stream*s,
+	unsigned char*inp,size_t inp_len,
+	unsigned char*out,size_t out_len,
+	size_t*used,size_t*len
+){
+	size_t r;
+	ZSTD_inBuffer ib={.src=inp,.size=inp_len,.pos=0};
+	ZSTD_outBuffer ob={.dst=out,.size=out_len,.pos=0};
+	r=ZSTD_decompressStream(s->data,&ob,&ib);
+	if(used)*used=ib.pos;
+	if(len)*len=ob.pos;
+	if(ZSTD_isError(r))return trlog_error(
+		-1,"zstd decompress failed: %s",ZSTD_getErrorName(r)
+	);
+	if(r==0)s->end=true;
+	return 0;
+}
+
+static void unzstd_finish(compress_stream*s){
+	ZSTD_freeDStream(s->data);
+	s->data=NULL;
+}
+
+static bool is_zstd(unsigned char*inp,size_t inp_len){
+	return inp_len>=4&&inp[0]==0x28&&inp[1]==0xb5&&inp[2]==0x2f&&inp[3]==0xfd;
+}
+
+compressor compressor_zstd={
+	.name="zstd",
+	.ext="zst",
+	.mime="application/zstd",
+	.is_format=is_zstd,
+	.decompress=unzstd,
+	.decompress_init=unzstd_init,
+	.decompress_update=unzstd_update,
+	.decompress_finish=unzstd_finish,
+};
+#endif
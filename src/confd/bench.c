@@ -0,0 +1,213 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/un.h>
+#include<sys/socket.h>
+#include"confd_internal.h"
+#define BENCH_BASE "benchmark"
+#define BENCH_GROUPS 10
+
+static double time_diff(struct timespec*start){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (double)(now.tv_sec-start->tv_sec)+
+		(double)(now.tv_nsec-start->tv_nsec)/1e9;
+}
+
+static void bench_key(char*buf,size_t len,size_t i){
+	snprintf(
+		buf,len,BENCH_BASE".group%zu.key%zu",
+		i%BENCH_GROUPS,i
+	);
+}
+
+int conf_bench_lookup(size_t keys,size_t loops){
+	char key[128];
+	double t;
+	size_t miss=0;
+	struct timespec start;
+	if(keys==0||loops==0)ERET(EINVAL);
+	conf_del(BENCH_BASE,0,0);
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for(size_t i=0;i<keys;i++){
+		bench_key(key,sizeof(key),i);
+		if(conf_set_integer(key,(int64_t)i,0,0)!=0){
+			conf_del(BENCH_BASE,0,0);
+			return -errno;
+		}
+	}
+	t=time_diff(&start);
+	printf(
+		"insert: %zu keys in %.3fs (%.0f keys/s)\n",
+		keys,t,t>0?keys/t:0
+	);
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for(size_t l=0;l<loops;l++)for(size_t i=0;i<keys;i++){
+		bench_key(key,sizeof(key),i);
+		if(conf_get_integer(key,-1,0,0)!=(int64_t)i)miss++;
+	}
+	t=time_diff(&start);
+	printf(
+		"lookup: %zu lookups in %.3fs (%.0f lookups/s), %zu missed\n",
+		keys*loops,t,t>0?keys*loops/t:0,miss
+	);
+	conf_del(BENCH_BASE,0,0);
+	return miss>0?-1:0;
+}
+
+struct bench_client{
+	pthread_t tid;
+	int fd;
+	unsigned int seed;
+	struct confd_bench*bench;
+	uint64_t*lat;
+	size_t done,errors;
+};
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL+(uint64_t)ts.tv_nsec;
+}
+
+static int bench_connect(const char*sock){
+	int fd;
+	struct sockaddr_un n={.sun_family=AF_UNIX};
+	strncpy(n.sun_path,sock,sizeof(n.sun_path)-1);
+	if((fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0))<0)return -1;
+	if(connect(fd,(struct sockaddr*)&n,sizeof(n))<0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int bench_skip(int fd,size_t len){
+	char buf[4096];
+	while(len>0){
+		size_t l=len>sizeof(buf)?sizeof(buf):len;
+		if(confd_internal_read_data(fd,buf,l)<0)return -1;
+		len-=l;
+	}
+	return 0;
+}
+
+static int bench_request(struct bench_client*c,size_t i){
+	struct confd_msg msg,res;
+	struct confd_bench*b=c->bench;
+	unsigned int w=b->get+b->set+b->ls,r=(unsigned int)rand_r(&c->seed)%w;
+	size_t k=(size_t)rand_r(&c->seed)%b->keys;
+	if(r<b->get){
+		confd_internal_init_msg(&msg,CONF_GET_INTEGER);
+		bench_key(msg.path,sizeof(msg.path),k);
+	}else if(r<b->get+b->set){
+		confd_internal_init_msg(&msg,CONF_SET_INTEGER);
+		bench_key(msg.path,sizeof(msg.path),k);
+		msg.data.integer=(int64_t)i;
+	}else{
+		confd_internal_init_msg(&msg,CONF_LIST);
+		snprintf(msg.path,sizeof(msg.path),BENCH_BASE".group%zu",k%BENCH_GROUPS);
+	}
+	if(confd_internal_send(c->fd,&msg)<0)return -1;
+	if(confd_internal_read_msg(c->fd,&res)<=0)return -1;
+	if(msg.action==CONF_LIST&&res.data.data_len>0&&
+		bench_skip(c->fd,sizeof(size_t)+res.data.data_len)<0)return -1;
+	return res.code==0?0:1;
+}
+
+static void*bench_client_thread(void*d){
+	uint64_t start;
+	struct bench_client*c=d;
+	for(size_t i=0;i<c->bench->ops;i++){
+		start=now_ns();
+		switch(bench_request(c,i)){
+			case 0:break;
+			case 1:c->errors++;break;
+			default:c->errors++;return NULL;
+		}
+		c->lat[c->done++]=now_ns()-start;
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void*a,const void*b){
+	uint64_t x=*(const uint64_t*)a,y=*(const uint64_t*)b;
+	return x<y?-1:x>y?1:0;
+}
+
+static uint64_t percentile(uint64_t*lat,size_t cnt,size_t per_mille){
+	size_t i=cnt*per_mille/1000;
+	return cnt>0?lat[i>=cnt?cnt-1:i]:0;
+}
+
+int confd_bench_run(const char*sock,struct confd_bench*b){
+	int r=-1,e;
+	uint64_t start,*lat=NULL;
+	size_t i,cnt=0,started=0;
+	struct bench_client*cs=NULL;
+	if(!sock||!b||b->threads<=0||b->ops<=0||b->keys<=0)ERET(EINVAL);
+	if(b->get+b->set+b->ls<=0)ERET(EINVAL);
+	b->done=0,b->errors=0,b->elapsed=0;
+	b->p50=0,b->p99=0,b->p999=0,b->max=0;
+	if(!(cs=malloc(sizeof(struct bench_client)*b->threads)))ERET(ENOMEM);
+	memset(cs,0,sizeof(struct bench_client)*b->threads);
+	for(i=0;i<b->threads;i++)cs[i].fd=-1;
+
+	// fill keys through the normal client, so ls and get have something to find
+	confd_delete(BENCH_BASE);
+	for(i=0;i<b->keys;i++){
+		char key[128];
+		bench_key(key,sizeof(key),i);
+		if(confd_set_integer(key,(int64_t)i)!=0)goto done;
+	}
+
+	// every client has its own connection, so requests really run concurrently
+	for(i=0;i<b->threads;i++){
+		cs[i].bench=b,cs[i].seed=(unsigned int)(i*7919+1);
+		if(!(cs[i].lat=malloc(sizeof(uint64_t)*b->ops)))goto done;
+		if((cs[i].fd=bench_connect(sock))<0)goto done;
+	}
+	start=now_ns();
+	for(i=0;i<b->threads;i++,started++)
+		if(pthread_create(&cs[i].tid,NULL,bench_client_thread,&cs[i])!=0)break;
+	for(i=0;i<started;i++)pthread_join(cs[i].tid,NULL);
+	b->elapsed=(double)(now_ns()-start)/1e9;
+	if(started!=b->threads)goto done;
+
+	for(i=0;i<b->threads;i++)b->done+=cs[i].done,b->errors+=cs[i].errors;
+	if(b->done>0&&(lat=malloc(sizeof(uint64_t)*b->done))){
+		for(i=0;i<b->threads;i++){
+			memcpy(lat+cnt,cs[i].lat,sizeof(uint64_t)*cs[i].done);
+			cnt+=cs[i].done;
+		}
+		qsort(lat,cnt,sizeof(uint64_t),cmp_u64);
+		b->p50=percentile(lat,cnt,500);
+		b->p99=percentile(lat,cnt,990);
+		b->p999=percentile(lat,cnt,999);
+		b->max=lat[cnt-1];
+		free(lat);
+	}
+	r=0;
+	done:
+	e=r!=0?(errno?errno:EIO):0;
+	for(i=0;i<b->threads;i++){
+		if(cs[i].fd>=0)close(cs[i].fd);
+		if(cs[i].lat)free(cs[i].lat);
+	}
+	free(cs);
+	confd_delete(BENCH_BASE);
+	errno=e;
+	return r;
+}
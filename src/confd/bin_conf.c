@@ -0,0 +1,198 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<string.h>
+#include<stdlib.h>
+#include"list.h"
+#include"logger.h"
+#include"confd_internal.h"
+#define TAG "config"
+
+/*
+ * binary snapshot layout, all offsets are from the file start and
+ * in host byte order, so a loaded (or mmap-ed) file is used in place:
+ *
+ *   struct conf_bin_header
+ *   struct conf_bin_node[node_cnt]  pre-order, parents before children
+ *   char strings[str_len]           NUL terminated names and values
+ */
+#define BIN_MAGIC "SICB"
+#define BIN_VERSION 1
+#define BIN_ENDIAN 0x1234
+#define BIN_NO_PARENT UINT32_MAX
+#define BIN_MAX_DEPTH 64
+
+struct conf_bin_header{
+	char magic[4];
+	uint16_t version;
+	uint16_t endian;
+	uint32_t node_cnt;
+	uint32_t node_off;
+	uint32_t str_off;
+	uint32_t str_len;
+};
+
+struct conf_bin_node{
+	uint32_t parent;
+	uint32_t name;
+	uint32_t type;
+	uint32_t reserved;
+	union{
+		int64_t integer;
+		uint32_t string;
+		uint8_t boolean;
+	}value;
+};
+
+struct bin_buffer{
+	char*data;
+	size_t len,size;
+};
+
+static int bin_append(struct bin_buffer*b,const void*data,size_t len){
+	if(b->len+len>b->size){
+		size_t ns=b->size;
+		char*n;
+		do{ns+=4096;}while(b->len+len>ns);
+		if(!(n=realloc(b->data,ns)))ERET(ENOMEM);
+		b->data=n,b->size=ns;
+	}
+	memcpy(b->data+b->len,data,len);
+	b->len+=len;
+	return 0;
+}
+
+static int bin_add_string(struct bin_buffer*str,const char*s,uint32_t*off){
+	if(str->len>=UINT32_MAX)ERET(EFBIG);
+	*off=(uint32_t)str->len;
+	return bin_append(str,s,strlen(s)+1);
+}
+
+static int save_bin_node(struct bin_buffer*nodes,struct bin_buffer*str,struct conf*c,uint32_t parent){
+	uint32_t idx;
+	struct conf_bin_node n;
+	if(c->include||!c->save)return 0;
+	idx=(uint32_t)(nodes->len/sizeof(n));
+	if(c->name[0]){
+		memset(&n,0,sizeof(n));
+		n.parent=parent,n.type=c->type;
+		if(bin_add_string(str,c->name,&n.name)!=0)return -1;
+		switch(c->type){
+			case TYPE_KEY:break;
+			case TYPE_STRING:
+				if(!VALUE_STRING(c))return 0;
+				if(bin_add_string(str,VALUE_STRING(c),&n.value.string)!=0)return -1;
+			break;
+			case TYPE_INTEGER:n.value.integer=VALUE_INTEGER(c);break;
+			case TYPE_BOOLEAN:n.value.boolean=VALUE_BOOLEAN(c);break;
+			default:return 0;
+		}
+		if(bin_append(nodes,&n,sizeof(n))!=0)return -1;
+	}else idx=BIN_NO_PARENT;
+	if(c->type==TYPE_KEY)CONF_FOR_EACH(l,c)
+		if(save_bin_node(nodes,str,l,idx)!=0)return -1;
+	return 0;
+}
+
+static int conf_save(struct conf_file_hand*hand){
+	int r=-1;
+	struct conf_bin_header hdr;
+	struct bin_buffer nodes={0},str={0};
+	if(save_bin_node(&nodes,&str,conf_get_store(),BIN_NO_PARENT)!=0)
+		EDONE(tlog_warn("generate binary config failed"));
+	if(nodes.len/sizeof(struct conf_bin_node)>=BIN_NO_PARENT)
+		EDONE(tlog_warn("too many config items"));
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,BIN_MAGIC,sizeof(hdr.magic));
+	hdr.version=BIN_VERSION,hdr.endian=BIN_ENDIAN;
+	hdr.node_cnt=nodes.len/sizeof(struct conf_bin_node);
+	hdr.node_off=sizeof(hdr);
+	hdr.str_off=hdr.node_off+nodes.len;
+	hdr.str_len=str.len;
+
+	// write with len 0 means a string
+	hand->write(hand,(char*)&hdr,sizeof(hdr));
+	if(nodes.len>0)hand->write(hand,nodes.data,nodes.len);
+	if(str.len>0)hand->write(hand,str.data,str.len);
+	r=0;
+	done:
+	if(nodes.data)free(nodes.data);
+	if(str.data)free(str.data);
+	return r;
+}
+
+static const char*bin_string(struct conf_bin_header*hdr,const char*strs,uint32_t off){
+	if(off>=hdr->str_len)return NULL;
+	if(!memchr(strs+off,0,hdr->str_len-off))return NULL;
+	return strs+off;
+}
+
+static int conf_load(struct conf_file_hand*hand){
+	char path[PATH_MAX],*str;
+	const char*strs,*name,*val;
+	struct conf_bin_header*hdr;
+	struct conf_bin_node*nodes,*n;
+	size_t depth=0,l,plen[BIN_MAX_DEPTH];
+	uint32_t pidx[BIN_MAX_DEPTH];
+	if(hand->len<sizeof(struct conf_bin_header))goto inv;
+	hdr=(struct conf_bin_header*)hand->buff;
+	if(memcmp(hdr->magic,BIN_MAGIC,sizeof(hdr->magic))!=0)goto inv;
+	if(hdr->version!=BIN_VERSION||hdr->endian!=BIN_ENDIAN)
+		return trlog_warn(-1,"unsupported binary config %s",hand->path);
+	if(
+		hdr->node_off<sizeof(struct conf_bin_header)||
+		hdr->node_off>hand->len||
+		hdr->node_cnt>(hand->len-hdr->node_off)/sizeof(struct conf_bin_node)||
+		hdr->str_off<hdr->node_off+hdr->node_cnt*sizeof(struct conf_bin_node)||
+		hdr->str_off>hand->len||
+		hdr->str_len>hand->len-hdr->str_off
+	)goto inv;
+	nodes=(struct conf_bin_node*)(hand->buff+hdr->node_off);
+	strs=hand->buff+hdr->str_off;
+
+	// walk pre-order nodes, keep a stack of the current parent chain
+	for(uint32_t i=0;i<hdr->node_cnt;i++){
+		n=&nodes[i];
+		if(n->parent!=BIN_NO_PARENT&&n->parent>=i)goto inv;
+		while(depth>0&&pidx[depth-1]!=n->parent)depth--;
+		if(depth==0&&n->parent!=BIN_NO_PARENT)goto inv;
+		if(!(name=bin_string(hdr,strs,n->name))||!name[0])goto inv;
+		l=depth>0?plen[depth-1]:0;
+		if(l+strlen(name)+2>=sizeof(path))goto inv;
+		if(l>0)path[l++]='.';
+		strcpy(path+l,name);
+		switch(n->type){
+			case TYPE_KEY:
+				if(depth>=BIN_MAX_DEPTH)goto inv;
+				conf_add_key(path,0,0);
+				pidx[depth]=i,plen[depth]=strlen(path),depth++;
+			break;
+			case TYPE_STRING:
+				if(!(val=bin_string(hdr,strs,n->value.string)))goto inv;
+				if(!(str=strdup(val)))ERET(ENOMEM);
+				if(conf_set_string_inc(path,str,0,0,hand->include)!=0)free(str);
+			break;
+			case TYPE_INTEGER:
+				conf_set_integer_inc(path,n->value.integer,0,0,hand->include);
+			break;
+			case TYPE_BOOLEAN:
+				conf_set_boolean_inc(path,n->value.boolean!=0,0,0,hand->include);
+			break;
+			default:tlog_warn("unsupported item type %u in %s",n->type,hand->path);
+		}
+	}
+	return 0;
+	inv:return trlog_warn(-1,"invalid binary config %s",hand->path);
+}
+
+struct conf_file_hand conf_hand_bin={
+	.ext=(char*[]){"bin","snap",NULL},
+	.load=conf_load,
+	.save=conf_save,
+};
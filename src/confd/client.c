@@ -7,8 +7,11 @@
  */
 
 #define _GNU_SOURCE
+#include<poll.h>
+#include<unistd.h>
 #include<stdlib.h>
 #include<string.h>
+#include<pthread.h>
 #include<sys/un.h>
 #include<sys/socket.h>
 #include"lock.h"
@@ -16,9 +19,30 @@
 #include"confd_internal.h"
 
 int confd=-1;
+bool confd_local=false;
+pid_t confd_local_pid=0;
 static mutex_t lock;
 static bool lock_initialized=false;
 
+// store is in this process, skip the socket and use our own credentials
+#define IS_LOCAL (confd_local&&getpid()==confd_local_pid)
+#define LOCAL_CRED geteuid(),getegid()
+
+static int local_code(int r){
+	if(r<0)errno=-r;
+	return errno;
+}
+
+static void confd_negotiate(){
+	struct confd_msg msg;
+	confd_proto=1;
+	confd_internal_init_msg(&msg,CONF_HELLO);
+	msg.data.integer=CONFD_PROTO;
+	if(confd_internal_send(confd,&msg)<0)return;
+	if(confd_internal_read_msg(confd,&msg)<=0)return;
+	if(msg.action==CONF_OK&&msg.data.integer>=2)confd_proto=2;
+}
+
 int open_confd_socket(bool quiet,char*tag,char*path){
 	if(!lock_initialized){
 		lock_initialized=true;
@@ -36,6 +60,7 @@ int open_confd_socket(bool quiet,char*tag,char*path){
 		close(confd);
 		confd=-1;
 	}
+	if(confd>=0)confd_negotiate();
 	MUTEX_UNLOCK(lock);
 	return confd;
 }
@@ -45,6 +70,7 @@ int check_open_confd_socket(bool quiet,char*tag,char*path){
 }
 
 int set_confd_socket(int fd){
+	confd_proto=1;
 	return confd=fd;
 }
 
@@ -69,6 +95,7 @@ int confd_delete(const char*path){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_del(path,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_DELETE);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -85,6 +112,7 @@ int confd_add_key(const char*path){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_add_key(path,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_ADD_KEY);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -101,6 +129,7 @@ int confd_set_integer(const char*path,int64_t data){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_set_integer(path,data,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_INTEGER);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -113,12 +142,20 @@ int confd_set_integer(const char*path,int64_t data){
 	return success?(int)res.code:-1;
 }
 
+static int confd_local_set_string(const char*path,char*data){
+	char*str=strdup(data?data:"");
+	if(!str)ERET(ENOMEM);
+	if(local_code(conf_set_string(path,str,LOCAL_CRED))!=0)free(str);
+	return errno;
+}
+
 int confd_set_string(const char*path,char*data){
 	errno=0;
 	size_t size=0;
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return confd_local_set_string(path,data);
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_STRING);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -137,6 +174,7 @@ int confd_set_boolean(const char*path,bool data){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_set_boolean(path,data,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_BOOLEAN);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -154,6 +192,10 @@ int64_t confd_count(const char*path){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL){
+		int r=conf_count(path,LOCAL_CRED);
+		return r<0?(local_code(r),0):r;
+	}
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_COUNT);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -165,12 +207,30 @@ int64_t confd_count(const char*path){
 	return success?res.data.integer:-1;
 }
 
+int confd_tree_hash(const char*path,uint64_t*hash){
+	errno=0;
+	bool success=false;
+	struct confd_msg msg,res;
+	if(!path||!hash||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_tree_hash(path,hash,LOCAL_CRED));
+	MUTEX_LOCK(lock);
+	confd_internal_init_msg(&msg,CONF_HASH);
+	strncpy(msg.path,path,sizeof(msg.path)-1);
+	if(confd_internal_send(confd,&msg)<0)goto fail;
+	if(confd_internal_read_msg(confd,&res)<0)goto fail;
+	if(res.code>0)errno=res.code;
+	else *hash=(uint64_t)res.data.integer,success=true;
+	fail:MUTEX_UNLOCK(lock);
+	return success?0:-1;
+}
+
 char**confd_ls(const char*path){
 	errno=0;
 	char**ls=NULL,*ret=NULL;
 	struct confd_msg msg,res;
 	if(!path)EPRET(EINVAL);
 	if(confd<0)return NULL;
+	if(IS_LOCAL)return conf_ls_dup(path,LOCAL_CRED);
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_LIST);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -206,6 +266,7 @@ enum conf_type confd_get_type(const char*path){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return conf_get_type(path,LOCAL_CRED);
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_TYPE);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -223,6 +284,16 @@ char*confd_get_string(const char*path,char*def){
 	if(def&&!xdef)EPRET(ENOMEM);
 	ret=xdef;
 	if(confd<0)return xdef;
+	if(IS_LOCAL){
+		errno=0;
+		if(!(ret=conf_dup_string(path,LOCAL_CRED)))return xdef;
+		if(!ret[0]){
+			free(ret);
+			return xdef;
+		}
+		if(xdef)free(xdef);
+		return ret;
+	}
 	struct confd_msg msg,res;
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_STRING);
@@ -262,6 +333,7 @@ int64_t confd_get_integer(const char*path,int64_t def){
 	struct confd_msg msg,res;
 	if(!path)ERET(EINVAL);
 	if(confd<0)return def;
+	if(IS_LOCAL)return conf_get_integer(path,def,LOCAL_CRED);
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_INTEGER);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -280,6 +352,7 @@ bool confd_get_boolean(const char*path,bool def){
 	struct confd_msg msg,res;
 	if(!path)ERET(EINVAL);
 	if(confd<0)return def;
+	if(IS_LOCAL)return conf_get_boolean(path,def,LOCAL_CRED);
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_BOOLEAN);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -331,6 +404,7 @@ int confd_rename(const char*path,const char*name){
 	struct confd_msg msg,res;
 	if(!path||!name||!*path||!*name||confd<0)ERET(EINVAL);
 	if(strchr(path,':')||strchr(name,':'))ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_rename(path,name,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_RENAME);
 	snprintf(msg.path,sizeof(msg.path)-1,"%s:%s",path,name);
@@ -347,6 +421,7 @@ int confd_set_save(const char*path,bool save){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_set_save(path,save,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_SAVE);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -364,6 +439,7 @@ bool confd_get_save(const char*path){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0)ERET(EINVAL);
+	if(IS_LOCAL)return conf_get_save(path,LOCAL_CRED);
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_SAVE);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -380,6 +456,7 @@ int confd_get_own(const char*path,uid_t*own){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0||!own)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_get_own(path,own,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_OWNER);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -397,6 +474,7 @@ int confd_get_grp(const char*path,uid_t*grp){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0||!grp)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_get_grp(path,grp,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_GROUP);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -414,6 +492,7 @@ int confd_get_mod(const char*path,mode_t*mod){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0||!mod)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_get_mod(path,mod,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_GET_MODE);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -431,6 +510,7 @@ int confd_set_own(const char*path,uid_t own){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0||!own)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_set_own(path,own,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_OWNER);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -448,6 +528,7 @@ int confd_set_grp(const char*path,uid_t grp){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0||!grp)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_set_grp(path,grp,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_GROUP);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -465,6 +546,7 @@ int confd_set_mod(const char*path,mode_t mod){
 	bool success=false;
 	struct confd_msg msg,res;
 	if(!path||confd<0||!mod)ERET(EINVAL);
+	if(IS_LOCAL)return local_code(conf_set_mod(path,mod,LOCAL_CRED));
 	MUTEX_LOCK(lock);
 	confd_internal_init_msg(&msg,CONF_SET_MODE);
 	strncpy(msg.path,path,sizeof(msg.path)-1);
@@ -477,6 +559,215 @@ int confd_set_mod(const char*path,mode_t mod){
 	return success?(int)res.code:-1;
 }
 
+static int confd_batch(struct confd_item*items,size_t cnt,bool set){
+	errno=0;
+	char*buf=NULL,*p;
+	size_t len=0,off=0,n=0;
+	struct confd_msg msg,res;
+	struct confd_batch_rec rec;
+	if(!items||cnt<=0||cnt>CONFD_BATCH_MAX||confd<0)ERET(EINVAL);
+	for(size_t i=0;i<cnt;i++){
+		if(!items[i].path)ERET(EINVAL);
+		len+=sizeof(rec)+strlen(items[i].path);
+		if(set&&items[i].type==TYPE_STRING&&items[i].value.string)
+			len+=strlen(items[i].value.string);
+	}
+	if(len>CONFD_BATCH_SIZE)ERET(E2BIG);
+	if(!(buf=malloc(len)))ERET(ENOMEM);
+	for(size_t i=0;i<cnt;i++){
+		struct confd_item*it=&items[i];
+		memset(&rec,0,sizeof(rec));
+		rec.type=it->type;
+		rec.path_len=strlen(it->path);
+		if(set)switch(it->type){
+			case TYPE_STRING:
+				rec.action=CONF_SET_STRING;
+				if(it->value.string)rec.data_len=strlen(it->value.string);
+			break;
+			case TYPE_INTEGER:
+				rec.action=CONF_SET_INTEGER;
+				rec.data.integer=it->value.integer;
+			break;
+			case TYPE_BOOLEAN:
+				rec.action=CONF_SET_BOOLEAN;
+				rec.data.boolean=it->value.boolean;
+			break;
+			default:free(buf);ERET(EINVAL);
+		}else rec.action=CONF_GET_TYPE;
+		memcpy(buf+off,&rec,sizeof(rec)),off+=sizeof(rec);
+		memcpy(buf+off,it->path,rec.path_len),off+=rec.path_len;
+		if(rec.data_len>0){
+			memcpy(buf+off,it->value.string,rec.data_len);
+			off+=rec.data_len;
+		}
+	}
+	MUTEX_LOCK(lock);
+	confd_internal_init_msg(&msg,CONF_BATCH);
+	msg.code=cnt;
+	msg.data.data_len=len;
+	if(confd_internal_send(confd,&msg)<0)goto done;
+	if(confd_internal_send_data(confd,buf,len)<0)goto done;
+	free(buf);
+	buf=NULL;
+	if(confd_internal_read_msg(confd,&res)<0)goto done;
+	if(res.code!=0)EDONE(errno=res.code);
+	if((len=res.data.data_len)>CONFD_BATCH_SIZE)EDONE(errno=EBADMSG);
+	if(!(buf=malloc(len)))EDONE(errno=ENOMEM);
+	if(confd_internal_read_data(confd,buf,len)<0)goto done;
+	MUTEX_UNLOCK(lock);
+	off=0;
+	for(size_t i=0;i<cnt;i++){
+		struct confd_item*it=&items[i];
+		if(off+sizeof(rec)>len)break;
+		memcpy(&rec,buf+off,sizeof(rec));
+		off+=sizeof(rec)+rec.path_len;
+		if(off+rec.data_len>len)break;
+		p=buf+off,off+=rec.data_len;
+		if((it->code=rec.code)==0&&!set)switch((it->type=rec.type)){
+			case TYPE_STRING:
+				if(!(it->value.string=strndup(p,rec.data_len)))
+					it->code=ENOMEM;
+			break;
+			case TYPE_INTEGER:it->value.integer=rec.data.integer;break;
+			case TYPE_BOOLEAN:it->value.boolean=rec.data.boolean;break;
+			default:;
+		}
+		n++;
+	}
+	free(buf);
+	if(n!=cnt)ERET(EBADMSG);
+	return 0;
+	done:
+	if(errno==0)errno=EIO;
+	if(buf)free(buf);
+	MUTEX_UNLOCK(lock);
+	return -1;
+}
+
+int confd_get_many(struct confd_item*items,size_t cnt){
+	return confd_batch(items,cnt,false);
+}
+
+int confd_set_many(struct confd_item*items,size_t cnt){
+	return confd_batch(items,cnt,true);
+}
+
+struct confd_item*confd_get_tree(const char*path,size_t*cnt){
+	errno=0;
+	char*buf=NULL;
+	size_t len=0;
+	struct confd_item*items;
+	struct confd_msg msg,res;
+	if(!path||!cnt||confd<0)EPRET(EINVAL);
+	if(IS_LOCAL){
+		if(conf_tree_dump(path,&buf,&len,LOCAL_CRED)!=0)return NULL;
+	}else{
+		MUTEX_LOCK(lock);
+		confd_internal_init_msg(&msg,CONF_TREE);
+		strncpy(msg.path,path,sizeof(msg.path)-1);
+		if(confd_internal_send(confd,&msg)<0)goto done;
+		if(confd_internal_read_msg(confd,&res)<0)goto done;
+		if(res.code!=0)EDONE(errno=res.code);
+		if((len=res.data.data_len)>CONFD_BATCH_SIZE)EDONE(errno=EBADMSG);
+		if(!(buf=malloc(len)))EDONE(errno=ENOMEM);
+		if(confd_internal_read_data(confd,buf,len)<0)goto done;
+		MUTEX_UNLOCK(lock);
+	}
+	items=conf_tree_items(buf,len,cnt);
+	free(buf);
+	return items;
+	done:
+	if(errno==0)errno=EIO;
+	if(buf)free(buf);
+	MUTEX_UNLOCK(lock);
+	return NULL;
+}
+
+struct confd_watcher{
+	int fd;
+	pthread_t tid;
+	confd_watch_cb cb;
+	void*data;
+};
+
+int confd_watch_open(const char*prefix){
+	int fd;
+	struct confd_msg msg;
+	struct sockaddr_un n={0};
+	socklen_t len=sizeof(n);
+	if(!prefix||confd<0)ERET(EINVAL);
+	if(getpeername(confd,(struct sockaddr*)&n,&len)<0)return -1;
+	if((fd=socket(AF_UNIX,SOCK_STREAM,0))<0)return -1;
+	if(connect(fd,(struct sockaddr*)&n,len)<0)goto fail;
+	confd_internal_init_msg(&msg,CONF_WATCH);
+	strncpy(msg.path,prefix,sizeof(msg.path)-1);
+	if(confd_internal_send(fd,&msg)<0)goto fail;
+	if(confd_internal_read_msg(fd,&msg)<=0)goto fail;
+	if(msg.code!=0)EDONE(errno=msg.code);
+	return fd;
+	fail:
+	if(errno==0)errno=EIO;
+	done:
+	close(fd);
+	return -1;
+}
+
+int confd_watch_read(int fd,char*path,size_t len,enum conf_type*type,int timeout){
+	int r;
+	struct confd_msg msg;
+	struct pollfd p={.fd=fd,.events=POLLIN};
+	if(fd<0||!path||len<=0)ERET(EINVAL);
+	do{errno=0;r=poll(&p,1,timeout);}while(r<0&&errno==EINTR);
+	if(r<=0)return r;
+	if(confd_internal_read_msg(fd,&msg)<=0){
+		if(errno==0)errno=EPIPE;
+		return -1;
+	}
+	if(msg.action!=CONF_WATCH)ERET(EBADMSG);
+	strncpy(path,msg.path,len-1);
+	path[len-1]=0;
+	if(type)*type=msg.data.type;
+	return 1;
+}
+
+void confd_watch_close(int fd){
+	if(fd>=0)close(fd);
+}
+
+static void*confd_watch_thread(void*d){
+	enum conf_type type;
+	char path[sizeof(((struct confd_msg*)0)->path)];
+	struct confd_watcher*w=d;
+	while(confd_watch_read(w->fd,path,sizeof(path),&type,-1)>0)
+		w->cb(path,type,w->data);
+	close(w->fd);
+	free(w);
+	return NULL;
+}
+
+int confd_watch(const char*prefix,confd_watch_cb cb,void*data){
+	int fd;
+	struct confd_watcher*w;
+	if(!cb)ERET(EINVAL);
+	if(!(w=malloc(sizeof(struct confd_watcher))))ERET(ENOMEM);
+	if((fd=confd_watch_open(prefix))<0){
+		free(w);
+		return -1;
+	}
+	w->fd=fd,w->cb=cb,w->data=data;
+	if((errno=pthread_create(&w->tid,NULL,confd_watch_thread,w))!=0){
+		close(fd);
+		free(w);
+		return -1;
+	}
+	pthread_detach(w->tid);
+	return fd;
+}
+
+void confd_unwatch(int id){
+	if(id>=0)shutdown(id,SHUT_RDWR);
+}
+
 #define _EXT_BASE(ret,func,ret_func,...) \
 ret func##_base(const char*base,const char*path __VA_ARGS__){\
 	char xpath[PATH_MAX]={0};\
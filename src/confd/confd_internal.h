@@ -17,7 +17,13 @@
 
 #define CONFD_MAGIC0 0xEF
 #define CONFD_MAGIC1 0x66
+#define CONFD_MAGIC1_V2 0x67
+#define CONFD_PROTO 2
 #define CONF_KEY_CHARS LETTER NUMBER "-_."
+#define CONF_NAME_MAX 256
+#define CONFD_BATCH_MAX 4096
+#define CONFD_BATCH_SIZE 0x100000
+#define CONFD_TIMEOUT 5000
 
 // initconfd remote action
 enum confd_action{
@@ -31,6 +37,11 @@ enum confd_action{
 	CONF_ADD_KEY      =0xAC07,
 	CONF_COUNT        =0xAC08,
 	CONF_RENAME       =0xAC09,
+	CONF_BATCH        =0xAC0A,
+	CONF_HELLO        =0xAC0B,
+	CONF_WATCH        =0xAC0C,
+	CONF_HASH         =0xAC0D,
+	CONF_TREE         =0xAC0E,
 	CONF_GET_STRING   =0xAC21,
 	CONF_GET_INTEGER  =0xAC22,
 	CONF_GET_BOOLEAN  =0xAC23,
@@ -51,27 +62,62 @@ enum confd_action{
 	CONF_GET_MODE     =0xACB6,
 };
 
-// initconfd message
+// initconfd message data
+union confd_data{
+	size_t data_len;
+	enum conf_type type;
+	int64_t integer;
+	bool boolean;
+	uid_t uid;
+	gid_t gid;
+	mode_t mode;
+};
+
+// initconfd message (legacy fixed size frame)
 struct confd_msg{
 	unsigned char magic0,magic1;
 	enum confd_action action;
 	char path[4096-(sizeof(void*)*3)];
 	uint64_t code;
+	union confd_data data;
+};
+
+// initconfd v2 message header, followed by path_len bytes path
+struct confd_msg_v2{
+	unsigned char magic0,magic1;
+	uint16_t path_len;
+	enum confd_action action;
+	uint64_t code;
+	union confd_data data;
+};
+
+// initconfd batch record, followed by path_len bytes path and data_len bytes string
+struct confd_batch_rec{
+	enum confd_action action;
+	enum conf_type type;
+	int32_t code;
+	uint32_t path_len;
+	uint32_t data_len;
 	union{
-		size_t data_len;
-		enum conf_type type;
 		int64_t integer;
 		bool boolean;
-		uid_t uid;
-		gid_t gid;
-		mode_t mode;
 	}data;
 };
 
-// config struct
+// config key children hash index (open addressing, linear probing)
+struct conf_index{
+	size_t size;
+	size_t used;
+	struct conf**slots;
+};
+
+// config struct, allocated from slabs in src/confd/slab.c
 struct conf{
-	char name[256];
+	const char*name;
+	uint32_t hash;
+	uint16_t name_len;
 	struct conf*parent;
+	struct conf*next,*prev;
 	enum conf_type type;
 	uid_t user;
 	gid_t group;
@@ -79,7 +125,10 @@ struct conf{
 	bool save;
 	bool include;
 	union{
-		list*keys;
+		struct{
+			struct conf*child,*last;
+			struct conf_index index;
+		};
 		union{
 			char*string;
 			int64_t integer;
@@ -88,6 +137,18 @@ struct conf{
 	};
 };
 
+// config store memory usage
+struct conf_mem{
+	size_t nodes;
+	size_t slabs;
+	size_t slab_bytes;
+	size_t names;
+	size_t name_bytes;
+};
+
+// iterate over children of a config key
+#define CONF_FOR_EACH(var,key) for(struct conf*var=(key)->child;var;var=var->next)
+
 struct conf_file_hand;
 typedef int(*file_process_func)(struct conf_file_hand*hand);
 typedef ssize_t(*file_io_func)(struct conf_file_hand*hand,char*buff,size_t len);
@@ -111,13 +172,33 @@ struct conf_file_hand{
 	file_io_func write;
 };
 
+// owner and mode a removed config item had
+struct conf_owner{
+	uid_t user;
+	gid_t group;
+	mode_t mode;
+};
+
+// config store change hook, type is 0 and gone is set when the item was removed
+typedef void(*conf_notify_func)(const char*path,enum conf_type type,const struct conf_owner*gone);
+
 extern bool conf_store_changed;
 
+// src/confd/store.c: called after a config item changed
+extern conf_notify_func conf_notify;
+
 extern struct conf_file_hand*conf_hands[];
 
 // src/confd/client.c: current confd fd
 extern int confd;
 
+// src/confd/client.c: confd runs as a thread of confd_local_pid
+extern bool confd_local;
+extern pid_t confd_local_pid;
+
+// src/confd/internal.c: protocol version for new messages
+extern int confd_proto;
+
 // src/confd/internal.c: check message magick
 extern bool confd_internal_check_magic(struct confd_msg*msg);
 
@@ -127,12 +208,21 @@ extern void confd_internal_init_msg(struct confd_msg*msg,enum confd_action actio
 // src/confd/internal.c: send message
 extern int confd_internal_send(int fd,struct confd_msg*msg);
 
+// src/confd/internal.c: send message without waiting, a full socket fails with EAGAIN
+extern int confd_internal_send_nowait(int fd,struct confd_msg*msg);
+
 // src/confd/internal.c: send code
 extern int confd_internal_send_code(int fd,enum confd_action action,int code);
 
 // src/confd/internal.c: read message
 extern int confd_internal_read_msg(int fd,struct confd_msg*buff);
 
+// src/confd/internal.c: read message payload
+extern int confd_internal_read_data(int fd,void*data,size_t len);
+
+// src/confd/internal.c: send message payload
+extern int confd_internal_send_data(int fd,void*data,size_t len);
+
 // src/confd/internal.c: convert action to string
 extern const char*confd_action2name(enum confd_action action);
 
@@ -142,6 +232,18 @@ extern int conf_dump_store(enum log_level level);
 // src/confd/store.c: get config store root struct
 extern struct conf*conf_get_store(void);
 
+// src/confd/store.c: lock config store for walking the tree directly
+extern void conf_store_lock(bool write);
+
+// src/confd/store.c: unlock config store
+extern void conf_store_unlock(void);
+
+// src/confd/store.c: check whether path is inside or above a watched prefix
+extern bool conf_watch_match(const char*prefix,const char*path);
+
+// src/confd/store.c: get config item struct by path, caller must hold conf_store_lock
+extern struct conf*conf_get_node(const char*path);
+
 // src/confd/store.c: convert config item type to string
 extern const char*conf_type2string(enum conf_type type);
 
@@ -154,9 +256,28 @@ extern const char*conf_get_type_string(const char*pat,uid_t u,gid_t gh);
 // src/confd/store.c: list config item keys
 extern const char**conf_ls(const char*path,uid_t u,gid_t g);
 
+// src/confd/store.c: list a copy of config item keys, names share one block at [0]
+extern char**conf_ls_dup(const char*path,uid_t u,gid_t g);
+
+// src/confd/store.c: get a copy of a string config item, NULL when missing
+extern char*conf_dup_string(const char*path,uid_t u,gid_t g);
+
+// src/confd/store.c: check a removed config item was readable, its parent must still be
+extern bool conf_removed_readable(const char*path,const struct conf_owner*gone,uid_t u,gid_t g);
+
 // src/confd/store.c: get config item keys count
 extern int conf_count(const char*path,uid_t u,gid_t g);
 
+// src/confd/store.c: hash names, types and values of a config item and all children
+extern int conf_tree_hash(const char*path,uint64_t*hash,uid_t u,gid_t g);
+
+// src/confd/store.c: get a config item and all readable children as batch records
+// paths are relative to path, parents come before their children
+extern int conf_tree_dump(const char*path,char**buf,size_t*len,uid_t u,gid_t g);
+
+// src/confd/store.c: convert batch records of conf_tree_dump to items in one block
+extern struct confd_item*conf_tree_items(const char*buf,size_t len,size_t*cnt);
+
 // src/confd/store.c: delete config item and all children
 extern int conf_del(const char*path,uid_t u,gid_t g);
 
@@ -193,6 +314,45 @@ extern int conf_set_mod(const char*path,mode_t mod,uid_t u,gid_t g);
 // src/confd/store.c: calculate conf store memory size
 extern size_t conf_calc_size(struct conf*c);
 
+// src/confd/journal.c: journal changes next to config path (NULL to stop)
+extern void conf_journal_open(const char*path);
+
+// src/confd/journal.c: is the change journal in use
+extern bool conf_journal_active(void);
+
+// src/confd/journal.c: append a changed config item to journal
+extern void conf_journal_record(const char*path,enum conf_type type);
+
+// src/confd/journal.c: load config file and replay its journal
+extern int conf_journal_load(const char*path);
+
+// src/confd/journal.c: save a full snapshot and truncate journal when it grows too large
+extern int conf_journal_compact(bool force);
+
+// src/confd/slab.c: allocate a zeroed config node
+extern struct conf*conf_node_alloc(void);
+
+// src/confd/slab.c: release a config node
+extern void conf_node_free(struct conf*c);
+
+// src/confd/slab.c: get a reference to an interned node name
+extern const char*conf_name_get(const char*name,size_t len,uint32_t hash);
+
+// src/confd/slab.c: drop a reference to an interned node name
+extern void conf_name_put(const char*name);
+
+// src/confd/slab.c: get nodes and names memory usage
+extern void conf_mem_stat(struct conf_mem*mem);
+
+// src/confd/slab.c: free slabs without nodes in use, returns bytes released
+extern size_t conf_slab_trim(void);
+
+// src/confd/store.c: add the store shrinker for memory pressure
+extern void conf_store_shrinker(void);
+
+// src/confd/bench.c: benchmark config store lookups with a synthetic store
+extern int conf_bench_lookup(size_t keys,size_t loops);
+
 // src/confd/file.c: load config file to config store
 extern int conf_load_file(fsh*parent,const char*path);
 
@@ -202,6 +362,9 @@ extern int conf_include_file(fsh*parent,const char*path);
 // src/confd/file.c: include config file to config store with depth
 extern int conf_include_file_depth(fsh*parent,const char*file,int depth);
 
+// src/confd/file.c: load a journal (conf syntax with any file name) to config store
+extern int conf_load_journal(fsh*parent,const char*file);
+
 // src/confd/file.c: save config store to config file
 extern int conf_save_file(fsh*parent,const char*path);
 
@@ -214,12 +377,15 @@ extern char**conf_get_supported_exts();
 #define VALUE_INTEGER(conf)conf->value.integer
 
 // src/confd/store.c: get or set config item value
-#define DECLARE_CONF_GET_SET(_tag,_type,_func) \
+#define DECLARE_CONF_SET(_tag,_type,_func) \
 	extern int conf_set_##_func(const char*path,_type data,uid_t u,gid_t g);\
-	extern int conf_set_##_func##_inc(const char*path,_type data,uid_t u,gid_t g,bool inc);\
+	extern int conf_set_##_func##_inc(const char*path,_type data,uid_t u,gid_t g,bool inc);
+#define DECLARE_CONF_GET_SET(_tag,_type,_func) \
+	DECLARE_CONF_SET(_tag,_type,_func)\
 	extern _type conf_get_##_func(const char*path,_type def,uid_t u,gid_t g);
 
-DECLARE_CONF_GET_SET(STRING,char*,string)
+// strings are taken over on success and read back with conf_dup_string
+DECLARE_CONF_SET(STRING,char*,string)
 DECLARE_CONF_GET_SET(INTEGER,int64_t,integer)
 DECLARE_CONF_GET_SET(BOOLEAN,bool,boolean)
 
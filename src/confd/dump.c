@@ -42,9 +42,7 @@ static int dump(enum log_level l,struct conf*key,int depth){
 	if(key->type==TYPE_KEY){
 		strlcat(buf,"(key)",cnt-1);
 		logger_print(l,TAG,buf);
-		list*p=list_first(key->keys);
-		if(p)do{dump(l,LIST_DATA(p,struct conf*),depth+1);}
-		while((p=p->next));
+		CONF_FOR_EACH(c,key)dump(l,c,depth+1);
 		free(buf);
 		return 0;
 	}
@@ -86,17 +84,41 @@ static int dump(enum log_level l,struct conf*key,int depth){
 	return 0;
 }
 
-int conf_dump_store(enum log_level level){
-	int r=0;
+// one malloc-ed node with a fixed 256 bytes name and a list cell per child
+#define LEGACY_NODE_SIZE (sizeof(struct conf)+CONF_NAME_MAX+sizeof(list)+32)
+
+static void dump_mem(enum log_level level,struct conf_mem*mem,size_t size){
 	char buf[64];
-	struct conf*c=conf_get_store();
-	logger_print(level,TAG,"dump configuration store:");
-	if(dump(level,c,0)!=0)r=-1;
-	size_t size=conf_calc_size(c);
+	size_t nodes=mem->nodes?mem->nodes:1;
+	size_t legacy=size+mem->nodes*(LEGACY_NODE_SIZE-sizeof(struct conf));
+	size+=mem->name_bytes;
 	logger_printf(
 		level,TAG,
 		"used memory size: %zu bytes (%s)",size,
 		make_readable_str_buf(buf,sizeof(buf),size,1,0)
 	);
+	logger_printf(
+		level,TAG,
+		"%zu nodes in %zu slabs (%zu bytes reserved), %zu interned names (%zu bytes)",
+		mem->nodes,mem->slabs,mem->slab_bytes,mem->names,mem->name_bytes
+	);
+	logger_printf(
+		level,TAG,
+		"%zu bytes per node (%zu bytes per node with legacy layout)",
+		size/nodes,legacy/nodes
+	);
+}
+
+int conf_dump_store(enum log_level level){
+	int r=0;
+	struct conf_mem mem;
+	struct conf*c=conf_get_store();
+	logger_print(level,TAG,"dump configuration store:");
+	conf_store_lock(false);
+	if(dump(level,c,0)!=0)r=-1;
+	size_t size=conf_calc_size(c)-sizeof(struct conf);
+	conf_mem_stat(&mem);
+	conf_store_unlock();
+	dump_mem(level,&mem,size);
 	return r;
 }
@@ -15,8 +15,10 @@
 extern struct conf_file_hand conf_hand_conf;
 extern struct conf_file_hand conf_hand_json;
 extern struct conf_file_hand conf_hand_xml;
+extern struct conf_file_hand conf_hand_bin;
 struct conf_file_hand*conf_hands[]={
 	&conf_hand_conf,
+	&conf_hand_bin,
 	#ifdef ENABLE_JSONC
 	&conf_hand_json,
 	#endif
@@ -120,13 +122,11 @@ static ssize_t conf_write(struct conf_file_hand*hand,char*buff,size_t len){
 	return len;
 }
 
-static int _conf_load_file(fsh*parent,const char*file,bool inc,int depth){
+static int conf_load_hand(struct conf_file_hand*hand,fsh*parent,const char*file,bool inc,int depth){
 	int r=0;
 	static char xpath[PATH_MAX];
 	if(depth>=8)ERET(ELOOP);
-	if(!file)ERET(EINVAL);
-	struct conf_file_hand*hand=find_hand_by_file(file);
-	if(!hand)ERET(EINVAL);
+	if(!file||!hand)ERET(EINVAL);
 	if(!hand->load)ERET(ENOSYS);
 	if(!hand->initialized){
 		MUTEX_INIT(hand->lock);
@@ -156,6 +156,13 @@ static int _conf_load_file(fsh*parent,const char*file,bool inc,int depth){
 	return r;
 }
 
+static int _conf_load_file(fsh*parent,const char*file,bool inc,int depth){
+	if(!file)ERET(EINVAL);
+	struct conf_file_hand*hand=find_hand_by_file(file);
+	if(!hand)ERET(EINVAL);
+	return conf_load_hand(hand,parent,file,inc,depth);
+}
+
 char**conf_get_supported_exts(){
 	char**exts=NULL;
 	size_t cnt=0,size;
@@ -183,6 +190,10 @@ int conf_include_file_depth(fsh*parent,const char*file,int depth){
 	return _conf_load_file(parent,file,true,depth);
 }
 
+int conf_load_journal(fsh*parent,const char*file){
+	return conf_load_hand(&conf_hand_conf,parent,file,false,0);
+}
+
 int conf_save_file(fsh*parent,const char*file){
 	int r=0;
 	static char xpath[PATH_MAX];
@@ -203,7 +214,9 @@ int conf_save_file(fsh*parent,const char*file){
 	hand->path=xpath;
 	r=do_save(hand);
 	if(r==0){
+		conf_store_lock(false);
 		r=hand->save(hand);
+		conf_store_unlock();
 		do_close(hand,true);
 		if(r==0)errno=0;
 	}else{
@@ -218,3 +231,9 @@ int conf_save_file(fsh*parent,const char*file){
 	MUTEX_UNLOCK(hand->lock);
 	return r;
 }
+
+int conf_convert_file(const char*from,const char*to){
+	if(!from||!to)ERET(EINVAL);
+	if(conf_load_file(NULL,from)!=0)return -1;
+	return conf_save_file(NULL,to);
+}
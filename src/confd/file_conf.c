@@ -41,9 +41,7 @@ static int print_conf(struct conf_file_hand*hand,struct conf*key,const char*name
 		else snprintf(path,PATH_MAX-1,"%s.%s",name,key->name);
 	}
 	if(key->type==TYPE_KEY){
-		list*p=list_first(key->keys);
-		if(!p)return 0;
-		do{print_conf(hand,LIST_DATA(p,struct conf*),path);}while((p=p->next));
+		CONF_FOR_EACH(c,key)print_conf(hand,c,path);
 	}else if(key->include)return 0;
 	else switch(key->type){
 		case TYPE_STRING:
@@ -93,11 +91,9 @@ static int conf_save(struct conf_file_hand*hand){
 
 static void line_set_string(struct conf_file_hand*hand,char*key,char*value,size_t len){
 	value[len-1]=0,value++;
-	char*old=conf_get_string(key,NULL,0,0);
 	char*val=str_unescape(value);
 	if(!val)return;
-	if(old)free(old);
-	conf_set_string_inc(key,val,0,0,hand->include);
+	if(conf_set_string_inc(key,val,0,0,hand->include)!=0)free(val);
 }
 
 static void conf_parse_line(struct conf_file_hand*hand,int*err,const char*name,size_t n,char*data){
@@ -9,26 +9,70 @@
 #include<stdbool.h>
 #include<string.h>
 #include<errno.h>
+#include<poll.h>
+#include<sys/socket.h>
 #include"system.h"
 #include"defines.h"
 #include"confd_internal.h"
 
+int confd_proto=1;
+
 bool confd_internal_check_magic(struct confd_msg*msg){
-	return msg&&msg->magic0==CONFD_MAGIC0&&msg->magic1==CONFD_MAGIC1;
+	return msg&&msg->magic0==CONFD_MAGIC0&&(
+		msg->magic1==CONFD_MAGIC1||
+		msg->magic1==CONFD_MAGIC1_V2
+	);
 }
 
 void confd_internal_init_msg(struct confd_msg*msg,enum confd_action action){
 	if(!msg)return;
 	memset(msg,0,sizeof(struct confd_msg));
 	msg->magic0=CONFD_MAGIC0;
-	msg->magic1=CONFD_MAGIC1;
+	msg->magic1=confd_proto>=2?CONFD_MAGIC1_V2:CONFD_MAGIC1;
 	msg->action=action;
 }
 
+#define FRAME_SIZE (sizeof(struct confd_msg_v2)+sizeof(((struct confd_msg*)0)->path))
+
+// legacy frames are the message itself, v2 ones are built in buf
+static void*msg_frame(struct confd_msg*msg,char buf[FRAME_SIZE],size_t*len){
+	struct confd_msg_v2 hdr;
+	if(msg->magic1!=CONFD_MAGIC1_V2){
+		*len=sizeof(struct confd_msg);
+		return msg;
+	}
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic0=msg->magic0,hdr.magic1=msg->magic1;
+	hdr.path_len=strnlen(msg->path,sizeof(msg->path)-1);
+	hdr.action=msg->action,hdr.code=msg->code,hdr.data=msg->data;
+	memcpy(buf,&hdr,sizeof(hdr));
+	memcpy(buf+sizeof(hdr),msg->path,hdr.path_len);
+	*len=sizeof(hdr)+hdr.path_len;
+	return buf;
+}
+
 int confd_internal_send(int fd,struct confd_msg*msg){
-	if(fd<0)ERET(EINVAL);
-	static size_t xs=sizeof(struct confd_msg);
-	return (int)full_write(fd,msg,xs);
+	size_t len;
+	void*data;
+	char buf[FRAME_SIZE];
+	if(fd<0||!msg)ERET(EINVAL);
+	data=msg_frame(msg,buf,&len);
+	return confd_internal_send_data(fd,data,len)==0?(int)len:-1;
+}
+
+int confd_internal_send_nowait(int fd,struct confd_msg*msg){
+	ssize_t s;
+	size_t len;
+	void*data;
+	char buf[FRAME_SIZE];
+	if(fd<0||!msg)ERET(EINVAL);
+	data=msg_frame(msg,buf,&len);
+	do{s=send(fd,data,len,MSG_DONTWAIT|MSG_NOSIGNAL);}while(s<0&&errno==EINTR);
+	if(s<0)return -errno;
+
+	// the rest of a cut frame could only go out blocking
+	if((size_t)s!=len)ERET(EAGAIN);
+	return (int)s;
 }
 
 int confd_internal_send_code(int fd,enum confd_action action,int code){
@@ -40,23 +84,71 @@ int confd_internal_send_code(int fd,enum confd_action action,int code){
 }
 
 int confd_internal_read_msg(int fd,struct confd_msg*buff){
+	ssize_t s;
+	struct confd_msg_v2 hdr;
+	size_t hs=sizeof(hdr);
 	if(!buff||fd<0)ERET(EINVAL);
-	size_t size=sizeof(struct confd_msg),s,len=0;
-	memset(buff,0,size);
-	errno=0;
-	do{
+	memset(buff,0,sizeof(struct confd_msg));
+	do{errno=0;s=read(fd,buff,hs);}while(s<0&&errno==EINTR);
+	if(s==0)return EOF;
+	if(s<0)return errno==EAGAIN?0:-2;
+	if((size_t)s<hs&&confd_internal_read_data(fd,(char*)buff+s,hs-s)<0)return -2;
+	if(!confd_internal_check_magic(buff))return -2;
+
+	// legacy fixed size frame
+	if(buff->magic1==CONFD_MAGIC1)return confd_internal_read_data(
+		fd,(char*)buff+hs,sizeof(struct confd_msg)-hs
+	)<0?-2:1;
+
+	// v2 frame, only the used part of path is sent
+	memcpy(&hdr,buff,hs);
+	if(hdr.path_len>=sizeof(buff->path))return -2;
+	memset(buff,0,hs);
+	buff->magic0=hdr.magic0,buff->magic1=hdr.magic1;
+	buff->action=hdr.action,buff->code=hdr.code,buff->data=hdr.data;
+	return confd_internal_read_data(fd,buff->path,hdr.path_len)<0?-2:1;
+}
+
+int confd_internal_read_data(int fd,void*data,size_t len){
+	ssize_t s;
+	size_t off=0;
+	struct pollfd p={.fd=fd,.events=POLLIN};
+	if(fd<0||(!data&&len>0))ERET(EINVAL);
+	while(off<len){
 		errno=0;
-		s=read(fd,buff+len,size-len);
-		if(s==0)break;
-		else if(s>0)len+=s;
+		s=read(fd,(char*)data+off,len-off);
+		if(s>0)off+=s;
+		else if(s==0)ERET(EPIPE);
 		else switch(errno){
 			case EINTR:continue;
-			case EAGAIN:return 0;
-			default:return -2;
+			case EAGAIN:
+				if(poll(&p,1,CONFD_TIMEOUT)<=0)ERET(ETIMEDOUT);
+			continue;
+			default:return -errno;
 		}
-	}while(len<size);
-	if(s==0)return EOF;
-	return (s!=size||!(confd_internal_check_magic(buff)))?-2:1;
+	}
+	return 0;
+}
+
+int confd_internal_send_data(int fd,void*data,size_t len){
+	ssize_t s;
+	size_t off=0;
+	struct pollfd p={.fd=fd,.events=POLLOUT};
+	if(fd<0||(!data&&len>0))ERET(EINVAL);
+	while(off<len){
+		errno=0;
+		s=write(fd,(char*)data+off,len-off);
+		if(s>0)off+=s;
+		else if(s==0)ERET(EPIPE);
+		else switch(errno){
+			case EINTR:continue;
+			case EAGAIN:
+				if(poll(&p,1,CONFD_TIMEOUT)<=0)ERET(ETIMEDOUT);
+			continue;
+			default:return -errno;
+		}
+	}
+	return 0;
 }
 
 const char*confd_action2name(enum confd_action action){
@@ -88,6 +180,11 @@ const char*confd_action2name(enum confd_action action){
 		case CONF_LOAD:        return "Load Config";
 		case CONF_SAVE:        return "Save Config";
 		case CONF_COUNT:       return "Count Values";
+		case CONF_BATCH:       return "Batch";
+		case CONF_HELLO:       return "Hello";
+		case CONF_WATCH:       return "Watch";
+		case CONF_HASH:        return "Tree Hash";
+		case CONF_TREE:        return "Get Tree";
 		default:               return "Unknown";
 	}
 }
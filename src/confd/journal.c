@@ -0,0 +1,146 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<sys/stat.h>
+#include"str.h"
+#include"logger.h"
+#include"confd_internal.h"
+#define TAG "journal"
+#define JOURNAL_EXT ".journal"
+#define JOURNAL_SIZE 0x10000
+
+// journal is a conf syntax file, "key = value" sets and bare "key" deletes
+static int jfd=-1;
+static char*base=NULL;
+static char jpath[PATH_MAX];
+static pthread_mutex_t jlock=PTHREAD_MUTEX_INITIALIZER;
+
+// changes made while loading come from the files themselves
+static pthread_t loader;
+static bool loading=false;
+
+static void journal_close(){
+	if(jfd>=0)close(jfd);
+	jfd=-1;
+}
+
+void conf_journal_open(const char*path){
+	MUTEX_LOCK(jlock);
+	journal_close();
+	if(base)free(base);
+	base=NULL,jpath[0]=0;
+	if(path&&path[0]&&(size_t)snprintf(
+		jpath,sizeof(jpath),"%s"JOURNAL_EXT,path
+	)<sizeof(jpath))base=strdup(path);
+	if(!base)jpath[0]=0;
+	MUTEX_UNLOCK(jlock);
+}
+
+bool conf_journal_active(){
+	return base&&conf_get_boolean("confd.journal",true,0,0);
+}
+
+static void journal_node(struct conf*c,const char*path){
+	char*str,sub[PATH_MAX];
+	if(!c->save)return;
+	switch(c->type){
+		case TYPE_KEY:
+			CONF_FOR_EACH(d,c){
+				snprintf(sub,sizeof(sub),"%s.%s",path,d->name);
+				journal_node(d,sub);
+			}
+		break;
+		case TYPE_STRING:
+			if(c->include||!VALUE_STRING(c))break;
+			if(!(str=str_escape(VALUE_STRING(c))))break;
+			dprintf(jfd,"%s = \"%s\"\n",path,str);
+			free(str);
+		break;
+		case TYPE_INTEGER:
+			if(c->include)break;
+			dprintf(jfd,"%s = %lld\n",path,(long long int)VALUE_INTEGER(c));
+		break;
+		case TYPE_BOOLEAN:
+			if(c->include)break;
+			dprintf(jfd,"%s = %s\n",path,BOOL2STR(VALUE_BOOLEAN(c)));
+		break;
+		default:;
+	}
+}
+
+void conf_journal_record(const char*path,enum conf_type type __attribute__((unused))){
+	struct conf*c;
+	if(!path||!path[0]||!base)return;
+	if(loading&&pthread_equal(loader,pthread_self()))return;
+	if(strncmp(path,"runtime.",8)==0||strcmp(path,"runtime")==0)return;
+	if(!conf_journal_active())return;
+	MUTEX_LOCK(jlock);
+	if(jfd<0&&jpath[0]){
+		jfd=open(jpath,O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC,0644);
+		if(jfd<0)telog_warn("open journal %s failed",jpath);
+	}
+	// always write the current state, another change may have raced this one
+	if(jfd>=0){
+		conf_store_lock(false);
+		if((c=conf_get_node(path)))journal_node(c,path);
+		else dprintf(jfd,"%s\n",path);
+		conf_store_unlock();
+	}
+	MUTEX_UNLOCK(jlock);
+}
+
+int conf_journal_load(const char*path){
+	int r;
+	struct stat st;
+	char xpath[PATH_MAX];
+	if(!path)ERET(EINVAL);
+	loader=pthread_self(),loading=true;
+	r=conf_load_file(NULL,path);
+	if(
+		r==0&&
+		(size_t)snprintf(xpath,sizeof(xpath),"%s"JOURNAL_EXT,path)<sizeof(xpath)&&
+		stat(xpath,&st)==0&&st.st_size>0
+	){
+		tlog_debug("replay journal %s",xpath);
+		if(conf_load_journal(NULL,xpath)!=0)
+			tlog_warn("replay journal %s failed",xpath);
+	}
+	if(r==0)errno=0;
+	loading=false;
+	return r;
+}
+
+int conf_journal_compact(bool force){
+	int r=0;
+	struct stat st;
+	MUTEX_LOCK(jlock);
+	if(!base)EDONE(r=ENUM(EINVAL));
+	if(!force){
+		if(stat(jpath,&st)!=0||st.st_size<=0)goto done;
+		if(st.st_size<conf_get_integer("confd.journal_size",JOURNAL_SIZE,0,0)){
+			if(jfd>=0)fdatasync(jfd);
+			goto done;
+		}
+	}
+	tlog_debug("compact journal into %s",base);
+	if((r=conf_save_file(NULL,base))!=0||errno!=0)goto done;
+	conf_store_changed=false;
+	journal_close();
+	if(truncate(jpath,0)!=0&&errno!=ENOENT)telog_warn("truncate journal %s failed",jpath);
+	errno=0;
+	done:
+	MUTEX_UNLOCK(jlock);
+	return r;
+}
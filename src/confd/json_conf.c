@@ -90,7 +90,6 @@ static int conf_load(struct conf_file_hand*hand){
 }
 
 static int save_json_object(struct conf_file_hand*hand,struct json_object*obj,struct conf*c){
-	list*p;
 	struct json_object*val;
 	if(!hand||!obj||!c)return -1;
 	if(c->include||!c->save)return 0;
@@ -98,10 +97,7 @@ static int save_json_object(struct conf_file_hand*hand,struct json_object*obj,st
 		case TYPE_KEY:
 			if(!c->name[0])val=obj;
 			else if(!(val=json_object_new_object()))break;
-			if((p=list_first(c->keys)))do{
-				LIST_DATA_DECLARE(l,p,struct conf*);
-				save_json_object(hand,val,l);
-			}while((p=p->next));
+			CONF_FOR_EACH(l,c)save_json_object(hand,val,l);
 		break;
 		case TYPE_STRING:val=VALUE_STRING(c)?
 			json_object_new_string(VALUE_STRING(c)):
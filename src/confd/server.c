@@ -25,6 +25,8 @@
 #include"output.h"
 #include"confd_internal.h"
 #include"proctitle.h"
+#include"metrics.h"
+#include"mempressure.h"
 #define TAG "confd"
 
 static pthread_t save_thread;
@@ -32,12 +34,114 @@ static char*def_path=NULL;
 static char*sock=DEFAULT_CONFD;
 static bool clean=false,protect=false;
 static int efd=-1;
+static list*watchers=NULL;
+static mutex_t watch_lock;
+
+struct confd_watcher{
+	int fd;
+	bool dead;
+	unsigned char magic;
+	uid_t uid;
+	gid_t gid;
+	char prefix[PATH_MAX];
+};
+
+static void watch_remove(int fd){
+	list*p,*n;
+	MUTEX_LOCK(watch_lock);
+	if((p=list_first(watchers)))do{
+		n=p->next;
+		LIST_DATA_DECLARE(w,p,struct confd_watcher*);
+		if(w->fd==fd)list_obj_del(&watchers,p,list_default_free);
+	}while((p=n));
+	MUTEX_UNLOCK(watch_lock);
+}
+
+// peer credentials by client fd, read once when the client connects
+static struct ucred*peers=NULL;
+static size_t peers_cnt=0;
+
+static int peer_add(int fd){
+	size_t n;
+	struct ucred*p;
+	socklen_t len=sizeof(struct ucred);
+	if(fd<0)ERET(EINVAL);
+	if((size_t)fd>=peers_cnt){
+		n=MAX((size_t)fd+1,MAX(peers_cnt*2,16));
+		if(!(p=realloc(peers,sizeof(struct ucred)*n)))ERET(ENOMEM);
+		memset(p+peers_cnt,0,sizeof(struct ucred)*(n-peers_cnt));
+		peers=p,peers_cnt=n;
+	}
+	p=&peers[fd];
+	if(getsockopt(fd,SOL_SOCKET,SO_PEERCRED,p,&len)<0)return -errno;
+	if(len!=sizeof(struct ucred)||p->pid<=0){
+		memset(p,0,sizeof(struct ucred));
+		ERET(EIO);
+	}
+	return 0;
+}
 
 static void ctl_fd(int op,int fd){
 	static struct epoll_event ev;
 	ev.events=EPOLLIN,ev.data.fd=fd;
 	epoll_ctl(efd,op,fd,&ev);
-	if(op==EPOLL_CTL_DEL)close(fd);
+	if(op==EPOLL_CTL_DEL){
+		if(fd>=0&&(size_t)fd<peers_cnt)
+			memset(&peers[fd],0,sizeof(struct ucred));
+		watch_remove(fd);
+		close(fd);
+	}
+}
+
+static void watch_notify(const char*path,enum conf_type type,const struct conf_owner*gone){
+	list*p;
+	struct confd_msg msg;
+	MUTEX_LOCK(watch_lock);
+	if((p=list_first(watchers)))do{
+		LIST_DATA_DECLARE(w,p,struct confd_watcher*);
+		if(w->dead||!conf_watch_match(w->prefix,path))continue;
+		if(type!=0&&(int)conf_get_type(path,w->uid,w->gid)<0)continue;
+
+		// the item is gone, only tell watchers that could read it
+		if(type==0&&!conf_removed_readable(path,gone,w->uid,w->gid))continue;
+		confd_internal_init_msg(&msg,CONF_WATCH);
+		msg.magic1=w->magic;
+		msg.data.type=type;
+		strncpy(msg.path,path,sizeof(msg.path)-1);
+		if(confd_internal_send_nowait(w->fd,&msg)>=0)continue;
+
+		// never wait for a watcher here, one that does not read its
+		// events is dropped and epoll cleans it up
+		if(errno==EAGAIN)tlog_warn("drop stalled watcher %d",w->fd);
+		else telog_warn("drop watcher %d",w->fd);
+		w->dead=true;
+		shutdown(w->fd,SHUT_RDWR);
+	}while((p=p->next));
+	MUTEX_UNLOCK(watch_lock);
+}
+
+static void confd_notify(const char*path,enum conf_type type,const struct conf_owner*gone){
+	conf_journal_record(path,type);
+	watch_notify(path,type,gone);
+}
+
+static int do_watch(int fd,struct confd_msg*msg,struct confd_msg*ret,struct ucred*cred){
+	struct confd_watcher*w=malloc(sizeof(struct confd_watcher));
+	if(!w)ERET(ENOMEM);
+	memset(w,0,sizeof(struct confd_watcher));
+	w->fd=fd,w->magic=msg->magic1;
+	w->uid=cred->uid,w->gid=cred->gid;
+	strncpy(w->prefix,msg->path,sizeof(w->prefix)-1);
+	MUTEX_LOCK(watch_lock);
+	if(list_obj_add_new(&watchers,w)!=0){
+		MUTEX_UNLOCK(watch_lock);
+		free(w);
+		ERET(ENOMEM);
+	}
+	// reply under watch_lock so no event can go out before it
+	confd_internal_send(fd,ret);
+	MUTEX_UNLOCK(watch_lock);
+	return 0;
 }
 
 static void confd_cleanup(int s __attribute__((unused))){
@@ -79,10 +183,12 @@ static void do_ls(int fd,struct confd_msg*msg,struct confd_msg*ret,struct ucred*
 }
 
 static void do_get_string(int fd,struct confd_msg*msg,struct confd_msg*ret,struct ucred*cred){
-	char*re=conf_get_string(msg->path,NULL,cred->uid,cred->gid);
+	char*re=conf_dup_string(msg->path,cred->uid,cred->gid);
 	ret->data.data_len=re?strlen(re):0;
 	confd_internal_send(fd,ret);
-	if(re)full_write(fd,re,ret->data.data_len);
+	if(!re)return;
+	full_write(fd,re,ret->data.data_len);
+	free(re);
 }
 
 static int do_set_string(int fd,struct confd_msg*msg,struct ucred*cred){
@@ -98,8 +204,6 @@ static int do_set_string(int fd,struct confd_msg*msg,struct ucred*cred){
 		free(data);
 		return 0;
 	}
-	char*old=conf_get_string(msg->path,NULL,cred->uid,cred->gid);
-	if(old)free(old);
 	int retdata=-conf_set_string(msg->path,data,cred->uid,cred->gid);
 	if(retdata!=0)free(data);
 	return retdata;
@@ -113,8 +217,119 @@ static int do_rename(int fd,struct confd_msg*msg,struct ucred*cred){
 	return conf_rename(msg->path,n,cred->uid,cred->gid);
 }
 
+static int batch_append(char**buf,size_t*len,size_t*size,void*data,size_t l){
+	if(*len+l>*size){
+		size_t ns=*size;
+		char*n;
+		do{ns+=4096;}while(*len+l>ns);
+		if(!(n=realloc(*buf,ns)))ERET(ENOMEM);
+		*buf=n,*size=ns;
+	}
+	if(l>0)memcpy(*buf+*len,data,l);
+	*len+=l;
+	return 0;
+}
+
+static void batch_get(struct confd_batch_rec*rec,char*path,char**str,struct ucred*cred){
+	errno=0;
+	enum conf_type t=conf_get_type(path,cred->uid,cred->gid);
+	if((int)t<0)EDONE(rec->code=errno?errno:ENOENT);
+	if(rec->type!=0&&rec->type!=t)EDONE(rec->code=ENOENT);
+	switch((rec->type=t)){
+		case TYPE_KEY:break;
+		case TYPE_STRING:
+			*str=conf_dup_string(path,cred->uid,cred->gid);
+			if(*str)rec->data_len=strlen(*str);
+		break;
+		case TYPE_INTEGER:
+			rec->data.integer=conf_get_integer(path,0,cred->uid,cred->gid);
+		break;
+		case TYPE_BOOLEAN:
+			rec->data.boolean=conf_get_boolean(path,false,cred->uid,cred->gid);
+		break;
+		default:rec->code=EBADMSG;
+	}
+	done:return;
+}
+
+static void batch_set(struct confd_batch_rec*rec,char*path,char*data,size_t len,struct ucred*cred){
+	char*str;
+	switch(rec->action){
+		case CONF_SET_STRING:
+			if(!(str=strndup(data,len)))EDONE(rec->code=ENOMEM);
+			rec->code=-conf_set_string(path,str,cred->uid,cred->gid);
+			if(rec->code!=0)free(str);
+		break;
+		case CONF_SET_INTEGER:
+			rec->code=-conf_set_integer(path,rec->data.integer,cred->uid,cred->gid);
+		break;
+		case CONF_SET_BOOLEAN:
+			rec->code=-conf_set_boolean(path,rec->data.boolean,cred->uid,cred->gid);
+		break;
+		default:rec->code=ENOSYS;
+	}
+	done:return;
+}
+
+static int do_batch(int fd,struct confd_msg*msg,struct confd_msg*ret,struct ucred*cred){
+	struct confd_batch_rec rec;
+	char*in=NULL,*out=NULL,*str,path[PATH_MAX];
+	size_t len=msg->data.data_len,cnt=msg->code;
+	size_t off=0,olen=0,osize=0,i,dl;
+	bool fail;
+	if(len>CONFD_BATCH_SIZE||cnt<=0||cnt>CONFD_BATCH_MAX)return EOF;
+	if(!(in=malloc(len)))return EOF;
+	if(confd_internal_read_data(fd,in,len)<0){
+		free(in);
+		return EOF;
+	}
+	for(i=0;i<cnt;i++){
+		if(off+sizeof(rec)>len)break;
+		memcpy(&rec,in+off,sizeof(rec));
+		off+=sizeof(rec),dl=rec.data_len;
+		if(off+rec.path_len+dl>len)break;
+		str=NULL,rec.code=0,rec.data_len=0;
+		if(rec.path_len>=sizeof(path))rec.code=ENAMETOOLONG;
+		else{
+			memcpy(path,in+off,rec.path_len);
+			path[rec.path_len]=0;
+			if(rec.action==CONF_GET_TYPE)batch_get(&rec,path,&str,cred);
+			else batch_set(&rec,path,in+off+rec.path_len,dl,cred);
+		}
+		off+=rec.path_len+dl,rec.path_len=0;
+		fail=
+			batch_append(&out,&olen,&osize,&rec,sizeof(rec))!=0||
+			batch_append(&out,&olen,&osize,str,rec.data_len)!=0;
+		if(str)free(str);
+		if(fail)break;
+	}
+	free(in);
+	if(i!=cnt){
+		ret->code=errno==ENOMEM?ENOMEM:EBADMSG;
+		olen=0;
+	}
+	ret->data.data_len=olen;
+	confd_internal_send(fd,ret);
+	if(olen>0)confd_internal_send_data(fd,out,olen);
+	if(out)free(out);
+	return 0;
+}
+
+static int do_tree(int fd,struct confd_msg*msg,struct confd_msg*ret,struct ucred*cred){
+	char*buf=NULL;
+	size_t len=0;
+	if(conf_tree_dump(msg->path,&buf,&len,cred->uid,cred->gid)!=0)
+		ret->code=errno?errno:EIO,len=0;
+	ret->data.data_len=len;
+	confd_internal_send(fd,ret);
+	if(len>0)confd_internal_send_data(fd,buf,len);
+	if(buf)free(buf);
+	return 0;
+}
+
 struct async_load_save_data{
 	int fd;
+	unsigned char magic;
 	char path[PATH_MAX];
 	pthread_t tid;
 	bool include;
@@ -125,9 +340,10 @@ static void*_async_load_thread(void*d){
 	struct async_load_save_data*data=d;
 	struct confd_msg ret;
 	confd_internal_init_msg(&ret,CONF_OK);
+	ret.magic1=data->magic;
 	ret.code=-(data->include?
 		conf_include_file(NULL,data->path[0]?data->path:def_path):
-		conf_load_file(NULL,data->path[0]?data->path:def_path)
+		conf_journal_load(data->path[0]?data->path:def_path)
 	);
 	if(ret.code==0&&errno!=0)ret.code=errno;
 	confd_internal_send(data->fd,&ret);
@@ -140,7 +356,10 @@ static void*_async_save_thread(void*d){
 	struct async_load_save_data*data=d;
 	struct confd_msg ret;
 	confd_internal_init_msg(&ret,CONF_OK);
-	ret.code=-conf_save_file(NULL,data->path[0]?data->path:def_path);
+	ret.magic1=data->magic;
+	if(!data->path[0]||(def_path&&strcmp(data->path,def_path)==0))
+		ret.code=-conf_journal_compact(true);
+	else ret.code=-conf_save_file(NULL,data->path);
 	if(ret.code==0){
 		if(errno!=0)ret.code=errno;
 		else if(!data->path[0])conf_store_changed=false;
@@ -150,11 +369,11 @@ static void*_async_save_thread(void*d){
 	return NULL;
 }
 
-static int do_async_load(int fd,const char*path,bool inc){
+static int do_async_load(int fd,unsigned char magic,const char*path,bool inc){
 	if(!path)return -1;
 	struct async_load_save_data*d=malloc(sizeof(struct async_load_save_data));
 	if(!d)return -1;
-	d->fd=fd;
+	d->fd=fd,d->magic=magic;
 	d->include=inc;
 	strcpy(d->path,path);
 	int r=pthread_create(&d->tid,NULL,_async_load_thread,d);
@@ -162,17 +381,20 @@ static int do_async_load(int fd,const char*path,bool inc){
 	return r;
 }
 
-static int do_async_save(int fd,const char*path){
+static int do_async_save(int fd,unsigned char magic,const char*path){
 	if(!path)return -1;
 	struct async_load_save_data*d=malloc(sizeof(struct async_load_save_data));
 	if(!d)return -1;
-	d->fd=fd;
+	d->fd=fd,d->magic=magic;
 	strcpy(d->path,path);
 	int r=pthread_create(&d->tid,NULL,_async_save_thread,d);
 	if(r!=0)free(d);
 	return r;
 }
 
+METRIC_COUNTER(m_ops,"confd_requests_total","requests handled by confd");
+METRIC_HISTOGRAM(m_latency,"confd_request_seconds","time confd takes to answer a request");
+
 static int confd_read(int fd){
 	if(fd<0)ERET(EINVAL);
 	errno=0;
@@ -180,20 +402,27 @@ static int confd_read(int fd){
 	int e=confd_internal_read_msg(fd,&msg);
 	if(e<0)return e;
 	else if(e==0)return 0;
+	uint64_t start=metric_now_us();
+	metric_inc(&m_ops);
 	struct confd_msg ret;
 	confd_internal_init_msg(&ret,CONF_OK);
+	ret.magic1=msg.magic1;
 	int retdata=0;
-	socklen_t len=sizeof(struct ucred);
 	struct ucred cred;
-	if(getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&len)<0)goto fail;
-	if(len!=sizeof(struct ucred)||cred.pid<=0){
+	if((size_t)fd>=peers_cnt||peers[fd].pid<=0){
 		errno=EIO;
 		goto fail;
 	}
+	cred=peers[fd];
 	switch(msg.action){
 		// command response
 		case CONF_OK:case CONF_FAIL:break;
 
+		// protocol negotiation
+		case CONF_HELLO:
+			ret.data.integer=CONFD_PROTO;
+		break;
+
 		// terminate confd
 		case CONF_QUIT:
 			if(cred.uid!=0||cred.gid!=0)errno=EACCES;
@@ -274,6 +503,20 @@ static int confd_read(int fd){
 			ret.data.type=conf_get_type(msg.path,cred.uid,cred.gid);
 		break;
 
+		// subscribe changes under a prefix
+		case CONF_WATCH:
+			if(do_watch(fd,&msg,&ret,&cred)==0)return e;
+		break;
+
+		// batch get or set items
+		case CONF_BATCH:
+			return do_batch(fd,&msg,&ret,&cred)==0?e:EOF;
+
+		// get item and all children in one walk
+		case CONF_TREE:
+			do_tree(fd,&msg,&ret,&cred);
+		return e;
+
 		// get item as string
 		case CONF_GET_STRING:
 			do_get_string(fd,&msg,&ret,&cred);
@@ -310,6 +553,13 @@ static int confd_read(int fd){
 			if(ret.data.integer<0)retdata=-ret.data.integer,ret.data.integer=0;
 		break;
 
+		// get config item tree hash
+		case CONF_HASH:{
+			uint64_t h=0;
+			if(conf_tree_hash(msg.path,&h,cred.uid,cred.gid)!=0)retdata=errno;
+			ret.data.integer=(int64_t)h;
+		}break;
+
 		// set default config path
 		case CONF_SET_DEFAULT:
 			if(cred.uid!=0||cred.gid!=0){
@@ -323,24 +573,25 @@ static int confd_read(int fd){
 			if(def_path)free(def_path);
 			def_path=strdup(msg.path);
 			if(!def_path)errno=ENOMEM;
+			conf_journal_open(def_path);
 		break;
 
 		// load config
 		case CONF_LOAD:
 			if(cred.uid!=0||cred.gid!=0)errno=EACCES;
-			else if(do_async_load(fd,msg.path,false)==0)return e;
+			else if(do_async_load(fd,msg.magic1,msg.path,false)==0)return e;
 			break;
 
 		// load config
 		case CONF_INCLUDE:
 			if(cred.uid!=0||cred.gid!=0)errno=EACCES;
-			else if(do_async_load(fd,msg.path,true)==0)return e;
+			else if(do_async_load(fd,msg.magic1,msg.path,true)==0)return e;
 		break;
 
 		// save config
 		case CONF_SAVE:
 			if(cred.uid!=0||cred.gid!=0)errno=EACCES;
-			else if(do_async_save(fd,msg.path)==0)return e;
+			else if(do_async_save(fd,msg.magic1,msg.path)==0)return e;
 		break;
 
 		// unknown
@@ -353,6 +604,7 @@ static int confd_read(int fd){
 	if(retdata==0&&errno!=0)retdata=errno;
 	ret.code=retdata;
 	confd_internal_send(fd,&ret);
+	metric_observe(&m_latency,metric_now_us()-start);
 	return e;
 }
 
@@ -386,6 +638,10 @@ static void*confd_save_thread(void*d __attribute__((unused))){
 	for(;;){
 		sleep(conf_get_integer("confd.save_interval",10,0,0));
 		if(!def_path)continue;
+		if(conf_journal_active()){
+			conf_journal_compact(false);
+			continue;
+		}
 		if(conf_store_changed){
 			int r=confd_save_file(def_path);
 			if(r==0&&errno==0)conf_store_changed=false;
@@ -395,40 +651,31 @@ static void*confd_save_thread(void*d __attribute__((unused))){
 	return NULL;
 }
 
-int confd_thread(int cfd){
-	static size_t es=sizeof(struct epoll_event);
-	int r,e=0,fd;
-	open_socket_logfd_default();
-	tlog_info("confd start with pid %d",getpid());
-	if((fd=listen_confd_socket())<0)return -1;
-	struct epoll_event*evs;
-	setproctitle("confd");
-	prctl(PR_SET_NAME,"Config Daemon",0,0,0);
-	action_signals(
-		(int[]){SIGINT,SIGHUP,SIGQUIT,SIGTERM},
-		4,signal_handler
-	);
+static int confd_setup(int fd){
 	if((efd=epoll_create(64))<0)
 		return terlog_error(-errno,"epoll_create failed");
-	if(!(evs=malloc(es*64))){
-		telog_error("malloc failed");
-		e=-errno;
-		goto ex;
-	}
-	memset(evs,0,es*64);
+	MUTEX_INIT(watch_lock);
+	conf_notify=confd_notify;
+	conf_store_shrinker();
 	ctl_fd(EPOLL_CTL_ADD,fd);
-	if(cfd>=0){
-		confd_internal_send_code(cfd,CONF_OK,0);
-		close(cfd);
-	}
+	return 0;
+}
+
+static int confd_loop(int fd){
+	static size_t es=sizeof(struct epoll_event);
+	int r;
+	struct epoll_event*evs;
+	if(!(evs=malloc(es*64)))
+		return terlog_error(-errno,"malloc failed");
+	memset(evs,0,es*64);
 	pthread_create(&save_thread,NULL,confd_save_thread,NULL);
 	while(1){
 		r=epoll_wait(efd,evs,64,-1);
 		if(r==-1){
 			if(errno==EINTR)continue;
 			telog_error("epoll failed");
-			e=-1;
-			goto ex;
+			free(evs);
+			return -1;
 		}else if(r==0)continue;
 		else for(int i=0;i<r;i++){
 			int f=evs[i].data.fd;
@@ -439,19 +686,74 @@ int confd_thread(int cfd){
 					continue;
 				}
 				fcntl(n,F_SETFL,O_RDWR|O_NONBLOCK);
+				if(peer_add(n)!=0){
+					close(n);
+					continue;
+				}
 				ctl_fd(EPOLL_CTL_ADD,n);
 			}else{
 				int x=confd_read(f);
 				if(x==EOF)ctl_fd(EPOLL_CTL_DEL,f);
-				else if(x==-4)goto ex;
+				else if(x==-4){
+					free(evs);
+					return 0;
+				}
 			}
 		}
 	}
-	ex:
+}
+
+int confd_thread(int cfd){
+	int e=0,fd;
+	open_socket_logfd_default();
+	tlog_info("confd start with pid %d",getpid());
+	if((fd=listen_confd_socket())<0)return -1;
+	setproctitle("confd");
+	prctl(PR_SET_NAME,"Config Daemon",0,0,0);
+	action_signals(
+		(int[]){SIGINT,SIGHUP,SIGQUIT,SIGTERM},
+		4,signal_handler
+	);
+	if(confd_setup(fd)<0)return -1;
+	mem_monitor_start();
+	if(cfd>=0){
+		confd_internal_send_code(cfd,CONF_OK,0);
+		close(cfd);
+	}
+	e=confd_loop(fd);
 	confd_cleanup(0);
 	exit(e);
 }
 
+static void*confd_local_thread(void*d){
+	prctl(PR_SET_NAME,"Config Daemon",0,0,0);
+	confd_loop((int)(intptr_t)d);
+	tlog_info("confd thread exiting");
+	confd_local=false;
+	confd_cleanup(0);
+	return NULL;
+}
+
+int start_confd_thread(char*tag){
+	int fd;
+	pthread_t tid;
+	if(confd>=0||confd_local)ERET(EEXIST);
+	if((fd=listen_confd_socket())<0)return -1;
+	if(confd_setup(fd)<0){
+		close(fd);
+		confd_cleanup(0);
+		return -1;
+	}
+	if((errno=pthread_create(&tid,NULL,confd_local_thread,(void*)(intptr_t)fd))!=0){
+		confd_cleanup(0);
+		return -1;
+	}
+	pthread_detach(tid);
+	tlog_info("confd start as thread of pid %d",getpid());
+	confd_local=true,confd_local_pid=getpid();
+	return open_default_confd_socket(false,tag);
+}
+
 static int usage(int e){
 	return return_printf(
 		e,e==0?STDOUT_FILENO:STDERR_FILENO,
@@ -460,6 +762,7 @@ static int usage(int e){
 		"Options:\n"
 		"\t-s, --socket <SOCKET>  Listen custom control socket (default is %s)\n"
 		"\t-d, --daemon           Run in daemon\n"
+		"\t-b, --benchmark <KEYS> Benchmark store lookups with KEYS synthetic keys\n"
 		"\t-h, --help             Display this help and exit\n",
 		DEFAULT_CONFD
 	);
@@ -470,14 +773,16 @@ int initconfd_main(int argc __attribute__((unused)),char**argv __attribute__((un
 		{"help",    no_argument,       NULL,'h'},
 		{"daemon",  no_argument,       NULL,'d'},
 		{"socket",  required_argument, NULL,'s'},
+		{"benchmark",required_argument, NULL,'b'},
 		{NULL,0,NULL,0}
 	};
 	int o;
 	bool daemon=false;
-	while((o=b_getlopt(argc,argv,"hqdD:s:",lo,NULL))>0)switch(o){
+	while((o=b_getlopt(argc,argv,"hqdD:s:b:",lo,NULL))>0)switch(o){
 		case 'h':return usage(0);
 		case 'd':daemon=true;break;
 		case 's':sock=b_optarg;break;
+		case 'b':return conf_bench_lookup(parse_long(b_optarg,10000),100)==0?0:1;
 		default:return 1;
 	}
 	if(daemon){
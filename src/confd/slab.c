@@ -0,0 +1,171 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stddef.h>
+#include<stdlib.h>
+#include<string.h>
+#include"confd_internal.h"
+#define SLAB_NODES 128
+#define NAMES_MIN 64
+
+// all functions here are protected by the config store write lock
+
+// a slab of config nodes, never returned to the heap
+struct conf_slab{
+	struct conf_slab*next;
+	struct conf nodes[SLAB_NODES];
+};
+
+// interned node name, shared by all nodes with the same name
+struct conf_name{
+	struct conf_name*next;
+	uint32_t ref;
+	uint32_t hash;
+	uint16_t len;
+	char str[];
+};
+
+static struct conf_slab*slabs=NULL;
+static struct conf*free_nodes=NULL;
+static size_t slab_cnt=0,node_cnt=0;
+
+static struct conf_name**names=NULL;
+static size_t names_size=0,names_used=0,names_bytes=0;
+
+#define NAME_OF(s) ((struct conf_name*)((char*)(s)-offsetof(struct conf_name,str)))
+
+struct conf*conf_node_alloc(){
+	struct conf*n;
+	struct conf_slab*s;
+	if(!free_nodes){
+		if(!(s=malloc(sizeof(struct conf_slab))))EPRET(ENOMEM);
+		s->next=slabs,slabs=s,slab_cnt++;
+		for(size_t i=0;i<SLAB_NODES;i++){
+			s->nodes[i].next=free_nodes;
+			free_nodes=&s->nodes[i];
+		}
+	}
+	n=free_nodes,free_nodes=n->next;
+	memset(n,0,sizeof(struct conf));
+	node_cnt++;
+	return n;
+}
+
+void conf_node_free(struct conf*c){
+	if(!c)return;
+	memset(c,0,sizeof(struct conf));
+	c->next=free_nodes,free_nodes=c;
+	node_cnt--;
+}
+
+static int names_grow(){
+	size_t size=names_size?names_size*2:NAMES_MIN;
+	struct conf_name**n,*x,*next;
+	if(!(n=malloc(sizeof(struct conf_name*)*size)))ERET(ENOMEM);
+	memset(n,0,sizeof(struct conf_name*)*size);
+	for(size_t i=0;i<names_size;i++)for(x=names[i];x;x=next){
+		next=x->next;
+		x->next=n[x->hash&(size-1)];
+		n[x->hash&(size-1)]=x;
+	}
+	if(names)free(names);
+	names=n,names_size=size;
+	return 0;
+}
+
+const char*conf_name_get(const char*name,size_t len,uint32_t hash){
+	struct conf_name*n,**b;
+	if(len>=CONF_NAME_MAX)EPRET(ENAMETOOLONG);
+	if(names)for(n=names[hash&(names_size-1)];n;n=n->next)
+		if(n->hash==hash&&n->len==len&&memcmp(n->str,name,len)==0){
+			n->ref++;
+			return n->str;
+		}
+	if(names_used>=names_size&&names_grow()!=0)return NULL;
+	if(!(n=malloc(sizeof(struct conf_name)+len+1)))EPRET(ENOMEM);
+	n->ref=1,n->hash=hash,n->len=len;
+	memcpy(n->str,name,len);
+	n->str[len]=0;
+	b=&names[hash&(names_size-1)];
+	n->next=*b,*b=n;
+	names_used++,names_bytes+=sizeof(struct conf_name)+len+1;
+	return n->str;
+}
+
+void conf_name_put(const char*name){
+	struct conf_name*n,**b;
+	if(!name||!name[0])return;
+	n=NAME_OF(name);
+	if(--n->ref>0)return;
+	for(b=&names[n->hash&(names_size-1)];*b;b=&(*b)->next){
+		if(*b!=n)continue;
+		*b=n->next;
+		break;
+	}
+	names_used--,names_bytes-=sizeof(struct conf_name)+n->len+1;
+	free(n);
+}
+
+void conf_mem_stat(struct conf_mem*mem){
+	if(!mem)return;
+	memset(mem,0,sizeof(struct conf_mem));
+	mem->nodes=node_cnt;
+	mem->slabs=slab_cnt;
+	mem->slab_bytes=slab_cnt*sizeof(struct conf_slab);
+	mem->names=names_used;
+	mem->name_bytes=names_bytes+names_size*sizeof(struct conf_name*);
+}
+
+static int slab_cmp(const void*a,const void*b){
+	uintptr_t x=(uintptr_t)*(struct conf_slab*const*)a;
+	uintptr_t y=(uintptr_t)*(struct conf_slab*const*)b;
+	return x<y?-1:x>y;
+}
+
+// index of the slab holding a node in the address sorted array
+static size_t slab_find(struct conf_slab**arr,size_t cnt,struct conf*c){
+	size_t lo=0,hi=cnt;
+	while(hi-lo>1){
+		size_t mid=(lo+hi)/2;
+		if((uintptr_t)arr[mid]<=(uintptr_t)c)lo=mid;
+		else hi=mid;
+	}
+	return lo;
+}
+
+// return slabs with no node in use, callers hold the store write lock
+size_t conf_slab_trim(){
+	size_t i,cnt=slab_cnt,released=0,*frees;
+	struct conf*c,**pc;
+	struct conf_slab*s,**ps,**arr;
+	if(cnt==0||!free_nodes)return 0;
+	if(!(arr=malloc(cnt*(sizeof(struct conf_slab*)+sizeof(size_t)))))return 0;
+	frees=(size_t*)(arr+cnt);
+	memset(frees,0,cnt*sizeof(size_t));
+	for(s=slabs,i=0;s;s=s->next,i++)arr[i]=s;
+	qsort(arr,cnt,sizeof(struct conf_slab*),slab_cmp);
+
+	// a slab with all of its nodes on the free list can go
+	for(c=free_nodes;c;c=c->next)frees[slab_find(arr,cnt,c)]++;
+	for(pc=&free_nodes;(c=*pc);){
+		if(frees[slab_find(arr,cnt,c)]==SLAB_NODES)*pc=c->next;
+		else pc=&c->next;
+	}
+	for(ps=&slabs;(s=*ps);){
+		if(frees[slab_find(arr,cnt,(struct conf*)s)]!=SLAB_NODES){
+			ps=&s->next;
+			continue;
+		}
+		*ps=s->next,slab_cnt--;
+		released+=sizeof(struct conf_slab);
+		free(s);
+	}
+	free(arr);
+	return released;
+}
@@ -8,19 +8,24 @@
 
 #define _GNU_SOURCE
 #include<fcntl.h>
+#include<stdio.h>
 #include<unistd.h>
 #include<string.h>
 #include<stdlib.h>
 #include<sys/stat.h>
 #include"confd_internal.h"
+#include"mempressure.h"
 #include"logger.h"
 #include"lock.h"
 #define KEY_MODE 0755
 #define VAL_MODE 0644
-static mutex_t store_lock;
+#define INDEX_MIN 8
+static rwlock_t store_lock=RWLOCK_INITIALIZER;
 
 bool conf_store_changed=false;
+conf_notify_func conf_notify=NULL;
 static struct conf conf_store={
+	.name="",
 	.type=TYPE_KEY,
 	.save=true,
 	.user=0,
@@ -30,18 +35,113 @@ static struct conf conf_store={
 
 struct conf*conf_get_store(){return &conf_store;}
 
-static bool conf_cmp(list*l,void*d){
-	LIST_DATA_DECLARE(x,l,struct conf*);
-	return x&&d&&strcmp(x->name,(char*)d)==0;
+bool conf_watch_match(const char*prefix,const char*path){
+	size_t pl,l;
+	if(!prefix||!path)return false;
+	if(!prefix[0])return true;
+	pl=strlen(prefix),l=strlen(path);
+	if(l>=pl)return strncmp(path,prefix,pl)==0&&(!path[pl]||path[pl]=='.');
+	return strncmp(prefix,path,l)==0&&prefix[l]=='.';
 }
 
-static struct conf*conf_get(struct conf*conf,const char*name){
+// called without store_lock held, hook may access the store
+static void conf_notify_change(const char*path,enum conf_type type){
+	int e=errno;
+	if(!conf_notify||!path)return;
+	conf_notify(path,type,NULL);
+	errno=e;
+}
+
+static void conf_notify_remove(const char*path,const struct conf_owner*gone){
+	int e=errno;
+	if(!conf_notify||!path)return;
+	conf_notify(path,0,gone);
+	errno=e;
+}
+
+static void conf_notify_rename(const char*path,const char*name,enum conf_type type,const struct conf_owner*gone){
+	char np[PATH_MAX];
+	const char*p;
+	int e=errno;
+	if(!conf_notify)return;
+	if((p=strrchr(path,'.')))snprintf(np,sizeof(np),"%.*s.%s",(int)(p-path),path,name);
+	else snprintf(np,sizeof(np),"%s",name);
+	conf_notify(path,0,gone);
+	conf_notify(np,type,NULL);
+	errno=e;
+}
+
+static uint32_t conf_hash(const char*name,size_t len){
+	uint32_t h=0x811C9DC5;
+	for(size_t i=0;i<len;i++)h=(h^(uint8_t)name[i])*0x01000193;
+	return h;
+}
+
+static struct conf**conf_index_slot(struct conf_index*idx,const char*name,size_t len,uint32_t hash){
+	size_t mask=idx->size-1,i=hash&mask;
+	struct conf*c;
+	for(;;i=(i+1)&mask){
+		c=idx->slots[i];
+		if(!c)break;
+		if(c->hash!=hash||c->name_len!=len)continue;
+		if(memcmp(c->name,name,len)==0)break;
+	}
+	return &idx->slots[i];
+}
+
+static int conf_index_grow(struct conf_index*idx){
+	size_t size=idx->size?idx->size*2:INDEX_MIN,old=idx->size;
+	struct conf**slots=idx->slots,**n,*c;
+	if(!(n=malloc(sizeof(struct conf*)*size)))ERET(ENOMEM);
+	memset(n,0,sizeof(struct conf*)*size);
+	idx->slots=n,idx->size=size;
+	for(size_t i=0;i<old;i++)if((c=slots[i]))
+		*conf_index_slot(idx,c->name,c->name_len,c->hash)=c;
+	if(slots)free(slots);
+	return 0;
+}
+
+static int conf_index_add(struct conf*conf,struct conf*n){
+	struct conf_index*idx=&conf->index;
+	if((idx->used+1)*4>idx->size*3&&conf_index_grow(idx)!=0)return -1;
+	*conf_index_slot(idx,n->name,n->name_len,n->hash)=n;
+	idx->used++;
+	return 0;
+}
+
+static void conf_index_del(struct conf*conf,struct conf*n){
+	struct conf_index*idx=&conf->index;
+	if(!idx->slots)return;
+	size_t mask=idx->size-1,i,j,k;
+	struct conf**s=conf_index_slot(idx,n->name,n->name_len,n->hash);
+	if(*s!=n)return;
+	i=j=s-idx->slots,*s=NULL,idx->used--;
+	while(idx->slots[j=(j+1)&mask]){
+		k=idx->slots[j]->hash&mask;
+		if(i<=j?(i<k&&k<=j):(i<k||k<=j))continue;
+		idx->slots[i]=idx->slots[j];
+		idx->slots[j]=NULL;
+		i=j;
+	}
+}
+
+static void conf_index_free(struct conf*conf){
+	if(conf->index.slots)free(conf->index.slots);
+	memset(&conf->index,0,sizeof(conf->index));
+}
+
+static struct conf*conf_index_get(struct conf*conf,const char*name,size_t len){
+	if(!conf->index.slots)return NULL;
+	return *conf_index_slot(&conf->index,name,len,conf_hash(name,len));
+}
+
+static struct conf*conf_get(struct conf*conf,const char*name,size_t len){
 	errno=0;
 	if(!conf)return NULL;
 	if(conf->type!=TYPE_KEY)EPRET(ENOTDIR);
-	list*l=list_search_one(conf->keys,conf_cmp,(char*)name);
-	if(!l)EPRET(ENOENT);
-	return LIST_DATA(l,struct conf*);
+	struct conf*c=conf_index_get(conf,name,len);
+	if(!c)EPRET(ENOENT);
+	return c;
 }
 
 static bool check_perm_read(struct conf*conf,uid_t u,gid_t g){
@@ -60,86 +160,115 @@ static bool check_perm_write(struct conf*conf,uid_t u,gid_t g){
 	else return false;
 }
 
-static struct conf*conf_create(struct conf*conf,const char*name,uid_t u,gid_t g){
+static int conf_set_name(struct conf*c,const char*name,size_t len){
+	uint32_t hash=conf_hash(name,len);
+	const char*n=conf_name_get(name,len,hash);
+	if(!n)return -1;
+	conf_name_put(c->name);
+	c->name=n,c->name_len=len,c->hash=hash;
+	return 0;
+}
+
+static void conf_link_child(struct conf*conf,struct conf*n){
+	n->parent=conf,n->next=NULL,n->prev=conf->last;
+	if(conf->last)conf->last->next=n;
+	else conf->child=n;
+	conf->last=n;
+}
+
+static void conf_unlink_child(struct conf*conf,struct conf*n){
+	if(n->prev)n->prev->next=n->next;
+	else conf->child=n->next;
+	if(n->next)n->next->prev=n->prev;
+	else conf->last=n->prev;
+	n->next=n->prev=NULL;
+}
+
+static struct conf*conf_create(struct conf*conf,const char*name,size_t len,uid_t u,gid_t g){
 	errno=0;
 	if(!conf)return NULL;
 	if(conf->type!=TYPE_KEY)EPRET(ENOTDIR);
+	if(len>=CONF_NAME_MAX)EPRET(ENAMETOOLONG);
 	if(!check_perm_read(conf,u,g))EPRET(EACCES);
-	if(list_search_one(conf->keys,conf_cmp,(char*)name))EPRET(EEXIST);
+	if(conf_index_get(conf,name,len))EPRET(EEXIST);
 	if(!check_perm_write(conf,u,g))EPRET(EACCES);
-	struct conf*n=malloc(sizeof(struct conf));
+	struct conf*n=conf_node_alloc();
 	if(!n)EPRET(ENOMEM);
-	memset(n,0,sizeof(struct conf));
-	strcpy(n->name,name);
-	n->parent=conf,n->save=conf->save,n->user=u,n->group=g;
-	list_obj_add_new_notnull(&conf->keys,n);
+	if(conf_set_name(n,name,len)!=0){
+		conf_node_free(n);
+		return NULL;
+	}
+	n->save=conf->save,n->user=u,n->group=g;
+	if(conf_index_add(conf,n)!=0){
+		conf_name_put(n->name);
+		conf_node_free(n);
+		return NULL;
+	}
+	conf_link_child(conf,n);
 	return n;
 }
 
+// caller must hold store_lock (write lock when create)
 static struct conf*conf_lookup(const char*path,bool create,enum conf_type type,uid_t u,gid_t g){
 	errno=0;
+	size_t len;
+	const char*key=path,*p;
 	struct conf*cur=&conf_store,*x;
-	char*xpath,*p,*key;
+	if(!path)EPRET(EINVAL);
 	if(!check_perm_read(&conf_store,u,g))EPRET(EACCES);
-	if(strcmp(path,"/")==0&&type==0)return &conf_store;
-	if(!path[0]&&type==0)return &conf_store;
-	if(!(xpath=strdup(path)))EPRET(ENOMEM);
-	p=xpath,key=xpath;
-	MUTEX_LOCK(store_lock);
-	if(p)do{
-		if(*p!='.')continue;
-		*p=0;
-		if(!(x=conf_get(cur,key))){
-			if(!create){
-				MUTEX_UNLOCK(store_lock);
-				free(xpath);
-				EPRET(ENOENT);
-			}
-			if(!(x=conf_create(cur,key,u,g))){
-				MUTEX_UNLOCK(store_lock);
-				free(xpath);
-				return NULL;
-			}
-			x->type=TYPE_KEY;
-			x->mode=KEY_MODE;
-		}
-		if(!check_perm_read(x,u,g)){
-			MUTEX_UNLOCK(store_lock);
-			free(xpath);
-			EPRET(EACCES);
-		}
-		cur=x,key=++p;
-	}while(*p++);
-	if(!key[0]){
-		MUTEX_UNLOCK(store_lock);
-		free(xpath);
-		EPRET(EINVAL);
-	}
-	if(!(x=conf_get(cur,key))){
-		if(!create){
-			MUTEX_UNLOCK(store_lock);
-			free(xpath);
-			EPRET(ENOENT);
+	if(type==0&&(!path[0]||strcmp(path,"/")==0))return &conf_store;
+	for(;;){
+		p=strchr(key,'.');
+		len=p?(size_t)(p-key):strlen(key);
+		if(len==0)EPRET(EINVAL);
+		if(!(x=conf_get(cur,key,len))){
+			if(!create||errno!=ENOENT)return NULL;
+			if(!(x=conf_create(cur,key,len,u,g)))return NULL;
+			x->type=p?TYPE_KEY:type;
+			x->mode=x->type==TYPE_KEY?KEY_MODE:VAL_MODE;
 		}
-		if(!(x=conf_create(cur,key,u,g))){
-			MUTEX_UNLOCK(store_lock);
-			free(xpath);
-			return NULL;
-		}
-		x->type=type;
-		x->mode=type==TYPE_KEY?KEY_MODE:VAL_MODE;
+		if(!check_perm_read(x,u,g))EPRET(EACCES);
+		if(!p)break;
+		cur=x,key=p+1;
 	}
-	MUTEX_UNLOCK(store_lock);
-	free(xpath);
-	if(!check_perm_read(x,u,g))EPRET(EACCES);
 	if(x->type==0)EPRET(EBADMSG);
 	if(type!=0&&type!=x->type)EPRET(ENOENT);
 	return x;
 }
 
+struct conf*conf_get_node(const char*path){
+	return conf_lookup(path,false,0,0,0);
+}
+
+void conf_store_lock(bool write){
+	if(write)RWLOCK_WRLOCK(store_lock);
+	else RWLOCK_RDLOCK(store_lock);
+}
+
+void conf_store_unlock(){
+	RWLOCK_UNLOCK(store_lock);
+}
+
+// nodes are reused from slabs, under pressure the empty ones go back
+static size_t conf_store_shrink(enum mem_pressure level __attribute__((unused)),void*d __attribute__((unused))){
+	size_t r;
+	RWLOCK_WRLOCK(store_lock);
+	r=conf_slab_trim();
+	RWLOCK_UNLOCK(store_lock);
+	return r;
+}
+
+void conf_store_shrinker(){
+	static int id=0;
+	if(id<=0)id=mem_shrinker_add("confd store",MEM_PRIO_STORE,conf_store_shrink,NULL);
+}
+
 enum conf_type conf_get_type(const char*path,uid_t u,gid_t g){
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
-	return c?c->type:(enum conf_type)-1;
+	enum conf_type t=c?c->type:(enum conf_type)-1;
+	RWLOCK_UNLOCK(store_lock);
+	return t;
 }
 
 const char*conf_type2string(enum conf_type type){
@@ -158,167 +287,376 @@ const char*conf_get_type_string(const char*path,uid_t u,gid_t g){
 }
 
 const char**conf_ls(const char*path,uid_t u,gid_t g){
+	const char**r=NULL;
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
-	if(!c)return NULL;
-	if(c->type!=TYPE_KEY)EPRET(ENOTDIR);
-	MUTEX_LOCK(store_lock);
-	int i=list_count(c->keys),x=0;
-	if(i<0)i=0;
-	size_t s=sizeof(char*)*(i+1);
-	const char**r=malloc(s);
-	if(!r){
-		MUTEX_UNLOCK(store_lock);
-		EPRET(ENOMEM);
-	}
+	if(!c)goto done;
+	if(c->type!=TYPE_KEY)EDONE(errno=ENOTDIR);
+	size_t x=0,s=sizeof(char*)*(c->index.used+1);
+	if(!(r=malloc(s)))EDONE(errno=ENOMEM);
 	memset(r,0,s);
-	list*p=list_first(c->keys);
-	if(p)do{
-		LIST_DATA_DECLARE(d,p,struct conf*);
-		r[x++]=d->name;
-	}while((p=p->next));
-	MUTEX_UNLOCK(store_lock);
+	CONF_FOR_EACH(d,c)r[x++]=d->name;
+	errno=0;
+	done:
+	RWLOCK_UNLOCK(store_lock);
+	return r;
+}
+
+char**conf_ls_dup(const char*path,uid_t u,gid_t g){
+	char**r=NULL,*p=NULL;
+	size_t x=0,s=0;
+	RWLOCK_RDLOCK(store_lock);
+	struct conf*c=conf_lookup(path,false,0,u,g);
+	if(!c)goto done;
+	if(c->type!=TYPE_KEY)EDONE(errno=ENOTDIR);
+	CONF_FOR_EACH(d,c)s+=d->name_len+1;
+	if(s<=0)goto done;
+	if(
+		!(r=malloc(sizeof(char*)*(c->index.used+1)))||
+		!(p=malloc(s))
+	){
+		if(r)free(r);
+		r=NULL;
+		EDONE(errno=ENOMEM);
+	}
+	CONF_FOR_EACH(d,c){
+		memcpy(p,d->name,d->name_len+1);
+		r[x++]=p,p+=d->name_len+1;
+	}
+	r[x]=NULL;
+	errno=0;
+	done:
+	RWLOCK_UNLOCK(store_lock);
 	return r;
 }
 
 int conf_count(const char*path,uid_t u,gid_t g){
+	int i=-1;
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
-	if(!c)return -1;
-	if(c->type!=TYPE_KEY)ERET(ENOTDIR);
-	MUTEX_LOCK(store_lock);
-	int i=list_count(c->keys);
-	if(i<0)i=0;
-	MUTEX_UNLOCK(store_lock);
-	return i;
-}
-
-static int conf_del_obj(struct conf*c){
-	if(!c)return -1;
-	if(!c->parent)ERET(EINVAL);
-	MUTEX_LOCK(store_lock);
-	list*p;
-	if(c->type==TYPE_KEY){
-		list*x;
-		if((p=list_first(c->keys)))do{
-			x=p->next;
-			MUTEX_UNLOCK(store_lock);
-			conf_del_obj(LIST_DATA(p,struct conf*));
-			MUTEX_LOCK(store_lock);
-		}while((p=x));
-		if(c->keys)free(c->keys);
-		c->keys=NULL;
-	}else if(c->type==TYPE_STRING&&c->value.string)free(c->value.string);
-	if((p=list_first(c->parent->keys)))do{
-		LIST_DATA_DECLARE(d,p,struct conf*);
-		if(d!=c)continue;
-		list_obj_del(&c->parent->keys,p,NULL);
+	if(!c)goto done;
+	if(c->type!=TYPE_KEY)EDONE(errno=ENOTDIR);
+	i=c->index.used;
+	done:
+	RWLOCK_UNLOCK(store_lock);
+	return i<0?ENUM(errno):i;
+}
+
+// FNV-1a, children are hashed in their insertion order
+static uint64_t hash_bytes(uint64_t h,const void*data,size_t len){
+	const unsigned char*p=data;
+	for(size_t i=0;i<len;i++)h=(h^p[i])*0x100000001b3ULL;
+	return h;
+}
+
+static uint64_t conf_tree_hash_obj(struct conf*c,uint64_t h){
+	int32_t type=c->type;
+	h=hash_bytes(h,c->name,c->name_len+1);
+	h=hash_bytes(h,&type,sizeof(type));
+	switch(c->type){
+		case TYPE_KEY:
+			CONF_FOR_EACH(d,c)h=conf_tree_hash_obj(d,h);
+			h=hash_bytes(h,"",1);
 		break;
-	}while((p=p->next));
-	free(c);
-	conf_store_changed=true;
-	MUTEX_UNLOCK(store_lock);
+		case TYPE_STRING:
+			if(c->value.string)h=hash_bytes(h,c->value.string,strlen(c->value.string)+1);
+		break;
+		case TYPE_INTEGER:h=hash_bytes(h,&c->value.integer,sizeof(c->value.integer));break;
+		case TYPE_BOOLEAN:h=hash_bytes(h,&c->value.boolean,sizeof(c->value.boolean));break;
+		default:;
+	}
+	return h;
+}
+
+int conf_tree_hash(const char*path,uint64_t*hash,uid_t u,gid_t g){
+	int r=0;
+	if(!hash)ERET(EINVAL);
+	RWLOCK_RDLOCK(store_lock);
+	struct conf*c=conf_lookup(path,false,0,u,g);
+	if(!c)r=-errno;
+	else *hash=conf_tree_hash_obj(c,0xcbf29ce484222325ULL);
+	RWLOCK_UNLOCK(store_lock);
+	return r<0?ENUM(-r):0;
+}
+
+struct tree_dump{
+	char*buf;
+	size_t len,size,plen;
+	uid_t u;
+	gid_t g;
+	char path[PATH_MAX];
+};
+
+static int conf_tree_dump_obj(struct tree_dump*t,struct conf*c){
+	char*n;
+	int r;
+	size_t need,l;
+	struct confd_batch_rec rec;
+	memset(&rec,0,sizeof(rec));
+	rec.action=CONF_GET_TYPE;
+	rec.type=c->type;
+	rec.path_len=t->plen;
+	switch(c->type){
+		case TYPE_STRING:if(c->value.string)rec.data_len=strlen(c->value.string);break;
+		case TYPE_INTEGER:rec.data.integer=c->value.integer;break;
+		case TYPE_BOOLEAN:rec.data.boolean=c->value.boolean;break;
+		default:;
+	}
+	need=sizeof(rec)+rec.path_len+rec.data_len;
+	if(t->len+need>CONFD_BATCH_SIZE)ERET(E2BIG);
+	if(t->len+need>t->size){
+		l=t->size*2>t->len+need?t->size*2:t->len+need+4096;
+		if(!(n=realloc(t->buf,l)))ERET(ENOMEM);
+		t->buf=n,t->size=l;
+	}
+	memcpy(t->buf+t->len,&rec,sizeof(rec)),t->len+=sizeof(rec);
+	memcpy(t->buf+t->len,t->path,rec.path_len),t->len+=rec.path_len;
+	if(rec.data_len>0){
+		memcpy(t->buf+t->len,c->value.string,rec.data_len);
+		t->len+=rec.data_len;
+	}
+	if(c->type==TYPE_KEY)CONF_FOR_EACH(d,c){
+		if(!check_perm_read(d,t->u,t->g))continue;
+		l=t->plen;
+		if(l+d->name_len+1>=sizeof(t->path))ERET(ENAMETOOLONG);
+		if(l>0)t->path[t->plen++]='.';
+		memcpy(t->path+t->plen,d->name,d->name_len);
+		t->plen+=d->name_len;
+		r=conf_tree_dump_obj(t,d);
+		t->plen=l;
+		if(r!=0)return r;
+	}
 	return 0;
 }
 
+int conf_tree_dump(const char*path,char**buf,size_t*len,uid_t u,gid_t g){
+	int r=0;
+	struct tree_dump*t;
+	if(!buf||!len)ERET(EINVAL);
+	if(!(t=malloc(sizeof(struct tree_dump))))ERET(ENOMEM);
+	memset(t,0,sizeof(struct tree_dump));
+	t->u=u,t->g=g;
+	RWLOCK_RDLOCK(store_lock);
+	struct conf*c=conf_lookup(path,false,0,u,g);
+	if(!c||conf_tree_dump_obj(t,c)!=0)r=-errno;
+	RWLOCK_UNLOCK(store_lock);
+	if(r<0&&t->buf)free(t->buf);
+	else *buf=t->buf,*len=t->len;
+	free(t);
+	return r<0?ENUM(-r):0;
+}
+
+struct confd_item*conf_tree_items(const char*buf,size_t len,size_t*cnt){
+	char*p;
+	size_t off,n=0;
+	struct confd_item*items,*it;
+	struct confd_batch_rec rec;
+	if(!buf||!cnt)EPRET(EINVAL);
+	for(off=0;off+sizeof(rec)<=len;n++){
+		memcpy(&rec,buf+off,sizeof(rec));
+		off+=sizeof(rec)+rec.path_len+rec.data_len;
+	}
+	if(off!=len||n<=0)EPRET(EBADMSG);
+	if(!(items=malloc(n*(sizeof(struct confd_item)+2)+len)))EPRET(ENOMEM);
+	p=(char*)(items+n);
+	for(off=0,it=items;it<items+n;it++){
+		memcpy(&rec,buf+off,sizeof(rec)),off+=sizeof(rec);
+		memset(it,0,sizeof(struct confd_item));
+		it->type=rec.type,it->code=rec.code,it->path=p;
+		memcpy(p,buf+off,rec.path_len);
+		p+=rec.path_len,off+=rec.path_len,*p++=0;
+		switch(rec.type){
+			case TYPE_STRING:
+				it->value.string=p;
+				memcpy(p,buf+off,rec.data_len);
+				p+=rec.data_len,*p++=0;
+			break;
+			case TYPE_INTEGER:it->value.integer=rec.data.integer;break;
+			case TYPE_BOOLEAN:it->value.boolean=rec.data.boolean;break;
+			default:;
+		}
+		off+=rec.data_len;
+	}
+	*cnt=n;
+	return items;
+}
+
+static void conf_del_obj(struct conf*c){
+	struct conf*d,*x;
+	if(c->type==TYPE_KEY){
+		for(d=c->child;d;d=x){
+			x=d->next;
+			d->parent=NULL;
+			conf_del_obj(d);
+		}
+		c->child=c->last=NULL;
+		conf_index_free(c);
+	}else if(c->type==TYPE_STRING&&c->value.string)free(c->value.string);
+	if(c->parent){
+		conf_index_del(c->parent,c);
+		conf_unlink_child(c->parent,c);
+	}
+	conf_name_put(c->name);
+	conf_node_free(c);
+}
+
 int conf_del(const char*path,uid_t u,gid_t g){
+	int r=0;
+	struct conf_owner gone;
+	RWLOCK_WRLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
-	return c?conf_del_obj(c):-(errno);
+	if(!c)r=-errno;
+	else if(!c->parent)r=ENUM(EINVAL);
+	else{
+		gone.user=c->user,gone.group=c->group,gone.mode=c->mode;
+		conf_del_obj(c);
+		conf_store_changed=true;
+	}
+	RWLOCK_UNLOCK(store_lock);
+	if(r==0)conf_notify_remove(path,&gone);
+	return r;
+}
+
+bool conf_removed_readable(const char*path,const struct conf_owner*gone,uid_t u,gid_t g){
+	bool r;
+	const char*p;
+	char parent[PATH_MAX];
+	struct conf c;
+	if(!path||!gone)return false;
+	memset(&c,0,sizeof(c));
+	c.user=gone->user,c.group=gone->group,c.mode=gone->mode;
+	if(!check_perm_read(&c,u,g))return false;
+	if((p=strrchr(path,'.')))snprintf(parent,sizeof(parent),"%.*s",(int)(p-path),path);
+	else parent[0]=0;
+	RWLOCK_RDLOCK(store_lock);
+	r=conf_lookup(parent,false,0,u,g)!=NULL;
+	RWLOCK_UNLOCK(store_lock);
+	return r;
 }
 
 int conf_rename(const char*path,const char*name,uid_t u,gid_t g){
-	struct conf*c=conf_lookup(path,false,0,u,g);
-	if(!c)return -(errno);
+	int r=0;
+	enum conf_type t=0;
+	struct conf_owner gone;
 	if(!name||!*name||strchr(name,'.'))ERET(EINVAL);
-	if(strlen(name)>=sizeof(c->name)-1)ERET(EINVAL);
-	if(!c->parent||!c->name[0])ERET(EACCES);
-	if(strcmp(c->name,name)==0)return 0;
-	if(!check_perm_read(c->parent,u,g))ERET(EACCES);
-	if(list_search_one(c->parent->keys,conf_cmp,(char*)name))ERET(EEXIST);
-	if(!check_perm_write(c,u,g))ERET(EACCES);
-	memset(c->name,0,sizeof(c->name));
-	strncpy(c->name,name,sizeof(c->name)-1);
-	return 0;
+	RWLOCK_WRLOCK(store_lock);
+	struct conf*c=conf_lookup(path,false,0,u,g);
+	if(!c)EDONE(r=-errno);
+	if(strlen(name)>=CONF_NAME_MAX)EDONE(r=ENUM(ENAMETOOLONG));
+	if(!c->parent||!c->name[0])EDONE(r=ENUM(EACCES));
+	if(strcmp(c->name,name)==0)goto done;
+	if(!check_perm_read(c->parent,u,g))EDONE(r=ENUM(EACCES));
+	if(conf_index_get(c->parent,name,strlen(name)))EDONE(r=ENUM(EEXIST));
+	if(!check_perm_write(c,u,g))EDONE(r=ENUM(EACCES));
+	conf_index_del(c->parent,c);
+	if(conf_set_name(c,name,strlen(name))!=0){
+		conf_index_add(c->parent,c);
+		EDONE(r=-errno);
+	}
+	conf_index_add(c->parent,c);
+	conf_store_changed=true;
+	t=c->type;
+	gone.user=c->user,gone.group=c->group,gone.mode=c->mode;
+	done:
+	RWLOCK_UNLOCK(store_lock);
+	if(t!=0)conf_notify_rename(path,name,t,&gone);
+	return r;
 }
 
 int conf_add_key(const char*path,uid_t u,gid_t g){
-	return conf_lookup(path,true,TYPE_KEY,u,g)!=NULL;
+	RWLOCK_WRLOCK(store_lock);
+	struct conf*c=conf_lookup(path,true,TYPE_KEY,u,g);
+	RWLOCK_UNLOCK(store_lock);
+	return c!=NULL;
 }
 
-static int _conf_set_save(bool lock,struct conf*c,bool save,uid_t u,gid_t g){
-	list*p;
+static int _conf_set_save(struct conf*c,bool save,uid_t u,gid_t g){
 	int r=0;
 	if(!c)ERET(EINVAL);
-	if(lock)MUTEX_LOCK(store_lock);
-	if(c->type==TYPE_KEY&&(p=list_first(c->keys)))do{
-		LIST_DATA_DECLARE(d,p,struct conf*);
+	if(c->type==TYPE_KEY)CONF_FOR_EACH(d,c){
 		if(!check_perm_write(d,u,g))r=EPERM;
-		else if(_conf_set_save(false,d,save,u,g)!=0)r=-errno;
-	}while((p=p->next));
+		else if(_conf_set_save(d,save,u,g)!=0)r=-errno;
+	}
 	if(!check_perm_write(c,u,g))r=EPERM;
 	else c->save=save;
-	if(lock)MUTEX_UNLOCK(store_lock);
 	return r;
 }
 
 int conf_set_save(const char*path,bool save,uid_t u,gid_t g){
-	return _conf_set_save(true,conf_lookup(path,false,0,u,g),save,u,g);
+	RWLOCK_WRLOCK(store_lock);
+	int r=_conf_set_save(conf_lookup(path,false,0,u,g),save,u,g);
+	RWLOCK_UNLOCK(store_lock);
+	return r;
 }
 
 bool conf_get_save(const char*path,uid_t u,gid_t g){
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
-	return c?c->save:false;
+	bool r=c?c->save:false;
+	RWLOCK_UNLOCK(store_lock);
+	return r;
 }
 
 int conf_get_own(const char*path,uid_t*own,uid_t u,gid_t g){
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
 	if(c&&own)*own=c->user;
+	RWLOCK_UNLOCK(store_lock);
 	return c&&own;
 }
 
 int conf_get_grp(const char*path,gid_t*grp,uid_t u,gid_t g){
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
 	if(c&&grp)*grp=c->group;
+	RWLOCK_UNLOCK(store_lock);
 	return c&&grp;
 }
 
 int conf_get_mod(const char*path,mode_t*mod,uid_t u,gid_t g){
+	RWLOCK_RDLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
 	if(c&&mod)*mod=c->mode;
+	RWLOCK_UNLOCK(store_lock);
 	return c&&mod;
 }
 
 int conf_set_own(const char*path,uid_t own,uid_t u,gid_t g){
 	if(u!=0&&g!=0)ERET(EPERM);
+	RWLOCK_WRLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
 	if(c)c->user=own;
+	RWLOCK_UNLOCK(store_lock);
 	return c!=NULL;
 }
 
 int conf_set_grp(const char*path,gid_t grp,uid_t u,gid_t g){
 	if(u!=0&&g!=0)ERET(EPERM);
+	RWLOCK_WRLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
 	if(c)c->group=grp;
+	RWLOCK_UNLOCK(store_lock);
 	return c!=NULL;
 }
 
 int conf_set_mod(const char*path,mode_t mod,uid_t u,gid_t g){
+	int r=0;
+	RWLOCK_WRLOCK(store_lock);
 	struct conf*c=conf_lookup(path,false,0,u,g);
-	if(!c)return -1;
-	if(u!=0&&u!=c->user)ERET(EPERM);
-	c->mode=mod;
-	return 0;
+	if(!c)r=-1;
+	else if(u!=0&&u!=c->user)r=ENUM(EPERM);
+	else c->mode=mod;
+	RWLOCK_UNLOCK(store_lock);
+	return r;
 }
 
 size_t conf_calc_size(struct conf*c){
 	if(!c)return 0;
-	list*p;
 	size_t size=sizeof(struct conf);
 	switch(c->type){
 		case TYPE_KEY:
-			if((p=list_first(c->keys)))do{
-				LIST_DATA_DECLARE(l,p,struct conf*);
-				size+=sizeof(list);
-				size+=conf_calc_size(l);
-			}while((p=p->next));
+			CONF_FOR_EACH(l,c)size+=conf_calc_size(l);
+			size+=sizeof(struct conf*)*c->index.size;
 		break;
 		case TYPE_STRING:
 			if(c->value.string)size+=strlen(c->value.string)+1;
@@ -328,29 +666,51 @@ size_t conf_calc_size(struct conf*c){
 	return size;
 }
 
-#define FUNCTION_CONF_GET_SET(_tag,_type,_func) \
+#define FUNCTION_CONF_SET(_tag,_type,_func,_drop) \
 	int conf_set_##_func##_inc(const char*path,_type data,uid_t u,gid_t g,bool inc){\
+		RWLOCK_WRLOCK(store_lock);\
 		struct conf*c=conf_lookup(path,true,TYPE_##_tag,u,g);\
-		if(!c)return -errno;\
-		MUTEX_LOCK(store_lock);\
-		if(c->type!=TYPE_##_tag){\
-			MUTEX_UNLOCK(store_lock);\
-			ERET(EBADMSG);\
+		if(!c){\
+			RWLOCK_UNLOCK(store_lock);\
+			return -errno;\
 		}\
-                c->include=inc;\
+		c->include=inc;\
+		_drop;\
 		VALUE_##_tag(c)=data;\
 		conf_store_changed=true;\
-		MUTEX_UNLOCK(store_lock);\
+		RWLOCK_UNLOCK(store_lock);\
+		conf_notify_change(path,TYPE_##_tag);\
 		return 0;\
 	}\
 	int conf_set_##_func(const char*path,_type data,uid_t u,gid_t g){\
 		return conf_set_##_func##_inc(path,data,u,g,false);\
-	}\
+	}
+
+#define FUNCTION_CONF_GET(_tag,_type,_func) \
 	_type conf_get_##_func(const char*path,_type def,uid_t u,gid_t g){\
+		RWLOCK_RDLOCK(store_lock);\
 		struct conf*c=conf_lookup(path,false,TYPE_##_tag,u,g);\
-		return c?VALUE_##_tag(c):def;\
+		_type r=c?VALUE_##_tag(c):def;\
+		RWLOCK_UNLOCK(store_lock);\
+		return r;\
 	}
 
-FUNCTION_CONF_GET_SET(STRING,char*,string)
-FUNCTION_CONF_GET_SET(INTEGER,int64_t,integer)
-FUNCTION_CONF_GET_SET(BOOLEAN,bool,boolean)
+/*
+ * the store owns a string once it is set, the replaced value is freed
+ * under the write lock, readers only ever get a copy from conf_dup_string
+ */
+#define STRING_DROP if(VALUE_STRING(c)&&VALUE_STRING(c)!=data)free(VALUE_STRING(c))
+FUNCTION_CONF_SET(STRING,char*,string,STRING_DROP)
+FUNCTION_CONF_SET(INTEGER,int64_t,integer,)
+FUNCTION_CONF_SET(BOOLEAN,bool,boolean,)
+FUNCTION_CONF_GET(INTEGER,int64_t,integer)
+FUNCTION_CONF_GET(BOOLEAN,bool,boolean)
+
+char*conf_dup_string(const char*path,uid_t u,gid_t g){
+	char*r=NULL;
+	RWLOCK_RDLOCK(store_lock);
+	struct conf*c=conf_lookup(path,false,TYPE_STRING,u,g);
+	if(c&&VALUE_STRING(c)&&!(r=strdup(VALUE_STRING(c))))errno=ENOMEM;
+	RWLOCK_UNLOCK(store_lock);
+	return r;
+}
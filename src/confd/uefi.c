@@ -20,6 +20,15 @@
 int confd=-1;
 static char*def_path=NULL;
 static fsh*def_fp=NULL;
+static list*watchers=NULL;
+static int watch_id=0;
+
+struct confd_watcher{
+	int id;
+	confd_watch_cb cb;
+	void*data;
+	char prefix[PATH_MAX];
+};
 
 static void set_default(fsh*fp,char*path,...){
 	url*u;
@@ -115,6 +124,7 @@ int confd_init(){
 		for(i=0;vs[i];i++)if(try_default(vs[i]))break;
 	}
 	if(!def_fp||!def_path)tlog_warn("no default config save path");
+	conf_store_shrinker();
 	done:
 	if(exts)free(exts);
 	return 0;
@@ -152,11 +162,11 @@ int confd_set_integer(const char*path,int64_t data){
 }
 
 int confd_set_string(const char*path,char*data){
+	int r;
 	char*s=strdup(data);
 	if(!s)ERET(ENOMEM);
-	char*c=conf_get_string(path,NULL,0,0);
-	if(c)free(c);
-	return conf_set_string(path,s,0,0);
+	if((r=conf_set_string(path,s,0,0))!=0)free(s);
+	return r;
 }
 
 int confd_set_boolean(const char*path,bool data){
@@ -205,20 +215,24 @@ int64_t confd_count(const char*path){
 	return conf_count(path,0,0);
 }
 
+int confd_tree_hash(const char*path,uint64_t*hash){
+	return conf_tree_hash(path,hash,0,0);
+}
+
 enum conf_type confd_get_type(const char*path){
 	return conf_get_type(path,0,0);
 }
 
 char*confd_get_string(const char*path,char*def){
-	char*x=conf_get_string(path,def,0,0);
-	if(!x)x=def;
-	return x?strdup(x):NULL;
+	char*x=conf_dup_string(path,0,0);
+	return x?x:def?strdup(def):NULL;
 }
 
 char*confd_get_sstring(const char*path,char*def,char*buf,size_t len){
-	char*x=conf_get_string(path,NULL,0,0);
+	char*x=conf_dup_string(path,0,0);
 	memset(buf,0,len);
 	if(x||def)strncpy(buf,x?x:def,len-1);
+	if(x)free(x);
 	return buf;
 }
 
@@ -270,6 +284,106 @@ int confd_add_key(const char*path){
 	return conf_add_key(path,0,0);
 }
 
+int confd_get_many(struct confd_item*items,size_t cnt){
+	if(!items)ERET(EINVAL);
+	for(size_t i=0;i<cnt;i++){
+		struct confd_item*it=&items[i];
+		enum conf_type t=conf_get_type(it->path,0,0);
+		it->code=0;
+		if((int)t<0)it->code=errno?errno:ENOENT;
+		else if(it->type!=0&&it->type!=t)it->code=ENOENT;
+		else switch((it->type=t)){
+			case TYPE_KEY:break;
+			case TYPE_STRING:
+				it->value.string=confd_get_string(it->path,NULL);
+				if(!it->value.string)it->code=ENOMEM;
+			break;
+			case TYPE_INTEGER:it->value.integer=conf_get_integer(it->path,0,0,0);break;
+			case TYPE_BOOLEAN:it->value.boolean=conf_get_boolean(it->path,false,0,0);break;
+			default:it->code=EBADMSG;
+		}
+	}
+	return 0;
+}
+
+struct confd_item*confd_get_tree(const char*path,size_t*cnt){
+	char*buf=NULL;
+	size_t len=0;
+	struct confd_item*items;
+	if(!path||!cnt)EPRET(EINVAL);
+	if(conf_tree_dump(path,&buf,&len,0,0)!=0)return NULL;
+	items=conf_tree_items(buf,len,cnt);
+	free(buf);
+	return items;
+}
+
+int confd_set_many(struct confd_item*items,size_t cnt){
+	if(!items)ERET(EINVAL);
+	for(size_t i=0;i<cnt;i++){
+		struct confd_item*it=&items[i];
+		switch(it->type){
+			case TYPE_STRING:
+				it->code=it->value.string?
+					-confd_set_string(it->path,it->value.string):EINVAL;
+			break;
+			case TYPE_INTEGER:it->code=-confd_set_integer(it->path,it->value.integer);break;
+			case TYPE_BOOLEAN:it->code=-confd_set_boolean(it->path,it->value.boolean);break;
+			default:it->code=EINVAL;
+		}
+	}
+	return 0;
+}
+
+static void watch_notify(const char*path,enum conf_type type,const struct conf_owner*gone __attribute__((unused))){
+	list*p,*n;
+	if((p=list_first(watchers)))do{
+		n=p->next;
+		LIST_DATA_DECLARE(w,p,struct confd_watcher*);
+		if(conf_watch_match(w->prefix,path))w->cb(path,type,w->data);
+	}while((p=n));
+}
+
+int confd_watch_open(const char*prefix __attribute__((unused))){
+	ERET(ENOSYS);
+}
+
+int confd_watch_read(
+	int fd __attribute__((unused)),
+	char*path __attribute__((unused)),
+	size_t len __attribute__((unused)),
+	enum conf_type*type __attribute__((unused)),
+	int timeout __attribute__((unused))
+){
+	ERET(ENOSYS);
+}
+
+void confd_watch_close(int fd __attribute__((unused))){}
+
+int confd_watch(const char*prefix,confd_watch_cb cb,void*data){
+	struct confd_watcher*w;
+	if(!prefix||!cb)ERET(EINVAL);
+	if(!(w=malloc(sizeof(struct confd_watcher))))ERET(ENOMEM);
+	memset(w,0,sizeof(struct confd_watcher));
+	w->id=watch_id++,w->cb=cb,w->data=data;
+	strncpy(w->prefix,prefix,sizeof(w->prefix)-1);
+	if(list_obj_add_new(&watchers,w)!=0){
+		free(w);
+		ERET(ENOMEM);
+	}
+	conf_notify=watch_notify;
+	return w->id;
+}
+
+void confd_unwatch(int id){
+	list*p;
+	if((p=list_first(watchers)))do{
+		LIST_DATA_DECLARE(w,p,struct confd_watcher*);
+		if(w->id!=id)continue;
+		list_obj_del(&watchers,p,list_default_free);
+		break;
+	}while((p=p->next));
+}
+
 #define _EXT_BASE(ret,func,ret_func,...) \
 ret func##_base(const char*base,const char*path __VA_ARGS__){\
 	char xpath[PATH_MAX];\
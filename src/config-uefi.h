@@ -9,6 +9,7 @@
 #define ENABLE_LUA          1
 #define ENABLE_FDT          1
 #define ENABLE_ZLIB         1
+#define ENABLE_ZLIB_SIMD    1
 #define ENABLE_LIBTSM       1
 #define ENABLE_LIBZIP       1
 #define ENABLE_HIVEX        1
@@ -0,0 +1,229 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/stat.h>
+#include<blkid/blkid.h>
+#define TAG "blkindex"
+#include"str.h"
+#include"devd.h"
+#include"array.h"
+#include"system.h"
+#include"logger.h"
+#include"defines.h"
+#include"pathnames.h"
+
+/*
+ * each block device is probed once when it appears, its tags become links
+ * in /dev/disk/by-*, so waiting for a root tag is a stat and not a probe.
+ * the probed values also stay in memory to answer DEV_TAG_* queries.
+ */
+static const struct{
+	const char*key,*name,*dir;
+}tags[]={
+	{"LABEL",     "LABEL",           "by-label"},
+	{"UUID",      "UUID",            "by-uuid"},
+	{"PARTLABEL", "PART_ENTRY_NAME", "by-partlabel"},
+	{"PARTUUID",  "PART_ENTRY_UUID", "by-partuuid"},
+	{"TYPE",      "TYPE",            NULL},
+};
+
+struct blk_ent{
+	char devname[64];
+	char*values[ARRLEN(tags)];
+};
+
+static struct blk_ent*blks=NULL;
+static size_t blks_cnt=0,blks_size=0;
+static pthread_mutex_t blks_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static ssize_t find_tag(const char*key,size_t len){
+	for(size_t i=0;i<ARRLEN(tags);i++)
+		if(strlen(tags[i].key)==len&&strncmp(tags[i].key,key,len)==0)
+			return (ssize_t)i;
+	return -1;
+}
+
+// caller holds blks_lock
+static void forget_device(const char*devname){
+	for(size_t i=0;i<blks_cnt;i++){
+		if(strcmp(blks[i].devname,devname)!=0)continue;
+		for(size_t t=0;t<ARRLEN(tags);t++)
+			if(blks[i].values[t])free(blks[i].values[t]);
+		blks[i]=blks[--blks_cnt];
+		return;
+	}
+}
+
+// caller holds blks_lock
+static struct blk_ent*new_device(const char*devname){
+	struct blk_ent*n;
+	if(strlen(devname)>=sizeof(n->devname))return NULL;
+	if(blks_cnt>=blks_size){
+		size_t ns=blks_size?blks_size*2:32;
+		if(!(n=realloc(blks,sizeof(struct blk_ent)*ns)))return NULL;
+		blks=n,blks_size=ns;
+	}
+	n=&blks[blks_cnt++];
+	memset(n,0,sizeof(struct blk_ent));
+	strcpy(n->devname,devname);
+	return n;
+}
+
+char*blkindex_find(const char*tag){
+	size_t kl;
+	ssize_t t;
+	const char*v;
+	char*r=NULL;
+	if(!tag||!(v=strchr(tag,'=')))EPRET(EINVAL);
+	if((t=find_tag(tag,v-tag))<0)EPRET(EINVAL);
+
+	// values may be quoted like in fstab
+	if(*++v=='"')v++;
+	if((kl=strlen(v))>0&&v[kl-1]=='"')kl--;
+	pthread_mutex_lock(&blks_lock);
+	for(size_t i=0;i<blks_cnt&&!r;i++){
+		char*x=blks[i].values[t];
+		if(!x||strlen(x)!=kl||strncmp(x,v,kl)!=0)continue;
+		if(asprintf(&r,_PATH_DEV"/%s",blks[i].devname)<0)r=NULL;
+	}
+	pthread_mutex_unlock(&blks_lock);
+	if(!r)errno=ENOENT;
+	return r;
+}
+
+char*blkindex_value(const char*dev,const char*key){
+	ssize_t t;
+	char*r=NULL;
+	if(!dev||!key||(t=find_tag(key,strlen(key)))<0)EPRET(EINVAL);
+	if(strncmp(dev,_PATH_DEV"/",sizeof(_PATH_DEV))==0)dev+=sizeof(_PATH_DEV);
+	pthread_mutex_lock(&blks_lock);
+	for(size_t i=0;i<blks_cnt;i++)
+		if(strcmp(blks[i].devname,dev)==0){
+			if(blks[i].values[t])r=strdup(blks[i].values[t]);
+			break;
+		}
+	pthread_mutex_unlock(&blks_lock);
+	if(!r)errno=ENOENT;
+	return r;
+}
+
+static void remove_links(const char*devname){
+	DIR*d;
+	int dfd;
+	ssize_t s;
+	struct dirent*e;
+	char path[PATH_MAX],dest[PATH_MAX],link[PATH_MAX];
+	snprintf(dest,sizeof(dest),"../../%s",devname);
+	for(size_t i=0;i<ARRLEN(tags);i++){
+		if(!tags[i].dir)continue;
+		snprintf(path,sizeof(path),_PATH_DEV"/disk/%s",tags[i].dir);
+		if((dfd=open(path,O_RDONLY|O_DIRECTORY|O_CLOEXEC))<0)continue;
+		if(!(d=fdopendir(dfd))){
+			close(dfd);
+			continue;
+		}
+		while((e=readdir(d))){
+			if(e->d_type!=DT_LNK)continue;
+			if((s=readlinkat(dfd,e->d_name,link,sizeof(link)-1))<=0)continue;
+			link[s]=0;
+			if(strcmp(link,dest)==0)unlinkat(dfd,e->d_name,0);
+		}
+		closedir(d);
+	}
+}
+
+static void add_link_tag(const char*devname,const char*dir,const char*value){
+	char name[256],path[PATH_MAX],dest[PATH_MAX];
+	if(!value||!*value||!blk_tag_escape(value,name,sizeof(name)))return;
+	mkdir(_PATH_DEV"/disk",0755);
+	snprintf(path,sizeof(path),_PATH_DEV"/disk/%s",dir);
+	mkdir(path,0755);
+	snprintf(path,sizeof(path),_PATH_DEV"/disk/%s/%s",dir,name);
+	snprintf(dest,sizeof(dest),"../../%s",devname);
+
+	// last device with a tag wins, same as udev without priorities
+	unlink(path);
+	if(symlink(dest,path)<0)telog_debug("link %s",path);
+}
+
+static int index_device(const char*devname){
+	int r;
+	const char*value;
+	blkid_probe pr;
+	struct blk_ent*ent;
+	char path[PATH_MAX];
+	snprintf(path,sizeof(path),_PATH_DEV"/%s",devname);
+	if(!(pr=blkid_new_probe_from_filename(path)))return -errno;
+	blkid_probe_enable_superblocks(pr,1);
+	blkid_probe_set_superblocks_flags(pr,BLKID_SUBLKS_LABEL|BLKID_SUBLKS_UUID|BLKID_SUBLKS_TYPE);
+	blkid_probe_enable_partitions(pr,1);
+	blkid_probe_set_partitions_flags(pr,BLKID_PARTS_ENTRY_DETAILS);
+	pthread_mutex_lock(&blks_lock);
+	forget_device(devname);
+	ent=new_device(devname);
+	if((r=blkid_do_safeprobe(pr))==0)
+		for(size_t i=0;i<ARRLEN(tags);i++){
+			if(blkid_probe_lookup_value(pr,tags[i].name,&value,NULL)!=0)continue;
+			if(ent&&value)ent->values[i]=strdup(value);
+			if(tags[i].dir)add_link_tag(devname,tags[i].dir,value);
+		}
+	pthread_mutex_unlock(&blks_lock);
+	blkid_free_probe(pr);
+	return r<0?-1:0;
+}
+
+int blkindex_process(uevent*event){
+	if(
+		!event||!event->devname||!event->subsystem||
+		strcmp(event->subsystem,"block")!=0
+	)return 0;
+	switch(event->action){
+		case ACTION_ADD:case ACTION_CHANGE:
+			remove_links(event->devname);
+			return index_device(event->devname);
+		case ACTION_REMOVE:
+			remove_links(event->devname);
+			pthread_mutex_lock(&blks_lock);
+			forget_device(event->devname);
+			pthread_mutex_unlock(&blks_lock);
+		break;
+		default:;
+	}
+	return 0;
+}
+
+int blkindex_scan(){
+	DIR*d;
+	struct dirent*e;
+	char buf[PATH_MAX],*name,*end;
+	int cnt=0;
+	if(!(d=opendir(_PATH_SYS_CLASS"/block")))return -errno;
+	mkdir(_PATH_DEV"/disk",0755);
+	while((e=readdir(d))){
+		if(is_virt_dir(e))continue;
+
+		// DEVNAME may differ from the sysfs name, take it from uevent
+		if(read_file(buf,sizeof(buf),true,_PATH_SYS_CLASS"/block/%s/uevent",e->d_name)<=0)continue;
+		if(!(name=strstr(buf,"DEVNAME=")))continue;
+		name+=8;
+		if((end=strchr(name,'\n')))*end=0;
+		if(index_device(name)==0)cnt++;
+	}
+	closedir(d);
+	tlog_debug("indexed %d block devices",cnt);
+	return cnt;
+}
@@ -7,15 +7,22 @@
  */
 
 #define _GNU_SOURCE
+#include<stdio.h>
 #include<errno.h>
+#include<stdlib.h>
+#include<limits.h>
 #include<unistd.h>
 #include<string.h>
 #include<sys/un.h>
 #include<sys/socket.h>
+#include<blkid/blkid.h>
+#include"lock.h"
 #include"ttyd.h"
+#include"gadget.h"
 #include"logger.h"
 #include"uevent.h"
 #include"system.h"
+#include"defines.h"
 #include"devd_internal.h"
 #define TAG "devd"
 
@@ -58,6 +65,60 @@ int devd_call_quit(){
 	return devd_command(DEV_QUIT);
 }
 
+// aliases go as one list of NUL terminated strings
+int devd_call_modprobe(char**aliases,size_t cnt){
+	int r;
+	char*buf,*p;
+	size_t size=0;
+	struct devd_msg msg;
+	if(!aliases||cnt<=0)ERET(EINVAL);
+	if(devfd<0)ERET(ENOTCONN);
+	for(size_t i=0;i<cnt;i++)size+=strlen(aliases[i])+1;
+	if(!(p=buf=malloc(size)))ERET(ENOMEM);
+	for(size_t i=0;i<cnt;i++)p=stpcpy(p,aliases[i])+1;
+	r=devd_internal_send_msg(devfd,DEV_MODPROBE,buf,size);
+	free(buf);
+	if(r<0)return r;
+	if(devd_internal_read_msg(devfd,&msg)<0)ERET(EIO);
+	if(msg.size>0&&(buf=devd_read_data(devfd,&msg)))free(buf);
+	if(msg.oper!=DEV_OK)ERET(EIO);
+	return 0;
+}
+
+static char*devd_query(enum devd_oper oper,void*data,size_t size){
+	char*r=NULL;
+	struct devd_msg msg;
+	if(devfd<0)EPRET(ENOTCONN);
+	if(devd_internal_send_msg(devfd,oper,data,size)<0)return NULL;
+	if(devd_internal_read_msg(devfd,&msg)<0)EPRET(EIO);
+	if(msg.size>0&&!(r=devd_read_data(devfd,&msg)))EPRET(EIO);
+	if(msg.oper!=DEV_OK||!r||r[msg.size-1]!=0){
+		if(r)free(r);
+		EPRET(ENOENT);
+	}
+	return r;
+}
+
+char*devd_find_tag(const char*tag){
+	if(!tag)EPRET(EINVAL);
+	return devd_query(DEV_TAG_FIND,(void*)tag,strlen(tag)+1);
+}
+
+char*blk_get_tag_value(const char*dev,const char*key){
+	char*r;
+	if(!dev||!key)EPRET(EINVAL);
+	if(devfd>=0&&(r=devd_tag_value(dev,key)))return r;
+	return blkid_get_tag_value(NULL,key,dev);
+}
+
+char*devd_tag_value(const char*dev,const char*key){
+	char buf[PATH_MAX];
+	int l;
+	if(!dev||!key)EPRET(EINVAL);
+	if((l=snprintf(buf,sizeof(buf),"%s%c%s",dev,0,key))<0||(size_t)l>=sizeof(buf))EPRET(EINVAL);
+	return devd_query(DEV_TAG_VALUE,buf,l+1);
+}
+
 int process_module(uevent*event){
 	if(!event->devpath)return -1;
 	char*mod=strchr(event->devpath+1,'/')+1;
@@ -69,25 +130,57 @@ int process_module(uevent*event){
 	return 0;
 }
 
+// runs after the device node is made, ttyd opens it right away
+static mutex_t ttyd_lock=MUTEX_INITIALIZER;
 int process_tty(uevent*event){
+	int r;
+	if(!event->devname)return 0;
 	switch(event->action){
 		case ACTION_ADD:tlog_debug("add tty '%s'",event->devname);break;
 		case ACTION_REMOVE:tlog_debug("remove tty '%s'",event->devname);break;
 		default:return 0;
 	}
-	check_open_default_ttyd_socket(false,TAG);
-	ttyd_reload();
+
+	// shards run in parallel, the ttyd socket takes one request at a time
+	MUTEX_LOCK(ttyd_lock);
+	if(check_open_default_ttyd_socket(true,TAG)>=0){
+		r=event->action==ACTION_ADD?
+			ttyd_add_tty(event->devname):
+			ttyd_remove_tty(event->devname);
+		if(r<0)close_ttyd_socket();
+	}
+	MUTEX_UNLOCK(ttyd_lock);
+	return 0;
+}
+
+// bind the configured gadget when its udc probes late or comes back
+static int process_udc(uevent*event){
+	char*name;
+	if(!event->devpath||!(name=strrchr(event->devpath,'/')))return 0;
+	switch(event->action){
+		case ACTION_ADD:case ACTION_CHANGE:case ACTION_BIND:
+			tlog_debug("udc '%s' %s",name+1,uevent_action2char(event->action));
+			gadget_udc_event(name+1,true);
+		break;
+		case ACTION_REMOVE:
+			tlog_debug("remove udc '%s'",name+1);
+			gadget_udc_event(name+1,false);
+		break;
+		default:break;
+	}
 	return 0;
 }
 
 int process_uevent(uevent*event){
 	if(!event)return -1;
 	if(event->subsystem){
-		if(strcmp(event->subsystem,"tty")==0)process_tty(event);
 		if(strcmp(event->subsystem,"firmware")==0)process_firmware_load(event);
 		if(strcmp(event->subsystem,"module")==0)process_module(event);
 	}
 	if(event->major>=0&&event->minor>=0)process_new_node(0,event);
+	if(event->subsystem&&strcmp(event->subsystem,"tty")==0)process_tty(event);
+	if(event->subsystem&&strcmp(event->subsystem,"udc")==0)process_udc(event);
+	blkindex_process(event);
 	if(event->modalias)insmod(event->modalias,false);
 	return 0;
 }
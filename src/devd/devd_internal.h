@@ -24,6 +24,10 @@ enum devd_oper{
 	DEV_INIT     =0xAD04,
 	DEV_MODALIAS =0xAD05,
 	DEV_MODLOAD  =0xAD06,
+	DEV_EVENT    =0xAD07,
+	DEV_TAG_FIND =0xAD08,
+	DEV_TAG_VALUE=0xAD09,
+	DEV_MODPROBE =0xAD0A,
 };
 
 // devd message packet
@@ -51,8 +55,23 @@ extern int devd_internal_read_msg(int fd,struct devd_msg*buff);
 // src/devd/internal.c: send a string devd packet
 extern int devd_internal_send_msg_string(int fd,enum devd_oper oper,char*data);
 
-// src/devd/netlink.c: kobject uevent netlink listen thread
-extern int uevent_netlink_thread(void);
+// src/devd/netlink.c: open kobject uevent netlink socket
+extern int uevent_netlink_open(void);
+
+// src/devd/netlink.c: drain uevents from netlink socket in batches
+extern int uevent_netlink_recv(int fd,void(*cb)(char*data,size_t len),bool*lost);
+
+// src/devd/netlink.c: rescan devices after lost uevents
+extern void uevent_rescan(void);
+
+// src/devd/pipeline.c: start uevent shards, handler runs on the shard thread
+extern int devd_pipeline_start(void(*handler)(void*data));
+
+// src/devd/pipeline.c: queue data to the shard of the DEVPATH in event
+extern int devd_pipeline_push(const char*event,size_t len,void*data);
+
+// src/devd/pipeline.c: drain and stop all uevent shards
+extern void devd_pipeline_stop(void);
 
 // src/devd/internal.c: send devd command
 extern int devd_command_with_data(enum devd_oper oper,void*data,size_t size);
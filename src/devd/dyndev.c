@@ -7,7 +7,10 @@
  */
 
 #define _GNU_SOURCE
+#include<stdio.h>
 #include<errno.h>
+#include<string.h>
+#include<limits.h>
 #include<unistd.h>
 #define TAG "devnoded"
 #include"devd.h"
@@ -6,8 +6,12 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<poll.h>
 #include<stdio.h>
 #include<fcntl.h>
+#include<dirent.h>
+#include<pthread.h>
 #include<errno.h>
 #include<string.h>
 #include<stdlib.h>
@@ -20,18 +24,177 @@
 #include"cmdline.h"
 #include"uevent.h"
 #include"logger.h"
+#include"system.h"
+#include"pool.h"
+#include"array.h"
+
+
+// copy buffer when sendfile does not work on the data node
+#define CHUNK_SIZE (64*1024)
+
+// firmware requests running at the same time
+#define FW_WORKERS 2
+
+/*
+ * all files of firmware_list collected on first use, highest folder wins.
+ * mounting vendor or modules partitions changes what exists, so the cache
+ * is dropped when /proc/self/mountinfo reports a change.
+ */
+struct fw_ent{
+	char*name;
+	int dir;
+};
+
+struct fw_req{
+	char*devpath,*firmware;
+};
+
+static struct fw_ent*fw_cache=NULL;
+static size_t fw_cnt=0,fw_size=0;
+static bool fw_built=false;
+static int mounts_fd=-1;
+static struct pool*fw_pool=NULL;
+static pthread_mutex_t fw_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_add(const char*name,int dir){
+	struct fw_ent*n;
+	if(fw_cnt>=fw_size){
+		size_t ns=fw_size?fw_size*2:256;
+		if(!(n=realloc(fw_cache,sizeof(struct fw_ent)*ns)))return;
+		fw_cache=n,fw_size=ns;
+	}
+	if(!(fw_cache[fw_cnt].name=strdup(name)))return;
+	fw_cache[fw_cnt++].dir=dir;
+}
+
+static void cache_walk(int fd,char*prefix,int dir,int depth){
+	DIR*d;
+	struct stat st;
+	struct dirent*e;
+	size_t pl=strlen(prefix);
+	if(!(d=fdopendir(fd))){
+		close(fd);
+		return;
+	}
+	while((e=readdir(d))){
+		if(is_virt_dir(e))continue;
+		if(pl+strlen(e->d_name)+2>=PATH_MAX)continue;
+		if(pl>0)strcat(prefix,"/");
+		strcat(prefix,e->d_name);
+
+		// firmware folders often use symlinks, follow them like access() did
+		if(fstatat(fd,e->d_name,&st,0)==0){
+			if(S_ISREG(st.st_mode))cache_add(prefix,dir);
+			else if(S_ISDIR(st.st_mode)&&depth<8){
+				int sub=openat(fd,e->d_name,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+				if(sub>=0)cache_walk(sub,prefix,dir,depth+1);
+			}
+		}
+		prefix[pl]=0;
+	}
+	closedir(d);
+}
+
+static int fw_cmp(const void*a,const void*b){
+	const struct fw_ent*x=a,*y=b;
+	int r=strcmp(x->name,y->name);
+	return r!=0?r:y->dir-x->dir;
+}
+
+static int fw_cmp_name(const void*a,const void*b){
+	return strcmp(((struct fw_ent*)a)->name,((struct fw_ent*)b)->name);
+}
+
+static void cache_free(){
+	for(size_t i=0;i<fw_cnt;i++)free(fw_cache[i].name);
+	if(fw_cache)free(fw_cache);
+	fw_cache=NULL,fw_cnt=0,fw_size=0,fw_built=false;
+}
+
+// caller holds fw_lock
+static void cache_check(){
+	char buf[4096];
+	struct pollfd p;
+	size_t u=0;
+	if(mounts_fd<0)mounts_fd=open(_PATH_PROC_SELF"/mountinfo",O_RDONLY|O_CLOEXEC);
+	if(mounts_fd>=0){
+		p.fd=mounts_fd,p.events=POLLPRI,p.revents=0;
+		if(poll(&p,1,0)>0&&(p.revents&(POLLPRI|POLLERR))&&fw_built){
+			tlog_debug("mounts changed, drop firmware cache");
+			cache_free();
+		}
+	}
+	if(fw_built)return;
+
+	// reading to the end clears the change notification
+	if(mounts_fd>=0){
+		lseek(mounts_fd,0,SEEK_SET);
+		while(read(mounts_fd,buf,sizeof(buf))>0);
+	}
+	fw_built=true;
+	for(int i=0;i<(int)ARRLEN(firmware_list);i++){
+		char prefix[PATH_MAX]={0};
+		int fd;
+		if(!firmware_list[i])continue;
+		if((fd=open(firmware_list[i],O_RDONLY|O_DIRECTORY|O_CLOEXEC))<0)continue;
+		cache_walk(fd,prefix,i,0);
+	}
+	if(fw_cnt>0){
+		qsort(fw_cache,fw_cnt,sizeof(struct fw_ent),fw_cmp);
+		for(size_t i=0;i<fw_cnt;i++)
+			if(u>0&&strcmp(fw_cache[u-1].name,fw_cache[i].name)==0)free(fw_cache[i].name);
+			else fw_cache[u++]=fw_cache[i];
+		fw_cnt=u;
+	}
+	tlog_debug("firmware cache has %zu files",fw_cnt);
+}
+
+static int write_all(int fd,const char*buf,size_t len){
+	ssize_t w;
+	while(len>0){
+		if((w=write(fd,buf,len))<0){
+			if(errno==EINTR)continue;
+			return -1;
+		}
+		buf+=w,len-=(size_t)w;
+	}
+	return 0;
+}
+
+static int copy_firmware(int ofd,int ifd,size_t size){
+	char buf[CHUNK_SIZE];
+	ssize_t r;
+	off_t off=0;
+	while((size_t)off<size){
+		if((r=sendfile(ofd,ifd,&off,size-(size_t)off))>0)continue;
+		if(r<0&&errno==EINTR)continue;
+		if(r==0||(errno!=ENOSYS&&errno!=EINVAL))return -1;
+
+		// no sendfile to this node, stream the rest in chunks
+		if(lseek(ifd,off,SEEK_SET)<0)return -1;
+		while((r=read(ifd,buf,sizeof(buf)))!=0){
+			if(r<0){
+				if(errno==EINTR)continue;
+				return -1;
+			}
+			if(write_all(ofd,buf,r)<0)return -1;
+		}
+		return 0;
+	}
+	return 0;
+}
 
 int write_firmware(int cfd,char*path,char*devpath){
 	if(cfd<0||!path||!devpath)ERET(EINVAL);
-	int ifd,ofd=-1,r;
+	int ifd=-1,ofd=-1,r;
 	char opath[PATH_MAX]={0};
 	struct stat st;
 	snprintf(opath,PATH_MAX-1,_PATH_SYS"%s/data",devpath);
-	if((ifd=open(path,O_RDONLY))<0){
+	if((ifd=open(path,O_RDONLY|O_CLOEXEC))<0){
 		r=terlog_error(-1,"open firmware %s for read",path);
 		goto ex;
 	}
-	if((ofd=open(opath,O_WRONLY|O_SYNC))<0){
+	if((ofd=open(opath,O_WRONLY|O_CLOEXEC))<0){
 		r=terlog_error(-1,"open %s for send firmware",devpath);
 		goto ex;
 	}
@@ -40,76 +203,83 @@ int write_firmware(int cfd,char*path,char*devpath){
 		goto ex;
 	}
 	write(cfd,"1\n",2);
-	if(st.st_size>0&&sendfile(ofd,ifd,0,st.st_size)!=st.st_size){
-		if(errno==ENOSYS){
-			void*data=malloc(st.st_size+1);
-			if(!data){
-				r=terlog_error(-2,"malloc firmware space %s failed",path);
-				goto ex;
-			}
-			if(read(ifd,data,st.st_size)!=st.st_size){
-				r=terlog_error(-2,"read firmware %s failed",path);
-				free(data);
-				goto ex;
-			}
-			if(write(ofd,data,st.st_size)!=st.st_size){
-				r=terlog_error(-2,"write firmware %s failed",path);
-				free(data);
-				goto ex;
-			}
-			free(data);
-		}else{
-			r=terlog_error(-2,"write firmware %s failed(sendfile)",path);
-			goto ex;
-		}
+	if(st.st_size>0&&copy_firmware(ofd,ifd,st.st_size)<0){
+		r=terlog_error(-1,"write firmware %s failed",path);
+		goto ex;
 	}
 	r=trlog_info(0,"sent firmware %s (%ld bytes)",path,st.st_size);
 	ex:
 	if(r==-1)write(cfd,"-1\n",3);
 	else write(cfd,"0\n",2);
-	if(ifd<0)close(ifd);
-	if(ofd<0)close(ofd);
-	if(cfd<0)close(cfd);
+	if(ifd>=0)close(ifd);
+	if(ofd>=0)close(ofd);
+	close(cfd);
 	return r;
 }
+
 char* search_firmware(char*firm,char*buff,size_t len){
 	if(!firm||!buff)EPRET(EINVAL);
-	for(int i=sizeof(firmware_list)/sizeof(char*)-1;i>=0;i--){
-		if(!(firmware_list[i]))continue;
+	struct fw_ent key={.name=firm},*e=NULL;
+	pthread_mutex_lock(&fw_lock);
+	cache_check();
+	if(fw_cnt>0)e=bsearch(&key,fw_cache,fw_cnt,sizeof(struct fw_ent),fw_cmp_name);
+	if(e&&firmware_list[e->dir]){
 		memset(buff,0,len);
-		snprintf(buff,len-1,"%s/%s",firmware_list[i],firm);
-		if(access(buff,R_OK)==0){
-			tlog_debug("found firmware at %s",buff);
-			errno=0;
-			return buff;
-		}
-		if(errno!=ENOENT)telog_warn("failed to access %s",buff);
+		snprintf(buff,len-1,"%s/%s",firmware_list[e->dir],e->name);
+	}
+	pthread_mutex_unlock(&fw_lock);
+	if(e){
+		tlog_debug("found firmware at %s",buff);
+		errno=0;
+		return buff;
 	}
 	telog_warn("firmware %s not found",firm);
 	EPRET(ENONET);
 }
 
+static void*firmware_thread(void*d){
+	int cfd;
+	struct fw_req*req=d;
+	char cpath[PATH_MAX],fpath[PATH_MAX];
+	memset(cpath,0,PATH_MAX);
+	snprintf(cpath,PATH_MAX-1,_PATH_SYS"%s/loading",req->devpath);
+	if((cfd=open(cpath,O_WRONLY|O_CLOEXEC))<0)telog_error("open %s for control",cpath);
+	else if(!search_firmware(req->firmware,fpath,PATH_MAX-1)){
+		write(cfd,"-1\n",3);
+		close(cfd);
+	}else write_firmware(cfd,fpath,req->devpath);
+	free(req->devpath);
+	free(req->firmware);
+	free(req);
+	return NULL;
+}
+
 int process_firmware_load(uevent*event){
 	if(
 		!event||
 		!event->devpath||
-		!event->environs||
 		!event->subsystem||
 		event->action!=ACTION_ADD||
 		strcmp(event->subsystem,"firmware")!=0
 	)return -1;
-	int cfd;
-	char*firm=kvarr_get(event->environs,"FIRMWARE",NULL);
-	char cpath[PATH_MAX],fpath[PATH_MAX];
-	if(!firm)return -1;
-	tlog_debug("kernel request firmware %s",firm);
-	memset(cpath,0,PATH_MAX);
-	snprintf(cpath,PATH_MAX-1,_PATH_SYS"%s/loading",event->devpath);
-	if((cfd=open(cpath,O_WRONLY|O_SYNC))<0)return terlog_error(-1,"open %s for control",cpath);
-	if(!search_firmware(firm,fpath,PATH_MAX-1)){
-		write(cfd,"-1\n",3);
-		close(cfd);
-		return -1;
-	}
-	return write_firmware(cfd,fpath,event->devpath);
+	struct fw_req*req;
+	if(!event->firmware)return -1;
+	tlog_debug("kernel request firmware %s",event->firmware);
+	if(!(req=malloc(sizeof(struct fw_req))))ERET(ENOMEM);
+	req->devpath=strdup(event->devpath);
+	req->firmware=strdup(event->firmware);
+	if(!req->devpath||!req->firmware)goto fail;
+
+	// large firmware takes a while, keep the uevent shard moving
+	pthread_mutex_lock(&fw_lock);
+	if(!fw_pool)fw_pool=pool_init(FW_WORKERS,256);
+	pthread_mutex_unlock(&fw_lock);
+	if(fw_pool&&pool_add(fw_pool,firmware_thread,req)==0)return 0;
+	firmware_thread(req);
+	return 0;
+	fail:
+	if(req->devpath)free(req->devpath);
+	if(req->firmware)free(req->firmware);
+	free(req);
+	ERET(ENOMEM);
 }
@@ -8,6 +8,9 @@
 
 #define _GNU_SOURCE
 #include<dirent.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<pthread.h>
 #include<unistd.h>
 #include<fcntl.h>
 #include<string.h>
@@ -16,64 +19,148 @@
 #include"system.h"
 #include"logger.h"
 #include"str.h"
+#include"pool.h"
 #define TAG "modalias"
 
-static int scan_modalias(int dir);
+// directories above this depth become pool jobs, deeper ones are walked inline
+#define SPLIT_DEPTH 4
 
-static int scan_modalias_dir(int dir,char*name){
-	if(!name||dir<0)return -1;
-	int f,e;
-	if((f=openat(dir,name,O_DIR))>=0){
-		e=scan_modalias(f);
-		close(f);
-	}else e=-errno;
-	return e;
+/*
+ * coldplug walks /sys/devices with a thread pool and only collects aliases,
+ * modules are inserted at the end by insmod_batch in depends order.
+ */
+struct walk{
+	struct pool*pool;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	size_t pending,cnt,size;
+	char**aliases;
+};
+
+struct walk_job{
+	struct walk*walk;
+	int dir,depth;
+};
+
+static void scan_modalias(struct walk*w,int dir,int depth);
+
+static void add_alias(struct walk*w,char*alias){
+	char**n,*a;
+	if(!alias[0]||!(a=strdup(alias)))return;
+	pthread_mutex_lock(&w->lock);
+	if(w->cnt>=w->size){
+		size_t ns=w->size?w->size*2:256;
+		if(!(n=realloc(w->aliases,sizeof(char*)*ns))){
+			pthread_mutex_unlock(&w->lock);
+			free(a);
+			return;
+		}
+		w->aliases=n,w->size=ns;
+	}
+	w->aliases[w->cnt++]=a;
+	pthread_mutex_unlock(&w->lock);
 }
 
-static int scan_modalias_file(int dir,char*name){
-	if(!name||dir<0)return -1;
-	int f,e;
-	char buff[PATH_MAX]={0};
-	if(strcmp(name,"modalias")!=0)return 0;
-	if((f=openat(dir,name,O_RDONLY))>=0){
-		ssize_t r=read(f,buff,PATH_MAX-1);
-		if(r>0){
-			trim(buff);
-			e=insmod(buff,false);
-		}else e=-errno;
-		close(f);
-	}else e=-errno;
-	return e;
+static void*scan_job(void*d){
+	struct walk_job*j=d;
+	struct walk*w=j->walk;
+	scan_modalias(w,j->dir,j->depth);
+	free(j);
+	pthread_mutex_lock(&w->lock);
+	if(--w->pending==0)pthread_cond_signal(&w->done);
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static bool queue_dir(struct walk*w,int dir,int depth){
+	struct walk_job*j;
+	if(!w->pool||depth>=SPLIT_DEPTH||!(j=malloc(sizeof(struct walk_job))))return false;
+	j->walk=w,j->dir=dir,j->depth=depth;
+	pthread_mutex_lock(&w->lock);
+	w->pending++;
+	pthread_mutex_unlock(&w->lock);
+	if(pool_add(w->pool,scan_job,j)==0)return true;
+	pthread_mutex_lock(&w->lock);
+	w->pending--;
+	pthread_mutex_unlock(&w->lock);
+	free(j);
+	return false;
+}
+
+static void scan_modalias_dir(struct walk*w,int dir,char*name,int depth){
+	int f;
+	if((f=openat(dir,name,O_DIR))<0)return;
+	if(!queue_dir(w,f,depth+1))scan_modalias(w,f,depth+1);
 }
 
-static int scan_modalias_dirent(int dir,struct dirent*r){
-	if(!r||dir<0)return -1;
-	if(is_virt_dir(r))return 0;
-	int e=0;
-	switch(r->d_type){
-		case DT_DIR:e+=scan_modalias_dir(dir,r->d_name);break;
-		case DT_REG:e+=scan_modalias_file(dir,r->d_name);break;
+static void scan_modalias_file(struct walk*w,int dir,char*name){
+	int f;
+	char buff[PATH_MAX]={0};
+	if(strcmp(name,"modalias")!=0)return;
+	if((f=openat(dir,name,O_RDONLY))<0)return;
+	if(read(f,buff,PATH_MAX-1)>0){
+		trim(buff);
+		add_alias(w,buff);
 	}
-	return e;
+	close(f);
 }
 
-static int scan_modalias(int dir){
+// takes over dir
+static void scan_modalias(struct walk*w,int dir,int depth){
+	struct dirent*r;
 	DIR*d=fdopendir(dir);
-	if(!d)goto er;
-	int e=0;
-	struct dirent*r=NULL;
-	while((r=readdir(d)))e+=scan_modalias_dirent(dir,r);
+	if(!d){
+		close(dir);
+		return;
+	}
+	while((r=readdir(d))){
+		if(is_virt_dir(r))continue;
+		switch(r->d_type){
+			case DT_DIR:scan_modalias_dir(w,dir,r->d_name,depth);break;
+			case DT_REG:scan_modalias_file(w,dir,r->d_name);break;
+		}
+	}
 	closedir(d);
-	return e;
-	er:
-	if(dir>=0)close(dir);
-	ERET(ENOMEM);
+}
+
+static int alias_cmp(const void*a,const void*b){
+	return strcmp(*(char**)a,*(char**)b);
 }
 
 int load_modalias(){
+	int r;
+	size_t u=0;
+	struct walk w;
+	memset(&w,0,sizeof(w));
 	int dfd=open(_PATH_SYS_DEVICES,O_DIR);
 	if(dfd<0)return -errno;
-	int r=scan_modalias(dfd);
-	close(dfd);
+
+	// start from what is loaded now, then every alias is looked up once
+	insmod_reset();
+	pthread_mutex_init(&w.lock,NULL);
+	pthread_cond_init(&w.done,NULL);
+
+	// own pool, this may run on a devd worker and must not wait on its own pool
+	w.pool=pool_init_cpus(65536);
+	scan_modalias(&w,dfd,0);
+	pthread_mutex_lock(&w.lock);
+	while(w.pending>0)pthread_cond_wait(&w.done,&w.lock);
+	pthread_mutex_unlock(&w.lock);
+	if(w.pool)pool_destroy(w.pool);
+
+	// many devices share one alias
+	if(w.cnt>0){
+		qsort(w.aliases,w.cnt,sizeof(char*),alias_cmp);
+		for(size_t i=0;i<w.cnt;i++){
+			if(u>0&&strcmp(w.aliases[u-1],w.aliases[i])==0)free(w.aliases[i]);
+			else w.aliases[u++]=w.aliases[i];
+		}
+	}
+	tlog_debug("found %zu unique modalias from %zu devices",u,w.cnt);
+	r=insmod_batch(w.aliases,u,false);
+	for(size_t i=0;i<u;i++)free(w.aliases[i]);
+	if(w.aliases)free(w.aliases);
+	pthread_mutex_destroy(&w.lock);
+	pthread_cond_destroy(&w.done);
 	return r;
 }
@@ -10,6 +10,7 @@
 #include<ctype.h>
 #include<dirent.h>
 #include<stdlib.h>
+#include<pthread.h>
 #include<string.h>
 #include"str.h"
 #include"devd.h"
@@ -30,13 +31,77 @@ static const char*path[]={
 	NULL
 };
 
-static void load_mod(const char*name,const char*mod){
+/*
+ * modules of all files are collected first and inserted with insmod_batch,
+ * which orders dependencies and softdeps by itself. a "#barrier" comment
+ * line makes every module above it load before the ones below it.
+ */
+struct mod_list{
+	char**names;
+	size_t cnt,size,group;
+	int depth;
+};
+
+static struct mod_list mods={NULL,0,0,0,0};
+static pthread_mutex_t mods_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static bool mod_eq(const char*a,const char*b){
+	for(;*a&&*b;a++,b++)if(
+		(*a=='-'?'_':*a)!=
+		(*b=='-'?'_':*b)
+	)return false;
+	return *a==*b;
+}
+
+static void add_mod(const char*name,const char*mod){
+	char**n;
+	for(size_t i=0;i<mods.cnt;i++)
+		if(mod_eq(mods.names[i],mod))return;
+	if(mods.cnt>=mods.size){
+		size_t ns=mods.size?mods.size*2:32;
+		if(!(n=realloc(mods.names,sizeof(char*)*ns)))return;
+		mods.names=n,mods.size=ns;
+	}
+	if(!(mods.names[mods.cnt]=strdup(mod)))return;
+	mods.cnt++;
 	tlog_debug("load %s from %s",mod,name);
-	if(insmod(mod,true)<0)
-		telog_warn("load %s failed",mod);
 }
 
-int mods_conf_parse_file(const char*name,const char*file){
+// insert every module collected since the last barrier
+static void load_group(){
+	size_t cnt=mods.cnt-mods.group;
+	if(cnt<=0)return;
+	if(insmod_batch(mods.names+mods.group,cnt,true)<0)
+		telog_warn("load modules failed");
+	mods.group=mods.cnt;
+}
+
+static void list_begin(){
+	pthread_mutex_lock(&mods_lock);
+	mods.depth++;
+}
+
+static void list_end(){
+	if(--mods.depth<=0){
+		load_group();
+		for(size_t i=0;i<mods.cnt;i++)free(mods.names[i]);
+		if(mods.names)free(mods.names);
+		memset(&mods,0,sizeof(mods));
+	}
+	pthread_mutex_unlock(&mods_lock);
+}
+
+static void read_comment(int fd){
+	char r,buf[64];
+	size_t idx=0;
+	while(read(fd,&r,1)==1&&r!='\r'&&r!='\n')
+		if(idx<sizeof(buf)-1)buf[idx++]=r;
+	buf[idx]=0;
+	trim(buf);
+	if(strcmp(buf,"barrier")==0)load_group();
+}
+
+static int parse_file(const char*name,const char*file){
 	if(!is_file(file)||!name)return -errno;
 	int fd=open(file,O_RDONLY);
 	if(fd<0)return telog_warn("open file %s failed",file);
@@ -45,18 +110,26 @@ int mods_conf_parse_file(const char*name,const char*file){
 	while(read(fd,&r,1)==1)if(isspace(r[0])){
 		if(idx<=0)continue;
 		buf[idx]=0,idx=0;
-		load_mod(name,buf);
-	}else if(r[0]=='#')skips(fd,"\r\n");
-	else buf[idx++]=r[0];
+		add_mod(name,buf);
+	}else if(r[0]=='#')read_comment(fd);
+	else if(idx<sizeof(buf)-1)buf[idx++]=r[0];
 	if(idx>0){
 		buf[idx]=0;
-		load_mod(name,buf);
+		add_mod(name,buf);
 	}
 	close(fd);
 	return 0;
 }
 
-int mods_conf_parse_folder(const char*dir){
+int mods_conf_parse_file(const char*name,const char*file){
+	int r;
+	list_begin();
+	r=parse_file(name,file);
+	list_end();
+	return r;
+}
+
+static int parse_folder(const char*dir){
 	if(!is_folder(dir))return -errno;
 	DIR*d=opendir(dir);
 	if(!d)return telog_warn("open folder %s failed",dir);
@@ -79,15 +152,25 @@ int mods_conf_parse_folder(const char*dir){
 			dir[ds-1]=='/'?"":"/",
 			e->d_name
 		);
-		mods_conf_parse_file(e->d_name,n);
+		parse_file(e->d_name,n);
 		free(n);
 	}
 	closedir(d);
 	return 0;
 }
 
+int mods_conf_parse_folder(const char*dir){
+	int r;
+	list_begin();
+	r=parse_folder(dir);
+	list_end();
+	return r;
+}
+
 int mods_conf_parse(){
+	list_begin();
 	for(int i=0;path[i];i++)
-		mods_conf_parse_folder(path[i]);
+		parse_folder(path[i]);
+	list_end();
 	return 0;
 }
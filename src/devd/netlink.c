@@ -6,95 +6,132 @@
  *
  */
 
+#define _GNU_SOURCE
 #include<errno.h>
+#include<fcntl.h>
 #include<stdio.h>
+#include<dirent.h>
 #include<stdlib.h>
 #include<string.h>
 #include<unistd.h>
-#include<sys/epoll.h>
-#include<sys/prctl.h>
 #include<sys/socket.h>
 #include<linux/netlink.h>
 #include"system.h"
 #include"logger.h"
+#include"defines.h"
 #include"pathnames.h"
-#include"proctitle.h"
+#include"ttyd.h"
 #include"devd_internal.h"
 #define TAG "kobject"
 
-static int init_hotplug_sock(){
-	int s;
+// kernel uevent socket receive buffer, large enough for hotplug bursts
+#define RCVBUF_SIZE (128*1024*1024)
+
+// messages per recvmmsg and size of one message
+#define RECV_BATCH 32
+#define UEVENT_SIZE 8192
+
+int uevent_netlink_open(){
+	int s,size=RCVBUF_SIZE;
 	struct sockaddr_nl n={
 		.nl_family=AF_NETLINK,
 		.nl_groups=1
 	};
-	n.nl_pid=getpid();
-	if((s=socket(AF_NETLINK,SOCK_DGRAM,NETLINK_KOBJECT_UEVENT))<0)
-		return terlog_error(-errno,"cannot create socket");
+	if((s=socket(
+		AF_NETLINK,
+		SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT
+	))<0)goto fail;
+
+	// FORCE passes rmem_max as root, otherwise take what the limit allows
+	if(
+		setsockopt(s,SOL_SOCKET,SO_RCVBUFFORCE,&size,sizeof(size))<0&&
+		setsockopt(s,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size))<0
+	)telog_warn("cannot set uevent socket receive buffer");
 	if(bind(s,(struct sockaddr*)&n,sizeof(n))<0){
 		telog_error("cannot bind netlink uevent socket");
 		close(s);
-		return -1;
+		goto fail;
 	}
+	tlog_info("kobject uevent receiver ready");
 	return s;
+	fail:
+	if(s<0)telog_error("cannot create socket");
+
+	// no netlink, let the kernel run the hotplug helper instead
+	simple_file_write(_PATH_PROC_SYS"/kernel/hotplug",_PATH_USR_BIN"/hotplug");
+	return -1;
 }
 
-int uevent_netlink_thread(){
-	static size_t es=sizeof(struct epoll_event),ms=sizeof(struct devd_msg);
-	close_all_fd(NULL,0);
-	open_socket_logfd_default();
-	tlog_info("kobject uevent forwarder start with pid %d",getpid());
-	setproctitle("uevent");
-	prctl(PR_SET_NAME,"UEvent Forward",0,0,0);
-	char buf[8192],*v;
-	size_t vs;
-	ssize_t s;
-	bool run=true;
-	struct devd_msg msg;
-	struct epoll_event ev,*evs=NULL;
-	int hs,ds=-1,efd=-1,e=-1,r;
-	if((hs=init_hotplug_sock())<0)goto fail;
-	if((ds=open_default_devd_socket(TAG))<0)goto fail;
-	if((efd=epoll_create(2))<0)return terlog_error(-errno,"epoll_create failed");
-	if(!(evs=malloc(es*2)))goto fail;
-	ev.events=EPOLLIN;
-	ev.data.fd=hs;epoll_ctl(efd,EPOLL_CTL_ADD,hs,&ev);
-	ev.data.fd=ds;epoll_ctl(efd,EPOLL_CTL_ADD,ds,&ev);
-	while(run){
-		e=-2;
-		r=epoll_wait(efd,evs,2,-1);
-		if(r==-1){
+int uevent_netlink_recv(int fd,void(*cb)(char*data,size_t len),bool*lost){
+	static char bufs[RECV_BATCH][UEVENT_SIZE];
+	struct mmsghdr msgs[RECV_BATCH];
+	struct sockaddr_nl addrs[RECV_BATCH];
+	struct iovec iovs[RECV_BATCH];
+	int n,cnt=0;
+	char*buf,*v;
+	size_t len;
+	if(fd<0||!cb)ERET(EINVAL);
+	for(;;){
+		memset(msgs,0,sizeof(msgs));
+		for(int i=0;i<RECV_BATCH;i++){
+			iovs[i].iov_base=bufs[i];
+			iovs[i].iov_len=UEVENT_SIZE-1;
+			msgs[i].msg_hdr.msg_iov=&iovs[i];
+			msgs[i].msg_hdr.msg_iovlen=1;
+			msgs[i].msg_hdr.msg_name=&addrs[i];
+			msgs[i].msg_hdr.msg_namelen=sizeof(struct sockaddr_nl);
+		}
+		if((n=recvmmsg(fd,msgs,RECV_BATCH,MSG_DONTWAIT,NULL))<0){
 			if(errno==EINTR)continue;
-			telog_error("epoll failed");
-			goto fail;
-		}else for(int i=0;i<r;i++){
-			int f=evs[i].data.fd;
-			if(f==hs){
-				memset(buf,0,8192);
-				if((s=recv(hs,&buf,8191,0))<0)break;
-				for(ssize_t x=0;x<s;x++)if(buf[x]==0)buf[x]='\n';
-				if(!(v=strchr(buf,'\n')))continue;
-				v++,vs=s-(v-(char*)buf)+1;
-				memset(&msg,0,ms);
-				devd_internal_send_msg(ds,DEV_ADD,v,vs);
-				do{if(devd_internal_read_msg(ds,&msg)<0)goto fail;}
-				while(msg.oper!=DEV_OK&&msg.oper!=DEV_FAIL);
-			}else if(f==ds){
-				if(devd_internal_read_msg(ds,&msg)<0)goto fail;
-				if(msg.size>0)lseek(ds,(size_t)msg.size,SEEK_CUR);
-				if(msg.oper==DEV_QUIT){
-					run=false;
-					break;
-				}
+
+			// the kernel dropped events, the socket keeps working after this
+			if(errno==ENOBUFS){
+				if(lost)*lost=true;
+				continue;
 			}
+			if(errno==EAGAIN)break;
+			return terlog_error(-errno,"receive uevent failed");
+		}
+		for(int i=0;i<n;i++){
+			buf=bufs[i],len=msgs[i].msg_len;
+
+			// only the kernel, not userspace multicast
+			if(addrs[i].nl_pid!=0||len<=0)continue;
+			if(msgs[i].msg_hdr.msg_flags&MSG_TRUNC)continue;
+			buf[len]=0;
+			for(size_t x=0;x<len;x++)if(buf[x]==0)buf[x]='\n';
+
+			// skip the action@devpath header
+			if(!(v=strchr(buf,'\n')))continue;
+			v++;
+			cb(v,len-(v-buf)+1);
+			cnt++;
 		}
+		if(n<RECV_BATCH)break;
 	}
-	e=0;
-	fail:
-	simple_file_write(_PATH_PROC_SYS"/kernel/hotplug",_PATH_USR_BIN"/hotplug");
-	if(hs>=0)close(hs);
-	if(ds>=0)close(ds);
-	if(efd>=0)close(efd);
-	if(evs)free(evs);
-	return e;
+	return cnt;
+}
+
+// only for devices that wait for userspace, ask the kernel to send them again
+static void retrigger(const char*dir){
+	DIR*d;
+	struct dirent*e;
+	char path[PATH_MAX];
+	if(!(d=opendir(dir)))return;
+	while((e=readdir(d))){
+		if(is_virt_dir(e))continue;
+		snprintf(path,sizeof(path)-1,"%s/%s/uevent",dir,e->d_name);
+		simple_file_write(path,"add");
+	}
+	closedir(d);
+}
+
+void uevent_rescan(){
+	tlog_notice("rescan devices after lost uevents");
+	if(init_devtmpfs(_PATH_DEV)<0)telog_warn("init_devtmpfs failed");
+	if(load_modalias()<0)telog_warn("load_modalias failed");
+	retrigger(_PATH_SYS_CLASS"/firmware");
+	check_open_default_ttyd_socket(false,TAG);
+	ttyd_reload();
 }
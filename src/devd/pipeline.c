@@ -0,0 +1,164 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<errno.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<sys/prctl.h>
+#include<sys/sysinfo.h>
+#include"devd_internal.h"
+#include"logger.h"
+#include"defines.h"
+#include"metrics.h"
+#define TAG "devd"
+
+// queued events of one shard before the reader has to wait
+#define SHARD_MAX 4096
+
+/*
+ * uevents are sharded by DEVPATH, every shard is one thread with a FIFO queue.
+ * events of one device always land in the same shard and keep their order,
+ * different devices are processed in parallel.
+ */
+struct shard_item{
+	void*data;
+	uint64_t queued_at;
+	struct shard_item*next;
+};
+
+struct shard{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t nempty,nfull;
+	struct shard_item*first,*last;
+	size_t cnt;
+	bool closed,started;
+};
+
+METRIC_HISTOGRAM(m_latency,"devd_event_seconds","time from reading a uevent until it is handled");
+METRIC_GAUGE(m_backlog,"devd_event_backlog","uevents queued in the pipeline shards");
+
+static struct shard*shards=NULL;
+static size_t shards_cnt=0;
+static void(*shard_handler)(void*data)=NULL;
+
+static void*shard_main(void*d){
+	struct shard*s=d;
+	struct shard_item*i;
+	prctl(PR_SET_NAME,"UEvent Shard",0,0,0);
+	for(;;){
+		pthread_mutex_lock(&s->lock);
+		while(!s->first&&!s->closed)pthread_cond_wait(&s->nempty,&s->lock);
+		if(!(i=s->first)){
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		if(!(s->first=i->next))s->last=NULL;
+		if(s->cnt--==SHARD_MAX)pthread_cond_signal(&s->nfull);
+		pthread_mutex_unlock(&s->lock);
+		metric_gauge_add(&m_backlog,-1);
+		shard_handler(i->data);
+		metric_observe(&m_latency,metric_now_us()-i->queued_at);
+		free(i);
+	}
+	return NULL;
+}
+
+// key is the DEVPATH value in a KEY=VALUE\n uevent buffer
+static uint32_t devpath_hash(const char*data,size_t len){
+	uint32_t h=0x811c9dc5;
+	const char*p=data,*end=data+len;
+	static const char key[]="DEVPATH=";
+	while(p&&p<end){
+		if((size_t)(end-p)>sizeof(key)-1&&memcmp(p,key,sizeof(key)-1)==0){
+			for(p+=sizeof(key)-1;p<end&&*p&&*p!='\n';p++)
+				h=(h^(unsigned char)*p)*0x01000193;
+			return h;
+		}
+		if((p=memchr(p,'\n',end-p)))p++;
+	}
+	return 0;
+}
+
+int devd_pipeline_start(void(*handler)(void*data)){
+	int r;
+	if(!handler)ERET(EINVAL);
+	if(shards)ERET(EEXIST);
+	shards_cnt=(size_t)MAX(1,get_nprocs());
+	if(!(shards=calloc(shards_cnt,sizeof(struct shard))))ERET(ENOMEM);
+	shard_handler=handler;
+	for(size_t i=0;i<shards_cnt;i++){
+		struct shard*s=&shards[i];
+		pthread_mutex_init(&s->lock,NULL);
+		pthread_cond_init(&s->nempty,NULL);
+		pthread_cond_init(&s->nfull,NULL);
+		if((r=pthread_create(&s->thread,NULL,shard_main,s))!=0){
+			telog_warn("create uevent shard %zu failed",i);
+			if(i==0){
+				free(shards);
+				shards=NULL;
+				ERET(r);
+			}
+			shards_cnt=i;
+			break;
+		}
+		s->started=true;
+	}
+	tlog_debug("uevent pipeline with %zu shards",shards_cnt);
+	return 0;
+}
+
+int devd_pipeline_push(const char*event,size_t len,void*data){
+	struct shard*s;
+	struct shard_item*i;
+	if(!shards)ERET(ENOTCONN);
+	if(!(i=malloc(sizeof(struct shard_item))))ERET(ENOMEM);
+	i->data=data,i->next=NULL;
+	i->queued_at=metric_now_us();
+	s=&shards[event?devpath_hash(event,len)%shards_cnt:0];
+	pthread_mutex_lock(&s->lock);
+	while(s->cnt>=SHARD_MAX&&!s->closed)pthread_cond_wait(&s->nfull,&s->lock);
+	if(s->closed){
+		pthread_mutex_unlock(&s->lock);
+		free(i);
+		ERET(ESHUTDOWN);
+	}
+	if(s->last)s->last->next=i;
+	else s->first=i;
+	s->last=i,s->cnt++;
+	metric_gauge_add(&m_backlog,1);
+	pthread_cond_signal(&s->nempty);
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+void devd_pipeline_stop(){
+	if(!shards)return;
+	for(size_t i=0;i<shards_cnt;i++){
+		struct shard*s=&shards[i];
+		pthread_mutex_lock(&s->lock);
+		s->closed=true;
+		pthread_cond_broadcast(&s->nempty);
+		pthread_cond_broadcast(&s->nfull);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	// shards drain what is queued before they exit
+	for(size_t i=0;i<shards_cnt;i++){
+		struct shard*s=&shards[i];
+		if(s->started)pthread_join(s->thread,NULL);
+		pthread_mutex_destroy(&s->lock);
+		pthread_cond_destroy(&s->nempty);
+		pthread_cond_destroy(&s->nfull);
+	}
+	free(shards);
+	shards=NULL,shards_cnt=0;
+}
@@ -25,6 +25,8 @@
 #include"devd.h"
 #include"init.h"
 #include"pool.h"
+#include"trace.h"
+#include"metrics.h"
 #define TAG "devd"
 
 static int devdfd=-1;
@@ -69,25 +71,80 @@ static void signal_handler(int s,siginfo_t *info,void*c __attribute__((unused)))
 
 static void process_add(char*data){
 	uevent event;
-	uevent_parse(data,&event);
-	process_uevent(&event);
-	kvarr_free(event.environs);
+	if(uevent_parse(data,&event))process_uevent(&event);
 }
 
 static struct pool*pool;
+static const char*oper2string(enum devd_oper oper){
+	switch(oper){
+		case DEV_OK:return "ok";
+		case DEV_FAIL:return "fail";
+		case DEV_QUIT:return "quit";
+		case DEV_ADD:return "add uevent";
+		case DEV_EVENT:return "stream uevent";
+		case DEV_TAG_FIND:return "find tag";
+		case DEV_TAG_VALUE:return "tag value";
+		case DEV_INIT:return "init devtmpfs";
+		case DEV_MODALIAS:return "load modalias";
+		case DEV_MODLOAD:return "load modules";
+		case DEV_MODPROBE:return "modprobe";
+		default:return "unknown";
+	}
+}
+
 struct save_data{
 	int fd;
 	struct devd_msg msg;
 	char*data;
 };
+// data of tag queries is NUL terminated strings, the reply carries the result
+static char*process_tag(struct save_data*s){
+	char*dev,*key;
+	size_t l;
+	if(!s->data||s->msg.size<=0||s->data[s->msg.size-1]!=0)return NULL;
+	if(s->msg.oper==DEV_TAG_FIND)return blkindex_find(s->data);
+	dev=s->data,l=strlen(dev)+1;
+	if(l>=s->msg.size)return NULL;
+	key=dev+l;
+	return blkindex_value(dev,key);
+}
+
+/*
+ * modprobe requests share the kmod contexts of coldplug, so the index
+ * files are parsed once for all callers. only root may load modules.
+ */
+static bool process_modprobe(struct save_data*s){
+	int r;
+	char**list;
+	size_t cnt=0,i=0;
+	struct ucred cred;
+	socklen_t len=sizeof(cred);
+	if(!s->data||s->msg.size<=0||s->data[s->msg.size-1]!=0)return false;
+	if(
+		getsockopt(s->fd,SOL_SOCKET,SO_PEERCRED,&cred,&len)<0||
+		len!=sizeof(cred)||cred.uid!=0
+	)return false;
+	for(size_t o=0;o<s->msg.size;o++)if(!s->data[o])cnt++;
+	if(!(list=malloc(sizeof(char*)*cnt)))return false;
+	for(size_t o=0;o<s->msg.size;o+=strlen(s->data+o)+1)list[i++]=s->data+o;
+	if((r=modprobe_batch(list,cnt,true))<0)
+		tlog_debug("modprobe of %zu aliases failed: %s",cnt,strerror(-r));
+	free(list);
+	return r>=0;
+}
+
 static void*process_thread(void*d){
 	if(!d)EPRET(EINVAL);
+	char*reply=NULL;
+	enum devd_oper ret=DEV_OK;
 	struct save_data*s=(struct save_data*)d;
+	const char*name=oper2string(s->msg.oper);
+	trace_begin("devd","%s",name);
 	switch(s->msg.oper){
 		case DEV_OK:case DEV_FAIL:break;
 
 		// process kobject uevent
-		case DEV_ADD:
+		case DEV_ADD:case DEV_EVENT:
 			if(s->data)process_add(s->data);
 		break;
 
@@ -108,17 +165,67 @@ static void*process_thread(void*d){
 			mods_conf_parse();
 		break;
 
+		// insert modules of aliases for the modprobe command
+		case DEV_MODPROBE:
+			if(!process_modprobe(s))ret=DEV_FAIL;
+		break;
+
+		// resolve tags from block index
+		case DEV_TAG_FIND:case DEV_TAG_VALUE:
+			if(!(reply=process_tag(s)))ret=DEV_FAIL;
+		break;
+
 		// terminate devd
 		case DEV_QUIT:run=false;break;
 	}
+	trace_end("devd","%s",name);
 	if(s->data)free(s->data);
-	devd_internal_send_msg(s->fd,DEV_OK,NULL,0);
+
+	// streamed uevents from the netlink forwarder take no reply
+	if(s->msg.oper!=DEV_EVENT)devd_internal_send_msg(
+		s->fd,ret,reply,reply?strlen(reply)+1:0
+	);
+	if(reply)free(reply);
 	free(s);
 	return NULL;
 }
 
-static int _start_uevent_thread(void*d __attribute__((unused))){
-	return uevent_netlink_thread();
+static void process_shard(void*d){
+	process_thread(d);
+}
+
+// uevents go to their device shard, other requests run on the pool
+static void dispatch(struct save_data*d){
+	switch(d->msg.oper){
+		case DEV_ADD:case DEV_EVENT:
+			if(devd_pipeline_push(d->data,d->msg.size,d)==0)return;
+		break;
+		default:;
+	}
+	pool_add(pool,process_thread,d);
+}
+
+static void*blkindex_thread(void*d __attribute__((unused))){
+	blkindex_scan();
+	return NULL;
+}
+
+static void*rescan_thread(void*d __attribute__((unused))){
+	uevent_rescan();
+	return NULL;
+}
+
+// netlink events are streamed to the shards like DEV_EVENT, without reply
+static void netlink_event(char*data,size_t len){
+	struct save_data*d;
+	if(!(d=calloc(1,sizeof(struct save_data))))return;
+	if(!(d->data=malloc(len))){
+		free(d);
+		return;
+	}
+	memcpy(d->data,data,len);
+	d->fd=-1,d->msg.oper=DEV_EVENT,d->msg.size=len;
+	dispatch(d);
 }
 
 static void ctl_fd(int efd,int oper,int fd){
@@ -133,13 +240,14 @@ static int devd_thread(int cfd){
 		ss=sizeof(struct save_data),
 		ds=sizeof(struct devd_msg),
 		es=sizeof(struct epoll_event);
-	int e=0,r,fd,efd;
+	int e=0,r,fd,efd,nfd;
+	bool lost;
 	struct epoll_event*evs;
 	open_socket_logfd_default();
 	open_default_confd_socket(false,TAG);
 	if((fd=listen_devd_socket())<0)return fd;
 	tlog_info("devd start with pid %d",getpid());
-	fork_run("netlink",false,NULL,NULL,_start_uevent_thread);
+	metrics_serve("devd");
 	signal(SIGCHLD,SIG_IGN);
 	handle_signals((int[]){SIGUSR1,SIGUSR2,SIGCHLD},3,SIG_IGN);
 	action_signals((int[]){SIGINT,SIGHUP,SIGTERM,SIGQUIT},4,signal_handler);
@@ -155,9 +263,15 @@ static int devd_thread(int cfd){
 		e=-errno;
 		goto ex;
 	}
+	if(devd_pipeline_start(process_shard)<0)
+		telog_warn("start uevent pipeline failed, uevents run unordered");
+
+	// devices present before devd get their tag links too
+	pool_add(pool,blkindex_thread,NULL);
 	setproctitle("initdevd");
 	prctl(PR_SET_NAME,"Device Daemon",0,0,0);
 	ctl_fd(efd,EPOLL_CTL_ADD,fd);
+	if((nfd=uevent_netlink_open())>=0)ctl_fd(efd,EPOLL_CTL_ADD,nfd);
 	if(cfd>=0){
 		devd_internal_send_msg(cfd,DEV_OK,NULL,0);
 		close(cfd);
@@ -171,7 +285,17 @@ static int devd_thread(int cfd){
 			goto ex;
 		}else for(int i=0;i<r;i++){
 			int f=evs[i].data.fd;
-			if(f==fd){
+			if(f==nfd){
+				lost=false;
+				if(uevent_netlink_recv(nfd,netlink_event,&lost)<0){
+					ctl_fd(efd,EPOLL_CTL_DEL,nfd);
+					nfd=-1;
+				}
+				if(lost){
+					tlog_warn("uevent socket overflow, events lost");
+					pool_add(pool,rescan_thread,NULL);
+				}
+			}else if(f==fd){
 				int n=accept(f,NULL,NULL);
 				if(n<0)continue;
 				fcntl(n,F_SETFL,O_RDWR|O_NONBLOCK);
@@ -204,12 +328,14 @@ static int devd_thread(int cfd){
 					break;
 				}else{
 					d->fd=f;
-					pool_add(pool,process_thread,d);
+					dispatch(d);
 				}
 			}
 		}
 	}
 	ex:
+	devd_pipeline_stop();
+	if(nfd>=0)close(nfd);
 	if(efd>=0)close(efd);
 	if(evs)free(evs);
 	devd_cleanup(0);
@@ -11,6 +11,7 @@
 #include"str.h"
 #include"uevent.h"
 #include"array.h"
+#include"defines.h"
 
 const char *uevent_actions[]={
 	[ACTION_ADD]     = "add",
@@ -34,30 +35,88 @@ const char*uevent_action2char(enum uevent_action act){
 	return uevent_actions[act<0||act>=ARRLEN(uevent_actions)?ACTION_UNKNOWN:act];
 }
 
+char*uevent_next(uevent*data,size_t*iter){
+	char*e;
+	if(!data||!iter)return NULL;
+	if(data->envs){
+		while((e=data->envs[*iter])){
+			++*iter;
+			if(*e)return e;
+		}
+		return NULL;
+	}
+	while(data->buf&&*iter<data->len){
+		e=data->buf+*iter;
+		*iter+=strlen(e)+1;
+		if(*e)return e;
+	}
+	return NULL;
+}
+
+char*uevent_get(uevent*data,const char*key){
+	char*e;
+	size_t iter=0,kl;
+	if(!data||!key)return NULL;
+	kl=strlen(key);
+	while((e=uevent_next(data,&iter)))
+		if(strncmp(e,key,kl)==0&&e[kl]=='=')return e+kl+1;
+	return NULL;
+}
+
+#define KEY(_name)(kl==sizeof(_name)-1&&memcmp(e,_name,kl)==0)
+
+// well known keys by length, so most entries are one compare
+static void fill_key(uevent*data,char*e,size_t kl,char*v){
+	switch(kl){
+		case 5:
+			if(KEY("MAJOR"))data->major=parse_int(v,-1);
+			else if(KEY("MINOR"))data->minor=parse_int(v,-1);
+		break;
+		case 6:if(KEY("ACTION"))data->action=uevent_chars2action(v);
+		else if(KEY("DRIVER"))data->driver=v;
+		else if(KEY("SEQNUM"))data->seqnum=parse_long(v,-1);
+		break;
+		case 7:
+			if(KEY("DEVPATH"))data->devpath=v;
+			else if(KEY("DEVNAME"))data->devname=v;
+			else if(KEY("DEVTYPE"))data->devtype=v;
+		break;
+		case 8:
+			if(KEY("MODALIAS"))data->modalias=v;
+			else if(KEY("FIRMWARE"))data->firmware=v;
+		break;
+		case 9:if(KEY("SUBSYSTEM"))data->subsystem=v;break;
+	}
+}
+
 uevent*uevent_fill_summary(uevent*data){
-	if(!data||!data->environs)return NULL;
-	keyval**kvs=data->environs;
-	data->action=uevent_chars2action(kvarr_get(kvs,"ACTION",NULL));
-	data->devpath=kvarr_get(kvs,"DEVPATH",NULL);
-	data->subsystem=kvarr_get(kvs,"SUBSYSTEM",NULL);
-	data->major=parse_int(kvarr_get(kvs,"MAJOR",NULL),-1);
-	data->minor=parse_int(kvarr_get(kvs,"MINOR",NULL),-1);
-	data->devname=kvarr_get(kvs,"DEVNAME",NULL);
-	data->devtype=kvarr_get(kvs,"DEVTYPE",NULL);
-	data->driver=kvarr_get(kvs,"DRIVER",NULL);
-	data->modalias=kvarr_get(kvs,"MODALIAS",NULL);
-	data->seqnum=parse_long(kvarr_get(kvs,"SEQNUM",NULL),-1);
+	char*e,*v;
+	size_t iter=0;
+	if(!data||(!data->buf&&!data->envs))return NULL;
+	data->action=ACTION_UNKNOWN;
+	data->devpath=NULL,data->subsystem=NULL;
+	data->major=-1,data->minor=-1;
+	data->devname=NULL,data->devtype=NULL;
+	data->driver=NULL,data->modalias=NULL;
+	data->firmware=NULL,data->seqnum=-1;
+	while((e=uevent_next(data,&iter)))
+		if((v=strchr(e,'=')))fill_key(data,e,v-e,v+1);
 	return data;
 }
 
 uevent*uevent_parse_x(char**envs,uevent*data){
 	if(!envs||!data)return NULL;
-	if(!(data->environs=kvarr_new_parse_arr(envs,'=')))return NULL;
+	memset(data,0,sizeof(uevent));
+	data->envs=envs;
 	return uevent_fill_summary(data);
 }
 
 uevent*uevent_parse(char*envs,uevent*data){
 	if(!envs||!data)return NULL;
-	if(!(data->environs=kvarr_new_parse(envs,'\n','=')))return NULL;
+	memset(data,0,sizeof(uevent));
+	data->buf=envs,data->len=strlen(envs);
+
+	// split entries in place, the buffer must live as long as the event
+	for(size_t i=0;i<data->len;i++)if(envs[i]=='\n')envs[i]=0;
 	return uevent_fill_summary(data);
 }
@@ -0,0 +1,206 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<time.h>
+#include"fs_internal.h"
+
+/*
+ * complete folder listings, shared by every handle opened on the same url.
+ * an entry lives for the cache_info_time of the driver, writes and renames
+ * going through this layer drop the folder and its parent at once.
+ */
+#define DIR_CACHE_MAX 16
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define STORE(v,n) __atomic_store_n(&(v),(n),__ATOMIC_RELEASE)
+
+mutex_t dir_cache_lock;
+static struct dir_cache*dir_caches=NULL;
+static size_t dir_caches_cnt=0;
+
+static char*dir_cache_key(const char*url){
+	char*key;
+	size_t len;
+	if(!url||!(key=strdup(url)))return NULL;
+
+	// keep the slash right after the authority, "file:///" is a folder
+	len=strlen(key);
+	while(len>0&&key[len-1]=='/'&&!(len>=3&&strncmp(key+len-3,":///",3)==0))
+		key[--len]=0;
+	return key;
+}
+
+static void dir_cache_unlink(struct dir_cache*c){
+	if(!c->cached)return;
+	if(c->prev)c->prev->next=c->next;
+	else dir_caches=c->next;
+	if(c->next)c->next->prev=c->prev;
+	c->prev=c->next=NULL;
+	c->cached=false;
+	dir_caches_cnt--;
+}
+
+static void dir_cache_free(struct dir_cache*c){
+	if(c->key)free(c->key);
+	if(c->infos)free(c->infos);
+	free(c);
+}
+
+// caller holds dir_cache_lock
+static void dir_cache_drop(struct dir_cache*c){
+	dir_cache_unlink(c);
+	c->gone=true;
+	if(c->refs<=0)dir_cache_free(c);
+}
+
+void dir_cache_put(struct dir_cache*c){
+	if(!c)return;
+	MUTEX_LOCK(dir_cache_lock);
+	c->refs--;
+	if(c->gone&&c->refs<=0)dir_cache_free(c);
+	MUTEX_UNLOCK(dir_cache_lock);
+}
+
+static void dir_cache_remove(const char*key){
+	struct dir_cache*c;
+	for(c=dir_caches;c;c=c->next)if(strcmp(c->key,key)==0){
+		dir_cache_drop(c);
+		break;
+	}
+}
+
+void dir_cache_invalidate(const char*url){
+	char*key,*path,*p;
+	if(!url||!LOAD(dir_caches))return;
+	if(!(key=dir_cache_key(url)))return;
+	MUTEX_LOCK(dir_cache_lock);
+	dir_cache_remove(key);
+
+	// the parent lists this one, cut the last component but not the root
+	if(
+		(path=strstr(key,"://"))&&(path=strchr(path+3,'/'))&&
+		path[1]&&(p=strrchr(path,'/'))
+	){
+		p[p==path?1:0]=0;
+		dir_cache_remove(key);
+	}
+	MUTEX_UNLOCK(dir_cache_lock);
+	free(key);
+}
+
+void dir_cache_clean(){
+	MUTEX_LOCK(dir_cache_lock);
+	while(dir_caches)dir_cache_drop(dir_caches);
+	MUTEX_UNLOCK(dir_cache_lock);
+}
+
+static int dir_cache_fill(
+	const fsdrv*drv,
+	const fsdrv*use,
+	fsh*f,
+	struct dir_cache*c
+){
+	int r;
+	size_t size=0;
+	fs_file_info*n;
+	for(;;){
+		if(c->cnt>=size){
+			size=size?size*2:64;
+			if(!(n=realloc(c->infos,sizeof(fs_file_info)*size)))RET(ENOMEM);
+			c->infos=n;
+		}
+		memset(&c->infos[c->cnt],0,sizeof(fs_file_info));
+		if((r=use->readdir(drv,f,&c->infos[c->cnt]))!=0)break;
+		c->cnt++;
+	}
+	RET(r==EOF?0:r);
+}
+
+static struct dir_cache*dir_cache_get(fsh*f,int*err){
+	time_t t;
+	char*key=NULL;
+	struct dir_cache*c,*last;
+	const fsdrv*drv=f->driver,*use=drv,*seek=drv;
+	while(use&&!use->readdir)use=use->base;
+	while(seek&&!seek->seek)seek=seek->base;
+	if(!use||!use->readdir){
+		*err=ENOSYS;
+		return NULL;
+	}
+	t=time(NULL);
+	if(use->cache_info_time>0&&(key=dir_cache_key(f->url))){
+		MUTEX_LOCK(dir_cache_lock);
+		for(c=dir_caches;c;c=c->next){
+			if(strcmp(c->key,key)!=0)continue;
+			if(t-c->time>=use->cache_info_time){
+				dir_cache_drop(c);
+				break;
+			}
+
+			// most recently used first, eviction takes the tail
+			if(c->prev){
+				dir_cache_unlink(c);
+				c->cached=true,dir_caches_cnt++;
+				c->next=dir_caches,dir_caches->prev=c;
+				STORE(dir_caches,c);
+			}
+			c->refs++;
+			MUTEX_UNLOCK(dir_cache_lock);
+			free(key);
+			return c;
+		}
+		MUTEX_UNLOCK(dir_cache_lock);
+	}
+	if(!(c=malloc(sizeof(struct dir_cache)))){
+		if(key)free(key);
+		*err=ENOMEM;
+		return NULL;
+	}
+	memset(c,0,sizeof(struct dir_cache));
+	c->key=key,c->time=t,c->refs=1;
+
+	// a listing that does not start at the top is only good for this handle
+	if(!seek||!seek->seek||seek->seek(drv,f,0,SEEK_SET)!=0)
+		if(c->key)free(c->key),c->key=NULL;
+	if((*err=dir_cache_fill(drv,use,f,c))!=0){
+		dir_cache_free(c);
+		return NULL;
+	}
+	if(!c->key)return c;
+	MUTEX_LOCK(dir_cache_lock);
+	dir_cache_remove(c->key);
+	if(dir_caches_cnt>=DIR_CACHE_MAX){
+		for(last=dir_caches;last->next;last=last->next);
+		dir_cache_drop(last);
+	}
+	c->next=dir_caches,c->cached=true,c->refs++;
+	if(dir_caches)dir_caches->prev=c;
+	STORE(dir_caches,c);
+	dir_caches_cnt++;
+	MUTEX_UNLOCK(dir_cache_lock);
+	return c;
+}
+
+int fs_readdir_batch_locked(fsh*f,fs_file_info*infos,size_t max,size_t*cnt){
+	int r=0;
+	size_t i;
+	if(!fsh_check(f))RET(EBADF);
+	if(!infos||!cnt||max<=0)RET(EINVAL);
+	if(!fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(ENOTDIR);
+	*cnt=0;
+	if(!f->dir){
+		if(!(f->dir=dir_cache_get(f,&r)))RET(r);
+		f->dir_pos=0;
+	}
+	if(f->dir_pos>=f->dir->cnt)RET(EOF);
+	for(i=0;i<max&&f->dir_pos<f->dir->cnt;i++,f->dir_pos++){
+		memcpy(&infos[i],&f->dir->infos[f->dir_pos],sizeof(fs_file_info));
+		infos[i].parent=f;
+	}
+	*cnt=i;
+	RET(0);
+}
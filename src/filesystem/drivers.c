@@ -21,6 +21,7 @@ extern void fsvol_register_mount(bool deinit);
 list*fs_drivers=NULL;
 list*fs_volumes;
 list*fs_volume_infos;
+uint64_t fsvol_generation=0;
 mutex_t fsdrv_lock;
 mutex_t fsvol_lock;
 mutex_t fsvol_info_lock;
@@ -18,8 +18,35 @@
 #include"str.h"
 #define TAG "fs"
 #define FS_BUF_SIZE 4096
+#define FS_BUFFER_SIZE 0x10000
 #define fsh_new(drv,uri,data,flag)\
 	fsh_get_new(drv,uri,(void**)&(data),sizeof(*(data)),flag)
+// FILE_FLAG_BUFFERED state, read-ahead data or pending writes, never both
+struct fsh_buffer{
+	char*data;
+	size_t size,pos,len;
+	bool dirty;
+};
+// complete listing of one folder, see dircache.c
+struct dir_cache{
+	char*key;
+	fs_file_info*infos;
+	size_t cnt;
+	time_t time;
+	int refs;
+	bool cached,gone;
+	struct dir_cache*prev,*next;
+};
+extern mutex_t dir_cache_lock;
+
+// src/filesystem/dircache.c: drop a reference taken by fs_readdir_batch
+extern void dir_cache_put(struct dir_cache*c);
+
+// src/filesystem/dircache.c: forget the listing of url and of its parent
+extern void dir_cache_invalidate(const char*url);
+
+// src/filesystem/dircache.c: forget all listings
+extern void dir_cache_clean();
 #define RET(e) return (errno=(e))
 #define DONE(e) {(errno=(e));goto done;}
 #define XRET(e,d) return (errno=((e)?:(d)))
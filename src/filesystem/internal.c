@@ -6,11 +6,35 @@
  *
  */
 
+#include<ctype.h>
 #include"str.h"
 #include"fs_internal.h"
 
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define STORE(v,n) __atomic_store_n(&(v),(n),__ATOMIC_RELEASE)
+
 static bool fsdrv_initialized=false;
 
+/*
+ * scheme to driver hash, rebuilt under fsdrv_lock on every registration and
+ * published by pointer swap, lookups read it without any lock. replaced
+ * tables stay alive until deinit since a reader may still walk them,
+ * drivers are only registered a few times at startup.
+ */
+struct fsdrv_slot{
+	const fsdrv*drv;
+	size_t pos;
+	uint32_t hash;
+};
+
+struct fsdrv_table{
+	size_t size,custom_cnt;
+	struct fsdrv_slot*slots,*custom;
+	struct fsdrv_table*next;
+};
+
+static struct fsdrv_table*fsdrv_table=NULL,*fsdrv_tables=NULL;
+
 bool fs_file_info_check(fs_file_info*f){
 	if(!f)return false;
 	if(memcmp(
@@ -79,7 +103,12 @@ void fsh_free(fsh**h){
 	if(!h||!*h)return;
 	if((*h)->uri)url_free((*h)->uri);
 	if((*h)->url)free((*h)->url);
+	if((*h)->dir)dir_cache_put((*h)->dir);
 	if((*h)->data)free((*h)->data);
+	if((*h)->buffer){
+		if((*h)->buffer->data)free((*h)->buffer->data);
+		free((*h)->buffer);
+	}
 	list_free_all_def((*h)->on_close);
 	MUTEX_DESTROY((*h)->lock);
 	memset((*h),0,sizeof(fsh));
@@ -137,6 +166,7 @@ void fsdrv_initialize(){
 		MUTEX_INIT(fsdrv_lock);
 		MUTEX_INIT(fsvol_lock);
 		MUTEX_INIT(fsvol_info_lock);
+		MUTEX_INIT(dir_cache_lock);
 	}
 	run=true;
 	if(!fsdrv_initialized){
@@ -155,14 +185,101 @@ __attribute__((destructor)) void fsdrv_deinitialize(){
 		list_free_all_def(fs_drivers);
 		fs_drivers=NULL;
 	}
+	dir_cache_clean();
+	STORE(fsdrv_table,NULL);
+	for(struct fsdrv_table*t=fsdrv_tables,*n;t;t=n){
+		n=t->next;
+		free(t->slots);
+		free(t);
+	}
+	fsdrv_tables=NULL;
 	MUTEX_UNLOCK(fsdrv_lock);
 }
 
+static uint32_t proto_hash(const char*name){
+	uint32_t h=2166136261u;
+	while(*name)h=(h^(unsigned char)tolower(*name++))*16777619u;
+	return h;
+}
+
+// drivers with an own is_compatible keep their place in the list order
+static bool fsdrv_is_custom(const fsdrv*d){
+	return d->is_compatible&&d->is_compatible!=fsdrv_template.is_compatible;
+}
+
+// caller holds fsdrv_lock
+static void fsdrv_table_rebuild(){
+	list*l;
+	uint32_t h;
+	size_t cnt=0,size=16,pos=0,s;
+	struct fsdrv_table*t;
+	if((l=list_first(fs_drivers)))do{cnt++;}while((l=l->next));
+	while(size<cnt*2)size*=2;
+	if(!(t=malloc(sizeof(struct fsdrv_table))))goto fail;
+	memset(t,0,sizeof(struct fsdrv_table));
+	if(!(t->slots=malloc(sizeof(struct fsdrv_slot)*(size+cnt)))){
+		free(t);
+		goto fail;
+	}
+	memset(t->slots,0,sizeof(struct fsdrv_slot)*(size+cnt));
+	t->size=size,t->custom=t->slots+size;
+	if((l=list_first(fs_drivers)))do{
+		LIST_DATA_DECLARE(d,l,fsdrv*);
+		pos++;
+		if(!fsdrv_check(d))continue;
+		if(fsdrv_is_custom(d)){
+			t->custom[t->custom_cnt].drv=d;
+			t->custom[t->custom_cnt++].pos=pos;
+			continue;
+		}
+		if(!d->protocol[0])continue;
+		h=proto_hash(d->protocol);
+		for(s=h&(size-1);t->slots[s].drv;s=(s+1)&(size-1))
+			if(t->slots[s].hash==h&&strcasecmp(t->slots[s].drv->protocol,d->protocol)==0)break;
+		if(t->slots[s].drv)continue;
+		t->slots[s].drv=d,t->slots[s].pos=pos,t->slots[s].hash=h;
+	}while((l=l->next));
+	t->next=fsdrv_tables,fsdrv_tables=t;
+	STORE(fsdrv_table,t);
+	return;
+
+	// without a table lookups fall back to walking the list
+	fail:STORE(fsdrv_table,NULL);
+}
+
+static const struct fsdrv_slot*fsdrv_table_find(struct fsdrv_table*t,const char*name){
+	uint32_t h=proto_hash(name);
+	for(size_t s=h&(t->size-1);t->slots[s].drv;s=(s+1)&(t->size-1))
+		if(t->slots[s].hash==h&&strcasecmp(t->slots[s].drv->protocol,name)==0)
+			return &t->slots[s];
+	return NULL;
+}
+
+static const fsdrv*fsdrv_table_lookup(struct fsdrv_table*t,url*u){
+	size_t i=0;
+	const struct fsdrv_slot*s=u->scheme?fsdrv_table_find(t,u->scheme):NULL;
+	for(;i<t->custom_cnt;i++){
+		if(s&&t->custom[i].pos>s->pos)break;
+		if(t->custom[i].drv->is_compatible(t->custom[i].drv,u))return t->custom[i].drv;
+	}
+	if(s)return s->drv;
+	for(;i<t->custom_cnt;i++)
+		if(t->custom[i].drv->is_compatible(t->custom[i].drv,u))return t->custom[i].drv;
+	return NULL;
+}
+
 const fsdrv*fsdrv_lookup(url*u){
 	list*l;
+	const fsdrv*d;
 	fs_drv_is_compatible h;
+	struct fsdrv_table*t;
 	if(!u)EPRET(EINVAL);
 	fsdrv_initialize();
+	if((t=LOAD(fsdrv_table))){
+		if(!(d=fsdrv_table_lookup(t,u)))EPRET(ENOENT);
+		errno=0;
+		return d;
+	}
 	MUTEX_LOCK(fsdrv_lock);
 	if((l=list_first(fs_drivers)))do{
 		LIST_DATA_DECLARE(d,l,fsdrv*);
@@ -184,8 +301,11 @@ static bool fsdrv_proto_cmp(list*l,void*d){
 
 const fsdrv*fsdrv_lookup_by_protocol(const char*name){
 	list*l;
+	struct fsdrv_table*t;
+	const struct fsdrv_slot*s;
 	if(!name)EPRET(EINVAL);
 	fsdrv_initialize();
+	if((t=LOAD(fsdrv_table))&&(s=fsdrv_table_find(t,name)))return s->drv;
 	MUTEX_LOCK(fsdrv_lock);
 	l=list_search_one(
 		fs_drivers,
@@ -207,6 +327,7 @@ int fsdrv_register(fsdrv*drv){
 	int r=list_obj_add_new(
 		&fs_drivers,drv
 	);
+	if(r==0)fsdrv_table_rebuild();
 	MUTEX_UNLOCK(fsdrv_lock);
 	if(r!=0)EXRET(ENOMEM);
 	RET(0);
@@ -222,6 +343,7 @@ int fsdrv_register_dup(fsdrv*drv){
 	int r=list_obj_add_new_dup(
 		&fs_drivers,drv,sizeof(fsdrv)
 	);
+	if(r==0)fsdrv_table_rebuild();
 	MUTEX_UNLOCK(fsdrv_lock);
 	if(r!=0)EXRET(ENOMEM);
 	RET(0);
@@ -267,6 +389,7 @@ void fsvol_info_delete(fsvol_private_info*info){
 	if(!info)return;
 	MUTEX_LOCK(fsvol_info_lock);
 	list_obj_del_data(&fs_volume_infos,info,NULL);
+	fsvol_generation++;
 	MUTEX_UNLOCK(fsvol_info_lock);
 	fsvol_info_free(info);
 }
@@ -277,6 +400,7 @@ int fsvol_add_volume(fsvol_private_info*info){
 	int r=list_obj_add_new(
 		&fs_volume_infos,info
 	);
+	if(r==0)fsvol_generation++;
 	MUTEX_UNLOCK(fsvol_info_lock);
 	if(r!=0)EXRET(ENOMEM);
 	RET(0);
@@ -289,6 +413,7 @@ int fsvol_add_volume_dup(fsvol_private_info*info){
 		&fs_volume_infos,info,
 		sizeof(fsvol_private_info)
 	);
+	if(r==0)fsvol_generation++;
 	MUTEX_UNLOCK(fsvol_info_lock);
 	if(r!=0)EXRET(ENOMEM);
 	RET(0);
@@ -73,6 +73,12 @@ static bool assets_dir_to_file_info(
 	);
 }
 
+static void fsdrv_close(const fsdrv*drv,fsh*f){
+	struct fsd*d;
+	if(!f||!drv||drv!=f->driver||!(d=f->data))return;
+	if(d->type==FS_TYPE_FILE_REG&&d->file)asset_file_release(d->file);
+}
+
 static int fsdrv_open(
 	const fsdrv*drv,
 	fsh*nf,
@@ -109,6 +115,9 @@ static int fsdrv_open(
 		if(!(nd->file=get_assets_file(
 			dir,path
 		)))EXRET(ENOENT);
+
+		// decoded contents must outlive the handle
+		asset_file_hold(nd->file);
 	}
 	nd->info=&nd->file->info;
 	RET(0);
@@ -134,7 +143,8 @@ static int fsdrv_read(
 	if(!d->file->content)RET(EFAULT);
 	if(d->pos>d->file->length)RET(0);
 	size_t ms=MIN(btr,d->file->length-d->pos);
-	memcpy(buffer,d->file->content,ms);
+	memcpy(buffer,d->file->content+d->pos,ms);
+	d->pos+=ms;
 	if(br)*br=ms;
 	RET(0);
 }
@@ -209,17 +219,19 @@ static int fsdrv_map(
 ){
 	struct fsd*d;
 	if(!f||!(d=f->data))RET(EINVAL);
-	if(!buffer||!*size)RET(EINVAL);
+	if(!buffer||!size)RET(EINVAL);
 	if(!drv||f->driver!=drv)RET(EINVAL);
 	if(fs_has_flag(flag,FILE_FLAG_WRITE))RET(EROFS);
-	if(!(fs_has_flag(f->flags,FILE_FLAG_FOLDER)))RET(ENOTDIR);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
 	if(d->type!=FS_TYPE_FILE_REG)RET(EISDIR);
-	if(*size==0&&fs_get_size(f,size)!=0)EXRET(EINVAL);
-	if(!d->file||*size==0)RET(EBADF);
-	if(off+*size>=d->file->length)RET(EFAULT);
+	if(!d->file)RET(EBADF);
+	if(off>d->file->length)RET(EFAULT);
+	if(*size==0)*size=d->file->length-off;
+	if(off+*size>d->file->length)RET(EFAULT);
 	if(!d->file->content)RET(EFAULT);
+
+	// contents live in the rootfs image, nothing to copy
 	*buffer=d->file->content+off;
-	*size=d->file->length;
 	RET(0);
 }
 
@@ -230,12 +242,15 @@ static int fsdrv_unmap(
 	size_t size
 ){
 	struct fsd*d;
-	if(!f||!(d=f->data)||size<=0)RET(EINVAL);
+	if(!f||!(d=f->data))RET(EINVAL);
 	if(!drv||f->driver!=drv)RET(EINVAL);
-	if(!(fs_has_flag(f->flags,FILE_FLAG_FOLDER)))RET(ENOTDIR);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
 	if(d->type!=FS_TYPE_FILE_REG)RET(EISDIR);
-	if(!d->file)RET(EBADF);
-	if(buffer!=d->file->content)RET(EFAULT);
+	if(!d->file||!d->file->content)RET(EBADF);
+	if(
+		(char*)buffer<(char*)d->file->content||
+		(char*)buffer+size>(char*)d->file->content+d->file->length
+	)RET(EFAULT);
 	RET(0);
 }
 
@@ -334,6 +349,7 @@ static fsdrv fsdrv_assets={
 		FS_FEATURE_HAVE_PATH|
 		FS_FEATURE_HAVE_TIME|
 		FS_FEATURE_HAVE_FOLDER,
+	.close=fsdrv_close,
 	.open=fsdrv_open,
 	.read=fsdrv_read,
 	.readdir=fsdrv_readdir,
@@ -17,14 +17,36 @@ struct mem_data{
 	size_t pos;
 };
 
+// small reads are served from one request of this size
+#define DEFAULT_READAHEAD 0x40000
+
+// large reads are split into ranges fetched on parallel connections
+#define DEFAULT_CHUNK 0x400000
+#define DEFAULT_PARALLEL 4
+
 struct curl_ctx{
 	char*path;
 	CURL*hand;
 	size_t pos;
 	size_t size;
 	bool have_size;
+	bool no_ranges;
+	char*ra;
+	size_t ra_off,ra_len;
+	size_t readahead,chunk;
+	int parallel;
+};
+
+struct range_job{
+	CURL*hand;
+	struct mem_data md;
+	bool active;
 };
 
+// connections, dns and tls sessions are kept across handles
+static CURLSH*share=NULL;
+static mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
 static size_t mem_write_cb(
 	void*cont,
 	size_t size,
@@ -163,6 +185,39 @@ static int curl_code_to_errno(CURLcode code){
 	}
 }
 
+static void share_lock(
+	CURL*hand __attribute__((unused)),
+	curl_lock_data data,
+	curl_lock_access access __attribute__((unused)),
+	void*user __attribute__((unused))
+){
+	if(data<CURL_LOCK_DATA_LAST)MUTEX_LOCK(share_locks[data]);
+}
+
+static void share_unlock(
+	CURL*hand __attribute__((unused)),
+	curl_lock_data data,
+	void*user __attribute__((unused))
+){
+	if(data<CURL_LOCK_DATA_LAST)MUTEX_UNLOCK(share_locks[data]);
+}
+
+static void share_init(){
+	for(int i=0;i<CURL_LOCK_DATA_LAST;i++)MUTEX_INIT(share_locks[i]);
+	if(!(share=curl_share_init()))return;
+	curl_share_setopt(share,CURLSHOPT_LOCKFUNC,share_lock);
+	curl_share_setopt(share,CURLSHOPT_UNLOCKFUNC,share_unlock);
+	curl_share_setopt(share,CURLSHOPT_SHARE,CURL_LOCK_DATA_CONNECT);
+	curl_share_setopt(share,CURLSHOPT_SHARE,CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share,CURLSHOPT_SHARE,CURL_LOCK_DATA_SSL_SESSION);
+}
+
+static void share_cleanup(){
+	if(share)curl_share_cleanup(share);
+	share=NULL;
+	for(int i=0;i<CURL_LOCK_DATA_LAST;i++)MUTEX_DESTROY(share_locks[i]);
+}
+
 static void update_info(struct curl_ctx*ctx){
 	CURLcode c;
 	off_t len=0;
@@ -190,9 +245,13 @@ static int fsdrv_open(
 	if(!drv||!nf||!uri||!(ctx=nf->data))RET(EINVAL);
 	if(!(ctx->hand=curl_easy_init()))DONE(ENOMEM);
 	if(!(ctx->path=url_generate_alloc(uri)))DONE(ENOMEM);
+	ctx->readahead=DEFAULT_READAHEAD;
+	ctx->chunk=DEFAULT_CHUNK,ctx->parallel=DEFAULT_PARALLEL;
 	curl_easy_setopt(ctx->hand,CURLOPT_URL,ctx->path);
 	curl_easy_setopt(ctx->hand,CURLOPT_NOBODY,1L);
 	curl_easy_setopt(ctx->hand,CURLOPT_FOLLOWLOCATION,1L);
+	curl_easy_setopt(ctx->hand,CURLOPT_TCP_KEEPALIVE,1L);
+	if(share)curl_easy_setopt(ctx->hand,CURLOPT_SHARE,share);
 	if((c=curl_easy_perform(ctx->hand))!=CURLE_OK){
 		tlog_warn("request %s for info failed",ctx->path);
 		DONE(curl_code_to_errno(c));
@@ -205,13 +264,13 @@ static int fsdrv_open(
 	XRET(e,EIO);
 }
 
-static void set_range(struct curl_ctx*ctx,size_t size){
+static void set_range(CURL*hand,size_t start,size_t size){
 	char range[64];
 	snprintf(
 		range,sizeof(range),"%zu-%zu",
-		ctx->pos,ctx->pos+size-1
+		start,start+size-1
 	);
-	curl_easy_setopt(ctx->hand,CURLOPT_RANGE,range);
+	curl_easy_setopt(hand,CURLOPT_RANGE,range);
 }
 
 static int proc_return(
@@ -246,6 +305,114 @@ static int proc_return(
 	RET(0);
 }
 
+static void set_download(CURL*hand,struct mem_data*md){
+	curl_easy_setopt(hand,CURLOPT_NOBODY,0L);
+	curl_easy_setopt(hand,CURLOPT_UPLOAD,0L);
+	curl_easy_setopt(hand,CURLOPT_READFUNCTION,NULL);
+	curl_easy_setopt(hand,CURLOPT_WRITEFUNCTION,mem_write_cb);
+	curl_easy_setopt(hand,CURLOPT_READDATA,NULL);
+	curl_easy_setopt(hand,CURLOPT_WRITEDATA,md);
+}
+
+// one range request at ctx->pos, position moves by what arrived
+static int get_range(struct curl_ctx*ctx,void*buffer,size_t size,size_t*got){
+	CURLcode c;
+	struct mem_data md;
+	md.buffer=buffer,md.size=size;
+	md.pos=0,md.allocate=false;
+	set_download(ctx->hand,&md);
+	set_range(ctx->hand,ctx->pos,size);
+	c=curl_easy_perform(ctx->hand);
+	*got=md.pos;
+	if(c!=CURLE_OK){
+		tlog_warn(
+			"read request %s failed: %s",
+			ctx->path,curl_easy_strerror(c)
+		);
+		RET(curl_code_to_errno(c));
+	}
+	return proc_return(ctx,&md,"read");
+}
+
+static bool start_job(
+	struct curl_ctx*ctx,
+	CURLM*multi,
+	struct range_job*j,
+	void*buffer,
+	size_t btr,
+	size_t*next
+){
+	size_t len;
+	if(*next>=btr)return false;
+	len=MIN(ctx->chunk,btr-*next);
+	j->md.buffer=buffer+*next,j->md.size=len;
+	j->md.pos=0,j->md.allocate=false;
+	set_range(j->hand,ctx->pos+*next,len);
+	if(curl_multi_add_handle(multi,j->hand)!=CURLM_OK)return false;
+	*next+=len,j->active=true;
+	return true;
+}
+
+// fetch btr bytes as chunks over several connections into buffer
+static int parallel_read(struct curl_ctx*ctx,void*buffer,size_t btr,size_t*br){
+	int run=0,left,r=0,cnt,active=0;
+	long code;
+	size_t next=0,got=0;
+	CURLcode res;
+	CURLM*multi;
+	CURLMsg*msg;
+	struct range_job*jobs,*j;
+	btr=MIN(btr,ctx->size-ctx->pos);
+	cnt=MIN((size_t)ctx->parallel,(btr+ctx->chunk-1)/ctx->chunk);
+	if(cnt<2)RET(EINVAL);
+	if(!(multi=curl_multi_init()))RET(ENOMEM);
+	if(!(jobs=malloc(sizeof(struct range_job)*cnt))){
+		curl_multi_cleanup(multi);
+		RET(ENOMEM);
+	}
+	memset(jobs,0,sizeof(struct range_job)*cnt);
+	set_download(ctx->hand,NULL);
+	for(int i=0;i<cnt;i++){
+		if(!(jobs[i].hand=curl_easy_duphandle(ctx->hand)))DONE(ENOMEM);
+		curl_easy_setopt(jobs[i].hand,CURLOPT_WRITEDATA,&jobs[i].md);
+	}
+	for(int i=0;i<cnt;i++)if(start_job(ctx,multi,&jobs[i],buffer,btr,&next))active++;
+	while(active>0&&r==0){
+		if(curl_multi_perform(multi,&run)!=CURLM_OK)DONE(EIO);
+		while((msg=curl_multi_info_read(multi,&left))){
+			if(msg->msg!=CURLMSG_DONE)continue;
+			for(j=jobs;j<jobs+cnt&&j->hand!=msg->easy_handle;j++);
+			if(j>=jobs+cnt)continue;
+			res=msg->data.result,code=0;
+			curl_easy_getinfo(j->hand,CURLINFO_RESPONSE_CODE,&code);
+			curl_multi_remove_handle(multi,j->hand);
+			j->active=false,active--;
+			if(r!=0)continue;
+
+			// a full reply means the server ignores ranges
+			if(code==200)r=ENOTSUP,ctx->no_ranges=true;
+			else if(res!=CURLE_OK)r=curl_code_to_errno(res);
+			else if(code!=206||j->md.pos!=j->md.size)r=EIO;
+			else{
+				got+=j->md.pos;
+				if(start_job(ctx,multi,j,buffer,btr,&next))active++;
+			}
+		}
+		if(active>0&&r==0)curl_multi_poll(multi,NULL,0,1000,NULL);
+	}
+	errno=r;
+	done:r=errno;
+	for(int i=0;i<cnt;i++){
+		if(jobs[i].active)curl_multi_remove_handle(multi,jobs[i].hand);
+		if(jobs[i].hand)curl_easy_cleanup(jobs[i].hand);
+	}
+	free(jobs);
+	curl_multi_cleanup(multi);
+	if(r==0)ctx->pos+=got,*br=got;
+	else tlog_debug("parallel read of %s failed: %s",ctx->path,strerror(r));
+	RET(r);
+}
+
 static int fsdrv_read(
 	const fsdrv*drv,
 	fsh*f,
@@ -253,32 +420,49 @@ static int fsdrv_read(
 	size_t btr,
 	size_t*br
 ){
-	CURLcode c;
+	int r;
+	size_t got=0,size,n;
 	struct curl_ctx*ctx;
-	struct mem_data md;
 	if(br)*br=0;
 	if(!drv||!f||!(ctx=f->data))RET(EINVAL);
-	if(!buffer||f->driver!=drv)RET(EINVAL);
+	if(!buffer||!br||f->driver!=drv)RET(EINVAL);
 	if(!fs_has_flag(f->flags,FILE_FLAG_READ))RET(EPERM);
 	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
-	md.buffer=buffer,md.size=btr;
-	md.pos=0,md.allocate=false;
-	curl_easy_setopt(ctx->hand,CURLOPT_NOBODY,0L);
-	curl_easy_setopt(ctx->hand,CURLOPT_READFUNCTION,NULL);
-	curl_easy_setopt(ctx->hand,CURLOPT_WRITEFUNCTION,mem_write_cb);
-	curl_easy_setopt(ctx->hand,CURLOPT_READDATA,NULL);
-	curl_easy_setopt(ctx->hand,CURLOPT_WRITEDATA,&md);
-	set_range(ctx,btr);
-	c=curl_easy_perform(ctx->hand);
-	if(br)*br=md.pos;
-	if(c!=CURLE_OK){
-		tlog_warn(
-			"read request %s failed: %s",
-			ctx->path,curl_easy_strerror(c)
-		);
-		RET(curl_code_to_errno(c));
+	if(btr==0)RET(0);
+	if(ctx->have_size&&ctx->pos>=ctx->size)RET(0);
+
+	// served from the read-ahead window
+	if(ctx->ra_len>0&&ctx->pos>=ctx->ra_off&&ctx->pos<ctx->ra_off+ctx->ra_len){
+		n=MIN(btr,ctx->ra_off+ctx->ra_len-ctx->pos);
+		memcpy(buffer,ctx->ra+(ctx->pos-ctx->ra_off),n);
+		ctx->pos+=n,*br=n;
+		RET(0);
 	}
-	return proc_return(ctx,&md,"read");
+	if(
+		ctx->have_size&&!ctx->no_ranges&&ctx->parallel>1&&
+		btr>=ctx->chunk*2&&parallel_read(ctx,buffer,btr,br)==0
+	)RET(0);
+	if(btr>=ctx->readahead||ctx->no_ranges){
+		r=get_range(ctx,buffer,btr,&got);
+		*br=got;
+		RET(r);
+	}
+	if(!ctx->ra&&!(ctx->ra=malloc(ctx->readahead)))RET(ENOMEM);
+	size=ctx->readahead;
+	if(ctx->have_size)size=MIN(size,ctx->size-ctx->pos);
+	ctx->ra_off=ctx->pos,ctx->ra_len=0;
+	if((r=get_range(ctx,ctx->ra,size,&got))!=0)RET(r);
+
+	// proc_return moved the position, the window starts where it was
+	if(ctx->pos!=ctx->ra_off+got){
+		ctx->no_ranges=true,ctx->pos=ctx->ra_off;
+		RET(ESPIPE);
+	}
+	ctx->ra_len=got,ctx->pos=ctx->ra_off;
+	n=MIN(btr,got);
+	memcpy(buffer,ctx->ra,n);
+	ctx->pos+=n,*br=n;
+	RET(0);
 }
 
 static int fsdrv_write(
@@ -296,14 +480,16 @@ static int fsdrv_write(
 	md.buffer=buffer,md.size=btw,md.pos=0,md.allocate=false;
 	if(!fs_has_flag(f->flags,FILE_FLAG_WRITE))RET(EPERM);
 	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+	ctx->ra_len=0;
 	curl_easy_setopt(ctx->hand,CURLOPT_NOBODY,0L);
 	curl_easy_setopt(ctx->hand,CURLOPT_UPLOAD,1L);
 	curl_easy_setopt(ctx->hand,CURLOPT_READFUNCTION,mem_read_cb);
 	curl_easy_setopt(ctx->hand,CURLOPT_WRITEFUNCTION,NULL);
 	curl_easy_setopt(ctx->hand,CURLOPT_READDATA,&md);
 	curl_easy_setopt(ctx->hand,CURLOPT_WRITEDATA,NULL);
-	set_range(ctx,btw);
+	set_range(ctx->hand,ctx->pos,btw);
 	c=curl_easy_perform(ctx->hand);
+	curl_easy_setopt(ctx->hand,CURLOPT_UPLOAD,0L);
 	if(bw)*bw=md.pos;
 	if(c!=CURLE_OK){
 		tlog_warn(
@@ -348,12 +534,38 @@ static int fsdrv_tell(const fsdrv*drv,fsh*f,size_t*pos){
 	return errno;
 }
 
+static int fsdrv_ioctl(const fsdrv*drv,fsh*f,fs_ioctl_id id,va_list args){
+	size_t v;
+	int p;
+	struct curl_ctx*ctx;
+	if(!f||!drv||f->driver!=drv)RET(EINVAL);
+	if(!(ctx=f->data))RET(EBADF);
+	switch(id){
+		case FS_IOCTL_CURL_SET_READAHEAD:
+			v=va_arg(args,size_t);
+			if(ctx->ra)free(ctx->ra);
+			ctx->ra=NULL,ctx->ra_len=0,ctx->readahead=v;
+		break;
+		case FS_IOCTL_CURL_SET_CHUNK:
+			if((v=va_arg(args,size_t))==0)RET(EINVAL);
+			ctx->chunk=v;
+		break;
+		case FS_IOCTL_CURL_SET_PARALLEL:
+			if((p=va_arg(args,int))<=0)RET(EINVAL);
+			ctx->parallel=p;
+		break;
+		default:RET(ENOTSUP);
+	}
+	RET(0);
+}
+
 static void fsdrv_close(const fsdrv*drv,fsh*f){
 	struct curl_ctx*ctx;
 	if(!f||!(ctx=f->data))return;
 	if(!drv||f->driver!=drv)return;
 	if(ctx->hand)curl_easy_cleanup(ctx->hand);
 	if(ctx->path)free(ctx->path);
+	if(ctx->ra)free(ctx->ra);
 }
 
 static fsdrv fsdrv_curl={
@@ -373,15 +585,19 @@ static fsdrv fsdrv_curl={
 	.read=fsdrv_read,
 	.write=fsdrv_write,
 	.get_size=fsdrv_get_size,
+	.ioctl=fsdrv_ioctl,
 };
 
 void fsdrv_register_curl(bool deinit){
 	errno=0;
 	fsdrv*drv=NULL;
 	curl_version_info_data*data=NULL;
-	if(deinit)curl_global_cleanup();
-	else{
+	if(deinit){
+		share_cleanup();
+		curl_global_cleanup();
+	}else{
 		curl_global_init(CURL_GLOBAL_ALL);
+		share_init();
 		if(!(data=curl_version_info(CURLVERSION_NOW)))return;
 		for(size_t i=0;data->protocols[i];i++){
 			if(!(drv=malloc(sizeof(fsdrv))))continue;
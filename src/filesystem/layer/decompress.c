@@ -0,0 +1,331 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include"str.h"
+#include"compress.h"
+#include"../fs_internal.h"
+
+/*
+ * overlay of a folder that hands out compressed files decoded,
+ * data comes from the base file as it is read, nothing is staged.
+ * going backwards restarts the stream, the size is known after one
+ * full pass and kept for the handle.
+ */
+#define DECOMP_BUF 0x10000
+
+struct decomp{
+	fsh*file;
+	compressor*comp;
+	compress_stream*stream;
+	unsigned char*inp;
+	size_t inp_pos,inp_len;
+	size_t pos,size;
+	bool sized;
+};
+
+static void decomp_free(struct decomp*d){
+	if(d->stream)compressor_decompress_finish(d->stream);
+	if(d->inp)free(d->inp);
+	d->stream=NULL,d->inp=NULL;
+}
+
+static int decomp_reset(struct decomp*d){
+	int r;
+	if(d->stream)compressor_decompress_finish(d->stream);
+	d->inp_pos=d->inp_len=d->pos=0;
+	if(!(d->stream=compressor_decompress_init(d->comp)))EXRET(ENOMEM);
+	if((r=fs_seek(d->file,0,SEEK_SET))!=0)RET(r);
+	RET(0);
+}
+
+static int decomp_read(struct decomp*d,void*buffer,size_t btr,size_t*br){
+	int r;
+	size_t done=0,used,len,n;
+	if(!d->stream)RET(EIO);
+	while(done<btr&&!compressor_decompress_is_end(d->stream)){
+		if(d->inp_pos>=d->inp_len){
+			d->inp_pos=d->inp_len=0,n=0;
+			if((r=fs_read(d->file,d->inp,DECOMP_BUF,&n))!=0)RET(r);
+			if(n==0){
+				// tell the stream, formats without an end mark stop here
+				if(compressor_decompress_update(
+					d->stream,NULL,0,
+					buffer+done,btr-done,&used,&len
+				)!=0)RET(EIO);
+				done+=len;
+				if(compressor_decompress_is_end(d->stream))continue;
+				if(done>0)break;
+				RET(EIO);
+			}
+			d->inp_len=n;
+		}
+		if(compressor_decompress_update(
+			d->stream,
+			d->inp+d->inp_pos,d->inp_len-d->inp_pos,
+			buffer+done,btr-done,&used,&len
+		)!=0)RET(EIO);
+		d->inp_pos+=used,done+=len;
+	}
+	d->pos+=done;
+	if(compressor_decompress_is_end(d->stream)&&!d->sized)
+		d->size=d->pos,d->sized=true;
+	if(br)*br=done;
+	RET(0);
+}
+
+// decode and drop until pos, stops early at the end of data
+static int decomp_skip(struct decomp*d,size_t pos){
+	int r=0;
+	void*tmp;
+	size_t len;
+	if(d->pos<pos&&!(tmp=malloc(DECOMP_BUF)))RET(ENOMEM);
+	if(d->pos<pos){
+		do{
+			len=MIN(pos-d->pos,(size_t)DECOMP_BUF);
+			if((r=decomp_read(d,tmp,len,&len))!=0)break;
+		}while(len>0&&d->pos<pos);
+		free(tmp);
+	}
+	RET(r);
+}
+
+static int decomp_size(struct decomp*d){
+	int r;
+	size_t pos=d->pos;
+	if(d->sized)RET(0);
+	if((r=decomp_skip(d,SIZE_MAX))!=0)RET(r);
+	if(!d->sized)RET(EIO);
+	if((r=decomp_reset(d))!=0)RET(r);
+	RET(decomp_skip(d,pos));
+}
+
+static void fsdrv_close(const fsdrv*drv,fsh*f){
+	struct decomp*d;
+	if(!f||!drv||drv!=f->driver||!(d=f->data))return;
+	decomp_free(d);
+	fs_close(&d->file);
+}
+
+static int fsdrv_open(
+	const fsdrv*drv,
+	fsh*nf,
+	url*uri,
+	fs_file_flag flags
+){
+	int r=0;
+	size_t len=0;
+	struct decomp*d;
+	unsigned char head[64];
+	if(!drv||!uri||!uri->path)RET(EINVAL);
+	if(uri->path[0]!='/'||!uri->path[1])RET(EINVAL);
+	if(fs_has_flag(flags,FILE_FLAG_WRITE))RET(EROFS);
+	if(!nf)RET(fs_open(drv->data,NULL,uri->path+1,flags));
+	if(!(d=nf->data))RET(EINVAL);
+	if((r=fs_open(drv->data,&d->file,uri->path+1,flags))!=0)RET(r);
+	if(fs_has_flag(flags,FILE_FLAG_FOLDER))RET(0);
+
+	// files that are not compressed pass through unchanged
+	if((r=fs_read(d->file,head,sizeof(head),&len))!=0)DONE(r);
+	if((r=fs_seek(d->file,0,SEEK_SET))!=0)DONE(r);
+	if(len<=0||!(d->comp=compressor_get_by_format(head,len)))RET(0);
+	if(!(d->inp=malloc(DECOMP_BUF)))DONE(ENOMEM);
+	if(!(d->stream=compressor_decompress_init(d->comp)))DONE(ENOTSUP);
+	RET(0);
+	done:
+	decomp_free(d);
+	fs_close(&d->file);
+	RET(r);
+}
+
+static int fsdrv_read(
+	const fsdrv*drv,fsh*f,
+	void*buffer,
+	size_t btr,
+	size_t*br
+){
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	if(!d->comp)RET(fs_read(d->file,buffer,btr,br));
+	RET(decomp_read(d,buffer,btr,br));
+}
+
+static int fsdrv_read_all(
+	const fsdrv*drv,
+	fsh*f,
+	void**buffer,
+	size_t*size
+){
+	int r;
+	void*buff=NULL,*b;
+	struct decomp*d;
+	size_t len=0,cnt,bs;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	if(!d->comp)RET(fs_read_all(d->file,buffer,size));
+	if(d->pos>0&&(r=decomp_reset(d))!=0)RET(r);
+
+	// grow with the data, the size is only known once it was decoded
+	bs=d->sized?d->size+1:DECOMP_BUF;
+	do{
+		if(len>=bs)bs*=2;
+		if(!(b=realloc(buff,bs))){
+			if(buff)free(buff);
+			RET(ENOMEM);
+		}
+		buff=b,cnt=0;
+		if((r=decomp_read(d,buff+len,bs-len,&cnt))!=0){
+			free(buff);
+			RET(r);
+		}
+		len+=cnt;
+	}while(cnt>0);
+	*buffer=buff;
+	if(size)*size=len;
+	RET(0);
+}
+
+static int fsdrv_readdir(
+	const fsdrv*drv,
+	fsh*f,
+	fs_file_info*info
+){
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	RET(fs_readdir(d->file,info));
+}
+
+static int fsdrv_seek(const fsdrv*drv,fsh*f,size_t pos,int whence){
+	int r;
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	if(!d->comp)RET(fs_seek(d->file,pos,whence));
+	switch(whence){
+		case SEEK_SET:break;
+		case SEEK_CUR:pos+=d->pos;break;
+		case SEEK_END:
+			if((r=decomp_size(d))!=0)RET(r);
+			pos+=d->size;
+		break;
+		default:RET(EINVAL);
+	}
+	if(pos<d->pos&&(r=decomp_reset(d))!=0)RET(r);
+	RET(decomp_skip(d,pos));
+}
+
+static int fsdrv_tell(const fsdrv*drv,fsh*f,size_t*pos){
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data)||!pos)RET(EINVAL);
+	if(!d->comp)RET(fs_tell(d->file,pos));
+	*pos=d->pos;
+	RET(0);
+}
+
+static int fsdrv_get_info(
+	const fsdrv*drv,
+	fsh*f,
+	fs_file_info*info
+){
+	int r;
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	if((r=fs_get_info(d->file,info))!=0)RET(r);
+	if(d->comp&&d->sized)info->size=d->size;
+	RET(0);
+}
+
+static int fsdrv_get_type(
+	const fsdrv*drv,
+	fsh*f,
+	fs_type*type
+){
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	RET(fs_get_type(d->file,type));
+}
+
+static int fsdrv_get_size(
+	const fsdrv*drv,
+	fsh*f,
+	size_t*out
+){
+	int r;
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data)||!out)RET(EINVAL);
+	if(!d->comp)RET(fs_get_size(d->file,out));
+	if((r=decomp_size(d))!=0)RET(r);
+	*out=d->size;
+	RET(0);
+}
+
+static int fsdrv_get_name(
+	const fsdrv*drv,
+	fsh*f,
+	char*buff,
+	size_t buff_len
+){
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	RET(fs_get_name(d->file,buff,buff_len));
+}
+
+static int fsdrv_get_features(
+	const fsdrv*drv,
+	fsh*f,
+	fs_feature*features
+){
+	int r;
+	struct decomp*d;
+	if(!f||!drv||f->driver!=drv||!(d=f->data))RET(EINVAL);
+	if((r=fs_get_features(d->file,features))!=0)RET(r);
+	if(d->comp)*features&=~FS_FEATURE_WRITABLE;
+	RET(0);
+}
+
+static fsdrv fsdrv_decompress={
+	.magic=FS_DRIVER_MAGIC,
+	.cache_info_time=0,
+	.readonly_fs=true,
+	.hand_data_size=sizeof(struct decomp),
+	.base=&fsdrv_template,
+	.close=fsdrv_close,
+	.open=fsdrv_open,
+	.read=fsdrv_read,
+	.read_all=fsdrv_read_all,
+	.readdir=fsdrv_readdir,
+	.seek=fsdrv_seek,
+	.tell=fsdrv_tell,
+	.get_info=fsdrv_get_info,
+	.get_type=fsdrv_get_type,
+	.get_size=fsdrv_get_size,
+	.get_name=fsdrv_get_name,
+	.get_features=fsdrv_get_features,
+};
+
+static void on_base_file_close(
+	const char*name,
+	fsh*f,
+	void*data
+){
+	fsdrv*d=data;
+	if(!d||!f||!name)return;
+	d->data=NULL;
+	memset(d->protocol,0,sizeof(d->protocol));
+}
+
+int fs_register_decompress(fsh*f,const char*name){
+	fsdrv*drv;
+	if(!fsh_check(f))RET(EBADF);
+	if(!name)RET(EINVAL);
+	if(fsdrv_lookup_by_protocol(name))RET(EEXIST);
+	if(!(drv=malloc(sizeof(fsdrv))))RET(ENOMEM);
+	memcpy(drv,&fsdrv_decompress,sizeof(fsdrv));
+	strncpy(drv->protocol,name,sizeof(drv->protocol)-1);
+	drv->features=f->driver->features;
+	fs_add_on_close(f,name,on_base_file_close,drv);
+	drv->data=f;
+	return fsdrv_register(drv);
+}
@@ -6,14 +6,44 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<poll.h>
+#include<fcntl.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<sys/uio.h>
 #include<sys/mman.h>
 #include<sys/stat.h>
+#include<sys/syscall.h>
+#include<sys/sendfile.h>
 #include<dirent.h>
+#if __has_include(<linux/io_uring.h>)&&defined(__NR_io_uring_setup)
+#include<linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
 #include"str.h"
 #include"system.h"
 #include"../fs_internal.h"
 
+// largest count linux moves in one copy call
+#define COPY_MAX 0x7ffff000
+
+// iovecs converted per readv or writev call
+#define IOV_BATCH 64
+
+// submission queue size of the shared ring
+#define RING_ENTRIES 64
+
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define STORE(v,n) __atomic_store_n(&(v),(n),__ATOMIC_RELEASE)
+
 static fsdrv fsdrv_posix;
+
+static size_t page_size(){
+	static size_t page=0;
+	if(page==0)page=sysconf(_SC_PAGESIZE);
+	return page;
+}
 struct fsd{
 	DIR*dir;
 	char name[256];
@@ -212,6 +242,281 @@ int fsdrv_posix_write(
 	RET(0);
 }
 
+static int fsdrv_copy_to(
+	const fsdrv*drv,
+	fsh*f,
+	int fd,
+	size_t size,
+	size_t*sent
+){
+	int mode=0;
+	ssize_t r=0;
+	size_t len;
+	if(!drv||!sent)RET(EINVAL);
+	if(!f||f->driver!=drv)RET(EINVAL);
+	if(f->fd<0)RET(EBADF);
+	*sent=0;
+	while(*sent<size){
+		errno=0,len=MIN(size-*sent,COPY_MAX);
+		switch(mode){
+			case 0:r=copy_file_range(f->fd,NULL,fd,NULL,len,0);break;
+			case 1:r=sendfile(fd,f->fd,NULL,len);break;
+			case 2:r=splice(f->fd,NULL,fd,NULL,len,SPLICE_F_MOVE);break;
+			default:RET(ENOSYS);
+		}
+
+		// this pair of fds cannot use the call, try the next one
+		if(r<0&&*sent==0&&(
+			errno==EXDEV||errno==EINVAL||errno==ENOSYS||
+			errno==EOPNOTSUPP||errno==EBADF
+		)){
+			mode++;
+			continue;
+		}
+		if(r<0){
+			if(errno==EINTR)continue;
+			EXRET(EIO);
+		}
+
+		// procfs and sysfs report no data to copy_file_range
+		if(r==0&&mode==0&&*sent==0){
+			mode++;
+			continue;
+		}
+		if(r==0)break;
+		*sent+=r;
+	}
+	RET(0);
+}
+
+static int posix_iov(
+	const fsdrv*drv,
+	fsh*f,
+	const fs_iovec*iov,
+	size_t cnt,
+	size_t*done,
+	bool write
+){
+	size_t n,want;
+	ssize_t r;
+	struct iovec v[IOV_BATCH];
+	if(!f||!drv||f->driver!=drv||!iov||!done)RET(EINVAL);
+	if(f->fd<0)RET(EBADF);
+	while(cnt>0){
+		n=MIN(cnt,(size_t)IOV_BATCH),want=0;
+		for(size_t i=0;i<n;i++){
+			v[i].iov_base=iov[i].buffer;
+			v[i].iov_len=iov[i].length;
+			want+=iov[i].length;
+		}
+		r=write?writev(f->fd,v,n):readv(f->fd,v,n);
+		if(r<0){
+			if(errno==EINTR)continue;
+			if(*done>0)break;
+			EXRET(EIO);
+		}
+		*done+=r;
+		if((size_t)r<want)break;
+		iov+=n,cnt-=n;
+	}
+	RET(0);
+}
+
+static int fsdrv_readv(
+	const fsdrv*drv,
+	fsh*f,
+	const fs_iovec*iov,
+	size_t cnt,
+	size_t*br
+){
+	return posix_iov(drv,f,iov,cnt,br,false);
+}
+
+static int fsdrv_writev(
+	const fsdrv*drv,
+	fsh*f,
+	const fs_iovec*iov,
+	size_t cnt,
+	size_t*bw
+){
+	return posix_iov(drv,f,iov,cnt,bw,true);
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * one ring shared by all handles, fs_submit queues a request and enters the
+ * kernel right away so that several reads overlap, fs_complete reaps every
+ * completion it finds and marks the owning request finished.
+ * when io_uring is not usable the generic layer runs requests synchronously.
+ */
+static struct{
+	int fd;
+	bool failed;
+	mutex_t lock;
+	unsigned entries,cq_entries,inflight;
+	unsigned*sq_head,*sq_tail,*sq_mask,*sq_array;
+	unsigned*cq_head,*cq_tail,*cq_mask;
+	struct io_uring_sqe*sqes;
+	struct io_uring_cqe*cqes;
+	void*sq_ptr,*cq_ptr;
+	size_t sq_len,cq_len,sqes_len;
+}ring={.fd=-1};
+
+static void ring_free(){
+	if(ring.sqes)munmap(ring.sqes,ring.sqes_len);
+	if(ring.cq_ptr&&ring.cq_ptr!=ring.sq_ptr)munmap(ring.cq_ptr,ring.cq_len);
+	if(ring.sq_ptr)munmap(ring.sq_ptr,ring.sq_len);
+	if(ring.fd>=0)close(ring.fd);
+	ring.sqes=NULL,ring.sq_ptr=ring.cq_ptr=NULL,ring.fd=-1;
+}
+
+// caller holds ring.lock
+static int ring_setup(){
+	char*sq,*cq;
+	struct io_uring_params p;
+	if(ring.fd>=0)RET(0);
+	if(ring.failed)RET(ENOTSUP);
+	memset(&p,0,sizeof(p));
+	if((ring.fd=syscall(__NR_io_uring_setup,RING_ENTRIES,&p))<0)goto fail;
+	ring.sq_len=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	ring.cq_len=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	ring.sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+	if(p.features&IORING_FEAT_SINGLE_MMAP)
+		ring.sq_len=ring.cq_len=MAX(ring.sq_len,ring.cq_len);
+	if((ring.sq_ptr=mmap(
+		NULL,ring.sq_len,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE,ring.fd,IORING_OFF_SQ_RING
+	))==MAP_FAILED){
+		ring.sq_ptr=NULL;
+		goto fail;
+	}
+	if(p.features&IORING_FEAT_SINGLE_MMAP)ring.cq_ptr=ring.sq_ptr;
+	else if((ring.cq_ptr=mmap(
+		NULL,ring.cq_len,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE,ring.fd,IORING_OFF_CQ_RING
+	))==MAP_FAILED){
+		ring.cq_ptr=NULL;
+		goto fail;
+	}
+	if((ring.sqes=mmap(
+		NULL,ring.sqes_len,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE,ring.fd,IORING_OFF_SQES
+	))==MAP_FAILED){
+		ring.sqes=NULL;
+		goto fail;
+	}
+	sq=ring.sq_ptr,cq=ring.cq_ptr;
+	ring.sq_head=(unsigned*)(sq+p.sq_off.head);
+	ring.sq_tail=(unsigned*)(sq+p.sq_off.tail);
+	ring.sq_mask=(unsigned*)(sq+p.sq_off.ring_mask);
+	ring.sq_array=(unsigned*)(sq+p.sq_off.array);
+	ring.cq_head=(unsigned*)(cq+p.cq_off.head);
+	ring.cq_tail=(unsigned*)(cq+p.cq_off.tail);
+	ring.cq_mask=(unsigned*)(cq+p.cq_off.ring_mask);
+	ring.cqes=(struct io_uring_cqe*)(cq+p.cq_off.cqes);
+	ring.entries=p.sq_entries,ring.cq_entries=p.cq_entries;
+	RET(0);
+	fail:
+	telog_debug("io_uring not available");
+	ring_free();
+	ring.failed=true;
+	RET(ENOTSUP);
+}
+
+// caller holds ring.lock
+static void ring_reap(){
+	fs_io*io;
+	struct io_uring_cqe*cqe;
+	unsigned head=*ring.cq_head,tail=LOAD(*ring.cq_tail);
+	while(head!=tail){
+		cqe=&ring.cqes[head&*ring.cq_mask];
+		if((io=(fs_io*)(uintptr_t)cqe->user_data)){
+			if(cqe->res<0)io->result=-cqe->res;
+			else io->done=cqe->res;
+			if(io->priv)free(io->priv);
+			io->priv=NULL;
+			STORE(io->finished,true);
+		}
+		head++,ring.inflight--;
+	}
+	STORE(*ring.cq_head,head);
+}
+
+// caller holds ring.lock, queued entries go to the kernel
+static void ring_enter(unsigned wait){
+	unsigned pending=*ring.sq_tail-LOAD(*ring.sq_head);
+	if(pending<=0&&wait<=0)return;
+	syscall(
+		__NR_io_uring_enter,ring.fd,pending,wait,
+		wait>0?IORING_ENTER_GETEVENTS:0,NULL,0
+	);
+}
+
+static int fsdrv_submit(const fsdrv*drv,fsh*f,fs_io*io){
+	int r=0;
+	unsigned tail,idx;
+	struct iovec*v=NULL;
+	struct io_uring_sqe*sqe;
+	if(!f||!drv||f->driver!=drv||!io)RET(EINVAL);
+	if(f->fd<0)RET(EBADF);
+	MUTEX_LOCK(ring.lock);
+	if((r=ring_setup())!=0)goto done;
+	ring_reap();
+
+	// a full ring or no memory just means this one runs synchronously
+	tail=*ring.sq_tail;
+	if(
+		ring.inflight>=ring.cq_entries||
+		tail-LOAD(*ring.sq_head)>=ring.entries||
+		!(v=malloc(sizeof(struct iovec)))
+	){
+		r=EAGAIN;
+		goto done;
+	}
+	v->iov_base=io->buffer,v->iov_len=io->size;
+	idx=tail&*ring.sq_mask;
+	sqe=&ring.sqes[idx];
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	sqe->opcode=io->op==FS_IO_WRITE?IORING_OP_WRITEV:IORING_OP_READV;
+	sqe->fd=f->fd,sqe->off=io->offset;
+	sqe->addr=(uintptr_t)v,sqe->len=1;
+	sqe->user_data=(uintptr_t)io;
+	io->priv=v;
+	ring.sq_array[idx]=idx;
+	STORE(*ring.sq_tail,tail+1);
+	ring.inflight++;
+	ring_enter(0);
+	done:
+	MUTEX_UNLOCK(ring.lock);
+	RET(r);
+}
+
+static int fsdrv_complete(const fsdrv*drv,fs_io*io,long timeout){
+	int slice;
+	long waited=0;
+	struct pollfd pfd;
+	if(!drv||!io)RET(EINVAL);
+	for(;;){
+		MUTEX_LOCK(ring.lock);
+		if(ring.fd>=0){
+			ring_enter(0);
+			ring_reap();
+		}
+		pfd.fd=ring.fd,pfd.events=POLLIN;
+		MUTEX_UNLOCK(ring.lock);
+		if(LOAD(io->finished))RET(0);
+		if(pfd.fd<0)RET(EINVAL);
+		if(timeout>=0&&waited>=timeout)RET(ETIMEDOUT);
+
+		// short slices, another waiter may reap our completion
+		slice=timeout<0?10:(int)MIN(10,timeout-waited);
+		if(poll(&pfd,1,slice)==0)waited+=slice;
+	}
+}
+
+#endif
+
 int fsdrv_posix_wait(
 	const fsdrv*drv,
 	fsh**gots,
@@ -303,6 +608,7 @@ static int fsdrv_map(
 ){
 	errno=0;
 	void*buf;
+	size_t fs=0,delta;
 	int protect=PROT_READ,flags=MAP_SHARED;
 	if(!drv||!buffer||!size)RET(EINVAL);
 	if(!f||f->driver!=drv)RET(EINVAL);
@@ -312,11 +618,18 @@ static int fsdrv_map(
 	if(fs_has_flag(flag,FILE_FLAG_SHARED))flags=MAP_SHARED;
 	if(fs_has_flag(flag,FILE_FLAG_PRIVATE))flags=MAP_PRIVATE;
 	if(fs_has_flag(flag,FILE_FLAG_FIXED))flags=MAP_FIXED;
-	if(*size==0&&fs_get_size(f,size)!=0)EXRET(EINVAL);
+	if(*size==0){
+		if(fs_get_size_locked(f,&fs)!=0)EXRET(EINVAL);
+		if(off>fs)RET(EFAULT);
+		*size=fs-off;
+	}
 	if(*size==0||f->fd<=0)RET(EBADF);
-	buf=mmap(NULL,*size,protect,flags,f->fd,off);
+
+	// mmap wants a page aligned offset, map from the page start
+	delta=off%page_size();
+	buf=mmap(NULL,*size+delta,protect,flags,f->fd,off-delta);
 	if(!buf||buf==MAP_FAILED)EXRET(EFAULT);
-	*buffer=buf;
+	*buffer=(char*)buf+delta;
 	RET(0);
 }
 
@@ -329,7 +642,8 @@ static int fsdrv_unmap(
 	errno=0;
 	if(!f||!drv||f->driver!=drv)RET(EINVAL);
 	if(!buffer||len<=0)RET(EINVAL);
-	if(munmap(buffer,len)!=0)EXRET(EIO);
+	size_t delta=(uintptr_t)buffer%page_size();
+	if(munmap((char*)buffer-delta,len+delta)!=0)EXRET(EIO);
 	RET(0);
 }
 
@@ -390,6 +704,16 @@ static int fsdrv_getcwd(
 }
 
 void fsdrv_register_posix(bool deinit){
+	#ifdef HAVE_IO_URING
+	if(deinit){
+		MUTEX_LOCK(ring.lock);
+		ring_free();
+		MUTEX_UNLOCK(ring.lock);
+		MUTEX_DESTROY(ring.lock);
+		return;
+	}
+	MUTEX_INIT(ring.lock);
+	#endif
 	if(!deinit)fsdrv_register_dup(&fsdrv_posix);
 }
 
@@ -417,6 +741,13 @@ static fsdrv fsdrv_posix={
 	.read=fsdrv_posix_read,
 	.readdir=fsdrv_readdir,
 	.write=fsdrv_posix_write,
+	.readv=fsdrv_readv,
+	.writev=fsdrv_writev,
+	#ifdef HAVE_IO_URING
+	.submit=fsdrv_submit,
+	.complete=fsdrv_complete,
+	#endif
+	.copy_to=fsdrv_copy_to,
 	.seek=fsdrv_seek,
 	.tell=fsdrv_tell,
 	.map=fsdrv_map,
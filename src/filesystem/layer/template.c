@@ -15,9 +15,15 @@ struct map_info{
 	fsh*hand;
 	size_t offset;
 	size_t size;
+	size_t refs;
+	struct map_info*next;
 	char data[];
 };
 
+/*
+ * generic map for drivers without a real one, the range is read into memory.
+ * read only maps of the same range on one handle share the copy.
+ */
 static int fsdrv_map(
 	const fsdrv*drv,
 	fsh*f,
@@ -27,8 +33,9 @@ static int fsdrv_map(
 	fs_file_flag flag
 ){
 	int e;
-	size_t bs=0,read=0,fs=0,lp=0;
+	size_t bs=0,fs=0,lp=0;
 	struct map_info*map=NULL;
+	bool write=false;
 	if(!fsh_check(f))RET(EBADF);
 	if(!drv||!f->driver||!buffer||!size)RET(EINVAL);
 	*buffer=NULL;
@@ -40,35 +47,44 @@ static int fsdrv_map(
 			"hand %p driver %p unsupported write",
 			f,f->driver
 		));
+		write=true;
 	}else if(!fs_has_flag(flag,FILE_FLAG_READ))goto done;
 	if((errno=fs_get_size_locked(f,&fs))!=0)
 		EDONE(telog_verbose("hand %p get file size for map failed",f));
-	if(*size==0)*size=fs;
-	else if(off+*size>fs)EDONE(telog_verbose(
-		"hand %p request map range out of file %zu",
+	if(off>fs)DONE(trlog_verbose(
+		EFAULT,"hand %p request map offset out of file %zu",
+		f,off
+	));
+	if(*size==0)*size=fs-off;
+	else if(off+*size>fs)DONE(trlog_verbose(
+		EFAULT,"hand %p request map range out of file %zu",
 		f,*size
 	));
+	if(!write)for(map=f->maps;map;map=map->next){
+		if(fs_has_flag(map->flag,FILE_FLAG_WRITE))continue;
+		if(map->offset!=off||map->size!=*size)continue;
+		map->refs++,*buffer=map->data;
+		RET(0);
+	}
 	bs=sizeof(struct map_info)+(*size)+1;
 	if(!(map=malloc(bs)))EDONE(telog_verbose(
 		"hand %p alloc buffer %zu bytes for map failed",
 		f,bs
 	));
+	memset(map,0,sizeof(struct map_info));
 	memcpy(map->magic,MAP_INFO_MAGIC,sizeof(map->magic));
-	map->hand=f,map->size=*size,map->flag=flag,map->offset=off;
-	if(!(errno=fs_tell_locked(f,&lp)))
+	map->hand=f,map->size=*size,map->flag=flag,map->offset=off,map->refs=1;
+	if((errno=fs_tell_locked(f,&lp))!=0)
 		EDONE(telog_verbose("hand %p tell for map failed",f));
-	if(!(errno=fs_seek_locked(f,off,SEEK_SET)))
+	if((errno=fs_seek_locked(f,off,SEEK_SET))!=0)
 		EDONE(telog_verbose("hand %p seek for map failed",f));
-	if(!(errno=fs_read_locked(f,map->data,*size,&read)))
-		EDONE(telog_verbose("hand %p read for map failed",f));
-	if(!(errno=fs_seek_locked(f,lp,SEEK_SET)))
+	e=fs_full_read_locked(f,map->data,*size);
+	if((errno=fs_seek_locked(f,lp,SEEK_SET))!=0)
 		EDONE(telog_verbose("hand %p seek back for map failed",f));
-	if(read!=*size)DONE(trlog_verbose(
-		EIO,
-		"hand %p read file size mismatch %zu != %zu",
-		f,read,*size
-	));
+	if((errno=e)!=0)
+		EDONE(telog_verbose("hand %p read for map failed",f));
 	map->data[*size]=0,*buffer=map->data;
+	map->next=f->maps,f->maps=map;
 	RET(0);
 	done:
 	e=errno;
@@ -83,13 +99,17 @@ static int fsdrv_unmap(
 	void*buffer,
 	size_t size
 ){
-	size_t lp=0,write=0;
+	int r=0;
+	size_t lp=0;
+	struct map_info**p;
 	if(!fsh_check(f))RET(EBADF);
 	if(!drv||!buffer)RET(EINVAL);
 	struct map_info*map=buffer-sizeof(struct map_info);
+	for(p=&f->maps;*p&&*p!=map;p=&(*p)->next);
+	if(!*p)RET(trlog_verbose(EINVAL,"hand %p buffer %p not mapped",f,buffer));
 	if(memcmp(map->magic,MAP_INFO_MAGIC,sizeof(map->magic)))
 		RET(trlog_verbose(EINVAL,"hand %p buffer %p map info magic mismatch",f,buffer));
-	if(map->size!=size)RET(trlog_verbose(
+	if(size!=0&&map->size!=size)RET(trlog_verbose(
 		EINVAL,"hand %p buffer %p map info size mismatch %zu != %zu",
 		f,buffer,size,map->size
 	));
@@ -97,21 +117,22 @@ static int fsdrv_unmap(
 		EINVAL,"hand %p buffer %p map info handler mismatch %p",
 		f,buffer,map->hand
 	));
+	if(--map->refs>0)RET(0);
+	*p=map->next;
 	if(fs_has_flag(map->flag,FILE_FLAG_WRITE)){
-		if(!(errno=fs_tell_locked(f,&lp)))
-			RET(terlog_verbose(errno,"hand %p tell for unmap write back failed",f));
-		if(!(errno=fs_seek_locked(f,map->offset,SEEK_SET)))
-			RET(terlog_verbose(errno,"hand %p seek for unmap write back failed",f));
-		if(!(errno=fs_write_locked(f,map->data,map->size,&write)))
-			RET(terlog_verbose(errno,"hand %p unmap write back failed",f));
-		if(!(errno=fs_seek_locked(f,lp,SEEK_SET)))
-			RET(terlog_verbose(errno,"hand %p seek back for unmap write back failed",f));
-		if(write!=map->size)RET(trlog_verbose(
-			EIO,"hand %p unmap write back mismatch %zu != %zu",f,write,map->size
-		));
+		if((r=fs_tell_locked(f,&lp))!=0)
+			telog_verbose("hand %p tell for unmap write back failed",f);
+		else if((r=fs_seek_locked(f,map->offset,SEEK_SET))!=0)
+			telog_verbose("hand %p seek for unmap write back failed",f);
+		else{
+			if((r=fs_full_write_locked(f,map->data,map->size))!=0)
+				telog_verbose("hand %p unmap write back failed",f);
+			if(fs_seek_locked(f,lp,SEEK_SET)!=0)
+				telog_verbose("hand %p seek back for unmap write back failed",f);
+		}
 	}
 	free(map);
-	RET(0);
+	RET(r);
 }
 
 static bool fsdrv_is_compatible(const fsdrv*drv,url*uri){
@@ -13,7 +13,9 @@
 #include<Library/MemoryAllocationLib.h>
 #include<Library/UefiBootServicesTableLib.h>
 #include<Protocol/DiskIo.h>
+#include<Protocol/DiskIo2.h>
 #include<Protocol/BlockIo.h>
+#include<Protocol/BlockIo2.h>
 #include<Protocol/DevicePath.h>
 #include<Protocol/LoadedImage.h>
 #include<Protocol/SimpleFileSystem.h>
@@ -29,6 +31,13 @@
 
 static fsdrv fsdrv_uefi;
 
+// smallest block cache window, rounded up to the optimal transfer size
+#define BLOCK_CACHE_MIN 0x10000
+
+// large aligned reads are split into this many overlapping block io 2 transfers
+#define BLOCK_CHUNK 0x100000
+#define BLOCK_INFLIGHT 8
+
 struct fsd{
 	EFI_FILE_HANDLE hand;
 	EFI_DEVICE_PATH_PROTOCOL*dp;
@@ -48,6 +57,11 @@ struct fsd{
 			UINT64 offset;
 			EFI_BLOCK_IO_PROTOCOL*blk;
 			EFI_DISK_IO_PROTOCOL*disk;
+			EFI_DISK_IO2_PROTOCOL*disk2;
+			EFI_BLOCK_IO2_PROTOCOL*blk2;
+			UINT8*cache;
+			UINT64 cache_off;
+			UINTN cache_len,cache_size;
 		}block;
 	};
 };
@@ -100,6 +114,7 @@ static void fsdrv_close(const fsdrv*drv,fsh*f){
 			if(d->file.file)st=d->file.file->Close(d->file.file);
 			if(d->file.root)d->file.root->Close(d->file.root);
 		}
+		if(d->type==TYPE_BLOCK&&d->block.cache)FreePool(d->block.cache);
 		memset(d,0,sizeof(struct fsd));
 	}
 	errno=efi_status_to_errno(st);
@@ -235,6 +250,18 @@ static int fs_get_root(
 					hand,efi_status_to_string(st)
 				));
 			}
+
+			// optional, requests run synchronously without it
+			if(hand&&d&&!d->block.disk2&&EFI_ERROR(gBS->HandleProtocol(
+				hand,
+				&gEfiDiskIo2ProtocolGuid,
+				(VOID**)&d->block.disk2
+			)))d->block.disk2=NULL;
+			if(hand&&d&&!d->block.blk2&&EFI_ERROR(gBS->HandleProtocol(
+				hand,
+				&gEfiBlockIo2ProtocolGuid,
+				(VOID**)&d->block.blk2
+			)))d->block.blk2=NULL;
 			if(d)d->block.disk=disk,d->block.blk=blk;
 		}break;
 		default:ERET(EINVAL);
@@ -329,6 +356,118 @@ static int fsdrv_open(
 	EXRET(EIO);
 }
 
+static UINTN block_size(struct fsd*d){
+	return d->block.blk->Media->BlockSize?:512;
+}
+
+// window aligned to whole optimal transfers, allocated on first small read
+static bool block_cache_init(struct fsd*d){
+	UINTN unit,gran=0;
+	EFI_BLOCK_IO_MEDIA*m=d->block.blk->Media;
+	if(d->block.cache)return true;
+	if(d->block.blk->Revision>=EFI_BLOCK_IO_PROTOCOL_REVISION3)
+		gran=m->OptimalTransferLengthGranularity;
+	unit=block_size(d)*(gran?:1);
+	d->block.cache_size=(BLOCK_CACHE_MIN+unit-1)/unit*unit;
+	d->block.cache_len=0;
+	if(!(d->block.cache=AllocatePool(d->block.cache_size)))
+		d->block.cache_size=0;
+	return d->block.cache!=NULL;
+}
+
+// whole blocks with a suitably aligned buffer go out as parallel transfers
+static EFI_STATUS block_read_large(struct fsd*d,UINT64 off,UINT8*buf,UINTN len){
+	UINTN i,cnt,n,pos=0,idx;
+	UINTN bs=block_size(d),chunk=MAX(BLOCK_CHUNK/bs,1)*bs;
+	UINT32 align=d->block.blk->Media->IoAlign;
+	EFI_BLOCK_IO2_PROTOCOL*blk2=d->block.blk2;
+	EFI_BLOCK_IO2_TOKEN tokens[BLOCK_INFLIGHT];
+	EFI_STATUS st=EFI_SUCCESS,ts;
+	bool stop=false;
+	if(
+		!blk2||off%bs!=0||len%bs!=0||
+		(align>1&&((UINTN)buf)%align!=0)
+	)goto fallback;
+	while(pos<len&&!stop){
+		for(cnt=0;cnt<BLOCK_INFLIGHT&&pos<len;cnt++){
+			n=MIN(chunk,len-pos);
+			ZeroMem(&tokens[cnt],sizeof(EFI_BLOCK_IO2_TOKEN));
+			if(EFI_ERROR(gBS->CreateEvent(0,0,NULL,NULL,&tokens[cnt].Event))){
+				stop=true;
+				break;
+			}
+			if(EFI_ERROR(blk2->ReadBlocksEx(
+				blk2,d->block.blk->Media->MediaId,
+				(off+pos)/bs,&tokens[cnt],n,buf+pos
+			))){
+				gBS->CloseEvent(tokens[cnt].Event);
+				stop=true;
+				break;
+			}
+			pos+=n;
+		}
+		for(i=0;i<cnt;i++){
+			gBS->WaitForEvent(1,&tokens[i].Event,&idx);
+			ts=tokens[i].TransactionStatus;
+			gBS->CloseEvent(tokens[i].Event);
+			if(EFI_ERROR(ts)&&!EFI_ERROR(st))st=ts;
+		}
+		if(EFI_ERROR(st))return st;
+	}
+
+	// whatever could not be queued goes through disk io
+	if(pos>=len)return EFI_SUCCESS;
+	fallback:
+	return d->block.disk->ReadDisk(
+		d->block.disk,
+		d->block.blk->Media->MediaId,
+		off+pos,len-pos,buf+pos
+	);
+}
+
+static EFI_STATUS block_read(struct fsd*d,UINT8*buf,UINTN len,UINTN*got){
+	UINTN n,done=0;
+	UINT64 pos,start,end;
+	EFI_STATUS st;
+	EFI_BLOCK_IO_MEDIA*m=d->block.blk->Media;
+	end=(UINT64)block_size(d)*(m->LastBlock+1);
+	*got=0;
+	if(d->block.offset>=end)return EFI_SUCCESS;
+	len=MIN(len,end-d->block.offset);
+	while(done<len){
+		pos=d->block.offset+done;
+		if(
+			d->block.cache_len>0&&
+			pos>=d->block.cache_off&&
+			pos<d->block.cache_off+d->block.cache_len
+		){
+			n=MIN(len-done,d->block.cache_off+d->block.cache_len-pos);
+			CopyMem(buf+done,d->block.cache+(pos-d->block.cache_off),n);
+			done+=n;
+			continue;
+		}
+
+		// large reads skip the copy
+		if(!block_cache_init(d)||len-done>=d->block.cache_size){
+			st=block_read_large(d,pos,buf+done,len-done);
+			if(EFI_ERROR(st))return st;
+			done=len;
+			break;
+		}
+		start=pos-pos%d->block.cache_size;
+		n=MIN(d->block.cache_size,end-start);
+		d->block.cache_len=0;
+		st=d->block.disk->ReadDisk(
+			d->block.disk,m->MediaId,
+			start,n,d->block.cache
+		);
+		if(EFI_ERROR(st))return st;
+		d->block.cache_off=start,d->block.cache_len=n;
+	}
+	*got=done;
+	return EFI_SUCCESS;
+}
+
 static int fsdrv_read(
 	const fsdrv*drv,fsh*f,
 	void*buffer,
@@ -354,12 +493,8 @@ static int fsdrv_read(
 				!d->block.blk||
 				!d->block.blk->Media
 			)RET(EBADF);
-			st=d->block.disk->ReadDisk(
-				d->block.disk,
-				d->block.blk->Media->MediaId,
-				d->block.offset,btr,buffer
-			);
-			d->block.offset+=btr;
+			st=block_read(d,buffer,btr,&size);
+			d->block.offset+=size;
 		}break;
 		default:RET(ENOSYS);
 	}
@@ -437,6 +572,7 @@ static int fsdrv_write(
 				!d->block.blk||
 				!d->block.blk->Media
 			)RET(EBADF);
+			d->block.cache_len=0;
 			st=d->block.disk->WriteDisk(
 				d->block.disk,
 				d->block.blk->Media->MediaId,
@@ -450,6 +586,59 @@ static int fsdrv_write(
 	RET(efi_status_to_errno(st));
 }
 
+// only block devices have positional async access through disk io 2
+static int fsdrv_submit(const fsdrv*drv,fsh*f,fs_io*io){
+	struct fsd*d;
+	EFI_STATUS st;
+	EFI_DISK_IO2_TOKEN*token;
+	if(!f||!drv||f->driver!=drv||!io)RET(EINVAL);
+	if(!(d=f->data))RET(EBADF);
+	if(d->type!=TYPE_BLOCK||!d->block.disk2)RET(ENOTSUP);
+	if(!d->block.blk||!d->block.blk->Media)RET(EBADF);
+	if(io->op==FS_IO_WRITE)d->block.cache_len=0;
+	if(!(token=AllocateZeroPool(sizeof(EFI_DISK_IO2_TOKEN))))RET(EAGAIN);
+	st=gBS->CreateEvent(0,0,NULL,NULL,&token->Event);
+	if(EFI_ERROR(st)){
+		FreePool(token);
+		RET(EAGAIN);
+	}
+	st=io->op==FS_IO_WRITE?
+		d->block.disk2->WriteDiskEx(
+			d->block.disk2,
+			d->block.blk->Media->MediaId,
+			io->offset,token,io->size,io->buffer
+		):d->block.disk2->ReadDiskEx(
+			d->block.disk2,
+			d->block.blk->Media->MediaId,
+			io->offset,token,io->size,io->buffer
+		);
+	if(EFI_ERROR(st)){
+		gBS->CloseEvent(token->Event);
+		FreePool(token);
+		RET(efi_status_to_errno(st));
+	}
+	io->priv=token;
+	RET(0);
+}
+
+static int fsdrv_complete(const fsdrv*drv,fs_io*io,long timeout){
+	long waited=0;
+	EFI_DISK_IO2_TOKEN*token;
+	if(!drv||!io||!(token=io->priv))RET(EINVAL);
+	while(gBS->CheckEvent(token->Event)==EFI_NOT_READY){
+		if(timeout>=0&&waited>=timeout)RET(ETIMEDOUT);
+		gBS->Stall(1000);
+		waited++;
+	}
+	if(EFI_ERROR(token->TransactionStatus))
+		io->result=efi_status_to_errno(token->TransactionStatus);
+	else io->done=io->size;
+	gBS->CloseEvent(token->Event);
+	FreePool(token);
+	io->priv=NULL,io->finished=true;
+	RET(0);
+}
+
 static int fsdrv_seek(const fsdrv*drv,fsh*f,size_t pos,int whence){
 	int r=0;
 	size_t o=0;
@@ -690,6 +879,8 @@ static fsdrv fsdrv_uefi={
 	.read=fsdrv_read,
 	.readdir=fsdrv_readdir,
 	.write=fsdrv_write,
+	.submit=fsdrv_submit,
+	.complete=fsdrv_complete,
 	.seek=fsdrv_seek,
 	.tell=fsdrv_tell,
 	.get_info=fsdrv_get_info,
@@ -8,20 +8,57 @@
 
 #ifdef ENABLE_LIBZIP
 #include<stdbool.h>
+#include<stdlib.h>
 #include<zip.h>
+#include<zlib.h>
 #include<zip_source_file.h>
 #include"../fs_internal.h"
 #include"str.h"
+#include"mempressure.h"
+
+// compressed bytes fetched from the base file per read
+#define RAW_CHUNK 0x10000
+
+// entries up to this size are decompressed once and kept in memory
+#define CACHE_ENTRY_MAX 0x40000
+#define CACHE_MAX 0x800000
+
+// from zipint.h, that header clashes with our config.h
+extern zip_uint64_t _zip_file_get_offset(const zip_t*,zip_uint64_t,zip_error_t*);
 
 static mutex_t lock;
 static list*opened_zip=NULL;
 
+struct zip_cache{
+	struct zip_entry*ent;
+	char*data;
+	size_t size;
+	int refs;
+	bool gone;
+	struct zip_cache*prev,*next;
+};
+
+// central directory entry, filled once when the archive is registered
+struct zip_entry{
+	zip_stat_t st;
+	uint32_t hash;
+	zip_uint64_t data;
+	struct zip_cache*cache;
+};
+
 struct zip_file_ctx{
 	fsh*file;
 	struct zip_ctx*ctx;
 	zip_int64_t index;
 	zip_file_t*zip;
 	zip_int64_t offset;
+	struct zip_entry*ent;
+	struct zip_cache*cache;
+	z_stream*zs;
+	unsigned char*in;
+	zip_uint64_t raw,pos;
+	uLong crc;
+	bool direct,check;
 };
 
 struct zip_ctx{
@@ -36,6 +73,13 @@ struct zip_ctx{
 	zip_t*zip;
 	fsh*file;
 	list*opened;
+	struct zip_entry*entries;
+	zip_uint64_t entries_cnt;
+	zip_uint64_t*slots;
+	size_t slots_size;
+	mutex_t cache_lock;
+	struct zip_cache*cache_head,*cache_tail;
+	size_t cache_size;
 };
 
 static int zip_error_to_errno(int err){
@@ -104,6 +148,290 @@ static bool zip_stat_to_file_info(zip_stat_t*st,fs_file_info*info){
 	return true;
 }
 
+static uint32_t name_hash(const char*name){
+	uint32_t h=2166136261u;
+	while(*name)h=(h^(unsigned char)*name++)*16777619u;
+	return h;
+}
+
+static int build_index(struct zip_ctx*c){
+	zip_int64_t cnt;
+	size_t size=16,s;
+	struct zip_entry*e;
+	if((cnt=zip_get_num_entries(c->zip,0))<0)RET(EFAULT);
+	if(cnt==0)RET(0);
+	while(size<(size_t)cnt*2)size*=2;
+	if(!(c->entries=malloc(sizeof(struct zip_entry)*cnt)))RET(ENOMEM);
+	if(!(c->slots=malloc(sizeof(zip_uint64_t)*size)))RET(ENOMEM);
+	memset(c->entries,0,sizeof(struct zip_entry)*cnt);
+	memset(c->slots,0,sizeof(zip_uint64_t)*size);
+	c->entries_cnt=cnt,c->slots_size=size;
+	for(zip_int64_t i=0;i<cnt;i++){
+		e=&c->entries[i];
+		if(zip_stat_index(c->zip,i,0,&e->st)!=0||!e->st.name){
+			e->st.name=NULL;
+			continue;
+		}
+
+		// slots hold index+1, duplicated names resolve to the first one
+		e->hash=name_hash(e->st.name);
+		for(s=e->hash&(size-1);c->slots[s];s=(s+1)&(size-1));
+		c->slots[s]=i+1;
+	}
+	RET(0);
+}
+
+static struct zip_entry*find_entry(struct zip_ctx*c,const char*name){
+	struct zip_entry*e;
+	uint32_t h=name_hash(name);
+	if(!c->slots)return NULL;
+	for(size_t s=h&(c->slots_size-1);c->slots[s];s=(s+1)&(c->slots_size-1)){
+		e=&c->entries[c->slots[s]-1];
+		if(e->hash==h&&strcmp(e->st.name,name)==0)return e;
+	}
+	return NULL;
+}
+
+// stored or deflated data without encryption is read without libzip
+static bool can_direct(struct zip_entry*e){
+	zip_uint64_t need=
+		ZIP_STAT_SIZE|ZIP_STAT_COMP_SIZE|ZIP_STAT_CRC|
+		ZIP_STAT_COMP_METHOD|ZIP_STAT_ENCRYPTION_METHOD;
+	if(!e||(e->st.valid&need)!=need)return false;
+	if(e->st.encryption_method!=ZIP_EM_NONE)return false;
+	if(e->st.comp_method==ZIP_CM_STORE)return e->st.size==e->st.comp_size;
+	return e->st.comp_method==ZIP_CM_DEFLATE;
+}
+
+static void cache_free(struct zip_cache*n){
+	if(n->data)free(n->data);
+	free(n);
+}
+
+static void cache_unlink(struct zip_ctx*c,struct zip_cache*n){
+	if(n->prev)n->prev->next=n->next;
+	else c->cache_head=n->next;
+	if(n->next)n->next->prev=n->prev;
+	else c->cache_tail=n->prev;
+	n->prev=n->next=NULL;
+}
+
+static void cache_link(struct zip_ctx*c,struct zip_cache*n){
+	n->prev=NULL,n->next=c->cache_head;
+	if(c->cache_head)c->cache_head->prev=n;
+	else c->cache_tail=n;
+	c->cache_head=n;
+}
+
+// evicted entries still in use are freed by their last reader
+static size_t cache_evict(struct zip_ctx*c,size_t size,struct zip_cache*keep){
+	size_t released=0;
+	struct zip_cache*t;
+	while(c->cache_size>size&&(t=c->cache_tail)&&t!=keep){
+		cache_unlink(c,t);
+		t->ent->cache=NULL;
+		c->cache_size-=t->size;
+		released+=t->size;
+		if(t->refs>0)t->gone=true;
+		else cache_free(t);
+	}
+	return released;
+}
+
+static struct zip_cache*cache_get(struct zip_ctx*c,struct zip_entry*e){
+	struct zip_cache*n;
+	MUTEX_LOCK(c->cache_lock);
+	if((n=e->cache)){
+		cache_unlink(c,n);
+		cache_link(c,n);
+		n->refs++;
+	}
+	MUTEX_UNLOCK(c->cache_lock);
+	return n;
+}
+
+static struct zip_cache*cache_put(struct zip_ctx*c,struct zip_entry*e,char*data,size_t size){
+	struct zip_cache*n;
+	MUTEX_LOCK(c->cache_lock);
+
+	// another reader may have loaded it meanwhile
+	if((n=e->cache)){
+		free(data);
+		cache_unlink(c,n);
+	}else{
+		if(!(n=malloc(sizeof(struct zip_cache)))){
+			MUTEX_UNLOCK(c->cache_lock);
+			free(data);
+			return NULL;
+		}
+		memset(n,0,sizeof(struct zip_cache));
+		n->ent=e,n->data=data,n->size=size;
+		e->cache=n,c->cache_size+=size;
+	}
+	cache_link(c,n);
+	n->refs++;
+	cache_evict(c,CACHE_MAX,n);
+	MUTEX_UNLOCK(c->cache_lock);
+	return n;
+}
+
+static void cache_release(struct zip_ctx*c,struct zip_cache*n){
+	MUTEX_LOCK(c->cache_lock);
+	if(--n->refs<=0&&n->gone)cache_free(n);
+	MUTEX_UNLOCK(c->cache_lock);
+}
+
+static void direct_free(struct zip_file_ctx*ctx){
+	if(ctx->zs){
+		inflateEnd(ctx->zs);
+		free(ctx->zs);
+	}
+	if(ctx->in)free(ctx->in);
+	ctx->zs=NULL,ctx->in=NULL,ctx->direct=false;
+}
+
+static void direct_reset(struct zip_file_ctx*ctx){
+	ctx->raw=0,ctx->pos=0,ctx->check=true;
+	ctx->crc=crc32(0,NULL,0);
+	if(ctx->zs){
+		inflateReset(ctx->zs);
+		ctx->zs->avail_in=0;
+	}
+}
+
+static int direct_init(struct zip_file_ctx*ctx){
+	if(ctx->ent->st.comp_method==ZIP_CM_DEFLATE){
+		if(!(ctx->zs=malloc(sizeof(z_stream))))RET(ENOMEM);
+		memset(ctx->zs,0,sizeof(z_stream));
+		if(inflateInit2(ctx->zs,-MAX_WBITS)!=Z_OK){
+			free(ctx->zs);
+			ctx->zs=NULL;
+			RET(ENOMEM);
+		}
+		if(!(ctx->in=malloc(RAW_CHUNK))){
+			direct_free(ctx);
+			RET(ENOMEM);
+		}
+	}
+	ctx->direct=true;
+	direct_reset(ctx);
+	RET(0);
+}
+
+// only the base file access is serialized, inflating runs per handle
+static int raw_read(struct zip_file_ctx*ctx,void*buf,size_t len,size_t*got){
+	int r;
+	struct zip_ctx*c=ctx->ctx;
+	zip_uint64_t left=ctx->ent->st.comp_size-ctx->raw;
+	*got=0;
+	if((len=MIN(len,left))<=0)RET(0);
+	MUTEX_LOCK(c->lock);
+	r=fs_seek(c->file,ctx->ent->data+ctx->raw,SEEK_SET);
+	if(r==0)r=fs_full_read(c->file,buf,len);
+	MUTEX_UNLOCK(c->lock);
+	if(r!=0)RET(r);
+	ctx->raw+=len,*got=len;
+	RET(0);
+}
+
+static int inflate_read(struct zip_file_ctx*ctx,void*buf,size_t len,size_t*got){
+	int r;
+	size_t n;
+	z_stream*zs=ctx->zs;
+	zs->next_out=buf,zs->avail_out=len;
+	while(zs->avail_out>0){
+		if(zs->avail_in<=0){
+			if((r=raw_read(ctx,ctx->in,RAW_CHUNK,&n))!=0)return r;
+			if(n<=0)break;
+			zs->next_in=ctx->in,zs->avail_in=n;
+		}
+		r=inflate(zs,Z_NO_FLUSH);
+		if(r==Z_STREAM_END)break;
+		if(r==Z_BUF_ERROR&&zs->avail_in<=0)continue;
+		if(r!=Z_OK)RET(EUCLEAN);
+	}
+	*got=len-zs->avail_out;
+	RET(0);
+}
+
+static int direct_read(struct zip_file_ctx*ctx,void*buf,size_t len,size_t*got){
+	int r;
+	size_t n=0;
+	zip_uint64_t size=ctx->ent->st.size;
+	if((len=MIN(len,size-ctx->pos))<=0){
+		*got=0;
+		RET(0);
+	}
+	r=ctx->zs?
+		inflate_read(ctx,buf,len,&n):
+		raw_read(ctx,buf,len,&n);
+	if(r!=0)return r;
+	if(n<=0)RET(EUCLEAN);
+	ctx->pos+=n,*got=n;
+	if(ctx->check){
+		ctx->crc=crc32(ctx->crc,buf,n);
+		if(ctx->pos>=size&&ctx->crc!=ctx->ent->st.crc)RET(EUCLEAN);
+	}
+	RET(0);
+}
+
+static int seek_target(
+	zip_uint64_t cur,
+	zip_uint64_t size,
+	size_t pos,
+	int whence,
+	zip_uint64_t*target
+){
+	switch(whence){
+		case SEEK_SET:*target=pos;break;
+		case SEEK_CUR:*target=cur+pos;break;
+		case SEEK_END:*target=size+pos;break;
+		default:RET(EINVAL);
+	}
+	if(*target>size)RET(EINVAL);
+	RET(0);
+}
+
+static int direct_seek(struct zip_file_ctx*ctx,zip_uint64_t target){
+	int r;
+	size_t n;
+	char buf[4096];
+	if(!ctx->zs){
+		ctx->raw=ctx->pos=target;
+		ctx->check=target==0;
+		if(ctx->check)ctx->crc=crc32(0,NULL,0);
+		RET(0);
+	}
+
+	// deflate has no random access, restart and skip forward
+	if(target<ctx->pos)direct_reset(ctx);
+	while(ctx->pos<target){
+		r=direct_read(ctx,buf,MIN(sizeof(buf),target-ctx->pos),&n);
+		if(r!=0)return r;
+	}
+	RET(0);
+}
+
+// decompress a small entry at once and share it between all readers
+static void load_cache(struct zip_file_ctx*ctx){
+	char*data;
+	size_t n,size=ctx->ent->st.size;
+	if((ctx->cache=cache_get(ctx->ctx,ctx->ent))){
+		direct_free(ctx);
+		return;
+	}
+	if(!(data=malloc(MAX(size,1))))return;
+	for(size_t pos=0;pos<size;pos+=n)
+		if(direct_read(ctx,data+pos,size-pos,&n)!=0){
+			free(data);
+			direct_reset(ctx);
+			return;
+		}
+	ctx->cache=cache_put(ctx->ctx,ctx->ent,data,size);
+	direct_reset(ctx);
+	if(ctx->cache)direct_free(ctx);
+}
+
 static int close_zip_ctx(
 	struct zip_ctx*ctx,
 	bool close_file,
@@ -117,11 +445,22 @@ static int close_zip_ctx(
 		if(!c)continue;
 		if(c->file)MUTEX_LOCK(c->file->lock);
 		if(c->zip)zip_fclose(c->zip);
-		c->zip=NULL,c->ctx=NULL;
+		direct_free(c);
+		c->zip=NULL,c->ctx=NULL,c->cache=NULL,c->ent=NULL;
 		if(c->file)MUTEX_UNLOCK(c->file->lock);
 	}while((l=l->next));
 	if(close_file&&ctx->file)fs_close(&ctx->file);
 	if(ctx->zip)zip_close(ctx->zip);
+	MUTEX_LOCK(ctx->cache_lock);
+	while(ctx->cache_head){
+		struct zip_cache*n=ctx->cache_head;
+		ctx->cache_head=n->next;
+		cache_free(n);
+	}
+	ctx->cache_tail=NULL,ctx->cache_size=0;
+	MUTEX_UNLOCK(ctx->cache_lock);
+	if(ctx->entries)free(ctx->entries);
+	if(ctx->slots)free(ctx->slots);
 	if(free_list){
 		MUTEX_LOCK(lock);
 		list_obj_del_data(&opened_zip,ctx,NULL);
@@ -130,6 +469,7 @@ static int close_zip_ctx(
 	list_free_all(ctx->opened,NULL);
 	MUTEX_UNLOCK(ctx->lock);
 	MUTEX_DESTROY(ctx->lock);
+	MUTEX_DESTROY(ctx->cache_lock);
 	free(ctx);
 	RET(0);
 }
@@ -164,7 +504,9 @@ static int fsdrv_open(
 	int e=0,fl=0;
 	char*path=NULL;
 	zip_int64_t index=-1;
+	zip_error_t error;
 	struct zip_ctx*c=NULL;
+	struct zip_entry*ent=NULL;
 	struct zip_file_ctx*ctx=NULL;
 	if(fs_has_flag(flags,FILE_FLAG_WRITE))RET(EROFS);
 	if(fs_has_flag(flags,FILE_FLAG_CREATE))RET(EROFS);
@@ -194,25 +536,37 @@ static int fsdrv_open(
 				nf->uri->path=path;
 			}
 		}else path=uri->path;
-		if((index=zip_name_locate(c->zip,path+1,0))<0)
-			DONE(zip_error_to_errno(c->zip_err));
+		if(!(ent=find_entry(c,path+1)))DONE(ENOENT);
+		index=ent->st.index;
 	}
 	if(!fs_has_flag(flags,FILE_FLAG_ACCESS)){
 		if(!ctx||!nf)DONE(EBADF);
-		ctx->file=nf,ctx->ctx=c,ctx->index=index;
-		if(
-			!fs_has_flag(flags,FILE_FLAG_FOLDER)&&
-			(index<0||!(ctx->zip=zip_fopen_index(c->zip,index,0)))
-		)DONE(zip_error_to_errno(c->zip_err));
+		ctx->file=nf,ctx->ctx=c,ctx->index=index,ctx->ent=ent;
+		if(!fs_has_flag(flags,FILE_FLAG_FOLDER)){
+			if(index<0)DONE(ENOENT);
+
+			// the local header is parsed once, later opens skip libzip
+			if(can_direct(ent)&&!ent->data){
+				zip_error_init(&error);
+				ent->data=_zip_file_get_offset(c->zip,index,&error);
+				zip_error_fini(&error);
+			}
+			if(!ent->data||direct_init(ctx)!=0){
+				if(!(ctx->zip=zip_fopen_index(c->zip,index,0)))
+					DONE(zip_error_to_errno(zip_get_error(c->zip)->zip_err));
+			}
+		}
 		list_obj_add_new(&c->opened,ctx);
 	}
 	MUTEX_UNLOCK(c->lock);
 	MUTEX_UNLOCK(lock);
+	if(ctx&&ctx->direct&&ent->st.size<=CACHE_ENTRY_MAX)load_cache(ctx);
 	RET(0);
 	done:e=errno;
 	if(c&&(fl--))MUTEX_UNLOCK(c->lock);
 	if((fl--))MUTEX_UNLOCK(lock);
 	if(ctx&&ctx->zip)zip_fclose(ctx->zip);
+	if(ctx)direct_free(ctx);
 	XRET(e,ENOENT);
 }
 
@@ -221,25 +575,16 @@ static int fsdrv_get_info(
 	fsh*f,
 	fs_file_info*info
 ){
-	int e;
-	zip_stat_t st;
 	struct zip_ctx*c;
 	struct zip_file_ctx*ctx;
 	if(!f||!(ctx=f->data))RET(EINVAL);
 	if(!drv||f->driver!=drv||!info)RET(EINVAL);
 	if(!(c=ctx->ctx)||!c->zip)RET(ESTALE);
 	memset(info,0,sizeof(fs_file_info));
-	MUTEX_LOCK(c->lock);
-	int r=zip_stat_index(c->zip,ctx->index,0,&st);
-	if(r!=0)DONE(zip_error_to_errno(c->zip_err));
-	if(!zip_stat_to_file_info(&st,info))DONE(EIO);
+	if(!ctx->ent||!zip_stat_to_file_info(&ctx->ent->st,info))RET(EIO);
 	info->features=drv->features;
 	info->parent=f;
-	MUTEX_UNLOCK(c->lock);
 	RET(0);
-	done:e=errno;
-	MUTEX_UNLOCK(c->lock);
-	XRET(e,EIO);
 }
 
 static int fsdrv_readdir(
@@ -247,57 +592,60 @@ static int fsdrv_readdir(
 	fsh*f,
 	fs_file_info*info
 ){
-	int e;
-	zip_stat_t st;
-	zip_int64_t cnt;
 	size_t len=0,fl;
 	struct zip_ctx*c;
-	const char*name,*fn;
+	struct zip_entry*e;
+	const char*name=NULL,*fn;
 	struct zip_file_ctx*ctx;
 	if(!f||!(ctx=f->data))RET(EINVAL);
 	if(!drv||f->driver!=drv)RET(EINVAL);
 	if(!(c=ctx->ctx)||!c->zip)RET(ESTALE);
 	if(!fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(ENOTDIR);
 	memset(info,0,sizeof(fs_file_info));
-	MUTEX_LOCK(c->lock);
-	cnt=zip_get_num_entries(c->zip,0);
-	if(cnt<0)DONE(EFAULT);
-	if(ctx->offset>=cnt)DONE(EOF);
-	if((name=zip_get_name(c->zip,ctx->index,0))){
+	if(ctx->offset<0||(zip_uint64_t)ctx->offset>=c->entries_cnt)RET(EOF);
+	if(ctx->ent&&(name=ctx->ent->st.name)){
 		if((len=strlen(name))<=0)name=NULL;
 	}
+
+	// the index never changes after register, no lock needed
 	do{
-		if(zip_stat_index(c->zip,ctx->offset,0,&st)!=0)continue;
-		if(!(fn=st.name)||(fl=strlen(fn))<=0)continue;
+		e=&c->entries[ctx->offset];
+		if(!(fn=e->st.name)||(fl=strlen(fn))<=0)continue;
 		if(name&&strncmp(fn,name,len)!=0)continue;
 		fn+=len,fl-=len;
 		if(fl<=0||memchr(fn,'/',fl-1))continue;
 		ctx->offset++;
-		if(!zip_stat_to_file_info(&st,info))DONE(EFAULT);
+		if(!zip_stat_to_file_info(&e->st,info))RET(EFAULT);
 		info->parent=f;
-		MUTEX_UNLOCK(c->lock);
 		RET(0);
-	}while(++ctx->offset<cnt);
-	MUTEX_UNLOCK(c->lock);
+	}while((zip_uint64_t)++ctx->offset<c->entries_cnt);
 	RET(EOF);
-	done:e=errno;
-	MUTEX_UNLOCK(c->lock);
-	XRET(e,EIO);
 }
 
 static int fsdrv_seek(const fsdrv*drv,fsh*f,size_t pos,int whence){
+	int r;
+	zip_uint64_t target;
 	struct zip_ctx*c;
 	struct zip_file_ctx*ctx;
 	if(!f||!(ctx=f->data))RET(EINVAL);
 	if(!drv||f->driver!=drv)RET(EINVAL);
 	if(!(c=ctx->ctx)||!c->zip)RET(ESTALE);
+	if(ctx->cache||ctx->direct){
+		if((r=seek_target(
+			ctx->pos,ctx->ent->st.size,
+			pos,whence,&target
+		))!=0)RET(r);
+		if(ctx->cache)ctx->pos=target;
+		else if((r=direct_seek(ctx,target))!=0)RET(r);
+		RET(0);
+	}
 	MUTEX_LOCK(c->lock);
 	if(!zip_file_is_seekable(ctx->zip))DONE(ENOTSUP);
 	if(ctx->zip)zip_fseek(ctx->zip,pos,whence);
 	else switch(whence){
 		case SEEK_SET:ctx->offset=pos;break;
 		case SEEK_CUR:ctx->offset+=pos;break;
-		case SEEK_END:ctx->offset=zip_get_num_entries(c->zip,0)+pos;break;
+		case SEEK_END:ctx->offset=c->entries_cnt+pos;break;
 	}
 	MUTEX_UNLOCK(c->lock);
 	RET(0);
@@ -312,6 +660,10 @@ static int fsdrv_tell(const fsdrv*drv,fsh*f,size_t*pos){
 	if(!f||!drv||f->driver!=drv)RET(EINVAL);
 	if(!(ctx=f->data)||!pos)RET(EINVAL);
 	if(!(c=ctx->ctx)||!c->zip)RET(ESTALE);
+	if(ctx->cache||ctx->direct){
+		*pos=ctx->pos;
+		RET(0);
+	}
 	MUTEX_LOCK(c->lock);
 	if(ctx->zip)*pos=zip_ftell(ctx->zip);
 	else *pos=ctx->offset;
@@ -326,17 +678,33 @@ static int fsdrv_read(
 	size_t btr,
 	size_t*br
 ){
+	size_t n=0;
 	zip_int64_t r;
 	struct zip_ctx*c;
+	struct zip_cache*cache;
 	struct zip_file_ctx*ctx;
 	if(!f||!drv||f->driver!=drv)RET(EINVAL);
 	if(!(ctx=f->data)||!buffer)RET(EINVAL);
 	if(!(c=ctx->ctx)||!c->zip)RET(ESTALE);
 	if(!fs_has_flag(f->flags,FILE_FLAG_READ))RET(EPERM);
 	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+	if((cache=ctx->cache)){
+		if(ctx->pos<cache->size){
+			n=MIN(btr,cache->size-ctx->pos);
+			memcpy(buffer,cache->data+ctx->pos,n);
+			ctx->pos+=n;
+		}
+		if(br)*br=n;
+		RET(0);
+	}
+	if(ctx->direct){
+		if((r=direct_read(ctx,buffer,btr,&n))!=0)RET(r);
+		if(br)*br=n;
+		RET(0);
+	}
 	MUTEX_LOCK(c->lock);
 	r=zip_fread(ctx->zip,buffer,(zip_uint64_t)btr);
-	if(r<0)errno=zip_error_to_errno(c->zip_err);
+	if(r<0)errno=zip_error_to_errno(zip_file_get_error(ctx->zip)->zip_err);
 	else if(br)*br=(size_t)r;
 	MUTEX_UNLOCK(c->lock);
 	return errno;
@@ -345,8 +713,12 @@ static int fsdrv_read(
 static void fsdrv_close(const fsdrv*drv,fsh*f){
 	struct zip_file_ctx*ctx;
 	if(!f||!drv||f->driver!=drv||!(ctx=f->data))return;
-	if(ctx->ctx)list_obj_del_data(&ctx->ctx->opened,ctx,NULL);
+	if(ctx->ctx){
+		list_obj_del_data(&ctx->ctx->opened,ctx,NULL);
+		if(ctx->cache)cache_release(ctx->ctx,ctx->cache);
+	}
 	if(ctx->zip)zip_fclose(ctx->zip);
+	direct_free(ctx);
 }
 
 static fsdrv fsdrv_zip={
@@ -491,7 +863,14 @@ int fs_register_zip(fsh*f,const char*name){
 	memset(ctx,0,sizeof(struct zip_ctx));
 	strncpy(ctx->name,pn,sizeof(ctx->name)-1);
 	ctx->file=f,ctx->zip=zip;
+	if((r=build_index(ctx))!=0){
+		if(ctx->entries)free(ctx->entries);
+		if(ctx->slots)free(ctx->slots);
+		free(ctx);
+		DONE(r);
+	}
 	MUTEX_INIT(ctx->lock);
+	MUTEX_INIT(ctx->cache_lock);
 	fs_add_on_close(f,NULL,on_base_file_close,ctx);
 	list_obj_add_new(&opened_zip,ctx);
 	MUTEX_UNLOCK(lock);
@@ -504,8 +883,27 @@ int fs_register_zip(fsh*f,const char*name){
 	XRET(e,EIO);
 }
 
+// inflated entries of every archive, low pressure keeps the hot half
+static size_t zip_shrink(enum mem_pressure level,void*d __attribute__((unused))){
+	list*l;
+	size_t released=0;
+	MUTEX_LOCK(lock);
+	if((l=list_first(opened_zip)))do{
+		LIST_DATA_DECLARE(c,l,struct zip_ctx*);
+		if(!c)continue;
+		MUTEX_LOCK(c->cache_lock);
+		released+=cache_evict(c,level>=MEM_PRESSURE_CRITICAL?0:c->cache_size/2,NULL);
+		MUTEX_UNLOCK(c->cache_lock);
+	}while((l=l->next));
+	MUTEX_UNLOCK(lock);
+	return released;
+}
+
 void fsdrv_register_zip(bool deinit){
+	static int shrinker=0;
 	if(deinit){
+		mem_shrinker_del(shrinker);
+		shrinker=0;
 		MUTEX_LOCK(lock);
 		list_free_all(opened_zip,free_zip_ctx);
 		opened_zip=NULL;
@@ -514,6 +912,7 @@ void fsdrv_register_zip(bool deinit){
 	}else{
 		MUTEX_INIT(lock);
 		fsdrv_register_dup(&fsdrv_zip);
+		shrinker=mem_shrinker_add("zip cache",MEM_PRIO_CACHE,zip_shrink,NULL);
 	}
 }
 
@@ -30,8 +30,10 @@ DECL_ONE_LOCK(get_size,(fsh*f,size_t*out),(f,out),f)
 DECL_ONE_LOCK(print,(fsh*f,const char*str),(f,str),f)
 DECL_ONE_LOCK(println,(fsh*f,const char*str),(f,str),f)
 DECL_ONE_LOCK(set_size,(fsh*f,size_t size),(f,size),f)
+DECL_ONE_LOCK(set_buffer,(fsh*f,size_t size),(f,size),f)
 DECL_ONE_LOCK(get_type,(fsh*f,fs_type*type),(f,type),f)
 DECL_ONE_LOCK(readdir,(fsh*f,fs_file_info*info),(f,info),f)
+DECL_ONE_LOCK(readdir_batch,(fsh*f,fs_file_info*infos,size_t max,size_t*cnt),(f,infos,max,cnt),f)
 DECL_ONE_LOCK(get_path_alloc,(fsh*f,char**buff),(f,buff),f)
 DECL_ONE_LOCK(get_info,(fsh*f,fs_file_info*info),(f,info),f)
 DECL_ONE_LOCK(del_on_close,(fsh*f,const char*name),(f,name),f)
@@ -51,6 +53,8 @@ DECL_ONE_LOCK(get_name,(fsh*f,char*buff,size_t buff_len),(f,buff,buff_len),f)
 DECL_ONE_LOCK(full_read_alloc,(fsh*f,void**buffer,size_t btr),(f,buffer,btr),f)
 DECL_ONE_LOCK(read,(fsh*f,void*buffer,size_t btr,size_t*br),(f,buffer,btr,br),f)
 DECL_ONE_LOCK(write,(fsh*f,void*buffer,size_t btw,size_t*bw),(f,buffer,btw,bw),f)
+DECL_ONE_LOCK(readv,(fsh*f,const fs_iovec*iov,size_t cnt,size_t*br),(f,iov,cnt,br),f)
+DECL_ONE_LOCK(writev,(fsh*f,const fs_iovec*iov,size_t cnt,size_t*bw),(f,iov,cnt,bw),f)
 DECL_ONE_LOCK(read_to_fd,(fsh*f,int fd,size_t size,size_t*sent),(f,fd,size,sent),f)
 DECL_ONE_LOCK(read_alloc,(fsh*f,void**buffer,size_t btr,size_t*br),(f,buffer,btr,br),f)
 DECL_ONE_LOCK(add_on_close,(fsh*f,const char*name,fs_handle_close*hand,void*data),(f,name,hand,data),f)
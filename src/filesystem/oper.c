@@ -15,6 +15,66 @@ void fs_set_debug(bool debug){
 	fs_debug=debug;
 }
 
+static struct fsh_buffer*get_buffer(fsh*f){
+	struct fsh_buffer*b=f->buffer;
+	if(!fs_has_flag(f->flags,FILE_FLAG_BUFFERED))return NULL;
+	if(b&&b->data)return b;
+	if(!b){
+		if(!(b=malloc(sizeof(struct fsh_buffer))))return NULL;
+		memset(b,0,sizeof(struct fsh_buffer));
+		b->size=FS_BUFFER_SIZE,f->buffer=b;
+	}
+
+	// without memory the handle just works unbuffered
+	if(!(b->data=malloc(b->size)))return NULL;
+	b->pos=b->len=0,b->dirty=false;
+	return b;
+}
+
+// write out coalesced data
+static int buffer_flush(fsh*f){
+	int r;
+	size_t bw;
+	struct fsh_buffer*b=f->buffer;
+	if(!b||!b->dirty)return 0;
+	const fsdrv*drv=f->driver,*use=drv;
+	while(use&&!use->write)use=use->base;
+	if(!use||!use->write)RET(ENOSYS);
+	while(b->pos<b->len){
+		bw=0;
+		r=use->write(drv,f,b->data+b->pos,b->len-b->pos,&bw);
+		if(r==EINTR)continue;
+		if(r==0&&bw==0)r=EIO;
+		if(r!=0){
+			memmove(b->data,b->data+b->pos,b->len-b->pos);
+			b->len-=b->pos,b->pos=0;
+			RET(r);
+		}
+		b->pos+=bw;
+	}
+	b->pos=b->len=0,b->dirty=false;
+	return 0;
+}
+
+// forget read-ahead data, moving the driver back to the logical position
+static int buffer_drop(fsh*f){
+	int r;
+	size_t pos=0;
+	struct fsh_buffer*b=f->buffer;
+	if(!b||b->dirty)return 0;
+	if(b->pos<b->len){
+		const fsdrv*drv=f->driver,*use=drv;
+		while(use&&!use->tell)use=use->base;
+		if(!use||!use->tell)RET(ESPIPE);
+		if((r=use->tell(drv,f,&pos))!=0)RET(r);
+		for(use=drv;use&&!use->seek;use=use->base);
+		if(!use||!use->seek)RET(ESPIPE);
+		if((r=use->seek(drv,f,pos-(b->len-b->pos),SEEK_SET))!=0)RET(r);
+	}
+	b->pos=b->len=0;
+	return 0;
+}
+
 void fs_close(fsh**f){
 	list*l;
 	if(!f||!*f)return;
@@ -25,19 +85,24 @@ void fs_close(fsh**f){
 	}
 	const fsdrv*drv=(*f)->driver,*use=drv;
 	while(use&&!use->close)use=use->base;
+	if(buffer_flush(*f)!=0)telog_warn("flush buffered data failed");
 	if((l=list_first((*f)->on_close)))do{
 		LIST_DATA_DECLARE(p,l,struct fsh_hand_on_close*);
 		if(!p||!p->callback)continue;
 		p->callback(p->name,*f,p->user_data);
 	}while((l=l->next));
 	if(use&&use->close)use->close(drv,*f);
+	if(fs_has_flag((*f)->flags,FILE_FLAG_WRITE))
+		dir_cache_invalidate((*f)->url);
 	memset((*f)->magic,0,sizeof((*f)->magic));
 	MUTEX_UNLOCK((*f)->lock);
 	fsh_free(f);
 }
 
 int fs_flush_locked(fsh*f){
+	int r;
 	if(!fsh_check(f))RET(EBADF);
+	if((r=buffer_flush(f))!=0)RET(r);
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->flush)use=use->base;
 	if(!use||use->readonly_fs)RET(EROFS);
@@ -208,7 +273,10 @@ int fs_open_uri(fsh**nf,url*uri,fs_file_flag flag){
 			}
 		}
 		if(nf)fsh_free(nf);
-	}
+	}else if(nf&&(
+		fs_has_flag(flag,FILE_FLAG_WRITE)||
+		fs_has_flag(flag,FILE_FLAG_CREATE)
+	))dir_cache_invalidate((*nf)->url);
 	RET(r);
 }
 
@@ -223,6 +291,8 @@ int fs_readdir_locked(fsh*f,fs_file_info*info){
 }
 
 int fs_read_locked(fsh*f,void*buffer,size_t btr,size_t*br){
+	int r;
+	struct fsh_buffer*b;
 	if(!fsh_check(f))RET(EBADF);
 	if(!buffer||!br)RET(EINVAL);
 	const fsdrv*drv=f->driver,*use=drv;
@@ -230,7 +300,22 @@ int fs_read_locked(fsh*f,void*buffer,size_t btr,size_t*br){
 	if(!use||!use->read)RET(ENOSYS);
 	if(!fs_has_flag(f->flags,FILE_FLAG_READ))RET(EPERM);
 	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
-	RET(use->read(drv,f,buffer,btr,br));
+	if(!(b=get_buffer(f)))RET(use->read(drv,f,buffer,btr,br));
+	if((r=buffer_flush(f))!=0)RET(r);
+	if(b->pos>=b->len){
+		b->pos=b->len=0;
+
+		// reads as large as the window gain nothing from a copy
+		if(btr>=b->size)RET(use->read(drv,f,buffer,btr,br));
+		if((r=use->read(drv,f,b->data,b->size,&b->len))!=0){
+			b->len=0;
+			RET(r);
+		}
+	}
+	*br=MIN(btr,b->len-b->pos);
+	memcpy(buffer,b->data+b->pos,*br);
+	b->pos+=*br;
+	RET(0);
 }
 
 int fs_read_all_locked(fsh*f,void**buffer,size_t*br){
@@ -245,6 +330,8 @@ int fs_read_all_locked(fsh*f,void**buffer,size_t*br){
 }
 
 int fs_write_locked(fsh*f,void*buffer,size_t btw,size_t*bw){
+	int r;
+	struct fsh_buffer*b;
 	if(!fsh_check(f))RET(EBADF);
 	if(!buffer||!bw)RET(EINVAL);
 	const fsdrv*drv=f->driver,*use=drv;
@@ -253,7 +340,164 @@ int fs_write_locked(fsh*f,void*buffer,size_t btw,size_t*bw){
 	if(use->readonly_fs||drv->readonly_fs)RET(EROFS);
 	if(!fs_has_flag(f->flags,FILE_FLAG_WRITE))RET(EPERM);
 	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
-	RET(use->write(drv,f,buffer,btw,bw));
+	if(!(b=get_buffer(f)))RET(use->write(drv,f,buffer,btw,bw));
+	if((r=buffer_drop(f))!=0)RET(r);
+	if(b->len+btw>b->size&&(r=buffer_flush(f))!=0)RET(r);
+	if(btw>=b->size)RET(use->write(drv,f,buffer,btw,bw));
+	memcpy(b->data+b->len,buffer,btw);
+	b->len+=btw,b->dirty=true,*bw=btw;
+	RET(0);
+}
+
+// one call per buffer, stops at the first short transfer like readv
+static int iov_loop(fsh*f,const fs_iovec*iov,size_t cnt,size_t*done,bool write){
+	int r;
+	size_t n;
+	for(size_t i=0;i<cnt;i++){
+		if(iov[i].length<=0)continue;
+		n=0,r=write?
+			fs_write_locked(f,iov[i].buffer,iov[i].length,&n):
+			fs_read_locked(f,iov[i].buffer,iov[i].length,&n);
+		if(r!=0)RET(*done>0?0:r);
+		*done+=n;
+		if(n<iov[i].length)break;
+	}
+	RET(0);
+}
+
+int fs_readv_locked(fsh*f,const fs_iovec*iov,size_t cnt,size_t*br){
+	if(!fsh_check(f))RET(EBADF);
+	if(!iov||!br)RET(EINVAL);
+	*br=0;
+	const fsdrv*drv=f->driver,*use=drv;
+	while(use&&!use->readv)use=use->base;
+	if(!use||!use->readv||fs_has_flag(f->flags,FILE_FLAG_BUFFERED))
+		RET(iov_loop(f,iov,cnt,br,false));
+	if(!fs_has_flag(f->flags,FILE_FLAG_READ))RET(EPERM);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+	RET(use->readv(drv,f,iov,cnt,br));
+}
+
+int fs_writev_locked(fsh*f,const fs_iovec*iov,size_t cnt,size_t*bw){
+	if(!fsh_check(f))RET(EBADF);
+	if(!iov||!bw)RET(EINVAL);
+	*bw=0;
+	const fsdrv*drv=f->driver,*use=drv;
+	while(use&&!use->writev)use=use->base;
+	if(!use||!use->writev||fs_has_flag(f->flags,FILE_FLAG_BUFFERED))
+		RET(iov_loop(f,iov,cnt,bw,true));
+	if(use->readonly_fs||drv->readonly_fs)RET(EROFS);
+	if(!fs_has_flag(f->flags,FILE_FLAG_WRITE))RET(EPERM);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+	RET(use->writev(drv,f,iov,cnt,bw));
+}
+
+// caller holds the lock, runs the request at once and restores the position
+static int io_sync(fs_io*io){
+	int r,e;
+	size_t pos=0,n;
+	fsh*f=io->file;
+	char*buf=io->buffer;
+	if((r=fs_tell_locked(f,&pos))!=0)RET(r);
+	if((r=fs_seek_locked(f,io->offset,SEEK_SET))!=0)RET(r);
+	while(io->done<io->size){
+		n=0,r=io->op==FS_IO_WRITE?
+			fs_write_locked(f,buf+io->done,io->size-io->done,&n):
+			fs_read_locked(f,buf+io->done,io->size-io->done,&n);
+		if(r==EINTR)continue;
+		if(r!=0||n==0)break;
+		io->done+=n;
+	}
+	if(r==0&&io->op==FS_IO_WRITE)r=buffer_flush(f);
+	e=fs_seek_locked(f,pos,SEEK_SET);
+	RET(r?:e);
+}
+
+// caller holds the lock
+static int io_start(fs_io*io){
+	int r;
+	fsh*f=io->file;
+	const fsdrv*drv=f->driver,*use=drv;
+	if(io->op==FS_IO_WRITE){
+		if(drv->readonly_fs)RET(EROFS);
+		if(!fs_has_flag(f->flags,FILE_FLAG_WRITE))RET(EPERM);
+	}else if(!fs_has_flag(f->flags,FILE_FLAG_READ))RET(EPERM);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+
+	// the driver sees the data coalesced so far, read-ahead may go stale
+	if((r=buffer_flush(f))!=0)RET(r);
+	if(io->op==FS_IO_WRITE&&(r=buffer_drop(f))!=0)RET(r);
+	while(use&&!use->submit)use=use->base;
+	if(use&&use->submit){
+		r=use->submit(drv,f,io);
+		if(r!=ENOTSUP&&r!=EAGAIN)RET(r);
+	}
+	r=io_sync(io);
+	io->result=r,io->finished=true;
+	RET(r);
+}
+
+int fs_submit(fs_io**ios,size_t cnt){
+	int r,ret=0;
+	fs_io*io;
+	if(!ios)RET(EINVAL);
+	for(size_t i=0;i<cnt;i++){
+		if(!(io=ios[i]))continue;
+		io->finished=false,io->result=0;
+		io->done=0,io->priv=NULL;
+		if(!fsh_check(io->file))r=EBADF;
+		else if(!io->buffer)r=EINVAL;
+		else if(io->op!=FS_IO_READ&&io->op!=FS_IO_WRITE)r=EINVAL;
+		else{
+			MUTEX_LOCK(io->file->lock);
+			r=io_start(io);
+			MUTEX_UNLOCK(io->file->lock);
+		}
+		if(r!=0){
+			io->result=r,io->finished=true;
+			if(!ret)ret=r;
+		}
+	}
+	RET(ret);
+}
+
+// timeout in ms applies to each pending request, negative waits forever
+int fs_complete(fs_io**ios,size_t cnt,long timeout){
+	int r,ret=0;
+	fs_io*io;
+	if(!ios)RET(EINVAL);
+	for(size_t i=0;i<cnt;i++){
+		if(!(io=ios[i]))continue;
+		if(!__atomic_load_n(&io->finished,__ATOMIC_ACQUIRE)){
+			const fsdrv*use=io->file->driver;
+			while(use&&!use->complete)use=use->base;
+			r=use&&use->complete?
+				use->complete(io->file->driver,io,timeout):
+				EINVAL;
+			if(r!=0){
+				if(!ret)ret=r;
+				continue;
+			}
+		}
+		if(io->result!=0&&!ret)ret=io->result;
+	}
+	RET(ret);
+}
+
+int fs_copy_to_locked(fsh*f,int fd,size_t size,size_t*sent){
+	int r;
+	if(!fsh_check(f)||fd<0)RET(EBADF);
+	if(!sent)RET(EINVAL);
+
+	// buffered data must be consumed through fs_read
+	if((r=buffer_flush(f))!=0)RET(r);
+	if(f->buffer&&f->buffer->pos<f->buffer->len)RET(EBUSY);
+	const fsdrv*drv=f->driver,*use=drv;
+	while(use&&!use->copy_to)use=use->base;
+	if(!use||!use->copy_to)RET(ENOSYS);
+	if(!fs_has_flag(f->flags,FILE_FLAG_READ))RET(EPERM);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+	RET(use->copy_to(drv,f,fd,size,sent));
 }
 
 int fs_wait_locked(
@@ -304,20 +548,40 @@ int fs_wait_locked(
 }
 
 int fs_seek_locked(fsh*f,size_t pos,int whence){
+	int r;
+	struct fsh_buffer*b;
 	if(!fsh_check(f))RET(EBADF);
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->seek)use=use->base;
 	if(!use||!use->seek)RET(ENOSYS);
+	if((r=buffer_flush(f))!=0)RET(r);
+	if((b=f->buffer)){
+		// the driver is ahead of the caller by the unread data
+		if(whence==SEEK_CUR)pos-=b->len-b->pos;
+		b->pos=b->len=0;
+	}
+	if(f->dir){
+		// the next batch takes a fresh listing
+		dir_cache_put(f->dir);
+		f->dir=NULL,f->dir_pos=0;
+	}
 	RET(use->seek(drv,f,pos,whence));
 }
 
 int fs_tell_locked(fsh*f,size_t*pos){
+	int r;
+	struct fsh_buffer*b;
 	if(!fsh_check(f))RET(EBADF);
 	if(!pos)RET(EINVAL);
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->tell)use=use->base;
 	if(!use||!use->tell)RET(ENOSYS);
-	RET(use->tell(drv,f,pos));
+	if((r=use->tell(drv,f,pos))!=0)RET(r);
+	if((b=f->buffer)){
+		if(b->dirty)*pos+=b->len-b->pos;
+		else *pos-=b->len-b->pos;
+	}
+	RET(0);
 }
 
 int fs_map_locked(
@@ -327,7 +591,9 @@ int fs_map_locked(
 	size_t*size,
 	fs_file_flag flag
 ){
+	int r;
 	if(!fsh_check(f))RET(EBADF);
+	if((r=buffer_flush(f))!=0)RET(r);
 	if(!buffer||!size)RET(EINVAL);
 	if(fs_has_flag(flag,FILE_FLAG_CREATE))RET(EINVAL);
 	const fsdrv*drv=f->driver,*use=drv;
@@ -361,6 +627,7 @@ int fs_get_info_locked(fsh*f,fs_file_info*info){
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->get_info)use=use->base;
 	if(!use||!use->get_info)RET(ENOSYS);
+	if((r=buffer_flush(f))!=0)RET(r);
 	t=time(NULL);
 	if(t-f->cache_info_time>=use->cache_info_time)
 		r=use->get_info(drv,f,&f->cached_info);
@@ -384,7 +651,9 @@ int fs_get_type_locked(fsh*f,fs_type*type){
 }
 
 int fs_get_size_locked(fsh*f,size_t*out){
+	int r;
 	if(!fsh_check(f))RET(EBADF);
+	if((r=buffer_flush(f))!=0)RET(r);
 	if(!out)RET(EINVAL);
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->get_size)use=use->base;
@@ -403,6 +672,7 @@ int fs_get_name_locked(fsh*f,char*buff,size_t buff_len){
 }
 
 int fs_set_size_locked(fsh*f,size_t size){
+	int r;
 	if(!fsh_check(f))RET(EBADF);
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->resize)use=use->base;
@@ -410,7 +680,32 @@ int fs_set_size_locked(fsh*f,size_t size){
 	if(!use->resize)RET(ENOSYS);
 	if(!fs_has_flag(f->flags,FILE_FLAG_WRITE))RET(EPERM);
 	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
-	RET(use->resize(drv,f,size));
+	if((r=buffer_flush(f))!=0||(r=buffer_drop(f))!=0)RET(r);
+	if((r=use->resize(drv,f,size))==0)dir_cache_invalidate(f->url);
+	RET(r);
+}
+
+int fs_set_buffer_locked(fsh*f,size_t size){
+	int r;
+	char*data;
+	if(!fsh_check(f))RET(EBADF);
+	if(fs_has_flag(f->flags,FILE_FLAG_FOLDER))RET(EISDIR);
+	if((r=buffer_flush(f))!=0||(r=buffer_drop(f))!=0)RET(r);
+	if(size==0){
+		f->flags&=~FILE_FLAG_BUFFERED;
+		if(f->buffer){
+			if(f->buffer->data)free(f->buffer->data);
+			free(f->buffer);
+			f->buffer=NULL;
+		}
+		RET(0);
+	}
+	f->flags|=FILE_FLAG_BUFFERED;
+	if(!get_buffer(f))RET(ENOMEM);
+	if(f->buffer->size==size)RET(0);
+	if(!(data=realloc(f->buffer->data,size)))RET(ENOMEM);
+	f->buffer->data=data,f->buffer->size=size;
+	RET(0);
 }
 
 int fs_get_url_locked(fsh*f,url**out){
@@ -452,13 +747,22 @@ int fs_get_features_locked(fsh*f,fs_feature*features){
 }
 
 int fs_rename_uri_locked(fsh*f,url*to){
+	int r;
+	char*u;
 	if(!fsh_check(f))RET(EBADF);
 	if(!to||!to->path)RET(EINVAL);
 	const fsdrv*drv=f->driver,*use=drv;
 	while(use&&!use->rename)use=use->base;
 	if(!use||use->readonly_fs||drv->readonly_fs)RET(EROFS);
 	if(!use->rename)RET(ENOSYS);
-	RET(use->rename(drv,f,to));
+	if((r=use->rename(drv,f,to))==0){
+		dir_cache_invalidate(f->url);
+		if((u=url_generate_alloc(to))){
+			dir_cache_invalidate(u);
+			free(u);
+		}
+	}
+	RET(r);
 }
 
 int fs_rename_locked(fsh*f,const char*to){
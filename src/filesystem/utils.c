@@ -140,20 +140,33 @@ int fs_full_read_alloc_locked(fsh*f,void**buffer,size_t btr){
 	RET(r);
 }
 
-int fs_read_to_locked(
+// fd behind a handle when writing it is a plain write(2)
+static int direct_fd(fsh*t){
+	const fsdrv*use=t->driver;
+	while(use&&!use->write)use=use->base;
+	if(!use||use->write!=fsdrv_posix_write)return -1;
+	if(use->readonly_fs||t->driver->readonly_fs)return -1;
+	if(!fs_has_flag(t->flags,FILE_FLAG_WRITE))return -1;
+	if(fs_has_flag(t->flags,FILE_FLAG_FOLDER))return -1;
+	return t->fd>0?t->fd:-1;
+}
+
+static int read_to(
 	fsh*f,
 	fsh*t,
+	int fd,
 	size_t size,
 	size_t*sent
 ){
-	int r;
+	int r=0;
 	char buff[FS_BUF_SIZE];
 	size_t br,rd=0,bs;
-	if(!fsh_check(f))RET(EBADF);
-	if(!fsh_check(t))RET(EBADF);
+
+	// let the driver move the data without a copy first,
+	// on failure the buffered loop continues after the sent part
+	if(fd>=0&&size>0&&fs_copy_to_locked(f,fd,size,&rd)==0)goto done;
 	do{
-		errno=0,br=0;
-		bs=MAX(size-rd,sizeof(buff));
+		errno=0,br=0,bs=MIN(size-rd,sizeof(buff));
 		r=fs_read_locked(f,buff,bs,&br),rd+=br;
 		if(r!=0){
 			if(r==EINTR)continue;
@@ -167,47 +180,41 @@ int fs_read_to_locked(
 			}
 			RET(r);
 		}
-		if(br>0&&(r=fs_full_write_locked(
-			t,buff,br
-		))!=0)RET(r);
+		if(br>0){
+			if(t){
+				if((r=fs_full_write_locked(
+					t,buff,br
+				))!=0)RET(r);
+			}else if(full_write(
+				fd,buff,br
+			)!=(ssize_t)br)EXRET(EIO);
+		}
 		if(br==0||br!=bs)break;
 	}while(size>rd);
-	if(sent)*sent=br;
+	done:
+	if(sent)*sent=rd;
 	RET(0);
 }
 
+int fs_read_to_locked(
+	fsh*f,
+	fsh*t,
+	size_t size,
+	size_t*sent
+){
+	if(!fsh_check(f))RET(EBADF);
+	if(!fsh_check(t))RET(EBADF);
+	return read_to(f,t,direct_fd(t),size,sent);
+}
+
 int fs_read_to_fd_locked(
 	fsh*f,
 	int fd,
 	size_t size,
 	size_t*sent
 ){
-	int r=0;
-	char buff[FS_BUF_SIZE];
-	size_t br,rd=0,bs;
 	if(!fsh_check(f)||fd<0)RET(EBADF);
-	do{
-		errno=0,br=0,bs=MIN(size-rd,sizeof(buff));
-		r=fs_read_locked(f,buff,bs,&br),rd+=br;
-		if(r!=0){
-			if(r==EINTR)continue;
-			if(r==EAGAIN){
-				if((r=fs_wait_locked(
-					NULL,&f,1,-1,
-					FILE_WAIT_IO_READ,
-					false
-				))!=0)RET(r);
-				continue;
-			}
-			RET(r);
-		}
-		if(br>0&&full_write(
-			fd,buff,br
-		)!=(ssize_t)br)EXRET(EIO);
-		if(br==0||br!=bs)break;
-	}while(size>rd);
-	if(sent)*sent=br;
-	RET(r);
+	return read_to(f,NULL,fd,size,sent);
 }
 
 int fs_full_read_to_locked(fsh*f,fsh*t,size_t size){
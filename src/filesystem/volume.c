@@ -8,6 +8,10 @@
 
 #include"fs_internal.h"
 
+static fsvol_info**table=NULL;
+static size_t table_cnt=0;
+static uint64_t table_gen=0;
+
 static bool cmp_fsid(list*l,void*d){
 	if(!l||!d)return false;
 	LIST_DATA_DECLARE(f,l,fsvol_private_info*);
@@ -137,7 +141,7 @@ fsvol_info**fsvol_get_by_driver_name(const char*name){
 	if((l=list_first(fs_volume_infos)))do{
 		LIST_DATA_DECLARE(info,l,fsvol_info*);
 		if(!fsvol_info_check(info))continue;
-		if(strcmp(name,info->name)==0)cnt++;
+		if(strcmp(name,info->driver)==0)cnt++;
 	}while((l=l->next));
 	size=(cnt+1)*sizeof(fsvol_info*);
 	if(cnt>0&&(infos=malloc(size))){
@@ -145,7 +149,7 @@ fsvol_info**fsvol_get_by_driver_name(const char*name){
 		if((l=list_first(fs_volume_infos)))do{
 			LIST_DATA_DECLARE(info,l,fsvol_info*);
 			if(!fsvol_info_check(info))continue;
-			if(strcmp(name,info->name)==0)infos[i++]=info;
+			if(strcmp(name,info->driver)==0)infos[i++]=info;
 			if(i>=cnt)break;
 		}while((l=l->next));
 	}
@@ -193,22 +197,38 @@ int fsvol_open_volume(fsvol_info*info,fsh**nf){
 
 fsvol_info**fsvol_get_volumes(){
 	list*l;
-	int cnt,i=0;
-	size_t size=0;
-	fsvol_info**infos=NULL;
+	size_t size;
+	fsvol_info**infos=NULL,**n;
 	fsvol_info_initialize();
+
+	// cheap unless a volume driver got notified of a change
+	fsvol_rescan();
 	MUTEX_LOCK(fsvol_info_lock);
-	cnt=list_count(fs_volume_infos);
-	if(cnt>0)size=(cnt+1)*sizeof(fsvol_info*);
-	if(cnt>0&&size>0&&(infos=malloc(size))){
-		memset(infos,0,size);
-		if((l=list_first(fs_volume_infos)))do{
-			LIST_DATA_DECLARE(info,l,fsvol_info*);
-			if(!fsvol_info_check(info))continue;
-			infos[i++]=info;
-			if(i>=cnt)break;
-		}while((l=l->next));
+
+	// volumes only come and go by add or delete, both bump the generation
+	if(!table||table_gen!=fsvol_generation){
+		size=(list_count(fs_volume_infos)+1)*sizeof(fsvol_info*);
+		if((n=realloc(table,size))){
+			table=n,table_cnt=0;
+			if((l=list_first(fs_volume_infos)))do{
+				LIST_DATA_DECLARE(info,l,fsvol_info*);
+				if(fsvol_info_check(info))table[table_cnt++]=info;
+			}while((l=l->next));
+			table[table_cnt]=NULL,table_gen=fsvol_generation;
+		}
+	}
+	if(table&&table_cnt>0){
+		size=(table_cnt+1)*sizeof(fsvol_info*);
+		if((infos=malloc(size)))memcpy(infos,table,size);
 	}
 	MUTEX_UNLOCK(fsvol_info_lock);
 	return infos;
 }
+
+uint64_t fsvol_get_generation(){
+	fsvol_info_initialize();
+	MUTEX_LOCK(fsvol_info_lock);
+	uint64_t gen=fsvol_generation;
+	MUTEX_UNLOCK(fsvol_info_lock);
+	return gen;
+}
@@ -10,8 +10,8 @@
 #include<linux/fs.h>
 #include<sys/ioctl.h>
 #include<sys/statfs.h>
-#include<libblkid/blkid.h>
 #include"system.h"
+#include"devd.h"
 #include"linux.h"
 #include"md5.h"
 #include"str.h"
@@ -31,23 +31,23 @@ void fill_from_block_path(fsvol_private_info*info,char*block){
 	char*value;
 	struct fsvol_info_fs*fs=&info->info.fs;
 	struct fsvol_info_part*p=&info->info.part;
-	if((value=blkid_get_tag_value(NULL,"TYPE",block))){
+	if((value=blk_get_tag_value(block,"TYPE"))){
 		strncpy(fs->type,value,sizeof(fs->type)-1);
 		free(value);
 	}
-	if((value=blkid_get_tag_value(NULL,"UUID",block))){
+	if((value=blk_get_tag_value(block,"UUID"))){
 		strncpy(fs->uuid,value,sizeof(fs->uuid)-1);
 		free(value);
 	}
-	if((value=blkid_get_tag_value(NULL,"PARTUUID",block))){
+	if((value=blk_get_tag_value(block,"PARTUUID"))){
 		strncpy(p->uuid,value,sizeof(p->uuid)-1);
 		free(value);
 	}
-	if((value=blkid_get_tag_value(NULL,"LABEL",block))){
+	if((value=blk_get_tag_value(block,"LABEL"))){
 		strncpy(fs->label,value,sizeof(fs->label)-1);
 		free(value);
 	}
-	if((value=blkid_get_tag_value(NULL,"PARTLABEL",block))){
+	if((value=blk_get_tag_value(block,"PARTLABEL"))){
 		strncpy(p->label,value,sizeof(p->label)-1);
 		free(value);
 	}
@@ -56,6 +56,7 @@ void fill_from_block_path(fsvol_private_info*info,char*block){
 		ioctl(fd,BLKGETSIZE64,&p->size);
 		ioctl(fd,BLKGETSIZE,&p->sector_count);
 		ioctl(fd,BLKSSZGET,&p->sector_size);
+		close(fd);
 	}
 }
 
@@ -6,6 +6,9 @@
  *
  */
 
+#include<poll.h>
+#include<fcntl.h>
+#include<unistd.h>
 #include<sys/statfs.h>
 #include<libblkid/blkid.h>
 #include"system.h"
@@ -13,17 +16,23 @@
 #include"../fs_internal.h"
 
 struct mnt_info{
-	bool found;
+	bool found,probed;
 	struct mount_item*mnt;
 };
 
+// kept open, the kernel flags it on every mount table change
+static int mounts_fd=-1;
+
 static int fs_volume_update_core(fsvol_private_info*info,struct statfs*st){
 	struct mnt_info*mi;
 	if(!info||!(mi=info->data))RET(EINVAL);
 	if(st)fill_from_statfs(info,st);
 	fill_from_mount_item(info,mi->mnt);
-	if(strncmp(mi->mnt->source,"/dev/",5)==0)
+
+	// tags of a mounted block device stay, only space is worth refreshing
+	if(!mi->probed&&strncmp(mi->mnt->source,"/dev/",5)==0)
 		fill_from_block_path(info,mi->mnt->source);
+	mi->probed=true;
 	RET(0);
 }
 
@@ -96,8 +105,19 @@ static void renew_all(const fsvol*vol,bool found,bool delete){
 	free(infos);
 }
 
+static bool mounts_changed(){
+	struct pollfd p;
+	if(mounts_fd<0){
+		mounts_fd=open(_PATH_PROC_SELF"/mounts",O_RDONLY|O_CLOEXEC);
+		return true;
+	}
+	p.fd=mounts_fd,p.events=POLLPRI,p.revents=0;
+	return poll(&p,1,0)!=0;
+}
+
 static int fs_volume_scan(const fsvol*vol){
 	struct mount_item**ms,*m;
+	if(!mounts_changed())RET(0);
 	if(!(ms=read_proc_mounts()))EXRET(ENOENT);
 	renew_all(vol,false,false);
 	for(size_t i=0;(m=ms[i]);i++)
@@ -135,4 +155,8 @@ static fsvol vol_mount={
 
 void fsvol_register_mount(bool deinit){
 	if(!deinit)fsvol_register_dup(&vol_mount);
+	else if(mounts_fd>=0){
+		close(mounts_fd);
+		mounts_fd=-1;
+	}
 }
@@ -30,6 +30,11 @@ struct vol_data{
 	EFI_HANDLE*hand;
 };
 
+// signaled by the firmware when a volume protocol gets installed
+static EFI_EVENT vol_event=NULL;
+static VOID*vol_regs[2]={NULL,NULL};
+static volatile BOOLEAN vol_changed=TRUE;
+
 static int fs_volume_update_core(fsvol_private_info*info){
 	CHAR16*txt=NULL;
 	struct vol_data*d;
@@ -190,9 +195,53 @@ static int scan_by_guid(const fsvol*vol,EFI_GUID*guid){
 	RET(0);
 }
 
+static VOID EFIAPI vol_notify(IN EFI_EVENT ev,IN VOID*ctx){
+	(VOID)ev,(VOID)ctx;
+	vol_changed=TRUE;
+}
+
+static void vol_register_notify(){
+	EFI_STATUS st;
+	if(vol_event)return;
+	st=gBS->CreateEvent(
+		EVT_NOTIFY_SIGNAL,TPL_CALLBACK,
+		vol_notify,NULL,&vol_event
+	);
+	if(EFI_ERROR(st)){
+		vol_event=NULL;
+		return;
+	}
+	gBS->RegisterProtocolNotify(
+		&gEfiSimpleFileSystemProtocolGuid,
+		vol_event,&vol_regs[0]
+	);
+	gBS->RegisterProtocolNotify(
+		&gEfiBlockIoProtocolGuid,
+		vol_event,&vol_regs[1]
+	);
+}
+
+// uninstalls are not notified, drop handles that lost their device path
+static void drop_stale(const fsvol*vol){
+	VOID*dp;
+	struct vol_data*d;
+	fsvol_private_info*info,**infos;
+	if(!(infos=fsvolp_get_by_driver_name(vol->name)))return;
+	for(size_t i=0;(info=infos[i]);i++)if((d=info->data)&&EFI_ERROR(
+		gBS->HandleProtocol(d->hand,&gEfiDevicePathProtocolGuid,&dp)
+	))fsvol_info_delete(info);
+	free(infos);
+}
+
 static int fs_volume_scan(const fsvol*vol){
 	struct vol_data*d;
 	fsvol_private_info*info,**infos;
+	vol_register_notify();
+	if(vol_event&&!vol_changed){
+		drop_stale(vol);
+		RET(0);
+	}
+	vol_changed=FALSE;
 	if((infos=fsvolp_get_by_driver_name(vol->name))){
 		for(size_t i=0;(info=infos[i]);i++)
 			if((d=info->data))d->found=FALSE;
@@ -255,4 +304,8 @@ static fsvol vol_uefi={
 
 void fsvol_register_uefi(bool deinit){
 	if(!deinit)fsvol_register_dup(&vol_uefi);
+	else if(vol_event){
+		gBS->CloseEvent(vol_event);
+		vol_event=NULL,vol_changed=TRUE;
+	}
 }
@@ -9,7 +9,6 @@
 #define _GNU_SOURCE
 #include<fcntl.h>
 #include<stdio.h>
-#include<dirent.h>
 #include<string.h>
 #include<stdbool.h>
 #include<sys/mount.h>
@@ -73,18 +72,9 @@ int open_usb_gadget(){
 }
 
 char*gadget_find_udc(){
-	insmod("udc-core",false);
-	DIR*d=opendir(_PATH_SYS_CLASS"/udc");
-	if(!d){
-		telog_error("cannot open UDC class");
-		return NULL;
-	}
-	char*udc=NULL;
-	struct dirent*r=NULL;
-	while((r=readdir(d)))
-		if(!is_virt_dir(r)&&r->d_type==DT_LNK)udc=r->d_name;
-	if(!udc){
-		tlog_error("cannot find usable UDC.");
+	static char udc[256];
+	if(!gadget_select_udc(udc,sizeof(udc),NULL)){
+		telog_error("cannot find usable UDC");
 		return NULL;
 	}
 	return udc;
@@ -9,6 +9,7 @@
 #define _GNU_SOURCE
 #include<string.h>
 #include<stdlib.h>
+#include"str.h"
 #include"init_internal.h"
 #include"service.h"
 #include"version.h"
@@ -22,14 +23,22 @@
 
 static char*base="gadget.func";
 
+/*
+ * the whole gadget subtree comes from confd in one request,
+ * descriptors, strings, configs and functions are all read from it,
+ * so bring-up does not wait on a confd round trip per value
+ * gadget.udc is a selector (fnmatch pattern), when no udc matches yet
+ * the gadget stays registered and devd binds it when the udc appears
+ */
+struct gadget_conf{
+	struct confd_item*items;
+	size_t cnt;
+};
+
 static void init_gadget_conf(){
 	char*udc=confd_get_string("runtime.cmdline.udc",NULL);
 	char*serial=confd_get_string("runtime.cmdline.serial","1234567890");
 	if(!serial)return;
-	if(!udc){
-		udc=gadget_find_udc();
-		if(udc)udc=strdup(udc);
-	}
 
 	confd_set_string("gadget.name","gadget");
 	confd_set_integer("gadget.id_vendor",0x0519);
@@ -58,11 +67,36 @@ static void init_gadget_conf(){
 	free(serial);
 }
 
-static int gadget_init_console(char*item,gadget*g,gadget_func*f){
+static struct confd_item*conf_find(struct gadget_conf*c,const char*item,const char*key,enum conf_type type){
+	char path[256];
+	if(item)snprintf(path,sizeof(path),"func.%s.%s",item,key);
+	else strlcpy(path,key,sizeof(path));
+	for(size_t i=0;i<c->cnt;i++)
+		if(c->items[i].type==type&&strcmp(c->items[i].path,path)==0)
+			return &c->items[i];
+	return NULL;
+}
+
+static char*conf_str(struct gadget_conf*c,const char*item,const char*key,char*def){
+	struct confd_item*i=conf_find(c,item,key,TYPE_STRING);
+	return i?i->value.string:def;
+}
+
+static int64_t conf_int(struct gadget_conf*c,const char*item,const char*key,int64_t def){
+	struct confd_item*i=conf_find(c,item,key,TYPE_INTEGER);
+	return i?i->value.integer:def;
+}
+
+static bool conf_bool(struct gadget_conf*c,const char*item,const char*key,bool def){
+	struct confd_item*i=conf_find(c,item,key,TYPE_BOOLEAN);
+	return i?i->value.boolean:def;
+}
+
+static int gadget_init_console(struct gadget_conf*c,char*item,gadget*g,gadget_func*f){
 	char buf[256]={0},tty[512]={0};
 	if(gadget_add_function(g,f)<0)
 		return trlog_warn(-1,"add gadget console func %s failed",item);
-	if(!confd_get_boolean_dict(base,item,"console",false))return 0;
+	if(!conf_bool(c,item,"console",false))return 0;
 	if(fd_read_file(
 		g->dir_fd,buf,sizeof(buf),false,
 		"functions/%s.%s/port_num",
@@ -80,29 +114,28 @@ static int gadget_init_console(char*item,gadget*g,gadget_func*f){
 	return 0;
 }
 
-static int gadget_init_generic(char*item,gadget*g,gadget_func*f){
+static int gadget_init_generic(struct gadget_conf*c __attribute__((unused)),char*item,gadget*g,gadget_func*f){
 	if(gadget_add_function(g,f)<0)tlog_warn("add gadget func %s failed",item);
 	return 0;
 }
 
-static int gadget_init_adbd(char*item,gadget*g,gadget_func*f){
-	char*path=confd_get_string_dict(base,item,"path",NULL);
+static int gadget_init_adbd(struct gadget_conf*c,char*item,gadget*g,gadget_func*f){
+	char*path=conf_str(c,item,"path",NULL);
 	if(!path){
 		tlog_warn("no path specified for adbd");
 		return -1;
 	}
 	if(gadget_add_func_adbd(g,f->name,path)<0)
 		tlog_warn("add gadget adbd func %s failed",item);
-	if(path)free(path);
 	return 0;
 }
 
-static int gadget_init_mass(char*item,gadget*g,gadget_func*f){
+static int gadget_init_mass(struct gadget_conf*c,char*item,gadget*g,gadget_func*f){
 	struct stat st;
-	bool removable=confd_get_boolean_dict(base,item,"removable",true);
-	bool cdrom=confd_get_boolean_dict(base,item,"cdrom",false);
-	bool ro=confd_get_boolean_dict(base,item,"ro",false);
-	char*path=confd_get_string_dict(base,item,"path",NULL);
+	bool removable=conf_bool(c,item,"removable",true);
+	bool cdrom=conf_bool(c,item,"cdrom",false);
+	bool ro=conf_bool(c,item,"ro",false);
+	char*path=conf_str(c,item,"path",NULL);
 	if(!path)return trlog_warn(-1,"no path specified for mass storage");
 	if(path[0]!='/')return trlog_warn(-1,"block path is not absolute");
 	if(stat(path,&st)!=0)return terlog_warn(-1,"stat path failed");
@@ -117,12 +150,13 @@ static int gadget_init_mass(char*item,gadget*g,gadget_func*f){
 	};
 	if(gadget_add_function(g,f)<0)
 		tlog_warn("add gadget mass storage func %s failed",item);
-	if(path)free(path);
 	return 0;
 }
 
 static int gadget_startup(struct service*svc __attribute__((unused))){
-	#define XERR(msg...) {tlog_error(msg);goto fail;}
+	#define XERR(msg...) {tlog_error(msg);goto done;}
+	int r=-1;
+	struct gadget_conf c={NULL,0};
 	struct gadget_string gs={
 		.id=0x409,.serialnumber=NULL,
 		.product=NULL,.manufacturer=NULL,
@@ -136,51 +170,59 @@ static int gadget_startup(struct service*svc __attribute__((unused))){
 		.strings = GADGET_STRARRAY{&gs,NULL},
 		.configs = GADGET_CFGARRAY{&gc,NULL},
 	};
-	char**items,*item,*udc;
+	char*item,*mode,*sel,udc[256];
 	open_default_confd_socket(false,TAG);
 	if(confd_get_type("gadget")!=TYPE_KEY)init_gadget_conf();
-	if(!(g.name=confd_get_string("gadget.name",NULL)))XERR("invalid gadget name")
-	if((g.vendor=confd_get_integer("gadget.id_vendor",0))==0)XERR("invalid vendor id")
-	if((g.product=confd_get_integer("gadget.id_product",0))==0)XERR("invalid product id")
-	if(!(gs.manufacturer=confd_get_string("gadget.manufacturer",NULL)))XERR("invalid manufacturer")
-	if(!(gs.product=confd_get_string("gadget.product",NULL)))XERR("invalid product")
-	if(!(gs.serialnumber=confd_get_string("gadget.serial",NULL)))XERR("invalid serial")
-	if(!(gcs.configuration=confd_get_string("gadget.config",NULL)))XERR("invalid config")
+	if(!(c.items=confd_get_tree("gadget",&c.cnt)))XERR("failed to read gadget config")
+	if(!(g.name=conf_str(&c,NULL,"name",NULL)))XERR("invalid gadget name")
+	if((g.vendor=conf_int(&c,NULL,"id_vendor",0))==0)XERR("invalid vendor id")
+	if((g.product=conf_int(&c,NULL,"id_product",0))==0)XERR("invalid product id")
+	if(!(gs.manufacturer=conf_str(&c,NULL,"manufacturer",NULL)))XERR("invalid manufacturer")
+	if(!(gs.product=conf_str(&c,NULL,"product",NULL)))XERR("invalid product")
+	if(!(gs.serialnumber=conf_str(&c,NULL,"serial",NULL)))XERR("invalid serial")
+	if(!(gcs.configuration=conf_str(&c,NULL,"config",NULL)))XERR("invalid config")
+	g.device=conf_int(&c,NULL,"bcd_device",0);
+	g.USB=conf_int(&c,NULL,"bcd_usb",0);
+	g.devClass=conf_int(&c,NULL,"dev_class",0);
+	g.devSubClass=conf_int(&c,NULL,"dev_subclass",0);
+	g.devProtocol=conf_int(&c,NULL,"dev_protocol",0);
+	gc.attributes=conf_int(&c,NULL,"attributes",0);
+	gc.max_power=conf_int(&c,NULL,"max_power",500);
 	tlog_info("register gadget");
-	if(gadget_register(&g)<0)XERR("failed to register gadget");
-	if(!(items=confd_ls(base)))XERR("failed to read functions list")
-	for(int i=0;(item=items[i]);i++){
+	if(gadget_register(&g)<0)XERR("failed to register gadget")
+	for(size_t i=0;i<c.cnt;i++){
 		gadget_func f={0};
-		char*mode;
-		f.name=confd_get_string_dict(base,item,"name",NULL);
-		f.function=confd_get_string_dict(base,item,"func",NULL);
-		mode=confd_get_string_dict(base,item,"mode","generic");
-		if(!f.name||!f.function||!mode)tlog_warn("invalid name or func, skip func %d",i);
-		else if(strcmp(mode,"generic")==0)gadget_init_generic(item,&g,&f);
-		else if(strcmp(mode,"console")==0)gadget_init_console(item,&g,&f);
-		else if(strcmp(mode,"adbd")==0)gadget_init_adbd(item,&g,&f);
-		else if(strcmp(mode,"mass")==0)gadget_init_mass(item,&g,&f);
+		if(c.items[i].type!=TYPE_KEY)continue;
+		if(strncmp(c.items[i].path,"func.",5)!=0)continue;
+		item=(char*)c.items[i].path+5;
+		if(!item[0]||strchr(item,'.'))continue;
+		f.name=conf_str(&c,item,"name",NULL);
+		f.function=conf_str(&c,item,"func",NULL);
+		mode=conf_str(&c,item,"mode","generic");
+		if(!f.name||!f.function)tlog_warn("invalid name or func, skip func %s",item);
+		else if(strcmp(mode,"generic")==0)gadget_init_generic(&c,item,&g,&f);
+		else if(strcmp(mode,"console")==0)gadget_init_console(&c,item,&g,&f);
+		else if(strcmp(mode,"adbd")==0)gadget_init_adbd(&c,item,&g,&f);
+		else if(strcmp(mode,"mass")==0)gadget_init_mass(&c,item,&g,&f);
 		else tlog_warn("unknown gadget mode %s, skip func %s",mode,item);
-		if(f.name)free(f.name);
-		if(f.function)free(f.function);
-		if(mode)free(mode);
 	}
-	if(items[0])free(items[0]);
-	free(items);
-	if(!(udc=confd_get_string("gadget.udc",gadget_find_udc())))XERR("get gadget udc failed")
-	int r=gadget_start(&g,udc);
-	if(r<0)tlog_error("start gadget failed with %s",udc);
-	free(udc);
-	if(r<0)goto fail;
+	sel=conf_str(&c,NULL,"udc",NULL);
+	if(!gadget_select_udc(udc,sizeof(udc),sel)){
+		tlog_info("no UDC matches '%s' yet, bind when it appears",sel?sel:"*");
+		r=0;
+		goto done;
+	}
+
+	// devd may have bound it from a udc uevent meanwhile
+	if(
+		gadget_bind_udc(g.dir_fd,g.name,udc)<0&&
+		fd_read_file(g.dir_fd,udc,sizeof(udc),false,"UDC")<=0
+	)XERR("start gadget failed with %s",udc)
 	tlog_info("usb gadget initialized");
-	return 0;
-	fail:
-	if(g.name)free(g.name);
-	if(gs.product)free(gs.product);
-	if(gs.manufacturer)free(gs.manufacturer);
-	if(gs.serialnumber)free(gs.serialnumber);
-	if(gcs.configuration)free(gcs.configuration);
-	return -1;
+	r=0;
+	done:
+	if(c.items)free(c.items);
+	return r;
 }
 
 static int gadget_shutdown(struct service*svc __attribute__((unused))){
@@ -0,0 +1,112 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<string.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<fnmatch.h>
+#include"str.h"
+#include"lock.h"
+#include"confd.h"
+#include"system.h"
+#include"logger.h"
+#include"gadget.h"
+#include"pathnames.h"
+#define TAG "gadget"
+#define UDC _PATH_SYS_CLASS"/udc"
+
+/*
+ * udc hotplug, devd passes every udc uevent here
+ * a udc that probes after the gadget service started, or comes back
+ * after an otg role switch, gets the configured gadget bound again,
+ * gadget.udc selects which udc may take it (fnmatch pattern, any when unset)
+ * the bound udc, its state and how long the bind took (us) are kept in
+ * runtime.gadget.udc, runtime.gadget.state and runtime.gadget.bind_latency
+ */
+static mutex_t udc_lock=MUTEX_INITIALIZER;
+
+char*gadget_select_udc(char*buff,size_t len,const char*sel){
+	DIR*d;
+	struct dirent*e;
+	if(!buff||len<=0)EPRET(EINVAL);
+	insmod("udc-core",false);
+	if(!(d=opendir(UDC)))EPRET(ENODEV);
+	buff[0]=0;
+	while((e=readdir(d))){
+		if(is_virt_dir(e)||e->d_type!=DT_LNK)continue;
+		if(sel&&sel[0]&&fnmatch(sel,e->d_name,0)!=0)continue;
+		strlcpy(buff,e->d_name,len);
+		break;
+	}
+	closedir(d);
+	if(!buff[0])EPRET(ENODEV);
+	return buff;
+}
+
+int gadget_bind_udc(int fd,const char*name,const char*udc){
+	int64_t us;
+	struct timespec a,b;
+	if(fd<0||!name||!udc)ERET(EINVAL);
+	clock_gettime(CLOCK_MONOTONIC,&a);
+	if(gadget_start_fd(fd,udc)<0)
+		return terlog_error(-1,"bind gadget '%s' to UDC '%s' failed",name,udc);
+	clock_gettime(CLOCK_MONOTONIC,&b);
+	us=(b.tv_sec-a.tv_sec)*1000000+(b.tv_nsec-a.tv_nsec)/1000;
+	tlog_info("bound gadget '%s' to UDC '%s' in %lldus",name,udc,(long long)us);
+	confd_set_string("runtime.gadget.udc",(char*)udc);
+	confd_set_integer("runtime.gadget.bind_latency",us);
+	return 0;
+}
+
+int gadget_udc_event(const char*udc,bool present){
+	int o,g=-1;
+	char*name=NULL,*sel=NULL,cur[256],state[64];
+	if(!udc||!udc[0]||strchr(udc,'/'))ERET(EINVAL);
+	MUTEX_LOCK(udc_lock);
+	if(!(name=confd_get_string("gadget.name",NULL)))goto done;
+	sel=confd_get_string("gadget.udc",NULL);
+	if(sel&&sel[0]&&fnmatch(sel,udc,0)!=0)goto done;
+	if((o=open_usb_gadget())<0)goto done;
+	g=openat(o,name,O_DIR|O_CLOEXEC);
+	close(o);
+
+	// not registered yet, the service binds when it starts
+	if(g<0)goto done;
+	if(fd_read_file(g,cur,sizeof(cur),false,"UDC")<0)cur[0]=0;
+	trim(cur);
+	if(!present){
+		if(strcmp(cur,udc)!=0)goto done;
+		tlog_info("UDC '%s' of gadget '%s' removed",udc,name);
+		confd_delete("runtime.gadget.udc");
+		confd_delete("runtime.gadget.state");
+		goto done;
+	}
+	if(fd_read_file(AT_FDCWD,state,sizeof(state),false,UDC"/%s/state",udc)>0)
+		confd_set_string("runtime.gadget.state",state);
+
+	// the kernel binds a returning udc with the same name by itself
+	if(strcmp(cur,udc)==0){
+		confd_set_string("runtime.gadget.udc",cur);
+		goto done;
+	}
+
+	// bound to another udc that is still there
+	if(cur[0]&&fd_is_link(AT_FDCWD,UDC"/%s",cur))goto done;
+	if(cur[0])gadget_stop_fd(g);
+	gadget_bind_udc(g,name,udc);
+	done:
+	MUTEX_UNLOCK(udc_lock);
+	if(g>=0)close(g);
+	if(name)free(name);
+	if(sel)free(sel);
+	return 0;
+}
@@ -29,6 +29,7 @@ extern struct gui_register guireg_text_edit;
 extern struct gui_register guireg_conf_save;
 extern struct gui_register guireg_conf_load;
 extern struct gui_register guireg_benchmark;
+extern struct gui_register guireg_boottime;
 extern struct gui_register guireg_backlight;
 extern struct gui_register guireg_logviewer;
 extern struct gui_register guireg_clipboard;
@@ -60,6 +61,7 @@ struct gui_register*guiact_register[]={
 	&guireg_uefi_shell,
 	&guireg_mouse_menu,
 	&guireg_boot_linux,
+	&guireg_boottime,
 	&guireg_acpi_load,
 	&guireg_fdt_load,
 	#else
@@ -0,0 +1,199 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_GUI
+#include<string.h>
+#include<sys/stat.h>
+#include"gui.h"
+#include"assets.h"
+#include"logger.h"
+#include"font_bin.h"
+#include"gui/font.h"
+#define TAG "fontbin"
+
+/*
+ * prerendered fonts from src/host/fontbin.c, glyphs are drawn by the
+ * lvgl text font code straight out of the buffer, only the glyph
+ * descriptors and code point lists are unpacked. the buffer must stay
+ * for the font lifetime. numbers are read as host endian, the same as
+ * lv_font_load does.
+ */
+struct font_bin{
+	lv_font_t font;
+	lv_font_fmt_txt_dsc_t dsc;
+	lv_font_fmt_txt_glyph_cache_t cache;
+};
+
+static inline uint32_t rd32(const unsigned char*p){
+	uint32_t v;
+	memcpy(&v,p,sizeof(v));
+	return v;
+}
+
+// returns table body length, the position moves past the table
+static ssize_t get_table(
+	const unsigned char*data,size_t len,
+	size_t*pos,const char*label,
+	const unsigned char**body
+){
+	struct font_bin_label l;
+	if(len-*pos<sizeof(l))return -1;
+	memcpy(&l,data+*pos,sizeof(l));
+	if(memcmp(l.label,label,4)!=0)return -1;
+	if(l.length<sizeof(l)||l.length>len-*pos)return -1;
+	*body=data+*pos+sizeof(l);
+	*pos+=l.length;
+	return l.length-sizeof(l);
+}
+
+void lv_font_bin_destroy(lv_font_t*font){
+	struct font_bin*fb=(struct font_bin*)font;
+	lv_font_fmt_txt_cmap_t*cmaps;
+	if(!fb)return;
+	if((cmaps=(lv_font_fmt_txt_cmap_t*)fb->dsc.cmaps)){
+		for(uint16_t i=0;i<fb->dsc.cmap_num;i++)
+			if(cmaps[i].unicode_list)lv_mem_free((void*)cmaps[i].unicode_list);
+		lv_mem_free(cmaps);
+	}
+	if(fb->dsc.glyph_dsc)lv_mem_free((void*)fb->dsc.glyph_dsc);
+	lv_mem_free(fb);
+}
+
+static bool load_cmaps(struct font_bin*fb,const unsigned char*cmap,size_t len,uint32_t glyphs){
+	uint32_t cnt;
+	uint16_t*list;
+	struct font_bin_cmap c;
+	lv_font_fmt_txt_cmap_t*cmaps;
+	size_t hdr=sizeof(struct font_bin_label);
+	if(len<4||(cnt=rd32(cmap))==0||cnt>511)return false;
+	if((len-4)/sizeof(c)<cnt)return false;
+	if(!(cmaps=lv_mem_alloc(sizeof(lv_font_fmt_txt_cmap_t)*cnt)))return false;
+	memset(cmaps,0,sizeof(lv_font_fmt_txt_cmap_t)*cnt);
+	fb->dsc.cmaps=cmaps,fb->dsc.cmap_num=cnt;
+	for(uint32_t i=0;i<cnt;i++){
+		memcpy(&c,cmap+4+i*sizeof(c),sizeof(c));
+		if(c.format_type!=FONT_BIN_CMAP_SPARSE_TINY)return false;
+		if(c.data_offset<hdr||c.data_offset-hdr>len)return false;
+		if(c.data_entries_count*sizeof(uint16_t)>len-(c.data_offset-hdr))return false;
+		if((uint32_t)c.glyph_id_start+c.data_entries_count>glyphs)return false;
+		if(!(list=lv_mem_alloc(c.data_entries_count*sizeof(uint16_t))))return false;
+		memcpy(list,cmap+c.data_offset-hdr,c.data_entries_count*sizeof(uint16_t));
+		cmaps[i].unicode_list=list;
+		cmaps[i].list_length=c.data_entries_count;
+		cmaps[i].range_start=c.range_start;
+		cmaps[i].range_length=c.range_length;
+		cmaps[i].glyph_id_start=c.glyph_id_start;
+		cmaps[i].type=LV_FONT_FMT_TXT_CMAP_SPARSE_TINY;
+	}
+	return true;
+}
+
+static bool load_glyphs(
+	struct font_bin*fb,
+	const unsigned char*loca,size_t loca_len,
+	const unsigned char*glyf,size_t glyf_len
+){
+	uint32_t cnt,off;
+	const unsigned char*g;
+	lv_font_fmt_txt_glyph_dsc_t*dsc;
+	size_t hdr=sizeof(struct font_bin_label);
+	cnt=rd32(loca);
+	if(cnt==0||(loca_len-4)/4<cnt)return false;
+	if(!(dsc=lv_mem_alloc(sizeof(lv_font_fmt_txt_glyph_dsc_t)*cnt)))return false;
+	memset(dsc,0,sizeof(lv_font_fmt_txt_glyph_dsc_t)*cnt);
+	fb->dsc.glyph_dsc=dsc;
+
+	// offsets count from the glyf label, so does the bitmap index
+	fb->dsc.glyph_bitmap=glyf-hdr;
+	for(uint32_t i=1;i<cnt;i++){
+		off=rd32(loca+4+i*4);
+		if(off<hdr||off-hdr>glyf_len||glyf_len-(off-hdr)<FONT_BIN_GLYPH_HDR)return false;
+		g=glyf+off-hdr;
+		dsc[i].adv_w=g[0]*16;
+		dsc[i].ofs_x=(int8_t)g[1];
+		dsc[i].ofs_y=(int8_t)g[2];
+		dsc[i].box_w=g[3];
+		dsc[i].box_h=g[4];
+		dsc[i].bitmap_index=off+FONT_BIN_GLYPH_HDR;
+		if((size_t)g[3]*g[4]>glyf_len-(off-hdr)-FONT_BIN_GLYPH_HDR)return false;
+	}
+	return true;
+}
+
+lv_font_t*lv_font_bin_init_data(const unsigned char*data,size_t len){
+	size_t pos=0;
+	struct font_bin*fb;
+	struct font_bin_head h;
+	ssize_t head_len,cmap_len,loca_len,glyf_len;
+	const unsigned char*head,*cmap,*loca,*glyf;
+	if(!data||len<=0)return NULL;
+	if(
+		(head_len=get_table(data,len,&pos,"head",&head))<(ssize_t)sizeof(h)||
+		(cmap_len=get_table(data,len,&pos,"cmap",&cmap))<0||
+		(loca_len=get_table(data,len,&pos,"loca",&loca))<4||
+		(glyf_len=get_table(data,len,&pos,"glyf",&glyf))<0
+	){
+		tlog_error("bad font tables");
+		return NULL;
+	}
+	memcpy(&h,head,sizeof(h));
+	if(
+		h.index_to_loc_format!=FONT_BIN_LOCA_U32||
+		h.bits_per_pixel!=FONT_BIN_BPP||
+		h.advance_width_format!=0||
+		h.advance_width_bits!=FONT_BIN_ADV_BITS||
+		h.xy_bits!=FONT_BIN_XY_BITS||
+		h.wh_bits!=FONT_BIN_WH_BITS||
+		h.compression_id!=LV_FONT_FMT_TXT_PLAIN
+	){
+		tlog_error("unsupported font format");
+		return NULL;
+	}
+	if(!(fb=lv_mem_alloc(sizeof(struct font_bin))))return NULL;
+	memset(fb,0,sizeof(struct font_bin));
+	if(
+		!load_glyphs(fb,loca,loca_len,glyf,glyf_len)||
+		!load_cmaps(fb,cmap,cmap_len,rd32(loca))
+	){
+		tlog_error("bad font data");
+		lv_font_bin_destroy(&fb->font);
+		return NULL;
+	}
+	fb->dsc.cache=&fb->cache;
+	fb->dsc.bpp=FONT_BIN_BPP;
+	fb->dsc.bitmap_format=LV_FONT_FMT_TXT_PLAIN;
+	fb->font.dsc=&fb->dsc;
+	fb->font.get_glyph_dsc=lv_font_get_glyph_dsc_fmt_txt;
+	fb->font.get_glyph_bitmap=lv_font_get_bitmap_fmt_txt;
+	fb->font.line_height=h.ascent-h.descent;
+	fb->font.base_line=-h.descent;
+	fb->font.subpx=LV_FONT_SUBPX_NONE;
+	fb->font.underline_position=h.underline_position;
+	fb->font.underline_thickness=h.underline_thickness;
+	return &fb->font;
+}
+
+// a missing file is not an error, prerendered sizes are optional
+lv_font_t*lv_font_bin_init_assets(entry_dir*assets,const char*path){
+	lv_font_t*font;
+	entry_file*f;
+	if(!assets||!path||!(f=get_assets_file(assets,path)))return NULL;
+	if(f->length<=0||!S_ISREG(f->info.mode)){
+		tlog_error("load invalid assets font from %s",path);
+		return NULL;
+	}
+	asset_file_hold(f);
+	if((font=lv_font_bin_init_data((unsigned char*)f->content,f->length)))
+		tlog_info("prerendered font %s size %zu bytes",path,f->length);
+	return font;
+}
+
+lv_font_t*lv_font_bin_init_rootfs(const char*path){
+	return lv_font_bin_init_assets(&assets_rootfs,path);
+}
+#endif
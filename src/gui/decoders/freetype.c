@@ -32,7 +32,6 @@ typedef struct{
 	lv_font_t*font;
 	uint16_t style;
 	uint16_t height;
-	FT_Face face;
 }lv_font_fmt_ft_dsc_t;
 static FT_Library library;
 static lv_ll_t names_ll;
@@ -97,24 +96,147 @@ void lv_freetype_destroy(void){
 	FT_Done_FreeType(library);
 }
 
-static bool get_bold_glyph(
-	const lv_font_t*font,
+/*
+ * bold and italic glyphs are rendered from a copy of the outline, the
+ * shared face is never transformed. the bitmaps are kept in a small
+ * lru cache keyed by font (face and size) and glyph, bounded by bitmap
+ * bytes, so styled text renders each glyph once.
+ */
+#define GLYPH_BUCKETS 256
+#define GLYPH_CACHE   0x100000
+
+typedef struct styled_glyph{
+	struct styled_glyph*hnext,*prev,*next;
+	const lv_font_fmt_ft_dsc_t*font;
+	FT_UInt index;
+	uint16_t adv_w,box_w,box_h;
+	int16_t ofs_x,ofs_y;
+	size_t size;
+	uint8_t bitmap[];
+}styled_glyph;
+
+static struct glyph_cache{
+	styled_glyph*table[GLYPH_BUCKETS];
+	styled_glyph*head,*tail;
+	size_t used;
+}glyphs;
+
+static inline size_t glyph_bucket(const lv_font_fmt_ft_dsc_t*font,FT_UInt index){
+	return (((uintptr_t)font>>4)*31+index)%GLYPH_BUCKETS;
+}
+
+static void glyph_unlink(styled_glyph*g){
+	if(g->prev)g->prev->next=g->next;
+	else glyphs.head=g->next;
+	if(g->next)g->next->prev=g->prev;
+	else glyphs.tail=g->prev;
+	g->prev=g->next=NULL;
+}
+
+static void glyph_push(styled_glyph*g){
+	g->prev=NULL,g->next=glyphs.head;
+	if(glyphs.head)glyphs.head->prev=g;
+	else glyphs.tail=g;
+	glyphs.head=g;
+}
+
+static void glyph_remove(styled_glyph*g){
+	styled_glyph**p=&glyphs.table[glyph_bucket(g->font,g->index)];
+	while(*p&&*p!=g)p=&(*p)->hnext;
+	if(*p)*p=g->hnext;
+	glyph_unlink(g);
+	glyphs.used-=g->size;
+	free(g);
+}
+
+static styled_glyph*glyph_lookup(const lv_font_fmt_ft_dsc_t*font,FT_UInt index){
+	styled_glyph*g=glyphs.table[glyph_bucket(font,index)];
+	for(;g;g=g->hnext){
+		if(g->font!=font||g->index!=index)continue;
+		if(g!=glyphs.head)glyph_unlink(g),glyph_push(g);
+		return g;
+	}
+	return NULL;
+}
+
+static void glyph_purge(const lv_font_fmt_ft_dsc_t*font){
+	styled_glyph*g,*n;
+	for(g=glyphs.head;g;g=n){
+		n=g->next;
+		if(g->font==font)glyph_remove(g);
+	}
+}
+
+size_t lv_freetype_trim(bool all){
+	size_t used=glyphs.used;
+	while(glyphs.tail&&glyphs.used>(all?0:used/2))
+		glyph_remove(glyphs.tail);
+
+	// faces, sizes and sbits of freetype reload on the next lookup
+	if(all&&cache_manager)FTC_Manager_Reset(cache_manager);
+	return used-glyphs.used;
+}
+
+static styled_glyph*glyph_render(
+	const lv_font_fmt_ft_dsc_t*dsc,
+	FT_Face face,
+	FT_UInt index
+){
+	size_t w,h,size,bucket;
+	styled_glyph*g=NULL;
+	FT_Glyph glyph=NULL;
+	FT_BitmapGlyph bmp;
+	FT_Matrix italic={
+		.xx=1<<16,.xy=0x5800,
+		.yx=0,.yy=1<<16,
+	};
+	if(FT_Load_Glyph(face,index,FT_LOAD_DEFAULT|FT_LOAD_NO_BITMAP))return NULL;
+	if(FT_Get_Glyph(face->glyph,&glyph))return NULL;
+	if(glyph->format==FT_GLYPH_FORMAT_OUTLINE){
+		if(dsc->style&FT_FONT_STYLE_BOLD)
+			FT_Outline_Embolden(&((FT_OutlineGlyph)glyph)->outline,1<<6);
+		if(dsc->style&FT_FONT_STYLE_ITALIC)
+			FT_Glyph_Transform(glyph,&italic,NULL);
+	}
+	if(FT_Glyph_To_Bitmap(&glyph,FT_RENDER_MODE_NORMAL,NULL,1))goto done;
+	bmp=(FT_BitmapGlyph)glyph;
+	w=bmp->bitmap.width,h=bmp->bitmap.rows,size=w*h;
+	if(!(g=malloc(sizeof(styled_glyph)+size)))goto done;
+	memset(g,0,sizeof(styled_glyph));
+	for(size_t y=0;y<h;y++)memcpy(
+		g->bitmap+y*w,
+		bmp->bitmap.buffer+y*bmp->bitmap.pitch,w
+	);
+	g->font=dsc,g->index=index,g->size=sizeof(styled_glyph)+size;
+	g->adv_w=face->glyph->metrics.horiAdvance>>6;
+	g->box_w=w,g->box_h=h;
+	g->ofs_x=bmp->left,g->ofs_y=bmp->top-h;
+
+	// evict from the cold end to make room
+	while(glyphs.tail&&glyphs.used+g->size>GLYPH_CACHE)
+		glyph_remove(glyphs.tail);
+	bucket=glyph_bucket(dsc,index);
+	g->hnext=glyphs.table[bucket],glyphs.table[bucket]=g;
+	glyph_push(g);
+	glyphs.used+=g->size;
+	done:
+	if(glyph)FT_Done_Glyph(glyph);
+	return g;
+}
+
+static bool get_styled_glyph(
+	lv_font_fmt_ft_dsc_t*dsc,
 	FT_Face face,
 	FT_UInt glyph_index,
 	lv_font_glyph_dsc_t*dsc_out
 ){
-	if(FT_Load_Glyph(face,glyph_index,FT_LOAD_DEFAULT))return false;
-	lv_font_fmt_ft_dsc_t*dsc=(lv_font_fmt_ft_dsc_t*)(font->dsc);
-	if(
-		face->glyph->format==FT_GLYPH_FORMAT_OUTLINE&&
-		dsc->style&FT_FONT_STYLE_BOLD
-	)FT_Outline_Embolden(&face->glyph->outline,1<<6);
-	if(FT_Render_Glyph(face->glyph,FT_RENDER_MODE_NORMAL))return false;
-	dsc_out->adv_w=(face->glyph->metrics.horiAdvance>>6);
-	dsc_out->box_h=face->glyph->bitmap.rows;
-	dsc_out->box_w=face->glyph->bitmap.width;
-	dsc_out->ofs_x=face->glyph->bitmap_left;
-	dsc_out->ofs_y=face->glyph->bitmap_top-face->glyph->bitmap.rows;
+	styled_glyph*g=glyph_lookup(dsc,glyph_index);
+	if(!g&&!(g=glyph_render(dsc,face,glyph_index)))return false;
+	dsc_out->adv_w=g->adv_w;
+	dsc_out->box_h=g->box_h;
+	dsc_out->box_w=g->box_w;
+	dsc_out->ofs_x=g->ofs_x;
+	dsc_out->ofs_y=g->ofs_y;
 	dsc_out->bpp=8;
 	return true;
 }
@@ -155,20 +277,8 @@ static bool get_glyph_dsc_cb(
 		charmap_index,unicode_letter
 	);
 	dsc_out->is_placeholder=glyph_index==0;
-	if(dsc->style&FT_FONT_STYLE_ITALIC){
-		FT_Matrix italic_matrix;
-		italic_matrix.xx=1<<16;
-		italic_matrix.xy=0x5800;
-		italic_matrix.yx=0;
-		italic_matrix.yy=1<<16;
-		FT_Set_Transform(face,&italic_matrix,NULL);
-	}
-	if(dsc->style&FT_FONT_STYLE_BOLD){
-		dsc->face=face;
-		if(!get_bold_glyph(font,face,glyph_index,dsc_out)){
-			dsc->face=NULL;
-			return false;
-		}
+	if(dsc->style&(FT_FONT_STYLE_BOLD|FT_FONT_STYLE_ITALIC)){
+		if(!get_styled_glyph(dsc,face,glyph_index,dsc_out))return false;
 		goto end;
 	}
 	FTC_ImageTypeRec desc_type;
@@ -202,15 +312,23 @@ static bool get_glyph_dsc_cb(
 
 static const uint8_t*get_glyph_bitmap_cb(
 	const lv_font_t*font,
-	uint32_t ul __attribute__((unused))
+	uint32_t unicode_letter
 ){
+	FT_Face face;
+	styled_glyph*g;
+	FT_UInt glyph_index;
 	lv_font_fmt_ft_dsc_t*dsc=(lv_font_fmt_ft_dsc_t*)(font->dsc);
-	if(dsc->style&FT_FONT_STYLE_BOLD){
-		if(dsc->face&&dsc->face->glyph->format==FT_GLYPH_FORMAT_BITMAP)
-			return (const uint8_t*)(dsc->face->glyph->bitmap.buffer);
-		return NULL;
-	}
-	return (const uint8_t*)sbit->buffer;
+	if(!(dsc->style&(FT_FONT_STYLE_BOLD|FT_FONT_STYLE_ITALIC)))
+		return (const uint8_t*)sbit->buffer;
+
+	// the glyph was just cached by get_glyph_dsc_cb
+	if(FTC_Manager_LookupFace(cache_manager,(FTC_FaceID)dsc,&face))return NULL;
+	glyph_index=FTC_CMapCache_Lookup(
+		cmap_cache,(FTC_FaceID)dsc,
+		FT_Get_Charmap_Index(face->charmap),
+		unicode_letter
+	);
+	return (g=glyph_lookup(dsc,glyph_index))?g->bitmap:NULL;
 }
 static const char*name_refer_find(const char*name){
 	name_refer_t*refer=_lv_ll_get_head(&names_ll);
@@ -317,6 +435,7 @@ void lv_ft_font_destroy(lv_font_t*font){
 	if(!font)return;
 	lv_font_fmt_ft_dsc_t*dsc=(lv_font_fmt_ft_dsc_t*)(font->dsc);
 	if(dsc){
+		glyph_purge(dsc);
 		FTC_Manager_RemoveFaceID(cache_manager,(FTC_FaceID)dsc);
 		name_refer_del(dsc->name);
 		lv_mem_free(dsc);
@@ -343,6 +462,9 @@ lv_font_t*lv_ft_init_assets(entry_dir*assets,char*path,int weight,lv_ft_style st
 		return NULL;
 	}
 	telog_info("assets font %s size %zu bytes",path,f->length);
+
+	// the font is read from this buffer for as long as it exists
+	asset_file_hold(f);
 	return lv_ft_init_data((unsigned char*)f->content,f->length,weight,style);
 }
 
@@ -6,11 +6,14 @@
  *
  */
 
+#define _GNU_SOURCE
 #ifdef ENABLE_GUI
 #include<stdlib.h>
 #include<string.h>
 #include<sys/stat.h>
+#include"gui.h"
 #include"list.h"
+#include"lock.h"
 #include"confd.h"
 #include"logger.h"
 #include"gui/image.h"
@@ -41,9 +44,28 @@ image_decoder*img_decoders[]={
 	NULL
 };
 
-static list*caches=NULL;
-static time_t cache_time=5;
-static long cache_hit=0,cache_miss=0,load_fail=0;
+/*
+ * decoded images live in a hash table for lookups and a lru list for
+ * eviction, most recently used first. the list is bounded by decoded
+ * bytes (gui.image_cache_size), the coldest images go first. images
+ * lvgl has open for drawing are pinned until closed and never freed.
+ * gui.image_cache_time also drops images unused for that many seconds,
+ * 0 keeps them as long as they fit.
+ */
+#define CACHE_BUCKETS 256
+#define CACHE_SIZE    0x2000000
+
+// theme indexes are shared with the decode workers
+static mutex_t resolve_lock=MUTEX_INITIALIZER;
+
+static struct image_cache{
+	image_data*table[CACHE_BUCKETS];
+	image_data*head,*tail;
+	size_t used,count;
+}cache;
+static size_t cache_size=CACHE_SIZE;
+static time_t cache_time=0;
+static long cache_hit=0,cache_miss=0,load_fail=0,cache_evict=0;
 
 image_decoder*image_get_decoder(char*ext){
 	char*e=NULL;
@@ -71,66 +93,147 @@ static int image_free_data(void*d){
 	return 0;
 }
 
-static image_data*image_get_cache(char*path){
-	if(!path||!caches)return NULL;
-	list*l=list_first(caches);
-	if(l)do{
-		LIST_DATA_DECLARE(c,l,image_data*);
-		if(!c||strcmp(path,c->path)!=0)continue;
+// fnv-1a
+static uint32_t path_hash(const char*path){
+	uint32_t h=0x811C9DC5;
+	while(*path)h=(h^(unsigned char)*path++)*0x01000193;
+	return h;
+}
+
+static void lru_unlink(image_data*c){
+	if(c->prev)c->prev->next=c->next;
+	else cache.head=c->next;
+	if(c->next)c->next->prev=c->prev;
+	else cache.tail=c->prev;
+	c->prev=c->next=NULL;
+}
+
+static void lru_push(image_data*c){
+	c->prev=NULL,c->next=cache.head;
+	if(cache.head)cache.head->prev=c;
+	else cache.tail=c;
+	cache.head=c;
+}
+
+static void cache_remove(image_data*c){
+	image_data**p=&cache.table[c->hash%CACHE_BUCKETS];
+	while(*p&&*p!=c)p=&(*p)->hnext;
+	if(*p)*p=c->hnext;
+	lru_unlink(c);
+	cache.used-=c->size,cache.count--;
+	image_free_data(c);
+}
+
+// plain lookups take any size, sized ones a full or a large enough decode
+static bool cache_fits(image_data*c,uint32_t w,uint32_t h){
+	if(w==0&&h==0)return true;
+	if(c->hint_w==0&&c->hint_h==0)return true;
+	return c->hint_w>=w&&c->hint_h>=h;
+}
+
+static image_data*image_get_cache(char*path,uint32_t w,uint32_t h){
+	uint32_t hash;
+	image_data*c;
+	if(!path||cache.count<=0)return NULL;
+	hash=path_hash(path);
+	for(c=cache.table[hash%CACHE_BUCKETS];c;c=c->hnext){
+		if(c->hash!=hash||strcmp(path,c->path)!=0)continue;
+		if(!cache_fits(c,w,h))continue;
 		time(&c->last);
+		if(c!=cache.head)lru_unlink(c),lru_push(c);
 		return c;
-	}while((l=l->next));
+	}
 	return NULL;
 }
 
-int image_cache_gc(void){
+// evict from the cold end until size fits, keep stays
+static int cache_shrink(size_t size,image_data*keep){
 	int cnt=0;
+	image_data*c,*p;
+	for(c=cache.tail;c&&cache.used>size;c=p){
+		p=c->prev;
+		if(c->pins>0||c==keep)continue;
+		cache_remove(c);
+		cache_evict++,cnt++;
+	}
+	return cnt;
+}
+
+int image_cache_gc(void){
 	time_t t;
-	list*l=list_first(caches),*n;
+	image_data*c,*p;
+	int cnt=cache_shrink(cache_size,NULL);
+	if(cache_time<=0)return cnt;
 	time(&t);
-	if(l)do{
-		n=l->next;
-		LIST_DATA_DECLARE(c,l,image_data*);
-		if(!c)continue;
-		if(t-c->last>5){
-			list_obj_del(&caches,l,image_free_data);
-			cnt++;
-		}
-	}while((l=n));
+
+	// ordered by last use, everything after the first recent one is newer
+	for(c=cache.tail;c&&t-c->last>cache_time;c=p){
+		p=c->prev;
+		if(c->pins>0)continue;
+		cache_remove(c);
+		cache_evict++,cnt++;
+	}
 	return cnt;
 }
 
+size_t image_cache_trim(bool all){
+	size_t used=cache.used;
+	cache_shrink(all?0:used/2,NULL);
+	return used-cache.used;
+}
+
 void image_cache_clean(void){
-	list_free_all(caches,image_free_data);
-	caches=NULL;
+	while(cache.head)cache_remove(cache.head);
+	memset(&cache,0,sizeof(cache));
 }
 
 static void image_add_cache(image_data*img){
+	size_t bucket;
+	image_data*c,*n;
 	if(!img||!img->pixels||!img->path[0])return;
-	list*l=list_first(caches),*n;
-	if(l)do{
-		n=l->next;
-		LIST_DATA_DECLARE(c,l,image_data*);
-		if(!c)continue;
-		if(c==img)return;
-		if(strcmp(img->path,c->path)==0)
-			list_obj_del(&caches,l,image_free_data);
-	}while((l=n));
+	img->hash=path_hash(img->path),img->pins=0;
+	bucket=img->hash%CACHE_BUCKETS;
+
+	// a new decode replaces older sizes of the same image
+	for(c=cache.table[bucket];c;c=n){
+		n=c->hnext;
+		if(c->pins>0||c->hash!=img->hash)continue;
+		if(strcmp(c->path,img->path)==0)cache_remove(c);
+	}
+	img->size=sizeof(image_data)+lv_img_buf_get_img_size(
+		img->width,img->height,img->format
+	);
 	time(&img->last);
-	list_obj_add_new_notnull(&caches,img);
+	img->hnext=cache.table[bucket],cache.table[bucket]=img;
+	lru_push(img);
+	cache.used+=img->size,cache.count++;
+	cache_shrink(cache_size,img);
+}
+
+struct icon_file{
+	fsh*f;
+	unsigned char*data;
+	size_t len;
+	bool mapped;
+	image_decoder*d;
+};
+
+static void icon_file_free(struct icon_file*file){
+	if(file->mapped)fs_unmap(file->f,file->data,file->len);
+	else if(file->data)free(file->data);
+	if(file->f)fs_close(&file->f);
+	memset(file,0,sizeof(struct icon_file));
 }
 
 static bool load_icon(
 	struct icon_theme*theme,
 	struct icon_theme_search_path*s,
 	char*type,char*path,
-	unsigned char**data,
-	size_t*len,
-	image_decoder**d
+	struct icon_file*file
 ){
 	int r=0;
-	fsh*f=NULL;
-	if(!path||!data||!len||!d)return false;
+	void*buf=NULL;
+	if(!path||!file)return false;
 	if(!type){
 		if(!(type=strrchr(path,'.'))||strchr(type,'/')){
 			tlog_warn("'%s' image type not set",path);
@@ -138,11 +241,19 @@ static bool load_icon(
 		}
 		type++;
 	}
-	if(!(*d=image_get_decoder(type))||!(*d)->decode_cb)return false;
-	r=fs_open(s?s->folder:theme->root,&f,path,FILE_FLAG_READ);
+	if(!(file->d=image_get_decoder(type))||!file->d->decode_cb)return false;
+	r=fs_open(s?s->folder:theme->root,&file->f,path,FILE_FLAG_READ);
 	if(r!=0)return false;
-	r=fs_read_all(f,(void**)data,len);
-	fs_close(&f);
+
+	// decode straight from a mapped view when nothing writes into it
+	if(!file->d->modify_data&&fs_map(file->f,&buf,0,&file->len,FILE_FLAG_READ)==0){
+		file->data=buf,file->mapped=true;
+		return true;
+	}
+	file->len=0;
+	r=fs_read_all(file->f,&buf,&file->len);
+	file->data=buf;
+	fs_close(&file->f);
 	return r==0;
 }
 
@@ -150,13 +261,12 @@ static bool load_search_path(
 	struct icon_theme*theme,
 	struct icon_theme_search_path*s,
 	char*path,
-	unsigned char**data,
-	size_t*len,
-	image_decoder**d
+	struct icon_file*file,
+	struct icon_theme_name_mapping**found
 ){
 	list*l;
 	bool ret=false;
-	if(!theme||!path||!data||!len||!d)return false;
+	if(!theme||!path||!file)return false;
 	if(path[0]=='@'){
 		path++;
 		if((l=list_first(theme->name_mapping)))do{
@@ -165,75 +275,141 @@ static bool load_search_path(
 			if(icon->name&&strcmp(path,icon->name)!=0)continue;
 			if(icon->regex&&regexp_exec(icon->regex,path,NULL,0)!=0)continue;
 			if(icon->search&&(!s||!s->id||strcmp(icon->search,s->id)!=0))continue;
-			if(load_icon(theme,s,icon->type,icon->path,data,len,d))return true;
+			if(load_icon(theme,s,icon->type,icon->path,file)){
+				*found=icon;
+				return true;
+			}
+			icon_file_free(file);
 		}while((l=l->next));
-	}else ret=load_icon(theme,s,NULL,path,data,len,d);
+	}else if(!(ret=load_icon(theme,s,NULL,path,file)))icon_file_free(file);
 	return ret;
 }
 
-static bool load_theme(
+/*
+ * every theme memoizes where a name resolved, mapping and search path,
+ * or that it resolved nowhere. themes do not change once loaded, the
+ * next lookup of a name is one probe and at most one open.
+ */
+static icon_theme_resolved*theme_index_get(
+	struct icon_theme*theme,
+	const char*path,
+	uint32_t hash
+){
+	icon_theme_resolved*r;
+	for(r=theme->index[hash%ICON_THEME_INDEX_SIZE];r;r=r->next)
+		if(r->hash==hash&&strcmp(r->name,path)==0)return r;
+	return NULL;
+}
+
+static void theme_index_set(
+	struct icon_theme*theme,
+	icon_theme_resolved*r,
+	const char*path,
+	uint32_t hash,
+	bool found,
+	struct icon_theme_search_path*s,
+	struct icon_theme_name_mapping*map
+){
+	size_t len=strlen(path)+1,bucket=hash%ICON_THEME_INDEX_SIZE;
+	if(!r){
+		if(!(r=malloc(sizeof(icon_theme_resolved)+len)))return;
+		memcpy(r->name,path,len);
+		r->hash=hash;
+		r->next=theme->index[bucket];
+		theme->index[bucket]=r;
+	}
+	r->found=found,r->search=s,r->map=map;
+}
+
+static bool load_theme_index(
+	struct icon_theme*theme,
 	char*path,
-	unsigned char**data,
-	size_t*len,
-	image_decoder**d
+	uint32_t hash,
+	struct icon_file*file
 ){
-	list*l,*s;
+	list*s;
+	struct icon_theme_name_mapping*map=NULL;
+	icon_theme_resolved*r=theme_index_get(theme,path,hash);
+	if(r&&!r->found)return false;
+	if(r){
+		if(load_icon(
+			theme,r->search,
+			r->map?r->map->type:NULL,
+			r->map?r->map->path:path,file
+		))return true;
+		icon_file_free(file);
+	}
+
+	// first lookup in this theme, or the resolved file went away
+	if((s=list_first(theme->search_path)))do{
+		LIST_DATA_DECLARE(search,s,struct icon_theme_search_path*);
+		if(!search)continue;
+		if(load_search_path(theme,search,path,file,&map)){
+			theme_index_set(theme,r,path,hash,true,search,map);
+			return true;
+		}
+	}while((s=s->next));
+	if(load_search_path(theme,NULL,path,file,&map)){
+		theme_index_set(theme,r,path,hash,true,NULL,map);
+		return true;
+	}
+	theme_index_set(theme,r,path,hash,false,NULL,NULL);
+	return false;
+}
+
+static bool load_theme(char*path,struct icon_file*file){
+	list*l;
+	uint32_t hash;
 	static bool no_any=false;
-	if(!path||!data||!len||!d)return false;
-	*len=0,*data=NULL,*d=NULL;
+	if(!path||!file)return false;
+	memset(file,0,sizeof(struct icon_file));
 	if(!gui_icon_themes){
 		if(!no_any)tlog_warn("no any icon themes found");
 		no_any=true;
 		return false;
 	}
+	hash=path_hash(path);
 	if((l=list_first(gui_icon_themes)))do{
 		LIST_DATA_DECLARE(theme,l,struct icon_theme*);
 		if(!theme)continue;
-		if((s=list_first(theme->search_path)))do{
-			LIST_DATA_DECLARE(search,s,struct icon_theme_search_path*);
-			if(!search)continue;
-			if(load_search_path(
-				theme,search,
-				path,data,len,d
-			))return true;
-		}while((s=s->next));
-		if(load_search_path(
-			theme,NULL,
-			path,data,len,d
-		))return true;
+		if(load_theme_index(theme,path,hash,file))return true;
 	}while((l=l->next));
 	tlog_warn("icon %s not found",path);
 	return false;
 }
 
-static image_data*image_decode(char*path){
-	size_t len=0;
+static image_data*image_decode(char*path,uint32_t w,uint32_t h){
+	bool found;
 	image_data*img=NULL;
-	image_decoder*d=NULL;
-	unsigned char*data=NULL;
-	if(!load_theme(path,&data,&len,&d))goto done;
-	if(!data||len<=0||!d||!d->decode_cb)goto done;
+	struct icon_file file;
+	memset(&file,0,sizeof(file));
+	MUTEX_LOCK(resolve_lock);
+	found=load_theme(path,&file);
+	MUTEX_UNLOCK(resolve_lock);
+	if(!found)goto done;
+	if(!file.data||file.len<=0||!file.d||!file.d->decode_cb)goto done;
 	if(!(img=malloc(sizeof(image_data))))goto done;
 	memset(img,0,sizeof(image_data));
 	strncpy(img->path,path,sizeof(img->path)-1);
-	if(d->decode_cb(data,len,img)!=0)goto done;
+	img->hint_w=w,img->hint_h=h;
+	if(file.d->decode_cb(file.data,file.len,img)!=0)goto done;
 	if(img->width<=0||img->height<=0||!img->pixels)goto done;
-	free(data);
+	icon_file_free(&file);
 	return img;
 	done:
 	image_free_data(img);
-	if(data)free(data);
+	icon_file_free(&file);
 	return NULL;
 }
 
-static image_data*image_get(char*path){
+static image_data*image_get(char*path,uint32_t w,uint32_t h){
 	image_data*img=NULL;
 	if(!path)return NULL;
-	if((img=image_get_cache(path))){
+	if((img=image_get_cache(path,w,h))){
 		cache_hit++;
 		return img;
 	}
-	if(!(img=image_decode(path))){
+	if(!(img=image_decode(path,w,h))){
 		load_fail++;
 		return NULL;
 	}
@@ -245,7 +421,7 @@ static image_data*image_get(char*path){
 static lv_res_t decoder_info(lv_img_decoder_t*d __attribute__((unused)),const void*src,lv_img_header_t*m){
 	image_data*img;
 	if(lv_img_src_get_type(src)!=LV_IMG_SRC_FILE)return LV_RES_INV;
-	if(!(img=image_get((char*)src)))return LV_RES_INV;
+	if(!(img=image_get((char*)src,0,0)))return LV_RES_INV;
 	m->h=img->height;
 	m->w=img->width;
 	m->cf=img->format;
@@ -256,19 +432,214 @@ static lv_res_t decoder_info(lv_img_decoder_t*d __attribute__((unused)),const vo
 static lv_res_t decoder_open(lv_img_decoder_t*d __attribute__((unused)),lv_img_decoder_dsc_t*dsc){
 	image_data*img;
 	if(dsc->src_type!=LV_IMG_SRC_FILE)return LV_RES_INV;
-	if(!(img=image_get((char*)dsc->src)))return LV_RES_INV;
+	if(!(img=image_get((char*)dsc->src,0,0)))return LV_RES_INV;
 	dsc->img_data=img->pixels;
+	dsc->user_data=img;
+	img->pins++;
 	return LV_RES_OK;
 }
 
 static void decoder_close(lv_img_decoder_t*d __attribute__((unused)),lv_img_decoder_dsc_t*dsc){
+	image_data*img=dsc->user_data;
+	if(img)img->pins--;
+	dsc->img_data=NULL,dsc->user_data=NULL;
 	image_cache_gc();
-	dsc->img_data=NULL;
+}
+
+#ifndef ENABLE_UEFI
+/*
+ * async sources decode on worker threads, the gui thread only picks up
+ * the results from an lvgl timer that runs while jobs are out. the
+ * object shows a placeholder symbol meanwhile, a finished image joins
+ * the cache and becomes the object source, then the callback runs.
+ * jobs of deleted objects or objects given a new source are dropped,
+ * their callbacks never run.
+ */
+#define DECODE_THREADS 2
+#define DECODE_POLL    15
+
+enum job_state{
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+};
+
+struct image_job{
+	struct image_job*next;
+	enum job_state state;
+	char path[PATH_MAX];
+	uint32_t w,h;
+	lv_obj_t*obj;
+	image_async_cb cb;
+	void*data;
+	image_data*img;
+};
+
+static struct image_job*jobs=NULL;
+static pthread_mutex_t job_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond=PTHREAD_COND_INITIALIZER;
+static lv_timer_t*job_timer=NULL;
+static int job_threads=-1;
+
+static void*decode_worker(void*data __attribute__((unused))){
+	image_data*img;
+	struct image_job*job;
+	pthread_mutex_lock(&job_lock);
+	for(;;){
+		for(job=jobs;job&&job->state!=JOB_QUEUED;job=job->next);
+		if(!job){
+			pthread_cond_wait(&job_cond,&job_lock);
+			continue;
+		}
+		job->state=JOB_RUNNING;
+		pthread_mutex_unlock(&job_lock);
+		img=image_decode(job->path,job->w,job->h);
+		pthread_mutex_lock(&job_lock);
+		job->img=img,job->state=JOB_DONE;
+		gui_wakeup();
+	}
+	return NULL;
+}
+
+static void job_obj_delete(lv_event_t*e){
+	struct image_job*job=lv_event_get_user_data(e);
+	job->obj=NULL;
+}
+
+static void job_detach(struct image_job*job){
+	if(job->obj)lv_obj_remove_event_cb_with_user_data(
+		job->obj,job_obj_delete,job
+	);
+	job->obj=NULL;
+}
+
+static void job_finish(struct image_job*job){
+	lv_obj_t*obj=job->obj;
+	bool ok=job->img!=NULL;
+	if(!ok)load_fail++;
+	else if(image_get_cache(job->path,job->w,job->h))
+		image_free_data(job->img);
+	else cache_miss++,image_add_cache(job->img);
+	if(obj){
+		job_detach(job);
+		if(ok)lv_img_set_src(obj,job->path);
+		if(job->cb)job->cb(obj,ok,job->data);
+	}
+	free(job);
+}
+
+static void job_timer_cb(lv_timer_t*t){
+	struct image_job*done=NULL,*job,**p;
+	pthread_mutex_lock(&job_lock);
+	for(p=&jobs;(job=*p);){
+		if(job->state!=JOB_DONE){
+			p=&job->next;
+			continue;
+		}
+		*p=job->next;
+		job->next=done,done=job;
+	}
+	if(!jobs)lv_timer_pause(t);
+	pthread_mutex_unlock(&job_lock);
+	while((job=done)){
+		done=job->next;
+		job_finish(job);
+	}
+}
+
+static void decode_workers_start(void){
+	pthread_t t;
+	int64_t cnt;
+	if(job_threads>=0)return;
+	job_threads=0;
+	cnt=confd_get_integer("gui.image_decode_threads",DECODE_THREADS);
+	for(int64_t i=0;i<cnt;i++){
+		if(pthread_create(&t,NULL,decode_worker,NULL)!=0){
+			telog_warn("failed to start image decode thread");
+			break;
+		}
+		pthread_setname_np(t,"Image Decoder");
+		pthread_detach(t);
+		job_threads++;
+	}
+}
+
+// only the newest source of an object counts, unwanted queued jobs go
+static void image_dequeue(lv_obj_t*obj){
+	struct image_job*job,**p;
+	pthread_mutex_lock(&job_lock);
+	for(p=&jobs;(job=*p);){
+		if(job->obj==obj)job_detach(job);
+		if(!job->obj&&job->state==JOB_QUEUED){
+			*p=job->next;
+			free(job);
+			continue;
+		}
+		p=&job->next;
+	}
+	pthread_mutex_unlock(&job_lock);
+}
+
+static bool image_queue(
+	lv_obj_t*obj,const char*path,
+	uint32_t w,uint32_t h,
+	image_async_cb cb,void*data
+){
+	struct image_job*job,**p;
+	decode_workers_start();
+	if(job_threads<=0)return false;
+	if(!(job=malloc(sizeof(struct image_job))))return false;
+	memset(job,0,sizeof(struct image_job));
+	strncpy(job->path,path,sizeof(job->path)-1);
+	job->w=w,job->h=h,job->obj=obj;
+	job->cb=cb,job->data=data;
+	job->state=JOB_QUEUED;
+	pthread_mutex_lock(&job_lock);
+	for(p=&jobs;*p;p=&(*p)->next);
+	*p=job;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+	lv_obj_add_event_cb(obj,job_obj_delete,LV_EVENT_DELETE,job);
+	lv_img_set_src(obj,LV_SYMBOL_IMAGE);
+	if(!job_timer)job_timer=lv_timer_create(job_timer_cb,DECODE_POLL,NULL);
+	else lv_timer_resume(job_timer);
+	return true;
+}
+#endif
+
+void image_set_src_async(
+	lv_obj_t*obj,const char*path,
+	uint32_t w,uint32_t h,
+	image_async_cb cb,void*data
+){
+	bool ok;
+	if(!obj||!path)return;
+	#ifndef ENABLE_UEFI
+	image_dequeue(obj);
+	#endif
+	if(image_get_cache((char*)path,w,h)){
+		cache_hit++;
+		ok=true;
+	}else{
+		#ifndef ENABLE_UEFI
+		if(image_queue(obj,path,w,h,cb,data))return;
+		#endif
+		ok=image_get((char*)path,w,h)!=NULL;
+	}
+	if(ok)lv_img_set_src(obj,path);
+	if(cb)cb(obj,ok,data);
 }
 
 void image_set_cache_time(time_t time){
 	cache_time=time;
 	confd_set_integer("gui.image_cache_time",time);
+	image_cache_gc();
+}
+
+void image_set_cache_size(size_t size){
+	cache_size=size;
+	confd_set_integer("gui.image_cache_size",size);
+	image_cache_gc();
 }
 
 void image_decoder_init(){
@@ -276,13 +647,15 @@ void image_decoder_init(){
 	lv_img_decoder_set_info_cb(dec,decoder_info);
 	lv_img_decoder_set_open_cb(dec,decoder_open);
 	lv_img_decoder_set_close_cb(dec,decoder_close);
-	cache_time=confd_get_integer("gui.image_cache_time",5);
+	cache_time=confd_get_integer("gui.image_cache_time",0);
+	cache_size=confd_get_integer("gui.image_cache_size",CACHE_SIZE);
 	icon_theme_load_from_confd();
 }
 
 long image_get_cache_hits(){return cache_hit;}
 long image_get_cache_misses(){return cache_miss;}
 long image_get_load_fails(){return load_fail;}
+long image_get_cache_evictions(){return cache_evict;}
 
 void image_print_stat(){
 	tlog_debug(
@@ -291,5 +664,9 @@ void image_print_stat(){
 		image_get_cache_misses(),image_get_cache_miss_percent(),
 		image_get_load_fails(),image_get_load_fail_percent()
 	);
+	tlog_debug(
+		"cache evicted: %ld, used: %zu/%zu bytes in %zu images",
+		image_get_cache_evictions(),cache.used,cache_size,cache.count
+	);
 }
 #endif
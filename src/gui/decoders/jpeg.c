@@ -49,12 +49,20 @@ static int image_decode(unsigned char*data,size_t len,image_data*img){
 	jpeg_create_decompress(&ci);
 	jpeg_mem_src(&ci,data,len);
 	jpeg_read_header(&ci,true);
-	img->width=ci.image_width;
-	img->height=ci.image_height;
-	img->format=LV_IMG_CF_TRUE_COLOR;
+
+	// dct scaling by 1/2, 1/4 or 1/8 while still covering the wanted size
+	if(img->hint_w>0&&img->hint_h>0)for(unsigned d=8;d>1;d/=2){
+		if(ci.image_width/d<img->hint_w)continue;
+		if(ci.image_height/d<img->hint_h)continue;
+		ci.scale_num=1,ci.scale_denom=d;
+		break;
+	}
 	jpeg_start_decompress(&ci);
+	img->width=ci.output_width;
+	img->height=ci.output_height;
+	img->format=LV_IMG_CF_TRUE_COLOR;
 	dlen=ci.output_width*ci.output_components;
-	blen=ci.image_width*ci.image_height*sizeof(lv_color32_t);
+	blen=ci.output_width*ci.output_height*sizeof(lv_color32_t);
 	if(!(cs=malloc(blen))||!(buf=malloc(dlen)))goto fail;
 	memset(cs,0,blen);
 	memset(buf,0,dlen);
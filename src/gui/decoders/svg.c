@@ -20,18 +20,29 @@
 
 static int image_decode(unsigned char*data,size_t len __attribute__((unused)),struct image_data*img){
 	int s=-1;
+	float scale=SCALE;
+	size_t w,h;
 	NSVGimage*m=NULL;
 	NSVGrasterizer*rast=NULL;
 	if(!(m=nsvgParse((char*)data,"px",(float)gui_dpi)))goto fail;
+	if(m->width<=0||m->height<=0)goto fail;
+
+	// rasterize straight at the wanted size, keeping the aspect
+	if(img->hint_w>0&&img->hint_h>0)scale=MIN(
+		img->hint_w/m->width,
+		img->hint_h/m->height
+	);
+	w=m->width*scale,h=m->height*scale;
+	if(w<=0||h<=0)goto fail;
 	if(!(rast=nsvgCreateRasterizer()))goto fail;
-	if(!(img->pixels=malloc((m->width*SCALE)*(m->height*SCALE)*4)))goto fail;
-	nsvgRasterize(rast,m,0,0,SCALE,img->pixels,m->width*SCALE,m->height*SCALE,m->width*SCALE*4);
-	for(size_t i=0;i<(m->width*SCALE)*(m->height*SCALE);i++){
+	if(!(img->pixels=malloc(w*h*4)))goto fail;
+	nsvgRasterize(rast,m,0,0,scale,img->pixels,w,h,w*4);
+	for(size_t i=0;i<w*h;i++){
 		uint8_t*b=img->pixels+(i*4),k;
 		k=b[0],b[0]=b[2],b[2]=k;
 	}
-	img->width=m->width*SCALE;
-	img->height=m->height*SCALE;
+	img->width=w;
+	img->height=h;
 	img->format=LV_IMG_CF_RAW_ALPHA;
 	s=0;
 	done:
@@ -47,6 +58,7 @@ static int image_decode(unsigned char*data,size_t len __attribute__((unused)),st
 
 image_decoder image_decoder_svg={
 	.decode_cb=image_decode,
+	.modify_data=true,
 	.types=(char*[]){"svg",NULL}
 };
 #endif
@@ -12,6 +12,7 @@
 extern struct gui_driver guidrv_dummy;
 extern struct gui_driver guidrv_gtk;
 extern struct gui_driver guidrv_sdl2;
+extern struct gui_driver guidrv_sdl2_kmsdrm;
 extern struct gui_driver guidrv_drm;
 extern struct gui_driver guidrv_vnc;
 extern struct gui_driver guidrv_http;
@@ -40,6 +41,7 @@ struct gui_driver*gui_drvs[]={
 	#endif
 	#ifdef ENABLE_SDL2
 	&guidrv_sdl2,
+	&guidrv_sdl2_kmsdrm,
 	#endif
 	#ifdef ENABLE_DRM
 	&guidrv_drm,
@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#ifdef ENABLE_GUI
+#include<string.h>
+#ifndef ENABLE_UEFI
+#include<unistd.h>
+#include<pthread.h>
+#endif
+#include"confd.h"
+#include"logger.h"
+#include"defines.h"
+#include"gui/guidrv.h"
+#define TAG "draw"
+
+/*
+ * lvgl software draw context shared by the framebuffer style drivers.
+ * every fill, image blit and glyph ends in the sw blend callback, large
+ * blends are cut into horizontal stripes, the drawing thread takes the
+ * first one and a worker pool the rest. each stripe is a plain blend
+ * with the clip narrowed to its rows, so no pixel is written twice.
+ * small, masked per line, set_px_cb and argb screen blends stay on the
+ * drawing thread, the argb kernels keep a static color cache.
+ * gui.draw_threads sets the thread count, 0 picks from online cpus.
+ * firmware builds have no threads, they always blend in place.
+ */
+#define DRAW_MAX_THREADS  8
+#define DRAW_AUTO_THREADS 4
+#define DRAW_SPLIT_PIXELS 0x10000
+
+#ifndef ENABLE_UEFI
+static struct draw_pool{
+	pthread_mutex_t lock;
+	pthread_cond_t start,done;
+	size_t cnt,pending;
+	uint32_t gen;
+	lv_draw_sw_ctx_t*ctx;
+	const lv_draw_sw_blend_dsc_t*dsc;
+	lv_area_t clip;
+	lv_coord_t step;
+}pool={
+	.lock=PTHREAD_MUTEX_INITIALIZER,
+	.start=PTHREAD_COND_INITIALIZER,
+	.done=PTHREAD_COND_INITIALIZER,
+};
+
+static void blend_stripe(size_t idx){
+	lv_draw_sw_ctx_t ctx;
+	lv_area_t clip=pool.clip;
+	clip.y1=pool.clip.y1+idx*pool.step;
+	clip.y2=MIN(clip.y1+pool.step-1,pool.clip.y2);
+	if(clip.y1>clip.y2)return;
+	memcpy(&ctx,pool.ctx,sizeof(ctx));
+	ctx.base_draw.clip_area=&clip;
+	lv_draw_sw_blend_basic(&ctx.base_draw,pool.dsc);
+}
+
+static void*draw_worker(void*data){
+	uint32_t gen=0;
+	size_t idx=(size_t)data;
+	pthread_mutex_lock(&pool.lock);
+	for(;;){
+		while(pool.gen==gen)pthread_cond_wait(&pool.start,&pool.lock);
+		gen=pool.gen;
+		pthread_mutex_unlock(&pool.lock);
+		blend_stripe(idx);
+		pthread_mutex_lock(&pool.lock);
+		if(--pool.pending==0)pthread_cond_signal(&pool.done);
+	}
+	return NULL;
+}
+
+static void draw_blend(lv_draw_ctx_t*draw_ctx,const lv_draw_sw_blend_dsc_t*dsc){
+	lv_area_t area;
+	lv_disp_t*disp=_lv_refr_get_disp_refreshing();
+	if(
+		!_lv_area_intersect(&area,dsc->blend_area,draw_ctx->clip_area)||
+		disp->driver->set_px_cb||disp->driver->screen_transp||
+		lv_area_get_size(&area)<DRAW_SPLIT_PIXELS||
+		lv_area_get_height(&area)<(lv_coord_t)pool.cnt
+	){
+		lv_draw_sw_blend_basic(draw_ctx,dsc);
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.ctx=(lv_draw_sw_ctx_t*)draw_ctx;
+	pool.dsc=dsc,pool.clip=area;
+	pool.step=(lv_area_get_height(&area)+pool.cnt-1)/pool.cnt;
+	pool.pending=pool.cnt-1,pool.gen++;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+	blend_stripe(0);
+	pthread_mutex_lock(&pool.lock);
+	while(pool.pending>0)pthread_cond_wait(&pool.done,&pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+// workers live as long as the process, displays may come and go
+static void draw_pool_start(void){
+	pthread_t t;
+	long cpus;
+	int64_t cnt=confd_get_integer("gui.draw_threads",0);
+	if(pool.cnt>0)return;
+	pool.cnt=1;
+	if(cnt<=0){
+		cpus=sysconf(_SC_NPROCESSORS_ONLN);
+		cnt=MIN(cpus,DRAW_AUTO_THREADS);
+	}
+	cnt=MIN(cnt,DRAW_MAX_THREADS);
+	for(size_t i=1;i<(size_t)cnt;i++){
+		if(pthread_create(&t,NULL,draw_worker,(void*)i)!=0){
+			telog_warn("failed to start draw thread %zu",i);
+			break;
+		}
+		pthread_setname_np(t,"GUI Draw Thread");
+		pthread_detach(t);
+		pool.cnt++;
+	}
+	if(pool.cnt>1)tlog_debug("software draw with %zu threads",pool.cnt);
+}
+#endif
+
+void gui_draw_init_ctx(lv_disp_drv_t*drv,lv_draw_ctx_t*draw_ctx){
+	lv_draw_sw_init_ctx(drv,draw_ctx);
+	#ifndef ENABLE_UEFI
+	draw_pool_start();
+	if(pool.cnt>1)((lv_draw_sw_ctx_t*)draw_ctx)->blend=draw_blend;
+	#endif
+}
+
+void gui_draw_deinit_ctx(lv_disp_drv_t*drv,lv_draw_ctx_t*draw_ctx){
+	lv_draw_sw_deinit_ctx(drv,draw_ctx);
+}
+#endif
@@ -3,10 +3,12 @@
 #define _GNU_SOURCE
 #include<errno.h>
 #include<stdio.h>
+#include<time.h>
 #include<fcntl.h>
 #include<dirent.h>
 #include<stdlib.h>
 #include<unistd.h>
+#include<poll.h>
 #include<libgen.h>
 #include<semaphore.h>
 #include<sys/mman.h>
@@ -22,8 +24,12 @@
 #include"gui/guidrv.h"
 #define TAG "drm"
 #define DIV_ROUND_UP(n,d)(((n)+(d)-1)/(d))
+#define DRM_BUFFERS 2
+#define DRM_DAMAGE_MAX 32
+#define DRM_FLIP_TIMEOUT 100
 struct drm_buffer{
 	uint32_t handle,pitch,offset;
+	uint32_t width,height;
 	unsigned long int size;
 	void*map;
 	uint32_t fb_handle;
@@ -35,16 +41,30 @@ static struct drm_dev{
 		conn_id,
 		enc_id,
 		crtc_id,
+		crtc_idx,
+		plane_id,
+		cursor_id,
+		prop_fb,
+		prop_damage,
 		width,height,
 		mmWidth,mmHeight;
 	drmModeModeInfo mode;
 	uint32_t blob_id;
 	drmModeCrtc*crtc;
 	lv_color_t*cbuf;
-	struct drm_buffer buf;
+	struct drm_buffer buf[DRM_BUFFERS];
+	int front;
+	bool direct,pending,damage_full,atomic;
+	lv_area_t damage[DRM_DAMAGE_MAX];
+	size_t damage_cnt;
+	struct drm_buffer cursor;
+	lv_obj_t*cursor_layer,*cursor_obj;
+	const void*cursor_src;
+	lv_coord_t cursor_x,cursor_y;
+	bool cursor_shown,cursor_sw;
 	struct display_mode*modes;
 	int modes_cnt;
-	sem_t flush;
+	sem_t flip;
 	pthread_t tid;
 	lv_disp_draw_buf_t dbuf;
 	lv_disp_drv_t drv;
@@ -55,8 +75,10 @@ static void drm_exit(void){
 	drm_dev.cbuf=NULL;
 	close(drm_dev.fd);
 	drm_dev.fd=-1;
-	sem_post(&drm_dev.flush);
-	sem_destroy(&drm_dev.flush);
+	if(!drm_dev.tid)return;
+	pthread_join(drm_dev.tid,NULL);
+	sem_destroy(&drm_dev.flip);
+	drm_dev.tid=0;
 }
 static const char*conn_to_str(drmModeConnection conn){
 	switch(conn){
@@ -281,6 +303,10 @@ static int drm_find_connector(void){
 		telog_error("no crtc found");
 		goto free_res;
 	}
+	for(i=0;i<res->count_crtcs;i++)
+		if(res->crtcs[i]==drm_dev.crtc_id)drm_dev.crtc_idx=i;
+	drmModeFreeConnector(conn);
+	drmModeFreeResources(res);
 	return 0;
 	free_res:
 	drmModeFreeResources(res);
@@ -289,6 +315,82 @@ static int drm_find_connector(void){
 	drm_dev.modes_cnt=0;
 	return -1;
 }
+static bool drm_get_prop(
+	uint32_t obj,uint32_t type,const char*name,
+	uint32_t*id,uint64_t*value
+){
+	bool found=false;
+	drmModePropertyRes*prop;
+	drmModeObjectProperties*props;
+	if(!(props=drmModeObjectGetProperties(drm_dev.fd,obj,type)))return false;
+	for(uint32_t i=0;i<props->count_props&&!found;i++){
+		if(!(prop=drmModeGetProperty(drm_dev.fd,props->props[i])))continue;
+		if(strcmp(prop->name,name)==0){
+			if(id)*id=prop->prop_id;
+			if(value)*value=props->prop_values[i];
+			found=true;
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+	return found;
+}
+static void drm_find_planes(void){
+	uint64_t type;
+	drmModePlane*p;
+	drmModePlaneRes*res;
+	if(drmSetClientCap(drm_dev.fd,DRM_CLIENT_CAP_UNIVERSAL_PLANES,1)!=0)return;
+	if(!(res=drmModeGetPlaneResources(drm_dev.fd)))return;
+	for(uint32_t i=0;i<res->count_planes;i++){
+		if(!(p=drmModeGetPlane(drm_dev.fd,res->planes[i])))continue;
+		if(
+			(p->possible_crtcs&(1<<drm_dev.crtc_idx))&&
+			drm_get_prop(p->plane_id,DRM_MODE_OBJECT_PLANE,"type",NULL,&type)
+		){
+			if(type==DRM_PLANE_TYPE_PRIMARY&&!drm_dev.plane_id)
+				drm_dev.plane_id=p->plane_id;
+			if(type==DRM_PLANE_TYPE_CURSOR&&!drm_dev.cursor_id)
+				drm_dev.cursor_id=p->plane_id;
+		}
+		drmModeFreePlane(p);
+	}
+	drmModeFreePlaneResources(res);
+	tlog_debug(
+		"primary plane %d, cursor plane %d",
+		drm_dev.plane_id,drm_dev.cursor_id
+	);
+}
+/*
+ * with atomic modesetting a flip only swaps FB_ID of the primary plane,
+ * the areas lvgl redrew go along as FB_DAMAGE_CLIPS, so panels with
+ * self refresh or command mode dsi transfer only those rectangles.
+ * the mode itself is still set through the legacy crtc call.
+ */
+static void drm_setup_atomic(void){
+	if(!confd_get_boolean("gui.drm_atomic",true))return;
+	if(!drm_dev.plane_id)return;
+	if(drmSetClientCap(drm_dev.fd,DRM_CLIENT_CAP_ATOMIC,1)!=0){
+		tlog_debug("atomic modesetting not supported");
+		return;
+	}
+	if(!drm_get_prop(
+		drm_dev.plane_id,DRM_MODE_OBJECT_PLANE,
+		"FB_ID",&drm_dev.prop_fb,NULL
+	)){
+		tlog_warn("primary plane has no FB_ID");
+		drmSetClientCap(drm_dev.fd,DRM_CLIENT_CAP_ATOMIC,0);
+		return;
+	}
+	drm_get_prop(
+		drm_dev.plane_id,DRM_MODE_OBJECT_PLANE,
+		"FB_DAMAGE_CLIPS",&drm_dev.prop_damage,NULL
+	);
+	drm_dev.atomic=true;
+	tlog_info(
+		"use atomic modesetting%s",
+		drm_dev.prop_damage?" with damage clips":""
+	);
+}
 static int drm_find_backlight(int sfd){
 	char buff[64];
 	int conn,status,ret;
@@ -336,7 +438,7 @@ static int drm_show(){
 	return drmModeSetCrtc(
 		drm_dev.fd,
 		drm_dev.crtc_id,
-		drm_dev.buf.fb_handle,0,0,
+		drm_dev.buf[drm_dev.front].fb_handle,0,0,
 		&drm_dev.conn_id,1,
 		&drm_dev.mode
 	);
@@ -356,11 +458,11 @@ static void drm_set_brightness(int value){
 		errno=0;
 		drm_dev.blank=false;
 		drm_show();
-		sem_post(&drm_dev.flush);
 		telog_debug("screen resume");
 	}else if(value<=0){
 		errno=0;
 		drm_dev.blank=true;
+		drm_dev.cursor_shown=false;
 		drmModeSetCrtc(drm_dev.fd,drm_dev.crtc_id,0,0,0,NULL,0,NULL);
 		telog_debug("screen suspend");
 	}
@@ -382,6 +484,8 @@ static int drm_setup(int fd,int sfd){
 		return trlog_error(-1,"available drm devices not found");
 	if(!(drm_dev.crtc=drmModeGetCrtc(fd,drm_dev.crtc_id)))
 		return trlog_error(-1,"can not get crtc");
+	drm_find_planes();
+	drm_setup_atomic();
 	tlog_info(
 		"found connector %d, crtc %d",
 		drm_dev.conn_id,
@@ -394,12 +498,12 @@ static int drm_setup(int fd,int sfd){
 	);
 	return 0;
 }
-static int drm_allocate_dumb(struct drm_buffer*b){
+static int drm_allocate_dumb(struct drm_buffer*b,uint32_t w,uint32_t h,bool fb){
 	struct drm_mode_create_dumb creq;
 	struct drm_mode_map_dumb mreq;
 	memset(&creq,0,sizeof(creq));
-	creq.width=drm_dev.width;
-	creq.height=drm_dev.height;
+	creq.width=w,b->width=w;
+	creq.height=h,b->height=h;
 	creq.bpp=LV_COLOR_DEPTH;
 	if(drmIoctl(
 		drm_dev.fd,
@@ -409,10 +513,8 @@ static int drm_allocate_dumb(struct drm_buffer*b){
 	b->handle=creq.handle;
 	b->pitch=creq.pitch;
 	b->size=creq.size;
-	if(drmModeAddFB(
-		drm_dev.fd,
-		drm_dev.width,
-		drm_dev.height,
+	if(fb&&drmModeAddFB(
+		drm_dev.fd,w,h,
 		24,32,
 		b->pitch,
 		b->handle,
@@ -437,29 +539,247 @@ static int drm_allocate_dumb(struct drm_buffer*b){
 	memset(b->map,0,creq.size);
 	return 0;
 }
-static void*flush_thread(void*data __attribute__((unused))){
-	drm_show();
+/*
+ * two dumb buffers, lvgl draws into the one not on screen and a page flip
+ * shows it on the next vblank. without rotation and with a packed pitch
+ * lvgl renders into the buffers directly, otherwise areas are copied in.
+ * before the next frame starts the areas of the last one are copied into
+ * the new back buffer, so only damaged regions move between the two.
+ */
+static void page_flip_handler(
+	int fd __attribute__((unused)),
+	unsigned int seq __attribute__((unused)),
+	unsigned int sec __attribute__((unused)),
+	unsigned int usec __attribute__((unused)),
+	void*data __attribute__((unused))
+){
+	lv_disp_flush_ready(&drm_dev.drv);
+	sem_post(&drm_dev.flip);
+}
+
+static void*flip_thread(void*data __attribute__((unused))){
+	struct pollfd pfd;
+	drmEventContext ev;
+	memset(&ev,0,sizeof(ev));
+	ev.version=2;
+	ev.page_flip_handler=page_flip_handler;
 	while(drm_dev.fd>=0){
-		drmModePageFlip(
-			drm_dev.fd,
-			drm_dev.crtc_id,
-			drm_dev.buf.fb_handle,
-			0,NULL
-		);
-		sem_wait(&drm_dev.flush);
+		pfd.fd=drm_dev.fd,pfd.events=POLLIN,pfd.revents=0;
+		if(poll(&pfd,1,DRM_FLIP_TIMEOUT)<=0)continue;
+		if(pfd.revents&POLLIN)drmHandleEvent(drm_dev.fd,&ev);
 	}
 	return data;
 }
+
+static void copy_area(struct drm_buffer*dst,struct drm_buffer*src,const lv_area_t*a){
+	size_t off,len=(a->x2-a->x1+1)*sizeof(lv_color_t);
+	for(lv_coord_t y=a->y1;y<=a->y2;y++){
+		off=y*dst->pitch+a->x1*sizeof(lv_color_t);
+		memcpy(dst->map+off,src->map+off,len);
+	}
+}
+
+static void drm_render_start(lv_disp_drv_t*disp_drv __attribute__((unused))){
+	struct timespec ts;
+	struct drm_buffer*front,*back;
+	if(drm_dev.pending){
+		clock_gettime(CLOCK_REALTIME,&ts);
+		ts.tv_nsec+=DRM_FLIP_TIMEOUT*1000000L;
+		ts.tv_sec+=ts.tv_nsec/1000000000L;
+		ts.tv_nsec%=1000000000L;
+		if(sem_timedwait(&drm_dev.flip,&ts)!=0){
+			tlog_warn("page flip timed out");
+			lv_disp_flush_ready(&drm_dev.drv);
+		}
+		drm_dev.pending=false;
+	}
+	front=&drm_dev.buf[drm_dev.front];
+	back=&drm_dev.buf[!drm_dev.front];
+	if(drm_dev.damage_full)memcpy(back->map,front->map,back->size);
+	else for(size_t i=0;i<drm_dev.damage_cnt;i++)
+		copy_area(back,front,&drm_dev.damage[i]);
+	drm_dev.damage_cnt=0,drm_dev.damage_full=false;
+}
+
+// drm rectangles end exclusive, no clips means the whole plane changed
+static int drm_commit_atomic(struct drm_buffer*b){
+	int r;
+	uint32_t blob=0;
+	drmModeAtomicReq*req;
+	struct drm_mode_rect clips[DRM_DAMAGE_MAX];
+	if(!(req=drmModeAtomicAlloc()))return -1;
+	drmModeAtomicAddProperty(req,drm_dev.plane_id,drm_dev.prop_fb,b->fb_handle);
+	if(drm_dev.prop_damage&&!drm_dev.damage_full&&drm_dev.damage_cnt>0){
+		for(size_t i=0;i<drm_dev.damage_cnt;i++){
+			clips[i].x1=drm_dev.damage[i].x1;
+			clips[i].y1=drm_dev.damage[i].y1;
+			clips[i].x2=drm_dev.damage[i].x2+1;
+			clips[i].y2=drm_dev.damage[i].y2+1;
+		}
+		if(drmModeCreatePropertyBlob(
+			drm_dev.fd,clips,
+			sizeof(struct drm_mode_rect)*drm_dev.damage_cnt,
+			&blob
+		)==0)drmModeAtomicAddProperty(
+			req,drm_dev.plane_id,
+			drm_dev.prop_damage,blob
+		);
+	}
+	r=drmModeAtomicCommit(
+		drm_dev.fd,req,
+		DRM_MODE_PAGE_FLIP_EVENT|DRM_MODE_ATOMIC_NONBLOCK,
+		NULL
+	);
+	drmModeAtomicFree(req);
+	if(blob)drmModeDestroyPropertyBlob(drm_dev.fd,blob);
+	return r;
+}
+
+static int drm_page_flip(struct drm_buffer*b){
+	if(drm_dev.atomic){
+		if(drm_commit_atomic(b)==0)return 0;
+		telog_warn("atomic commit failed, fallback to page flip");
+		drm_dev.atomic=false;
+	}
+	return drmModePageFlip(
+		drm_dev.fd,
+		drm_dev.crtc_id,
+		b->fb_handle,
+		DRM_MODE_PAGE_FLIP_EVENT,NULL
+	);
+}
+
 static void drm_flush(lv_disp_drv_t*disp_drv,const lv_area_t*area,lv_color_t*color_p){
-	int i,y;
+	int i,y,back=!drm_dev.front;
 	lv_coord_t w=(area->x2-area->x1+1);
-	for(y=0,i=area->y1;i<=area->y2;++i,++y)memcpy(
-		drm_dev.buf.map+(area->x1*4)+(drm_dev.buf.pitch*i),
-		(void*)color_p+(w*4*y),w*4
+	if(!drm_dev.direct)for(y=0,i=area->y1;i<=area->y2;++i,++y)memcpy(
+		drm_dev.buf[back].map+(area->x1*sizeof(lv_color_t))+(drm_dev.buf[back].pitch*i),
+		(void*)color_p+(w*sizeof(lv_color_t)*y),w*sizeof(lv_color_t)
 	);
-	sem_post(&drm_dev.flush);
-	lv_disp_flush_ready(disp_drv);
+	if(drm_dev.damage_cnt<DRM_DAMAGE_MAX)
+		lv_area_copy(&drm_dev.damage[drm_dev.damage_cnt++],area);
+	else drm_dev.damage_full=true;
+	if(!lv_disp_flush_is_last(disp_drv)){
+		lv_disp_flush_ready(disp_drv);
+		return;
+	}
+	drm_dev.front=back;
+	if(!drm_dev.blank&&drm_page_flip(&drm_dev.buf[back])==0)
+		drm_dev.pending=true;
+	else lv_disp_flush_ready(disp_drv);
+}
+
+/*
+ * gui_cursor goes on the cursor plane when there is one. after an input
+ * device attached it to the system layer it moves into a hidden layer,
+ * so pointer motion no longer invalidates anything, the image is drawn
+ * once into the cursor buffer and only the plane position follows.
+ */
+static void drm_setup_cursor(void){
+	uint64_t w=64,h=64;
+	struct drm_buffer*b=&drm_dev.cursor;
+	if(!drm_dev.cursor_id||gui_rotate!=0)return;
+	if(!confd_get_boolean("gui.drm_cursor",true))return;
+	drmGetCap(drm_dev.fd,DRM_CAP_CURSOR_WIDTH,&w);
+	drmGetCap(drm_dev.fd,DRM_CAP_CURSOR_HEIGHT,&h);
+	if(drm_allocate_dumb(b,w,h,false)!=0){
+		tlog_warn("cursor buffer allocation failed");
+		b->map=NULL;
+	}else if(b->pitch!=w*sizeof(lv_color_t)){
+		munmap(b->map,b->size);
+		b->map=NULL;
+	}else tlog_debug("use cursor plane with %dx%d",(int)w,(int)h);
 }
+
+static bool drm_cursor_render(lv_obj_t*c){
+	bool ret=true;
+	lv_obj_t*canvas;
+	lv_draw_img_dsc_t img;
+	lv_draw_label_dsc_t label;
+	lv_img_t*i=(lv_img_t*)c;
+	struct drm_buffer*b=&drm_dev.cursor;
+	const void*src=lv_img_get_src(c);
+	if(!src||i->w<=0||i->h<=0)return false;
+	if((uint32_t)i->w>b->width||(uint32_t)i->h>b->height)return false;
+	if(!(canvas=lv_canvas_create(drm_dev.cursor_layer)))return false;
+	memset(b->map,0,b->size);
+	lv_canvas_set_buffer(
+		canvas,b->map,
+		b->width,b->height,
+		LV_IMG_CF_TRUE_COLOR_ALPHA
+	);
+	switch(lv_img_src_get_type(src)){
+		case LV_IMG_SRC_SYMBOL:
+			lv_draw_label_dsc_init(&label);
+			lv_obj_init_draw_label_dsc(c,LV_PART_MAIN,&label);
+			lv_canvas_draw_text(canvas,0,0,i->w,&label,src);
+		break;
+		case LV_IMG_SRC_FILE:case LV_IMG_SRC_VARIABLE:
+			lv_draw_img_dsc_init(&img);
+			lv_obj_init_draw_img_dsc(c,LV_PART_MAIN,&img);
+			lv_canvas_draw_img(canvas,0,0,src,&img);
+		break;
+		default:ret=false;
+	}
+	lv_obj_del(canvas);
+
+	// cursor planes take premultiplied alpha
+	for(lv_color_t*p=b->map;(void*)p<b->map+b->size;p++){
+		p->ch.red=p->ch.red*p->ch.alpha/0xFF;
+		p->ch.green=p->ch.green*p->ch.alpha/0xFF;
+		p->ch.blue=p->ch.blue*p->ch.alpha/0xFF;
+	}
+	return ret;
+}
+
+static void drm_taskhandler(void){
+	bool shown;
+	lv_coord_t x,y;
+	lv_obj_t*c=gui_cursor,*sys;
+	if(!drm_dev.cursor.map||drm_dev.blank||!c||!lv_obj_is_valid(c))return;
+	if(c!=drm_dev.cursor_obj){
+		drm_dev.cursor_obj=c,drm_dev.cursor_src=NULL;
+		drm_dev.cursor_sw=false;
+	}
+	if(drm_dev.cursor_sw)return;
+	sys=lv_disp_get_layer_sys(NULL);
+	if(!drm_dev.cursor_layer){
+		if(!(drm_dev.cursor_layer=lv_obj_create(sys)))return;
+		lv_obj_remove_style_all(drm_dev.cursor_layer);
+		lv_obj_clear_flag(drm_dev.cursor_layer,LV_OBJ_FLAG_CLICKABLE);
+		lv_obj_add_flag(drm_dev.cursor_layer,LV_OBJ_FLAG_HIDDEN);
+	}
+	if(lv_obj_get_parent(c)==sys)lv_obj_set_parent(c,drm_dev.cursor_layer);
+	if(lv_obj_get_parent(c)!=drm_dev.cursor_layer)return;
+	if(lv_img_get_src(c)!=drm_dev.cursor_src){
+		if(!drm_cursor_render(c)){
+			tlog_warn("cursor does not fit cursor plane, draw by lvgl");
+			drmModeSetCursor(drm_dev.fd,drm_dev.crtc_id,0,0,0);
+			lv_obj_set_parent(c,sys);
+			drm_dev.cursor_sw=true,drm_dev.cursor_shown=false;
+			return;
+		}
+		drm_dev.cursor_src=lv_img_get_src(c);
+		drm_dev.cursor_shown=false;
+	}
+	shown=!lv_obj_has_flag(c,LV_OBJ_FLAG_HIDDEN);
+	x=lv_obj_get_style_x(c,LV_PART_MAIN);
+	y=lv_obj_get_style_y(c,LV_PART_MAIN);
+	if(shown&&(!drm_dev.cursor_shown||x!=drm_dev.cursor_x||y!=drm_dev.cursor_y)){
+		drmModeMoveCursor(drm_dev.fd,drm_dev.crtc_id,x,y);
+		drm_dev.cursor_x=x,drm_dev.cursor_y=y;
+	}
+	if(shown!=drm_dev.cursor_shown){
+		drmModeSetCursor(
+			drm_dev.fd,drm_dev.crtc_id,
+			shown?drm_dev.cursor.handle:0,
+			shown?drm_dev.cursor.width:0,
+			shown?drm_dev.cursor.height:0
+		);
+		drm_dev.cursor_shown=shown;
+	}
+}
+
 static void drm_get_sizes(lv_coord_t*width,lv_coord_t*height){
 	lv_coord_t w=0,h=0;
 	switch(gui_rotate){
@@ -483,14 +803,24 @@ static int _drm_register(){
 		drm_exit();
 		return -1;
 	}
-	size_t s=drm_dev.width*drm_dev.height*sizeof(lv_color_t);
-	if(!(drm_dev.cbuf=malloc(s))){
-		telog_error("malloc display buffer");
-		drm_exit();
-		return -1;
+	size_t s=drm_dev.width*drm_dev.height;
+	drm_dev.direct=gui_rotate==0&&
+		drm_dev.buf[0].pitch==drm_dev.width*sizeof(lv_color_t);
+	if(drm_dev.direct)lv_disp_draw_buf_init(
+		&drm_dev.dbuf,
+		drm_dev.buf[0].map,
+		drm_dev.buf[1].map,s
+	);
+	else{
+		if(!(drm_dev.cbuf=malloc(s*sizeof(lv_color_t)))){
+			telog_error("malloc display buffer");
+			drm_exit();
+			return -1;
+		}
+		memset(drm_dev.cbuf,0,s*sizeof(lv_color_t));
+		lv_disp_draw_buf_init(&drm_dev.dbuf,drm_dev.cbuf,NULL,s);
 	}
-	memset(drm_dev.cbuf,0,s);
-	lv_disp_draw_buf_init(&drm_dev.dbuf,drm_dev.cbuf,NULL,s);
+	tlog_debug("render %s",drm_dev.direct?"into scanout buffers":"with copy");
 	lv_disp_drv_init(&drm_dev.drv);
 	drm_dev.drv.hor_res=drm_dev.width;
 	drm_dev.drv.ver_res=drm_dev.height;
@@ -501,8 +831,10 @@ static int _drm_register(){
 	);
 	drm_dev.drv.draw_buf=&drm_dev.dbuf;
 	drm_dev.drv.flush_cb=drm_flush;
-	drm_dev.drv.draw_ctx_init=lv_draw_sw_init_ctx;
-	drm_dev.drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+	drm_dev.drv.render_start_cb=drm_render_start;
+	drm_dev.drv.direct_mode=drm_dev.direct;
+	drm_dev.drv.draw_ctx_init=gui_draw_init_ctx;
+	drm_dev.drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 	drm_dev.drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
 	switch(gui_rotate){
 		case 0:break;
@@ -511,8 +843,12 @@ static int _drm_register(){
 		case 270:drm_dev.drv.sw_rotate=1,drm_dev.drv.rotated=LV_DISP_ROT_270;break;
 	}
 	lv_disp_drv_register(&drm_dev.drv);
-	pthread_create(&drm_dev.tid,NULL,flush_thread,NULL);
-	sem_init(&drm_dev.flush,0,0);
+
+	// lvgl starts drawing into the first buffer, show the second
+	drm_dev.front=1;
+	if(drm_show()!=0)telog_warn("set crtc failed");
+	sem_init(&drm_dev.flip,0,0);
+	pthread_create(&drm_dev.tid,NULL,flip_thread,NULL);
 	set_active_console(7);
 	return 0;
 }
@@ -522,11 +858,14 @@ static int _drm_init_fd(int fd,int sfd){
 		drm_dev.fd=-1;
 		return -1;
 	}
-	if(drm_allocate_dumb(&drm_dev.buf)){
+	for(int i=0;i<DRM_BUFFERS;i++)if(drm_allocate_dumb(
+		&drm_dev.buf[i],drm_dev.width,drm_dev.height,true
+	)){
 		tlog_error("buffer allocation failed");
 		drm_dev.fd=-1;
 		return -1;
 	}
+	drm_setup_cursor();
 	tlog_debug("initialized");
 	return 0;
 }
@@ -608,6 +947,7 @@ struct gui_driver guidrv_drm={
 	.drv_getdpi=drm_get_dpi,
 	.drv_get_modes=drm_get_modes,
 	.drv_exit=drm_exit,
+	.drv_taskhandler=drm_taskhandler,
 	.drv_getbrightness=drm_get_brightness,
 	.drv_setbrightness=drm_set_brightness
 };
@@ -67,8 +67,8 @@ static int dummy_register(){
 	disp_drv.flush_cb=dummy_flush;
 	disp_drv.hor_res=ww;
 	disp_drv.ver_res=hh;
-	disp_drv.draw_ctx_init=lv_draw_sw_init_ctx;
-	disp_drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+	disp_drv.draw_ctx_init=gui_draw_init_ctx;
+	disp_drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 	disp_drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
 	switch(gui_rotate){
 		case 0:break;
@@ -13,6 +13,7 @@
 #include<sys/ioctl.h>
 #include<linux/fb.h>
 #include<semaphore.h>
+#include<time.h>
 #include"gui.h"
 #include"confd.h"
 #include"logger.h"
@@ -22,26 +23,50 @@
 #include"pathnames.h"
 #include"gui/guidrv.h"
 #define TAG "fbdev"
+#define FB_DAMAGE_MAX 32
+#define FB_FLIP_TIMEOUT 100
 static pthread_t fbrt;
 static bool blank=false,swap_abgr=false;
+static bool dbuf=false,pending=false,vsync=true,defio=true;
+static bool damage_full=false;
+static lv_area_t damage[FB_DAMAGE_MAX];
+static size_t damage_cnt=0;
+static int front=0;
 static char*fbp=0;
 static long int screensize=0;
 static int fbfd=-1;
-static sem_t flush;
+static sem_t flush,flip;
 struct fb_var_screeninfo vinfo;
 struct fb_fix_screeninfo finfo;
 static lv_disp_draw_buf_t disp_buf;
 static lv_disp_drv_t disp_drv;
+
+/*
+ * with a virtual height of two screens the frame is drawn into the half
+ * not on screen and FBIOPAN_DISPLAY flips to it, the refresher waits for
+ * vsync before the old half is reused. the areas of a frame are copied
+ * into the other half before the next one starts, like the drm driver.
+ * panels behind deferred io get the dirty pages pushed by fsync at once.
+ */
 static void*fbdev_refresh(void*args __attribute__((unused))){
+	int arg=0;
 	for(;;){
 		sem_wait(&flush);
 		ioctl(fbfd,FBIOPAN_DISPLAY,&vinfo);
+		if(defio&&fsync(fbfd)!=0&&(errno==EINVAL||errno==EROFS))defio=false;
+		if(!dbuf)continue;
+		if(vsync&&ioctl(fbfd,FBIO_WAITFORVSYNC,&arg)!=0){
+			tlog_debug("no vsync wait support");
+			vsync=false;
+		}
+		sem_post(&flip);
 	}
 	return NULL;
 }
 static int fbdev_refresher_start(){
 	if(fbrt)return terlog_error(-1,"refresher thread already running");
 	sem_init(&flush,0,0);
+	sem_init(&flip,0,0);
 	if(pthread_create(&fbrt,NULL,fbdev_refresh,(void*)0)!=0)
 		return terlog_error(-1,"failed to start refresher thread");
 	else pthread_setname_np(fbrt,"FrameBuffer Refresher Thread");
@@ -54,8 +79,30 @@ static int _fbdev_get_info(){
 		return terlog_error(-1,"ioctl FBIOGET_VSCREENINFO");
 	return 0;
 }
+static void _fbdev_setup_double(){
+	struct fb_var_screeninfo v;
+	if(!confd_get_boolean("gui.fbdev_double",true))return;
+	if(finfo.ypanstep==0||vinfo.yres<=0)return;
+	if(vinfo.yres_virtual<vinfo.yres*2){
+		memcpy(&v,&vinfo,sizeof(v));
+		v.yres_virtual=vinfo.yres*2,v.yoffset=0;
+		if(ioctl(fbfd,FBIOPUT_VSCREENINFO,&v)!=0){
+			telog_debug("set virtual height failed");
+			_fbdev_get_info();
+			return;
+		}
+		if(_fbdev_get_info()<0)return;
+	}
+	if(
+		vinfo.yres_virtual<vinfo.yres*2||
+		(size_t)finfo.line_length*vinfo.yres*2>finfo.smem_len
+	)return;
+	dbuf=true,front=0,vinfo.yoffset=0;
+	tlog_info("use double buffering with panning");
+}
 static int _fbdev_init_fd(){
 	if(_fbdev_get_info()<0)return -1;
+	_fbdev_setup_double();
 	screensize=finfo.smem_len;
 	fbp=(char*)mmap(0,screensize,PROT_READ|PROT_WRITE,MAP_SHARED,fbfd,0);
 	if((intptr_t)fbp==-1)return terlog_error(-1,"mmap");
@@ -97,64 +144,80 @@ static void fbdev_exit(void){
 	}
 	vtconsole_all_bind(1);
 }
-static inline uint32_t swap(uint32_t x){
-	return swap_abgr?
-		((x&0xff000000))|
-		((x&0x00ff0000)>>16)|
-		((x&0x0000ff00))|
-		((x&0x000000ff)<<16)
-		:x;
+// first byte of line y in the buffer on screen or the one drawn into
+static inline uint8_t*fbdev_line(int32_t y,bool back){
+	uint32_t base=dbuf?(back?!front:front)*vinfo.yres:vinfo.yoffset;
+	return (uint8_t*)fbp+(y+base)*finfo.line_length;
 }
-static inline void copy_swapped(uint32_t*a,const uint32_t*b,size_t l){
-	while(l--)*(uint32_t*)a++=swap(*(uint32_t*)b++);
+static void fbdev_render_start(lv_disp_drv_t*drv __attribute__((unused))){
+	size_t off,len;
+	struct timespec ts;
+	if(!dbuf||!fbp)return;
+	if(pending){
+		clock_gettime(CLOCK_REALTIME,&ts);
+		ts.tv_nsec+=FB_FLIP_TIMEOUT*1000000L;
+		ts.tv_sec+=ts.tv_nsec/1000000000L;
+		ts.tv_nsec%=1000000000L;
+		if(sem_timedwait(&flip,&ts)!=0)tlog_warn("pan display timed out");
+		pending=false;
+	}
+	if(damage_full)memcpy(
+		fbdev_line(0,true),fbdev_line(0,false),
+		(size_t)finfo.line_length*vinfo.yres
+	);
+	else for(size_t i=0;i<damage_cnt;i++){
+		off=(damage[i].x1+vinfo.xoffset)*vinfo.bits_per_pixel/8;
+		len=((damage[i].x2+vinfo.xoffset+1)*vinfo.bits_per_pixel+7)/8-off;
+		for(int32_t y=damage[i].y1;y<=damage[i].y2;y++)
+			memcpy(fbdev_line(y,true)+off,fbdev_line(y,false)+off,len);
+	}
+	damage_cnt=0,damage_full=false;
 }
 static void fbdev_flush(lv_disp_drv_t*drv,const lv_area_t*area,lv_color_t*color_p){
-	if(fbp==NULL||area->x2<0||area->y2<0||area->x1>(int32_t)vinfo.xres-1||area->y1>(int32_t)vinfo.yres-1){
+	lv_area_t a;
+	uint8_t*line;
+	const uint32_t*px;
+	lv_area_copy(&a,area);
+	if(
+		fbp==NULL||!(px=pixel_flush_rotate(drv,&a,color_p))||
+		a.x2<0||a.y2<0||
+		a.x1>(int32_t)vinfo.xres-1||
+		a.y1>(int32_t)vinfo.yres-1
+	)goto done;
+	int32_t act_x1=LV_MAX(a.x1,0),act_y1=LV_MAX(a.y1,0);
+	int32_t act_x2=LV_MIN(a.x2,(int32_t)vinfo.xres-1);
+	int32_t act_y2=LV_MIN(a.y2,(int32_t)vinfo.yres-1);
+	size_t w=lv_area_get_width(&a),len=act_x2-act_x1+1,x=act_x1+vinfo.xoffset;
+	px+=(act_y1-a.y1)*w+(act_x1-a.x1);
+	for(int32_t y=act_y1;y<=act_y2;y++,px+=w){
+		line=fbdev_line(y,true);
+		switch(vinfo.bits_per_pixel){
+			case 32:
+				if(swap_abgr)pixel_swap_rb((uint32_t*)line+x,px,len);
+				else memcpy((uint32_t*)line+x,px,len*sizeof(uint32_t));
+			break;
+			case 24:pixel_pack_24(line+x*3,px,len,swap_abgr);break;
+			case 16:pixel_pack_565((uint16_t*)line+x,px,len);break;
+			case 8:memcpy(line+x,px,len);break;
+			case 1:pixel_pack_mono(line,x,px,len);break;
+		}
+	}
+	if(dbuf){
+		if(damage_cnt<FB_DAMAGE_MAX){
+			lv_area_t*d=&damage[damage_cnt++];
+			d->x1=act_x1,d->y1=act_y1,d->x2=act_x2,d->y2=act_y2;
+		}else damage_full=true;
+	}
+	done:
+	if(!lv_disp_flush_is_last(drv)){
 		lv_disp_flush_ready(drv);
 		return;
 	}
-	int32_t act_x1=area->x1<0?0:area->x1,act_y1=area->y1<0?0:area->y1;
-	int32_t act_x2=area->x2>(int32_t)vinfo.xres-1?(int32_t)vinfo.xres-1:area->x2;
-	int32_t act_y2=area->y2>(int32_t)vinfo.yres-1?(int32_t)vinfo.yres-1:area->y2;
-	lv_coord_t w=(act_x2-act_x1+1);
-	long int location,byte_location;
-	unsigned char bit_location;
-	if(vinfo.bits_per_pixel==32||vinfo.bits_per_pixel==24){
-		uint32_t*fbp32=(uint32_t*)fbp;
-		for(int32_t y=act_y1;y<=act_y2;y++){
-			location=(act_x1+vinfo.xoffset)+(y+vinfo.yoffset)*finfo.line_length/4;
-			copy_swapped(&fbp32[location],(uint32_t *)color_p,act_x2-act_x1+1);
-			color_p+=w;
-		}
-	}else if(vinfo.bits_per_pixel==16){
-		uint16_t*fbp16=(uint16_t*)fbp;
-		for(int32_t y=act_y1;y<=act_y2;y++){
-			location=(act_x1+vinfo.xoffset)+(y+vinfo.yoffset)*finfo.line_length/2;
-			memcpy(&fbp16[location],(uint32_t*)color_p,(act_x2-act_x1+1)*2);
-			color_p+=w;
-		}
-	}else if(vinfo.bits_per_pixel==8){
-		uint8_t*fbp8=(uint8_t*)fbp;
-		for(int32_t y=act_y1;y<=act_y2;y++){
-			location=(act_x1+vinfo.xoffset)+(y+vinfo.yoffset)*finfo.line_length;
-			memcpy(&fbp8[location],(uint32_t*)color_p,(act_x2-act_x1+1));
-			color_p+=w;
-		}
-	}else if(vinfo.bits_per_pixel==1){
-		uint8_t*fbp8=(uint8_t*)fbp;
-		for(int32_t y=act_y1;y<=act_y2;y++){
-			for(int32_t x=act_x1;x<=act_x2;x++){
-				location=(x+vinfo.xoffset)+(y+vinfo.yoffset)*vinfo.xres;
-				byte_location=location/8;
-				bit_location=location%8;
-				fbp8[byte_location]&=~(((uint8_t)(1))<<bit_location);
-				fbp8[byte_location]|=((uint8_t)(color_p->full))<<bit_location;
-				color_p++;
-			}
-			color_p+=area->x2-act_x2;
-		}
-	}
-	if(fbrt)sem_post(&flush);
+	if(dbuf)front=!front,vinfo.yoffset=front*vinfo.yres;
+	if(fbrt){
+		pending=dbuf;
+		sem_post(&flush);
+	}else if(dbuf)ioctl(fbfd,FBIOPAN_DISPLAY,&vinfo);
 	lv_disp_flush_ready(drv);
 }
 static int _fbdev_register(){
@@ -173,17 +236,13 @@ static int _fbdev_register(){
 	lv_disp_drv_init(&disp_drv);
 	disp_drv.hor_res=vinfo.xres;
 	disp_drv.ver_res=vinfo.yres;
-	switch(gui_rotate){
-		case 0:break;
-		case 90:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_90;break;
-		case 180:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_180;break;
-		case 270:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_270;break;
-	}
+	disp_drv.rotated=pixel_get_rotation(gui_rotate);
 	tlog_notice("screen resolution: %dx%d",vinfo.xres,vinfo.yres);
 	disp_drv.draw_buf=&disp_buf;
 	disp_drv.flush_cb=fbdev_flush;
-	disp_drv.draw_ctx_init=lv_draw_sw_init_ctx;
-	disp_drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+	disp_drv.render_start_cb=fbdev_render_start;
+	disp_drv.draw_ctx_init=gui_draw_init_ctx;
+	disp_drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 	disp_drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
 	set_active_console(7);
 	vtconsole_all_bind(0);
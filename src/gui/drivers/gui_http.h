@@ -14,6 +14,7 @@
 #ifdef ENABLE_FFMPEG
 #include<libavutil/opt.h>
 #include<libavutil/imgutils.h>
+#include<libavutil/hwcontext.h>
 #include<libavcodec/avcodec.h>
 #include<libswscale/swscale.h>
 #endif
@@ -23,6 +24,7 @@
 #include"gui.h"
 #define TAG "http"
 #define _BOUNDARY "BoundaryString"
+#define GUI_HTTP_FPS 30
 
 #ifdef ENABLE_FFMPEG
 struct video_data{
@@ -38,8 +40,14 @@ struct video_ctx{
 	struct SwsContext*sws;
 	AVCodecContext*ctx;
 	AVFrame*pic;
+	AVFrame*hw_pic;
 	AVPacket*pkt;
-	int64_t pts;
+	AVBufferRef*hw_device;
+	AVBufferRef*hw_frames;
+	int64_t rate;
+	uint64_t seq;
+	uint32_t start,last,ready;
+	bool started;
 };
 #endif
 struct post_data{
@@ -61,9 +69,15 @@ struct gui_http_state{
 	lv_indev_data_t ptr_data;
 	lv_indev_data_t enc_data;
 	sem_t input_wait;
+	pthread_mutex_t frame_lock;
+	pthread_cond_t frame_cond;
+	uint64_t frame_seq;
+	uint32_t video_rate;
 	#ifdef ENABLE_WEBSOCKET
 	sem_t disp_wait;
-	bool frame_compress;
+	int disp_inflight,disp_window;
+	uint32_t disp_tick;
+	bool frame_compress,frame_stream;
 	frame_type disp_type;
 	struct http_hand_websocket_data*disp_ws;
 	#endif
@@ -81,6 +95,7 @@ extern enum MHD_Result gui_http_hand_static_png(struct http_hand_info*i);
 #endif
 extern enum MHD_Result gui_http_hand_static_raw(struct http_hand_info*i);
 extern bool gui_http_init_img_ctx();
+extern void gui_http_wait_frame(uint64_t*seq,uint32_t*last);
 extern json_object*gui_http_get_size_json();
 extern void gui_http_img_write(void*c,void*data,int size);
 extern int gui_http_recv_input_json(struct http_hand_websocket_data*d,struct ws_data_hand*hand,const json_object*jo);
@@ -91,12 +106,16 @@ extern int gui_http_disp_ws_cmd_size(struct ws_cmd_proc*cmd,struct http_hand_web
 extern int gui_http_disp_ws_cmd_inv(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
 extern int gui_http_disp_ws_cmd_full_screen(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
 extern int gui_http_disp_ws_cmd_set_type(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
+extern int gui_http_disp_ws_cmd_set_rate(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
+extern int gui_http_disp_ws_cmd_set_window(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
 extern int gui_http_disp_ws_cmd_set_compress(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
 extern int gui_http_disp_ws_cmd_dragon_egg(struct ws_cmd_proc*cmd,struct http_hand_websocket_data*d,char**dd,size_t*dl);
 extern int gui_http_disp_ws_establish(struct http_hand_websocket_data*d);
 extern int gui_http_disp_ws_disconnect(struct http_hand_websocket_data*d);
 extern void gui_http_send_frame(enum frame_pixel mode,uint64_t sx,uint64_t sy,uint64_t dx,uint64_t dy,const void*frame);
 extern void gui_http_send_frame_area(const lv_area_t*area,const lv_color_t*frame);
+extern void gui_http_mark_tiles(const lv_area_t*area);
+extern void gui_http_send_tiles();
 #endif
 #endif
 #endif
\ No newline at end of file
@@ -14,6 +14,7 @@
 #include<microhttpd.h>
 #include"frame_protocol.h"
 #include"gui/guidrv.h"
+#include"gui/perf.h"
 #include"gui_http.h"
 #include"confd.h"
 #include"http.h"
@@ -51,31 +52,63 @@ static void*bytes_mon(void*d __attribute__((unused))){
 	return NULL;
 }
 
+static void frame_done(){
+	pthread_mutex_lock(&state.frame_lock);
+	state.frame_seq++;
+	pthread_cond_broadcast(&state.frame_cond);
+	pthread_mutex_unlock(&state.frame_lock);
+}
+
+/*
+ * streams encode only after lvgl drew something new, capped to
+ * GUI_HTTP_FPS. an idle screen still gets a frame every second so
+ * clients and encoders do not stall.
+ */
+void gui_http_wait_frame(uint64_t*seq,uint32_t*last){
+	struct timespec ts;
+	uint32_t e=lv_tick_elaps(*last);
+	if(e<1000/GUI_HTTP_FPS)usleep((1000/GUI_HTTP_FPS-e)*1000);
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	ts.tv_sec++;
+	pthread_mutex_lock(&state.frame_lock);
+	while(state.frame_seq==*seq)if(pthread_cond_timedwait(
+		&state.frame_cond,&state.frame_lock,&ts
+	)!=0)break;
+	*seq=state.frame_seq;
+	pthread_mutex_unlock(&state.frame_lock);
+	*last=lv_tick_get();
+}
+
 static void http_flush(
 	lv_disp_drv_t*disp_drv,
 	const lv_area_t*area,
 	lv_color_t*color_p
 ){
+	lv_area_t a;
+	const uint32_t*px;
+	lv_area_copy(&a,area);
 	if(
-		area->x2<0||area->y2<0||
-		area->x1>disp_drv->hor_res-1||
-		area->y1>disp_drv->ver_res-1
+		!(px=pixel_flush_rotate(disp_drv,&a,color_p))||
+		a.x2<0||a.y2<0||
+		a.x1>disp_drv->hor_res-1||
+		a.y1>disp_drv->ver_res-1
 	){
 		lv_disp_flush_ready(disp_drv);
 		return;
 	}
+	int32_t y;
+	const uint32_t*p=px;
+	uint8_t*fb=state.buffer;
+	size_t w=lv_area_get_width(&a);
+	size_t len=LV_MIN(a.x2,disp_drv->hor_res-1)-a.x1+1;
+	for(y=a.y1;y<=a.y2&&y<disp_drv->ver_res;y++,p+=w)
+		pixel_pack_24(fb+(y*disp_drv->hor_res+a.x1)*3,p,len,true);
+
+	// tile frames are cut from the screen copy, so it is updated first
 	#ifdef ENABLE_WEBSOCKET
-	if(state.disp_ws)gui_http_send_frame_area(area,color_p);
+	if(state.disp_ws)gui_http_send_frame_area(&a,(const lv_color_t*)px);
 	#endif
-	int32_t y,x,p;
-	uint8_t*fb=state.buffer;
-	for(y=area->y1;y<=area->y2&&y<disp_drv->ver_res;y++){
-		p=(y*disp_drv->hor_res+area->x1)*3;
-		for(x=area->x1;x<=area->x2&&x<disp_drv->hor_res;x++){
-			pixel_copy(PIXEL_BGRA32,(char*)fb+p,(char*)color_p);
-			p+=3,color_p++;
-		}
-	}
+	if(lv_disp_flush_is_last(disp_drv))frame_done();
 	lv_disp_flush_ready(disp_drv);
 }
 
@@ -123,6 +156,38 @@ static enum MHD_Result hand_query_size(struct http_hand_info*i){
 	return MHD_YES;
 }
 
+static json_object*perf_value_json(struct gui_perf_value*v){
+	json_object*jo=json_object_new_object();
+	json_object_object_add(jo,"last",json_object_new_int64(v->last));
+	json_object_object_add(jo,"avg",json_object_new_int64(gui_perf_avg(*v)));
+	json_object_object_add(jo,"max",json_object_new_int64(v->max));
+	json_object_object_add(jo,"count",json_object_new_int64(v->cnt));
+	return jo;
+}
+
+// stats of the last second, times in microseconds, areas in pixels
+static enum MHD_Result hand_query_perf(struct http_hand_info*i){
+	struct gui_perf p;
+	struct MHD_Response*r;
+	json_object*jo=json_object_new_object();
+	gui_perf_get(&p);
+	json_object_object_add(jo,"driver",json_object_new_string(guidrv_getname()));
+	json_object_object_add(jo,"frames",json_object_new_int64(p.frames));
+	json_object_object_add(jo,"fps",json_object_new_int64(gui_perf_fps(&p)));
+	json_object_object_add(jo,"render",perf_value_json(&p.render));
+	json_object_object_add(jo,"flush",perf_value_json(&p.flush));
+	json_object_object_add(jo,"area",perf_value_json(&p.area));
+	json_object_object_add(jo,"latency",perf_value_json(&p.latency));
+	const char*str=json_object_to_json_string(jo);
+	r=MHD_create_response_from_buffer(strlen(str),(char*)str,MHD_RESPMEM_MUST_COPY);
+	MHD_add_response_header(r,MHD_HTTP_HEADER_CONTENT_TYPE,"application/json");
+	MHD_add_response_header(r,MHD_HTTP_HEADER_CACHE_CONTROL,"no-cache");
+	MHD_queue_response(i->conn,MHD_HTTP_OK,r);
+	MHD_destroy_response(r);
+	json_object_put(jo);
+	return MHD_YES;
+}
+
 #ifdef ENABLE_FFMPEG
 #define CODECS(_codecs...) .codecs=(struct video_codec*[]){_codecs,NULL},
 #define CODEC(_name,_fmt) &(struct video_codec){.name=_name,.fmt=_fmt}
@@ -134,6 +199,8 @@ static enum MHD_Result hand_query_size(struct http_hand_info*i){
 
 static struct http_hand handlers[]={
 	{.enabled=true, .url="/query/size",   .handler=hand_query_size},
+	{.enabled=true, .url="/query/perf",   .handler=hand_query_perf},
+	{.enabled=true, .url="/metrics",      .handler=http_hand_metrics},
 	{.enabled=true, .url="/static/raw",   .handler=gui_http_hand_static_raw},
 	#ifdef ENABLE_STB
 	{.enabled=true, .url="/static/bmp",   .handler=gui_http_hand_static_bmp},
@@ -147,13 +214,13 @@ static struct http_hand handlers[]={
 	VIDEO("amv",   "video/mjpeg",    CODEC("amv",AV_PIX_FMT_YUVJ420P))
 	VIDEO("mpeg1", "video/mpeg",     CODEC("mpeg1video",AV_PIX_FMT_YUV420P))
 	VIDEO("mpeg2", "video/mpeg",     CODEC("mpeg2_vaapi",AV_PIX_FMT_VAAPI), CODEC("mpeg2video",AV_PIX_FMT_YUV420P))
-	VIDEO("mpeg4", "video/mpeg",     CODEC("mpeg4",AV_PIX_FMT_YUV420P))
+	VIDEO("mpeg4", "video/mpeg",     CODEC("mpeg4_v4l2m2m",AV_PIX_FMT_YUV420P), CODEC("mpeg4",AV_PIX_FMT_YUV420P))
 	VIDEO("h261",  "video/h261",     CODEC("h261",AV_PIX_FMT_YUV420P))
 	VIDEO("h262",  "video/h262",     CODEC("libx262",AV_PIX_FMT_YUV420P))
 	VIDEO("h263",  "video/h263",     CODEC("h263",AV_PIX_FMT_YUV420P), CODEC("h263p",AV_PIX_FMT_YUV420P))
-	VIDEO("h264",  "video/h264",     CODEC("h264_vaapi",AV_PIX_FMT_VAAPI), CODEC("libx264rgb",AV_PIX_FMT_RGB24), CODEC("libx264",AV_PIX_FMT_YUV420P))
-	VIDEO("h265",  "video/h265",     CODEC("hevc_vaapi",AV_PIX_FMT_VAAPI), CODEC("libx265",AV_PIX_FMT_YUV420P))
-	VIDEO("vp8",   "video/vp8",      CODEC("vp8_vaapi",AV_PIX_FMT_VAAPI),  CODEC("libvpx",AV_PIX_FMT_YUV420P))
+	VIDEO("h264",  "video/h264",     CODEC("h264_v4l2m2m",AV_PIX_FMT_YUV420P), CODEC("h264_vaapi",AV_PIX_FMT_VAAPI), CODEC("libx264rgb",AV_PIX_FMT_RGB24), CODEC("libx264",AV_PIX_FMT_YUV420P))
+	VIDEO("h265",  "video/h265",     CODEC("hevc_v4l2m2m",AV_PIX_FMT_YUV420P), CODEC("hevc_vaapi",AV_PIX_FMT_VAAPI), CODEC("libx265",AV_PIX_FMT_YUV420P))
+	VIDEO("vp8",   "video/vp8",      CODEC("vp8_v4l2m2m",AV_PIX_FMT_YUV420P), CODEC("vp8_vaapi",AV_PIX_FMT_VAAPI),  CODEC("libvpx",AV_PIX_FMT_YUV420P))
 	VIDEO("vp9",   "video/vp9",      CODEC("vp9_vaapi",AV_PIX_FMT_VAAPI),  CODEC("libvpx-vp9",AV_PIX_FMT_YUV420P))
 	VIDEO("av1",   "video/av1",      CODEC("libaom-av1",AV_PIX_FMT_YUV420P))
 	VIDEO("flv",   "video/x-flv",    CODEC("flv",AV_PIX_FMT_YUV420P))
@@ -173,6 +240,10 @@ static struct http_hand handlers[]={
 				WS_CMD_PROC("TYPE:PNG",gui_http_disp_ws_cmd_set_type)
 				WS_CMD_PROC("TYPE:BMP",gui_http_disp_ws_cmd_set_type)
 				WS_CMD_PROC("TYPE:RAW",gui_http_disp_ws_cmd_set_type)
+				WS_CMD_PROC("TYPE:TILE",gui_http_disp_ws_cmd_set_type)
+				WS_CMD_PROC("RATE:",gui_http_disp_ws_cmd_set_rate)
+				WS_CMD_PROC("WINDOW:",gui_http_disp_ws_cmd_set_window)
+				WS_CMD_PROC("COMP:STREAM",gui_http_disp_ws_cmd_set_compress)
 				WS_CMD_PROC("COMP:TRUE",gui_http_disp_ws_cmd_set_compress)
 				WS_CMD_PROC("COMP:FALSE",gui_http_disp_ws_cmd_set_compress)
 				WS_CMD_PROC("SIZE",gui_http_disp_ws_cmd_size)
@@ -213,6 +284,7 @@ static int http_register(){
 	static lv_color_t*buf=NULL;
 	static lv_disp_draw_buf_t disp_buf;
 	uint16_t port=(uint16_t)confd_get_integer("gui.http_port",8080);
+	pthread_condattr_t ca;
 	errno=0;
 	if(
 		!(buf=malloc(s*sizeof(lv_color_t)))||
@@ -224,6 +296,11 @@ static int http_register(){
 		state.buffer=buf=NULL;
 		return -1;
 	}
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca,CLOCK_MONOTONIC);
+	pthread_cond_init(&state.frame_cond,&ca);
+	pthread_condattr_destroy(&ca);
+	pthread_mutex_init(&state.frame_lock,NULL);
 	if(!(state.hs=MHD_start_daemon(
 		MHD_USE_POLL_INTERNAL_THREAD|
 		MHD_USE_THREAD_PER_CONNECTION|
@@ -251,15 +328,10 @@ static int http_register(){
 	disp_drv.flush_cb=http_flush;
 	disp_drv.hor_res=state.ww;
 	disp_drv.ver_res=state.hh;
-	disp_drv.draw_ctx_init=lv_draw_sw_init_ctx;
-	disp_drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+	disp_drv.draw_ctx_init=gui_draw_init_ctx;
+	disp_drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 	disp_drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
-	switch(gui_rotate){
-		case 0:break;
-		case 90:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_90;break;
-		case 180:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_180;break;
-		case 270:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_270;break;
-	}
+	disp_drv.rotated=pixel_get_rotation(gui_rotate);
 	tlog_debug("screen resolution: %dx%d",state.ww,state.hh);
 	lv_disp_drv_register(&disp_drv);
 	return 0;
@@ -14,20 +14,39 @@
 #include"gui_http.h"
 #include"http.h"
 
+/*
+ * encoders are tried in the order listed, so v4l2 m2m and vaapi come in
+ * front of the software ones. the bitrate follows the RATE the display
+ * websocket reported, or backs off when the client drains packets late.
+ */
+#define VIDEO_RATE     400000
+#define VIDEO_MIN_RATE 100000
+#define VIDEO_MAX_RATE 4000000
+
+static void update_rate(struct video_ctx*video){
+	int64_t rate=video->rate;
+	uint32_t drain=lv_tick_elaps(video->ready);
+	if(state.video_rate>0)rate=(int64_t)state.video_rate*1000;
+	else if(drain>2000/GUI_HTTP_FPS)rate=rate*3/4;
+	else if(drain<250/GUI_HTTP_FPS)rate+=rate/10;
+	rate=MAX(MIN(rate,VIDEO_MAX_RATE),VIDEO_MIN_RATE);
+	if(rate==video->rate)return;
+	video->rate=rate;
+
+	// only some encoders reconfigure on the fly, the rest keep their rate
+	video->ctx->bit_rate=rate;
+}
+
 static bool write_video_frame(struct video_ctx*video){
+	AVFrame*pic=video->pic;
 	int r=AVERROR(EAGAIN);
-	static uint32_t last=0;
 	if(!state.buffer)return false;
-	if(video->pts!=0)r=avcodec_receive_packet(video->ctx,video->pkt);
+	if(video->started)r=avcodec_receive_packet(video->ctx,video->pkt);
 	if(r==AVERROR(EAGAIN)||r==AVERROR_EOF){
-		uint32_t cur=lv_tick_get();
-		uint32_t e=cur-last;
-		if(e<1000/30)usleep(e*1000);
-		last=cur;
+		gui_http_wait_frame(&video->seq,&video->last);
 		errno=0,r=av_frame_make_writable(video->pic);
 		if(r<0)return terlog_warn(false,"frame unwritable: %d",r);
-		video->pts++;
-		int st=gui_w*3;
+		int st=state.ww*3;
 		const uint8_t*const src[]={state.buffer,NULL};
 		sws_scale(
 			video->sws,src,
@@ -35,11 +54,22 @@ static bool write_video_frame(struct video_ctx*video){
 			video->pic->data,
 			video->pic->linesize
 		);
-		video->pic->pts=video->pts;
-		errno=0,r=avcodec_send_frame(video->ctx,video->pic);
+		if(video->hw_frames){
+			av_frame_unref(video->hw_pic);
+			errno=0,r=av_hwframe_get_buffer(video->hw_frames,video->hw_pic,0);
+			if(r<0)return terlog_warn(false,"get hardware frame failed: %d",r);
+			errno=0,r=av_hwframe_transfer_data(video->hw_pic,video->pic,0);
+			if(r<0)return terlog_warn(false,"upload frame failed: %d",r);
+			pic=video->hw_pic;
+		}
+		pic->pts=lv_tick_elaps(video->start);
+		errno=0,r=avcodec_send_frame(video->ctx,pic);
 		if(r<0)return terlog_warn(false,"send frame failed: %d",r);
+		video->started=true;
 		return write_video_frame(video);
 	}
+	if(r<0)return terlog_warn(false,"receive packet failed: %d",r);
+	video->ready=lv_tick_get();
 	return true;
 }
 static ssize_t stream_video(
@@ -52,6 +82,7 @@ static ssize_t stream_video(
 	static size_t bs=0,bp=0;
 	if(bp>=bs){
 		bp=0;
+		if(video->started)update_rate(video);
 		if(!write_video_frame(video))return -1;
 		bs=video->pkt->size;
 	}
@@ -65,21 +96,54 @@ static void clean_video_ctx(struct video_ctx*video){
 	if(video->ctx)avcodec_free_context(&video->ctx);
 	if(video->pkt)av_packet_free(&video->pkt);
 	if(video->pic)av_frame_free(&video->pic);
+	if(video->hw_pic)av_frame_free(&video->hw_pic);
+	if(video->hw_frames)av_buffer_unref(&video->hw_frames);
+	if(video->hw_device)av_buffer_unref(&video->hw_device);
 	if(video->sws)sws_freeContext(video->sws);
 	free(video);
 }
 
+// vaapi encoders take frames from a device pool, uploaded from nv12
+static bool setup_vaapi(struct video_ctx*video){
+	int x;
+	AVHWFramesContext*fc;
+	errno=0,x=av_hwdevice_ctx_create(
+		&video->hw_device,AV_HWDEVICE_TYPE_VAAPI,
+		NULL,NULL,0
+	);
+	if(x<0)return terlog_warn(false,"create vaapi device failed: %d",x);
+	errno=0,video->hw_frames=av_hwframe_ctx_alloc(video->hw_device);
+	if(!video->hw_frames)return terlog_warn(false,"alloc hardware frames failed");
+	fc=(AVHWFramesContext*)video->hw_frames->data;
+	fc->format=AV_PIX_FMT_VAAPI;
+	fc->sw_format=AV_PIX_FMT_NV12;
+	fc->width=state.ww;
+	fc->height=state.hh;
+	fc->initial_pool_size=4;
+	errno=0,x=av_hwframe_ctx_init(video->hw_frames);
+	if(x<0)return terlog_warn(false,"init hardware frames failed: %d",x);
+	errno=0,video->ctx->hw_frames_ctx=av_buffer_ref(video->hw_frames);
+	if(!video->ctx->hw_frames_ctx)return terlog_warn(false,"ref hardware frames failed");
+	errno=0,video->hw_pic=av_frame_alloc();
+	if(!video->hw_pic)return terlog_warn(false,"alloc hardware frame failed");
+	return true;
+}
+
 static bool get_encoder(struct video_ctx*video,struct video_codec*c){
 	int x=0;
+	enum AVPixelFormat fmt=c->fmt;
 	errno=0,video->codec=avcodec_find_encoder_by_name(c->name);
 	if(!video->codec)return terlog_warn(false,"codec %s not found",c->name);
 	errno=0,video->ctx=avcodec_alloc_context3(video->codec);
 	if(!video->ctx)EDONE(telog_warn("alloc context failed"));
-	video->ctx->width=gui_w;
+	video->rate=VIDEO_RATE;
+	video->ctx->width=state.ww;
 	video->ctx->height=state.hh;
-	video->ctx->bit_rate=400000;
-	video->ctx->time_base.den=30;
+	video->ctx->bit_rate=video->rate;
+	video->ctx->time_base.den=1000;
 	video->ctx->time_base.num=1;
+	video->ctx->framerate.den=1;
+	video->ctx->framerate.num=GUI_HTTP_FPS;
 	video->ctx->gop_size=60;
 	video->ctx->pix_fmt=c->fmt;
 	video->ctx->thread_count=1;
@@ -91,26 +155,36 @@ static bool get_encoder(struct video_ctx*video,struct video_codec*c){
 			break;
 		default:break;
 	}
+	if(c->fmt==AV_PIX_FMT_VAAPI){
+		if(!setup_vaapi(video))goto done;
+		fmt=AV_PIX_FMT_NV12;
+	}
 	av_opt_set(video->ctx->priv_data,"tune","zerolatency",0);
 	av_opt_set(video->ctx->priv_data,"preset","ultrafast",0);
 	errno=0,x=avcodec_open2(video->ctx,video->codec,NULL);
 	if(x<0)EDONE(telog_warn("open codec %s failed: %d",c->name,x));
 	video->pic->width=video->ctx->width;
 	video->pic->height=video->ctx->height;
-	video->pic->format=video->ctx->pix_fmt;
+	video->pic->format=fmt;
 	errno=0,x=av_frame_get_buffer(video->pic,0);
 	if(x<0)EDONE(telog_warn("alloc buffer failed: %d",x));
 	errno=0,x=av_frame_make_writable(video->pic);
 	if(x<0)EDONE(telog_warn("frame not writable: %d",x));
 	errno=0,video->sws=sws_getContext(
-		gui_w,state.hh,AV_PIX_FMT_RGB24,
-		gui_w,state.hh,video->ctx->pix_fmt,
+		state.ww,state.hh,AV_PIX_FMT_RGB24,
+		state.ww,state.hh,fmt,
 		SWS_FAST_BILINEAR,NULL,NULL,NULL
 	);
 	if(!video->sws)EDONE(telog_warn("alloc swscale failed"));
+	tlog_info("stream video with encoder %s",c->name);
+	video->seq=UINT64_MAX;
+	video->start=lv_tick_get();
 	return true;
 	done:
 	if(video->ctx)avcodec_free_context(&video->ctx);
+	if(video->hw_pic)av_frame_free(&video->hw_pic);
+	if(video->hw_frames)av_buffer_unref(&video->hw_frames);
+	if(video->hw_device)av_buffer_unref(&video->hw_device);
 	video->ctx=NULL;
 	video->codec=NULL;
 	return false;
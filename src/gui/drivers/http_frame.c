@@ -11,52 +11,96 @@
 #ifdef ENABLE_MICROHTTPD
 #ifdef ENABLE_WEBSOCKET
 #include<zlib.h>
+#include<stdint.h>
 #include<stb_image_write.h>
 #include"frame_protocol.h"
 #include"gui_http.h"
 #include"http.h"
 
-void gui_http_send_frame(
-	enum frame_pixel mode,
+/*
+ * frames are not waited for one by one, up to DISP_WINDOW of them may be
+ * in flight before the sender holds back, the client may change it with
+ * WINDOW. tile frames never wait, the changed tiles stay dirty and go out
+ * with the next FLUSH from client.
+ * with COMP:STREAM all frames of a connection go through one deflate
+ * stream ended by a sync flush, so the dictionary carries across frames.
+ * a frame marked reset starts the stream over, after connect or errors.
+ */
+#define DISP_WINDOW     3
+#define DISP_WINDOW_MAX 16
+#define DISP_TIMEOUT    30000
+#define TILE_FORCE      2
+
+static struct{
+	z_stream zs;
+	bool init,reset;
+}stream;
+
+static struct{
+	int cols,rows;
+	uint8_t*dirty;
+	uint32_t*hash;
+	uint8_t data[FRAME_TILE_SIZE*FRAME_TILE_SIZE*4];
+}tiles;
+
+static bool window_full(){
+	int window=state.disp_window>0?state.disp_window:DISP_WINDOW;
+	if(__atomic_load_n(&state.disp_inflight,__ATOMIC_ACQUIRE)<window)return false;
+	if(lv_tick_elaps(state.disp_tick)<DISP_TIMEOUT)return true;
+	tlog_warn("display client does not acknowledge frames, reset window");
+	__atomic_store_n(&state.disp_inflight,0,__ATOMIC_RELEASE);
+	return false;
+}
+
+static void window_wait(){
+	struct timespec ts;
+	while(state.disp_ws&&window_full()){
+		clock_gettime(CLOCK_REALTIME,&ts);
+		ts.tv_sec++;
+		sem_timedwait(&state.disp_wait,&ts);
+	}
+}
+
+// caller holds gui_http_ctx.lock
+static bool stream_init(){
+	if(stream.init)return true;
+	memset(&stream.zs,0,sizeof(stream.zs));
+	if(deflateInit(&stream.zs,Z_BEST_SPEED)!=Z_OK)
+		return trlog_warn(false,"zlib deflate init failed");
+	stream.init=true,stream.reset=true;
+	return true;
+}
+
+// caller holds gui_http_ctx.lock
+static bool stream_compress(frame_data*fd,size_t max,const void*src,size_t ss){
+	int i;
+	fd->reset=stream.reset;
+	if(stream.reset&&deflateReset(&stream.zs)!=Z_OK)return false;
+	stream.reset=true;
+	stream.zs.next_in=(Bytef*)src,stream.zs.avail_in=ss;
+	stream.zs.next_out=(Bytef*)fd->frame,stream.zs.avail_out=max;
+	if((i=deflate(&stream.zs,Z_SYNC_FLUSH))!=Z_OK||stream.zs.avail_in!=0)
+		return trlog_warn(false,"zlib deflate failed: %d",i);
+	fd->size=max-stream.zs.avail_out,fd->src_size=ss;
+	stream.reset=false;
+	return true;
+}
+
+// caller holds gui_http_ctx.lock
+static void frame_send(
+	frame_type type,enum frame_pixel mode,
 	uint64_t sx,uint64_t sy,
 	uint64_t dx,uint64_t dy,
-	const void*frame
+	const void*src,size_t ss,
+	uint32_t t,int level
 ){
-	int r=1;
-	const void*src;
-	size_t ss,size;
+	size_t size;
 	static frame_data*fd=NULL;
 	static size_t ds=sizeof(frame_data),max=0;
-	uint32_t t=lv_tick_get();
-	if(!state.disp_ws||!gui_http_init_img_ctx())return;
-	uint8_t bsp=pixel_size(mode);
-	uint64_t w=dx-sx+1,h=dy-sy+1;
-	MUTEX_LOCK(gui_http_ctx.lock);
-	switch(state.disp_type){
-		case TYPE_RAW:
-			ss=w*h*bsp,src=frame;
-			break;
-		case TYPE_BMP:
-			gui_http_ctx.last_pos=0;
-			r=stbi_write_bmp_to_func(gui_http_img_write,&gui_http_ctx,w,h,bsp,frame);
-			src=gui_http_ctx.buf,ss=gui_http_ctx.last_pos;
-			break;
-		case TYPE_JPG:
-			gui_http_ctx.last_pos=0;
-			r=stbi_write_jpg_to_func(gui_http_img_write,&gui_http_ctx,w,h,bsp,frame,90);
-			src=gui_http_ctx.buf,ss=gui_http_ctx.last_pos;
-			break;
-		case TYPE_PNG:
-			gui_http_ctx.last_pos=0;
-			r=stbi_write_png_to_func(gui_http_img_write,&gui_http_ctx,w,h,bsp,frame,w*bsp);
-			src=gui_http_ctx.buf,ss=gui_http_ctx.last_pos;
-			break;
-		default:MUTEX_UNLOCK(gui_http_ctx.lock);return;
-	}
-	if(r<=0)EDONE(tlog_warn("generate frame failed: %d",r));
+	bool zs=state.frame_compress&&state.frame_stream&&stream_init();
 	size=ds+ss;
 	if(state.frame_compress){
-		size_t ns=compressBound(ss);
+		size_t ns=zs?deflateBound(&stream.zs,ss)+16:compressBound(ss);
 		if(ns>ss)size=ds+ns;
 	}
 	if(size>max){
@@ -75,39 +119,226 @@ void gui_http_send_frame(
 		tlog_debug("resize buffer to %zu bytes",size);
 		max=size;
 	}
-	if(state.frame_compress){
+	if(zs){
+		if(!stream_compress(fd,size-ds,src,ss))goto done;
+		size=ds+fd->size;
+	}else if(state.frame_compress){
 		uLong len=size-ds;
-		int i=compress2((Bytef*)fd->frame,&len,src,ss,3);
+		int i=compress2((Bytef*)fd->frame,&len,src,ss,level);
 		if(i!=Z_OK)EDONE(tlog_warn("zlib compress failed: %d",i));
 		fd->size=len,fd->src_size=ss,size=ds+len;
 	}else{
 		memcpy(fd->frame,src,ss);
 		fd->size=ss,fd->src_size=ss;
 	}
-	MUTEX_UNLOCK(gui_http_ctx.lock);
 	fd->pixel=mode;
 	fd->compressed=state.frame_compress;
+	fd->stream=zs;
 	fd->src_x=sx,fd->src_y=sy;
 	fd->dst_x=dx,fd->dst_y=dy;
-	fd->type=state.disp_type;
+	fd->type=type;
 	fd->gen_time=time(NULL);
 	uint32_t e=lv_tick_get();
 	fd->cost_time=e-t;
 	state.bytes+=size;
+	if(__atomic_fetch_add(&state.disp_inflight,1,__ATOMIC_ACQ_REL)==0)
+		state.disp_tick=e;
 	ws_send_payload(state.disp_ws,"FRAME",fd,size);
-	struct timespec ts={.tv_sec=30,.tv_nsec=0};
-	sem_timedwait(&state.disp_wait,&ts);
-	return;
+	done:;
+}
+
+static void send_frame(
+	enum frame_pixel mode,
+	uint64_t sx,uint64_t sy,
+	uint64_t dx,uint64_t dy,
+	const void*frame,bool wait
+){
+	int r=1;
+	const void*src;
+	size_t ss;
+	uint32_t t=lv_tick_get();
+	if(!state.disp_ws||!gui_http_init_img_ctx())return;
+	uint8_t bsp=pixel_size(mode);
+	uint64_t w=dx-sx+1,h=dy-sy+1;
+	if(wait)window_wait();
+	MUTEX_LOCK(gui_http_ctx.lock);
+	switch(state.disp_type){
+		case TYPE_RAW:
+			ss=w*h*bsp,src=frame;
+			break;
+		case TYPE_BMP:
+			gui_http_ctx.last_pos=0;
+			r=stbi_write_bmp_to_func(gui_http_img_write,&gui_http_ctx,w,h,bsp,frame);
+			src=gui_http_ctx.buf,ss=gui_http_ctx.last_pos;
+			break;
+		case TYPE_JPG:
+			gui_http_ctx.last_pos=0;
+			r=stbi_write_jpg_to_func(gui_http_img_write,&gui_http_ctx,w,h,bsp,frame,90);
+			src=gui_http_ctx.buf,ss=gui_http_ctx.last_pos;
+			break;
+		case TYPE_PNG:
+			gui_http_ctx.last_pos=0;
+			r=stbi_write_png_to_func(gui_http_img_write,&gui_http_ctx,w,h,bsp,frame,w*bsp);
+			src=gui_http_ctx.buf,ss=gui_http_ctx.last_pos;
+			break;
+		default:MUTEX_UNLOCK(gui_http_ctx.lock);return;
+	}
+	if(r<=0)tlog_warn("generate frame failed: %d",r);
+	else frame_send(state.disp_type,mode,sx,sy,dx,dy,src,ss,t,3);
+	MUTEX_UNLOCK(gui_http_ctx.lock);
+}
+
+void gui_http_send_frame(
+	enum frame_pixel mode,
+	uint64_t sx,uint64_t sy,
+	uint64_t dx,uint64_t dy,
+	const void*frame
+){
+	send_frame(mode,sx,sy,dx,dy,frame,true);
+}
+
+// caller holds gui_http_ctx.lock
+static bool tiles_alloc(){
+	int cols=(state.ww+FRAME_TILE_SIZE-1)/FRAME_TILE_SIZE;
+	int rows=(state.hh+FRAME_TILE_SIZE-1)/FRAME_TILE_SIZE;
+	if(tiles.dirty&&tiles.cols==cols&&tiles.rows==rows)return true;
+	if(tiles.dirty)free(tiles.dirty);
+	if(tiles.hash)free(tiles.hash);
+	tiles.cols=cols,tiles.rows=rows;
+	tiles.dirty=malloc(cols*rows);
+	tiles.hash=malloc(cols*rows*sizeof(uint32_t));
+	if(!tiles.dirty||!tiles.hash){
+		telog_warn("allocate tiles failed");
+		if(tiles.dirty)free(tiles.dirty);
+		if(tiles.hash)free(tiles.hash);
+		tiles.dirty=NULL,tiles.hash=NULL;
+		return false;
+	}
+	memset(tiles.dirty,TILE_FORCE,cols*rows);
+	return true;
+}
+
+static void tiles_force(){
+	if(!gui_http_init_img_ctx())return;
+	MUTEX_LOCK(gui_http_ctx.lock);
+	if(tiles_alloc())memset(tiles.dirty,TILE_FORCE,tiles.cols*tiles.rows);
+	MUTEX_UNLOCK(gui_http_ctx.lock);
+}
+
+void gui_http_mark_tiles(const lv_area_t*area){
+	int x1,y1,x2,y2;
+	if(!gui_http_init_img_ctx())return;
+	MUTEX_LOCK(gui_http_ctx.lock);
+	if(tiles_alloc()){
+		x1=LV_MAX(area->x1,0)/FRAME_TILE_SIZE;
+		y1=LV_MAX(area->y1,0)/FRAME_TILE_SIZE;
+		x2=LV_MIN(area->x2,state.ww-1)/FRAME_TILE_SIZE;
+		y2=LV_MIN(area->y2,state.hh-1)/FRAME_TILE_SIZE;
+		for(int y=y1;y<=y2;y++)for(int x=x1;x<=x2;x++)
+			if(!tiles.dirty[y*tiles.cols+x])
+				tiles.dirty[y*tiles.cols+x]=1;
+	}
+	MUTEX_UNLOCK(gui_http_ctx.lock);
+}
+
+static uint32_t tile_hash(const uint8_t*fb,int x,int y,int w,int h){
+	uLong crc=crc32(0L,Z_NULL,0);
+	for(int j=0;j<h;j++)
+		crc=crc32(crc,fb+((y+j)*state.ww+x)*3,w*3);
+	return (uint32_t)crc;
+}
+
+// solid tiles are one pixel, runs are kept only while smaller than raw
+static size_t tile_encode(uint8_t*out,const uint8_t*fb,int x,int y,int w,int h,uint8_t*enc){
+	bool solid=true;
+	unsigned cnt=0;
+	size_t o=0,raw=w*h*3;
+	const uint8_t*row,*p,*run=NULL;
+	for(int j=0;j<h;j++){
+		row=fb+((y+j)*state.ww+x)*3;
+		for(int i=0;i<w;i++){
+			p=row+i*3;
+			if(run&&memcmp(p,run,3)==0){
+				if(cnt<256){cnt++;continue;}
+			}else if(run)solid=false;
+			if(run){
+				if(o+4>raw)goto raw;
+				out[o]=cnt-1;
+				memcpy(out+o+1,run,3);
+				o+=4;
+			}
+			run=p,cnt=1;
+		}
+	}
+	if(solid){
+		memcpy(out,run,3);
+		*enc=TILE_SOLID;
+		return 3;
+	}
+	if(o+4>raw)goto raw;
+	out[o]=cnt-1;
+	memcpy(out+o+1,run,3);
+	*enc=TILE_RLE;
+	return o+4;
+	raw:
+	for(int j=0;j<h;j++)
+		memcpy(out+j*w*3,fb+((y+j)*state.ww+x)*3,w*3);
+	*enc=TILE_RAW;
+	return raw;
+}
+
+void gui_http_send_tiles(){
+	size_t pos;
+	uint32_t hash;
+	frame_tile tile;
+	const uint8_t*fb=state.buffer;
+	static const uint8_t pad[3]={0};
+	int x1=INT32_MAX,y1=INT32_MAX,x2=-1,y2=-1;
+	uint32_t t=lv_tick_get();
+	if(!state.disp_ws||!fb||!gui_http_init_img_ctx())return;
+	MUTEX_LOCK(gui_http_ctx.lock);
+	if(state.disp_type!=TYPE_TILE||!tiles_alloc()||window_full())
+		goto done;
+	gui_http_ctx.last_pos=0;
+	memset(&tile,0,sizeof(tile));
+	for(int i=0;i<tiles.cols*tiles.rows;i++){
+		if(!tiles.dirty[i])continue;
+		tile.x=(i%tiles.cols)*FRAME_TILE_SIZE;
+		tile.y=(i/tiles.cols)*FRAME_TILE_SIZE;
+		tile.w=LV_MIN(FRAME_TILE_SIZE,state.ww-tile.x);
+		tile.h=LV_MIN(FRAME_TILE_SIZE,state.hh-tile.y);
+		hash=tile_hash(fb,tile.x,tile.y,tile.w,tile.h);
+		if(tiles.dirty[i]!=TILE_FORCE&&tiles.hash[i]==hash){
+			tiles.dirty[i]=0;
+			continue;
+		}
+		tile.size=tile_encode(tiles.data,fb,tile.x,tile.y,tile.w,tile.h,&tile.enc);
+		pos=gui_http_ctx.last_pos+sizeof(tile)+FRAME_TILE_ALIGN(tile.size);
+		gui_http_img_write(NULL,&tile,sizeof(tile));
+		gui_http_img_write(NULL,tiles.data,tile.size);
+		gui_http_img_write(NULL,(void*)pad,FRAME_TILE_ALIGN(tile.size)-tile.size);
+		if(gui_http_ctx.last_pos!=pos)EDONE(telog_warn("grow tiles buffer failed"));
+		tiles.dirty[i]=0,tiles.hash[i]=hash;
+		x1=LV_MIN(x1,tile.x),y1=LV_MIN(y1,tile.y);
+		x2=LV_MAX(x2,tile.x+tile.w-1),y2=LV_MAX(y2,tile.y+tile.h-1);
+	}
+	if(gui_http_ctx.last_pos>0)frame_send(
+		TYPE_TILE,PIXEL_RGB24,x1,y1,x2,y2,
+		gui_http_ctx.buf,gui_http_ctx.last_pos,
+		t,Z_BEST_SPEED
+	);
 	done:
 	MUTEX_UNLOCK(gui_http_ctx.lock);
-	return;
 }
 
 void gui_http_send_frame_area(
 	const lv_area_t*area,
 	const lv_color_t*frame
 ){
-	gui_http_send_frame(
+	if(state.disp_type==TYPE_TILE){
+		gui_http_mark_tiles(area);
+		gui_http_send_tiles();
+	}else gui_http_send_frame(
 		PIXEL_BGRA32,
 		area->x1,area->y1,
 		area->x2,area->y2,
@@ -121,8 +352,12 @@ int gui_http_disp_ws_cmd_flush(
 	char**dd __attribute__((unused)),
 	size_t*dl __attribute__((unused))
 ){
-	if(state.disp_ws==d)
-		sem_post(&state.disp_wait);
+	if(state.disp_ws!=d)return 0;
+	state.disp_tick=lv_tick_get();
+	if(__atomic_sub_fetch(&state.disp_inflight,1,__ATOMIC_ACQ_REL)<0)
+		__atomic_store_n(&state.disp_inflight,0,__ATOMIC_RELEASE);
+	sem_post(&state.disp_wait);
+	if(state.disp_type==TYPE_TILE)gui_http_send_tiles();
 	return 0;
 }
 
@@ -157,11 +392,15 @@ int gui_http_disp_ws_cmd_full_screen(
 	size_t*dl __attribute__((unused))
 ){
 	if(state.disp_ws!=d)return 2;
-	gui_http_send_frame(
+	if(state.disp_type==TYPE_TILE){
+		tiles_force();
+		gui_http_send_tiles();
+	}else send_frame(
 		PIXEL_RGB24,0,0,
 		state.ww-1,
 		state.hh-1,
-		state.buffer
+		state.buffer,
+		false
 	);
 	return 0;
 }
@@ -179,6 +418,7 @@ int gui_http_disp_ws_cmd_set_type(
 	else if(strcmp(m,"PNG")==0)state.disp_type=TYPE_PNG;
 	else if(strcmp(m,"BMP")==0)state.disp_type=TYPE_BMP;
 	else if(strcmp(m,"RAW")==0)state.disp_type=TYPE_RAW;
+	else if(strcmp(m,"TILE")==0)state.disp_type=TYPE_TILE,tiles_force();
 	else return ws_send_cmd_r(1,d,"INVAL");
 	return ws_send_cmd_r(1,d,"OKAY");
 }
@@ -192,9 +432,59 @@ int gui_http_disp_ws_cmd_set_compress(
 	char*m=(char*)cmd->cmd;
 	if(strncmp(m,"COMP:",5)!=0)return 0;
 	m+=5;
+	MUTEX_LOCK(gui_http_ctx.lock);
 	if(strcmp(m,"FALSE")==0)state.frame_compress=false;
-	else if(strcmp(m,"TRUE")==0)state.frame_compress=true;
-	else return ws_send_cmd_r(1,d,"INVAL");
+	else if(strcmp(m,"TRUE")==0)
+		state.frame_compress=true,state.frame_stream=false;
+	else if(strcmp(m,"STREAM")==0)
+		state.frame_compress=true,state.frame_stream=true;
+	else{
+		MUTEX_UNLOCK(gui_http_ctx.lock);
+		return ws_send_cmd_r(1,d,"INVAL");
+	}
+	stream.reset=true;
+	MUTEX_UNLOCK(gui_http_ctx.lock);
+	return ws_send_cmd_r(1,d,"OKAY");
+}
+
+// frames allowed in flight before the sender waits for FLUSH, 0 returns to default
+int gui_http_disp_ws_cmd_set_window(
+	struct ws_cmd_proc*cmd __attribute__((unused)),
+	struct http_hand_websocket_data*d,
+	char**dd,
+	size_t*dl
+){
+	char buf[8],*end=NULL;
+	if(!*dd||*dl<=0||*dl>=sizeof(buf))return ws_send_cmd_r(1,d,"INVAL");
+	memset(buf,0,sizeof(buf));
+	memcpy(buf,*dd,*dl);
+	*dd+=*dl,*dl=0;
+	errno=0;
+	unsigned long window=strtoul(buf,&end,10);
+	if(errno!=0||end==buf||*end||window>DISP_WINDOW_MAX)
+		return ws_send_cmd_r(1,d,"INVAL");
+	state.disp_window=window;
+	sem_post(&state.disp_wait);
+	return ws_send_cmd_r(1,d,"OKAY");
+}
+
+// video bitrate in kbit/s reported by the client, 0 returns to automatic
+int gui_http_disp_ws_cmd_set_rate(
+	struct ws_cmd_proc*cmd __attribute__((unused)),
+	struct http_hand_websocket_data*d,
+	char**dd,
+	size_t*dl
+){
+	char buf[16],*end=NULL;
+	if(!*dd||*dl<=0||*dl>=sizeof(buf))return ws_send_cmd_r(1,d,"INVAL");
+	memset(buf,0,sizeof(buf));
+	memcpy(buf,*dd,*dl);
+	*dd+=*dl,*dl=0;
+	errno=0;
+	unsigned long rate=strtoul(buf,&end,10);
+	if(errno!=0||end==buf||*end||rate>UINT32_MAX/1000)
+		return ws_send_cmd_r(1,d,"INVAL");
+	state.video_rate=rate;
 	return ws_send_cmd_r(1,d,"OKAY");
 }
 
@@ -215,6 +505,8 @@ int gui_http_disp_ws_establish(
 	if(state.disp_ws)return -1;
 	tlog_debug("new display stream web socket connection");
 	sem_init(&state.disp_wait,0,0);
+	state.disp_inflight=0,state.disp_window=0;
+	stream.reset=true;
 	state.disp_ws=d;
 	return 0;
 }
@@ -43,12 +43,13 @@ bool gui_http_init_img_ctx(){
 #ifdef ENABLE_STB
 static bool gen_jpeg_frame(void**buf,size_t*size,uint32_t*ft){
 	static uint32_t last=0;
+	static uint64_t seq=UINT64_MAX;
 	if(!state.buffer)return false;
 	if(!gui_http_init_img_ctx())return -1;
-	gui_http_ctx.last_pos=0;
+	gui_http_wait_frame(&seq,&last);
 	uint32_t cur=lv_tick_get();
-	uint32_t e=cur-last;
 	MUTEX_LOCK(gui_http_ctx.lock);
+	gui_http_ctx.last_pos=0;
 	int r=stbi_write_jpg_to_func(
 		gui_http_img_write,NULL,
 		state.ww,state.hh,
@@ -56,8 +57,6 @@ static bool gen_jpeg_frame(void**buf,size_t*size,uint32_t*ft){
 	);
 	MUTEX_UNLOCK(gui_http_ctx.lock);
 	if(ft)*ft=lv_tick_get()-cur;
-	if(e<1000/30)usleep(e*1000);
-	last=cur;
 	if(r==0){
 		tlog_warn("write jpeg failed: %d",r);
 		return false;
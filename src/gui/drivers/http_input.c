@@ -44,6 +44,7 @@ static bool parse_input_json(const json_object*jo){
 	else if(strcasecmp(type,"encoder")==0)
 		memcpy(&state.enc_data,&data,sizeof(data));
 	else return false;
+	gui_wakeup();
 	sem_wait(&state.input_wait);
 	return true;
 }
@@ -16,27 +16,61 @@
 #include<stdlib.h>
 #include<stdbool.h>
 #include<pthread.h>
+#include<dirent.h>
 #include<sys/epoll.h>
+#include<sys/inotify.h>
 #include<sys/ioctl.h>
 #include<linux/input.h>
 #define TAG "input"
 #include"str.h"
+#include"lock.h"
 #include"gui.h"
 #include"array.h"
+#include"confd.h"
 #include"logger.h"
 #include"gui/tools.h"
 #include"gui/guidrv.h"
+
+/*
+ * the input thread reads all queued events of a device at once and
+ * builds up a pending state, EV_SYN SYN_REPORT commits it as one report.
+ * changed reports are queued in a ring and lvgl reads all of them in
+ * one poll, so a press and release within one period are both seen,
+ * when the ring is full pointer moves just update the newest report.
+ * multi-touch protocol B is followed through slots, the pointer is the
+ * contact that touched first and moves to another one when it lifts.
+ * absolute positions are normalized with the EVIOCGABS ranges, rotated
+ * and calibrated by gui.input.<device name>.rotate (0/90/180/270, clockwise)
+ * and .matrix ("a b c d e f", x'=ax+by+c y'=dx+ey+f like libinput)
+ * devices appearing in /dev/input later are added from an inotify watch.
+ */
+#define IN_EVENTS 64
+#define IN_QUEUE 32
+#define IN_SLOTS 10
+struct in_report{
+	bool down;
+	int16_t x,y;
+	uint32_t key;
+};
+struct in_slot{
+	int32_t id,x,y;
+};
 struct in_data{
 	bool enabled,mouse;
 	int fd,type;
 	char path[64],name[256];
 	lv_indev_drv_t indrv;
 	lv_indev_t*indev;
-	bool down;
-	int16_t last_x,last_y;
-	uint32_t key;
-	char _pad[104];
-	uint32_t xmax,ymax;
+	mutex_t lock;
+	bool dropped,mt,has_mt,abs;
+	int slot,primary;
+	int32_t raw_x,raw_y;
+	struct input_absinfo xr,yr;
+	double cal[6];
+	struct in_slot slots[IN_SLOTS];
+	struct in_report pending,state;
+	struct in_report queue[IN_QUEUE];
+	size_t head,tail;
 };
 static bool mouse=false;
 static struct epoll_event*evs;
@@ -46,7 +80,7 @@ static size_t
 	is=sizeof(struct input_event),
 	ds=sizeof(struct in_data);
 static pthread_t inp=0;
-static int efd=-1;
+static int efd=-1,dev_wd=-1;
 static uint32_t keymap(uint16_t key){
 	if(lv_group_get_editing(gui_grp))switch(key){
 		case KEY_ENTER:
@@ -77,7 +111,122 @@ static uint32_t keymap(uint16_t key){
 		default:return key;
 	}
 }
+static bool same_report(struct in_report*a,struct in_report*b){
+	return a->down==b->down&&a->key==b->key&&a->x==b->x&&a->y==b->y;
+}
+static void queue_report(struct in_data*d,struct in_report*r){
+	size_t next=(d->head+1)%IN_QUEUE;
+	struct in_report*last=&d->queue[(d->head+IN_QUEUE-1)%IN_QUEUE];
+	if(same_report(d->head!=d->tail?last:&d->state,r))return;
+	if(next==d->tail){
+
+		// full, moves update the newest report, otherwise the oldest is dropped
+		if(last->down==r->down&&last->key==r->key){
+			*last=*r;
+			return;
+		}
+		d->tail=(d->tail+1)%IN_QUEUE;
+	}
+	d->queue[d->head]=*r;
+	d->head=next;
+}
+static void update_primary(struct in_data*d){
+	int i;
+	if(d->primary<0||d->slots[d->primary].id<0){
+		for(i=0;i<IN_SLOTS&&d->slots[i].id<0;i++);
+		d->primary=i<IN_SLOTS?i:-1;
+	}
+	if(d->primary<0)return;
+	d->raw_x=d->slots[d->primary].x;
+	d->raw_y=d->slots[d->primary].y;
+}
+static int16_t abs_to_screen(double v,lv_coord_t max){
+	return lv_coord_border((lv_coord_t)(v*max),max-1,0);
+}
+static void update_position(struct in_data*d){
+	double nx,ny,x,y;
+	nx=(double)(d->raw_x-d->xr.minimum)/(d->xr.maximum-d->xr.minimum);
+	ny=(double)(d->raw_y-d->yr.minimum)/(d->yr.maximum-d->yr.minimum);
+	x=d->cal[0]*nx+d->cal[1]*ny+d->cal[2];
+	y=d->cal[3]*nx+d->cal[4]*ny+d->cal[5];
+	d->pending.x=abs_to_screen(x,gui_w);
+	d->pending.y=abs_to_screen(y,gui_h);
+}
+static void commit_report(struct in_data*d){
+	if(d->mt)update_primary(d);
+	if(d->abs)update_position(d);
+	MUTEX_LOCK(d->lock);
+	queue_report(d,&d->pending);
+	MUTEX_UNLOCK(d->lock);
+}
+static void process_pointer(struct in_data*d,struct input_event*e){
+	struct in_slot*s=d->slot>=0&&d->slot<IN_SLOTS?&d->slots[d->slot]:NULL;
+	switch(e->type){
+		case EV_REL:switch(e->code){
+			case REL_X:
+				d->pending.x=lv_coord_border(d->pending.x+e->value,gui_w-1,0);
+				mouse=true;
+			break;
+			case REL_Y:
+				d->pending.y=lv_coord_border(d->pending.y+e->value,gui_h-1,0);
+				mouse=true;
+			break;
+		}break;
+		case EV_ABS:switch(e->code){
+			case ABS_X:if(!d->has_mt)d->raw_x=e->value,d->abs=mouse=true;break;
+			case ABS_Y:if(!d->has_mt)d->raw_y=e->value,d->abs=mouse=true;break;
+			case ABS_MT_SLOT:d->slot=e->value,d->mt=true;break;
+			case ABS_MT_TRACKING_ID:
+				d->mt=true,mouse=false;
+				if(s)s->id=e->value;
+			break;
+			case ABS_MT_POSITION_X:
+				mouse=false,d->abs=true;
+				if(d->mt&&s)s->x=e->value;
+				else d->raw_x=e->value;
+			break;
+			case ABS_MT_POSITION_Y:
+				mouse=false,d->abs=true;
+				if(d->mt&&s)s->y=e->value;
+				else d->raw_y=e->value;
+			break;
+		}break;
+		case EV_KEY:switch(e->code){
+			case BTN_TOUCH:mouse=false;//fallthrough
+			case BTN_LEFT:d->pending.down=e->value==1;break;
+		}break;
+	}
+}
+static void process_keypad(struct in_data*d,struct input_event*e){
+	if(e->type!=EV_KEY||e->value==2)return;
+	d->pending.down=e->value>0;
+	d->pending.key=keymap(e->code);
+
+	// every key transition is a report of its own
+	commit_report(d);
+}
+static void process_events(struct in_data*d,struct input_event*evs,size_t cnt){
+	for(size_t i=0;i<cnt;i++){
+		struct input_event*e=&evs[i];
+		if(e->type==EV_SYN)switch(e->code){
+			case SYN_DROPPED:d->dropped=true;continue;
+			case SYN_REPORT:
+				if(d->dropped)d->dropped=false;
+				else if(d->indrv.type==LV_INDEV_TYPE_POINTER)commit_report(d);
+			continue;
+			default:continue;
+		}
+		if(d->dropped)continue;
+		switch(d->indrv.type){
+			case LV_INDEV_TYPE_POINTER:process_pointer(d,e);break;
+			case LV_INDEV_TYPE_KEYPAD:process_keypad(d,e);break;
+			default:;
+		}
+	}
+}
 static void*input_handler(void*args __attribute__((unused))){
+	ssize_t c;
+	struct input_event events[IN_EVENTS];
 	for(;;){
 		int r=epoll_wait(efd,evs,64,-1);
 		if(r<0){
@@ -86,68 +235,41 @@ static void*input_handler(void*args __attribute__((unused))){
 			break;
 		}else for(int i=0;i<r;i++){
 			struct in_data*d=evs[i].data.ptr;
-			struct input_event event;
-			ssize_t c=read(d->fd,&event,is);
+			c=read(d->fd,events,sizeof(events));
 			if(c<=0){
+				if(c<0&&(errno==EINTR||errno==EAGAIN))continue;
 				telog_warn("read %s failed",d->path);
 				epoll_ctl(efd,EPOLL_CTL_DEL,d->fd,NULL);
 				close(d->fd);
 				d->enabled=false;
+				continue;
 			}
-			if(!gui_sleep)switch(d->indrv.type){
-				case LV_INDEV_TYPE_POINTER:switch(event.type){
-					case EV_REL:switch(event.code){
-						case REL_X:
-							d->last_x+=event.value;
-							if(d->last_x>=gui_w)d->last_x=gui_w-1;
-							if(d->last_x<0)d->last_x=0;
-							mouse=true;
-						break;
-						case REL_Y:
-							d->last_y+=event.value;
-							if(d->last_y>=gui_h)d->last_y=gui_h-1;
-							if(d->last_y<0)d->last_y=0;
-							mouse=true;
-						break;
-					}
-					break;
-					case EV_ABS:switch(event.code){
-						case ABS_X:d->last_x=gui_w*event.value/d->xmax,mouse=true;break;
-						case ABS_Y:d->last_y=gui_h*event.value/d->ymax,mouse=true;break;
-						case ABS_MT_POSITION_X:d->last_x=event.value,mouse=false;break;
-						case ABS_MT_POSITION_Y:d->last_y=event.value,mouse=false;break;
-					}break;
-					case EV_KEY:switch(event.code){
-						case BTN_TOUCH:mouse=false;//fallthrough
-						case BTN_LEFT:d->down=event.value==1;break;
-					}break;
-				}break;
-				case LV_INDEV_TYPE_KEYPAD:switch(event.type){
-					case EV_KEY:
-						d->down=event.value>0?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
-						d->key=keymap(event.code);
-					break;
-					case EV_SW:;break;
-				}break;
-				default:;
-			}
+			if(!gui_sleep)process_events(d,events,c/is);
 			gui_quit_sleep();
 		}
+		gui_wakeup();
 	}
 	return NULL;
 }
 static void input_read(lv_indev_drv_t*indev_drv,lv_indev_data_t*data){
 	struct in_data*d=indev_drv->user_data;
 	if(!d->enabled||indev_drv->user_data!=d)return;
+	MUTEX_LOCK(d->lock);
+	if(d->head!=d->tail){
+		d->state=d->queue[d->tail];
+		d->tail=(d->tail+1)%IN_QUEUE;
+	}
+	data->continue_reading=d->head!=d->tail;
+	MUTEX_UNLOCK(d->lock);
 	switch(indev_drv->type){
 		case LV_INDEV_TYPE_POINTER:
-			data->point.x=lv_coord_border(d->last_x,gui_w-1,0);
-			data->point.y=lv_coord_border(d->last_y,gui_h-1,0);
-			data->state=d->down?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
+			data->point.x=lv_coord_border(d->state.x,gui_w-1,0);
+			data->point.y=lv_coord_border(d->state.y,gui_h-1,0);
+			data->state=d->state.down?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
 		break;
 		case LV_INDEV_TYPE_KEYPAD:
-			data->key=d->key;
-			data->state=d->down?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
+			data->key=d->state.key;
+			data->state=d->state.down?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
 		break;
 		default:;
 	}
@@ -187,12 +309,59 @@ static struct in_data*get_unused_in_data(){
 			indatas[x]=d=malloc(ds);
 			if(!d)telog_error("malloc failed");
 		}else if(d->enabled)continue;
+		else if(d->indev)lv_indev_delete(d->indev);
 		memset(d,0,ds);
 		return d;
 	}
 	telog_warn("too many input device open");
 	return NULL;
 }
+static void load_ranges(struct in_data*d,int fd){
+	struct input_absinfo info;
+	memset(&info,0,sizeof(info));
+	if(ioctl(fd,EVIOCGABS(ABS_MT_POSITION_X),&info)>=0&&info.maximum>info.minimum){
+		d->has_mt=true,d->xr=info;
+		memset(&info,0,sizeof(info));
+		if(ioctl(fd,EVIOCGABS(ABS_MT_POSITION_Y),&info)>=0&&info.maximum>info.minimum)
+			d->yr=info;
+		return;
+	}
+	memset(&info,0,sizeof(info));
+	if(ioctl(fd,EVIOCGABS(ABS_X),&info)>=0&&info.maximum>info.minimum)
+		d->xr=info;
+	memset(&info,0,sizeof(info));
+	if(ioctl(fd,EVIOCGABS(ABS_Y),&info)>=0&&info.maximum>info.minimum)
+		d->yr=info;
+}
+static void load_calibration(struct in_data*d){
+	char item[256],*str;
+	double m[6]={1,0,0,0,1,0},r[6];
+	strlcpy(item,d->name,sizeof(item));
+	strrep(item,'.','_');
+	switch(confd_get_integer_dict("gui.input",item,"rotate",0)){
+		case 90:memcpy(r,(double[]){0,-1,1,1,0,0},sizeof(r));break;
+		case 180:memcpy(r,(double[]){-1,0,1,0,-1,1},sizeof(r));break;
+		case 270:memcpy(r,(double[]){0,1,0,-1,0,1},sizeof(r));break;
+		default:memcpy(r,(double[]){1,0,0,0,1,0},sizeof(r));break;
+	}
+	if((str=confd_get_string_dict("gui.input",item,"matrix",NULL))){
+		if(sscanf(str,"%lf %lf %lf %lf %lf %lf",
+			&m[0],&m[1],&m[2],&m[3],&m[4],&m[5]
+		)!=6){
+			tlog_warn("invalid calibration matrix for %s: %s",d->name,str);
+			memcpy(m,(double[]){1,0,0,0,1,0},sizeof(m));
+		}
+		free(str);
+	}
+
+	// rotate first, then the calibration matrix
+	d->cal[0]=m[0]*r[0]+m[1]*r[3];
+	d->cal[1]=m[0]*r[1]+m[1]*r[4];
+	d->cal[2]=m[0]*r[2]+m[1]*r[5]+m[2];
+	d->cal[3]=m[3]*r[0]+m[4]*r[3];
+	d->cal[4]=m[3]*r[1]+m[4]*r[4];
+	d->cal[5]=m[3]*r[2]+m[4]*r[5]+m[5];
+}
 static int input_init(char*dev,int fd){
 	if(fd<0||!dev)return -1;
 	bool support=false,abs=false;
@@ -220,16 +389,12 @@ static int input_init(char*dev,int fd){
 		break;
 	}
 	if(!support)return -1;
-	d->xmax=65536,d->ymax=65536;
-	if(abs){
-		struct input_absinfo info;
-		memset(&info,0,sizeof(info));
-		if(ioctl(fd,EVIOCGABS(ABS_X),&info)>=0&&info.maximum>0)
-			d->xmax=info.maximum;
-		memset(&info,0,sizeof(info));
-		if(ioctl(fd,EVIOCGABS(ABS_Y),&info)>=0&&info.maximum>0)
-			d->ymax=info.maximum;
-	}
+	MUTEX_INIT(d->lock);
+	d->primary=-1;
+	for(int j=0;j<IN_SLOTS;j++)d->slots[j].id=-1;
+	d->xr.maximum=gui_w,d->yr.maximum=gui_h;
+	if(abs)load_ranges(d,fd);
+	load_calibration(d);
 	tlog_debug("found input device %s (%s)",dev,d->name);
 	d->indrv.read_cb=input_read;
 	d->indrv.user_data=d;
@@ -246,12 +411,88 @@ static int input_init(char*dev,int fd){
 	else pthread_setname_np(inp,"Input Device Thread");
 	return 0;
 }
+static void input_add(const char*name){
+	int fd;
+	char path[64];
+	struct in_data*d;
+	snprintf(path,sizeof(path),_PATH_DEV"/input/%s",name);
+	for(size_t x=0;x<ARRLEN(indatas);x++)
+		if((d=indatas[x])&&d->enabled&&strcmp(d->path,path)==0)return;
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))<0){
+		telog_warn("failed to open %s",path);
+		return;
+	}
+	if(input_init(path,fd)<0)close(fd);
+	else tlog_info("input device %s added",path);
+}
+static void input_scan_dir(void){
+	DIR*dir;
+	struct dirent*e;
+	if(!(dir=opendir(_PATH_DEV"/input")))return;
+	while((e=readdir(dir)))
+		if(strncmp(e->d_name,"event",5)==0)
+			input_add(e->d_name);
+	closedir(dir);
+}
+static void input_hotplug(int fd,void*data __attribute__((unused))){
+	ssize_t len;
+	struct in_data*d;
+	struct inotify_event*e;
+	char buf[4096]__attribute__((aligned(__alignof__(struct inotify_event))));
+	while((len=read(fd,buf,sizeof(buf)))>0)for(
+		char*p=buf;p<buf+len;
+		p+=sizeof(struct inotify_event)+e->len
+	){
+		e=(struct inotify_event*)p;
+		if(!e->len)continue;
+
+		// /dev/input did not exist when the watch started
+		if(e->wd==dev_wd){
+			if(strcmp(e->name,"input")!=0)continue;
+			inotify_rm_watch(fd,dev_wd);
+			dev_wd=-1;
+			if(inotify_add_watch(fd,_PATH_DEV"/input",IN_CREATE|IN_DELETE)<0)
+				telog_warn("watch "_PATH_DEV"/input failed");
+			input_scan_dir();
+			continue;
+		}
+		if(strncmp(e->name,"event",5)!=0)continue;
+		if(e->mask&IN_CREATE)input_add(e->name);
+
+		// the input thread disables devices when read fails
+		if(e->mask&IN_DELETE)for(size_t x=0;x<ARRLEN(indatas);x++){
+			if(!(d=indatas[x])||d->enabled||!d->indev)continue;
+			lv_indev_delete(d->indev);
+			d->indev=NULL;
+		}
+	}
+}
+static bool input_watch(void){
+	int fd;
+	if((fd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC))<0){
+		telog_warn("inotify init failed");
+		return false;
+	}
+	if(inotify_add_watch(fd,_PATH_DEV"/input",IN_CREATE|IN_DELETE)<0){
+		if(errno!=ENOENT||(dev_wd=inotify_add_watch(fd,_PATH_DEV,IN_CREATE))<0){
+			telog_warn("watch "_PATH_DEV"/input failed");
+			close(fd);
+			return false;
+		}
+	}
+	if(gui_watch_fd(fd,input_hotplug,NULL)<0){
+		close(fd);
+		return false;
+	}
+	return true;
+}
 static int input_scan_init(void){
 	tlog_info("probing input devices");
-	bool found=false;
+	bool found=false,watch;
 	char path[32]={0};
 	int fd;
 	memset(indatas,0,sizeof(indatas));
+	watch=input_watch();
 	for(int i=0;i<32;i++){
 		memset(path,0,32);
 		snprintf(path,31,_PATH_DEV"/input/event%d",i);
@@ -262,8 +503,11 @@ static int input_scan_init(void){
 		if(input_init(path,fd)<0)close(fd);
 		else found=true;
 	}
-	if(!found)tlog_error("no input devices found");
-	return found?0:-1;
+	if(!found)tlog_warn(watch?
+		"no input devices found, waiting for hotplug":
+		"no input devices found"
+	);
+	return found||watch?0:-1;
 }
 void input_register(char*dev){input_init(dev,open(dev,O_RDONLY|O_CLOEXEC));}
 void input_scan_register(void){input_scan_init();}
@@ -272,6 +516,7 @@ struct input_driver indrv_event={
 	.compatible={
 		"drm",
 		"fbdev",
+		"kmsdrm",
 		NULL
 	},
 	.drv_register=input_scan_init,
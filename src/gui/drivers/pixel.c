@@ -0,0 +1,289 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_GUI
+#include<stdlib.h>
+#include<string.h>
+#include"gui/guidrv.h"
+
+/*
+ * pixel kernels shared by the framebuffer style drivers.
+ * sources are always lvgl 32bpp pixels (bgra in memory), every kernel
+ * has a plain loop and sse2 or neon paths when the compiler offers them.
+ * firmware builds keep to general registers, they use the plain loops.
+ */
+#ifndef ENABLE_UEFI
+#if defined(__SSE2__)
+#define PIXEL_SSE2
+#include<emmintrin.h>
+#elif defined(__ARM_NEON)
+#define PIXEL_NEON
+#include<arm_neon.h>
+#endif
+#endif
+#if defined(PIXEL_SSE2)||defined(PIXEL_NEON)
+#define PIXEL_SIMD
+#endif
+
+// lvgl 32bpp brightness, same weights as lv_color_brightness
+#define LUMA(r,g,b) ((r)*77+(g)*151+(b)*28)
+#define LUMA_MIN    (128<<8)
+
+static lv_color_t*rot_buf=NULL;
+static size_t rot_size=0;
+
+static inline uint32_t swap_rb(uint32_t x){
+	return (x&0xFF00FF00)|((x>>16)&0xFF)|((x&0xFF)<<16);
+}
+
+void pixel_swap_rb(uint32_t*dst,const uint32_t*src,size_t cnt){
+	size_t i=0;
+	#if defined(PIXEL_SSE2)
+	const __m128i ag=_mm_set1_epi32(0xFF00FF00),c=_mm_set1_epi32(0xFF);
+	for(;i+4<=cnt;i+=4){
+		__m128i v=_mm_loadu_si128((const __m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i),_mm_or_si128(
+			_mm_and_si128(v,ag),_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(v,16),c),
+				_mm_slli_epi32(_mm_and_si128(v,c),16)
+			)
+		));
+	}
+	#elif defined(PIXEL_NEON)
+	for(;i+16<=cnt;i+=16){
+		uint8x16x4_t v=vld4q_u8((const uint8_t*)(src+i));
+		uint8x16_t t=v.val[0];
+		v.val[0]=v.val[2],v.val[2]=t;
+		vst4q_u8((uint8_t*)(dst+i),v);
+	}
+	#endif
+	for(;i<cnt;i++)dst[i]=swap_rb(src[i]);
+}
+
+void pixel_pack_565(uint16_t*dst,const uint32_t*src,size_t cnt){
+	size_t i=0;
+	#if defined(PIXEL_SSE2)
+	const __m128i mr=_mm_set1_epi32(0xF800);
+	const __m128i mg=_mm_set1_epi32(0x07E0);
+	const __m128i mb=_mm_set1_epi32(0x001F);
+	for(;i+8<=cnt;i+=8){
+		__m128i p[2];
+		for(int j=0;j<2;j++){
+			__m128i v=_mm_loadu_si128((const __m128i*)(src+i+j*4));
+			v=_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(v,8),mr),_mm_or_si128(
+					_mm_and_si128(_mm_srli_epi32(v,5),mg),
+					_mm_and_si128(_mm_srli_epi32(v,3),mb)
+				)
+			);
+
+			// sign extend so the saturating pack keeps all 16 bits
+			p[j]=_mm_srai_epi32(_mm_slli_epi32(v,16),16);
+		}
+		_mm_storeu_si128((__m128i*)(dst+i),_mm_packs_epi32(p[0],p[1]));
+	}
+	#elif defined(PIXEL_NEON)
+	for(;i+8<=cnt;i+=8){
+		uint8x8x4_t v=vld4_u8((const uint8_t*)(src+i));
+		uint16x8_t o=vshll_n_u8(v.val[2],8);
+		o=vsriq_n_u16(o,vshll_n_u8(v.val[1],8),5);
+		o=vsriq_n_u16(o,vshll_n_u8(v.val[0],8),11);
+		vst1q_u16(dst+i,o);
+	}
+	#endif
+	for(;i<cnt;i++)dst[i]=
+		((src[i]>>8)&0xF800)|
+		((src[i]>>5)&0x07E0)|
+		((src[i]>>3)&0x001F);
+}
+
+void pixel_pack_24(uint8_t*dst,const uint32_t*src,size_t cnt,bool swap){
+	size_t i=0;
+	int r=swap?0:2,b=swap?2:0;
+	#if defined(PIXEL_NEON)
+	for(;i+16<=cnt;i+=16){
+		uint8x16x4_t v=vld4q_u8((const uint8_t*)(src+i));
+		uint8x16x3_t o;
+		o.val[r]=v.val[2],o.val[1]=v.val[1],o.val[b]=v.val[0];
+		vst3q_u8(dst+i*3,o);
+	}
+	#endif
+	for(;i<cnt;i++,dst+=3){
+		dst[r]=src[i]>>16;
+		dst[1]=src[i]>>8;
+		dst[b]=src[i];
+	}
+}
+
+static inline void mono_set(uint8_t*dst,size_t bit,uint32_t px){
+	if(LUMA((px>>16)&0xFF,(px>>8)&0xFF,px&0xFF)>=LUMA_MIN)*dst|=1<<bit;
+	else *dst&=~(1<<bit);
+}
+
+// returns eight pixels as one byte, least significant bit first
+static inline uint8_t mono_byte(const uint32_t*src){
+	#if defined(PIXEL_SSE2)
+	const __m128i m=_mm_set1_epi32(0x00FF00FF);
+	const __m128i wbr=_mm_set1_epi32((77<<16)|28);
+	const __m128i wg=_mm_set1_epi32(151);
+	const __m128i min=_mm_set1_epi32(LUMA_MIN-1);
+	__m128i l[2];
+	for(int j=0;j<2;j++){
+		__m128i v=_mm_loadu_si128((const __m128i*)(src+j*4));
+		l[j]=_mm_cmpgt_epi32(_mm_add_epi32(
+			_mm_madd_epi16(_mm_and_si128(v,m),wbr),
+			_mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(v,8),m),wg)
+		),min);
+	}
+	return _mm_movemask_epi8(_mm_packs_epi16(
+		_mm_packs_epi32(l[0],l[1]),
+		_mm_setzero_si128()
+	))&0xFF;
+	#elif defined(PIXEL_NEON)
+	static const uint8_t bits[8]={1,2,4,8,16,32,64,128};
+	uint8x8x4_t v=vld4_u8((const uint8_t*)src);
+	uint16x8_t l=vmull_u8(v.val[2],vdup_n_u8(77));
+	l=vmlal_u8(l,v.val[1],vdup_n_u8(151));
+	l=vmlal_u8(l,v.val[0],vdup_n_u8(28));
+	uint8x8_t s=vand_u8(vmovn_u16(vcgeq_u16(l,vdupq_n_u16(LUMA_MIN))),vld1_u8(bits));
+	s=vpadd_u8(s,s),s=vpadd_u8(s,s),s=vpadd_u8(s,s);
+	return vget_lane_u8(s,0);
+	#else
+	uint8_t r=0;
+	for(int j=0;j<8;j++)mono_set(&r,j,src[j]);
+	return r;
+	#endif
+}
+
+void pixel_pack_mono(uint8_t*dst,size_t bit,const uint32_t*src,size_t cnt){
+	size_t i=0;
+	dst+=bit/8,bit%=8;
+
+	// only the partial bytes at both ends need a read back
+	for(;i<cnt&&bit!=0;i++){
+		mono_set(dst,bit,src[i]);
+		if(++bit>=8)dst++,bit=0;
+	}
+	for(;i+8<=cnt;i+=8)*dst++=mono_byte(src+i);
+	for(;i<cnt;i++,bit++)mono_set(dst,bit,src[i]);
+}
+
+/*
+ * rotation transposes 4x4 tiles in registers, w and h are the source
+ * size, the destination is packed too. lvgl maps a logical pixel to
+ * (y,H-1-x) for 90 and to (W-1-y,x) for 270 degrees.
+ */
+#if defined(PIXEL_SSE2)
+typedef __m128i pixel_vec;
+#define VLOAD(p)     _mm_loadu_si128((const __m128i*)(p))
+#define VSTORE(p,v)  _mm_storeu_si128((__m128i*)(p),(v))
+#define VREV(v)      _mm_shuffle_epi32((v),0x1B)
+static inline void transpose4(pixel_vec*v){
+	__m128i a=_mm_unpacklo_epi32(v[0],v[1]),b=_mm_unpacklo_epi32(v[2],v[3]);
+	__m128i c=_mm_unpackhi_epi32(v[0],v[1]),d=_mm_unpackhi_epi32(v[2],v[3]);
+	v[0]=_mm_unpacklo_epi64(a,b),v[1]=_mm_unpackhi_epi64(a,b);
+	v[2]=_mm_unpacklo_epi64(c,d),v[3]=_mm_unpackhi_epi64(c,d);
+}
+#elif defined(PIXEL_NEON)
+typedef uint32x4_t pixel_vec;
+#define VLOAD(p)     vld1q_u32(p)
+#define VSTORE(p,v)  vst1q_u32((p),(v))
+#define VREV(v)      ({uint32x4_t _r=vrev64q_u32(v);vcombine_u32(vget_high_u32(_r),vget_low_u32(_r));})
+static inline void transpose4(pixel_vec*v){
+	uint32x4x2_t a=vtrnq_u32(v[0],v[1]),b=vtrnq_u32(v[2],v[3]);
+	v[0]=vcombine_u32(vget_low_u32(a.val[0]),vget_low_u32(b.val[0]));
+	v[1]=vcombine_u32(vget_low_u32(a.val[1]),vget_low_u32(b.val[1]));
+	v[2]=vcombine_u32(vget_high_u32(a.val[0]),vget_high_u32(b.val[0]));
+	v[3]=vcombine_u32(vget_high_u32(a.val[1]),vget_high_u32(b.val[1]));
+}
+#endif
+
+static void rotate_180(uint32_t*dst,const uint32_t*src,size_t n){
+	size_t i=0;
+	#ifdef PIXEL_SIMD
+	for(;i+4<=n;i+=4)VSTORE(dst+n-4-i,VREV(VLOAD(src+i)));
+	#endif
+	for(;i<n;i++)dst[n-1-i]=src[i];
+}
+
+static void rotate_90(uint32_t*dst,const uint32_t*src,size_t w,size_t h,bool r270){
+	size_t x=0,y=0;
+	#ifdef PIXEL_SIMD
+	pixel_vec v[4];
+	for(y=0;y+4<=h;y+=4)for(x=0;x+4<=w;x+=4){
+		for(int j=0;j<4;j++)v[j]=VLOAD(src+(y+j)*w+x);
+		transpose4(v);
+		for(int j=0;j<4;j++){
+			if(r270)VSTORE(dst+(x+j)*h+h-4-y,VREV(v[j]));
+			else VSTORE(dst+(w-1-x-j)*h+y,v[j]);
+		}
+	}
+	#endif
+
+	// right strip of the tiled rows, then the rows below them
+	for(size_t ty=0;ty<y;ty++)for(size_t tx=x;tx<w;tx++){
+		if(r270)dst[tx*h+h-1-ty]=src[ty*w+tx];
+		else dst[(w-1-tx)*h+ty]=src[ty*w+tx];
+	}
+	for(;y<h;y++)for(x=0;x<w;x++){
+		if(r270)dst[x*h+h-1-y]=src[y*w+x];
+		else dst[(w-1-x)*h+y]=src[y*w+x];
+	}
+}
+
+void pixel_rotate(uint32_t*dst,const uint32_t*src,size_t w,size_t h,lv_disp_rot_t rot){
+	switch(rot){
+		case LV_DISP_ROT_90:rotate_90(dst,src,w,h,false);break;
+		case LV_DISP_ROT_180:rotate_180(dst,src,w*h);break;
+		case LV_DISP_ROT_270:rotate_90(dst,src,w,h,true);break;
+		default:memcpy(dst,src,w*h*sizeof(uint32_t));
+	}
+}
+
+void pixel_rotate_area(lv_area_t*out,const lv_area_t*in,lv_coord_t w,lv_coord_t h,lv_disp_rot_t rot){
+	lv_area_t a;
+	switch(rot){
+		case LV_DISP_ROT_90:
+			a.x1=in->y1,a.x2=in->y2;
+			a.y1=h-1-in->x2,a.y2=h-1-in->x1;
+		break;
+		case LV_DISP_ROT_180:
+			a.x1=w-1-in->x2,a.x2=w-1-in->x1;
+			a.y1=h-1-in->y2,a.y2=h-1-in->y1;
+		break;
+		case LV_DISP_ROT_270:
+			a.x1=w-1-in->y2,a.x2=w-1-in->y1;
+			a.y1=in->x1,a.y2=in->x2;
+		break;
+		default:lv_area_copy(&a,in);
+	}
+	lv_area_copy(out,&a);
+}
+
+const uint32_t*pixel_flush_rotate(lv_disp_drv_t*drv,lv_area_t*area,const lv_color_t*color_p){
+	lv_color_t*b;
+	size_t w=lv_area_get_width(area),h=lv_area_get_height(area);
+	if(drv->rotated==LV_DISP_ROT_NONE)return (const uint32_t*)color_p;
+	if(w*h>rot_size){
+		if(!(b=realloc(rot_buf,w*h*sizeof(lv_color_t))))return NULL;
+		rot_buf=b,rot_size=w*h;
+	}
+	pixel_rotate((uint32_t*)rot_buf,(const uint32_t*)color_p,w,h,drv->rotated);
+	pixel_rotate_area(area,area,drv->hor_res,drv->ver_res,drv->rotated);
+	return (const uint32_t*)rot_buf;
+}
+
+lv_disp_rot_t pixel_get_rotation(uint16_t angle){
+	switch(angle){
+		case 90:return LV_DISP_ROT_90;
+		case 180:return LV_DISP_ROT_180;
+		case 270:return LV_DISP_ROT_270;
+		default:return LV_DISP_ROT_NONE;
+	}
+}
+#endif
@@ -23,7 +23,7 @@ typedef struct{
 static uint32_t ww=540,hh=960;
 static monitor_t monitor;
 static volatile bool sdl_inited=false,sdl_quit_qry=false;
-static bool accelerated;
+static bool accelerated,kmsdrm;
 static bool left_button_down=false;
 static int16_t last_x=0,last_y=0,enc_diff=0;
 static uint32_t last_key;
@@ -184,24 +184,49 @@ static void sdl_apply_mode(){
 	done:
 	if(name)free(name);
 }
-static int monitor_init(){
-	if(!getenv("DISPLAY")&&!getenv("WAYLAND_DISPLAY"))return -1;
+
+/*
+ * kmsdrm runs the same window on the console, sdl brings up egl on a
+ * gbm surface and its gles2 renderer, presenting flips the gbm buffer
+ * onto the crtc, nothing is copied by the cpu. lvgl draws with its
+ * sdl unit, decoded images, glyphs and rounded rect masks stay cached
+ * as textures, blending and transforms run in the renderer.
+ */
+static int kmsdrm_setup(){
+	SDL_DisplayMode dm;
+	if(SDL_GetDesktopDisplayMode(0,&dm)!=0)
+		return trlog_warn(-1,"get display mode failed: %s",SDL_GetError());
+	ww=dm.w,hh=dm.h;
+	tlog_info("kmsdrm display %ux%u@%dHz",ww,hh,dm.refresh_rate);
+	SDL_ShowCursor(SDL_DISABLE);
+	SDL_SetHint(SDL_HINT_RENDER_DRIVER,"opengles2");
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC,"1");
+	return 0;
+}
+static int monitor_setup(){
+	int r;
 	memset(&monitor,0,sizeof(monitor));
-	sdl_apply_mode();
-	SDL_Init(SDL_INIT_VIDEO);
+	if(kmsdrm)setenv("SDL_VIDEODRIVER","kmsdrm",1);
+	else sdl_apply_mode();
+	r=SDL_Init(SDL_INIT_VIDEO);
+	if(kmsdrm)unsetenv("SDL_VIDEODRIVER");
+	if(r!=0)return trlog_warn(-1,"init sdl video failed: %s",SDL_GetError());
+	if(kmsdrm&&kmsdrm_setup()!=0)return -1;
 	SDL_SetEventFilter(quit_filter,NULL);
-	accelerated=confd_get_boolean("gui.sdl2.accelerated",false);
-	monitor.window=SDL_CreateWindow(
+	accelerated=kmsdrm||confd_get_boolean("gui.sdl2.accelerated",false);
+	if(!(monitor.window=SDL_CreateWindow(
 		PRODUCT,
 		SDL_WINDOWPOS_UNDEFINED,
 		SDL_WINDOWPOS_UNDEFINED,
-		ww,hh,SDL_WINDOW_HIDDEN
-	);
-	monitor.renderer=SDL_CreateRenderer(
+		ww,hh,kmsdrm?
+		SDL_WINDOW_FULLSCREEN|SDL_WINDOW_OPENGL:
+		SDL_WINDOW_HIDDEN
+	)))return trlog_warn(-1,"create window failed: %s",SDL_GetError());
+	if(!(monitor.renderer=SDL_CreateRenderer(
 		monitor.window,-1,accelerated?
-		SDL_RENDERER_ACCELERATED:
+		SDL_RENDERER_ACCELERATED|SDL_RENDERER_TARGETTEXTURE:
 		SDL_RENDERER_SOFTWARE
-	);
+	)))return trlog_warn(-1,"create renderer failed: %s",SDL_GetError());
 	if(accelerated){
 		monitor.texture=lv_draw_sdl_create_screen_texture(
 			monitor.renderer,ww,hh
@@ -253,8 +278,8 @@ static int monitor_init(){
 		disp_drv.draw_ctx_deinit=lv_draw_sdl_deinit_ctx;
 		disp_drv.draw_ctx_size=sizeof(lv_draw_sdl_ctx_t);
 	}else{
-		disp_drv.draw_ctx_init=lv_draw_sw_init_ctx;
-		disp_drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+		disp_drv.draw_ctx_init=gui_draw_init_ctx;
+		disp_drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 		disp_drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
 	}
 	switch(gui_rotate){
@@ -270,6 +295,22 @@ static int monitor_init(){
 
 	return 0;
 }
+static int monitor_start(){
+	if(monitor_setup()==0)return 0;
+	sdl2_exit();
+	memset(&monitor,0,sizeof(monitor));
+	return -1;
+}
+static int monitor_init(){
+	if(!getenv("DISPLAY")&&!getenv("WAYLAND_DISPLAY"))return -1;
+	kmsdrm=false;
+	return monitor_start();
+}
+static int kmsdrm_init(){
+	if(!confd_get_boolean("gui.sdl2.kmsdrm",false))return -1;
+	kmsdrm=true;
+	return monitor_start();
+}
 
 static int kbd_init(){
 	// Keyboard input device
@@ -311,7 +352,10 @@ static void sdl2_get_sizes(lv_coord_t*width,lv_coord_t*height){
 	if(height)*height=h;
 }
 static void sdl2_get_dpi(int*dpi){
-	if(dpi)*dpi=200;
+	float d=0;
+	if(!dpi)return;
+	*dpi=200;
+	if(kmsdrm&&SDL_GetDisplayDPI(0,&d,NULL,NULL)==0&&d>0)*dpi=d;
 }
 static bool sdl2_can_sleep(){
 	return false;
@@ -335,6 +379,14 @@ static void sdl2_set_brightness(int value){
 	telog_debug("set virtual backlight to %d%%",value);
 }
 #endif
+struct gui_driver guidrv_sdl2_kmsdrm={
+	.name="kmsdrm",
+	.drv_register=kmsdrm_init,
+	.drv_getsize=sdl2_get_sizes,
+	.drv_getdpi=sdl2_get_dpi,
+	.drv_cansleep=sdl2_can_sleep,
+	.drv_exit=sdl2_exit,
+};
 struct input_driver indrv_sdl2_kbd={
 	.name="sdl2-keyboard",
 	.compatible={
@@ -86,12 +86,14 @@ static int stdin_init(){
 	indrv.type=LV_INDEV_TYPE_KEYPAD;
 	indev=lv_indev_drv_register(&indrv);
 	lv_indev_set_group(indev,gui_grp);
+	gui_watch_fd(STDIN_FILENO,NULL,NULL);
 	initialized=true;
 	return 0;
 }
 
 static void stdin_exit(){
 	if(!initialized)return;
+	gui_unwatch_fd(STDIN_FILENO);
 	tcsetattr(STDIN_FILENO,TCSANOW,&oldtios);
 }
 
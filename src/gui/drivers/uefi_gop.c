@@ -30,14 +30,17 @@ static int ww=-1,hh=-1;
 static EFI_GRAPHICS_OUTPUT_PROTOCOL*gop;
 
 static void uefigop_flush(lv_disp_drv_t*disp_drv,const lv_area_t*area,lv_color_t*color_p){
-	gop->Blt(
+	lv_area_t a;
+	const uint32_t*px;
+	lv_area_copy(&a,area);
+	if((px=pixel_flush_rotate(disp_drv,&a,color_p)))gop->Blt(
 		gop,
-		(EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)color_p,
+		(EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)px,
 		EfiBltBufferToVideo,
 		0,0,
-		area->x1,area->y1,
-		area->x2-area->x1+1,
-		area->y2-area->y1+1,
+		a.x1,a.y1,
+		a.x2-a.x1+1,
+		a.y2-a.y1+1,
 		0
 	);
 	lv_disp_flush_ready(disp_drv);
@@ -142,15 +145,10 @@ static int uefigop_register(){
 	disp_drv.flush_cb=uefigop_flush;
 	disp_drv.hor_res=ww;
 	disp_drv.ver_res=hh;
-	disp_drv.draw_ctx_init=lv_draw_sw_init_ctx;
-	disp_drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+	disp_drv.draw_ctx_init=gui_draw_init_ctx;
+	disp_drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 	disp_drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
-	switch(gui_rotate){
-		case 0:break;
-		case 90:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_90;break;
-		case 180:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_180;break;
-		case 270:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_270;break;
-	}
+	disp_drv.rotated=pixel_get_rotation(gui_rotate);
 	lv_disp_drv_register(&disp_drv);
 	logger_set_console(false);
 	return 0;
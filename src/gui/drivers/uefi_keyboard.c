@@ -35,10 +35,26 @@ static lv_indev_drv_t drv;
 static lv_indev_t*dev;
 struct keyboard_data{
 	EFI_SIMPLE_TEXT_INPUT_PROTOCOL*kbd;
+	EFI_SIMPLE_TEXT_INPUT_EX_PROTOCOL*kbdx;
 	void*pd;
 };
+
+// extended keyboards also tell shift state, partial keys carry no key
+static bool read_key(struct keyboard_data*kd,EFI_INPUT_KEY*p,bool*shift){
+	EFI_KEY_DATA kx;
+	*shift=false;
+	if(!kd->kbdx)return !EFI_ERROR(kd->kbd->ReadKeyStroke(kd->kbd,p));
+	if(EFI_ERROR(kd->kbdx->ReadKeyStrokeEx(kd->kbdx,&kx)))return false;
+	*p=kx.Key;
+	if(kx.KeyState.KeyShiftState&EFI_SHIFT_STATE_VALID)*shift=(kx.KeyState.KeyShiftState&(
+		EFI_LEFT_SHIFT_PRESSED|EFI_RIGHT_SHIFT_PRESSED
+	))!=0;
+	return true;
+}
+
 static void keyboard_read(lv_indev_drv_t*indev_drv,lv_indev_data_t*data){
 	list*l,*n;
+	bool shift;
 	EFI_INPUT_KEY p;
 	data->state=LV_INDEV_STATE_REL;
 	if(indev_drv!=&drv||!dev||dev->driver!=indev_drv)return;
@@ -49,13 +65,15 @@ static void keyboard_read(lv_indev_drv_t*indev_drv,lv_indev_data_t*data){
 	}else do{
 		n=l->next;
 		LIST_DATA_DECLARE(kd,l,struct keyboard_data*);
-		if(!kd->pd)kd->pd=kd->kbd->ReadKeyStroke;
-		else if(kd->kbd->ReadKeyStroke!=kd->pd){
+
+		// only keyboards with a pending key, idle ones cost no read
+		if(gBS->CheckEvent(kd->kbdx?kd->kbdx->WaitForKeyEx:kd->kbd->WaitForKey)!=EFI_SUCCESS)continue;
+		if((kd->kbdx?(void*)kd->kbdx->ReadKeyStrokeEx:(void*)kd->kbd->ReadKeyStroke)!=kd->pd){
 			tlog_warn("ReadKeyStroke changed, disable keyboard device");
 			list_obj_del(&kbds,l,list_default_free);
 			continue;
 		}
-		if(EFI_ERROR(kd->kbd->ReadKeyStroke(kd->kbd,&p)))continue;
+		if(!read_key(kd,&p,&shift))continue;
 		data->state=0;
 		if(p.ScanCode!=0){
 			if(lv_group_get_editing(gui_grp))switch(p.ScanCode){
@@ -95,6 +113,7 @@ static void keyboard_read(lv_indev_drv_t*indev_drv,lv_indev_data_t*data){
 			}
 		}else if(p.UnicodeChar!=0)switch(p.UnicodeChar){
 			case ' ':case '\n':case '\r':data->key=LV_KEY_ENTER;break;
+			case '\t':data->key=shift?LV_KEY_PREV:LV_KEY_NEXT;break;
 			default:data->key=p.UnicodeChar;
 		}else continue;
 		data->state=LV_INDEV_STATE_PR;
@@ -107,25 +126,41 @@ static bool proto_cmp(list*f,void*data){
 	LIST_DATA_DECLARE(d,f,struct keyboard_data*);
 	return d->kbd==(EFI_SIMPLE_TEXT_INPUT_PROTOCOL*)data;
 }
-static int _keyboard_register(EFI_SIMPLE_TEXT_INPUT_PROTOCOL*k){
+static int _keyboard_register(EFI_HANDLE hand,EFI_SIMPLE_TEXT_INPUT_PROTOCOL*k){
 	struct keyboard_data*kbd=NULL;
 	if(list_search_one(kbds,proto_cmp,k))return 0;
 	if(!(kbd=malloc(sizeof(struct keyboard_data))))return -1;
 	memset(kbd,0,sizeof(struct keyboard_data));
 	kbd->kbd=k;
-	tlog_debug("found new uefi keyboard %p",kbd->kbd);
+
+	// the extended protocol on the same handle reads the same keys
+	if(hand&&EFI_ERROR(gBS->HandleProtocol(
+		hand,&gEfiSimpleTextInputExProtocolGuid,
+		(VOID**)&kbd->kbdx
+	)))kbd->kbdx=NULL;
+	kbd->pd=kbd->kbdx?(void*)kbd->kbdx->ReadKeyStrokeEx:(void*)k->ReadKeyStroke;
+	gui_watch_event(kbd->kbdx?kbd->kbdx->WaitForKeyEx:k->WaitForKey);
+	tlog_debug(
+		"found new uefi keyboard %p%s",kbd->kbd,
+		kbd->kbdx?" (extended)":""
+	);
 	list_obj_add_new(&kbds,kbd);
 	if(dev)lv_indev_enable(dev,true);
 	return 0;
 }
 STATIC EFIAPI VOID keyboard_event(IN EFI_EVENT ev,IN VOID*ctx){
+	UINTN size=sizeof(EFI_HANDLE);
+	EFI_HANDLE hand=NULL;
 	EFI_SIMPLE_TEXT_INPUT_PROTOCOL*kbd=NULL;
-	EFI_STATUS st=gBS->LocateProtocol(
-		&gEfiSimpleTextInProtocolGuid,
-		event_reg,(VOID**)&kbd
-	);
 	tlog_notice("receive keyboard device hot-plug event");
-	if(!EFI_ERROR(st)&&kbd)_keyboard_register(kbd);
+	while(!EFI_ERROR(gBS->LocateHandle(
+		ByRegisterNotify,NULL,event_reg,&size,&hand
+	))){
+		if(!EFI_ERROR(gBS->HandleProtocol(
+			hand,&gEfiSimpleTextInProtocolGuid,(VOID**)&kbd
+		))&&kbd)_keyboard_register(hand,kbd);
+		size=sizeof(EFI_HANDLE);
+	}
 }
 static int keyboard_register(){
 	bool found=false;
@@ -147,7 +182,7 @@ static int keyboard_register(){
 			&gEfiSimpleTextInProtocolGuid,
 			(VOID**)&kbd
 		))||!kbd)continue;
-		if(_keyboard_register(kbd)==0)found=true;
+		if(_keyboard_register(hands[i],kbd)==0)found=true;
 	}
 	EfiCreateProtocolNotifyEvent(
 		&gEfiSimpleTextInProtocolGuid,
@@ -52,8 +52,10 @@ static void pointer_read(lv_indev_drv_t*indev_drv,lv_indev_data_t*data){
 	}else do{
 		n=l->next;
 		LIST_DATA_DECLARE(d,l,struct input_data*);
-		if(!d->pd)d->pd=d->mouse->GetState;
-		else if(d->mouse->GetState!=d->pd){
+
+		// only devices with pending input, idle ones cost no GetState
+		if(gBS->CheckEvent(d->mouse->WaitForInput)!=EFI_SUCCESS)continue;
+		if(d->mouse->GetState!=d->pd){
 			tlog_warn("GetState changed, disable mouse device");
 			list_obj_del(&mouses,l,list_default_free);
 			continue;
@@ -88,8 +90,10 @@ static int _pointer_register(EFI_SIMPLE_POINTER_PROTOCOL*mouse){
 	if(!(data=malloc(sizeof(struct input_data))))return -1;
 	memset(data,0,sizeof(struct input_data));
 	data->mouse=mouse;
+	data->pd=mouse->GetState;
 	data->rx=data->mouse->Mode->ResolutionX;
 	data->ry=data->mouse->Mode->ResolutionY;
+	gui_watch_event(mouse->WaitForInput);
 	tlog_debug("found new uefi pointer %p",data->mouse);
 	list_obj_add_new(&mouses,data);
 	if(dev)lv_indev_enable(dev,true);
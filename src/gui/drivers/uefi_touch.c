@@ -29,9 +29,11 @@ static void*event_reg=NULL;
 static list*touchs;
 static lv_indev_drv_t drv;
 static lv_indev_t*dev;
+static bool lp=false,lp_btn=false;
 static INT64 lx=0,ly=0;
 struct input_data{
-	INT64 lx,ly,rx,ry;
+	INT64 lx,ly,mx,my,rx,ry;
+	bool buttons;
 	EFI_ABSOLUTE_POINTER_PROTOCOL*touch;
 	void*pd;
 };
@@ -47,23 +49,35 @@ static void touch_read(lv_indev_drv_t*indev_drv,lv_indev_data_t*data){
 	}else do{
 		n=l->next;
 		LIST_DATA_DECLARE(d,l,struct input_data*);
-		if(!d->pd)d->pd=d->touch->GetState;
-		else if(d->touch->GetState!=d->pd){
+
+		// only devices with pending input, idle ones cost no GetState
+		if(gBS->CheckEvent(d->touch->WaitForInput)!=EFI_SUCCESS)continue;
+		if(d->touch->GetState!=d->pd){
 			tlog_warn("GetState changed, disable touch device");
 			list_obj_del(&touchs,l,list_default_free);
 			continue;
 		}
 		if(EFI_ERROR(d->touch->GetState(d->touch,&p)))continue;
-		if(p.CurrentX==d->lx&&p.CurrentY==d->ly)continue;
-		lx=((double)p.CurrentX/(double)d->rx)*gui_w;
-		ly=((double)p.CurrentY/(double)d->ry)*gui_h;
-		d->lx=p.CurrentX,d->ly=p.CurrentY;
-		data->state=LV_INDEV_STATE_PR;
+
+		/*
+		 * tablets report hover too, so a device that ever set a button
+		 * presses only with it. others press on each moved report
+		 */
+		if(p.ActiveButtons!=0)d->buttons=true;
+		if(!d->buttons&&p.CurrentX==d->lx&&p.CurrentY==d->ly)continue;
+		lp=d->buttons?(p.ActiveButtons&(EFI_ABSP_TouchActive|EFI_ABS_AltActive))!=0:true;
+		lx=(double)(MIN(MAX((INT64)p.CurrentX,d->mx),d->mx+d->rx)-d->mx)/(double)d->rx*gui_w;
+		ly=(double)(MIN(MAX((INT64)p.CurrentY,d->my),d->my+d->ry)-d->my)/(double)d->ry*gui_h;
+		d->lx=p.CurrentX,d->ly=p.CurrentY,lp_btn=d->buttons;
 		data->continue_reading=true;
 		break;
 	}while((l=n));
+
+	// a move only press lasts until a read without reports
+	if(!l&&!lp_btn)lp=false;
 	data->point.x=lx;
 	data->point.y=ly;
+	data->state=lp?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
 }
 static bool proto_cmp(list*f,void*data){
 	LIST_DATA_DECLARE(d,f,struct input_data*);
@@ -82,8 +96,12 @@ static int _touch_register(EFI_ABSOLUTE_POINTER_PROTOCOL*touch){
 	if(!(data=malloc(sizeof(struct input_data))))return -1;
 	memset(data,0,sizeof(struct input_data));
 	data->touch=touch;
-	data->rx=data->touch->Mode->AbsoluteMaxX;
-	data->ry=data->touch->Mode->AbsoluteMaxY;
+	data->pd=touch->GetState;
+	data->mx=touch->Mode->AbsoluteMinX;
+	data->my=touch->Mode->AbsoluteMinY;
+	data->rx=MAX(touch->Mode->AbsoluteMaxX-data->mx,1);
+	data->ry=MAX(touch->Mode->AbsoluteMaxY-data->my,1);
+	gui_watch_event(touch->WaitForInput);
 	tlog_debug("found new uefi absolute %p",data->touch);
 	list_obj_add_new(&touchs,data);
 	if(dev)lv_indev_enable(dev,true);
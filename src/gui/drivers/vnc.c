@@ -10,6 +10,7 @@
 #ifdef ENABLE_GUI
 #ifdef ENABLE_VNCSERVER
 #include<stdio.h>
+#include<string.h>
 #include<rfb/rfb.h>
 #include<rfb/keysym.h>
 #include"gui.h"
@@ -20,31 +21,54 @@
 #define TAG "vnc"
 #define DPI    200
 
+/*
+ * the server format is set to the layout of lv_color_t, so clients read
+ * what lvgl drew. without rotation lvgl renders straight into the server
+ * framebuffer, rotated areas are copied in. damage of one refresh is
+ * collected and handed to the server once.
+ */
 static rfbScreenInfoPtr server=NULL;
 static uint32_t*fb=NULL;
+static lv_color_t*buf=NULL;
+static sraRegionPtr damage=NULL;
 static uint32_t kbd_key=0;
 static int ptr_x=0,ptr_y=0;
 static lv_indev_state_t kbd_state=LV_INDEV_STATE_REL;
 static lv_indev_state_t ptr_state=LV_INDEV_STATE_REL;
 static lv_indev_t*kbd_dev,*ptr_dev;
 static uint32_t ww=540,hh=960;
-static lv_color_t buf[846000];
 static lv_disp_draw_buf_t disp_buf;
 static lv_disp_drv_t disp_drv;
 
-static inline uint32_t swap(uint32_t x){
-	return
-	       ((x&0xff000000))|
-	       ((x&0x00ff0000)>>16)|
-	       ((x&0x0000ff00))|
-	       ((x&0x000000ff)<<16);
+static void vnc_damage(const lv_area_t*a){
+	sraRegionPtr r=sraRgnCreateRect(
+		LV_MAX(a->x1,0),LV_MAX(a->y1,0),
+		LV_MIN(a->x2+1,(int32_t)ww),
+		LV_MIN(a->y2+1,(int32_t)hh)
+	);
+	if(!r)return;
+	sraRgnOr(damage,r);
+	sraRgnDestroy(r);
 }
 
 static void vnc_flush(lv_disp_drv_t*drv,const lv_area_t*area,lv_color_t*color_p){
-	for(int32_t y=area->y1;y<=area->y2;y++)
-		for(int32_t x=area->x1;x<=area->x2;x++)
-			fb[y*ww+x]=swap(*(uint32_t*)(color_p++));
-	rfbMarkRectAsModified(server,area->x1,area->y1,area->x2+1,area->y2+1);
+	lv_area_t a;
+	const uint32_t*px;
+	lv_area_copy(&a,area);
+	if(!drv->direct_mode){
+		if(!(px=pixel_flush_rotate(drv,&a,color_p))){
+			lv_disp_flush_ready(drv);
+			return;
+		}
+		size_t w=lv_area_get_width(&a);
+		for(int32_t y=a.y1;y<=a.y2;y++,px+=w)
+			memcpy(fb+y*ww+a.x1,px,w*sizeof(uint32_t));
+	}
+	vnc_damage(&a);
+	if(lv_disp_flush_is_last(drv)){
+		rfbMarkRegionAsModified(server,damage);
+		sraRgnMakeEmpty(damage);
+	}
 	lv_disp_flush_ready(drv);
 }
 
@@ -81,11 +105,13 @@ static void vnc_key(rfbBool down,rfbKeySym k,rfbClientPtr cl __attribute__((unus
 		default:           kbd_key=k;break;
 	}
 	kbd_state=down?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
+	gui_wakeup();
 }
 
 static void vnc_ptr(int btn,int x,int y,rfbClientPtr cl __attribute__((unused))){
 	ptr_x=x,ptr_y=y;
 	ptr_state=btn!=0?LV_INDEV_STATE_PR:LV_INDEV_STATE_REL;
+	gui_wakeup();
 }
 
 static void vnc_log_normal(const char*text,...){
@@ -130,18 +156,20 @@ static void vnc_apply_mode(){
 }
 
 static int vnc_register(){
-	lv_disp_draw_buf_init(&disp_buf,buf,NULL,sizeof(buf));
 	lv_disp_drv_init(&disp_drv);
 	size_t bpp=sizeof(*fb);
 	vnc_apply_mode();
 	if(!(fb=malloc(ww*hh*bpp)))return -1;
-	if(!(server=rfbGetScreen(0,NULL,ww,hh,8,3,bpp))){
-		free(fb);
-		return -1;
-	}
+	memset(fb,0,ww*hh*bpp);
+	if(!(damage=sraRgnCreate()))goto fail;
+	if(gui_rotate!=0&&!(buf=malloc(ww*hh*sizeof(lv_color_t))))goto fail;
+	if(!(server=rfbGetScreen(0,NULL,ww,hh,8,3,bpp)))goto fail;
 
 	server->desktopName=NAME" "VERSION;
 	server->frameBuffer=(void*)fb;
+	server->serverFormat.redShift=16;
+	server->serverFormat.greenShift=8;
+	server->serverFormat.blueShift=0;
 	server->alwaysShared=true;
 	server->httpDir=NULL;
 	server->port=confd_get_integer("gui.vnc_port",5900);
@@ -150,27 +178,33 @@ static int vnc_register(){
 	rfbLog=vnc_log_normal;
 	rfbErr=vnc_log_warn;
 
+	if(buf)lv_disp_draw_buf_init(&disp_buf,buf,NULL,ww*hh);
+	else lv_disp_draw_buf_init(&disp_buf,(lv_color_t*)fb,NULL,ww*hh);
 	disp_drv.hor_res=ww;
 	disp_drv.ver_res=hh;
+	disp_drv.direct_mode=!buf;
 	disp_drv.draw_buf=&disp_buf;
 	disp_drv.flush_cb=vnc_flush;
-	disp_drv.draw_ctx_init=lv_draw_sw_init_ctx;
-	disp_drv.draw_ctx_deinit=lv_draw_sw_init_ctx;
+	disp_drv.draw_ctx_init=gui_draw_init_ctx;
+	disp_drv.draw_ctx_deinit=gui_draw_deinit_ctx;
 	disp_drv.draw_ctx_size=sizeof(lv_draw_sw_ctx_t);
-	switch(gui_rotate){
-		case 0:break;
-		case 90:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_90;break;
-		case 180:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_180;break;
-		case 270:disp_drv.sw_rotate=1,disp_drv.rotated=LV_DISP_ROT_270;break;
-	}
+	disp_drv.rotated=pixel_get_rotation(gui_rotate);
 
 	lv_disp_drv_register(&disp_drv);
 
 	tlog_notice("screen resolution: %dx%d",ww,hh);
 	rfbInitServer(server);
-	rfbRunEventLoop(server,-1,1);
+
+	// every client gets its own thread, encodings are what it asks for
+	rfbRunEventLoop(server,-1,true);
 
 	return 0;
+	fail:
+	if(damage)sraRgnDestroy(damage);
+	if(buf)free(buf);
+	free(fb);
+	fb=NULL,buf=NULL,damage=NULL;
+	return -1;
 }
 
 static int vnc_input_init(){
@@ -214,9 +248,11 @@ static int vnc_get_modes(int*cnt,struct display_mode**modes){
 
 static void vnc_exit(){
 	rfbShutdownServer(server,true);
-	free(fb);
 	rfbScreenCleanup(server);
-	fb=NULL,server=NULL;
+	sraRgnDestroy(damage);
+	if(buf)free(buf);
+	free(fb);
+	fb=NULL,buf=NULL,damage=NULL,server=NULL;
 }
 
 struct input_driver indrv_vnc={
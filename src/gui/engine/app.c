@@ -110,9 +110,9 @@ bool xml_assets_load_all_activity(entry_dir*dir){
 	bool res=true;
 	if(!dir)return false;
 	if(dir->subfiles)for(size_t s=0;(f=dir->subfiles[s]);s++){
-		if(!f->content||f->length<=0)continue;
 		if((len=strlen(f->info.name))<=4)continue;
 		if(strcasecmp(f->info.name+len-4,".xml")!=0)continue;
+		if(!asset_file_load(f)||!f->content||f->length<=0)continue;
 		if(!xml_assets_file_load_activity(f))res=false;
 	}
 	if(dir->subdirs)for(size_t s=0;(d=dir->subdirs[s]);s++)
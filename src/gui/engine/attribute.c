@@ -91,12 +91,7 @@ static bool setup_attr_id(xml_render_obj_attr*d,bool resize){
 }
 
 static bool setup_attr_attr(xml_render_obj_attr*d,bool resize){
-	xml_attr_handle*hand=NULL;
-	for(size_t x=0;(hand=&xml_attr_handles[x])->valid;x++){
-		if(strcasecmp(hand->name,d->key)!=0)continue;
-		d->hand=hand;
-		break;
-	}
+	if(!d->hand)d->hand=render_find_attr_handle(d->key);
 	if(!d->hand){
 		tlog_error("unsupported attribute: %s",d->key);
 		return false;
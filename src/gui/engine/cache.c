@@ -0,0 +1,198 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_GUI
+#ifdef ENABLE_MXML
+#include<ctype.h>
+#include<stdlib.h>
+#include<stddef.h>
+#include"str.h"
+#include"defines.h"
+#include"render_internal.h"
+
+/*
+ * layouts are parsed and checked once, renders of the same content share
+ * the document, nothing writes to the dom after parsing. documents stay
+ * while a render holds them, up to LAYOUT_CACHE_MAX unused ones are kept
+ * for the next activity, the least recently used is dropped first.
+ * the object, attribute and style handler tables are indexed by name on
+ * first use instead of a strcasecmp scan for every element and attribute.
+ */
+#define LAYOUT_CACHE_MAX 16
+#define INDEX_SIZE       128
+
+struct name_index{
+	bool ready;
+	size_t head[INDEX_SIZE];
+	size_t*next;
+};
+
+static mutex_t cache_lock=MUTEX_INITIALIZER;
+static xml_render_layout*layouts=NULL;
+static struct name_index obj_index,attr_index,style_index;
+
+static uint32_t name_hash(const char*name){
+	uint32_t h=0x811C9DC5;
+	while(*name)h=(h^(unsigned char)tolower(*name++))*0x01000193;
+	return h;
+}
+
+static uint32_t content_hash(const char*content,size_t len){
+	uint32_t h=0x811C9DC5;
+	for(size_t i=0;i<len;i++)h=(h^(unsigned char)content[i])*0x01000193;
+	return h;
+}
+
+#define ENTRY(table,stride,i) ((char*)(table)+(stride)*(i))
+#define ENTRY_VALID(table,stride,i) (*(bool*)ENTRY(table,stride,i))
+#define ENTRY_NAME(table,stride,off,i) (ENTRY(table,stride,i)+(off))
+
+// every table starts with the valid flag and ends at the first invalid entry
+static bool index_build(struct name_index*idx,void*table,size_t stride,size_t off){
+	size_t cnt=0,h;
+	while(ENTRY_VALID(table,stride,cnt))cnt++;
+	if(!(idx->next=malloc(sizeof(size_t)*(cnt+1))))return false;
+	for(size_t i=0;i<INDEX_SIZE;i++)idx->head[i]=SIZE_MAX;
+
+	// pushed in reverse, so the first entry of a name is found first
+	for(size_t i=cnt;i-->0;){
+		h=name_hash(ENTRY_NAME(table,stride,off,i))%INDEX_SIZE;
+		idx->next[i]=idx->head[h],idx->head[h]=i;
+	}
+	idx->ready=true;
+	return true;
+}
+
+static void*index_lookup(
+	struct name_index*idx,void*table,
+	size_t stride,size_t off,const char*name
+){
+	void*ret=NULL;
+	if(!name)return NULL;
+	MUTEX_LOCK(cache_lock);
+	if(idx->ready||index_build(idx,table,stride,off)){
+		for(
+			size_t i=idx->head[name_hash(name)%INDEX_SIZE];
+			i!=SIZE_MAX;i=idx->next[i]
+		){
+			if(strcasecmp(ENTRY_NAME(table,stride,off,i),name)!=0)continue;
+			ret=ENTRY(table,stride,i);
+			break;
+		}
+	}
+	MUTEX_UNLOCK(cache_lock);
+	return ret;
+}
+
+xml_obj_handle*render_find_obj_handle(const char*name){
+	return index_lookup(
+		&obj_index,xml_obj_handles,sizeof(xml_obj_handle),
+		offsetof(xml_obj_handle,name),name
+	);
+}
+
+xml_attr_handle*render_find_attr_handle(const char*name){
+	return index_lookup(
+		&attr_index,xml_attr_handles,sizeof(xml_attr_handle),
+		offsetof(xml_attr_handle,name),name
+	);
+}
+
+xml_style_prop*render_find_style_prop(const char*name){
+	return index_lookup(
+		&style_index,xml_style_props,sizeof(xml_style_prop),
+		offsetof(xml_style_prop,name),name
+	);
+}
+
+static void layout_free(xml_render_layout*l){
+	if(!l)return;
+	if(l->document)mxmlDelete(l->document);
+	if(l->content)free(l->content);
+	free(l);
+}
+
+static xml_render_layout*layout_parse(const char*content,size_t len){
+	char*end=NULL,*comp;
+	xml_render_layout*l;
+	if(!(l=malloc(sizeof(xml_render_layout))))return NULL;
+	memset(l,0,sizeof(xml_render_layout));
+	l->len=len,l->hash=content_hash(content,len);
+	if(!(l->content=malloc(len+1)))goto done;
+	memcpy(l->content,content,len);
+	l->content[len]=0;
+	if(!(l->document=mxmlLoadString(
+		NULL,l->content,
+		MXML_OPAQUE_CALLBACK
+	)))EDONE(tlog_error("parse xml document failed"));
+	if(!(l->root_node=mxmlFindElement(
+		l->document,l->document,
+		"SimpleInitGUI",
+		NULL,NULL,MXML_DESCEND
+	)))EDONE(tlog_error("invalid xml render config"));
+	if(!(comp=(char*)mxmlElementGetAttr(
+		l->root_node,"compatible"
+	)))EDONE(tlog_error("missing compatibility level"));
+	errno=0,l->compatible_level=(uint32_t)strtol(comp,&end,0);
+	if(*end||end==comp||errno!=0)
+		EDONE(tlog_error("invalid compatibility level"));
+	if(l->compatible_level>RENDER_COMPATIBLE_LEVEL)
+		EDONE(tlog_error("incompatible new version xml"));
+	if(l->compatible_level<RENDER_COMPATIBLE_LEVEL)
+		tlog_warn("found an old version of xml, need to upgrade");
+	return l;
+	done:
+	layout_free(l);
+	return NULL;
+}
+
+// drop unused layouts past the limit, the list is most recent first
+static void layout_trim(void){
+	size_t unused=0;
+	xml_render_layout**p=&layouts,*l;
+	while((l=*p)){
+		if(l->refs>0||++unused<=LAYOUT_CACHE_MAX){
+			p=&l->next;
+			continue;
+		}
+		*p=l->next;
+		layout_free(l);
+	}
+}
+
+xml_render_layout*render_layout_get(const char*content,size_t len){
+	uint32_t hash;
+	xml_render_layout**p,*l;
+	if(!content||len<=0)return NULL;
+	hash=content_hash(content,len);
+	MUTEX_LOCK(cache_lock);
+	for(p=&layouts;(l=*p);p=&l->next){
+		if(l->hash!=hash||l->len!=len)continue;
+		if(memcmp(l->content,content,len)!=0)continue;
+		*p=l->next;
+		break;
+	}
+	if(!l&&(l=layout_parse(content,len)))
+		tlog_debug("parsed xml layout %08x (%zu bytes)",hash,len);
+	if(l){
+		l->refs++;
+		l->next=layouts,layouts=l;
+	}
+	MUTEX_UNLOCK(cache_lock);
+	return l;
+}
+
+void render_layout_put(xml_render_layout*layout){
+	if(!layout)return;
+	MUTEX_LOCK(cache_lock);
+	if(layout->refs>0)layout->refs--;
+	layout_trim();
+	MUTEX_UNLOCK(cache_lock);
+}
+#endif
+#endif
@@ -8,8 +8,16 @@
 
 #ifdef ENABLE_GUI
 #ifdef ENABLE_MXML
+#include"gui/string.h"
 #include"render_internal.h"
 
+/*
+ * a snippet is compiled the first time it runs, the chunk is kept in the
+ * registry and called again after that. an event handler gets the event
+ * as its first argument (...), the global event stays for old layouts.
+ * events="clicked,focused" on a Code limits the event codes that reach
+ * the snippet, other codes are dropped before entering lua at all.
+ */
 xml_render_code*render_new_scode(
 	xml_render*render,
 	const char*name,
@@ -34,6 +42,9 @@ xml_render_code*render_new_scode(
 	if(!(c=malloc(sizeof(xml_render_code))))EPRET(ENOMEM);
 	memset(c,0,sizeof(xml_render_code));
 	c->render=render;
+	#ifdef ENABLE_LUA
+	c->func=LUA_NOREF;
+	#endif
 	strncpy(c->id,name,sizeof(c->id)-1);
 	if(!(c->code=malloc(len+1)))goto done;
 	memset(c->code,0,len+1);
@@ -59,6 +70,33 @@ xml_render_code*render_new_code(
 	);
 }
 
+static bool parse_events(xml_render_code*code,const char*events){
+	char name[64];
+	size_t len;
+	lv_event_code_t event;
+	for(const char*p=events;*p;p+=len){
+		p+=strspn(p,", \t\n");
+		if(!(len=strcspn(p,", \t\n")))break;
+		if(len>=sizeof(name)){
+			tlog_error("event name too long");
+			return false;
+		}
+		memcpy(name,p,len);
+		name[len]=0;
+		if(!lv_name_to_event_code(name,&event)){
+			tlog_error("unknown event: %s",name);
+			return false;
+		}
+		if(event<64)code->events|=(uint64_t)1<<event;
+	}
+	return true;
+}
+
+bool render_code_want_event(xml_render_code*code,lv_event_code_t event){
+	if(!code||code->events==0||event>=64)return true;
+	return (code->events>>event)&1;
+}
+
 xml_render_code*render_load_code(
 	xml_render*render,
 	mxml_node_t*node
@@ -66,7 +104,7 @@ xml_render_code*render_load_code(
 	bool autorun=false;
 	xml_render_code*code;
 	const char*key,*value;
-	const char*cont=NULL,*id=NULL;
+	const char*cont=NULL,*id=NULL,*events=NULL;
 	if(!render||!node)EPRET(EINVAL);
 	if(!(key=mxmlGetElement(node)))EPRET(EINVAL);
 	if(strcasecmp(key,"Code")!=0)EPRET(EINVAL);
@@ -78,7 +116,8 @@ xml_render_code*render_load_code(
 			if(string_is_false(value))autorun=false;
 			else if(string_is_true(value))autorun=true;
 			else tlog_warn("invalid boolean attribute: %s",value);
-		}else tlog_warn("unknown attribute: %s",key);
+		}else if(strcasecmp(key,"events")==0)events=value;
+		else tlog_warn("unknown attribute: %s",key);
 	}
 	if(!id||!*id){
 		tlog_error("code snippet id not set");
@@ -89,6 +128,11 @@ xml_render_code*render_load_code(
 		return NULL;
 	}
 	if(!(code=render_new_code(render,id,cont)))return NULL;
+	if(events&&!parse_events(code,events)){
+		list_obj_del_data(&code->render->codes,code,NULL);
+		render_code_free(code);
+		return NULL;
+	}
 	if(autorun&&render_code_exec_run(code)!=LUA_OK){
 		tlog_error("auto run code snippet %s failed",code->id);
 		list_obj_del_data(&code->render->codes,code,NULL);
@@ -98,22 +142,37 @@ xml_render_code*render_load_code(
 	return code;
 }
 
-int render_code_exec_run(xml_render_code*code){
+int render_code_exec_call(xml_render_code*code,int nargs){
 	int r=0;
 	if(!code)ERET(EINVAL);
 	#ifdef ENABLE_LUA
-	lua_settop(code->render->lua,0);
-	if((r=luaL_loadstring(code->render->lua,code->code))!=LUA_OK)
-		EDONE(tlog_error("load lua code %s failed",code->id));
-	if((r=lua_pcall(code->render->lua,0,LUA_MULTRET,0))!=LUA_OK)
+	lua_State*L=code->render->lua;
+	if(code->func==LUA_NOREF){
+		if((r=luaL_loadstring(L,code->code))!=LUA_OK)
+			EDONE(tlog_error("load lua code %s failed",code->id));
+		xlua_set_env(L,code->render->lua_env);
+		code->func=luaL_ref(L,LUA_REGISTRYINDEX);
+	}
+	lua_rawgeti(L,LUA_REGISTRYINDEX,code->func);
+	lua_insert(L,-(nargs+1));
+	if((r=lua_pcall(L,nargs,LUA_MULTRET,0))!=LUA_OK)
 		EDONE(tlog_error("error while running lua code %s",code->id));
 	done:
-	if(r!=LUA_OK)xlua_show_error(code->render->lua,TAG);
+	if(r!=LUA_OK)xlua_show_error(L,TAG);
 	#else
+	(void)nargs;
 	tlog_error("lua is disabled");
 	r=-1;
 	#endif
 	return r;
 }
+
+int render_code_exec_run(xml_render_code*code){
+	if(!code)ERET(EINVAL);
+	#ifdef ENABLE_LUA
+	lua_settop(code->render->lua,0);
+	#endif
+	return render_code_exec_call(code,0);
+}
 #endif
 #endif
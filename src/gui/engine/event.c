@@ -56,6 +56,36 @@ static xml_event_info*get_listener(
 	return obj_get_listener(obj,evt_id);
 }
 
+#ifdef ENABLE_LUA
+/*
+ * one event userdata lives with a render, it is also the global event
+ * of its environment. a dispatch points it at the event on the stack,
+ * the one before comes back after, so a nested event does not break
+ * the outer handler and a kept reference cannot reach a gone event.
+ */
+static int trigger_code_event(xml_render*render,xml_render_code*code,xml_render_event*e){
+	int r;
+	lua_State*L=render->lua;
+	struct lua_render_event_data*d;
+	xml_render_event*prev;
+	lua_settop(L,0);
+	if(render->lua_event==LUA_NOREF){
+		render_event_to_lua(L,NULL);
+		xlua_push_env(L,render->lua_env);
+		lua_pushvalue(L,-2);
+		lua_setfield(L,-2,"event");
+		lua_pop(L,1);
+		render->lua_event=luaL_ref(L,LUA_REGISTRYINDEX);
+	}
+	lua_rawgeti(L,LUA_REGISTRYINDEX,render->lua_event);
+	d=lua_touserdata(L,-1);
+	prev=d->event,d->event=e;
+	r=render_code_exec_call(code,1);
+	d->event=prev;
+	return r;
+}
+#endif
+
 static int trigger_event(
 	xml_event_info*info,
 	lv_event_t*event,
@@ -68,22 +98,16 @@ static int trigger_event(
 	if(!info||!info->obj)return -1;
 	if(
 		info->event!=_LV_EVENT_LAST&&
+		info->event!=LV_EVENT_ALL&&
 		info->event!=lv_event_get_code(event)
 	)return 0;
+	if(!render_code_want_event(info->code,lv_event_get_code(event)))return 0;
 	memset(&e,0,sizeof(e));
 	e.info=info;
 	e.event=event;
 	e.data=data;
 	#ifdef ENABLE_LUA
-	if(info->code){
-		lua_State*st=info->obj->render->lua;
-		render_event_to_lua(st,&e);
-		lua_setglobal(st,"event");
-		r=render_code_exec_run(info->code);
-		lua_pushnil(st);
-		lua_setglobal(st,"event");
-		return r;
-	}
+	if(info->code)return trigger_code_event(info->obj->render,info->code,&e);
 	#endif
 	info->callback(&e);
 	return r;
@@ -38,7 +38,7 @@ lv_coord_t render_resolve_coord(
 		if(percent||len<=1)
 			EDONE(tlog_error("invalid expression: %s",name));
 		#ifdef ENABLE_LUA
-		if(xlua_eval_string(obj->render->lua,val+1)!=LUA_OK){
+		if(xlua_eval_string_env(obj->render->lua,obj->render->lua_env,val+1)!=LUA_OK){
 			tlog_error("error while running lua expression %s",name+1);
 			xlua_show_error(obj->render->lua,TAG);
 			result=0;
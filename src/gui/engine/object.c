@@ -26,20 +26,19 @@ static bool render_init_object(xml_render_obj*obj){
 		tlog_error("cannot get object type");
 		return false;
 	}
-	for(size_t s=0;(hand=&xml_obj_handles[s])->valid;s++){
-		if(strcasecmp(hand->name,type)!=0)continue;
-		obj->hand=hand,obj->type=hand->type;
-		if(!hand->pre_hand(obj)){
-			obj->obj=NULL,obj->type=OBJ_NONE;
-			tlog_error("create object %s failed",type);
-			return false;
-		}
-		if(!obj->obj)return false;
-		lv_obj_set_user_data(obj->obj,obj);
-		return true;
+	if(!(hand=render_find_obj_handle(type))){
+		tlog_error("unsupported object type: %s",type);
+		return false;
 	}
-	tlog_error("unsupported object type: %s",type);
-	return false;
+	obj->hand=hand,obj->type=hand->type;
+	if(!hand->pre_hand(obj)){
+		obj->obj=NULL,obj->type=OBJ_NONE;
+		tlog_error("create object %s failed",type);
+		return false;
+	}
+	if(!obj->obj)return false;
+	lv_obj_set_user_data(obj->obj,obj);
+	return true;
 }
 
 static int style_set_id(
@@ -207,7 +206,7 @@ static bool render_parse_if(
 		#ifdef ENABLE_LUA
 		if(code)r=render_code_exec_run(code);
 		else{
-			r=xlua_eval_string(render->lua,cond);
+			r=xlua_eval_string_env(render->lua,render->lua_env,cond);
 			if(r!=LUA_OK){
 				tlog_error(
 					"error while running lua condition '%s'",
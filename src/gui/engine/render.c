@@ -35,49 +35,26 @@ bool render_resize(xml_render*render){
 bool render_parse_doc(
 	xml_render*render,
 	xml_render_obj*parent,
-	char*content
+	const char*content,
+	size_t len
 ){
 	xml_render_doc*d;
-	char*end=NULL,*comp;
 	if(!(d=malloc(sizeof(xml_render_doc))))return false;
 	memset(d,0,sizeof(xml_render_doc));
-	if(!(d->document=mxmlLoadString(
-		NULL,content,
-		MXML_OPAQUE_CALLBACK
-	))){
-		tlog_error("parse xml document failed");
-		return false;
-	}
-	if(!(d->root_node=mxmlFindElement(
-		d->document,d->document,
-		"SimpleInitGUI",
-		NULL,NULL,MXML_DESCEND
-	))){
-		tlog_error("invalid xml render config");
-		return false;
-	}
-	if(!(comp=(char*)mxmlElementGetAttr(
-		d->root_node,"compatible"
-	))){
-		tlog_error("missing compatibility level");
-		return false;
-	}
-	errno=0,render->compatible_level=(uint32_t)strtol(comp,&end,0);
-	if(*end||end==comp||errno!=0){
-		tlog_error("invalid compatibility level");
-		return false;
-	}
-	if(render->compatible_level>RENDER_COMPATIBLE_LEVEL){
-		tlog_error("incompatible new version xml");
+
+	// the parsed document is shared with other renders of this layout
+	if(!(d->layout=render_layout_get(content,len))){
+		free(d);
 		return false;
 	}
-	if(render->compatible_level<RENDER_COMPATIBLE_LEVEL)
-		tlog_warn("found an old version of xml, need to upgrade");
+	d->document=d->layout->document;
+	d->root_node=d->layout->root_node;
+	render->compatible_level=d->layout->compatible_level;
+	list_obj_add_new(&render->docs,d);
 	if(!render_parse_object(render,parent,d->root_node)){
 		tlog_error("error while render xml");
 		return false;
 	}
-	list_obj_add_new(&render->docs,d);
 	return true;
 }
 
@@ -89,7 +66,7 @@ bool render_parse(xml_render*render,lv_obj_t*root){
 	)return false;
 	MUTEX_LOCK(render->lock);
 	render->root_obj=root;
-	if(!render_parse_doc(render,NULL,render->content)){
+	if(!render_parse_doc(render,NULL,render->content,render->length)){
 		tlog_error("error while parse xml document");
 		MUTEX_UNLOCK(render->lock);
 		return false;
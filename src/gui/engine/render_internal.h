@@ -49,6 +49,7 @@ typedef struct xml_render_obj_attr xml_render_obj_attr;
 typedef struct xml_attr_handle xml_attr_handle;
 typedef struct xml_obj_handle xml_obj_handle;
 typedef struct xml_render_doc xml_render_doc;
+typedef struct xml_render_layout xml_render_layout;
 
 typedef int(*xml_style_set_type)(
 	xml_render_obj*obj,
@@ -199,11 +200,26 @@ struct xml_render_code{
 	mxml_node_t*node;
 	char*code;
 	size_t len;
+	uint64_t events;
+	#ifdef ENABLE_LUA
+	int func;
+	#endif
 };
 
 struct xml_render_doc{
+	xml_render_layout*layout;
+	mxml_node_t*document;
+	mxml_node_t*root_node;
+};
+
+struct xml_render_layout{
+	uint32_t hash;
+	size_t len,refs;
+	char*content;
+	uint32_t compatible_level;
 	mxml_node_t*document;
 	mxml_node_t*root_node;
+	xml_render_layout*next;
 };
 
 struct xml_render{
@@ -215,6 +231,8 @@ struct xml_render{
 	lv_obj_t*root_obj;
 	#ifdef ENABLE_LUA
 	lua_State*lua;
+	int lua_env;
+	int lua_event;
 	#endif
 	list*docs;
 	list*codes;
@@ -276,7 +294,14 @@ extern bool render_init_attributes(xml_render_obj*obj,bool resize);
 extern void render_obj_attr_free(xml_render_obj_attr*o);
 extern bool render_move_callbacks(xml_render*render);
 extern int render_code_exec_run(xml_render_code*code);
+extern int render_code_exec_call(xml_render_code*code,int nargs);
+extern bool render_code_want_event(xml_render_code*code,lv_event_code_t event);
 extern int render_lua_init_event(lua_State*L);
+extern xml_obj_handle*render_find_obj_handle(const char*name);
+extern xml_attr_handle*render_find_attr_handle(const char*name);
+extern xml_style_prop*render_find_style_prop(const char*name);
+extern xml_render_layout*render_layout_get(const char*content,size_t len);
+extern void render_layout_put(xml_render_layout*layout);
 extern bool xml_style_apply_style(
 	xml_render_style*style,
 	const char*k,
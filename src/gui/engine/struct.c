@@ -29,7 +29,8 @@ static int list_render_obj_attr_free(void*r){
 
 void render_doc_free(xml_render_doc*o){
 	if(!o)return;
-	if(o->document)mxmlDelete(o->document);
+	if(o->layout)render_layout_put(o->layout);
+	else if(o->document)mxmlDelete(o->document);
 	memset(o,0,sizeof(xml_render_doc));
 	free(o);
 }
@@ -60,6 +61,10 @@ void render_style_free(xml_render_style*o){
 
 void render_code_free(xml_render_code*o){
 	if(!o)return;
+	#ifdef ENABLE_LUA
+	if(o->render&&o->render->lua&&o->func!=LUA_NOREF)
+		luaL_unref(o->render->lua,LUA_REGISTRYINDEX,o->func);
+	#endif
 	if(o->code)free(o->code);
 	memset(o,0,sizeof(xml_render_code));
 	free(o);
@@ -105,7 +110,9 @@ void render_free(xml_render*r){
 		list_render_doc_free
 	);
 	#ifdef ENABLE_LUA
-	if(r->lua)lua_close(r->lua);
+	if(r->lua&&r->lua_event!=LUA_NOREF)
+		luaL_unref(r->lua,LUA_REGISTRYINDEX,r->lua_event);
+	if(r->lua)xlua_free_env(r->lua,r->lua_env);
 	#endif
 	if(r->content)free(r->content);
 	MUTEX_UNLOCK(r->lock);
@@ -120,9 +127,17 @@ xml_render*render_create(void*user_data){
 	memset(render,0,sizeof(xml_render));
 	render->data=user_data;
 	#ifdef ENABLE_LUA
-	if(!(render->lua=xlua_init()))
+
+	// all renders run in the gui thread, they share one state
+	render->lua_env=LUA_NOREF;
+	render->lua_event=LUA_NOREF;
+	if(!(render->lua=xlua_shared()))
 		EDONE(tlog_error("initialize lua failed"));
-	lua_gui_init(render->lua);
+	if((render->lua_env=xlua_new_env(render->lua))==LUA_REFNIL)
+		EDONE(tlog_error("create lua environment failed"));
+	xlua_push_env(render->lua,render->lua_env);
+	lua_gui_init_table(render->lua);
+	lua_pop(render->lua,1);
 	#endif
 	MUTEX_INIT(render->lock);
 	return render;
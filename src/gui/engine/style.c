@@ -34,11 +34,9 @@ static int style_set_type(
 }
 
 static xml_style_prop*get_prop(char*key){
-	for(size_t i=0;xml_style_props[i].valid;i++)
-		if(strcasecmp(xml_style_props[i].name,key)==0)
-			return &xml_style_props[i];
-	tlog_warn("unknown style prop %s",key);
-	return NULL;
+	xml_style_prop*prop=render_find_style_prop(key);
+	if(!prop)tlog_warn("unknown style prop %s",key);
+	return prop;
 }
 
 static bool style_selector_cmp(list*f,void*data){
@@ -23,6 +23,10 @@
 #else
 #include<semaphore.h>
 #include<pthread.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/timerfd.h>
+#include"metrics.h"
 #endif
 #ifdef ENABLE_LUA
 #include"xlua.h"
@@ -30,14 +34,18 @@
 #endif
 #include"str.h"
 #include"gui.h"
+#include"array.h"
 #include"confd.h"
 #include"system.h"
 #include"logger.h"
 #include"defines.h"
 #include"hardware.h"
+#include"font_bin.h"
+#include"mempressure.h"
 #include"gui/font.h"
 #include"gui/image.h"
 #include"gui/sysbar.h"
+#include"gui/perf.h"
 #include"gui/guidrv.h"
 #include"gui/activity.h"
 #include"gui/clipboard.h"
@@ -163,6 +171,20 @@ void guess_font_size(){
 	tlog_debug("select font size %d/%d based on dpi",gui_font_size,gui_font_size_small);
 }
 
+// glyphs rendered at build time, missing ones fall through to font
+static const lv_font_t*prerendered_font(const lv_font_t*font,int size){
+	char path[64];
+	lv_font_t*pre;
+	#ifndef ENABLE_UEFI
+	if(getenv("FONT"))return font;
+	#endif
+	if(!confd_get_boolean("gui.prerendered_font",true))return font;
+	snprintf(path,sizeof(path),FONT_BIN_ASSET,size);
+	if(!(pre=lv_font_bin_init_rootfs(path)))return font;
+	pre->fallback=font;
+	return pre;
+}
+
 static void lvgl_logger(const char*buf){
 	logger_print(LEVEL_INFO,"lvgl",(char*)buf);
 }
@@ -229,6 +251,7 @@ int gui_pre_init(){
 	if(guidrv_init(&gui_w,&gui_h,&gui_dpi)<0)return -1;
 	gui_sx=0,gui_sy=0,gui_sw=gui_w,gui_sh=gui_h;
 	indrv_init();
+	gui_perf_init();
 	int cnt=0;
 	struct display_mode*modes=NULL;
 	if(guidrv_get_modes(&cnt,&modes)==0&&cnt>0&&modes){
@@ -275,6 +298,8 @@ int gui_pre_init(){
 
 	((lv_font_t*)gui_font)->fallback=symbol_font;
 	((lv_font_t*)gui_font_small)->fallback=symbol_font;
+	gui_font=prerendered_font(gui_font,gui_font_size);
+	gui_font_small=prerendered_font(gui_font_small,gui_font_size_small);
 
 	#ifdef ENABLE_LUA
 	if(gui_global_lua)
@@ -323,7 +348,12 @@ static void gui_enter_sleep(){
 }
 #else
 
+static void mem_check_cb(lv_timer_t*t __attribute__((unused))){
+	mem_check();
+}
+
 extern bool conf_store_changed;
+static lv_timer_t*save_timer=NULL;
 static void conf_save_cb(lv_timer_t*t __attribute__((unused))){
 	if(!conf_store_changed)return;
 	int r=confd_save_file(NULL);
@@ -332,14 +362,37 @@ static void conf_save_cb(lv_timer_t*t __attribute__((unused))){
 	conf_store_changed=false;
 }
 
+static void save_interval_cb(
+	const char*path __attribute__((unused)),
+	enum conf_type type __attribute__((unused)),
+	void*data __attribute__((unused))
+){
+	int64_t i=confd_get_integer("confd.save_interval",10);
+	if(save_timer&&i>0)lv_timer_set_period(save_timer,i*1000);
+}
+
 static void gui_enter_sleep(){
 	lv_disp_trig_activity(NULL);
 }
 #endif
 
+// a fixed tick only moves by gui_advance_tick, for repeatable animations
+static bool tick_fixed=false;
+static uint32_t tick_fixed_ms=0;
+
+void gui_set_fixed_tick(bool fixed){
+	if(fixed&&!tick_fixed)tick_fixed_ms=custom_tick_get();
+	tick_fixed=fixed;
+}
+
+void gui_advance_tick(uint32_t ms){
+	tick_fixed_ms+=ms;
+}
+
 uint32_t custom_tick_get(void){
 	static uint64_t start_ms=0;
 	uint64_t cur_ms;
+	if(tick_fixed)return tick_fixed_ms;
 	errno=0;
 	if(guidrv_get_driver()){
 		uint32_t u=guidrv_tickget();
@@ -475,6 +528,193 @@ static void image_cache_cb(lv_timer_t*t __attribute__((unused))){
 	image_print_stat();
 }
 
+// sleep allowed by config, updated by watching gui.can_sleep
+static volatile bool conf_can_sleep=true;
+static void can_sleep_cb(
+	const char*path __attribute__((unused)),
+	enum conf_type type __attribute__((unused)),
+	void*data __attribute__((unused))
+){
+	bool s=confd_get_boolean("gui.can_sleep",true);
+	if(s==conf_can_sleep)return;
+	tlog_notice("config %s sleep",s?"enabled":"disabled");
+	conf_can_sleep=s;
+}
+
+/*
+ * the main loop sleeps until the next lvgl timer is due, or until an
+ * input device, a driver or another thread has something for it. every
+ * wake up by input marks the input devices for reading, so new events
+ * reach lvgl in the same pass instead of at the next read period.
+ */
+#define GUI_WATCH_MAX 32
+
+static void loop_ready_input(){
+	lv_indev_t*indev=NULL;
+	MUTEX_LOCK(gui_lock);
+	while((indev=lv_indev_get_next(indev)))
+		if(indev->driver->read_timer)
+			lv_timer_ready(indev->driver->read_timer);
+	MUTEX_UNLOCK(gui_lock);
+}
+
+#ifdef ENABLE_UEFI
+// the first event is the timer for the next deadline
+static EFI_EVENT loop_events[GUI_WATCH_MAX+1];
+static UINTN loop_cnt=0;
+
+int gui_watch_event(void*event){
+	if(!event)ERET(EINVAL);
+	for(UINTN i=1;i<=loop_cnt;i++)
+		if(loop_events[i]==event)return 0;
+	if(loop_cnt>=GUI_WATCH_MAX)ERET(ENOSPC);
+	loop_events[++loop_cnt]=event;
+	return 0;
+}
+
+void gui_unwatch_event(void*event){
+	for(UINTN i=1;i<=loop_cnt;i++){
+		if(loop_events[i]!=event)continue;
+		loop_events[i]=loop_events[loop_cnt];
+		loop_events[loop_cnt--]=NULL;
+		break;
+	}
+}
+
+static void loop_wait(uint32_t time){
+	UINTN idx=0;
+	EFI_STATUS st=EFI_NOT_READY;
+	if(!loop_events[0])st=gBS->CreateEvent(
+		EVT_TIMER,0,NULL,NULL,&loop_events[0]
+	);
+	if(loop_events[0])st=gBS->SetTimer(
+		loop_events[0],TimerRelative,
+		EFI_TIMER_PERIOD_MILLISECONDS(time)
+	);
+	if(!EFI_ERROR(st))st=gBS->WaitForEvent(loop_cnt+1,loop_events,&idx);
+	if(EFI_ERROR(st)){
+		gBS->Stall(EFI_TIMER_PERIOD_MILLISECONDS(time));
+		idx=0;
+	}
+
+	// the fallback tick only knows about full waits
+	if(idx==0)tick_ms+=time;
+	else loop_ready_input();
+}
+#else
+struct gui_watch{
+	bool used;
+	int fd;
+	gui_fd_cb cb;
+	void*data;
+};
+static struct gui_watch watches[GUI_WATCH_MAX];
+static int loop_efd=-1,loop_tfd=-1,loop_wfd=-1;
+
+static int loop_init(){
+	if(loop_efd>=0)return 0;
+	if((loop_efd=epoll_create1(EPOLL_CLOEXEC))<0)
+		return terlog_warn(-1,"epoll_create failed");
+	if(
+		(loop_tfd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC))<0||
+		(loop_wfd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC))<0||
+		epoll_ctl(loop_efd,EPOLL_CTL_ADD,loop_tfd,&(struct epoll_event){
+			.events=EPOLLIN,.data.ptr=&loop_tfd
+		})<0||
+		epoll_ctl(loop_efd,EPOLL_CTL_ADD,loop_wfd,&(struct epoll_event){
+			.events=EPOLLIN,.data.ptr=&loop_wfd
+		})<0
+	){
+		telog_warn("create main loop events failed");
+		if(loop_tfd>=0)close(loop_tfd);
+		if(loop_wfd>=0)close(loop_wfd);
+		close(loop_efd);
+		loop_efd=loop_tfd=loop_wfd=-1;
+		return -1;
+	}
+	return 0;
+}
+
+void gui_wakeup(){
+	uint64_t v=1;
+	if(loop_wfd>=0&&write(loop_wfd,&v,sizeof(v))<0&&errno!=EAGAIN)
+		telog_warn("wake up main loop failed");
+}
+
+int gui_watch_fd(int fd,gui_fd_cb cb,void*data){
+	if(fd<0)ERET(EINVAL);
+	if(loop_init()<0)return -1;
+	for(size_t i=0;i<ARRLEN(watches);i++){
+		struct gui_watch*w=&watches[i];
+		if(w->used)continue;
+		w->fd=fd,w->cb=cb,w->data=data;
+		if(epoll_ctl(loop_efd,EPOLL_CTL_ADD,fd,&(struct epoll_event){
+			.events=EPOLLIN,.data.ptr=w
+		})<0)return terlog_warn(-1,"watch fd %d failed",fd);
+		w->used=true;
+		return 0;
+	}
+	ERET(ENOSPC);
+}
+
+void gui_unwatch_fd(int fd){
+	for(size_t i=0;i<ARRLEN(watches);i++){
+		struct gui_watch*w=&watches[i];
+		if(!w->used||w->fd!=fd)continue;
+		epoll_ctl(loop_efd,EPOLL_CTL_DEL,fd,NULL);
+		memset(w,0,sizeof(struct gui_watch));
+	}
+}
+
+static void loop_wait(uint32_t time){
+	int r,timeout=-1;
+	uint64_t v;
+	bool input=false;
+	struct epoll_event evs[8];
+	struct itimerspec its;
+	if(loop_init()<0){
+		usleep(time*1000);
+		return;
+	}
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec=time/1000;
+	its.it_value.tv_nsec=(time%1000)*1000000;
+	if(timerfd_settime(loop_tfd,0,&its,NULL)<0)timeout=time;
+	if((r=epoll_wait(loop_efd,evs,ARRLEN(evs),timeout))<0)return;
+	for(int i=0;i<r;i++){
+		void*p=evs[i].data.ptr;
+		if(p==&loop_tfd){
+			if(read(loop_tfd,&v,sizeof(v))<0){}
+		}else if(p==&loop_wfd){
+			if(read(loop_wfd,&v,sizeof(v))<0){}
+			input=true;
+		}else{
+			struct gui_watch*w=p;
+			if(w->cb){
+				MUTEX_LOCK(gui_lock);
+				w->cb(w->fd,w->data);
+				MUTEX_UNLOCK(gui_lock);
+			}
+			input=true;
+		}
+	}
+	if(input)loop_ready_input();
+}
+#endif
+
+// decoded images and rendered glyphs come back from their files on demand
+static size_t gui_shrink(enum mem_pressure level,void*d __attribute__((unused))){
+	size_t r;
+	bool all=level>=MEM_PRESSURE_CRITICAL;
+	MUTEX_LOCK(gui_lock);
+	r=image_cache_trim(all);
+	#ifdef ENABLE_FREETYPE2
+	r+=lv_freetype_trim(all);
+	#endif
+	MUTEX_UNLOCK(gui_lock);
+	return r;
+}
+
 int gui_main(){
 	int64_t i=confd_get_integer("gui.image_cache_statistics",0);
 	if(i>0)lv_timer_create(image_cache_cb,i,NULL);
@@ -485,45 +725,51 @@ int gui_main(){
 	// kill the watchdog
 	gBS->SetWatchdogTimer(0,0,0,NULL);
 
-	lv_timer_create(
+	save_timer=lv_timer_create(
 		conf_save_cb,
 		confd_get_integer("confd.save_interval",10)*1000,
 		NULL
 	);
+	confd_watch("confd.save_interval",save_interval_cb,NULL);
+
+	// free pool watermark, caches trim before allocations fail
+	mem_set_watermark(confd_get_integer("gui.mem_watermark",0x1000000));
+	lv_timer_create(mem_check_cb,1000,NULL);
 
 	#else
 	sem_init(&gui_wait,0,0);
 	handle_signals((int[]){SIGINT,SIGQUIT,SIGTERM},3,gui_quit_handler);
+	metrics_serve("gui");
+	mem_monitor_start();
 	#endif
+	mem_shrinker_add("gui caches",MEM_PRIO_CACHE,gui_shrink,NULL);
 	bool cansleep=guidrv_can_sleep();
 	if(!cansleep)tlog_notice("gui driver disabled sleep");
-	if(!confd_get_boolean("gui.can_sleep",true)){
+	if(!(conf_can_sleep=confd_get_boolean("gui.can_sleep",true)))
 		tlog_notice("config disabled sleep");
-		cansleep=false;
-	}
+	int watch=confd_watch("gui.can_sleep",can_sleep_cb,NULL);
 	#ifdef ENABLE_LUA
 	if(gui_global_lua)
 		xlua_run_confd(gui_global_lua,TAG,"lua.on_gui_pre_main");
 	#endif
+	#ifndef ENABLE_UEFI
+	// first screen is up, ends the boot readahead recording
+	confd_set_boolean("runtime.boot.ready",true);
+	#endif
 	uint32_t time=30;
 	while(gui_run){
 		// 10 seconds inactive sleep
-		if(lv_disp_get_inactive_time(NULL)<10000||!cansleep){
+		if(lv_disp_get_inactive_time(NULL)<10000||!cansleep||!conf_can_sleep){
 			MUTEX_LOCK(gui_lock);
 			time=lv_task_handler();
 			guidrv_taskhandler();
 			MUTEX_UNLOCK(gui_lock);
 		}else gui_enter_sleep();
-		if(time>0){
-			#ifdef ENABLE_UEFI
-			tick_ms+=time;
-			gBS->Stall(EFI_TIMER_PERIOD_MILLISECONDS(time));
-			#else
-			usleep(time*1000);
-			#endif
-		}
+		if(time==LV_NO_TIMER_READY)time=LV_DISP_DEF_REFR_PERIOD;
+		if(time>0)loop_wait(time);
 	}
 	tlog_notice("exiting");
+	confd_unwatch(watch);
 
 	gui_do_quit();
 	#ifdef ENABLE_UEFI
@@ -1,11 +1,18 @@
 #ifdef ENABLE_GUI
 #define _GNU_SOURCE
+#include<stdio.h>
 #include<unistd.h>
 #include<stdlib.h>
+#ifdef ENABLE_JSONC
+#include<json.h>
+#endif
 #include"gui.h"
+#include"getopt.h"
 #include"logger.h"
+#include"output.h"
 #include"pathnames.h"
 #include"gui/sysbar.h"
+#include"gui/perf.h"
 #include"gui/guidrv.h"
 #include"gui/activity.h"
 #undef time
@@ -27,6 +34,7 @@
 #define SHADOW_OFS_X_LARGE   LV_MAX(LV_DPI/10,5)
 #define SHADOW_OFS_Y_LARGE   LV_MAX(LV_DPI/10,5)
 #define SHADOW_SPREAD_LARGE  LV_MAX(LV_DPI/30,2)
+#define SHADOW_WIDTH_BLUR    LV_MAX(LV_DPI/2, 20)
 #define IMG_WIDTH            100
 #define IMG_HEIGHT           100
 #define IMG_NUM              LV_MAX((int)(gui_sw*gui_sh)/5/IMG_WIDTH/IMG_HEIGHT,1)
@@ -45,10 +53,12 @@ typedef struct{
 	uint32_t time_sum_normal,time_sum_opa;
 	uint32_t refr_cnt_normal,refr_cnt_opa;
 	uint32_t fps_normal,fps_opa;
+	struct gui_perf perf_normal,perf_opa;
 	uint8_t weight;
 }scene_dsc_t;
 static lv_obj_t*screen;
-static bool run=false;
+static bool run=false,finished=false,scripted=false;
+static const char*json_out=NULL;
 static lv_style_t style_common;
 static bool opa_mode=true;
 static int32_t scene_act=-1;
@@ -282,6 +292,14 @@ static void shadow_large_ofs_cb(void){
 	lv_style_set_shadow_spread(&style_common,SHADOW_SPREAD_LARGE);
 	rect_create(&style_common);
 }
+static void blur_cb(void){
+	lv_style_reset(&style_common);
+	lv_style_set_radius(&style_common,RADIUS);
+	lv_style_set_bg_opa(&style_common,opa_mode?LV_OPA_50:LV_OPA_COVER);
+	lv_style_set_shadow_opa(&style_common,opa_mode?LV_OPA_50:LV_OPA_COVER);
+	lv_style_set_shadow_width(&style_common,SHADOW_WIDTH_BLUR);
+	rect_create(&style_common);
+}
 static void img_rgb_cb(void){
 	lv_style_reset(&style_common);
 	lv_style_set_img_opa(&style_common,opa_mode?LV_OPA_50:LV_OPA_COVER);
@@ -457,6 +475,7 @@ static scene_dsc_t scenes[]={
 	{.name="Shadow small offset",		 .weight=5, .create_cb=shadow_small_ofs_cb},
 	{.name="Shadow large",			 .weight=5, .create_cb=shadow_large_cb},
 	{.name="Shadow large offset",		 .weight=3, .create_cb=shadow_large_ofs_cb},
+	{.name="Blur",				 .weight=3, .create_cb=blur_cb},
 	{.name="Image RGB",			 .weight=20,.create_cb=img_rgb_cb},
 	{.name="Image ARGB",			 .weight=20,.create_cb=img_argb_cb},
 	{.name="Image chorma keyed",		 .weight=5, .create_cb=img_ckey_cb},
@@ -501,9 +520,53 @@ static void result_out(bool opa){
 		name,opa?" + opa":"",fps
 	);
 }
+static void json_perf(FILE*f,const char*key,uint32_t fps,struct gui_perf*p){
+	fprintf(
+		f,"\"%s\":{\"fps\":%u,\"frames\":%u,"
+		"\"render_avg_us\":%u,\"render_max_us\":%u,"
+		"\"flush_avg_us\":%u,\"flush_max_us\":%u,"
+		"\"area_avg_px\":%u}",
+		key,fps,p->frames,
+		gui_perf_avg(p->render),p->render.max,
+		gui_perf_avg(p->flush),p->flush.max,
+		gui_perf_avg(p->area)
+	);
+}
+
+// results for comparing runs, scene names need no escaping
+static void result_json(uint32_t fps_weighted,uint32_t opa_speed_pct){
+	FILE*f;
+	bool out=strcmp(json_out,"-")==0;
+	if(!(f=out?stdout:fopen(json_out,"w"))){
+		telog_error("open %s failed",json_out);
+		return;
+	}
+	fprintf(
+		f,"{\"driver\":\"%s\",\"width\":%d,\"height\":%d,"
+		"\"weighted_fps\":%u,\"opa_speed_pct\":%u,\"scenes\":[",
+		guidrv_getname(),(int)gui_sw,(int)gui_sh,
+		fps_weighted,opa_speed_pct
+	);
+	for(size_t i=0;scenes[i].create_cb;i++){
+		fprintf(f,"%s{\"name\":\"%s\",\"weight\":%u,",i>0?",":"",scenes[i].name,scenes[i].weight);
+		json_perf(f,"normal",scenes[i].fps_normal,&scenes[i].perf_normal);
+		fputc(',',f);
+		json_perf(f,"opa",scenes[i].fps_opa,&scenes[i].perf_opa);
+		fputc('}',f);
+	}
+	fprintf(f,"]}\n");
+	if(out)fflush(f);
+	else fclose(f);
+	tlog_info("results saved to %s",json_out);
+}
 static void scene_next_task_cb(lv_timer_t*timer __attribute__((unused))){
 	if(!run)return;
 	lv_disp_trig_activity(NULL);
+	if(scene_act<0)gui_perf_collect(NULL);
+	else if(scenes[scene_act].create_cb)gui_perf_collect(opa_mode?
+		&scenes[scene_act].perf_opa:
+		&scenes[scene_act].perf_normal
+	);
 	lv_obj_clean(scene_bg);
 	if(opa_mode){
 		if(scene_act>=0){
@@ -561,6 +624,11 @@ static void scene_next_task_cb(lv_timer_t*timer __attribute__((unused))){
 		uint32_t fps_opa_unweighted=fps_opa_sum/weight_opa_sum;
 		if(fps_opa_unweighted<=0)fps_opa_unweighted=1;
 		uint32_t opa_speed_pct=(fps_opa_unweighted*100)/fps_normal_unweighted;
+		if(json_out){
+			result_json(fps_weighted,opa_speed_pct);
+			finished=true;
+			return;
+		}
 		lv_obj_clean(screen);
 		sysbar_set_full_screen(false);
 		lv_obj_update_layout(screen);
@@ -625,6 +693,7 @@ static void monitor_cb(
 	uint32_t time,
 	uint32_t px __attribute__((unused))
 ){
+	if(!run||scene_act<0)return;
 	if(opa_mode){
 		scenes[scene_act].refr_cnt_opa++;
 		scenes[scene_act].time_sum_opa+=time;
@@ -636,7 +705,6 @@ static void monitor_cb(
 
 static void benchmark_draw(lv_obj_t*scr){
 	screen=scr;
-	lv_disp_get_next(NULL)->driver->monitor_cb=monitor_cb;
 	lv_obj_set_style_pad_all(scr,0,0);
 	lv_obj_set_flex_flow(scr,LV_FLEX_FLOW_COLUMN);
 	lv_obj_set_style_bg_opa(scr,LV_OPA_COVER,0);
@@ -650,35 +718,346 @@ static void benchmark_draw(lv_obj_t*scr){
 	lv_obj_set_width(scene_bg,lv_pct(100));
 	lv_style_init(&style_common);
 	lv_obj_update_layout(scr);
-	scene_next_task_cb(NULL);
+	if(run)scene_next_task_cb(NULL);
+}
+
+#ifdef ENABLE_JSONC
+/*
+ * scripted runs use a fixed tick that moves one frame per loop, so the
+ * animations give the same frames on every run and every driver. an
+ * item is a scene or an activity kept for a number of loops, activities
+ * are invalidated every loop to draw them in full. the times of every
+ * drawn frame of an item are kept for the percentiles.
+ */
+#define SCRIPT_FRAME_MS 16
+#define SCRIPT_FRAMES   120
+
+extern struct gui_register guireg_benchmark;
+
+struct script_dist{
+	uint32_t p50,p90,p99,max,avg;
+};
+
+struct script_item{
+	char name[64];
+	int32_t scene;
+	bool activity,opa;
+	uint32_t loops,drawn;
+	uint64_t area;
+	struct script_dist render,flush;
+};
+
+struct script{
+	struct script_item*items;
+	size_t cnt,cur;
+	uint32_t loop;
+	bool started;
+	uint32_t*render,*flush;
+	size_t samples,size;
+};
+
+static struct script*script=NULL;
+
+static void script_frame(uint32_t render,uint32_t flush,uint32_t area){
+	struct script_item*it;
+	if(!script||!script->started)return;
+	it=&script->items[script->cur];
+	it->drawn++,it->area+=area;
+	if(script->samples>=script->size)return;
+	script->render[script->samples]=render;
+	script->flush[script->samples]=flush;
+	script->samples++;
+}
+
+static int u32_cmp(const void*a,const void*b){
+	uint32_t x=*(const uint32_t*)a,y=*(const uint32_t*)b;
+	return x<y?-1:x>y?1:0;
+}
+
+static void script_dist(struct script_dist*d,uint32_t*v,size_t cnt){
+	uint64_t sum=0;
+	memset(d,0,sizeof(struct script_dist));
+	if(cnt<=0)return;
+	qsort(v,cnt,sizeof(uint32_t),u32_cmp);
+	for(size_t i=0;i<cnt;i++)sum+=v[i];
+	d->p50=v[(cnt-1)*50/100];
+	d->p90=v[(cnt-1)*90/100];
+	d->p99=v[(cnt-1)*99/100];
+	d->max=v[cnt-1];
+	d->avg=sum/cnt;
+}
+
+static int32_t find_scene(const char*name){
+	for(int32_t i=0;scenes[i].create_cb;i++)
+		if(strcasecmp(scenes[i].name,name)==0)return i;
+	return -1;
+}
+
+// an item is a scene name, or an object with scene or activity
+static bool script_add(struct script*sc,json_object*jo,uint32_t loops){
+	json_object*v;
+	const char*name=NULL;
+	struct script_item*it=&sc->items[sc->cnt];
+	memset(it,0,sizeof(struct script_item));
+	it->scene=-1,it->loops=loops;
+	if(json_object_is_type(jo,json_type_string))
+		name=json_object_get_string(jo);
+	else if(json_object_is_type(jo,json_type_object)){
+		if(json_object_object_get_ex(jo,"scene",&v))
+			name=json_object_get_string(v);
+		else if(json_object_object_get_ex(jo,"activity",&v))
+			name=json_object_get_string(v),it->activity=true;
+		if(json_object_object_get_ex(jo,"opa",&v))
+			it->opa=json_object_get_boolean(v);
+		if(json_object_object_get_ex(jo,"frames",&v))
+			it->loops=json_object_get_int(v);
+	}
+	if(!name)return trlog_warn(false,"invalid benchmark item");
+	if(it->loops<=0)return trlog_warn(false,"invalid frames of %s",name);
+	if(it->activity){
+		if(!guiact_find_register((char*)name))
+			return trlog_warn(false,"activity %s not found",name);
+		snprintf(it->name,sizeof(it->name),"%s",name);
+	}else{
+		if((it->scene=find_scene(name))<0)
+			return trlog_warn(false,"scene %s not found",name);
+		snprintf(
+			it->name,sizeof(it->name),"%s%s",
+			scenes[it->scene].name,it->opa?" + opa":""
+		);
+	}
+	sc->cnt++;
+	return true;
 }
 
-int benchmark_main(int argc __attribute__((unused)),char**argv __attribute__((unused))){
+// without a scenes list every scene runs without and with opa
+static struct script*script_load(const char*file,const char**output){
+	size_t cnt;
+	json_object*jo,*v,*list=NULL;
+	uint32_t loops=SCRIPT_FRAMES;
+	struct script*sc=NULL;
+	if(!(jo=json_object_from_file(file)))
+		EDONE(tlog_error("load %s failed: %s",file,json_util_get_last_err()));
+	if(json_object_object_get_ex(jo,"frames",&v))loops=json_object_get_int(v);
+	if(!*output&&json_object_object_get_ex(jo,"output",&v))
+		*output=strdup(json_object_get_string(v));
+	if(json_object_object_get_ex(jo,"scenes",&list)&&!json_object_is_type(list,json_type_array))
+		EDONE(tlog_error("scenes of %s is not an array",file));
+	if(list)cnt=json_object_array_length(list);
+	else for(cnt=0;scenes[cnt].create_cb;cnt++);
+	if(!list)cnt*=2;
+	if(!(sc=malloc(sizeof(struct script))))goto done;
+	memset(sc,0,sizeof(struct script));
+	if(cnt<=0||!(sc->items=malloc(sizeof(struct script_item)*cnt)))
+		EDONE(tlog_error("no benchmark items"));
+	for(size_t i=0;i<cnt;i++){
+		bool r;
+		if(list)r=script_add(sc,json_object_array_get_idx(list,i),loops);
+		else{
+			v=json_object_new_object();
+			json_object_object_add(v,"scene",json_object_new_string(scenes[i/2].name));
+			json_object_object_add(v,"opa",json_object_new_boolean(i%2));
+			r=script_add(sc,v,loops);
+			json_object_put(v);
+		}
+		if(!r)goto done;
+	}
+	json_object_put(jo);
+	return sc;
+	done:
+	if(jo)json_object_put(jo);
+	if(sc){
+		if(sc->items)free(sc->items);
+		free(sc);
+	}
+	return NULL;
+}
+
+static void script_begin(struct script*sc,struct script_item*it){
+	size_t size=it->loops+8;
+	if(size>sc->size){
+		uint32_t*r=realloc(sc->render,sizeof(uint32_t)*size);
+		if(r)sc->render=r;
+		uint32_t*f=realloc(sc->flush,sizeof(uint32_t)*size);
+		if(f)sc->flush=f;
+		if(r&&f)sc->size=size;
+	}
+	sc->samples=0,sc->loop=0;
+	lv_label_set_text_fmt(title,"%zu/%zu: %s",sc->cur+1,sc->cnt,it->name);
+	lv_label_set_text(subtitle,"");
+	tlog_debug("benchmark %s",it->name);
+	if(it->activity)guiact_start_activity_by_name(it->name,NULL);
+	else{
+		lv_obj_clean(scene_bg);
+		opa_mode=it->opa;
+		rnd_reset();
+		scenes[it->scene].create_cb();
+	}
+	sc->started=true;
+}
+
+static void script_end(struct script*sc,struct script_item*it){
+	sc->started=false;
+	if(it->activity)guiact_remove_last(true);
+	else lv_obj_clean(scene_bg);
+	script_dist(&it->render,sc->render,sc->samples);
+	script_dist(&it->flush,sc->flush,sc->samples);
+	tlog_info(
+		"result of \"%s\": %u frames, render p50 %uus p99 %uus, flush p50 %uus p99 %uus",
+		it->name,it->drawn,it->render.p50,it->render.p99,it->flush.p50,it->flush.p99
+	);
+}
+
+static void script_step(struct script*sc){
+	struct script_item*it;
+	if(!screen)return;
+	if(sc->cur>=sc->cnt){
+		finished=true;
+		return;
+	}
+	it=&sc->items[sc->cur];
+	if(!sc->started)script_begin(sc,it);
+	else if(sc->loop++<it->loops){
+		if(it->activity)lv_obj_invalidate(lv_scr_act());
+	}else{
+		script_end(sc,it);
+		sc->cur++;
+	}
+}
+
+static json_object*dist_json(struct script_dist*d){
+	json_object*jo=json_object_new_object();
+	json_object_object_add(jo,"p50",json_object_new_int64(d->p50));
+	json_object_object_add(jo,"p90",json_object_new_int64(d->p90));
+	json_object_object_add(jo,"p99",json_object_new_int64(d->p99));
+	json_object_object_add(jo,"max",json_object_new_int64(d->max));
+	json_object_object_add(jo,"avg",json_object_new_int64(d->avg));
+	return jo;
+}
+
+static int script_save(struct script*sc,const char*output){
+	int r=0;
+	const char*str;
+	json_object*jo,*arr,*item;
+	jo=json_object_new_object();
+	arr=json_object_new_array();
+	json_object_object_add(jo,"driver",json_object_new_string(guidrv_getname()));
+	json_object_object_add(jo,"width",json_object_new_int(gui_sw));
+	json_object_object_add(jo,"height",json_object_new_int(gui_sh));
+	json_object_object_add(jo,"frame_ms",json_object_new_int(SCRIPT_FRAME_MS));
+	for(size_t i=0;i<sc->cnt;i++){
+		struct script_item*it=&sc->items[i];
+		item=json_object_new_object();
+		json_object_object_add(item,"name",json_object_new_string(it->name));
+		json_object_object_add(item,"type",json_object_new_string(it->activity?"activity":"scene"));
+		json_object_object_add(item,"loops",json_object_new_int64(it->loops));
+		json_object_object_add(item,"frames",json_object_new_int64(it->drawn));
+		json_object_object_add(item,"render_us",dist_json(&it->render));
+		json_object_object_add(item,"flush_us",dist_json(&it->flush));
+		json_object_object_add(item,"area_avg_px",json_object_new_int64(
+			it->drawn>0?it->area/it->drawn:0
+		));
+		json_object_array_add(arr,item);
+	}
+	json_object_object_add(jo,"scenes",arr);
+	if(!output||strcmp(output,"-")==0){
+		str=json_object_to_json_string_ext(jo,JSON_C_TO_STRING_PRETTY);
+		printf("%s\n",str);
+		fflush(stdout);
+	}else if(json_object_to_file_ext((char*)output,jo,JSON_C_TO_STRING_PRETTY)<0){
+		tlog_error("save %s failed: %s",output,json_util_get_last_err());
+		r=-1;
+	}else tlog_info("results saved to %s",output);
+	json_object_put(jo);
+	return r;
+}
+
+static int script_main(const char*file,const char*output){
+	int r;
+	if(!(script=script_load(file,&output)))return 1;
+	scripted=true;
+	sysbar_draw(lv_scr_act());
+	gui_perf_set_frame_hook(script_frame);
+	gui_set_fixed_tick(true);
+	if(guiact_start_activity(&guireg_benchmark,NULL)<0)return 1;
+	while(!finished){
+		gui_advance_tick(SCRIPT_FRAME_MS);
+		script_step(script);
+		lv_task_handler();
+		guidrv_taskhandler();
+	}
+	gui_set_fixed_tick(false);
+	gui_perf_set_frame_hook(NULL);
+	r=script_save(script,output);
+	guidrv_exit();
+	return r==0?0:1;
+}
+#endif
+
+static int usage(int e){
+	return return_printf(
+		e,e==0?STDOUT_FILENO:STDERR_FILENO,
+		"Usage: benchmark [OPTION]...\n"
+		"Run GUI Benchmark.\n\n"
+		"Options:\n"
+		"\t-o, --output <FILE>    Exit after all scenes and write results as JSON to FILE (- for stdout)\n"
+		"\t-s, --scenes <FILE>    Run the scenes and activities listed in JSON FILE with a fixed tick\n"
+		"\t-d, --driver <DRIVER>  Use gui driver DRIVER (e.g. dummy)\n"
+		"\t-h, --help             Display this help and exit\n"
+	);
+}
+
+int benchmark_main(int argc,char**argv){
+	static const struct option lo[]={
+		{"help",    no_argument,       NULL,'h'},
+		{"output",  required_argument, NULL,'o'},
+		{"scenes",  required_argument, NULL,'s'},
+		{"driver",  required_argument, NULL,'d'},
+		{NULL,0,NULL,0}
+	};
+	int o;
+	const char*file=NULL;
+	while((o=b_getlopt(argc,argv,"ho:s:d:",lo,NULL))>0)switch(o){
+		case 'h':return usage(0);
+		case 'o':json_out=b_optarg;break;
+		case 's':file=b_optarg;break;
+		case 'd':setenv("GUIDRV",b_optarg,1);break;
+		default:return 1;
+	}
+	#ifndef ENABLE_JSONC
+	if(file)return re_printf(1,"scenes file needs json-c support\n");
+	#endif
 	open_socket_logfd_default();
-	gui_pre_init();
-	gui_screen_init();
+	if(gui_pre_init()<0||gui_screen_init()<0)return 1;
+	#ifdef ENABLE_JSONC
+	if(file)return script_main(file,json_out);
+	#endif
+	if(gui_perf_set_monitor(monitor_cb)<0)return 1;
 	run=true;
 	benchmark_draw(lv_scr_act());
-	for(;;){
+	while(!finished){
 		lv_task_handler();
 		guidrv_taskhandler();
 		usleep(30000);
 	}
+	gui_perf_set_monitor(NULL);
+	guidrv_exit();
+	return 0;
 }
 
 static int benchmark_cleanup(struct gui_activity*act __attribute__((unused))){
-	lv_disp_get_next(NULL)->driver->monitor_cb=NULL;
+	gui_perf_set_monitor(NULL);
 	scene_act=-1,run=false,opa_mode=true;
 	return 0;
 }
 
 static int benchmark_init(struct gui_activity*act __attribute__((unused))){
-	return (lv_disp_get_next(NULL)->driver->monitor_cb)?-1:0;
+	return gui_perf_set_monitor(monitor_cb);
 }
 
 static int benchmark_wrapper_draw(struct gui_activity*act){
 	rnd_reset();
-	run=true;
+	run=!scripted;
 	benchmark_draw(act->page);
 	return 0;
 }
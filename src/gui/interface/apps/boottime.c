@@ -0,0 +1,57 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_GUI
+#ifdef ENABLE_UEFI
+#include<Uefi.h>
+#include"gui.h"
+#include"uefi.h"
+#include"gui/activity.h"
+
+static void add_row(lv_obj_t*tbl,uint16_t row,const char*name,UINT64 us,UINT64 prev){
+	char buf[64];
+	unsigned long long t=us,d=us-prev;
+	lv_table_set_cell_value(tbl,row,0,name);
+	lv_snprintf(buf,sizeof(buf),"%llu.%03llu",t/1000000,(t/1000)%1000);
+	lv_table_set_cell_value(tbl,row,1,buf);
+	lv_snprintf(buf,sizeof(buf),"+%llu",d/1000);
+	lv_table_set_cell_value(tbl,row,2,buf);
+}
+
+static int boottime_draw(struct gui_activity*act){
+	UINT64 us=0,prev=0;
+	const char*name;
+	lv_obj_t*tbl=lv_table_create(act->page);
+	lv_coord_t w=lv_obj_get_content_width(act->page);
+	lv_obj_set_size(tbl,lv_pct(100),lv_pct(100));
+	lv_table_set_col_cnt(tbl,3);
+	lv_table_set_col_width(tbl,0,w/2-3);
+	lv_table_set_col_width(tbl,1,w/4-3);
+	lv_table_set_col_width(tbl,2,w/4-3);
+	lv_table_set_cell_value(tbl,0,0,_("Phase"));
+	lv_table_set_cell_value(tbl,0,1,_("Time (s)"));
+	lv_table_set_cell_value(tbl,0,2,_("Took (ms)"));
+
+	// the gap before the first mark is spent in the firmware
+	for(UINTN i=0;(name=boottime_get(i,&us));i++){
+		add_row(tbl,i+1,name,us,prev);
+		prev=us;
+	}
+	return 0;
+}
+
+struct gui_register guireg_boottime={
+	.name="boot-time",
+	.title="Boot Time",
+	.show_app=true,
+	.draw=boottime_draw,
+	.back=true,
+	.mask=false,
+};
+#endif
+#endif
@@ -22,6 +22,9 @@
 struct log_viewer{
 	bool load;
 	list*file;
+	#ifndef ENABLE_UEFI
+	struct log_store*store;
+	#endif
 	uint16_t per_page,page_cnt,page_cur;
 	lv_obj_t*txt,*view,*content;
 	lv_obj_t*pager,*arr_top,*arr_left;
@@ -48,7 +51,12 @@ static void calc_pages(struct log_viewer*v){
 	if(p<=0)p=64;
 	v->per_page=confd_get_integer("gui.logviewer.per_page",p*3);
 	if(v->per_page<64)v->per_page=64;
-	if((cnt=list_count(v->file))>=0){
+	#ifndef ENABLE_UEFI
+	if(v->store)cnt=(int)MIN(log_store_count(v->store),INT_MAX);
+	else
+	#endif
+	cnt=list_count(v->file);
+	if(cnt>=0){
 		v->page_cnt=ceil((double)cnt/(double)v->per_page);
 		max=MIN(MAX(v->page_cnt-1,1),INT16_MAX);
 	}else max=1,v->page_cnt=0;
@@ -60,7 +68,8 @@ static void calc_pages(struct log_viewer*v){
 
 static bool load_file(struct log_viewer*v){
 	#ifdef ENABLE_UEFI
-	list*l=NULL;
+	struct log_cursor cur;
+	struct log_item*item=NULL;
 	#else
 	FILE*f=NULL;
 	size_t bs=0,len;
@@ -72,33 +81,42 @@ static bool load_file(struct log_viewer*v){
 		list_free_all_def(v->file);
 		v->file=NULL;
 	}
+	#ifndef ENABLE_UEFI
+	// binary store pages are read on demand, only fall back to the text log without it
+	if(v->store||(v->store=log_store_open(DEFAULT_LOG_STORE))){
+		v->load=true;
+		calc_pages(v);
+		return true;
+	}
+	#endif
 	if(!(xb=malloc(xs)))EDONE();
 	#ifdef ENABLE_UEFI
-	if((l=list_first(logbuffer)))do{
+	if(!(item=malloc(sizeof(struct log_item))))EDONE();
+	logger_buffer_cursor(&cur);
+	while(logger_buffer_read(&cur,item)){
 		bool changed=false;
-		LIST_DATA_DECLARE(b,l,struct log_buff*);
-		if(!b||!b->tag||!b->content)continue;
 		s=8;
-		if(b->tag[0])s+=strlen(b->tag);
-		if(b->content[0])s+=strlen(b->content);
+		if(item->tag[0])s+=strlen(item->tag);
+		if(item->content[0])s+=strlen(item->content);
 		if(s>xs){
 			xs=s,free(xb);
 			if(!(xb=malloc(xs)))EDONE();
 		}
 		memset(xb,0,xs);
-		if(b->tag[0]){
-			strlcat(xb,b->tag,xs-1);
+		if(item->tag[0]){
+			strlcat(xb,item->tag,xs-1);
 			strlcat(xb,": ",xs-1);
 			changed=true;
 		}
-		if(b->content[0]){
-			strlcat(xb,b->content,xs-1);
+		if(item->content[0]){
+			strlcat(xb,item->content,xs-1);
 			changed=true;
 		}
 		if(changed)list_obj_add_new_strdup(
 			&v->file,xb
 		);
-	}while((l=l->next));
+	}
+	free(item);
 	#else
 	if(!(f=fopen(_PATH_DEV"/logger.log","r")))
 		EDONE(telog_warn("open logger.log failed"));
@@ -135,6 +153,8 @@ static bool load_file(struct log_viewer*v){
 	done:
 	#ifndef ENABLE_UEFI
 	if(f)fclose(f);
+	#else
+	if(item)free(item);
 	#endif
 	if(xb)free(xb);
 	if(buff)free(buff);
@@ -143,6 +163,47 @@ static bool load_file(struct log_viewer*v){
 	return false;
 }
 
+#ifndef ENABLE_UEFI
+struct page_buff{
+	char*buff;
+	size_t len,size;
+};
+
+static int append_item(struct log_item*item,void*data){
+	char t[24]={0},*n;
+	struct page_buff*p=data;
+	size_t need=strlen(item->tag)+strlen(item->content)+64;
+	if(p->len+need>p->size){
+		size_t ns=MAX(p->size*2,p->len+need);
+		if(!(n=realloc(p->buff,ns)))return -1;
+		p->buff=n,p->size=ns;
+	}
+	p->len+=snprintf(
+		p->buff+p->len,p->size-p->len,
+		"[%s] <%s> %s[%d]: %s\n",
+		time2ndefstr(&item->time,t,sizeof(t)),
+		logger_level2string(item->level),
+		item->tag,item->pid,item->content
+	);
+	return 0;
+}
+
+static bool load_store_page(struct log_viewer*v){
+	struct page_buff p={0};
+	if(log_store_page(
+		v->store,v->page_cur-1,v->per_page,
+		append_item,&p
+	)<0){
+		if(p.buff)free(p.buff);
+		return false;
+	}
+	lv_obj_scroll_to(v->view,0,0,LV_ANIM_OFF);
+	lv_label_set_text(v->content,p.buff?p.buff:"");
+	if(p.buff)free(p.buff);
+	return true;
+}
+#endif
+
 static void load_log_task(void*data){
 	list*l=NULL;
 	char*buff=NULL;
@@ -152,6 +213,12 @@ static void load_log_task(void*data){
 	if(v->per_page<=0||v->page_cur<=0)goto fail;
 	if(v->page_cur>v->page_cnt)v->page_cur=v->page_cnt;
 	if(v->page_cur<1)v->page_cur=1;
+	#ifndef ENABLE_UEFI
+	if(v->store){
+		if(!load_store_page(v))goto fail;
+		return;
+	}
+	#endif
 	start=(v->page_cur-1)*v->per_page;
 	end=v->page_cur*v->per_page;
 	size=4,i=0;
@@ -256,6 +323,9 @@ static int do_clean(struct gui_activity*act){
 	struct log_viewer*v=act->data;
 	if(!v)return 0;
 	list_free_all_def(v->file);
+	#ifndef ENABLE_UEFI
+	if(v->store)log_store_close(v->store);
+	#endif
 	free(v);
 	act->data=NULL;
 	return 0;
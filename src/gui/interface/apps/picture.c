@@ -17,6 +17,7 @@
 #include"gui.h"
 #include"logger.h"
 #include"gui/tools.h"
+#include"gui/image.h"
 #include"gui/activity.h"
 #include"gui/sysbar.h"
 #include"gui/filepicker.h"
@@ -28,12 +29,10 @@ struct picture_viewer{
 	lv_obj_t*pad;
 };
 
-static void reload_image(struct picture_viewer*pv){
-	lv_obj_add_flag(pv->img,LV_OBJ_FLAG_HIDDEN);
-	lv_obj_add_flag(pv->info,LV_OBJ_FLAG_HIDDEN);
-	lv_img_set_src(pv->img,pv->path);
-	lv_img_t*e=(lv_img_t*)pv->img;
-	if(e->w<=0||e->h<=0){
+static void image_loaded(lv_obj_t*obj,bool ok,void*data){
+	struct picture_viewer*pv=data;
+	lv_img_t*e=(lv_img_t*)obj;
+	if(!ok||e->w<=0||e->h<=0){
 		lv_obj_clear_flag(pv->info,LV_OBJ_FLAG_HIDDEN);
 		lv_label_set_text(pv->info,_("Picture load failed"));
 		lv_obj_align_to(pv->info,NULL,LV_ALIGN_CENTER,0,0);
@@ -48,6 +47,13 @@ static void reload_image(struct picture_viewer*pv){
 	}else lv_obj_align_to(pv->img,NULL,LV_ALIGN_CENTER,0,0);
 }
 
+// pictures larger than the screen are shrunk to fit, decode near that size
+static void reload_image(struct picture_viewer*pv){
+	lv_obj_add_flag(pv->img,LV_OBJ_FLAG_HIDDEN);
+	lv_obj_add_flag(pv->info,LV_OBJ_FLAG_HIDDEN);
+	image_set_src_async(pv->img,pv->path,gui_sw,gui_sh,image_loaded,pv);
+}
+
 static void open_image(struct picture_viewer*pv,const char*path){
 	if(strcasecmp(pv->path,path)==0)return;
 	memset(pv->path,0,sizeof(pv->path));
@@ -9,7 +9,6 @@
 #ifdef ENABLE_GUI
 #define _GNU_SOURCE
 #include<stdlib.h>
-#include<pthread.h>
 #include"str.h"
 #include"gui.h"
 #include"defines.h"
@@ -19,8 +18,7 @@
 #include"gui/inputbox.h"
 #include"gui/activity.h"
 
-static volatile bool thread_run=false;
-static pthread_t run_t;
+static bool running=false;
 static lv_obj_t*view;
 static lv_obj_t*btn_prev,*btn_delete,*btn_next;
 static lv_obj_t*btn_create,*btn_clean,*btn_start;
@@ -199,6 +197,8 @@ static void clean_cb(lv_event_t*e __attribute__((unused))){
 }
 
 static int do_clean(struct gui_activity*act __attribute__((unused))){
+	if(running)vibrate_stop();
+	running=false;
 	clean_steps();
 	view=NULL;
 	MUTEX_DESTROY(lock);
@@ -237,52 +237,51 @@ static void move_cb(lv_event_t*e){
 	lv_obj_scroll_to_view(selected->btn,false);
 }
 
-static void*worker_thread(void*data  __attribute__((unused))){
-	for(;;){
-		MUTEX_LOCK(lock);
-		int i=0;
-		list*o=list_first(steps),*n;
-		if(o)do{
-			n=o->next;
-			LIST_DATA_DECLARE(d,o,struct vibrate_step*);
-			if(!d)continue;
-			enum vibrate_type type=d->type;
-			int time=d->time;
-			MUTEX_UNLOCK(lock);
-			i++;
-			if(!thread_run)return NULL;
-			switch(type){
-				case TYPE_VIBRATE:vibrate(time);break;
-				case TYPE_IDLE:usleep(time*1000);break;
-			}
-			MUTEX_UNLOCK(lock);
-		}while((o=n));
+// steps to durations alternating on and off, repeated steps get a zero gap
+static int*build_pattern(size_t*cnt){
+	int*pat;
+	size_t i=0;
+	list*o;
+	MUTEX_LOCK(lock);
+	if(!(pat=malloc((list_count(steps)*2+1)*sizeof(int)))){
 		MUTEX_UNLOCK(lock);
-		if(i<=0)break;
+		return NULL;
 	}
-	thread_run=false;
-	return NULL;
+	if((o=list_first(steps)))do{
+		LIST_DATA_DECLARE(d,o,struct vibrate_step*);
+		if(!d)continue;
+		if((d->type==TYPE_VIBRATE)!=(i%2==0))pat[i++]=0;
+		pat[i++]=d->time;
+	}while((o=o->next));
+	MUTEX_UNLOCK(lock);
+	*cnt=i;
+	return pat;
 }
 
 static void start_cb(lv_event_t*e __attribute__((unused))){
-	if(!thread_run){
-		if(list_count(steps)<=0){
-			msgbox_alert("No any steps configured");
-			return;
-		}
-		errno=0;
-		vibrate(10);
-		if(errno>0){
-			msgbox_alert("Call vibrator failed: %m");
-			return;
-		}
-		errno=0;
-		if(pthread_create(&run_t,NULL,worker_thread,NULL)!=0){
-			msgbox_alert("Create thread failed: %m");
-			return;
-		}
+	int*pat;
+	size_t cnt=0;
+	if(running){
+		vibrate_stop();
+		running=false;
+		return;
+	}
+	if(list_count(steps)<=0){
+		msgbox_alert("No any steps configured");
+		return;
+	}
+	if(vibrate(10)!=0){
+		msgbox_alert("Call vibrator failed: %m");
+		return;
+	}
+	if(!(pat=build_pattern(&cnt))){
+		msgbox_alert("Build vibrate pattern failed: %m");
+		return;
 	}
-	thread_run=!thread_run;
+	if(vibrate_pattern(pat,cnt,-1)!=0)
+		msgbox_alert("Start vibrate pattern failed: %m");
+	else running=true;
+	free(pat);
 }
 
 static int vibrator_draw(struct gui_activity*act){
@@ -383,6 +383,9 @@ int guiapp_main(int argc __attribute((unused)),char**argv __attribute((unused)))
 	#ifndef ENABLE_UEFI
 	open_socket_logfd_default();
 	open_default_confd_socket(false,TAG);
+	char*drop=confd_get_string("logger.async","new");
+	logger_set_async(logger_parse_drop(drop));
+	if(drop)free(drop);
 	open_socket_initfd(DEFAULT_INITD,false);
 	lang_init_locale();
 	prctl(PR_SET_NAME,"GUI Launcher");
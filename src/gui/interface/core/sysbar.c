@@ -12,13 +12,23 @@
 #include<stddef.h>
 #include<stdint.h>
 #include<stdbool.h>
+#ifndef ENABLE_UEFI
+#include<sys/socket.h>
+#include<linux/netlink.h>
+#endif
 #include"gui.h"
+#include"array.h"
+#include"logger.h"
 #include"hardware.h"
+#ifndef ENABLE_UEFI
+#include"uevent.h"
+#endif
 #include"gui/tools.h"
 #include"gui/sysbar.h"
 #include"gui/snackbar.h"
 #include"gui/activity.h"
 #include"gui/clipboard.h"
+#define TAG "sysbar"
 struct sysbar sysbar;
 
 static struct{
@@ -39,22 +49,30 @@ static struct{
 	{ false,NULL,NULL,NULL}
 };
 
-static void sysbar_thread(struct sysbar*b){
-	#ifndef ENABLE_UEFI
-	int bats[64];
-	int bat,lvl;
+/*
+ * the clock timer fires just after every minute boundary,
+ * power supply directories stay open between updates and
+ * are only scanned again when a power supply comes or goes,
+ * capacity is read again on power_supply change uevents and
+ * on every clock tick for drivers that never send them
+ */
+#ifndef ENABLE_UEFI
+static struct{
+	int fds[64];
+	bool scanned;
+	int uevent_fd;
+}power={.uevent_fd=-1};
+
+static void sysbar_update_battery(struct sysbar*b){
+	int lvl=-1;
 	char*sym=NULL;
-	#endif
-	char timestr[64];
-	time_t t=time(NULL);
-	struct tm*tt=localtime(&t);
-	memset(timestr,0,sizeof(timestr));
-	if(tt&&strftime(timestr,sizeof(timestr)-1,"%H:%M",tt)>0)
-		lv_label_set_text(b->top.content.time,timestr);
-	#ifndef ENABLE_UEFI
-	memset(bats,0,sizeof(bats));
-	bat=pwr_scan_device(bats,sizeof(bats)-1,true);
-	if(bat>=0&&(lvl=pwr_multi_get_capacity(bats))>=0){
+	if(!power.scanned){
+		pwr_close_device(power.fds);
+		memset(power.fds,0,sizeof(power.fds));
+		pwr_scan_device(power.fds,ARRLEN(power.fds)-1,true);
+		power.scanned=true;
+	}
+	if(power.fds[0]>0&&(lvl=pwr_multi_get_capacity(power.fds))>=0){
 		if(lvl<10)sym=LV_SYMBOL_BATTERY_EMPTY;
 		else if(lvl<25)sym=LV_SYMBOL_BATTERY_1;
 		else if(lvl<45)sym=LV_SYMBOL_BATTERY_2;
@@ -69,16 +87,92 @@ static void sysbar_thread(struct sysbar*b){
 		lv_obj_add_flag(b->top.content.level,LV_OBJ_FLAG_HIDDEN);
 		lv_obj_add_flag(b->top.content.battery,LV_OBJ_FLAG_HIDDEN);
 	}
-	pwr_close_device(bats);
+}
+
+static void uevent_recv(int fd,void*data){
+	ssize_t s;
+	uevent event;
+	bool update=false;
+	char buf[8192],*v;
+	while((s=recv(fd,buf,sizeof(buf)-1,MSG_DONTWAIT))>0){
+		buf[s]=0;
+		for(ssize_t x=0;x<s;x++)if(buf[x]==0)buf[x]='\n';
+		if(!(v=strchr(buf,'\n')))continue;
+		if(!uevent_parse(v+1,&event))continue;
+		if(!event.subsystem||strcmp(event.subsystem,"power_supply")!=0)continue;
+		switch(event.action){
+			case ACTION_ADD:
+			case ACTION_REMOVE:power.scanned=false;//fallthrough
+			case ACTION_CHANGE:update=true;break;
+			default:break;
+		}
+	}
+	if(update&&sysbar.content)sysbar_update_battery(data);
+}
+
+static void uevent_start(struct sysbar*b){
+	struct sockaddr_nl n={
+		.nl_family=AF_NETLINK,
+		.nl_groups=1
+	};
+	if(power.uevent_fd>=0)return;
+	if((power.uevent_fd=socket(
+		AF_NETLINK,
+		SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT
+	))<0){
+		telog_warn("cannot create uevent socket");
+		return;
+	}
+	if(
+		bind(power.uevent_fd,(struct sockaddr*)&n,sizeof(n))<0||
+		gui_watch_fd(power.uevent_fd,uevent_recv,b)<0
+	){
+		telog_warn("cannot listen power supply uevents");
+		close(power.uevent_fd);
+		power.uevent_fd=-1;
+	}
+}
+
+static void uevent_stop(void){
+	if(power.uevent_fd>=0){
+		gui_unwatch_fd(power.uevent_fd);
+		close(power.uevent_fd);
+		power.uevent_fd=-1;
+	}
+	pwr_close_device(power.fds);
+	power.scanned=false;
+}
+#endif
+
+// returns milliseconds until the next minute starts
+static uint32_t sysbar_update_time(struct sysbar*b){
+	char timestr[64];
+	time_t t=time(NULL);
+	struct tm*tt=localtime(&t);
+	memset(timestr,0,sizeof(timestr));
+	if(tt&&strftime(timestr,sizeof(timestr)-1,"%H:%M",tt)>0)
+		lv_label_set_text(b->top.content.time,timestr);
+	return tt?(60-MIN(tt->tm_sec,59))*1000:5000;
+}
+
+static uint32_t sysbar_thread(struct sysbar*b){
+	uint32_t next=sysbar_update_time(b);
+	#ifndef ENABLE_UEFI
+	sysbar_update_battery(b);
 	#endif
+	return next;
 }
 
 static void sysbar_thread_cb(lv_timer_t*a){
 	if(!sysbar.content){
+		#ifndef ENABLE_UEFI
+		uevent_stop();
+		#endif
 		lv_timer_del(a);
 		return;
 	}
-	sysbar_thread((struct sysbar*)a->user_data);
+	lv_timer_set_period(a,sysbar_thread((struct sysbar*)a->user_data));
 }
 
 static void set_bar_style(lv_obj_t*obj,uint8_t part){
@@ -404,7 +498,10 @@ int sysbar_draw(lv_obj_t*scr){
 
 	sysbar_draw_top();
 	sysbar_draw_bottom();
-	sysbar_thread(&sysbar);
+	uint32_t next=sysbar_thread(&sysbar);
+	#ifndef ENABLE_UEFI
+	uevent_start(&sysbar);
+	#endif
 
 	lv_coord_t bs=gui_font_size*3;
 	lv_coord_t bm=gui_font_size*4;
@@ -459,7 +556,7 @@ int sysbar_draw(lv_obj_t*scr){
 	ctrl_pad_draw();
 	snackbar_draw(sysbar.screen,sysbar.size,sysbar.size/2*3);
 
-	lv_timer_create(sysbar_thread_cb,5000,&sysbar);
+	lv_timer_create(sysbar_thread_cb,next,&sysbar);
 	return 0;
 }
 
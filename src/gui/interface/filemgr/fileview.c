@@ -25,23 +25,31 @@
 #endif
 #include"gui.h"
 #include"str.h"
-#include"list.h"
 #include"confd.h"
 #include"logger.h"
 #include"system.h"
 #include"filesystem.h"
 #include"gui/tools.h"
+#include"gui/vlist.h"
 #include"gui/fileview.h"
 #define TAG "fileview"
 
+/*
+ * a folder is read into a flat array of small entries, only the name
+ * and the shown attributes are kept. rows on screen come from a vlist
+ * and are filled from the array when they scroll into view, so large
+ * folders cost one entry per file and a screen of objects.
+ */
 static lv_label_long_mode_t lm;
 
 struct fileview{
 	lv_obj_t*view,*info;
-	list*items;
+	struct fileitem*items;
+	size_t count,size;
 	bool hidden,parent,verbose,check_mode;
-	int count;
 	lv_group_t*grp;
+	struct vlist*list;
+	lv_coord_t grid_col[4];
 	fileview_on_item_select on_select_item;
 	fileview_on_item_click on_click_item;
 	fileview_on_change_dir on_change_dir;
@@ -52,13 +60,31 @@ struct fileview{
 
 struct fileitem{
 	struct fileview*view;
-	lv_obj_t*btn,*fn,*w_img,*img;
-	lv_obj_t*size,*info1,*info2;
 	fs_type type;
-	fs_file_info file;
+	bool checked;
+	char*name,*target;
+	size_t size;
+	time_t mtime;
+	mode_t mode;
+	uid_t owner;
+	gid_t group;
+	dev_t device;
+	fs_feature features;
 	fsvol_info*vol;
 };
 
+struct filerow{
+	lv_obj_t*btn,*fn,*w_img,*img;
+	lv_obj_t*size,*info1,*info2;
+};
+
+static lv_coord_t grid_row[]={
+	LV_GRID_FR(1),
+	LV_GRID_FR(1),
+	LV_GRID_FR(1),
+	LV_GRID_TEMPLATE_LAST
+};
+
 static const char*get_icon(struct fileitem*fi){
 	if(fs_has_type(fi->type,FS_TYPE_PARENT))return "@mime-inode-parent";
 	if(fs_has_type(fi->type,FS_TYPE_VOLUME))return "@mime-inode-disk";
@@ -87,7 +113,7 @@ static bool call_on_click_item(struct fileitem*fi){
 	char*name;
 	if(!fi->view||!fi->view->on_click_item)return true;
 	if(fs_has_type(fi->type,FS_TYPE_PARENT))name="..";
-	else if(fs_has_type(fi->type,FS_TYPE_FILE))name=fi->file.name;
+	else if(fs_has_type(fi->type,FS_TYPE_FILE))name=fi->name;
 	else if(fs_has_type(fi->type,FS_TYPE_VOLUME))name=fi->vol->name;
 	else return true;
 	return fi->view->on_click_item(fi->view,name,fi->type);
@@ -126,19 +152,18 @@ void fileview_go_back(struct fileview*fv){
 }
 
 static void check_item(struct fileitem*fi,bool checked){
-	if(!fi||!fi->view||!fi->btn)return;
+	struct fileview*fv;
+	if(!fi||!(fv=fi->view))return;
 	if(fs_has_type(fi->type,FS_TYPE_PARENT)){
-		fileview_go_back(fi->view);
-		return;
-	}
-	if(fs_has_type(fi->type,FS_TYPE_VOLUME)){
-		lv_obj_set_checked(fi->btn,false);
+		fileview_go_back(fv);
 		return;
 	}
-	lv_obj_set_checked(fi->btn,checked);
+	fi->checked=checked&&!fs_has_type(fi->type,FS_TYPE_VOLUME);
+	vlist_refresh_item(fv->list,fi-fv->items);
+	if(fs_has_type(fi->type,FS_TYPE_VOLUME))return;
 	call_on_select_item(
-		fi->view,fi->file.name,fi->type,checked,
-		fileview_get_checked_count(fi->view)
+		fv,fi->name,fi->type,checked,
+		fileview_get_checked_count(fv)
 	);
 }
 
@@ -160,14 +185,13 @@ static void click_item(struct fileitem*fi){
 	}else if(fs_has_type(fi->type,FS_TYPE_PARENT)){
 		fileview_go_back(fv);
 	}else if(fs_has_type(fi->type,FS_TYPE_FILE)){
-		if(fileview_get_checked_count(fi->view)>0){
-			if(fs_has_type(fi->type,FS_TYPE_FILE))
-				check_item(fi,!lv_obj_is_checked(fi->btn));
+		if(fileview_get_checked_count(fv)>0){
+			check_item(fi,!fi->checked);
 			return;
 		}
 		if(!call_on_click_item(fi))return;
 		if(fs_has_type(fi->type,FS_TYPE_FILE_FOLDER)){
-			if((r=fs_open_with(&nf,&fi->file,FILE_FLAG_FOLDER))!=0){
+			if((r=fs_open(fv->folder,&nf,fi->name,FILE_FLAG_FOLDER))!=0){
 				tlog_warn("open folder failed: %s",strerror(r));
 				return;
 			}
@@ -184,126 +208,116 @@ static void click_item(struct fileitem*fi){
 	}
 }
 
+static struct fileitem*get_row_item(lv_event_t*e){
+	ssize_t idx;
+	struct fileview*fv=e->user_data;
+	if(!fv||(idx=vlist_get_row_index(fv->list,e->current_target))<0)return NULL;
+	return (size_t)idx<fv->count?&fv->items[idx]:NULL;
+}
+
 static void item_click(lv_event_t*e){
 	lv_indev_t*i=lv_indev_get_act();
 	if(i&&i->proc.long_pr_sent)return;
-	click_item(e->user_data);
+	click_item(get_row_item(e));
 }
 
 static void item_check(lv_event_t*e){
-	struct fileitem*fi=e->user_data;
-	if(!fi||!fi->btn)return;
+	struct fileitem*fi=get_row_item(e);
+	if(!fi)return;
 	e->stop_processing=1;
-	check_item(fi,!lv_obj_is_checked(fi->btn));
+	check_item(fi,!fi->checked);
 }
 
 static struct fileitem*get_item(struct fileview*view,const char*name){
-	list*l;
 	bool parent;
+	struct fileitem*fi;
 	if(!view||!name)return NULL;
 	parent=strcmp(name,"..")==0;
-	if((l=list_first(view->items)))do{
-		LIST_DATA_DECLARE(fi,l,struct fileitem*);
-		if(!fi||fi->view!=view)continue;
+	for(size_t i=0;i<view->count;i++){
+		fi=&view->items[i];
 		if(fs_has_type(fi->type,FS_TYPE_PARENT))
 			if(parent)return fi;
 		if(fs_has_type(fi->type,FS_TYPE_FILE))
-			if(strcmp(fi->file.name,name)==0)return fi;
+			if(strcmp(fi->name,name)==0)return fi;
 		if(fs_has_type(fi->type,FS_TYPE_VOLUME))
 			if(strcmp(fi->vol->name,name)==0)return fi;
-	}while((l=l->next));
+	}
 	return NULL;
 }
 
-static void draw_item_file_info(struct fileitem*fi){
+static void show_label(lv_obj_t*lbl,const char*text){
+	lv_label_set_text(lbl,text);
+	lv_obj_clear_flag(lbl,LV_OBJ_FLAG_HIDDEN);
+}
+
+static void draw_item_file_info(struct filerow*fr,struct fileitem*fi){
 	char dev[32];
 	uint8_t cs=2,rs=3;
 	memset(dev,0,sizeof(dev));
 
 	if(
-		fi->file.type==FS_TYPE_FILE_REG&&
-		fs_has_feature(fi->file.features,FS_FEATURE_HAVE_SIZE)
+		fi->type==FS_TYPE_FILE_REG&&
+		fs_has_feature(fi->features,FS_FEATURE_HAVE_SIZE)
 	){
 		char size[32];
-		make_readable_str_buf(size,sizeof(size)-1,fi->file.size,1,0);
-		fi->size=lv_label_create(fi->btn);
-		lv_label_set_text(fi->size,size);
-		lv_label_set_long_mode(fi->size,lm);
-		lv_obj_set_small_text_font(fi->size,0);
-		lv_obj_set_grid_cell(
-			fi->size,
-			LV_GRID_ALIGN_START,2,1,
-			LV_GRID_ALIGN_CENTER,0,1
-		);
+		make_readable_str_buf(size,sizeof(size)-1,fi->size,1,0);
+		show_label(fr->size,size);
 		cs=1;
 	}
 
 	if(
-		fs_has_feature(fi->file.features,FS_FEATURE_UNIX_PERM)||
-		fs_has_feature(fi->file.features,FS_FEATURE_HAVE_TIME)
+		fs_has_feature(fi->features,FS_FEATURE_UNIX_PERM)||
+		fs_has_feature(fi->features,FS_FEATURE_HAVE_TIME)
 	){
 		char times[64];
 		memset(times,0,sizeof(times));
 		if(fs_has_feature(
-			fi->file.features,
+			fi->features,
 			FS_FEATURE_HAVE_TIME
 		))strftime(
 			times,sizeof(times),
 			"%Y/%m/%d %H:%M:%S",
-			localtime(&fi->file.mtime)
+			localtime(&fi->mtime)
 		);
 
 		// file info1 (time and permission)
-		fi->info1=lv_label_create(fi->btn);
-		lv_obj_set_small_text_font(fi->info1,LV_PART_MAIN);
 		#ifdef ENABLE_UEFI
-		lv_label_set_text(fi->info1,times);
+		show_label(fr->info1,times);
 		#else
 		lv_label_set_text_fmt(
-			fi->info1,"%s %s",
-			times,mode_string(fi->file.mode)
+			fr->info1,"%s %s",
+			times,mode_string(fi->mode)
 		);
+		lv_obj_clear_flag(fr->info1,LV_OBJ_FLAG_HIDDEN);
 		#endif
-		lv_obj_set_grid_cell(
-			fi->info1,
-			LV_GRID_ALIGN_START,1,2,
-			LV_GRID_ALIGN_CENTER,1,1
-		);
 		rs--;
 	}
 
 	#ifndef ENABLE_UEFI
-	if(fs_has_feature(fi->file.features,FS_FEATURE_UNIX_DEVICE)){
+	if(fs_has_feature(fi->features,FS_FEATURE_UNIX_DEVICE)){
 		char*dt=NULL;
-		if(fi->file.type==FS_TYPE_FILE_CHAR)dt="char";
-		if(fi->file.type==FS_TYPE_FILE_BLOCK)dt="block";
+		if(fi->type==FS_TYPE_FILE_CHAR)dt="char";
+		if(fi->type==FS_TYPE_FILE_BLOCK)dt="block";
 		if(dt)snprintf(
 			dev,sizeof(dev)-1,
 			"%s[%d:%d] ",dt,
-			major(fi->file.device),
-			minor(fi->file.device)
+			major(fi->device),
+			minor(fi->device)
 		);
 	}
 
-	if(fs_has_feature(fi->file.features,FS_FEATURE_UNIX_PERM)){
+	if(fs_has_feature(fi->features,FS_FEATURE_UNIX_PERM)){
 		char owner[128],group[128];
 		memset(owner,0,sizeof(owner));
 		memset(group,0,sizeof(group));
 		// file info2 (owner/group, device node and symbolic link target)
-		fi->info2=lv_label_create(fi->btn);
-		lv_obj_align_to(fi->info2,fi->info1,LV_ALIGN_OUT_BOTTOM_LEFT,0,0);
-		lv_obj_set_small_text_font(fi->info2,LV_PART_MAIN);
 		lv_label_set_text_fmt(
-			fi->info2,"%s:%s %s%s",
-			get_username(fi->file.owner,owner,sizeof(owner)-1),
-			get_groupname(fi->file.group,group,sizeof(group)-1),
-			dev,fi->file.type==FS_TYPE_FILE_LINK?fi->file.target:""
-		);
-		lv_obj_set_grid_cell(
-			fi->info2,
-			LV_GRID_ALIGN_START,1,2,
-			LV_GRID_ALIGN_CENTER,2,1
+			fr->info2,"%s:%s %s%s",
+			get_username(fi->owner,owner,sizeof(owner)-1),
+			get_groupname(fi->group,group,sizeof(group)-1),
+			dev,fi->target?fi->target:""
 		);
+		lv_obj_clear_flag(fr->info2,LV_OBJ_FLAG_HIDDEN);
 		rs--;
 	}
 	#else
@@ -311,26 +325,19 @@ static void draw_item_file_info(struct fileitem*fi){
 	#endif
 
 	lv_obj_set_grid_cell(
-		fi->fn,
+		fr->fn,
 		LV_GRID_ALIGN_STRETCH,1,cs,
 		LV_GRID_ALIGN_CENTER,0,rs
 	);
 }
 
-static void draw_item_volume_info(struct fileitem*fi){
+static void draw_item_volume_info(struct filerow*fr,struct fileitem*fi){
 	uint8_t rs=3;
 	char used[32],size[32];
 
+	// partition name
 	if(fi->vol->part.label[0]){
-		// partition name
-		fi->info1=lv_label_create(fi->btn);
-		lv_obj_set_small_text_font(fi->info1,LV_PART_MAIN);
-		lv_label_set_text(fi->info1,fi->vol->part.label);
-		lv_obj_set_grid_cell(
-			fi->info1,
-			LV_GRID_ALIGN_START,1,2,
-			LV_GRID_ALIGN_CENTER,1,1
-		);
+		show_label(fr->info1,fi->vol->part.label);
 		rs--;
 	}
 
@@ -338,145 +345,168 @@ static void draw_item_volume_info(struct fileitem*fi){
 		int pct=fi->vol->fs.used*100/fi->vol->fs.size;
 		make_readable_str_buf(used,sizeof(used),fi->vol->fs.used,1,0);
 		make_readable_str_buf(size,sizeof(size),fi->vol->fs.size,1,0);
-		fi->info2=lv_label_create(fi->btn);
-		lv_label_set_text_fmt(fi->info2,"%s/%s (%d%%)",used,size,pct);
-		lv_label_set_long_mode(fi->info2,lm);
-		lv_obj_set_small_text_font(fi->info2,0);
-		lv_obj_set_grid_cell(
-			fi->info2,
-			LV_GRID_ALIGN_START,1,2,
-			LV_GRID_ALIGN_CENTER,2,1
-		);
+		lv_label_set_text_fmt(fr->info2,"%s/%s (%d%%)",used,size,pct);
+		lv_obj_clear_flag(fr->info2,LV_OBJ_FLAG_HIDDEN);
 		rs--;
 	}
 
 	lv_obj_set_grid_cell(
-		fi->fn,
+		fr->fn,
 		LV_GRID_ALIGN_STRETCH,1,2,
 		LV_GRID_ALIGN_CENTER,0,rs
 	);
 }
 
-static struct fileitem*add_item(
-	struct fileitem*item,
-	struct fileview*view,
-	fs_type type,
-	fs_file_info*file,
-	fsvol_info*vol
-){
-	struct fileitem*fi=item;
-	static lv_coord_t grid_col[]={
-		0,
-		LV_GRID_FR(1),
-		LV_GRID_CONTENT,
-		LV_GRID_TEMPLATE_LAST
-	},grid_row[]={
-		LV_GRID_FR(1),
-		LV_GRID_FR(1),
-		LV_GRID_FR(1),
-		LV_GRID_TEMPLATE_LAST
-	};
-	if(!view->view)return NULL;
-	if(fs_has_type(type,FS_TYPE_PARENT)){
-		if(file||vol)return NULL;
-	}else if(fs_has_type(type,FS_TYPE_FILE)){
-		if(!file||vol)return NULL;
-	}else if(fs_has_type(type,FS_TYPE_VOLUME)){
-		if(file||!vol)return NULL;
-	}else return NULL;
-	if(!fi){
-		if(!(fi=malloc(sizeof(struct fileitem)))){
-			telog_error("cannot allocate fileitem");
-			abort();
-		}
-		memset(fi,0,sizeof(struct fileitem));
-		fi->view=view,fi->type=type;
-		if(fs_has_type(fi->type,FS_TYPE_FILE))
-			memcpy(&fi->file,file,sizeof(fs_file_info));
-		else if(fs_has_type(fi->type,FS_TYPE_VOLUME))
-			fi->vol=vol;
-		if(list_obj_add_new(&view->items,fi)!=0){
-			telog_error("cannot add file item list");
-			abort();
-		}
-	}else if(!fi->view||fi->type==FS_TYPE_NONE)abort();
-	grid_col[0]=gui_font_size*(view->verbose?3:1);
+static void row_delete(lv_event_t*e){
+	free(e->user_data);
+}
+
+static lv_obj_t*info_label(lv_obj_t*btn,uint8_t col,uint8_t cs,uint8_t row){
+	lv_obj_t*lbl=lv_label_create(btn);
+	lv_label_set_long_mode(lbl,lm);
+	lv_obj_set_small_text_font(lbl,LV_PART_MAIN);
+	lv_obj_add_flag(lbl,LV_OBJ_FLAG_HIDDEN);
+	lv_obj_set_grid_cell(
+		lbl,
+		LV_GRID_ALIGN_START,col,cs,
+		LV_GRID_ALIGN_CENTER,row,1
+	);
+	return lbl;
+}
+
+static lv_obj_t*create_row(struct vlist*vl,lv_obj_t*parent){
+	struct filerow*fr;
+	struct fileview*view=vlist_get_data(vl);
+	lv_coord_t is=view->grid_col[0];
+	if(!(fr=malloc(sizeof(struct filerow)))){
+		telog_error("cannot allocate file row");
+		return NULL;
+	}
+	memset(fr,0,sizeof(struct filerow));
 
 	// file item button
-	fi->btn=lv_btn_create(view->view);
-	lv_obj_set_width(fi->btn,lv_pct(100));
-	lv_obj_set_content_height(fi->btn,grid_col[0]);
-	lv_style_set_btn_item(fi->btn);
-	lv_obj_add_event_cb(fi->btn,item_click,LV_EVENT_CLICKED,fi);
-	lv_obj_add_event_cb(fi->btn,item_check,LV_EVENT_LONG_PRESSED,fi);
-	lv_obj_set_grid_dsc_array(fi->btn,grid_col,grid_row);
+	fr->btn=lv_btn_create(parent);
+	lv_obj_set_user_data(fr->btn,fr);
+	lv_obj_set_width(fr->btn,lv_pct(100));
+	lv_obj_set_content_height(fr->btn,is);
+	lv_style_set_btn_item(fr->btn);
+	lv_obj_add_event_cb(fr->btn,item_click,LV_EVENT_CLICKED,view);
+	lv_obj_add_event_cb(fr->btn,item_check,LV_EVENT_LONG_PRESSED,view);
+	lv_obj_add_event_cb(fr->btn,row_delete,LV_EVENT_DELETE,fr);
+	lv_obj_set_grid_dsc_array(fr->btn,view->grid_col,grid_row);
 
 	// file image
-	fi->w_img=lv_obj_create(fi->btn);
-	lv_obj_set_size(fi->w_img,grid_col[0],grid_col[0]);
-	lv_obj_clear_flag(fi->w_img,LV_OBJ_FLAG_SCROLLABLE);
-	lv_obj_clear_flag(fi->w_img,LV_OBJ_FLAG_CLICKABLE);
-	lv_obj_set_style_border_width(fi->w_img,0,0);
-	lv_obj_set_style_bg_opa(fi->w_img,LV_OPA_0,0);
+	fr->w_img=lv_obj_create(fr->btn);
+	lv_obj_set_size(fr->w_img,is,is);
+	lv_obj_clear_flag(fr->w_img,LV_OBJ_FLAG_SCROLLABLE);
+	lv_obj_clear_flag(fr->w_img,LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_set_style_border_width(fr->w_img,0,0);
+	lv_obj_set_style_bg_opa(fr->w_img,LV_OPA_0,0);
 	lv_obj_set_grid_cell(
-		fi->w_img,
+		fr->w_img,
 		LV_GRID_ALIGN_STRETCH,0,1,
 		LV_GRID_ALIGN_STRETCH,0,3
 	);
-	fi->img=lv_img_create(fi->w_img);
-	lv_img_t*ext=(lv_img_t*)fi->img;
-	lv_img_set_src(fi->img,get_icon(fi));
+	fr->img=lv_img_create(fr->w_img);
+	lv_img_set_size_mode(fr->img,LV_IMG_SIZE_MODE_REAL);
+
+	fr->fn=lv_label_create(fr->btn);
+	lv_obj_set_small_text_font(fr->fn,0);
+	lv_label_set_long_mode(fr->fn,lm);
+
+	// file size, time and permission, owner and target
+	fr->size=info_label(fr->btn,2,1,0);
+	fr->info1=info_label(fr->btn,1,2,1);
+	fr->info2=info_label(fr->btn,1,2,2);
+	return fr->btn;
+}
+
+static void bind_row(struct vlist*vl,lv_obj_t*row,size_t idx){
+	lv_img_t*ext;
+	struct fileview*view=vlist_get_data(vl);
+	struct filerow*fr=lv_obj_get_user_data(row);
+	struct fileitem*fi=&view->items[idx];
+	lv_coord_t is=view->grid_col[0];
+	if(!fr||idx>=view->count)return;
+	lv_img_set_src(fr->img,get_icon(fi));
+	ext=(lv_img_t*)fr->img;
 	if(ext->w<=0||ext->h<=0)
-		lv_img_set_src(fi->img,"@mime-inode-file");
-	lv_img_set_size_mode(fi->img,LV_IMG_SIZE_MODE_REAL);
-	lv_img_fill_image(fi->img,grid_col[0],grid_col[0]);
-	lv_obj_center(fi->img);
-
-	fi->fn=lv_label_create(fi->btn);
-	lv_obj_set_small_text_font(fi->fn,0);
-	lv_label_set_long_mode(fi->fn,lm);
-	if(fs_has_type(type,FS_TYPE_PARENT)){
-		lv_label_set_text(fi->fn,_("Parent folder"));
-	}else if(fs_has_type(type,FS_TYPE_FILE)){
-		lv_label_set_text(fi->fn,fi->file.name);
-	}else if(fs_has_type(type,FS_TYPE_VOLUME)){
-		lv_label_set_text(fi->fn,fi->vol->title);
-	}
-
-	// add group
-	if(view->grp)lv_group_add_obj(view->grp,fi->btn);
-
-	if(view->verbose){
-		if(fs_has_type(type,FS_TYPE_FILE))
-			draw_item_file_info(fi);
-		else if(fs_has_type(type,FS_TYPE_VOLUME))
-			draw_item_volume_info(fi);
-		else lv_obj_set_grid_cell(
-			fi->fn,
-			LV_GRID_ALIGN_STRETCH,1,2,
-			LV_GRID_ALIGN_CENTER,0,3
-		);
-	}else lv_obj_set_grid_cell(
-		fi->fn,
+		lv_img_set_src(fr->img,"@mime-inode-file");
+	lv_img_fill_image(fr->img,is,is);
+	lv_obj_center(fr->img);
+
+	lv_obj_add_flag(fr->size,LV_OBJ_FLAG_HIDDEN);
+	lv_obj_add_flag(fr->info1,LV_OBJ_FLAG_HIDDEN);
+	lv_obj_add_flag(fr->info2,LV_OBJ_FLAG_HIDDEN);
+	if(fs_has_type(fi->type,FS_TYPE_PARENT))
+		lv_label_set_text(fr->fn,_("Parent folder"));
+	else if(fs_has_type(fi->type,FS_TYPE_FILE))
+		lv_label_set_text(fr->fn,fi->name);
+	else if(fs_has_type(fi->type,FS_TYPE_VOLUME))
+		lv_label_set_text(fr->fn,fi->vol->title);
+	lv_obj_set_checked(fr->btn,fi->checked);
+
+	if(view->verbose&&fs_has_type(fi->type,FS_TYPE_FILE))
+		draw_item_file_info(fr,fi);
+	else if(view->verbose&&fs_has_type(fi->type,FS_TYPE_VOLUME))
+		draw_item_volume_info(fr,fi);
+	else lv_obj_set_grid_cell(
+		fr->fn,
 		LV_GRID_ALIGN_STRETCH,1,2,
 		LV_GRID_ALIGN_CENTER,0,3
 	);
-	view->count++;
-	return fi;
 }
 
-static int _free_item(void*d){
-	struct fileitem*fi=(struct fileitem*)d;
-	lv_obj_del(fi->btn);
-	free(fi);
-	return 0;
+static bool add_item(
+	struct fileview*view,
+	fs_type type,
+	fs_file_info*file,
+	fsvol_info*vol
+){
+	size_t ns;
+	struct fileitem*fi,*n;
+	if(view->count>=view->size){
+		ns=view->size>0?view->size*2:64;
+		if(!(n=realloc(view->items,sizeof(struct fileitem)*ns))){
+			telog_error("cannot allocate fileitem");
+			return false;
+		}
+		view->items=n,view->size=ns;
+	}
+	fi=&view->items[view->count];
+	memset(fi,0,sizeof(struct fileitem));
+	fi->view=view,fi->type=type,fi->vol=vol;
+	if(fs_has_type(type,FS_TYPE_FILE)&&file){
+		if(!(fi->name=strdup(file->name)))return false;
+		if(file->type==FS_TYPE_FILE_LINK&&file->target[0]){
+			if(!(fi->target=strdup(file->target))){
+				free(fi->name);
+				return false;
+			}
+		}
+		fi->size=file->size;
+		fi->mtime=file->mtime;
+		fi->mode=file->mode;
+		fi->owner=file->owner;
+		fi->group=file->group;
+		fi->device=file->device;
+		fi->features=file->features;
+	}
+	view->count++;
+	return true;
 }
 
 static void clean_items(struct fileview*view){
 	if(!view->view)return;
-	if(view->items)list_free_all(view->items,_free_item);
+	vlist_reset(view->list);
+	for(size_t i=0;i<view->count;i++){
+		if(view->items[i].name)free(view->items[i].name);
+		if(view->items[i].target)free(view->items[i].target);
+	}
+	if(view->items)free(view->items);
 	if(view->info)lv_obj_del(view->info);
-	view->items=NULL,view->info=NULL,view->count=0;
+	view->items=NULL,view->info=NULL;
+	view->count=0,view->size=0;
 	call_on_select_item(view,NULL,0,false,0);
 }
 
@@ -497,35 +527,28 @@ static void set_info(struct fileview*view,char*text,...){
 	if(buf)free(buf);
 }
 
-static bool fileitem_sorter(list*a,list*b){
-	LIST_DATA_DECLARE(fa,a,struct fileitem*);
-	LIST_DATA_DECLARE(fb,b,struct fileitem*);
-	if(!fa||!fb)return false;
-	if(
-		fs_has_type(fa->type,FS_TYPE_PARENT)!=
-		fs_has_type(fb->type,FS_TYPE_PARENT)
-	)return !fs_has_type(fa->type,FS_TYPE_PARENT);
-	if(
-		fs_has_type(fa->type,FS_TYPE_FILE_FOLDER)!=
-		fs_has_type(fb->type,FS_TYPE_FILE_FOLDER)
-	)return !fs_has_type(fa->type,FS_TYPE_FILE_FOLDER);
-	char*na=fa->file.name,*nb=fb->file.name;
-	if(!na[0]||!nb[0])return false;
-	for(size_t i=0;na[i]&&nb[i];i++)
-		if(na[i]!=nb[i])return na[i]>nb[i];
-	return false;
+static int fileitem_cmp(const void*a,const void*b){
+	const struct fileitem*fa=a,*fb=b;
+	bool pa=fs_has_type(fa->type,FS_TYPE_PARENT);
+	bool pb=fs_has_type(fb->type,FS_TYPE_PARENT);
+	if(pa||pb)return pa==pb?0:pa?-1:1;
+	pa=fs_has_type(fa->type,FS_TYPE_FILE_FOLDER);
+	pb=fs_has_type(fb->type,FS_TYPE_FILE_FOLDER);
+	if(pa!=pb)return pa?-1:1;
+	return strcmp(fa->name,fb->name);
 }
 
 static void scan_items(struct fileview*view){
-	list*l;
 	int r=0;
+	size_t cnt=0;
 	fsvol_info**vols;
-	struct fileitem item;
+	fs_file_info*infos;
 	if(!view->view)return;
 	clean_items(view);
+	view->grid_col[0]=gui_font_size*(view->verbose?3:1);
 	if(view->url){
 		if(view->parent&&!fileview_is_top(view))
-			add_item(NULL,view,FS_TYPE_PARENT,NULL,NULL);
+			add_item(view,FS_TYPE_PARENT,NULL,NULL);
 		if(!view->folder){
 			if((r=fs_open_uri(
 				&view->folder,
@@ -537,20 +560,23 @@ static void scan_items(struct fileview*view){
 				return;
 			}
 		}else fs_seek(view->folder,0,SEEK_SET);
-		memset(&item,0,sizeof(item));
-		while((r=fs_readdir(view->folder,&item.file))==0){
-			if(item.file.name[0]=='.'&&!view->hidden)continue;
-			item.view=view,item.type=item.file.type;
-			list_obj_add_new_dup(&view->items,&item,sizeof(item));
-			memset(&item,0,sizeof(item));
-			if(view->count>=256)tlog_warn("too many files, skip");
+		if(!(infos=malloc(sizeof(fs_file_info)*64))){
+			set_info(view,_("open dir failed: %s"),strerror(ENOMEM));
+			return;
+		}
+		while(r==0&&(r=fs_readdir_batch(view->folder,infos,64,&cnt))==0){
+			for(size_t i=0;i<cnt&&r==0;i++){
+				if(infos[i].name[0]=='.'&&!view->hidden)continue;
+				if(!add_item(view,infos[i].type,&infos[i],NULL))r=ENOMEM;
+			}
 		}
-		list_sort(view->items,fileitem_sorter);
-		if((l=list_first(view->items)))do{
-			LIST_DATA_DECLARE(i,l,struct fileitem*);
-			add_item(i,view,i->type,&i->file,NULL);
-		}while((l=l->next));
+		free(infos);
 		if(r==EOF)r=0;
+		if(view->count>1)qsort(
+			view->items,view->count,
+			sizeof(struct fileitem),
+			fileitem_cmp
+		);
 	}else if((vols=fsvol_get_volumes())){
 		for(size_t i=0;vols[i];i++){
 			if(!view->hidden&&fs_has_vol_feature(
@@ -559,8 +585,7 @@ static void scan_items(struct fileview*view){
 			if(!fs_has_vol_feature(
 				vols[i]->features,FSVOL_FILES
 			))continue;
-			add_item(NULL,view,FS_TYPE_VOLUME,NULL,vols[i]);
-			if(view->count>=256)tlog_warn("too many volumes, skip");
+			add_item(view,FS_TYPE_VOLUME,NULL,vols[i]);
 		}
 		free(vols);
 	}
@@ -569,6 +594,7 @@ static void scan_items(struct fileview*view){
 		tlog_warn("read dir failed: %s",strerror(r));
 		set_info(view,_("read dir failed: %s"),strerror(r));
 	}
+	vlist_set_count(view->list,view->count);
 }
 
 void fileview_set_url(struct fileview*view,url*u){
@@ -617,7 +643,17 @@ struct fileview*fileview_create(lv_obj_t*screen){
 	view->verbose=true;
 	view->view=screen;
 	view->parent=true;
-	lv_obj_set_flex_flow(view->view,LV_FLEX_FLOW_COLUMN);
+	view->grid_col[0]=0;
+	view->grid_col[1]=LV_GRID_FR(1);
+	view->grid_col[2]=LV_GRID_CONTENT;
+	view->grid_col[3]=LV_GRID_TEMPLATE_LAST;
+	if(!(view->list=vlist_create(
+		screen,create_row,bind_row
+	))){
+		free(view);
+		return NULL;
+	}
+	vlist_set_data(view->list,view);
 	lm=confd_get_boolean("gui.text_scroll",true)?
 		LV_LABEL_LONG_SCROLL_CIRCULAR:
 		LV_LABEL_LONG_DOT;
@@ -646,33 +682,27 @@ void fileview_set_verbose(struct fileview*view,bool verbose){
 
 uint16_t fileview_get_checked_count(struct fileview*view){
 	uint16_t checked=0;
-	list*l=list_first(view->items);
-	if(l)do{
-		LIST_DATA_DECLARE(ffi,l,struct fileitem*);
-		if(ffi&&lv_obj_is_checked(ffi->btn))
-			checked++;
-	}while((l=l->next));
+	for(size_t i=0;i<view->count;i++)
+		if(view->items[i].checked)checked++;
 	return checked;
 }
 
 char**fileview_get_checked(struct fileview*view){
-	list*l;
+	struct fileitem*fi;
 	uint16_t checked=fileview_get_checked_count(view),num=0;
 	size_t size=sizeof(char*)*(checked+1);
 	char**arr=malloc(size);
 	if(!arr)return NULL;
 	memset(arr,0,size);
-	if(checked>0&&(l=list_first(view->items)))do{
-		LIST_DATA_DECLARE(ffi,l,struct fileitem*);
-		if(!ffi||!lv_obj_is_checked(ffi->btn))continue;
-		if(fs_has_type(ffi->type,FS_TYPE_PARENT)){
-			arr[num++]=ffi->file.name;
-		}else if(fs_has_type(ffi->type,FS_TYPE_FILE)){
-			arr[num++]=ffi->file.name;
-		}else if(fs_has_type(ffi->type,FS_TYPE_VOLUME)){
-			arr[num++]=ffi->vol->name;
+	for(size_t i=0;i<view->count&&num<checked;i++){
+		fi=&view->items[i];
+		if(!fi->checked)continue;
+		if(fs_has_type(fi->type,FS_TYPE_FILE)){
+			arr[num++]=fi->name;
+		}else if(fs_has_type(fi->type,FS_TYPE_VOLUME)){
+			arr[num++]=fi->vol->name;
 		}
-	}while((l=l->next));
+	}
 	return arr;
 }
 
@@ -715,20 +745,12 @@ bool fileview_check_item(struct fileview*view,const char*name,bool checked){
 }
 
 void fileview_add_group(struct fileview*view,lv_group_t*grp){
-	list*l=list_first(view->items);
-	if(l)do{
-		LIST_DATA_DECLARE(fi,l,struct fileitem*);
-		lv_group_add_obj(grp,fi->btn);
-	}while((l=l->next));
+	vlist_set_group(view->list,grp);
 	view->grp=grp;
 }
 
 void fileview_remove_group(struct fileview*view){
-	list*l=list_first(view->items);
-	if(l)do{
-		LIST_DATA_DECLARE(fi,l,struct fileitem*);
-		lv_group_remove_obj(fi->btn);
-	}while((l=l->next));
+	vlist_set_group(view->list,NULL);
 	view->grp=NULL;
 }
 
@@ -736,6 +758,7 @@ void fileview_free(struct fileview*view){
 	if(!view)return;
 	fileview_remove_group(view);
 	clean_items(view);
+	vlist_free(view->list);
 	free(view);
 }
 #endif
@@ -9,17 +9,43 @@
 #ifdef ENABLE_GUI
 #define _GNU_SOURCE
 #include<stdlib.h>
+#include<sys/socket.h>
+#include<sys/eventfd.h>
+#include<linux/netlink.h>
 #include<libfdisk/libfdisk.h>
 #include"gui.h"
 #include"str.h"
+#include"list.h"
+#include"lock.h"
+#include"pool.h"
 #include"confd.h"
 #include"guipm.h"
 #include"system.h"
 #include"logger.h"
+#include"uevent.h"
 #include"gui/tools.h"
 #include"gui/activity.h"
 #define TAG "guipm"
 
+// partition tables are read by pool workers since a slow disk blocks for seconds,
+// finished probes queue up in probe_done and wake the gui loop through probe_efd
+#define PROBE_WORKERS 4
+struct probe_job{
+	unsigned gen;
+	char name[256];
+	char path[BUFSIZ];
+	char layout[16];
+	struct fdisk_context*ctx;
+	struct fdisk_label*lbl;
+};
+static struct pool*probe_pool=NULL;
+static mutex_t probe_lock=MUTEX_INITIALIZER;
+static list*probe_done=NULL;
+static unsigned probe_gen=0;
+static int probe_efd=-1,uevent_fd=-1;
+static bool probe_watched=false;
+static struct disks_info*probe_di=NULL;
+
 static char*get_model(struct disks_disk_info*d){
 	return d->model[0]==0?"Unknown":d->model;
 }
@@ -47,6 +73,18 @@ static void disk_click(lv_event_t*e){
 	lv_group_focus_obj(di->btn_ok);
 }
 
+static void guipm_disk_remove(struct disks_disk_info*k,bool ui){
+	if(!k->enable)return;
+	if(k->di&&k->di->selected==k){
+		k->di->selected=NULL;
+		if(ui)lv_obj_set_enabled(k->di->btn_ok,false);
+	}
+	if(ui)lv_obj_del(k->btn);
+	if(k->ctx)fdisk_unref_context(k->ctx);
+	close(k->sysfs_fd);
+	memset(k,0,sizeof(struct disks_disk_info));
+}
+
 static void guipm_disk_clear(struct disks_info*di,bool ui){
 	if(!di)return;
 	if(ui){
@@ -54,13 +92,7 @@ static void guipm_disk_clear(struct disks_info*di,bool ui){
 		if(di->disks_info)lv_obj_del(di->disks_info);
 	}
 	di->disks_info=NULL,di->selected=NULL;
-	for(int i=0;i<32;i++){
-		if(!di->disks[i].enable)continue;
-		if(ui)lv_obj_del(di->disks[i].btn);
-		if(di->disks[i].ctx)fdisk_unref_context(di->disks[i].ctx);
-		close(di->disks[i].sysfs_fd);
-		memset(&di->disks[i],0,sizeof(struct disks_disk_info));
-	}
+	for(int i=0;i<32;i++)guipm_disk_remove(&di->disks[i],ui);
 }
 
 static void guipm_set_disks_info(struct disks_info*di,char*text){
@@ -111,25 +143,94 @@ static int get_block_path(struct disks_disk_info*k){
 	return 0;
 }
 
-static int get_fdisk_ctx(struct disks_disk_info*k){
+static int get_fdisk_ctx(struct probe_job*j){
 	errno=0;
-	if(!(k->ctx=fdisk_new_context()))
+	if(!(j->ctx=fdisk_new_context()))
 		return terlog_error(-1,"failed to initialize fdisk context");
 	errno=0;
-	if(fdisk_assign_device(k->ctx,k->path,true)!=0){
-		telog_warn("failed assign block %s to fdisk context",k->name);
-		fdisk_unref_context(k->ctx);
-		k->ctx=NULL,k->lbl=NULL;
+	if(fdisk_assign_device(j->ctx,j->path,true)!=0){
+		telog_warn("failed assign block %s to fdisk context",j->name);
+		fdisk_unref_context(j->ctx);
+		j->ctx=NULL,j->lbl=NULL;
 		return -1;
 	}
-	k->lbl=fdisk_get_label(k->ctx,NULL);
-	if(fdisk_has_label(k->ctx)&&k->lbl){
-		strncpy(k->layout,fdisk_label_get_name(k->lbl),15);
-		strtoupper(k->layout);
+	j->lbl=fdisk_get_label(j->ctx,NULL);
+	if(fdisk_has_label(j->ctx)&&j->lbl){
+		strncpy(j->layout,fdisk_label_get_name(j->lbl),15);
+		strtoupper(j->layout);
 	}
 	return 0;
 }
 
+static void*probe_thread(void*d){
+	uint64_t v=1;
+	struct probe_job*j=d;
+	get_fdisk_ctx(j);
+	MUTEX_LOCK(probe_lock);
+	if(list_obj_add_new(&probe_done,j)!=0){
+		if(j->ctx)fdisk_unref_context(j->ctx);
+		free(j);
+		j=NULL;
+	}
+	MUTEX_UNLOCK(probe_lock);
+	if(j&&probe_efd>=0&&write(probe_efd,&v,sizeof(v))<0&&errno!=EAGAIN)
+		telog_warn("wake up disk selector failed");
+	return NULL;
+}
+
+static int probe_job_free(void*d){
+	struct probe_job*j=d;
+	if(j->ctx)fdisk_unref_context(j->ctx);
+	free(j);
+	return 0;
+}
+
+static void probe_apply(struct probe_job*j){
+	struct disks_disk_info*k=NULL;
+	if(probe_di)for(int i=0;i<32&&!k;i++)
+		if(probe_di->disks[i].enable&&probe_di->disks[i].gen==j->gen)
+			k=&probe_di->disks[i];
+	if(!k)return;
+	k->ctx=j->ctx,k->lbl=j->lbl,j->ctx=NULL;
+	memcpy(k->layout,j->layout,sizeof(k->layout));
+	if(k->spinner)lv_obj_del(k->spinner);
+	k->spinner=NULL;
+	lv_label_set_text(k->d_layout,_(get_layout(k)));
+	lv_obj_clear_flag(k->d_layout,LV_OBJ_FLAG_HIDDEN);
+	tlog_debug("scan block device %s (%s)",k->path,get_layout(k));
+}
+
+static void probe_drain(int fd,void*data __attribute__((unused))){
+	uint64_t v;
+	list*done,*l;
+	if(fd>=0)read(fd,&v,sizeof(v));
+	MUTEX_LOCK(probe_lock);
+	done=probe_done,probe_done=NULL;
+	MUTEX_UNLOCK(probe_lock);
+	if((l=list_first(done)))do{
+		LIST_DATA_DECLARE(j,l,struct probe_job*);
+		probe_apply(j);
+	}while((l=l->next));
+	list_free_all(done,probe_job_free);
+}
+
+static void probe_start(struct disks_disk_info*k){
+	struct probe_job*j;
+	if(!(j=malloc(sizeof(struct probe_job)))){
+		telog_error("cannot allocate probe job");
+		return;
+	}
+	memset(j,0,sizeof(struct probe_job));
+	j->gen=k->gen=++probe_gen;
+	strcpy(j->name,k->name);
+	strcpy(j->path,k->path);
+	if(!probe_pool&&(probe_pool=pool_init(PROBE_WORKERS,256)))
+		pool_set_idle(probe_pool,0,0);
+	if(probe_watched&&probe_pool&&pool_add(probe_pool,probe_thread,j)==0)return;
+	probe_thread(j);
+	probe_drain(-1,NULL);
+}
+
 static int get_block_model(struct disks_disk_info*k){
 	char model[511]={0},vendor[511]={0};
 	int xm;
@@ -174,7 +275,8 @@ static void disks_add_item(struct disks_disk_info*k){
 	lv_obj_set_size(k->btn,lv_pct(100),gui_font_size*5);
 	lv_obj_set_grid_dsc_array(k->btn,grid_col,grid_row);
 	lv_obj_add_event_cb(k->btn,disk_click,LV_EVENT_CLICKED,k->di);
-	lv_group_add_obj(gui_grp,k->btn);
+	if(strcmp(guiact_get_last()->name,"guipm-disk-select")==0)
+		lv_group_add_obj(gui_grp,k->btn);
 
 	// disk name
 	lv_obj_t*lbl=lv_label_create(k->btn);
@@ -213,21 +315,68 @@ static void disks_add_item(struct disks_disk_info*k){
 		LV_GRID_ALIGN_CENTER,0,1
 	);
 
-	// disk layout type
-	lv_obj_t*d_layout=lv_label_create(k->btn);
-	lv_label_set_long_mode(d_layout,lm);
-	lv_obj_set_style_text_align(d_layout,LV_TEXT_ALIGN_RIGHT,0);
-	lv_label_set_text(d_layout,_(get_layout(k)));
+	// disk layout type, filled when probe finished
+	k->d_layout=lv_label_create(k->btn);
+	lv_label_set_long_mode(k->d_layout,lm);
+	lv_obj_set_style_text_align(k->d_layout,LV_TEXT_ALIGN_RIGHT,0);
+	lv_obj_add_flag(k->d_layout,LV_OBJ_FLAG_HIDDEN);
 	lv_obj_set_grid_cell(
-		d_layout,
+		k->d_layout,
 		LV_GRID_ALIGN_STRETCH,1,1,
 		LV_GRID_ALIGN_CENTER,1,1
 	);
+
+	// probing spinner
+	k->spinner=lv_spinner_create(k->btn,1000,60);
+	lv_obj_set_size(k->spinner,gui_font_size,gui_font_size);
+	lv_obj_set_style_arc_width(k->spinner,gui_font_size/6,0);
+	lv_obj_set_style_arc_width(k->spinner,gui_font_size/6,LV_PART_INDICATOR);
+	lv_obj_clear_flag(k->spinner,LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_set_grid_cell(
+		k->spinner,
+		LV_GRID_ALIGN_END,1,1,
+		LV_GRID_ALIGN_CENTER,1,1
+	);
+}
+
+static int guipm_disk_add(struct disks_info*di,int dfd,const char*name){
+	struct disks_disk_info*k=NULL;
+	for(int i=0;i<32&&!k;i++)if(!di->disks[i].enable)k=&di->disks[i];
+	if(!k)return trlog_warn(-1,"disk too many, only show 32 disks");
+	memset(k,0,sizeof(struct disks_disk_info));
+	strncpy(k->name,name,sizeof(k->name)-1);
+	errno=0;
+	if((k->sysfs_fd=openat(dfd,k->name,O_DIR))<0)
+		return terlog_warn(-1,"cannot open block %s",k->name);
+	if(
+		get_block_size(k)<0||
+		get_block_path(k)<0||
+		(!di->is_show_all&&(
+		     strncmp(k->name,"dm",2)==0||
+		     strncmp(k->name,"fd",2)==0||
+		     strncmp(k->name,"nbd",3)==0||
+		     strncmp(k->name,"mtd",3)==0||
+		     strncmp(k->name,"aoe",3)==0||
+		     strncmp(k->name,"ram",3)==0||
+		     strncmp(k->name,"zram",4)==0||
+		     strncmp(k->name,"loop",4)==0||
+		     k->size<=0
+	     ))
+	){
+		close(k->sysfs_fd);
+		memset(k,0,sizeof(struct disks_disk_info));
+		return 1;
+	}
+	k->enable=true,k->di=di;
+	get_block_model(k);
+	disks_add_item(k);
+	probe_start(k);
+	return 0;
 }
 
 static void guipm_disk_reload(struct disks_info*di){
 	guipm_disk_clear(di,true);
-	int i;
+	int i,r;
 	DIR*d;
 	if(
 		(i=open(_PATH_SYS_BLOCK,O_DIR))<0||
@@ -241,49 +390,76 @@ static void guipm_disk_reload(struct disks_info*di){
 	int blk=0;
 	struct dirent*e;
 	while((e=readdir(d))){
-		struct disks_disk_info*k=&di->disks[blk];
 		if(e->d_type!=DT_LNK)continue;
-		memset(k,0,sizeof(struct disks_disk_info));
-		strcpy(k->name,e->d_name);
-		errno=0;
-		if((k->sysfs_fd=openat(i,k->name,O_DIR))<0){
-			telog_warn("cannot open block %s",k->name);
-			continue;
-		}
-		if(
-			get_block_size(k)<0||
-			get_block_path(k)<0||
-			(!di->is_show_all&&(
-			     strncmp(k->name,"dm",2)==0||
-			     strncmp(k->name,"fd",2)==0||
-			     strncmp(k->name,"nbd",3)==0||
-			     strncmp(k->name,"mtd",3)==0||
-			     strncmp(k->name,"aoe",3)==0||
-			     strncmp(k->name,"ram",3)==0||
-			     strncmp(k->name,"zram",4)==0||
-			     strncmp(k->name,"loop",4)==0||
-			     k->size<=0
-		     ))
-		){
-			close(k->sysfs_fd);
-			continue;
-		}
-		k->enable=true,k->di=di;
-
-		get_fdisk_ctx(k);
-		get_block_model(k);
-		disks_add_item(k);
-
-		tlog_debug("scan block device %s (%s)",k->path,get_layout(k));
+		if((r=guipm_disk_add(di,i,e->d_name))==0)blk++;
+		else if(r<0&&blk>=32)break;
+	}
+	tlog_info("found %d disks",blk);
+	closedir(d);
+}
 
-		if(++blk>=32){
-			tlog_warn("disk too many, only show 31 disks");
-			break;
+// kernel uevents of whole disks, devd has no event subscription for clients
+static void uevent_recv(int fd,void*data){
+	int dfd;
+	ssize_t s;
+	uevent event;
+	char buf[8192],*v,*name;
+	struct disks_info*di=data;
+	while((s=recv(fd,buf,sizeof(buf)-1,MSG_DONTWAIT))>0){
+		buf[s]=0;
+		for(ssize_t x=0;x<s;x++)if(buf[x]==0)buf[x]='\n';
+		if(!(v=strchr(buf,'\n')))continue;
+		if(!uevent_parse(v+1,&event))continue;
+		if(!event.subsystem||strcmp(event.subsystem,"block")!=0)continue;
+		if(!event.devtype||strcmp(event.devtype,"disk")!=0)continue;
+		if(!event.devpath||!(name=strrchr(event.devpath,'/')))continue;
+		name++;
+		switch(event.action){
+			case ACTION_ADD:
+			case ACTION_REMOVE:
+			case ACTION_CHANGE:break;
+			default:continue;
 		}
+		tlog_debug("block %s %s",name,uevent_action2char(event.action));
+		for(int i=0;i<32;i++)
+			if(di->disks[i].enable&&strcmp(di->disks[i].name,name)==0)
+				guipm_disk_remove(&di->disks[i],true);
+		if(event.action==ACTION_REMOVE)continue;
+		if((dfd=open(_PATH_SYS_BLOCK,O_DIR))<0)continue;
+		guipm_disk_add(di,dfd,name);
+		close(dfd);
 	}
-	tlog_info("found %d disks",blk);
-	free(d);
-	close(i);
+}
+
+static void uevent_start(struct disks_info*di){
+	struct sockaddr_nl n={
+		.nl_family=AF_NETLINK,
+		.nl_groups=1
+	};
+	if(uevent_fd>=0)return;
+	if((uevent_fd=socket(
+		AF_NETLINK,
+		SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT
+	))<0){
+		telog_warn("cannot create uevent socket");
+		return;
+	}
+	if(
+		bind(uevent_fd,(struct sockaddr*)&n,sizeof(n))<0||
+		gui_watch_fd(uevent_fd,uevent_recv,di)<0
+	){
+		telog_warn("cannot listen block uevents");
+		close(uevent_fd);
+		uevent_fd=-1;
+	}
+}
+
+static void uevent_stop(void){
+	if(uevent_fd<0)return;
+	gui_unwatch_fd(uevent_fd);
+	close(uevent_fd);
+	uevent_fd=-1;
 }
 
 static void refresh_click(lv_event_t*e){
@@ -314,6 +490,11 @@ static void show_all_click(lv_event_t*e){
 static int do_cleanup(struct gui_activity*d){
 	struct disks_info*di=d->data;
 	if(!di)return 0;
+	probe_di=NULL;
+	uevent_stop();
+	if(probe_watched)gui_unwatch_fd(probe_efd);
+	probe_watched=false;
+	probe_drain(-1,NULL);
 	guipm_disk_clear(di,false);
 	di->is_show_all=false;
 	free(di);
@@ -330,6 +511,10 @@ static int do_reload(struct gui_activity*d){
 static int guipm_disk_get_focus(struct gui_activity*d){
 	struct disks_info*di=d->data;
 	if(!di)return -1;
+	for(int i=0;i<32;i++){
+		if(!di->disks[i].enable)continue;
+		lv_group_add_obj(gui_grp,di->disks[i].btn);
+	}
 	lv_group_add_obj(gui_grp,di->show_all);
 	lv_group_add_obj(gui_grp,di->btn_ok);
 	lv_group_add_obj(gui_grp,di->btn_refresh);
@@ -393,6 +578,14 @@ static int guipm_draw_disk_sel(struct gui_activity*act){
 		#undef BTN
 		NULL
 	);
+
+	// probe results and disk hotplug arrive in the gui loop
+	probe_di=di;
+	if(probe_efd<0&&(probe_efd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC))<0)
+		telog_warn("cannot create probe event");
+	if(probe_efd>=0&&!probe_watched)
+		probe_watched=gui_watch_fd(probe_efd,probe_drain,NULL)==0;
+	uevent_start(di);
 	return 0;
 }
 
@@ -38,7 +38,8 @@ extern void guipm_init_size_block(lv_obj_t*box,void*pi,fdisk_sector_t lsec,struc
 
 struct disks_disk_info{
 	bool enable;
-	lv_obj_t*btn;
+	unsigned gen;
+	lv_obj_t*btn,*d_layout,*spinner;
 	struct fdisk_context*ctx;
 	struct fdisk_label*lbl;
 	long size;
@@ -20,21 +20,40 @@
 #include"gui/tools.h"
 #include"gui/msgbox.h"
 #include"gui/activity.h"
+#include"gui/vlist.h"
 #include"gui/inputbox.h"
 #include"gui/filepicker.h"
 #define TAG "regedit"
 
+// name and type are read from the hive when an item is first bound or searched
 struct reg_item{
 	struct regedit*reg;
-	bool parent;
+	bool parent,checked,loaded;
+	ssize_t row;
 	char name[255];
 	hive_node_h node;
 	hive_value_h dir;
 	hive_value_h value;
 	hive_type type;
+};
+
+// keys and values of a node are kept in reg->items, reg->shown maps
+// rows of the vlist to the items matched by the search filter
+struct reg_row{
 	lv_obj_t*btn,*lbl,*w_img,*img,*val,*xtype;
 };
 
+static lv_coord_t grid_col[]={
+	0,
+	LV_GRID_FR(1),
+	LV_GRID_CONTENT,
+	LV_GRID_TEMPLATE_LAST
+},grid_row[]={
+	LV_GRID_FR(1),
+	LV_GRID_FR(1),
+	LV_GRID_TEMPLATE_LAST
+};
+
 static char*get_string_path(struct regedit*reg,char*sub){
 	if(!reg)return NULL;
 	static char string[BUFSIZ],*p,*s,*e;
@@ -56,30 +75,66 @@ static char*get_string_path(struct regedit*reg,char*sub){
 	return string;
 }
 
+static void load_item(struct reg_item*ci){
+	size_t len;
+	char*key=NULL;
+	if(!ci||ci->loaded)return;
+	ci->loaded=true;
+	if(ci->parent)return;
+	if(ci->value){
+		key=hivex_value_key(ci->reg->hive,ci->value);
+		if(hivex_value_type(ci->reg->hive,ci->value,&ci->type,&len)<0)
+			ci->type=hive_t_REG_NONE;
+	}else if(ci->node)key=hivex_node_name(ci->reg->hive,ci->node);
+	if(!key)return;
+	strncpy(ci->name,key,sizeof(ci->name)-1);
+	free(key);
+}
+
 static const char*get_icon(struct reg_item*ci){
 	if(!ci)return NULL;
 	if(ci->parent)return "inode-parent";
-	switch(ci->type){
-		case hive_t_REG_NONE:return "inode-dir";
-		default:return "text-x-plain";
-	}
-	return "unknown";
+	return ci->value?"text-x-plain":"inode-dir";
+}
+
+static bool match_item(struct reg_item*ci,const char*filter){
+	if(ci->parent||!filter[0])return true;
+	load_item(ci);
+	return strcasestr(ci->name,filter)!=NULL;
 }
 
-static int clean_item(void*d){
-	struct reg_item*i=(struct reg_item*)d;
-	if(i){
-		if(i->btn)lv_obj_del(i->btn);
-		free(i);
+static void apply_filter(struct regedit*reg,const char*filter,bool narrow){
+	size_t i,k=0,cnt;
+	if(!reg)return;
+	if(!reg->shown)cnt=0;
+	else if(narrow&&strncasecmp(filter,reg->filter,strlen(reg->filter))==0)
+		cnt=reg->shown_cnt;
+	else for(cnt=0;cnt<reg->count;cnt++)reg->shown[cnt]=cnt;
+	for(i=0;i<cnt;i++){
+		struct reg_item*ci=&reg->items[reg->shown[i]];
+		ci->row=-1;
+		if(!match_item(ci,filter))continue;
+		ci->row=k,reg->shown[k++]=reg->shown[i];
 	}
-	return 0;
+	if(filter!=reg->filter)strncpy(reg->filter,filter,sizeof(reg->filter)-1);
+	reg->shown_cnt=k;
+	vlist_set_count(reg->list,k);
+}
+
+static void clear_filter(struct regedit*reg){
+	reg->filter[0]=0;
+	if(reg->search)lv_textarea_set_text(reg->search,"");
 }
 
 static void clean_view(struct regedit*reg){
 	if(!reg)return;
 	if(reg->info)lv_obj_del(reg->info);
-	list_free_all(reg->items,clean_item);
+	vlist_set_count(reg->list,0);
+	if(reg->items)free(reg->items);
+	if(reg->shown)free(reg->shown);
 	reg->items=NULL,reg->info=NULL,reg->last_btn=NULL;
+	reg->shown=NULL,reg->shown_cnt=0;
+	reg->count=0,reg->size=0;
 	lv_obj_set_enabled(reg->btn_delete,false);
 	lv_obj_set_enabled(reg->btn_edit,false);
 }
@@ -102,17 +157,21 @@ static void go_back(struct regedit*reg){
 	if(par<=0)return;
 	reg->node=par;
 	list_obj_del(&reg->path,list_last(reg->path),list_default_free);
+	clear_filter(reg);
 	load_view(reg);
 }
 
 static void click_item(struct reg_item*ci){
 	if(!ci||!ci->reg)return;
-	if(ci->type==hive_t_REG_NONE){
+	load_item(ci);
+	if(!ci->value){
 		if(ci->parent)go_back(ci->reg);
 		else if(ci->node>0){
-			list_obj_add_new_strdup(&ci->reg->path,ci->name);
-			ci->reg->node=ci->node;
-			load_view(ci->reg);
+			struct regedit*reg=ci->reg;
+			list_obj_add_new_strdup(&reg->path,ci->name);
+			reg->node=ci->node;
+			clear_filter(reg);
+			load_view(reg);
 		}
 	}else{
 		static struct regedit_value value;
@@ -128,11 +187,8 @@ static void click_item(struct reg_item*ci){
 
 static size_t get_selected(struct regedit*reg){
 	size_t c=0;
-	list*o=list_first(reg->items);
-	if(o)do{
-		LIST_DATA_DECLARE(item,o,struct reg_item*);
-		if(item&&item->btn&&lv_obj_is_checked(item->btn))c++;
-	}while((o=o->next));
+	for(size_t i=0;i<reg->count;i++)
+		if(reg->items[i].checked)c++;
 	return c;
 }
 
@@ -142,7 +198,8 @@ static void check_item(struct reg_item*ci,bool checked){
 		go_back(ci->reg);
 		return;
 	}
-	lv_obj_set_checked(ci->btn,checked);
+	ci->checked=checked;
+	if(ci->row>=0)vlist_refresh_item(ci->reg->list,ci->row);
 	size_t c=get_selected(ci->reg);
 	if(c==0){
 		lv_obj_set_enabled(ci->reg->btn_delete,false);
@@ -156,140 +213,155 @@ static void check_item(struct reg_item*ci,bool checked){
 	}
 }
 
+static struct reg_item*get_row_item(lv_event_t*e){
+	ssize_t idx;
+	struct regedit*reg=e->user_data;
+	if(!reg||(idx=vlist_get_row_index(reg->list,e->current_target))<0)return NULL;
+	return (size_t)idx<reg->shown_cnt?&reg->items[reg->shown[idx]]:NULL;
+}
+
 static void item_click(lv_event_t*e){
-	struct reg_item*ci=e->user_data;
+	struct reg_item*ci=get_row_item(e);
 	lv_indev_t*i=lv_indev_get_act();
-	if(i&&i->proc.long_pr_sent)return;
+	if(!ci||(i&&i->proc.long_pr_sent))return;
 	size_t c=get_selected(ci->reg);
-	if(c>0)check_item(ci,!lv_obj_is_checked(ci->btn));
+	if(c>0)check_item(ci,!ci->checked);
 	else click_item(ci);
 }
 
 static void item_check(lv_event_t*e){
-	struct reg_item*ci=e->user_data;
-	if(ci->parent)return;
+	struct reg_item*ci=get_row_item(e);
+	if(!ci||ci->parent)return;
 	e->stop_processing=1;
-	check_item(ci,!lv_obj_is_checked(ci->btn));
+	check_item(ci,!ci->checked);
 }
 
-static void add_item(struct reg_item*ci){
-	char buf[256]={0};
-	static lv_coord_t grid_col[]={
-		0,
-		LV_GRID_FR(1),
-		LV_GRID_CONTENT,
-		LV_GRID_TEMPLATE_LAST
-	},grid_row[]={
-		LV_GRID_FR(1),
-		LV_GRID_FR(1),
-		LV_GRID_TEMPLATE_LAST
-	};
-	if(!ci||!ci->reg)return;
+static void row_delete(lv_event_t*e){
+	free(e->user_data);
+}
+
+static lv_obj_t*create_row(struct vlist*vl,lv_obj_t*parent){
+	struct reg_row*row;
+	struct regedit*reg=vlist_get_data(vl);
+	if(!(row=malloc(sizeof(struct reg_row)))){
+		telog_error("cannot allocate reg row");
+		return NULL;
+	}
+	memset(row,0,sizeof(struct reg_row));
 	if(grid_col[0]==0)grid_col[0]=gui_font_size*3;
 
 	// reg item button
-	ci->btn=lv_btn_create(ci->reg->view);
-	lv_obj_set_width(ci->btn,lv_pct(100));
-	lv_obj_set_content_height(ci->btn,grid_col[0]);
-	lv_style_set_btn_item(ci->btn);
-	lv_obj_set_grid_dsc_array(ci->btn,grid_col,grid_row);
-	lv_obj_add_event_cb(ci->btn,item_click,LV_EVENT_CLICKED,ci);
-	lv_obj_add_event_cb(ci->btn,item_check,LV_EVENT_LONG_PRESSED,ci);
-	lv_group_add_obj(gui_grp,ci->btn);
-	if(list_obj_add_new(&ci->reg->items,ci)!=0){
-		telog_error("cannot add reg item list");
-		abort();
-	}
+	row->btn=lv_btn_create(parent);
+	lv_obj_set_user_data(row->btn,row);
+	lv_obj_set_width(row->btn,lv_pct(100));
+	lv_obj_set_content_height(row->btn,grid_col[0]);
+	lv_style_set_btn_item(row->btn);
+	lv_obj_set_grid_dsc_array(row->btn,grid_col,grid_row);
+	lv_obj_add_event_cb(row->btn,item_click,LV_EVENT_CLICKED,reg);
+	lv_obj_add_event_cb(row->btn,item_check,LV_EVENT_LONG_PRESSED,reg);
+	lv_obj_add_event_cb(row->btn,row_delete,LV_EVENT_DELETE,row);
 
 	// reg image
-	ci->w_img=lv_obj_create(ci->btn);
-	lv_obj_set_size(ci->w_img,grid_col[0],grid_col[0]);
-	lv_obj_clear_flag(ci->w_img,LV_OBJ_FLAG_SCROLLABLE);
-	lv_obj_clear_flag(ci->w_img,LV_OBJ_FLAG_CLICKABLE);
-	lv_obj_set_style_border_width(ci->w_img,0,0);
-	lv_obj_set_style_bg_opa(ci->w_img,LV_OPA_0,0);
+	row->w_img=lv_obj_create(row->btn);
+	lv_obj_set_size(row->w_img,grid_col[0],grid_col[0]);
+	lv_obj_clear_flag(row->w_img,LV_OBJ_FLAG_SCROLLABLE);
+	lv_obj_clear_flag(row->w_img,LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_set_style_border_width(row->w_img,0,0);
+	lv_obj_set_style_bg_opa(row->w_img,LV_OPA_0,0);
 	lv_obj_set_grid_cell(
-		ci->w_img,
+		row->w_img,
 		LV_GRID_ALIGN_STRETCH,0,1,
 		LV_GRID_ALIGN_STRETCH,0,2
 	);
-	ci->img=lv_img_create(ci->w_img);
-	lv_img_src_try(ci->img,"mime",get_icon(ci),NULL);
-	lv_img_set_size_mode(ci->img,LV_IMG_SIZE_MODE_REAL);
-	lv_img_fill_image(ci->img,grid_col[0],grid_col[0]);
-	lv_obj_center(ci->img);
-
-	// reg name and checkbox
-	ci->lbl=lv_label_create(ci->btn);
-	lv_label_set_text(ci->lbl,ci->parent?_("Parent key"):ci->name);
-	if(ci->type!=hive_t_REG_NONE){
+	row->img=lv_img_create(row->w_img);
+	lv_img_set_size_mode(row->img,LV_IMG_SIZE_MODE_REAL);
+
+	// reg name, value and type
+	row->lbl=lv_label_create(row->btn);
+	row->val=lv_label_create(row->btn);
+	lv_label_set_long_mode(row->val,LV_LABEL_LONG_DOT);
+	lv_obj_set_small_text_font(row->val,LV_PART_MAIN);
+	lv_obj_set_grid_cell(
+		row->val,
+		LV_GRID_ALIGN_STRETCH,1,2,
+		LV_GRID_ALIGN_CENTER,1,1
+	);
+	row->xtype=lv_label_create(row->btn);
+	lv_obj_set_style_text_align(row->xtype,LV_TEXT_ALIGN_RIGHT,0);
+	lv_label_set_long_mode(row->xtype,LV_LABEL_LONG_CLIP);
+	lv_obj_set_grid_cell(
+		row->xtype,
+		LV_GRID_ALIGN_STRETCH,2,1,
+		LV_GRID_ALIGN_CENTER,0,1
+	);
+	return row->btn;
+}
+
+static void bind_row(struct vlist*vl,lv_obj_t*obj,size_t idx){
+	char buf[256]={0};
+	struct regedit*reg=vlist_get_data(vl);
+	struct reg_row*row=lv_obj_get_user_data(obj);
+	struct reg_item*ci;
+	if(!reg||!row||idx>=reg->shown_cnt)return;
+	ci=&reg->items[reg->shown[idx]];
+	load_item(ci);
+	lv_img_src_try(row->img,"mime",get_icon(ci),NULL);
+	lv_img_fill_image(row->img,grid_col[0],grid_col[0]);
+	lv_obj_center(row->img);
+	lv_label_set_text(row->lbl,ci->parent?_("Parent key"):ci->name);
+	lv_obj_set_checked(row->btn,ci->checked);
+	if(ci->value){
 		lv_obj_set_grid_cell(
-			ci->lbl,
+			row->lbl,
 			LV_GRID_ALIGN_START,1,1,
 			LV_GRID_ALIGN_CENTER,0,1
 		);
-		ci->val=lv_label_create(ci->btn);
-		lv_label_set_long_mode(ci->val,LV_LABEL_LONG_DOT);
-		lv_obj_set_small_text_font(ci->val,LV_PART_MAIN);
-		lv_obj_set_grid_cell(
-			ci->val,
-			LV_GRID_ALIGN_STRETCH,1,2,
-			LV_GRID_ALIGN_CENTER,1,1
-		);
-		hivex_value_to_string(buf,256,ci->reg->hive,ci->value);
-		lv_label_set_text(ci->val,buf);
-		ci->xtype=lv_label_create(ci->btn);
-		lv_obj_set_style_text_align(ci->xtype,LV_TEXT_ALIGN_RIGHT,0);
-		lv_label_set_long_mode(ci->xtype,LV_LABEL_LONG_CLIP);
-		lv_label_set_text(ci->xtype,hivex_type_to_string(ci->type));
+		hivex_value_to_string(buf,256,reg->hive,ci->value);
+		lv_label_set_text(row->val,buf);
+		lv_label_set_text(row->xtype,hivex_type_to_string(ci->type));
+		lv_obj_clear_flag(row->val,LV_OBJ_FLAG_HIDDEN);
+		lv_obj_clear_flag(row->xtype,LV_OBJ_FLAG_HIDDEN);
+	}else{
 		lv_obj_set_grid_cell(
-			ci->xtype,
-			LV_GRID_ALIGN_STRETCH,2,1,
-			LV_GRID_ALIGN_CENTER,0,1
+			row->lbl,
+			LV_GRID_ALIGN_START,1,2,
+			LV_GRID_ALIGN_CENTER,0,2
 		);
-	}else lv_obj_set_grid_cell(
-		ci->lbl,
-		LV_GRID_ALIGN_START,1,2,
-		LV_GRID_ALIGN_CENTER,0,2
-	);
+		lv_obj_add_flag(row->val,LV_OBJ_FLAG_HIDDEN);
+		lv_obj_add_flag(row->xtype,LV_OBJ_FLAG_HIDDEN);
+	}
 }
 
-static void add_node_item(struct regedit*reg,bool parent,hive_node_h dir,hive_node_h n){
-	if(!reg)return;
-	char*key;
-	struct reg_item*ci=malloc(sizeof(struct reg_item));
-	if(!ci)return;
-	memset(ci,0,sizeof(struct reg_item));
-	if(!parent&&(key=hivex_node_name(reg->hive,n))){
-		strncpy(ci->name,key,sizeof(ci->name)-1);
-		free(key);
+static struct reg_item*add_item(struct regedit*reg){
+	size_t ns;
+	struct reg_item*n;
+	if(reg->count>=reg->size){
+		ns=reg->size>0?reg->size*2:32;
+		if(!(n=realloc(reg->items,sizeof(struct reg_item)*ns))){
+			telog_error("cannot allocate reg item");
+			return NULL;
+		}
+		reg->items=n,reg->size=ns;
 	}
+	n=&reg->items[reg->count++];
+	memset(n,0,sizeof(struct reg_item));
+	n->reg=reg;
+	return n;
+}
+
+static void add_node_item(struct regedit*reg,bool parent,hive_node_h dir,hive_node_h n){
+	struct reg_item*ci;
+	if(!reg||!(ci=add_item(reg)))return;
 	ci->parent=parent;
 	ci->node=n;
-	ci->reg=reg;
 	ci->dir=dir;
-	add_item(ci);
 }
 
 static void add_value_item(struct regedit*reg,hive_node_h dir,hive_value_h v){
-	if(!reg)return;
-	char*key=hivex_value_key(reg->hive,v);
-	struct reg_item*ci=malloc(sizeof(struct reg_item));
-	if(!ci||!key)goto fail;
-	memset(ci,0,sizeof(struct reg_item));
-	size_t len;
-	if(hivex_value_type(reg->hive,v,&ci->type,&len)==-1)goto fail;
-	strncpy(ci->name,key,sizeof(ci->name)-1);
-	free(key);
-	ci->parent=false;
+	struct reg_item*ci;
+	if(!reg||!(ci=add_item(reg)))return;
 	ci->value=v;
-	ci->reg=reg;
 	ci->dir=dir;
-	add_item(ci);
-	return;
-	fail:
-	if(ci)free(ci);
-	if(key)free(key);
 }
 
 static void load_view(struct regedit*reg){
@@ -310,6 +382,11 @@ static void load_view(struct regedit*reg){
 			for(i=0;vs[i];i++)add_value_item(reg,reg->node,vs[i]);
 			free(vs);
 		}
+		if(reg->count>0&&!(reg->shown=malloc(sizeof(size_t)*reg->count))){
+			telog_error("cannot allocate reg rows");
+			reg->count=0;
+		}
+		apply_filter(reg,reg->filter,false);
 	}else set_info(reg,_("nothing here"));
 }
 
@@ -317,6 +394,8 @@ static int regedit_get_focus(struct gui_activity*d){
 	struct regedit*reg=d->data;
 	if(!reg)return 0;
 	load_view(reg);
+	vlist_set_group(reg->list,gui_grp);
+	lv_group_add_obj(gui_grp,reg->search);
 	lv_group_add_obj(gui_grp,reg->btn_add);
 	lv_group_add_obj(gui_grp,reg->btn_reload);
 	lv_group_add_obj(gui_grp,reg->btn_delete);
@@ -331,11 +410,8 @@ static int regedit_get_focus(struct gui_activity*d){
 static int regedit_lost_focus(struct gui_activity*d){
 	struct regedit*reg=d->data;
 	if(!reg)return 0;
-	list*o=list_first(reg->items);
-	if(o)do{
-		LIST_DATA_DECLARE(item,o,struct reg_item*);
-		if(item->btn)lv_group_remove_obj(item->btn);
-	}while((o=o->next));
+	vlist_set_group(reg->list,NULL);
+	lv_group_remove_obj(reg->search);
 	lv_group_remove_obj(reg->btn_add);
 	lv_group_remove_obj(reg->btn_reload);
 	lv_group_remove_obj(reg->btn_delete);
@@ -357,6 +433,7 @@ static void close_file(struct regedit*reg){
 	list_free_all_def(reg->path);
 	reg->node=0,reg->root=0,reg->changed=false;
 	reg->hive=NULL,reg->path=NULL;
+	clear_filter(reg);
 	load_view(reg);
 }
 
@@ -455,7 +532,7 @@ static bool reg_save_cb(uint16_t id,const char*btn __attribute__((unused)),void*
 }
 
 static bool reg_delete_cb(uint16_t id,const char*btn __attribute__((unused)),void*user_data){
-	list*l;
+	struct reg_item*item;
 	if(id!=0)return false;
 	struct regedit*reg=user_data;
 	bool failed=false,change_value=false;
@@ -464,11 +541,12 @@ static bool reg_delete_cb(uint16_t id,const char*btn __attribute__((unused)),voi
 	if(!vs){
 		telog_warn("get values failed");
 		failed=true;
-	}else if((l=list_first(reg->items)))do{
-		LIST_DATA_DECLARE(item,l,struct reg_item*);
-		if(!lv_obj_is_checked(item->btn))continue;
+	}else for(size_t x=0;x<reg->count;x++){
+		item=&reg->items[x];
+		if(!item->checked)continue;
+		load_item(item);
 		if(
-			item->node&&!item->value&&item->type==hive_t_REG_NONE&&
+			item->node&&!item->value&&
 			hivex_node_delete_child(reg->hive,item->node)!=0
 		){
 			telog_warn(
@@ -477,7 +555,7 @@ static bool reg_delete_cb(uint16_t id,const char*btn __attribute__((unused)),voi
 			);
 			failed=true;
 		}
-		if(!item->node&&item->value&&item->type!=hive_t_REG_NONE){
+		if(!item->node&&item->value){
 			bool found=false;
 			for(size_t i=0;i<len;i++){
 				if(vs[i]!=item->value)continue;
@@ -493,7 +571,7 @@ static bool reg_delete_cb(uint16_t id,const char*btn __attribute__((unused)),voi
 			}
 		}
 		reg->changed=true;
-	}while((l=l->next));
+	}
 	if(change_value&&!failed){
 		size_t new_len=0;
 		struct hive_set_value*sv;
@@ -532,11 +610,11 @@ static bool reg_delete_cb(uint16_t id,const char*btn __attribute__((unused)),voi
 		}
 	}
 	if(failed)msgbox_alert("One or more items failed to delete");
+	load_view(reg);
 	return false;
 }
 
 static void btns_cb(lv_event_t*e){
-	list*l;
 	static struct regedit_value value;
 	static const char*create_buttons[]={
 		"Registry Key",
@@ -566,19 +644,18 @@ static void btns_cb(lv_event_t*e){
 			"Are you sure you want to delete selected items?"
 		),reg);
 	}else if(e->target==reg->btn_edit){
-		if((l=list_first(reg->items)))do{
-			LIST_DATA_DECLARE(item,l,struct reg_item*);
-			if(lv_obj_is_checked(item->btn)){
-				value.value=item->value;
-				value.node=item->dir;
-			}
-		}while((l=l->next));
+		for(size_t i=0;i<reg->count;i++){
+			if(!reg->items[i].checked)continue;
+			value.value=reg->items[i].value;
+			value.node=reg->items[i].dir;
+		}
 		if(value.value)guiact_start_activity(
 			&guireg_regedit_value,&value
 		);
 	}else if(e->target==reg->btn_home){
 		list_free_all_def(reg->path);
 		reg->path=NULL,reg->node=reg->root;
+		clear_filter(reg);
 		load_view(reg);
 	}else if(e->target==reg->btn_save){
 		if(reg->changed)msgbox_set_user_data(msgbox_create_yesno(
@@ -593,6 +670,13 @@ static void btns_cb(lv_event_t*e){
 	}
 }
 
+static void search_cb(lv_event_t*e){
+	struct regedit*reg=e->user_data;
+	const char*text=lv_textarea_get_text(reg->search);
+	if(!text||strcmp(text,reg->filter)==0)return;
+	apply_filter(reg,text,true);
+}
+
 static int regedit_draw(struct gui_activity*act){
 	struct regedit*reg=(struct regedit*)act->data;
 	if(!reg)return 0;
@@ -603,8 +687,17 @@ static int regedit_draw(struct gui_activity*act){
 	reg->view=lv_obj_create(reg->scr);
 	lv_obj_set_width(reg->view,lv_pct(100));
 	lv_obj_set_style_border_width(reg->view,0,0);
-	lv_obj_set_flex_flow(reg->view,LV_FLEX_FLOW_COLUMN);
 	lv_obj_set_flex_grow(reg->view,1);
+	if(!(reg->list=vlist_create(reg->view,create_row,bind_row)))return -1;
+	vlist_set_data(reg->list,reg);
+
+	// incremental search in current key
+	reg->search=lv_textarea_create(reg->scr);
+	lv_obj_set_width(reg->search,lv_pct(100));
+	lv_textarea_set_one_line(reg->search,true);
+	lv_textarea_set_placeholder_text(reg->search,_("Search"));
+	lv_obj_add_event_cb(reg->search,lv_input_cb,LV_EVENT_CLICKED,NULL);
+	lv_obj_add_event_cb(reg->search,search_cb,LV_EVENT_VALUE_CHANGED,reg);
 
 	// current path
 	reg->lbl_path=lv_label_create(reg->scr);
@@ -645,10 +738,12 @@ static int regedit_draw(struct gui_activity*act){
 static int do_clean(struct gui_activity*d){
 	struct regedit*reg=d->data;
 	if(!reg)return 0;
-	list_free_all_def(reg->items);
+	if(reg->items)free(reg->items);
+	if(reg->shown)free(reg->shown);
+	vlist_free(reg->list);
 	list_free_all_def(reg->path);
 	if(reg->hive)hivex_close(reg->hive);
-	reg->items=NULL,reg->path=NULL,reg->info=NULL;
+	reg->items=NULL,reg->shown=NULL,reg->path=NULL,reg->info=NULL;
 	reg->hive=NULL,reg->root=0,reg->node=0;
 	free(reg);
 	d->data=NULL;
@@ -18,9 +18,14 @@ extern struct gui_register guireg_regedit;
 extern struct gui_register guireg_regedit_value;
 struct regedit{
 	bool changed;
-	lv_obj_t*view,*scr,*info,*lbl_path,*last_btn;
+	lv_obj_t*view,*scr,*info,*lbl_path,*search,*last_btn;
 	lv_obj_t*btn_add,*btn_reload,*btn_delete,*btn_edit,*btn_home,*btn_load,*btn_save;
-	list*path,*items;
+	list*path;
+	struct reg_item*items;
+	size_t count,size;
+	size_t*shown,shown_cnt;
+	char filter[256];
+	struct vlist*list;
 	hive_h*hive;
 	hive_node_h root,node;
 };
@@ -72,10 +72,16 @@ static void serial_port_close(struct serial_port*port){
 }
 
 #ifdef ENABLE_UEFI
+
+// serial io has no event to wait on, poll fast while data flows
+#define SERIAL_POLL_MIN 10
+#define SERIAL_POLL_MAX 100
+
 static void serial_port_read_task(lv_timer_t*tsk){
 	UINTN bs;
 	EFI_STATUS st;
 	char buf[256];
+	bool got=false;
 	struct serial_port*port=tsk->user_data;
 	if(!port->open||!port->proto||port->task!=tsk)return;
 	struct tsm_vte*vte=lv_termview_get_vte(
@@ -87,13 +93,16 @@ static void serial_port_read_task(lv_timer_t*tsk){
 		if(bs>0){
 			tsm_vte_input(vte,buf,(size_t)bs);
 			lv_termview_update(port->con->termview);
+			got=true;
 		}
-		if(st!=EFI_TIMEOUT)lv_termview_line_printf(
+		if(EFI_ERROR(st)&&st!=EFI_TIMEOUT)lv_termview_line_printf(
 			port->con->termview,
 			_("[receive data failed: %s]"),
 			ERRSTR
 		);
 	}while(bs>0);
+	lv_timer_set_period(tsk,got?SERIAL_POLL_MIN:
+		MIN(tsk->period*2,(uint32_t)SERIAL_POLL_MAX));
 }
 #else
 static void*serial_port_read_thread(void*data){
@@ -111,7 +120,7 @@ static void*serial_port_read_thread(void*data){
 		FD_SET(port->fd,&fds);
 		t.tv_sec=1,t.tv_usec=0;
 		if(select(FD_SETSIZE,&fds,NULL,NULL,&t)<0)switch(errno){
-			case EAGAIN:usleep(50000);//fallthrough
+			case EAGAIN:
 			case EINTR:continue;
 			default:
 				telog_warn("select failed");
@@ -144,6 +153,7 @@ static void*serial_port_read_thread(void*data){
 				lv_termview_update(port->con->termview);
 			}
 			MUTEX_UNLOCK(gui_lock);
+			gui_wakeup();
 		}
 	}
 	MUTEX_LOCK(gui_lock);
@@ -250,7 +260,7 @@ static int serial_port_launch(struct gui_activity*act){
 	if(!port->proto)FAIL(_("[no serial port specified]"));
 	serial_set_speed(port);
 	port->open=true;
-	port->task=lv_timer_create(serial_port_read_task,50,port);
+	port->task=lv_timer_create(serial_port_read_task,SERIAL_POLL_MIN,port);
 	#else
 	if(port->port[0]){
 		errno=0;
@@ -99,7 +99,7 @@ static void*pty_dispatch_thread(void*data){
 			continue;
 		}
 		if(select(FD_SETSIZE,&fds,NULL,NULL,&t)<0)switch(errno){
-			case EAGAIN:usleep(50000);//fallthrough
+			case EAGAIN:
 			case EINTR:continue;
 			default:
 				telog_warn("select failed");
@@ -116,6 +116,7 @@ static void*pty_dispatch_thread(void*data){
 		MUTEX_LOCK(gui_lock);
 		lv_async_call(pty_dispatch_task,term);
 		MUTEX_UNLOCK(gui_lock);
+		gui_wakeup();
 		sem_wait(&term->cont);
 	}
 	MUTEX_LOCK(gui_lock);
@@ -9,12 +9,181 @@
 #ifdef ENABLE_GUI
 #ifdef ENABLE_LIBTSM
 #include<stdio.h>
+#include<string.h>
 #include<stdarg.h>
 #include"gui/termview.h"
 #include"shl-llog.h"
 #include"libtsm.h"
 #define LV_OBJX_NAME "lv_termview"
 
+/*
+ * cells are copied straight into the canvas buffer instead of going
+ * through the lvgl label code. the coverage of a cell (every code point
+ * of it and the underline, placed the way lv_draw_letter places them)
+ * is rendered once and kept by the tsm symbol id, the colors are mixed
+ * while copying, so one mask serves every fg and bg, a cell is written
+ * in a single pass.
+ * an update walks the screen twice: the first walk hashes every row,
+ * when no cell is newer than the last draw it stops there. rows that
+ * moved are found by their hashes and moved inside the buffer, the
+ * second walk only draws rows that differ from what the canvas shows,
+ * and only those rows are invalidated.
+ */
+#define TERM_GLYPH_BUCKETS 256
+#define TERM_GLYPH_CACHE   0x40000
+#define TERM_HASH_BASIS    0xCBF29CE484222325ULL
+#define TERM_HASH_PRIME    0x100000001B3ULL
+
+// masks do not depend on the inverse and blink bits
+#define TERM_GLYPH_KEY(id) ((id)&~(3ULL<<(TSM_UCS4_MAX_BITS+3)))
+
+struct term_glyph{
+	uint64_t key;
+	unsigned int cw;
+	size_t size;
+	struct term_glyph*hnext,*prev,*next;
+	uint8_t mask[];
+};
+
+struct term_cache{
+	struct term_glyph*table[TERM_GLYPH_BUCKETS];
+	struct term_glyph*head,*tail;
+	size_t used;
+	uint32_t rows;
+	uint64_t*shown,*hash;
+	bool*dirty;
+	bool aged;
+	uint32_t first,last;
+};
+
+static void glyph_unlink(struct term_cache*c,struct term_glyph*g){
+	if(g->prev)g->prev->next=g->next;
+	else c->head=g->next;
+	if(g->next)g->next->prev=g->prev;
+	else c->tail=g->prev;
+	g->prev=NULL,g->next=NULL;
+}
+
+static void glyph_drop(struct term_cache*c,struct term_glyph*g){
+	struct term_glyph**p=&c->table[g->key%TERM_GLYPH_BUCKETS];
+	while(*p&&*p!=g)p=&(*p)->hnext;
+	if(*p)*p=g->hnext;
+	glyph_unlink(c,g);
+	c->used-=g->size;
+	lv_mem_free(g);
+}
+
+static void glyph_purge(struct term_cache*c){
+	while(c&&c->head)glyph_drop(c,c->head);
+}
+
+static inline uint8_t glyph_px(const uint8_t*bmp,uint8_t bpp,uint32_t i){
+	switch(bpp){
+		case 1:return (bmp[i>>3]>>(7-(i&7)))&1?0xFF:0;
+		case 2:return ((bmp[i>>2]>>(6-(i&3)*2))&3)*0x55;
+		case 4:return ((bmp[i>>1]>>((i&1)?0:4))&0xF)*0x11;
+		case 8:return bmp[i];
+		default:return 0;
+	}
+}
+
+static void glyph_render(
+	uint8_t*mask,
+	const uint32_t*cs,size_t len,
+	lv_coord_t w,lv_coord_t h,
+	const lv_font_t*font,bool underline
+){
+	const uint8_t*bmp;
+	lv_font_glyph_dsc_t g;
+	lv_coord_t gx,gy,x,y,uy,ut;
+	memset(mask,0,w*h);
+	for(size_t i=0;i<len;i++){
+		if(!lv_font_get_glyph_dsc(font,&g,cs[i],0))continue;
+		if(g.box_w<=0||g.box_h<=0||!g.resolved_font)continue;
+		if(g.bpp!=1&&g.bpp!=2&&g.bpp!=4&&g.bpp!=8)continue;
+		if(!(bmp=lv_font_get_glyph_bitmap(g.resolved_font,cs[i])))continue;
+		gx=g.ofs_x,gy=(font->line_height-font->base_line)-g.box_h-g.ofs_y;
+		for(y=0;y<g.box_h;y++){
+			if(gy+y<0||gy+y>=h)continue;
+			for(x=0;x<g.box_w;x++){
+				if(gx+x<0||gx+x>=w)continue;
+				uint8_t v=glyph_px(bmp,g.bpp,y*g.box_w+x);
+				uint8_t*m=&mask[(gy+y)*w+gx+x];
+				if(v>*m)*m=v;
+			}
+		}
+	}
+	if(!underline)return;
+	ut=font->underline_thickness?font->underline_thickness:1;
+	uy=font->line_height-font->base_line-font->underline_position-ut/2;
+	for(y=LV_MAX(uy,0);y<uy+ut&&y<h;y++)
+		memset(&mask[y*w],0xFF,w);
+}
+
+static const uint8_t*glyph_get(
+	lv_termview_t*term,uint64_t id,
+	const uint32_t*cs,size_t len,unsigned int cw,
+	const lv_font_t*font,bool underline
+){
+	struct term_glyph*g;
+	struct term_cache*c=term->cache;
+	uint64_t key=TERM_GLYPH_KEY(id);
+	lv_coord_t w=term->glyph_width*cw,h=term->glyph_height;
+	struct term_glyph**head=&c->table[key%TERM_GLYPH_BUCKETS];
+	for(g=*head;g;g=g->hnext){
+		if(g->key!=key||g->cw!=cw)continue;
+		if(g!=c->head){
+			glyph_unlink(c,g);
+			g->next=c->head;
+			if(c->head)c->head->prev=g;
+			c->head=g;
+			if(!c->tail)c->tail=g;
+		}
+		return g->mask;
+	}
+	size_t size=sizeof(struct term_glyph)+w*h;
+	while(c->tail&&c->used+size>TERM_GLYPH_CACHE)glyph_drop(c,c->tail);
+	if(!(g=lv_mem_alloc(size)))return NULL;
+	g->key=key,g->cw=cw,g->size=size;
+	glyph_render(g->mask,cs,len,w,h,font,underline);
+	g->hnext=*head,*head=g;
+	g->prev=NULL,g->next=c->head;
+	if(c->head)c->head->prev=g;
+	c->head=g;
+	if(!c->tail)c->tail=g;
+	c->used+=size;
+	return g->mask;
+}
+
+// forget what the canvas shows, the next update draws every row
+static void term_invalidate_rows(lv_termview_t*term){
+	struct term_cache*c=term->cache;
+	if(!c||!c->shown)return;
+	memset(c->shown,0,sizeof(uint64_t)*c->rows);
+}
+
+static bool term_alloc_rows(lv_termview_t*term,uint32_t rows){
+	struct term_cache*c=term->cache;
+	if(!c)return false;
+	if(c->rows==rows&&c->shown)return true;
+	if(c->shown)lv_mem_free(c->shown);
+	if(c->hash)lv_mem_free(c->hash);
+	if(c->dirty)lv_mem_free(c->dirty);
+	c->shown=NULL,c->hash=NULL,c->dirty=NULL,c->rows=0;
+	if(rows<=0)return false;
+	if(
+		!(c->shown=lv_mem_alloc(sizeof(uint64_t)*rows))||
+		!(c->hash=lv_mem_alloc(sizeof(uint64_t)*rows))||
+		!(c->dirty=lv_mem_alloc(sizeof(bool)*rows))
+	){
+		LV_LOG_ERROR("cannot allocate terminal rows");
+		return false;
+	}
+	c->rows=rows;
+	term_invalidate_rows(term);
+	return true;
+}
+
 void lv_termview_resize(lv_obj_t*tv){
 	if(!tv)return;
 	uint32_t cols,rows;
@@ -57,6 +226,7 @@ void lv_termview_resize(lv_obj_t*tv){
 	if(term->glyph_height!=term->font_reg->line_height){
 		term->glyph_height=term->font_reg->line_height;
 		term->glyph_width=term->font_reg->line_height/2;
+		glyph_purge(term->cache);
 	}
 	if(term->glyph_height<=0||term->glyph_width<=0){
 		LV_LOG_WARN("invalid glyph size");
@@ -75,6 +245,8 @@ void lv_termview_resize(lv_obj_t*tv){
 		tv,LV_PART_MAIN
 	);
 	lv_canvas_fill_bg(tv,bg,LV_OPA_COVER);
+	term_alloc_rows(term,rows);
+	term_invalidate_rows(term);
 	term->max_sb=LV_MAX(
 		term->max_sb,
 		(uint32_t)(cols*rows*128)
@@ -87,57 +259,155 @@ void lv_termview_resize(lv_obj_t*tv){
 	lv_termview_update(tv);
 }
 
+static inline uint64_t term_hash(uint64_t h,uint64_t v){
+	for(int i=0;i<8;i++,v>>=8)h=(h^(v&0xFF))*TERM_HASH_PRIME;
+	return h;
+}
+
+static int term_hash_cell(
+	struct tsm_screen*screen,
+	uint64_t id,
+	const uint32_t*cs __attribute__((unused)),
+	size_t len,
+	unsigned int cw,
+	unsigned int px,
+	unsigned int py,
+	const struct tsm_screen_attr*a,
+	tsm_age_t age,
+	void *data
+){
+	uint64_t h;
+	lv_termview_t*term=data;
+	struct term_cache*c=term->cache;
+	if(screen!=term->screen||py>=c->rows||px>=term->cols)return 0;
+	h=term_hash(c->hash[py],len>0?id:id&~((1ULL<<TSM_UCS4_MAX_BITS)-1));
+	h=term_hash(h,
+		((uint64_t)a->fr<<40)|((uint64_t)a->fg<<32)|((uint64_t)a->fb<<24)|
+		((uint64_t)a->br<<16)|((uint64_t)a->bg<<8)|a->bb
+	);
+	c->hash[py]=term_hash(h,cw);
+	if(!age||!term->age||age>term->age)c->aged=true;
+	return 0;
+}
+
 static int term_draw_cell(
 	struct tsm_screen*screen,
-	uint64_t id __attribute__((unused)),
+	uint64_t id,
 	const uint32_t*cs,
 	size_t len,
 	unsigned int cw,
 	unsigned int px,
 	unsigned int py,
 	const struct tsm_screen_attr*a,
-	tsm_age_t age,
+	tsm_age_t age __attribute__((unused)),
 	void *data
 ){
-	char xs[8];
-	lv_obj_t*tv=data;
-	lv_color_t fc,bc;
-	lv_coord_t dw,dh,x,y;
-	lv_draw_rect_dsc_t rd;
-	lv_draw_label_dsc_t ld;
-	lv_termview_t*term=(lv_termview_t*)tv;
+	uint8_t m;
+	lv_color_t fc,bc,t,*row;
+	const lv_font_t*font;
+	const uint8_t*mask=NULL;
+	lv_coord_t dw,dh,mw,mh,x,y;
+	lv_termview_t*term=data;
 	if(!term||screen!=term->screen||cw<=0)return 0;
 	if(px>=term->cols||py>=term->rows)return 0;
-	if(age&&term->age&&age<=term->age)return 0;
-	lv_draw_rect_dsc_init(&rd);
+	if(py>=term->cache->rows||!term->cache->dirty[py])return 0;
 	fc=(lv_color_t)LV_COLOR_MAKE(a->fr,a->fg,a->fb);
 	bc=(lv_color_t)LV_COLOR_MAKE(a->br,a->bg,a->bb);
-	rd.bg_color=a->inverse?fc:bc;
+	if(a->inverse)t=fc,fc=bc,bc=t;
 	x=px*term->glyph_width,y=py*term->glyph_height;
-	dw=term->glyph_width*cw,dh=term->glyph_height;
-	if(px==term->cols-1||dh+x>term->width)dw=term->width-x;
+	mw=dw=term->glyph_width*cw,mh=dh=term->glyph_height;
+	if(px==term->cols-1||dw+x>term->width)dw=term->width-x;
 	if(py==term->rows-1||dh+y>term->height)dh=term->height-y;
-	lv_canvas_draw_rect(tv,x,y,dw,dh,&rd);
-	if(len<=0)return 0;
-	lv_draw_label_dsc_init(&ld);
-	ld.color=a->inverse?bc:fc;
-	if(a->bold&&a->italic)ld.font=term->font_bold_ital;
-	else if(a->italic)ld.font=term->font_ital;
-	else if(a->bold)ld.font=term->font_bold;
-	else ld.font=term->font_reg;
-	if(!ld.font)return 0;
-	if(a->underline)ld.decor=LV_TEXT_DECOR_UNDERLINE;
-	for(size_t i=0;i<len;i++){
-		memset(xs,0,sizeof(xs));
-		tsm_ucs4_to_utf8(cs[i],xs);
-		dw=term->glyph_width*cw;
-		if(x+dw>term->width)dw=term->width-x;
-		lv_canvas_draw_text(tv,x,y,dw,&ld,xs);
-		x+=dw;
+	if(a->bold&&a->italic)font=term->font_bold_ital;
+	else if(a->italic)font=term->font_ital;
+	else if(a->bold)font=term->font_bold;
+	else font=term->font_reg;
+	if(len>0&&font)mask=glyph_get(
+		term,id,cs,len,cw,
+		font,a->underline
+	);
+	for(lv_coord_t yy=0;yy<dh;yy++){
+		row=term->buffer+(y+yy)*term->width+x;
+		if(!mask||yy>=mh){
+			for(lv_coord_t xx=0;xx<dw;xx++)row[xx]=bc;
+			continue;
+		}
+		for(lv_coord_t xx=0;xx<dw;xx++){
+			m=xx<mw?mask[yy*mw+xx]:0;
+			if(m==0)row[xx]=bc;
+			else if(m==0xFF)row[xx]=fc;
+			else row[xx]=lv_color_mix(fc,bc,m);
+		}
 	}
 	return 0;
 }
 
+// finds how far the text moved since the last draw, 0 when it did not
+static int term_find_shift(struct term_cache*c){
+	int best=0;
+	uint32_t cnt,most=0;
+	for(uint32_t i=0;i<c->rows;i++)
+		if(c->shown[i]&&c->hash[i]==c->shown[i])most++;
+	for(int k=1-(int)c->rows;k<(int)c->rows;k++){
+		if(k==0)continue;
+		cnt=0;
+		for(uint32_t i=0;i<c->rows;i++){
+			int64_t o=(int64_t)i+k;
+			if(o<0||o>=c->rows||!c->shown[o])continue;
+			if(c->hash[i]==c->shown[o])cnt++;
+		}
+		if(cnt>most&&cnt>=2)most=cnt,best=k;
+	}
+	return best;
+}
+
+// the last row is taller than the others, it is always drawn again
+static void term_shift(lv_termview_t*term,int k){
+	struct term_cache*c=term->cache;
+	uint32_t n=c->rows-(k>0?k:-k);
+	size_t band=term->width*term->glyph_height;
+	if(k>0){
+		memmove(term->buffer,term->buffer+band*k,sizeof(lv_color_t)*band*n);
+		memmove(c->shown,c->shown+k,sizeof(uint64_t)*n);
+		memset(c->shown+n,0,sizeof(uint64_t)*k);
+	}else{
+		memmove(term->buffer+band*-k,term->buffer,sizeof(lv_color_t)*band*n);
+		memmove(c->shown-k,c->shown,sizeof(uint64_t)*n);
+		memset(c->shown,0,sizeof(uint64_t)*-k);
+	}
+	c->shown[c->rows-1]=0;
+	c->first=0,c->last=c->rows-1;
+}
+
+void lv_termview_update(lv_obj_t*tv){
+	lv_area_t area;
+	lv_termview_t*term=(lv_termview_t*)tv;
+	struct term_cache*c=term->cache;
+	if(!c||!c->shown||!term->buffer||c->rows!=term->rows){
+		term->age=0;
+		return;
+	}
+	for(uint32_t i=0;i<c->rows;i++)c->hash[i]=TERM_HASH_BASIS;
+	c->aged=false,c->first=UINT32_MAX,c->last=0;
+	term->age=tsm_screen_draw(term->screen,term_hash_cell,term);
+	if(!c->aged)return;
+	for(uint32_t i=0;i<c->rows;i++)c->hash[i]|=1;
+	int k=term_find_shift(c);
+	if(k!=0)term_shift(term,k);
+	for(uint32_t i=0;i<c->rows;i++){
+		if(!(c->dirty[i]=c->hash[i]!=c->shown[i]))continue;
+		c->first=LV_MIN(c->first,i),c->last=LV_MAX(c->last,i);
+		c->shown[i]=c->hash[i];
+	}
+	if(c->first>c->last)return;
+	term->age=tsm_screen_draw(term->screen,term_draw_cell,term);
+	lv_obj_get_coords(tv,&area);
+	area.y1+=c->first*term->glyph_height;
+	if(c->last<c->rows-1)area.y2=area.y1+
+		(c->last-c->first+1)*term->glyph_height-1;
+	lv_obj_invalidate_area(tv,&area);
+}
+
 static void log_cb(
 	void*data __attribute__((unused)),
 	const char*file,
@@ -269,6 +539,8 @@ void lv_termview_set_font(lv_obj_t*tv,const lv_font_t*font){
 	term->font_ital=font;
 	term->font_bold_ital=font;
 	term->cust_font=true;
+	glyph_purge(term->cache);
+	term_invalidate_rows(term);
 }
 
 void lv_termview_set_font_regular(lv_obj_t*tv,lv_font_t*font){
@@ -278,6 +550,8 @@ void lv_termview_set_font_regular(lv_obj_t*tv,lv_font_t*font){
 	term->glyph_width=font->line_height/2;
 	term->font_reg=font;
 	term->cust_font=true;
+	glyph_purge(term->cache);
+	term_invalidate_rows(term);
 }
 
 void lv_termview_set_font_bold(lv_obj_t*tv,lv_font_t*font){
@@ -285,6 +559,8 @@ void lv_termview_set_font_bold(lv_obj_t*tv,lv_font_t*font){
 	if(!font||font->line_height<=0)return;
 	term->font_bold=font;
 	term->cust_font=true;
+	glyph_purge(term->cache);
+	term_invalidate_rows(term);
 }
 
 void lv_termview_set_font_italic(lv_obj_t*tv,lv_font_t*font){
@@ -292,6 +568,8 @@ void lv_termview_set_font_italic(lv_obj_t*tv,lv_font_t*font){
 	if(!font||font->line_height<=0)return;
 	term->font_ital=font;
 	term->cust_font=true;
+	glyph_purge(term->cache);
+	term_invalidate_rows(term);
 }
 
 void lv_termview_set_font_bold_italic(lv_obj_t*tv,lv_font_t*font){
@@ -299,15 +577,8 @@ void lv_termview_set_font_bold_italic(lv_obj_t*tv,lv_font_t*font){
 	if(!font)return;
 	term->font_bold_ital=font;
 	term->cust_font=true;
-}
-
-void lv_termview_update(lv_obj_t*tv){
-	lv_termview_t*term=(lv_termview_t*)tv;
-	term->age=tsm_screen_draw(
-		term->screen,
-		term_draw_cell,
-		tv
-	);
+	glyph_purge(term->cache);
+	term_invalidate_rows(term);
 }
 
 uint32_t lv_termview_get_cols(lv_obj_t*tv){
@@ -397,6 +668,9 @@ static void lv_termview_constructor(const lv_obj_class_t*class_p,lv_obj_t*obj){
 	ext->glyph_height=0,ext->glyph_width=0;
 	ext->cols=0,ext->rows=0,ext->age=0;
 	ext->buffer=NULL,ext->mem_size=0;
+	if((ext->cache=lv_mem_alloc(sizeof(struct term_cache))))
+		memset(ext->cache,0,sizeof(struct term_cache));
+	else LV_LOG_ERROR("cannot allocate terminal cache");
 	ext->mods=0,ext->drag_y_last=0;
 	ext->resize_cb=NULL;
 	ext->write_cb=NULL;
@@ -438,9 +712,15 @@ static void lv_termview_destructor(const lv_obj_class_t*class_p,lv_obj_t*obj){
 	if(term->screen)tsm_screen_unref(term->screen);
 	if(term->vte)tsm_vte_unref(term->vte);
 	if(term->buffer)lv_mem_free(term->buffer);
+	if(term->cache){
+		glyph_purge(term->cache);
+		term_alloc_rows(term,0);
+		lv_mem_free(term->cache);
+	}
 	term->screen=NULL;
 	term->vte=NULL;
 	term->buffer=NULL;
+	term->cache=NULL;
 }
 
 const lv_obj_class_t lv_termview_class={
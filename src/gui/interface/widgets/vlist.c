@@ -0,0 +1,240 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_GUI
+#include<stdlib.h>
+#include<stdint.h>
+#include"gui.h"
+#include"logger.h"
+#include"defines.h"
+#include"gui/vlist.h"
+#define TAG "vlist"
+
+/*
+ * a list that only has objects for the rows on screen. all rows have
+ * the height of the first one, a spacer sized for every item gives the
+ * container its scroll range, rows are placed by hand over it.
+ * item i always goes to row i modulo the row count, so a scroll only
+ * binds the rows that came into view and the group order of the rows
+ * follows the item order. a focused row pulls its neighbours into view,
+ * keys never walk into a row that is waiting to be reused.
+ */
+struct vlist{
+	lv_obj_t*cont,*spacer;
+	lv_obj_t**rows;
+	size_t*bound;
+	size_t cnt,count;
+	lv_coord_t row_h,gap;
+	lv_group_t*grp;
+	vlist_create_row create;
+	vlist_bind_row bind;
+	void*data;
+};
+
+static void layout(struct vlist*vl,bool force);
+
+static void row_focused(lv_event_t*e){
+	struct vlist*vl=e->user_data;
+	ssize_t idx=vlist_get_row_index(vl,e->current_target);
+	if(idx>=0)vlist_scroll_to(vl,idx);
+}
+
+static void free_rows(struct vlist*vl){
+	if(vl->cont)for(size_t i=0;i<vl->cnt;i++)
+		if(vl->rows[i])lv_obj_del(vl->rows[i]);
+	if(vl->rows)free(vl->rows);
+	if(vl->bound)free(vl->bound);
+	vl->rows=NULL,vl->bound=NULL;
+	vl->cnt=0,vl->row_h=0;
+}
+
+// rows are added in item order, a bigger pool is put in again
+static void set_rows_group(struct vlist*vl,lv_group_t*grp){
+	for(size_t i=0;i<vl->cnt;i++){
+		if(!vl->rows[i])continue;
+		if(lv_obj_get_group(vl->rows[i]))
+			lv_group_remove_obj(vl->rows[i]);
+		if(grp)lv_group_add_obj(grp,vl->rows[i]);
+	}
+}
+
+static bool grow_rows(struct vlist*vl,size_t cnt){
+	lv_obj_t**rows;
+	size_t*bound;
+	if(cnt<=vl->cnt)return true;
+	if(!(rows=realloc(vl->rows,sizeof(lv_obj_t*)*cnt)))return false;
+	vl->rows=rows;
+	if(!(bound=realloc(vl->bound,sizeof(size_t)*cnt)))return false;
+	vl->bound=bound;
+	for(size_t i=vl->cnt;i<cnt;i++){
+		if(!(rows[i]=vl->create(vl,vl->cont))){
+			tlog_warn("create row failed");
+			break;
+		}
+		lv_obj_add_flag(rows[i],LV_OBJ_FLAG_HIDDEN);
+		lv_obj_clear_flag(rows[i],LV_OBJ_FLAG_SCROLL_ON_FOCUS);
+		lv_obj_add_event_cb(rows[i],row_focused,LV_EVENT_FOCUSED,vl);
+		vl->cnt++;
+	}
+
+	// the item to row mapping changed
+	for(size_t i=0;i<vl->cnt;i++)bound[i]=SIZE_MAX;
+	if(vl->grp)set_rows_group(vl,vl->grp);
+	return vl->cnt>=cnt;
+}
+
+static bool measure(struct vlist*vl){
+	if(vl->row_h>0)return true;
+	if(!grow_rows(vl,1))return false;
+	lv_obj_clear_flag(vl->rows[0],LV_OBJ_FLAG_HIDDEN);
+	lv_obj_update_layout(vl->rows[0]);
+	vl->gap=lv_obj_get_style_pad_row(vl->cont,LV_PART_MAIN);
+	vl->row_h=lv_obj_get_height(vl->rows[0])+vl->gap;
+	if(vl->row_h<=0){
+		vl->row_h=0;
+		return false;
+	}
+	return true;
+}
+
+static void layout(struct vlist*vl,bool force){
+	size_t first,need,idx,slot;
+	lv_coord_t view_h,scroll;
+	if(!vl||!vl->cont)return;
+	if(vl->count<=0){
+		for(size_t i=0;i<vl->cnt;i++){
+			lv_obj_add_flag(vl->rows[i],LV_OBJ_FLAG_HIDDEN);
+			vl->bound[i]=SIZE_MAX;
+		}
+		lv_obj_set_height(vl->spacer,0);
+		return;
+	}
+	if(!measure(vl))return;
+	lv_obj_set_height(vl->spacer,vl->count*vl->row_h-vl->gap);
+	view_h=lv_obj_get_content_height(vl->cont);
+	need=MIN((size_t)(MAX(view_h,0)/vl->row_h+2),vl->count);
+	grow_rows(vl,need);
+	scroll=MAX(lv_obj_get_scroll_y(vl->cont),0);
+	first=MIN((size_t)(scroll/vl->row_h),vl->count-1);
+	if(first+vl->cnt>vl->count)first=vl->count>vl->cnt?vl->count-vl->cnt:0;
+	for(size_t i=0;i<vl->cnt;i++){
+		idx=first+i,slot=idx%vl->cnt;
+		if(idx>=vl->count){
+			lv_obj_add_flag(vl->rows[slot],LV_OBJ_FLAG_HIDDEN);
+			vl->bound[slot]=SIZE_MAX;
+			continue;
+		}
+		if(!force&&vl->bound[slot]==idx)continue;
+		vl->bound[slot]=idx;
+		lv_obj_set_y(vl->rows[slot],idx*vl->row_h);
+		lv_obj_clear_flag(vl->rows[slot],LV_OBJ_FLAG_HIDDEN);
+		vl->bind(vl,vl->rows[slot],idx);
+	}
+}
+
+static void cont_event(lv_event_t*e){
+	struct vlist*vl=e->user_data;
+	switch(e->code){
+		case LV_EVENT_SCROLL:layout(vl,false);break;
+		case LV_EVENT_SIZE_CHANGED:layout(vl,false);break;
+		case LV_EVENT_DELETE:
+			// rows go with the container
+			vl->cont=NULL,vl->spacer=NULL;
+			for(size_t i=0;i<vl->cnt;i++)vl->rows[i]=NULL;
+		break;
+		default:;
+	}
+}
+
+struct vlist*vlist_create(lv_obj_t*cont,vlist_create_row create,vlist_bind_row bind){
+	struct vlist*vl;
+	if(!cont||!create||!bind)return NULL;
+	if(!(vl=malloc(sizeof(struct vlist))))return NULL;
+	memset(vl,0,sizeof(struct vlist));
+	vl->cont=cont,vl->create=create,vl->bind=bind;
+	lv_obj_set_layout(cont,0);
+	vl->spacer=lv_obj_create(cont);
+	lv_obj_remove_style_all(vl->spacer);
+	lv_obj_clear_flag(vl->spacer,LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_clear_flag(vl->spacer,LV_OBJ_FLAG_SCROLLABLE);
+	lv_obj_set_size(vl->spacer,1,0);
+	lv_obj_add_event_cb(cont,cont_event,LV_EVENT_ALL,vl);
+	return vl;
+}
+
+void vlist_set_data(struct vlist*vl,void*data){
+	if(vl)vl->data=data;
+}
+
+void*vlist_get_data(struct vlist*vl){
+	return vl?vl->data:NULL;
+}
+
+void vlist_set_count(struct vlist*vl,size_t cnt){
+	if(!vl)return;
+	vl->count=cnt;
+	if(vl->cont)lv_obj_scroll_to_y(vl->cont,0,LV_ANIM_OFF);
+	layout(vl,true);
+}
+
+size_t vlist_get_count(struct vlist*vl){
+	return vl?vl->count:0;
+}
+
+void vlist_refresh_item(struct vlist*vl,size_t idx){
+	size_t slot;
+	if(!vl||vl->cnt<=0||idx>=vl->count)return;
+	slot=idx%vl->cnt;
+	if(vl->bound[slot]!=idx||!vl->rows[slot])return;
+	vl->bind(vl,vl->rows[slot],idx);
+}
+
+void vlist_reset(struct vlist*vl){
+	if(!vl)return;
+	free_rows(vl);
+	vl->count=0;
+	if(vl->spacer)lv_obj_set_height(vl->spacer,0);
+}
+
+ssize_t vlist_get_row_index(struct vlist*vl,lv_obj_t*row){
+	if(!vl||!row)return -1;
+	for(size_t i=0;i<vl->cnt;i++)
+		if(vl->rows[i]==row)
+			return vl->bound[i]==SIZE_MAX?-1:(ssize_t)vl->bound[i];
+	return -1;
+}
+
+void vlist_scroll_to(struct vlist*vl,size_t idx){
+	lv_coord_t top,bottom,view_h,scroll;
+	if(!vl||!vl->cont||idx>=vl->count||!measure(vl))return;
+	view_h=lv_obj_get_content_height(vl->cont);
+	scroll=lv_obj_get_scroll_y(vl->cont);
+	top=(idx>0?idx-1:0)*vl->row_h;
+	bottom=MIN(idx+2,vl->count)*vl->row_h-vl->gap;
+	if(top<scroll)lv_obj_scroll_to_y(vl->cont,top,LV_ANIM_OFF);
+	else if(bottom>scroll+view_h)
+		lv_obj_scroll_to_y(vl->cont,bottom-view_h,LV_ANIM_OFF);
+	layout(vl,false);
+}
+
+void vlist_set_group(struct vlist*vl,lv_group_t*grp){
+	if(!vl)return;
+	vl->grp=grp;
+	set_rows_group(vl,grp);
+}
+
+void vlist_free(struct vlist*vl){
+	if(!vl)return;
+	free_rows(vl);
+	if(vl->cont){
+		lv_obj_remove_event_cb_with_user_data(vl->cont,cont_event,vl);
+		if(vl->spacer)lv_obj_del(vl->spacer);
+	}
+	free(vl);
+}
+#endif
@@ -10,36 +10,42 @@
 #ifdef ENABLE_LUA
 #include"gui/lua.h"
 
-void lua_gui_init(lua_State*L){
+void lua_gui_init_table(lua_State*L){
 	lua_pushinteger(L,gui_dpi);
-	lua_setglobal(L,"gui_dpi");
+	lua_setfield(L,-2,"gui_dpi");
 	lua_pushinteger(L,gui_dpi_force);
-	lua_setglobal(L,"gui_dpi_force");
+	lua_setfield(L,-2,"gui_dpi_force");
 	lua_pushinteger(L,gui_dpi_def);
-	lua_setglobal(L,"gui_dpi_def");
+	lua_setfield(L,-2,"gui_dpi_def");
 	lua_pushinteger(L,gui_font_size);
-	lua_setglobal(L,"gui_font_size");
+	lua_setfield(L,-2,"gui_font_size");
 	lua_pushinteger(L,gui_w);
-	lua_setglobal(L,"gui_w");
+	lua_setfield(L,-2,"gui_w");
 	lua_pushinteger(L,gui_h);
-	lua_setglobal(L,"gui_h");
+	lua_setfield(L,-2,"gui_h");
 	lua_pushinteger(L,gui_sw);
-	lua_setglobal(L,"gui_sw");
+	lua_setfield(L,-2,"gui_sw");
 	lua_pushinteger(L,gui_sh);
-	lua_setglobal(L,"gui_sh");
+	lua_setfield(L,-2,"gui_sh");
 	lua_pushinteger(L,gui_sx);
-	lua_setglobal(L,"gui_sx");
+	lua_setfield(L,-2,"gui_sx");
 	lua_pushinteger(L,gui_sy);
-	lua_setglobal(L,"gui_sy");
+	lua_setfield(L,-2,"gui_sy");
 	lua_pushboolean(L,gui_run);
-	lua_setglobal(L,"gui_run");
+	lua_setfield(L,-2,"gui_run");
 	lua_pushboolean(L,gui_dark);
-	lua_setglobal(L,"gui_dark");
+	lua_setfield(L,-2,"gui_dark");
 	#ifndef ENABLE_UEFI
 	lua_pushboolean(L,gui_sleep);
-	lua_setglobal(L,"gui_sleep");
+	lua_setfield(L,-2,"gui_sleep");
 	#endif
 }
 
+void lua_gui_init(lua_State*L){
+	lua_pushglobaltable(L);
+	lua_gui_init_table(L);
+	lua_pop(L,1);
+}
+
 #endif
 #endif
@@ -14,8 +14,15 @@
 #include"gui/string.h"
 #include"../engine/render_internal.h"
 
-static int lua_render_event_get_type(lua_State*L){
+// the pooled event of a render points nowhere outside of a dispatch
+static struct lua_render_event_data*check_event(lua_State*L){
 	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	if(!e->event)luaL_error(L,"event is not dispatching anymore");
+	return e;
+}
+
+static int lua_render_event_get_type(lua_State*L){
+	struct lua_render_event_data*e=check_event(L);
 	const char*event=lv_event_code_to_name(e->event->event->code);
 	if(event)lua_pushstring(L,event);
 	else lua_pushnil(L);
@@ -23,37 +30,37 @@ static int lua_render_event_get_type(lua_State*L){
 }
 
 static int lua_render_event_get_event_id(lua_State*L){
-	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	struct lua_render_event_data*e=check_event(L);
 	lua_pushstring(L,e->event->info->event_id);
 	return 1;
 }
 
 static int lua_render_event_get_render(lua_State*L){
-	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	struct lua_render_event_data*e=check_event(L);
 	render_to_lua(L,e->event->info->obj->render);
 	return 1;
 }
 
 static int lua_render_event_get_object(lua_State*L){
-	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	struct lua_render_event_data*e=check_event(L);
 	render_obj_to_lua(L,e->event->info->obj);
 	return 1;
 }
 
 static int lua_render_event_get_object_id(lua_State*L){
-	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	struct lua_render_event_data*e=check_event(L);
 	lua_pushstring(L,e->event->info->obj->id);
 	return 1;
 }
 
 static int lua_render_event_get_info(lua_State*L){
-	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	struct lua_render_event_data*e=check_event(L);
 	render_event_info_to_lua(L,e->event->info);
 	return 1;
 }
 
 static int lua_render_event_get_lvgl_obj(lua_State*L){
-	struct lua_render_event_data*e=luaL_checkudata(L,1,LUA_RENDER_EVENT);
+	struct lua_render_event_data*e=check_event(L);
 	lvgl_obj_to_lua(L,e->event->info->obj->obj);
 	return 1;
 }
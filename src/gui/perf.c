@@ -0,0 +1,288 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_GUI
+#include<errno.h>
+#include<string.h>
+#ifdef ENABLE_UEFI
+#include<Library/TimerLib.h>
+#else
+#include<time.h>
+#endif
+#include"gui.h"
+#include"lock.h"
+#include"confd.h"
+#include"logger.h"
+#include"defines.h"
+#include"gui/perf.h"
+#include"gui/guidrv.h"
+#ifndef ENABLE_UEFI
+#include"metrics.h"
+
+METRIC_HISTOGRAM(m_flush,"gui_flush_seconds","time the display driver takes to flush a frame");
+#endif
+#define TAG "perf"
+
+/*
+ * the refresh timer of the display runs through a wrapper, so a refresh
+ * is timed in microseconds as a whole. the flush callback is wrapped to
+ * take its own time out of it, the wait callback counts the time spent
+ * on flushes the driver finishes later. the first input event after a
+ * drawn frame starts a latency, the end of the next drawn frame stops
+ * it. a period is one second, the last full one is kept for the overlay,
+ * the http driver and the log, collect gives any caller its own span.
+ */
+#define PERF_PERIOD      1000
+#define PERF_LATENCY_MAX 1000000
+
+static bool ready=false,overlay=false;
+static volatile bool conf_overlay=false;
+static volatile int64_t conf_log=0;
+static lv_disp_t*disp=NULL;
+static lv_obj_t*label=NULL;
+static uint32_t periods=0;
+static mutex_t perf_lock=MUTEX_INITIALIZER;
+static struct gui_perf cur,last,span;
+static void(*monitor)(lv_disp_drv_t*,uint32_t,uint32_t)=NULL;
+static void(*drv_flush)(lv_disp_drv_t*,const lv_area_t*,lv_color_t*)=NULL;
+static void(*drv_wait)(lv_disp_drv_t*)=NULL;
+static void(*frame_hook)(uint32_t,uint32_t,uint32_t)=NULL;
+static uint64_t flush_us=0,wait_last=0,input_us=0;
+static uint32_t area_px=0;
+static bool drawn=false;
+
+static uint64_t perf_now(void){
+	#ifdef ENABLE_UEFI
+	return DivU64x32(GetTimeInNanoSecond(GetPerformanceCounter()),1000);
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+	#endif
+}
+
+static void value_add(struct gui_perf_value*v,uint32_t val){
+	v->sum+=val,v->cnt++,v->last=val;
+	if(val>v->max)v->max=val;
+}
+
+static void perf_add(struct gui_perf*p,uint32_t render,uint32_t flush,uint32_t area,uint32_t latency){
+	p->frames++;
+	value_add(&p->render,render);
+	value_add(&p->flush,flush);
+	value_add(&p->area,area);
+	if(latency>0)value_add(&p->latency,latency);
+}
+
+static void perf_reset(struct gui_perf*p,uint64_t now){
+	memset(p,0,sizeof(struct gui_perf));
+	p->start=now;
+}
+
+static void perf_flush(lv_disp_drv_t*drv,const lv_area_t*area,lv_color_t*color){
+	uint64_t start=perf_now();
+	wait_last=0;
+	drv_flush(drv,area,color);
+	flush_us+=perf_now()-start;
+}
+
+static void perf_wait(lv_disp_drv_t*drv){
+	uint64_t now=perf_now();
+	if(wait_last>0)flush_us+=now-wait_last;
+	wait_last=now;
+	if(drv_wait)drv_wait(drv);
+}
+
+static void perf_monitor(lv_disp_drv_t*drv,uint32_t time,uint32_t px){
+	drawn=true,area_px=px;
+	if(monitor)monitor(drv,time,px);
+}
+
+static void perf_refr(lv_timer_t*t){
+	uint64_t start,end,total;
+	uint32_t latency=0;
+	flush_us=0,wait_last=0,drawn=false;
+	start=perf_now();
+	_lv_disp_refr_timer(t);
+	if(!drawn)return;
+	end=perf_now(),total=end-start;
+	if(flush_us>total)flush_us=total;
+	if(input_us>0){
+		if(end-input_us<PERF_LATENCY_MAX)latency=end-input_us;
+		input_us=0;
+	}
+	#ifndef ENABLE_UEFI
+	metric_observe(&m_flush,flush_us);
+	#endif
+	perf_add(&cur,total-flush_us,flush_us,area_px,latency);
+	perf_add(&span,total-flush_us,flush_us,area_px,latency);
+	if(frame_hook)frame_hook(total-flush_us,flush_us,area_px);
+}
+
+static void perf_feedback(lv_indev_drv_t*drv __attribute__((unused)),uint8_t code){
+	switch(code){
+		case LV_EVENT_PRESSED:
+		case LV_EVENT_RELEASED:
+		case LV_EVENT_KEY:
+		case LV_EVENT_SCROLL:
+			if(input_us==0)input_us=perf_now();
+		break;
+		default:;
+	}
+}
+
+// input devices may come later, only empty feedback slots are taken
+static void hook_indevs(void){
+	lv_indev_t*indev=NULL;
+	while((indev=lv_indev_get_next(indev)))
+		if(!indev->driver->feedback_cb)
+			indev->driver->feedback_cb=perf_feedback;
+}
+
+uint32_t gui_perf_fps(struct gui_perf*perf){
+	uint64_t time;
+	if(!perf||perf->end<=perf->start)return 0;
+	time=perf->end-perf->start;
+	return (uint32_t)(((uint64_t)perf->frames*1000000+time/2)/time);
+}
+
+static void overlay_update(void){
+	uint32_t fps,area=1;
+	if(overlay&&!label){
+		label=lv_label_create(lv_layer_sys());
+		lv_obj_set_style_bg_color(label,lv_color_black(),0);
+		lv_obj_set_style_bg_opa(label,LV_OPA_70,0);
+		lv_obj_set_style_text_color(label,lv_color_white(),0);
+		lv_obj_set_style_text_font(label,gui_font_small,0);
+		lv_obj_set_style_pad_all(label,gui_font_size/4,0);
+		lv_obj_align(label,LV_ALIGN_TOP_RIGHT,0,0);
+	}else if(!overlay&&label){
+		lv_obj_del(label);
+		label=NULL;
+	}
+	if(!label)return;
+	fps=gui_perf_fps(&last);
+	if(disp)area=MAX(1,lv_disp_get_hor_res(disp)*lv_disp_get_ver_res(disp));
+	lv_label_set_text_fmt(
+		label,
+		"%s %u FPS\n"
+		"render %u.%02u ms (max %u.%02u)\n"
+		"flush %u.%02u ms (max %u.%02u)\n"
+		"area %u%%\n"
+		"latency %u ms",
+		guidrv_getname(),fps,
+		gui_perf_avg(last.render)/1000,gui_perf_avg(last.render)%1000/10,
+		last.render.max/1000,last.render.max%1000/10,
+		gui_perf_avg(last.flush)/1000,gui_perf_avg(last.flush)%1000/10,
+		last.flush.max/1000,last.flush.max%1000/10,
+		(uint32_t)((uint64_t)gui_perf_avg(last.area)*100/area),
+		gui_perf_avg(last.latency)/1000
+	);
+}
+
+static void perf_log(void){
+	if(last.frames<=0)return;
+	tlog_info(
+		"%s %u fps, render avg %uus max %uus, "
+		"flush avg %uus max %uus, area avg %upx, "
+		"latency avg %uus max %uus",
+		guidrv_getname(),gui_perf_fps(&last),
+		gui_perf_avg(last.render),last.render.max,
+		gui_perf_avg(last.flush),last.flush.max,
+		gui_perf_avg(last.area),
+		gui_perf_avg(last.latency),last.latency.max
+	);
+}
+
+static void perf_period(lv_timer_t*t __attribute__((unused))){
+	uint64_t now=perf_now();
+	cur.end=now;
+	MUTEX_LOCK(perf_lock);
+	memcpy(&last,&cur,sizeof(struct gui_perf));
+	MUTEX_UNLOCK(perf_lock);
+	perf_reset(&cur,now);
+	hook_indevs();
+	overlay=conf_overlay;
+	overlay_update();
+	periods++;
+	if(conf_log>0&&periods%conf_log==0)perf_log();
+}
+
+// overlay and log interval in seconds, updated by watching gui.perf
+static void perf_conf_cb(
+	const char*path __attribute__((unused)),
+	enum conf_type type __attribute__((unused)),
+	void*data __attribute__((unused))
+){
+	conf_overlay=confd_get_boolean("gui.perf.overlay",conf_overlay);
+	conf_log=confd_get_integer("gui.perf.log_interval",conf_log);
+}
+
+void gui_perf_init(void){
+	uint64_t now;
+	if(ready)return;
+	if(!(disp=lv_disp_get_default())||!disp->refr_timer){
+		tlog_warn("no display to profile");
+		return;
+	}
+	now=perf_now();
+	perf_reset(&cur,now);
+	perf_reset(&last,now);
+	perf_reset(&span,now);
+	conf_overlay=confd_get_boolean("gui.perf.overlay",false);
+	conf_log=confd_get_integer("gui.perf.log_interval",0);
+	confd_watch("gui.perf",perf_conf_cb,NULL);
+	drv_flush=disp->driver->flush_cb;
+	drv_wait=disp->driver->wait_cb;
+	monitor=disp->driver->monitor_cb;
+	if(drv_flush)disp->driver->flush_cb=perf_flush;
+	disp->driver->wait_cb=perf_wait;
+	disp->driver->monitor_cb=perf_monitor;
+	disp->refr_timer->timer_cb=perf_refr;
+	hook_indevs();
+	lv_timer_create(perf_period,PERF_PERIOD,NULL);
+	ready=true;
+}
+
+void gui_perf_get(struct gui_perf*perf){
+	if(!perf)return;
+	MUTEX_LOCK(perf_lock);
+	memcpy(perf,&last,sizeof(struct gui_perf));
+	MUTEX_UNLOCK(perf_lock);
+}
+
+void gui_perf_collect(struct gui_perf*perf){
+	uint64_t now=perf_now();
+	span.end=now;
+	if(perf)memcpy(perf,&span,sizeof(struct gui_perf));
+	perf_reset(&span,now);
+}
+
+int gui_perf_set_monitor(void(*cb)(lv_disp_drv_t*,uint32_t,uint32_t)){
+	if(cb&&monitor)ERET(EBUSY);
+	monitor=cb;
+	if(!ready&&(disp=lv_disp_get_default()))
+		disp->driver->monitor_cb=cb;
+	return 0;
+}
+
+void gui_perf_set_frame_hook(void(*cb)(uint32_t render,uint32_t flush,uint32_t area)){
+	frame_hook=cb;
+}
+
+void gui_perf_set_overlay(bool show){
+	conf_overlay=show;
+	if(!ready)return;
+	overlay=show;
+	overlay_update();
+}
+
+bool gui_perf_get_overlay(void){
+	return conf_overlay;
+}
+#endif
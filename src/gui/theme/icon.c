@@ -69,7 +69,7 @@ static void fill_name_mapping(mxml_node_t*node,icon_theme*theme){
 	if(!path)return;
 	if((!name&&!regex)||(name&&regex))return;
 	memset(&map,0,sizeof(map));
-	if(regex&&!regexp_comp(regex,REG_ICASE,NULL))goto done;
+	if(regex&&!(map.regex=regexp_comp(regex,REG_ICASE,NULL)))goto done;
 	if(name&&!(map.name=strdup(name)))goto done;
 	if(!(map.path=strdup(path)))goto done;
 	if(!type){
@@ -87,6 +87,7 @@ static void fill_name_mapping(mxml_node_t*node,icon_theme*theme){
 	if(map.type)free(map.type);
 	if(map.path)free(map.path);
 	if(map.search)free(map.search);
+	if(map.regex)regexp_free(map.regex);
 }
 
 static void fill_search_paths(mxml_node_t*root,icon_theme*theme){
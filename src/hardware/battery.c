@@ -137,7 +137,7 @@ int pwr_multi_get_capacity(int*fds){
 
 int pwr_scan_device(int fds[],int max,bool battery){
 	if(max<=0||!fds)ERET(EINVAL);
-	memset(fds,0,max);
+	memset(fds,0,sizeof(int)*max);
 	int ps,cur=0;
 	if((ps=_open_ps())<0)return -1;
 	DIR*d=fdopendir(ps);
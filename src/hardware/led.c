@@ -14,6 +14,7 @@
 #include<sys/stat.h>
 #define TAG "led"
 #include"str.h"
+#include"lock.h"
 #include"system.h"
 #include"hardware.h"
 #include"logger.h"
@@ -69,18 +70,28 @@ int led_find_class(int sysfs,const char*name){
 	if(name&&!led_check_name(name))ERET(EINVAL);
 	int bn;
 	struct dirent*e;
-	DIR*d=fdopendir(sysfs);
-	if(!d)return -1;
+	DIR*d;
+
+	// a named led is one open, no scan of the class
+	if(name){
+		if((bn=openat(sysfs,name,O_DIR|O_CLOEXEC))<0)return -1;
+		if(led_is_led(bn))return bn;
+		close(bn);
+		ERET(ENOENT);
+	}
+	if(!(d=fdopendir(sysfs)))return -1;
 	seekdir(d,0);
 	while((e=readdir(d))){
 		if(e->d_type!=DT_DIR&&e->d_type!=DT_LNK)continue;
 		if(e->d_name[0]=='.')continue;
-		if(name&&strcmp(name,e->d_name)!=0)continue;
 		if((bn=openat(sysfs,e->d_name,O_DIR|O_CLOEXEC))<0){
 			telog_warn("open led %s folder failed",e->d_name);
 			continue;
 		}
-		if(led_is_led(bn))return bn;
+		if(led_is_led(bn)){
+			free(d);
+			return bn;
+		}
 		close(bn);
 
 	}
@@ -88,10 +99,86 @@ int led_find_class(int sysfs,const char*name){
 	ERET(ENOENT);
 }
 
+/*
+ * leds found by name stay open, every find hands out a dup of the cached
+ * fd so callers still close what they get. a led that went away fails
+ * led_is_led and is looked up again
+ */
+#define LED_CACHE 16
+static struct led_cache{
+	char name[64];
+	int fd;
+}led_cache[LED_CACHE];
+static int led_cache_cnt=0;
+static mutex_t led_lock=MUTEX_INITIALIZER;
+
 int led_find(const char*name){
-	int c;
-	if((c=led_open_sysfs_class())<0)return -1;
-	return led_find_class(c,name);
+	int c,fd=-1,i;
+	if(!name||strlen(name)>=sizeof(led_cache[0].name)){
+		if((c=led_open_sysfs_class())<0)return -1;
+		return led_find_class(c,name);
+	}
+	MUTEX_LOCK(led_lock);
+	for(i=0;i<led_cache_cnt;i++){
+		if(strcmp(led_cache[i].name,name)!=0)continue;
+		if(led_is_led(led_cache[i].fd)){
+			fd=fcntl(led_cache[i].fd,F_DUPFD_CLOEXEC,0);
+			MUTEX_UNLOCK(led_lock);
+			return fd;
+		}
+		close(led_cache[i].fd);
+		led_cache[i]=led_cache[--led_cache_cnt];
+		break;
+	}
+	if((c=led_open_sysfs_class())>=0&&(fd=led_find_class(c,name))>=0&&led_cache_cnt<LED_CACHE){
+		i=led_cache_cnt;
+		if((led_cache[i].fd=fcntl(fd,F_DUPFD_CLOEXEC,0))>=0){
+			strcpy(led_cache[i].name,name);
+			led_cache_cnt++;
+		}
+	}
+	MUTEX_UNLOCK(led_lock);
+	return fd;
+}
+
+bool led_has_trigger(int fd,const char*trigger){
+	size_t l;
+	char buf[4096],*p;
+	if(!trigger||!(l=strlen(trigger)))return false;
+	if(fd_read_file(fd,buf,sizeof(buf),false,"trigger")<=0)return false;
+
+	// space separated names, the active one is in brackets
+	for(p=buf;(p=strstr(p,trigger));p+=l){
+		if(p>buf&&p[-1]!=' '&&p[-1]!='[')continue;
+		if(p[l]==0||p[l]==' '||p[l]==']'||p[l]=='\n')return true;
+	}
+	return false;
+}
+
+int led_set_trigger(int fd,const char*trigger){
+	if(fd<0)ERET(EBADF);
+	if(!trigger)ERET(EINVAL);
+	return write_file(fd,"trigger",trigger,0,0,false,false,false)<0?-1:0;
+}
+
+int led_set_timer(int fd,int on,int off){
+	if(on<0||off<0)ERET(EINVAL);
+	if(led_set_trigger(fd,"timer")!=0)return -1;
+	if(fd_write_int(fd,"delay_on",on,true)!=0)return -1;
+	return fd_write_int(fd,"delay_off",off,true);
+}
+
+int led_set_heartbeat(int fd){
+	return led_set_trigger(fd,"heartbeat");
+}
+
+int led_set_pattern(int fd,const char*pattern,int repeat){
+	if(!pattern)ERET(EINVAL);
+	if(led_set_trigger(fd,"pattern")!=0)return -1;
+
+	// the whole sequence goes to the kernel in one write
+	if(write_file(fd,"pattern",pattern,0,0,false,false,false)<0)return -1;
+	return fd_write_int(fd,"repeat",repeat,true);
 }
 
 int led_set_brightness_percent_by_name(char*name,int percent){
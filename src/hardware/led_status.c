@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#define TAG "led"
+#include"str.h"
+#include"confd.h"
+#include"logger.h"
+#include"hardware.h"
+#include"led_status.h"
+
+/*
+ * system states shown by leds, configured as led.status.<state>
+ * a value is a list of <led>=<mode> split by ';', for example
+ *   led.status.booting = "white:status=heartbeat"
+ *   led.status.failed  = "red:status=timer 100 100;white:status=off"
+ * modes:
+ *   off, on [percent], heartbeat, timer <on ms> <off ms>,
+ *   pattern <brightness> <ms> ... (ledtrig-pattern, loops)
+ *   any other word is used as the trigger name
+ * every mode is one trigger change, the kernel does all the blinking
+ */
+
+static int apply_pattern(int fd,char*args){
+	int on,off;
+	if(led_has_trigger(fd,"pattern"))return led_set_pattern(fd,args,-1);
+
+	// without ledtrig-pattern the first step pair becomes a timer
+	if(sscanf(args,"%*d %d %*d %d",&on,&off)!=2)ERET(EINVAL);
+	return led_set_timer(fd,on,off);
+}
+
+static int apply_mode(int fd,char*mode){
+	int on=100,off;
+	char*args=mode;
+	while(*args&&*args!=' ')args++;
+	if(*args)*args++=0;
+	while(*args==' ')args++;
+	if(strcmp(mode,"off")==0||strcmp(mode,"none")==0){
+		led_set_trigger(fd,"none");
+		return led_set_brightness(fd,0);
+	}
+	if(strcmp(mode,"on")==0){
+		if(*args&&((on=parse_int(args,-1))<0||on>100))ERET(EINVAL);
+		led_set_trigger(fd,"none");
+		return led_set_brightness_percent(fd,on);
+	}
+	if(strcmp(mode,"timer")==0){
+		if(sscanf(args,"%d %d",&on,&off)!=2)ERET(EINVAL);
+		return led_set_timer(fd,on,off);
+	}
+	if(strcmp(mode,"pattern")==0)return apply_pattern(fd,args);
+	if(strcmp(mode,"heartbeat")==0)return led_set_heartbeat(fd);
+	return led_set_trigger(fd,mode);
+}
+
+int led_status(const char*state){
+	int fd,r=0;
+	char key[128],*val,*item,*save=NULL,*mode;
+	if(!state||!*state)ERET(EINVAL);
+	snprintf(key,sizeof(key),"led.status.%s",state);
+	if(!(val=confd_get_string(key,NULL)))return 0;
+	for(item=strtok_r(val,";",&save);item;item=strtok_r(NULL,";",&save)){
+		if(!(mode=strchr(item,'='))){
+			tlog_warn("bad led status %s item %s",state,item);
+			r=-1;
+			continue;
+		}
+		*mode++=0;
+		if((fd=led_find(item))<0){
+			tlog_warn("led %s for status %s not found",item,state);
+			r=-1;
+			continue;
+		}
+		if(apply_mode(fd,mode)!=0){
+			telog_warn("set led %s for status %s failed",item,state);
+			r=-1;
+		}
+		close(fd);
+	}
+	free(val);
+	return r;
+}
@@ -7,22 +7,243 @@
  */
 
 #define _GNU_SOURCE
+#include<time.h>
+#include<errno.h>
 #include<fcntl.h>
+#include<dirent.h>
+#include<stdlib.h>
+#include<string.h>
 #include<unistd.h>
+#include<pthread.h>
+#include<sys/ioctl.h>
+#include<linux/input.h>
+#define TAG "vibrate"
+#include"lock.h"
 #include"system.h"
+#include"logger.h"
+#include"defines.h"
 #include"pathnames.h"
 #include"hardware.h"
 
-void vibrate(int time){
-	if(time<0||time>0xFFFF)return;
-	if(fd_write_int(
-		AT_FDCWD,
+/*
+ * the backend is resolved once and its files stay open, a failed write
+ * drops it so the next call resolves again (hot-plugged or removed device)
+ * every backend times the vibration in the kernel, so vibrate never sleeps
+ * backends by preference:
+ *   evdev force feedback with FF_RUMBLE
+ *   timed_output/vibrator/enable
+ *   a led named vibrator with the transient trigger (duration, activate)
+ */
+enum vib_backend{
+	VIB_UNKNOWN=0,
+	VIB_NONE,
+	VIB_FF,
+	VIB_TIMED,
+	VIB_LED,
+};
+
+static mutex_t vib_lock=MUTEX_INITIALIZER;
+static enum vib_backend backend=VIB_UNKNOWN;
+static int vib_fd=-1,vib_fd2=-1;
+static struct ff_effect effect;
+static time_t retry=0;
+
+#define TEST_BIT(bit,arr) ((arr)[(bit)/(8*sizeof(long))]&(1UL<<((bit)%(8*sizeof(long)))))
+
+static int open_ff(){
+	DIR*d;
+	int fd;
+	struct dirent*e;
+	unsigned long bits[(FF_MAX+1+8*sizeof(long)-1)/(8*sizeof(long))];
+	if(!(d=opendir(_PATH_DEV"/input")))return -1;
+	while((e=readdir(d))){
+		if(strncmp(e->d_name,"event",5)!=0)continue;
+		if((fd=openat(dirfd(d),e->d_name,O_RDWR|O_CLOEXEC|O_NONBLOCK))<0)continue;
+		memset(bits,0,sizeof(bits));
+		if(ioctl(fd,EVIOCGBIT(EV_FF,sizeof(bits)),bits)>=0&&TEST_BIT(FF_RUMBLE,bits)){
+			tlog_debug("use force feedback device %s",e->d_name);
+			closedir(d);
+			return fd;
+		}
+		close(fd);
+	}
+	closedir(d);
+	return -1;
+}
+
+static void vib_close(){
+	if(vib_fd>=0)close(vib_fd);
+	if(vib_fd2>=0)close(vib_fd2);
+	vib_fd=vib_fd2=-1;
+	backend=VIB_UNKNOWN;
+}
+
+static time_t now_sec(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec;
+}
+
+static enum vib_backend vib_resolve(){
+	int dir;
+	if(backend!=VIB_UNKNOWN&&(backend!=VIB_NONE||now_sec()<retry))return backend;
+	if((vib_fd=open_ff())>=0){
+		memset(&effect,0,sizeof(effect));
+		effect.type=FF_RUMBLE,effect.id=-1;
+		effect.u.rumble.strong_magnitude=0xC000;
+		effect.u.rumble.weak_magnitude=0xC000;
+		return backend=VIB_FF;
+	}
+	if((vib_fd=open(
 		_PATH_SYS_CLASS"/timed_output/vibrator/enable",
-		time,true
-	)==0)return;
-	int v=led_find("vibrator");
-	if(v<0)return;
-	fd_write_int(v,"duration",time,true);
-	fd_write_int(v,"activate",1,true);
-	close(v);
+		O_WRONLY|O_CLOEXEC
+	))>=0)return backend=VIB_TIMED;
+	if((dir=led_find("vibrator"))>=0){
+		vib_fd=openat(dir,"duration",O_WRONLY|O_CLOEXEC);
+		vib_fd2=openat(dir,"activate",O_WRONLY|O_CLOEXEC);
+		close(dir);
+		if(vib_fd>=0&&vib_fd2>=0)return backend=VIB_LED;
+		vib_close();
+	}
+
+	// no vibrator now, look again later without a scan per call
+	retry=now_sec()+10;
+	return backend=VIB_NONE;
+}
+
+// sysfs attributes take one value per write from offset zero
+static int write_attr(int fd,int value){
+	char buf[16];
+	int l=snprintf(buf,sizeof(buf),"%d\n",value);
+	return pwrite(fd,buf,l,0)==l?0:-1;
+}
+
+static int vib_ff(int time){
+	struct input_event ev;
+	if(time==0&&effect.id<0)return 0;
+	if(time>0&&(effect.id<0||effect.replay.length!=time)){
+		effect.replay.length=time;
+		if(ioctl(vib_fd,EVIOCSFF,&effect)<0){
+			effect.id=-1;
+			return -1;
+		}
+	}
+	memset(&ev,0,sizeof(ev));
+	ev.type=EV_FF,ev.code=effect.id,ev.value=time>0;
+	return write(vib_fd,&ev,sizeof(ev))==sizeof(ev)?0:-1;
+}
+
+static int vib_run(int time){
+	int r;
+	switch(vib_resolve()){
+		case VIB_FF:r=vib_ff(time);break;
+		case VIB_TIMED:r=write_attr(vib_fd,time);break;
+		case VIB_LED:
+			if(time==0)r=write_attr(vib_fd2,0);
+			else if((r=write_attr(vib_fd,time))==0)
+				r=write_attr(vib_fd2,1);
+		break;
+		default:ERET(ENODEV);
+	}
+	if(r!=0){
+		telog_warn("vibrate failed, looking for vibrator again");
+		vib_close();
+	}
+	return r;
+}
+
+int vibrate(int time){
+	int r;
+	if(time<0||time>0xFFFF)ERET(EINVAL);
+	MUTEX_LOCK(vib_lock);
+	r=vib_run(time);
+	MUTEX_UNLOCK(vib_lock);
+	return r;
+}
+
+/*
+ * patterns play on one helper thread, a new pattern or vibrate_stop
+ * replaces the running one at once, callers never wait for it
+ */
+static pthread_cond_t pat_cond;
+static pthread_t pat_thread;
+static bool pat_started=false;
+static int*pat=NULL;
+static size_t pat_cnt=0;
+static int pat_repeat=0;
+static unsigned int pat_gen=0;
+
+// sleep until the deadline, false when the pattern was replaced
+static bool pat_sleep(struct timespec*ts,int ms,unsigned int gen){
+	ts->tv_sec+=ms/1000;
+	ts->tv_nsec+=(ms%1000)*1000000L;
+	if(ts->tv_nsec>=1000000000L)ts->tv_sec++,ts->tv_nsec-=1000000000L;
+	while(gen==pat_gen)
+		if(pthread_cond_timedwait(&pat_cond,&vib_lock,ts)==ETIMEDOUT)break;
+	return gen==pat_gen;
+}
+
+static void*pat_worker(void*d __attribute__((unused))){
+	struct timespec ts;
+	unsigned int gen;
+	MUTEX_LOCK(vib_lock);
+	for(;;){
+		while(!pat)pthread_cond_wait(&pat_cond,&vib_lock);
+		gen=pat_gen;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		for(int r=0;pat&&gen==pat_gen&&(pat_repeat<0||r<=pat_repeat);r++)
+			for(size_t i=0;i<pat_cnt;i++){
+				if(i%2==0&&pat[i]>0)vib_run(MIN(pat[i],0xFFFF));
+				if(!pat_sleep(&ts,pat[i],gen))break;
+			}
+		if(gen==pat_gen){
+			free(pat);
+			pat=NULL;
+		}
+	}
+	return NULL;
+}
+
+int vibrate_pattern(const int*pattern,size_t cnt,int repeat){
+	int*p=NULL;
+	long total=0;
+	pthread_condattr_t ca;
+	if(cnt>0&&!pattern)ERET(EINVAL);
+	for(size_t i=0;i<cnt;i++){
+		if(pattern[i]<0)ERET(EINVAL);
+		total+=pattern[i];
+	}
+	if(cnt>0&&total==0)ERET(EINVAL);
+	if(cnt>0){
+		if(!(p=malloc(cnt*sizeof(int))))ERET(ENOMEM);
+		memcpy(p,pattern,cnt*sizeof(int));
+	}
+	MUTEX_LOCK(vib_lock);
+	if(!pat_started&&cnt>0){
+		pthread_condattr_init(&ca);
+		pthread_condattr_setclock(&ca,CLOCK_MONOTONIC);
+		pthread_cond_init(&pat_cond,&ca);
+		pthread_condattr_destroy(&ca);
+		if(pthread_create(&pat_thread,NULL,pat_worker,NULL)!=0){
+			pthread_cond_destroy(&pat_cond);
+			MUTEX_UNLOCK(vib_lock);
+			free(p);
+			return terlog_warn(-1,"create vibrate pattern thread failed");
+		}
+		pthread_detach(pat_thread);
+		pat_started=true;
+	}
+
+	// a replaced pattern stops its vibration too
+	if(pat&&backend!=VIB_UNKNOWN&&backend!=VIB_NONE)vib_run(0);
+	free(pat);
+	pat=p,pat_cnt=cnt,pat_repeat=repeat;
+	pat_gen++;
+	if(pat_started)pthread_cond_broadcast(&pat_cond);
+	MUTEX_UNLOCK(vib_lock);
+	return 0;
+}
+
+void vibrate_stop(){
+	vibrate_pattern(NULL,0,0);
 }
@@ -0,0 +1,262 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define HOST_TOOL
+#include<stdio.h>
+#include<endian.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include<stdbool.h>
+#include<ft2build.h>
+#include FT_FREETYPE_H
+#include"font_bin.h"
+
+/*
+ * usage: fontbin <font> <size> <output> [text...]
+ * renders printable ascii and every code point found in the text files
+ * (the translations) at one pixel size, with the same metrics the gui
+ * freetype loader uses, so both can be mixed on one line.
+ * code points the font does not have are left out.
+ */
+#define MAX_CODEPOINT 0x110000
+
+struct buf{
+	unsigned char*data;
+	size_t len,size;
+};
+
+static uint8_t*used=NULL;
+static uint32_t*cps=NULL;
+static size_t cps_cnt=0;
+
+static void*xalloc(void*p,size_t size){
+	if(!(p=realloc(p,size))){
+		perror("realloc failed");
+		exit(1);
+	}
+	return p;
+}
+
+static void put(struct buf*b,const void*data,size_t len){
+	if(b->len+len>b->size){
+		while(b->len+len>b->size)b->size=b->size?b->size*2:4096;
+		b->data=xalloc(b->data,b->size);
+	}
+	if(data)memcpy(b->data+b->len,data,len);
+	else memset(b->data+b->len,0,len);
+	b->len+=len;
+}
+
+static void put8(struct buf*b,uint8_t v){put(b,&v,1);}
+static void put16(struct buf*b,uint16_t v){v=htole16(v),put(b,&v,2);}
+static void put32(struct buf*b,uint32_t v){v=htole32(v),put(b,&v,4);}
+
+static void put_label(struct buf*b,uint32_t len,const char*label){
+	put32(b,len);
+	put(b,label,4);
+}
+
+static void set32(struct buf*b,size_t off,uint32_t v){
+	v=htole32(v),memcpy(b->data+off,&v,4);
+}
+
+static void add_codepoint(uint32_t cp){
+	if(cp<0x20||(cp>=0x7F&&cp<0xA0)||cp>=MAX_CODEPOINT)return;
+	used[cp/8]|=1<<(cp%8);
+}
+
+// invalid sequences are skipped byte by byte
+static void scan_text(const char*path){
+	int c;
+	FILE*f;
+	uint32_t cp;
+	int more=0;
+	if(!(f=fopen(path,"r"))){
+		perror(path);
+		exit(1);
+	}
+	while((c=fgetc(f))!=EOF){
+		if(more>0&&(c&0xC0)==0x80){
+			cp=(cp<<6)|(c&0x3F);
+			if(--more==0)add_codepoint(cp);
+			continue;
+		}
+		more=0;
+		if(c<0x80)add_codepoint(c);
+		else if((c&0xE0)==0xC0)cp=c&0x1F,more=1;
+		else if((c&0xF0)==0xE0)cp=c&0x0F,more=2;
+		else if((c&0xF8)==0xF0)cp=c&0x07,more=3;
+	}
+	fclose(f);
+}
+
+static void write_head(struct buf*b,FT_Face face,int size){
+	struct buf h={0};
+	FT_Size_Metrics*m=&face->size->metrics;
+	int descent=m->descender>>6;
+	int thickness=FT_MulFix(m->y_scale,face->underline_thickness)>>6;
+	put_label(&h,sizeof(struct font_bin_label)+sizeof(struct font_bin_head),"head");
+	put32(&h,FONT_BIN_VERSION);
+	put16(&h,3);
+	put16(&h,size);
+	put16(&h,(m->height>>6)+descent);
+	put16(&h,descent);
+	put16(&h,m->ascender>>6);
+	put16(&h,descent);
+	put16(&h,0);
+	put16(&h,descent);
+	put16(&h,m->ascender>>6);
+	put16(&h,0);
+	put16(&h,0);
+	put8(&h,FONT_BIN_LOCA_U32);
+	put8(&h,1);
+	put8(&h,0);
+	put8(&h,FONT_BIN_BPP);
+	put8(&h,FONT_BIN_XY_BITS);
+	put8(&h,FONT_BIN_WH_BITS);
+	put8(&h,FONT_BIN_ADV_BITS);
+	put8(&h,0);
+	put8(&h,0);
+	put8(&h,0);
+	put16(&h,FT_MulFix(m->y_scale,face->underline_position)>>6);
+	put16(&h,thickness<1?1:thickness);
+	put(b,h.data,h.len);
+	free(h.data);
+}
+
+// one sparse list per 64K span, glyph ids follow the code point order
+static void write_cmap(struct buf*b){
+	struct buf c={0};
+	size_t i,j,cnt=0,hdr,data;
+	for(i=0;i<cps_cnt;i=j,cnt++)
+		for(j=i;j<cps_cnt&&cps[j]-cps[i]<=0xFFFF;j++);
+	hdr=sizeof(struct font_bin_label)+4;
+	data=hdr+cnt*sizeof(struct font_bin_cmap);
+	put_label(&c,0,"cmap");
+	put32(&c,cnt);
+	for(i=0;i<cps_cnt;i=j){
+		for(j=i;j<cps_cnt&&cps[j]-cps[i]<=0xFFFF;j++);
+		put32(&c,data);
+		put32(&c,cps[i]);
+		put16(&c,cps[j-1]-cps[i]);
+		put16(&c,i+1);
+		put16(&c,j-i);
+		put8(&c,FONT_BIN_CMAP_SPARSE_TINY);
+		put8(&c,0);
+		data+=((j-i)*2+3)&~3;
+	}
+	for(i=0;i<cps_cnt;i=j){
+		for(j=i;j<cps_cnt&&cps[j]-cps[i]<=0xFFFF;j++)
+			put16(&c,cps[j]-cps[i]);
+		if((j-i)%2)put16(&c,0);
+	}
+	set32(&c,0,c.len);
+	put(b,c.data,c.len);
+	free(c.data);
+}
+
+static void write_glyf(struct buf*b,FT_Face face){
+	FT_Bitmap*bmp;
+	FT_GlyphSlot slot=face->glyph;
+	struct buf loca={0},glyf={0};
+	size_t loca_len=sizeof(struct font_bin_label)+4+(cps_cnt+1)*4;
+	put_label(&loca,loca_len,"loca");
+	put32(&loca,cps_cnt+1);
+	put_label(&glyf,0,"glyf");
+
+	// glyph 0 is the reserved empty glyph
+	put32(&loca,glyf.len);
+	put(&glyf,NULL,FONT_BIN_GLYPH_HDR);
+	for(size_t i=0;i<cps_cnt;i++){
+		if(FT_Load_Char(face,cps[i],FT_LOAD_RENDER|FT_LOAD_TARGET_NORMAL)){
+			fprintf(stderr,"render U+%04X failed\n",cps[i]);
+			exit(1);
+		}
+		bmp=&slot->bitmap;
+		if(
+			bmp->width>255||bmp->rows>255||
+			slot->advance.x>255*64||
+			slot->bitmap_left<-128||slot->bitmap_left>127||
+			bmp->pixel_mode!=FT_PIXEL_MODE_GRAY
+		){
+			fprintf(stderr,"unsupported bitmap of U+%04X\n",cps[i]);
+			exit(1);
+		}
+		put32(&loca,glyf.len);
+		put8(&glyf,(slot->advance.x+32)>>6);
+		put8(&glyf,(int8_t)slot->bitmap_left);
+		put8(&glyf,(int8_t)(slot->bitmap_top-(int)bmp->rows));
+		put8(&glyf,bmp->width);
+		put8(&glyf,bmp->rows);
+		for(unsigned y=0;y<bmp->rows;y++)
+			put(&glyf,bmp->buffer+y*bmp->pitch,bmp->width);
+	}
+	set32(&glyf,0,glyf.len);
+	put(b,loca.data,loca.len);
+	put(b,glyf.data,glyf.len);
+	free(loca.data);
+	free(glyf.data);
+}
+
+int main(int argc,char**argv){
+	FILE*f;
+	int size;
+	FT_Face face;
+	FT_Library lib;
+	struct buf out={0};
+	if(argc<4){
+		fprintf(stderr,"Usage: %s <FONT> <SIZE> <OUTPUT> [TEXT]...\n",argv[0]);
+		return 1;
+	}
+	if((size=atoi(argv[2]))<=0||size>255){
+		fprintf(stderr,"invalid font size %s\n",argv[2]);
+		return 1;
+	}
+	used=xalloc(NULL,MAX_CODEPOINT/8);
+	memset(used,0,MAX_CODEPOINT/8);
+	for(uint32_t c=0x20;c<0x7F;c++)add_codepoint(c);
+	for(int i=4;i<argc;i++)scan_text(argv[i]);
+	if(
+		FT_Init_FreeType(&lib)||
+		FT_New_Face(lib,argv[1],0,&face)||
+		FT_Set_Pixel_Sizes(face,size,size)
+	){
+		fprintf(stderr,"load font %s failed\n",argv[1]);
+		return 1;
+	}
+	for(uint32_t c=0;c<MAX_CODEPOINT;c++){
+		if(!(used[c/8]&(1<<(c%8))))continue;
+		if(!FT_Get_Char_Index(face,c))continue;
+		cps=xalloc(cps,sizeof(uint32_t)*(cps_cnt+1));
+		cps[cps_cnt++]=c;
+	}
+	if(cps_cnt>=0xFFFF){
+		fprintf(stderr,"too many glyphs\n");
+		return 1;
+	}
+	write_head(&out,face,size);
+	write_cmap(&out);
+	write_glyf(&out,face);
+	if(!(f=fopen(argv[3],"wb"))){
+		perror(argv[3]);
+		return 1;
+	}
+	if(fwrite(out.data,1,out.len,f)!=out.len){
+		perror("write failed");
+		return 1;
+	}
+	fclose(f);
+	printf("%s: %zu glyphs at %dpx, %zu bytes\n",argv[3],cps_cnt,size,out.len);
+	FT_Done_Face(face);
+	FT_Done_FreeType(lib);
+	free(out.data);
+	free(used);
+	free(cps);
+	return 0;
+}
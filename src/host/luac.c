@@ -0,0 +1,56 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define HOST_TOOL
+#include<stdio.h>
+#include<stdlib.h>
+#include"lua.h"
+#include"lauxlib.h"
+
+/*
+ * usage: luac <input> <output>
+ * compiles one script to stripped bytecode with the bundled lua, the
+ * header lundump checks carries its version and number format, a target
+ * that does not match it loads the source instead.
+ */
+static int writer(lua_State*L,const void*p,size_t sz,void*ud){
+	(void)L;
+	return fwrite(p,1,sz,(FILE*)ud)!=sz;
+}
+
+int main(int argc,char**argv){
+	int r;
+	FILE*out;
+	lua_State*L;
+	if(argc!=3){
+		fprintf(stderr,"usage: %s <input> <output>\n",argv[0]);
+		return 1;
+	}
+	if(!(L=luaL_newstate())){
+		fprintf(stderr,"create lua state failed\n");
+		return 1;
+	}
+	if(luaL_loadfile(L,argv[1])!=LUA_OK){
+		fprintf(stderr,"%s\n",lua_tostring(L,-1));
+		lua_close(L);
+		return 1;
+	}
+	if(!(out=fopen(argv[2],"wb"))){
+		perror(argv[2]);
+		lua_close(L);
+		return 1;
+	}
+	r=lua_dump(L,writer,out,1);
+	if(fclose(out)!=0)r=1;
+	lua_close(L);
+	if(r!=0){
+		fprintf(stderr,"write %s failed\n",argv[2]);
+		remove(argv[2]);
+	}
+	return r!=0;
+}
@@ -0,0 +1,187 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define HOST_TOOL
+#include<stdio.h>
+#include<endian.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include"modalias_index.h"
+
+struct value{
+	char*pattern,*module;
+	struct value*next;
+};
+
+struct node{
+	uint32_t id;
+	size_t cnt,size;
+	unsigned char*chs;
+	struct node**children;
+	struct value*values;
+	uint32_t nvalues;
+};
+
+static struct node**nodes=NULL;
+static size_t nodes_cnt=0,edges_cnt=0,values_cnt=0,nodes_size=0;
+static char*strings=NULL;
+static size_t strings_len=0,strings_size=0;
+
+static void*xalloc(void*p,size_t size){
+	if(!(p=realloc(p,size))){
+		perror("realloc failed");
+		exit(1);
+	}
+	return p;
+}
+
+static struct node*new_node(){
+	struct node*n=xalloc(NULL,sizeof(struct node));
+	memset(n,0,sizeof(struct node));
+	return n;
+}
+
+static struct node*get_child(struct node*n,unsigned char ch){
+	size_t i;
+	for(i=0;i<n->cnt&&n->chs[i]<ch;i++);
+	if(i<n->cnt&&n->chs[i]==ch)return n->children[i];
+	if(n->cnt>=n->size){
+		n->size=n->size?n->size*2:4;
+		n->chs=xalloc(n->chs,n->size);
+		n->children=xalloc(n->children,sizeof(struct node*)*n->size);
+	}
+
+	// keep children sorted for the binary search at runtime
+	memmove(&n->chs[i+1],&n->chs[i],n->cnt-i);
+	memmove(&n->children[i+1],&n->children[i],sizeof(struct node*)*(n->cnt-i));
+	n->chs[i]=ch,n->children[i]=new_node(),n->cnt++;
+	return n->children[i];
+}
+
+static void add_alias(struct node*root,char*pattern,char*module){
+	struct value*v;
+	struct node*n=root;
+	size_t pre=strcspn(pattern,"*?[");
+	for(size_t i=0;i<pre;i++)n=get_child(n,(unsigned char)pattern[i]);
+	for(v=n->values;v;v=v->next)
+		if(strcmp(v->pattern,pattern+pre)==0&&strcmp(v->module,module)==0)return;
+	v=xalloc(NULL,sizeof(struct value));
+	v->pattern=strdup(pattern+pre),v->module=strdup(module);
+	v->next=n->values,n->values=v,n->nvalues++;
+}
+
+// breadth first, so children of one node get consecutive ids
+static void number_nodes(struct node*root){
+	size_t head=0;
+	nodes=xalloc(NULL,sizeof(struct node*)*(nodes_size=64));
+	nodes[nodes_cnt++]=root;
+	while(head<nodes_cnt){
+		struct node*n=nodes[head];
+		n->id=head++;
+		edges_cnt+=n->cnt,values_cnt+=n->nvalues;
+		for(size_t i=0;i<n->cnt;i++){
+			if(nodes_cnt>=nodes_size)
+				nodes=xalloc(nodes,sizeof(struct node*)*(nodes_size*=2));
+			nodes[nodes_cnt++]=n->children[i];
+		}
+	}
+}
+
+static uint32_t add_string(const char*s){
+	size_t l=strlen(s)+1,off=strings_len;
+	if(strings_len+l>strings_size){
+		while(strings_len+l>strings_size)strings_size=strings_size?strings_size*2:4096;
+		strings=xalloc(strings,strings_size);
+	}
+	memcpy(strings+strings_len,s,l);
+	strings_len+=l;
+	return off;
+}
+
+static void write_u32s(FILE*f,uint32_t*v,size_t cnt){
+	for(size_t i=0;i<cnt;i++){
+		uint32_t x=htole32(v[i]);
+		if(fwrite(&x,sizeof(x),1,f)!=1){
+			perror("write failed");
+			exit(1);
+		}
+	}
+}
+
+static void write_index(FILE*f){
+	uint32_t edge=0,value=0;
+	struct modalias_index_header hdr={
+		.magic=MODALIAS_INDEX_MAGIC,
+		.version=MODALIAS_INDEX_VERSION,
+		.nodes=nodes_cnt,.edges=edges_cnt,
+		.values=values_cnt,.strings=0,
+	};
+	uint32_t*vals=xalloc(NULL,sizeof(uint32_t)*(values_cnt*2+1));
+	for(size_t i=0;i<nodes_cnt;i++)
+		for(struct value*v=nodes[i]->values;v;v=v->next){
+			vals[value*2]=add_string(v->pattern);
+			vals[value*2+1]=add_string(v->module);
+			value++;
+		}
+	hdr.strings=strings_len;
+	write_u32s(f,(uint32_t*)&hdr,sizeof(hdr)/sizeof(uint32_t));
+	value=0;
+	for(size_t i=0;i<nodes_cnt;i++){
+		struct node*n=nodes[i];
+		write_u32s(f,(uint32_t[]){edge,n->cnt,value,n->nvalues},4);
+		edge+=n->cnt,value+=n->nvalues;
+	}
+	for(size_t i=0;i<nodes_cnt;i++)for(size_t c=0;c<nodes[i]->cnt;c++)
+		write_u32s(f,(uint32_t[]){nodes[i]->chs[c],nodes[i]->children[c]->id},2);
+	write_u32s(f,vals,values_cnt*2);
+	if(strings_len>0&&fwrite(strings,strings_len,1,f)!=1){
+		perror("write failed");
+		exit(1);
+	}
+	free(vals);
+}
+
+int main(int argc,char**argv){
+	FILE*in,*out;
+	char line[4096],*alias,*module,*save;
+	struct node*root=new_node();
+	size_t cnt=0;
+	if(argc!=3){
+		fputs("Usage: modalias <MODULES_ALIAS> <OUTPUT>\n",stderr);
+		return 1;
+	}
+	if(!(in=fopen(argv[1],"r"))){
+		perror("open modules.alias");
+		return 1;
+	}
+
+	// lines look like: alias usb:v1234p*d*dc*dsc*dp*ic*isc*ip*in* some_driver
+	while(fgets(line,sizeof(line),in)){
+		if(line[0]=='#')continue;
+		if(!strtok_r(line," \t\n",&save))continue;
+		if(strcmp(line,"alias")!=0)continue;
+		if(!(alias=strtok_r(NULL," \t\n",&save)))continue;
+		if(!(module=strtok_r(NULL," \t\n",&save)))continue;
+		add_alias(root,alias,module);
+		cnt++;
+	}
+	fclose(in);
+	number_nodes(root);
+	if(!(out=fopen(argv[2],"wb"))){
+		perror("open output");
+		return 1;
+	}
+	write_index(out);
+	fclose(out);
+	fprintf(
+		stderr,"%zu aliases, %zu nodes, %zu patterns, %zu bytes strings\n",
+		cnt,nodes_cnt,values_cnt,strings_len
+	);
+	return 0;
+}
@@ -19,14 +19,35 @@
 #include<sys/stat.h>
 #include<sys/time.h>
 #include<sys/mman.h>
+#include"zlib.h"
+#include"assets.h"
+
+// smaller files or ones saving less than an eighth are stored as-is
+#define COMPRESS_MIN 4096
 
 char source[PATH_MAX],binary[PATH_MAX],*folder;
 static int dfd,ofd,bfd;
+static bool use_compress=false;
+
+struct index_item{
+	char*path;
+	char kind;
+	size_t id;
+};
+
+static char*var;
+static size_t next_id=0,items_cnt=0,items_size=0;
+static struct index_item*items=NULL;
 
-static void print_info(struct stat*st,int depth);
+struct folder_list{
+	size_t*dirs,*files;
+	size_t dirs_cnt,files_cnt;
+};
+
+static void print_info(struct stat*st,const char*parent,int depth);
 static void print_file(int cfd,char*name,size_t size,int depth);
-static void print_folder(int cfd,char*name,int depth);
-static void print_entity(int fd,char*name,int depth);
+static void print_folder(int cfd,char*name,const char*path,size_t id,struct folder_list*l);
+static size_t print_entity(int fd,char*name,const char*path,const char*parent,char*kind);
 
 static void on_failure(){
 	close(ofd);
@@ -56,8 +77,9 @@ static void add_line_indent(int len,const char*line,...){
 #define add_str_val(name,value) add_line("%s=\"%s\",\n",(name),(value))
 #define add_int_val(name,value) add_line("%s=%d,\n",(name),(value))
 
-static void print_info(struct stat*st,int depth){
-	add_line(".info.parent=NULL,\n");
+static void print_info(struct stat*st,const char*parent,int depth){
+	if(parent)add_line(".info.parent=%s,\n",parent);
+	else add_line(".info.parent=NULL,\n");
 	add_int_val(".info.mode",          st->st_mode);
 	add_int_val(".info.owner",         st->st_uid);
 	add_int_val(".info.group",         st->st_gid);
@@ -67,7 +89,53 @@ static void print_info(struct stat*st,int depth){
 	add_int_val(".info.mtime.tv_nsec", st->st_mtim.tv_nsec);
 }
 
-static void print_folder(int cfd,char*name,int depth){
+static void entity_name(char*buf,size_t len,char kind,size_t id){
+	if(id==0)snprintf(buf,len,"%s",var);
+	else snprintf(buf,len,"%s_%c%zu",var,kind,id);
+}
+
+static void add_item(const char*path,char kind,size_t id){
+	struct index_item*n;
+	if(items_cnt>=items_size){
+		items_size=items_size?items_size*2:256;
+		if(!(n=realloc(items,sizeof(*items)*items_size))){
+			perror("realloc failed");
+			on_failure();
+		}
+		items=n;
+	}
+	if(!(items[items_cnt].path=strdup(path))){
+		perror("strdup failed");
+		on_failure();
+	}
+	items[items_cnt].kind=kind;
+	items[items_cnt].id=id;
+	items_cnt++;
+}
+
+static void print_list(const char*field,char kind,size_t*ids,size_t cnt){
+	int depth=1;
+	char buf[256];
+	add_line("%s=(entry_%s*[]){\n",field,kind=='d'?"dir":"file");
+	for(size_t i=0;i<cnt;i++){
+		entity_name(buf,sizeof(buf),kind,ids[i]);
+		add_line("\t&%s,\n",buf);
+	}
+	add_line("\tNULL\n");
+	add_line("},\n");
+}
+
+static void add_id(size_t**ids,size_t*cnt,size_t id){
+	if(!(*ids=realloc(*ids,sizeof(size_t)*(*cnt+1)))){
+		perror("realloc failed");
+		on_failure();
+	}
+	(*ids)[(*cnt)++]=id;
+}
+
+// children are written out first, their ids go into l
+static void print_folder(int cfd,char*name,const char*path,size_t id,struct folder_list*l){
+	char kind,self[256],parent[260];
 	int fd=name?openat(cfd,name,O_RDONLY|O_DIRECTORY):cfd;
 	if(fd<0){
 		perror("open failed");
@@ -81,35 +149,46 @@ static void print_folder(int cfd,char*name,int depth){
 		return;
 	}
 	struct dirent*e;
-	add_line(".subdirs=(entry_dir*[]){\n");
-	depth++;
+	entity_name(self,sizeof(self),'d',id);
+	snprintf(parent,sizeof(parent),"&%s",self);
 	while((e=readdir(d))){
 		if(
 			e->d_type!=DT_DIR||
 			strcmp(e->d_name,".")==0||
 			strcmp(e->d_name,"..")==0
 		)continue;
-		print_entity(fd,e->d_name,depth);
+		add_id(&l->dirs,&l->dirs_cnt,print_entity(fd,e->d_name,path,parent,&kind));
 	}
-	add_line("NULL\n");
-	depth--;
 	seekdir(d,0);
-	add_line("},\n");
-	add_line(".subfiles=(entry_file*[]){\n");
-	depth++;
 	while((e=readdir(d))){
 		if(
 			e->d_type==DT_DIR||
 			strncmp(e->d_name,".git",4)==0
 		)continue;
-		print_entity(fd,e->d_name,depth);
+		add_id(&l->files,&l->files_cnt,print_entity(fd,e->d_name,path,parent,&kind));
 	}
-	add_line("NULL\n");
-	depth--;
-	add_line("},\n");
 	closedir(d);
 }
 
+static void*compress_file(void*data,size_t size,size_t*out){
+	z_stream zs;
+	void*buf=NULL;
+	if(!use_compress||size<COMPRESS_MIN)return NULL;
+	memset(&zs,0,sizeof(zs));
+	if(deflateInit2(&zs,9,Z_DEFLATED,MAX_WBITS+16,9,Z_DEFAULT_STRATEGY)!=Z_OK)
+		return NULL;
+	*out=deflateBound(&zs,size);
+	if((buf=malloc(*out))){
+		zs.next_in=data,zs.avail_in=size;
+		zs.next_out=buf,zs.avail_out=*out;
+		if(deflate(&zs,Z_FINISH)==Z_STREAM_END&&zs.total_out<size-size/8)
+			*out=zs.total_out;
+		else free(buf),buf=NULL;
+	}
+	deflateEnd(&zs);
+	return buf;
+}
+
 static void print_file(int cfd,char*name,size_t size,int depth){
 	int fd=name?openat(cfd,name,O_RDONLY):cfd;
 	if(fd<0){
@@ -117,70 +196,140 @@ static void print_file(int cfd,char*name,size_t size,int depth){
 		on_failure();
 		return;
 	}
+	off_t off=lseek(bfd,0,SEEK_CUR);
 	add_int_val(".length",size);
-	add_int_val(".offset",lseek(bfd,0,SEEK_CUR));
-	add_line(".content=NULL,\n");
+	add_int_val(".offset",off);
 	if(size>0){
-		void*v=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+		size_t len=size;
+		void*v=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0),*c;
 		if(!v){
 			perror("mmap failed");
 			on_failure();
 			return;
 		}
-		ssize_t x=write(bfd,v,size);
+		add_line(".crc=0x%08lx,\n",crc32(0,v,size));
+		if((c=compress_file(v,size,&len))){
+			add_line(".compressed=true,\n");
+			add_int_val(".stored",len);
+			add_line(".content=NULL,\n");
+		}else add_line(".content=&_binary_rootfs_bin_start+%ld,\n",(long)off);
+		ssize_t x=write(bfd,c?c:v,len);
 		munmap(v,size);
-		if((size_t)x!=size){
-			fprintf(stderr,"write binary size mismatch %zu != %zu: %m\n",x,size);
+		if(c)free(c);
+		if((size_t)x!=len){
+			fprintf(stderr,"write binary size mismatch %zu != %zu: %m\n",x,len);
 			on_failure();
 			return;
 		}
 		write(bfd,(char[]){0,0},1);
-	}
+	}else add_line(".content=NULL,\n");
 	close(fd);
 }
 
-static void print_entity(int fd,char*name,int depth){
+static size_t print_entity(int fd,char*name,const char*path,const char*parent,char*kind){
+	int depth=1;
+	size_t id=next_id++;
 	struct stat st;
+	char sub[PATH_MAX],buf[256];
+	struct folder_list l;
 	if(name?fstatat(fd,name,&st,AT_SYMLINK_NOFOLLOW):fstat(fd,&st)<0){
 		perror("fstat failed");
 		on_failure();
-		return;
+		return 0;
+	}
+	*kind=S_ISDIR(st.st_mode)?'d':'f';
+	entity_name(buf,sizeof(buf),*kind,id);
+	if(!name)sub[0]=0;
+	else if(path[0])snprintf(sub,sizeof(sub),"%s/%s",path,name);
+	else snprintf(sub,sizeof(sub),"%s",name);
+	if(name)add_item(sub,*kind,id);
+
+	// folders are referenced by their children before being defined
+	if(*kind=='d'){
+		add_line_indent(0,"%sentry_dir %s;\n",name?"static ":"",buf);
+		memset(&l,0,sizeof(l));
+		print_folder(fd,name,sub,id,&l);
 	}
-	if(name){
-		add_line("&(entry_%s){\n",S_ISDIR(st.st_mode)?"dir":"file");
-		depth++;
-		add_str_val(".info.name",name);
-	}else depth++;
-	print_info(&st,depth);
+	add_line_indent(0,"%sentry_%s %s={\n",name?"static ":"",*kind=='d'?"dir":"file",buf);
+	if(name)add_str_val(".info.name",name);
+	print_info(&st,parent,depth);
 	switch(st.st_mode&S_IFMT){
 		case S_IFLNK:{
 			if(!name)break;
-			char buf[PATH_MAX]={0};
-			if(readlinkat(fd,name,buf,PATH_MAX-1)<0){
+			char lnk[PATH_MAX]={0};
+			if(readlinkat(fd,name,lnk,PATH_MAX-1)<0){
 				perror("readlink failed");
 				on_failure();
-				return;
+				return 0;
 			}
-			add_str_val(".content",buf);
+			add_str_val(".content",lnk);
 		}break;
 		case S_IFBLK:
 		case S_IFCHR:
 		case S_IFIFO:
 		case S_IFSOCK:add_int_val(".dev",st.st_rdev);break;
-		case S_IFDIR:print_folder(fd,name,depth);break;
 		case S_IFREG:print_file(fd,name,st.st_size,depth);break;
+		case S_IFDIR:
+			print_list(".subdirs",'d',l.dirs,l.dirs_cnt);
+			print_list(".subfiles",'f',l.files,l.files_cnt);
+			if(l.dirs)free(l.dirs);
+			if(l.files)free(l.files);
+		break;
 	}
-	if(name){
-		depth--;
-		add_line("},\n");
+	if(!name)add_line(".index=&%s_index,\n",var);
+	add_line_indent(0,"};\n");
+	return id;
+}
+
+// open addressing table, at most half full so probes stay short
+static void print_index(){
+	size_t size=16,slot;
+	char buf[256];
+	struct index_item**table;
+	while(size<items_cnt*2)size*=2;
+	if(!(table=calloc(size,sizeof(*table)))){
+		perror("calloc failed");
+		on_failure();
+		return;
+	}
+	for(size_t i=0;i<items_cnt;i++){
+		slot=assets_path_hash(items[i].path,strlen(items[i].path))&(size-1);
+		while(table[slot])slot=(slot+1)&(size-1);
+		table[slot]=&items[i];
+	}
+	dprintf(ofd,"static entry_index %s_index_table[]={\n",var);
+	for(size_t i=0;i<size;i++){
+		if(!table[i]){
+			dprintf(ofd,"\t{0,NULL,NULL,NULL},\n");
+			continue;
+		}
+		entity_name(buf,sizeof(buf),table[i]->kind,table[i]->id);
+		dprintf(
+			ofd,"\t{0x%08x,\"%s\",%s%s,%s%s},\n",
+			assets_path_hash(table[i]->path,strlen(table[i]->path)),
+			table[i]->path,
+			table[i]->kind=='d'?"&":"",table[i]->kind=='d'?buf:"NULL",
+			table[i]->kind=='f'?"&":"",table[i]->kind=='f'?buf:"NULL"
+		);
 	}
+	dprintf(ofd,"};\n");
+	dprintf(ofd,"assets_index %s_index={\n",var);
+	dprintf(ofd,"\t.size=%zu,\n",size);
+	dprintf(ofd,"\t.table=%s_index_table,\n",var);
+	dprintf(ofd,"};\n");
+	free(table);
 }
+
 int main(int argc,char**argv){
+	if(argc==5&&strcmp(argv[1],"-z")==0){
+		use_compress=true;
+		argc--,argv++;
+	}
 	if(argc!=4){
-		fputs("Usage: assets <FOLDER> <SOURCE_DIR> <VARIABLE>\n",stderr);
+		fputs("Usage: assets [-z] <FOLDER> <SOURCE_DIR> <VARIABLE>\n",stderr);
 		return 1;
 	}
-	folder=argv[1];
+	folder=argv[1],var=argv[3];
 	snprintf(source,PATH_MAX-1,"%s/rootfs.c",argv[2]);
 	snprintf(binary,PATH_MAX-1,"%s/rootfs.bin",argv[2]);
 	if((dfd=open(folder,O_RDONLY|O_DIRECTORY))<0){
@@ -198,9 +347,10 @@ int main(int argc,char**argv){
 	dprintf(ofd,"#include<stddef.h>\n");
 	dprintf(ofd,"#include<sys/stat.h>\n");
 	dprintf(ofd,"#include\"assets.h\"\n");
-	dprintf(ofd,"entry_dir %s={\n",argv[3]);
-	print_entity(dfd,NULL,0);
-	dprintf(ofd,"};\n");
+	dprintf(ofd,"extern char _binary_rootfs_bin_start;\n");
+	dprintf(ofd,"extern assets_index %s_index;\n",var);
+	print_entity(dfd,NULL,"",NULL,(char[]){0});
+	print_index();
 	close(ofd);
 	return 0;
 }
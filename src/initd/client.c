@@ -12,6 +12,7 @@
 #include"defines.h"
 #include"output.h"
 #include"init_internal.h"
+#define PIPELINE_DEPTH 32
 
 int initfd=-1;
 
@@ -52,13 +53,48 @@ int init_recv_raw(struct init_msg*response){
 	return init_recv_data(initfd,response);
 }
 
+static uint32_t next_id=0;
+
+static uint32_t new_id(){
+	if(++next_id==0)next_id=1;
+	return next_id;
+}
+
+static bool is_status(struct init_msg*msg){
+	return msg->action==ACTION_OK||msg->action==ACTION_FAIL;
+}
+
 int init_send(struct init_msg*send,struct init_msg*response){
 	if(!send||!response)ERET(EINVAL);
+	send->id=new_id();
 	if(init_send_raw(send)!=0)return -errno;
 	do{if(init_recv_raw(response))return -errno;}
-	while(
-		response->action!=ACTION_OK&&
-		response->action!=ACTION_FAIL
-	);
+	while(!is_status(response)||response->id!=send->id);
+	return 0;
+}
+
+int init_send_batch(struct init_msg*reqs,struct init_msg*res,size_t cnt){
+	size_t sent=0,done=0,i;
+	uint32_t base;
+	struct init_msg r;
+	if(!reqs||!res)ERET(EINVAL);
+	if(cnt==0)return 0;
+	base=new_id();
+	next_id=base+cnt-1;
+	for(i=0;i<cnt;i++){
+		reqs[i].id=base+i;
+		init_initialize_msg(&res[i],ACTION_NONE);
+	}
+
+	// keep some requests in flight, replies can come back in any order
+	while(done<cnt){
+		while(sent<cnt&&sent-done<PIPELINE_DEPTH)
+			if(init_send_raw(&reqs[sent++])!=0)return -errno;
+		if(init_recv_raw(&r)!=0)return -errno;
+		if(!is_status(&r)||(i=r.id-base)>=cnt)continue;
+		if(res[i].action!=ACTION_NONE)continue;
+		memcpy(&res[i],&r,sizeof(r));
+		done++;
+	}
 	return 0;
-}
\ No newline at end of file
+}
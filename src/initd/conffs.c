@@ -12,9 +12,9 @@
 #include<stdlib.h>
 #include<string.h>
 #include<pthread.h>
-#include<blkid/blkid.h>
 #include"init.h"
 #include"confd.h"
+#include"devd.h"
 #include"logger.h"
 #include"system.h"
 #include"defines.h"
@@ -24,6 +24,7 @@
 #define DEFAULT_CONFFS_BLOCK "PARTLABEL=logfs"
 
 static pthread_t t_conffs;
+static char conffs_point[PATH_MAX]={0};
 
 static int _setup_conffs(){
 	int e=0;
@@ -42,7 +43,7 @@ static int _setup_conffs(){
 	wait_block(conffs,10,TAG);
 
 	if(conffs[0]!='/'){
-		char*x=blkid_evaluate_tag(conffs,NULL,NULL);
+		char*x=blk_resolve_tag(conffs);
 		free(conffs);
 		conffs=x;
 	}
@@ -52,13 +53,10 @@ static int _setup_conffs(){
 	}
 
 	char*type=NULL;
-	blkid_cache cache=NULL;
-	blkid_get_cache(&cache,NULL);
-	if(!(type=blkid_get_tag_value(cache,"TYPE",conffs))){
+	bool alloc=true;
+	if(!(type=blk_get_tag_value(conffs,"TYPE"))){
 		telog_warn("cannot determine fstype in conffs %s",conffs);
-		type="vfat";
-		blkid_put_cache(cache);
-		cache=NULL;
+		type="vfat",alloc=false;
 	}
 
 	char mod[64]={0};
@@ -67,6 +65,7 @@ static int _setup_conffs(){
 
 	char point[PATH_MAX];
 	if((e=auto_mount(conffs,type,point,PATH_MAX))!=0)goto ex;
+	strncpy(conffs_point,point,sizeof(conffs_point)-1);
 
 	char path[PATH_MAX]={0};
 	snprintf(path,sizeof(path)-1,"%s/simple-init.static.linux.conf",point);
@@ -76,10 +75,7 @@ static int _setup_conffs(){
 	e=confd_set_default_config(path);
 	confd_load_file(path);
 	ex:
-	if(cache){
-		if(type)free(type);
-		blkid_put_cache(cache);
-	}
+	if(alloc&&type)free(type);
 	if(conffile)free(conffile);
 	free(conffs);
 	return e;
@@ -87,6 +83,7 @@ static int _setup_conffs(){
 
 static void*_conffs_thread(void*d __attribute__((unused))){
 	_setup_conffs();
+	readahead_set_conffs(conffs_point[0]?conffs_point:NULL);
 	return NULL;
 }
 
@@ -24,6 +24,8 @@
 #include"defines.h"
 #include"cmdline.h"
 #include"service.h"
+#include"led_status.h"
+#include"trace.h"
 #include"language.h"
 #include"proctitle.h"
 
@@ -34,7 +36,10 @@ static int sfd=-1;
 
 static int system_boot(){
 	int r;
-	if((r=preinit())!=0)return trlog_emerg(r,"preinit failed with %d",r);
+	trace_begin("init","preinit");
+	r=preinit();
+	trace_end("init","preinit");
+	if(r!=0)return trlog_emerg(r,"preinit failed with %d",r);
 	tlog_info("init system start");
 	setproctitle("init");
 	chdir(_PATH_ROOT)==0?
@@ -44,8 +49,11 @@ static int system_boot(){
 	setup_signals();
 	init_environ();
 
+	trace_begin("init","wait logfs and conffs");
 	wait_logfs();
 	wait_conffs();
+	trace_end("init","wait logfs and conffs");
+	led_status("booting");
 
 	char*lang=confd_get_string("language",NULL);
 	if(lang)lang_set(lang);
@@ -54,7 +62,8 @@ static int system_boot(){
 
 int system_down(){
 	tlog_notice("prepare system clean");
-	service_wait_all_stop();
+	led_status("shutdown");
+	shutdown_services();
 	if(action==ACTION_SWITCHROOT){
 		#define root actiondata.newroot.root
 		#define init actiondata.newroot.init
@@ -135,6 +144,10 @@ int init_main(int argc __attribute__((unused)),char**argv){
 	)return invoke_internal_cmd_nofork_by_name("simple-init",argv);
 	status=INIT_BOOT;
 
+	// boot timeline, before any daemon forks so they share it
+	trace_init(TRACE_EVENTS);
+	trace_begin("init","init");
+
 	init_console();
 
 	// start loggerd
@@ -151,16 +164,23 @@ int init_main(int argc __attribute__((unused)),char**argv){
 	prctl(PR_SET_NAME,"Init Daemon",0,0,0);
 
 	// boot
-	if((r=system_boot())!=0)return r;
+	trace_begin("init","system boot");
+	r=system_boot();
+	trace_end("init","system boot");
+	if(r!=0)return r;
 
 	// init service framework
 	service_init();
 
 	// register all services
+	trace_begin("init","register services");
 	init_register_all_service();
+	trace_end("init","register services");
 
 	// load all services from config
+	trace_begin("init","load services");
 	svc_conf_parse_services("service.services");
+	trace_end("init","load services");
 
 	// listen init control socket
 	if((sfd=listen_init_socket())<0){
@@ -168,9 +188,14 @@ int init_main(int argc __attribute__((unused)),char**argv){
 		abort();
 	}
 
+	// bind activation sockets, those services start on first connection
+	svc_listen_all_sockets();
+
 	// start default service
 	service_start(svc_default);
+	trace_end("init","init");
 
+	led_status("running");
 	running:
 	status=INIT_RUNNING;
 	while(status==INIT_RUNNING){
@@ -12,10 +12,10 @@
 #include<stdlib.h>
 #include<string.h>
 #include<pthread.h>
-#include<blkid/blkid.h>
 #include"str.h"
 #include"init.h"
 #include"confd.h"
+#include"devd.h"
 #include"logger.h"
 #include"system.h"
 #include"defines.h"
@@ -44,7 +44,7 @@ static int _setup_logfs(){
 	wait_block(logfs,10,TAG);
 
 	if(logfs[0]!='/'){
-		char*x=blkid_evaluate_tag(logfs,NULL,NULL);
+		char*x=blk_resolve_tag(logfs);
 		free(logfs);
 		logfs=x;
 	}
@@ -54,13 +54,10 @@ static int _setup_logfs(){
 	}
 
 	char*type=NULL;
-	blkid_cache cache=NULL;
-	blkid_get_cache(&cache,NULL);
-	if(!(type=blkid_get_tag_value(cache,"TYPE",logfs))){
+	bool alloc=true;
+	if(!(type=blk_get_tag_value(logfs,"TYPE"))){
 		telog_warn("cannot determine fstype in logfs %s",logfs);
-		type="vfat";
-		blkid_put_cache(cache);
-		cache=NULL;
+		type="vfat",alloc=false;
 	}
 
 	char mod[64]={0};
@@ -93,10 +90,7 @@ static int _setup_logfs(){
 	}
 	e=logger_open(path);
 	ex:
-	if(cache){
-		if(type)free(type);
-		blkid_put_cache(cache);
-	}
+	if(alloc&&type)free(type);
 	if(logfile)free(logfile);
 	free(logfs);
 	return e;
@@ -10,6 +10,7 @@
 #include<fcntl.h>
 #include<errno.h>
 #include<unistd.h>
+#include<stdlib.h>
 #include<string.h>
 #include<sys/stat.h>
 #include"cmdline.h"
@@ -23,6 +24,9 @@
 #include"pathnames.h"
 #include"language.h"
 #include"hardware.h"
+#include"trace.h"
+#include"metrics.h"
+#include"mempressure.h"
 #define TAG "preinit"
 
 static bool need_extract_rootfs(){
@@ -42,7 +46,36 @@ static bool need_extract_rootfs(){
 	return need;
 }
 
+static void init_assets(int dfd){
+	#ifdef ENABLE_ROOTFS_IMAGE
+	int r;
+	trace_begin("preinit","mount assets");
+	r=mount_rootfs_image(dfd);
+	trace_end("preinit","mount assets");
+	if(r==0){
+		tlog_debug("mount assets done");
+		return;
+	}
+	tlog_warn("mount rootfs image failed, extract instead");
+	#endif
+	trace_begin("preinit","extract assets");
+	create_assets_dir(dfd,&assets_rootfs,false);
+	trace_end("preinit","extract assets");
+	tlog_debug("extract assets done");
+}
+
+static void log_filter_cb(
+	const char*path __attribute__((unused)),
+	enum conf_type type __attribute__((unused)),
+	void*data __attribute__((unused))
+){
+	char*f=confd_get_string("logger.filter",NULL);
+	if(logger_send_filter(f)!=0)tlog_warn("invalid log filter %s",f?f:"");
+	if(f)free(f);
+}
+
 int preinit(){
+	int64_t bs;
 
 	// ensure important folder exists
 	mkdir(_PATH_PROC,755);
@@ -61,6 +94,9 @@ int preinit(){
 	if(access(_PATH_PROC_CMDLINE,R_OK)!=0)
 		return terlog_error(2,"failed to find proc mountpoint");
 
+	// prefetch the files of the last boot, the list comes with the conffs
+	readahead_start();
+
 	// disable printk ratelimit
 	simple_file_write(_PATH_PROC_SYS"/kernel/printk_devkmsg","on\n");
 
@@ -71,13 +107,14 @@ int preinit(){
 	if(need_extract_rootfs()){
 		int dfd;
 		if((dfd=open(_PATH_ROOT,O_DIR))>0){
-			create_assets_dir(dfd,&assets_rootfs,false);
-			tlog_debug("extract assets done");
+			init_assets(dfd);
 			lang_init_locale();
 			close(dfd);
 		}
 		if((dfd=open(_PATH_USR_BIN,O_DIR))>0){
+			trace_begin("preinit","install commands");
 			install_cmds(dfd);
+			trace_end("preinit","install commands");
 			tlog_debug("install commands done");
 			close(dfd);
 		}
@@ -91,11 +128,38 @@ int preinit(){
 	chown(DEFAULT_LOGGER,0,0);
 
 	// start config daemon
+	#ifdef ENABLE_CONFD_THREAD
+	if(start_confd_thread(TAG)<0){
+	#else
 	if(start_confd(TAG,NULL)<0){
+	#endif
 		tlog_emerg("start config daemon failed");
 		abort();
 	}
 
+	// counters of init and every daemon thread inside it
+	metrics_serve("init");
+	mem_monitor_start();
+
+	// resize loggerd history when configured
+	if((bs=confd_get_integer("logger.buffer_size",0))>0&&logger_set_buffer_size((size_t)bs)!=0)
+		telog_warn("set logger buffer size failed");
+
+	// rotate file outputs, closed segments are compressed by loggerd
+	if((bs=confd_get_integer("logger.rotate_size",-1))>=0){
+		char*comp=confd_get_string("logger.rotate_compress","gzip");
+		if(logger_set_rotate(
+			(size_t)bs,
+			(int)confd_get_integer("logger.rotate_keep",4),
+			comp
+		)!=0)telog_warn("set logger rotation failed");
+		if(comp)free(comp);
+	}
+
+	// push per tag log levels to all clients, now and whenever they change
+	log_filter_cb(NULL,0,NULL);
+	confd_watch("logger.filter",log_filter_cb,NULL);
+
 	// create config runtime root key
 	confd_add_key("runtime");
 	confd_set_save("runtime",false);
@@ -144,7 +208,9 @@ int preinit(){
 	start_devd(TAG,NULL);
 
 	// create all device nodes
+	trace_begin("preinit","init devices");
 	devd_call_init();
+	trace_end("preinit","init devices");
 
 	// open active consoles
 	logger_open_console();
@@ -166,6 +232,9 @@ int preinit(){
 	chmod(dev_logger,0600);
 	chown(dev_logger,0,0);
 
+	// open binary log store for logviewer
+	logger_open_store(DEFAULT_LOG_STORE);
+
 	// load modules from list config
 	devd_call_modload();
 
@@ -10,15 +10,18 @@
 #include<stdlib.h>
 #include<string.h>
 #include<stdbool.h>
+#include<poll.h>
 #include<sys/socket.h>
 #include"str.h"
 #include"system.h"
 #include"service.h"
 #include"logger.h"
 #include"defines.h"
+#include"trace.h"
 #include"language.h"
 #include"init_internal.h"
 #define TAG "init"
+#define SEND_TIMEOUT 5000
 
 bool init_check_msg(struct init_msg*msg){
 	return msg&&
@@ -117,22 +120,102 @@ static void process_setenv(struct init_msg*msg,struct init_msg*res){
 	);
 }
 
+// long replies are sent as chunks of act before the final status
+static void send_chunks(struct init_client*clt,struct init_msg*res,enum init_action act,char*buf,size_t len){
+	size_t off,s;
+	struct init_msg msg;
+	for(off=0;off<len;off+=s){
+		init_initialize_msg(&msg,act);
+		msg.id=res->id;
+		s=MIN(len-off,sizeof(msg.data.data)-1);
+		memcpy(msg.data.data,buf+off,s);
+		if(init_send_data(clt->fd,&msg)!=0)break;
+	}
+}
+
+static void process_bootchart(struct init_client*clt,struct init_msg*res){
+	char*buf=NULL;
+	size_t len=0;
+	FILE*f=open_memstream(&buf,&len);
+	if(!f){
+		res->action=ACTION_FAIL,res->data.status.ret=errno;
+		return;
+	}
+	if(trace_dump_json(f)!=0){
+		res->action=ACTION_FAIL,res->data.status.ret=errno?errno:EIO;
+		fclose(f);
+		free(buf);
+		return;
+	}
+	fclose(f);
+	send_chunks(clt,res,ACTION_BOOTCHART,buf,len);
+	free(buf);
+}
+
+static void usage_line(FILE*f,struct service*svc){
+	char mem[32],peak[32],rd[32],wr[32];
+	if(svc_cgroup_update(svc)!=0)return;
+	fprintf(
+		f,"%-20s %-8s %10llu %8s %8s %8s %8s %4llu\n",
+		svc->name,svc_status_short_string(svc->status),
+		(unsigned long long)svc->usage.cpu_usec/1000,
+		make_readable_str_buf(mem,sizeof(mem),svc->usage.mem_current,1,0),
+		make_readable_str_buf(peak,sizeof(peak),svc->usage.mem_peak,1,0),
+		make_readable_str_buf(rd,sizeof(rd),svc->usage.io_rbytes,1,0),
+		make_readable_str_buf(wr,sizeof(wr),svc->usage.io_wbytes,1,0),
+		(unsigned long long)svc->usage.oom_kills
+	);
+}
+
+static void process_usage(struct init_client*clt,struct init_msg*msg,struct init_msg*res){
+	list*cur,*next;
+	char*buf=NULL;
+	size_t len=0;
+	struct service*svc=NULL;
+	FILE*f;
+	msg->data.data[sizeof(msg->data.data)-1]=0;
+	if(msg->data.data[0]&&!(svc=svc_lookup_by_name(msg->data.data))){
+		res->action=ACTION_FAIL,res->data.status.ret=errno?errno:ENOENT;
+		return;
+	}
+	if(!(f=open_memstream(&buf,&len))){
+		res->action=ACTION_FAIL,res->data.status.ret=errno;
+		return;
+	}
+	fprintf(
+		f,"%-20s %-8s %10s %8s %8s %8s %8s %4s\n",
+		"SERVICE","STATUS","CPU(ms)","MEMORY","PEAK","READ","WRITE","OOM"
+	);
+	if(svc)usage_line(f,svc);
+	else{
+		MUTEX_LOCK(services_lock);
+		if((next=list_first(services)))do{
+			cur=next;
+			LIST_DATA_DECLARE(s,cur,struct service*);
+			if(s)usage_line(f,s);
+		}while((next=cur->next));
+		MUTEX_UNLOCK(services_lock);
+	}
+	fclose(f);
+	send_chunks(clt,res,ACTION_SVC_USAGE,buf,len);
+	free(buf);
+}
+
 static void process_language(struct init_msg*msg,struct init_msg*res){
 	if(lang_set(msg->data.data)!=0)res->data.status.ret=errno;
 	else tlog_info("set language to %s",msg->data.data);
 }
 
 int init_process_data(struct init_client*clt,struct init_msg*msg){
-	char s[BUFSIZ];
 	struct init_msg res;
 	init_initialize_msg(&res,ACTION_OK);
 	if(!init_check_msg(msg))ERET(EINVAL);
+	res.id=msg->id;
 	memset(&actiondata,0,sizeof(actiondata));
 	memcpy(&actiondata,&msg->data,sizeof(union action_data));
 	tlog_debug(
 		"receive %s request from %s",
-		action2string(msg->action),
-		ucred2string(&clt->cred,s,BUFSIZ,true)
+		action2string(msg->action),clt->peer
 	);
 	if(init_check_privilege(msg->action,&clt->cred))switch(msg->action){
 		case ACTION_POWEROFF:case ACTION_HALT:case ACTION_REBOOT:
@@ -178,6 +261,8 @@ int init_process_data(struct init_client*clt,struct init_msg*msg){
 			res.data.status.ret=errno;
 		}break;
 		case ACTION_SVC_DUMP:svc_dump_services();break;
+		case ACTION_BOOTCHART:process_bootchart(clt,&res);break;
+		case ACTION_SVC_USAGE:process_usage(clt,msg,&res);break;
 		case ACTION_NONE:case ACTION_OK:case ACTION_FAIL:break;
 		default:res.action=ACTION_FAIL,res.data.status.ret=ENOSYS;
 	}
@@ -199,22 +284,31 @@ const char*action2string(enum init_action act){
 		case ACTION_SVC_RELOAD:return "ReLoad Service";
 		case ACTION_SVC_DUMP:return "Dump All Service";
 		case ACTION_SVC_STATUS:return "Get Service Status";
+		case ACTION_BOOTCHART:return "Dump Boot Timeline";
+		case ACTION_SVC_USAGE:return "Get Service Usage";
 		default:return "Unknown";
 	}
 }
 
 int init_send_data(int fd,struct init_msg*send){
 	ssize_t s;
+	size_t off=0;
+	struct pollfd p={.fd=fd,.events=POLLOUT};
 	if(fd<0)ERET(ENOTCONN);
 	if(!init_check_msg(send))ERET(EINVAL);
-	while(true){
-		s=write(fd,send,sizeof(struct init_msg));
+
+	// client sockets in initd are non-blocking, a busy reader must not lose replies
+	while(off<sizeof(struct init_msg)){
+		s=write(fd,(char*)send+off,sizeof(struct init_msg)-off);
 		if(s<0)switch(errno){
 			case EINTR:continue;
+			case EAGAIN:
+				if(poll(&p,1,SEND_TIMEOUT)>0)continue;
+				ERET(ETIMEDOUT);
 			default:return -1;
-		}else break;
+		}else if(s==0)ERET(EIO);
+		off+=s;
 	}
-	if(s!=sizeof(struct init_msg))ERET(EIO);
 	return 0;
 }
 
@@ -0,0 +1,475 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<poll.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<limits.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<sys/utsname.h>
+#include<sys/fanotify.h>
+#include<linux/fs.h>
+#include<linux/fiemap.h>
+#include"init.h"
+#include"lock.h"
+#include"array.h"
+#include"confd.h"
+#include"trace.h"
+#include"logger.h"
+#include"system.h"
+#include"defines.h"
+#include"pathnames.h"
+#define TAG "readahead"
+
+/*
+ * boot readahead, enabled by readahead.enabled
+ * the list lives in the conffs (readahead.file), so the worker started by
+ * preinit waits until the conffs is mounted
+ * without a valid list, fanotify records every regular file opened on a
+ * block backed mount until gui or getty set runtime.boot.ready (or
+ * readahead.record_time seconds pass), then mincore tells which pages
+ * the boot read, those ranges are saved sorted by device and the first
+ * physical extent of the file
+ * with a list, the ranges are prefetched with readahead(2) in that order
+ * the list is dropped when the kernel, modules, firmware or init binary
+ * changed (stamp), or when a quarter of its files changed
+ * both boots log the time until runtime.boot.ready and put it in the
+ * boot timeline, the prefetching one against the recording one
+ */
+#define RA_FILE      "simple-init.readahead"
+#define RA_MAGIC     "# simple-init readahead 1"
+#define RA_READY     "runtime.boot.ready"
+#define RA_FILES     4096
+#define RA_RANGES    16
+#define RA_GAP       16
+#define RA_MAX_BYTES 0x4000000
+#define RA_RECORD    60
+#define RA_WAIT      60
+
+struct ra_range{
+	long long off,len;
+};
+
+struct ra_file{
+	dev_t dev;
+	ino_t ino;
+	uint64_t key;
+	long long size,mtime;
+	size_t cnt;
+	struct ra_range ranges[RA_RANGES];
+	char*path;
+};
+
+static mutex_t ra_lock=MUTEX_INITIALIZER;
+static pthread_cond_t ra_cond=PTHREAD_COND_INITIALIZER;
+static char conffs_point[PATH_MAX]={0};
+static bool conffs_known=false;
+
+static struct ra_file*files=NULL;
+static size_t files_cnt=0;
+static uint32_t seen[RA_FILES*2];
+
+static long long boot_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_BOOTTIME,&ts);
+	return ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+}
+
+static uint64_t fnv(uint64_t h,const void*data,size_t len){
+	const unsigned char*p=data;
+	while(len--)h=(h^*p++)*0x100000001B3ULL;
+	return h;
+}
+
+static uint64_t stat_hash(uint64_t h,const char*path){
+	struct stat st;
+	long long v[2];
+	if(stat(path,&st)!=0)return fnv(h,"-",1);
+	v[0]=st.st_size,v[1]=st.st_mtime;
+	return fnv(h,v,sizeof(v));
+}
+
+// anything that changes what early boot loads
+static uint64_t ra_stamp(){
+	struct utsname u;
+	char path[PATH_MAX];
+	uint64_t h=0xCBF29CE484222325ULL;
+	if(uname(&u)==0){
+		h=fnv(h,u.release,strlen(u.release));
+		snprintf(path,sizeof(path),_PATH_LIB_MODULES"/%s/modules.dep",u.release);
+		h=stat_hash(h,path);
+	}
+	h=stat_hash(h,_PATH_LIB"/firmware");
+	return stat_hash(h,_PATH_PROC_SELF"/exe");
+}
+
+void readahead_set_conffs(const char*point){
+	MUTEX_LOCK(ra_lock);
+	if(point)strncpy(conffs_point,point,sizeof(conffs_point)-1);
+	conffs_known=true;
+	pthread_cond_broadcast(&ra_cond);
+	MUTEX_UNLOCK(ra_lock);
+}
+
+static bool ra_wait_conffs(char*point,size_t size){
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	ts.tv_sec+=RA_WAIT;
+	MUTEX_LOCK(ra_lock);
+	while(!conffs_known)
+		if(pthread_cond_timedwait(&ra_cond,&ra_lock,&ts)==ETIMEDOUT)break;
+	strncpy(point,conffs_point,size-1);
+	MUTEX_UNLOCK(ra_lock);
+	return point[0]!=0;
+}
+
+// wait for gui or getty, returns the boot time then
+static long long ra_wait_ready(int timeout){
+	int fd;
+	char path[256];
+	long long end=boot_ms()+timeout*1000LL,left,ready=-1;
+	fd=confd_watch_open(RA_READY);
+	for(;;){
+		if(confd_get_boolean(RA_READY,false)){
+			ready=boot_ms();
+			break;
+		}
+		if(fd<0||(left=end-boot_ms())<=0)break;
+		if(confd_watch_read(fd,path,sizeof(path),NULL,left)<0)break;
+	}
+	confd_watch_close(fd);
+	return ready;
+}
+
+static void ra_report(long long ready,long long recorded,bool record){
+	if(ready<0){
+		tlog_notice("boot not ready within the readahead timeout");
+		return;
+	}
+	if(record||recorded<0){
+		tlog_info("boot ready after %lld ms%s",ready,record?" while recording":"");
+		trace_instant("readahead","boot ready %lldms",ready);
+		return;
+	}
+	tlog_info(
+		"boot ready after %lld ms, %+lld ms against the recording boot",
+		ready,ready-recorded
+	);
+	trace_instant("readahead","boot ready %lldms (%+lldms)",ready,ready-recorded);
+}
+
+static FILE*ra_open(const char*list,uint64_t stamp,long long*recorded){
+	FILE*f;
+	char line[256];
+	unsigned long long s=0;
+	if(!(f=fopen(list,"r")))return NULL;
+	if(
+		!fgets(line,sizeof(line),f)||strncmp(line,RA_MAGIC,strlen(RA_MAGIC))!=0||
+		!fgets(line,sizeof(line),f)||sscanf(line,"stamp %llx",&s)!=1||
+		!fgets(line,sizeof(line),f)||sscanf(line,"boot %lld",recorded)!=1
+	){
+		tlog_warn("invalid readahead list %s, record again",list);
+		fclose(f);
+		return NULL;
+	}
+	if(s!=stamp){
+		tlog_notice("kernel, modules or init changed, record readahead again");
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+// one line is: <size> <mtime> <off>+<len>[,<off>+<len>]... <path>
+static void ra_prefetch(FILE*f,size_t max,size_t*total,size_t*stale,size_t*bytes){
+	int fd,n;
+	struct stat st;
+	long long size,mtime,off,len;
+	char line[PATH_MAX+512],*r,*p,*e;
+	while(*bytes<max&&fgets(line,sizeof(line),f)){
+		if((e=strchr(line,'\n')))*e=0;
+		if(sscanf(line,"%lld %lld %n",&size,&mtime,&n)!=2)continue;
+		r=line+n;
+		if(!(p=strchr(r,' ')))continue;
+		*p++=0,(*total)++;
+		if((fd=open(p,O_RDONLY|O_CLOEXEC|O_NOATIME))<0){
+			(*stale)++;
+			continue;
+		}
+		if(fstat(fd,&st)!=0||st.st_size!=size||st.st_mtime!=mtime){
+			(*stale)++;
+			close(fd);
+			continue;
+		}
+		for(;r&&*bytes<max;r=(e=strchr(r,','))?e+1:NULL){
+			if(sscanf(r,"%lld+%lld",&off,&len)!=2)break;
+			readahead(fd,off,len);
+			*bytes+=len;
+		}
+		close(fd);
+	}
+}
+
+static size_t ra_slot(dev_t dev,ino_t ino){
+	size_t i=((uint64_t)ino*0x9E3779B97F4A7C15ULL^dev)%ARRLEN(seen);
+	while(seen[i]&&(files[seen[i]-1].ino!=ino||files[seen[i]-1].dev!=dev))
+		i=(i+1)%ARRLEN(seen);
+	return i;
+}
+
+static void ra_record_open(int fd){
+	ssize_t l;
+	size_t slot;
+	struct stat st;
+	char path[PATH_MAX];
+	if(files_cnt>=RA_FILES)return;
+	if(fstat(fd,&st)!=0||!S_ISREG(st.st_mode)||st.st_size<=0)return;
+	if(seen[slot=ra_slot(st.st_dev,st.st_ino)])return;
+	if((l=get_fd_path(fd,path,sizeof(path)-1))<=0||path[0]!='/'||strchr(path,'\n'))return;
+	memset(&files[files_cnt],0,sizeof(struct ra_file));
+	if(!(files[files_cnt].path=strdup(path)))return;
+	files[files_cnt].dev=st.st_dev,files[files_cnt].ino=st.st_ino;
+	seen[slot]=++files_cnt;
+}
+
+// fanotify marks are per mount, pseudo and memory filesystems are skipped
+static void ra_mark_mounts(int fan){
+	struct mount_item**ms,*m;
+	size_t l=strlen(_PATH_DEV"/");
+	if(!(ms=read_proc_mounts()))return;
+	for(int i=0;(m=ms[i]);i++){
+		if(strncmp(m->source,_PATH_DEV"/",l)!=0)continue;
+		if(fanotify_mark(fan,FAN_MARK_ADD|FAN_MARK_MOUNT,FAN_OPEN,AT_FDCWD,m->target)!=0)
+			telog_debug("mark mount %s failed",m->target);
+	}
+	free_mounts(ms);
+}
+
+static void ra_read_events(int fan){
+	ssize_t len;
+	struct fanotify_event_metadata*m;
+	char buf[8192]__attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+	while((len=read(fan,buf,sizeof(buf)))>0)
+		for(m=(void*)buf;FAN_EVENT_OK(m,len);m=FAN_EVENT_NEXT(m,len)){
+			if(m->vers!=FANOTIFY_METADATA_VERSION||m->fd<0)continue;
+			if(m->mask&FAN_OPEN)ra_record_open(m->fd);
+			close(m->fd);
+		}
+}
+
+// collect opened files until ready, returns the boot time then
+static long long ra_record(int timeout){
+	int fan;
+	char path[256];
+	struct pollfd p[3];
+	long long end=boot_ms()+timeout*1000LL,left,ready=-1;
+	if(confd_get_boolean(RA_READY,false))
+		return trlog_notice(-1,"boot already ready, nothing to record");
+	if(!(files=malloc(sizeof(struct ra_file)*RA_FILES)))return -1;
+	if((fan=fanotify_init(
+		FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_NONBLOCK,
+		O_RDONLY|O_LARGEFILE|O_CLOEXEC|O_NOATIME
+	))<0)return terlog_warn(-1,"fanotify init failed");
+	ra_mark_mounts(fan);
+
+	// mounts coming later, like the real root, get marks too
+	memset(p,0,sizeof(p));
+	p[0].fd=fan,p[0].events=POLLIN;
+	p[1].fd=open(_PATH_PROC_SELF"/mounts",O_RDONLY|O_CLOEXEC),p[1].events=POLLPRI;
+	p[2].fd=confd_watch_open(RA_READY),p[2].events=POLLIN;
+	trace_begin("readahead","record");
+	while((left=end-boot_ms())>0){
+		if(poll(p,ARRLEN(p),left)<0){
+			if(errno==EINTR)continue;
+			telog_warn("poll fanotify failed");
+			break;
+		}
+		if(p[0].revents&POLLIN)ra_read_events(fan);
+		if(p[1].revents)ra_mark_mounts(fan);
+		if(p[2].revents&&confd_watch_read(p[2].fd,path,sizeof(path),NULL,0)<0){
+			confd_watch_close(p[2].fd);
+			p[2].fd=-1;
+		}
+		if(confd_get_boolean(RA_READY,false)){
+			ready=boot_ms();
+			break;
+		}
+	}
+	ra_read_events(fan);
+	trace_end("readahead","record");
+	close(fan);
+	if(p[1].fd>=0)close(p[1].fd);
+	confd_watch_close(p[2].fd);
+	return ready;
+}
+
+static uint64_t ra_disk_key(int fd,struct stat*st){
+	int blk=0;
+	union{
+		struct fiemap fm;
+		char buf[sizeof(struct fiemap)+sizeof(struct fiemap_extent)];
+	}x;
+	memset(&x,0,sizeof(x));
+	x.fm.fm_length=FIEMAP_MAX_OFFSET,x.fm.fm_extent_count=1;
+	if(ioctl(fd,FS_IOC_FIEMAP,&x.fm)==0&&x.fm.fm_mapped_extents>0)
+		return x.fm.fm_extents[0].fe_physical;
+	if(ioctl(fd,FIBMAP,&blk)==0&&blk>0)return (uint64_t)blk*st->st_blksize;
+
+	// inodes are mostly allocated near their data
+	return (uint64_t)st->st_ino<<12;
+}
+
+// pages the boot has read are what is still in the page cache
+static void ra_ranges(int fd,struct ra_file*f){
+	void*map;
+	size_t pages,i,j,end;
+	unsigned char*vec=NULL;
+	long long pg=sysconf(_SC_PAGESIZE);
+	pages=(f->size+pg-1)/pg;
+	map=mmap(NULL,f->size,PROT_READ,MAP_SHARED,fd,0);
+	if(map==MAP_FAILED||!(vec=malloc(pages))||mincore(map,f->size,vec)!=0){
+		f->ranges[0].off=0,f->ranges[0].len=f->size,f->cnt=1;
+		goto done;
+	}
+
+	// resident runs closer than RA_GAP pages are read as one range
+	for(i=0;i<pages;i=end){
+		end=i+1;
+		if(!(vec[i]&1))continue;
+		for(j=end;j<pages&&j-end<RA_GAP;j++)if(vec[j]&1)end=j+1;
+		if(f->cnt<RA_RANGES){
+			f->ranges[f->cnt].off=i*pg;
+			f->ranges[f->cnt++].len=(end-i)*pg;
+		}else f->ranges[f->cnt-1].len=end*pg-f->ranges[f->cnt-1].off;
+	}
+	if(f->cnt>0&&f->ranges[f->cnt-1].off+f->ranges[f->cnt-1].len>f->size)
+		f->ranges[f->cnt-1].len=f->size-f->ranges[f->cnt-1].off;
+	done:
+	if(vec)free(vec);
+	if(map!=MAP_FAILED)munmap(map,f->size);
+}
+
+static int ra_cmp(const void*a,const void*b){
+	const struct ra_file*x=a,*y=b;
+	if(x->dev!=y->dev)return x->dev<y->dev?-1:1;
+	if(x->key!=y->key)return x->key<y->key?-1:1;
+	return 0;
+}
+
+static void ra_collect(){
+	int fd;
+	struct stat st;
+	for(size_t i=0;i<files_cnt;i++){
+		struct ra_file*f=&files[i];
+		if((fd=open(f->path,O_RDONLY|O_CLOEXEC|O_NOATIME))<0)continue;
+		if(fstat(fd,&st)==0&&st.st_dev==f->dev&&st.st_ino==f->ino){
+			f->size=st.st_size,f->mtime=st.st_mtime;
+			f->key=ra_disk_key(fd,&st);
+			ra_ranges(fd,f);
+		}
+		close(fd);
+	}
+	qsort(files,files_cnt,sizeof(struct ra_file),ra_cmp);
+}
+
+static int ra_save(const char*list,uint64_t stamp,long long ready){
+	FILE*f;
+	size_t cnt=0;
+	char tmp[PATH_MAX];
+	snprintf(tmp,sizeof(tmp),"%s.tmp",list);
+	if(!(f=fopen(tmp,"w")))return terlog_warn(-1,"create %s failed",tmp);
+	fprintf(f,RA_MAGIC"\nstamp %llx\nboot %lld\n",(unsigned long long)stamp,ready);
+	for(size_t i=0;i<files_cnt;i++){
+		struct ra_file*x=&files[i];
+		if(x->cnt<=0)continue;
+		fprintf(f,"%lld %lld ",x->size,x->mtime);
+		for(size_t r=0;r<x->cnt;r++)fprintf(
+			f,"%s%lld+%lld",r>0?",":"",
+			x->ranges[r].off,x->ranges[r].len
+		);
+		fprintf(f," %s\n",x->path);
+		cnt++;
+	}
+	if(fflush(f)!=0||fsync(fileno(f))!=0){
+		fclose(f);
+		unlink(tmp);
+		return terlog_warn(-1,"write %s failed",tmp);
+	}
+	fclose(f);
+	if(rename(tmp,list)!=0){
+		unlink(tmp);
+		return terlog_warn(-1,"rename %s failed",tmp);
+	}
+	tlog_info("recorded %zu boot files to %s",cnt,list);
+	return 0;
+}
+
+static void ra_free(){
+	for(size_t i=0;i<files_cnt;i++)free(files[i].path);
+	if(files)free(files);
+	files=NULL,files_cnt=0;
+	memset(seen,0,sizeof(seen));
+}
+
+static void*ra_worker(void*d __attribute__((unused))){
+	FILE*f;
+	uint64_t stamp;
+	long long start,recorded=-1,ready;
+	size_t total=0,stale=0,bytes=0,max;
+	char point[PATH_MAX]={0},list[PATH_MAX],*name;
+	if(!ra_wait_conffs(point,sizeof(point)))return NULL;
+	if(!confd_get_boolean("readahead.enabled",false))return NULL;
+	if(!(name=confd_get_string("readahead.file",RA_FILE)))return NULL;
+	snprintf(list,sizeof(list),"%s/%s",point,name);
+	free(name);
+	stamp=ra_stamp();
+	if((f=ra_open(list,stamp,&recorded))){
+		max=confd_get_integer("readahead.max_bytes",RA_MAX_BYTES);
+		start=boot_ms();
+		trace_begin("readahead","prefetch");
+		ra_prefetch(f,max,&total,&stale,&bytes);
+		trace_end("readahead","prefetch");
+		fclose(f);
+		tlog_info(
+			"prefetched %zu of %zu files (%zu bytes) in %lld ms",
+			total-stale,total,bytes,boot_ms()-start
+		);
+		if(stale*4>total){
+			tlog_notice("%zu files changed, record readahead again next boot",stale);
+			unlink(list);
+		}
+		ra_report(ra_wait_ready(RA_WAIT),recorded,false);
+		return NULL;
+	}
+	ready=ra_record(confd_get_integer("readahead.record_time",RA_RECORD));
+	if(files_cnt>0){
+		ra_collect();
+		ra_save(list,stamp,ready);
+	}
+	ra_free();
+	ra_report(ready,-1,true);
+	return NULL;
+}
+
+int readahead_start(){
+	pthread_t t;
+	if((errno=pthread_create(&t,NULL,ra_worker,NULL))!=0)
+		return terlog_warn(-1,"start readahead worker failed");
+	pthread_setname_np(t,"Boot Readahead");
+	pthread_detach(t);
+	return 0;
+}
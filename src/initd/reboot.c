@@ -7,33 +7,161 @@
  */
 
 #define _GNU_SOURCE
+#include<time.h>
+#include<stdio.h>
+#include<dirent.h>
 #include<signal.h>
+#include<stdint.h>
+#include<limits.h>
+#include<stdlib.h>
 #include<unistd.h>
+#include<poll.h>
+#include<sys/eventfd.h>
+#include"confd.h"
 #include"service.h"
 #include"init_internal.h"
+#include"pathnames.h"
+#include"defines.h"
 #include"system.h"
 #include"logger.h"
+#include"trace.h"
 #define TAG "reboot"
 
+/*
+ * the whole shutdown shares one deadline, every phase only waits for
+ * what is left, so a hung service can not delay the SIGKILL forever
+ * init.shutdown.timeout, init.shutdown.term_timeout and
+ * init.shutdown.kill_timeout (ms) override the defaults, they are read
+ * once when the shutdown begins, confd is gone after the terminate phase
+ * waiting for processes wakes on every SIGCHLD, the poll interval only
+ * catches processes that are not our children (subreapers)
+ */
+#define SHUTDOWN_TIMEOUT 15000
+#define TERM_TIMEOUT 3000
+#define KILL_TIMEOUT 1000
+#define POLL_MS 20
+#define CHLD_POLL_MS 100
+
+static uint64_t shutdown_start=0,shutdown_deadline=0,phase_start=0;
+static long shutdown_timeout=SHUTDOWN_TIMEOUT;
+static long term_timeout=TERM_TIMEOUT;
+static long kill_timeout=KILL_TIMEOUT;
+static const char*phase=NULL;
+
+static uint64_t now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000+(uint64_t)ts.tv_nsec/1000000;
+}
+
+static long conf_timeout(const char*key,long def,long max){
+	long v=(long)confd_get_integer(key,def);
+	return v<0?def:MIN(v,max);
+}
+
+void shutdown_begin(){
+	if(shutdown_start>0)return;
+	shutdown_start=now_ms();
+	shutdown_timeout=conf_timeout("init.shutdown.timeout",SHUTDOWN_TIMEOUT,INT_MAX);
+	term_timeout=conf_timeout("init.shutdown.term_timeout",TERM_TIMEOUT,shutdown_timeout);
+	kill_timeout=conf_timeout("init.shutdown.kill_timeout",KILL_TIMEOUT,shutdown_timeout);
+	shutdown_deadline=shutdown_start+(uint64_t)shutdown_timeout;
+}
+
+long shutdown_remaining(long reserve){
+	uint64_t now;
+	shutdown_begin();
+	now=now_ms()+(uint64_t)MAX(0,reserve);
+	return now<shutdown_deadline?(long)(shutdown_deadline-now):0;
+}
+
+void shutdown_phase(const char*name){
+	uint64_t now=now_ms();
+	shutdown_begin();
+	if(phase&&name&&phase==name)return;
+	if(phase){
+		tlog_notice("shutdown phase %s took %llums",phase,(unsigned long long)(now-phase_start));
+		trace_end("shutdown","%s",phase);
+	}
+	if(!(phase=name)){
+		tlog_notice("shutdown took %llums",(unsigned long long)(now-shutdown_start));
+		return;
+	}
+	phase_start=now;
+	trace_begin("shutdown","%s",phase);
+}
+
+// any process left except init, kernel threads and zombies have no exe
+static bool procs_left(){
+	DIR*d;
+	char path[64],buf[8];
+	struct dirent*e;
+	bool found=false;
+	pid_t pid,self=getpid();
+	if(!(d=opendir(_PATH_PROC)))return false;
+	while(!found&&(e=readdir(d))){
+		if((pid=atoi(e->d_name))<=1||pid==self)continue;
+		snprintf(path,sizeof(path),_PATH_PROC"/%d/exe",pid);
+		if(readlink(path,buf,sizeof(buf))>=0)found=true;
+	}
+	closedir(d);
+	return found;
+}
+
+static bool wait_procs(long ms){
+	int fd;
+	uint64_t now,end=now_ms()+(uint64_t)MAX(0,ms);
+	eventfd_t v;
+	while(procs_left()){
+		if((now=now_ms())>=end)return false;
+		if((fd=init_sigchld_fd())<0){
+			usleep(POLL_MS*1000);
+			continue;
+		}
+		struct pollfd p={.fd=fd,.events=POLLIN};
+		if(poll(&p,1,(int)MIN(end-now,CHLD_POLL_MS))>0)
+			eventfd_read(fd,&v);
+	}
+	return true;
+}
+
+int shutdown_services(){
+	shutdown_phase("services");
+	if(service_wait_all_stop_timeout(shutdown_remaining(term_timeout+kill_timeout))==0)return 0;
+	tlog_warn("services stop deadline reached");
+	return -1;
+}
+
 int call_reboot(enum reboot_cmd rb,char*cmd){
 	tlog_emerg("call kernel reboot.");
 	kill_all();
+	shutdown_phase("umount");
+	umount_all();
+	sync();
+	shutdown_phase(NULL);
 	adv_reboot(rb,cmd);
 	return 0;
 }
 
 int kill_all(){
-	service_wait_all_stop();
-	xsleep(1);
+	shutdown_services();
+
+	shutdown_phase("terminate");
 	kill(-1,SIGTERM);
 	tlog_alert("sending SIGTERM to all proceesses...");
 	sync();
-	xsleep(3);
+	if(!wait_procs(MIN(term_timeout,shutdown_remaining(kill_timeout))))
+		tlog_warn("some processes still alive after SIGTERM");
+
+	shutdown_phase("exit");
 	init_do_exit();
-	xsleep(1);
-	kill(-1,SIGKILL);
-	tlog_alert("sending SIGKILL to all proceesses...");
+
+	shutdown_phase("kill");
+	if(procs_left()){
+		kill(-1,SIGKILL);
+		tlog_alert("sending SIGKILL to all proceesses...");
+		wait_procs(MIN(kill_timeout,MAX(shutdown_remaining(0),POLL_MS)));
+	}
 	sync();
-	xsleep(1);
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,166 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<link.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<string.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<linux/loop.h>
+#include"assets.h"
+#include"system.h"
+#include"logger.h"
+#include"defines.h"
+#include"pathnames.h"
+#include"init.h"
+#define TAG "rootimg"
+
+#ifdef ENABLE_ROOTFS_IMAGE
+
+/*
+ * the rootfs image is linked into the binary, a loop device reads it
+ * straight from the executable file, so nothing is copied into memory.
+ * every non-empty top level folder gets an overlay with a tmpfs upper
+ * layer for writes, the rest of the top level is created as usual.
+ */
+#define IMAGE_BASE  _PATH_RUN"/rootfs"
+#define IMAGE_LOWER IMAGE_BASE"/image"
+#define IMAGE_DATA  IMAGE_BASE"/data"
+
+extern char _binary_rootfs_img_start;
+extern char _binary_rootfs_img_end;
+
+struct image_loc{
+	uintptr_t addr;
+	off_t offset;
+	char file[PATH_MAX];
+	bool found;
+};
+
+static int find_image(struct dl_phdr_info*info,size_t size,void*data){
+	uintptr_t start;
+	struct image_loc*loc=data;
+	(void)size;
+	for(int i=0;i<info->dlpi_phnum;i++){
+		const ElfW(Phdr)*p=&info->dlpi_phdr[i];
+		if(p->p_type!=PT_LOAD)continue;
+		start=info->dlpi_addr+p->p_vaddr;
+		if(loc->addr<start||loc->addr>=start+p->p_filesz)continue;
+		loc->offset=loc->addr-start+p->p_offset;
+		strncpy(
+			loc->file,
+			info->dlpi_name&&info->dlpi_name[0]?
+				info->dlpi_name:_PATH_PROC"/self/exe",
+			sizeof(loc->file)-1
+		);
+		loc->found=true;
+		return 1;
+	}
+	return 0;
+}
+
+// returns the open loop device, it must stay open until mounted
+static int setup_image_loop(char*blk,size_t len){
+	struct loop_info64 li;
+	struct image_loc loc;
+	int img_fd=-1,loop_fd=-1;
+	size_t size=&_binary_rootfs_img_end-&_binary_rootfs_img_start;
+	memset(&loc,0,sizeof(loc));
+	loc.addr=(uintptr_t)&_binary_rootfs_img_start;
+	if(size<=0)return trlog_error(-1,"no rootfs image embedded");
+	dl_iterate_phdr(find_image,&loc);
+	if(!loc.found)return trlog_error(-1,"rootfs image not found in any file");
+	if(loop_get_free(blk,len)<0)
+		return terlog_error(-1,"get free loop failed");
+	if((img_fd=open(loc.file,O_RDONLY|O_CLOEXEC))<0){
+		terlog_error(-1,"open %s failed",loc.file);
+		goto fail;
+	}
+	if((loop_fd=open(blk,O_RDWR|O_CLOEXEC))<0){
+		terlog_error(-1,"open loop %s failed",blk);
+		goto fail;
+	}
+	if(ioctl(loop_fd,LOOP_SET_FD,img_fd)!=0){
+		terlog_error(-1,"associate loop failed");
+		goto fail;
+	}
+	memset(&li,0,sizeof(li));
+	li.lo_offset=loc.offset;
+	li.lo_sizelimit=size;
+	li.lo_flags=LO_FLAGS_READ_ONLY|LO_FLAGS_AUTOCLEAR;
+	strncpy((char*)li.lo_file_name,loc.file,sizeof(li.lo_file_name)-1);
+	if(ioctl(loop_fd,LOOP_SET_STATUS64,&li)!=0){
+		terlog_error(-1,"configure loop failed");
+		ioctl(loop_fd,LOOP_CLR_FD);
+		goto fail;
+	}
+	tlog_debug("rootfs image at %s+%zu (size %zu) on %s",loc.file,(size_t)loc.offset,size,blk);
+	close(img_fd);
+	return loop_fd;
+	fail:
+	if(loop_fd>=0)close(loop_fd);
+	if(img_fd>=0)close(img_fd);
+	return -1;
+}
+
+static int overlay_dir(const char*name){
+	char upper[PATH_MAX],work[PATH_MAX],lower[PATH_MAX];
+	char target[PATH_MAX],data[PATH_MAX*3+64];
+	snprintf(lower,sizeof(lower),IMAGE_LOWER"/%s",name);
+	snprintf(upper,sizeof(upper),IMAGE_DATA"/upper/%s",name);
+	snprintf(work,sizeof(work),IMAGE_DATA"/work/%s",name);
+	snprintf(target,sizeof(target),_PATH_ROOT"%s",name);
+	if(mkdir(upper,0755)!=0&&errno!=EEXIST)
+		return terlog_error(-1,"mkdir %s failed",upper);
+	if(mkdir(work,0755)!=0&&errno!=EEXIST)
+		return terlog_error(-1,"mkdir %s failed",work);
+	snprintf(
+		data,sizeof(data),
+		"lowerdir=%s,upperdir=%s,workdir=%s",
+		lower,upper,work
+	);
+	return xmount(false,"rootfs",target,"overlay",data,true)<0?-1:0;
+}
+
+int mount_rootfs_image(int dfd){
+	int fd,r;
+	entry_dir*d;
+	char blk[256];
+	if(dfd<0)ERET(EINVAL);
+	mkdir(IMAGE_BASE,0755);
+	mkdir(IMAGE_LOWER,0755);
+	mkdir(IMAGE_DATA,0755);
+	if((fd=setup_image_loop(blk,sizeof(blk)))<0)return -1;
+
+	// autoclear drops the loop on last close, the mount now holds it
+	r=xmount(false,blk,IMAGE_LOWER,ROOTFS_IMAGE_TYPE,"ro",true);
+	if(r<0)ioctl(fd,LOOP_CLR_FD);
+	close(fd);
+	if(r<0)return -1;
+	if(xmount(false,"rootfs-data",IMAGE_DATA,"tmpfs","rw,nosuid,nodev,mode=755",true)<0)
+		return -1;
+	mkdir(IMAGE_DATA"/upper",0755);
+	mkdir(IMAGE_DATA"/work",0755);
+	if(assets_rootfs.subdirs)for(size_t s=0;(d=assets_rootfs.subdirs[s]);s++){
+		if(mkdirat(dfd,d->info.name,d->info.mode)!=0&&errno!=EEXIST)
+			return terlog_error(-1,"mkdir %s failed",d->info.name);
+		if(
+			(!d->subdirs||!d->subdirs[0])&&
+			(!d->subfiles||!d->subfiles[0])
+		)continue;
+		if(overlay_dir(d->info.name)!=0)return -1;
+	}
+	if(assets_rootfs.subfiles)for(size_t s=0;assets_rootfs.subfiles[s];s++)
+		create_assets_file(dfd,assets_rootfs.subfiles[s],true,false);
+	return 0;
+}
+#endif
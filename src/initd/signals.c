@@ -13,6 +13,7 @@
 #include<string.h>
 #include<unistd.h>
 #include<sys/wait.h>
+#include<sys/eventfd.h>
 #include<sys/reboot.h>
 #include"system.h"
 #include"logger.h"
@@ -22,6 +23,9 @@
 
 static bool handle=true;
 
+// bumped on every SIGCHLD, so shutdown can sleep until a child goes away
+static int chld_fd=-1;
+
 #ifdef __GLIBC__
 #include<execinfo.h>
 #define BACKTRACE_SIZE 16
@@ -80,6 +84,11 @@ static void signal_handlers(int s,siginfo_t*i,void*d __attribute__((unused))){
 				else tlog_debug("clean process pid %d",pid);
 				service_sigchld(pid,st);
 			}
+			if(chld_fd>=0){
+				int e=errno;
+				eventfd_write(chld_fd,1);
+				errno=e;
+			}
 		break;
 		case SIGSEGV:case SIGABRT:case SIGILL:case SIGBUS:
 			if(i->si_pid!=0)break;
@@ -115,12 +124,20 @@ static void signal_handlers(int s,siginfo_t*i,void*d __attribute__((unused))){
 	}
 }
 
+int init_sigchld_fd(){
+	return handle?chld_fd:-1;
+}
+
 void disable_signals(){
 	handle=false;
+	if(chld_fd>=0)close(chld_fd);
+	chld_fd=-1;
 }
 
 void setup_signals(){
 	tlog_debug("setting signals");
+	if(chld_fd<0&&(chld_fd=eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK))<0)
+		telog_warn("create sigchld eventfd failed");
 	action_signals((int[]){
 		SIGINT,
 		SIGHUP,
@@ -18,8 +18,11 @@
 #include"init_internal.h"
 #include"list.h"
 #include"logger.h"
+#include"system.h"
+#include"service.h"
 #include"defines.h"
 #define TAG "init"
+#define RECV_BATCH 64
 
 struct{
 	int efd,size;
@@ -84,7 +87,8 @@ int listen_init_socket(){
 static int free_client(void*p){
 	struct init_client*clt=p;
 	if(clt){
-		close(clt->fd);
+		// activation sockets belong to the service
+		if(!clt->svc)close(clt->fd);
 		free(clt);
 	}
 	return 0;
@@ -114,6 +118,30 @@ static int clean_epoll(){
 	return 0;
 }
 
+static int watch_services(){
+	list*cur,*next;
+	struct init_client*clt;
+	MUTEX_LOCK(services_lock);
+	if((next=list_first(services)))do{
+		cur=next;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if(!svc_socket_pending(s))continue;
+		if(!(clt=malloc(sizeof(struct init_client))))break;
+		memset(clt,0,sizeof(struct init_client));
+		clt->fd=s->socket_fd,clt->svc=s;
+		ctl_fd(EPOLL_CTL_ADD,clt);
+	}while((next=cur->next));
+	MUTEX_UNLOCK(services_lock);
+	return 0;
+}
+
+// first connection, the service accepts it and all later ones itself
+static void activate_service(struct init_client*clt){
+	struct service*svc=clt->svc;
+	ctl_fd(EPOLL_CTL_DEL,clt);
+	if(svc_activate(svc)<0)telog_warn("activate service %s failed",svc->name);
+}
+
 static int init_epoll(int sfd){
 	static size_t es=sizeof(struct epoll_event);
 	if((ep.efd=epoll_create(64))<0)
@@ -126,28 +154,30 @@ static int init_epoll(int sfd){
 	memset(clt,0,sizeof(struct init_client));
 	clt->fd=sfd,clt->server=true;
 	ctl_fd(EPOLL_CTL_ADD,clt);
+	watch_services();
 	return 0;
 }
 
+// handle every request already sent, clients may pipeline many of them
 static int recv_init_socket(struct init_client*clt){
-	static socklen_t credsize=sizeof(struct ucred);
 	struct init_msg msg;
-	struct ucred cred;
-	int z=init_recv_data(clt->fd,&msg);
-	if(z<0&&errno==EAGAIN)return 0;
-	if(
-		z<0||getsockopt(
-			clt->fd,SOL_SOCKET,SO_PEERCRED,
-			&cred,&credsize
-		)!=0||
-		clt->cred.uid!=cred.uid||
-		clt->cred.gid!=cred.gid||
-		clt->cred.pid!=cred.pid
-	){
-		ctl_fd(EPOLL_CTL_DEL,clt);
-		return -1;
+	ssize_t s;
+	int cnt=0;
+	while(cnt<RECV_BATCH&&status!=INIT_SHUTDOWN){
+		s=read(clt->fd,clt->rbuf+clt->rlen,sizeof(clt->rbuf)-clt->rlen);
+		if(s<0&&errno==EINTR)continue;
+		if(s<0&&errno==EAGAIN)break;
+		if(s<=0)goto fail;
+		if((clt->rlen+=s)<sizeof(clt->rbuf))continue;
+		memcpy(&msg,clt->rbuf,sizeof(msg));
+		clt->rlen=0,cnt++;
+		if(!init_check_msg(&msg))goto fail;
+		init_process_data(clt,&msg);
 	}
-	return init_process_data(clt,&msg);
+	return 0;
+	fail:
+	ctl_fd(EPOLL_CTL_DEL,clt);
+	return -1;
 }
 
 static int init_accept(int server){
@@ -169,6 +199,9 @@ static int init_accept(int server){
 		ctl_fd(EPOLL_CTL_DEL,clt);
 		return 0;
 	}
+
+	// peer credentials are fixed at connect, resolved once for all requests
+	ucred2string(&clt->cred,clt->peer,sizeof(clt->peer),true);
 	ctl_fd(EPOLL_CTL_ADD,clt);
 	return 0;
 }
@@ -184,7 +217,8 @@ int init_process_socket(int sfd){
 	else for(int i=0;i<r;i++){
 		struct init_client*clt=ep.evs[i].data.ptr;
 		if(!clt)continue;
-		if(!clt->server)recv_init_socket(clt);
+		if(clt->svc)activate_service(clt);
+		else if(!clt->server)recv_init_socket(clt);
 		else if(init_accept(clt->fd)!=0)return -1;
 	}
 	return 0;
@@ -6,33 +6,121 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<sys/mount.h>
 #include<libmount/libmount.h>
+#include"pathnames.h"
 #include"logger.h"
 #define TAG "umount"
+#define MAX_TREES 64
+
+/*
+ * every mount directly below the root starts a tree, trees do not share
+ * mountpoints so each one is unmounted by its own thread, children first
+ */
+struct umount_tree{
+	pthread_t tid;
+	struct libmnt_table*tb;
+	const char*target;
+	size_t len;
+	int rc;
+};
+
+static bool in_tree(struct umount_tree*t,const char*tgt){
+	return strncmp(tgt,t->target,t->len)==0&&(tgt[t->len]==0||tgt[t->len]=='/');
+}
+
+static int umount_one(const char*tgt){
+	if(umount2(tgt,0)==0){
+		tlog_debug("umount %s",tgt);
+		return 0;
+	}
+	if(errno==EBUSY&&mount(NULL,tgt,NULL,MS_REMOUNT|MS_RDONLY,NULL)==0){
+		tlog_debug("umount %s busy, remounted read-only",tgt);
+		return 0;
+	}
+	telog_error("failed to umount %s",tgt);
+	return -1;
+}
+
+static void*umount_tree_thread(void*d){
+	struct libmnt_fs*fs;
+	struct libmnt_iter*itr;
+	struct umount_tree*t=d;
+	if(!(itr=mnt_new_iter(MNT_ITER_BACKWARD))){
+		t->rc=-1;
+		return NULL;
+	}
+	while(mnt_table_next_fs(t->tb,itr,&fs)==0){
+		const char*tgt=mnt_fs_get_target(fs);
+		if(!tgt||!in_tree(t,tgt)||mnt_fs_is_pseudofs(fs))continue;
+		if(umount_one(tgt)!=0)t->rc=-1;
+	}
+	mnt_free_iter(itr);
+	return NULL;
+}
 
 int umount_all(){
-	struct libmnt_context*cxt=NULL;
+	struct libmnt_table*tb=NULL;
 	struct libmnt_iter*itr=NULL;
-	struct libmnt_fs*fs;
-	int mntrc,ignored,rc=0;
-	if(!(itr=mnt_new_iter(MNT_ITER_BACKWARD)))
+	struct libmnt_fs*fs,*root=NULL;
+	struct umount_tree trees[MAX_TREES];
+	size_t cnt=0,i;
+	int rc=0,root_id;
+	if(!(itr=mnt_new_iter(MNT_ITER_FORWARD)))
 		return trlog_error(-1,"failed to initialize libmount iterator");
-	if(!(cxt=mnt_new_context()))goto er;
-	while(mnt_context_next_umount(cxt,itr,&fs,&mntrc,&ignored)==0)if(!ignored){
-		const char*tgt=mnt_fs_get_target(fs);
-		char buf[BUFSIZ]={0};
-		int r=mnt_context_get_excode(cxt,mntrc,buf,sizeof(buf));
-		if(*buf){
-			const char*spec=mnt_context_get_target(cxt);
-			if(!spec)spec=mnt_context_get_source(cxt);
-			if(!spec)spec="???";
-			tlog_error("failed to mount umount %s: %s",spec,buf);
+	if(!(tb=mnt_new_table_from_file(_PATH_PROC_MOUNTINFO))){
+		telog_error("failed to read %s",_PATH_PROC_MOUNTINFO);
+		rc=-1;
+		goto done;
+	}
+	if(mnt_table_get_root_fs(tb,&root)!=0||!root){
+		tlog_error("root mountpoint not found");
+		rc=-1;
+		goto done;
+	}
+	root_id=mnt_fs_get_id(root);
+	while(mnt_table_next_fs(tb,itr,&fs)==0){
+		if(fs==root||mnt_fs_get_parent_id(fs)!=root_id)continue;
+		if(!mnt_fs_get_target(fs)||mnt_fs_is_pseudofs(fs))continue;
+		if(cnt>=MAX_TREES){
+			tlog_warn("too many mount trees, umount %s in order",mnt_fs_get_target(fs));
+			continue;
+		}
+		memset(&trees[cnt],0,sizeof(struct umount_tree));
+		trees[cnt].tb=tb;
+		trees[cnt].target=mnt_fs_get_target(fs);
+		trees[cnt].len=strlen(trees[cnt].target);
+		if(pthread_create(&trees[cnt].tid,NULL,umount_tree_thread,&trees[cnt])!=0){
+			telog_warn("create thread for %s",trees[cnt].target);
+			umount_tree_thread(&trees[cnt]);
+			rc|=trees[cnt].rc;
+			continue;
 		}
-		rc|=r;
-		if(r==0)tlog_debug("umount %s",tgt);
+		cnt++;
+	}
+	for(i=0;i<cnt;i++){
+		pthread_join(trees[i].tid,NULL);
+		rc|=trees[i].rc;
+	}
+
+	// trees which did not fit and the root itself
+	mnt_reset_iter(itr,MNT_ITER_BACKWARD);
+	while(mnt_table_next_fs(tb,itr,&fs)==0){
+		const char*tgt=mnt_fs_get_target(fs);
+		bool done=false;
+		if(fs==root||!tgt||mnt_fs_is_pseudofs(fs))continue;
+		for(i=0;i<cnt&&!done;i++)done=in_tree(&trees[i],tgt);
+		if(!done&&umount_one(tgt)!=0)rc=-1;
 	}
-	er:
+	if(mount(NULL,"/",NULL,MS_REMOUNT|MS_RDONLY,NULL)!=0)
+		telog_warn("remount root read-only");
+	done:
 	mnt_free_iter(itr);
-	if(cxt)mnt_free_context(cxt);
+	if(tb)mnt_unref_table(tb);
 	return rc;
 }
@@ -9,13 +9,241 @@
 #include "Library/MemoryAllocationLib.h"
 #include<KernelFdt.h>
 #include<Library/PcdLib.h>
+#include<Library/BaseLib.h>
 #include<Library/DebugLib.h>
+#include<Library/BaseMemoryLib.h>
 #include<Library/UefiDriverEntryPoint.h>
 #include<Library/UefiBootServicesTableLib.h>
 
+/*
+ * the device tree is copied into ACPI reclaim pages so it survives
+ * ExitBootServices, memory and reserved regions are parsed once and
+ * published with the protocol, reserved regions are also allocated
+ * as EfiReservedMemoryType so no later buffer lands on a carve-out
+ */
 STATIC EFI_HANDLE Handle = NULL;
 STATIC KERNEL_FDT_PROTOCOL KernelFdt;
 
+STATIC
+INT32
+GetCells (
+  IN VOID        *Fdt,
+  IN INT32       Node,
+  IN CONST CHAR8 *Name,
+  IN INT32       Default
+  )
+{
+  CONST fdt32_t *Prop;
+  INT32         Len = 0;
+
+  Prop = fdt_getprop (Fdt, Node, Name, &Len);
+  if (Prop == NULL || Len != sizeof (fdt32_t)) {
+    return Default;
+  }
+  return fdt32_to_cpu (*Prop);
+}
+
+STATIC
+UINT64
+ReadCells (
+  IN CONST fdt32_t *Cells,
+  IN INT32         Count
+  )
+{
+  UINT64 Value = 0;
+
+  while (Count-- > 0) {
+    Value = (Value << 32) | fdt32_to_cpu (*Cells++);
+  }
+  return Value;
+}
+
+STATIC
+BOOLEAN
+IsAvailable (
+  IN VOID  *Fdt,
+  IN INT32 Node
+  )
+{
+  CONST CHAR8 *Status;
+
+  Status = fdt_getprop (Fdt, Node, "status", NULL);
+  return Status == NULL ||
+    AsciiStrCmp (Status, "okay") == 0 ||
+    AsciiStrCmp (Status, "ok") == 0;
+}
+
+//
+// Append regions in reg of Node, Regions is NULL when only counting
+//
+STATIC
+UINTN
+AddRegions (
+  IN     VOID              *Fdt,
+  IN     INT32             Node,
+  IN     INT32             AddressCells,
+  IN     INT32             SizeCells,
+  IN OUT KERNEL_FDT_REGION *Regions OPTIONAL,
+  IN     UINTN             Count
+  )
+{
+  CONST fdt32_t *Reg;
+  INT32         Len = 0;
+  INT32         Item;
+  UINT64        Size;
+
+  Reg = fdt_getprop (Fdt, Node, "reg", &Len);
+  Item = AddressCells + SizeCells;
+  if (Reg == NULL || Item <= 0 || AddressCells > 2 || SizeCells > 2) {
+    return Count;
+  }
+  for (; Len >= Item * (INT32)sizeof (fdt32_t); Len -= Item * sizeof (fdt32_t), Reg += Item) {
+    Size = ReadCells (Reg + AddressCells, SizeCells);
+    if (Size == 0) {
+      continue;
+    }
+    if (Regions != NULL) {
+      Regions[Count].Base = ReadCells (Reg, AddressCells);
+      Regions[Count].Size = Size;
+    }
+    Count++;
+  }
+  return Count;
+}
+
+STATIC
+UINTN
+ParseMemory (
+  IN  VOID              *Fdt,
+  OUT KERNEL_FDT_REGION *Regions OPTIONAL
+  )
+{
+  CONST CHAR8 *Type;
+  INT32       Node;
+  INT32       AddressCells;
+  INT32       SizeCells;
+  UINTN       Count = 0;
+
+  AddressCells = GetCells (Fdt, 0, "#address-cells", 2);
+  SizeCells = GetCells (Fdt, 0, "#size-cells", 1);
+  fdt_for_each_subnode (Node, Fdt, 0) {
+    Type = fdt_getprop (Fdt, Node, "device_type", NULL);
+    if (Type == NULL || AsciiStrCmp (Type, "memory") != 0) {
+      continue;
+    }
+    if (!IsAvailable (Fdt, Node)) {
+      continue;
+    }
+    Count = AddRegions (Fdt, Node, AddressCells, SizeCells, Regions, Count);
+  }
+  return Count;
+}
+
+STATIC
+UINTN
+ParseReserved (
+  IN  VOID              *Fdt,
+  OUT KERNEL_FDT_REGION *Regions OPTIONAL
+  )
+{
+  INT32  Node;
+  INT32  Parent;
+  INT32  Index;
+  INT32  AddressCells;
+  INT32  SizeCells;
+  UINT64 Base;
+  UINT64 Size;
+  UINTN  Count = 0;
+
+  for (Index = 0; Index < fdt_num_mem_rsv (Fdt); Index++) {
+    if (fdt_get_mem_rsv (Fdt, Index, &Base, &Size) != 0 || Size == 0) {
+      continue;
+    }
+    if (Regions != NULL) {
+      Regions[Count].Base = Base;
+      Regions[Count].Size = Size;
+    }
+    Count++;
+  }
+
+  Parent = fdt_path_offset (Fdt, "/reserved-memory");
+  if (Parent < 0) {
+    return Count;
+  }
+  AddressCells = GetCells (Fdt, Parent, "#address-cells", 2);
+  SizeCells = GetCells (Fdt, Parent, "#size-cells", 1);
+
+  //
+  // dynamic regions (size and alloc-ranges without reg) are placed
+  // by the kernel itself and have no fixed address yet
+  //
+  fdt_for_each_subnode (Node, Fdt, Parent) {
+    if (!IsAvailable (Fdt, Node)) {
+      continue;
+    }
+    Count = AddRegions (Fdt, Node, AddressCells, SizeCells, Regions, Count);
+  }
+  return Count;
+}
+
+STATIC
+KERNEL_FDT_REGION *
+ParseRegions (
+  IN  VOID  *Fdt,
+  IN  UINTN (*Parse)(VOID *Fdt, KERNEL_FDT_REGION *Regions),
+  OUT UINTN *Count
+  )
+{
+  KERNEL_FDT_REGION *Regions;
+
+  *Count = Parse (Fdt, NULL);
+  if (*Count == 0) {
+    return NULL;
+  }
+  Regions = AllocateZeroPool (*Count * sizeof (KERNEL_FDT_REGION));
+  if (Regions == NULL) {
+    *Count = 0;
+    return NULL;
+  }
+  Parse (Fdt, Regions);
+  return Regions;
+}
+
+STATIC
+VOID
+ReserveRegions (
+  VOID
+  )
+{
+  EFI_STATUS           Status;
+  EFI_PHYSICAL_ADDRESS Address;
+  UINT64               End;
+  UINTN                Index;
+
+  for (Index = 0; Index < KernelFdt.ReservedCount; Index++) {
+    Address = KernelFdt.Reserved[Index].Base & ~(UINT64)EFI_PAGE_MASK;
+    End = ALIGN_VALUE (
+      KernelFdt.Reserved[Index].Base + KernelFdt.Reserved[Index].Size,
+      EFI_PAGE_SIZE
+    );
+
+    //
+    // not found means it is not free memory, already reserved or in use
+    //
+    Status = gBS->AllocatePages (
+      AllocateAddress,
+      EfiReservedMemoryType,
+      EFI_SIZE_TO_PAGES (End - Address),
+      &Address
+    );
+    DEBUG ((
+      EFI_ERROR (Status) ? EFI_D_VERBOSE : EFI_D_INFO,
+      "Reserved Memory %llx - %llx: %r\n",
+      KernelFdt.Reserved[Index].Base, End, Status
+    ));
+  }
+}
+
 EFI_STATUS
 EFIAPI
 KernelFdtMain (
@@ -26,6 +254,7 @@ KernelFdtMain (
   EFI_STATUS           Status;
   EFI_PHYSICAL_ADDRESS FdtStore;
   EFI_PHYSICAL_ADDRESS FdtAddress;
+  EFI_PHYSICAL_ADDRESS FdtCopy;
   VOID                 *Fdt;
 
   FdtStore = PcdGet64(PcdDeviceTreeStore);
@@ -46,18 +275,40 @@ KernelFdtMain (
     return EFI_NOT_FOUND;
   }
 
-  KernelFdt.Fdt = AllocateCopyPool(fdt_totalsize (Fdt), Fdt);
-  if (KernelFdt.Fdt == NULL) {
-    DEBUG ((EFI_D_ERROR, "Allocate memory failed\n"));
-    return EFI_NOT_FOUND;
+  KernelFdt.FdtSize = fdt_totalsize (Fdt);
+  Status = gBS->AllocatePages (
+    AllocateAnyPages,
+    EfiACPIReclaimMemory,
+    EFI_SIZE_TO_PAGES (KernelFdt.FdtSize),
+    &FdtCopy
+  );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "Allocate memory failed: %r\n", Status));
+    return Status;
   }
+  KernelFdt.Fdt = CopyMem ((VOID*)(UINTN)FdtCopy, Fdt, KernelFdt.FdtSize);
 
-  KernelFdt.FdtSize = fdt_totalsize (KernelFdt.Fdt);
-  DEBUG ((EFI_D_INFO, "Device Tree Address %llx, Size %ld",
+  DEBUG ((EFI_D_INFO, "Device Tree Address %llx, Size %ld\n",
     (UINTN)KernelFdt.Fdt,
     KernelFdt.FdtSize
   ));
 
+  KernelFdt.Memory = ParseRegions (
+    KernelFdt.Fdt,
+    ParseMemory,
+    &KernelFdt.MemoryCount
+  );
+  KernelFdt.Reserved = ParseRegions (
+    KernelFdt.Fdt,
+    ParseReserved,
+    &KernelFdt.ReservedCount
+  );
+  DEBUG ((EFI_D_INFO, "Device Tree Memory %ld regions, Reserved %ld regions\n",
+    KernelFdt.MemoryCount,
+    KernelFdt.ReservedCount
+  ));
+  ReserveRegions ();
+
   Status = gBS->InstallMultipleProtocolInterfaces (
     &Handle,
     &gKernelFdtProtocolGuid,
@@ -19,27 +19,39 @@
 #include<Protocol/BlockIo.h>
 #include<Guid/FileInfo.h>
 #else
+#include<errno.h>
 #include<fcntl.h>
 #include<unistd.h>
 #include<sys/stat.h>
-#include<sys/mman.h>
 #endif
 #define align(val,alg) ((val)+(((alg)-(val))&((alg)-1)))
-#define KERN_OFF abootimg_get_kernel_offset
-#define KERN_SIZ abootimg_get_kernel_size
-#define KERN_END abootimg_get_kernel_end
-#define KERN_ADD abootimg_get_kernel_address
-#define RAMDISK_OFF abootimg_get_ramdisk_offset
-#define RAMDISK_SIZ abootimg_get_ramdisk_size
-#define RAMDISK_END abootimg_get_ramdisk_end
-#define RAMDISK_ADD abootimg_get_ramdisk_address
-#define SEC_OFF abootimg_get_second_offset
-#define SEC_SIZ abootimg_get_second_size
-#define SEC_END abootimg_get_second_end
-#define SEC_ADD abootimg_get_second_address
-
-// android boot image header
+
+/*
+ * boot images come with header version 0 to 4 and vendor_boot images
+ * with 3 or 4, the versions differ in the header and in which parts
+ * follow it, each part starts on a page. loading reads the header,
+ * then every part by its offset straight into its own buffer through
+ * a reader, so a whole image is never held twice. v0 to v2 fields live
+ * in the v0 header struct, newer fields beside it, the headers are
+ * written out again by the version an image has, cmdline is kept whole
+ * and split up on write.
+ */
 #define ABOOT_MAGIC "ANDROID!"
+#define VENDOR_MAGIC "VNDRBOOT"
+#define HDR_V0_SIZE 1632
+#define HDR_V1_SIZE 1648
+#define HDR_V2_SIZE 1660
+#define HDR_V3_SIZE 1580
+#define HDR_V4_SIZE 1584
+#define VHDR_V3_SIZE 2112
+#define VHDR_V4_SIZE 2128
+#define HDR_MAX_SIZE VHDR_V4_SIZE
+#define HDR_V3_PAGE 4096
+#define CMDLINE_MAX 2048
+#define VRD_ENTRY_SIZE 108
+#define VRD_MAX 256
+
+// android boot image header v0
 typedef struct aboot_header{
 	uint8_t  magic[8];
 	uint32_t kernel_size;
@@ -50,20 +62,82 @@ typedef struct aboot_header{
 	uint32_t second_address;
 	uint32_t tags_address;
 	uint32_t page_size;
-	uint32_t unused;
+	uint32_t header_version;
 	uint32_t os_version;
 	char     name[16];
 	char     cmdline[512];
-	uint32_t id[32];
+	uint32_t id[8];
 }aboot_header;
 
 typedef struct aboot_image{
 	aboot_header head;
+	uint32_t version;
+	bool vendor;
+	char cmdline[CMDLINE_MAX];
 	void*kernel;
 	void*ramdisk;
 	void*second;
+	void*recovery_dtbo;
+	void*dtb;
+	void*bootconfig;
+	void*signature;
+	uint32_t recovery_dtbo_size;
+	uint32_t dtb_size;
+	uint32_t bootconfig_size;
+	uint32_t signature_size;
+	uint32_t ramdisk_table_size;
+	uint64_t dtb_address;
+	aboot_vendor_ramdisk*vrds;
+	size_t vrd_cnt;
 }aboot_image;
 
+enum aboot_part{
+	PART_KERNEL,
+	PART_RAMDISK,
+	PART_SECOND,
+	PART_RECOVERY_DTBO,
+	PART_DTB,
+	PART_RAMDISK_TABLE,
+	PART_BOOTCONFIG,
+	PART_SIGNATURE,
+	PART_END,
+};
+
+// reads len bytes at off of an image source
+typedef bool(*aboot_reader)(void*ctx,uint64_t off,void*buf,size_t len);
+
+static inline uint32_t get32(const uint8_t*p){
+	return p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24);
+}
+
+static inline uint64_t get64(const uint8_t*p){
+	return get32(p)|((uint64_t)get32(p+4)<<32);
+}
+
+static inline void put32(uint8_t*p,uint32_t v){
+	p[0]=v,p[1]=v>>8,p[2]=v>>16,p[3]=v>>24;
+}
+
+static inline void put64(uint8_t*p,uint64_t v){
+	put32(p,(uint32_t)v),put32(p+4,(uint32_t)(v>>32));
+}
+
+// append a field that may lack its terminator
+static void get_str(char*dst,size_t dsize,const uint8_t*src,size_t ssize){
+	size_t cur=strlen(dst),n=0;
+	while(n<ssize&&src[n])n++;
+	if(n>dsize-1-cur)n=dsize-1-cur;
+	memcpy(dst+cur,src,n);
+	dst[cur+n]=0;
+}
+
+// fill a field from *src and move on, one byte stays for the terminator
+static void put_str(uint8_t*dst,size_t dsize,const char**src){
+	size_t n=strlen(*src);
+	if(n>dsize-1)n=dsize-1;
+	memcpy(dst,*src,n);
+	*src+=n;
+}
 
 bool abootimg_check_page(size_t p){
 	if(p<=sizeof(aboot_header))return false;
@@ -82,7 +156,7 @@ static bool abootimg_check_header(aboot_image*img){
 	if(!img)return false;
 	if(memcmp(
 		img->head.magic,
-		ABOOT_MAGIC,
+		img->vendor?VENDOR_MAGIC:ABOOT_MAGIC,
 		sizeof(img->head.magic)
 	)!=0)return false;
 	if(!abootimg_check_page(img->head.page_size))return false;
@@ -93,49 +167,298 @@ static uint32_t get_aligned_size(aboot_image*img,uint32_t size){
 	return align(size,abootimg_get_page_size(img));
 }
 
-static bool parse_image(aboot_image*img,void*file,size_t len){
-	if(!abootimg_check_header(img))return false;
-	#define DO_LOAD(type)\
-		if(abootimg_get_##type##_size(img)>0){\
-			if(abootimg_get_##type##_end(img)>len)return false;\
-			if(!(img->type=malloc(abootimg_get_##type##_size(img))))return false;\
-			memcpy(\
-				img->type,\
-				file+abootimg_get_##type##_offset(img),\
-				abootimg_get_##type##_size(img)\
-			);\
+static uint32_t get_header_size(aboot_image*img){
+	if(img->vendor)return img->version>=4?VHDR_V4_SIZE:VHDR_V3_SIZE;
+	switch(img->version){
+		case 0:return HDR_V0_SIZE;
+		case 1:return HDR_V1_SIZE;
+		case 2:return HDR_V2_SIZE;
+		case 3:return HDR_V3_SIZE;
+		default:return HDR_V4_SIZE;
+	}
+}
+
+// parts of an image in the order they are stored
+static size_t get_layout(aboot_image*img,enum aboot_part*parts){
+	size_t n=0;
+	if(img->vendor){
+		parts[n++]=PART_RAMDISK;
+		parts[n++]=PART_DTB;
+		if(img->version>=4){
+			parts[n++]=PART_RAMDISK_TABLE;
+			parts[n++]=PART_BOOTCONFIG;
 		}
-	DO_LOAD(kernel)
-	DO_LOAD(ramdisk)
-	DO_LOAD(second)
-	#undef DO_LOAD
+	}else if(img->version>=3){
+		parts[n++]=PART_KERNEL;
+		parts[n++]=PART_RAMDISK;
+		if(img->version>=4)parts[n++]=PART_SIGNATURE;
+	}else{
+		parts[n++]=PART_KERNEL;
+		parts[n++]=PART_RAMDISK;
+		parts[n++]=PART_SECOND;
+		if(img->version>=1)parts[n++]=PART_RECOVERY_DTBO;
+		if(img->version>=2)parts[n++]=PART_DTB;
+	}
+	return n;
+}
+
+// the ramdisk table has no buffer, it is parsed on load and built on write
+static void**get_part(aboot_image*img,enum aboot_part part,uint32_t**size){
+	switch(part){
+		case PART_KERNEL:*size=&img->head.kernel_size;return &img->kernel;
+		case PART_RAMDISK:*size=&img->head.ramdisk_size;return &img->ramdisk;
+		case PART_SECOND:*size=&img->head.second_size;return &img->second;
+		case PART_RECOVERY_DTBO:*size=&img->recovery_dtbo_size;return &img->recovery_dtbo;
+		case PART_DTB:*size=&img->dtb_size;return &img->dtb;
+		case PART_BOOTCONFIG:*size=&img->bootconfig_size;return &img->bootconfig;
+		case PART_SIGNATURE:*size=&img->signature_size;return &img->signature;
+		case PART_RAMDISK_TABLE:*size=&img->ramdisk_table_size;return NULL;
+		default:*size=NULL;return NULL;
+	}
+}
+
+// offset of a part, a part not in this version gets the image end
+static uint64_t part_offset(aboot_image*img,enum aboot_part part){
+	uint32_t*size;
+	enum aboot_part parts[PART_END];
+	size_t cnt=get_layout(img,parts);
+	uint64_t off=get_aligned_size(img,get_header_size(img));
+	for(size_t i=0;i<cnt&&parts[i]!=part;i++){
+		get_part(img,parts[i],&size);
+		off+=get_aligned_size(img,*size);
+	}
+	return off;
+}
+
+// a new vendor ramdisk leaves the old ramdisk table meaningless
+static void part_replaced(aboot_image*img,void**data){
+	if(data!=&img->ramdisk||!img->vrds)return;
+	free(img->vrds);
+	img->vrds=NULL,img->vrd_cnt=0;
+	img->ramdisk_table_size=0;
+}
+
+static bool parse_vendor_header(
+	aboot_image*img,const uint8_t*h,size_t len,
+	uint32_t*vrd_num,uint32_t*vrd_entry
+){
+	if(len<VHDR_V3_SIZE)return false;
+	if((img->version=get32(h+8))<3)return false;
+	if(img->version>=4&&len<VHDR_V4_SIZE)return false;
+	img->vendor=true;
+	memcpy(img->head.magic,h,sizeof(img->head.magic));
+	img->head.header_version=img->version;
+	img->head.page_size=get32(h+12);
+	img->head.kernel_address=get32(h+16);
+	img->head.ramdisk_address=get32(h+20);
+	img->head.ramdisk_size=get32(h+24);
+	get_str(img->cmdline,sizeof(img->cmdline),h+28,2048);
+	img->head.tags_address=get32(h+2076);
+	memcpy(img->head.name,h+2080,sizeof(img->head.name));
+	img->dtb_size=get32(h+2100);
+	img->dtb_address=get64(h+2104);
+	if(img->version>=4){
+		img->ramdisk_table_size=get32(h+2112);
+		*vrd_num=get32(h+2116);
+		*vrd_entry=get32(h+2120);
+		img->bootconfig_size=get32(h+2124);
+	}
+	return true;
+}
+
+static bool parse_header(
+	aboot_image*img,const uint8_t*h,size_t len,
+	uint32_t*vrd_num,uint32_t*vrd_entry
+){
+	uint32_t v;
+	if(len<sizeof(aboot_header))return false;
+	if(memcmp(h,VENDOR_MAGIC,8)==0)
+		return parse_vendor_header(img,h,len,vrd_num,vrd_entry);
+	if(memcmp(h,ABOOT_MAGIC,8)!=0)return false;
+	v=get32(h+40);
+	if((v==3||v==4)&&get32(h+20)==(v==3?HDR_V3_SIZE:HDR_V4_SIZE)){
+		if(len<get32(h+20))return false;
+		memcpy(img->head.magic,h,sizeof(img->head.magic));
+		img->version=img->head.header_version=v;
+		img->head.kernel_size=get32(h+8);
+		img->head.ramdisk_size=get32(h+12);
+		img->head.os_version=get32(h+16);
+		img->head.page_size=HDR_V3_PAGE;
+		get_str(img->cmdline,sizeof(img->cmdline),h+44,1536);
+		if(v>=4)img->signature_size=get32(h+1580);
+		return true;
+	}
+
+	// old images put other things into the version field, so a version
+	// only counts when the header size field agrees with it
+	memcpy(&img->head,h,sizeof(aboot_header));
+	if(v==1||v==2){
+		uint32_t want=v==1?HDR_V1_SIZE:HDR_V2_SIZE;
+		if(len<want||get32(h+1644)!=want)v=0;
+	}else v=0;
+	img->version=v;
+	get_str(img->cmdline,sizeof(img->cmdline),h+64,512);
+	if(len>=HDR_V0_SIZE)get_str(img->cmdline,sizeof(img->cmdline),h+608,1024);
+	if(v>=1)img->recovery_dtbo_size=get32(h+1632);
+	if(v>=2){
+		img->dtb_size=get32(h+1648);
+		img->dtb_address=get64(h+1652);
+	}
+	return true;
+}
+
+static bool parse_ramdisk_table(
+	aboot_image*img,const uint8_t*t,size_t len,
+	uint32_t num,uint32_t entry
+){
+	if(num<=0)return true;
+	if(num>VRD_MAX||entry<VRD_ENTRY_SIZE||num>len/entry)return false;
+	if(!(img->vrds=malloc(sizeof(aboot_vendor_ramdisk)*num)))return false;
+	memset(img->vrds,0,sizeof(aboot_vendor_ramdisk)*num);
+	img->vrd_cnt=num;
+	for(uint32_t i=0;i<num;i++){
+		const uint8_t*p=t+i*entry;
+		aboot_vendor_ramdisk*r=&img->vrds[i];
+		r->size=get32(p);
+		r->offset=get32(p+4);
+		r->type=get32(p+8);
+		memcpy(r->name,p+12,sizeof(r->name)-1);
+		for(int j=0;j<16;j++)r->board_id[j]=get32(p+44+j*4);
+		if((uint64_t)r->offset+r->size>img->head.ramdisk_size)return false;
+	}
 	return true;
 }
 
+static void build_ramdisk_table(aboot_image*img,uint8_t*t){
+	for(size_t i=0;i<img->vrd_cnt;i++){
+		uint8_t*p=t+i*VRD_ENTRY_SIZE;
+		aboot_vendor_ramdisk*r=&img->vrds[i];
+		put32(p,r->size);
+		put32(p+4,r->offset);
+		put32(p+8,r->type);
+		memcpy(p+12,r->name,sizeof(r->name));
+		for(int j=0;j<16;j++)put32(p+44+j*4,r->board_id[j]);
+	}
+}
+
+static void build_header(aboot_image*img,uint8_t*h){
+	const char*c=img->cmdline;
+	uint32_t v=img->version;
+	if(img->vendor){
+		memcpy(h,VENDOR_MAGIC,8);
+		put32(h+8,v);
+		put32(h+12,img->head.page_size);
+		put32(h+16,img->head.kernel_address);
+		put32(h+20,img->head.ramdisk_address);
+		put32(h+24,img->head.ramdisk_size);
+		put_str(h+28,2048,&c);
+		put32(h+2076,img->head.tags_address);
+		memcpy(h+2080,img->head.name,sizeof(img->head.name));
+		put32(h+2096,get_header_size(img));
+		put32(h+2100,img->dtb_size);
+		put64(h+2104,img->dtb_address);
+		if(v>=4){
+			put32(h+2112,img->ramdisk_table_size);
+			put32(h+2116,(uint32_t)img->vrd_cnt);
+			put32(h+2120,VRD_ENTRY_SIZE);
+			put32(h+2124,img->bootconfig_size);
+		}
+	}else if(v>=3){
+		memcpy(h,ABOOT_MAGIC,8);
+		put32(h+8,img->head.kernel_size);
+		put32(h+12,img->head.ramdisk_size);
+		put32(h+16,img->head.os_version);
+		put32(h+20,get_header_size(img));
+		put32(h+40,v);
+		put_str(h+44,1536,&c);
+		if(v>=4)put32(h+1580,img->signature_size);
+	}else{
+		memcpy(h,&img->head,sizeof(aboot_header));
+		memset(h+64,0,sizeof(img->head.cmdline));
+		put_str(h+64,sizeof(img->head.cmdline),&c);
+		put_str(h+608,1024,&c);
+		if(v>=1){
+			put32(h+1632,img->recovery_dtbo_size);
+			if(img->recovery_dtbo_size>0)
+				put64(h+1636,part_offset(img,PART_RECOVERY_DTBO));
+			put32(h+1644,get_header_size(img));
+		}
+		if(v>=2){
+			put32(h+1648,img->dtb_size);
+			put64(h+1652,img->dtb_address);
+		}
+	}
+}
+
+// read the header, then every part right into its own buffer
+static aboot_image*load_image(aboot_reader read,void*ctx,uint64_t size){
+	void**data;
+	uint8_t*buf=NULL;
+	uint32_t*len,vrd_num=0,vrd_entry=0;
+	uint64_t off;
+	aboot_image*img=NULL;
+	enum aboot_part parts[PART_END];
+	size_t cnt,hlen=HDR_MAX_SIZE;
+	if(size>0&&size<hlen)hlen=size;
+	if(hlen<=sizeof(aboot_header))return NULL;
+	if(!(img=abootimg_allocate()))return NULL;
+	if(!(buf=malloc(hlen)))goto fail;
+	if(!read(ctx,0,buf,hlen))goto fail;
+	if(!parse_header(img,buf,hlen,&vrd_num,&vrd_entry))goto fail;
+	free(buf);
+	buf=NULL;
+	if(!abootimg_check_header(img))goto fail;
+	cnt=get_layout(img,parts);
+	for(size_t i=0;i<cnt;i++){
+		data=get_part(img,parts[i],&len);
+		if(*len<=0)continue;
+		off=part_offset(img,parts[i]);
+		if(size>0&&off+*len>size)goto fail;
+		if(!(buf=malloc(*len)))goto fail;
+		if(!read(ctx,off,buf,*len))goto fail;
+		if(data)*data=buf;
+		else if(!parse_ramdisk_table(img,buf,*len,vrd_num,vrd_entry))goto fail;
+		else free(buf);
+		buf=NULL;
+	}
+	if(img->vendor)img->ramdisk_table_size=img->vrd_cnt*VRD_ENTRY_SIZE;
+	return img;
+	fail:
+	if(buf)free(buf);
+	if(img)abootimg_free(img);
+	return NULL;
+}
+
 bool abootimg_is_empty(aboot_image*img){
-	return img&&!img->kernel&&!img->ramdisk&&!img->second;
+	return img&&
+		!img->kernel&&!img->ramdisk&&!img->second&&
+		!img->recovery_dtbo&&!img->dtb&&!img->bootconfig;
 }
 
 bool abootimg_is_invalid(aboot_image*img){
 	if(!abootimg_check_header(img))return true;
+	if(img->vendor)return !img->ramdisk&&!img->dtb;
 	if(!img->kernel)return true;
 	return false;
 }
 
-uint32_t abootimg_get_kernel_offset(aboot_image*img){
-	return abootimg_get_page_size(img);
+bool abootimg_is_vendor(aboot_image*img){
+	return img&&img->vendor;
 }
 
-uint32_t abootimg_get_ramdisk_offset(aboot_image*img){
-	return KERN_OFF(img)+get_aligned_size(img,KERN_SIZ(img));
+uint32_t abootimg_get_header_version(aboot_image*img){
+	return img?img->version:0;
 }
 
-uint32_t abootimg_get_second_offset(aboot_image*img){
-	return RAMDISK_OFF(img)+get_aligned_size(img,RAMDISK_SIZ(img));
+bool abootimg_set_header_version(aboot_image*img,uint32_t version){
+	if(!img||version>4||(img->vendor&&version<3))return false;
+	img->version=img->head.header_version=version;
+	if(!img->vendor&&version>=3)img->head.page_size=HDR_V3_PAGE;
+	return true;
 }
 
 uint32_t abootimg_get_image_size(aboot_image*img){
-	return SEC_OFF(img)+get_aligned_size(img,SEC_SIZ(img));
+	return (uint32_t)part_offset(img,PART_END);
 }
 
 aboot_image*abootimg_new_image(){
@@ -146,59 +469,130 @@ aboot_image*abootimg_new_image(){
 	return img;
 }
 
+aboot_image*abootimg_new_vendor_image(){
+	aboot_image*img=abootimg_allocate();
+	if(!img)return NULL;
+	memcpy(img->head.magic,VENDOR_MAGIC,sizeof(img->head.magic));
+	img->head.page_size=4096;
+	img->version=img->head.header_version=4;
+	img->vendor=true;
+	return img;
+}
+
 void abootimg_free(aboot_image*img){
 	if(!img)return;
 	if(img->kernel)free(img->kernel);
 	if(img->ramdisk)free(img->ramdisk);
 	if(img->second)free(img->second);
+	if(img->recovery_dtbo)free(img->recovery_dtbo);
+	if(img->dtb)free(img->dtb);
+	if(img->bootconfig)free(img->bootconfig);
+	if(img->signature)free(img->signature);
+	if(img->vrds)free(img->vrds);
 	free(img);
 }
 
+size_t abootimg_get_vendor_ramdisk_count(aboot_image*img){
+	return img?img->vrd_cnt:0;
+}
+
+void*abootimg_get_vendor_ramdisk(aboot_image*img,size_t idx,aboot_vendor_ramdisk*info){
+	if(!img||!img->ramdisk||idx>=img->vrd_cnt)return NULL;
+	if(info)memcpy(info,&img->vrds[idx],sizeof(aboot_vendor_ramdisk));
+	return (uint8_t*)img->ramdisk+img->vrds[idx].offset;
+}
+
+bool abootimg_add_vendor_ramdisk(aboot_image*img,void*data,uint32_t len,uint32_t type,const char*name){
+	void*buf;
+	aboot_vendor_ramdisk*r;
+	uint32_t old;
+	if(!img||!img->vendor||!data||len<=0)return false;
+	if(img->vrd_cnt>=VRD_MAX)return false;
+	old=img->head.ramdisk_size;
+	if(old+len<old)return false;
+	if(!(r=realloc(img->vrds,sizeof(aboot_vendor_ramdisk)*(img->vrd_cnt+1))))return false;
+	img->vrds=r;
+	if(!(buf=realloc(img->ramdisk,old+len)))return false;
+	img->ramdisk=buf;
+	memcpy((uint8_t*)buf+old,data,len);
+	r=&img->vrds[img->vrd_cnt++];
+	memset(r,0,sizeof(aboot_vendor_ramdisk));
+	r->size=len,r->offset=old,r->type=type;
+	if(name)strncpy(r->name,name,sizeof(r->name)-1);
+	img->head.ramdisk_size=old+len;
+	img->ramdisk_table_size=img->vrd_cnt*VRD_ENTRY_SIZE;
+	return true;
+}
+
+struct mem_source{
+	const uint8_t*ptr;
+	size_t len;
+};
+
+static bool mem_read(void*ctx,uint64_t off,void*buf,size_t len){
+	struct mem_source*m=ctx;
+	if(off>m->len||len>m->len-off)return false;
+	memcpy(buf,m->ptr+off,len);
+	return true;
+}
+
 aboot_image*abootimg_load_from_memory(void*file,size_t len){
+	struct mem_source m={.ptr=file,.len=len};
 	if(!file||len<=0)return NULL;
-	aboot_image*img=abootimg_allocate();
-	if(!img)goto fail;
-	if(len<=sizeof(aboot_header))goto fail;
-	memcpy(&img->head,file,sizeof(aboot_header));
-	if(len<abootimg_get_image_size(img))goto fail;
-	if(!parse_image(img,file,len))goto fail;
-	return img;
-	fail:if(img)abootimg_free(img);
-	return NULL;
+	return load_image(mem_read,&m,len);
 }
 
 bool abootimg_generate(aboot_image*img,void**output,uint32_t*len){
+	void**data;
+	uint8_t*out;
+	uint32_t*part;
+	enum aboot_part parts[PART_END];
 	if(!img||!output||!len)return false;
-	size_t size=abootimg_get_image_size(img);
+	size_t size=abootimg_get_image_size(img),cnt=get_layout(img,parts);
 	if(*len&&*len>size)size=*len;
 	else *len=size;
-	if(!(*output=malloc(size)))return false;
-	memset(*output,0,size);
-	memcpy(*output,&img->head,sizeof(aboot_header));
-	#define DO_GEN(type)\
-		if(img->type)memcpy(\
-			(*output)+abootimg_get_##type##_offset(img),\
-			img->type,abootimg_get_##type##_size(img)\
-		);
-	DO_GEN(kernel)
-	DO_GEN(ramdisk)
-	DO_GEN(second)
-	#undef DO_GEN
+	if(!(out=malloc(size)))return false;
+	memset(out,0,size);
+	build_header(img,out);
+	for(size_t i=0;i<cnt;i++){
+		data=get_part(img,parts[i],&part);
+		if(data&&*data&&*part>0)
+			memcpy(out+part_offset(img,parts[i]),*data,*part);
+		else if(!data&&img->vrd_cnt>0)
+			build_ramdisk_table(img,out+part_offset(img,parts[i]));
+	}
+	*output=out;
 	return true;
 }
 
-aboot_image*abootimg_load_from_fsh(fsh*f){
-	int r=0;
+// map the whole file when the driver can, read it otherwise
+static void*fsh_get_all(fsh*f,size_t*len,bool*mapped){
 	void*buf=NULL;
-	size_t len=0;
-	aboot_image*img=NULL;
-	if(!f)return NULL;
+	*len=0,*mapped=false;
+	if(fs_map(f,&buf,0,len,FILE_FLAG_READ)==0&&buf){
+		*mapped=true;
+		return buf;
+	}
+	*len=0;
 	fs_seek(f,0,SEEK_SET);
-	r=fs_read_all(f,&buf,&len);
-	if(r!=0||!buf)return NULL;
-	img=abootimg_load_from_memory(buf,len);
-	free(buf);
-	return img;
+	if(fs_read_all(f,&buf,len)!=0)return NULL;
+	return buf;
+}
+
+static void fsh_put_all(fsh*f,void*buf,size_t len,bool mapped){
+	if(mapped)fs_unmap(f,buf,len);
+	else free(buf);
+}
+
+static bool fsh_read(void*ctx,uint64_t off,void*buf,size_t len){
+	return fs_seek(ctx,off,SEEK_SET)==0&&fs_full_read(ctx,buf,len)==0;
+}
+
+aboot_image*abootimg_load_from_fsh(fsh*f){
+	size_t size=0;
+	if(!f)return NULL;
+	if(fs_get_size(f,&size)!=0)size=0;
+	return load_image(fsh_read,f,size);
 }
 
 aboot_image*abootimg_load_from_url(url*u){
@@ -259,30 +653,38 @@ bool abootimg_save_to_url_path(aboot_image*img,const char*path){
 }
 
 #ifdef ENABLE_UEFI
-aboot_image*abootimg_load_from_blockio(EFI_BLOCK_IO_PROTOCOL*bio){
-	if(!bio)return NULL;
-	UINTN size=0;
-	void*cont=NULL;
-	aboot_image*img=NULL;
+// whole blocks go straight into the buffer, only unaligned edges bounce
+static bool blockio_read(void*ctx,uint64_t off,void*buf,size_t len){
+	UINTN n,skip;
+	bool ret=false;
+	UINT8*out=buf,*blk=NULL;
+	EFI_BLOCK_IO_PROTOCOL*bio=ctx;
 	UINT32 mid=bio->Media->MediaId;
-	if(!(img=abootimg_new_image()))return NULL;
-	size=align(sizeof(aboot_header),bio->Media->BlockSize);
-	if(!(cont=AllocateZeroPool(size)))goto fail;
-	if(EFI_ERROR(bio->ReadBlocks(bio,mid,0,size,cont)))goto fail;
-	CopyMem(&img->head,cont,sizeof(aboot_header));
-	FreePool(cont);
-	cont=NULL;
-	if(!abootimg_check_header(img))goto fail;
-	size=align(abootimg_get_image_size(img),bio->Media->BlockSize);
-	if(!(cont=AllocateZeroPool(size)))goto fail;
-	if(EFI_ERROR(bio->ReadBlocks(bio,mid,0,size,cont)))goto fail;
-	if(!parse_image(img,cont,size))goto fail;
-	FreePool(cont);
-	return img;
-	fail:
-	if(img)abootimg_free(img);
-	if(cont)FreePool(cont);
-	return NULL;
+	UINT32 bs=bio->Media->BlockSize;
+	while(len>0){
+		if((skip=off%bs)==0&&len>=bs){
+			n=len-len%bs;
+			if(EFI_ERROR(bio->ReadBlocks(bio,mid,off/bs,n,out)))goto done;
+		}else{
+			if(!blk&&!(blk=AllocatePool(bs)))goto done;
+			if(EFI_ERROR(bio->ReadBlocks(bio,mid,off/bs,bs,blk)))goto done;
+			n=MIN(bs-skip,len);
+			CopyMem(out,blk+skip,n);
+		}
+		off+=n,out+=n,len-=n;
+	}
+	ret=true;
+	done:
+	if(blk)FreePool(blk);
+	return ret;
+}
+
+aboot_image*abootimg_load_from_blockio(EFI_BLOCK_IO_PROTOCOL*bio){
+	if(!bio||!bio->Media||bio->Media->BlockSize<=0)return NULL;
+	return load_image(
+		blockio_read,bio,
+		(bio->Media->LastBlock+1)*bio->Media->BlockSize
+	);
 }
 
 bool abootimg_save_to_blockio(aboot_image*img,EFI_BLOCK_IO_PROTOCOL*bio){
@@ -299,26 +701,43 @@ bool abootimg_save_to_blockio(aboot_image*img,EFI_BLOCK_IO_PROTOCOL*bio){
 	return !EFI_ERROR(st);
 }
 
-aboot_image*abootimg_load_from_fp(EFI_FILE_PROTOCOL*fp){
-	if(!fp)return NULL;
-	UINTN read=0;
-	void*cont=NULL;
-	aboot_image*img=NULL;
+static bool fp_read(void*ctx,uint64_t off,void*buf,size_t len){
+	UINTN read;
+	UINT8*out=buf;
+	EFI_FILE_PROTOCOL*fp=ctx;
+	if(EFI_ERROR(fp->SetPosition(fp,off)))return false;
+	while(len>0){
+		read=len;
+		if(EFI_ERROR(fp->Read(fp,&read,out))||read==0)return false;
+		out+=read,len-=read;
+	}
+	return true;
+}
+
+// read a whole file into one buffer sized by its info
+static bool fp_read_all(EFI_FILE_PROTOCOL*fp,void**buf,size_t*len){
 	EFI_FILE_INFO*info=NULL;
-	if(EFI_ERROR(efi_file_get_file_info(fp,NULL,&info)))goto fail;
-	read=info->FileSize;
-	if(!(cont=AllocateZeroPool(info->FileSize)))goto fail;
-	if(EFI_ERROR(fp->Read(fp,&read,cont)))goto fail;
-	if(read!=info->FileSize)goto fail;
-	img=abootimg_load_from_memory(cont,info->FileSize);
-	FreePool(cont);
+	if(EFI_ERROR(efi_file_get_file_info(fp,NULL,&info)))return false;
+	*len=info->FileSize;
 	FreePool(info);
-	return img;
-	fail:
-	if(img)abootimg_free(img);
-	if(info)FreePool(info);
-	if(cont)FreePool(cont);
-	return NULL;
+	if(*len<=0||!(*buf=malloc(*len)))return false;
+	if(!fp_read(fp,0,*buf,*len)){
+		free(*buf);
+		*buf=NULL;
+		return false;
+	}
+	return true;
+}
+
+aboot_image*abootimg_load_from_fp(EFI_FILE_PROTOCOL*fp){
+	UINT64 size=0;
+	EFI_FILE_INFO*info=NULL;
+	if(!fp)return NULL;
+	if(!EFI_ERROR(efi_file_get_file_info(fp,NULL,&info))){
+		size=info->FileSize;
+		FreePool(info);
+	}
+	return load_image(fp_read,fp,size);
 }
 
 aboot_image*abootimg_load_from_wfile(EFI_FILE_PROTOCOL*root,CHAR16*path){
@@ -395,37 +814,28 @@ bool abootimg_save_to_file(aboot_image*img,EFI_FILE_PROTOCOL*root,char*path){
 
 #define ABOOTIMG_LOAD_SAVE(tag) \
 	bool abootimg_load_##tag##_from_blockio(aboot_image*img,EFI_BLOCK_IO_PROTOCOL*bio){\
-		if(!bio)return false;\
+		if(!bio||!bio->Media)return false;\
 		void*cont=NULL;\
-		bool ret=false;\
-		UINT32 mid=bio->Media->MediaId;\
-		UINTN size=(bio->Media->LastBlock-1)*bio->Media->BlockSize;\
-		if(size>=UINT32_MAX)goto fail;\
-		if(!(cont=AllocateZeroPool(size)))goto fail;\
-		if(EFI_ERROR(bio->ReadBlocks(bio,mid,0,size,cont)))goto fail;\
-		ret=abootimg_set_##tag(img,cont,(uint32_t)size);\
-		fail:\
-		if(cont)FreePool(cont);\
-		return ret;\
+		UINTN size=(bio->Media->LastBlock+1)*bio->Media->BlockSize;\
+		if(size<=0||size>=UINT32_MAX)return false;\
+		if(!(cont=malloc(size)))return false;\
+		if(!blockio_read(bio,0,cont,size)||\
+			!abootimg_take_##tag(img,cont,(uint32_t)size)){\
+			free(cont);\
+			return false;\
+		}\
+		return true;\
 	}\
 	bool abootimg_load_##tag##_from_fp(aboot_image*img,EFI_FILE_PROTOCOL*fp){\
 		if(!fp)return false;\
-		UINTN read=0;\
+		size_t len=0;\
 		void*cont=NULL;\
-		EFI_FILE_INFO*info=NULL;\
-		if(EFI_ERROR(efi_file_get_file_info(fp,NULL,&info)))goto fail;\
-		read=info->FileSize;\
-		if(!(cont=AllocateZeroPool(info->FileSize)))goto fail;\
-		if(EFI_ERROR(fp->Read(fp,&read,cont)))goto fail;\
-		if(read!=info->FileSize)goto fail;\
-		bool ret=abootimg_set_##tag(img,cont,info->FileSize);\
-		FreePool(cont);\
-		FreePool(info);\
-		return ret;\
-		fail:\
-		if(info)FreePool(info);\
-		if(cont)FreePool(cont);\
-		return false;\
+		if(!fp_read_all(fp,&cont,&len))return false;\
+		if(len>UINT32_MAX||!abootimg_take_##tag(img,cont,(uint32_t)len)){\
+			free(cont);\
+			return false;\
+		}\
+		return true;\
 	}\
 	bool abootimg_load_##tag##_from_wfile(aboot_image*img,EFI_FILE_PROTOCOL*root,CHAR16*path){\
 		if(!root||!path)return false;\
@@ -501,52 +911,64 @@ bool abootimg_save_to_file(aboot_image*img,EFI_FILE_PROTOCOL*root,char*path){
 		return ret;\
 	}
 #else
-static bool allocate_read(int fd,size_t blk,void**buf,size_t*len){
-	size_t bs,mem,size;
-	if(!buf||blk<=0||fd<0)return false;
-	if(!(*buf=malloc(blk)))return false;
-	mem=blk,bs=blk,size=0;
-	while(1){
-		if(bs<=0){
-			mem+=blk,bs+=blk;
-			void*b=realloc(*buf,mem);
-			if(!b)goto ef;
-			*buf=b;
+static bool pread_full(int fd,void*buf,size_t len,off_t off){
+	ssize_t r;
+	while(len>0){
+		if((r=pread(fd,buf,len,off))<0&&errno==EINTR)continue;
+		if(r<=0)return false;
+		buf+=r,off+=r,len-=r;
+	}
+	return true;
+}
+
+static bool fd_read(void*ctx,uint64_t off,void*buf,size_t len){
+	return pread_full(*(int*)ctx,buf,len,(off_t)off);
+}
+
+// size the buffer by fstat, a stream without size grows it by doubling
+static bool fd_read_all(int fd,void**buf,size_t*len){
+	ssize_t r;
+	void*b=NULL;
+	struct stat st;
+	size_t mem=0x10000,size=0;
+	if(fstat(fd,&st)==0&&S_ISREG(st.st_mode)&&st.st_size>0){
+		if(!(b=malloc(st.st_size)))return false;
+		if(!pread_full(fd,b,st.st_size,0))goto fail;
+		*buf=b,*len=st.st_size;
+		return true;
+	}
+	lseek(fd,0,SEEK_SET);
+	if(!(b=malloc(mem)))return false;
+	while((r=read(fd,b+size,mem-size))!=0){
+		if(r<0){
+			if(errno==EINTR)continue;
+			goto fail;
 		}
-		ssize_t r=read(fd,(*buf)+size,bs);
-		if(r<0)goto ef;
-		else if(r==0)break;
-		size+=r,bs-=r;
+		if((size+=r)<mem)continue;
+		void*n=realloc(b,mem*=2);
+		if(!n)goto fail;
+		b=n;
 	}
-	if(len)*len=size;
+	*buf=b,*len=size;
 	return true;
-	ef:
-	if(!*buf)free(*buf);
-	size=0,*buf=NULL;
+	fail:
+	free(b);
 	return false;
 }
 
 aboot_image*abootimg_load_from_fd(int fd){
-	if(fd<0)return NULL;
-	void*map=NULL;
-	struct stat st;
+	off_t end;
+	void*buf=NULL;
 	size_t len=0;
 	aboot_image*img=NULL;
-	if(fstat(fd,&st)==0){
-		if(st.st_size>0)len=st.st_size;
-		else if(st.st_blksize>0)len=st.st_size;
-	}
-	lseek(fd,0,SEEK_SET);
-	if(len>0){
-		if((size_t)len<=sizeof(aboot_header))return NULL;
-		if(!(map=mmap(0,len,PROT_READ,MAP_PRIVATE,fd,0)))return NULL;
-		img=abootimg_load_from_memory(map,len);
-		munmap(map,len);
-	}else{
-		if(!allocate_read(fd,0x100000,&map,&len))return NULL;
-		img=abootimg_load_from_memory(map,len);
-		free(map);
-	}
+	if(fd<0)return NULL;
+	if((end=lseek(fd,0,SEEK_END))>0)
+		return load_image(fd_read,&fd,(uint64_t)end);
+
+	// pipes can not seek, take the stream whole
+	if(!fd_read_all(fd,&buf,&len))return NULL;
+	img=abootimg_load_from_memory(buf,len);
+	free(buf);
 	return img;
 }
 
@@ -598,25 +1020,14 @@ bool abootimg_save_to_file(aboot_image*img,int cfd,const char*file){
 	}\
 	bool abootimg_load_##tag##_from_fd(aboot_image*img,int fd){\
 		if(!img||fd<0)return false;\
-                bool ret;\
-                size_t len=0;\
-		void*map=NULL;\
-		struct stat st;\
-		if(fstat(fd,&st)==0){\
-			if(st.st_size>0)len=st.st_size;\
-			else if(st.st_blksize>0)len=st.st_size;\
-		}\
-		lseek(fd,0,SEEK_SET);\
-		if(len>0){\
-			if(!(map=mmap(0,len,PROT_READ,MAP_PRIVATE,fd,0)))return NULL;\
-			ret=abootimg_set_##tag(img,map,len);\
-			munmap(map,len);\
-		}else{\
-			if(!allocate_read(fd,0x100000,&map,&len))return NULL;\
-			ret=abootimg_set_##tag(img,map,len);\
-			free(map);\
+		size_t len=0;\
+		void*buf=NULL;\
+		if(!fd_read_all(fd,&buf,&len))return false;\
+		if(len>UINT32_MAX||!abootimg_take_##tag(img,buf,(uint32_t)len)){\
+			free(buf);\
+			return false;\
 		}\
-		return ret;\
+		return true;\
 	}\
 	bool abootimg_load_##tag##_from_file(aboot_image*img,int cfd,const char*file){\
 		if(!img||!file)return false;\
@@ -656,16 +1067,15 @@ bool abootimg_save_to_file(aboot_image*img,int cfd,const char*file){
 		return ret;\
 	}\
         bool abootimg_load_##tag##_from_fsh(aboot_image*img,fsh*f){\
-                bool ret;\
-		int r=0;\
+                bool ret,mapped=false;\
 		void*buf=NULL;\
 		size_t len=0;\
 		if(!img||!f)return false;\
-		fs_seek(f,0,SEEK_SET);\
-		r=fs_read_all(f,&buf,&len);\
-		if(r!=0||!buf)return false;\
-		ret=abootimg_set_##tag(img,buf,len);\
-		free(buf);\
+		if(!(buf=fsh_get_all(f,&len,&mapped)))return false;\
+		ret=len<=UINT32_MAX&&(mapped?\
+			abootimg_set_##tag(img,buf,len):\
+			abootimg_take_##tag(img,buf,len));\
+		if(mapped||!ret)fsh_put_all(f,buf,len,mapped);\
 		return ret;\
 	}\
 	bool abootimg_load_##tag##_from_url(aboot_image*img,url*u){\
@@ -688,16 +1098,25 @@ bool abootimg_save_to_file(aboot_image*img,int cfd,const char*file){
 		url_free(u);\
 		return ret;\
 	}
-#define ABOOTIMG_GET_SET(tag)\
-	bool abootimg_set_##tag(aboot_image*img,void*tag,uint32_t len){\
+#define ABOOTIMG_GET_SET(tag,part)\
+	static bool abootimg_take_##tag(aboot_image*img,void*tag,uint32_t len){\
 		if(!img||!tag||len<=0)return false;\
 		if(img->tag)free(img->tag);\
-		img->tag=NULL,img->head.tag##_size=0;\
-		if(!(img->tag=malloc(len)))return false;\
-		memcpy(img->tag,tag,len);\
-		img->head.tag##_size=len;\
+		part_replaced(img,&img->tag);\
+		img->tag=tag;\
+		abootimg_set_##tag##_size(img,len);\
 		return true;\
 	}\
+	bool abootimg_set_##tag(aboot_image*img,void*tag,uint32_t len){\
+		void*buf;\
+		if(!img||!tag||len<=0)return false;\
+		if(!(buf=malloc(len)))return false;\
+		memcpy(buf,tag,len);\
+		return abootimg_take_##tag(img,buf,len);\
+	}\
+	uint32_t abootimg_get_##tag##_offset(aboot_image*img){\
+		return (uint32_t)part_offset(img,part);\
+	}\
 	uint32_t abootimg_get_##tag(aboot_image*img,void**tag){\
 		if(!img||!tag)return 0;\
 		*tag=img->tag;\
@@ -714,25 +1133,23 @@ bool abootimg_save_to_file(aboot_image*img,int cfd,const char*file){
 	bool abootimg_have_##tag(aboot_image*img){\
 		return img&&img->tag;\
 	}
-#define ABOOTIMG_GET_VAR(type,key,def)\
-	type abootimg_get_##key(aboot_image*img){return img?img->head.key:def;}
-#define ABOOTIMG_SET_VAR(key)\
-	void abootimg_set_##key(aboot_image*img,uint32_t key){if(img)img->head.key=key;}
-#define ABOOTIMG_SET_STRING(key) \
+#define ABOOTIMG_GET_VAR(type,key,field,def)\
+	type abootimg_get_##key(aboot_image*img){return img?img->field:def;}
+#define ABOOTIMG_SET_VAR(type,key,field)\
+	void abootimg_set_##key(aboot_image*img,type key){if(img)img->field=key;}
+#define ABOOTIMG_SET_STRING(key,field) \
 	void abootimg_set_##key(aboot_image*img,const char*key){\
 		if(!img)return;\
-		memset(img->head.key,0,sizeof(img->head.key));\
-		if(key)strncpy(img->head.key,key,sizeof(img->head.key)-1);\
+		memset(img->field,0,sizeof(img->field));\
+		if(key)strncpy(img->field,key,sizeof(img->field)-1);\
 	}
-#define ABOOTIMG_GETSET_VAR(key) ABOOTIMG_GET_VAR(uint32_t,key,0) ABOOTIMG_SET_VAR(key)
-#define ABOOTIMG_GETSET_STRING(key) ABOOTIMG_GET_VAR(const char*,key,NULL) ABOOTIMG_SET_STRING(key)
-#define ABOOTIMG_CONT(tag) ABOOTIMG_GET_SET(tag) ABOOTIMG_LOAD_SAVE(tag) ABOOTIMG_FSH_LOAD_SAVE(tag)
-
-ABOOTIMG_CONT(kernel)
-ABOOTIMG_CONT(ramdisk)
-ABOOTIMG_CONT(second)
-ABOOTIMG_GETSET_STRING(name)
-ABOOTIMG_GETSET_STRING(cmdline)
+#define ABOOTIMG_GETSET_VAR(key) ABOOTIMG_GET_VAR(uint32_t,key,head.key,0) ABOOTIMG_SET_VAR(uint32_t,key,head.key)
+#define ABOOTIMG_GETSET_EXT(type,key) ABOOTIMG_GET_VAR(type,key,key,0) ABOOTIMG_SET_VAR(type,key,key)
+#define ABOOTIMG_GETSET_STRING(key,field) ABOOTIMG_GET_VAR(const char*,key,field,NULL) ABOOTIMG_SET_STRING(key,field)
+#define ABOOTIMG_CONT(tag,part) ABOOTIMG_GET_SET(tag,part) ABOOTIMG_LOAD_SAVE(tag) ABOOTIMG_FSH_LOAD_SAVE(tag)
+
+ABOOTIMG_GETSET_STRING(name,head.name)
+ABOOTIMG_GETSET_STRING(cmdline,cmdline)
 ABOOTIMG_GETSET_VAR(kernel_size)
 ABOOTIMG_GETSET_VAR(ramdisk_size)
 ABOOTIMG_GETSET_VAR(second_size)
@@ -741,3 +1158,14 @@ ABOOTIMG_GETSET_VAR(ramdisk_address)
 ABOOTIMG_GETSET_VAR(second_address)
 ABOOTIMG_GETSET_VAR(tags_address)
 ABOOTIMG_GETSET_VAR(page_size)
+ABOOTIMG_GETSET_VAR(os_version)
+ABOOTIMG_GETSET_EXT(uint32_t,recovery_dtbo_size)
+ABOOTIMG_GETSET_EXT(uint32_t,dtb_size)
+ABOOTIMG_GETSET_EXT(uint64_t,dtb_address)
+ABOOTIMG_GETSET_EXT(uint32_t,bootconfig_size)
+ABOOTIMG_CONT(kernel,PART_KERNEL)
+ABOOTIMG_CONT(ramdisk,PART_RAMDISK)
+ABOOTIMG_CONT(second,PART_SECOND)
+ABOOTIMG_CONT(recovery_dtbo,PART_RECOVERY_DTBO)
+ABOOTIMG_CONT(dtb,PART_DTB)
+ABOOTIMG_CONT(bootconfig,PART_BOOTCONFIG)
@@ -0,0 +1,126 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<errno.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include"defines.h"
+#include"arena.h"
+
+/*
+ * memory is cut from blocks of the same size one after another, nothing
+ * is freed alone. anything bigger than a quarter of a block gets its own
+ * block, those are the only ones given back on reset, the others are
+ * reused from the first one. every allocation is aligned for any type.
+ */
+#define ARENA_BLOCK 4096
+#define ARENA_ALIGN (sizeof(void*)*2)
+#define ALIGN_UP(v) (((v)+ARENA_ALIGN-1)&~(ARENA_ALIGN-1))
+
+struct arena_block{
+	struct arena_block*next;
+	size_t size,used;
+};
+#define BLOCK_HDR ALIGN_UP(sizeof(struct arena_block))
+#define BLOCK_DATA(b) ((char*)(b)+BLOCK_HDR)
+
+struct arena{
+	size_t block;
+	struct arena_block*first,*cur,*big;
+};
+
+static struct arena_block*block_new(size_t size){
+	struct arena_block*b;
+	if(!(b=malloc(BLOCK_HDR+size)))EPRET(ENOMEM);
+	b->next=NULL,b->size=size,b->used=0;
+	return b;
+}
+
+arena*arena_new(size_t block){
+	arena*a;
+	if(!(a=malloc(sizeof(arena))))EPRET(ENOMEM);
+	memset(a,0,sizeof(arena));
+	a->block=ALIGN_UP(block>0?block:ARENA_BLOCK);
+	return a;
+}
+
+void*arena_alloc(arena*a,size_t size){
+	void*p;
+	struct arena_block*b;
+	if(!a)EPRET(EINVAL);
+	if(size>SIZE_MAX-BLOCK_HDR-ARENA_ALIGN)EPRET(ENOMEM);
+	size=ALIGN_UP(MAX(size,(size_t)1));
+	if(size>a->block/4){
+		if(!(b=block_new(size)))return NULL;
+		b->next=a->big,a->big=b;
+		return BLOCK_DATA(b);
+	}
+	while(a->cur&&a->cur->used+size>a->cur->size&&a->cur->next)
+		a->cur=a->cur->next;
+	if(!a->cur||a->cur->used+size>a->cur->size){
+		if(!(b=block_new(a->block)))return NULL;
+		if(a->cur)a->cur->next=b;
+		else a->first=b;
+		a->cur=b;
+	}
+	p=BLOCK_DATA(a->cur)+a->cur->used;
+	a->cur->used+=size;
+	return p;
+}
+
+void*arena_zalloc(arena*a,size_t size){
+	void*p=arena_alloc(a,size);
+	if(p)memset(p,0,size);
+	return p;
+}
+
+void*arena_memdup(arena*a,const void*mem,size_t len){
+	void*p;
+	if(!mem)EPRET(EINVAL);
+	if((p=arena_alloc(a,len)))memcpy(p,mem,len);
+	return p;
+}
+
+char*arena_strndup(arena*a,const char*str,size_t len){
+	char*p;
+	if(!str)EPRET(EINVAL);
+	len=strnlen(str,len);
+	if(!(p=arena_alloc(a,len+1)))return NULL;
+	memcpy(p,str,len);
+	p[len]=0;
+	return p;
+}
+
+char*arena_strdup(arena*a,const char*str){
+	return arena_strndup(a,str,SIZE_MAX);
+}
+
+static void blocks_free(struct arena_block*b){
+	struct arena_block*next;
+	for(;b;b=next){
+		next=b->next;
+		free(b);
+	}
+}
+
+void arena_reset(arena*a){
+	if(!a)return;
+	blocks_free(a->big);
+	a->big=NULL;
+	for(struct arena_block*b=a->first;b;b=b->next)b->used=0;
+	a->cur=a->first;
+}
+
+void arena_free(arena*a){
+	if(!a)return;
+	blocks_free(a->big);
+	blocks_free(a->first);
+	free(a);
+}
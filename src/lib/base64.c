@@ -5,65 +5,238 @@
  */
 
 #define _GNU_SOURCE
-#include<ctype.h>
+#include<errno.h>
 #include<string.h>
+#include<stdint.h>
 #include<sys/types.h>
+#include"defines.h"
 #include"str.h"
+
+/*
+ * decoding goes through a reverse table instead of strchr, runs of four
+ * data characters are turned into three bytes at once and only
+ * whitespace, padding and the tail go through the state machine. the
+ * stream functions keep up to three characters or two bytes in
+ * b64_state between calls so the input can come in any pieces.
+ */
 static const char base64[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char pad64='=';
+
+#define X 0xFF
+#define S 0xFE
+#define P 0xFD
+static const uint8_t base64_rev[256]={
+	 X, X, X, X, X, X, X, X, X, S, S, S, S, S, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 S, X, X, X, X, X, X, X, X, X, X,62, X, X, X,63,
+	52,53,54,55,56,57,58,59,60,61, X, X, X, P, X, X,
+	 X, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+	15,16,17,18,19,20,21,22,23,24,25, X, X, X, X, X,
+	 X,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+	41,42,43,44,45,46,47,48,49,50,51, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	 X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+};
+#undef X
+#undef S
+#undef P
+#define B64_BAD 0xFF
+#define B64_SPC 0xFE
+#define B64_PAD 0xFD
+
 int b64_pton(char const*src,u_char*target,size_t targsize){
 	size_t tarindex;
 	int state,ch;
-	char*pos;
+	uint8_t a,b,c,d,v;
 	if(!src||!target)return -1;
 	state=0;
 	tarindex=0;
-	while((ch=(u_char)*src++)!='\0'){
-		if(isspace(ch))continue;
-		if(ch==pad64)break;
-		if((pos=strchr(base64,ch))==0)return(-1);
+	for(;;){
+		if(state==0)while(
+			tarindex+3<=targsize&&
+			(a=base64_rev[(u_char)src[0]])<64&&
+			(b=base64_rev[(u_char)src[1]])<64&&
+			(c=base64_rev[(u_char)src[2]])<64&&
+			(d=base64_rev[(u_char)src[3]])<64
+		){
+			target[tarindex]=a<<2|b>>4;
+			target[tarindex+1]=b<<4|c>>2;
+			target[tarindex+2]=c<<6|d;
+			tarindex+=3,src+=4;
+		}
+		if((ch=(u_char)*src++)=='\0')break;
+		if((v=base64_rev[ch])==B64_SPC)continue;
+		if(v==B64_PAD)break;
+		if(v==B64_BAD)return(-1);
 		switch(state){
 			case 0:
 				if(tarindex>=targsize)return(-1);
-				target[tarindex]=(pos-base64)<<2;
+				target[tarindex]=v<<2;
 				state=1;
 			break;
 			case 1:
 				if(tarindex+1>=targsize)return(-1);
-				target[tarindex]|=(u_int32_t)(pos-base64)>>4;
-				target[tarindex+1]=((pos-base64)&0x0f)<<4;
+				target[tarindex]|=v>>4;
+				target[tarindex+1]=(v&0x0f)<<4;
 				tarindex++;
 				state=2;
 			break;
 			case 2:
 				if(tarindex+1>=targsize)return(-1);
-				target[tarindex]|=(u_int32_t)(pos-base64)>>2;
-				target[tarindex+1]=((pos-base64)&0x03)<<6;
+				target[tarindex]|=v>>2;
+				target[tarindex+1]=(v&0x03)<<6;
 				tarindex++;
 				state=3;
 			break;
 			case 3:
 				if(tarindex>=targsize)return(-1);
-				target[tarindex]|=(pos-base64);
+				target[tarindex]|=v;
 				tarindex++;
 				state=0;
 			break;
 		}
 	}
 	if(ch==pad64){
-		ch=*src++;
+		ch=(u_char)*src++;
 		switch(state){
 			case 0:case 1:return(-1);
 			case 2:
-				for(;ch!='\0';ch=(u_char)*src++)if(!isspace(ch))break;
+				for(;ch!='\0';ch=(u_char)*src++)if(base64_rev[ch]!=B64_SPC)break;
 				if(ch!=pad64)return(-1);
-				ch=*src++;
+				ch=(u_char)*src++;
 			// FALLTHROUGH
 			case 3:
-				for(;ch!='\0';ch=(u_char)*src++)if(!isspace(ch))return(-1);
+				for(;ch!='\0';ch=(u_char)*src++)if(base64_rev[ch]!=B64_SPC)return(-1);
 				if(target[tarindex]!=0)return(-1);
 			break;
 		}
 	}else if(state!=0)return(-1);
 	return(tarindex);
 }
+
+static inline void encode_block(const u_char*in,char*out){
+	out[0]=base64[in[0]>>2];
+	out[1]=base64[(in[0]&0x03)<<4|in[1]>>4];
+	out[2]=base64[(in[1]&0x0f)<<2|in[2]>>6];
+	out[3]=base64[in[2]&0x3f];
+}
+
+static inline void encode_tail(const u_char*in,size_t len,char*out){
+	out[0]=base64[in[0]>>2];
+	if(len==1){
+		out[1]=base64[(in[0]&0x03)<<4];
+		out[2]=pad64;
+	}else{
+		out[1]=base64[(in[0]&0x03)<<4|in[1]>>4];
+		out[2]=base64[(in[1]&0x0f)<<2];
+	}
+	out[3]=pad64;
+}
+
+int b64_ntop(u_char const*src,size_t srclength,char*target,size_t targsize){
+	size_t i,o=0;
+	if(!src||!target)return -1;
+	if(B64_ENCODE_LEN(srclength)>=targsize)return -1;
+	for(i=0;i+3<=srclength;i+=3,o+=4)encode_block(src+i,target+o);
+	if(i<srclength)encode_tail(src+i,srclength-i,target+o),o+=4;
+	target[o]=0;
+	return (int)o;
+}
+
+void b64_state_init(struct b64_state*st){
+	if(st)memset(st,0,sizeof(struct b64_state));
+}
+
+ssize_t b64_encode_update(struct b64_state*st,const void*src,size_t len,char*out,size_t outsize){
+	size_t i=0,o=0;
+	const u_char*in=src;
+	if(!st||(!src&&len>0)||st->cnt<0||st->cnt>2)ERET(EINVAL);
+	if((st->cnt+len)/3*4>outsize)ERET(ENOSPC);
+	if(st->cnt>0){
+		while(st->cnt<3&&i<len)st->buf[st->cnt++]=in[i++];
+		if(st->cnt<3)return 0;
+		encode_block(st->buf,out),o+=4;
+		st->cnt=0;
+	}
+	for(;i+3<=len;i+=3,o+=4)encode_block(in+i,out+o);
+	while(i<len)st->buf[st->cnt++]=in[i++];
+	return (ssize_t)o;
+}
+
+ssize_t b64_encode_final(struct b64_state*st,char*out,size_t outsize){
+	if(!st||st->cnt<0||st->cnt>2)ERET(EINVAL);
+	if(st->cnt==0)return 0;
+	if(!out||outsize<4)ERET(ENOSPC);
+	encode_tail(st->buf,st->cnt,out);
+	b64_state_init(st);
+	return 4;
+}
+
+ssize_t b64_decode_update(struct b64_state*st,const char*src,size_t len,void*out,size_t outsize){
+	size_t i=0,o=0;
+	uint8_t a,b,c,d,v;
+	u_char*t=out;
+	const u_char*in=(const u_char*)src;
+	if(!st||(!src&&len>0)||st->cnt<0||st->cnt>3)ERET(EINVAL);
+	if((st->cnt+len)/4*3>outsize)ERET(ENOSPC);
+	while(i<len){
+		if(st->cnt==0&&st->pad==0)while(
+			i+4<=len&&
+			(a=base64_rev[in[i]])<64&&
+			(b=base64_rev[in[i+1]])<64&&
+			(c=base64_rev[in[i+2]])<64&&
+			(d=base64_rev[in[i+3]])<64
+		){
+			t[o]=a<<2|b>>4;
+			t[o+1]=b<<4|c>>2;
+			t[o+2]=c<<6|d;
+			o+=3,i+=4;
+		}
+		if(i>=len)break;
+		v=base64_rev[in[i++]];
+		if(v==B64_SPC)continue;
+		if(v==B64_BAD)ERET(EINVAL);
+		if(v==B64_PAD){
+			if(st->cnt<2||st->cnt+ ++st->pad>4)ERET(EINVAL);
+			continue;
+		}
+		if(st->pad>0)ERET(EINVAL);
+		st->buf[st->cnt++]=v;
+		if(st->cnt<4)continue;
+		t[o]=st->buf[0]<<2|st->buf[1]>>4;
+		t[o+1]=st->buf[1]<<4|st->buf[2]>>2;
+		t[o+2]=st->buf[2]<<6|st->buf[3];
+		o+=3,st->cnt=0;
+	}
+	return (ssize_t)o;
+}
+
+ssize_t b64_decode_final(struct b64_state*st,void*out,size_t outsize){
+	u_char*t=out;
+	if(!st)ERET(EINVAL);
+	switch(st->cnt){
+		case 0:
+			if(st->pad!=0)ERET(EINVAL);
+			return 0;
+		case 2:
+			if(st->pad==1||(st->buf[1]&0x0f))ERET(EINVAL);
+			if(!out||outsize<1)ERET(ENOSPC);
+			t[0]=st->buf[0]<<2|st->buf[1]>>4;
+			b64_state_init(st);
+			return 1;
+		case 3:
+			if(st->buf[2]&0x03)ERET(EINVAL);
+			if(!out||outsize<2)ERET(ENOSPC);
+			t[0]=st->buf[0]<<2|st->buf[1]>>4;
+			t[1]=st->buf[1]<<4|st->buf[2]>>2;
+			b64_state_init(st);
+			return 2;
+		default:ERET(EINVAL);
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<Uefi.h>
+#include<Library/BaseLib.h>
+#include<Library/TimerLib.h>
+#include<Library/PrintLib.h>
+#include<Library/BaseMemoryLib.h>
+#include"uefi.h"
+
+/*
+ * timestamps of the boot phases, taken from the performance counter.
+ * times are microseconds since the counter started, so they also show
+ * how long the firmware took before us. nothing is allocated, marks
+ * past the table size are dropped.
+ */
+#define BOOTTIME_MAX 32
+
+static struct boottime_point{
+	CHAR8 name[24];
+	UINT64 ticks;
+}points[BOOTTIME_MAX];
+static UINTN points_cnt=0;
+
+void boottime_mark(const char*name){
+	struct boottime_point*p;
+	if(!name||points_cnt>=BOOTTIME_MAX)return;
+	p=&points[points_cnt++];
+	p->ticks=GetPerformanceCounter();
+	AsciiStrnCpyS(p->name,sizeof(p->name),name,sizeof(p->name)-1);
+}
+
+UINTN boottime_count(void){
+	return points_cnt;
+}
+
+const char*boottime_get(UINTN idx,UINT64*us){
+	UINT64 s=0,e=0,t;
+	if(idx>=points_cnt)return NULL;
+	if(us){
+		GetPerformanceCounterProperties(&s,&e);
+		t=s>e?s-points[idx].ticks:points[idx].ticks-s;
+		*us=DivU64x32(GetTimeInNanoSecond(t),1000);
+	}
+	return points[idx].name;
+}
+
+UINT64 boottime_elapsed_us(UINT64 start){
+	UINT64 s=0,e=0,now=GetPerformanceCounter();
+	GetPerformanceCounterProperties(&s,&e);
+	return DivU64x32(GetTimeInNanoSecond(s>e?start-now:now-start),1000);
+}
+
+UINTN boottime_dump(CHAR8*buf,UINTN len){
+	UINT64 us;
+	UINTN pos=0,n;
+	const char*name;
+	for(UINTN i=0;(name=boottime_get(i,&us));i++){
+		if(pos>=len)break;
+		n=AsciiSPrint(buf+pos,len-pos,"%a=%lu",name,us);
+		if(pos+n+1>=len)break;
+		pos+=n+1;
+	}
+	return pos;
+}
+
+EFI_STATUS boottime_save(void){
+	UINTN len;
+	CHAR8 buf[BOOTTIME_MAX*48];
+	if(points_cnt<=0)return EFI_NOT_FOUND;
+	if((len=boottime_dump(buf,sizeof(buf)))<=0)return EFI_BUFFER_TOO_SMALL;
+	return efi_setvar(L"BootTime",buf,len);
+}
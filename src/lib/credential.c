@@ -9,40 +9,174 @@
 #define _GNU_SOURCE
 #include<pwd.h>
 #include<grp.h>
+#include<time.h>
+#include<fcntl.h>
 #include<stdio.h>
+#include<stdlib.h>
 #include<string.h>
+#include<unistd.h>
 #include<sys/socket.h>
+#include<sys/inotify.h>
+#include"lock.h"
 #include"pathnames.h"
 #include"system.h"
+#include"defines.h"
+
+/*
+ * name lookups are cached, they run for every logged peer request
+ * users and groups live until /etc/passwd or /etc/group changes (inotify on
+ * /etc, replaced files included), or NAME_TTL seconds without inotify
+ * process names are kept COMM_TTL seconds, then /proc/<pid>/stat is read
+ * again, a pid reused by another process has a new start time
+ */
+#define CACHE_SLOTS 64
+#define NAME_TTL 60
+#define COMM_TTL 5
+
+struct name_slot{
+	bool valid;
+	unsigned int id,gen;
+	time_t expire;
+	unsigned long long start;
+	char name[64];
+};
+
+static mutex_t cache_lock=MUTEX_INITIALIZER;
+static struct name_slot users[CACHE_SLOTS],groups[CACHE_SLOTS],comms[CACHE_SLOTS];
+static unsigned int user_gen=0,group_gen=0;
+static int etc_fd=-2;
+
+static time_t now_sec(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec;
+}
+
+// drain pending inotify events, a change of passwd or group drops its cache
+static void check_etc(){
+	ssize_t r;
+	struct inotify_event*ev;
+	char buf[4096]__attribute__((aligned(__alignof__(struct inotify_event))));
+	if(etc_fd==-2){
+		etc_fd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+		if(etc_fd>=0&&inotify_add_watch(
+			etc_fd,_PATH_ETC,
+			IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_DELETE
+		)<0){
+			close(etc_fd);
+			etc_fd=-1;
+		}
+	}
+	if(etc_fd<0)return;
+	while((r=read(etc_fd,buf,sizeof(buf)))>0)
+		for(char*p=buf;p<buf+r;p+=sizeof(struct inotify_event)+ev->len){
+			ev=(struct inotify_event*)p;
+			if(ev->mask&IN_Q_OVERFLOW)user_gen++,group_gen++;
+			if(ev->len<=0)continue;
+			if(strcmp(ev->name,"passwd")==0)user_gen++;
+			else if(strcmp(ev->name,"group")==0)group_gen++;
+		}
+}
+
+static bool cache_get(struct name_slot*slots,unsigned int id,unsigned int gen,char*buff,size_t size){
+	struct name_slot*s=&slots[id%CACHE_SLOTS];
+	if(!s->valid||s->id!=id||s->gen!=gen||s->expire<now_sec())return false;
+	strncpy(buff,s->name,size-1);
+	return true;
+}
+
+static void cache_put(struct name_slot*slots,unsigned int id,unsigned int gen,const char*name,int ttl){
+	struct name_slot*s=&slots[id%CACHE_SLOTS];
+	if(strlen(name)>=sizeof(s->name))return;
+	s->valid=true,s->id=id,s->gen=gen;
+	s->expire=now_sec()+ttl;
+	strcpy(s->name,name);
+}
 
 char*get_username(uid_t uid,char*buff,size_t size){
+	struct passwd*pw;
 	memset(buff,0,size);
-	struct passwd*pw=getpwuid(uid);
-	if(pw)strncpy(buff,pw->pw_name,size-1);
-	else if(uid==0)strncpy(buff,"root",size-1);
-	else snprintf(buff,size-1,"%d",uid);
+	MUTEX_LOCK(cache_lock);
+	check_etc();
+	if(!cache_get(users,uid,user_gen,buff,size)){
+		if((pw=getpwuid(uid))){
+			strncpy(buff,pw->pw_name,size-1);
+			cache_put(users,uid,user_gen,pw->pw_name,NAME_TTL);
+		}else if(uid==0)strncpy(buff,"root",size-1);
+		else snprintf(buff,size-1,"%d",uid);
+	}
+	MUTEX_UNLOCK(cache_lock);
 	return buff;
 }
 
 char*get_groupname(gid_t gid,char*buff,size_t size){
+	struct group*gr;
 	memset(buff,0,size);
-	struct group*gr=getgrgid(gid);
-	if(gr)strncpy(buff,gr->gr_name,size-1);
-	else if(gid==0)strncpy(buff,"root",size-1);
-	else snprintf(buff,size-1,"%d",gid);
+	MUTEX_LOCK(cache_lock);
+	check_etc();
+	if(!cache_get(groups,gid,group_gen,buff,size)){
+		if((gr=getgrgid(gid))){
+			strncpy(buff,gr->gr_name,size-1);
+			cache_put(groups,gid,group_gen,gr->gr_name,NAME_TTL);
+		}else if(gid==0)strncpy(buff,"root",size-1);
+		else snprintf(buff,size-1,"%d",gid);
+	}
+	MUTEX_UNLOCK(cache_lock);
 	return buff;
 }
 
+// comm and start time from one read of /proc/<pid>/stat
+static bool read_stat_comm(pid_t pid,char*comm,size_t size,unsigned long long*start){
+	size_t l;
+	int field=2;
+	char buf[1024],*b,*e;
+	if(read_file(buf,sizeof(buf),false,_PATH_PROC"/%d/stat",pid)<=0)return false;
+
+	// comm may hold any character, it ends at the last parenthesis
+	if(!(b=strchr(buf,'('))||!(e=strrchr(buf,')')))return false;
+	l=MIN((size_t)(e-b-1),size-1);
+	memcpy(comm,b+1,l);
+	comm[l]=0;
+	*start=0;
+	for(char*p=e+1;*p;p++)if(*p==' '&&++field==22){
+		*start=strtoull(p+1,NULL,10);
+		break;
+	}
+	return true;
+}
+
+static bool lookup_comm(pid_t pid,char*buff,size_t size){
+	char comm[64];
+	unsigned long long start;
+	struct name_slot*s=&comms[pid%CACHE_SLOTS];
+	MUTEX_LOCK(cache_lock);
+	if(s->valid&&s->id==(unsigned int)pid&&s->expire>=now_sec()){
+		strncpy(buff,s->name,size-1);
+		MUTEX_UNLOCK(cache_lock);
+		return true;
+	}
+	MUTEX_UNLOCK(cache_lock);
+	if(!read_stat_comm(pid,comm,sizeof(comm),&start))return false;
+	strncpy(buff,comm,size-1);
+	MUTEX_LOCK(cache_lock);
+
+	// same process after the ttl, only extend it
+	if(!(s->valid&&s->id==(unsigned int)pid&&s->start==start))
+		cache_put(comms,pid,0,comm,COMM_TTL);
+	else s->expire=now_sec()+COMM_TTL;
+	s->start=start;
+	MUTEX_UNLOCK(cache_lock);
+	return true;
+}
+
 char*get_commname(pid_t pid,char*buff,size_t size,bool with_pid){
 	if(pid<=0)return NULL;
-	if(read_file(
-		buff,size,false,
-		_PATH_PROC"/%d/comm",pid
-	)<=0)snprintf(buff,size-1,"%d",pid);
+	memset(buff,0,size);
+	if(!lookup_comm(pid,buff,size))snprintf(buff,size-1,"%d",pid);
 	else if(with_pid){
 		char p[16]={0};
 		snprintf(p,15,"[%d]",pid);
-		strncat(buff,p,size-1);
+		strncat(buff,p,size-strlen(buff)-1);
 	}
 	return buff;
 }
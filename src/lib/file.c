@@ -11,15 +11,19 @@
 #include<string.h>
 #include<stdlib.h>
 #include<stdbool.h>
+#include<poll.h>
+#include<time.h>
 #include<dirent.h>
 #include<libgen.h>
 #include<unistd.h>
 #include<sys/stat.h>
+#include<sys/inotify.h>
 #include<sys/ioctl.h>
 #include<sys/sysmacros.h>
 #include<linux/loop.h>
 #include<blkid/blkid.h>
 #include"str.h"
+#include"array.h"
 #include"logger.h"
 #include"system.h"
 #include"defines.h"
@@ -114,16 +118,75 @@ bool is_invalid_path(char*path){
 	return valid;
 }
 
+// watch the nearest existing parent, a new component wakes up the next round
+static void watch_parent(int ifd,const char*path){
+	char buf[PATH_MAX],*p;
+	uint32_t mask=IN_CREATE|IN_MOVED_TO|IN_ATTRIB;
+	strncpy(buf,path,sizeof(buf)-1);
+	buf[sizeof(buf)-1]=0;
+	for(size_t l=strlen(buf);l>1&&buf[l-1]=='/';l--)buf[l-1]=0;
+	for(;;){
+		if(!(p=strrchr(buf,'/'))){
+			inotify_add_watch(ifd,".",mask);
+			break;
+		}
+		if(p==buf)p[1]=0;
+		else p[0]=0;
+		if(inotify_add_watch(ifd,buf,mask)>=0)break;
+		if(p==buf||(errno!=ENOENT&&errno!=ENOTDIR))break;
+	}
+}
+
+int wait_exists_many(char**paths,size_t cnt,long time,long step){
+	char buf[4096];
+	int ifd,r;
+	long left;
+	size_t i;
+	struct timespec start,now;
+	struct pollfd p;
+	if(!paths){
+		errno=EINVAL;
+		return -1;
+	}
+	if(step<=0)step=1000;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+
+	// wake up on inotify events, poll every step for filesystems without them
+	ifd=inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+	for(;;){
+		for(i=0;i<cnt;i++){
+			if(!paths[i])errno=EINVAL;
+			else if(access(paths[i],F_OK)==0)continue;
+			if(errno!=ENOENT){
+				r=-1;
+				goto done;
+			}
+			if(ifd<0)break;
+			watch_parent(ifd,paths[i]);
+			if(access(paths[i],F_OK)!=0)break;
+		}
+		if(i>=cnt){
+			r=0;
+			goto done;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		left=time-((now.tv_sec-start.tv_sec)*1000+(now.tv_nsec-start.tv_nsec)/1000000);
+		if(left<=0)break;
+		left=MIN(left,step);
+		if(ifd<0)usleep(left*1000);
+		else{
+			p.fd=ifd,p.events=POLLIN,p.revents=0;
+			if(poll(&p,1,left)>0)while(read(ifd,buf,sizeof(buf))>0);
+		}
+	}
+	errno=ETIME,r=-2;
+	done:
+	if(ifd>=0)close(ifd);
+	return r;
+}
+
 int wait_exists(char*path,long time,long step){
-	long cur=0;
-	do{
-		if(access(path,F_OK)==0)return 0;
-		if(errno!=ENOENT)return -1;
-		cur+=step;
-		usleep(step*1000);
-	}while(cur<time);
-	errno=ETIME;
-	return -2;
+	return wait_exists_many(&path,1,time,step);
 }
 
 int mkdir_res(char*path){
@@ -156,40 +219,118 @@ int remove_folders(int dfd,int flags){
 	return 0;
 }
 
+static const struct{
+	const char*tag,*dir;
+}blk_tags[]={
+	{"LABEL=",     "by-label"},
+	{"UUID=",      "by-uuid"},
+	{"PARTLABEL=", "by-partlabel"},
+	{"PARTUUID=",  "by-partuuid"},
+};
+
+// same escape as udev, slashes and blanks become \xNN
+char*blk_tag_escape(const char*value,char*buf,size_t len){
+	size_t o=0;
+	if(!value||!buf||len<=0)EPRET(EINVAL);
+	for(const char*p=value;*p&&o+5<len;p++){
+		unsigned char c=*p;
+		if(c=='/'||c=='\\'||c<=' '||c==0x7f)
+			o+=snprintf(buf+o,len-o,"\\x%02x",c);
+		else buf[o++]=c;
+	}
+	buf[o]=0;
+	return buf;
+}
+
+char*blk_tag_path(const char*tag,char*buf,size_t len){
+	char val[256];
+	if(!tag||!buf)EPRET(EINVAL);
+	for(size_t i=0;i<ARRLEN(blk_tags);i++){
+		size_t l=strlen(blk_tags[i].tag);
+		if(strncmp(tag,blk_tags[i].tag,l)!=0)continue;
+		blk_tag_escape(tag+l,val,sizeof(val));
+		snprintf(buf,len,_PATH_DEV"/disk/%s/%s",blk_tags[i].dir,val);
+		return buf;
+	}
+	EPRET(ENOENT);
+}
+
+// devd keeps /dev/disk/by-*, blkid is only for trees without it
+char*blk_resolve_tag(const char*tag){
+	char path[PATH_MAX];
+	struct stat st;
+	if(!blk_tag_path(tag,path,sizeof(path)))
+		return blkid_evaluate_tag(tag,NULL,NULL);
+	if(stat(path,&st)==0)return realpath(path,NULL);
+	if(errno!=ENOENT)return NULL;
+	if(access(_PATH_DEV"/disk",F_OK)==0){
+		errno=ENOENT;
+		return NULL;
+	}
+	return blkid_evaluate_tag(tag,NULL,NULL);
+}
+
 int has_block(char*block){
 	char*p=block;
-	if(
-		block[0]!='/'&&
-		!(p=blkid_evaluate_tag(block,NULL,NULL))
-	)return false;
 	struct stat st;
-	if(stat(p,&st)<0)return errno==ENOENT?false:-1;
-	if(!S_ISBLK(st.st_mode)){
-		errno=ENOTBLK;
-		return -1;
+	int r;
+	if(block[0]!='/'&&!(p=blk_resolve_tag(block)))return false;
+	if((r=stat(p,&st))<0)r=errno==ENOENT?false:-1;
+	else if(!S_ISBLK(st.st_mode))r=-1,errno=ENOTBLK;
+	else r=true;
+	if(p!=block)free(p);
+	return r;
+}
+
+static void watch_block_dirs(int ifd){
+	char path[PATH_MAX];
+	uint32_t mask=IN_CREATE|IN_MOVED_TO|IN_ATTRIB;
+	inotify_add_watch(ifd,_PATH_DEV,mask);
+	inotify_add_watch(ifd,_PATH_DEV"/disk",mask);
+	for(size_t i=0;i<ARRLEN(blk_tags);i++){
+		snprintf(path,sizeof(path),_PATH_DEV"/disk/%s",blk_tags[i].dir);
+		inotify_add_watch(ifd,path,mask);
 	}
-	free(p);
-	return true;
 }
 
 int wait_block(char*block,long time,char*tag){
+	char buf[4096];
 	bool msg=false;
-	long t=0;
-	while(time==0||t++<time)switch(has_block(block)){
-		case false:
-			if(tag&&!msg){
-				char x[128]={0};
-				if(time!=0)snprintf(x,127," %ld seconds",time);
-				log_notice(tag,"wait for block %s%s",tag,x);
-				msg=true;
-			}
-			sleep(1);
-		continue;
-		case true:return 0;
-		case -1:return -errno;
+	int ifd,r=-1;
+	long left;
+	struct timespec start,now;
+	struct pollfd p;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+
+	// wake up when devd creates nodes or links, poll once a second for blkid only trees
+	ifd=inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+	for(;;){
+		if(ifd>=0)watch_block_dirs(ifd);
+		switch(has_block(block)){
+			case true:r=0;goto done;
+			case -1:r=-errno;goto done;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		left=time*1000-((now.tv_sec-start.tv_sec)*1000+(now.tv_nsec-start.tv_nsec)/1000000);
+		if(time!=0&&left<=0)break;
+		if(tag&&!msg){
+			char x[128]={0};
+			if(time!=0)snprintf(x,127," %ld seconds",time);
+			log_notice(tag,"wait for block %s%s",block,x);
+			msg=true;
+		}
+		left=time==0?1000:MIN(left,1000);
+		if(ifd<0)usleep(left*1000);
+		else{
+			p.fd=ifd,p.events=POLLIN,p.revents=0;
+			if(poll(&p,1,left)>0)while(read(ifd,buf,sizeof(buf))>0);
+		}
 	}
-	if(tag)log_error(tag,"wait for block %s timed out",tag);
-	ERET(ETIMEDOUT);
+	if(tag)log_error(tag,"wait for block %s timed out",block);
+	errno=ETIMEDOUT,r=-ETIMEDOUT;
+	done:
+	if(ifd>=0)close(ifd);
+	return r;
 }
 
 static ssize_t _fd_read_file(int at,char*buff,size_t len,bool lf,char*path,va_list va){
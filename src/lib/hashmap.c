@@ -0,0 +1,290 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<ctype.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/random.h>
+#include"hashmap.h"
+#include"lock.h"
+
+/*
+ * entries are appended to one array in insertion order, the open
+ * addressing index only holds their positions, so a walk is in
+ * insertion order and a removed entry leaves a hole in the array and a
+ * tombstone in the index. both go away when the index is rebuilt, that
+ * happens when it is three quarters full counting tombstones. string
+ * keys are hashed with siphash-1-3 under a key chosen once per process,
+ * keys from outside cannot be picked to collide. the map has no lock,
+ * removing entries while walking is fine, adding them is not.
+ */
+#define SLOT_EMPTY UINT32_MAX
+#define SLOT_TOMB  (UINT32_MAX-1)
+
+struct hm_ent{
+	uint64_t hash;
+	const void*key;
+	void*value;
+};
+
+struct hashmap{
+	int flags;
+	uint64_t seed[2];
+	struct hm_ent*ents;
+	uint32_t*index;
+	size_t used,cnt,cap,isize;
+};
+
+static mutex_t seed_lock=MUTEX_INITIALIZER;
+static bool seeded=false;
+static uint64_t seed[2];
+
+static void get_seed(uint64_t out[2]){
+	MUTEX_LOCK(seed_lock);
+	if(!seeded){
+		if(getrandom(seed,sizeof(seed),GRND_NONBLOCK)!=sizeof(seed)){
+			seed[0]=(uint64_t)time(NULL)^((uint64_t)getpid()<<32);
+			seed[1]=(uint64_t)(uintptr_t)&seed^(uint64_t)clock();
+		}
+		seeded=true;
+	}
+	out[0]=seed[0],out[1]=seed[1];
+	MUTEX_UNLOCK(seed_lock);
+}
+
+#define ROTL(x,b) (uint64_t)(((x)<<(b))|((x)>>(64-(b))))
+#define SIPROUND do{\
+	v0+=v1,v1=ROTL(v1,13),v1^=v0,v0=ROTL(v0,32);\
+	v2+=v3,v3=ROTL(v3,16),v3^=v2;\
+	v0+=v3,v3=ROTL(v3,21),v3^=v0;\
+	v2+=v1,v1=ROTL(v1,17),v1^=v2,v2=ROTL(v2,32);\
+}while(0)
+
+static uint64_t siphash(const uint8_t*in,size_t len,const uint64_t k[2],bool nocase){
+	uint64_t m,b=(uint64_t)len<<56;
+	uint64_t v0=0x736f6d6570736575ULL^k[0];
+	uint64_t v1=0x646f72616e646f6dULL^k[1];
+	uint64_t v2=0x6c7967656e657261ULL^k[0];
+	uint64_t v3=0x7465646279746573ULL^k[1];
+	size_t i,left=len&7;
+	const uint8_t*end=in+len-left;
+	for(;in!=end;in+=8){
+		for(m=0,i=0;i<8;i++)
+			m|=(uint64_t)(nocase?tolower(in[i]):in[i])<<(i*8);
+		v3^=m;
+		SIPROUND;
+		v0^=m;
+	}
+	for(i=0;i<left;i++)
+		b|=(uint64_t)(nocase?tolower(in[i]):in[i])<<(i*8);
+	v3^=b;
+	SIPROUND;
+	v0^=b,v2^=0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0^v1^v2^v3;
+}
+
+// murmur3 finalizer, pointers need no protection only spreading
+static uint64_t hash_pointer(const void*p){
+	uint64_t h=(uint64_t)(uintptr_t)p;
+	h^=h>>33,h*=0xff51afd7ed558ccdULL;
+	h^=h>>33,h*=0xc4ceb9fe1a85ec53ULL;
+	h^=h>>33;
+	return h;
+}
+
+uint64_t hashmap_hash(const void*buf,size_t len){
+	uint64_t k[2];
+	get_seed(k);
+	return siphash(buf,len,k,false);
+}
+
+static uint64_t key_hash(hashmap*map,const void*key){
+	if(map->flags&HASHMAP_POINTER)return hash_pointer(key);
+	return siphash(key,strlen(key),map->seed,map->flags&HASHMAP_NOCASE);
+}
+
+static bool key_equal(hashmap*map,const void*k1,const void*k2){
+	if(k1==k2)return true;
+	if(map->flags&HASHMAP_POINTER)return false;
+	if(map->flags&HASHMAP_NOCASE)return strcasecmp(k1,k2)==0;
+	return strcmp(k1,k2)==0;
+}
+
+// slot holding key, or SLOT_EMPTY with *ins set to where it would go
+static uint32_t find_slot(hashmap*map,const void*key,uint64_t hash,size_t*ins){
+	size_t mask=map->isize-1,i=hash&mask,tomb=SIZE_MAX;
+	uint32_t s;
+	struct hm_ent*e;
+	if(map->isize<=0){
+		if(ins)*ins=SIZE_MAX;
+		return SLOT_EMPTY;
+	}
+	for(;;i=(i+1)&mask){
+		if((s=map->index[i])==SLOT_EMPTY)break;
+		if(s==SLOT_TOMB){
+			if(tomb==SIZE_MAX)tomb=i;
+			continue;
+		}
+		e=&map->ents[s];
+		if(e->hash==hash&&key_equal(map,e->key,key))return (uint32_t)i;
+	}
+	if(ins)*ins=tomb!=SIZE_MAX?tomb:i;
+	return SLOT_EMPTY;
+}
+
+// drop the holes, size the index for twice the live entries
+static int rebuild(hashmap*map,size_t want){
+	size_t isize=8,j=0;
+	uint32_t*index;
+	struct hm_ent*ents;
+	while(isize<want*2)isize*=2;
+	if(want>=SLOT_TOMB)ERET(ENOMEM);
+	if(!(index=malloc(sizeof(uint32_t)*isize)))ERET(ENOMEM);
+	memset(index,0xff,sizeof(uint32_t)*isize);
+	for(size_t i=0;i<map->used;i++){
+		if(!map->ents[i].key)continue;
+		if(i!=j)map->ents[j]=map->ents[i];
+		j++;
+	}
+	if(want>map->cap){
+		if(!(ents=realloc(map->ents,sizeof(struct hm_ent)*want))){
+			free(index);
+			ERET(ENOMEM);
+		}
+		map->ents=ents,map->cap=want;
+	}
+	map->used=j;
+	for(size_t i=0,k;i<j;i++){
+		for(k=map->ents[i].hash&(isize-1);index[k]!=SLOT_EMPTY;k=(k+1)&(isize-1));
+		index[k]=(uint32_t)i;
+	}
+	if(map->index)free(map->index);
+	map->index=index,map->isize=isize;
+	return 0;
+}
+
+hashmap*hashmap_new(int flags){
+	hashmap*map;
+	if(!(map=malloc(sizeof(hashmap))))EPRET(ENOMEM);
+	memset(map,0,sizeof(hashmap));
+	map->flags=flags;
+	get_seed(map->seed);
+	return map;
+}
+
+void hashmap_clear(hashmap*map,runnable_t*datafree){
+	if(!map)return;
+	for(size_t i=0;i<map->used;i++){
+		struct hm_ent*e=&map->ents[i];
+		if(!e->key)continue;
+		if(datafree&&e->value)datafree(e->value);
+		if(!(map->flags&(HASHMAP_POINTER|HASHMAP_NOCOPY)))
+			free((void*)e->key);
+	}
+	if(map->index)memset(map->index,0xff,sizeof(uint32_t)*map->isize);
+	map->used=0,map->cnt=0;
+}
+
+void hashmap_free(hashmap*map,runnable_t*datafree){
+	if(!map)return;
+	hashmap_clear(map,datafree);
+	if(map->ents)free(map->ents);
+	if(map->index)free(map->index);
+	free(map);
+}
+
+static int insert(hashmap*map,const void*key,void*value,void**old,bool replace){
+	size_t ins;
+	uint32_t s;
+	uint64_t hash;
+	const void*k=key;
+	struct hm_ent*e;
+	if(!map||!key)ERET(EINVAL);
+	hash=key_hash(map,key);
+	if((s=find_slot(map,key,hash,&ins))!=SLOT_EMPTY){
+		e=&map->ents[map->index[s]];
+		if(!replace)ERET(EEXIST);
+		if(old)*old=e->value;
+		e->value=value;
+		return 0;
+	}
+	if(
+		map->used>=map->cap||
+		(map->used+1)*4>map->isize*3
+	){
+		if(rebuild(map,MAX(map->cnt+1,map->cnt*2))<0)return -errno;
+		find_slot(map,key,hash,&ins);
+	}
+	if(!(map->flags&(HASHMAP_POINTER|HASHMAP_NOCOPY))&&!(k=strdup(key)))
+		ERET(ENOMEM);
+	e=&map->ents[map->used];
+	e->hash=hash,e->key=k,e->value=value;
+	map->index[ins]=(uint32_t)map->used++;
+	map->cnt++;
+	if(old)*old=NULL;
+	return 0;
+}
+
+int hashmap_set(hashmap*map,const void*key,void*value,void**old){
+	return insert(map,key,value,old,true);
+}
+
+int hashmap_add(hashmap*map,const void*key,void*value){
+	return insert(map,key,value,NULL,false);
+}
+
+bool hashmap_lookup(hashmap*map,const void*key,void**value){
+	uint32_t s;
+	if(!map||!key||map->cnt<=0)return false;
+	if((s=find_slot(map,key,key_hash(map,key),NULL))==SLOT_EMPTY)return false;
+	if(value)*value=map->ents[map->index[s]].value;
+	return true;
+}
+
+void*hashmap_get(hashmap*map,const void*key){
+	void*value=NULL;
+	return hashmap_lookup(map,key,&value)?value:NULL;
+}
+
+int hashmap_del(hashmap*map,const void*key,void**old){
+	uint32_t s;
+	struct hm_ent*e;
+	if(!map||!key)ERET(EINVAL);
+	if(map->cnt<=0||(s=find_slot(map,key,key_hash(map,key),NULL))==SLOT_EMPTY)
+		ERET(ENOENT);
+	e=&map->ents[map->index[s]];
+	if(old)*old=e->value;
+	if(!(map->flags&(HASHMAP_POINTER|HASHMAP_NOCOPY)))free((void*)e->key);
+	e->key=NULL,e->value=NULL;
+	map->index[s]=SLOT_TOMB;
+	map->cnt--;
+	return 0;
+}
+
+size_t hashmap_count(hashmap*map){
+	return map?map->cnt:0;
+}
+
+bool hashmap_next(hashmap*map,size_t*iter,const void**key,void**value){
+	if(!map||!iter)return false;
+	while(*iter<map->used){
+		struct hm_ent*e=&map->ents[(*iter)++];
+		if(!e->key)continue;
+		if(key)*key=e->key;
+		if(value)*value=e->value;
+		return true;
+	}
+	return false;
+}
@@ -11,6 +11,7 @@
 #include<time.h>
 #include<zlib.h>
 #include<stddef.h>
+#include<stdlib.h>
 #include<string.h>
 #include<stdbool.h>
 #include<microhttpd.h>
@@ -18,12 +19,33 @@
 #include<sys/stat.h>
 #include"regexp.h"
 #include"assets.h"
+#include"lock.h"
 #include"logger.h"
 #include"http.h"
+#include"metrics.h"
 #include"str.h"
 #define TAG "http"
 #define TIME_FMT "%a, %d %b %Y %H:%M:%S GMT"
 
+/*
+ * assets never change, so each compressed variant is made once and
+ * kept here. entries are counted, a response in flight keeps its buffer
+ * even after the slot was reused.
+ */
+#define ZCACHE_MAX 32
+
+struct zbuf{
+	entry_file*file;
+	bool gzip;
+	int refs;
+	size_t len;
+	unsigned char data[];
+};
+
+static mutex_t zcache_lock=MUTEX_INITIALIZER;
+static struct zbuf*zcache[ZCACHE_MAX];
+static size_t zcache_next=0;
+
 struct fd_data{
 	int fd;
 	bool auto_close;
@@ -186,13 +208,39 @@ list*http_get_encodings(struct http_hand_info*i){
 	return items;
 }
 
-bool http_has_deflate(struct http_hand_info*i){
-	list*l=http_get_encodings(i);
-	bool ret=list_search_case_string(l,"deflate")!=NULL;
+bool http_has_encoding(struct http_hand_info*i,const char*enc){
+	list*l,*o;
+	bool ret=false;
+	char*item,*q;
+	size_t len=strlen(enc);
+	if(!i||!enc||!(l=http_get_encodings(i)))return false;
+	if((o=list_first(l)))do{
+		if(!(item=LIST_DATA(o,char*)))continue;
+		if(strncasecmp(item,enc,len)!=0)continue;
+		if(item[len]&&item[len]!=';'&&item[len]!=' ')continue;
+
+		// "gzip;q=0" means the client refuses it
+		if((q=strstr(item+len,"q="))&&strtod(q+2,NULL)<=0)continue;
+		ret=true;
+		break;
+	}while((o=o->next));
 	list_free_all_def(l);
 	return ret;
 }
 
+bool http_has_deflate(struct http_hand_info*i){
+	return http_has_encoding(i,"deflate");
+}
+
+static bool http_mime_compressible(const char*mime){
+	if(strncasecmp(mime,"text/",5)==0)return true;
+	if(strcasecmp(mime,"image/bmp")==0)return true;
+	if(strcasecmp(mime,"application/json")==0)return true;
+	if(strcasecmp(mime,"application/javascript")==0)return true;
+	if(strcasecmp(mime+strlen(mime)-4,"+xml")==0)return true;
+	return false;
+}
+
 bool http_check_can_deflate(
 	struct http_hand_info*i,
 	size_t len,
@@ -200,12 +248,7 @@ bool http_check_can_deflate(
 ){
 	if(len<1024||len>32*1024*1024)return false;
 	if(!http_has_deflate(i))return false;
-	if(strncasecmp(mime,"text/",5)==0)return true;
-	if(strcasecmp(mime,"image/bmp")==0)return true;
-	if(strcasecmp(mime,"application/json")==0)return true;
-	if(strcasecmp(mime,"application/javascript")==0)return true;
-	if(strcasecmp(mime+strlen(mime)-4,"+xml")==0)return true;
-	return false;
+	return http_mime_compressible(mime);
 }
 
 struct MHD_Response*http_create_zlib_response(
@@ -266,39 +309,183 @@ void http_add_file_name_header(
 	);
 }
 
+enum MHD_Result http_check_etag(
+	struct http_hand_info*i,
+	const char*etag
+){
+	const char*val;
+	struct MHD_Response*r;
+	if(!i||!etag)return MHD_NO;
+	if(!(val=MHD_lookup_connection_value(
+		i->conn,MHD_HEADER_KIND,
+		MHD_HTTP_HEADER_IF_NONE_MATCH
+	)))return MHD_NO;
+	if(strcmp(val,"*")!=0&&!strstr(val,etag))return MHD_NO;
+	r=MHD_create_response_from_buffer(0,NULL,MHD_RESPMEM_PERSISTENT);
+	MHD_add_response_header(r,MHD_HTTP_HEADER_ETAG,etag);
+	enum MHD_Result x=MHD_queue_response(i->conn,MHD_HTTP_NOT_MODIFIED,r);
+	MHD_destroy_response(r);
+	return x;
+}
+
+// strong, every encoding of a file is a different representation
+static void asset_etag(entry_file*f,const char*enc,char*buf,size_t len){
+	if(f->crc)snprintf(
+		buf,len,"\"%08x-%zx%s%s\"",
+		f->crc,f->length,enc?"-":"",enc?enc:""
+	);
+	else snprintf(
+		buf,len,"\"%lx.%lx-%zx%s%s\"",
+		(long)f->info.mtime.tv_sec,(long)f->info.mtime.tv_nsec,
+		f->length,enc?"-":"",enc?enc:""
+	);
+}
+
+static void zbuf_put(void*cls){
+	struct zbuf*z=cls;
+	if(!z)return;
+	MUTEX_LOCK(zcache_lock);
+	if(--z->refs<=0)free(z);
+	MUTEX_UNLOCK(zcache_lock);
+}
+
+// len is 0 when compressing did not pay off
+static struct zbuf*zbuf_make(entry_file*f,bool gzip){
+	z_stream zs;
+	struct zbuf*z;
+	size_t bound;
+	memset(&zs,0,sizeof(zs));
+	if(deflateInit2(
+		&zs,9,Z_DEFLATED,
+		gzip?MAX_WBITS+16:MAX_WBITS,
+		9,Z_DEFAULT_STRATEGY
+	)!=Z_OK)return NULL;
+	bound=deflateBound(&zs,f->length);
+	if((z=malloc(sizeof(struct zbuf)+bound))){
+		z->file=f,z->gzip=gzip,z->refs=1,z->len=0;
+		zs.next_in=(Bytef*)f->content,zs.avail_in=f->length;
+		zs.next_out=z->data,zs.avail_out=bound;
+		if(deflate(&zs,Z_FINISH)==Z_STREAM_END&&zs.total_out<f->length)
+			z->len=zs.total_out;
+	}
+	deflateEnd(&zs);
+	return z;
+}
+
+static struct zbuf*zbuf_get(entry_file*f,bool gzip){
+	size_t s;
+	struct zbuf*z,*x;
+	MUTEX_LOCK(zcache_lock);
+	for(s=0;s<ZCACHE_MAX;s++)if(
+		(z=zcache[s])&&
+		z->file==f&&z->gzip==gzip
+	){
+		z->refs++;
+		MUTEX_UNLOCK(zcache_lock);
+		return z;
+	}
+	MUTEX_UNLOCK(zcache_lock);
+	if(!(z=zbuf_make(f,gzip)))return NULL;
+	MUTEX_LOCK(zcache_lock);
+	if((x=zcache[zcache_next])&&--x->refs<=0)free(x);
+	zcache[zcache_next]=z,z->refs++;
+	zcache_next=(zcache_next+1)%ZCACHE_MAX;
+	MUTEX_UNLOCK(zcache_lock);
+	return z;
+}
+
+static void asset_release(void*cls){
+	asset_file_release(cls);
+}
+
+// pick stored gzip, then cached gzip or deflate, or nothing
+static struct MHD_Response*http_create_asset_encoded(
+	struct http_hand_info*i,
+	entry_file*file,
+	const char*mime,
+	const char**enc
+){
+	size_t len;
+	struct zbuf*z;
+	const void*data;
+	bool gzip=http_has_encoding(i,"gzip");
+	if(!gzip&&!http_has_deflate(i))return NULL;
+	if(gzip&&(data=asset_file_get_stored(file,&len))){
+		*enc="gzip";
+		return MHD_create_response_from_buffer(
+			len,(void*)data,MHD_RESPMEM_PERSISTENT
+		);
+	}
+	if(file->length<1024||file->length>32*1024*1024)return NULL;
+	if(!http_mime_compressible(mime))return NULL;
+	if(!(z=zbuf_get(file,gzip)))return NULL;
+	if(z->len<=0){
+		zbuf_put(z);
+		return NULL;
+	}
+	*enc=gzip?"gzip":"deflate";
+	return MHD_create_response_from_buffer_with_free_callback_cls(
+		z->len,z->data,zbuf_put,z
+	);
+}
+
 enum MHD_Result http_ret_assets_file(
 	struct http_hand_info*i,
 	entry_file*file
 ){
 	time_t mt;
-	char mime[128];
+	char mime[128],etag[64];
 	void*buffer=NULL;
+	const char*enc=NULL;
 	int code=MHD_HTTP_OK;
 	size_t len=0,start=0,end=0;
 	struct MHD_Response*r=NULL;
 	if(!i||!file)return MHD_NO;
 	mt=file->info.mtime.tv_sec;
-	if(http_check_last_modify(i,mt)==MHD_YES)
-		return MHD_YES;
-	buffer=file->content,len=file->length,end=len-1;
 	mime_get_by_filename(mime,sizeof(mime),file->info.name);
 	if(http_parse_range(i,&code,file->length,&start,&end))
-		len=end+1-start,buffer+=start;
-	if(code!=MHD_HTTP_OK&&code!=MHD_HTTP_PARTIAL_CONTENT)
-		len=0,buffer=NULL;
-	if(
-		buffer&&http_check_can_deflate(i,len,mime)
-	)r=http_create_zlib_response(
-		buffer,len,MHD_RESPMEM_PERSISTENT
+		len=end+1-start;
+	if(code==MHD_HTTP_OK){
+		if(!(r=http_create_asset_encoded(i,file,mime,&enc)))
+			enc=NULL;
+		asset_etag(file,enc,etag,sizeof(etag));
+		if(
+			http_check_etag(i,etag)==MHD_YES||
+			http_check_last_modify(i,mt)==MHD_YES
+		){
+			if(r)MHD_destroy_response(r);
+			return MHD_YES;
+		}
+	}else asset_etag(file,NULL,etag,sizeof(etag));
+
+	// plain data is sent in place, the hold keeps it until sent
+	if(!r&&(code==MHD_HTTP_OK||code==MHD_HTTP_PARTIAL_CONTENT)){
+		asset_file_hold(file);
+		if(!(buffer=file->content)){
+			asset_file_release(file);
+			return MHD_NO;
+		}
+		if(code==MHD_HTTP_OK)len=file->length;
+		r=MHD_create_response_from_buffer_with_free_callback_cls(
+			len,buffer+start,asset_release,file
+		);
+	}else if(!r)r=MHD_create_response_from_buffer(
+		0,NULL,MHD_RESPMEM_PERSISTENT
 	);
-	if(!r)r=MHD_create_response_from_buffer(
-		len,buffer,MHD_RESPMEM_PERSISTENT
+	if(!r)return MHD_NO;
+	if(enc)MHD_add_response_header(
+		r,MHD_HTTP_HEADER_CONTENT_ENCODING,enc
 	);
-	http_add_range(r,code,start,end,file->length);
+	else http_add_range(r,code,start,end,file->length);
+	MHD_add_response_header(
+		r,MHD_HTTP_HEADER_VARY,
+		MHD_HTTP_HEADER_ACCEPT_ENCODING
+	);
+	MHD_add_response_header(r,MHD_HTTP_HEADER_ETAG,etag);
 	if(code==MHD_HTTP_OK)http_add_time_header(
 		r,MHD_HTTP_HEADER_LAST_MODIFIED,mt
 	);
-	if(buffer){
+	if(code==MHD_HTTP_OK||code==MHD_HTTP_PARTIAL_CONTENT){
 		http_add_file_name_header(r,file->info.name);
 		MHD_add_response_header(
 			r,MHD_HTTP_HEADER_CONTENT_TYPE,mime
@@ -469,6 +656,28 @@ enum MHD_Result http_hand_file(struct http_hand_info*i){
 	return http_ret_file(i,f->name);
 }
 
+enum MHD_Result http_hand_metrics(struct http_hand_info*i){
+	FILE*f;
+	char*buf=NULL;
+	size_t len=0;
+	struct MHD_Response*r;
+	if(!i)return MHD_NO;
+	if(!(f=open_memstream(&buf,&len)))
+		return http_ret_code(i,MHD_HTTP_INTERNAL_SERVER_ERROR);
+	metrics_collect(f);
+	fclose(f);
+	r=MHD_create_response_from_buffer(len,buf,MHD_RESPMEM_MUST_FREE);
+	if(!r){
+		free(buf);
+		return http_ret_code(i,MHD_HTTP_INTERNAL_SERVER_ERROR);
+	}
+	MHD_add_response_header(r,MHD_HTTP_HEADER_CONTENT_TYPE,"text/plain; version=0.0.4");
+	MHD_add_response_header(r,MHD_HTTP_HEADER_CACHE_CONTROL,"no-cache");
+	MHD_queue_response(i->conn,MHD_HTTP_OK,r);
+	MHD_destroy_response(r);
+	return MHD_YES;
+}
+
 enum MHD_Result http_ret_fd_folder(
 	struct http_hand_info*i,
 	int fd,
@@ -0,0 +1,249 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<poll.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/un.h>
+#include<sys/uio.h>
+#include<sys/stat.h>
+#include<sys/socket.h>
+#include"ipc.h"
+#include"defines.h"
+
+int ipc_conn_init(struct ipc_conn*c,int fd,uint8_t magic0,uint8_t magic1){
+	int type=SOCK_STREAM;
+	socklen_t l=sizeof(type);
+	if(!c||fd<0)ERET(EINVAL);
+	memset(c,0,sizeof(struct ipc_conn));
+	if(getsockopt(fd,SOL_SOCKET,SO_TYPE,&type,&l)!=0)type=SOCK_STREAM;
+	c->fd=fd,c->type=type;
+	c->magic0=magic0,c->magic1=magic1;
+	c->next_id=1;
+	return fd;
+}
+
+void ipc_conn_close(struct ipc_conn*c){
+	if(!c||c->fd<0)return;
+	close(c->fd);
+	c->fd=-1,c->have_cred=false;
+}
+
+int ipc_connect(struct ipc_conn*c,const char*path,uint8_t magic0,uint8_t magic1){
+	int fd,type=SOCK_SEQPACKET;
+	struct sockaddr_un un={.sun_family=AF_UNIX};
+	if(!c||!path)ERET(EINVAL);
+	if(strlen(path)>=sizeof(un.sun_path))ERET(ENAMETOOLONG);
+	strcpy(un.sun_path,path);
+	for(;;){
+		if((fd=socket(AF_UNIX,type|SOCK_CLOEXEC,0))<0)return -errno;
+		if(connect(fd,(struct sockaddr*)&un,sizeof(un))==0)break;
+		close(fd);
+
+		// listener is a stream socket (activation socket from initd)
+		if(errno==EPROTOTYPE&&type!=SOCK_STREAM){
+			type=SOCK_STREAM;
+			continue;
+		}
+		return -errno;
+	}
+	return ipc_conn_init(c,fd,magic0,magic1);
+}
+
+int ipc_listen(const char*path,int type,int backlog,mode_t mode){
+	int fd,e;
+	struct sockaddr_un un={.sun_family=AF_UNIX};
+	if(!path)ERET(EINVAL);
+	if(strlen(path)>=sizeof(un.sun_path))ERET(ENAMETOOLONG);
+	strcpy(un.sun_path,path);
+	if((fd=socket(AF_UNIX,type|SOCK_NONBLOCK|SOCK_CLOEXEC,0))<0)return -errno;
+	if(bind(fd,(struct sockaddr*)&un,sizeof(un))<0||listen(fd,backlog)<0){
+		e=errno;
+		close(fd);
+		ERET(e);
+	}
+	if(mode>0)chmod(path,mode);
+	return fd;
+}
+
+int ipc_accept(struct ipc_conn*c,int lfd,uint8_t magic0,uint8_t magic1){
+	int fd;
+	if(!c||lfd<0)ERET(EINVAL);
+	if((fd=accept4(lfd,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC))<0)return -errno;
+	return ipc_conn_init(c,fd,magic0,magic1);
+}
+
+struct ucred*ipc_get_cred(struct ipc_conn*c){
+	socklen_t l=sizeof(struct ucred);
+	if(!c||c->fd<0)EPRET(EINVAL);
+	if(c->have_cred)return &c->cred;
+	if(getsockopt(c->fd,SOL_SOCKET,SO_PEERCRED,&c->cred,&l)!=0)return NULL;
+	c->have_cred=true;
+	return &c->cred;
+}
+
+// wait until fd is ready for events, the socket may be non-blocking
+static int wait_fd(int fd,short events){
+	int r;
+	struct pollfd p={.fd=fd,.events=events};
+	while((r=poll(&p,1,IPC_TIMEOUT))<0&&errno==EINTR);
+	if(r==0)ERET(ETIMEDOUT);
+	return r<0?-1:0;
+}
+
+int ipc_send(struct ipc_conn*c,uint16_t action,uint32_t id,int32_t code,const void*data,size_t len){
+	ssize_t r;
+	size_t off=0,total;
+	struct iovec iov[2];
+	struct msghdr mh={.msg_iov=iov,.msg_iovlen=2};
+	struct ipc_hdr hdr={
+		.magic0=c?c->magic0:0,.magic1=c?c->magic1:0,
+		.action=action,.id=id,.code=code,.len=(uint32_t)len,
+	};
+	if(!c||c->fd<0||(len>0&&!data))ERET(EINVAL);
+	if(len>IPC_MAX_PAYLOAD)ERET(EMSGSIZE);
+	iov[0]=IOVEC(&hdr,sizeof(hdr));
+	iov[1]=IOVEC((void*)data,len);
+	total=sizeof(hdr)+len;
+
+	// a packet goes out whole, a stream may take it in pieces
+	while(off<total){
+		if((r=sendmsg(c->fd,&mh,MSG_NOSIGNAL))<0){
+			if(errno==EINTR)continue;
+			if(errno==EAGAIN&&wait_fd(c->fd,POLLOUT)==0)continue;
+			return -1;
+		}
+		off+=r;
+		while(mh.msg_iovlen>0&&(size_t)r>=mh.msg_iov->iov_len){
+			r-=mh.msg_iov->iov_len;
+			mh.msg_iov++,mh.msg_iovlen--;
+		}
+		if(mh.msg_iovlen>0){
+			mh.msg_iov->iov_base=(char*)mh.msg_iov->iov_base+r;
+			mh.msg_iov->iov_len-=r;
+		}
+	}
+	return 0;
+}
+
+uint32_t ipc_request(struct ipc_conn*c,uint16_t action,int32_t code,const void*data,size_t len){
+	uint32_t id;
+	if(!c){
+		errno=EINVAL;
+		return 0;
+	}
+	if((id=c->next_id++)==0)id=c->next_id++;
+	return ipc_send(c,action,id,code,data,len)==0?id:0;
+}
+
+int ipc_reply(struct ipc_conn*c,struct ipc_hdr*req,uint16_t action,int32_t code,const void*data,size_t len){
+	return ipc_send(c,action,req?req->id:0,code,data,len);
+}
+
+// read exactly len bytes of a stream, the frame has started already
+static int read_full(int fd,void*buf,size_t len){
+	ssize_t r;
+	size_t off=0;
+	char drop[256];
+	while(off<len){
+		r=read(fd,buf?(char*)buf+off:drop,buf?len-off:MIN(len-off,sizeof(drop)));
+		if(r==0)ERET(EPIPE);
+		if(r<0){
+			if(errno==EINTR)continue;
+			if(errno==EAGAIN&&wait_fd(fd,POLLIN)==0)continue;
+			return -1;
+		}
+		off+=r;
+	}
+	return 0;
+}
+
+static int recv_stream(struct ipc_conn*c,struct ipc_hdr*hdr,void*buf,size_t size){
+	ssize_t r;
+	size_t len;
+	while((r=read(c->fd,hdr,sizeof(struct ipc_hdr)))<0&&errno==EINTR);
+	if(r==0){
+		errno=0;
+		return EOF;
+	}
+	if(r<0)return errno==EAGAIN?0:-1;
+	if(
+		(size_t)r<sizeof(struct ipc_hdr)&&
+		read_full(c->fd,(char*)hdr+r,sizeof(struct ipc_hdr)-r)!=0
+	)return -1;
+
+	// framing is lost with a bad magic, the connection is useless
+	if(hdr->magic0!=c->magic0||hdr->magic1!=c->magic1)ERET(EBADMSG);
+	if(hdr->len>IPC_MAX_PAYLOAD)ERET(EBADMSG);
+	len=MIN((size_t)hdr->len,size>0?size-1:0);
+	if(read_full(c->fd,buf,len)!=0)return -1;
+	if(len<hdr->len){
+
+		// too long for the buffer, keep the stream in sync
+		if(read_full(c->fd,NULL,hdr->len-len)!=0)return -1;
+		ERET(EMSGSIZE);
+	}
+	if(buf&&size>0)((char*)buf)[len]=0;
+	return 1;
+}
+
+static int recv_packet(struct ipc_conn*c,struct ipc_hdr*hdr,void*buf,size_t size){
+	ssize_t r;
+	size_t len=size>0?size-1:0;
+	struct iovec iov[2]={IOVEC(hdr,sizeof(struct ipc_hdr)),IOVEC(buf,buf?len:0)};
+	struct msghdr mh={.msg_iov=iov,.msg_iovlen=2};
+	while((r=recvmsg(c->fd,&mh,0))<0&&errno==EINTR);
+	if(r==0){
+		errno=0;
+		return EOF;
+	}
+	if(r<0)return errno==EAGAIN?0:-1;
+	if(mh.msg_flags&MSG_TRUNC)ERET(EMSGSIZE);
+	if((size_t)r<sizeof(struct ipc_hdr))ERET(EBADMSG);
+	if(hdr->magic0!=c->magic0||hdr->magic1!=c->magic1)ERET(EBADMSG);
+	if(hdr->len!=(size_t)r-sizeof(struct ipc_hdr))ERET(EBADMSG);
+	if(buf&&size>0)((char*)buf)[hdr->len]=0;
+	return 1;
+}
+
+int ipc_recv(struct ipc_conn*c,struct ipc_hdr*hdr,void*buf,size_t size){
+	if(!c||!hdr||c->fd<0)ERET(EINVAL);
+	memset(hdr,0,sizeof(struct ipc_hdr));
+	errno=0;
+	return c->type==SOCK_STREAM?
+		recv_stream(c,hdr,buf,size):
+		recv_packet(c,hdr,buf,size);
+}
+
+int ipc_wait(struct ipc_conn*c,uint32_t id,struct ipc_hdr*hdr,void*buf,size_t size){
+	int r;
+	if(!c||!hdr||id==0)ERET(EINVAL);
+	for(;;){
+		if((r=ipc_recv(c,hdr,buf,size))==0){
+			if(wait_fd(c->fd,POLLIN)!=0)return -1;
+			continue;
+		}
+		if(r<0){
+			if(errno==0)errno=EPIPE;
+			return -errno;
+		}
+
+		// reply of an earlier request nobody waits for anymore
+		if(hdr->id!=id)continue;
+		return 0;
+	}
+}
+
+int ipc_call(struct ipc_conn*c,uint16_t action,int32_t code,const void*data,size_t len,struct ipc_hdr*hdr,void*buf,size_t size){
+	uint32_t id;
+	if(!(id=ipc_request(c,action,code,data,len)))return -1;
+	return ipc_wait(c,id,hdr,buf,size);
+}
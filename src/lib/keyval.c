@@ -518,3 +518,65 @@ char*kvlst_get_key_by_value(list*kvs,char*value,char*def){
 	if(!kv)errno=ENOENT;
 	return kv?kv->key:def;
 }
+
+keyval*arena_kv_new_parse(arena*a,const char*line,size_t len,char del){
+	keyval*kv;
+	const char*pos;
+	if(!a||!line)EPRET(EINVAL);
+	if(!(kv=arena_zalloc(a,sizeof(keyval))))return NULL;
+	if((pos=memchr(line,del,len))){
+		if(
+			!(kv->key=arena_strndup(a,line,pos-line))||
+			!(kv->value=arena_strndup(a,pos+1,len-(pos-line)-1))
+		)return NULL;
+	}else if(!(kv->key=arena_strndup(a,line,len)))return NULL;
+	return kv;
+}
+
+keyval**arena_kvarr_new_parse(arena*a,const char*lines,char ldel,char del){
+	size_t s=1,i=0;
+	keyval**kvs;
+	const char*cur,*next;
+	if(!a||!lines)EPRET(EINVAL);
+	if(ldel)for(cur=lines;(cur=strchr(cur,ldel));cur++)s++;
+	if(!(kvs=arena_zalloc(a,sizeof(keyval*)*(s+1))))return NULL;
+	for(cur=lines;cur;cur=next?next+1:NULL){
+		size_t len=(next=ldel?strchr(cur,ldel):NULL)?(size_t)(next-cur):strlen(cur);
+		if(!(kvs[i++]=arena_kv_new_parse(a,cur,len,del)))return NULL;
+	}
+	return kvs;
+}
+
+keyval**arena_kvarr_new_parse_arr(arena*a,char**lines,char del){
+	size_t s;
+	keyval**kvs;
+	if(!a||!lines)EPRET(EINVAL);
+	s=char_array_len(lines);
+	if(!(kvs=arena_zalloc(a,sizeof(keyval*)*(s+1))))return NULL;
+	for(size_t i=0;i<s;i++)
+		if(!(kvs[i]=arena_kv_new_parse(a,lines[i],strlen(lines[i]),del)))
+			return NULL;
+	return kvs;
+}
+
+list*arena_kvlst_parse(arena*a,list*kvs,size_t s,const char*lines,char ldel,char del){
+	keyval*kv,*o;
+	list*item,*last=kvs?list_last(kvs):NULL;
+	const char*cur,*next;
+	size_t i=0,len;
+	if(!a||!lines)EPRET(EINVAL);
+	for(cur=lines;cur&&(s==0||i<s);cur=next?next+1:NULL,i++){
+		len=(next=ldel?strchr(cur,ldel):NULL)?(size_t)(next-cur):strlen(cur);
+		if(!(kv=arena_kv_new_parse(a,cur,len,del)))return NULL;
+		if((o=kvlst_get_by_key(kvs,kv->key,NULL))){
+			o->value=kv->value;
+			continue;
+		}
+		if(!(item=arena_zalloc(a,sizeof(list))))return NULL;
+		item->data=kv;
+		if(last)list_add(last,item);
+		else kvs=item;
+		last=item;
+	}
+	return kvs;
+}
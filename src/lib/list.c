@@ -138,34 +138,30 @@ list*list_last(list*point){
 
 list*list_duplicate(list*lst,list*end){
 	if(!lst)EPRET(EINVAL);
-	list*x,*r;
-	if(
-		!(x=list_first(lst))||
-		!(r=list_new(x->data))
-	)return NULL;
-	while((x=x->next)&&x!=end){
-		if(list_push_new(r,x->data)<0){
-			list_free_all(r,NULL);
+	list*x;
+	struct list_head r=LIST_HEAD_INIT;
+	if(!(x=list_first(lst)))return NULL;
+	do{
+		if(list_head_push_new(&r,x->data)<0){
+			list_head_free_all(&r,NULL);
 			return NULL;
 		}
-	}
-	return r;
+	}while((x=x->next)&&x!=end);
+	return list_head_detach(&r);
 }
 
 list*list_duplicate_chars(list*lst,list*end){
 	if(!lst)EPRET(EINVAL);
-	list*x,*r;
-	if(
-		!(x=list_first(lst))||
-		!(r=list_new_strdup(x->data))
-	)return NULL;
-	while((x=x->next)&&x!=end){
-		if(list_push_new_strdup(r,x->data)<0){
-			list_free_all(r,NULL);
+	list*x;
+	struct list_head r=LIST_HEAD_INIT;
+	if(!(x=list_first(lst)))return NULL;
+	do{
+		if(list_head_push_new_strdup(&r,x->data)<0){
+			list_head_free_all_def(&r);
 			return NULL;
 		}
-	}
-	return r;
+	}while((x=x->next)&&x!=end);
+	return list_head_detach(&r);
 }
 
 list*list_first(list*point){
@@ -288,23 +284,65 @@ int list_obj_del_data(list**lst,void*data,runnable_t*datafree){
 	return item?list_obj_del(lst,item,datafree):-errno;
 }
 
+/*
+ * bottom up merge on the chain itself, runs of k items are merged in
+ * pairs with k doubling each pass, nothing is allocated. sorter true
+ * means the left one goes after the right, equal items keep their order.
+ */
+static list*merge_sort(list*head,list_sorter sorter,list**last){
+	list*tail=NULL,*p,*q,*e;
+	size_t k=1,merges,ps,qs;
+	do{
+		p=head,head=tail=NULL,merges=0;
+		while(p){
+			merges++,q=p,ps=0;
+			while(ps<k&&q)ps++,q=q->next;
+			qs=k;
+			while(ps>0||(qs>0&&q)){
+				if(ps==0||(qs>0&&q&&sorter(p,q)))e=q,q=q->next,qs--;
+				else e=p,p=p->next,ps--;
+				if(tail)tail->next=e;
+				else head=e;
+				e->prev=tail,tail=e;
+			}
+			p=q;
+		}
+		tail->next=NULL;
+		k*=2;
+	}while(merges>1);
+	if(last)*last=tail;
+	return head;
+}
+
 int list_sort(list*lst,list_sorter sorter){
 	if(!lst||!sorter)ERET(EINVAL);
-	int r=0;
 	list*f;
-	bool changed=false;
-	do{
-		changed=false;
-		if(!(f=list_first(lst)))continue;
-		do{
-			if(!f->next)continue;
-			if(!sorter(f,f->next))continue;
-			list_swap_neighbor(f,f->next);
-			changed=true;
-		}while((f=f->next));
-		r++;
-	}while(changed);
-	return r;
+	if(!(f=list_first(lst)))return -errno;
+	if(f->next)merge_sort(f,sorter,NULL);
+	return 0;
+}
+
+/*
+ * each entry starts with the data pointer of its item, so compar gets
+ * what it would get from qsort on an array of the data pointers.
+ */
+int list_sort_array(list*lst,list_compar compar){
+	if(!lst||!compar)ERET(EINVAL);
+	struct sort_ent{void*data;list*item;}*a;
+	size_t cnt=0,i=0;
+	list*f;
+	if(!(f=list_first(lst)))return -errno;
+	for(list*c=f;c;c=c->next)cnt++;
+	if(cnt<2)return 0;
+	if(!(a=malloc(sizeof(struct sort_ent)*cnt)))ERET(ENOMEM);
+	for(list*c=f;c;c=c->next,i++)a[i].data=c->data,a[i].item=c;
+	qsort(a,cnt,sizeof(struct sort_ent),compar);
+	for(i=0;i<cnt;i++){
+		a[i].item->prev=i>0?a[i-1].item:NULL;
+		a[i].item->next=i<cnt-1?a[i+1].item:NULL;
+	}
+	free(a);
+	return 0;
 }
 
 list*list_search_one(list*lst,list_comparator comparator,void*data){
@@ -366,3 +404,95 @@ char*list_string_append(list*lst,char*buff,size_t len,char*sep){
 	}while((l=l->next));
 	return buff;
 }
+
+int list_head_push(struct list_head*head,list*new){
+	size_t cnt=1;
+	list*f,*l;
+	errno=0;
+	if(!head||!new)ERET(EINVAL);
+	if(!(f=list_first(new))||!(l=f))return -errno;
+	while(l->next)l=l->next,cnt++;
+	if(head->last)head->last->next=f,f->prev=head->last;
+	else head->first=f;
+	head->last=l,head->count+=cnt;
+	return 0;
+}
+
+int list_head_push_new(struct list_head*head,void*data){
+	list*new;
+	if(!head)ERET(EINVAL);
+	if(!(new=list_new(data)))return -errno;
+	if(head->last)head->last->next=new,new->prev=head->last;
+	else head->first=new;
+	head->last=new,head->count++;
+	return 0;
+}
+
+int list_head_unshift(struct list_head*head,list*new){
+	size_t cnt=1;
+	list*f,*l;
+	errno=0;
+	if(!head||!new)ERET(EINVAL);
+	if(!(f=list_first(new))||!(l=f))return -errno;
+	while(l->next)l=l->next,cnt++;
+	if(head->first)head->first->prev=l,l->next=head->first;
+	else head->last=l;
+	head->first=f,head->count+=cnt;
+	return 0;
+}
+
+int list_head_unshift_new(struct list_head*head,void*data){
+	list*new;
+	if(!head)ERET(EINVAL);
+	if(!(new=list_new(data)))return -errno;
+	if(head->first)head->first->prev=new,new->next=head->first;
+	else head->last=new;
+	head->first=new,head->count++;
+	return 0;
+}
+
+int list_head_remove(struct list_head*head,list*item){
+	errno=0;
+	if(!head||!item||head->count<=0)ERET(EINVAL);
+	if(head->first==item)head->first=item->next;
+	if(head->last==item)head->last=item->prev;
+	if(item->prev)item->prev->next=item->next;
+	if(item->next)item->next->prev=item->prev;
+	item->prev=NULL,item->next=NULL;
+	head->count--;
+	return 0;
+}
+
+int list_head_del(struct list_head*head,list*item,runnable_t*datafree){
+	if(list_head_remove(head,item)<0)return -errno;
+	return list_free_item(item,datafree);
+}
+
+int list_head_free_all(struct list_head*head,runnable_t*datafree){
+	errno=0;
+	if(!head)ERET(EINVAL);
+	if(head->first)list_free_all(head->first,datafree);
+	head->first=NULL,head->last=NULL,head->count=0;
+	return 0;
+}
+
+int list_head_sort(struct list_head*head,list_sorter sorter){
+	if(!head||!sorter)ERET(EINVAL);
+	if(head->count<2)return 0;
+	head->first=merge_sort(head->first,sorter,&head->last);
+	return 0;
+}
+
+int list_head_attach(struct list_head*head,list*lst){
+	if(!head)ERET(EINVAL);
+	head->first=NULL,head->last=NULL,head->count=0;
+	return lst?list_head_push(head,lst):0;
+}
+
+list*list_head_detach(struct list_head*head){
+	list*l;
+	if(!head)EPRET(EINVAL);
+	l=head->first;
+	head->first=NULL,head->last=NULL,head->count=0;
+	return l;
+}
@@ -0,0 +1,303 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<errno.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#ifdef ENABLE_UEFI
+#include<Library/MemoryAllocationLib.h>
+#include<Library/UefiBootServicesTableLib.h>
+#else
+#include<time.h>
+#include<poll.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<malloc.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/prctl.h>
+#include"system.h"
+#include"pathnames.h"
+#endif
+#include"lock.h"
+#include"logger.h"
+#include"defines.h"
+#include"mempressure.h"
+#define TAG "mempressure"
+#define MEM_SHRINKERS 32
+
+struct mem_shrinker{
+	int id,prio;
+	const char*name;
+	mem_shrink_cb*cb;
+	void*data;
+};
+
+// kept sorted by priority, shrink holds the lock while callbacks run
+static mutex_t shrink_lock=MUTEX_INITIALIZER;
+static struct mem_shrinker shrinkers[MEM_SHRINKERS];
+static size_t shrinker_cnt=0;
+static int shrinker_id=0;
+
+int mem_shrinker_add(const char*name,int prio,mem_shrink_cb*cb,void*data){
+	int id;
+	size_t i;
+	if(!name||!cb)ERET(EINVAL);
+	MUTEX_LOCK(shrink_lock);
+	if(shrinker_cnt>=MEM_SHRINKERS){
+		MUTEX_UNLOCK(shrink_lock);
+		ERET(ENOSPC);
+	}
+	for(i=shrinker_cnt;i>0&&shrinkers[i-1].prio>prio;i--)
+		shrinkers[i]=shrinkers[i-1];
+	id=++shrinker_id;
+	shrinkers[i].id=id,shrinkers[i].prio=prio;
+	shrinkers[i].name=name,shrinkers[i].cb=cb,shrinkers[i].data=data;
+	shrinker_cnt++;
+	MUTEX_UNLOCK(shrink_lock);
+	return id;
+}
+
+void mem_shrinker_del(int id){
+	if(id<=0)return;
+	MUTEX_LOCK(shrink_lock);
+	for(size_t i=0;i<shrinker_cnt;i++){
+		if(shrinkers[i].id!=id)continue;
+		memmove(
+			&shrinkers[i],&shrinkers[i+1],
+			(shrinker_cnt-i-1)*sizeof(struct mem_shrinker)
+		);
+		shrinker_cnt--;
+		break;
+	}
+	MUTEX_UNLOCK(shrink_lock);
+}
+
+const char*mem_pressure2string(enum mem_pressure level){
+	switch(level){
+		case MEM_PRESSURE_NONE:return "none";
+		case MEM_PRESSURE_LOW:return "low";
+		case MEM_PRESSURE_CRITICAL:return "critical";
+		default:return "unknown";
+	}
+}
+
+size_t mem_shrink(enum mem_pressure level){
+	size_t r,total=0;
+	if(level<=MEM_PRESSURE_NONE)return 0;
+	MUTEX_LOCK(shrink_lock);
+	for(size_t i=0;i<shrinker_cnt;i++){
+		r=shrinkers[i].cb(level,shrinkers[i].data);
+		if(r>0)tlog_debug("%s released %zu bytes",shrinkers[i].name,r);
+		total+=r;
+	}
+	MUTEX_UNLOCK(shrink_lock);
+
+	// freed chunks are only worth something once the heap gives them back
+	#ifdef __GLIBC__
+	malloc_trim(0);
+	#endif
+	tlog_info(
+		"%s memory pressure, caches released %zu bytes",
+		mem_pressure2string(level),total
+	);
+	return total;
+}
+
+#ifdef ENABLE_UEFI
+#define MEM_WATERMARK 0x1000000
+
+static size_t watermark=MEM_WATERMARK;
+static enum mem_pressure last_level=MEM_PRESSURE_NONE;
+
+void mem_set_watermark(size_t low){
+	watermark=low;
+}
+
+// free conventional memory, what AllocatePool can still take
+static size_t mem_free_bytes(){
+	UINT32 ver;
+	size_t total=0;
+	EFI_STATUS st;
+	UINTN size=0,key,ds;
+	EFI_MEMORY_DESCRIPTOR*map=NULL,*d;
+	st=gBS->GetMemoryMap(&size,NULL,&key,&ds,&ver);
+	while(st==EFI_BUFFER_TOO_SMALL){
+		if(map)FreePool(map);
+
+		// the allocation itself may split a descriptor
+		size+=ds*4;
+		if(!(map=AllocatePool(size)))return 0;
+		st=gBS->GetMemoryMap(&size,map,&key,&ds,&ver);
+	}
+	if(!EFI_ERROR(st)&&map)for(UINTN i=0;i<size/ds;i++){
+		d=(EFI_MEMORY_DESCRIPTOR*)((UINT8*)map+i*ds);
+		if(d->Type==EfiConventionalMemory)
+			total+=EFI_PAGES_TO_SIZE(d->NumberOfPages);
+	}
+	if(map)FreePool(map);
+	return total;
+}
+
+enum mem_pressure mem_check(){
+	size_t avail;
+	enum mem_pressure level=MEM_PRESSURE_NONE;
+	if(watermark==0||(avail=mem_free_bytes())==0)return level;
+	if(avail<watermark/4)level=MEM_PRESSURE_CRITICAL;
+	else if(avail<watermark)level=MEM_PRESSURE_LOW;
+
+	// below the watermark every check trims again, only a change is logged
+	if(level!=last_level)tlog_notice(
+		"free memory %zu bytes, pressure %s",
+		avail,mem_pressure2string(level)
+	);
+	last_level=level;
+	if(level!=MEM_PRESSURE_NONE)mem_shrink(level);
+	return level;
+}
+#else
+
+/*
+ * psi triggers: some task stalled 300ms in a 2s window is low,
+ * all tasks stalled 200ms in a 2s window is critical, windows of whole
+ * seconds need CAP_SYS_RESOURCE, 2s ones work for any process
+ * without psi, a cgroup v2 memory.events change is used, a new high
+ * event is low, max or oom events are critical
+ * shrinks of the same or a lower level run at most once per second
+ */
+#define PSI_LOW      "some 300000 2000000"
+#define PSI_CRITICAL "full 200000 2000000"
+#define CGROUP_ROOT  _PATH_SYS_FS"/cgroup"
+
+struct mem_events{
+	unsigned long long high,max,oom;
+};
+
+static mutex_t monitor_lock=MUTEX_INITIALIZER;
+static pid_t monitor_pid=0;
+
+static int psi_open(const char*trigger){
+	int fd;
+	if((fd=open(_PATH_PROC"/pressure/memory",O_RDWR|O_NONBLOCK|O_CLOEXEC))<0)return -1;
+	if(write(fd,trigger,strlen(trigger)+1)<0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int cgroup_open(){
+	char buf[1024],path[PATH_MAX],*p,*e;
+
+	// the unified hierarchy line is 0::<path>
+	if(read_file(buf,sizeof(buf),false,_PATH_PROC_SELF"/cgroup")<=0)return -1;
+	for(p=buf;p&&*p;p=e?e+1:NULL){
+		if((e=strchr(p,'\n')))*e=0;
+		if(strncmp(p,"0::",3)!=0)continue;
+		snprintf(path,sizeof(path),CGROUP_ROOT"%s/memory.events",p+3);
+		return open(path,O_RDONLY|O_CLOEXEC);
+	}
+	ERET(ENOENT);
+}
+
+static bool cgroup_read(int fd,struct mem_events*ev){
+	ssize_t r;
+	unsigned long long v;
+	char buf[512],name[32],*p,*e;
+	if((r=pread(fd,buf,sizeof(buf)-1,0))<=0)return false;
+	buf[r]=0;
+	memset(ev,0,sizeof(struct mem_events));
+	for(p=buf;p&&*p;p=e?e+1:NULL){
+		e=strchr(p,'\n');
+		if(sscanf(p,"%31s %llu",name,&v)!=2)continue;
+		if(strcmp(name,"high")==0)ev->high=v;
+		else if(strcmp(name,"max")==0)ev->max=v;
+		else if(strcmp(name,"oom")==0)ev->oom=v;
+	}
+	return true;
+}
+
+static time_t now_sec(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec;
+}
+
+static void*monitor_thread(void*d __attribute__((unused))){
+	int n=0,cg=-1;
+	time_t last=0,now;
+	struct pollfd fds[2];
+	struct mem_events old,cur;
+	enum mem_pressure level,last_level=MEM_PRESSURE_NONE;
+	prctl(PR_SET_NAME,"Memory Monitor",0,0,0);
+	memset(fds,0,sizeof(fds));
+	if((fds[0].fd=psi_open(PSI_LOW))>=0){
+		fds[0].events=POLLPRI,n++;
+		if((fds[1].fd=psi_open(PSI_CRITICAL))>=0)fds[1].events=POLLPRI,n++;
+	}else if((cg=cgroup_open())>=0&&cgroup_read(cg,&old)){
+		fds[0].fd=cg,fds[0].events=POLLPRI,n++;
+		tlog_debug("no psi, watch cgroup memory events");
+	}else{
+		if(cg>=0)close(cg);
+		tlog_notice("no psi or cgroup memory events, memory monitor disabled");
+		MUTEX_LOCK(monitor_lock);
+		monitor_pid=0;
+		MUTEX_UNLOCK(monitor_lock);
+		return NULL;
+	}
+	for(;;){
+		if(poll(fds,n,-1)<0){
+			if(errno==EINTR)continue;
+			telog_warn("poll memory pressure failed");
+			break;
+		}
+		level=MEM_PRESSURE_NONE;
+		if(cg>=0){
+			if(!cgroup_read(cg,&cur))break;
+			if(cur.max>old.max||cur.oom>old.oom)level=MEM_PRESSURE_CRITICAL;
+			else if(cur.high>old.high)level=MEM_PRESSURE_LOW;
+			old=cur;
+		}else{
+			// a trigger gone with its cgroup reports an error
+			if((fds[0].revents|fds[1].revents)&POLLERR)break;
+			if(fds[1].revents&POLLPRI)level=MEM_PRESSURE_CRITICAL;
+			else if(fds[0].revents&POLLPRI)level=MEM_PRESSURE_LOW;
+		}
+		if(level==MEM_PRESSURE_NONE)continue;
+		now=now_sec();
+		if(level<=last_level&&now-last<1)continue;
+		mem_shrink(level);
+		last=now,last_level=level;
+	}
+	for(int i=0;i<n;i++)close(fds[i].fd);
+	tlog_warn("memory monitor stopped");
+	return NULL;
+}
+
+int mem_monitor_start(){
+	pthread_t t;
+	pid_t pid=getpid();
+	MUTEX_LOCK(monitor_lock);
+
+	// a forked child has no thread, even with the pid copied from its parent
+	if(monitor_pid==pid){
+		MUTEX_UNLOCK(monitor_lock);
+		return 0;
+	}
+	if((errno=pthread_create(&t,NULL,monitor_thread,NULL))!=0){
+		MUTEX_UNLOCK(monitor_lock);
+		return terlog_warn(-errno,"start memory monitor thread failed");
+	}
+	pthread_detach(t);
+	monitor_pid=pid;
+	MUTEX_UNLOCK(monitor_lock);
+	return 0;
+}
+#endif
@@ -0,0 +1,308 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<dirent.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/stat.h>
+#include<sys/prctl.h>
+#include"ipc.h"
+#include"str.h"
+#include"array.h"
+#include"logger.h"
+#include"metrics.h"
+#include"defines.h"
+#define TAG "metrics"
+#define METRICS_MAGIC0 0xEF
+#define METRICS_MAGIC1 0x4D
+#define METRICS_GET    0x4D01
+#define METRICS_DATA   0x4D02
+#define METRICS_END    0x4D03
+#define METRICS_CHUNK  60000
+
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_RELAXED)
+#define ADD(v,n) __atomic_add_fetch(&(v),(n),__ATOMIC_RELAXED)
+
+static struct metric*registry=NULL;
+static char served[64]={0};
+static __thread int shard=-1;
+static int next_shard=0;
+
+static void metric_register(struct metric*m){
+	bool f=false;
+	if(!__atomic_compare_exchange_n(&m->registered,&f,true,false,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED))return;
+	m->next=__atomic_load_n(&registry,__ATOMIC_ACQUIRE);
+	while(!__atomic_compare_exchange_n(&registry,&m->next,m,false,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE));
+}
+
+static struct metric_shard*get_shard(struct metric*m){
+	if(!LOAD(m->registered))metric_register(m);
+	if(shard<0)shard=__atomic_fetch_add(&next_shard,1,__ATOMIC_RELAXED)%METRIC_SHARDS;
+	return &m->shards[shard];
+}
+
+uint64_t metric_now_us(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000+(uint64_t)ts.tv_nsec/1000;
+}
+
+void metric_add(struct metric*m,uint64_t val){
+	if(!m)return;
+	ADD(get_shard(m)->count,val);
+}
+
+void metric_set(struct metric*m,int64_t val){
+	if(!m)return;
+	if(!LOAD(m->registered))metric_register(m);
+	__atomic_store_n(&m->gauge,val,__ATOMIC_RELAXED);
+}
+
+void metric_gauge_add(struct metric*m,int64_t val){
+	if(!m)return;
+	if(!LOAD(m->registered))metric_register(m);
+	ADD(m->gauge,val);
+}
+
+void metric_observe(struct metric*m,uint64_t us){
+	int b;
+	struct metric_shard*s;
+	if(!m)return;
+	s=get_shard(m);
+
+	// bucket b holds samples up to 2^b us, larger ones only count for +Inf
+	b=us<=1?0:64-__builtin_clzll(us-1);
+	if(b<METRIC_BUCKETS)ADD(s->buckets[b],1);
+	ADD(s->count,1);
+	ADD(s->sum,us);
+}
+
+static const char*type2name(enum metric_type t){
+	switch(t){
+		case METRIC_COUNTER:return "counter";
+		case METRIC_GAUGE:return "gauge";
+		case METRIC_HISTOGRAM:return "histogram";
+		default:return "untyped";
+	}
+}
+
+static void write_histogram(FILE*f,struct metric*m,const char*lbl,const char*sep){
+	uint64_t cnt=0,sum=0,acc=0,bk[METRIC_BUCKETS]={0};
+	for(int i=0;i<METRIC_SHARDS;i++){
+		cnt+=LOAD(m->shards[i].count);
+		sum+=LOAD(m->shards[i].sum);
+		for(int b=0;b<METRIC_BUCKETS;b++)bk[b]+=LOAD(m->shards[i].buckets[b]);
+	}
+	for(int b=0;b<METRIC_BUCKETS;b++){
+		acc+=bk[b];
+		fprintf(
+			f,"%s_bucket{%s%sle=\"%g\"} %llu\n",
+			m->name,lbl,sep,(double)(1ULL<<b)/1000000,
+			(unsigned long long)acc
+		);
+	}
+	fprintf(f,"%s_bucket{%s%sle=\"+Inf\"} %llu\n",m->name,lbl,sep,(unsigned long long)cnt);
+	fprintf(f,"%s_sum{%s} %g\n",m->name,lbl,(double)sum/1000000);
+	fprintf(f,"%s_count{%s} %llu\n",m->name,lbl,(unsigned long long)cnt);
+}
+
+int metrics_write(FILE*f,const char*process){
+	uint64_t cnt;
+	char lbl[96]={0};
+	struct metric*m;
+	if(!f)ERET(EINVAL);
+	if(process)snprintf(lbl,sizeof(lbl),"process=\"%s\"",process);
+	for(m=__atomic_load_n(&registry,__ATOMIC_ACQUIRE);m;m=m->next){
+		fprintf(f,"# HELP %s %s\n",m->name,m->help?m->help:m->name);
+		fprintf(f,"# TYPE %s %s\n",m->name,type2name(m->type));
+		switch(m->type){
+			case METRIC_COUNTER:
+				cnt=0;
+				for(int i=0;i<METRIC_SHARDS;i++)cnt+=LOAD(m->shards[i].count);
+				fprintf(f,"%s{%s} %llu\n",m->name,lbl,(unsigned long long)cnt);
+			break;
+			case METRIC_GAUGE:
+				fprintf(f,"%s{%s} %lld\n",m->name,lbl,(long long)LOAD(m->gauge));
+			break;
+			case METRIC_HISTOGRAM:
+				write_histogram(f,m,lbl,lbl[0]?",":"");
+			break;
+		}
+	}
+	return 0;
+}
+
+static void serve_client(struct ipc_conn*c){
+	FILE*f;
+	char*buf=NULL;
+	size_t len=0,off,s;
+	struct ipc_hdr hdr;
+	fcntl(c->fd,F_SETFL,fcntl(c->fd,F_GETFL)&~O_NONBLOCK);
+	while(ipc_recv(c,&hdr,NULL,0)>0){
+		if(hdr.action!=METRICS_GET){
+			ipc_reply(c,&hdr,METRICS_END,EINVAL,NULL,0);
+			continue;
+		}
+		if(!(f=open_memstream(&buf,&len))){
+			ipc_reply(c,&hdr,METRICS_END,ENOMEM,NULL,0);
+			continue;
+		}
+		metrics_write(f,served);
+		fclose(f);
+		for(off=0;off<len;off+=s){
+			s=MIN(len-off,METRICS_CHUNK);
+			if(ipc_reply(c,&hdr,METRICS_DATA,0,buf+off,s)!=0)break;
+		}
+		free(buf);
+		buf=NULL,len=0;
+		ipc_reply(c,&hdr,METRICS_END,0,NULL,0);
+	}
+}
+
+static void*metrics_thread(void*d){
+	int lfd=(int)(intptr_t)d;
+	struct ipc_conn c;
+	prctl(PR_SET_NAME,"Metrics Server",0,0,0);
+	fcntl(lfd,F_SETFL,fcntl(lfd,F_GETFL)&~O_NONBLOCK);
+	for(;;){
+		if(ipc_accept(&c,lfd,METRICS_MAGIC0,METRICS_MAGIC1)<0){
+			if(errno==EINTR||errno==EAGAIN||errno==ECONNABORTED)continue;
+			telog_warn("accept metrics client failed");
+			break;
+		}
+		serve_client(&c);
+		ipc_conn_close(&c);
+	}
+	close(lfd);
+	return NULL;
+}
+
+static int fetch(FILE*f,const char*path){
+	int r;
+	uint32_t id;
+	char buf[METRICS_CHUNK+1];
+	struct ipc_conn c;
+	struct ipc_hdr hdr;
+	if((r=ipc_connect(&c,path,METRICS_MAGIC0,METRICS_MAGIC1))<0){
+
+		// the process is gone and left its socket
+		if(errno==ECONNREFUSED)unlink(path);
+		return r;
+	}
+	if(!(id=ipc_request(&c,METRICS_GET,0,NULL,0))){
+		ipc_conn_close(&c);
+		return -1;
+	}
+	while((r=ipc_wait(&c,id,&hdr,buf,sizeof(buf)))==0&&hdr.action==METRICS_DATA)
+		fwrite(buf,1,hdr.len,f);
+	ipc_conn_close(&c);
+	return r;
+}
+
+int metrics_serve(const char*process){
+	int fd;
+	pthread_t t;
+	char path[256];
+	if(!process||!process[0]||strchr(process,'/'))ERET(EINVAL);
+	mkdir(METRICS_DIR,0755);
+	snprintf(path,sizeof(path),METRICS_DIR"/%s.sock",process);
+	unlink(path);
+	if((fd=ipc_listen(path,SOCK_SEQPACKET,4,0600))<0)
+		return terlog_warn(-errno,"listen metrics socket %s failed",path);
+	strlcpy(served,process,sizeof(served));
+	if(pthread_create(&t,NULL,metrics_thread,(void*)(intptr_t)fd)!=0){
+		close(fd);
+		unlink(path);
+		served[0]=0;
+		return terlog_warn(-errno,"start metrics thread failed");
+	}
+	pthread_detach(t);
+	return 0;
+}
+
+// metric family of a sample line (name, name_bucket, name_sum, name_count)
+static bool in_family(const char*line,const char*fam,size_t l){
+	if(strncmp(line,fam,l)!=0)return false;
+	line+=l;
+	return *line=='{'||*line==' '||
+		strncmp(line,"_bucket{",8)==0||
+		strncmp(line,"_sum{",5)==0||
+		strncmp(line,"_count{",7)==0;
+}
+
+/*
+ * every process writes its own HELP and TYPE lines, prometheus wants
+ * each family once, so the samples of all processes are grouped by family
+ */
+static void write_grouped(FILE*f,char**texts,size_t cnt){
+	size_t l,n;
+	char*p,*e,*fam,*q,*qe;
+	for(size_t i=0;i<cnt;i++)for(p=texts[i];p&&*p;p=*e?e+1:e){
+		if(!(e=strchr(p,'\n')))e=p+strlen(p);
+		if(strncmp(p,"# HELP ",7)!=0)continue;
+		fam=p+7;
+		for(l=0;fam+l<e&&fam[l]!=' ';l++);
+		bool seen=false;
+		for(size_t j=0;j<i&&!seen;j++)for(q=texts[j];q&&*q&&!seen;q=*qe?qe+1:qe){
+			if(!(qe=strchr(q,'\n')))qe=q+strlen(q);
+			if(strncmp(q,"# HELP ",7)==0&&strncmp(q+7,fam,l)==0&&q[7+l]==' ')seen=true;
+		}
+		if(seen)continue;
+
+		// HELP and the TYPE line after it
+		n=e-p;
+		if(*e&&strncmp(e+1,"# TYPE ",7)==0){
+			char*te=strchr(e+1,'\n');
+			n=(te?te:e+1+strlen(e+1))-p;
+		}
+		fwrite(p,1,n,f);
+		fputc('\n',f);
+		for(size_t j=i;j<cnt;j++)for(q=texts[j];q&&*q;q=*qe?qe+1:qe){
+			if(!(qe=strchr(q,'\n')))qe=q+strlen(q);
+			if(*q=='#'||!in_family(q,fam,l))continue;
+			fwrite(q,1,qe-q,f);
+			fputc('\n',f);
+		}
+	}
+}
+
+int metrics_collect(FILE*f){
+	DIR*d;
+	FILE*m;
+	size_t l,cnt=0,lens[64];
+	char path[PATH_MAX],*texts[64];
+	struct dirent*e;
+	if(!f)ERET(EINVAL);
+	if(!(d=opendir(METRICS_DIR)))return -errno;
+	while(cnt<ARRLEN(texts)&&(e=readdir(d))){
+		if((l=strlen(e->d_name))<=5||strcmp(e->d_name+l-5,".sock")!=0)continue;
+		texts[cnt]=NULL,lens[cnt]=0;
+		if(!(m=open_memstream(&texts[cnt],&lens[cnt])))continue;
+
+		// our own registry needs no round trip
+		if(served[0]&&strlen(served)==l-5&&strncmp(served,e->d_name,l-5)==0)
+			metrics_write(m,served);
+		else{
+			snprintf(path,sizeof(path),METRICS_DIR"/%s",e->d_name);
+			fetch(m,path);
+		}
+		fclose(m);
+		cnt++;
+	}
+	closedir(d);
+	write_grouped(f,texts,cnt);
+	for(size_t i=0;i<cnt;i++)free(texts[i]);
+	return 0;
+}
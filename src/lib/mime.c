@@ -7,43 +7,89 @@
  */
 
 #include<stdint.h>
+#include<stdlib.h>
 #include"str.h"
+#include"lock.h"
 #include"assets.h"
+#include"hashmap.h"
 #define _MIMES "/usr/share/mime/mime.types"
 #define _MIME_FAIL "application/octet-stream"
 
+/*
+ * mime.types is parsed once into a hash map keyed by the extension
+ * without case. the asset never changes, so the map is kept for the
+ * whole run, keys and types point into a private copy of the file.
+ * the first type listing an extension wins, as the old linear scan did.
+ */
+struct mime_ent{
+	const char*ext;
+	const char*mime;
+};
+
+static mutex_t mime_lock=MUTEX_INITIALIZER;
+static bool mime_loaded=false;
+static char*mime_data=NULL;
+static hashmap*mime_map=NULL;
+
+// split the copy in place into extension and type pairs
+static size_t mime_parse(char*c,struct mime_ent**out){
+	char*line,*next,*mime,*ext,*sp,*p;
+	size_t cnt=0,size=0;
+	struct mime_ent*ents=NULL,*n;
+	for(line=c;line;line=next){
+		if((next=strpbrk(line,"\r\n")))*next++=0;
+		if((p=strchr(line,'#')))*p=0;
+		if(!(mime=strtok_r(line," \t",&sp)))continue;
+		while((ext=strtok_r(NULL," \t",&sp))){
+			if(cnt>=size){
+				size=size?size*2:512;
+				if(!(n=realloc(ents,sizeof(*ents)*size))){
+					if(ents)free(ents);
+					return 0;
+				}
+				ents=n;
+			}
+			ents[cnt].ext=ext,ents[cnt].mime=mime;
+			cnt++;
+		}
+	}
+	*out=ents;
+	return cnt;
+}
+
+static void mime_load(){
+	entry_file*file;
+	size_t cnt;
+	struct mime_ent*ents=NULL;
+	MUTEX_LOCK(mime_lock);
+	if(mime_loaded)goto done;
+	if(!(file=rootfs_get_assets_file(_MIMES)))goto loaded;
+	asset_file_hold(file);
+	if(file->content&&(mime_data=malloc(file->length+1))){
+		memcpy(mime_data,file->content,file->length);
+		mime_data[file->length]=0;
+	}
+	asset_file_release(file);
+	if(!mime_data)goto done;
+	if((cnt=mime_parse(mime_data,&ents))>0){
+		if((mime_map=hashmap_new(HASHMAP_NOCOPY|HASHMAP_NOCASE)))
+			for(size_t i=0;i<cnt;i++)
+				hashmap_add(mime_map,ents[i].ext,(void*)ents[i].mime);
+		free(ents);
+	}
+	loaded:
+	__atomic_store_n(&mime_loaded,true,__ATOMIC_RELEASE);
+	done:
+	MUTEX_UNLOCK(mime_lock);
+}
+
 char*mime_get_by_ext(char*buff,size_t bs,const char*ext){
+	const char*mime;
 	if(!ext||!buff||bs<=0)return NULL;
 	memset(buff,0,bs);
-	entry_file*file=rootfs_get_assets_file(_MIMES);
-	if(!file||!file->content)
-		return strncpy(buff,_MIME_FAIL,bs-1);
-	size_t l=file->length,p=0;
-	char*c=file->content;
-	char buf[512];
-	uint8_t m=0;
-	memset(buf,0,sizeof(buf));
-	for(size_t i=0;i<l;i++)switch(c[i]){
-		case '#':while(i<l&&c[i]!='\r'&&c[i]!='\n')i++;break;
-		case '\r':case '\n':
-			if(m==1&&strcasecmp(buf,ext)==0&&p>0)
-				return buff;
-			memset(buf,0,sizeof(buf));
-			m=0,p=0;
-		break;
-		case '\t':case ' ':
-			if(m==1&&strcasecmp(buf,ext)==0&&p>0)
-				return buff;
-			else if(m==0&&p>0){
-				memset(buff,0,bs);
-				strncpy(buff,buf,bs-1);
-				m=1,p=0;
-			}
-			memset(buf,0,sizeof(buf));
-		break;
-		default:buf[p++]=c[i];break;
-	}
-	return strncpy(buff,_MIME_FAIL,bs-1);
+	if(!__atomic_load_n(&mime_loaded,__ATOMIC_ACQUIRE))mime_load();
+	if(!(mime=hashmap_get(mime_map,ext)))mime=_MIME_FAIL;
+	return strncpy(buff,mime,bs-1);
 }
 
 char*mime_get_by_filename(char*buff,size_t bs,const char*filename){
@@ -0,0 +1,155 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<stdio.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<endian.h>
+#include<string.h>
+#include<unistd.h>
+#include<fnmatch.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include"modalias_index.h"
+#include"assets.h"
+#include"logger.h"
+#include"defines.h"
+#define TAG "kmod"
+
+static const unsigned char*index_map=NULL;
+static size_t index_size=0;
+static bool index_mmap=false;
+static entry_file*index_file=NULL;
+static const unsigned char*nodes,*edges,*values;
+static const char*strings;
+static uint32_t nodes_cnt,edges_cnt,values_cnt,strings_len;
+
+// asset contents have no alignment, so every number is read bytewise
+static inline uint32_t rd32(const unsigned char*p,size_t idx){
+	uint32_t v;
+	memcpy(&v,p+idx*sizeof(uint32_t),sizeof(v));
+	return le32toh(v);
+}
+
+static const char*get_str(uint32_t off){
+	return off<strings_len?strings+off:NULL;
+}
+
+static bool index_check(const unsigned char*map,size_t size){
+	size_t hs=sizeof(struct modalias_index_header),need;
+	if(size<hs)return false;
+	if(rd32(map,0)!=MODALIAS_INDEX_MAGIC||rd32(map,1)!=MODALIAS_INDEX_VERSION)return false;
+	nodes_cnt=rd32(map,2),edges_cnt=rd32(map,3);
+	values_cnt=rd32(map,4),strings_len=rd32(map,5);
+	need=hs+
+		(size_t)nodes_cnt*sizeof(struct modalias_index_node)+
+		(size_t)edges_cnt*sizeof(struct modalias_index_edge)+
+		(size_t)values_cnt*sizeof(struct modalias_index_value)+
+		strings_len;
+	if(need>size||nodes_cnt<=0)return false;
+	nodes=map+hs;
+	edges=nodes+nodes_cnt*sizeof(struct modalias_index_node);
+	values=edges+edges_cnt*sizeof(struct modalias_index_edge);
+	strings=(const char*)values+values_cnt*sizeof(struct modalias_index_value);
+
+	// every string must end inside the pool
+	return strings_len==0||strings[strings_len-1]==0;
+}
+
+static int load_file(const char*path){
+	int fd;
+	void*map;
+	struct stat st;
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))<0)return -errno;
+	if(fstat(fd,&st)<0||st.st_size<=0){
+		close(fd);
+		ERET(EINVAL);
+	}
+	map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if(map==MAP_FAILED)return -errno;
+	if(!index_check(map,st.st_size)){
+		munmap(map,st.st_size);
+		return trlog_warn(-EINVAL,"invalid modalias index %s",path);
+	}
+	index_map=map,index_size=st.st_size,index_mmap=true;
+	return 0;
+}
+
+int modalias_index_load(const char*modsdir){
+	char path[PATH_MAX];
+	entry_file*file;
+	if(index_map)return 0;
+
+	// an index next to the modules belongs to that kernel, prefer it
+	if(modsdir&&modsdir[0]){
+		snprintf(path,sizeof(path)-1,"%s/%s",modsdir,MODALIAS_INDEX_NAME);
+		if(load_file(path)==0)goto done;
+	}
+	if(
+		(file=rootfs_get_assets_file(MODALIAS_INDEX_ASSET))&&
+		S_ISREG(file->info.mode)&&file->content&&
+		index_check((unsigned char*)file->content,file->length)
+	){
+		asset_file_hold(file);
+		index_file=file;
+		index_map=(unsigned char*)file->content;
+		index_size=file->length,index_mmap=false;
+		goto done;
+	}
+	ERET(ENOENT);
+	done:
+	tlog_debug("modalias index with %u patterns loaded",values_cnt);
+	return 0;
+}
+
+void modalias_index_unload(){
+	if(index_map&&index_mmap)munmap((void*)index_map,index_size);
+	if(index_file)asset_file_release(index_file);
+	index_map=NULL,index_size=0,index_mmap=false,index_file=NULL;
+}
+
+static uint32_t find_edge(uint32_t first,uint32_t cnt,unsigned char ch){
+	uint32_t lo=0,hi=cnt,mid,c;
+	if(first>edges_cnt||cnt>edges_cnt-first)return UINT32_MAX;
+	while(lo<hi){
+		mid=(lo+hi)/2;
+		c=rd32(edges,(size_t)(first+mid)*2);
+		if(c==ch)return rd32(edges,(size_t)(first+mid)*2+1);
+		if(c<ch)lo=mid+1;
+		else hi=mid;
+	}
+	return UINT32_MAX;
+}
+
+int modalias_index_lookup(const char*alias,void(*cb)(const char*module,void*data),void*data){
+	int cnt=0;
+	size_t pos=0;
+	uint32_t node=0,vs,vc;
+	const char*pat,*mod;
+	if(!alias||!cb)ERET(EINVAL);
+	if(!index_map)ERET(ENOENT);
+	for(;;){
+		if(node>=nodes_cnt)break;
+
+		// patterns whose literal prefix ends here, the rest goes to fnmatch
+		vs=rd32(nodes,(size_t)node*4+2),vc=rd32(nodes,(size_t)node*4+3);
+		for(uint32_t i=0;i<vc&&vs+i<values_cnt;i++){
+			pat=get_str(rd32(values,(size_t)(vs+i)*2));
+			mod=get_str(rd32(values,(size_t)(vs+i)*2+1));
+			if(!pat||!mod||fnmatch(pat,alias+pos,0)!=0)continue;
+			cb(mod,data);
+			cnt++;
+		}
+		if(!alias[pos])break;
+		if((vs=rd32(nodes,(size_t)node*4+1))<=0)break;
+		node=find_edge(rd32(nodes,(size_t)node*4),vs,(unsigned char)alias[pos++]);
+		if(node==UINT32_MAX)break;
+	}
+	return cnt;
+}
@@ -6,15 +6,29 @@
  *
  */
 
+#include<time.h>
 #include<errno.h>
+#include<stdint.h>
+#include<stdlib.h>
 #include<stdio.h>
 #include<string.h>
+#include<pthread.h>
 #include<libkmod.h>
+#include<sys/sysinfo.h>
 #include<sys/utsname.h>
+#include"lock.h"
 #include"logger.h"
 #include"defines.h"
 #include"pathnames.h"
+#include"modalias_index.h"
 #define TAG "kmod"
+#define WAVE_WALKING -2
+
+// modules one alias resolves to at most
+#define MAX_FOUND 32
+
+// insert time that is worth an info line
+#define SLOW_MS 100
 
 static char modsdir[PATH_MAX]={0};
 
@@ -55,22 +69,92 @@ static struct kmod_ctx*_new_context_mods(bool log){
 	struct kmod_ctx*ctx=_new_context();
 	if(!ctx)return NULL;
 	kmod_load_resources(ctx);
+	modalias_index_load(modsdir);
 	return ctx;
 }
 
-static bool _is_module_loaded(struct kmod_ctx*ctx,const char*name){
-	if(!ctx||!name)return false;
-	if(access(_PATH_PROC_MODULES,R_OK)!=0)return false;
-	bool used=false;
-	struct kmod_list*list,*itr;
-	kmod_module_new_from_loaded(ctx,&list);
-	kmod_list_foreach(itr,list){
-		struct kmod_module*mod=kmod_module_get_module(itr);
-		if(strcmp(name,kmod_module_get_name(mod))==0)used=true;
-		kmod_module_unref(mod);
+/*
+ * one context lives as long as the process, so index files are loaded once.
+ * loaded modules and looked up aliases are kept in string sets, coldplug
+ * sees the same alias for many devices and only the first one does work.
+ */
+struct str_set{
+	size_t size,used;
+	char**slots;
+};
+
+static struct kmod_ctx*shared_ctx=NULL,**worker_ctxs=NULL;
+static size_t worker_cnt=0;
+static struct str_set loaded={0},aliases={0},missing={0};
+static bool loaded_read=false;
+static mutex_t kmod_lock;
+
+static uint32_t str_hash(const char*s){
+	uint32_t h=0x811c9dc5;
+	while(*s)h=(h^(unsigned char)*s++)*0x01000193;
+	return h;
+}
+
+static char**set_slot(struct str_set*set,const char*s){
+	size_t i=str_hash(s)&(set->size-1);
+	while(set->slots[i]&&strcmp(set->slots[i],s)!=0)i=(i+1)&(set->size-1);
+	return &set->slots[i];
+}
+
+static bool set_has(struct str_set*set,const char*s){
+	return set->size>0&&*set_slot(set,s);
+}
+
+static int set_add(struct str_set*set,const char*s){
+	char**slot,**old=set->slots;
+	size_t os=set->size;
+	if(set->size>0&&*set_slot(set,s))return 0;
+	if((set->used+1)*4>=set->size*3){
+		size_t ns=os?os*2:256;
+		if(!(set->slots=calloc(ns,sizeof(char*)))){
+			set->slots=old;
+			ERET(ENOMEM);
+		}
+		set->size=ns;
+		for(size_t i=0;i<os;i++)if(old[i])*set_slot(set,old[i])=old[i];
+		if(old)free(old);
 	}
-	kmod_module_unref_list(list);
-	return used;
+	slot=set_slot(set,s);
+	if(!(*slot=strdup(s)))ERET(ENOMEM);
+	set->used++;
+	return 0;
+}
+
+static void set_free(struct str_set*set){
+	for(size_t i=0;i<set->size;i++)if(set->slots[i])free(set->slots[i]);
+	if(set->slots)free(set->slots);
+	memset(set,0,sizeof(struct str_set));
+}
+
+// read /proc/modules once, later inserts are added by ourselves
+static void read_loaded(){
+	FILE*f;
+	char line[512];
+	if(loaded_read)return;
+	loaded_read=true;
+	if(!(f=fopen(_PATH_PROC_MODULES,"re")))return;
+	while(fgets(line,sizeof(line),f)){
+		line[strcspn(line," \t\n")]=0;
+		if(line[0])set_add(&loaded,line);
+	}
+	fclose(f);
+}
+
+static void mark_loaded(struct kmod_module*mod){
+	struct kmod_list*deps,*itr;
+	set_add(&loaded,kmod_module_get_name(mod));
+	if(!(deps=kmod_module_get_dependencies(mod)))return;
+	kmod_list_foreach(itr,deps){
+		struct kmod_module*dep=kmod_module_get_module(itr);
+		set_add(&loaded,kmod_module_get_name(dep));
+		kmod_module_unref(dep);
+	}
+	kmod_module_unref_list(deps);
 }
 
 static void _mod_load_err(bool log,int err,const char*name){
@@ -81,36 +165,333 @@ static void _mod_load_err(bool log,int err,const char*name){
 	}
 }
 
+static bool is_blacklisted(struct kmod_ctx*ctx,const char*name){
+	bool r=false;
+	struct kmod_config_iter*iter;
+	if(!(iter=kmod_config_get_blacklists(ctx)))return false;
+	while(!r&&kmod_config_iter_next(iter))
+		r=strcmp(kmod_config_iter_get_key(iter),name)==0;
+	kmod_config_iter_free_iter(iter);
+	return r;
+}
+
+struct found{
+	struct kmod_ctx*ctx;
+	struct kmod_module*mods[MAX_FOUND];
+	size_t cnt;
+};
+
+static void found_module(const char*name,void*d){
+	struct found*f=d;
+	struct kmod_module*mod=NULL;
+	if(f->cnt>=MAX_FOUND)return;
+	if(kmod_module_new_from_name(f->ctx,name,&mod)<0||!mod)return;
+	for(size_t i=0;i<f->cnt;i++)if(f->mods[i]==mod){
+		kmod_module_unref(mod);
+		return;
+	}
+	if(is_blacklisted(f->ctx,kmod_module_get_name(mod))){
+		kmod_module_unref(mod);
+		return;
+	}
+	f->mods[f->cnt++]=mod;
+}
+
+/*
+ * modules of an alias, blacklist applied like KMOD_PROBE_APPLY_BLACKLIST_ALIAS_ONLY.
+ * the precomputed index needs no modules.alias parse, kmod lookup is the fallback
+ * for a missing or older index.
+ */
+static size_t find_modules(struct kmod_ctx*ctx,const char*alias,struct found*f){
+	struct kmod_list*l,*list=NULL,*filtered=NULL;
+	f->ctx=ctx,f->cnt=0;
+	if(modalias_index_lookup(alias,found_module,f)>0&&f->cnt>0)return f->cnt;
+	if(kmod_module_new_from_lookup(ctx,alias,&list)<0||!list)return 0;
+	if(kmod_module_apply_filter(ctx,KMOD_FILTER_BLACKLIST,list,&filtered)<0)
+		filtered=NULL;
+	kmod_list_foreach(l,filtered)
+		if(f->cnt<MAX_FOUND)f->mods[f->cnt++]=kmod_module_get_module(l);
+	if(filtered)kmod_module_unref_list(filtered);
+	kmod_module_unref_list(list);
+	return f->cnt;
+}
+
 static int _insmod(struct kmod_ctx*ctx,const char*alias,bool log){
-	struct kmod_list*l,*list=NULL;
-	int err,flags=0;
-	err=kmod_module_new_from_lookup(ctx,alias,&list);
-	if(!list||err<0)ERET(ENOENT);
-	flags|=KMOD_PROBE_APPLY_BLACKLIST_ALIAS_ONLY;
-	kmod_list_foreach(l,list){
-		struct kmod_module*mod=kmod_module_get_module(l);
+	int err=0;
+	struct found f;
+	if(find_modules(ctx,alias,&f)<=0)ERET(ENOENT);
+	for(size_t i=0;i<f.cnt;i++){
+		struct kmod_module*mod=f.mods[i];
 		const char*name=kmod_module_get_name(mod);
-		if(!_is_module_loaded(ctx,name)){
+		if(!set_has(&loaded,name)){
 			if((err=kmod_module_probe_insert_module(
 				mod,
-				flags,
+				0,
 				NULL,
 				NULL,
 				NULL,
 				NULL
 			))<0)_mod_load_err(log,err,name);
+			if(err>=0||err==-EEXIST)mark_loaded(mod);
 			err=MIN(0,err);
 		}
 		kmod_module_unref(mod);
 	}
-	kmod_module_unref_list(list);
 	return err;
 }
 
 int insmod(const char*alias,bool log){
-	struct kmod_ctx*ctx=_new_context_mods(log);
-	if(!ctx)return -1;
-	int r=_insmod(ctx,alias,log);
-	kmod_unref(ctx);
+	int r=0;
+	if(!alias)ERET(EINVAL);
+	MUTEX_LOCK(kmod_lock);
+	if(!shared_ctx&&!(shared_ctx=_new_context_mods(log))){
+		MUTEX_UNLOCK(kmod_lock);
+		return -1;
+	}
+	read_loaded();
+
+	// same alias again, the result can only be the same
+	if(set_has(&missing,alias))r=-ENOENT,errno=ENOENT;
+	else if(!set_has(&aliases,alias)){
+		r=_insmod(shared_ctx,alias,log);
+		set_add(r==-ENOENT?&missing:&aliases,alias);
+	}
+	MUTEX_UNLOCK(kmod_lock);
+	return r;
+}
+
+static void drop_contexts(){
+	if(shared_ctx)kmod_unref(shared_ctx);
+	for(size_t i=0;i<worker_cnt;i++)if(worker_ctxs[i])kmod_unref(worker_ctxs[i]);
+	if(worker_ctxs)free(worker_ctxs);
+	modalias_index_unload();
+	shared_ctx=NULL,worker_ctxs=NULL,worker_cnt=0;
+	loaded_read=false;
+	set_free(&loaded);
+	set_free(&aliases);
+	set_free(&missing);
+}
+
+void insmod_reset(){
+	MUTEX_LOCK(kmod_lock);
+	drop_contexts();
+	MUTEX_UNLOCK(kmod_lock);
+}
+
+/*
+ * batch insert for coldplug: resolve all aliases first, then insert in waves.
+ * a module is in the wave after all its depends, so one wave has no depends
+ * between its modules and can be inserted by several threads at once.
+ */
+struct mod_ent{
+	char*name;
+	int wave,err;
+	long ms;
+	bool soft;
+};
+
+struct mod_table{
+	struct mod_ent*ents;
+	size_t cnt,size;
+};
+
+struct wave_worker{
+	struct kmod_ctx*ctx;
+	struct mod_table*tbl;
+	size_t*order,cnt,*next;
+	bool log;
+};
+
+static ssize_t table_find(struct mod_table*tbl,const char*name){
+	for(size_t i=0;i<tbl->cnt;i++)
+		if(strcmp(tbl->ents[i].name,name)==0)return (ssize_t)i;
+	return -1;
+}
+
+// wave of a module, -1 when it is loaded already
+static int table_add(struct mod_table*tbl,struct kmod_module*mod,bool soft){
+	ssize_t i;
+	int wave=0;
+	struct mod_ent*e;
+	struct kmod_list*deps,*itr,*pre=NULL,*post=NULL;
+	const char*name=kmod_module_get_name(mod);
+	if(set_has(&loaded,name))return -1;
+	if((i=table_find(tbl,name))>=0){
+		if(!soft)tbl->ents[i].soft=false;
+		return tbl->ents[i].wave==WAVE_WALKING?0:tbl->ents[i].wave;
+	}
+	if(tbl->cnt>=tbl->size){
+		size_t ns=tbl->size?tbl->size*2:64;
+		if(!(e=realloc(tbl->ents,sizeof(struct mod_ent)*ns)))return 0;
+		tbl->ents=e,tbl->size=ns;
+	}
+	if(!(name=strdup(name)))return 0;
+	i=(ssize_t)tbl->cnt++;
+	tbl->ents[i].name=(char*)name;
+	tbl->ents[i].wave=WAVE_WALKING;
+	tbl->ents[i].err=0,tbl->ents[i].ms=0;
+	tbl->ents[i].soft=soft;
+	if((deps=kmod_module_get_dependencies(mod))){
+		kmod_list_foreach(itr,deps){
+			struct kmod_module*dep=kmod_module_get_module(itr);
+			wave=MAX(wave,table_add(tbl,dep,soft)+1);
+			kmod_module_unref(dep);
+		}
+		kmod_module_unref_list(deps);
+	}
+
+	// softdep pre modules are ordering hints, they may be missing
+	if(kmod_module_get_softdeps(mod,&pre,&post)==0){
+		kmod_list_foreach(itr,pre){
+			struct kmod_module*dep=kmod_module_get_module(itr);
+			wave=MAX(wave,table_add(tbl,dep,true)+1);
+			kmod_module_unref(dep);
+		}
+		if(pre)kmod_module_unref_list(pre);
+		if(post)kmod_module_unref_list(post);
+	}
+	tbl->ents[i].wave=wave;
+	return wave;
+}
+
+static void resolve_alias(struct mod_table*tbl,const char*alias,bool fresh){
+	struct found f;
+	if(!fresh&&(set_has(&missing,alias)||set_has(&aliases,alias)))return;
+	if(find_modules(shared_ctx,alias,&f)<=0){
+		set_add(&missing,alias);
+		return;
+	}
+	set_add(&aliases,alias);
+	for(size_t i=0;i<f.cnt;i++){
+		table_add(tbl,f.mods[i],false);
+		kmod_module_unref(f.mods[i]);
+	}
+}
+
+static void*wave_insert(void*d){
+	int err;
+	size_t i;
+	struct timespec ts,te;
+	struct kmod_module*mod;
+	struct wave_worker*w=d;
+	while((i=__atomic_fetch_add(w->next,1,__ATOMIC_RELAXED))<w->cnt){
+		struct mod_ent*e=&w->tbl->ents[w->order[i]];
+		if((err=kmod_module_new_from_name(w->ctx,e->name,&mod))<0){
+			e->err=err;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		err=kmod_module_probe_insert_module(mod,0,NULL,NULL,NULL,NULL);
+		clock_gettime(CLOCK_MONOTONIC,&te);
+		e->ms=(te.tv_sec-ts.tv_sec)*1000+(te.tv_nsec-ts.tv_nsec)/1000000;
+		if(err<0&&err!=-EEXIST)_mod_load_err(w->log&&!e->soft,err,e->name);
+		e->err=err==-EEXIST||e->soft?0:MIN(0,err);
+		kmod_module_unref(mod);
+	}
+	return NULL;
+}
+
+// insert one wave, every thread owns a context since kmod_ctx is not thread safe
+static void run_wave(struct wave_worker*ws,size_t nws,struct mod_table*tbl,size_t*order,size_t cnt,bool log){
+	size_t next=0,n=MIN(nws,cnt);
+	pthread_t*ts=malloc(sizeof(pthread_t)*n);
+	bool*started=calloc(n,sizeof(bool));
+	for(size_t i=0;i<n;i++){
+		ws[i].tbl=tbl,ws[i].order=order;
+		ws[i].cnt=cnt,ws[i].next=&next,ws[i].log=log;
+		if(i>0&&ts&&started)started[i]=pthread_create(&ts[i],NULL,wave_insert,&ws[i])==0;
+	}
+	wave_insert(&ws[0]);
+	for(size_t i=1;i<n;i++)if(ts&&started&&started[i])pthread_join(ts[i],NULL);
+	if(ts)free(ts);
+	if(started)free(started);
+}
+
+// contexts of the other workers are kept like the shared one
+static size_t get_workers(struct wave_worker*ws,size_t nws){
+	struct kmod_ctx**n;
+	if(nws>worker_cnt+1){
+		if(!(n=realloc(worker_ctxs,sizeof(struct kmod_ctx*)*(nws-1))))nws=worker_cnt+1;
+		else{
+			worker_ctxs=n;
+			while(worker_cnt<nws-1){
+				if(!(worker_ctxs[worker_cnt]=_new_context_mods(false)))break;
+				worker_cnt++;
+			}
+			nws=MIN(nws,worker_cnt+1);
+		}
+	}
+	ws[0].ctx=shared_ctx;
+	for(size_t i=1;i<nws;i++)ws[i].ctx=worker_ctxs[i-1];
+	return nws;
+}
+
+/*
+ * fresh is for a modprobe of a user, depmod may have run and modules may
+ * have been removed since the last request, the contexts are checked,
+ * the loaded modules are read again and alias results are not reused.
+ */
+static int batch_insert(char**list,size_t cnt,bool log,bool fresh){
+	int r=0,waves=0,*width=NULL;
+	size_t nws,wide=0,*order=NULL,oc;
+	struct mod_table tbl={0};
+	struct wave_worker*ws=NULL;
+	if(!list)ERET(EINVAL);
+	MUTEX_LOCK(kmod_lock);
+	if(fresh&&shared_ctx){
+		if(kmod_validate_resources(shared_ctx)!=KMOD_RESOURCES_OK)drop_contexts();
+		loaded_read=false;
+		set_free(&loaded);
+	}
+	if(!shared_ctx&&!(shared_ctx=_new_context_mods(log))){
+		MUTEX_UNLOCK(kmod_lock);
+		return -1;
+	}
+	read_loaded();
+	for(size_t i=0;i<cnt;i++)if(list[i])resolve_alias(&tbl,list[i],fresh);
+	if(tbl.cnt<=0)goto done;
+	for(size_t i=0;i<tbl.cnt;i++)waves=MAX(waves,tbl.ents[i].wave+1);
+	if(!(width=calloc(waves,sizeof(int)))){
+		r=-ENOMEM;
+		goto done;
+	}
+	for(size_t i=0;i<tbl.cnt;i++)wide=MAX(wide,(size_t)++width[tbl.ents[i].wave]);
+	free(width);
+
+	// no more threads than the widest wave can use
+	nws=MIN((size_t)MAX(1,get_nprocs()),wide);
+	if(!(order=malloc(sizeof(size_t)*tbl.cnt))||!(ws=calloc(nws,sizeof(struct wave_worker)))){
+		r=-ENOMEM;
+		goto done;
+	}
+	nws=get_workers(ws,nws);
+	tlog_debug("insert %zu modules in %d waves with %zu threads",tbl.cnt,waves,nws);
+	for(int w=0;w<waves;w++){
+		oc=0;
+		for(size_t i=0;i<tbl.cnt;i++)if(tbl.ents[i].wave==w)order[oc++]=i;
+		if(oc>0)run_wave(ws,nws,&tbl,order,oc,log);
+	}
+	for(size_t i=0;i<tbl.cnt;i++){
+		struct mod_ent*e=&tbl.ents[i];
+		if(e->ms>=SLOW_MS)tlog_info("module %s took %ldms to insert",e->name,e->ms);
+		else if(e->err==0)tlog_debug("module %s inserted in %ldms",e->name,e->ms);
+		if(e->err==0)set_add(&loaded,e->name);
+		else if(r==0)r=e->err;
+	}
+	done:
+	if(ws)free(ws);
+	if(order)free(order);
+	for(size_t i=0;i<tbl.cnt;i++)free(tbl.ents[i].name);
+	if(tbl.ents)free(tbl.ents);
+	MUTEX_UNLOCK(kmod_lock);
+	if(r<0)errno=-r;
 	return r;
 }
+
+int insmod_batch(char**list,size_t cnt,bool log){
+	return batch_insert(list,cnt,log,false);
+}
+
+int modprobe_batch(char**list,size_t cnt,bool log){
+	return batch_insert(list,cnt,log,true);
+}
@@ -6,15 +6,24 @@
  *
  */
 
+#define _GNU_SOURCE
+#include<poll.h>
 #include<errno.h>
+#include<ctype.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<limits.h>
 #include<stdlib.h>
 #include<string.h>
 #include<sys/stat.h>
 #include<libmount/libmount.h>
 #include"str.h"
+#include"lock.h"
 #include"logger.h"
 #include"system.h"
 #include"array.h"
+#include"trace.h"
 #include"defines.h"
 #define TAG "mount"
 
@@ -47,8 +56,10 @@ int xmount(bool ex,const char*dev,const char*dir,const char*type,const char*data
 		mnt_free_context(cxt);
 		return -1;
 	}
+	trace_begin("mount","mount %s",dir);
 	int ec=mnt_context_mount(cxt);
 	er=errno;
+	trace_end("mount","mount %s",dir);
 	r=mnt_context_get_excode(cxt,ec,buf,sizeof(buf));
 	mnt_free_context(cxt);
 	snprintf(
@@ -68,48 +79,153 @@ int xmount(bool ex,const char*dev,const char*dir,const char*type,const char*data
 	return r;
 }
 
-static struct mount_item**_array_add_entry(struct mount_item**array,struct mount_item*entry){
-	size_t idx=0,s;
-	if(array)while(array[idx++]);
-	else idx++;
-	s=sizeof(struct mount_item*)*(idx+1);
-	if(!(array=array?realloc(array,s):malloc(s)))return NULL;
-	array[idx-1]=entry;
-	array[idx]=NULL;
-	return array;
+/*
+ * the text of /proc/self/mounts is cached per process, the kernel renders
+ * the whole table on every read, which is the expensive part
+ * the kept fd reports POLLPRI after any mount table change, a forked child
+ * or a reused fd number (close_all_fd) reopens it
+ */
+static struct{
+	mutex_t lock;
+	int fd;
+	pid_t pid;
+	dev_t dev;
+	ino_t ino;
+	char*buf;
+	size_t len,size;
+}mounts={.lock=MUTEX_INITIALIZER,.fd=-1};
+
+static int mounts_open(){
+	struct stat st;
+	bool same=mounts.fd>=0&&fstat(mounts.fd,&st)==0&&
+		st.st_dev==mounts.dev&&st.st_ino==mounts.ino;
+	if(same&&mounts.pid==getpid())return 1;
+
+	// a forked child shares the poll state with its parent, a reused fd is not ours
+	if(same)close(mounts.fd);
+	mounts.fd=-1,mounts.len=0;
+	if((mounts.fd=open(_PATH_PROC_SELF"/mounts",O_RDONLY|O_CLOEXEC))<0)return -1;
+	if(fstat(mounts.fd,&st)!=0){
+		close(mounts.fd);
+		mounts.fd=-1;
+		return -1;
+	}
+	mounts.pid=getpid(),mounts.dev=st.st_dev,mounts.ino=st.st_ino;
+	return 0;
 }
 
-struct mount_item**read_proc_mounts(){
-	FILE*f=fopen(_PATH_PROC_SELF"/mounts","r");
-	if(!f)return NULL;
-	size_t bs=sizeof(struct mount_item);
-	struct mount_item**array=NULL,**arr,*buff;
-	char line[BUFFER_SIZE];
-	while(!feof(f)){
-		memset(line,0,BUFSIZ);
-		fgets(line,BUFFER_SIZE,f);
-		if(!line[0])continue;
-		char**c=args2array(line,0);
-		if(!c||char_array_len(c)!=6)continue;
-		if(!(buff=malloc(bs))){
-			if(array)free_mounts(array);
-			return NULL;
+static int mounts_refresh(){
+	int r;
+	ssize_t n;
+	char*nb;
+	struct pollfd p;
+	if((r=mounts_open())<0)return -1;
+	if(r>0&&mounts.buf){
+		p.fd=mounts.fd,p.events=POLLPRI,p.revents=0;
+		if(poll(&p,1,0)==0)return 0;
+	}
+	if(lseek(mounts.fd,0,SEEK_SET)<0)return -1;
+	mounts.len=0;
+	for(;;){
+		if(mounts.size-mounts.len<BUFSIZ){
+			if(!(nb=realloc(mounts.buf,MAX(mounts.size*2,BUFFER_SIZE))))return -1;
+			mounts.buf=nb,mounts.size=MAX(mounts.size*2,BUFFER_SIZE);
+		}
+		if((n=read(mounts.fd,mounts.buf+mounts.len,mounts.size-mounts.len-1))<0){
+			if(errno==EINTR)continue;
+			mounts.len=0;
+			return -1;
 		}
-		memset(buff,0,bs);
-		buff->source=c[0];
-		buff->target=c[1];
-		buff->type=c[2];
-		buff->options=args2array(c[3],',');
-		buff->freq=parse_int(c[4],0);
-		buff->passno=parse_int(c[5],0);
-		free(c);
-		if(!(arr=_array_add_entry(array,buff))){
+		if(n==0)break;
+		mounts.len+=n;
+	}
+	mounts.buf[mounts.len]=0;
+	return 0;
+}
+
+// decode octal escapes of space, tab, newline and backslash in place
+static void mounts_unescape(char*s){
+	char*d=s;
+	while(*s){
+		if(
+			s[0]=='\\'&&
+			s[1]>='0'&&s[1]<='3'&&
+			s[2]>='0'&&s[2]<='7'&&
+			s[3]>='0'&&s[3]<='7'
+		){
+			*d++=(char)((s[1]-'0')<<6|(s[2]-'0')<<3|(s[3]-'0'));
+			s+=4;
+		}else *d++=*s++;
+	}
+	*d=0;
+}
+
+static struct mount_item*mounts_parse_line(const char*line,size_t len){
+	size_t i,cnt;
+	char*f[6],*b,*o,*c;
+	struct mount_item*m;
+	if(!(b=malloc(len+1)))return NULL;
+	memcpy(b,line,len);
+	b[len]=0;
+	for(i=0,c=b;i<6;i++){
+		while(*c&&isspace(*c))c++;
+		if(!*c)break;
+		f[i]=c;
+		while(*c&&!isspace(*c))c++;
+		if(*c)*c++=0;
+	}
+	if(i!=6)goto fail;
+	if(!(m=malloc(sizeof(struct mount_item))))goto fail;
+	memset(m,0,sizeof(struct mount_item));
+	for(cnt=1,c=f[3];*c;c++)if(*c==',')cnt++;
+	if(!(o=strdup(f[3]))||!(m->options=malloc(sizeof(char*)*(cnt+1)))){
+		if(o)free(o);
+		free(m);
+		goto fail;
+	}
+	for(i=0,c=o;i<cnt;i++){
+		m->options[i]=c;
+		if((c=strchr(c,',')))*c++=0;
+		else c=o+strlen(o);
+	}
+	m->options[cnt]=NULL;
+	mounts_unescape(f[0]);
+	mounts_unescape(f[1]);
+	m->source=b;
+	m->target=f[1];
+	m->type=f[2];
+	m->freq=parse_int(f[4],0);
+	m->passno=parse_int(f[5],0);
+	if(m->source!=f[0])memmove(m->source,f[0],strlen(f[0])+1);
+	return m;
+	fail:
+	free(b);
+	return NULL;
+}
+
+struct mount_item**read_proc_mounts(){
+	size_t cnt=0,idx=0;
+	char*l,*e;
+	struct mount_item**array=NULL,*m;
+	MUTEX_LOCK(mounts.lock);
+	if(mounts_refresh()<0)goto done;
+	for(l=mounts.buf;(l=strchr(l,'\n'));l++)cnt++;
+	if(!(array=malloc(sizeof(struct mount_item*)*(cnt+2))))goto done;
+	for(l=mounts.buf;*l;l=*e?e+1:e){
+		if(!(e=strchr(l,'\n')))e=l+strlen(l);
+		if(e==l||idx>cnt)continue;
+		if(!(m=mounts_parse_line(l,e-l))){
+			if(errno!=ENOMEM)continue;
+			array[idx]=NULL;
 			free_mounts(array);
 			array=NULL;
-			free(buff);
-			return NULL;
-		}else array=arr;
+			goto done;
+		}
+		array[idx++]=m;
 	}
+	array[idx]=NULL;
+	done:
+	MUTEX_UNLOCK(mounts.lock);
 	return array;
 }
 
@@ -133,13 +249,33 @@ void free_mounts(struct mount_item**c){
 }
 
 bool is_mountpoint(char*path){
-	struct mount_item**c=read_proc_mounts(),*s;
-	if(!c)return false;
-	bool ret=false;
-	size_t l=0;
-	while((s=c[l++]))if(strcmp(s->source,path)==0)ret=true;
-	free_mounts(c);
-	return ret;
+	char parent[PATH_MAX];
+	struct stat a,b;
+	struct statx sa,sb;
+	unsigned int flags=AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT;
+	if(!path||!path[0])return false;
+	snprintf(parent,sizeof(parent),"%s/..",path);
+	if(statx(AT_FDCWD,path,flags,STATX_BASIC_STATS|STATX_MNT_ID,&sa)==0){
+
+		#ifdef STATX_ATTR_MOUNT_ROOT
+		// linux 5.8+ answers with one call
+		if(sa.stx_attributes_mask&STATX_ATTR_MOUNT_ROOT)
+			return (sa.stx_attributes&STATX_ATTR_MOUNT_ROOT)!=0;
+		#endif
+		#ifdef STATX_MNT_ID
+		if(
+			(sa.stx_mask&STATX_MNT_ID)&&
+			statx(AT_FDCWD,parent,flags,STATX_MNT_ID,&sb)==0&&
+			(sb.stx_mask&STATX_MNT_ID)
+		)return sa.stx_mnt_id!=sb.stx_mnt_id;
+		#else
+		(void)sb;
+		#endif
+	}
+
+	// old kernels, a bind mount of the same filesystem is not seen here
+	if(lstat(path,&a)!=0||stat(parent,&b)!=0)return false;
+	return a.st_dev!=b.st_dev||a.st_ino==b.st_ino;
 }
 
 char*auto_mountpoint(char*path,size_t len){
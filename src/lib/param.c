@@ -10,6 +10,8 @@
 #include<string.h>
 #include<unistd.h>
 #include<stdbool.h>
+#include"str.h"
+#include"array.h"
 #include"defines.h"
 #include"keyval.h"
 #include"param.h"
@@ -77,7 +79,58 @@ keyval**param_parse_items(char*cmdline,size_t*length){
 	return param_s_parse_items(cmdline,strlen(cmdline),length);
 }
 
+/*
+ * bootconfig as the kernel shows it in /proc/bootconfig:
+ *   key = "value"
+ *   key = "value1", "value2"
+ * parsed in place, array values are joined with commas
+ */
+keyval**param_s_parse_bootconfig(char*conf,size_t len,size_t*length){
+	static keyval items[256];
+	static keyval*pointers[256];
+	size_t i,item=0;
+	char*line,*end,*eq,*p,*w;
+	if(!conf||len<=0)return NULL;
+	memset(items,0,sizeof(items));
+	memset(pointers,0,sizeof(pointers));
+	for(line=conf;line<conf+len&&item<ARRLEN(items)-1;line=end+1){
+		if(!(end=memchr(line,'\n',conf+len-line)))end=conf+len;
+		*end=0;
+		if(!(eq=strchr(line,'=')))continue;
+		*eq=0;
+		trim(line);
+		if(!line[0])continue;
+		for(p=w=eq+1;*p;p++){
+			if(*p==',')*w++=',';
+			if(*p!='"')continue;
+			while(*++p&&*p!='"'){
+				if(*p=='\\'&&p[1])p++;
+				*w++=*p;
+			}
+			if(!*p)break;
+		}
+		*w=0;
+		items[item].key=line;
+		items[item].value=eq+1;
+		item++;
+	}
+	if(length)*length=item;
+	for(i=0;i<item;i++)pointers[i]=&items[i];
+	return pointers;
+}
+
 #ifndef ENABLE_UEFI
+keyval**read_bootconfig(int fd){
+	static char buffer[32768];
+	ssize_t r;
+	size_t len=0;
+	if(fd<0)EPRET(EBADF);
+	memset(buffer,0,sizeof(buffer));
+	while(len<sizeof(buffer)-1&&(r=read(fd,buffer+len,sizeof(buffer)-1-len))>0)len+=r;
+	if(len<=0)return NULL;
+	return param_s_parse_bootconfig(buffer,len,NULL);
+}
+
 keyval**read_params(int fd){
 	static char buffer[BUFSIZ];
 	if(fd<0)EPRET(EBADF);
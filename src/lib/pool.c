@@ -7,57 +7,309 @@
  */
 
 #define _GNU_SOURCE
+#include<time.h>
+#include<errno.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 #include<stdbool.h>
+#include<sched.h>
 #include<pthread.h>
 #include<sys/sysinfo.h>
 #include<sys/prctl.h>
+#include"defines.h"
 #include"pool.h"
+#include"metrics.h"
+
+/*
+ * every worker slot has its own queue and lock, a job added from a
+ * worker goes to the queue of that worker, others go round robin. a
+ * worker takes from its own queue first, then steals from the others
+ * with trylock. the pool lock is only taken to sleep, to wake sleepers,
+ * to start a thread and to wait for room, the queued count and the idle
+ * count are checked against each other so no wakeup is lost. threads
+ * start when jobs find nobody idle, up to t_size, and leave after
+ * idle_ms without work while more than t_min run. a worker never waits
+ * for room in its own pool, it would wait for itself. finished jobs go
+ * to a free list instead of free().
+ */
+#define POOL_IDLE_MS 15000
+#define POOL_FREE_MAX 256
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_SEQ_CST)
+#define STORE(v,n) __atomic_store_n(&(v),n,__ATOMIC_SEQ_CST)
+#define ADD(v,n) __atomic_add_fetch(&(v),n,__ATOMIC_SEQ_CST)
+#define SUB(v,n) __atomic_sub_fetch(&(v),n,__ATOMIC_SEQ_CST)
+
+enum worker_state{W_NONE,W_RUN,W_DEAD};
+
+struct job{
+	void*(*callback)(void*arg);
+	void*arg;
+	struct pool_future*future;
+	uint64_t queued_at;
+	struct job*next;
+};
+
+struct pool_future{
+	struct pool*pool;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	void*result;
+};
+
+struct worker{
+	struct pool*pool;
+	int id;
+	enum worker_state state;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct job*first,*last;
+	size_t cnt;
+};
+
+struct pool{
+	int t_size,t_min,idle_ms,q_max;
+	struct worker*workers;
+	pthread_mutex_t lock;
+	pthread_cond_t wake,nfull,drained;
+	pthread_mutex_t free_lock;
+	struct job*free_jobs;
+	size_t free_cnt;
+	bool closed,stopping;
+	int threads,idle,full_waiters,peak_threads;
+	size_t queued,running;
+	unsigned int rr;
+	uint64_t peak_queued,jobs,steals,wait_ns,wait_max_ns,run_ns,run_max_ns;
+};
+
+static __thread struct worker*cur_worker=NULL;
+
+METRIC_HISTOGRAM(m_wait,"pool_queue_wait_seconds","time jobs wait in a pool queue");
+METRIC_COUNTER(m_jobs,"pool_jobs_total","jobs run by all pools");
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+static void update_max(uint64_t*max,uint64_t val){
+	uint64_t cur=LOAD(*max);
+	while(val>cur&&!__atomic_compare_exchange_n(
+		max,&cur,val,false,
+		__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST
+	));
+}
+
+static struct job*job_alloc(struct pool*pool){
+	struct job*j;
+	pthread_mutex_lock(&pool->free_lock);
+	if((j=pool->free_jobs))pool->free_jobs=j->next,pool->free_cnt--;
+	pthread_mutex_unlock(&pool->free_lock);
+	if(!j&&!(j=malloc(sizeof(struct job))))return NULL;
+	memset(j,0,sizeof(struct job));
+	return j;
+}
+
+static void job_free(struct pool*pool,struct job*j){
+	pthread_mutex_lock(&pool->free_lock);
+	if(pool->free_cnt<POOL_FREE_MAX){
+		j->next=pool->free_jobs,pool->free_jobs=j;
+		pool->free_cnt++,j=NULL;
+	}
+	pthread_mutex_unlock(&pool->free_lock);
+	if(j)free(j);
+}
+
+static void timeout_at(struct timespec*ts,int ms){
+	clock_gettime(CLOCK_MONOTONIC,ts);
+	ts->tv_sec+=ms/1000;
+	ts->tv_nsec+=(long)(ms%1000)*1000000L;
+	if(ts->tv_nsec>=1000000000L)ts->tv_sec++,ts->tv_nsec-=1000000000L;
+}
+
+static void*_pool_main(void*arg);
+
+// called with pool->lock held
+static void spawn(struct pool*pool){
+	struct worker*w=NULL;
+	if(pool->stopping||pool->threads>=pool->t_size)return;
+	for(int i=0;i<pool->t_size&&!w;i++)
+		if(pool->workers[i].state!=W_RUN)w=&pool->workers[i];
+	if(!w)return;
+	if(w->state==W_DEAD)pthread_join(w->thread,NULL);
+	w->state=W_RUN;
+	if(pthread_create(&w->thread,NULL,_pool_main,w)!=0){
+		w->state=W_NONE;
+		return;
+	}
+	if(ADD(pool->threads,1)>pool->peak_threads)
+		pool->peak_threads=pool->threads;
+}
+
+// jobs wait in the queues, make sure someone looks at them
+static void wakeup(struct pool*pool,size_t cnt){
+	int idle=LOAD(pool->idle);
+	if(idle<=0&&LOAD(pool->threads)>=pool->t_size)return;
+	pthread_mutex_lock(&pool->lock);
+	if(pool->idle>0){
+		if(cnt>1)pthread_cond_broadcast(&pool->wake);
+		else pthread_cond_signal(&pool->wake);
+	}
+	for(size_t i=(size_t)MAX(pool->idle,0);i<cnt&&pool->threads<pool->t_size;i++)
+		spawn(pool);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static struct job*pop(struct worker*w){
+	struct job*j;
+	if((j=w->first)){
+		if(!(w->first=j->next))w->last=NULL;
+		STORE(w->cnt,w->cnt-1);
+		j->next=NULL;
+	}
+	return j;
+}
+
+static struct job*take(struct pool*pool,struct worker*w){
+	struct job*j=NULL;
+	struct worker*o;
+	if(w){
+		pthread_mutex_lock(&w->lock);
+		j=pop(w);
+		pthread_mutex_unlock(&w->lock);
+		if(j)return j;
+	}
+	for(int pass=0;pass<2&&LOAD(pool->queued)>0;pass++){
+		for(int i=0;i<pool->t_size;i++){
+			o=&pool->workers[((w?w->id:0)+i+1)%pool->t_size];
+			if(o==w||LOAD(o->cnt)<=0)continue;
+			if(pass==0){
+				if(pthread_mutex_trylock(&o->lock)!=0)continue;
+			}else pthread_mutex_lock(&o->lock);
+			j=pop(o);
+			pthread_mutex_unlock(&o->lock);
+			if(j){
+				if(w)ADD(pool->steals,1);
+				return j;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void check_drained(struct pool*pool){
+	if(!LOAD(pool->closed)||LOAD(pool->queued)>0||LOAD(pool->running)>0)return;
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_broadcast(&pool->drained);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void run_job(struct pool*pool,struct job*j){
+	void*r,*(*callback)(void*)=j->callback,*arg=j->arg;
+	struct pool_future*f=j->future;
+	uint64_t start=now_ns(),end;
+	ADD(pool->running,1);
+	SUB(pool->queued,1);
+	if(LOAD(pool->full_waiters)>0){
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->nfull);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	ADD(pool->wait_ns,start-j->queued_at);
+	update_max(&pool->wait_max_ns,start-j->queued_at);
+	metric_observe(&m_wait,(start-j->queued_at)/1000);
+	metric_inc(&m_jobs);
+	job_free(pool,j);
+	r=callback(arg);
+	end=now_ns();
+	ADD(pool->run_ns,end-start);
+	update_max(&pool->run_max_ns,end-start);
+	ADD(pool->jobs,1);
+	if(f){
+		pthread_mutex_lock(&f->lock);
+		f->result=r,f->done=true;
+		pthread_cond_broadcast(&f->cond);
+		pthread_mutex_unlock(&f->lock);
+	}
+	SUB(pool->running,1);
+	check_drained(pool);
+}
 
 static void*_pool_main(void*arg){
-	struct pool*pool=(struct pool*)arg;
-	struct job*pjob=NULL;
+	int r;
+	struct job*j;
+	struct timespec ts;
+	struct worker*w=arg;
+	struct pool*pool=w->pool;
 	prctl(PR_SET_NAME,"Pool worker",0,0,0);
+	cur_worker=w;
 	for(;;){
-		pthread_mutex_lock(&(pool->mutex));
-		while((pool->q_cur==0)&&!pool->p_closed)
-			pthread_cond_wait(&(pool->q_nempty),&(pool->mutex));
-		if(pool->p_closed){
-			pthread_mutex_unlock(&(pool->mutex));
-			pthread_exit(NULL);
+		if((j=take(pool,w))){
+			run_job(pool,j);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		if(pool->stopping){
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		ADD(pool->idle,1);
+		if(LOAD(pool->queued)>0){
+			SUB(pool->idle,1);
+			pthread_mutex_unlock(&pool->lock);
+			sched_yield();
+			continue;
 		}
-		pool->q_cur--;
-		pjob=pool->first;
-		pool->first=pool->q_cur==0?(pool->last=NULL):pjob->next;
-		if(pool->q_cur==0)pthread_cond_signal(&(pool->q_empty));
-		if(pool->q_cur==pool->q_max-1)pthread_cond_broadcast(&(pool->q_nfull));
-		pthread_mutex_unlock(&(pool->mutex));
-		(*(pjob->callback))(pjob->arg);
-		free(pjob);
-		pjob=NULL;
+		timeout_at(&ts,pool->idle_ms);
+		r=pthread_cond_timedwait(&pool->wake,&pool->lock,&ts);
+		SUB(pool->idle,1);
+		if(
+			r==ETIMEDOUT&&!pool->stopping&&
+			LOAD(pool->queued)==0&&
+			pool->threads>pool->t_min
+		){
+			SUB(pool->threads,1);
+			w->state=W_DEAD;
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
 	}
+	cur_worker=NULL;
+	return NULL;
 }
 
 struct pool*pool_init(int t_size,int q_max){
 	struct pool*pool=NULL;
+	pthread_condattr_t attr;
+	if(t_size<=0)return NULL;
 	if(!(pool=malloc(sizeof(struct pool))))goto fail;
-	if(!(pool->pthreads=malloc(sizeof(pthread_t)*t_size)))goto fail;
-	pool->t_size=t_size;
-	pool->q_max=q_max,pool->q_cur=0;
-	pool->first=NULL,pool->last=NULL;
-	pool->q_closed=false,pool->p_closed=false;
-	if(pthread_mutex_init(&(pool->mutex),NULL))goto fail;
-	if(pthread_cond_init(&(pool->q_empty),NULL))goto fail;
-	if(pthread_cond_init(&(pool->q_nempty),NULL))goto fail;
-	if(pthread_cond_init(&(pool->q_nfull),NULL))goto fail;
-	int i;
-	for(i=0;i<pool->t_size;++i)
-		pthread_create(&(pool->pthreads[i]),NULL,_pool_main,(void*)pool);
+	memset(pool,0,sizeof(struct pool));
+	if(!(pool->workers=malloc(sizeof(struct worker)*t_size)))goto fail;
+	memset(pool->workers,0,sizeof(struct worker)*t_size);
+	pool->t_size=t_size,pool->q_max=q_max;
+	pool->t_min=1,pool->idle_ms=POOL_IDLE_MS;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+	pthread_mutex_init(&pool->lock,NULL);
+	pthread_mutex_init(&pool->free_lock,NULL);
+	pthread_cond_init(&pool->wake,&attr);
+	pthread_cond_init(&pool->nfull,NULL);
+	pthread_cond_init(&pool->drained,NULL);
+	pthread_condattr_destroy(&attr);
+	for(int i=0;i<t_size;i++){
+		pool->workers[i].pool=pool,pool->workers[i].id=i;
+		pthread_mutex_init(&pool->workers[i].lock,NULL);
+	}
+	pthread_mutex_lock(&pool->lock);
+	spawn(pool);
+	pthread_mutex_unlock(&pool->lock);
 	return pool;
 	fail:
 	if(pool){
-		if(pool->pthreads)free(pool->pthreads);
+		if(pool->workers)free(pool->workers);
 		free(pool);
 	}
 	return NULL;
@@ -68,62 +320,193 @@ struct pool*pool_init_cpus(int q_max){
 	return pool_init(r>0?r:2,q_max);
 }
 
-int pool_add(struct pool*pool,void*(*callback)(void*arg),void*arg){
-	if(!pool||!callback)return -1;
-	pthread_mutex_lock(&(pool->mutex));
-	while((pool->q_cur==pool->q_max)&&!(pool->q_closed||pool->p_closed))
-		pthread_cond_wait(&(pool->q_nfull),&(pool->mutex));
-	if(pool->q_closed||pool->p_closed){
-		pthread_mutex_unlock(&(pool->mutex));
-		return -1;
+void pool_set_idle(struct pool*pool,int t_min,int timeout_ms){
+	if(!pool)return;
+	pthread_mutex_lock(&pool->lock);
+	pool->t_min=MAX(0,MIN(t_min,pool->t_size));
+	if(timeout_ms>0)pool->idle_ms=timeout_ms;
+	while(pool->threads<pool->t_min){
+		int t=pool->threads;
+		spawn(pool);
+		if(pool->threads==t)break;
+	}
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// wait until the job fits, then count it, false when the pool closed
+static bool reserve(struct pool*pool){
+	bool own=cur_worker&&cur_worker->pool==pool;
+	while(
+		!own&&pool->q_max>0&&!LOAD(pool->closed)&&
+		LOAD(pool->queued)>=(size_t)pool->q_max
+	){
+		wakeup(pool,LOAD(pool->queued));
+		pthread_mutex_lock(&pool->lock);
+		ADD(pool->full_waiters,1);
+		if(!pool->closed&&LOAD(pool->queued)>=(size_t)pool->q_max)
+			pthread_cond_wait(&pool->nfull,&pool->lock);
+		SUB(pool->full_waiters,1);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	size_t q=ADD(pool->queued,1);
+	if(LOAD(pool->closed)){
+		SUB(pool->queued,1);
+		check_drained(pool);
+		return false;
 	}
-	struct job*pjob;
-	if(!(pjob=(struct job*)malloc(sizeof(struct job)))){
-		pthread_mutex_unlock(&(pool->mutex));
+	update_max(&pool->peak_queued,q);
+	return true;
+}
+
+static void enqueue(struct pool*pool,struct job*j){
+	struct worker*w=cur_worker;
+	if(!w||w->pool!=pool)
+		w=&pool->workers[ADD(pool->rr,1)%(unsigned int)pool->t_size];
+	j->queued_at=now_ns(),j->next=NULL;
+	pthread_mutex_lock(&w->lock);
+	if(w->last)w->last->next=j;
+	else w->first=j;
+	w->last=j;
+	STORE(w->cnt,w->cnt+1);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static int add_job(struct pool*pool,void*(*callback)(void*),void*arg,struct pool_future*f,bool wake){
+	struct job*j;
+	if(!reserve(pool))return -1;
+	if(!(j=job_alloc(pool))){
+		SUB(pool->queued,1);
+		check_drained(pool);
 		return -1;
 	}
-	pjob->callback=callback;
-	pjob->arg=arg;
-	pjob->next=NULL;
-	if(!pool->first){
-		pool->first=pool->last=pjob;
-		pthread_cond_broadcast(&(pool->q_nempty));
+	j->callback=callback,j->arg=arg,j->future=f;
+	enqueue(pool,j);
+	if(wake)wakeup(pool,1);
+	return 0;
+}
+
+int pool_add(struct pool*pool,void*(*callback)(void*arg),void*arg){
+	if(!pool||!callback)return -1;
+	return add_job(pool,callback,arg,NULL,true);
+}
+
+int pool_add_many(struct pool*pool,void*(*callback)(void*arg),void**args,size_t cnt){
+	size_t i;
+	if(!pool||!callback||(!args&&cnt>0))return -1;
+	for(i=0;i<cnt;i++)if(add_job(pool,callback,args[i],NULL,false)!=0)break;
+	if(i>0)wakeup(pool,i);
+	return (int)i;
+}
+
+struct pool_future*pool_submit(struct pool*pool,void*(*callback)(void*arg),void*arg){
+	struct pool_future*f;
+	if(!pool||!callback)return NULL;
+	if(!(f=malloc(sizeof(struct pool_future))))return NULL;
+	memset(f,0,sizeof(struct pool_future));
+	f->pool=pool;
+	pthread_mutex_init(&f->lock,NULL);
+	pthread_cond_init(&f->cond,NULL);
+	if(add_job(pool,callback,arg,f,true)!=0){
+		pthread_mutex_destroy(&f->lock);
+		pthread_cond_destroy(&f->cond);
+		free(f);
+		return NULL;
+	}
+	return f;
+}
+
+void*pool_future_wait(struct pool_future*f){
+	void*r;
+	struct job*j;
+	struct timespec ts;
+	if(!f)return NULL;
+
+	// a worker runs other jobs meanwhile, the pool may be all waiters
+	if(cur_worker&&cur_worker->pool==f->pool)for(;;){
+		pthread_mutex_lock(&f->lock);
+		if(f->done)break;
+		pthread_mutex_unlock(&f->lock);
+		if((j=take(f->pool,cur_worker))){
+			run_job(f->pool,j);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME,&ts);
+		if((ts.tv_nsec+=1000000L)>=1000000000L)ts.tv_sec++,ts.tv_nsec-=1000000000L;
+		pthread_mutex_lock(&f->lock);
+		if(!f->done)pthread_cond_timedwait(&f->cond,&f->lock,&ts);
+		pthread_mutex_unlock(&f->lock);
 	}else{
-		pool->last->next=pjob;
-		pool->last=pjob;
+		pthread_mutex_lock(&f->lock);
+		while(!f->done)pthread_cond_wait(&f->cond,&f->lock);
 	}
-	pool->q_cur++;
-	pthread_mutex_unlock(&(pool->mutex));
+	r=f->result;
+	pthread_mutex_unlock(&f->lock);
+	pthread_mutex_destroy(&f->lock);
+	pthread_cond_destroy(&f->cond);
+	free(f);
+	return r;
+}
+
+int pool_add_wait(struct pool*pool,void*(*callback)(void*arg),void*arg,void**result){
+	void*r;
+	struct pool_future*f;
+	if(!(f=pool_submit(pool,callback,arg)))return -1;
+	r=pool_future_wait(f);
+	if(result)*result=r;
 	return 0;
 }
 
+void pool_get_stats(struct pool*pool,struct pool_stats*stats){
+	if(!stats)return;
+	memset(stats,0,sizeof(struct pool_stats));
+	if(!pool)return;
+	stats->threads=LOAD(pool->threads);
+	stats->idle=LOAD(pool->idle);
+	stats->peak_threads=LOAD(pool->peak_threads);
+	stats->queued=LOAD(pool->queued);
+	stats->peak_queued=LOAD(pool->peak_queued);
+	stats->jobs=LOAD(pool->jobs);
+	stats->steals=LOAD(pool->steals);
+	stats->wait_ns=LOAD(pool->wait_ns);
+	stats->wait_max_ns=LOAD(pool->wait_max_ns);
+	stats->run_ns=LOAD(pool->run_ns);
+	stats->run_max_ns=LOAD(pool->run_max_ns);
+}
+
 int pool_destroy(struct pool*pool){
+	struct job*j;
 	if(!pool)return -1;
-	pthread_mutex_lock(&(pool->mutex));
-	if(pool->q_closed||pool->p_closed){
-		pthread_mutex_unlock(&(pool->mutex));
+	pthread_mutex_lock(&pool->lock);
+	if(pool->closed){
+		pthread_mutex_unlock(&pool->lock);
 		return -1;
 	}
-	pool->q_closed=true;
-	while(pool->q_cur!=0)
-		pthread_cond_wait(&(pool->q_empty),&(pool->mutex));
-	pool->p_closed=true;
-	pthread_mutex_unlock(&(pool->mutex));
-	pthread_cond_broadcast(&(pool->q_nempty));
-	pthread_cond_broadcast(&(pool->q_nfull));
-	for(int i=0;i<pool->t_size;++i)
-		pthread_join(pool->pthreads[i],NULL);
-	pthread_mutex_destroy(&(pool->mutex));
-	pthread_cond_destroy(&(pool->q_empty));
-	pthread_cond_destroy(&(pool->q_nempty));
-	pthread_cond_destroy(&(pool->q_nfull));
-	free(pool->pthreads);
-	struct job*p;
-	while(pool->first){
-		p=pool->first;
-		pool->first=p->next;
-		free(p);
+	STORE(pool->closed,true);
+	pthread_cond_broadcast(&pool->nfull);
+	while(LOAD(pool->queued)>0||LOAD(pool->running)>0){
+		if(pool->idle>0)pthread_cond_broadcast(&pool->wake);
+		else if(pool->threads<=0)spawn(pool);
+		pthread_cond_wait(&pool->drained,&pool->lock);
+	}
+	pool->stopping=true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(int i=0;i<pool->t_size;i++){
+		if(pool->workers[i].state!=W_NONE)
+			pthread_join(pool->workers[i].thread,NULL);
+		pthread_mutex_destroy(&pool->workers[i].lock);
 	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->free_lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->nfull);
+	pthread_cond_destroy(&pool->drained);
+	while((j=pool->free_jobs)){
+		pool->free_jobs=j->next;
+		free(j);
+	}
+	free(pool->workers);
 	free(pool);
 	return 0;
-}
\ No newline at end of file
+}
@@ -10,13 +10,159 @@
 
 #include <errno.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#ifdef ENABLE_UEFI
+#include <Uefi.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/Rng.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/random.h>
 #include "pathnames.h"
+#endif
+
+/*
+ * Random bytes come from a ChaCha20 keystream kept per thread, the
+ * kernel (or EFI_RNG_PROTOCOL under UEFI) is only asked for a 32 byte key
+ * on first use, after RNG_RESEED bytes and in the child after fork().
+ * Every refill takes the first 32 bytes of a fresh batch as the next
+ * key, so a leaked state does not give away bytes already handed out.
+ * When the kernel pool is not ready yet the key comes from
+ * GRND_INSECURE, the state stays marked weak and is reseeded on the next
+ * request until the kernel has real entropy.
+ */
+#define RNG_BLOCKS	4
+#define RNG_BATCH	(64 * RNG_BLOCKS)
+#define RNG_KEY		32
+#define RNG_RESEED	(1024 * 1024)
+
+struct rng_state {
+	uint32_t	key[8];
+	uint64_t	counter;
+	uint8_t		buf[RNG_BATCH];
+	size_t		avail;
+	size_t		since_seed;
+	unsigned int	gen;
+	bool		seeded;
+	bool		weak;
+};
+
+#define ROTL32(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d) do { \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7); \
+} while (0)
+
+static void chacha20_block(const uint32_t key[8], uint64_t counter, uint8_t out[64])
+{
+	uint32_t x[16], s[16] = {
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		key[0], key[1], key[2], key[3],
+		key[4], key[5], key[6], key[7],
+		(uint32_t) counter, (uint32_t) (counter >> 32), 0, 0
+	};
+	int i;
+
+	memcpy(x, s, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++) {
+		uint32_t v = x[i] + s[i];
+		out[i * 4 + 0] = v;
+		out[i * 4 + 1] = v >> 8;
+		out[i * 4 + 2] = v >> 16;
+		out[i * 4 + 3] = v >> 24;
+	}
+}
+
+static void rng_refill(struct rng_state *st)
+{
+	int i;
+
+	for (i = 0; i < RNG_BLOCKS; i++)
+		chacha20_block(st->key, st->counter++, st->buf + i * 64);
+	memcpy(st->key, st->buf, RNG_KEY);
+	memset(st->buf, 0, RNG_KEY);
+	st->avail = RNG_BATCH - RNG_KEY;
+}
+
+/*
+ * Fill @buf from the platform source.
+ *
+ * Returns 0 for good quality, 1 for weak quality and -1 on failure.
+ */
+static int platform_random(void *buf, size_t len);
+
+#ifdef ENABLE_UEFI
+
+static struct rng_state rng_global;
+#define RNG_STATE()	(&rng_global)
+#define RNG_GEN()	0
+
+static int platform_random(void *buf, size_t len)
+{
+	EFI_STATUS st;
+	EFI_RNG_PROTOCOL *rng = NULL;
+	UINT64 tick;
+	uint8_t *cp = buf;
+	size_t i;
+
+	st = gBS->LocateProtocol(&gEfiRngProtocolGuid, NULL, (VOID **) &rng);
+	if (!EFI_ERROR(st) && rng) {
+		st = rng->GetRNG(rng, NULL, len, (UINT8 *) buf);
+		if (!EFI_ERROR(st))
+			return 0;
+	}
+
+	/* no rng protocol, the performance counter is all there is */
+	for (i = 0; i < len; i++) {
+		tick = GetPerformanceCounter();
+		cp[i] ^= (uint8_t) (tick ^ (tick >> 8) ^ (tick >> 16));
+	}
+	return 1;
+}
+
+#else
+
+static __thread struct rng_state rng_local;
+static unsigned int rng_generation;
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+
+static void rng_atfork_child(void)
+{
+	__atomic_add_fetch(&rng_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void rng_register(void)
+{
+	pthread_atfork(NULL, NULL, rng_atfork_child);
+}
+
+static unsigned int rng_gen(void)
+{
+	pthread_once(&rng_once, rng_register);
+	return __atomic_load_n(&rng_generation, __ATOMIC_RELAXED);
+}
+
+#define RNG_STATE()	(&rng_local)
+#define RNG_GEN()	rng_gen()
 
 int rand_get_number(int low_n, int high_n)
 {
@@ -56,81 +202,117 @@ int random_get_fd(void)
 	return fd;
 }
 
-/*
- * Generate a stream of random nbytes into buf.
- * Use /dev/urandom if possible, and if not,
- * use glibc pseudo-random functions.
- */
-#define UL_RAND_READ_ATTEMPTS	8
-#define UL_RAND_READ_DELAY	125000	/* microseconds */
-
-/*
- * Write @nbytes random bytes into @buf.
- *
- * Returns 0 for good quality of random bytes or 1 for weak quality.
- */
-int random_get_bytes(void *buf, size_t nbytes)
+static int read_full(int fd, uint8_t *cp, size_t n)
 {
-	unsigned char *cp = (unsigned char *)buf;
-	size_t i, n = nbytes;
-	int lose_counter = 0;
+	ssize_t x;
 
 	while (n > 0) {
-		int x;
+		x = read(fd, cp, n);
+		if (x < 0 && errno == EINTR)
+			continue;
+		if (x <= 0)
+			return -1;
+		n -= x;
+		cp += x;
+	}
+	return 0;
+}
+
+static int platform_random(void *buf, size_t len)
+{
+	uint8_t *cp = buf;
+	size_t i, n = len;
+	ssize_t x;
+	int fd, flags = GRND_NONBLOCK, weak = 0;
 
+	while (n > 0) {
 		errno = 0;
-		x = getrandom(cp, n, GRND_NONBLOCK);
-		if (x > 0) {			/* success */
-		       n -= x;
-		       cp += x;
-		       lose_counter = 0;
-		       errno = 0;
-		} else if (errno == ENOSYS) {	/* kernel without getrandom() */
-			break;
-
-		} else if (errno == EAGAIN && lose_counter < UL_RAND_READ_ATTEMPTS) {
-			usleep(UL_RAND_READ_DELAY);	/* no entropy, wait and try again */
-			lose_counter++;
-		} else
-			break;
+		x = getrandom(cp, n, flags);
+		if (x > 0) {
+			n -= x;
+			cp += x;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+#ifdef GRND_INSECURE
+		/* pool not ready yet, take what the kernel has and say so */
+		if (errno == EAGAIN && flags != GRND_INSECURE) {
+			flags = GRND_INSECURE;
+			weak = 1;
+			continue;
+		}
+#endif
+		break;
 	}
+	if (n == 0)
+		return weak;
 
-	if (errno == ENOSYS)
-	/*
-	 * We've been built against headers that support getrandom, but the
-	 * running kernel does not.  Fallback to reading from /dev/{u,}random
-	 * as before
-	 */
-	{
-		int fd = random_get_fd();
-
-		lose_counter = 0;
-		if (fd >= 0) {
-			while (n > 0) {
-				ssize_t x = read(fd, cp, n);
-				if (x <= 0) {
-					if (lose_counter++ > UL_RAND_READ_ATTEMPTS)
-						break;
-					usleep(UL_RAND_READ_DELAY);
-					continue;
-				}
-				n -= x;
-				cp += x;
-				lose_counter = 0;
-			}
-
-			close(fd);
-		}
+	/* kernel without getrandom() or it failed, try the device */
+	if ((fd = random_get_fd()) >= 0) {
+		x = read_full(fd, cp, n);
+		close(fd);
+		if (x == 0)
+			return weak;
 	}
-	/*
-	 * We do this all the time, but this is the only source of
-	 * randomness if /dev/random/urandom is out to lunch.
-	 */
+
+	/* nothing from the kernel, mix in whatever we have */
 	crank_random();
-	for (cp = buf, i = 0; i < nbytes; i++)
+	for (cp = buf, i = 0; i < len; i++)
 		*cp++ ^= (rand() >> 7) & 0xFF;
+	return -1;
+}
+
+#endif
+
+static void rng_seed(struct rng_state *st, unsigned int gen)
+{
+	uint32_t key[8];
+	int r, i;
+
+	memset(key, 0, sizeof(key));
+	r = platform_random(key, sizeof(key));
+
+	/* keep mixing with the old key, a weak seed never makes it worse */
+	for (i = 0; i < 8; i++)
+		st->key[i] ^= key[i];
+	memset(key, 0, sizeof(key));
+	st->counter = 0;
+	st->avail = 0;
+	st->since_seed = 0;
+	st->gen = gen;
+	st->seeded = true;
+	st->weak = r != 0;
+}
 
-	return n != 0;
+/*
+ * Write @nbytes random bytes into @buf.
+ *
+ * Returns 0 for good quality of random bytes or 1 for weak quality.
+ */
+int random_get_bytes(void *buf, size_t nbytes)
+{
+	struct rng_state *st = RNG_STATE();
+	unsigned int gen = RNG_GEN();
+	uint8_t *cp = buf;
+	size_t n;
+
+	if (!st->seeded || st->weak || st->gen != gen ||
+	    st->since_seed >= RNG_RESEED)
+		rng_seed(st, gen);
+
+	while (nbytes > 0) {
+		if (st->avail == 0)
+			rng_refill(st);
+		n = nbytes < st->avail ? nbytes : st->avail;
+		memcpy(cp, st->buf + RNG_BATCH - st->avail, n);
+		memset(st->buf + RNG_BATCH - st->avail, 0, n);
+		st->avail -= n;
+		st->since_seed += n;
+		cp += n;
+		nbytes -= n;
+	}
+	return st->weak;
 }
 
 
@@ -139,5 +321,9 @@ int random_get_bytes(void *buf, size_t nbytes)
  */
 const char *random_tell_source(void)
 {
-	return "getrandom() function";
+#ifdef ENABLE_UEFI
+	return "chacha20 seeded by EFI_RNG_PROTOCOL";
+#else
+	return "chacha20 seeded by getrandom() function";
+#endif
 }
@@ -283,23 +283,23 @@ list*path2list(char*path,bool parent){
 	if(!path)EPRET(EINVAL);
 	size_t c=0;
 	char*po=path;
-	list*l=list_new_strdup(".");
+	list*l;
+	struct list_head h=LIST_HEAD_INIT;
 	while(*path){
 		if(*path!='/')c++;
 		else if(c==0)po=path+1;
 		else{
-			if(list_push_new_strndup(l,po,c)<0)goto fail;
+			if(list_head_push_new_strndup(&h,po,c)<0)goto fail;
 			po=path+1,c=0;
 		}
 		path++;
 	}
-	if((c>0&&list_push_new_strndup(l,po,c)<0)||!l->next)goto fail;
-	l=l->next;
-	list_remove_free_def(l->prev);
+	if((c>0&&list_head_push_new_strndup(&h,po,c)<0)||!h.first)goto fail;
+	l=list_head_detach(&h);
 	errno=0;
 	return parent?path_simplify(l,true):l;
 	fail:
-	list_free_all_def(l);
+	list_head_free_all_def(&h);
 	return NULL;
 }
 
@@ -7,7 +7,9 @@
  */
 
 #define _GNU_SOURCE
+#include<time.h>
 #include<errno.h>
+#include<sched.h>
 #include<stdio.h>
 #include<fcntl.h>
 #include<stdlib.h>
@@ -27,7 +29,13 @@
 #define STATFS_RAMFS_MAGIC 0x858458f6
 #define F_TYPE_EQUAL(a,b) ((a)==(__typeof__(a))(b))
 
-static int recursive_remove(int fd){
+/*
+ * the old initramfs is deleted by a forked helper that keeps an fd of the
+ * old root after the pivot, the new init is executed without waiting for it
+ * the helper runs as SCHED_IDLE, freeing the pages should not slow down
+ * the early boot of the new init
+ */
+static int recursive_remove(int fd,size_t*cnt){
 	struct stat rb;
 	DIR *dir;
 	int rc=-1;
@@ -53,29 +61,67 @@ static int recursive_remove(int fd){
 		}
 		if(!strcmp(d->d_name,".")||!strcmp(d->d_name,".."))continue;
 		if(d->d_type==DT_DIR||d->d_type==DT_UNKNOWN){
+			int cfd;
 			struct stat sb;
-			if(fstatat(dfd,d->d_name,&sb,AT_SYMLINK_NOFOLLOW)){
-				telog_error("stat of %s failed",d->d_name);
-				continue;
-			}
-			if(sb.st_dev!=rb.st_dev)continue;
-			if(S_ISDIR(sb.st_mode)){
-				int cfd;
-				if((cfd=openat(dfd,d->d_name,O_RDONLY))>=0){
-					recursive_remove(cfd);
+
+			// a directory is opened once and checked by its fd, only unknown types need fstatat
+			if(d->d_type==DT_UNKNOWN){
+				if(fstatat(dfd,d->d_name,&sb,AT_SYMLINK_NOFOLLOW)){
+					telog_error("stat of %s failed",d->d_name);
+					continue;
+				}
+				if(sb.st_dev!=rb.st_dev)continue;
+				isdir=S_ISDIR(sb.st_mode);
+			}else isdir=1;
+			if(isdir){
+				if((cfd=openat(dfd,d->d_name,O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC))<0){
+					telog_error("failed to open %s",d->d_name);
+					continue;
+				}
+				if(fstat(cfd,&sb)!=0||sb.st_dev!=rb.st_dev){
 					close(cfd);
+					continue;
 				}
-				isdir=1;
+
+				// fdopendir takes cfd, closedir in recursive_remove closes it
+				recursive_remove(cfd,cnt);
 			}
 		}
 		if(unlinkat(dfd,d->d_name,isdir?AT_REMOVEDIR:0))telog_error("failed to delete %s",d->d_name);
+		else if(cnt)(*cnt)++;
 	}
 	rc=0;
 	done:
 	if(dir)closedir(dir);
+	else close(fd);
 	return rc;
 }
 
+static void remove_old_root(int cfd,bool idle){
+	size_t cnt=0;
+	struct statfs stfs;
+	struct timespec a,b;
+	struct sched_param sp={.sched_priority=0};
+	if(
+		fstatfs(cfd,&stfs)!=0||(
+			!F_TYPE_EQUAL(stfs.f_type,STATFS_RAMFS_MAGIC)&&
+			!F_TYPE_EQUAL(stfs.f_type,STATFS_TMPFS_MAGIC)
+		)
+	){
+		tlog_error("old root filesystem is not an initramfs");
+		close(cfd);
+		return;
+	}
+	if(idle)sched_setscheduler(0,SCHED_IDLE,&sp);
+	clock_gettime(CLOCK_MONOTONIC,&a);
+	recursive_remove(cfd,&cnt);
+	clock_gettime(CLOCK_MONOTONIC,&b);
+	tlog_debug(
+		"removed %zu entries of old root in %ldms",cnt,
+		(long)((b.tv_sec-a.tv_sec)*1000+(b.tv_nsec-a.tv_nsec)/1000000)
+	);
+}
+
 static int switchroot(const char*newroot){
 	const char *umounts[]={_PATH_DEV,_PATH_PROC,_PATH_SYS,NULL};
 	int i,cfd;
@@ -105,18 +151,15 @@ static int switchroot(const char*newroot){
 		close(cfd);
 		return terlog_error(-1,"failed to change root");
 	}
-	if((pid=fork())<=0){
-		struct statfs stfs;
-		if(
-			fstatfs(cfd,&stfs)==0&&(
-				F_TYPE_EQUAL(stfs.f_type,STATFS_RAMFS_MAGIC)||
-				F_TYPE_EQUAL(stfs.f_type,STATFS_TMPFS_MAGIC)
-			)
-		)recursive_remove(cfd);
-		else telog_error("old root filesystem is not an initramfs");
-		if(pid==0)exit(0);
+	if((pid=fork())==0){
+		remove_old_root(cfd,true);
+		_exit(0);
+	}
+	if(pid>0)close(cfd);
+	else{
+		telog_warn("fork failed, remove old root synchronously");
+		remove_old_root(cfd,false);
 	}
-	close(cfd);
 	return 0;
 }
 
@@ -0,0 +1,119 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<errno.h>
+#include<stdio.h>
+#include<stdarg.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include"trace.h"
+#include"defines.h"
+
+/*
+ * boot timeline, a fixed array in a shared mapping,
+ * so loggerd, confd and devd forked from init write into the same buffer.
+ * writers only reserve a slot with an atomic add, events are never freed.
+ */
+struct trace_buf{
+	size_t size;
+	size_t next;
+	size_t dropped;
+	struct trace_event events[];
+};
+
+static struct trace_buf*trace=NULL;
+
+int trace_init(size_t events){
+	struct trace_buf*t;
+	size_t len;
+	if(trace)ERET(EEXIST);
+	if(events<=0)ERET(EINVAL);
+	len=sizeof(struct trace_buf)+sizeof(struct trace_event)*events;
+	t=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(t==MAP_FAILED)return -errno;
+	t->size=events,t->next=0,t->dropped=0;
+	trace=t;
+	return 0;
+}
+
+bool trace_enabled(){
+	return trace!=NULL;
+}
+
+void trace_point(char ph,uint64_t id,const char*cat,const char*fmt,...){
+	va_list va;
+	size_t idx;
+	struct timespec ts;
+	struct trace_event*e;
+	if(!trace||!fmt)return;
+	if((idx=__atomic_fetch_add(&trace->next,1,__ATOMIC_RELAXED))>=trace->size){
+		__atomic_fetch_add(&trace->dropped,1,__ATOMIC_RELAXED);
+		return;
+	}
+	e=&trace->events[idx];
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	e->ts=(uint64_t)ts.tv_sec*1000000+(uint64_t)ts.tv_nsec/1000;
+	e->pid=getpid(),e->tid=(int32_t)syscall(SYS_gettid),e->id=id;
+	strncpy(e->cat,cat?cat:"",sizeof(e->cat)-1);
+	va_start(va,fmt);
+	vsnprintf(e->name,sizeof(e->name),fmt,va);
+	va_end(va);
+
+	// a slot is complete once its phase is set
+	__atomic_store_n(&e->ph,ph,__ATOMIC_RELEASE);
+}
+
+static void json_string(FILE*f,const char*s,size_t len){
+	fputc('"',f);
+	for(size_t i=0;i<len&&s[i];i++)switch(s[i]){
+		case '"':fputs("\\\"",f);break;
+		case '\\':fputs("\\\\",f);break;
+		default:
+			if((unsigned char)s[i]<0x20)fprintf(f,"\\u%04x",s[i]);
+			else fputc(s[i],f);
+	}
+	fputc('"',f);
+}
+
+int trace_dump_json(FILE*f){
+	char ph;
+	bool first=true;
+	size_t cnt,dropped;
+	struct trace_event*e;
+	if(!f)ERET(EINVAL);
+	if(!trace)ERET(ENODATA);
+	cnt=MIN(__atomic_load_n(&trace->next,__ATOMIC_ACQUIRE),trace->size);
+	dropped=__atomic_load_n(&trace->dropped,__ATOMIC_RELAXED);
+	fputs("{\"traceEvents\":[",f);
+	for(size_t i=0;i<cnt;i++){
+		e=&trace->events[i];
+		if(!(ph=__atomic_load_n(&e->ph,__ATOMIC_ACQUIRE)))continue;
+		fputs(first?"\n":",\n",f);
+		first=false;
+		fputs("{\"name\":",f);
+		json_string(f,e->name,sizeof(e->name));
+		fputs(",\"cat\":",f);
+		json_string(f,e->cat[0]?e->cat:"init",sizeof(e->cat));
+		fprintf(
+			f,",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%d",
+			ph,(unsigned long long)e->ts,e->pid,e->tid
+		);
+		if(ph=='b'||ph=='e')fprintf(f,",\"id\":%llu",(unsigned long long)e->id);
+		if(ph=='i')fputs(",\"s\":\"p\"",f);
+		fputc('}',f);
+	}
+	fprintf(
+		f,"\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"events\":%zu,\"dropped\":%zu}}\n",
+		cnt,dropped
+	);
+	return ferror(f)?-1:0;
+}
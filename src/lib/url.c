@@ -6,6 +6,9 @@
  *
  */
 
+#include<ctype.h>
+#include<errno.h>
+#include<stdlib.h>
 #include<string.h>
 #include<stddef.h>
 #include<stdbool.h>
@@ -14,55 +17,196 @@
 
 #define NE(v)((v)&&*(v))
 
-static char url_encoding_map[256];
-static bool url_encoding_maps_initialized=false;
-
-static void init_url_encoding_map(){
-	unsigned char i;
-	if(url_encoding_maps_initialized)return;
-	memset(url_encoding_map,0,sizeof(url_encoding_map));
-	for(i='a';i<='z';i++)url_encoding_map[i]=i;
-	for(i='A';i<='Z';i++)url_encoding_map[i]=i;
-	for(i='0';i<='9';i++)url_encoding_map[i]=i;
-	url_encoding_map['-']='-';
-	url_encoding_map['_']='_';
-	url_encoding_map['.']='.';
-	url_encoding_map['*']='*';
-	url_encoding_maps_initialized=true;
-}
-
-static keyval*parse_single_query(const char*query,size_t len){
-	char*p;
-	keyval*kv;
-	if(!query||!*query||len<=0)return NULL;
-	p=memchr(query,'=',len);
-	if(p==query||!(kv=kv_new()))return NULL;
-	if(p){
-		size_t kl=(size_t)(p-query),vl=len-kl-1;
-		kv_set(kv,
-			url_decode_alloc(query,kl),
-			vl>0?url_decode_alloc(p+1,vl):NULL
-		);
-	}else kv_set(kv,url_decode_alloc(query,len),NULL);
-	if(!kv->key){
-		kv_free(kv);
-		kv=NULL;
+/*
+ * urls are split in one pass into views of the original buffer, only
+ * the fields of a url struct are copied and decoded, the query walker
+ * does not copy at all. output goes through a writer that only counts
+ * when it has no buffer, so every *_alloc asks for the exact size
+ * first and then writes once. encoding and decoding copy runs of plain
+ * characters at once and only stop at characters that change.
+ */
+
+// chars not escaped by url_encode, all others are zero
+static const char url_encoding_map[256]={
+	  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,'*',  0,  0,'-','.',  0,
+	'0','1','2','3','4','5','6','7','8','9',  0,  0,  0,  0,  0,  0,
+	  0,'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O',
+	'P','Q','R','S','T','U','V','W','X','Y','Z',  0,  0,  0,  0,'_',
+	  0,'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o',
+	'p','q','r','s','t','u','v','w','x','y','z',  0,  0,  0,  0,  0,
+};
+
+struct writer{
+	char*buf;
+	size_t size,pos,used;
+	bool full;
+};
+
+#define WRITER(_buf,_size){.buf=(_buf),.size=(_buf)?(_size):0,.pos=0,.used=0,.full=false}
+
+// pieces that do not fit are dropped whole, later ones too
+static void w_put(struct writer*w,const char*s,size_t len){
+	if(w->buf&&!w->full){
+		if(w->pos+len<w->size)memcpy(w->buf+w->pos,s,len);
+		else w->full=true,w->used=w->pos;
 	}
-	return kv;
+	w->pos+=len;
 }
 
-static char*url_append_queries(
-	char*buf,size_t len,
-	int mode,list*lst,keyval**kvs
-){
+static void w_str(struct writer*w,const char*s){
+	w_put(w,s,strlen(s));
+}
+
+static void w_char(struct writer*w,char c){
+	w_put(w,&c,1);
+}
+
+static void w_int(struct writer*w,int v){
+	char b[16];
+	int l=snprintf(b,sizeof(b),"%d",v);
+	if(l>0)w_put(w,b,(size_t)l);
+}
+
+static void w_encode(struct writer*w,const char*src,size_t len,const char*map){
+	size_t i=0,j;
+	char esc[3]={'%'};
+	while(i<len){
+		for(j=i;j<len&&map[(unsigned char)src[j]]==src[j];j++);
+		if(j>i)w_put(w,src+i,j-i),i=j;
+		if(i>=len)break;
+		unsigned char c=src[i++];
+		if(map[c])w_char(w,map[c]);
+		else{
+			esc[1]=dec2hex(c>>4,true);
+			esc[2]=dec2hex(c&0xF,true);
+			w_put(w,esc,3);
+		}
+	}
+}
+
+static char*w_end(struct writer*w){
+	if(!w->buf||w->size<=0)return NULL;
+	w->buf[w->full?w->used:w->pos]=0;
+	return w->buf;
+}
+
+static inline size_t src_length(const char*src,size_t src_len){
+	return src_len==0?strlen(src):strnlen(src,src_len);
+}
+
+static inline int hex_value(unsigned char c){
+	if(c>='0'&&c<='9')return c-'0';
+	c|=0x20;
+	if(c>='a'&&c<='f')return c-'a'+10;
+	return -1;
+}
+
+static const char*find_any(const char*p,const char*end,const char*set){
+	for(;p<end;p++)if(strchr(set,*p))return p;
+	return NULL;
+}
+
+static const char*find_scheme_end(const char*p,const char*end){
+	for(;p+3<=end&&(p=memchr(p,':',end-p-2));p++)
+		if(p[1]=='/'&&p[2]=='/')return p;
+	return NULL;
+}
+
+static inline void view_set(struct url_view*v,const char*ptr,const char*end){
+	v->ptr=ptr,v->len=(size_t)(end-ptr);
+}
+
+bool url_split(struct url_parts*parts,const char*url,size_t len){
+	const char*p,*c,*end;
+	if(!parts||!url||!*url)return false;
+	memset(parts,0,sizeof(struct url_parts));
+	parts->port=-1;
+	p=url,end=url+src_length(url,len);
+	while(p<end&&isspace((unsigned char)*p))p++;
+	while(end>p&&isspace((unsigned char)end[-1]))end--;
+	if(p>=end)return false;
+	if((c=find_scheme_end(p,end))){
+		view_set(&parts->scheme,p,c);
+		p=c+3;
+	}
+	if((c=find_any(p,end,"@/"))&&*c=='@'){
+		const char*info=p,*at=c;
+		p=c+1;
+		if((c=memchr(info,':',at-info))){
+			view_set(&parts->username,info,c);
+			view_set(&parts->password,c+1,at);
+		}else view_set(&parts->username,info,at);
+	}
+	if(p<end&&*p=='['){
+		if(!(c=memchr(p,']',end-p)))return false;
+		view_set(&parts->host,p+1,c);
+		p=c+1;
+	}else if(p>=end||!strchr(":/?#",*p)){
+		if(p>=end)return false;
+		c=find_any(p,end,":/?#");
+		view_set(&parts->host,p,c?c:end);
+		if(!c)return true;
+		p=c;
+	}
+	if(p<end&&*p==':'){
+		p++,c=find_any(p,end,"/?#");
+		if(c!=p){
+			char num[16],*e=NULL;
+			view_set(&parts->port_str,p,c?c:end);
+			if(parts->port_str.len>=sizeof(num))return false;
+			memcpy(num,p,parts->port_str.len);
+			num[parts->port_str.len]=0;
+			errno=0,parts->port=strtol(num,&e,0);
+			if(errno!=0||*e)return false;
+			if(!c)return true;
+			p=c;
+		}
+	}
+	if(p<end&&*p=='/'){
+		c=find_any(p,end,"?#");
+		view_set(&parts->path,p,c?c:end);
+		if(!c)return true;
+		p=c;
+	}
+	if(p<end&&*p=='?'){
+		p++,c=memchr(p,'#',end-p);
+		view_set(&parts->query,p,c?c:end);
+		if(!c)return true;
+		p=c;
+	}
+	if(p<end&&*p=='#')view_set(&parts->fragment,p+1,end);
+	return true;
+}
+
+bool url_query_next(const char**pos,const char*end,struct url_view*key,struct url_view*value){
+	const char*p,*c,*e,*eq;
+	if(!pos||!*pos||!end||!key||!value)return false;
+	while((p=*pos)<end){
+		for(c=p;c<end&&*c!='&'&&*c!=':';c++);
+		e=c,*pos=c<end?c+1:end;
+		if(e==p||*p=='=')continue;
+		if((eq=memchr(p,'=',e-p))){
+			view_set(key,p,eq);
+			view_set(value,eq+1,e);
+		}else{
+			view_set(key,p,e);
+			value->ptr=NULL,value->len=0;
+		}
+		return true;
+	}
+	return false;
+}
+
+static bool emit_queries(struct writer*w,int mode,list*lst,keyval**kvs){
 	size_t p=0;
 	list*l=NULL;
 	bool sep=false;
-	if(!buf||len<=0)return NULL;
 	switch(mode){
 		case 1:if((l=list_first(lst)))break;//fallthrough
 		case 2:if(kvs)break;//fallthrough
-		default:return NULL;
+		default:return false;
 	}
 	for(;;){
 		keyval*kv=NULL;
@@ -74,107 +218,95 @@ static char*url_append_queries(
 			case 2:kv=kvs[p++];break;
 		}
 		if(!kv)break;
-		if(sep)strlcat(buf,"&",len);
+		if(sep)w_char(w,'&');
 		if(kv->key){
-			url_encode_append(kv->key,0,buf,len);
+			w_encode(w,kv->key,strlen(kv->key),url_encoding_map);
 			sep=true;
 		}
 		if(kv->value){
-			strlcat(buf,"=",len);
-			url_encode_append(kv->value,0,buf,len);
+			w_char(w,'=');
+			w_encode(w,kv->value,strlen(kv->value),url_encoding_map);
 			sep=true;
 		}
 	}
-	return buf;
-}
-
-static char*url_append_schema(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u)return NULL;
-	if(NE(u->scheme))
-		lsnprintf(buf,len,"%s:",u->scheme);
-	strlcat(buf,"//",len);
-	return buf;
+	return true;
 }
 
-static char*url_append_user_info(char*buf,size_t len,url*u){
+static bool emit_user_info(struct writer*w,url*u){
 	bool append=false;
-	if(!buf||len<=0||!u)return NULL;
-	if(NE(u->username))url_encode_append(
-		u->username,0,buf,len
-	),append=true;
+	if(NE(u->username)){
+		w_encode(w,u->username,strlen(u->username),url_encoding_map);
+		append=true;
+	}
 	if(NE(u->password)){
-		strlcat(buf,":",len);
-		url_encode_append(
-			u->password,0,buf,len
-		);
+		w_char(w,':');
+		w_encode(w,u->password,strlen(u->password),url_encoding_map);
 		append=true;
 	}
-	if(append)strlcat(buf,"@",len);
-	return append?buf:NULL;
+	if(append)w_char(w,'@');
+	return append;
 }
 
-static char*url_append_host(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u||!NE(u->host))return NULL;
+static bool emit_host(struct writer*w,url*u){
+	if(!NE(u->host))return false;
 	if(strpbrk(u->host,"[]#?%"))
-		url_encode_append(u->host,0,buf,len);
-	else if(strpbrk(u->host,":/@"))
-		lsnprintf(buf,len,"[%s]",u->host);
-	else strlcat(buf,u->host,len);
-	return buf;
-}
-
-static char*url_append_port(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u||u->port<0)return NULL;
-	lsnprintf(buf,len,":%d",u->port);
-	return buf;
-}
-
-static char*url_append_authority(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u)return NULL;
-	bool success=false;
-	if(url_append_user_info(buf,len,u))success=true;
-	if(url_append_host(buf,len,u))success=true;
-	if(url_append_port(buf,len,u))success=true;
-	return success?buf:NULL;
-}
-
-static char*url_append_path(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u||!NE(u->path))return NULL;
-	if(u->path[0]!='/')strlcat(buf,"/",len);
-	url_encode_append_skip(u->path,0,buf,len,"/");
-	return buf;
+		w_encode(w,u->host,strlen(u->host),url_encoding_map);
+	else if(strpbrk(u->host,":/@")){
+		w_char(w,'[');
+		w_str(w,u->host);
+		w_char(w,']');
+	}else w_str(w,u->host);
+	return true;
 }
 
-static char*url_append_hierarchical(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u)return NULL;
+static bool emit_authority(struct writer*w,url*u){
 	bool success=false;
-	if(url_append_authority(buf,len,u))success=true;
-	if(url_append_path(buf,len,u))success=true;
-	return success?buf:NULL;
-}
-
-static char*url_append_query(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u||!NE(u->query))return NULL;
-	if(NE(buf)&&!NE(u->path))strlcat(buf,"/",len);
-	lsnprintf(buf,len,"?%s",u->query);
-	return buf;
+	if(emit_user_info(w,u))success=true;
+	if(emit_host(w,u))success=true;
+	if(u->port>=0){
+		w_char(w,':');
+		w_int(w,u->port);
+		success=true;
+	}
+	return success;
 }
 
-static char*url_append_fragment(char*buf,size_t len,url*u){
-	if(!buf||len<=0||!u||!NE(u->fragment))return NULL;
-	if(NE(buf)&&!NE(u->path)&&!NE(u->query))strlcat(buf,"/",len);
-	lsnprintf(buf,len,"#%s",u->fragment);
-	return buf;
+static void emit_url(struct writer*w,url*u){
+	char map[256];
+	if(NE(u->scheme)){
+		w_str(w,u->scheme);
+		w_char(w,':');
+	}
+	w_put(w,"//",2);
+	emit_authority(w,u);
+	if(NE(u->path)){
+		if(u->path[0]!='/')w_char(w,'/');
+		memcpy(map,url_encoding_map,sizeof(map));
+		map['/']='/';
+		w_encode(w,u->path,strlen(u->path),map);
+	}
+	if(NE(u->query)){
+		if(!NE(u->path))w_char(w,'/');
+		w_char(w,'?');
+		w_str(w,u->query);
+	}
+	if(NE(u->fragment)){
+		if(!NE(u->path)&&!NE(u->query))w_char(w,'/');
+		w_char(w,'#');
+		w_str(w,u->fragment);
+	}
 }
 
-static char*url_append_all(char*buf,size_t len,url*u){
-	bool success=false;
-	if(!buf||!u||len<=0)return NULL;
-	if(url_append_schema(buf,len,u))success=true;
-	if(url_append_hierarchical(buf,len,u))success=true;
-	if(url_append_query(buf,len,u))success=true;
-	if(url_append_fragment(buf,len,u))success=true;
-	return success?buf:NULL;
+static keyval*query_to_kv(struct url_view*key,struct url_view*value){
+	keyval*kv;
+	if(!(kv=kv_new()))return NULL;
+	kv->key=url_decode_alloc(key->ptr,key->len);
+	if(kv->key&&value->len>0)kv->value=url_decode_alloc(value->ptr,value->len);
+	if(!kv->key){
+		kv_free(kv);
+		return NULL;
+	}
+	return kv;
 }
 
 static void url_parse_query(
@@ -182,40 +314,33 @@ static void url_parse_query(
 	int mode,list**lst,keyval***kvs
 ){
 	keyval*kv;
-	char*c,*p,*sep;
 	bool http=false;
-	size_t l,s,pos=0,cnt;
-	const char*del=":&";
+	size_t s,pos=0,cnt=1;
+	const char*c,*p,*q,*end;
+	struct url_view key,value;
 	switch(mode){
 		case 1:if(lst)break;//fallthrough
 		case 2:if(kvs)break;//fallthrough
 		default:return;
 	}
 	if(!url||!*url)return;
-	s=len<=0?strlen(url):strnlen(url,len);
-	sep=memchr(url,'?',s);
-	if((c=memchr(url,':',s))){
-		if(c[1]=='/'&&c[2]=='/')http=true;
-		c=NULL;
-	}
-	if(!sep&&!http)p=(char*)url;
-	else if(http&&!sep)return;
-	else if(sep)p=sep+1,s-=sep-url+1;
+	s=src_length(url,len);
+	q=memchr(url,'?',s);
+	if((c=memchr(url,':',s))&&(size_t)(c-url)+2<s&&c[1]=='/'&&c[2]=='/')http=true;
+	if(q)p=q+1;
+	else if(!http)p=url;
 	else return;
-	if((c=memchr(p,'#',s)))s=c-p,c=NULL;
-	cnt=strncnt(url,len,del)+1;
-	if(mode==2&&!(*kvs=kvarr_new(cnt+1)))return;
-	do{
-		if(c)s-=c-p+1,p=c+1,c=NULL;
-		for(l=0;del[l]&&!c;l++)c=memchr(p,del[l],s);
-		if(c==p)continue;
-		l=c?(size_t)(c-p):s;
-		if((kv=parse_single_query(p,l))){
-			if(mode==1)list_obj_add_new(lst,kv);
-			if(mode==2)(*kvs)[pos]=kv;
-			pos++;
-		}
-	}while(c&&pos<=cnt);
+	end=url+s;
+	if((c=memchr(p,'#',end-p)))end=c;
+	if(mode==2){
+		for(c=p;c<end;c++)if(*c=='&'||*c==':')cnt++;
+		if(!(*kvs=kvarr_new(cnt+1)))return;
+	}
+	while(url_query_next(&p,end,&key,&value)){
+		if(!(kv=query_to_kv(&key,&value)))continue;
+		if(mode==1)list_obj_add_new(lst,kv);
+		if(mode==2&&pos<cnt)(*kvs)[pos++]=kv;
+	}
 }
 
 static size_t url_calc(url*u){
@@ -231,31 +356,25 @@ static size_t url_calc(url*u){
 	return len;
 }
 
+size_t url_encode_len(const char*src,size_t src_len,const char*map){
+	struct writer w=WRITER(NULL,0);
+	if(!src)return 0;
+	w_encode(&w,src,src_length(src,src_len),map?map:url_encoding_map);
+	return w.pos+1;
+}
+
 char*url_encode_map(const char*src,size_t src_len,char*out,size_t out_len,const char*map){
-	if(!src||!out||out_len<4)return NULL;
-	init_url_encoding_map();
-	const char*m=map;
-	size_t len=strlen(src),pos=0;
-	if(!m)m=url_encoding_map;
-	if(len>src_len&&src_len!=0)len=src_len;
-	memset(out,0,out_len);
-	for(size_t i=0;i<len&&pos<out_len-4;i++){
-		unsigned char c=src[i];
-		if(!m[c]){
-			out[pos++]='%';
-			out[pos++]=dec2hex(c>>4&0xF,true);
-			out[pos++]=dec2hex(c&0xF,true);
-		}else out[pos++]=m[c];
-	}
-	return out;
+	struct writer w=WRITER(out,out_len);
+	if(!src||!out||out_len<=0)return NULL;
+	w_encode(&w,src,src_length(src,src_len),map?map:url_encoding_map);
+	return w_end(&w);
 }
 
 char*url_encode_skip(const char*src,size_t src_len,char*out,size_t out_len,const char*skip){
 	char map[256];
-	if(!src||!out||out_len<4||!skip)return NULL;
-	init_url_encoding_map();
+	if(!src||!out||out_len<=0||!skip)return NULL;
 	memcpy(map,url_encoding_map,sizeof(map));
-	for(int i=0,c;(c=skip[i]);i++)map[c]=c;
+	for(int i=0,c;(c=(unsigned char)skip[i]);i++)map[c]=c;
 	return url_encode_map(src,src_len,out,out_len,map);
 }
 
@@ -268,7 +387,7 @@ char*url_encode_append_map(const char*src,size_t src_len,char*buf,size_t buf_len
 	size_t l=strnlen(buf,buf_len);
 	if(buf_len-1>l)url_encode_map(
 		src,src_len,buf+l,
-		buf_len-l-1,map
+		buf_len-l,map
 	);
 	return buf;
 }
@@ -278,7 +397,7 @@ char*url_encode_append_skip(const char*src,size_t src_len,char*buf,size_t buf_le
 	size_t l=strnlen(buf,buf_len);
 	if(buf_len-1>l)url_encode_skip(
 		src,src_len,buf+l,
-		buf_len-l-1,skip
+		buf_len-l,skip
 	);
 	return buf;
 }
@@ -289,26 +408,18 @@ char*url_encode_append(const char*src,size_t src_len,char*buf,size_t buf_len){
 
 char*url_encode_alloc_map(const char*src,size_t src_len,const char*map){
 	if(!src)return NULL;
-	size_t len=strlen(src);
-	if(len>src_len&&src_len!=0)len=src_len;
-	size_t size=len*3+1;
+	size_t size=url_encode_len(src,src_len,map);
 	char*data=malloc(size);
 	if(!data)return NULL;
-	char*ret=url_encode_map(src,src_len,data,size,map);
-	if(data!=ret)free(data),ret=NULL;
-	return ret;
+	return url_encode_map(src,src_len,data,size,map);
 }
 
 char*url_encode_alloc_skip(const char*src,size_t src_len,const char*skip){
-	if(!src)return NULL;
-	size_t len=strlen(src);
-	if(len>src_len&&src_len!=0)len=src_len;
-	size_t size=len*3+1;
-	char*data=malloc(size);
-	if(!data)return NULL;
-	char*ret=url_encode_skip(src,src_len,data,size,skip);
-	if(data!=ret)free(data),ret=NULL;
-	return ret;
+	char map[256];
+	if(!src||!skip)return NULL;
+	memcpy(map,url_encoding_map,sizeof(map));
+	for(int i=0,c;(c=(unsigned char)skip[i]);i++)map[c]=c;
+	return url_encode_alloc_map(src,src_len,map);
 }
 
 char*url_encode_alloc(const char*src,size_t src_len){
@@ -316,29 +427,32 @@ char*url_encode_alloc(const char*src,size_t src_len){
 }
 
 char*url_decode(const char*src,size_t src_len,char*out,size_t out_len){
+	int h,l;
+	size_t len,pos=0,i=0,j,n;
 	if(!src||!out||out_len<=0)return NULL;
-	char x=0,c=0;
-	size_t len=strlen(src),pos=0,i=0;
-	if(len>src_len&&src_len!=0)len=src_len;
-	memset(out,0,out_len);
+	len=src_length(src,src_len);
 	while(i<len&&pos<out_len-1){
+		for(j=i;j<len&&src[j]!='%'&&src[j]!='+';j++);
+		if(j>i){
+			n=MIN(j-i,out_len-1-pos);
+			memcpy(out+pos,src+i,n);
+			pos+=n,i+=n;
+			continue;
+		}
 		if(src[i]=='+')out[pos++]=' ',i++;
-		else if(src[i]=='%'){
-			i++;
-			if((x=hex2dec(src[i]))==16)return NULL;
-			c=x<<4,i++;
-			if((x=hex2dec(src[i]))==16)return NULL;
-			c|=x,i++;
-			out[pos++]=c;
-		}else out[pos++]=src[i++];
+		else{
+			if(i+2>=len)return NULL;
+			if((h=hex_value(src[i+1]))<0||(l=hex_value(src[i+2]))<0)return NULL;
+			out[pos++]=(char)(h<<4|l),i+=3;
+		}
 	}
+	out[pos]=0;
 	return out;
 }
 
 char*url_decode_alloc(const char*src,size_t src_len){
-	size_t len=strlen(src);
-	if(len>src_len&&src_len!=0)len=src_len;
-	size_t size=len+1;
+	if(!src)return NULL;
+	size_t size=src_length(src,src_len)+1;
 	char*data=malloc(size);
 	if(!data)return NULL;
 	char*ret=url_decode(src,src_len,data,size);
@@ -358,40 +472,38 @@ keyval**url_parse_query_array(const char*url,size_t len){
 	return ret;
 }
 
+static char*generate_queries(char*buf,size_t len,int mode,list*lst,keyval**kvs){
+	struct writer w=WRITER(buf,len);
+	if(!buf||len<=0)return NULL;
+	w.pos=strnlen(buf,len);
+	if(w.pos>=len)return NULL;
+	if(!emit_queries(&w,mode,lst,kvs))return NULL;
+	return w_end(&w);
+}
+
+static char*generate_queries_alloc(int mode,list*lst,keyval**kvs){
+	char*buf;
+	struct writer w=WRITER(NULL,0);
+	if(!emit_queries(&w,mode,lst,kvs))return NULL;
+	if(!(buf=malloc(w.pos+1)))return NULL;
+	buf[0]=0;
+	return generate_queries(buf,w.pos+1,mode,lst,kvs);
+}
+
 char*url_generate_query_list(char*buf,size_t len,list*queries){
-	return url_append_queries(buf,len,1,queries,NULL);
+	return generate_queries(buf,len,1,queries,NULL);
 }
 
 char*url_generate_query_list_alloc(list*queries){
-	list*l;
-	char*buf;
-	size_t len=0;
-	if((l=list_first(queries)))do{
-		LIST_DATA_DECLARE(kv,l,keyval*);
-		if(kv->key)len+=strlen(kv->key);
-		if(kv->value)len+=strlen(kv->value);
-		len+=16;
-	}while((l=l->next));
-	if(!(buf=malloc(len)))return NULL;
-	memset(buf,0,len);
-	return url_generate_query_list(buf,len,queries);
+	return generate_queries_alloc(1,queries,NULL);
 }
 
 char*url_generate_query_array(char*buf,size_t len,keyval**queries){
-	return url_append_queries(buf,len,2,NULL,queries);
+	return generate_queries(buf,len,2,NULL,queries);
 }
 
 char*url_generate_query_array_alloc(keyval**queries){
-	char*buf;
-	size_t len=0;
-	KVARR_FOREACH(queries,kv,i){
-		if(kv->key)len+=strlen(kv->key);
-		if(kv->value)len+=strlen(kv->value);
-		len+=16;
-	}
-	if(!(buf=malloc(len)))return NULL;
-	memset(buf,0,len);
-	return url_generate_query_array(buf,len,queries);
+	return generate_queries_alloc(2,NULL,queries);
 }
 
 url*url_new(){
@@ -402,67 +514,23 @@ url*url_new(){
 	return u;
 }
 
+#define SET_PART(_name,_field) \
+	if(parts._field.len>0&&!url_set_##_name(u,parts._field.ptr,parts._field.len))goto fail;
+
 bool url_parse(url*u,const char*url,size_t len){
-	size_t s;
-	char*c,*p,*full;
-	if(!u||!url||!*url)return false;
-	if(len<=0)len=strlen(url);
-	if(!(full=strndup(url,len)))goto done;
-	trim(full);
-	p=full;
+	struct url_parts parts;
+	if(!u||!url_split(&parts,url,len))return false;
 	url_clean(u);
-	if((c=strstr(p,"://"))){
-		if((s=c-p)>0&&!url_set_scheme(u,p,s))goto done;
-		p=c+3;
-	}
-	if((c=strpbrk(p,"@/"))&&*c=='@'){
-		char*info=p;
-		size_t si=c-p;
-		p=c+1;
-		if((c=memchr(info,':',si))){
-			s=c-info;
-			if(!url_set_username(u,info,s))goto done;
-			if(!url_set_password(u,c+1,p-c-2))goto done;
-		}else if(!url_set_username(u,info,si))goto done;
-	}
-	if(*p=='['){
-		if(!(c=strchr(p,']')))goto done;
-		if(!url_set_host(u,p+1,c-p-1))goto done;
-		p=c+1;
-	}else if(*p!='/'&&*p!=':'&&*p!='?'&&*p!='#'){
-		c=strpbrk(p,":/?#"),s=c?(size_t)(c-p):0;
-		if(!url_set_host(u,p,s))goto done;
-		if(!c)goto success;
-		p=c;
-	}
-	if(*p==':'){
-		p++,c=strpbrk(p,"/?#"),s=c?(size_t)(c-p):0;
-		if(c!=p){
-			char*e=NULL;
-			errno=0,u->port=strtol(p,&e,0);
-			if(errno!=0||(*e&&e!=c))goto done;
-			if(!c)goto success;
-			p=c;
-		}
-	}
-	if(*p=='/'){
-		c=strpbrk(p,"?#");
-		if(!url_set_path(u,p,c?c-p:0))goto done;
-		if(!c)goto success;
-		p=c;
-	}
-	if(*p=='?'){
-		p++,c=strchr(p,'#');
-		if(c!=p)url_set_query(u,p,c?c-p:0);
-		if(!c)goto success;
-		p=c;
-	}
-	if(*p=='#'&&!url_set_fragment(u,p+1,0))goto done;
-	success:
-	free(full);
+	SET_PART(scheme,scheme)
+	SET_PART(username,username)
+	SET_PART(password,password)
+	SET_PART(host,host)
+	SET_PART(path,path)
+	SET_PART(query,query)
+	SET_PART(fragment,fragment)
+	u->port=parts.port;
 	return true;
-	done:
-	if(full)free(full);
+	fail:
 	url_clean(u);
 	return false;
 }
@@ -623,28 +691,36 @@ void url_free(url*u){
 }
 
 char*url_generate(char*buf,size_t len,url*u){
+	struct writer w=WRITER(buf,len);
 	if(!buf||len<=0||!u)return NULL;
-	memset(buf,0,len);
-	return url_append_all(buf,len,u);
+	emit_url(&w,u);
+	return w_end(&w);
+}
+
+size_t url_generate_len(url*u){
+	struct writer w=WRITER(NULL,0);
+	if(!u)return 0;
+	emit_url(&w,u);
+	return w.pos+1;
 }
 
 char*url_generate_alloc(url*u){
+	char*buffer;
+	size_t l;
 	if(!u)return NULL;
-	char*buffer=NULL;
-	size_t l=0;
-	if(l<=0)l=url_calc(u)*4+64;
-	if(l<=0)l=8192;
+	l=url_generate_len(u);
 	if(!(buffer=malloc(l)))return NULL;
-	char*ret=url_generate(buffer,l,u);
-	if(ret)return ret;
-	free(buffer);
-	return NULL;
+	return url_generate(buffer,l,u);
 }
 
 char*url_generate_authority(char*buf,size_t len,url*u){
+	struct writer w=WRITER(buf,len);
 	if(!buf||len<=0||!u)return NULL;
-	memset(buf,0,len);
-	return url_append_authority(buf,len,u);
+	if(!emit_authority(&w,u)){
+		buf[0]=0;
+		return NULL;
+	}
+	return w_end(&w);
 }
 
 void url_dump(char*buf,size_t len,url*u){
@@ -9,11 +9,13 @@
 #define _GNU_SOURCE
 #ifdef ENABLE_MICROHTTPD
 #ifdef ENABLE_WEBSOCKET
+#include<errno.h>
 #include<stdio.h>
 #include<stdlib.h>
 #include<stddef.h>
 #include<string.h>
 #include<strings.h>
+#include<sys/uio.h>
 #include<microhttpd.h>
 #include<microhttpd_ws.h>
 #include"logger.h"
@@ -45,26 +47,128 @@ struct ws_pkt_cmd{
 	int code;
 };
 
-int ws_write(
+/*
+ * frames are sent without copying the payload, the header is built on
+ * the stack and written with writev next to the caller's data. a sender
+ * queues its frame, if nobody is writing it becomes the writer and
+ * writes everything queued so far in one go without holding the lock,
+ * otherwise it waits until the writer marks its frame sent. the payload
+ * must only live until the call returns.
+ */
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE  0x8
+#define WS_OP_PONG   0xA
+#define WS_IOV_MAX   64
+
+struct ws_frame{
+	struct ws_frame*next;
+	unsigned char hdr[2][10];
+	struct iovec iov[4];
+	int cnt;
+	size_t len;
+	bool done;
+	int ret;
+};
+
+static void frame_add(struct ws_frame*f,int op,const void*data,size_t len){
+	unsigned char*h=f->hdr[f->cnt/2];
+	size_t hl=2;
+	h[0]=0x80|op;
+	if(len<126)h[1]=len;
+	else if(len<=0xFFFF){
+		h[1]=126,hl=4;
+		h[2]=len>>8,h[3]=len&0xFF;
+	}else{
+		h[1]=127,hl=10;
+		for(int i=0;i<8;i++)h[2+i]=(uint64_t)len>>(56-i*8);
+	}
+	f->iov[f->cnt++]=IOVEC(h,hl);
+	if(len>0)f->iov[f->cnt++]=IOVEC((void*)data,len);
+	f->len+=hl+len;
+}
+
+static int full_writev(int fd,struct iovec*iov,int cnt){
+	ssize_t r;
+	while(cnt>0){
+		errno=0;
+		if((r=writev(fd,iov,cnt))<0){
+			if(errno==EINTR||errno==EAGAIN)continue;
+			return -1;
+		}
+		for(;cnt>0&&(size_t)r>=iov->iov_len;cnt--,iov++)
+			r-=iov->iov_len;
+		if(cnt>0){
+			iov->iov_base=(char*)iov->iov_base+r;
+			iov->iov_len-=r;
+		}
+	}
+	return 0;
+}
+
+static int write_frames(int fd,struct ws_frame*list){
+	int cnt=0;
+	struct iovec iov[WS_IOV_MAX];
+	for(struct ws_frame*f=list;f;f=f->next){
+		if(cnt+f->cnt>WS_IOV_MAX){
+			if(full_writev(fd,iov,cnt)!=0)return -1;
+			cnt=0;
+		}
+		memcpy(&iov[cnt],f->iov,sizeof(struct iovec)*f->cnt);
+		cnt+=f->cnt;
+	}
+	return cnt>0?full_writev(fd,iov,cnt):0;
+}
+
+static int send_frame(
 	struct http_hand_websocket_data*w,
-	const char*data,
-	size_t len
+	struct ws_frame*f
 ){
 	int r;
-	char*dd=NULL;
-	size_t dl=0;
-	if(!data||!w||!w->ws||w->fd<0)return -1;
+	struct ws_frame*list,*next;
+	f->next=NULL,f->done=false,f->ret=-1;
 	MUTEX_LOCK(w->lock);
-	if((r=MHD_websocket_encode_binary(
-		w->ws,data,len,0,&dd,&dl
-	))==0){
-		r=full_write(w->fd,dd,dl);
-		MHD_websocket_free(w->ws,dd);
+	*w->queue_tail=f,w->queue_tail=&f->next;
+	while(!f->done){
+		if(w->writing){
+			pthread_cond_wait(&w->sent,&w->lock);
+			continue;
+		}
+		list=w->queue,w->writing=true;
+		w->queue=NULL,w->queue_tail=&w->queue;
+		MUTEX_UNLOCK(w->lock);
+		r=write_frames(w->fd,list);
+		MUTEX_LOCK(w->lock);
+		for(;list;list=next){
+			next=list->next;
+			list->ret=r==0?(int)list->len:-1;
+			list->done=true;
+		}
+		w->writing=false;
+		pthread_cond_broadcast(&w->sent);
 	}
+	r=f->ret;
 	MUTEX_UNLOCK(w->lock);
 	return r;
 }
 
+static bool can_send(struct http_hand_websocket_data*w){
+	return w&&w->ws&&w->fd>=0&&w->queue_tail&&
+		MHD_websocket_stream_is_valid(w->ws)==
+		MHD_WEBSOCKET_VALIDITY_VALID;
+}
+
+int ws_write(
+	struct http_hand_websocket_data*w,
+	const char*data,
+	size_t len
+){
+	struct ws_frame f;
+	if(!data||!can_send(w))return -1;
+	memset(&f,0,sizeof(f));
+	frame_add(&f,WS_OP_BINARY,data,len);
+	return send_frame(w,&f);
+}
+
 int ws_print(
 	struct http_hand_websocket_data*w,
 	const char*data
@@ -76,15 +180,22 @@ int ws_printf(
 	struct http_hand_websocket_data*w,
 	const char*fmt,...
 ){
-	char*d=NULL;
-	if(!fmt)return -1;
+	int r;
 	va_list va;
+	char buf[256],*d=buf;
+	if(!fmt)return -1;
 	va_start(va,fmt);
-	int r=vasprintf(&d,fmt,va);
+	r=vsnprintf(buf,sizeof(buf),fmt,va);
 	va_end(va);
-	if(!d)return -1;
+	if(r<0)return -1;
+	if((size_t)r>=sizeof(buf)){
+		if(!(d=malloc(r+1)))return -1;
+		va_start(va,fmt);
+		vsnprintf(d,r+1,fmt,va);
+		va_end(va);
+	}
 	if(r>0)r=ws_write(w,d,r);
-	free(d);
+	if(d!=buf)free(d);
 	return r;
 }
 
@@ -195,11 +306,17 @@ int ws_send_payload(
 	const void*payload,
 	size_t len
 ){
-	if(!payload)return -1;
+	int hl;
+	char head[128];
+	struct ws_frame f;
+	if(!payload||!tag||!can_send(w))return -1;
 	tlog_verbose("send %zu bytes data with tag %s",len,tag);
-	int r=ws_printf(w,"!#DATA@%s:%zu;",tag,len);
-	if(r>0)r+=ws_write(w,payload,len);
-	return r;
+	hl=snprintf(head,sizeof(head),"!#DATA@%s:%zu;",tag,len);
+	if(hl<=0||(size_t)hl>=sizeof(head))return -1;
+	memset(&f,0,sizeof(f));
+	frame_add(&f,WS_OP_BINARY,head,hl);
+	frame_add(&f,WS_OP_BINARY,payload,len);
+	return send_frame(w,&f);
 }
 
 int ws_print_payload(
@@ -264,7 +381,7 @@ static int proc_data(
 			}
 			free(d->data);
 			memset(d,0,sizeof(struct packet_data));
-			ws_send_cmd(w,"OKAY");
+			w->acks++;
 		}
 	}
 	return ret;
@@ -275,30 +392,26 @@ static void send_close(
 ){
 	size_t sl=0;
 	char *sd=NULL;
-	MUTEX_LOCK(w->lock);
+	struct ws_frame f;
 	if(MHD_websocket_encode_close(
 		w->ws,0,NULL,0,&sd,&sl
 	)==0){
-		full_write(w->fd,sd,sl);
+		memset(&f,0,sizeof(f));
+		f.iov[0]=IOVEC(sd,sl),f.cnt=1,f.len=sl;
+		send_frame(w,&f);
 		MHD_websocket_free(w->ws,sd);
 	}
-	MUTEX_UNLOCK(w->lock);
 }
 
 static void send_pong(
 	struct http_hand_websocket_data*w,
 	char**dd,size_t*dl
 ){
-	size_t sl=0;
-	char *sd=NULL;
-	MUTEX_LOCK(w->lock);
-	if(MHD_websocket_encode_pong(
-		w->ws,*dd,*dl,&sd,&sl
-	)==0){
-		full_write(w->fd,sd,sl);
-		MHD_websocket_free(w->ws,sd);
-	}
-	MUTEX_UNLOCK(w->lock);
+	struct ws_frame f;
+	if(*dl>125)return;
+	memset(&f,0,sizeof(f));
+	frame_add(&f,WS_OP_PONG,*dd,*dl);
+	send_frame(w,&f);
 }
 
 static int proc_ws_data(
@@ -361,6 +474,8 @@ static void upgrade_hand_ws(
 		return;
 	}
 	MUTEX_INIT(wsd.lock);
+	pthread_cond_init(&wsd.sent,NULL);
+	wsd.queue_tail=&wsd.queue;
 	wsd.connected=true;
 	if(wsd.hand->establish)
 		wsd.connected=wsd.hand->establish(&wsd)==0;
@@ -372,9 +487,7 @@ static void upgrade_hand_ws(
 		r=select(FD_SETSIZE,&fds,NULL,NULL,&timeout);
 		if(r<0)break;
 		if(!FD_ISSET(fd,&fds))continue;
-		MUTEX_LOCK(wsd.lock);
 		got=recv(fd,buf,sizeof(buf),0);
-		MUTEX_UNLOCK(wsd.lock);
 		if(got<=0)break;
 		size_t off=0;
 		while(off<(size_t)got){
@@ -395,11 +508,16 @@ static void upgrade_hand_ws(
 		}
 		if(bd)MHD_websocket_free(wsd.ws,bd);
 		bd=dd=NULL;
+		if(wsd.acks>0){
+			wsd.acks=0;
+			ws_send_cmd(&wsd,"OKAY");
+		}
 	}
 	end:
 	if(bd)MHD_websocket_free(wsd.ws,bd);
 	wsd.connected=false;
 	if(wsd.hand->disconnect)wsd.hand->disconnect(&wsd);
+	pthread_cond_destroy(&wsd.sent);
 	MUTEX_DESTROY(wsd.lock);
 	MHD_websocket_stream_free(wsd.ws);
 	MHD_upgrade_action(urh,MHD_UPGRADE_ACTION_CLOSE);
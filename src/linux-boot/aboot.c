@@ -20,11 +20,14 @@
 #include"fdtparser.h"
 #include"KernelFdt.h"
 #define TAG "abootimg"
+#define BOOTCONFIG_MAGIC "#BOOTCONFIG\n"
 
 static void load_kernel(linux_boot*lb,aboot_image*img){
 	if(!abootimg_have_kernel(img))return;
-	if(lb->config->skip_abootimg_kernel)
+	if(lb->config->skip_abootimg_kernel){
 		tlog_debug("skip kernel from abootimg");
+		return;
+	}
 	linux_file_clean(&lb->kernel);
 	switch(lb->arch){
 		case ARCH_ARM32:lb->kernel.offset=LINUX_ARM32_OFFSET;break;
@@ -42,10 +45,7 @@ static void load_kernel(linux_boot*lb,aboot_image*img){
 	}
 }
 
-static void load_ramdisk(linux_boot*lb,aboot_image*img){
-	if(!abootimg_have_ramdisk(img))return;
-	if(lb->config->skip_abootimg_initrd)
-		tlog_debug("skip ramdisk from abootimg");
+static void add_ramdisk(linux_boot*lb,void*data,size_t size,const char*name){
 	linux_file_info*f=malloc(sizeof(linux_file_info));
 	int cur=list_count(lb->initrd_buf);
 	if(cur<0)cur=0;
@@ -54,10 +54,10 @@ static void load_ramdisk(linux_boot*lb,aboot_image*img){
 		return;
 	}
 	ZeroMem(f,sizeof(linux_file_info));
-	f->size=abootimg_get_ramdisk_size(img);
+	f->size=size;
 	if(linux_file_allocate(f,f->size)){
-		abootimg_copy_ramdisk(img,f->address,f->mem_size);
-		tlog_info("loaded initramfs #%d image from abootimg",cur);
+		CopyMem(f->address,data,size);
+		tlog_info("loaded initramfs #%d image from %s",cur,name);
 		linux_file_dump("abootimg initramfs",f);
 		list_obj_add_new(&lb->initrd_buf,f);
 	}else{
@@ -66,6 +66,80 @@ static void load_ramdisk(linux_boot*lb,aboot_image*img){
 	}
 }
 
+static void load_ramdisk(linux_boot*lb,aboot_image*img){
+	void*data=NULL;
+	if(!abootimg_have_ramdisk(img))return;
+	if(lb->config->skip_abootimg_initrd){
+		tlog_debug("skip ramdisk from abootimg");
+		return;
+	}
+	abootimg_get_ramdisk(img,&data);
+	add_ramdisk(lb,data,abootimg_get_ramdisk_size(img),"abootimg");
+}
+
+// recovery ramdisks are only for booting into recovery
+static void load_vendor_ramdisks(linux_boot*lb,aboot_image*img){
+	void*data;
+	aboot_vendor_ramdisk vrd;
+	size_t cnt=abootimg_get_vendor_ramdisk_count(img);
+	if(cnt<=0){
+		load_ramdisk(lb,img);
+		return;
+	}
+	if(lb->config->skip_abootimg_initrd){
+		tlog_debug("skip ramdisk from vendor_boot");
+		return;
+	}
+	for(size_t i=0;i<cnt;i++){
+		if(!(data=abootimg_get_vendor_ramdisk(img,i,&vrd)))continue;
+		if(vrd.type==ABOOT_VENDOR_RAMDISK_RECOVERY){
+			tlog_debug("skip recovery vendor ramdisk '%s'",vrd.name);
+			continue;
+		}
+		if(vrd.size>0)add_ramdisk(lb,data,vrd.size,"vendor_boot");
+	}
+}
+
+static void load_dtb(linux_boot*lb,aboot_image*img){
+	if(!abootimg_have_dtb(img))return;
+	linux_file_clean(&lb->dtb);
+	lb->dtb.size=abootimg_get_dtb_size(img);
+	if(linux_file_allocate(&lb->dtb,lb->dtb.size)){
+		abootimg_copy_dtb(img,lb->dtb.address,lb->dtb.mem_size);
+		tlog_info("loaded dtb from abootimg");
+		linux_file_dump("abootimg dtb",&lb->dtb);
+	}else{
+		ZeroMem(&lb->dtb,sizeof(linux_file_info));
+		tlog_warn("allocate pages for dtb failed");
+	}
+}
+
+// bootconfig goes to the end of initramfs with its size, checksum and magic
+static void load_bootconfig(linux_boot*lb,aboot_image*img){
+	UINT8*p;
+	void*data=NULL;
+	UINT32 sum=0,len,size;
+	if(!abootimg_have_bootconfig(img))return;
+	size=abootimg_get_bootconfig(img,&data);
+	len=ALIGN_VALUE(size,4);
+	linux_file_clean(&lb->bootconfig);
+	lb->bootconfig.size=len+8+sizeof(BOOTCONFIG_MAGIC)-1;
+	if(!linux_file_allocate(&lb->bootconfig,lb->bootconfig.size)){
+		ZeroMem(&lb->bootconfig,sizeof(linux_file_info));
+		tlog_warn("allocate pages for bootconfig failed");
+		return;
+	}
+	p=lb->bootconfig.address;
+	ZeroMem(p,lb->bootconfig.size);
+	CopyMem(p,data,size);
+	for(UINT32 i=0;i<size;i++)sum+=p[i];
+	CopyMem(p+len,&len,4);
+	CopyMem(p+len+4,&sum,4);
+	CopyMem(p+len+8,BOOTCONFIG_MAGIC,sizeof(BOOTCONFIG_MAGIC)-1);
+	linux_boot_append_cmdline(lb,"bootconfig");
+	tlog_info("loaded bootconfig %u bytes from vendor_boot",size);
+}
+
 int linux_boot_load_abootimg(linux_boot*lb,aboot_image*img){
 	const char*name,*cmdline;
 
@@ -76,11 +150,18 @@ int linux_boot_load_abootimg(linux_boot*lb,aboot_image*img){
 	cmdline=abootimg_get_cmdline(img);
 	if(name&&*name)tlog_info("image name '%s'",name);
 
+	if(abootimg_is_vendor(img))
+		return trlog_warn(-1,"vendor_boot image is not a boot image");
+	tlog_debug("android boot image header version %u",abootimg_get_header_version(img));
+
 	load_kernel(lb,img);
 	load_ramdisk(lb,img);
+	load_dtb(lb,img);
 
 	if(abootimg_have_second(img))
 		tlog_warn("second stage bootloader is not supported");
+	if(abootimg_have_recovery_dtbo(img))
+		tlog_warn("recovery dtbo is not supported");
 
 	if(!lb->config->skip_abootimg_cmdline)linux_boot_append_cmdline(lb,cmdline);
 	else tlog_debug("skip cmdline from abootimg");
@@ -88,6 +169,26 @@ int linux_boot_load_abootimg(linux_boot*lb,aboot_image*img){
 	return 0;
 }
 
+int linux_boot_load_vendor_boot(linux_boot*lb,aboot_image*img){
+	const char*name,*cmdline;
+
+	if(!abootimg_is_vendor(img)||abootimg_is_invalid(img))
+		return trlog_warn(-1,"invalid vendor boot image");
+
+	name=abootimg_get_name(img);
+	cmdline=abootimg_get_cmdline(img);
+	if(name&&*name)tlog_info("vendor image name '%s'",name);
+
+	load_vendor_ramdisks(lb,img);
+	load_dtb(lb,img);
+	load_bootconfig(lb,img);
+
+	if(!lb->config->skip_abootimg_cmdline)linux_boot_append_cmdline(lb,cmdline);
+	else tlog_debug("skip cmdline from vendor_boot");
+
+	return 0;
+}
+
 int linux_boot_load_abootimg_fsh(linux_boot*lb,fsh*f){
 	int ret=-1;
 	char buff[512];
@@ -133,6 +234,31 @@ int linux_boot_load_abootimg_config(linux_boot*lb){
 	return ret;
 }
 
+int linux_boot_load_vendor_boot_config(linux_boot*lb){
+	int ret;
+	fsh*f=NULL;
+	aboot_image*img=NULL;
+	if(!lb||!lb->config)return -1;
+	linux_load_from*from=&lb->config->vendor_boot;
+	if(!from->enabled)return 0;
+	switch(from->type){
+		case FROM_LOCATE:
+			if(fs_open(NULL,&f,from->locate,FILE_FLAG_READ)!=0)break;
+			img=abootimg_load_from_fsh(f);
+			fs_close(&f);
+		break;
+		case FROM_FILE_SYSTEM_HANDLE:img=abootimg_load_from_fsh(from->fsh);break;
+		case FROM_POINTER:img=abootimg_load_from_memory(from->pointer,from->size);break;
+		case FROM_BLOCKIO_PROTOCOL:img=abootimg_load_from_blockio(from->blk_proto);break;
+		case FROM_FILE_PROTOCOL:img=abootimg_load_from_fp(from->file_proto);break;
+		default:return trlog_warn(-1,"unknown load from type");
+	}
+	if(!img)return trlog_warn(-1,"parse vendor boot image failed");
+	ret=linux_boot_load_vendor_boot(lb,img);
+	abootimg_free(img);
+	return ret;
+}
+
 int linux_boot_load_abootimg_kfdt(linux_boot*lb){
 	int ret;
 	char buf[64];
@@ -7,23 +7,126 @@
  */
 
 #include<stdint.h>
+#include<Library/TimerLib.h>
 #include<Library/BaseMemoryLib.h>
 #include<Library/MemoryAllocationLib.h>
+#include<Library/UefiBootServicesTableLib.h>
+#include<Protocol/MpService.h>
 #include<comp_libfdt.h>
 #include"str.h"
+#include"list.h"
+#include"uefi.h"
 #include"logger.h"
 #include"compress.h"
 #include"internal.h"
 #define TAG "compress"
 
+/*
+ * a kernel in a streaming format is decoded while it is read, by the end
+ * of the read only the last chunk is left. the end of the compressed data
+ * is where an appended dtb starts, nothing has to be scanned for it.
+ */
+struct kernel_stream{
+	compress_stream*cs;
+	linux_file_info out;
+	size_t fed,used,len;
+	bool failed;
+};
+
+// output goes to the custom kernel region when there is one
+static bool kernel_out_alloc(linux_boot*lb,linux_file_info*dst){
+	ZeroMem(dst,sizeof(linux_file_info));
+	dst->offset=lb->kernel.offset;
+	if(linux_boot_place(lb,&lb->kernel,dst,0))return true;
+	dst->mem_pages=EFI_SIZE_TO_PAGES(MAX_KERNEL_SIZE);
+	dst->mem_size=EFI_PAGES_TO_SIZE(dst->mem_pages);
+	if(!(dst->address=AllocateAlignedPages(dst->mem_pages,MEM_ALIGN)))
+		return trlog_error(false,"allocate for compress buffer failed");
+	dst->address+=dst->offset;
+	dst->allocated=true;
+	return true;
+}
+
+static void kernel_stream_free(linux_boot*lb){
+	struct kernel_stream*ks=lb->kstream;
+	if(!ks)return;
+	if(ks->cs)compressor_decompress_finish(ks->cs);
+	linux_file_clean(&ks->out);
+	FreePool(ks);
+	lb->kstream=NULL;
+}
+
+void linux_boot_kernel_stream(linux_boot*lb,void*data,size_t pos,size_t len){
+	compressor*comp;
+	size_t used,out,cap;
+	struct kernel_stream*ks;
+	unsigned char*inp=data;
+	if(!lb)return;
+	if(pos==0){
+		kernel_stream_free(lb);
+		if(!inp||!(comp=compressor_get_by_format(inp,len)))return;
+		if(!(ks=AllocateZeroPool(sizeof(struct kernel_stream))))return;
+		lb->kstream=ks;
+		if(
+			!(ks->cs=compressor_decompress_init(comp))||
+			!kernel_out_alloc(lb,&ks->out)
+		){
+			kernel_stream_free(lb);
+			return;
+		}
+	}
+	if(!(ks=lb->kstream)||ks->failed)return;
+	if(pos!=ks->fed){
+		ks->failed=true;
+		return;
+	}
+	ks->fed+=len;
+	cap=ks->out.mem_size-ks->out.offset;
+	while(len>0&&!compressor_decompress_is_end(ks->cs)){
+		used=0,out=0;
+		if(compressor_decompress_update(
+			ks->cs,inp,len,
+			ks->out.address+ks->len,cap-ks->len,
+			&used,&out
+		)!=0||(used<=0&&out<=0)){
+			ks->failed=true;
+			break;
+		}
+		inp+=used,len-=used;
+		ks->used+=used,ks->len+=out;
+	}
+}
+
+// takes the output of a stream that saw the whole kernel
+static bool kernel_stream_take(linux_boot*lb,linux_file_info*dst,size_t*pos,size_t*len){
+	size_t n=0,used=0,cap;
+	struct kernel_stream*ks=lb->kstream;
+	if(!ks||ks->failed||ks->fed!=lb->kernel.size)return false;
+
+	// formats without an end mark stop at the end of the data
+	cap=ks->out.mem_size-ks->out.offset;
+	if(!compressor_decompress_is_end(ks->cs)&&ks->len<cap&&compressor_decompress_update(
+		ks->cs,NULL,0,ks->out.address+ks->len,cap-ks->len,&used,&n
+	)==0)ks->len+=n;
+	if(!compressor_decompress_is_end(ks->cs))return false;
+	CopyMem(dst,&ks->out,sizeof(linux_file_info));
+	ZeroMem(&ks->out,sizeof(linux_file_info));
+	*pos=ks->used,*len=ks->len;
+	return true;
+}
+
 int linux_boot_uncompress_kernel(linux_boot*lb){
 	char buf[64];
+	UINT64 start;
 	compressor*comp;
 	size_t pos=0,len=0;
-	size_t mem_size=0,mem_pages=0;
-	unsigned char*out=NULL,*inp=(unsigned char*)lb->kernel.address;
+	linux_file_info dst;
+	unsigned char*inp=(unsigned char*)lb->kernel.address;
 	if(!lb||!inp)return -1;
-	if(!(comp=compressor_get_by_format(inp,lb->kernel.size)))return 0;
+	if(!(comp=compressor_get_by_format(inp,lb->kernel.size))){
+		kernel_stream_free(lb);
+		return 0;
+	}
 
 	tlog_debug(
 		"found %s compressed kernel size %zu bytes (%s)",
@@ -31,24 +134,31 @@ int linux_boot_uncompress_kernel(linux_boot*lb){
 		make_readable_str_buf(buf,sizeof(buf),lb->kernel.size,1,0)
 	);
 
-	mem_pages=EFI_SIZE_TO_PAGES(MAX_KERNEL_SIZE);
-	mem_size=EFI_PAGES_TO_SIZE(mem_pages);
-	if(!(out=AllocateAlignedPages(mem_pages,MEM_ALIGN)))
-		EDONE(tlog_error("allocate for compress buffer failed"));
-	ZeroMem(out,mem_size);
-
-	if(compressor_decompress(
-		comp,
-		inp,lb->kernel.size,
-		out+lb->kernel.offset,
-		mem_size-lb->kernel.offset,
-		&pos,&len
-	)!=0)EDONE(tlog_error("decompress kernel failed at %zu",pos));
-	tlog_info(
-		"decompressed kernel size %zu (%s %d%%)",len,
-		make_readable_str_buf(buf,sizeof(buf),len,1,0),
-		(int)(lb->kernel.size*100/len)
-	);
+	if(kernel_stream_take(lb,&dst,&pos,&len)){
+		kernel_stream_free(lb);
+		tlog_info(
+			"decompressed kernel size %zu (%s %d%%) while loading",len,
+			make_readable_str_buf(buf,sizeof(buf),len,1,0),
+			(int)(lb->kernel.size*100/len)
+		);
+	}else{
+		kernel_stream_free(lb);
+		if(!kernel_out_alloc(lb,&dst))return -1;
+		start=GetPerformanceCounter();
+		if(compressor_decompress(
+			comp,
+			inp,lb->kernel.size,
+			dst.address,
+			dst.mem_size-dst.offset,
+			&pos,&len
+		)!=0)EDONE(tlog_error("decompress kernel failed at %zu",pos));
+		tlog_info(
+			"decompressed kernel size %zu (%s %d%%) in %llu us",len,
+			make_readable_str_buf(buf,sizeof(buf),len,1,0),
+			(int)(lb->kernel.size*100/len),
+			(unsigned long long)boottime_elapsed_us(start)
+		);
+	}
 
 	if(pos<lb->kernel.size){
 		bool should=!lb->dtb.address;
@@ -73,16 +183,168 @@ int linux_boot_uncompress_kernel(linux_boot*lb){
 		lb->kernel.address-lb->kernel.offset,
 		lb->kernel.mem_pages
 	);
-	lb->kernel.address=out+lb->kernel.offset;
-	lb->kernel.allocated=true;
+	lb->kernel.address=dst.address;
+	lb->kernel.allocated=dst.allocated;
+	lb->kernel.placed=dst.placed;
 	lb->kernel.decompressed=true;
-	lb->kernel.mem_pages=mem_pages;
-	lb->kernel.mem_size=mem_size;
+	lb->kernel.mem_pages=dst.mem_pages;
+	lb->kernel.mem_size=dst.mem_size;
 	lb->kernel.size=len;
 	lb->status.compressed=true;
 	linux_file_dump("decompressed kernel",&lb->kernel);
 	return 0;
 	done:
-	if(out)FreePages(out,mem_pages);
+	linux_file_clean(&dst);
 	return -1;
 }
+
+/*
+ * initramfs files are often several compressed members one after another.
+ * every file is an independent job, application processors take jobs
+ * whose members use a standalone decompressor, anything they cannot finish
+ * (other formats, output buffer too small) is completed on the BSP later.
+ */
+struct initrd_job{
+	linux_file_info*fi;
+	linux_file_info dst;
+	size_t pos,len;
+	bool done;
+};
+
+struct initrd_work{
+	struct initrd_job*jobs;
+	size_t cnt,next;
+};
+
+// members are decoded one by one, returns -1 when the job is not finished
+static int decode_members(struct initrd_job*j,bool ap){
+	compressor*comp;
+	size_t left,cap,used,len;
+	unsigned char*inp=j->fi->address,*out=j->dst.address;
+	while(j->pos<j->fi->size){
+
+		// kernel allows zero padding between members
+		if(!inp[j->pos]){
+			j->pos++;
+			continue;
+		}
+		left=j->fi->size-j->pos,cap=j->dst.mem_size-j->len;
+
+		// plain cpio, the kernel unpacks anything after it by itself
+		if(!(comp=compressor_get_by_format(inp+j->pos,left))){
+			if(left>cap)return -1;
+			CopyMem(out+j->len,inp+j->pos,left);
+			j->pos+=left,j->len+=left;
+			break;
+		}
+		if(ap&&!compressor_is_standalone(comp))return -1;
+		used=0,len=0;
+		if(compressor_decompress(
+			comp,inp+j->pos,left,
+			out+j->len,cap,&used,&len
+		)!=0||used<=0)return -1;
+		j->pos+=used,j->len+=len;
+	}
+	j->done=true;
+	return 0;
+}
+
+static int finish_job(struct initrd_job*j){
+	linux_file_info n;
+	while(!j->done&&decode_members(j,false)!=0){
+		if(j->dst.mem_size>=MAX_INITRD_SIZE)return trlog_warn(
+			-1,"decompress initramfs failed at %zu",j->pos
+		);
+
+		// out of room or bad data, retry the member with twice the buffer
+		ZeroMem(&n,sizeof(n));
+		if(!linux_file_allocate(&n,MIN(j->dst.mem_size*2,MAX_INITRD_SIZE)))
+			return -1;
+		CopyMem(n.address,j->dst.address,j->len);
+		linux_file_clean(&j->dst);
+		CopyMem(&j->dst,&n,sizeof(n));
+	}
+	return 0;
+}
+
+static void run_jobs(struct initrd_work*w,bool ap){
+	size_t i;
+	while((i=__atomic_fetch_add(&w->next,1,__ATOMIC_ACQ_REL))<w->cnt)
+		if(ap)decode_members(&w->jobs[i],true);
+		else finish_job(&w->jobs[i]);
+}
+
+static VOID EFIAPI initrd_ap_proc(VOID*arg){
+	run_jobs(arg,true);
+}
+
+static void run_parallel(struct initrd_work*w){
+	UINTN idx,cpus=0,enabled=0;
+	EFI_STATUS st;
+	EFI_EVENT ev=NULL;
+	EFI_MP_SERVICES_PROTOCOL*mp=NULL;
+	if(w->cnt<=1)return;
+	st=gBS->LocateProtocol(&gEfiMpServiceProtocolGuid,NULL,(VOID**)&mp);
+	if(EFI_ERROR(st)||!mp)return;
+	st=mp->GetNumberOfProcessors(mp,&cpus,&enabled);
+	if(EFI_ERROR(st)||enabled<=1)return;
+	tlog_debug("decompress %zu initramfs on %llu processors",w->cnt,(unsigned long long)enabled);
+
+	// the BSP takes jobs too when the firmware can run APs in background
+	st=gBS->CreateEvent(0,TPL_CALLBACK,NULL,NULL,&ev);
+	if(!EFI_ERROR(st))st=mp->StartupAllAPs(mp,initrd_ap_proc,FALSE,ev,0,w,NULL);
+	if(!EFI_ERROR(st)){
+		run_jobs(w,false);
+		gBS->WaitForEvent(1,&ev,&idx);
+	}else{
+		if(st==EFI_UNSUPPORTED)st=mp->StartupAllAPs(
+			mp,initrd_ap_proc,FALSE,NULL,0,w,NULL
+		);
+		if(EFI_ERROR(st))tlog_debug(
+			"start application processors failed: %s",
+			efi_status_to_string(st)
+		);
+	}
+	if(ev)gBS->CloseEvent(ev);
+}
+
+int linux_boot_uncompress_initrd(linux_boot*lb){
+	list*f;
+	char buf[64];
+	size_t i,cnt=0;
+	struct initrd_job*jobs;
+	struct initrd_work work;
+	if(!lb||!(cnt=list_count(lb->initrd_buf)))return 0;
+	if(!(jobs=AllocateZeroPool(sizeof(struct initrd_job)*cnt)))return -1;
+
+	// output buffers are set up here, application processors can not allocate
+	i=0,f=list_first(lb->initrd_buf);
+	if(f)do{
+		LIST_DATA_DECLARE(d,f,linux_file_info*);
+		if(!d->address||!compressor_get_by_format(d->address,d->size))continue;
+		if(!linux_file_allocate(&jobs[i].dst,MIN(
+			MAX(d->size*4,(size_t)MEM_ALIGN),
+			(size_t)MAX_INITRD_SIZE
+		)))break;
+		jobs[i++].fi=d;
+	}while((f=f->next));
+	ZeroMem(&work,sizeof(work));
+	work.jobs=jobs,work.cnt=i;
+	run_parallel(&work);
+	for(i=0;i<work.cnt;i++){
+		if(finish_job(&jobs[i])!=0){
+			linux_file_clean(&jobs[i].dst);
+			continue;
+		}
+		tlog_info(
+			"decompressed initramfs #%zu size %zu (%s)",i,jobs[i].len,
+			make_readable_str_buf(buf,sizeof(buf),jobs[i].len,1,0)
+		);
+		linux_file_clean(jobs[i].fi);
+		CopyMem(jobs[i].fi,&jobs[i].dst,sizeof(linux_file_info));
+		jobs[i].fi->size=jobs[i].len;
+		jobs[i].fi->decompressed=true;
+	}
+	FreePool(jobs);
+	return 0;
+}
@@ -150,6 +150,7 @@ linux_config*linux_config_new_from_confd(const char*key){
 	if(!cfg)return NULL;
 	confd_get_sstring_base(key,"cmdline",NULL,cfg->cmdline,sizeof(cfg->cmdline));
 	get_from_confd(&cfg->abootimg,key,"abootimg");
+	get_from_confd(&cfg->vendor_boot,key,"vendor_boot");
 	get_from_confd(&cfg->kernel,key,"kernel");
 	get_multi_from_confd(&cfg->initrd,key,"initrd");
 	get_multi_from_confd(&cfg->dtbo,key,"dtbo");
@@ -175,6 +176,7 @@ linux_config*linux_config_new_from_confd(const char*key){
 	load_boolean(key,"pass_kernel_fdt_as_dtb",cfg->pass_kfdt_dtb);
 	load_boolean(key,"use_kernel_fdt_ramdisk_kernel",cfg->use_kfdt_ramdisk_kernel);
 	load_boolean(key,"use_kernel_fdt_ramdisk_abootimg",cfg->use_kfdt_ramdisk_abootimg);
+	load_boolean(key,"decompress_initrd",cfg->decompress_initrd);
 	load_boolean(key,"add_simplefb",cfg->screen.add_simplefb);
 	load_boolean(key,"update_splash",cfg->screen.update_splash);
 	get_multi_str_from_confd(&cfg->dtb_model,key,"dtb_model");
@@ -12,6 +12,7 @@
 #include<Library/BaseMemoryLib.h>
 #include<Library/DevicePathLib.h>
 #include<Library/MemoryAllocationLib.h>
+#include<Library/UefiBootServicesTableLib.h>
 #include<comp_libfdt.h>
 #include<stdint.h>
 #include"list.h"
@@ -21,74 +22,159 @@
 #include"internal.h"
 #define TAG "fdt"
 
-static list*fdts=NULL;
+/*
+ * appended dtbs are found by scanning for the first magic byte and are
+ * checked where they are, only the selected one gets copied. what was
+ * parsed out of an image is kept by the crc of the whole image, so
+ * booting the same kernel again only looks at the headers.
+ */
+#define DTB_CACHE_MAX 8
 
 typedef struct fdt_info{
 	size_t id;
 	fdt address;
 	size_t offset;
 	size_t size;
-	size_t mem_size;
-	size_t mem_pages;
 	char model[256];
 	qcom_chip_info info;
 	int64_t vote;
 	list*compatibles;
 }fdt_info;
 
-static void search_dtb(linux_boot*lb,void*buff,void**pos){
-	fdt_info fi;
+typedef struct dtb_cache{
+	UINT32 crc;
+	size_t size;
+	size_t cnt;
+	fdt_info*fdts;
+	bool qualcomm;
+}dtb_cache;
+
+static struct list_head fdts=LIST_HEAD_INIT;
+static dtb_cache dtb_caches[DTB_CACHE_MAX];
+static size_t dtb_cache_next=0;
+
+static void*find_magic(void*pos,void*end){
+	UINT8*p=pos,*e=end;
+	while(e-p>=4){
+		if(!(p=ScanMem8(p,e-p-3,((UINT8*)&fdt_magic)[0])))break;
+		if(CompareMem(p,&fdt_magic,4)==0)return p;
+		p++;
+	}
+	return NULL;
+}
+
+// libfdt wants aligned blobs, unaligned ones are checked in a copy
+static bool parse_dtb(linux_boot*lb,void*blob,void*scratch,fdt_info*fi){
 	int len,off=0;
 	char*model,*comps,*comp;
-	if(CompareMem(&fdt_magic,(*pos),4)!=0)goto fail;
-
-	ZeroMem(&fi,sizeof(fdt_info));
-	fi.size=fdt_totalsize((*pos));
-	if(fi.size<=0||fi.size>=MAX_DTB_SIZE)goto fail;
-	ZeroMem(buff,MAX_DTB_SIZE);
-	CopyMem(buff,(*pos),fi.size);
-	fi.offset=(*pos)-lb->dtb.address;
-	(*pos)+=fi.size;
-	if(fdt_check_header(buff)!=0)return;
-	if(fdt_path_offset(buff,"/")!=0)return;
-	fi.mem_pages=EFI_SIZE_TO_PAGES(ALIGN_VALUE(fi.size,MEM_ALIGN));
-	fi.mem_size=EFI_PAGES_TO_SIZE(fi.mem_pages);
-	if(!(fi.address=AllocateAlignedPages(fi.mem_pages,MEM_ALIGN)))return;
-	ZeroMem(fi.address,fi.mem_size);
-	CopyMem(fi.address,buff,fi.size);
-	fi.id=MAX(list_count(fdts),0);
-
-	model=(char*)fdt_getprop(fi.address,0,"model",&len);
+	void*dtb=blob;
+	if((UINTN)blob%sizeof(UINT32)!=0){
+		if(!scratch)return false;
+		CopyMem(scratch,blob,fi->size);
+		dtb=scratch;
+	}
+	if(fdt_check_header(dtb)!=0)return false;
+	if(fdt_path_offset(dtb,"/")!=0)return false;
+	fi->address=blob;
+	fi->id=list_head_count(&fdts);
+
+	model=(char*)fdt_getprop(dtb,0,"model",&len);
 	if(!model)model="Linux Device Tree Blob";
-	AsciiStrCpyS(fi.model,sizeof(fi.model),model);
+	AsciiStrCpyS(fi->model,sizeof(fi->model),model);
 
-	if((comps=(char*)fdt_getprop(fi.address,0,"compatible",&len)))do{
+	if((comps=(char*)fdt_getprop(dtb,0,"compatible",&len)))do{
 		comp=comps+off;
 		if(!*comp)continue;
-		list_obj_add_new_strdup(&fi.compatibles,comp);
+		list_obj_add_new_strdup(&fi->compatibles,comp);
 		off+=strlen(comp);
 	}while(++off<len);
 
-	qcom_parse_id(fi.address,&fi.info);
-	if(fi.info.soc_id!=0)lb->status.qualcomm=true;
+	qcom_parse_id(dtb,&fi->info);
+	if(fi->info.soc_id!=0)lb->status.qualcomm=true;
 	tlog_verbose(
 		"dtb id %zu offset %zu size %zu (%s)",
-		fi.id,fi.offset,fi.size,fi.model
+		fi->id,fi->offset,fi->size,fi->model
 	);
-
-	list_obj_add_new_dup(&fdts,&fi,sizeof(fdt_info));
-	return;
-	fail:(*pos)++;
+	return true;
 }
 
-static int free_fdt(void*d){
-	fdt_info*f=(fdt_info*)d;
-	if(!f)return 0;
-	if(f->address)FreePages(f->address,f->mem_pages);
-	free(f);
+static int search_dtbs(linux_boot*lb){
+	fdt_info fi;
+	void*pos,*end,*scratch=NULL;
+	pos=lb->dtb.address,end=pos+lb->dtb.size;
+	while((pos=find_magic(pos,end))){
+		ZeroMem(&fi,sizeof(fdt_info));
+		fi.size=fdt_totalsize(pos);
+		if(fi.size<=0||fi.size>=MAX_DTB_SIZE||fi.size>(size_t)(end-pos)){
+			pos++;
+			continue;
+		}
+		if(!scratch&&(UINTN)pos%sizeof(UINT32)!=0&&!(scratch=AllocatePool(MAX_DTB_SIZE)))
+			return trlog_error(-1,"allocate for fdt buff failed");
+		fi.offset=pos-lb->dtb.address;
+		if(parse_dtb(lb,pos,scratch,&fi))
+			list_head_push_new_dup(&fdts,&fi,sizeof(fdt_info));
+		pos+=fi.size;
+	}
+	if(scratch)FreePool(scratch);
 	return 0;
 }
 
+static void cache_free(dtb_cache*c){
+	if(c->fdts){
+		for(size_t i=0;i<c->cnt;i++)
+			list_free_all_def(c->fdts[i].compatibles);
+		FreePool(c->fdts);
+	}
+	ZeroMem(c,sizeof(dtb_cache));
+}
+
+// the cache takes over the compatible lists, fdts only borrows them
+static bool cache_store(linux_boot*lb,UINT32 crc){
+	list*f;
+	size_t i=0;
+	dtb_cache*c=&dtb_caches[dtb_cache_next];
+	cache_free(c);
+	if(!(c->fdts=AllocateZeroPool(sizeof(fdt_info)*MAX(list_head_count(&fdts),1))))return false;
+	if((f=fdts.first))do{
+		CopyMem(&c->fdts[i++],LIST_DATA(f,fdt_info*),sizeof(fdt_info));
+	}while((f=f->next));
+	c->crc=crc,c->size=lb->dtb.size,c->cnt=i;
+	c->qualcomm=lb->status.qualcomm;
+	dtb_cache_next=(dtb_cache_next+1)%DTB_CACHE_MAX;
+	return true;
+}
+
+static bool cache_load(linux_boot*lb,UINT32 crc){
+	fdt_info fi;
+	dtb_cache*c=NULL;
+	for(size_t i=0;i<DTB_CACHE_MAX;i++){
+		if(!dtb_caches[i].fdts)continue;
+		if(dtb_caches[i].crc!=crc||dtb_caches[i].size!=lb->dtb.size)continue;
+		c=&dtb_caches[i];
+		break;
+	}
+	if(!c)return false;
+	for(size_t i=0;i<c->cnt;i++){
+		CopyMem(&fi,&c->fdts[i],sizeof(fdt_info));
+		fi.address=lb->dtb.address+fi.offset,fi.vote=0;
+		if(CompareMem(fi.address,&fdt_magic,4)!=0)return false;
+		list_head_push_new_dup(&fdts,&fi,sizeof(fdt_info));
+	}
+	lb->status.qualcomm=c->qualcomm;
+	tlog_debug("use cached dtb list");
+	return true;
+}
+
+static void fdts_free(bool own){
+	list*f;
+	if(own&&(f=fdts.first))do{
+		LIST_DATA_DECLARE(fi,f,fdt_info*);
+		list_free_all_def(fi->compatibles);
+	}while((f=f->next));
+	list_head_free_all_def(&fdts);
+}
+
 static bool sort_fdt(list*f1,list*f2){
 	LIST_DATA_DECLARE(d1,f1,fdt_info*);
 	LIST_DATA_DECLARE(d2,f2,fdt_info*);
@@ -113,7 +199,7 @@ static int check_dtbs(linux_boot*lb){
 	}
 	if(!auto_vote)tlog_debug("disabled dtb auto vote");
 	else if(qcom_get_chip_info(lb,&chip_info)!=0)return -1;
-	if((f=list_first(fdts)))do{
+	if((f=fdts.first))do{
 		LIST_DATA_DECLARE(fdt,f,fdt_info*);
 		if(auto_vote){
 			tlog_verbose("voting dtb %zu (%s)",fdt->id,fdt->model);
@@ -143,26 +229,32 @@ static int check_dtbs(linux_boot*lb){
 			(long long)fdt->vote,fdt->model
 		);
 	}while((f=f->next));
-	list_sort(fdts,sort_fdt);
+	list_head_sort(&fdts,sort_fdt);
 	return 0;
 }
 
+// the candidate lives in the old blob, it is dropped once copied
 static int select_dtb(linux_boot*lb,fdt_info*info){
+	linux_file_info old;
 	lb->status.dtb_id=(int64_t)info->id;
 	tlog_info("select dtb id %zu (%s)",info->id,info->model);
+	CopyMem(&old,&lb->dtb,sizeof(linux_file_info));
+	ZeroMem(&lb->dtb,sizeof(linux_file_info));
 	linux_boot_set_fdt(lb,info->address,info->size);
+	linux_file_clean(&old);
 	return 0;
 }
 
 int linux_boot_select_fdt(linux_boot*lb){
 	list*f=NULL;
 	int r,ret=-1;
+	UINT32 crc=0;
+	bool own=true;
 	fdt_info*fdt=NULL;
-	void*buff,*end,*pos;
-	if(!lb->config)return -1;
-	if(!lb||!lb->dtb.address)return 0;
-	list_free_all(fdts,free_fdt);
-	lb->status.qualcomm=false,fdts=NULL;
+	if(!lb||!lb->config)return -1;
+	if(!lb->dtb.address)return 0;
+	fdts_free(true);
+	lb->status.qualcomm=false;
 	r=fdt_check_header(lb->dtb.address);
 	if(r!=0){
 		tlog_warn("invalid dtb head: %s",fdt_strerror(r));
@@ -170,17 +262,20 @@ int linux_boot_select_fdt(linux_boot*lb){
 		return -1;
 	}
 	if(fdt_totalsize(lb->dtb.address)==lb->dtb.size)return 0;
-	if(!(buff=AllocateZeroPool(MAX_DTB_SIZE)))
-		EDONE(tlog_error("allocate for fdt buff failed"));
 
-	pos=lb->dtb.address,end=pos+lb->dtb.size;
-	while(pos<end-4)search_dtb(lb,buff,&pos);
-	FreePool(buff);
-	tlog_info("found %d dtbs",fdts?list_count(fdts):0);
-	if(!fdts)EDONE(tlog_warn("no dtb found"));
+	if(EFI_ERROR(gBS->CalculateCrc32(lb->dtb.address,lb->dtb.size,&crc)))crc=0;
+	if(crc&&cache_load(lb,crc))own=false;
+	else{
+		fdts_free(false);
+		lb->status.qualcomm=false;
+		if(search_dtbs(lb)!=0)goto done;
+		if(crc&&fdts.first&&cache_store(lb,crc))own=false;
+	}
+	tlog_info("found %zu dtbs",list_head_count(&fdts));
+	if(!fdts.first)EDONE(tlog_warn("no dtb found"));
 	check_dtbs(lb);
 	if(
-		!(f=list_first(fdts))||
+		!(f=fdts.first)||
 		!(fdt=LIST_DATA(f,fdt_info*))
 	)EDONE(tlog_warn("no dtb found"));
 	if(fdt->vote<0)EDONE(tlog_warn(
@@ -189,7 +284,6 @@ int linux_boot_select_fdt(linux_boot*lb){
 	));
 	ret=select_dtb(lb,fdt);
 	done:
-	list_free_all(fdts,free_fdt);
-	fdts=NULL;
+	fdts_free(own);
 	return ret;
 }
@@ -26,7 +26,23 @@
 #include"internal.h"
 #define TAG "dtbo"
 
+/*
+ * the merged tree is kept by one crc over the base tree, every overlay
+ * file and the config, booting the same entry again copies it instead
+ * of parsing, voting and applying the overlays a second time.
+ */
+#define DTBO_CACHE_MAX 4
+
+typedef struct dtbo_cache{
+	UINT32 crc;
+	void*merged;
+	size_t size,cap;
+	int64_t dtbo_id;
+}dtbo_cache;
+
 static list*dtbos;
+static dtbo_cache dtbo_caches[DTBO_CACHE_MAX];
+static size_t dtbo_cache_next=0;
 typedef struct dtbo_info{
 	size_t id;
 	fdt address;
@@ -218,7 +234,63 @@ static int fi_free(void*data){
 	return 0;
 }
 
+static UINT32 cache_key(linux_boot*lb){
+	list*f;
+	UINT32*v,crc=0;
+	UINTN i=0,cnt=list_count(lb->dtbo)*2+4;
+	if(!(v=AllocateZeroPool(cnt*sizeof(UINT32))))return 0;
+	v[i++]=fdt_totalsize(lb->dtb.address);
+	if(EFI_ERROR(gBS->CalculateCrc32(lb->dtb.address,v[0],&v[i++])))goto done;
+	if(lb->config->tag[0]&&EFI_ERROR(gBS->CalculateCrc32(
+		lb->config->tag,AsciiStrLen(lb->config->tag),&v[i]
+	)))goto done;
+	i++;
+	v[i++]=(UINT32)lb->config->dtbo_id;
+	if((f=list_first(lb->dtbo)))do{
+		LIST_DATA_DECLARE(fi,f,linux_file_info*);
+		v[i++]=(UINT32)fi->size;
+		if(EFI_ERROR(gBS->CalculateCrc32(fi->address,fi->size,&v[i++])))goto done;
+	}while((f=f->next));
+	if(EFI_ERROR(gBS->CalculateCrc32(v,i*sizeof(UINT32),&crc)))crc=0;
+	done:
+	FreePool(v);
+	return crc;
+}
+
+static void cache_store(linux_boot*lb,UINT32 crc){
+	dtbo_cache*c=&dtbo_caches[dtbo_cache_next];
+	size_t size=fdt_totalsize(lb->dtb.address);
+	if(c->merged)FreePool(c->merged);
+	ZeroMem(c,sizeof(dtbo_cache));
+	if(!(c->merged=AllocateCopyPool(size,lb->dtb.address)))return;
+	c->crc=crc,c->size=size;
+	c->cap=MAX(lb->dtb.mem_size-lb->dtb.offset,size);
+	c->dtbo_id=lb->status.dtbo_id;
+	dtbo_cache_next=(dtbo_cache_next+1)%DTBO_CACHE_MAX;
+}
+
+// keeps the room the tree had, later updates grow it in place
+static bool cache_load(linux_boot*lb,UINT32 crc){
+	linux_file_info n;
+	dtbo_cache*c=NULL;
+	for(size_t i=0;i<DTBO_CACHE_MAX&&!c;i++)
+		if(dtbo_caches[i].merged&&dtbo_caches[i].crc==crc)
+			c=&dtbo_caches[i];
+	if(!c)return false;
+	ZeroMem(&n,sizeof(n));
+	if(!linux_file_allocate(&n,c->cap))return false;
+	CopyMem(n.address,c->merged,c->size);
+	ZeroMem(n.address+c->size,c->cap-c->size);
+	linux_file_clean(&lb->dtb);
+	CopyMem(&lb->dtb,&n,sizeof(n));
+	lb->dtb.size=c->size;
+	lb->status.dtbo_id=c->dtbo_id;
+	tlog_debug("use cached dtb with overlays applied");
+	return true;
+}
+
 int linux_boot_apply_dtbo(linux_boot*lb){
+	UINT32 crc;
 	list*f;
 	int r=0;
 	size_t i=0;
@@ -227,6 +299,7 @@ int linux_boot_apply_dtbo(linux_boot*lb){
 	if(!lb->dtbo||!lb->dtb.address)return 0;
 	if(lb->config->skip_dtbo)
 		EDONE(tlog_debug("skip load dtbo"));
+	if((crc=cache_key(lb))&&cache_load(lb,crc))goto done;
 	if((f=list_first(lb->dtbo)))do{
 		i++;
 		LIST_DATA_DECLARE(fi,f,linux_file_info*);
@@ -254,6 +327,7 @@ int linux_boot_apply_dtbo(linux_boot*lb){
 		}
 		if(xr!=0)r=xr;
 	}while((f=f->next));
+	if(r==0&&crc)cache_store(lb,crc);
 	done:
 	list_free_all(lb->dtbo,fi_free);
 	lb->dtbo=NULL;
@@ -39,7 +39,7 @@ int linux_boot_set_fdt(linux_boot*lb,void*data,size_t size){
 	ZeroMem(lb->dtb.address,lb->dtb.mem_size);
 	CopyMem(lb->dtb.address,data,lb->dtb.size);
 
-	if(fdt_check_header(data)!=0)
+	if(fdt_check_header(lb->dtb.address)!=0)
 		EDONE(tlog_error("invalid dtb"));
 
 	tlog_info(
@@ -136,6 +136,7 @@ int linux_boot_update_fdt(linux_boot*lb){
 	linux_boot_update_splash(lb);
 	linux_boot_update_info(lb);
 	linux_boot_update_uefi(lb);
+	linux_boot_update_boottime(lb);
 
 	lb->dtb.size=fdt_totalsize(lb->dtb.address);
 	tlog_debug(
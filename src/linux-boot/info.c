@@ -12,6 +12,7 @@
 #include<Library/UefiBootServicesTableLib.h>
 #include<comp_libfdt.h>
 #include"str.h"
+#include"uefi.h"
 #include"version.h"
 #include"logger.h"
 #include"internal.h"
@@ -76,3 +77,24 @@ int linux_boot_update_info(linux_boot*lb){
 
 	return 0;
 }
+
+// exported as "name=usec" strings, so linux side tools can read the phases
+int linux_boot_update_boottime(linux_boot*lb){
+	int r;
+	UINTN len;
+	CHAR8 buff[BUFSIZ];
+	if(!lb->dtb.address)return 0;
+	boottime_mark("linux-fdt-update");
+	if((len=boottime_dump(buff,sizeof(buff)))<=0)return 0;
+	r=fdt_path_offset(lb->dtb.address,"/chosen");
+	if(r<0)return trlog_warn(
+		-1,"get chosen node failed: %s",
+		fdt_strerror(r)
+	);
+	fdt_setprop(
+		lb->dtb.address,r,
+		"simpleinit,boottime",
+		buff,len
+	);
+	return 0;
+}
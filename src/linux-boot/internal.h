@@ -48,6 +48,7 @@ typedef struct kernel_device_path{
 typedef struct linux_file_info{
 	bool allocated;
 	bool decompressed;
+	bool placed;
 	EFI_DEVICE_PATH_PROTOCOL*device;
 	kernel_device_path mem_device;
 	void*address;
@@ -65,22 +66,26 @@ typedef struct linux_boot_status{
 	bool qualcomm;
 }linux_boot_status;
 
+struct kernel_stream;
+
 // linux boot info
 typedef struct linux_boot{
 	linux_file_info kernel;
 	linux_file_info initrd;
 	linux_file_info dtb;
+	linux_file_info bootconfig;
 	list*initrd_buf;
 	list*dtbo;
 	linux_config*config;
+	struct kernel_stream*kstream;
 	linux_boot_status status;
 	linux_boot_arch arch;
 	char cmdline[
 		(PATH_MAX*2)-
-		sizeof(linux_file_info)*3-
+		sizeof(linux_file_info)*4-
 		sizeof(linux_boot_arch)-
 		sizeof(linux_boot_status)-
-		(sizeof(void*)*3)
+		(sizeof(void*)*4)
 	];
 }linux_boot;
 
@@ -92,12 +97,18 @@ typedef union linux_kernel_main{
 	linux_kernel_arm64_main arm64;
 }linux_kernel_main;
 
+// receives a file in order while it is being loaded
+typedef void(*linux_load_sink)(linux_boot*lb,void*data,size_t pos,size_t len);
+
 // src/linux-boot/loader.c: allocate pages memory for file
 extern bool linux_file_allocate(linux_file_info*fi,size_t size);
 
 // src/linux-boot/loader.c: load linux file into memory
 extern int linux_file_load(linux_file_info*fi,linux_load_from*from);
 
+// src/linux-boot/loader.c: load linux file into memory and pass it to sink
+extern int linux_file_load_sink(linux_file_info*fi,linux_load_from*from,linux_load_sink sink,linux_boot*lb);
+
 // src/linux-boot/loader.c: load linux files from confd
 extern int linux_load_from_config(linux_boot*lb);
 
@@ -116,15 +127,33 @@ extern int linux_boot_load_abootimg_path(linux_boot*lb,char*path);
 // src/linux-boot/aboot.c: load abootimg from config
 extern int linux_boot_load_abootimg_config(linux_boot*lb);
 
+// src/linux-boot/aboot.c: load vendor_boot image
+extern int linux_boot_load_vendor_boot(linux_boot*lb,aboot_image*img);
+
+// src/linux-boot/aboot.c: load vendor_boot image from config
+extern int linux_boot_load_vendor_boot_config(linux_boot*lb);
+
 // src/linux-boot/aboot.c: load abootimg from kernel fdt
 extern int linux_boot_load_abootimg_kfdt(linux_boot*lb);
 
 // src/linux-boot/move.c: move files to specified memory region
 extern int linux_boot_move(linux_boot*lb);
 
+// src/linux-boot/move.c: clear kernel bss after the image
+extern int linux_boot_clear_bss(linux_boot*lb);
+
+// src/linux-boot/move.c: put file at the final address of dst before filling it
+extern bool linux_boot_place(linux_boot*lb,linux_file_info*dst,linux_file_info*fi,size_t size);
+
+// src/linux-boot/compress.c: decode kernel while it is loaded, pos 0 starts over
+extern void linux_boot_kernel_stream(linux_boot*lb,void*data,size_t pos,size_t len);
+
 // src/linux-boot/compress.c: uncompress kernel
 extern int linux_boot_uncompress_kernel(linux_boot*lb);
 
+// src/linux-boot/compress.c: uncompress every loaded initramfs
+extern int linux_boot_uncompress_initrd(linux_boot*lb);
+
 // src/linux-boot/dtbo.c: apply device tree overlay
 extern int linux_boot_apply_dtbo(linux_boot*lb);
 
@@ -158,6 +187,9 @@ extern int linux_boot_update_cmdline(linux_boot*lb);
 // src/linux-boot/info.c: update device tree to add boot info
 extern int linux_boot_update_info(linux_boot*lb);
 
+// src/linux-boot/info.c: add boot phase timestamps to fdt
+extern int linux_boot_update_boottime(linux_boot*lb);
+
 // src/linux-boot/uefi.c: update device tree to add uefi info
 extern int linux_boot_update_uefi(linux_boot*lb);
 
@@ -200,6 +232,7 @@ extern int boot_linux_arm(linux_boot*boot);
 #define MAX_DTB_SIZE       0x00200000
 #define MAX_DTBO_SIZE      0x01800000
 #define MAX_KERNEL_SIZE    0x04000000
+#define MAX_INITRD_SIZE    0x20000000
 #define MAGIC_DTBO         0x1EABB7D7
 #define MAGIC_KERNEL_ARM32 0x016f2818
 #define MAGIC_KERNEL_ARM64 0x644d5241
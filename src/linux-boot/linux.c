@@ -11,6 +11,7 @@
 #include<Library/MemoryAllocationLib.h>
 #include<Library/UefiBootServicesTableLib.h>
 #include"str.h"
+#include"uefi.h"
 #include"logger.h"
 #include"internal.h"
 #include"KernelFdt.h"
@@ -69,22 +70,29 @@ static int check_boot(linux_boot*lb){
 }
 
 int linux_boot_prepare(linux_boot*lb){
+	boottime_mark("linux");
 	if(linux_load_from_config(lb)!=0)
 		return trlog_error(-1,"load linux failed");
+	boottime_mark("linux-load");
 	if(linux_boot_install_random_seed()!=0)
 		return trlog_error(-1,"install random seed failed");
 	if(linux_boot_uncompress_kernel(lb)!=0)
 		return trlog_error(-1,"decompress kernel failed");
+	boottime_mark("linux-decompress");
 	if(linux_boot_select_fdt(lb)!=0)
 		return trlog_error(-1,"select fdt failed");
 	if(linux_boot_apply_dtbo(lb)!=0)
 		return trlog_error(-1,"apply dtbo failed");
 	if(linux_boot_generate_fdt(lb)!=0)
 		return trlog_error(-1,"generate fdt failed");
+	boottime_mark("linux-fdt");
 	if(linux_boot_move(lb)!=0)
 		return trlog_error(-1,"move load failed");
+	if(linux_boot_clear_bss(lb)!=0)
+		return trlog_error(-1,"clear kernel bss failed");
 	if(linux_boot_install_initrd(lb)!=0)
 		return trlog_error(-1,"install initrd failed");
+	boottime_mark("linux-move");
 	if(linux_boot_update_fdt(lb)!=0)
 		return trlog_error(-1,"update fdt failed");
 	if(check_boot(lb)!=0)
@@ -97,6 +105,8 @@ int linux_boot_execute(linux_boot*lb){
 		tlog_error("kernel not loaded, abort boot...");
 		return -1;
 	}
+	boottime_mark("linux-start");
+	boottime_save();
 	switch(lb->arch){
 		case ARCH_UEFI:boot_linux_uefi(lb);break;
 		#if defined(__arm__)||defined(__aarch64__)
@@ -155,5 +165,7 @@ void linux_boot_free(linux_boot*lb){
 	if(lb->kernel.address)linux_file_clean(&lb->kernel);
 	if(lb->initrd.address)linux_file_clean(&lb->initrd);
 	if(lb->dtb.address)linux_file_clean(&lb->dtb);
+	if(lb->bootconfig.address)linux_file_clean(&lb->bootconfig);
+	linux_boot_kernel_stream(lb,NULL,0,0);
 	FreePool(lb);
 }
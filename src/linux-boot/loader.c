@@ -15,6 +15,7 @@
 #include<Library/MemoryAllocationLib.h>
 #include<Library/UefiBootServicesTableLib.h>
 #include<Protocol/BlockIo.h>
+#include<Protocol/BlockIo2.h>
 #include<Protocol/SimpleFileSystem.h>
 #include<Guid/FileInfo.h>
 #include"str.h"
@@ -36,12 +37,150 @@ bool linux_file_allocate(linux_file_info*fi,size_t size){
 		tlog_warn("allocate %zu pages for file failed",fi->mem_pages);
 		return false;
 	}
-	ZeroMem(fi->address,fi->mem_size);
+
+	// callers fill the first size bytes, only clear what is left around it
+	ZeroMem(fi->address,fi->offset);
+	ZeroMem(fi->address+fi->offset+size,fi->mem_size-fi->offset-size);
 	fi->address+=fi->offset;
 	fi->allocated=true;
 	return true;
 }
 
+/*
+ * files are read in chunks, while one chunk is in flight the one before
+ * it goes to the sink, a kernel is decoded as it arrives that way.
+ * block io 2 and file protocol ReadEx read in the background, other
+ * sources read each chunk synchronously but still interleave.
+ */
+#define LOAD_CHUNK 0x100000
+
+struct load_reader{
+	linux_file_info*fi;
+	size_t chunk;
+	EFI_STATUS status;
+	EFI_EVENT event;
+	EFI_STATUS(*start)(struct load_reader*r,size_t pos,size_t len);
+	EFI_STATUS(*wait)(struct load_reader*r);
+	fsh*f;
+	EFI_FILE_PROTOCOL*fp;
+	EFI_FILE_IO_TOKEN fp_token;
+	EFI_BLOCK_IO_PROTOCOL*bp;
+	EFI_BLOCK_IO2_PROTOCOL*bp2;
+	EFI_BLOCK_IO2_TOKEN bp_token;
+};
+
+static EFI_STATUS wait_sync(struct load_reader*r){
+	return r->status;
+}
+
+static EFI_STATUS start_fsh(struct load_reader*r,size_t pos,size_t len){
+	r->status=EFI_SUCCESS;
+	if(fs_full_read(r->f,r->fi->address+pos,len)!=0)
+		r->status=EFI_DEVICE_ERROR;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS start_fp(struct load_reader*r,size_t pos,size_t len){
+	UINTN read=len;
+	r->status=r->fp->Read(r->fp,&read,r->fi->address+pos);
+	if(!EFI_ERROR(r->status)&&read!=len)r->status=EFI_END_OF_FILE;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS start_fp_ex(struct load_reader*r,size_t pos,size_t len){
+	EFI_STATUS st;
+	r->fp_token.Status=EFI_SUCCESS;
+	r->fp_token.BufferSize=len;
+	r->fp_token.Buffer=r->fi->address+pos;
+	if((st=r->fp->ReadEx(r->fp,&r->fp_token))!=EFI_UNSUPPORTED)return st;
+
+	// no background reads on this file after all
+	r->start=start_fp,r->wait=wait_sync;
+	return start_fp(r,pos,len);
+}
+
+static EFI_STATUS wait_fp_ex(struct load_reader*r){
+	UINTN idx;
+	size_t len=r->fp_token.BufferSize;
+	gBS->WaitForEvent(1,&r->event,&idx);
+	if(EFI_ERROR(r->fp_token.Status))return r->fp_token.Status;
+	return len==r->fp_token.BufferSize?EFI_SUCCESS:EFI_END_OF_FILE;
+}
+
+static EFI_STATUS start_bp(struct load_reader*r,size_t pos,size_t len){
+	r->status=r->bp->ReadBlocks(
+		r->bp,r->bp->Media->MediaId,
+		pos/r->bp->Media->BlockSize,
+		len,r->fi->address+pos
+	);
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS start_bp2(struct load_reader*r,size_t pos,size_t len){
+	EFI_STATUS st;
+	r->bp_token.TransactionStatus=EFI_SUCCESS;
+	st=r->bp2->ReadBlocksEx(
+		r->bp2,r->bp->Media->MediaId,
+		pos/r->bp->Media->BlockSize,
+		&r->bp_token,len,r->fi->address+pos
+	);
+	if(st!=EFI_UNSUPPORTED)return st;
+
+	// the driver only does blocking reads
+	r->start=start_bp,r->wait=wait_sync;
+	return start_bp(r,pos,len);
+}
+
+static EFI_STATUS wait_bp2(struct load_reader*r){
+	UINTN idx;
+	gBS->WaitForEvent(1,&r->event,&idx);
+	return r->bp_token.TransactionStatus;
+}
+
+static EFI_BLOCK_IO2_PROTOCOL*find_block_io2(EFI_BLOCK_IO_PROTOCOL*bp){
+	UINTN cnt=0;
+	EFI_HANDLE*hands=NULL;
+	EFI_BLOCK_IO_PROTOCOL*b=NULL;
+	EFI_BLOCK_IO2_PROTOCOL*b2=NULL;
+	if(EFI_ERROR(gBS->LocateHandleBuffer(
+		ByProtocol,&gEfiBlockIoProtocolGuid,
+		NULL,&cnt,&hands
+	)))return NULL;
+	for(UINTN i=0;i<cnt;i++){
+		if(EFI_ERROR(gBS->HandleProtocol(
+			hands[i],&gEfiBlockIoProtocolGuid,(VOID**)&b
+		))||b!=bp)continue;
+		if(EFI_ERROR(gBS->HandleProtocol(
+			hands[i],&gEfiBlockIo2ProtocolGuid,(VOID**)&b2
+		)))b2=NULL;
+		break;
+	}
+	if(hands)FreePool(hands);
+	return b2;
+}
+
+// the sink sees every chunk in order, while the next one is being read
+static int load_chunks(struct load_reader*r,linux_load_sink sink,linux_boot*lb){
+	EFI_STATUS st;
+	size_t pos=0,len,next;
+	if(r->chunk<=0)r->chunk=LOAD_CHUNK;
+	len=MIN(r->chunk,r->fi->size);
+	if(!EFI_ERROR(st=r->start(r,0,len)))while(len>0){
+		if(EFI_ERROR(st=r->wait(r)))break;
+		next=MIN(r->chunk,r->fi->size-pos-len);
+		if(next>0&&EFI_ERROR(st=r->start(r,pos+len,next)))break;
+		if(sink)sink(lb,r->fi->address+pos,pos,len);
+		pos+=len,len=next;
+	}
+	if(r->event)gBS->CloseEvent(r->event);
+	r->event=NULL;
+	if(EFI_ERROR(st))return trlog_warn(
+		-1,"read failed at %zu: %s",
+		pos,efi_status_to_string(st)
+	);
+	return 0;
+}
+
 static void load_done(linux_file_info*fi){
 	char buff[64];
 	tlog_info(
@@ -51,9 +190,10 @@ static void load_done(linux_file_info*fi){
 	linux_file_dump(NULL,fi);
 }
 
-static int load_fsh(linux_file_info*fi,fsh*f){
+static int load_fsh(linux_file_info*fi,fsh*f,linux_load_sink sink,linux_boot*lb){
 	char buf[64];
 	size_t size=0;
+	struct load_reader r;
 
 	if(fs_get_size(f,&size)!=0)
 		EDONE(telog_warn("get file size failed"));
@@ -69,8 +209,9 @@ static int load_fsh(linux_file_info*fi,fsh*f){
 	if(!linux_file_allocate(fi,fi->size))goto done;
 
 	// read file to memory
-	if(fs_full_read(f,fi->address,fi->size)!=0)
-		EDONE(telog_warn("read file failed"));
+	ZeroMem(&r,sizeof(r));
+	r.fi=fi,r.f=f,r.start=start_fsh,r.wait=wait_sync;
+	if(load_chunks(&r,sink,lb)!=0)goto done;
 
 	fs_close(&f);
 	load_done(fi);
@@ -81,11 +222,12 @@ static int load_fsh(linux_file_info*fi,fsh*f){
 	return -1;
 }
 
-static int load_fp(linux_file_info*fi,EFI_FILE_PROTOCOL*fp){
+static int load_fp(linux_file_info*fi,EFI_FILE_PROTOCOL*fp,linux_load_sink sink,linux_boot*lb){
 	char buf[64];
 	EFI_STATUS st;
 	EFI_FILE_INFO*info=NULL;
-	UINTN infos=0,read;
+	UINTN infos=0;
+	struct load_reader r;
 
 	// get file info
 	st=efi_file_get_file_info(fp,&infos,&info);
@@ -111,16 +253,16 @@ static int load_fp(linux_file_info*fi,EFI_FILE_PROTOCOL*fp){
 	if(!linux_file_allocate(fi,fi->size))goto done;
 
 	// read file to memory
-	read=fi->size;
-	st=fp->Read(fp,&read,fi->address);
-	if(EFI_ERROR(st))EDONE(tlog_warn(
-		"read file failed: %s",
-		efi_status_to_string(st)
-	));
-	if(read!=fi->size)EDONE(tlog_warn(
-		"read file size not match %llu != %zu",
-		(unsigned long long)read,fi->size
-	));
+	ZeroMem(&r,sizeof(r));
+	r.fi=fi,r.fp=fp,r.start=start_fp,r.wait=wait_sync;
+	if(
+		fp->Revision>=EFI_FILE_PROTOCOL_REVISION2&&
+		!EFI_ERROR(gBS->CreateEvent(0,0,NULL,NULL,&r.event))
+	){
+		r.fp_token.Event=r.event;
+		r.start=start_fp_ex,r.wait=wait_fp_ex;
+	}
+	if(load_chunks(&r,sink,lb)!=0)goto done;
 	fp->Close(fp);
 
 	load_done(fi);
@@ -132,10 +274,11 @@ static int load_fp(linux_file_info*fi,EFI_FILE_PROTOCOL*fp){
 	return -1;
 }
 
-static int load_bp(linux_file_info*fi,EFI_BLOCK_IO_PROTOCOL*bp){
+static int load_bp(linux_file_info*fi,EFI_BLOCK_IO_PROTOCOL*bp,linux_load_sink sink,linux_boot*lb){
 	UINTN bs;
-	EFI_STATUS st;
 	char buf[64];
+	UINT32 align;
+	struct load_reader r;
 
 	// calc block size
 	bs=bp->Media->LastBlock+1;
@@ -151,15 +294,20 @@ static int load_bp(linux_file_info*fi,EFI_BLOCK_IO_PROTOCOL*bp){
 	// allocate memory for block
 	if(!linux_file_allocate(fi,fi->size))goto done;
 
-	// read block to memory
-	st=bp->ReadBlocks(bp,
-		bp->Media->MediaId,0,
-		fi->size,fi->address
-	);
-	if(EFI_ERROR(st))EDONE(tlog_warn(
-		"read block failed: %s",
-		efi_status_to_string(st)
-	));
+	// read block to memory, chunks stay whole blocks
+	ZeroMem(&r,sizeof(r));
+	align=bp->Media->IoAlign;
+	r.fi=fi,r.bp=bp,r.start=start_bp,r.wait=wait_sync;
+	r.chunk=MAX(LOAD_CHUNK/bp->Media->BlockSize,1)*bp->Media->BlockSize;
+	if(
+		(align<=1||((UINTN)fi->address)%align==0)&&
+		(r.bp2=find_block_io2(bp))&&
+		!EFI_ERROR(gBS->CreateEvent(0,0,NULL,NULL,&r.event))
+	){
+		r.bp_token.Event=r.event;
+		r.start=start_bp2,r.wait=wait_bp2;
+	}
+	if(load_chunks(&r,sink,lb)!=0)goto done;
 
 	load_done(fi);
 	return 0;
@@ -168,7 +316,7 @@ static int load_bp(linux_file_info*fi,EFI_BLOCK_IO_PROTOCOL*bp){
 	return -1;
 }
 
-static int load_pointer(linux_file_info*fi,void*p,size_t size){
+static int load_pointer(linux_file_info*fi,void*p,size_t size,linux_load_sink sink,linux_boot*lb){
 	char buf[64];
 	fi->size=size;
 	if(fi->size>=0x8000000)
@@ -181,6 +329,7 @@ static int load_pointer(linux_file_info*fi,void*p,size_t size){
 	if(!linux_file_allocate(fi,fi->size))goto done;
 
 	CopyMem(fi->address,p,size);
+	if(sink)sink(lb,fi->address,0,size);
 
 	load_done(fi);
 	return 0;
@@ -189,7 +338,12 @@ static int load_pointer(linux_file_info*fi,void*p,size_t size){
 	return -1;
 }
 
-int linux_file_load(linux_file_info*fi,linux_load_from*from){
+int linux_file_load_sink(
+	linux_file_info*fi,
+	linux_load_from*from,
+	linux_load_sink sink,
+	linux_boot*lb
+){
 	int r=-1;
 	fsh*f=NULL;
 	if(!fi||!from||!from->enabled)return r;
@@ -199,22 +353,36 @@ int linux_file_load(linux_file_info*fi,linux_load_from*from){
 				telog_warn("resolve locate failed");
 				break;
 			}
-			r=load_fsh(fi,f);
+			r=load_fsh(fi,f,sink,lb);
 		break;
-		case FROM_FILE_SYSTEM_HANDLE:r=load_fsh(fi,from->fsh);break;
-		case FROM_FILE_PROTOCOL:r=load_fp(fi,from->file_proto);break;
-		case FROM_BLOCKIO_PROTOCOL:r=load_bp(fi,from->blk_proto);break;
-		case FROM_POINTER:r=load_pointer(fi,from->pointer,from->size);break;
+		case FROM_FILE_SYSTEM_HANDLE:r=load_fsh(fi,from->fsh,sink,lb);break;
+		case FROM_FILE_PROTOCOL:r=load_fp(fi,from->file_proto,sink,lb);break;
+		case FROM_BLOCKIO_PROTOCOL:r=load_bp(fi,from->blk_proto,sink,lb);break;
+		case FROM_POINTER:r=load_pointer(fi,from->pointer,from->size,sink,lb);break;
 		default:tlog_warn("unsupported from type");
 	}
 	return r;
 }
 
+int linux_file_load(linux_file_info*fi,linux_load_from*from){
+	return linux_file_load_sink(fi,from,NULL,NULL);
+}
+
 static int load_merged_initrd(linux_boot*lb){
 	list*f;
 	size_t off=0,cnt=0;
 	char buff[64];
 	linux_file_clean(&lb->initrd);
+
+	// bootconfig is only found at the very end
+	if(lb->bootconfig.address){
+		linux_file_info*bc=malloc(sizeof(linux_file_info));
+		if(bc){
+			CopyMem(bc,&lb->bootconfig,sizeof(linux_file_info));
+			ZeroMem(&lb->bootconfig,sizeof(linux_file_info));
+			list_obj_add_new(&lb->initrd_buf,bc);
+		}
+	}
 	if((f=list_first(lb->initrd_buf)))do{
 		LIST_DATA_DECLARE(d,f,linux_file_info*);
 		lb->initrd.size+=d->size,cnt++;
@@ -225,10 +393,21 @@ static int load_merged_initrd(linux_boot*lb){
 		"merge %zu initramfs %zu bytes (%s)",cnt,lb->initrd.size,
 		make_readable_str_buf(buff,sizeof(buff),lb->initrd.size,1,0)
 	);
-	linux_file_allocate(&lb->initrd,lb->initrd.size);
-	if(lb->initrd.address&&(f=list_first(lb->initrd_buf)))do{
+
+	f=list_first(lb->initrd_buf);
+
+	// a single initramfs is taken over as is unless it has a region to go
+	if(!linux_boot_place(lb,&lb->initrd,&lb->initrd,lb->initrd.size)){
+		if(cnt==1&&f){
+			LIST_DATA_DECLARE(d,f,linux_file_info*);
+			CopyMem(&lb->initrd,d,sizeof(linux_file_info));
+			ZeroMem(d,sizeof(linux_file_info));
+			f=NULL;
+		}else linux_file_allocate(&lb->initrd,lb->initrd.size);
+	}
+	if(lb->initrd.address&&f)do{
 		LIST_DATA_DECLARE(d,f,linux_file_info*);
-		CopyMem(lb->initrd.address,d->address+off,d->size);
+		CopyMem(lb->initrd.address+off,d->address,d->size);
 		off+=d->size;
 	}while((f=f->next));
 	list_free_all_def(lb->initrd_buf);
@@ -236,11 +415,17 @@ static int load_merged_initrd(linux_boot*lb){
 	return 0;
 }
 
-static void single_load(linux_load_from*from,linux_file_info*fi,const char*tag){
+static void single_load(
+	linux_boot*lb,
+	linux_load_from*from,
+	linux_file_info*fi,
+	linux_load_sink sink,
+	const char*tag
+){
 	if(!from->enabled)return;
 	if(fi->address)linux_file_clean(fi);
 	tlog_info("single loading %s",tag);
-	linux_file_load(fi,from);
+	linux_file_load_sink(fi,from,sink,lb);
 }
 
 static void multiple_load(list**from,list**fi,const char*tag){
@@ -299,6 +484,8 @@ int linux_load_from_config(linux_boot*lb){
 		tlog_error("unsupported with non-efistub boot method");
 		return -1;
 	}
+	if(lb->config->vendor_boot.enabled)
+		linux_boot_load_vendor_boot_config(lb);
 	if(lb->config->abootimg.enabled)
 		linux_boot_load_abootimg_config(lb);
 	if(lb->config->use_kfdt_ramdisk_abootimg)
@@ -310,9 +497,11 @@ int linux_load_from_config(linux_boot*lb){
 	}
 	if(lb->config->use_kfdt_ramdisk_kernel)
 		load_kernel_from_kfdt(lb);
-	single_load(&lb->config->kernel,&lb->kernel,"kernel");
-	single_load(&lb->config->dtb,&lb->dtb,"dtb");
+	single_load(lb,&lb->config->kernel,&lb->kernel,linux_boot_kernel_stream,"kernel");
+	single_load(lb,&lb->config->dtb,&lb->dtb,NULL,"dtb");
 	multiple_load(&lb->config->initrd,&lb->initrd_buf,"initrd");
+	if(lb->config->decompress_initrd)
+		linux_boot_uncompress_initrd(lb);
 	multiple_load(&lb->config->dtbo,&lb->dtbo,"dtbo");
 	load_merged_initrd(lb);
 	if(lb->config->cmdline[0])
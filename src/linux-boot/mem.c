@@ -23,32 +23,22 @@
 #include"rampartition.h"
 #define TAG "memory"
 
-static int fdt_append_reg(void*fdt,int off,bool use32,UINTN val){
-	return use32?
-		fdt_appendprop_u32(fdt,off,"reg",(uint32_t)val):
-		fdt_appendprop_u64(fdt,off,"reg",(uint64_t)val);
-}
+/*
+ * regions are gathered first and written as one reg property at the end,
+ * appending cell by cell would move the rest of the blob every time.
+ * neighbouring regions of the memory map are merged on the way.
+ */
+typedef struct mem_regs{
+	fdt64_t*cells;
+	size_t cnt,max;
+	bool open;
+	UINTN start,end;
+}mem_regs;
 
-static int fdt_add_memory(linux_boot*lb,UINTN addr,UINTN size){
-	int ret=0;
+static void mem_add(mem_regs*m,UINTN addr,UINTN size){
+	size_t max;
+	fdt64_t*n;
 	char buf[64];
-	static int off=-1;
-	static void*dtb=NULL;
-	static bool use32=false;
-	if(dtb!=lb->dtb.address){
-		off=fdt_path_offset(lb->dtb.address,"/memory");
-		if(off<0){
-			off=fdt_add_subnode(lb->dtb.address,0,"/memory");
-			if(off<0)return trlog_warn(
-				-1,
-				"get memory node failed: %s",
-				fdt_strerror(off)
-			);
-			fdt_setprop_string(lb->dtb.address,off,"device_type","memory");
-		}
-		fdt_delprop(lb->dtb.address,off,"reg");
-		dtb=lb->dtb.address;
-	}
 	tlog_info(
 		"memory: 0x%016llx - 0x%016llx (%llu bytes / %s)",
 		(unsigned long long)addr,
@@ -56,36 +46,58 @@ static int fdt_add_memory(linux_boot*lb,UINTN addr,UINTN size){
 		(unsigned long long)size,
 		make_readable_str_buf(buf,sizeof(buf),size,1,0)
 	);
+	if(m->cnt+2>m->max){
+		max=m->max?m->max*2:64;
+		if(!(n=ReallocatePool(
+			m->max*sizeof(fdt64_t),
+			max*sizeof(fdt64_t),
+			m->cells
+		))){
+			tlog_warn("allocate memory for memory regions failed");
+			return;
+		}
+		m->cells=n,m->max=max;
+	}
+	m->cells[m->cnt++]=cpu_to_fdt64((uint64_t)addr);
+	m->cells[m->cnt++]=cpu_to_fdt64((uint64_t)size);
+}
 
-	ret=fdt_append_reg(lb->dtb.address,off,use32,addr);
-	if(ret<0)return trlog_warn(
-		ret,
-		"add memory address failed: %s",
-		fdt_strerror(ret)
-	);
+// a zero size flushes the region being merged
+static void mem_add_merge(mem_regs*m,UINTN addr,UINTN size){
+	if(size!=0&&m->open&&m->end==addr){
+		m->end=addr+size;
+		return;
+	}
+	if(m->open&&m->end>m->start)mem_add(m,m->start,m->end-m->start);
+	m->open=size!=0,m->start=addr,m->end=addr+size;
+}
 
-	ret=fdt_append_reg(lb->dtb.address,off,use32,size);
-	if(ret<0)tlog_warn(
-		"add memory size failed: %s",
+static int mem_write(linux_boot*lb,mem_regs*m){
+	int off,ret;
+	if(m->cnt<=0)return 0;
+	off=fdt_path_offset(lb->dtb.address,"/memory");
+	if(off<0){
+		off=fdt_add_subnode(lb->dtb.address,0,"memory");
+		if(off<0)return trlog_warn(
+			-1,
+			"get memory node failed: %s",
+			fdt_strerror(off)
+		);
+		fdt_setprop_string(lb->dtb.address,off,"device_type","memory");
+	}
+	ret=fdt_setprop(
+		lb->dtb.address,off,"reg",
+		m->cells,m->cnt*sizeof(fdt64_t)
+	);
+	if(ret<0)return trlog_warn(
+		-1,
+		"set memory regions failed: %s",
 		fdt_strerror(ret)
 	);
-	return ret;
-}
-
-static int fdt_add_merge_memory(linux_boot*lb,UINTN addr,UINTN size){
-	STATIC UINTN last_end=0,start=0;
-	UINTN end=addr+size;
-	if(size!=0){
-		if(last_end!=addr){
-			if(start>0&&end>start)fdt_add_memory(lb,start,end-start);
-			start=addr;
-		}
-		last_end=end;
-	}else if(start>0&&last_end>start)fdt_add_memory(lb,start,last_end-start);
 	return 0;
 }
 
-static int update_from_memory_map(linux_boot*lb){
+static int update_from_memory_map(mem_regs*m){
 	EFI_STATUS st;
 	EFI_MEMORY_DESCRIPTOR*mm=NULL,*md;
 	UINTN ms=0,mk=0,ds=0;
@@ -118,19 +130,20 @@ static int update_from_memory_map(linux_boot*lb){
 			case EfiACPIReclaimMemory:
 			case EfiACPIMemoryNVS:
 			case EfiPalCode:
-				fdt_add_merge_memory(
-					lb,md->PhysicalStart,
+				mem_add_merge(
+					m,md->PhysicalStart,
 					EFI_PAGES_TO_SIZE(md->NumberOfPages)
 				);
 			break;
 			default:continue;
 		}
 	}
-	fdt_add_merge_memory(lb,0,0);
+	mem_add_merge(m,0,0);
+	FreePool(mm);
 	return 0;
 }
 
-static int update_from_conf(linux_boot*lb){
+static int update_from_conf(linux_boot*lb,mem_regs*m){
 	int r=-1;
 	if(lb->config)for(
 		size_t i=0;
@@ -141,16 +154,15 @@ static int update_from_conf(linux_boot*lb){
 		UINTN size=reg->end-reg->start;
 		if(reg->start<=0||reg->end<=0||size<=0)continue;
 		if(r==-1)tlog_debug("update memory from config");
-		fdt_add_memory(lb,(UINTN)reg->start,size);
+		mem_add(m,(UINTN)reg->start,size);
 		r=0;
 	}
 	return r;
 }
 
-static int update_from_kernel_fdt(linux_boot*lb){
-	int node=0,r=-1;
+static int update_from_kernel_fdt(linux_boot*lb,mem_regs*m){
+	int r=-1;
 	EFI_STATUS st;
-	uint64_t base=0,size=0;
 	KERNEL_FDT_PROTOCOL*fdt;
 	if(lb->config->skip_kfdt_memory)return r;
 	st=gBS->LocateProtocol(
@@ -158,16 +170,18 @@ static int update_from_kernel_fdt(linux_boot*lb){
 		NULL,
 		(VOID**)&fdt
 	);
-	if(EFI_ERROR(st)||!fdt||!fdt->Fdt)return r;
+	if(EFI_ERROR(st)||!fdt||!fdt->Memory)return r;
+
+	// KernelFdtDxe parsed the memory nodes already
 	tlog_debug("update memory from kernel fdt");
-	while(fdt_get_memory(fdt->Fdt,node,&base,&size)){
-		fdt_add_memory(lb,(UINTN)base,(UINTN)size);
-		node++,r=0;
+	for(UINTN i=0;i<fdt->MemoryCount;i++){
+		mem_add(m,(UINTN)fdt->Memory[i].Base,(UINTN)fdt->Memory[i].Size);
+		r=0;
 	}
 	return r;
 }
 
-static int update_from_ram_partition(linux_boot*lb){
+static int update_from_ram_partition(mem_regs*m){
 	int r=-1;
 	UINT32 cnt=0;
 	EFI_STATUS st;
@@ -191,7 +205,7 @@ static int update_from_ram_partition(linux_boot*lb){
 	));
 	for(UINT32 i=0;i<cnt;i++){
 		if(parts[i].Base<=0||parts[i].AvailableLength<=0)continue;
-		fdt_add_memory(lb,parts[i].Base,parts[i].AvailableLength);
+		mem_add(m,parts[i].Base,parts[i].AvailableLength);
 		r=0;
 	}
 	done:
@@ -257,13 +271,21 @@ static int update_ddr_info(linux_boot*lb){
 }
 
 int linux_boot_update_memory(linux_boot*lb){
+	int r=0;
+	mem_regs m;
 	if(!lb->dtb.address)return 0;
 	if(lb->config->pass_kfdt_dtb)return 0;
 	if(update_ddr_info(lb)!=0)return -1;
-	if(update_from_conf(lb)==0)return 0;
-	if(update_from_ram_partition(lb)==0)return 0;
-	if(update_from_kernel_fdt(lb)==0)return 0;
-	if(update_from_memory_map(lb)==0)return 0;
-	tlog_warn("no avaliable memory update method");
-	return -1;
+	ZeroMem(&m,sizeof(m));
+	if(
+		update_from_conf(lb,&m)!=0&&
+		update_from_ram_partition(&m)!=0&&
+		update_from_kernel_fdt(lb,&m)!=0&&
+		update_from_memory_map(&m)!=0
+	){
+		tlog_warn("no avaliable memory update method");
+		r=-1;
+	}else r=mem_write(lb,&m);
+	if(m.cells)FreePool(m.cells);
+	return r;
 }
@@ -9,10 +9,13 @@
 #include<Uefi.h>
 #include<Library/PcdLib.h>
 #include<Library/BaseLib.h>
+#include<Library/TimerLib.h>
 #include<Library/BaseMemoryLib.h>
 #include<Library/MemoryAllocationLib.h>
 #include<Protocol/SimpleFileSystem.h>
 #include"str.h"
+#include"list.h"
+#include"uefi.h"
 #include"logger.h"
 #include"internal.h"
 #define TAG "move"
@@ -44,7 +47,7 @@ static bool check_load_info_other(linux_mem_region*li,linux_mem_region*sec){
 }
 static bool check_load_info_file(linux_mem_region*li,linux_file_info*fi){
 	if(!li||!fi)return false;
-	if(li->start==0||fi->address==0)return true;
+	if(li->start==0||fi->address==0||fi->placed)return true;
 	if(IN_RANGE_LI((UINTN)fi->address,li))return false;
 	if(IN_SIZE_TLI(li,fi))return false;
 	return true;
@@ -73,6 +76,7 @@ static bool check_boot_load_info(linux_boot_addresses*bli,linux_boot*lb){
 static int do_move(linux_mem_region*tgt,linux_file_info*src,size_t offset){
 	char buf[64];
 	if(!tgt||!src||!src->address)return -1;
+	if(src->placed)return 0;
 	tgt->start=ALIGN_VALUE(tgt->start,MEM_ALIGN)+offset;
 	if(tgt->end-tgt->start<src->size)
 		return trlog_warn(-1,"memory too small for load");
@@ -97,24 +101,82 @@ static int do_move(linux_mem_region*tgt,linux_file_info*src,size_t offset){
 	return 0;
 }
 
-static void do_erase_load(linux_mem_region*load){
-	if(!load||!load->start)return;
-	ZeroMem((VOID*)(UINTN)load->start,load->end-load->start);
+static size_t region_size(linux_mem_region*reg){
+	return reg&&reg->start&&reg->end>reg->start?reg->end-reg->start:0;
 }
 
+static bool region_in_use(linux_boot*lb,UINTN start,UINTN end){
+	list*f;
+	UINTN addr;
+	linux_file_info*fi,*fis[]={&lb->kernel,&lb->initrd,&lb->dtb};
+	for(size_t i=0;i<ARRAY_SIZE(fis);i++){
+		if(!(addr=(UINTN)fis[i]->address))continue;
+		if(addr<end&&addr+fis[i]->size>start)return true;
+	}
+	if((f=list_first(lb->initrd_buf)))do{
+		fi=LIST_DATA(f,linux_file_info*);
+		if(!fi||!(addr=(UINTN)fi->address))continue;
+		if(addr<end&&addr+fi->size>start)return true;
+	}while((f=f->next));
+	return false;
+}
+
+/*
+ * hand out the final address of the kernel or the initramfs up front,
+ * so they are decompressed or merged straight into the custom region
+ * instead of into a buffer that linux_boot_move copies again later.
+ * only a region dedicated to the file is used, the shared load region
+ * is still filled by linux_boot_move in its fixed order.
+ */
+bool linux_boot_place(linux_boot*lb,linux_file_info*dst,linux_file_info*fi,size_t size){
+	UINTN start,end;
+	linux_mem_region*reg;
+	linux_boot_addresses*info;
+	if(!lb||!dst||!fi||!lb->config->load_custom_address)return false;
+	info=&lb->config->load_address;
+	if(dst==&lb->kernel)reg=&info->kernel;
+	else if(dst==&lb->initrd)reg=&info->initrd;
+	else return false;
+	if(!reg->start||reg->end<=reg->start)return false;
+	if(info->kernel.start&&info->initrd.start&&(
+		IN_RANGE_TLI((&info->kernel),(&info->initrd))||
+		IN_RANGE_TLI((&info->initrd),(&info->kernel))
+	))return false;
+	start=(UINTN)ALIGN_VALUE(reg->start,MEM_ALIGN);
+	end=(UINTN)reg->end;
+	if(start+fi->offset>=end||end-start-fi->offset<size)return false;
+	if(region_in_use(lb,start,end))
+		return trlog_warn(false,"region for %s is in use, skip place",dst==&lb->kernel?"kernel":"initramfs");
+	fi->address=(void*)(start+fi->offset);
+	fi->mem_size=end-start;
+	fi->mem_pages=EFI_SIZE_TO_PAGES(fi->mem_size);
+	fi->allocated=false;
+	fi->placed=true;
+	tlog_debug(
+		"place %s at 0x%llx",
+		dst==&lb->kernel?"kernel":"initramfs",
+		(unsigned long long)(UINTN)fi->address
+	);
+	return true;
+}
+
+/*
+ * the regions are not wiped before the move any more, nothing in the
+ * boot protocols expects them clean. the kernel only needs its bss,
+ * which linux_boot_clear_bss takes care of wherever the image ends up.
+ */
 int linux_boot_move(linux_boot*lb){
+	UINT64 start;
+	size_t koff=0,skip;
+	char buf[64];
 	if(!lb->config->load_custom_address)return 0;
 	linux_boot_addresses*info=&lb->config->load_address;
 
 	if(!check_boot_load_info(info,lb))
 		return trlog_error(-1,"invalid addresses, skip move");
-	tlog_debug("try erase memory");
-	do_erase_load(&info->load);
-	do_erase_load(&info->kernel);
-	do_erase_load(&info->initrd);
-	do_erase_load(&info->fdt);
-	tlog_debug("erase memory done, try move");
-	size_t koff=0;
+	skip=region_size(&info->load)+region_size(&info->kernel);
+	skip+=region_size(&info->initrd)+region_size(&info->fdt);
+	start=GetPerformanceCounter();
 	switch(lb->arch){
 		case ARCH_ARM32:koff=LINUX_ARM32_OFFSET;break;
 		case ARCH_ARM64:koff=LINUX_ARM64_OFFSET;break;
@@ -123,6 +185,36 @@ int linux_boot_move(linux_boot*lb){
 	do_move((info->kernel.start?&info->kernel:&info->load),&lb->kernel,koff);
 	do_move((info->initrd.start?&info->initrd:&info->load),&lb->initrd,0);
 	do_move((info->fdt.start?&info->fdt:&info->load),&lb->dtb,0);
-	tlog_debug("move done");
+	tlog_debug(
+		"move done in %llu us, skipped erasing %s",
+		(unsigned long long)boottime_elapsed_us(start),
+		make_readable_str_buf(buf,sizeof(buf),skip,1,0)
+	);
+	return 0;
+}
+
+// arm64 Image header: image_size at 0x10 covers text, data and bss
+int linux_boot_clear_bss(linux_boot*lb){
+	UINT64 start,image;
+	size_t len,cap;
+	char buf[64];
+	linux_file_info*k=&lb->kernel;
+	if(lb->arch!=ARCH_ARM64||!k->address||k->size<0x40)return 0;
+	if(!is_kernel_arm64(k))return 0;
+	if((image=*(UINT64*)(k->address+0x10))<=k->size)return 0;
+	cap=k->mem_size>k->offset?k->mem_size-k->offset:0;
+	if(image>cap)tlog_warn(
+		"kernel needs 0x%llx bytes but buffer has 0x%llx",
+		(unsigned long long)image,(unsigned long long)cap
+	);
+	if((len=MIN((size_t)image,cap))<=k->size)return 0;
+	start=GetPerformanceCounter();
+	len-=k->size;
+	ZeroMem(k->address+k->size,len);
+	tlog_debug(
+		"cleared %s kernel bss in %llu us",
+		make_readable_str_buf(buf,sizeof(buf),len,1,0),
+		(unsigned long long)boottime_elapsed_us(start)
+	);
 	return 0;
 }
@@ -33,15 +33,13 @@ locate_match_state locate_match_esp(locate_dest*loc){
 }
 
 locate_match_state locate_match_device_path(locate_dest*loc){
-	CHAR16*dpt;
-	char xpx[PATH_MAX],*xpt;
-	EFI_DEVICE_PATH_PROTOCOL*dp;
+	char*xpt;
+	const char*xpx;
 	locate_match_state st=MATCH_FAILED;
-	if(!(dp=DevicePathFromHandle(loc->file_hand)))return MATCH_SKIP;
+	if(!loc||!loc->info)return MATCH_SKIP;
 	if(!(xpt=GSTR("by_device_path",NULL)))return MATCH_SKIP;
-	if(!(dpt=ConvertDevicePathToText(dp,FALSE,FALSE)))return MATCH_INVALID;
-	ZeroMem(xpx,sizeof(xpx));
-	UnicodeStrToAsciiStrS(dpt,xpx,sizeof(xpx));
-	if(AsciiStriCmp(xpx,xpt)==0)st=MATCH_SUCCESS;
+	if(!*(xpx=locate_get_path(loc->info)))st=MATCH_SKIP;
+	else if(AsciiStriCmp(xpx,xpt)==0)st=MATCH_SUCCESS;
+	free(xpt);
 	return st;
 }
@@ -9,46 +9,18 @@
 #include"internal.h"
 
 locate_match_state locate_match_fs_name(locate_dest*loc){
-	EFI_STATUS st;
-	UINTN bs=0,vs=0;
-	char label[256];
+	const char*label;
 	locate_match_state res=MATCH_FAILED;
-	EFI_FILE_SYSTEM_VOLUME_LABEL*fi=NULL;
 	char*name=GSTR("by_fs_label",NULL);
 	if(!name)return MATCH_SKIP;
 	if(!*name||strlen(name)>255)
 		EDONE(tlog_warn("invalid file system label"));
-	if(!loc||!loc->root)return MATCH_FAILED;
-	st=loc->root->GetInfo(
-		loc->root,
-		&gEfiFileSystemVolumeLabelInfoIdGuid,
-		&bs,fi
-	);
-	if(st==EFI_BUFFER_TOO_SMALL){
-		if(!(fi=AllocateZeroPool(bs)))
-			EDONE(tlog_warn("allocate memory failed"));
-		st=loc->root->GetInfo(
-			loc->root,
-			&gEfiFileSystemVolumeLabelInfoIdGuid,
-			&bs,fi
-		);
-	}
-	if(EFI_ERROR(st)||!fi)EDONE(tlog_warn(
-		"get file system volume label failed: %s",
-		efi_status_to_string(st)
-	));
-	vs=StrLen(fi->VolumeLabel);
-	if(vs<=0||vs>255)goto done;
-	UnicodeStrToAsciiStrS(
-		fi->VolumeLabel,
-		label,
-		sizeof(label)
-	);
-	if(AsciiStriCmp(label,name)!=0)goto done;
+	if(!loc||!loc->info||!loc->root)goto done;
+	label=locate_get_label(loc->info);
+	if(!label[0]||AsciiStriCmp(label,name)!=0)goto done;
 	res=MATCH_SUCCESS;
 	done:
 	if(name)free(name);
-	if(fi)FreePool(fi);
 	return res;
 }
 
@@ -11,7 +11,6 @@
 #define IGPT loc->part_proto->Info.Gpt
 
 locate_match_state locate_match_gpt_name(locate_dest*loc){
-	char pn[32];
 	char*name=GSTR("by_gpt_name",NULL);
 	if(!name)return MATCH_SKIP;
 	if(!*name||strlen(name)>=32){
@@ -20,19 +19,14 @@ locate_match_state locate_match_gpt_name(locate_dest*loc){
 		return MATCH_INVALID;
 	}
 	if(
-		!loc||!loc->part_proto||
+		!loc||!loc->info||!loc->part_proto||
 		loc->part_proto->Type!=PARTITION_TYPE_GPT
 	){
 		free(name);
 		return MATCH_FAILED;
 	}
-	ZeroMem(pn,sizeof(pn));
-	UnicodeStrToAsciiStrS(
-		IGPT.PartitionName,
-		pn,sizeof(pn)
-	);
 	locate_match_state st=MATCH_SUCCESS;
-	if(AsciiStriCmp(pn,name)!=0)st=MATCH_FAILED;
+	if(AsciiStriCmp(loc->info->gpt_name,name)!=0)st=MATCH_FAILED;
 	free(name);
 	return st;
 }
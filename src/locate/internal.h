@@ -15,6 +15,7 @@
 #include<Library/DevicePathLib.h>
 #include<Library/MemoryAllocationLib.h>
 #include<Library/UefiBootServicesTableLib.h>
+#include<Library/UefiRuntimeServicesTableLib.h>
 #include<Protocol/BlockIo.h>
 #include<Protocol/DevicePath.h>
 #include<Protocol/LoadedImage.h>
@@ -38,9 +39,23 @@
 #define GINT(key,def) confd_get_integer_dict(BASE,loc->tag,key,def)
 #define GBOOL(key,def) confd_get_boolean_dict(BASE,loc->tag,key,def)
 
+// what matchers look at, gathered once per handle and shared by every tag
+typedef struct locate_handle{
+	EFI_HANDLE*hand;
+	EFI_FILE_PROTOCOL*root;
+	EFI_BLOCK_IO_PROTOCOL*block_proto;
+	EFI_PARTITION_INFO_PROTOCOL*part_proto;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL*file_proto;
+	bool label_loaded,path_loaded;
+	char gpt_name[40];
+	char label[256];
+	char path[PATH_MAX];
+}locate_handle;
+
 typedef struct locate_dest{
 	char tag[255];
 	bool dump;
+	locate_handle*info;
 	EFI_HANDLE*file_hand;
 	EFI_FILE_PROTOCOL*root;
 	EFI_BLOCK_IO_PROTOCOL*block_proto;
@@ -58,4 +73,10 @@ typedef enum locate_match_state{
 
 typedef locate_match_state(*locate_match)(locate_dest*loc);
 extern locate_match locate_matches[];
+
+// src/locate/locate.c: get file system label of handle, empty when none
+extern const char*locate_get_label(locate_handle*info);
+
+// src/locate/locate.c: get device path text of handle, empty when none
+extern const char*locate_get_path(locate_handle*info);
 #endif
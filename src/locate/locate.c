@@ -9,29 +9,112 @@
 #include"internal.h"
 static list*locate_cache=NULL;
 
-static void init_locate(locate_dest*loc,const char*tag,EFI_HANDLE*hand){
-	ZeroMem(loc,sizeof(locate_dest));
-	AsciiStrCpyS(loc->tag,sizeof(loc->tag)-1,tag);
-	loc->file_hand=hand;
+/*
+ * protocols and partition attributes of a handle are looked up once,
+ * the volume stays open, label and device path text are read the first
+ * time a matcher asks for them. every tag checks against the same record.
+ */
+static list*locate_infos=NULL;
+
+static bool info_cmp(list*l,void*d){
+	LIST_DATA_DECLARE(x,l,locate_handle*);
+	return x&&x->hand==d;
+}
+
+static locate_handle*get_info(EFI_HANDLE*hand){
+	list*l;
+	locate_handle*info;
+	if((l=list_search_one(locate_infos,info_cmp,hand)))
+		return LIST_DATA(l,locate_handle*);
+	if(!(info=AllocateZeroPool(sizeof(locate_handle))))return NULL;
+	info->hand=hand;
 	gBS->HandleProtocol(
 		hand,
 		&gEfiPartitionInfoProtocolGuid,
-		(VOID**)&loc->part_proto
+		(VOID**)&info->part_proto
 	);
 	gBS->HandleProtocol(
 		hand,
 		&gEfiSimpleFileSystemProtocolGuid,
-		(VOID**)&loc->file_proto
+		(VOID**)&info->file_proto
 	);
 	gBS->HandleProtocol(
 		hand,
 		&gEfiBlockIoProtocolGuid,
-		(VOID**)&loc->block_proto
+		(VOID**)&info->block_proto
 	);
-	if(loc->file_proto)loc->file_proto->OpenVolume(
-		loc->file_proto,
-		&loc->root
+	if(info->file_proto)info->file_proto->OpenVolume(
+		info->file_proto,
+		&info->root
 	);
+	if(info->part_proto&&info->part_proto->Type==PARTITION_TYPE_GPT)
+		UnicodeStrToAsciiStrS(
+			info->part_proto->Info.Gpt.PartitionName,
+			info->gpt_name,sizeof(info->gpt_name)
+		);
+	list_obj_add_new(&locate_infos,info);
+	return info;
+}
+
+const char*locate_get_label(locate_handle*info){
+	UINTN bs=0;
+	EFI_STATUS st;
+	EFI_FILE_SYSTEM_VOLUME_LABEL*fi=NULL;
+	if(!info||info->label_loaded)return info?info->label:"";
+	info->label_loaded=true;
+	if(!info->root)return info->label;
+	st=info->root->GetInfo(
+		info->root,
+		&gEfiFileSystemVolumeLabelInfoIdGuid,
+		&bs,fi
+	);
+	if(st==EFI_BUFFER_TOO_SMALL){
+		if(!(fi=AllocateZeroPool(bs))){
+			tlog_warn("allocate memory failed");
+			return info->label;
+		}
+		st=info->root->GetInfo(
+			info->root,
+			&gEfiFileSystemVolumeLabelInfoIdGuid,
+			&bs,fi
+		);
+	}
+	if(EFI_ERROR(st)||!fi)tlog_warn(
+		"get file system volume label failed: %s",
+		efi_status_to_string(st)
+	);
+	else if(StrLen(fi->VolumeLabel)<sizeof(info->label))
+		UnicodeStrToAsciiStrS(
+			fi->VolumeLabel,
+			info->label,
+			sizeof(info->label)
+		);
+	if(fi)FreePool(fi);
+	return info->label;
+}
+
+const char*locate_get_path(locate_handle*info){
+	CHAR16*dpt;
+	EFI_DEVICE_PATH_PROTOCOL*dp;
+	if(!info||info->path_loaded)return info?info->path:"";
+	info->path_loaded=true;
+	if(!(dp=DevicePathFromHandle(info->hand)))return info->path;
+	if(!(dpt=ConvertDevicePathToText(dp,FALSE,FALSE)))return info->path;
+	UnicodeStrToAsciiStrS(dpt,info->path,sizeof(info->path));
+	FreePool(dpt);
+	return info->path;
+}
+
+static void init_locate(locate_dest*loc,const char*tag,EFI_HANDLE*hand){
+	locate_handle*info=get_info(hand);
+	ZeroMem(loc,sizeof(locate_dest));
+	AsciiStrCpyS(loc->tag,sizeof(loc->tag)-1,tag);
+	loc->file_hand=hand;
+	if(!(loc->info=info))return;
+	loc->root=info->root;
+	loc->block_proto=info->block_proto;
+	loc->part_proto=info->part_proto;
+	loc->file_proto=info->file_proto;
 }
 
 static locate_dest*new_locate(const char*tag,EFI_HANDLE*hand){
@@ -78,13 +161,105 @@ static const char*get_match_name(enum locate_match_state st){
 	}
 }
 
+// 1 when every matcher accepts the handle, -1 when the tag is unusable
+static int try_handle(const char*tag,locate_dest*loc,EFI_HANDLE*hand){
+	init_locate(loc,tag,hand);
+	for(UINTN s=0;locate_matches[s];s++){
+		enum locate_match_state st=locate_matches[s](loc);
+		if(st!=MATCH_SKIP)tlog_verbose(
+			"handle %p match %llu state %s",
+			hand,(unsigned long long)s,get_match_name(st)
+		);
+		switch(st){
+			case MATCH_NONE:
+			case MATCH_SKIP:
+			case MATCH_SUCCESS:continue;
+			case MATCH_INVALID:return -1;
+			case MATCH_FAILED:return 0;
+		}
+	}
+	return 1;
+}
+
+static void log_found(EFI_HANDLE*hand,const char*from){
+	CHAR16*dpt=NULL;
+	char dpx[PATH_MAX];
+	EFI_DEVICE_PATH_PROTOCOL*dp=NULL;
+	ZeroMem(dpx,sizeof(dpx));
+	if(
+		(dp=DevicePathFromHandle(hand))&&
+		(dpt=ConvertDevicePathToText(dp,TRUE,FALSE))
+	){
+		UnicodeStrToAsciiStrS(dpt,dpx,sizeof(dpx)-1);
+		FreePool(dpt);
+	}
+	if(!dpx[0])AsciiStrCpyS(dpx,sizeof(dpx)-1,"(Unknown)");
+	tlog_info("found locate %s%s",dpx,from);
+}
+
+/*
+ * the device path of the handle a tag resolved to is kept in a
+ * non-volatile variable. the next boot runs the matchers on that one
+ * handle and falls back to the full scan when it no longer fits,
+ * the variable is only written when the result changed.
+ */
+static void cache_name(CHAR16*name,UINTN size,const char*tag){
+	UnicodeSPrint(name,size,L"Locate-%a",tag);
+}
+
+static bool load_cached(const char*tag,locate_dest*loc){
+	int r=0;
+	UINTN size=0;
+	EFI_STATUS st;
+	CHAR16 name[300];
+	EFI_HANDLE hand=NULL;
+	EFI_DEVICE_PATH_PROTOCOL*dp=NULL,*rem;
+	cache_name(name,sizeof(name),tag);
+	st=GetVariable2(name,&gSimpleInitLocateCacheGuid,(VOID**)&dp,&size);
+	if(EFI_ERROR(st)||!dp)return false;
+	if(IsDevicePathValid(dp,size)){
+		rem=dp;
+		st=gBS->LocateDevicePath(&gEfiDevicePathProtocolGuid,&rem,&hand);
+		if(!EFI_ERROR(st)&&hand&&IsDevicePathEnd(rem))
+			r=try_handle(tag,loc,hand);
+	}
+	FreePool(dp);
+	if(r!=1){
+		tlog_debug("cached locate for %s is stale",tag);
+		return false;
+	}
+	log_found(hand," (cached)");
+	return true;
+}
+
+static void save_cached(const char*tag,locate_dest*loc){
+	bool same;
+	UINTN size,old=0;
+	CHAR16 name[300];
+	EFI_DEVICE_PATH_PROTOCOL*dp,*cur=NULL;
+	if(!(dp=DevicePathFromHandle(loc->file_hand)))return;
+	size=GetDevicePathSize(dp);
+	cache_name(name,sizeof(name),tag);
+	if(!EFI_ERROR(GetVariable2(
+		name,&gSimpleInitLocateCacheGuid,(VOID**)&cur,&old
+	))&&cur){
+		same=old==size&&CompareMem(cur,dp,size)==0;
+		FreePool(cur);
+		if(same)return;
+	}
+	gRT->SetVariable(
+		name,&gSimpleInitLocateCacheGuid,
+		EFI_VARIABLE_NON_VOLATILE|EFI_VARIABLE_BOOTSERVICE_ACCESS,
+		size,dp
+	);
+}
+
 static bool try_protocol(const char*tag,locate_dest*loc,EFI_GUID*protocol){
+	int r=0;
 	UINTN cnt=0;
 	EFI_STATUS st;
 	EFI_HANDLE*hands=NULL;
-	CHAR16*dpt=NULL;
-	char dpx[PATH_MAX],guid[64];
-	EFI_DEVICE_PATH_PROTOCOL*dp=NULL;
+	char guid[64];
 	AsciiSPrint(guid,sizeof(guid),"%g",protocol);
 	tlog_verbose("try locate protocol in guid %s",guid);
 	st=gBS->LocateHandleBuffer(
@@ -103,46 +278,23 @@ static bool try_protocol(const char*tag,locate_dest*loc,EFI_GUID*protocol){
 		"found %llu handles in protocol %s",
 		(unsigned long long)cnt,guid
 	);
-	for(UINTN i=0;i<cnt;i++){
-		init_locate(loc,tag,hands[i]);
+	for(UINTN i=0;i<cnt&&r==0;i++){
 		tlog_verbose(
 			"try match handle %p (%llu)",
 			hands[i],(unsigned long long)i
 		);
-		for(UINTN s=0;locate_matches[s];s++){
-			enum locate_match_state st=locate_matches[s](loc);
-			if(st!=MATCH_SKIP)tlog_verbose(
-				"handle %p (%llu) match %llu state %s",
-				hands[i],(unsigned long long)i,
-				(unsigned long long)s,get_match_name(st)
-			);
-			switch(st){
-				case MATCH_NONE:
-				case MATCH_SKIP:
-				case MATCH_SUCCESS:continue;
-				case MATCH_INVALID:return false;
-				case MATCH_FAILED:goto match_fail;
-			}
-		}
-		ZeroMem(dpx,sizeof(dpx));
-		if(
-			(dp=DevicePathFromHandle(hands[i]))&&
-			(dpt=ConvertDevicePathToText(dp,TRUE,FALSE))
-		){
-			UnicodeStrToAsciiStrS(dpt,dpx,sizeof(dpx)-1);
-			FreePool(dpt);
-		}
-		if(!dpx[0])AsciiStrCpyS(dpx,sizeof(dpx)-1,"(Unknown)");
-		tlog_info("found locate %s",dpx);
-		return true;
-		match_fail:;
+		if((r=try_handle(tag,loc,hands[i]))<=0)continue;
+		log_found(hands[i],"");
+		save_cached(tag,loc);
 	}
-	return false;
+	FreePool(hands);
+	return r>0;
 }
 
 static locate_dest*load_locate(const char*tag){
 	locate_dest*loc=AllocatePool(sizeof(locate_dest));
 	if(!loc)return NULL;
+	if(load_cached(tag,loc))return loc;
 	if(try_protocol(tag,loc,&gEfiPartitionInfoProtocolGuid))return loc;
 	if(try_protocol(tag,loc,&gEfiSimpleFileSystemProtocolGuid))return loc;
 	if(try_protocol(tag,loc,&gEfiBlockIoProtocolGuid))return loc;
@@ -10,84 +10,232 @@
 #include<string.h>
 #include<stdlib.h>
 #ifdef ENABLE_UEFI
+#include<Library/PcdLib.h>
 #include<Library/BaseLib.h>
 #include<Library/PrintLib.h>
 #include<Library/BaseMemoryLib.h>
 #include<Library/MemoryAllocationLib.h>
 #endif
-#include"list.h"
+#include"lock.h"
 #include"logger_internal.h"
+#ifdef ENABLE_UEFI
+#define LOG_BUFFER_SIZE FixedPcdGet32(PcdLoggerdBufferSize)
+#else
+#define LOG_BUFFER_SIZE 0x40000
+#endif
+#define LOG_BUFFER_MIN 0x4000
+#define ENT_ALIGN 8
+#define ENT_HDR sizeof(struct log_ent)
+
+/*
+ * the history is one allocation used as a byte ring, entries are never
+ * split: when an entry does not fit before the end, a zero size marker
+ * (or a gap too small for a header) sends readers back to offset 0
+ */
+struct log_ent{
+	uint64_t seq;
+	uint32_t size;
+	enum log_level level;
+	time_t time;
+	pid_t pid;
+	uint16_t tag_len;
+	uint16_t content_len;
+	char data[];
+};
 
-list*logbuffer=NULL;
+static char*ring=NULL;
+static size_t ring_size=0,ring_head=0,ring_tail=0,ring_cnt=0;
+static uint64_t first_seq=0,next_seq=0;
+static rwlock_t ring_lock=RWLOCK_INITIALIZER;
+
+
+static struct log_ent*ent_at(char*r,size_t size,size_t*off){
+	struct log_ent*e;
+	if(size-*off<ENT_HDR)*off=0;
+	e=(struct log_ent*)(r+*off);
+	if(e->size==0)*off=0,e=(struct log_ent*)r;
+	return e;
+}
+
+static size_t ent_next(size_t size,size_t off,struct log_ent*e){
+	off+=e->size;
+	return off>=size?0:off;
+}
 
-static int _buff_free(void*data){
-	if(!data)ERET(EINVAL);
-	struct log_buff*l=(struct log_buff*)data;
-	if(l->tag)free(l->tag);
-	if(l->content)free(l->content);
-	free(l);
+static void ring_evict(){
+	struct log_ent*e=ent_at(ring,ring_size,&ring_head);
+	ring_head=ent_next(ring_size,ring_head,e);
+	ring_cnt--,first_seq++;
+	if(ring_cnt==0)ring_head=0,ring_tail=0;
+}
+
+// find room for len bytes at tail, evicting the oldest entries as needed
+static struct log_ent*ring_reserve(size_t len){
+	while(1){
+		if(ring_cnt==0)ring_head=0,ring_tail=0;
+		if(ring_cnt==0||ring_tail>ring_head){
+			if(len<=ring_size-ring_tail)break;
+			if(len<=ring_head){
+				if(ring_size-ring_tail>=ENT_HDR)
+					((struct log_ent*)(ring+ring_tail))->size=0;
+				ring_tail=0;
+				break;
+			}
+		}else if(ring_tail<ring_head&&len<=ring_head-ring_tail)break;
+		ring_evict();
+	}
+	return (struct log_ent*)(ring+ring_tail);
+}
+
+static void ring_put(
+	enum log_level level,const char*tag,size_t tl,
+	const char*content,size_t cl,time_t time,pid_t pid
+){
+	size_t len;
+	struct log_ent*e;
+	if(tl>LOG_TAG_MAX)tl=LOG_TAG_MAX;
+	if(cl>ring_size/4)cl=ring_size/4;
+	if(cl>LOG_CONTENT_MAX)cl=LOG_CONTENT_MAX;
+	len=ENT_HDR+tl+cl+2;
+	len=(len+ENT_ALIGN-1)&~(size_t)(ENT_ALIGN-1);
+	e=ring_reserve(len);
+	e->seq=next_seq++,e->size=len;
+	e->level=level,e->time=time,e->pid=pid;
+	e->tag_len=tl,e->content_len=cl;
+	memcpy(e->data,tag,tl);
+	e->data[tl]=0;
+	memcpy(e->data+tl+1,content,cl);
+	e->data[tl+cl+1]=0;
+	ring_tail=ent_next(ring_size,ring_tail,e);
+	ring_cnt++;
+}
+
+static int ring_alloc(size_t size){
+	char*r;
+	size&=~(size_t)(ENT_ALIGN-1);
+	if(size<ENT_HDR*16)ERET(EINVAL);
+	if(!(r=malloc(size)))ERET(ENOMEM);
+	memset(r,0,ENT_HDR);
+	ring=r,ring_size=size;
+	ring_head=0,ring_tail=0,ring_cnt=0;
+	first_seq=next_seq;
 	return 0;
 }
 
-struct log_buff*logger_internal_item2buff(struct log_item*log){
-	errno=EINVAL;
-	if(!log)return NULL;
-	size_t s=sizeof(struct log_buff);
-	struct log_buff*buff=malloc(s);
-	if(!buff)goto fail;
-	memset(buff,0,s);
-	buff->pid=log->pid;
-	buff->time=log->time;
-	buff->level=log->level;
-	buff->tag=strdup(log->tag);
-	buff->content=strdup(log->content);
-	if(!buff->tag||!buff->content)goto fail;
-	errno=0;
-	return buff;
-	fail:
-	if(buff){
-		if(buff->content)free(buff->content);
-		if(buff->tag)free(buff->tag);
-		free(buff);
+int logger_internal_buffer_add(
+	enum log_level level,const char*tag,
+	const char*content,size_t len,
+	time_t time,pid_t pid
+){
+	if(!tag||!content)ERET(EINVAL);
+	RWLOCK_WRLOCK(ring_lock);
+	if(!ring&&ring_alloc(LOG_BUFFER_SIZE)!=0){
+		RWLOCK_UNLOCK(ring_lock);
+		return -errno;
 	}
-	errno=ENOMEM;
-	return NULL;
-}
-
-struct log_item*logger_internal_buff2item(struct log_buff*log){
-	errno=EINVAL;
-	if(!log)return NULL;
-	size_t s=sizeof(struct log_item);
-	struct log_item*item=malloc(s);
-	if(!item)return NULL;
-	memset(item,0,s);
-	item->pid=log->pid;
-	item->time=log->time;
-	item->level=log->level;
-	strncpy(item->tag,log->tag,sizeof(item->tag)-1);
-	strncpy(item->content,log->content,sizeof(item->content)-1);
-	errno=0;
-	return item;
+	ring_put(level,tag,strlen(tag),content,len,time,pid);
+	RWLOCK_UNLOCK(ring_lock);
+	return 0;
 }
 
 int logger_internal_buffer_push(struct log_item*log){
-	struct log_buff*buff=logger_internal_item2buff(log);
-	if(!buff)return -errno;
-	if(list_obj_add_new(&logbuffer,buff)!=0)goto fail;
-	return 0;
-	fail:
-	if(errno==0)errno=ENOMEM;
-	_buff_free(buff);
-	return -(errno);
+	if(!log)ERET(EINVAL);
+	return logger_internal_buffer_add(
+		log->level,log->tag,
+		log->content,strlen(log->content),
+		log->time,log->pid
+	);
+}
+
+int logger_buffer_set_size(size_t size){
+	int r=0;
+	char*old;
+	uint64_t seq;
+	struct log_ent*e;
+	size_t off,cnt,osize;
+	RWLOCK_WRLOCK(ring_lock);
+	old=ring,osize=ring_size,off=ring_head,cnt=ring_cnt,seq=next_seq;
+	if((r=ring_alloc(size))!=0)EDONE(ring=old);
+	next_seq=first_seq=seq-cnt;
+
+	// copy oldest first, so the newest logs are what survives a shrink
+	for(size_t i=0;old&&i<cnt;i++){
+		e=ent_at(old,osize,&off);
+		ring_put(
+			e->level,e->data,e->tag_len,
+			e->data+e->tag_len+1,e->content_len,
+			e->time,e->pid
+		);
+		off=ent_next(osize,off,e);
+	}
+	if(old)free(old);
+	done:
+	RWLOCK_UNLOCK(ring_lock);
+	return r;
+}
+
+// only critical pressure costs history, the newest logs are kept
+size_t logger_buffer_shrink(enum mem_pressure level,void*d __attribute__((unused))){
+	size_t size;
+	if(level<MEM_PRESSURE_CRITICAL)return 0;
+	RWLOCK_RDLOCK(ring_lock);
+	size=ring_size;
+	RWLOCK_UNLOCK(ring_lock);
+	if(size<=LOG_BUFFER_MIN)return 0;
+	return logger_buffer_set_size(LOG_BUFFER_MIN)==0?size-LOG_BUFFER_MIN:0;
+}
+
+void logger_buffer_cursor(struct log_cursor*c){
+	if(!c)return;
+	RWLOCK_RDLOCK(ring_lock);
+	c->seq=first_seq,c->off=ring_head,c->lost=0;
+	RWLOCK_UNLOCK(ring_lock);
+}
+
+bool logger_buffer_read(struct log_cursor*c,struct log_item*item){
+	size_t off;
+	struct log_ent*e=NULL;
+	if(!c||!item)return false;
+	RWLOCK_RDLOCK(ring_lock);
+	if(!ring||c->seq>=next_seq){
+		RWLOCK_UNLOCK(ring_lock);
+		return false;
+	}
+
+	// entries the cursor has not read yet were overwritten
+	if(c->seq<first_seq){
+		c->lost+=first_seq-c->seq;
+		c->seq=first_seq,c->off=ring_head;
+	}
+	if(c->off<ring_size){
+		off=c->off,e=ent_at(ring,ring_size,&off);
+		if(e->seq!=c->seq)e=NULL;
+	}
+	if(!e)for(off=ring_head;;off=ent_next(ring_size,off,e))
+		if((e=ent_at(ring,ring_size,&off))->seq==c->seq)break;
+	memset(item,0,sizeof(struct log_item)-sizeof(item->content));
+	item->level=e->level,item->time=e->time,item->pid=e->pid;
+	memcpy(item->tag,e->data,e->tag_len+1);
+	memcpy(item->content,e->data+e->tag_len+1,e->content_len+1);
+	c->seq++,c->off=ent_next(ring_size,off,e);
+	RWLOCK_UNLOCK(ring_lock);
+	return true;
 }
 
 char*logger_oper2string(enum log_oper oper){
 	switch(oper){
 		case LOG_OK:return "OK";
 		case LOG_ADD:return "Add";
+		case LOG_ADD_ASYNC:return "Add Async";
 		case LOG_OPEN:return "Open";
 		case LOG_CLOSE:return "Close";
 		case LOG_CLEAR:return "Clear";
+		case LOG_BUFFER:return "Buffer";
+		case LOG_ADD_BATCH:return "AddBatch";
+		case LOG_STORE:return "Store";
+		case LOG_FILTER:return "Filter";
+		case LOG_STATS:return "Stats";
+		case LOG_ROTATE:return "Rotate";
 		case LOG_KLOG:return "Klog";
 		case LOG_LISTEN:return "Listen";
 		case LOG_QUIT:return "Quit";
@@ -95,66 +243,51 @@ char*logger_oper2string(enum log_oper oper){
 	}
 }
 
-int logger_internal_free_buff(void*d){
-	struct log_buff*b=(struct log_buff*)d;
-	if(!b)return -1;
-	if(b->content)free(b->content);
-	if(b->tag)free(b->tag);
-	free(b);
-	return 0;
-}
-
 void clean_log_buffers(){
-	if(!logbuffer)return;
-	list_free_all(logbuffer,logger_internal_free_buff);
-	logbuffer=NULL;
+	RWLOCK_WRLOCK(ring_lock);
+	if(ring)free(ring);
+	ring=NULL,ring_size=0;
+	ring_head=0,ring_tail=0,ring_cnt=0;
+	first_seq=next_seq;
+	RWLOCK_UNLOCK(ring_lock);
 }
 
 #ifdef ENABLE_UEFI
 void flush_buffer(){
-	if(!logbuffer)return;
 	char*str=NULL;
+	struct log_cursor c;
+	struct log_item*item;
 	UINTN len=0,xz=0;
-	list*head,*cur,*next;
-	struct log_buff*buff;
-	if(!(head=list_first(logbuffer)))return;
-	cur=head;
-	do{
-		next=cur->next;
-		if(!(buff=LIST_DATA(cur,struct log_buff*)))continue;
-		xz=AsciiStrLen(buff->tag)+AsciiStrLen(buff->content)+8;
+	if(!(item=AllocateZeroPool(sizeof(struct log_item))))return;
+	logger_buffer_cursor(&c);
+	while(logger_buffer_read(&c,item)){
+		xz=AsciiStrLen(item->tag)+AsciiStrLen(item->content)+8;
 		if(len<xz||!str){
 			if(str)FreePool(str);
-			if(!(str=AllocateZeroPool(xz)))return;
+			if(!(str=AllocateZeroPool(xz)))break;
 			len=xz;
 		}
-		AsciiSPrint(str,xz,"%a: %a",buff->tag,buff->content);
+		AsciiSPrint(str,xz,"%a: %a",item->tag,item->content);
 		logger_out_write(str);
-	}while((cur=next));
+	}
 	if(str)FreePool(str);
+	FreePool(item);
 }
 #else
 void flush_buffer(struct logger*log){
+	struct log_cursor c;
+	struct log_item*item;
 	if(
 		!log||
 		!log->name||
 		!log->enabled||
 		!log->logger||
-		log->flushed||
-		!logbuffer
+		log->flushed
 	)return;
-	list*head,*cur,*next;
-	struct log_item*item;
-	struct log_buff*buff;
-	if(!(head=list_first(logbuffer)))return;
-	cur=head;
-	do{
-		next=cur->next;
-		if(!(buff=LIST_DATA(cur,struct log_buff*)))continue;
-		if(!(item=logger_internal_buff2item(buff)))continue;
-		log->logger(log->name,item);
-		free(item);
-	}while((cur=next));
+	if(!(item=malloc(sizeof(struct log_item))))return;
+	logger_buffer_cursor(&c);
+	while(logger_buffer_read(&c,item))log->logger(log->name,item);
+	free(item);
 	log->flushed=true;
 }
 #endif
@@ -27,10 +27,17 @@
 #include"locate.h"
 #include"compatible.h"
 #else
+#include"str.h"
 #include"recovery.h"
+#include<pthread.h>
+#include<semaphore.h>
 #include<sys/un.h>
+#include<poll.h>
+#include<sys/uio.h>
 #include<sys/socket.h>
+#include"metrics.h"
 #endif
+#include"lock.h"
 #include"confd.h"
 #include"output.h"
 #include"system.h"
@@ -46,9 +53,220 @@ static enum log_level logger_level=FixedPcdGet32(PcdLoggerdMinLevel);
 static enum log_level logger_level=LEVEL_DEBUG;
 #endif
 
+// per tag log levels, tags not listed use logger_level
+#define LOG_FILTER_MAX 32
+struct log_filter{
+	char tag[32];
+	enum log_level level;
+};
+static struct log_filter filters[LOG_FILTER_MAX];
+static size_t filter_cnt=0;
+static enum log_level filter_min=0,filter_max=0;
+static rwlock_t filter_lock=RWLOCK_INITIALIZER;
+
 #ifndef ENABLE_UEFI
+#define ASYNC_RING 256
+#define ASYNC_BATCH 16
 int logfd=-1;
 
+// bounded multi-producer ring, every slot sequence tells who may use it next
+struct async_slot{
+	size_t seq;
+	struct log_rec*rec;
+};
+
+static struct async_slot ring[ASYNC_RING];
+static size_t ring_head=0,ring_tail=0,drops=0;
+static enum log_drop async_drop=LOG_DROP_NONE;
+static bool async_init=false,async_started=false;
+static pthread_t async_tid;
+static pthread_mutex_t wlock=PTHREAD_MUTEX_INITIALIZER;
+static sem_t async_sem;
+
+METRIC_GAUGE(m_queue,"logger_async_queue","log records waiting for the async sender");
+METRIC_COUNTER(m_drops,"logger_async_drops_total","log records dropped by a full async queue");
+
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define STORE(v,n) __atomic_store_n(&(v),(n),__ATOMIC_RELEASE)
+#define CAS(v,o,n) __atomic_compare_exchange_n(&(v),&(o),(n),false,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED)
+
+static bool ring_push(struct log_rec*rec){
+	struct async_slot*s;
+	size_t pos=LOAD(ring_tail);
+	while(1){
+		s=&ring[pos%ASYNC_RING];
+		intptr_t diff=(intptr_t)LOAD(s->seq)-(intptr_t)pos;
+		if(diff==0&&CAS(ring_tail,pos,pos+1))break;
+		else if(diff<0)return false;
+		else if(diff>0)pos=LOAD(ring_tail);
+	}
+	s->rec=rec;
+	STORE(s->seq,pos+1);
+	metric_gauge_add(&m_queue,1);
+	return true;
+}
+
+static struct log_rec*ring_pop(){
+	struct log_rec*rec;
+	struct async_slot*s;
+	size_t pos=LOAD(ring_head);
+	while(1){
+		s=&ring[pos%ASYNC_RING];
+		intptr_t diff=(intptr_t)LOAD(s->seq)-(intptr_t)(pos+1);
+		if(diff==0&&CAS(ring_head,pos,pos+1))break;
+		else if(diff<0)return NULL;
+		else if(diff>0)pos=LOAD(ring_head);
+	}
+	rec=s->rec;
+	STORE(s->seq,pos+ASYNC_RING);
+	metric_gauge_add(&m_queue,-1);
+	return rec;
+}
+
+static void ring_reset(){
+	for(size_t i=0;i<ASYNC_RING;i++)ring[i].seq=i,ring[i].rec=NULL;
+	ring_head=0,ring_tail=0;
+}
+
+// handle a message pushed by loggerd, true when it answers a request
+static bool logger_handle_msg(struct log_msg*msg){
+	if(msg->oper==LOG_FILTER&&logger_set_filter(msg->data.string)!=0)
+		fprintf(stderr,"invalid log filter from loggerd\n");
+	return msg->oper==LOG_OK||msg->oper==LOG_FAIL;
+}
+
+// pick up filter updates when nothing waits for a reply, caller holds wlock
+static void logger_read_pushed(){
+	struct log_msg msg;
+	struct pollfd p={.fd=logfd,.events=POLLIN};
+	while(logfd>=0&&poll(&p,1,0)>0&&(p.revents&POLLIN))
+		if(logger_internal_read_msg(logfd,&msg)<=0)break;
+		else logger_handle_msg(&msg);
+}
+
+// send up to ASYNC_BATCH queued logs with one writev, caller holds wlock
+static size_t async_send_batch(){
+	ssize_t r;
+	size_t cnt=0,i=0,off=0;
+	struct iovec iov[ASYNC_BATCH];
+	struct log_rec*recs[ASYNC_BATCH];
+	while(cnt<ASYNC_BATCH&&(recs[cnt]=ring_pop())){
+		iov[cnt].iov_base=recs[cnt];
+		iov[cnt].iov_len=logger_internal_rec_size(recs[cnt]);
+		cnt++;
+	}
+	while(logfd>=0&&i<cnt){
+		errno=0;
+		r=writev(logfd,iov+i,cnt-i);
+		if(r<0){
+			if(errno==EINTR)continue;
+			break;
+		}
+		for(off=(size_t)r;i<cnt&&off>=iov[i].iov_len;i++)off-=iov[i].iov_len;
+		if(i<cnt)iov[i].iov_base=(char*)iov[i].iov_base+off,iov[i].iov_len-=off;
+	}
+	for(i=0;i<cnt;i++)free(recs[i]);
+	return cnt;
+}
+
+void logger_flush(){
+	if(!async_init)return;
+	pthread_mutex_lock(&wlock);
+	while(async_send_batch()>0);
+	logger_read_pushed();
+	pthread_mutex_unlock(&wlock);
+}
+
+static void*async_thread(void*d __attribute__((unused))){
+	while(1){
+		if(sem_wait(&async_sem)!=0&&errno==EINTR)continue;
+		logger_flush();
+	}
+	return NULL;
+}
+
+static void async_atfork_child(){
+	struct log_rec*rec;
+	// the flush thread is gone, child processes send logs synchronously
+	while((rec=ring_pop()))free(rec);
+	ring_reset();
+	pthread_mutex_init(&wlock,NULL);
+	async_drop=LOG_DROP_NONE,async_started=false;
+}
+
+int logger_set_async(enum log_drop drop){
+	if(drop==LOG_DROP_NONE){
+		logger_flush();
+		async_drop=drop;
+		return 0;
+	}
+	if(drop!=LOG_DROP_NEW&&drop!=LOG_DROP_OLD&&drop!=LOG_DROP_BLOCK)ERET(EINVAL);
+	if(!async_init){
+		ring_reset();
+		if(sem_init(&async_sem,0,0)!=0)return -errno;
+		pthread_atfork(NULL,NULL,async_atfork_child);
+		atexit(logger_flush);
+		async_init=true;
+	}
+	if(!async_started){
+		if((errno=pthread_create(&async_tid,NULL,async_thread,NULL))!=0)return -errno;
+		pthread_detach(async_tid);
+		async_started=true;
+	}
+	async_drop=drop;
+	return 0;
+}
+
+size_t logger_get_drops(){
+	return LOAD(drops);
+}
+
+enum log_drop logger_parse_drop(const char*v){
+	#define CS (const char*[])
+	if(!v)return LOG_DROP_NONE;
+	if(     fuzzy_cmps(v,CS{"new","newest","drop"  ,NULL}))return LOG_DROP_NEW;
+	else if(fuzzy_cmps(v,CS{"old","oldest"         ,NULL}))return LOG_DROP_OLD;
+	else if(fuzzy_cmps(v,CS{"block","wait","sync"  ,NULL}))return LOG_DROP_BLOCK;
+	else return LOG_DROP_NONE;
+}
+
+// queue a log for the flush thread, false means send it synchronously
+static bool logger_write_async(
+	enum log_level level,const char*tag,
+	const char*content,size_t len,
+	time_t time,pid_t pid
+){
+	size_t tl;
+	struct log_rec*rec,*old;
+	if(async_drop==LOG_DROP_NONE||!async_started)return false;
+	// keep severe logs in order and make sure they reach loggerd
+	if(level>=LEVEL_CRIT){
+		logger_flush();
+		return false;
+	}
+	if((tl=strlen(tag))>LOG_TAG_MAX)tl=LOG_TAG_MAX;
+	if(len>LOG_CONTENT_MAX)len=LOG_CONTENT_MAX;
+	if(!(rec=malloc(sizeof(struct log_rec)+tl+len)))return false;
+	logger_internal_encode_rec(rec,LOG_ADD_ASYNC,level,tag,tl,content,len,time,pid);
+	while(!ring_push(rec))switch(async_drop){
+		case LOG_DROP_OLD:
+			if((old=ring_pop()))free(old);
+			__atomic_add_fetch(&drops,1,__ATOMIC_RELAXED);
+			metric_inc(&m_drops);
+		break;
+		case LOG_DROP_BLOCK:
+			logger_flush();
+		break;
+		default:
+			free(rec);
+			__atomic_add_fetch(&drops,1,__ATOMIC_RELAXED);
+			metric_inc(&m_drops);
+			return true;
+	}
+	sem_post(&async_sem);
+	return true;
+}
+
 int set_logfd(int fd){
 	if(fd<0)return logfd;
 	logfd=fd;
@@ -56,6 +274,7 @@ int set_logfd(int fd){
 }
 
 void close_logfd(){
+	logger_flush();
 	close(logfd);
 	logfd=-1;
 }
@@ -84,18 +303,67 @@ int open_socket_logfd(char*path){
 		close(sock);
 		return -1;
 	}
+
+	// logs written until now only went to stderr
+	logger_early_send(sock);
 	return set_logfd(sock);
 }
 
-int logger_send_string(enum log_oper oper,char*string){
-	int r;
+// wait for loggerd to answer a request, caller holds wlock
+static int logger_read_reply(){
 	struct log_msg msg;
-	if((r=logger_internal_send_string(logfd,oper,string))<0)return r;
 	do{if(logger_internal_read_msg(logfd,&msg)<0)return -1;}
-	while(msg.oper!=LOG_OK&&msg.oper!=LOG_FAIL);
+	while(!logger_handle_msg(&msg));
 	return msg.data.code;
 }
 
+int logger_send_string(enum log_oper oper,char*string){
+	int r;
+	logger_flush();
+	pthread_mutex_lock(&wlock);
+	if((r=logger_internal_send_string(logfd,oper,string))>=0)
+		r=logger_read_reply();
+	pthread_mutex_unlock(&wlock);
+	return r<0?-1:r;
+}
+
+int logger_set_buffer_size(size_t size){
+	int r;
+	if(size<=0||size>INT32_MAX)ERET(EINVAL);
+	logger_flush();
+	pthread_mutex_lock(&wlock);
+	if((r=logger_internal_send_code(logfd,LOG_BUFFER,(int)size))>=0)
+		r=logger_read_reply();
+	pthread_mutex_unlock(&wlock);
+	return r<0?-1:r;
+}
+
+int logger_set_rotate(size_t size,int keep,const char*comp){
+	char buff[64];
+	if(keep<0)ERET(EINVAL);
+	snprintf(buff,sizeof(buff),"%zu %d %s",size,keep,comp&&comp[0]?comp:"none");
+	return logger_send_string(LOG_ROTATE,buff);
+}
+
+int logger_get_stats(char*buff,size_t len){
+	int r;
+	struct log_msg msg;
+	if(!buff||len<=0)ERET(EINVAL);
+	memset(buff,0,len);
+	logger_flush();
+	pthread_mutex_lock(&wlock);
+	if((r=logger_internal_send_code(logfd,LOG_STATS,0))>=0)do{
+		if(logger_internal_read_msg(logfd,&msg)<0){
+			r=-1;
+			break;
+		}
+		if(msg.oper==LOG_STATS)strncpy(buff,msg.data.string,len-1);
+		else if(logger_handle_msg(&msg))r=msg.data.code;
+	}while(msg.oper!=LOG_OK&&msg.oper!=LOG_FAIL);
+	pthread_mutex_unlock(&wlock);
+	return r<0?-1:r;
+}
+
 int logger_listen(char*file){
 	return file?logger_send_string(LOG_LISTEN,file):-EINVAL;
 }
@@ -104,6 +372,14 @@ int logger_open(char*file){
 	return file?logger_send_string(LOG_OPEN,file):-EINVAL;
 }
 
+int logger_send_filter(const char*spec){
+	return logger_send_string(LOG_FILTER,(char*)(spec?spec:""));
+}
+
+int logger_open_store(char*file){
+	return file?logger_send_string(LOG_STORE,file):-EINVAL;
+}
+
 int logger_exit(){
 	logger_send_string(LOG_QUIT,NULL);
 	close_logfd();
@@ -135,6 +411,9 @@ int start_loggerd(pid_t*p){
 			exit(r);
 	}
 	close(fds[0]);
+
+	// loggerd inherited the history with our early logs in it
+	logger_early_reset();
 	struct log_msg msg;
 	do{if(logger_internal_read_msg(fds[1],&msg)<0)ERET(EIO);}
 	while(msg.oper!=LOG_OK);
@@ -244,6 +523,10 @@ void logger_init(){
 		break;
 		default:tlog_warn("unknown type for min level");
 	}
+	if((k=confd_get_string("logger.filter",NULL))){
+		if(logger_set_filter(k)!=0)tlog_warn("invalid log filter %s",k);
+		free(k);
+	}
 }
 
 void logger_out_write(char*buff){
@@ -253,34 +536,106 @@ void logger_out_write(char*buff){
 }
 #endif
 
+// levels every tag passes or fails at, so most logs never walk the table
+static void filter_range(){
+	filter_min=filter_max=logger_level;
+	for(size_t i=0;i<filter_cnt;i++){
+		if(filters[i].level<filter_min)filter_min=filters[i].level;
+		if(filters[i].level>filter_max)filter_max=filters[i].level;
+	}
+}
+
 void logger_set_level(enum log_level level){
+	RWLOCK_WRLOCK(filter_lock);
 	logger_level=level;
+	filter_range();
+	RWLOCK_UNLOCK(filter_lock);
 }
 
-int logger_write(struct log_item*log){
-	if(!log)ERET(EINVAL);
-	if(log->level<logger_level)return 0;
-	ssize_t s=strlen(log->content)-1;
-	while(s>=0)
-		if(!isspace(log->content[s]))break;
-		else log->content[s]=0,s--;
+bool logger_enabled(enum log_level level,const char*tag){
+	bool r;
+	if(filter_cnt==0)return level>=logger_level;
+	if(level>=filter_max)return true;
+	if(level<filter_min)return false;
+	if(!tag)return level>=logger_level;
+	RWLOCK_RDLOCK(filter_lock);
+	r=level>=logger_level;
+	for(size_t i=0;i<filter_cnt;i++){
+		if(strcmp(filters[i].tag,tag)!=0)continue;
+		r=level>=filters[i].level;
+		break;
+	}
+	RWLOCK_UNLOCK(filter_lock);
+	return r;
+}
+
+int logger_set_filter(const char*spec){
+	size_t cnt=0,l;
+	char tok[64],*eq;
+	enum log_level level,def=0;
+	const char*p=spec,*e;
+	struct log_filter tab[LOG_FILTER_MAX];
+	while(p&&*p){
+		while(*p==','||isspace(*p))p++;
+		for(e=p;*e&&*e!=','&&!isspace(*e);e++);
+		if((l=e-p)==0)break;
+		if(l>=sizeof(tok))ERET(EINVAL);
+		memcpy(tok,p,l),tok[l]=0,p=e;
+
+		// "tag=level", or "*=level" and "level" for all other tags
+		if((eq=strchr(tok,'=')))*eq++=0;
+		if((level=logger_parse_level(eq?eq:tok))==0)ERET(EINVAL);
+		if(!eq||strcmp(tok,"*")==0){
+			def=level;
+			continue;
+		}
+		if(!tok[0]||strlen(tok)>=sizeof(tab[0].tag)||cnt>=LOG_FILTER_MAX)ERET(EINVAL);
+		strcpy(tab[cnt].tag,tok);
+		tab[cnt++].level=level;
+	}
+	RWLOCK_WRLOCK(filter_lock);
+	memcpy(filters,tab,sizeof(struct log_filter)*cnt);
+	filter_cnt=cnt;
+	if(def!=0)logger_level=def;
+	filter_range();
+	RWLOCK_UNLOCK(filter_lock);
+	return 0;
+}
+
+// length of content without trailing spaces
+static size_t content_len(const char*content){
+	size_t s=strnlen(content,LOG_CONTENT_MAX);
+	while(s>0&&isspace(content[s-1]))s--;
+	return s;
+}
+
+static int logger_send(
+	enum log_level level,const char*tag,
+	const char*content,size_t len,
+	time_t time,pid_t pid
+){
 	#ifndef ENABLE_UEFI
-	static size_t xs=sizeof(struct log_msg);
+	int r;
+	struct log_msg msg;
 	if(logfd<0){
-		if(recovery_out_fd>=0)recovery_ui_printf("%s: %s",log->tag,log->content);
-		return fprintf(stderr,"%s: %s\n",log->tag,log->content);
+		logger_early_add(level,tag,content,len,time,pid);
+		if(recovery_out_fd>=0)recovery_ui_printf("%s: %.*s",tag,(int)len,content);
+		return fprintf(stderr,"%s: %.*s\n",tag,(int)len,content);
 	}
-	struct log_msg msg;
-	logger_internal_init_msg(&msg,LOG_ADD);
-	memcpy(&msg.data.log,log,sizeof(struct log_item));
-	if(((size_t)write(logfd,&msg,xs))!=xs)return -1;
-	memset(&msg,0,sizeof(msg));
-	do{if(logger_internal_read_msg(logfd,&msg)<0)return -1;}
-	while(msg.oper!=LOG_OK&&msg.oper!=LOG_FAIL);
+	if(logger_write_async(level,tag,content,len,time,pid))return (int)len+1;
+	pthread_mutex_lock(&wlock);
+	r=logger_internal_send_rec(logfd,LOG_ADD,level,tag,content,len,time,pid);
+	if(r>=0)do{if(logger_internal_read_msg(logfd,&msg)<0){
+		r=-1;
+		break;
+	}}while(!logger_handle_msg(&msg));
+	pthread_mutex_unlock(&wlock);
+	if(r<0)return -1;
 	errno=msg.data.code;
-	return xs;
+	return r;
 	#else
-	AsciiSPrint(print_buff,sizeof(print_buff),"%a: %a",log->tag,log->content);
+	(void)time,(void)pid,(void)level;
+	AsciiSPrint(print_buff,sizeof(print_buff),"%a: %.*a",tag,(UINTN)len,content);
 	DebugPrint(EFI_D_INFO,"%a",print_buff);
 	DebugPrint(EFI_D_INFO,"\n");
 	if(console_output){
@@ -292,30 +647,45 @@ int logger_write(struct log_item*log){
 	#endif
 }
 
+int logger_write(struct log_item*log){
+	if(!log)ERET(EINVAL);
+	if(!logger_enabled(log->level,log->tag))return 0;
+	return logger_send(
+		log->level,log->tag,
+		log->content,content_len(log->content),
+		log->time,log->pid
+	);
+}
+
 int logger_print(enum log_level level,char*tag,char*content){
+	size_t len;
+	time_t now;
+	pid_t pid=0;
 	if(!tag||!content)ERET(EINVAL);
-	if(level<logger_level)return 0;
-	struct log_item*log=malloc(sizeof(struct log_item));
-	if(!log)ERET(ENOMEM);
-	memset(log,0,sizeof(struct log_item));
-	log->level=level;
-	strncpy(log->tag,tag,sizeof(log->tag)-1);
-	strncpy(log->content,content,sizeof(log->content)-1);
-	time(&log->time);
+	if(!logger_enabled(level,tag))return 0;
+	time(&now);
 	#ifndef ENABLE_UEFI
-	log->pid=getpid();
+	pid=getpid();
 	#endif
-	logger_internal_buffer_push(log);
-	int r=logger_write(log);
-	free(log);
-	return r;
+	len=strnlen(content,LOG_CONTENT_MAX);
+	logger_internal_buffer_add(level,tag,content,len,now,pid);
+	while(len>0&&isspace(content[len-1]))len--;
+	return logger_send(level,tag,content,len,now,pid);
 }
 
 static int logger_printf_x(enum log_level level,char*tag,const char*fmt,va_list ap){
 	int r;
-	char*content=NULL;
+	va_list cp;
+	char buff[256],*content=NULL;
 	if(!tag||!fmt)ERET(EINVAL);
-	if(level<logger_level)return 0;
+	if(!logger_enabled(level,tag))return 0;
+
+	// most logs fit in the stack buffer, only format again for long ones
+	va_copy(cp,ap);
+	r=vsnprintf(buff,sizeof(buff),fmt,cp);
+	va_end(cp);
+	if(r<0)return -errno;
+	if((size_t)r<sizeof(buff))return logger_print(level,tag,buff);
 	r=vasprintf(&content,fmt,ap);
 	if(r<0||!content)return -errno;
 	r=logger_print(level,tag,content);
@@ -325,7 +695,7 @@ static int logger_printf_x(enum log_level level,char*tag,const char*fmt,va_list
 
 static int logger_perror_x(enum log_level level,char*tag,const char*fmt,va_list ap){
 	if(!fmt)ERET(EINVAL);
-	if(level<logger_level)return 0;
+	if(!logger_enabled(level,tag))return 0;
 	char*buff=NULL;
 	if(errno>0){
 		char*er=strerror(errno);
@@ -341,7 +711,7 @@ static int logger_perror_x(enum log_level level,char*tag,const char*fmt,va_list
 
 int logger_printf(enum log_level level,char*tag,const char*fmt,...){
 	if(!tag||!fmt)ERET(EINVAL);
-	if(level<logger_level)return 0;
+	if(!logger_enabled(level,tag))return 0;
 	int err=errno;
 	va_list ap;
 	va_start(ap,fmt);
@@ -354,7 +724,7 @@ int logger_printf(enum log_level level,char*tag,const char*fmt,...){
 
 int logger_perror(enum log_level level,char*tag,const char*fmt,...){
 	if(!tag||!fmt)ERET(EINVAL);
-	if(level<logger_level)return 0;
+	if(!logger_enabled(level,tag))return 0;
 	int err=errno;
 	va_list ap;
 	va_start(ap,fmt);
@@ -367,7 +737,7 @@ int logger_perror(enum log_level level,char*tag,const char*fmt,...){
 
 int return_logger_printf(enum log_level level,int e,char*tag,const char*fmt,...){
 	if(!tag||!fmt)ERET(EINVAL);
-	if(level<logger_level)return 0;
+	if(!logger_enabled(level,tag))return 0;
 	int err=errno;
 	va_list ap;
 	va_start(ap,fmt);
@@ -380,7 +750,7 @@ int return_logger_printf(enum log_level level,int e,char*tag,const char*fmt,...)
 
 int return_logger_perror(enum log_level level,int e,char*tag,const char*fmt,...){
 	if(!tag||!fmt)ERET(EINVAL);
-	if(level<logger_level)return 0;
+	if(!logger_enabled(level,tag))return 0;
 	int ee=errno;
 	va_list ap;
 	va_start(ap,fmt);
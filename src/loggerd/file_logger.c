@@ -12,23 +12,138 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<pthread.h>
+#include<sys/stat.h>
 #include"logger_internal.h"
 #include"defines.h"
 #include"output.h"
 #include"str.h"
 
+// group commit, buffered lines hit the disk after FILE_FLUSH_MS or FILE_FLUSH_SIZE bytes
+#define FILE_FLUSH_SIZE 0x10000
+#define FILE_FLUSH_MS 50
+
+// files_lock guards the table, lock of a file guards its fd and buffer
 struct open_file{
 	char file[PATH_MAX];
 	int fd;
+	bool tty,regular;
+	char*buf;
+	size_t len,size;
+	uint64_t since;
+	pthread_mutex_t lock;
 };
 
 static struct open_file*files[128];
+static pthread_mutex_t files_lock=PTHREAD_MUTEX_INITIALIZER;
 
-int open_log_file(char*path){
-	int i;
-	struct open_file*f=NULL;
+static uint64_t now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000+(uint64_t)ts.tv_nsec/1000000;
+}
+
+static void write_file(struct open_file*f){
+	ssize_t r;
+	size_t off=0;
+	if(f->fd<0||f->len<=0)return;
+	while(off<f->len){
+		r=write(f->fd,f->buf+off,f->len-off);
+		if(r<0&&errno==EINTR)continue;
+		if(r<=0)break;
+		off+=r;
+	}
+	fdatasync(f->fd);
+	f->size+=off,f->len=0;
+}
+
+static int banner(struct open_file*f,const char*what){
+	int r;
 	char tc[24]={0};
 	time_t t=time(NULL);
+	if(f->tty)return 0;
+	r=dprintf(
+		f->fd,
+		"-------- file %s %s at %s --------\n",
+		f->file,what,time2ndefstr(&t,tc,23)
+	);
+	if(r>0)f->size+=r;
+	return r;
+}
+
+static int reopen_file(struct open_file*f){
+	struct stat st;
+	if((f->fd=open(
+		f->file,
+		O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC,
+		0644
+	))<0)return -1;
+	f->tty=isatty(f->fd);
+	f->regular=fstat(f->fd,&st)==0&&S_ISREG(st.st_mode);
+	f->size=f->regular?(size_t)st.st_size:0;
+	banner(f,"opened");
+	return f->fd;
+}
+
+// hand a full segment to the compressor and start a new one
+static void rotate_file(struct open_file*f){
+	banner(f,"rotated");
+	close(f->fd);
+	if(log_rotate(f->file)!=0)
+		fprintf(stderr,"rotate log file %s failed: %m\n",f->file);
+	reopen_file(f);
+}
+
+static void flush_file(struct open_file*f){
+	write_file(f);
+	if(f->fd>=0&&f->regular&&log_rotate_due(f->size))rotate_file(f);
+}
+
+int flush_log_files(bool force){
+	int i,wait=-1;
+	uint64_t now=now_ms(),left;
+	struct open_file*f=NULL;
+	pthread_mutex_lock(&files_lock);
+	for(i=0;(f=files[i]);i++){
+		// a busy file is being written by its dispatcher, look again later
+		if(force)pthread_mutex_lock(&f->lock);
+		else if(pthread_mutex_trylock(&f->lock)!=0){
+			if(wait<0||wait>FILE_FLUSH_MS)wait=FILE_FLUSH_MS;
+			continue;
+		}
+		if(f->fd<0||f->len<=0);
+		else if(force||now-f->since>=FILE_FLUSH_MS)flush_file(f);
+		else{
+			left=FILE_FLUSH_MS-(now-f->since);
+			if(wait<0||left<(uint64_t)wait)wait=(int)left;
+		}
+		pthread_mutex_unlock(&f->lock);
+	}
+	pthread_mutex_unlock(&files_lock);
+	return wait;
+}
+
+int file_logger_flush(char*name){
+	int i,wait=-1;
+	uint64_t now;
+	struct open_file*f=NULL;
+	pthread_mutex_lock(&files_lock);
+	for(i=0;(f=files[i]);i++)if(f->fd>=0&&strcmp(name,f->file)==0)break;
+	if(f)pthread_mutex_lock(&f->lock);
+	pthread_mutex_unlock(&files_lock);
+	if(!f)return -1;
+	if(f->len>0){
+		now=now_ms();
+		if(now-f->since>=FILE_FLUSH_MS)flush_file(f);
+		else wait=(int)(FILE_FLUSH_MS-(now-f->since));
+	}
+	pthread_mutex_unlock(&f->lock);
+	return wait;
+}
+
+static int open_file_locked(char*path){
+	int i;
+	struct open_file*f=NULL;
 	errno=0;
 	for(i=0;(f=files[i]);i++)
 		if(strcmp(path,f->file)==0)
@@ -39,20 +154,12 @@ int open_log_file(char*path){
 		if(!(f=malloc(sizeof(struct open_file))))return -1;
 		memset(f,0,sizeof(struct open_file));
 		strncpy(f->file,path,sizeof(f->file)-1);
-		if((f->fd=open(
-			path,
-			O_WRONLY|O_SYNC|O_APPEND|O_CREAT,
-			0644
-		))<0){
+		if(reopen_file(f)<0){
 			free(f);
 			return -1;
 		}
+		pthread_mutex_init(&f->lock,NULL);
 		files[i]=f;
-		if(!isatty(f->fd))dprintf(
-			f->fd,
-			"-------- file %s opened at %s --------\n",
-			path,time2ndefstr(&t,tc,23)
-		);
 		errno=0;
 		return f->fd;
 	}
@@ -60,34 +167,50 @@ int open_log_file(char*path){
 	ERET(ENOMEM);
 }
 
+int open_log_file(char*path){
+	int fd;
+	pthread_mutex_lock(&files_lock);
+	fd=open_file_locked(path);
+	pthread_mutex_unlock(&files_lock);
+	return fd;
+}
+
 static void close_log(struct open_file*f){
-	if(f->fd<=0)return;
-	char tc[24]={0};
-	time_t t=time(NULL);
-	if(!isatty(f->fd))dprintf(
-		f->fd,
-		"-------- file %s closed at %s --------\n",
-		f->file,time2ndefstr(&t,tc,23)
-	);
+	pthread_mutex_lock(&f->lock);
+	if(f->fd<=0){
+		pthread_mutex_unlock(&f->lock);
+		return;
+	}
+	write_file(f);
+	banner(f,"closed");
 	close(f->fd);
 	f->fd=-1;
+	if(f->buf)free(f->buf);
+	f->buf=NULL,f->len=0;
+	pthread_mutex_unlock(&f->lock);
 }
 void close_log_file(char*path){
 	int i;
 	struct open_file*f=NULL;
+	pthread_mutex_lock(&files_lock);
 	for(i=0;(f=files[i]);i++)
 		if(strcmp(path,f->file)==0)
 			close_log(f);
+	pthread_mutex_unlock(&files_lock);
 }
 
+// called after all dispatchers are stopped
 void close_all_file(){
 	int i;
 	struct open_file*f=NULL;
+	pthread_mutex_lock(&files_lock);
 	for(i=0;(f=files[i]);i++){
 		close_log(f);
+		pthread_mutex_destroy(&f->lock);
 		free(f);
 		files[i]=NULL;
 	}
+	pthread_mutex_unlock(&files_lock);
 }
 
 static char*level2color(enum log_level level){
@@ -105,27 +228,102 @@ static char*level2color(enum log_level level){
 	}
 }
 
-int file_logger(char*name,struct log_item*log){
-	char buff[24]={0},p[16]={0};
+// caller holds files_lock
+static struct open_file*find_file(int fd){
+	struct open_file*f=NULL;
+	for(int i=0;(f=files[i]);i++)if(f->fd==fd)return f;
+	return NULL;
+}
+
+#define LOG_FORMAT "%s[%s]%s %s<%s>%s%s %s%s%s%s: %s%s%s\n"
+#define LOG_ARGS \
+	tty?"\r\033[36m":"",time,end,\
+	tty?"\033[37;1;4m":"",level,end,level_pad,\
+	tty?"\033[33m":"",log->tag,p,end,\
+	tty?level2color(log->level):"",log->content,end
+
+static int file_open(char*name,struct open_file**f,bool*tty){
 	int fd=-1;
+	*f=NULL;
 	if(strncasecmp(name,"stderr",6)==0)fd=STDERR_FILENO;
 	else if(strncasecmp(name,"stdout",6)==0)fd=STDOUT_FILENO;
-	else fd=open_log_file(name);
+	else{
+		pthread_mutex_lock(&files_lock);
+		if((fd=open_file_locked(name))>=0)*f=find_file(fd);
+		pthread_mutex_unlock(&files_lock);
+	}
 	if(fd<0)return -errno;
+	*tty=*f?(*f)->tty:isatty(fd);
+	return fd;
+}
+
+static int file_put(int fd,struct open_file*f,bool tty,struct log_item*log){
+	char buff[24]={0},p[16]={0};
+	int r;
+	size_t left;
 	if(!log->time)ERET(EFAULT);
 	if(log->pid>0)snprintf(p,15,"[%d]",log->pid);
-	bool tty=isatty(fd);
 	char*time,*level,level_pad[16]={0},*end;
 	time=time2ndefstr(&log->time,buff,sizeof(buff));
 	level=logger_level2string(log->level);
 	for(size_t i=0;i<(6-strlen(level));i++)level_pad[i]=' ';
 	end=tty?"\033[0m":"";
-	int r=dprintf(fd,
-		"%s[%s]%s %s<%s>%s%s %s%s%s%s: %s%s%s\n",
-		tty?"\r\033[36m":"",time,end,
-		tty?"\033[37;1;4m":"",level,end,level_pad,
-		tty?"\033[33m":"",log->tag,p,end,
-		tty?level2color(log->level):"",log->content,end
-	);
+
+	// stdio and terminals are written through
+	if(!f||tty)return dprintf(fd,LOG_FORMAT,LOG_ARGS);
+	if(!f->buf&&!(f->buf=malloc(FILE_FLUSH_SIZE)))
+		return dprintf(fd,LOG_FORMAT,LOG_ARGS);
+	left=FILE_FLUSH_SIZE-f->len;
+	r=snprintf(f->buf+f->len,left,LOG_FORMAT,LOG_ARGS);
+	if(r<0)return r;
+	if((size_t)r>=left){
+		flush_file(f);
+		if((fd=f->fd)<0)ERET(EBADF);
+		r=snprintf(f->buf,FILE_FLUSH_SIZE,LOG_FORMAT,LOG_ARGS);
+		if(r<0)return r;
+		if((size_t)r>=FILE_FLUSH_SIZE){
+			if((r=dprintf(fd,LOG_FORMAT,LOG_ARGS))>0)f->size+=r;
+			fdatasync(fd);
+			return r;
+		}
+	}
+	if(f->len==0)f->since=now_ms();
+	f->len+=r;
+	return r;
+}
+
+int file_logger(char*name,struct log_item*log){
+	int fd,r;
+	bool tty;
+	struct open_file*f;
+	if((fd=file_open(name,&f,&tty))<0)return fd;
+
+	// the file may have been rotated meanwhile
+	if(f)pthread_mutex_lock(&f->lock),fd=f->fd;
+	r=fd<0?-EBADF:file_put(fd,f,tty,log);
+
+	// important records must survive a crash right after them
+	if(f&&log->level>=LEVEL_CRIT)flush_file(f);
+	if(f)pthread_mutex_unlock(&f->lock);
 	return r;
 }
+
+int file_logger_batch(char*name,struct log_item*logs,size_t cnt,enum log_level min_level){
+	int fd,r,len=0;
+	bool tty,crit=false;
+	struct open_file*f;
+	if((fd=file_open(name,&f,&tty))<0)return fd;
+	if(f)pthread_mutex_lock(&f->lock),fd=f->fd;
+	if(fd<0){
+		if(f)pthread_mutex_unlock(&f->lock);
+		return -EBADF;
+	}
+	for(size_t i=0;i<cnt;i++){
+		if(logs[i].level<min_level)continue;
+		if((r=file_put(fd,f,tty,&logs[i]))>0)len+=r;
+		if(logs[i].level>=LEVEL_CRIT)crit=true;
+	}
+	if(f&&crit)flush_file(f);
+	if(f)pthread_mutex_unlock(&f->lock);
+	return len;
+}
@@ -11,16 +11,207 @@
 #include<stdarg.h>
 #include<stdlib.h>
 #include<stdbool.h>
+#include<poll.h>
+#include<time.h>
+#include<signal.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<semaphore.h>
+#include<sys/uio.h>
 #include<string.h>
 #include"defines.h"
 #include"list.h"
 #include"logger_internal.h"
 
+#define QUEUE_SIZE 1024
+#define QUEUE_BATCH 8
+#define QUEUE_DRAIN_MS 1000
+
 list*loggers=NULL;
 
+// one copy of a log shared by every output queue it was pushed to
+struct log_qent{
+	uint32_t ref;
+	enum log_level level;
+	time_t time;
+	pid_t pid;
+	uint16_t tag_len,content_len;
+	char data[];
+};
+
+// bounded multi-producer ring, every slot sequence tells who may use it next
+struct log_slot{
+	size_t seq;
+	struct log_qent*ent;
+};
+
+// pending logs of one output, written out by its own dispatcher thread
+struct log_queue{
+	struct log_slot slots[QUEUE_SIZE];
+	size_t head,tail;
+	uint64_t pushed,written,drops;
+	bool stop;
+	pid_t pid;
+	pthread_t tid;
+	sem_t sem;
+	struct log_item items[QUEUE_BATCH];
+};
+
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define STORE(v,n) __atomic_store_n(&(v),(n),__ATOMIC_RELEASE)
+#define CAS(v,o,n) __atomic_compare_exchange_n(&(v),&(o),(n),false,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED)
+#define ADD(v,n) __atomic_add_fetch(&(v),(n),__ATOMIC_ACQ_REL)
+
+static struct log_qent*qent_new(struct log_item*log){
+	size_t tl,cl;
+	struct log_qent*e;
+	tl=strnlen(log->tag,LOG_TAG_MAX);
+	cl=strnlen(log->content,LOG_CONTENT_MAX);
+	if(!(e=malloc(sizeof(struct log_qent)+tl+cl)))return NULL;
+	e->ref=1,e->level=log->level;
+	e->time=log->time,e->pid=log->pid;
+	e->tag_len=tl,e->content_len=cl;
+	memcpy(e->data,log->tag,tl);
+	memcpy(e->data+tl,log->content,cl);
+	return e;
+}
+
+static void qent_put(struct log_qent*e){
+	if(e&&ADD(e->ref,-1)==0)free(e);
+}
+
+static void qent_decode(struct log_qent*e,struct log_item*log){
+	log->level=e->level,log->time=e->time,log->pid=e->pid;
+	memcpy(log->tag,e->data,e->tag_len);
+	memcpy(log->content,e->data+e->tag_len,e->content_len);
+	log->tag[e->tag_len]=0,log->content[e->content_len]=0;
+}
+
+static bool queue_push(struct log_queue*q,struct log_qent*e){
+	struct log_slot*s;
+	size_t pos=LOAD(q->head);
+	while(1){
+		s=&q->slots[pos%QUEUE_SIZE];
+		intptr_t diff=(intptr_t)LOAD(s->seq)-(intptr_t)pos;
+		if(diff==0&&CAS(q->head,pos,pos+1))break;
+		else if(diff<0)return false;
+		else if(diff>0)pos=LOAD(q->head);
+	}
+	s->ent=e;
+	STORE(s->seq,pos+1);
+	return true;
+}
+
+static struct log_qent*queue_pop(struct log_queue*q){
+	struct log_qent*e;
+	struct log_slot*s;
+	size_t pos=LOAD(q->tail);
+	while(1){
+		s=&q->slots[pos%QUEUE_SIZE];
+		intptr_t diff=(intptr_t)LOAD(s->seq)-(intptr_t)(pos+1);
+		if(diff==0&&CAS(q->tail,pos,pos+1))break;
+		else if(diff<0)return NULL;
+		else if(diff>0)pos=LOAD(q->tail);
+	}
+	e=s->ent;
+	STORE(s->seq,pos+QUEUE_SIZE);
+	return e;
+}
+
+// write out up to QUEUE_BATCH queued logs, batched outputs get them with one call
+static size_t queue_dispatch(struct logger*l){
+	size_t cnt=0;
+	struct log_qent*e;
+	struct log_queue*q=l->queue;
+	while(cnt<QUEUE_BATCH&&(e=queue_pop(q))){
+		qent_decode(e,&q->items[cnt++]);
+		qent_put(e);
+	}
+	if(cnt<=0)return 0;
+	if(l->batch)l->batch(l->name,q->items,cnt,l->min_level);
+	else for(size_t i=0;i<cnt;i++)l->logger(l->name,&q->items[i]);
+	ADD(q->written,cnt);
+	return cnt;
+}
+
+static int queue_wait(struct log_queue*q,int ms){
+	struct timespec ts;
+	if(ms<0)return sem_wait(&q->sem);
+	clock_gettime(CLOCK_REALTIME,&ts);
+	ts.tv_sec+=ms/1000,ts.tv_nsec+=(long)(ms%1000)*1000000;
+	if(ts.tv_nsec>=1000000000)ts.tv_sec++,ts.tv_nsec-=1000000000;
+	return sem_timedwait(&q->sem,&ts);
+}
+
+static void*dispatch_thread(void*d){
+	int wait=-1;
+	struct logger*l=d;
+	struct log_queue*q=l->queue;
+	while(1){
+		if(queue_wait(q,wait)!=0&&errno==EINTR)continue;
+		while(queue_dispatch(l)>0);
+		wait=l->flush?l->flush(l->name):-1;
+		if(LOAD(q->stop))break;
+	}
+	return NULL;
+}
+
+// start the dispatcher of an output, without it the output is written inline
+static void queue_start(struct logger*l){
+	sigset_t all,old;
+	struct log_queue*q;
+	if(!(q=malloc(sizeof(struct log_queue))))return;
+	memset(q,0,sizeof(struct log_queue));
+	for(size_t i=0;i<QUEUE_SIZE;i++)q->slots[i].seq=i;
+	q->pid=getpid();
+	if(sem_init(&q->sem,0,0)!=0){
+		free(q);
+		return;
+	}
+	l->queue=q;
+
+	// signals are handled by the loggerd main loop only
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK,&all,&old);
+	errno=pthread_create(&q->tid,NULL,dispatch_thread,l);
+	pthread_sigmask(SIG_SETMASK,&old,NULL);
+	if(errno!=0){
+		sem_destroy(&q->sem);
+		free(q);
+		l->queue=NULL;
+	}
+	errno=0;
+}
+
+static void queue_stop(struct logger*l){
+	struct log_qent*e;
+	struct log_queue*q=l->queue;
+	if(!q)return;
+
+	// a forked child has the queue but not the thread
+	if(q->pid==getpid()){
+		STORE(q->stop,true);
+		sem_post(&q->sem);
+		pthread_join(q->tid,NULL);
+	}
+	while((e=queue_pop(q)))qent_put(e);
+	sem_destroy(&q->sem);
+	free(q);
+	l->queue=NULL;
+}
+
+// wait a while for an output to write out everything queued before
+static void queue_drain(struct logger*l){
+	struct log_queue*q=l->queue;
+	if(!q||q->pid!=getpid())return;
+	for(int i=0;i<QUEUE_DRAIN_MS&&LOAD(q->written)<LOAD(q->pushed);i++)
+		usleep(1000);
+}
+
 static int _free_logger(void*data){
 	if(!data)ERET(EINVAL);
 	struct logger*l=(struct logger*)data;
+	queue_stop(l);
 	free(l->name);
 	free(l);
 	return 0;
@@ -46,27 +237,83 @@ int logger_internal_add(char*name,enum log_level min_level,on_log log){
 	logger->min_level=min_level;
 	logger->logger=log;
 	logger->enabled=false;
+	errno=0;
 	if(!loggers)loggers=list_new(logger);
 	else list_push_new(loggers,logger);
-	if(errno!=0)_free_logger(logger);
-	return -errno;
+	if(errno!=0){
+		_free_logger(logger);
+		return -errno;
+	}
+	queue_start(logger);
+	return 0;
 }
 
 int logger_internal_write(struct log_item*log){
 	if(!log)ERET(EINVAL);
 	if(!loggers)ERET(EFAULT);
-	int len=-1;
+	int cnt=0;
 	list*i;
 	struct logger*l;
+	struct log_qent*e=NULL;
 	logger_internal_buffer_push(log);
 	if(!(i=list_first(loggers)))ERET(ENOENT);
 	do{
 		l=LIST_DATA(i,struct logger*);
 		if(!l||!l->name||!l->logger||!l->enabled)continue;
 		if((l->min_level)>(log->level))continue;
-		len+=l->logger(l->name,log);
+		cnt++;
+
+		// a slow output only fills up its own queue
+		if(l->queue&&(e||(e=qent_new(log)))){
+			ADD(e->ref,1);
+			if(queue_push(l->queue,e)){
+				ADD(l->queue->pushed,1);
+				sem_post(&l->queue->sem);
+			}else{
+				ADD(l->queue->drops,1);
+				qent_put(e);
+			}
+		}else l->logger(l->name,log);
 	}while((i=i->next));
-	return len<0?-ENOENT:len;
+	qent_put(e);
+	return cnt<=0?-ENOENT:cnt;
+}
+
+int logger_internal_write_batch(struct log_item*logs,size_t cnt){
+	if(!logs)ERET(EINVAL);
+	if(!loggers)ERET(EFAULT);
+	int r,len=0;
+	for(size_t x=0;x<cnt;x++)
+		if((r=logger_internal_write(&logs[x]))>0)len+=r;
+	return len<=0?-ENOENT:len;
+}
+
+size_t logger_internal_stats(char*buff,size_t len){
+	int r;
+	list*i;
+	size_t s=0;
+	struct logger*l;
+	struct log_queue*q;
+	if(!buff||len<=0)return 0;
+	buff[0]=0;
+	if(!(i=list_first(loggers)))return 0;
+	do{
+		l=LIST_DATA(i,struct logger*);
+		if(!l||!l->name)continue;
+		q=l->queue;
+		r=snprintf(
+			buff+s,len-s,"%s %llu %llu %llu\n",l->name,
+			q?(unsigned long long)(LOAD(q->pushed)-LOAD(q->written)):0ULL,
+			q?(unsigned long long)LOAD(q->drops):0ULL,
+			q?(unsigned long long)LOAD(q->written):0ULL
+		);
+		if(r<0||(size_t)r>=len-s){
+			buff[s]=0;
+			break;
+		}
+		s+=r;
+	}while((i=i->next));
+	return s;
 }
 
 int logger_internal_print(enum log_level level,char*tag,char*content){
@@ -115,6 +362,7 @@ int logger_internal_set(char*name,bool enabled){
 		if(strcmp(l->name,name)!=0)continue;
 		l->enabled=enabled;
 		if(enabled)flush_buffer(l);
+		else queue_drain(l);
 		logger_internal_printf(
 			LEVEL_INFO,
 			"logger",
@@ -143,8 +391,43 @@ int logger_internal_set_level(char*name,enum log_level level){
 	ERET(ENOENT);
 }
 
+int logger_internal_set_batch(char*name,on_log_batch*batch){
+	if(!name)ERET(EINVAL);
+	if(!loggers)ERET(EFAULT);
+	list*i;
+	struct logger*l;
+	if(!(i=list_first(loggers)))ERET(ENOENT);
+	do{
+		l=LIST_DATA(i,struct logger*);
+		if(!l||!l->name)continue;
+		if(strcmp(l->name,name)!=0)continue;
+		l->batch=batch;
+		return 0;
+	}while((i=i->next));
+	ERET(ENOENT);
+}
+
+int logger_internal_set_flush(char*name,on_log_flush*flush){
+	if(!name)ERET(EINVAL);
+	if(!loggers)ERET(EFAULT);
+	list*i;
+	struct logger*l;
+	if(!(i=list_first(loggers)))ERET(ENOENT);
+	do{
+		l=LIST_DATA(i,struct logger*);
+		if(!l||!l->name)continue;
+		if(strcmp(l->name,name)!=0)continue;
+		l->flush=flush;
+		return 0;
+	}while((i=i->next));
+	ERET(ENOENT);
+}
+
 bool logger_internal_check_magic(struct log_msg*msg){
-	return msg&&msg->magic0==LOGD_MAGIC0&&msg->magic1==LOGD_MAGIC1;
+	return msg&&msg->magic0==LOGD_MAGIC0&&(
+		msg->magic1==LOGD_MAGIC1||
+		msg->magic1==LOGD_MAGIC1_REC
+	);
 }
 
 void logger_internal_init_msg(struct log_msg*msg,enum log_oper oper){
@@ -155,6 +438,20 @@ void logger_internal_init_msg(struct log_msg*msg,enum log_oper oper){
 	msg->oper=oper;
 }
 
+static int write_all(int fd,void*data,size_t len){
+	ssize_t r;
+	for(size_t s=0;s<len;s+=(size_t)r){
+		errno=0;
+		if((r=write(fd,(char*)data+s,len-s))>0)continue;
+		if(r<0&&errno==EINTR){
+			r=0;
+			continue;
+		}
+		return -1;
+	}
+	return 0;
+}
+
 int logger_internal_send_code(int fd,enum log_oper oper,int code){
 	struct log_msg msg;
 	size_t xs=sizeof(struct log_msg);
@@ -164,6 +461,110 @@ int logger_internal_send_code(int fd,enum log_oper oper,int code){
 	return ((size_t)write(fd,&msg,xs))==xs?(int)xs:-1;
 }
 
+int logger_internal_send_reply(int fd,struct log_msg*req,enum log_oper oper,int code){
+	struct log_rec rec;
+	if(fd<0||!req)ERET(EINVAL);
+	if(req->magic1!=LOGD_MAGIC1_REC)return logger_internal_send_code(fd,oper,code);
+	logger_internal_encode_rec(&rec,oper,0,NULL,0,NULL,0,0,0);
+	rec.code=code;
+	return write_all(fd,&rec,sizeof(rec))==0?(int)sizeof(rec):-1;
+}
+
+size_t logger_internal_encode_rec(
+	void*buff,enum log_oper oper,enum log_level level,
+	const char*tag,size_t tag_len,
+	const char*content,size_t content_len,
+	time_t time,pid_t pid
+){
+	struct log_rec*rec=buff;
+	if(tag_len>LOG_TAG_MAX)tag_len=LOG_TAG_MAX;
+	if(content_len>LOG_CONTENT_MAX)content_len=LOG_CONTENT_MAX;
+	memset(rec,0,sizeof(struct log_rec));
+	rec->magic0=LOGD_MAGIC0;
+	rec->magic1=LOGD_MAGIC1_REC;
+	rec->oper=oper,rec->level=level;
+	rec->pid=pid,rec->time=time;
+	rec->tag_len=tag_len,rec->content_len=content_len;
+	if(tag_len>0)memcpy((char*)(rec+1),tag,tag_len);
+	if(content_len>0)memcpy((char*)(rec+1)+tag_len,content,content_len);
+	return logger_internal_rec_size(rec);
+}
+
+size_t logger_internal_rec_size(struct log_rec*rec){
+	return sizeof(struct log_rec)+rec->tag_len+rec->content_len;
+}
+
+int logger_internal_send_rec(
+	int fd,enum log_oper oper,enum log_level level,
+	const char*tag,const char*content,size_t content_len,
+	time_t time,pid_t pid
+){
+	int r;
+	size_t tl,s;
+	char stack[512],*buff=stack;
+	if(fd<0||!tag||!content)ERET(EINVAL);
+	if((tl=strlen(tag))>LOG_TAG_MAX)tl=LOG_TAG_MAX;
+	if(content_len>LOG_CONTENT_MAX)content_len=LOG_CONTENT_MAX;
+	s=sizeof(struct log_rec)+tl+content_len;
+	if(s>sizeof(stack)&&!(buff=malloc(s)))ERET(ENOMEM);
+	logger_internal_encode_rec(buff,oper,level,tag,tl,content,content_len,time,pid);
+	r=write_all(fd,buff,s)==0?(int)s:-1;
+	if(buff!=stack)free(buff);
+	return r;
+}
+
+bool logger_internal_batch_add(struct log_batch*b,struct log_item*log){
+	size_t tl,cl,s;
+	if(!b||!log||b->cnt>=LOG_BATCH_MAX)return false;
+	if((tl=strnlen(log->tag,sizeof(log->tag)))>LOG_TAG_MAX)tl=LOG_TAG_MAX;
+	if((cl=strnlen(log->content,sizeof(log->content)))>LOG_CONTENT_MAX)cl=LOG_CONTENT_MAX;
+	s=LOG_BATCH_ALIGN(sizeof(struct log_rec)+tl+cl);
+	if(b->len+s>LOG_CONTENT_MAX)return false;
+	memset(b->buff+sizeof(struct log_rec)+b->len,0,s);
+	logger_internal_encode_rec(
+		b->buff+sizeof(struct log_rec)+b->len,
+		LOG_ADD_ASYNC,log->level,
+		log->tag,tl,log->content,cl,
+		log->time,log->pid
+	);
+	b->len+=s,b->cnt++;
+	return true;
+}
+
+int logger_internal_send_batch(int fd,struct log_batch*b){
+	int r;
+	struct log_rec*rec;
+	if(fd<0||!b)ERET(EINVAL);
+	if(b->cnt<=0)return 0;
+	rec=(struct log_rec*)b->buff;
+	logger_internal_encode_rec(rec,LOG_ADD_BATCH,0,NULL,0,NULL,0,0,0);
+	rec->content_len=b->len;
+	r=write_all(fd,b->buff,sizeof(struct log_rec)+b->len)==0?(int)b->cnt:-1;
+	b->cnt=0,b->len=0;
+	return r;
+}
+
+size_t logger_internal_parse_batch(struct log_msg*msg,struct log_item*logs,size_t max){
+	size_t cnt=0,s;
+	struct log_rec rec;
+	char*p,*end;
+	if(!msg||!logs)return 0;
+	p=msg->data.string,end=p+sizeof(msg->data.string);
+	while(cnt<max&&p+sizeof(rec)<=end){
+		memcpy(&rec,p,sizeof(rec));
+		if(rec.magic0!=LOGD_MAGIC0||rec.magic1!=LOGD_MAGIC1_REC)break;
+		if(rec.oper!=LOG_ADD_ASYNC)break;
+		if(rec.tag_len>LOG_TAG_MAX||rec.content_len>LOG_CONTENT_MAX)break;
+		if(p+(s=logger_internal_rec_size(&rec))>end)break;
+		logs[cnt].time=rec.time,logs[cnt].pid=rec.pid,logs[cnt].level=rec.level;
+		memcpy(logs[cnt].tag,p+sizeof(rec),rec.tag_len);
+		memcpy(logs[cnt].content,p+sizeof(rec)+rec.tag_len,rec.content_len);
+		logs[cnt].tag[rec.tag_len]=0,logs[cnt].content[rec.content_len]=0;
+		p+=LOG_BATCH_ALIGN(s),cnt++;
+	}
+	return cnt;
+}
+
 int logger_internal_send_string(int fd,enum log_oper oper,char*string){
 	struct log_msg msg;
 	size_t xs=sizeof(struct log_msg);
@@ -173,14 +574,48 @@ int logger_internal_send_string(int fd,enum log_oper oper,char*string){
 	return ((size_t)write(fd,&msg,xs))==xs?(int)xs:-1;
 }
 
+// read the rest of a frame that may arrive split over several reads
+static int read_rest(int fd,void*buff,size_t size){
+	ssize_t r;
+	for(size_t s=0;s<size;s+=(size_t)r){
+		errno=0;
+		if((r=read(fd,(char*)buff+s,size-s))>0)continue;
+		if(r==0)return -1;
+		r=0;
+		if(errno==EINTR)continue;
+		if(errno!=EAGAIN)return -1;
+		struct pollfd p={.fd=fd,.events=POLLIN};
+		if(poll(&p,1,1000)<=0)return -1;
+	}
+	return 0;
+}
+
+// read tag and content of a record, usually with a single readv
+static int read_rec_body(int fd,char*tag,size_t tl,char*content,size_t cl){
+	ssize_t r;
+	struct iovec iov[2]={{tag,tl},{content,cl}};
+	if(tl+cl==0)return 0;
+	do{errno=0;r=readv(fd,iov,2);}while(r<0&&errno==EINTR);
+	if(r<0&&errno!=EAGAIN)return -1;
+	if(r==0)return -1;
+	if(r<0)r=0;
+	if((size_t)r<tl)return (
+		read_rest(fd,tag+r,tl-r)<0||
+		read_rest(fd,content,cl)<0
+	)?-1:0;
+	r-=tl;
+	return read_rest(fd,content+r,cl-r);
+}
+
 int logger_internal_read_msg(int fd,struct log_msg*buff){
+	struct log_rec rec;
+	struct log_item*log;
+	size_t hs=sizeof(struct log_rec),s;
 	if(!buff||fd<0)ERET(EINVAL);
-	size_t size=sizeof(struct log_msg),s;
-	memset(buff,0,size);
 	errno=0;
 	while(1){
 		errno=0;
-		s=read(fd,buff,size);
+		s=read(fd,buff,hs);
 		if(errno==0)break;
 		switch(errno){
 			case EINTR:continue;
@@ -189,6 +624,35 @@ int logger_internal_read_msg(int fd,struct log_msg*buff){
 		}
 	}
 	if(s==0)return EOF;
-	return (s!=size||!(logger_internal_check_magic(buff)))?-2:1;
-}
+	if(s<hs&&read_rest(fd,(char*)buff+s,hs-s)<0)return -2;
+	if(!logger_internal_check_magic(buff))return -2;
 
+	// legacy fixed size frame
+	if(buff->magic1==LOGD_MAGIC1)return read_rest(
+		fd,(char*)buff+hs,sizeof(struct log_msg)-hs
+	)<0?-2:1;
+
+	// compact record, only the used part of tag and content is sent
+	memcpy(&rec,buff,hs);
+	if(rec.tag_len>LOG_TAG_MAX||rec.content_len>LOG_CONTENT_MAX)return -2;
+	if(rec.oper==LOG_ADD||rec.oper==LOG_ADD_ASYNC){
+		log=&buff->data.log;
+		log->time=rec.time,log->pid=rec.pid,log->level=rec.level;
+		if(read_rec_body(
+			fd,log->tag,rec.tag_len,
+			log->content,rec.content_len
+		)<0)return -2;
+		log->tag[rec.tag_len]=0,log->content[rec.content_len]=0;
+	}else if(rec.oper==LOG_ADD_BATCH){
+		// packed records, the zero header written after them ends the batch
+		if(rec.tag_len!=0)return -2;
+		if(read_rest(fd,buff->data.string,rec.content_len)<0)return -2;
+		memset(buff->data.string+rec.content_len,0,sizeof(struct log_rec));
+	}else{
+		if(read_rest(fd,buff->data.string,rec.tag_len)<0)return -2;
+		if(read_rest(fd,buff->data.string,rec.content_len)<0)return -2;
+		buff->data.string[rec.content_len]=0;
+		if(rec.content_len==0)buff->data.code=rec.code;
+	}
+	return 1;
+}
@@ -86,7 +86,7 @@ static int read_kmsg_thread(void*data __attribute__((unused))){
 	close_all_fd((int[]){klogfd},1);
 	open_socket_logfd_default();
 
-	if(fcntl(klogfd,F_SETFL,0)<0)return terlog_error(-errno,"fcntl klog fd");
+	if(fcntl(klogfd,F_SETFL,O_NONBLOCK)<0)return terlog_error(-errno,"fcntl klog fd");
 	if(lseek(klogfd,0,SEEK_END)<0)return terlog_error(-errno,"lseek klog fd");
 
 	klogctl(SYSLOG_ACTION_CONSOLE_OFF,NULL,0);
@@ -100,6 +100,7 @@ static int read_kmsg_thread(void*data __attribute__((unused))){
 
 	fd_set fs;
 	struct log_item item;
+	static struct log_batch batch;
 	struct timeval timeout;
 	int m=MAX(klogfd,logfd)+1;
 	while(run){
@@ -114,10 +115,15 @@ static int read_kmsg_thread(void*data __attribute__((unused))){
 			break;
 		}else if(r==0)continue;
 		else if(FD_ISSET(klogfd,&fs)){
-			if(
-				read_kmsg_item(&item,klogfd,false)&&
-				strncmp(item.content,"simple-init ",12)!=0
-			)logger_write(&item);
+			// drain all pending records and forward them in as few frames as possible
+			batch.cnt=0,batch.len=0;
+			while(read_kmsg_item(&item,klogfd,false)){
+				if(strncmp(item.content,"simple-init ",12)==0)continue;
+				if(logger_internal_batch_add(&batch,&item))continue;
+				if(logger_internal_send_batch(logfd,&batch)<0)break;
+				if(!logger_internal_batch_add(&batch,&item))logger_write(&item);
+			}
+			logger_internal_send_batch(logfd,&batch);
 		}else if(FD_ISSET(logfd,&fs)){
 			struct log_msg l;
 			int x=logger_internal_read_msg(logfd,&l);
@@ -134,36 +140,23 @@ static int read_kmsg_thread(void*data __attribute__((unused))){
 
 int init_kmesg(){
 	struct log_item log;
-	struct log_buff*buff=NULL;
-	list*head=NULL,*conts=NULL,*item=NULL;
 
 	struct sysinfo info;
 	sysinfo(&info);
 	boot_time=time(NULL)-(time_t)(info.uptime/1000);
 
-	if(logbuffer&&!(head=list_first(logbuffer)))return -errno;
 	if((klogfd=open(_PATH_DEV_KMSG,O_RDONLY|O_NONBLOCK))<0)goto fail;
 	if(lseek(klogfd,0,SEEK_DATA)<0)goto fail;
 
 	while(read_kmsg_item(&log,klogfd,true)){
-		if(!(buff=logger_internal_item2buff(&log)))goto fail;
-		if(strncmp(buff->tag,"simple-init ",12)==0)continue;
-		if(!(item=list_new(buff)))goto fail;
-		if(conts)list_add(conts,item);
-		conts=item;
-		item=NULL,buff=NULL;
+		if(strncmp(log.tag,"simple-init ",12)==0)continue;
+		if(logger_internal_buffer_push(&log)!=0)goto fail;
 	}
 
-	if(logbuffer)list_insert(head,conts);
-	else logbuffer=conts;
-	conts=NULL;
-
 	int x=fork_run("klog",false,NULL,NULL,read_kmsg_thread);
 	close(klogfd);
 	return x;
 	fail:
-	if(conts)list_free_all(conts,logger_internal_free_buff);
-	if(buff)free(buff);
 	if(klogfd>=0)close(klogfd);
 	return -errno;
 }
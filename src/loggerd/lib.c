@@ -6,11 +6,111 @@
  *
  */
 
+#include<stdio.h>
 #include<string.h>
+#ifndef ENABLE_UEFI
+#include<time.h>
+#include<errno.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/uio.h>
+#endif
 #include"str.h"
 #include"kloglevel.h"
 #include"logger_internal.h"
 
+#ifndef ENABLE_UEFI
+#define EARLY_SIZE 0x4000
+
+// logs written before this process is connected to loggerd, packed like a LOG_ADD_BATCH payload
+static struct{
+	size_t len,cnt,lost;
+	char buff[EARLY_SIZE];
+}early;
+static bool early_init=false;
+static pthread_mutex_t early_lock=PTHREAD_MUTEX_INITIALIZER;
+
+// the logs of the parent are not ours, they are already in the inherited history
+static void early_atfork_child(){
+	pthread_mutex_init(&early_lock,NULL);
+	early.len=0,early.cnt=0,early.lost=0;
+}
+
+void logger_early_add(
+	enum log_level level,const char*tag,
+	const char*content,size_t len,
+	time_t time,pid_t pid
+){
+	size_t tl,s;
+	if(!tag||!content)return;
+	if((tl=strlen(tag))>LOG_TAG_MAX)tl=LOG_TAG_MAX;
+	if(len>LOG_CONTENT_MAX)len=LOG_CONTENT_MAX;
+	s=LOG_BATCH_ALIGN(sizeof(struct log_rec)+tl+len);
+	pthread_mutex_lock(&early_lock);
+	if(!early_init){
+		pthread_atfork(NULL,NULL,early_atfork_child);
+		early_init=true;
+	}
+	if(early.len+s>sizeof(early.buff))early.lost++;
+	else{
+		memset(early.buff+early.len,0,s);
+		logger_internal_encode_rec(
+			early.buff+early.len,LOG_ADD_ASYNC,
+			level,tag,tl,content,len,time,pid
+		);
+		early.len+=s,early.cnt++;
+	}
+	pthread_mutex_unlock(&early_lock);
+}
+
+// send early logs as few LOG_ADD_BATCH frames, every frame fits one message
+int logger_early_send(int fd){
+	int r=0;
+	ssize_t w;
+	char note[64];
+	struct log_rec hdr,rec;
+	size_t off=0,start,cnt,s;
+	if(fd<0)ERET(EINVAL);
+	pthread_mutex_lock(&early_lock);
+	while(off<early.len){
+		start=off,cnt=0;
+		while(off<early.len&&cnt<LOG_BATCH_MAX){
+			memcpy(&rec,early.buff+off,sizeof(rec));
+			s=LOG_BATCH_ALIGN(logger_internal_rec_size(&rec));
+			if(off+s-start>LOG_CONTENT_MAX)break;
+			off+=s,cnt++;
+		}
+		logger_internal_encode_rec(&hdr,LOG_ADD_BATCH,0,NULL,0,NULL,0,0,0);
+		hdr.content_len=off-start;
+		struct iovec iov[2]={
+			{&hdr,sizeof(hdr)},
+			{early.buff+start,off-start},
+		};
+		do{w=writev(fd,iov,2);}while(w<0&&errno==EINTR);
+		if(w!=(ssize_t)(sizeof(hdr)+off-start)){
+			r=-1;
+			break;
+		}
+	}
+	if(r==0&&early.lost>0){
+		s=snprintf(note,sizeof(note),"%zu early logs lost",early.lost);
+		r=logger_internal_send_rec(
+			fd,LOG_ADD_ASYNC,LEVEL_WARNING,
+			"logger",note,s,time(NULL),getpid()
+		)<0?-1:0;
+	}
+	early.len=0,early.cnt=0,early.lost=0;
+	pthread_mutex_unlock(&early_lock);
+	return r;
+}
+
+void logger_early_reset(){
+	pthread_mutex_lock(&early_lock);
+	early.len=0,early.cnt=0,early.lost=0;
+	pthread_mutex_unlock(&early_lock);
+}
+#endif
+
 char*logger_level2string(enum log_level level){
 	switch(level){
 		case LEVEL_DEBUG:return   "DEBUG";
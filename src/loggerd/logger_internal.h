@@ -9,13 +9,20 @@
 #ifndef _LOGGER_INTERNAL_H
 #define _LOGGER_INTERNAL_H
 #include<stdio.h>
+#include<stdint.h>
 #include<sys/socket.h>
 #include"list.h"
 #include"logger.h"
+#include"mempressure.h"
 
 // logger packet magic
 #define LOGD_MAGIC0 0xEF
 #define LOGD_MAGIC1 0x88
+#define LOGD_MAGIC1_REC 0x89
+
+// longest tag and content a log record can carry
+#define LOG_TAG_MAX (sizeof(((struct log_item*)0)->tag)-1)
+#define LOG_CONTENT_MAX (sizeof(((struct log_item*)0)->content)-1)
 
 // logger operation
 enum log_oper{
@@ -30,6 +37,13 @@ enum log_oper{
 	LOG_KLOG     =0xAF08,
 	LOG_SYSLOG   =0xAF09,
 	LOG_CONSOLE  =0xAF0A,
+	LOG_ADD_ASYNC=0xAF0B,
+	LOG_BUFFER   =0xAF0C,
+	LOG_ADD_BATCH=0xAF0D,
+	LOG_STORE    =0xAF0E,
+	LOG_FILTER   =0xAF0F,
+	LOG_STATS    =0xAF10,
+	LOG_ROTATE   =0xAF11,
 };
 
 // logger message packet
@@ -43,16 +57,47 @@ struct log_msg{
 	}data;
 };
 
+// compact logger record header, followed by tag_len bytes tag and content_len bytes content
+struct log_rec{
+	unsigned char magic0,magic1;
+	enum log_oper oper;
+	int32_t code;
+	enum log_level level;
+	int32_t pid;
+	uint16_t tag_len;
+	uint16_t content_len;
+	int64_t time;
+};
+
+// most records carried by one LOG_ADD_BATCH frame
+#define LOG_BATCH_MAX 32
+#define LOG_BATCH_ALIGN(s) (((s)+7)&~(size_t)7)
+
+// records packed for one LOG_ADD_BATCH frame, each starts on an 8 byte boundary
+struct log_batch{
+	size_t cnt,len;
+	char buff[sizeof(struct log_rec)+LOG_CONTENT_MAX];
+};
+
 // logger output handle
 typedef int on_log(char*,struct log_item*);
 
+// logger batched output handle, gets records with level above min_level only
+typedef int on_log_batch(char*,struct log_item*,size_t,enum log_level);
+
+// logger delayed write handle, returns ms until it wants to be called again or -1
+typedef int on_log_flush(char*);
+
 // logger output
 struct logger{
 	char*name;
 	bool flushed;
 	enum log_level min_level;
 	on_log*logger;
+	on_log_batch*batch;
+	on_log_flush*flush;
 	bool enabled;
+	struct log_queue*queue;
 };
 
 // src/loggerd/internal.c: logger output list
@@ -64,6 +109,33 @@ extern int loggerd_thread(int fd);
 // src/loggerd/file_logger.c: file or stdio logger output
 extern int file_logger(char*name,struct log_item *log);
 
+// src/loggerd/file_logger.c: file or stdio batched logger output
+extern int file_logger_batch(char*name,struct log_item*logs,size_t cnt,enum log_level min_level);
+
+// src/loggerd/file_logger.c: write out the buffer of a file logger output when due
+extern int file_logger_flush(char*name);
+
+// src/loggerd/rotate.c: check a file output reached the rotation size
+extern bool log_rotate_due(size_t size);
+
+// src/loggerd/rotate.c: move a full file output away and compress it in background
+extern int log_rotate(const char*path);
+
+// src/loggerd/rotate.c: set rotation size, kept segments and compressor name
+extern int set_log_rotate(size_t size,int keep,const char*comp);
+
+// src/loggerd/store.c: binary log store output
+extern int store_logger(char*name,struct log_item*log);
+
+// src/loggerd/store.c: open binary log store for writing
+extern int open_log_store(char*path);
+
+// src/loggerd/store.c: close binary log store
+extern void close_log_store(char*path);
+
+// src/loggerd/store.c: close all openned binary log stores
+extern void close_all_store(void);
+
 // src/loggerd/syslog_logger.c: syslog logger output
 extern int syslog_logger(char*name,struct log_item *log);
 
@@ -76,6 +148,9 @@ extern int open_log_file(char*path);
 // src/loggerd/file_logger.c: close log file
 extern void close_log_file(char*path);
 
+// src/loggerd/file_logger.c: write out buffered log files, returns ms until next due flush or -1
+extern int flush_log_files(bool force);
+
 // src/loggerd/file_logger.c: close all openned log file
 extern void close_all_file(void);
 
@@ -85,9 +160,15 @@ extern void logger_internal_clean(void);
 // src/loggerd/internal.c: add new logger
 extern int logger_internal_add(char*name,enum log_level min_level,on_log log);
 
-// src/loggerd/internal.c: add raw log
+// src/loggerd/internal.c: add raw log, queued to every enabled output
 extern int logger_internal_write(struct log_item*log);
 
+// src/loggerd/internal.c: add many raw logs, one call per batched output
+extern int logger_internal_write_batch(struct log_item*logs,size_t cnt);
+
+// src/loggerd/internal.c: print name, queue depth, drops and written count of every output
+extern size_t logger_internal_stats(char*buff,size_t len);
+
 // src/loggerd/internal.c: add log with level, tag, content
 extern int logger_internal_print(enum log_level level,char*tag,char*content);
 
@@ -97,6 +178,12 @@ extern int logger_internal_printf(enum log_level level,char*tag,const char*fmt,.
 // src/loggerd/internal.c: turn on or off logger output
 extern int logger_internal_set(char*name,bool enabled);
 
+// src/loggerd/internal.c: set batched handle of a logger output
+extern int logger_internal_set_batch(char*name,on_log_batch*batch);
+
+// src/loggerd/internal.c: set delayed write handle of a logger output
+extern int logger_internal_set_flush(char*name,on_log_flush*flush);
+
 // src/loggerd/internal.c: set logger output level
 extern int logger_internal_set_level(char*name,enum log_level level);
 
@@ -112,27 +199,73 @@ extern int logger_internal_read_msg(int fd,struct log_msg*buff);
 // src/loggerd/internal.c: send a return code packet
 extern int logger_internal_send_code(int fd,enum log_oper oper,int code);
 
+// src/loggerd/internal.c: answer a request in the same framing it came in
+extern int logger_internal_send_reply(int fd,struct log_msg*req,enum log_oper oper,int code);
+
+// src/loggerd/internal.c: encode a log record into buff, returns record size
+extern size_t logger_internal_encode_rec(
+	void*buff,enum log_oper oper,enum log_level level,
+	const char*tag,size_t tag_len,
+	const char*content,size_t content_len,
+	time_t time,pid_t pid
+);
+
+// src/loggerd/internal.c: get full size of an encoded log record
+extern size_t logger_internal_rec_size(struct log_rec*rec);
+
+// src/loggerd/internal.c: send a log record packet
+extern int logger_internal_send_rec(
+	int fd,enum log_oper oper,enum log_level level,
+	const char*tag,const char*content,size_t content_len,
+	time_t time,pid_t pid
+);
+
+// src/loggerd/internal.c: pack a log into batch, returns false when batch is full
+extern bool logger_internal_batch_add(struct log_batch*b,struct log_item*log);
+
+// src/loggerd/internal.c: send all packed logs as one frame and empty batch
+extern int logger_internal_send_batch(int fd,struct log_batch*b);
+
+// src/loggerd/internal.c: unpack a received batch into logs, returns count
+extern size_t logger_internal_parse_batch(struct log_msg*msg,struct log_item*logs,size_t max);
+
 // src/loggerd/internal.c: send a string log packet
 extern int logger_internal_send_string(int fd,enum log_oper oper,char*string);
 
-// src/loggerd/buffer.c: convert operation to a readable string
-extern char*logger_oper2string(enum log_oper oper);
+#ifndef ENABLE_UEFI
+// src/loggerd/lib.c: keep a log written before the loggerd connection
+extern void logger_early_add(
+	enum log_level level,const char*tag,
+	const char*content,size_t len,
+	time_t time,pid_t pid
+);
 
-// src/loggerd/buffer.c: convert log_item to log_buff
-extern struct log_buff*logger_internal_item2buff(struct log_item*log);
+// src/loggerd/lib.c: hand all kept early logs over to loggerd
+extern int logger_early_send(int fd);
 
-// src/loggerd/buffer.c: convert log_buff to log_item
-extern struct log_item*logger_internal_buff2item(struct log_buff*log);
+// src/loggerd/lib.c: forget all kept early logs
+extern void logger_early_reset(void);
+#endif
+
+// src/loggerd/buffer.c: convert operation to a readable string
+extern char*logger_oper2string(enum log_oper oper);
 
 // src/loggerd/buffer.c: add log to buffer
 extern int logger_internal_buffer_push(struct log_item*log);
 
-// src/loggerd/buffer.c: free log_buff
-extern int logger_internal_free_buff(void*d);
+// src/loggerd/buffer.c: add log fields to buffer
+extern int logger_internal_buffer_add(
+	enum log_level level,const char*tag,
+	const char*content,size_t len,
+	time_t time,pid_t pid
+);
 
 // src/loggerd/buffer.c: clean log buffers
 extern void clean_log_buffers(void);
 
+// src/loggerd/buffer.c: shrink history to a minimum on critical memory pressure
+extern size_t logger_buffer_shrink(enum mem_pressure level,void*data);
+
 // src/loggerd/buffer.c: flush buffer to logger
 #ifdef ENABLE_UEFI
 extern void flush_buffer();
@@ -0,0 +1,216 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<signal.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<semaphore.h>
+#include<sys/stat.h>
+#include"logger_internal.h"
+#include"compress.h"
+#include"defines.h"
+
+/*
+ * size based rotation of file outputs:
+ *
+ *   path           current segment
+ *   path.rotateN   closed segment waiting for the compressor thread
+ *   path.1.gz      newest closed segment, up to path.KEEP.gz
+ */
+#define ROTATE_SIZE 0x100000
+#define ROTATE_KEEP 4
+#define ROTATE_JOBS 8
+#define ROTATE_COMPRESS "gzip"
+
+struct rotate_job{
+	char base[PATH_MAX];
+	char raw[PATH_MAX];
+};
+
+static size_t rotate_size=ROTATE_SIZE;
+static int rotate_keep=ROTATE_KEEP;
+static compressor*rotate_comp=NULL;
+static bool comp_set=false;
+
+// closed segments, produced by file outputs and consumed by the compressor thread
+static struct rotate_job jobs[ROTATE_JOBS];
+static size_t job_head=0,job_tail=0;
+static unsigned int job_seq=0;
+static bool job_started=false;
+static pthread_mutex_t job_lock=PTHREAD_MUTEX_INITIALIZER;
+static sem_t job_sem;
+
+static int read_segment(const char*path,unsigned char**data,size_t*len){
+	int fd;
+	ssize_t r;
+	struct stat st;
+	*data=NULL,*len=0;
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))<0)return -1;
+	if(fstat(fd,&st)<0||!(*data=malloc(st.st_size+1))){
+		close(fd);
+		return -1;
+	}
+	while((size_t)*len<(size_t)st.st_size){
+		r=read(fd,*data+*len,st.st_size-*len);
+		if(r<0&&errno==EINTR)continue;
+		if(r<=0)break;
+		*len+=r;
+	}
+	close(fd);
+	return 0;
+}
+
+static int write_segment(const char*path,unsigned char*data,size_t len){
+	int fd;
+	ssize_t r;
+	size_t off=0;
+	if((fd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644))<0)return -1;
+	while(off<len){
+		r=write(fd,data+off,len-off);
+		if(r<0&&errno==EINTR)continue;
+		if(r<=0)break;
+		off+=r;
+	}
+	fdatasync(fd);
+	close(fd);
+	return off==len?0:-1;
+}
+
+// make room for a new path.1, the oldest kept segment is dropped
+static void shift_segments(const char*base,const char*ext){
+	char from[PATH_MAX],to[PATH_MAX];
+	snprintf(to,sizeof(to),"%s.%d%s",base,rotate_keep,ext);
+	unlink(to);
+	for(int i=rotate_keep-1;i>0;i--){
+		snprintf(from,sizeof(from),"%s.%d%s",base,i,ext);
+		snprintf(to,sizeof(to),"%s.%d%s",base,i+1,ext);
+		rename(from,to);
+	}
+}
+
+static void rotate_segment(struct rotate_job*j){
+	char ext[40]={0},dst[PATH_MAX],tmp[PATH_MAX];
+	unsigned char*inp=NULL,*out=NULL;
+	size_t inp_len=0,out_len,len=0;
+	compressor*c=rotate_comp;
+	if(rotate_keep<=0)goto done;
+	if(c&&read_segment(j->raw,&inp,&inp_len)==0&&inp_len>0){
+		out_len=inp_len+inp_len/8+256;
+		if(
+			(out=malloc(out_len))&&
+			compressor_compress(c,inp,inp_len,out,out_len,NULL,&len)==0
+		){
+			snprintf(ext,sizeof(ext),".%s",compressor_get_ext(c));
+			snprintf(tmp,sizeof(tmp),"%s.tmp",j->raw);
+			if(write_segment(tmp,out,len)==0){
+				shift_segments(j->base,ext);
+				snprintf(dst,sizeof(dst),"%s.1%s",j->base,ext);
+				if(rename(tmp,dst)==0)goto done;
+			}
+			unlink(tmp);
+		}
+	}
+
+	// no compressor or it failed, keep the segment as plain text
+	shift_segments(j->base,"");
+	snprintf(dst,sizeof(dst),"%s.1",j->base);
+	if(rename(j->raw,dst)==0)j->raw[0]=0;
+	done:
+	if(j->raw[0])unlink(j->raw);
+	if(inp)free(inp);
+	if(out)free(out);
+}
+
+static void*rotate_thread(void*d __attribute__((unused))){
+	struct rotate_job j;
+	while(1){
+		if(sem_wait(&job_sem)!=0)continue;
+		pthread_mutex_lock(&job_lock);
+		if(job_tail==job_head){
+			pthread_mutex_unlock(&job_lock);
+			continue;
+		}
+		memcpy(&j,&jobs[job_tail%ROTATE_JOBS],sizeof(j));
+		pthread_mutex_unlock(&job_lock);
+		rotate_segment(&j);
+
+		// release the slot only now, so jobs of one file never overtake each other
+		pthread_mutex_lock(&job_lock);
+		job_tail++;
+		pthread_mutex_unlock(&job_lock);
+	}
+	return NULL;
+}
+
+// caller holds job_lock
+static int start_rotate_thread(){
+	pthread_t tid;
+	sigset_t all,old;
+	if(job_started)return 0;
+	if(sem_init(&job_sem,0,0)!=0)return -1;
+
+	// signals are handled by the loggerd main loop only
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK,&all,&old);
+	errno=pthread_create(&tid,NULL,rotate_thread,NULL);
+	pthread_sigmask(SIG_SETMASK,&old,NULL);
+	if(errno!=0){
+		sem_destroy(&job_sem);
+		return -1;
+	}
+	pthread_detach(tid);
+	job_started=true;
+	return 0;
+}
+
+bool log_rotate_due(size_t size){
+	return rotate_size>0&&size>=rotate_size;
+}
+
+int log_rotate(const char*path){
+	struct rotate_job*j;
+	if(!path)ERET(EINVAL);
+	if(!comp_set){
+		rotate_comp=compressor_get_by_name(ROTATE_COMPRESS);
+		comp_set=true;
+	}
+	pthread_mutex_lock(&job_lock);
+	if(job_head-job_tail>=ROTATE_JOBS||start_rotate_thread()!=0){
+		pthread_mutex_unlock(&job_lock);
+		ERET(EAGAIN);
+	}
+	j=&jobs[job_head%ROTATE_JOBS];
+	strncpy(j->base,path,sizeof(j->base)-1);
+	snprintf(j->raw,sizeof(j->raw),"%s.rotate%u",path,job_seq++);
+	if(rename(path,j->raw)!=0){
+		pthread_mutex_unlock(&job_lock);
+		return -1;
+	}
+	job_head++;
+	pthread_mutex_unlock(&job_lock);
+	sem_post(&job_sem);
+	return 0;
+}
+
+int set_log_rotate(size_t size,int keep,const char*comp){
+	compressor*c=NULL;
+	if(keep<0)ERET(EINVAL);
+	if(comp&&comp[0]&&strcasecmp(comp,"none")!=0&&!(c=compressor_get_by_name(comp)))
+		ERET(ENOENT);
+	pthread_mutex_lock(&job_lock);
+	rotate_size=size,rotate_keep=keep;
+	rotate_comp=c,comp_set=true;
+	pthread_mutex_unlock(&job_lock);
+	return 0;
+}
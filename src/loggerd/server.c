@@ -20,6 +20,7 @@
 #include"defines.h"
 #include"system.h"
 #include"proctitle.h"
+#include"metrics.h"
 #include"logger_internal.h"
 #define TAG "loggerd"
 
@@ -30,9 +31,16 @@ struct socket_data{
 };
 
 static bool clean=false;
+static volatile sig_atomic_t quit=0;
 static int efd=-1;
 static list*slist=NULL;
 
+// current per tag levels, pushed to every client
+static char*filter=NULL;
+
+// unpacked items of a LOG_ADD_BATCH frame, loggerd handles one frame at a time
+static struct log_item batch[LOG_BATCH_MAX];
+
 static struct socket_data*new_socket_data(int fd,bool server,char*path){
 	struct socket_data*sd=malloc(sizeof(struct socket_data));
 	if(!sd)return NULL;
@@ -165,6 +173,8 @@ int init_console(){
 			memset(path,0,PATH_MAX);
 			snprintf(path,PATH_MAX-1,_PATH_DEV"/%s",tty[i]);
 			logger_internal_add(path,LEVEL_DEBUG,&file_logger);
+			logger_internal_set_batch(path,&file_logger_batch);
+			logger_internal_set_flush(path,&file_logger_flush);
 			logger_internal_set(path,true);
 			ok=true;
 		}
@@ -174,6 +184,24 @@ int init_console(){
 	return 0;
 }
 
+static void send_filter(int fd,char*spec){
+	if(spec)logger_internal_send_rec(fd,LOG_FILTER,0,"",spec,strlen(spec),0,0);
+}
+
+static int set_filter(char*spec){
+	list*l;
+	char*f=NULL;
+	if(logger_set_filter(spec)!=0)return -1;
+	if(spec[0]&&!(f=strdup(spec)))ERET(ENOMEM);
+	if(filter)free(filter);
+	filter=f;
+	if((l=list_first(slist)))do{
+		LIST_DATA_DECLARE(sd,l,struct socket_data*);
+		if(sd&&!sd->server)send_filter(sd->fd,spec);
+	}while((l=l->next));
+	return 0;
+}
+
 static int loggerd_read(int fd){
 	if(fd<0)ERET(EINVAL);
 	errno=0;
@@ -193,6 +221,18 @@ static int loggerd_read(int fd){
 			logger_internal_write(&msg.data.log);
 		break;
 
+		// add log item without response
+		case LOG_ADD_ASYNC:
+			logger_internal_write(&msg.data.log);
+		return e;
+
+		// add many log items without response
+		case LOG_ADD_BATCH:
+			logger_internal_write_batch(batch,logger_internal_parse_batch(
+				&msg,batch,LOG_BATCH_MAX
+			));
+		return e;
+
 		// open log file
 		case LOG_OPEN:
 			if(open_log_file(msg.data.string)<0){
@@ -204,18 +244,57 @@ static int loggerd_read(int fd){
 				LEVEL_DEBUG,
 				&file_logger
 			);
+			logger_internal_set_batch(
+				msg.data.string,
+				&file_logger_batch
+			);
+			logger_internal_set_flush(
+				msg.data.string,
+				&file_logger_flush
+			);
+			logger_internal_set(
+				msg.data.string,
+				true
+			);
+		break;
+
+		// open binary log store
+		case LOG_STORE:
+			if(open_log_store(msg.data.string)<0){
+				ret=LOG_FAIL,retdata=errno;
+				break;
+			}
+			logger_internal_add(
+				msg.data.string,
+				LEVEL_DEBUG,
+				&store_logger
+			);
 			logger_internal_set(
 				msg.data.string,
 				true
 			);
 		break;
 
-		// close log file
+		// update per tag levels
+		case LOG_FILTER:
+			if(set_filter(msg.data.string)!=0)
+				ret=LOG_FAIL,retdata=errno;
+		break;
+
+		// close log file, after its queue is written out
 		case LOG_CLOSE:
-			close_log_file(msg.data.string);
 			logger_internal_set(msg.data.string,false);
+			close_log_file(msg.data.string);
+			close_log_store(msg.data.string);
 		break;
 
+		// output queue statistics
+		case LOG_STATS:{
+			char buff[LOG_CONTENT_MAX+1];
+			size_t s=logger_internal_stats(buff,sizeof(buff));
+			logger_internal_send_rec(fd,LOG_STATS,0,"",buff,s,0,0);
+		}break;
+
 		// add new listen
 		case LOG_LISTEN:
 			loggerd_add_listen(msg.data.string);
@@ -240,6 +319,23 @@ static int loggerd_read(int fd){
 				ret=LOG_FAIL,retdata=errno;
 		break;
 
+		// resize log history
+		case LOG_BUFFER:
+			if(logger_buffer_set_size((size_t)msg.data.code)!=0)
+				ret=LOG_FAIL,retdata=errno;
+		break;
+
+		// set file output rotation, "SIZE KEEP [COMPRESSOR]"
+		case LOG_ROTATE:{
+			int keep=0;
+			char comp[32]={0};
+			unsigned long long size=0;
+			if(
+				sscanf(msg.data.string,"%llu %d %31s",&size,&keep,comp)<2||
+				set_log_rotate((size_t)size,keep,comp)!=0
+			)ret=LOG_FAIL,retdata=errno?errno:EINVAL;
+		}break;
+
 		// clean log buffer
 		case LOG_CLEAR:
 			clean_log_buffers();
@@ -264,7 +360,7 @@ static int loggerd_read(int fd){
 				logger_oper2string(msg.oper)
 			);
 	}
-	logger_internal_send_code(fd,ret,retdata);
+	logger_internal_send_reply(fd,&msg,ret,retdata);
 	return e;
 }
 
@@ -272,13 +368,18 @@ static void logger_cleanup(int s __attribute__((unused))){
 	if(clean)return;
 	clean=true;
 	if(slist)list_free_all(slist,_hand_remove_data);
-	close_all_file();
 	logger_internal_clean();
+	close_all_file();
+	close_all_store();
+	if(filter)free(filter);
+	filter=NULL;
 }
 
 static void signal_handler(int s,siginfo_t *info,void*c __attribute__((unused))){
 	if(info->si_pid<=1)return;
-	logger_cleanup(s);
+
+	// dispatchers may hold output locks, clean up from the main loop
+	quit=s;
 }
 
 int loggerd_thread(int fd){
@@ -288,6 +389,7 @@ int loggerd_thread(int fd){
 	struct epoll_event*evs;
 	struct socket_data*sd;
 	logger_internal_add("stderr",LEVEL_DEBUG,&file_logger);
+	logger_internal_set_batch("stderr",&file_logger_batch);
 	logger_internal_add("printk",LEVEL_DEBUG,&printk_logger);
 	logger_internal_set("stderr",true);
 	logger_internal_set("printk",true);
@@ -299,6 +401,9 @@ int loggerd_thread(int fd){
 		getpid()
 	);
 	setproctitle("initloggerd");
+	metrics_serve("loggerd");
+	mem_shrinker_add("logger buffer",MEM_PRIO_BUFFER,logger_buffer_shrink,NULL);
+	mem_monitor_start();
 	prctl(PR_SET_NAME,"Logger Daemon",0,0,0);
 	action_signals(
 		(int[]){SIGINT,SIGHUP,SIGQUIT,SIGTERM},
@@ -314,7 +419,8 @@ int loggerd_thread(int fd){
 	memset(evs,0,es*64);
 	add_fd(fd,false,NULL);
 	while(1){
-		r=epoll_wait(efd,evs,64,-1);
+		r=epoll_wait(efd,evs,64,flush_log_files(false));
+		if(quit)goto ex;
 		if(r==-1){
 			if(errno==EINTR)continue;
 			logger_internal_printf(
@@ -338,6 +444,7 @@ int loggerd_thread(int fd){
 				}
 				fcntl(n,F_SETFL,O_RDWR|O_NONBLOCK);
 				add_fd(n,false,NULL);
+				send_filter(n,filter);
 			}else{
 				int x=loggerd_read(f);
 				if(x==EOF){
@@ -0,0 +1,435 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sys/uio.h>
+#include<sys/stat.h>
+#include"logger_internal.h"
+#include"defines.h"
+
+/*
+ * binary log store, an append-only segment and a sparse index beside it:
+ *
+ *   segment: struct store_header, then struct store_rec records,
+ *            each followed by tag and content and padded to 8 bytes
+ *   index:   struct store_idx for every STORE_STRIDE-th record
+ */
+#define STORE_MAGIC "SILS"
+#define STORE_VERSION 1
+#define STORE_ENDIAN 0x1234
+#define STORE_STRIDE 64
+#define STORE_INDEX_EXT ".idx"
+#define STORE_ALIGN(s) (((s)+7)&~(size_t)7)
+
+struct store_header{
+	char magic[4];
+	uint16_t version;
+	uint16_t endian;
+	uint32_t stride;
+	uint32_t reserved;
+};
+
+struct store_rec{
+	uint32_t size;
+	uint32_t level;
+	int64_t time;
+	int32_t pid;
+	uint16_t tag_len;
+	uint16_t content_len;
+};
+
+struct store_idx{
+	uint64_t rec;
+	uint64_t off;
+	int64_t time;
+};
+
+struct log_store{
+	FILE*seg,*idx;
+	uint64_t count,end;
+	uint64_t pos;
+	enum log_level min_level;
+	char tag[64];
+};
+
+struct open_store{
+	char file[PATH_MAX];
+	int fd,ifd;
+	uint64_t count,off;
+};
+
+static struct open_store*stores[8];
+static pthread_mutex_t stores_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static bool rec_valid(struct store_rec*r){
+	return
+		r->size>=sizeof(struct store_rec)+r->tag_len+r->content_len&&
+		r->size==STORE_ALIGN(r->size)&&
+		r->tag_len<=LOG_TAG_MAX&&
+		r->content_len<=LOG_CONTENT_MAX;
+}
+
+static bool header_valid(struct store_header*h){
+	return
+		memcmp(h->magic,STORE_MAGIC,sizeof(h->magic))==0&&
+		h->version==STORE_VERSION&&
+		h->endian==STORE_ENDIAN&&
+		h->stride==STORE_STRIDE;
+}
+
+static int write_full(int fd,void*data,size_t len){
+	ssize_t r;
+	for(size_t s=0;s<len;s+=(size_t)r)
+		if((r=write(fd,(char*)data+s,len-s))<=0){
+			if(r<0&&errno==EINTR){r=0;continue;}
+			return -1;
+		}
+	return 0;
+}
+
+static int index_add(struct open_store*s,int64_t time){
+	struct store_idx i={.rec=s->count,.off=s->off,.time=time};
+	return write_full(s->ifd,&i,sizeof(i));
+}
+
+// walk an existing segment, drop a torn tail and rebuild the index
+static int store_recover(struct open_store*s){
+	struct stat st;
+	struct store_rec r;
+	struct store_header h;
+	if(fstat(s->fd,&st)<0||ftruncate(s->ifd,0)<0)return -1;
+	if(
+		(size_t)st.st_size<sizeof(h)||
+		pread(s->fd,&h,sizeof(h),0)!=sizeof(h)||
+		!header_valid(&h)
+	){
+		memset(&h,0,sizeof(h));
+		memcpy(h.magic,STORE_MAGIC,sizeof(h.magic));
+		h.version=STORE_VERSION,h.endian=STORE_ENDIAN;
+		h.stride=STORE_STRIDE;
+		if(ftruncate(s->fd,0)<0||pwrite(s->fd,&h,sizeof(h),0)!=sizeof(h))return -1;
+		s->off=sizeof(h),s->count=0;
+		return 0;
+	}
+	s->off=sizeof(h),s->count=0;
+	while(
+		s->off+sizeof(r)<=(uint64_t)st.st_size&&
+		pread(s->fd,&r,sizeof(r),s->off)==sizeof(r)&&
+		rec_valid(&r)&&s->off+r.size<=(uint64_t)st.st_size
+	){
+		if(s->count%STORE_STRIDE==0&&index_add(s,r.time)!=0)return -1;
+		s->off+=r.size,s->count++;
+	}
+	if(s->off!=(uint64_t)st.st_size&&ftruncate(s->fd,s->off)<0)return -1;
+	return 0;
+}
+
+static int open_store_locked(char*path){
+	int i;
+	char ipath[PATH_MAX];
+	struct open_store*s=NULL;
+	if(!path)ERET(EINVAL);
+	for(i=0;i<8;i++)
+		if((s=stores[i])&&strcmp(path,s->file)==0)
+			return s->fd;
+	for(i=0;i<8&&stores[i];i++);
+	if(i>=8)ERET(ENOMEM);
+	if((size_t)snprintf(ipath,sizeof(ipath),"%s"STORE_INDEX_EXT,path)>=sizeof(ipath))
+		ERET(ENAMETOOLONG);
+	if(!(s=malloc(sizeof(struct open_store))))ERET(ENOMEM);
+	memset(s,0,sizeof(struct open_store));
+	strncpy(s->file,path,sizeof(s->file)-1);
+	s->ifd=-1;
+	if((s->fd=open(path,O_RDWR|O_CREAT|O_CLOEXEC,0600))<0)goto fail;
+	if((s->ifd=open(ipath,O_RDWR|O_CREAT|O_CLOEXEC,0600))<0)goto fail;
+	if(store_recover(s)!=0)goto fail;
+	if(lseek(s->fd,s->off,SEEK_SET)<0||lseek(s->ifd,0,SEEK_END)<0)goto fail;
+	stores[i]=s;
+	errno=0;
+	return s->fd;
+	fail:
+	if(s->fd>=0)close(s->fd);
+	if(s->ifd>=0)close(s->ifd);
+	free(s);
+	return -1;
+}
+
+int open_log_store(char*path){
+	int fd;
+	pthread_mutex_lock(&stores_lock);
+	fd=open_store_locked(path);
+	pthread_mutex_unlock(&stores_lock);
+	return fd;
+}
+
+static void close_store(int i){
+	if(!stores[i])return;
+	if(stores[i]->fd>=0)close(stores[i]->fd);
+	if(stores[i]->ifd>=0)close(stores[i]->ifd);
+	free(stores[i]);
+	stores[i]=NULL;
+}
+
+void close_log_store(char*path){
+	pthread_mutex_lock(&stores_lock);
+	for(int i=0;i<8;i++)
+		if(stores[i]&&strcmp(path,stores[i]->file)==0)
+			close_store(i);
+	pthread_mutex_unlock(&stores_lock);
+}
+
+void close_all_store(){
+	pthread_mutex_lock(&stores_lock);
+	for(int i=0;i<8;i++)close_store(i);
+	pthread_mutex_unlock(&stores_lock);
+}
+
+static int store_write(char*name,struct log_item*log){
+	int i;
+	ssize_t r;
+	size_t tl,cl,len;
+	struct store_rec rec;
+	struct open_store*s=NULL;
+	static const char pad[8]={0};
+	if(!log->time)ERET(EFAULT);
+	for(i=0;i<8;i++)if((s=stores[i])&&strcmp(name,s->file)==0)break;
+	if(i>=8)ERET(ENOENT);
+	tl=strnlen(log->tag,LOG_TAG_MAX);
+	cl=strnlen(log->content,LOG_CONTENT_MAX);
+	len=sizeof(rec)+tl+cl;
+	memset(&rec,0,sizeof(rec));
+	rec.size=STORE_ALIGN(len),rec.level=log->level;
+	rec.time=log->time,rec.pid=log->pid;
+	rec.tag_len=tl,rec.content_len=cl;
+	struct iovec iov[4]={
+		{&rec,sizeof(rec)},
+		{log->tag,tl},
+		{log->content,cl},
+		{(void*)pad,rec.size-len},
+	};
+	if(s->count%STORE_STRIDE==0&&index_add(s,rec.time)!=0)return -errno;
+	do{r=writev(s->fd,iov,4);}while(r<0&&errno==EINTR);
+	if(r!=(ssize_t)rec.size){
+		// do not leave a torn record for the readers
+		if(r>0&&ftruncate(s->fd,s->off)==0)lseek(s->fd,s->off,SEEK_SET);
+		return -1;
+	}
+	s->off+=rec.size,s->count++;
+	return (int)rec.size;
+}
+
+int store_logger(char*name,struct log_item*log){
+	int r;
+	pthread_mutex_lock(&stores_lock);
+	r=store_write(name,log);
+	pthread_mutex_unlock(&stores_lock);
+	return r;
+}
+
+struct log_store*log_store_open(const char*path){
+	char ipath[PATH_MAX];
+	struct store_header h;
+	struct log_store*s=NULL;
+	if(!path)EPRET(EINVAL);
+	if((size_t)snprintf(ipath,sizeof(ipath),"%s"STORE_INDEX_EXT,path)>=sizeof(ipath))
+		EPRET(ENAMETOOLONG);
+	if(!(s=malloc(sizeof(struct log_store))))EPRET(ENOMEM);
+	memset(s,0,sizeof(struct log_store));
+	s->min_level=LEVEL_VERBOSE;
+	if(!(s->seg=fopen(path,"re")))goto fail;
+	if(!(s->idx=fopen(ipath,"re")))goto fail;
+	if(fread(&h,sizeof(h),1,s->seg)!=1)goto fail;
+	if(!header_valid(&h)){
+		errno=EINVAL;
+		goto fail;
+	}
+	s->end=sizeof(h),s->pos=0;
+	log_store_count(s);
+	return s;
+	fail:
+	log_store_close(s);
+	return NULL;
+}
+
+void log_store_close(struct log_store*s){
+	if(!s)return;
+	if(s->seg)fclose(s->seg);
+	if(s->idx)fclose(s->idx);
+	free(s);
+}
+
+// read the header of the record at the current offset
+static bool read_rec(struct log_store*s,struct store_rec*r){
+	return fread(r,sizeof(*r),1,s->seg)==1&&rec_valid(r);
+}
+
+size_t log_store_count(struct log_store*s){
+	struct stat st;
+	struct store_rec r;
+	struct store_idx i;
+	off_t size;
+	if(!s||fstat(fileno(s->seg),&st)<0)return 0;
+
+	// start from the last index point past what is already counted
+	if(fseeko(s->idx,0,SEEK_END)==0&&(size=ftello(s->idx))>=(off_t)sizeof(i)){
+		size-=size%sizeof(i);
+		if(
+			fseeko(s->idx,size-sizeof(i),SEEK_SET)==0&&
+			fread(&i,sizeof(i),1,s->idx)==1&&
+			i.rec>=s->count
+		)s->count=i.rec,s->end=i.off;
+	}
+	if(fseeko(s->seg,s->end,SEEK_SET)!=0)return s->count;
+	// a record still being written is not counted yet
+	while(read_rec(s,&r)&&s->end+r.size<=(uint64_t)st.st_size){
+		if(fseeko(s->seg,s->end+r.size,SEEK_SET)!=0)break;
+		s->end+=r.size,s->count++;
+	}
+	clearerr(s->seg);
+	s->pos=s->count;
+	return s->count;
+}
+
+void log_store_filter(struct log_store*s,enum log_level min_level,const char*tag){
+	if(!s)return;
+	s->min_level=min_level;
+	memset(s->tag,0,sizeof(s->tag));
+	if(tag)strncpy(s->tag,tag,sizeof(s->tag)-1);
+}
+
+// position at the index point for record idx and return its record number
+static int seek_index(struct log_store*s,uint64_t n,uint64_t*rec){
+	struct store_idx i;
+	if(n/STORE_STRIDE>0&&(
+		fseeko(s->idx,(off_t)(n/STORE_STRIDE)*sizeof(i),SEEK_SET)!=0||
+		fread(&i,sizeof(i),1,s->idx)!=1
+	))return -1;
+	if(n/STORE_STRIDE==0)i.rec=0,i.off=sizeof(struct store_header);
+	if(fseeko(s->seg,i.off,SEEK_SET)!=0)return -1;
+	*rec=i.rec;
+	return 0;
+}
+
+static int skip_to(struct log_store*s,uint64_t rec,uint64_t n){
+	struct store_rec r;
+	for(;rec<n;rec++)
+		if(!read_rec(s,&r)||fseeko(s->seg,r.size-sizeof(r),SEEK_CUR)!=0)
+			ERET(ERANGE);
+	s->pos=n;
+	return 0;
+}
+
+int log_store_seek(struct log_store*s,size_t n){
+	uint64_t rec;
+	if(!s)ERET(EINVAL);
+	if(n>s->count)ERET(ERANGE);
+	clearerr(s->seg);
+	if(seek_index(s,n,&rec)!=0){
+		// index behind the segment, walk from its last point
+		if(seek_index(s,s->count/STORE_STRIDE*STORE_STRIDE,&rec)!=0)
+			ERET(EIO);
+	}
+	return skip_to(s,rec,n);
+}
+
+int log_store_seek_time(struct log_store*s,time_t time){
+	struct store_idx i;
+	struct store_rec r;
+	uint64_t lo=0,hi,mid,n;
+	off_t size;
+	if(!s)ERET(EINVAL);
+	clearerr(s->seg);
+
+	// binary search the last index point older than time
+	if(fseeko(s->idx,0,SEEK_END)!=0||(size=ftello(s->idx))<0)ERET(EIO);
+	hi=(uint64_t)size/sizeof(i);
+	while(lo+1<hi){
+		mid=(lo+hi)/2;
+		if(
+			fseeko(s->idx,(off_t)mid*sizeof(i),SEEK_SET)!=0||
+			fread(&i,sizeof(i),1,s->idx)!=1
+		)ERET(EIO);
+		if(i.time<(int64_t)time)lo=mid;
+		else hi=mid;
+	}
+	if(seek_index(s,lo*STORE_STRIDE,&n)!=0)ERET(EIO);
+
+	// then walk to the first record not older than time
+	while(n<s->count){
+		off_t off=ftello(s->seg);
+		if(!read_rec(s,&r))break;
+		if(r.time>=(int64_t)time){
+			fseeko(s->seg,off,SEEK_SET);
+			break;
+		}
+		if(fseeko(s->seg,r.size-sizeof(r),SEEK_CUR)!=0)break;
+		n++;
+	}
+	s->pos=n;
+	return 0;
+}
+
+bool log_store_next(struct log_store*s,struct log_item*item){
+	struct store_rec r;
+	if(!s||!item)return false;
+	while(s->pos<s->count&&read_rec(s,&r)){
+		size_t rest=r.size-sizeof(r);
+		s->pos++;
+
+		// skip by header only, tag is read before content when filtering by tag
+		if((enum log_level)r.level<s->min_level){
+			if(fseeko(s->seg,rest,SEEK_CUR)!=0)return false;
+			continue;
+		}
+		if(fread(item->tag,1,r.tag_len,s->seg)!=r.tag_len)return false;
+		item->tag[r.tag_len]=0,rest-=r.tag_len;
+		if(s->tag[0]&&strcmp(s->tag,item->tag)!=0){
+			if(fseeko(s->seg,rest,SEEK_CUR)!=0)return false;
+			continue;
+		}
+		if(fread(item->content,1,r.content_len,s->seg)!=r.content_len)return false;
+		item->content[r.content_len]=0,rest-=r.content_len;
+		if(rest>0&&fseeko(s->seg,rest,SEEK_CUR)!=0)return false;
+		item->level=r.level,item->time=r.time,item->pid=r.pid;
+		return true;
+	}
+	return false;
+}
+
+ssize_t log_store_page(
+	struct log_store*s,size_t page,size_t per_page,
+	log_store_cb*cb,void*data
+){
+	ssize_t cnt=0;
+	struct log_item*item;
+	bool filter;
+	if(!s||!cb||per_page<=0)ERET(EINVAL);
+	filter=s->min_level>LEVEL_VERBOSE||s->tag[0];
+	if(!(item=malloc(sizeof(struct log_item))))ERET(ENOMEM);
+
+	// without a filter a page starts at a known record number
+	if(log_store_seek(s,filter?0:MIN(page*per_page,s->count))!=0){
+		free(item);
+		return -1;
+	}
+	if(filter)for(size_t i=0;i<page*per_page;i++)
+		if(!log_store_next(s,item))break;
+	while((size_t)cnt<per_page&&log_store_next(s,item)){
+		cnt++;
+		if(cb(item,data)!=0)break;
+	}
+	free(item);
+	return cnt;
+}
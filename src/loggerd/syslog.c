@@ -105,10 +105,7 @@ int parse_syslog_item(struct ucred*cred,char*line){
 	// fill log_item
 	memset(b,0,sizeof(struct log_item));
 	b->time=time(NULL),b->pid=cred->pid;
-	if(read_file(
-		b->tag,sizeof(b->tag),false,
-		_PATH_PROC"/%d/comm",b->pid
-	)<0)strcpy(b->tag,"unknown");
+	get_commname(b->pid,b->tag,sizeof(b->tag),false);
 
 	// parse log level
 	int level=KERN_INFO;
@@ -231,19 +231,25 @@ static int aboot_img_size(lua_State*L){
 		lua_pushinteger(L,abootimg_get_##tag(img->img));\
 		return 1;\
 	}
-#define IMPL_PART(tag)\
+#define IMPL_BLOB(tag)\
 	IMPL_GET(tag)\
 	IMPL_SAVE(tag)\
-	IMPL_INTEGER(tag##_size)\
+	IMPL_INTEGER(tag##_size)
+#define IMPL_PART(tag)\
+	IMPL_BLOB(tag)\
 	IMPL_INTEGER(tag##_address)\
 
 IMPL_PART(kernel)
 IMPL_PART(ramdisk)
 IMPL_PART(second)
+IMPL_PART(dtb)
+IMPL_BLOB(recovery_dtbo)
+IMPL_BLOB(bootconfig)
 IMPL_STRING(name)
 IMPL_STRING(cmdline)
 IMPL_INTEGER(page_size)
 IMPL_INTEGER(tags_address)
+IMPL_INTEGER(header_version)
 
 static int abootimg_to_string(lua_State*L){
 	GET_ABOOTIMG(L,1,img);
@@ -328,10 +334,12 @@ static const luaL_Reg aboot_img_lib[]={
 	{"load_"#tag, aboot_img_load_##tag},\
 	{"save_"#tag, aboot_img_save_##tag},\
 	{"get_"#tag,  aboot_img_get_##tag},
-#define DECL_PART(tag)\
+#define DECL_BLOB(tag)\
 	DECL_GETSET(tag##_size)\
-	DECL_GETSET(tag##_address)\
 	DECL_CONT(tag)
+#define DECL_PART(tag)\
+	DECL_BLOB(tag)\
+	DECL_GETSET(tag##_address)
 static luaL_Reg abootimg_meta[]={
 	{"save",     aboot_img_save},
 	{"size",     aboot_img_size},
@@ -340,9 +348,13 @@ static luaL_Reg abootimg_meta[]={
 	DECL_GETSET(cmdline)
 	DECL_GETSET(page_size)
 	DECL_GETSET(tags_address)
+	DECL_GETSET(header_version)
 	DECL_PART(kernel)
 	DECL_PART(ramdisk)
 	DECL_PART(second)
+	DECL_PART(dtb)
+	DECL_BLOB(recovery_dtbo)
+	DECL_BLOB(bootconfig)
 	{NULL,NULL}
 };
 
@@ -8,11 +8,15 @@
 
 #ifdef ENABLE_LUA
 #include<errno.h>
+#include<stdio.h>
 #include<string.h>
 #include<stdlib.h>
 #include"xlua.h"
 #include"confd.h"
 
+#define WATCHERS "conf.watchers"
+#define TREE_DEPTH 64
+
 #define GET_KEY(n) \
         errno=0;\
 	const char*key=luaL_checkstring(L,n);\
@@ -307,6 +311,259 @@ static int conf_get(lua_State*L){
 	return errno!=0?luaL_error(L,"operation failed (%s)",strerror(errno)):1;
 }
 
+/**
+ * get many config items in one request
+ *
+ * @param table config paths list
+ * @return table config path to value map (missing items are absent)
+ */
+static int conf_get_many(lua_State*L){
+	errno=0;
+	luaL_checktype(L,1,LUA_TTABLE);
+	size_t cnt=lua_rawlen(L,1);
+	struct confd_item*items;
+	lua_createtable(L,0,cnt);
+	if(cnt<=0)return 1;
+	if(!(items=malloc(sizeof(struct confd_item)*cnt)))
+		return luaL_error(L,"operation failed (%s)",strerror(ENOMEM));
+	memset(items,0,sizeof(struct confd_item)*cnt);
+	for(size_t i=0;i<cnt;i++){
+		lua_rawgeti(L,1,i+1);
+		items[i].path=lua_tostring(L,-1);
+		lua_pop(L,1);
+		if(!items[i].path||!*items[i].path){
+			free(items);
+			return luaL_error(L,"invalid conf key");
+		}
+	}
+	if(confd_get_many(items,cnt)!=0){
+		free(items);
+		return luaL_error(L,"operation failed (%s)",strerror(errno));
+	}
+	for(size_t i=0;i<cnt;i++){
+		if(items[i].code!=0)continue;
+		switch(items[i].type){
+			case TYPE_STRING:
+				lua_pushstring(L,items[i].value.string);
+				free(items[i].value.string);
+			break;
+			case TYPE_INTEGER:lua_pushinteger(L,(lua_Integer)items[i].value.integer);break;
+			case TYPE_BOOLEAN:lua_pushboolean(L,items[i].value.boolean);break;
+			default:continue;
+		}
+		lua_setfield(L,-2,items[i].path);
+	}
+	free(items);
+	errno=0;
+	return 1;
+}
+
+/**
+ * set many config items in one request
+ *
+ * @param table config path to string/integer/boolean value map
+ * @return boolean all items set
+ */
+static int conf_set_many(lua_State*L){
+	errno=0;
+	bool ok=true;
+	size_t cnt=0,i=0;
+	struct confd_item*items;
+	luaL_checktype(L,1,LUA_TTABLE);
+	lua_pushnil(L);
+	while(lua_next(L,1)!=0)cnt++,lua_pop(L,1);
+	if(cnt<=0){
+		lua_pushboolean(L,true);
+		return 1;
+	}
+	if(!(items=malloc(sizeof(struct confd_item)*cnt)))
+		return luaL_error(L,"operation failed (%s)",strerror(ENOMEM));
+	memset(items,0,sizeof(struct confd_item)*cnt);
+	lua_pushnil(L);
+	while(lua_next(L,1)!=0){
+		struct confd_item*it=&items[i++];
+		if(lua_type(L,-2)!=LUA_TSTRING){
+			free(items);
+			return luaL_error(L,"invalid conf key");
+		}
+		it->path=lua_tostring(L,-2);
+		switch(lua_type(L,-1)){
+			case LUA_TSTRING:
+				it->type=TYPE_STRING;
+				it->value.string=(char*)lua_tostring(L,-1);
+			break;
+			case LUA_TNUMBER:
+				it->type=TYPE_INTEGER;
+				it->value.integer=(int64_t)lua_tointeger(L,-1);
+			break;
+			case LUA_TBOOLEAN:
+				it->type=TYPE_BOOLEAN;
+				it->value.boolean=lua_toboolean(L,-1)!=0;
+			break;
+			default:
+				free(items);
+				return luaL_error(L,"invalid data type");
+		}
+		lua_pop(L,1);
+	}
+	if(confd_set_many(items,cnt)!=0){
+		free(items);
+		return luaL_error(L,"operation failed (%s)",strerror(errno));
+	}
+	for(i=0;i<cnt;i++)if(items[i].code!=0)ok=false;
+	free(items);
+	lua_pushboolean(L,ok);
+	errno=0;
+	return 1;
+}
+
+static void push_value(lua_State*L,struct confd_item*it){
+	switch(it->type){
+		case TYPE_KEY:lua_newtable(L);break;
+		case TYPE_STRING:lua_pushstring(L,it->value.string);break;
+		case TYPE_INTEGER:lua_pushinteger(L,(lua_Integer)it->value.integer);break;
+		case TYPE_BOOLEAN:lua_pushboolean(L,it->value.boolean);break;
+		default:lua_pushnil(L);
+	}
+}
+
+/**
+ * get a config item and all children in one request
+ *
+ * @param string config path (default all items)
+ * @return table/string/integer/boolean nested table of a key or value of an item
+ */
+static int conf_get_tree(lua_State*L){
+	errno=0;
+	int root;
+	size_t cnt=0;
+	const char*p,*s;
+	struct confd_item*items;
+	const char*key=luaL_optstring(L,1,"");
+	if(!(items=confd_get_tree(key,&cnt))){
+		if(errno!=ENOENT)return luaL_error(L,"operation failed (%s)",strerror(errno));
+		lua_pushnil(L);
+		return 1;
+	}
+	push_value(L,&items[0]);
+	root=lua_gettop(L);
+	if(items[0].type==TYPE_KEY)for(size_t i=1;i<cnt;i++){
+		lua_pushvalue(L,root);
+		for(p=items[i].path;(s=strchr(p,'.'));p=s+1){
+			lua_pushlstring(L,p,s-p);
+			if(lua_rawget(L,-2)!=LUA_TTABLE){
+				lua_pop(L,1);
+				lua_newtable(L);
+				lua_pushlstring(L,p,s-p);
+				lua_pushvalue(L,-2);
+				lua_rawset(L,-4);
+			}
+			lua_remove(L,-2);
+		}
+		push_value(L,&items[i]);
+		lua_setfield(L,-2,p);
+		lua_pop(L,1);
+	}
+	free(items);
+	errno=0;
+	return 1;
+}
+
+struct tree_set{
+	struct confd_item*items;
+	size_t cnt,size;
+};
+
+static int tree_collect(lua_State*L,struct tree_set*t,const char*base,int idx,int depth){
+	int r=0;
+	char num[32],*path;
+	const char*name;
+	size_t len;
+	struct confd_item*it;
+	if(depth>TREE_DEPTH)return ELOOP;
+	luaL_checkstack(L,3,"config tree too deep");
+	lua_pushnil(L);
+	while(r==0&&lua_next(L,idx)!=0){
+		if(lua_type(L,-2)==LUA_TSTRING)name=lua_tostring(L,-2);
+		else if(lua_isinteger(L,-2)){
+			snprintf(num,sizeof(num),"%lld",(long long)lua_tointeger(L,-2));
+			name=num;
+		}else r=EINVAL;
+		if(r==0&&(!*name||strchr(name,'.')))r=EINVAL;
+		if(r!=0)break;
+		len=strlen(base)+strlen(name)+2;
+		if(!(path=malloc(len))){
+			r=ENOMEM;
+			break;
+		}
+		snprintf(path,len,"%s%s%s",base,*base?".":"",name);
+		if(lua_type(L,-1)==LUA_TTABLE){
+			r=tree_collect(L,t,path,lua_gettop(L),depth+1);
+			free(path);
+			lua_pop(L,1);
+			continue;
+		}
+		if(t->cnt>=t->size){
+			size_t n=t->size?t->size*2:64;
+			if(!(it=realloc(t->items,sizeof(struct confd_item)*n))){
+				free(path);
+				r=ENOMEM;
+				break;
+			}
+			t->items=it,t->size=n;
+		}
+		it=&t->items[t->cnt++];
+		memset(it,0,sizeof(struct confd_item));
+		it->path=path;
+		switch(lua_type(L,-1)){
+			case LUA_TSTRING:
+				it->type=TYPE_STRING;
+				it->value.string=(char*)lua_tostring(L,-1);
+			break;
+			case LUA_TNUMBER:
+				it->type=TYPE_INTEGER;
+				it->value.integer=(int64_t)lua_tointeger(L,-1);
+			break;
+			case LUA_TBOOLEAN:
+				it->type=TYPE_BOOLEAN;
+				it->value.boolean=lua_toboolean(L,-1)!=0;
+			break;
+			default:r=EINVAL;
+		}
+		lua_pop(L,1);
+	}
+	if(r!=0)lua_settop(L,idx);
+	return r;
+}
+
+/**
+ * set a nested table of values under a config path in one request
+ *
+ * @param string config path (default all items)
+ * @param table nested table of string/integer/boolean values
+ * @return boolean all items set
+ */
+static int conf_set_tree(lua_State*L){
+	errno=0;
+	bool ok=true;
+	int r;
+	struct tree_set t={NULL,0,0};
+	const char*key=luaL_optstring(L,1,"");
+	luaL_checktype(L,2,LUA_TTABLE);
+	lua_settop(L,2);
+	if((r=tree_collect(L,&t,key,2,0))==0&&t.cnt>0){
+		if(confd_set_many(t.items,t.cnt)!=0)r=errno?errno:EIO;
+		else for(size_t i=0;i<t.cnt;i++)if(t.items[i].code!=0)ok=false;
+	}
+	for(size_t i=0;i<t.cnt;i++)free((char*)t.items[i].path);
+	if(t.items)free(t.items);
+	if(r==EINVAL)return luaL_error(L,"invalid conf key or data type");
+	if(r!=0)return luaL_error(L,"operation failed (%s)",strerror(r));
+	lua_pushboolean(L,ok);
+	errno=0;
+	return 1;
+}
+
 /**
  * call confd dump config store
  *
@@ -427,6 +684,106 @@ static int conf_get_save(lua_State*L){
 	return errno!=0?luaL_error(L,"operation failed (%s)",strerror(errno)):1;
 }
 
+// callbacks of watch handles, keyed by handle
+static void push_watchers(lua_State*L){
+	if(lua_getfield(L,LUA_REGISTRYINDEX,WATCHERS)==LUA_TTABLE)return;
+	lua_pop(L,1);
+	lua_newtable(L);
+	lua_pushvalue(L,-1);
+	lua_setfield(L,LUA_REGISTRYINDEX,WATCHERS);
+}
+
+static void push_type(lua_State*L,enum conf_type type){
+	switch(type){
+		case TYPE_KEY:lua_pushstring(L,"key");break;
+		case TYPE_STRING:lua_pushstring(L,"string");break;
+		case TYPE_INTEGER:lua_pushstring(L,"integer");break;
+		case TYPE_BOOLEAN:lua_pushstring(L,"boolean");break;
+		default:lua_pushnil(L);
+	}
+}
+
+/**
+ * open a watch handle receiving changes under a prefix
+ *
+ * @param string config path prefix (default all items)
+ * @param function called with path and type for every change in wait (optional)
+ * @return integer watch handle
+ */
+static int conf_watch(lua_State*L){
+	errno=0;
+	const char*prefix=luaL_optstring(L,1,"");
+	if(!lua_isnoneornil(L,2))luaL_checktype(L,2,LUA_TFUNCTION);
+	int fd=confd_watch_open(prefix);
+	if(fd<0)return luaL_error(L,"operation failed (%s)",strerror(errno));
+	if(!lua_isnoneornil(L,2)){
+		push_watchers(L);
+		lua_pushvalue(L,2);
+		lua_rawseti(L,-2,fd);
+		lua_pop(L,1);
+	}
+	lua_pushinteger(L,fd);
+	return 1;
+}
+
+/**
+ * wait for a change from a watch handle
+ *
+ * @param integer watch handle
+ * @param integer timeout in milliseconds (default wait forever)
+ * @return string changed config path or nil on timeout
+ * @return string new item type or nil when item removed
+ * @return integer changes passed to the callback of a handle that has one
+ */
+static int conf_watch_wait(lua_State*L){
+	errno=0;
+	enum conf_type type=0;
+	char path[PATH_MAX];
+	int fd=(int)luaL_checkinteger(L,1);
+	int timeout=(int)luaL_optinteger(L,2,-1);
+	lua_Integer cnt=0;
+	int r;
+	push_watchers(L);
+	if(lua_rawgeti(L,-1,fd)==LUA_TFUNCTION){
+
+		// a handle with a callback gets all queued changes dispatched
+		while((r=confd_watch_read(fd,path,sizeof(path),&type,cnt>0?0:timeout))>0){
+			lua_pushvalue(L,-1);
+			lua_pushstring(L,path);
+			push_type(L,type);
+			lua_call(L,2,0);
+			cnt++;
+		}
+		if(r<0)return luaL_error(L,"operation failed (%s)",strerror(errno));
+		lua_pushinteger(L,cnt);
+		return 1;
+	}
+	r=confd_watch_read(fd,path,sizeof(path),&type,timeout);
+	if(r<0)return luaL_error(L,"operation failed (%s)",strerror(errno));
+	if(r==0){
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushstring(L,path);
+	push_type(L,type);
+	return 2;
+}
+
+/**
+ * close a watch handle
+ *
+ * @param integer watch handle
+ */
+static int conf_unwatch(lua_State*L){
+	int fd=(int)luaL_checkinteger(L,1);
+	push_watchers(L);
+	lua_pushnil(L);
+	lua_rawseti(L,-2,fd);
+	lua_pop(L,1);
+	confd_watch_close(fd);
+	return 0;
+}
+
 static const luaL_Reg conf_lib[]={
 	{"count",        conf_count},
 	{"exists",       conf_exists},
@@ -439,6 +796,8 @@ static const luaL_Reg conf_lib[]={
 	{"is_boolean",   conf_is_boolean},
 	{"type",         conf_get_type},
 	{"get",          conf_get},
+	{"get_many",     conf_get_many},
+	{"get_tree",     conf_get_tree},
 	{"get_own",      conf_get_own},
 	{"get_owner",    conf_get_own},
 	{"get_grp",      conf_get_grp},
@@ -454,6 +813,8 @@ static const luaL_Reg conf_lib[]={
 	{"get_bool",     conf_get_boolean},
 	{"get_boolean",  conf_get_boolean},
 	{"set",          conf_set},
+	{"set_many",     conf_set_many},
+	{"set_tree",     conf_set_tree},
 	{"chown",        conf_set_own},
 	{"chowner",      conf_set_own},
 	{"set_own",      conf_set_own},
@@ -489,6 +850,9 @@ static const luaL_Reg conf_lib[]={
 	{"purge",        conf_delete},
 	{"dump",         conf_dump},
 	{"list",         conf_list},
+	{"watch",        conf_watch},
+	{"wait",         conf_watch_wait},
+	{"unwatch",      conf_unwatch},
 	{"ls",           conf_list},
 	{NULL, NULL}
 };
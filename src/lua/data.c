@@ -17,8 +17,40 @@
 #define alloc_data(data,size) malloc(size)
 #endif
 
+/*
+ * buffers go between modules as data objects, a pointer and a length
+ * that either own their memory (allocated) or are a view of a parent.
+ * producers hand theirs over with lua_data_to_lua, consumers read with
+ * lua_arg_get_data, and a producer that gets a data object to fill
+ * writes into it in place (lua_arg_get_data_dst), so an image does not
+ * pass through lua strings. memory owned by data objects is counted for
+ * data.usage().
+ */
 #define OPT_DATA(L,n,var) OPT_UDATA(L,n,var,lua_data,LUA_DATA)
 #define GET_DATA(L,n,var) OPT_DATA(L,n,var);CHECK_NULL(L,n,var)
+
+static size_t mem_bytes=0,mem_count=0,mem_peak=0;
+
+// data objects can live in the states of several threads
+static void count_data(struct lua_data*data,size_t size){
+	size_t now;
+	if(data->counted>0){
+		__atomic_fetch_sub(&mem_bytes,data->counted,__ATOMIC_RELAXED);
+		__atomic_fetch_sub(&mem_count,1,__ATOMIC_RELAXED);
+	}
+	if((data->counted=size)<=0)return;
+	now=__atomic_add_fetch(&mem_bytes,size,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&mem_count,1,__ATOMIC_RELAXED);
+	if(now>__atomic_load_n(&mem_peak,__ATOMIC_RELAXED))
+		__atomic_store_n(&mem_peak,now,__ATOMIC_RELAXED);
+}
+
+void lua_data_usage(size_t*bytes,size_t*count,size_t*peak){
+	if(bytes)*bytes=__atomic_load_n(&mem_bytes,__ATOMIC_RELAXED);
+	if(count)*count=__atomic_load_n(&mem_count,__ATOMIC_RELAXED);
+	if(peak)*peak=__atomic_load_n(&mem_peak,__ATOMIC_RELAXED);
+}
+
 static void clean_parent(struct lua_data*data){
 	if(!data->parent)return;
 	list_obj_del_data(&data->parent->refs,data,NULL);
@@ -32,6 +64,7 @@ static bool convert_allocated(struct lua_data*data){
 	if(!ptr)return false;
 	memcpy(ptr,data->data,data->size);
 	data->data=ptr,data->allocated=true;
+	count_data(data,data->size);
 	clean_parent(data);
 	return true;
 }
@@ -51,6 +84,7 @@ static void clean_data(struct lua_data*data){
 	if(data->allocated)free_data(data);
 	clean_parent(data);
 	clean_refs(data);
+	count_data(data,0);
 	data->allocated=false;
 	data->data=NULL,data->size=0;
 }
@@ -79,6 +113,7 @@ static bool resize_data(struct lua_data*data,size_t size){
 		memcpy(ptr,data->data,MIN(size,data->size));
 		if(data->allocated)free_data(data);
 		data->data=ptr,data->allocated=true;
+		count_data(data,size);
 		clean_parent(data);
 	}
 	data->size=size;
@@ -149,6 +184,7 @@ static int lua_data_from_string(lua_State*L){
 	memset(data->data,0,data->size+1);
 	memcpy(data->data,str,data->size);
 	data->allocated=true;
+	count_data(data,data->size+1);
 	done:
 	lua_pushboolean(L,data->allocated);
 	return 1;
@@ -318,6 +354,7 @@ void lua_data_to_lua(lua_State*L,bool allocated,void*data,size_t size){
 	e->allocated=allocated;
 	e->data=data;
 	e->size=size;
+	if(allocated)count_data(e,size);
 }
 
 void lua_data_dup_to_lua(lua_State*L,void*data,size_t size){
@@ -330,6 +367,7 @@ void lua_data_dup_to_lua(lua_State*L,void*data,size_t size){
 	memcpy(e->data,data,size);
 	e->allocated=true;
 	e->size=size;
+	count_data(e,size);
 }
 
 #ifdef ENABLE_UEFI
@@ -343,6 +381,7 @@ void uefi_data_to_lua(lua_State*L,BOOLEAN allocated,VOID*data,UINTN size){
 	e->data=data;
 	e->size=(size_t)size;
 	e->uefi=true;
+	if(allocated)count_data(e,e->size);
 }
 
 void uefi_data_dup_to_lua(lua_State*L,VOID*data,UINTN size){
@@ -355,6 +394,7 @@ void uefi_data_dup_to_lua(lua_State*L,VOID*data,UINTN size){
 	e->allocated=true;
 	e->size=(size_t)size;
 	e->uefi=true;
+	count_data(e,e->size);
 }
 #endif
 
@@ -388,6 +428,17 @@ void lua_arg_get_data(lua_State*L,int idx,bool nil,void**data,size_t*size){
 	}
 }
 
+void*lua_arg_get_data_dst(lua_State*L,int idx,size_t size){
+	struct lua_data*data;
+	if(lua_isnoneornil(L,idx))return NULL;
+	data=luaL_checkudata(L,idx,LUA_DATA);
+	if(!data->data||data->size<size){
+		if(!data->allocated||!resize_data(data,size))
+			luaL_argerror(L,idx,"data too small");
+	}
+	return data->data;
+}
+
 static luaL_Reg data_meta[]={
 	{"ToString",          lua_data_to_raw_string},
 	{"to_string",         lua_data_to_raw_string},
@@ -469,6 +520,15 @@ static int lua_data_new_from_string(lua_State*L){
 	return 1;
 }
 
+static int lua_data_lib_usage(lua_State*L){
+	size_t bytes=0,count=0,peak=0;
+	lua_data_usage(&bytes,&count,&peak);
+	lua_pushinteger(L,(lua_Integer)bytes);
+	lua_pushinteger(L,(lua_Integer)count);
+	lua_pushinteger(L,(lua_Integer)peak);
+	return 3;
+}
+
 static luaL_Reg data_lib[]={
 	{"new",          lua_data_new},
 	{"New",          lua_data_new},
@@ -478,6 +538,7 @@ static luaL_Reg data_lib[]={
 	{"FromStr",      lua_data_new_from_string},
 	{"from_str",     lua_data_new_from_string},
 	{"from_string",  lua_data_new_from_string},
+	{"usage",        lua_data_lib_usage},
 	{NULL, NULL}
 };
 
@@ -9,6 +9,8 @@
 #ifndef _LUA_FDISK_H
 #define _LUA_FDISK_H
 #include<ctype.h>
+#include<errno.h>
+#include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
 #include<sys/sysmacros.h>
@@ -63,4 +65,6 @@ extern void lua_fdisk_script_to_lua(lua_State*L,bool allocated,struct fdisk_cont
 extern void lua_fdisk_table_to_lua(lua_State*L,bool allocated,struct fdisk_table*data);
 extern void lua_fdisk_labelitem_to_lua(lua_State*L,bool allocated,struct fdisk_labelitem*data);
 extern void lua_fdisk_iter_to_lua(lua_State*L,struct fdisk_iter*data);
+extern void lua_fdisk_partition_push_table(lua_State*L,struct fdisk_partition*pa);
+extern int lua_fdisk_script_load_string(struct fdisk_script*script,const char*buf,size_t len);
 #endif
@@ -722,7 +722,7 @@ static int lua_fdisk_get_partitions(lua_State*L){
 	struct lua_fdisk_table*td=NULL;
 	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
-	if(!lua_isnoneornil(L,2))td=luaL_checkudata(L,2,LUA_FDISK_PARTITION);
+	if(!lua_isnoneornil(L,2))td=luaL_checkudata(L,2,LUA_FDISK_TABLE);
 	if(td&&!td->data)return luaL_argerror(L,2,"invalid table");
 	if(td)table=td->data;
 	int ret=fdisk_get_partitions(data->data,&table);
@@ -740,7 +740,7 @@ static int lua_fdisk_get_freespaces(lua_State*L){
 	struct lua_fdisk_table*td=NULL;
 	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
-	if(!lua_isnoneornil(L,2))td=luaL_checkudata(L,2,LUA_FDISK_PARTITION);
+	if(!lua_isnoneornil(L,2))td=luaL_checkudata(L,2,LUA_FDISK_TABLE);
 	if(td&&!td->data)return luaL_argerror(L,2,"invalid table");
 	if(td)table=td->data;
 	int ret=fdisk_get_freespaces(data->data,&table);
@@ -755,7 +755,7 @@ static int lua_fdisk_get_freespaces(lua_State*L){
 static int lua_fdisk_apply_table(lua_State*L){
 	LUA_ARG_MAX(2);
 	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
-	struct lua_fdisk_table*table=luaL_checkudata(L,2,LUA_FDISK_PARTITION);
+	struct lua_fdisk_table*table=luaL_checkudata(L,2,LUA_FDISK_TABLE);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
 	if(!table||!table->data)return luaL_argerror(L,2,"invalid table");
 	int ret=fdisk_apply_table(data->data,table->data);
@@ -876,7 +876,7 @@ static int lua_fdisk_reread_partition_table(lua_State*L){
 static int lua_fdisk_reread_changes(lua_State*L){
 	LUA_ARG_MAX(2);
 	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
-	struct lua_fdisk_table*table=luaL_checkudata(L,2,LUA_FDISK_PARTITION);
+	struct lua_fdisk_table*table=luaL_checkudata(L,2,LUA_FDISK_TABLE);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
 	if(!table||!table->data)return luaL_argerror(L,2,"invalid table");
 	int ret=fdisk_reread_changes(data->data,table->data);
@@ -940,18 +940,74 @@ static int lua_fdisk_apply_script_headers(lua_State*L){
 	return 1;
 }
 
+/*
+ * a string is a whole sfdisk script, it is read and applied in one call
+ * without a script object or a file in between.
+ */
 static int lua_fdisk_apply_script(lua_State*L){
 	LUA_ARG_MAX(2);
-	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
-	struct lua_fdisk_script*script=luaL_checkudata(L,2,LUA_FDISK_SCRIPT);
-	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
-	if(!script||!script->data)return luaL_argerror(L,2,"invalid script");
-	int ret=fdisk_apply_script(data->data,script->data);
+	int ret;
+	size_t len=0;
+	const char*buf;
+	struct fdisk_script*sc;
+	struct lua_fdisk_script*script;
+	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
+	if(lua_type(L,2)==LUA_TSTRING){
+		buf=lua_tolstring(L,2,&len);
+		if(!(sc=fdisk_new_script(data->data)))
+			return luaL_error(L,"allocate script failed");
+		if((ret=lua_fdisk_script_load_string(sc,buf,len))>=0)
+			ret=fdisk_apply_script(data->data,sc);
+		fdisk_unref_script(sc);
+	}else{
+		script=luaL_checkudata(L,2,LUA_FDISK_SCRIPT);
+		if(!script||!script->data)return luaL_argerror(L,2,"invalid script");
+		ret=fdisk_apply_script(data->data,script->data);
+	}
 	if(lua_fdisk_check_error(L,ret))return 0;
 	lua_pushinteger(L,ret);
 	return 1;
 }
 
+static int lua_fdisk_new_script_from_string(lua_State*L){
+	LUA_ARG_MAX(2);
+	size_t len=0;
+	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
+	const char*buf=luaL_checklstring(L,2,&len);
+	struct fdisk_script*script=fdisk_new_script(data->data);
+	if(!script)return luaL_error(L,"allocate script failed");
+	int ret=lua_fdisk_script_load_string(script,buf,len);
+	if(ret<0){
+		fdisk_unref_script(script);
+		if(lua_fdisk_check_error(L,ret))return 0;
+		lua_pushnil(L);
+	}else lua_fdisk_script_to_lua(L,true,data->data,script);
+	return 1;
+}
+
+// all partitions as plain tables, table:to_list() without the table object
+static int lua_fdisk_list_partitions(lua_State*L){
+	LUA_ARG_MAX(1);
+	int i=0;
+	size_t n;
+	struct fdisk_partition*part=NULL;
+	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid context");
+	if(!fdisk_has_label(data->data))return luaL_error(L,"no partition table");
+	n=fdisk_get_npartitions(data->data);
+	lua_createtable(L,0,0);
+	for(size_t no=0;no<n;no++){
+		if(!fdisk_is_partition_used(data->data,no))continue;
+		if(fdisk_get_partition(data->data,no,&part)!=0)continue;
+		lua_fdisk_partition_push_table(L,part);
+		lua_rawseti(L,-2,++i);
+	}
+	fdisk_unref_partition(part);
+	return 1;
+}
+
 static int lua_fdisk_dos_fix_chs(lua_State*L){
 	LUA_ARG_MAX(1);
 	struct lua_fdisk_context*data=luaL_checkudata(L,1,LUA_FDISK_CONTEXT);
@@ -1104,6 +1160,7 @@ struct lua_fdisk_meta_table lua_fdisk_context={
 		{"reorder_partitions",           lua_fdisk_reorder_partitions},
 		{"partition_has_wipe",           lua_fdisk_partition_has_wipe},
 		{"get_partitions",               lua_fdisk_get_partitions},
+		{"list_partitions",              lua_fdisk_list_partitions},
 		{"get_freespaces",               lua_fdisk_get_freespaces},
 		{"apply_table",                  lua_fdisk_apply_table},
 		{"align_lba",                    lua_fdisk_align_lba},
@@ -1120,6 +1177,7 @@ struct lua_fdisk_meta_table lua_fdisk_context={
 		{"reread_changes",               lua_fdisk_reread_changes},
 		{"new_script",                   lua_fdisk_new_script},
 		{"new_script_from_file",         lua_fdisk_new_script_from_file},
+		{"new_script_from_string",       lua_fdisk_new_script_from_string},
 		{"set_script",                   lua_fdisk_set_script},
 		{"get_script",                   lua_fdisk_get_script},
 		{"apply_script_headers",         lua_fdisk_apply_script_headers},
@@ -35,10 +35,13 @@ static int lua_fdisk_label_get_nparttypes(lua_State*L){
 }
 
 static int lua_fdisk_label_get_parttype(lua_State*L){
-	LUA_ARG_MAX(1);
+	LUA_ARG_MAX(2);
+	struct fdisk_parttype*parttype;
 	struct lua_fdisk_label*data=luaL_checkudata(L,1,LUA_FDISK_LABEL);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid label");
-	lua_pushinteger(L,fdisk_label_get_nparttypes(data->data));
+	parttype=fdisk_label_get_parttype(data->data,luaL_checkinteger(L,2));
+	if(!parttype)lua_pushnil(L);
+	else lua_fdisk_parttype_to_lua(L,false,parttype);
 	return 1;
 }
 
@@ -74,15 +77,49 @@ static int lua_fdisk_label_has_parttypes_shortcuts(lua_State*L){
 	return 1;
 }
 
+/*
+ * the types a label knows are static in libfdisk, a lookup by code or by
+ * string scans all of them (a gpt label has some hundreds). found types
+ * are kept in the registry per label name and key, so repeated lookups
+ * return the same object without scanning again. misses are not kept.
+ */
+static void parttype_cache(lua_State*L,struct fdisk_label*lb){
+	const char*name=fdisk_label_get_name(lb);
+	luaL_getsubtable(L,LUA_REGISTRYINDEX,"fdisk.parttypes");
+	luaL_getsubtable(L,-1,name?name:"");
+	lua_remove(L,-2);
+}
+
+static bool parttype_cache_get(lua_State*L,struct fdisk_label*lb,int key){
+	parttype_cache(L,lb);
+	lua_pushvalue(L,key);
+	if(lua_rawget(L,-2)==LUA_TNIL){
+		lua_pop(L,2);
+		return false;
+	}
+	lua_remove(L,-2);
+	return true;
+}
+
+static void parttype_cache_put(lua_State*L,struct fdisk_label*lb,int key,struct fdisk_parttype*type){
+	lua_fdisk_parttype_to_lua(L,false,type);
+	parttype_cache(L,lb);
+	lua_pushvalue(L,key);
+	lua_pushvalue(L,-3);
+	lua_rawset(L,-3);
+	lua_pop(L,1);
+}
+
 static int lua_fdisk_label_get_parttype_from_code(lua_State*L){
 	LUA_ARG_MAX(2);
 	struct fdisk_parttype*parttype;
 	struct lua_fdisk_label*data=luaL_checkudata(L,1,LUA_FDISK_LABEL);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid label");
 	unsigned int code=luaL_checkinteger(L,2);
+	if(parttype_cache_get(L,data->data,2))return 1;
 	parttype=fdisk_label_get_parttype_from_code(data->data,code);
 	if(!parttype)lua_pushnil(L);
-	else lua_fdisk_parttype_to_lua(L,false,parttype);
+	else parttype_cache_put(L,data->data,2,parttype);
 	return 1;
 }
 
@@ -92,9 +129,10 @@ static int lua_fdisk_label_get_parttype_from_string(lua_State*L){
 	struct lua_fdisk_label*data=luaL_checkudata(L,1,LUA_FDISK_LABEL);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid label");
 	const char*string=luaL_checkstring(L,2);
+	if(parttype_cache_get(L,data->data,2))return 1;
 	parttype=fdisk_label_get_parttype_from_string(data->data,string);
 	if(!parttype)lua_pushnil(L);
-	else lua_fdisk_parttype_to_lua(L,false,parttype);
+	else parttype_cache_put(L,data->data,2,parttype);
 	return 1;
 }
 
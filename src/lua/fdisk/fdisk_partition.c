@@ -368,6 +368,121 @@ static int lua_fdisk_partition_next_partno(lua_State*L){
 	return 2;
 }
 
+/*
+ * a whole partition as one plain table, so a script that looks at many
+ * partitions does not make a call and a userdata for every field.
+ * fields that are not set are left out.
+ */
+static void set_int(lua_State*L,const char*key,lua_Integer val){
+	lua_pushinteger(L,val);
+	lua_setfield(L,-2,key);
+}
+
+static void set_str(lua_State*L,const char*key,const char*val){
+	if(!val)return;
+	lua_pushstring(L,val);
+	lua_setfield(L,-2,key);
+}
+
+static void set_bool(lua_State*L,const char*key,bool val){
+	lua_pushboolean(L,val);
+	lua_setfield(L,-2,key);
+}
+
+void lua_fdisk_partition_push_table(lua_State*L,struct fdisk_partition*pa){
+	size_t parent=0;
+	struct fdisk_parttype*type;
+	lua_createtable(L,0,16);
+	if(fdisk_partition_has_partno(pa))
+		set_int(L,"partno",fdisk_partition_get_partno(pa));
+	if(fdisk_partition_has_start(pa))
+		set_int(L,"start",fdisk_partition_get_start(pa));
+	if(fdisk_partition_has_size(pa))
+		set_int(L,"size",fdisk_partition_get_size(pa));
+	if(fdisk_partition_has_end(pa))
+		set_int(L,"end",fdisk_partition_get_end(pa));
+	if(fdisk_partition_get_parent(pa,&parent)==0&&fdisk_partition_is_nested(pa))
+		set_int(L,"parent",parent);
+	set_str(L,"name",fdisk_partition_get_name(pa));
+	set_str(L,"uuid",fdisk_partition_get_uuid(pa));
+	set_str(L,"attrs",fdisk_partition_get_attrs(pa));
+	if((type=fdisk_partition_get_type(pa))){
+		set_str(L,"type",fdisk_parttype_get_string(type));
+		set_str(L,"type_name",fdisk_parttype_get_name(type));
+		set_int(L,"type_code",fdisk_parttype_get_code(type));
+	}
+	set_bool(L,"freespace",fdisk_partition_is_freespace(pa));
+	set_bool(L,"used",fdisk_partition_is_used(pa));
+	set_bool(L,"bootable",fdisk_partition_is_bootable(pa));
+	set_bool(L,"container",fdisk_partition_is_container(pa));
+	set_bool(L,"nested",fdisk_partition_is_nested(pa));
+	set_bool(L,"wholedisk",fdisk_partition_is_wholedisk(pa));
+}
+
+static int lua_fdisk_partition_to_table(lua_State*L){
+	LUA_ARG_MAX(1);
+	struct lua_fdisk_partition*data=luaL_checkudata(L,1,LUA_FDISK_PARTITION);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid partition");
+	lua_fdisk_partition_push_table(L,data->data);
+	return 1;
+}
+
+// false for a missing field, an error for a field of another type
+static bool get_field(lua_State*L,const char*key,int type){
+	lua_settop(L,3);
+	if(lua_getfield(L,2,key)==LUA_TNIL)return false;
+	if(lua_type(L,-1)!=type)luaL_error(
+		L,"field %s must be a %s",
+		key,lua_typename(L,type)
+	);
+	return true;
+}
+
+/*
+ * the reverse of to_table, every field present in the table is set.
+ * type is a part type, or a string the label parses like sfdisk does.
+ */
+static int lua_fdisk_partition_set_fields(lua_State*L){
+	LUA_ARG_MAX(3);
+	int ret=0;
+	struct fdisk_parttype*pt;
+	struct lua_fdisk_parttype*type;
+	struct lua_fdisk_label*label=NULL;
+	struct lua_fdisk_partition*data=luaL_checkudata(L,1,LUA_FDISK_PARTITION);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid partition");
+	luaL_checktype(L,2,LUA_TTABLE);
+	if(!lua_isnoneornil(L,3))label=luaL_checkudata(L,3,LUA_FDISK_LABEL);
+	if(label&&!label->data)return luaL_argerror(L,3,"invalid label");
+	if(ret>=0&&get_field(L,"partno",LUA_TNUMBER))
+		ret=fdisk_partition_set_partno(data->data,lua_tointeger(L,-1));
+	if(ret>=0&&get_field(L,"start",LUA_TNUMBER))
+		ret=fdisk_partition_set_start(data->data,lua_tointeger(L,-1));
+	if(ret>=0&&get_field(L,"size",LUA_TNUMBER))
+		ret=fdisk_partition_set_size(data->data,lua_tointeger(L,-1));
+	if(ret>=0&&get_field(L,"name",LUA_TSTRING))
+		ret=fdisk_partition_set_name(data->data,lua_tostring(L,-1));
+	if(ret>=0&&get_field(L,"uuid",LUA_TSTRING))
+		ret=fdisk_partition_set_uuid(data->data,lua_tostring(L,-1));
+	if(ret>=0&&get_field(L,"attrs",LUA_TSTRING))
+		ret=fdisk_partition_set_attrs(data->data,lua_tostring(L,-1));
+	if(ret>=0&&label&&lua_getfield(L,2,"type")==LUA_TSTRING){
+		if(!(pt=fdisk_label_advparse_parttype(
+			label->data,lua_tostring(L,-1),
+			FDISK_PARTTYPE_PARSE_DEFAULT|FDISK_PARTTYPE_PARSE_NOUNKNOWN
+		)))return luaL_error(L,"unknown part type %s",lua_tostring(L,-1));
+		ret=fdisk_partition_set_type(data->data,pt);
+		fdisk_unref_parttype(pt);
+	}else if(ret>=0&&get_field(L,"type",LUA_TUSERDATA)){
+		type=luaL_checkudata(L,-1,LUA_FDISK_PARTTYPE);
+		if(!type||!type->data)return luaL_argerror(L,2,"invalid part type");
+		ret=fdisk_partition_set_type(data->data,type->data);
+	}
+	lua_settop(L,2);
+	if(lua_fdisk_check_error(L,ret))return 0;
+	lua_pushinteger(L,ret);
+	return 1;
+}
+
 static int lua_fdisk_partition_gc(lua_State*L){
 	LUA_ARG_MAX(1);
 	struct lua_fdisk_partition*data=NULL;
@@ -419,6 +534,8 @@ struct lua_fdisk_meta_table lua_fdisk_partition={
 		{"is_wholedisk",          lua_fdisk_partition_is_wholedisk},
 		{"to_string",             lua_fdisk_partition_to_string},
 		{"next_partno",           lua_fdisk_partition_next_partno},
+		{"to_table",              lua_fdisk_partition_to_table},
+		{"set_fields",            lua_fdisk_partition_set_fields},
 		{NULL, NULL}
 	},
 	.tostring=NULL,
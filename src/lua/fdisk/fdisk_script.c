@@ -123,6 +123,32 @@ static int lua_fdisk_script_read_line(lua_State*L){
 	return 2;
 }
 
+/*
+ * libfdisk only reads scripts from a FILE, a script held in a lua string
+ * is read through a memory stream instead of a temporary file.
+ */
+int lua_fdisk_script_load_string(struct fdisk_script*script,const char*buf,size_t len){
+	int ret;
+	FILE*f;
+	if(!script||!buf||len<=0)return -EINVAL;
+	if(!(f=fmemopen((void*)buf,len,"r")))return -errno;
+	ret=fdisk_script_read_file(script,f);
+	fclose(f);
+	return ret;
+}
+
+static int lua_fdisk_script_read_string(lua_State*L){
+	LUA_ARG_MAX(2);
+	size_t len=0;
+	struct lua_fdisk_script*data=luaL_checkudata(L,1,LUA_FDISK_SCRIPT);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid script");
+	const char*buf=luaL_checklstring(L,2,&len);
+	int ret=lua_fdisk_script_load_string(data->data,buf,len);
+	if(lua_fdisk_check_error(L,ret))return 0;
+	lua_pushinteger(L,ret);
+	return 1;
+}
+
 static int lua_fdisk_script_gc(lua_State*L){
 	LUA_ARG_MAX(1);
 	struct lua_fdisk_script*data=luaL_checkudata(L,1,LUA_FDISK_SCRIPT);
@@ -146,6 +172,7 @@ struct lua_fdisk_meta_table lua_fdisk_script={
 		{"enable_json",     lua_fdisk_script_enable_json},
 		{"write_file",      lua_fdisk_script_write_file},
 		{"read_line",       lua_fdisk_script_read_line},
+		{"read_string",     lua_fdisk_script_read_string},
 		{NULL, NULL}
 	},
 	.tostring=NULL,
@@ -129,7 +129,6 @@ static int lua_fdisk_table_get_partition_by_name(lua_State*L){
 	struct lua_fdisk_table*data=luaL_checkudata(L,1,LUA_FDISK_TABLE);
 	if(!data||!data->data)return luaL_argerror(L,1,"invalid table");
 	if(!iter)return luaL_error(L,"allocate iterator failed");
-	lua_createtable(L,0,0);
 	while(fdisk_table_next_partition(data->data,iter,&part)==0){
 		if(!part||!(cur=fdisk_partition_get_name(part)))continue;
 		if(!name[0]||!cur[0]||strcasecmp(name,cur)!=0)continue;
@@ -161,6 +160,26 @@ static int lua_fdisk_table_get_partitions(lua_State*L){
 	return 1;
 }
 
+// every partition as a plain table in one call, see partition:to_table()
+static int lua_fdisk_table_to_list(lua_State*L){
+	LUA_ARG_MAX(1);
+	int i=0;
+	struct fdisk_partition*part=NULL;
+	struct fdisk_iter*iter=fdisk_new_iter(FDISK_ITER_FORWARD);
+	struct lua_fdisk_table*data=luaL_checkudata(L,1,LUA_FDISK_TABLE);
+	if(!data||!data->data)return luaL_argerror(L,1,"invalid table");
+	if(!iter)return luaL_error(L,"allocate iterator failed");
+	lua_createtable(L,(int)fdisk_table_get_nents(data->data),0);
+	while(fdisk_table_next_partition(data->data,iter,&part)==0){
+		if(!part)continue;
+		lua_fdisk_partition_push_table(L,part);
+		lua_rawseti(L,-2,++i);
+		part=NULL;
+	}
+	fdisk_free_iter(iter);
+	return 1;
+}
+
 static int lua_fdisk_table_gc(lua_State*L){
 	LUA_ARG_MAX(1);
 	struct lua_fdisk_table*data=NULL;
@@ -185,6 +204,7 @@ struct lua_fdisk_meta_table lua_fdisk_table={
 		{"get_partition_by_partno", lua_fdisk_table_get_partition_by_partno},
 		{"get_partition_by_name",   lua_fdisk_table_get_partition_by_name},
 		{"get_partitions",          lua_fdisk_table_get_partitions},
+		{"to_list",                 lua_fdisk_table_to_list},
 		{NULL, NULL}
 	},
 	.tostring=NULL,
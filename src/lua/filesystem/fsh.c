@@ -86,7 +86,7 @@ static int lua_fsh_write(lua_State*L){
 	int64_t len=luaL_optinteger(L,3,size);
 	if(len<=0)return luaL_argerror(L,3,"invalid length");
 	if(size>0&&(size_t)len>size)return luaL_argerror(L,3,"out of range");
-	r=fs_write(f->f,&buffer,len,&size);
+	r=fs_write(f->f,buffer,len,&size);
 	lua_pushboolean(L,r==0);
 	lua_pushinteger(L,r);
 	lua_pushinteger(L,size);
@@ -103,7 +103,7 @@ static int lua_fsh_full_write(lua_State*L){
 	int64_t len=luaL_optinteger(L,3,size);
 	if(len<=0)return luaL_argerror(L,3,"invalid length");
 	if(size>0&&(size_t)len>size)return luaL_argerror(L,3,"out of range");
-	size=0,r=fs_full_write(f->f,&buffer,len);
+	size=0,r=fs_full_write(f->f,buffer,len);
 	lua_pushboolean(L,r==0);
 	lua_pushinteger(L,r);
 	return 2;
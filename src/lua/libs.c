@@ -29,13 +29,6 @@ const luaL_Reg simple_init_lua_libs[]={
 	{"data",     luaopen_data},
 	{"conf",     luaopen_conf},
 	{"logger",   luaopen_logger},
-	{"abootimg", luaopen_abootimg},
-	#ifdef ENABLE_STB
-	{"stb",      luaopen_stb},
-	#endif
-	#ifdef ENABLE_NANOSVG
-	{"nanosvg",  luaopen_nanosvg},
-	#endif
 	#ifdef ENABLE_GUI
 	{"lvgl",     luaopen_lvgl},
 	{"sysbar",   luaopen_sysbar},
@@ -46,9 +39,24 @@ const luaL_Reg simple_init_lua_libs[]={
 	#endif
 	#ifdef ENABLE_UEFI
 	{"uefi",     luaopen_uefi},
-	{"locate",   luaopen_locate},
 	#else
 	{"init",     luaopen_init},
+	#endif
+	{NULL,NULL}
+};
+
+// opened on first use, only what no other library makes objects of
+const luaL_Reg simple_init_lua_lazy_libs[]={
+	{"abootimg", luaopen_abootimg},
+	#ifdef ENABLE_STB
+	{"stb",      luaopen_stb},
+	#endif
+	#ifdef ENABLE_NANOSVG
+	{"nanosvg",  luaopen_nanosvg},
+	#endif
+	#ifdef ENABLE_UEFI
+	{"locate",   luaopen_locate},
+	#else
 	{"fdisk",    luaopen_fdisk},
 	{"recovery", luaopen_recovery},
 	#endif
@@ -9,12 +9,50 @@
 #ifdef ENABLE_LUA
 #include<string.h>
 #include<stdlib.h>
+#include<stdbool.h>
 #include"xlua.h"
+#include"lock.h"
+#include"array.h"
 #include"confd.h"
 #include"logger.h"
 #include"assets.h"
+#include"defines.h"
 #include"filesystem.h"
 
+/*
+ * the heavy bindings are not opened with the state, a missing global of
+ * the name opens them on first use through __index of _G, require finds
+ * them in package.preload.
+ */
+static int lazy_index(lua_State*L){
+	const char*name=lua_tostring(L,2);
+	lua_CFunction func;
+	if(!name||lua_rawget(L,lua_upvalueindex(1))!=LUA_TFUNCTION)return 0;
+	func=lua_tocfunction(L,-1);
+	luaL_requiref(L,name,func,1);
+	lua_pushnil(L);
+	lua_setfield(L,lua_upvalueindex(1),name);
+	return 1;
+}
+
+static void open_lazy_libs(lua_State*L,const luaL_Reg*libs){
+	luaL_getsubtable(L,LUA_REGISTRYINDEX,LUA_PRELOAD_TABLE);
+	lua_newtable(L);
+	for(const luaL_Reg*lib=libs;lib->func;lib++){
+		lua_pushcfunction(L,lib->func);
+		lua_pushvalue(L,-1);
+		lua_setfield(L,-4,lib->name);
+		lua_setfield(L,-2,lib->name);
+	}
+	lua_pushglobaltable(L);
+	lua_newtable(L);
+	lua_pushvalue(L,-3);
+	lua_pushcclosure(L,lazy_index,1);
+	lua_setfield(L,-2,"__index");
+	lua_setmetatable(L,-2);
+	lua_pop(L,3);
+}
+
 LUALIB_API void luaL_openlibs(lua_State*L){
 	const luaL_Reg *lib;
 	for(lib=lua_core_libs;lib->func;lib++){
@@ -25,6 +63,7 @@ LUALIB_API void luaL_openlibs(lua_State*L){
 		luaL_requiref(L,lib->name,lib->func,1);
 		lua_pop(L,1);
 	}
+	open_lazy_libs(L,simple_init_lua_lazy_libs);
 	for(lib=simple_init_lua_regs;lib->func;lib++){
 		lua_register(L,lib->name,lib->func);
 	}
@@ -43,12 +82,118 @@ lua_State*xlua_math(){
 	return L;
 }
 
-int xlua_eval_string(lua_State*L,const char*expr){
+/*
+ * users that live in one thread, like the renders of the gui, share one
+ * state that is opened once. every user gets an environment table that
+ * falls back to _G, its chunks run with it as _ENV, so globals set by
+ * one user do not show up for the others.
+ */
+static lua_State*shared_state=NULL;
+static mutex_t shared_lock=MUTEX_INITIALIZER;
+
+lua_State*xlua_shared(){
+	MUTEX_LOCK(shared_lock);
+	if(!shared_state)shared_state=xlua_init();
+	MUTEX_UNLOCK(shared_lock);
+	return shared_state;
+}
+
+int xlua_new_env(lua_State*L){
+	if(!L)return LUA_NOREF;
+	lua_newtable(L);
+	lua_newtable(L);
+	lua_pushglobaltable(L);
+	lua_setfield(L,-2,"__index");
+	lua_setmetatable(L,-2);
+	return luaL_ref(L,LUA_REGISTRYINDEX);
+}
+
+void xlua_free_env(lua_State*L,int env){
+	if(L&&env!=LUA_NOREF&&env!=LUA_REFNIL)luaL_unref(L,LUA_REGISTRYINDEX,env);
+}
+
+void xlua_push_env(lua_State*L,int env){
+	if(env==LUA_NOREF||env==LUA_REFNIL)lua_pushglobaltable(L);
+	else lua_rawgeti(L,LUA_REGISTRYINDEX,env);
+}
+
+void xlua_set_env(lua_State*L,int env){
+	if(env==LUA_NOREF||env==LUA_REFNIL)return;
+	xlua_push_env(L,env);
+	if(!lua_setupvalue(L,-2,1))lua_pop(L,1);
+}
+
+/*
+ * layouts evaluate the same expressions again on every relayout, the
+ * compiled chunk of an expression is kept in a registry table keyed by
+ * its text, so only the first evaluation runs the parser. there is one
+ * table for every environment, held weak by it, a table that grew too
+ * big is started over.
+ */
+#define EXPR_CACHE     "xlua.expr_cache"
+#define EXPR_CACHE_MAX 1024
+
+// cache table of env on top, [0] counts the chunks in it
+static void expr_cache(lua_State*L,int env,bool renew){
+	if(lua_getfield(L,LUA_REGISTRYINDEX,EXPR_CACHE)!=LUA_TTABLE){
+		lua_pop(L,1);
+		lua_newtable(L);
+		lua_newtable(L);
+		lua_pushliteral(L,"k");
+		lua_setfield(L,-2,"__mode");
+		lua_setmetatable(L,-2);
+		lua_pushvalue(L,-1);
+		lua_setfield(L,LUA_REGISTRYINDEX,EXPR_CACHE);
+	}
+	if(!renew){
+		xlua_push_env(L,env);
+		if(lua_rawget(L,-2)==LUA_TTABLE){
+			lua_remove(L,-2);
+			return;
+		}
+		lua_pop(L,1);
+	}
+	lua_newtable(L);
+	lua_pushinteger(L,0);
+	lua_rawseti(L,-2,0);
+	xlua_push_env(L,env);
+	lua_pushvalue(L,-2);
+	lua_rawset(L,-4);
+	lua_remove(L,-2);
+}
+
+int xlua_eval_string_env(lua_State*L,int env,const char*expr){
+	int r;
+	lua_Integer cnt;
 	if(!L||!expr)return -1;
 	lua_settop(L,0);
-	int r=xlua_return_string(L,expr);
-	if(r==LUA_OK)r=lua_pcall(L,0,LUA_MULTRET,0);
-	return r;
+	expr_cache(L,env,false);
+	if(lua_getfield(L,1,expr)!=LUA_TFUNCTION){
+		lua_pop(L,1);
+		lua_rawgeti(L,1,0);
+		cnt=lua_tointeger(L,-1);
+		lua_pop(L,1);
+		if(cnt>=EXPR_CACHE_MAX){
+			lua_pop(L,1);
+			expr_cache(L,env,true);
+			cnt=0;
+		}
+		if((r=xlua_return_string(L,expr))!=LUA_OK){
+			lua_remove(L,1);
+			return r;
+		}
+		xlua_set_env(L,env);
+		lua_pushvalue(L,-1);
+		lua_setfield(L,1,expr);
+		lua_pushinteger(L,cnt+1);
+		lua_rawseti(L,1,0);
+	}
+	lua_remove(L,1);
+	return lua_pcall(L,0,LUA_MULTRET,0);
+}
+
+int xlua_eval_string(lua_State*L,const char*expr){
+	return xlua_eval_string_env(L,LUA_NOREF,expr);
 }
 
 void xlua_show_error(lua_State*L,char*tag){
@@ -105,15 +250,136 @@ int xlua_create_metatable(
 	return 1;
 }
 
+/*
+ * scripts of the rootfs come with bytecode, name.luac next to name.lua
+ * is taken when lundump accepts its header, another lua version or
+ * number format loads the source instead. a chunk that was loaded once
+ * is kept dumped with the mtime and size of its file, loading it again
+ * does not read or parse the script.
+ */
+#define CHUNK_CACHE_MAX  64
+#define CHUNK_CACHE_SIZE 0x100000
+
+struct chunk_cache{
+	char*path;
+	time_t mtime;
+	size_t size;
+	char*code;
+	size_t len;
+};
+
+struct chunk_dump{
+	char*code;
+	size_t len,size;
+};
+
+static struct chunk_cache chunks[CHUNK_CACHE_MAX];
+static size_t chunks_next=0;
+static mutex_t chunks_lock=MUTEX_INITIALIZER;
+
+static int chunk_get(lua_State*L,const char*path,fs_file_info*info,const char*name){
+	int r=-1;
+	MUTEX_LOCK(chunks_lock);
+	for(size_t i=0;i<ARRLEN(chunks);i++){
+		struct chunk_cache*c=&chunks[i];
+		if(!c->path||strcmp(c->path,path)!=0)continue;
+		if(c->mtime==info->mtime&&c->size==info->size)
+			r=luaL_loadbufferx(L,c->code,c->len,name,"b");
+		if(r!=LUA_OK){
+			if(r!=-1)lua_pop(L,1);
+			free(c->path);
+			free(c->code);
+			memset(c,0,sizeof(struct chunk_cache));
+			r=-1;
+		}
+		break;
+	}
+	MUTEX_UNLOCK(chunks_lock);
+	return r;
+}
+
+static int chunk_writer(lua_State*L,const void*p,size_t sz,void*ud){
+	char*n;
+	size_t size;
+	struct chunk_dump*d=ud;
+	(void)L;
+	if(d->len+sz>CHUNK_CACHE_SIZE)return 1;
+	if(d->len+sz>d->size){
+		size=MAX(d->size*2,d->len+sz+4096);
+		if(!(n=realloc(d->code,size)))return 1;
+		d->code=n,d->size=size;
+	}
+	memcpy(d->code+d->len,p,sz);
+	d->len+=sz;
+	return 0;
+}
+
+static void chunk_put(lua_State*L,const char*path,fs_file_info*info){
+	char*p;
+	struct chunk_cache*c;
+	struct chunk_dump d={NULL,0,0};
+	if(lua_dump(L,chunk_writer,&d,0)!=0||!(p=strdup(path))){
+		if(d.code)free(d.code);
+		return;
+	}
+	MUTEX_LOCK(chunks_lock);
+	c=&chunks[chunks_next++%ARRLEN(chunks)];
+	if(c->path)free(c->path);
+	if(c->code)free(c->code);
+	c->path=p,c->code=d.code,c->len=d.len;
+	c->mtime=info->mtime,c->size=info->size;
+	MUTEX_UNLOCK(chunks_lock);
+}
+
+// bytecode older than its source is stale
+static int load_bytecode(lua_State*L,fsh*f,const char*name,fs_file_info*src){
+	int r=-1;
+	size_t len=0,l=strlen(name);
+	void*buffer=NULL;
+	fsh*hand=NULL;
+	fs_file_info info;
+	char path[PATH_MAX];
+	if(l<4||l>=sizeof(path)-1||strcmp(name+l-4,".lua")!=0)return -1;
+	snprintf(path,sizeof(path),"%sc",name);
+	if(fs_open(f,&hand,path,FILE_FLAG_READ)!=0)return -1;
+	if(
+		(!src||(fs_get_info(hand,&info)==0&&info.mtime>=src->mtime))&&
+		fs_read_all(hand,&buffer,&len)==0&&buffer
+	){
+		if((r=luaL_loadbufferx(L,buffer,len,name,"b"))!=LUA_OK){
+			log_debug("lua","bytecode %s not usable: %s",path,lua_tostring(L,-1));
+			lua_pop(L,1);
+			r=-1;
+		}
+	}
+	if(buffer)free(buffer);
+	fs_close(&hand);
+	return r;
+}
+
 int xlua_loadfile(lua_State*L,fsh*f,const char*name){
 	int r=0;
 	size_t len=0;
 	void*buffer=NULL;
-	r=fs_read_whole_file(f,name,&buffer,&len);
-	if(r!=0)return r;
-	if(!buffer)return EIO;
-	r=luaL_loadbufferx(L,buffer,len,name,NULL);
-	free(buffer);
+	fsh*hand=NULL;
+	fs_file_info info;
+	bool cache=false,have_info;
+	char path[PATH_MAX];
+	if((r=fs_open(f,&hand,name,FILE_FLAG_READ))!=0)return r;
+	have_info=fs_get_info(hand,&info)==0;
+	if(have_info&&fs_get_path(hand,path,sizeof(path))==0)cache=true;
+	if(cache&&chunk_get(L,path,&info,name)==LUA_OK){
+		fs_close(&hand);
+		return LUA_OK;
+	}
+	if(load_bytecode(L,f,name,have_info?&info:NULL)!=LUA_OK){
+		r=fs_read_all(hand,&buffer,&len);
+		if(r==0&&!buffer)r=EIO;
+		if(r==0)r=luaL_loadbufferx(L,buffer,len,name,NULL);
+		if(buffer)free(buffer);
+	}
+	fs_close(&hand);
+	if(r==LUA_OK&&cache)chunk_put(L,path,&info);
 	return r;
 }
 
@@ -49,7 +49,7 @@ void lua_nanosvg_rast_to_lua(lua_State*L,NSVGrasterizer*rast){
 	}
 	struct lua_nanosvg_rast*e;
 	e=lua_newuserdata(L,sizeof(struct lua_nanosvg_rast));
-	luaL_getmetatable(L,LUA_DATA);
+	luaL_getmetatable(L,LUA_NANOSVG_RAST);
 	lua_setmetatable(L,-2);
 	memset(e,0,sizeof(struct lua_nanosvg_rast));
 	e->rast=rast;
@@ -65,13 +65,20 @@ static int nanosvg_rasterize(lua_State*L,int n,NSVGimage*img,NSVGrasterizer*rast
 	int stride=luaL_optinteger(L,n+6,width*4);
 	luaL_argcheck(L,width>0,n+4,"width must greater than zero");
 	luaL_argcheck(L,height>0,n+5,"height must greater than zero");
-	luaL_argcheck(L,stride>0,n+6,"stride must greater than zero");
-	size_t size=width*height*4;
-	void*data=malloc(size);
-	if(!data)return luaL_error(L,"alloc image failed");
-	memset(data,0,size);
-	nsvgRasterize(rast,img,tx,ty,scale,data,width,height,stride);
-	lua_data_to_lua(L,true,data,size);
+	luaL_argcheck(L,stride>=width*4,n+6,"stride too small");
+	size_t size=(size_t)stride*height;
+
+	// a data object given as output is filled in place
+	void*data=lua_arg_get_data_dst(L,n+7,size);
+	if(data){
+		nsvgRasterize(rast,img,tx,ty,scale,data,width,height,stride);
+		lua_pushvalue(L,n+7);
+	}else{
+		if(!(data=malloc(size)))return luaL_error(L,"alloc image failed");
+		memset(data,0,size);
+		nsvgRasterize(rast,img,tx,ty,scale,data,width,height,stride);
+		lua_data_to_lua(L,true,data,size);
+	}
 	lua_pushinteger(L,width);
 	lua_pushinteger(L,height);
 	return 3;
@@ -165,7 +172,7 @@ static int nanosvg_img_rast(lua_State*L){
 			return luaL_error(L,"create rasterizer failed");
 		alloc=true;
 	}
-	int x=nanosvg_rasterize(L,n,img->img,r);
+	int x=nanosvg_rasterize(L,n-1,img->img,r);
 	if(alloc)nsvgDeleteRasterizer(r);
 	return x;
 }
@@ -44,18 +44,20 @@ static int lua_stbi_load(lua_State*L){
 				luaL_argcheck(L,1,d2->data!=NULL,"data must not null");
 				luaL_argcheck(L,1,d2->size>0,"data too small");
 				ret=stbi_load_from_memory(d2->data,d2->size,&x,&y,&c,dc);
+				break;
 			}
 			struct lua_fsh*d3;
-			if((d3=luaL_testudata(L,1,LUA_DATA))){
+			if((d3=luaL_testudata(L,1,LUA_FSH))){
 				luaL_argcheck(L,1,d3->f!=NULL,"fsh must not null");
 				if(fs_read_all(d3->f,&buf,&size)==0&&buf&&size>0)
 					ret=stbi_load_from_memory(buf,size,&x,&y,&c,dc);
+				break;
 			}
 		}/*fallthrough*/
 		default:return luaL_argerror(L,1,"unknown argument type");
 	}
 	if(x<0||y<0||c<0||!ret)lua_pushnil(L);
-	else lua_data_to_lua(L,true,ret,x*y*c);
+	else lua_data_to_lua(L,true,ret,(size_t)x*y*dc);
 	lua_pushinteger(L,x);
 	lua_pushinteger(L,y);
 	lua_pushinteger(L,c);
@@ -79,14 +81,22 @@ static int lua_stbir_resize(lua_State*L){
 	int ow=luaL_checkinteger(L,4);
 	int oh=luaL_checkinteger(L,5);
 	int ch=luaL_optinteger(L,6,4);
-	len=ow*oh*ch;
+	len=(size_t)ow*oh*ch;
 	if(!data||size<=0)return luaL_argerror(L,1,"invalid image");
 	if(iw<=0)return luaL_argerror(L,2,"invalid input width");
 	if(ih<=0)return luaL_argerror(L,3,"invalid input height");
 	if(ow<=0)return luaL_argerror(L,4,"invalid output width");
 	if(oh<=0)return luaL_argerror(L,5,"invalid output height");
 	if(ch<3||ch>4)return luaL_argerror(L,6,"invalid channels");
-	if(size<(size_t)(iw*ih*ch))return luaL_argerror(L,1,"image too small");
+	if(size<(size_t)iw*ih*ch)return luaL_argerror(L,1,"image too small");
+
+	// a data object given as output is filled in place
+	if((ret=lua_arg_get_data_dst(L,7,len))){
+		luaL_argcheck(L,ret!=data,7,"output must not be the input");
+		if(stbir_resize_uint8(data,iw,ih,0,ret,ow,oh,0,ch)!=1)lua_pushnil(L);
+		else lua_pushvalue(L,7);
+		return 1;
+	}
 	if(!(ret=malloc(len)))return luaL_error(L,"allocate output buffer failed");
 	memset(ret,0,len);
 	int r=stbir_resize_uint8(data,iw,ih,0,ret,ow,oh,0,ch);
@@ -99,18 +109,27 @@ static int lua_stbir_resize(lua_State*L){
 
 struct write_data{
 	void*data;
-	size_t size;
+	size_t size,cap;
+	bool failed;
 };
 
+// the encoders emit many small pieces, the buffer grows geometrically
 static void stbiw_write_callback(void*context,void*data,int size){
+	void*p;
+	size_t cap;
 	struct write_data*wd=context;
-	if(!wd||!data||size<=0)return;
-	size_t rs=wd->size+size;
-	void*p=wd->data?realloc(wd->data,rs):malloc(rs);
-	if(!p)return;
-	memcpy(p+wd->size,data,size);
-	if(wd->data)free(wd->data);
-	wd->size=rs,wd->data=p;
+	if(!wd||!data||size<=0||wd->failed)return;
+	if(wd->size+size>wd->cap){
+		cap=wd->cap?wd->cap:0x10000;
+		while(cap<wd->size+size)cap*=2;
+		if(!(p=realloc(wd->data,cap))){
+			wd->failed=true;
+			return;
+		}
+		wd->data=p,wd->cap=cap;
+	}
+	memcpy(wd->data+wd->size,data,size);
+	wd->size+=size;
 }
 
 static int lua_stbiw_write(lua_State*L){
@@ -127,6 +146,7 @@ static int lua_stbiw_write(lua_State*L){
 	if(w<=0)return luaL_argerror(L,3,"invalid width");
 	if(h<=0)return luaL_argerror(L,4,"invalid height");
 	if(c<3||c>4)return luaL_argerror(L,5,"invalid channels");
+	if(size<(size_t)w*h*c)return luaL_argerror(L,2,"image too small");
 	memset(&wd,0,sizeof(wd));
 	if(strcasecmp(type,"png")==0)
 		ret=stbi_write_png_to_func(stbiw_write_callback,&wd,w,h,c,data,0);
@@ -138,15 +158,13 @@ static int lua_stbiw_write(lua_State*L){
 		ret=stbi_write_hdr_to_func(stbiw_write_callback,&wd,w,h,c,data);
 	else if(strcasecmp(type,"jpg")==0){
 		int q=luaL_optinteger(L,6,90);
-		if(c<1||c>100)return luaL_argerror(L,6,"invalid quality");
+		if(q<1||q>100)return luaL_argerror(L,6,"invalid quality");
 		ret=stbi_write_jpg_to_func(stbiw_write_callback,&wd,w,h,c,data,q);
 	}else return luaL_argerror(L,1,"invalid type");
-	if(ret!=1){
+	if(ret!=1||wd.failed||!wd.data){
 		if(wd.data)free(wd.data);
-		memset(&wd,0,sizeof(wd));
-	}
-	if(!data||size<=0)lua_pushnil(L);
-	else lua_data_to_lua(L,true,wd.data,wd.size);
+		lua_pushnil(L);
+	}else lua_data_to_lua(L,true,wd.data,wd.size);
 	return 1;
 }
 
@@ -15,6 +15,7 @@
 #include"xlua.h"
 #endif
 #include"boot.h"
+#include"uefi.h"
 #include"confd.h"
 #include"errno.h"
 #include"logger.h"
@@ -31,6 +32,7 @@ extern void uefi_dump_info();
 
 static void show_bootmenu(void*d __attribute__((unused))){
 	bootmenu_draw();
+	boottime_mark("bootmenu");
 }
 
 static int post_main(){
@@ -38,12 +40,14 @@ static int post_main(){
 	logger_set_console(PcdGetBool(PcdLoggerdUseConsole));
 	confd_init();
 	logger_init();
+	boottime_mark("confd");
 	tlog_notice("initialize simple-init");
 	tlog_debug("simple init main entry point at %p",&UefiMain);
 	if((r=gui_pre_init())!=0)return r;
 	if((r=gui_screen_init())!=0)return r;
 	gui_splash_draw();
 	lv_task_handler();
+	boottime_mark("gui");
 	uefi_dump_info();
 
 	gui_splash_set_text(true,_("Initializing config store..."));
@@ -51,6 +55,7 @@ static int post_main(){
 
 	gui_splash_set_text(true,_("Loading extra UEFI Drivers..."));
 	boot_load_drivers();
+	boottime_mark("drivers");
 
 	gui_splash_set_text(true,_("Initializing I18N locale..."));
 	char*lang=confd_get_string("language",NULL);
@@ -59,6 +64,7 @@ static int post_main(){
 
 	gui_splash_set_text(true,_("Initializing Boot Manager..."));
 	boot_init_configs();
+	boottime_mark("bootmgr");
 
 	#ifdef ENABLE_LUA
 	gui_splash_set_text(true,_("Initializing LUA Framework..."));
@@ -67,6 +73,7 @@ static int post_main(){
 		xlua_run_confd(L,TAG,"lua.on_post_startup");
 		lua_close(L);
 	}
+	boottime_mark("lua");
 	#endif
 
 	gui_splash_set_text(true,_("Starting boot menu..."));
@@ -77,10 +84,12 @@ static int post_main(){
 
 // simple-init uefi entry point
 EFI_STATUS EFIAPI UefiMain(IN EFI_HANDLE ih,IN EFI_SYSTEM_TABLE*st){
+	boottime_mark("entry");
 	REPORT_STATUS_CODE(EFI_PROGRESS_CODE,(EFI_SOFTWARE_DXE_BS_DRIVER|EFI_SW_PC_USER_SETUP));
 
 	EfiBootManagerConnectAll();
 	EfiBootManagerRefreshAllBootOption();
+	boottime_mark("connect");
 	DEBUG((EFI_D_INFO,"Initialize SimpleInit GUI...\n"));
 
 	errno=0;
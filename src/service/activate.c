@@ -0,0 +1,75 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<errno.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/un.h>
+#include<sys/stat.h>
+#include<sys/socket.h>
+#include"list.h"
+#include"lock.h"
+#include"logger.h"
+#include"service.h"
+#include"defines.h"
+#include"service_scheduler.h"
+#define TAG "service"
+
+/*
+ * socket activation: initd binds the socket of a service at boot,
+ * starting the service only marks it started, the real start happens
+ * on the first connection. the listening fd is kept by init and
+ * inherited by every run of the service (fd 3 and LISTEN_FDS for commands).
+ */
+int svc_listen_socket(struct service*svc){
+	int fd;
+	struct sockaddr_un un={.sun_family=AF_UNIX};
+	if(!svc||!svc->socket)ERET(EINVAL);
+	if(svc->socket_fd>=0)return svc->socket_fd;
+	strncpy(un.sun_path,svc->socket,sizeof(un.sun_path)-1);
+	if((fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0))<0)
+		return terlog_error(-errno,"cannot create socket for %s",svc->name);
+	unlink(un.sun_path);
+	if(bind(fd,(struct sockaddr*)&un,sizeof(un))<0||listen(fd,16)<0){
+		telog_error("cannot listen %s for %s",svc->socket,svc->name);
+		close(fd);
+		return -1;
+	}
+	chmod(un.sun_path,0600);
+	tlog_debug("service %s listen socket %s as %d",svc->name,svc->socket,fd);
+	return svc->socket_fd=fd;
+}
+
+int svc_listen_all_sockets(){
+	list*cur,*next;
+	MUTEX_LOCK(services_lock);
+	if((next=list_first(services)))do{
+		cur=next;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if(s&&s->socket&&!s->activated)svc_listen_socket(s);
+	}while((next=cur->next));
+	MUTEX_UNLOCK(services_lock);
+	return 0;
+}
+
+bool svc_socket_pending(struct service*svc){
+	return svc&&svc->socket&&svc->socket_fd>=0&&!svc->activated;
+}
+
+int svc_activate(struct service*svc){
+	if(!svc_socket_pending(svc))ERET(EINVAL);
+	MUTEX_LOCK(svc->lock);
+	svc->activated=true;
+
+	// waiting listener was marked started, make it startable
+	if(svc->status==STATUS_STARTED)svc->status=STATUS_STOPPED;
+	MUTEX_UNLOCK(svc->lock);
+	tlog_notice("Activate service %s by connection on %s",svc_get_desc(svc),svc->socket);
+	return service_start(svc);
+}
@@ -0,0 +1,419 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/stat.h>
+#include"list.h"
+#include"lock.h"
+#include"array.h"
+#include"logger.h"
+#include"service.h"
+#include"defines.h"
+#define TAG "service"
+
+/*
+ * services parsed from config, stored in one file:
+ *
+ *   header  magic, version, config hash, services and depends count
+ *   service name, mode, strings, flags, limits, then 4 executes
+ *   execute 1 and the command, or 0 to keep what the service already has
+ *   depend  names of service and the service it depends on
+ *
+ * integers are in host order, the cache never leaves the device
+ */
+#define CACHE_MAGIC   0x43435653
+#define CACHE_VERSION 1
+#define CACHE_MAX     0x1000000
+#define NO_STR        0xFFFFFFFF
+
+struct cache_hdr{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint32_t services;
+	uint32_t depends;
+};
+
+struct wbuf{
+	char*data;
+	size_t len,size;
+	bool fail;
+};
+
+struct rbuf{
+	const char*data;
+	size_t len,off;
+	bool fail;
+};
+
+static void put(struct wbuf*b,const void*data,size_t len){
+	char*n;
+	size_t s;
+	if(b->fail)return;
+	if(b->len+len>b->size){
+		for(s=b->size?b->size:4096;s<b->len+len;s*=2);
+		if(s>CACHE_MAX||!(n=realloc(b->data,s))){
+			b->fail=true;
+			return;
+		}
+		b->data=n,b->size=s;
+	}
+	memcpy(b->data+b->len,data,len);
+	b->len+=len;
+}
+
+#define PUT(b,type,val) do{type _v=(type)(val);put(b,&_v,sizeof(_v));}while(0)
+
+static void put_str(struct wbuf*b,const char*str){
+	size_t len=str?strlen(str):0;
+	PUT(b,uint32_t,str?len:NO_STR);
+	if(str)put(b,str,len);
+}
+
+static void put_strv(struct wbuf*b,char**strv){
+	uint32_t cnt=0;
+	if(strv)while(strv[cnt])cnt++;
+	PUT(b,uint32_t,strv?cnt:NO_STR);
+	for(uint32_t i=0;strv&&i<cnt;i++)put_str(b,strv[i]);
+}
+
+static void get(struct rbuf*b,void*data,size_t len){
+	if(b->fail||b->len-b->off<len){
+		b->fail=true;
+		memset(data,0,len);
+		return;
+	}
+	memcpy(data,b->data+b->off,len);
+	b->off+=len;
+}
+
+#define GET(b,type) ({type _v;get(b,&_v,sizeof(_v));_v;})
+
+// returns a copy when dup, or only skips it, NULL string and errors look the same
+static char*get_str(struct rbuf*b,bool dup){
+	char*r;
+	uint32_t len=GET(b,uint32_t);
+	if(b->fail||len==NO_STR)return NULL;
+	if(b->len-b->off<len){
+		b->fail=true;
+		return NULL;
+	}
+	if(dup&&(r=strndup(b->data+b->off,len)))b->off+=len;
+	else if(dup)b->fail=true,r=NULL;
+	else b->off+=len,r=NULL;
+	return r;
+}
+
+static char**get_strv(struct rbuf*b,bool dup){
+	char**r=NULL;
+	uint32_t cnt=GET(b,uint32_t);
+	if(b->fail||cnt==NO_STR)return NULL;
+	if(cnt>(b->len-b->off)/sizeof(uint32_t)){
+		b->fail=true;
+		return NULL;
+	}
+	if(dup){
+		if(!(r=malloc(sizeof(char*)*(cnt+1)))){
+			b->fail=true;
+			return NULL;
+		}
+		memset(r,0,sizeof(char*)*(cnt+1));
+	}
+	for(uint32_t i=0;i<cnt&&!b->fail;i++){
+		char*s=get_str(b,dup);
+		if(r)r[i]=s;
+	}
+	if(b->fail&&r)array_free(r),r=NULL;
+	return r;
+}
+
+static void put_exec(struct wbuf*b,struct svc_exec*e){
+	if(!e||e->prop.type!=TYPE_COMMAND){
+		PUT(b,uint8_t,0);
+		return;
+	}
+	PUT(b,uint8_t,1);
+	put_str(b,e->prop.name);
+	PUT(b,uint32_t,e->prop.uid);
+	PUT(b,uint32_t,e->prop.gid);
+	PUT(b,int64_t,e->prop.timeout);
+	put_str(b,e->exec.cmd.path);
+	put_strv(b,e->exec.cmd.args);
+	put_strv(b,e->exec.cmd.environ);
+}
+
+static void put_service(struct wbuf*b,struct service*s){
+	uint8_t flags=
+		(s->terminal_output_signal?0x01:0)|
+		(s->stop_on_shutdown?0x02:0)|
+		(s->ignore_failed?0x04:0)|
+		(s->auto_restart?0x08:0)|
+		(s->stdio_syslog?0x10:0);
+	put_str(b,s->name);
+	PUT(b,uint8_t,s->mode);
+	put_str(b,s->description);
+	put_str(b,s->pid_file);
+	put_str(b,s->socket);
+	PUT(b,uint8_t,flags);
+	PUT(b,int64_t,s->restart_delay);
+	PUT(b,int32_t,s->restart_max);
+	PUT(b,int64_t,s->memory_max);
+	PUT(b,int32_t,s->cpu_max);
+	put_exec(b,s->start);
+	put_exec(b,s->stop);
+	put_exec(b,s->restart);
+	put_exec(b,s->reload);
+}
+
+static bool in_list(list*l,struct service*svc){
+	list*cur,*next;
+	if((next=list_first(l)))do{
+		cur=next;
+		if(cur->data==svc)return true;
+	}while((next=cur->next));
+	return false;
+}
+
+int svc_cache_save(const char*path,uint64_t hash,list*svcs){
+	int fd;
+	ssize_t r;
+	size_t off=0;
+	list*cur,*next,*dc,*dn;
+	char tmp[PATH_MAX];
+	struct wbuf b={0};
+	struct cache_hdr hdr={
+		.magic=CACHE_MAGIC,
+		.version=CACHE_VERSION,
+		.hash=hash,
+	};
+	if(!path||!svcs)ERET(EINVAL);
+	put(&b,&hdr,sizeof(hdr));
+	if((next=list_first(svcs)))do{
+		cur=next;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if(!s)continue;
+		MUTEX_LOCK(s->lock);
+		put_service(&b,s);
+		MUTEX_UNLOCK(s->lock);
+		hdr.services++;
+	}while((next=cur->next));
+
+	// every depend touching a parsed service, code registered ones are found again on load
+	MUTEX_LOCK(services_lock);
+	if((next=list_first(services)))do{
+		cur=next;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if(!s||!(dn=list_first(s->depends_on)))continue;
+		do{
+			dc=dn;
+			LIST_DATA_DECLARE(d,dc,struct service*);
+			if(!d||(!in_list(svcs,s)&&!in_list(svcs,d)))continue;
+			put_str(&b,s->name);
+			put_str(&b,d->name);
+			hdr.depends++;
+		}while((dn=dc->next));
+	}while((next=cur->next));
+	MUTEX_UNLOCK(services_lock);
+	if(b.fail){
+		if(b.data)free(b.data);
+		ERET(ENOMEM);
+	}
+	memcpy(b.data,&hdr,sizeof(hdr));
+
+	// write a new file and rename it, a crash never leaves half a cache
+	snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+	if((fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0600))<0){
+		free(b.data);
+		return terlog_warn(-1,"open service cache %s failed",tmp);
+	}
+	while(off<b.len){
+		if((r=write(fd,b.data+off,b.len-off))<0&&errno==EINTR)continue;
+		if(r<=0)break;
+		off+=r;
+	}
+	free(b.data);
+	if(off!=b.len||fsync(fd)!=0){
+		close(fd);
+		unlink(tmp);
+		return terlog_warn(-1,"write service cache %s failed",tmp);
+	}
+	close(fd);
+	if(rename(tmp,path)!=0){
+		unlink(tmp);
+		return terlog_warn(-1,"rename service cache %s failed",path);
+	}
+	tlog_debug("saved %u services to cache %s",hdr.services,path);
+	return 0;
+}
+
+static void load_exec(struct rbuf*b,struct service*svc,int which){
+	char rn[256];
+	struct svc_exec*exec=NULL,**e=NULL;
+	static const char*names[]={"start","stop","restart","reload"};
+	if(GET(b,uint8_t)==0||b->fail)return;
+	if(svc){
+		switch(which){
+			case 0:e=&svc->start;break;
+			case 1:e=&svc->stop;break;
+			case 2:e=&svc->restart;break;
+			default:e=&svc->reload;
+		}
+		snprintf(rn,sizeof(rn),"%s %s",svc->name,names[which]);
+		if(!(exec=svc_new_exec(rn)))b->fail=true;
+	}
+	if(exec){
+		free(exec->prop.name);
+		exec->prop.name=NULL;
+	}
+	char*name=get_str(b,exec!=NULL);
+	if(exec)exec->prop.name=name?name:strdup(rn);
+	uid_t uid=GET(b,uint32_t);
+	gid_t gid=GET(b,uint32_t);
+	time_t timeout=GET(b,int64_t);
+	char*cmd=get_str(b,exec!=NULL);
+	char**args=get_strv(b,exec!=NULL);
+	char**envs=get_strv(b,exec!=NULL);
+	if(!exec)return;
+	exec->prop.svc=svc;
+	exec->prop.uid=uid,exec->prop.gid=gid;
+	exec->prop.timeout=timeout;
+	exec->prop.type=TYPE_COMMAND;
+	exec->exec.cmd.path=cmd;
+	exec->exec.cmd.args=args;
+	exec->exec.cmd.environ=envs;
+	if(b->fail||!exec->prop.name||!cmd||!args){
+		b->fail=true;
+		svc_free_exec(exec);
+		return;
+	}
+	if(*e)svc_free_exec(*e);
+	*e=exec;
+}
+
+static void load_service(struct rbuf*b,bool apply){
+	bool created=false;
+	uint8_t mode,flags;
+	char*name,*desc,*pid_file,*socket;
+	struct service*svc=NULL;
+	if(!(name=get_str(b,true))){
+		b->fail=true;
+		return;
+	}
+	mode=GET(b,uint8_t);
+	desc=get_str(b,apply);
+	pid_file=get_str(b,apply);
+	socket=get_str(b,apply);
+	flags=GET(b,uint8_t);
+	time_t restart_delay=GET(b,int64_t);
+	int restart_max=GET(b,int32_t);
+	int64_t memory_max=GET(b,int64_t);
+	int cpu_max=GET(b,int32_t);
+	if(apply&&!b->fail&&!(svc=svc_lookup_by_name(name))){
+		if(!(svc=svc_new_service(name,mode)))b->fail=true;
+		else created=true;
+	}
+	if(svc){
+		MUTEX_LOCK(svc->lock);
+		svc->mode=mode;
+		if(desc){
+			if(svc->description)free(svc->description);
+			svc->description=desc,desc=NULL;
+		}
+		if(pid_file){
+			if(svc->pid_file)free(svc->pid_file);
+			svc->pid_file=pid_file,pid_file=NULL;
+		}
+		if(socket){
+			if(svc->socket)free(svc->socket);
+			svc->socket=socket,socket=NULL;
+		}
+		svc->terminal_output_signal=flags&0x01;
+		svc->stop_on_shutdown=flags&0x02;
+		svc->ignore_failed=flags&0x04;
+		svc->auto_restart=flags&0x08;
+		svc->stdio_syslog=flags&0x10;
+		svc->restart_delay=restart_delay;
+		svc->restart_max=restart_max;
+		svc->memory_max=memory_max;
+		svc->cpu_max=cpu_max;
+	}
+	for(int i=0;i<4;i++)load_exec(b,svc,i);
+	if(svc){
+		time(&svc->last_update);
+		MUTEX_UNLOCK(svc->lock);
+		if(created&&svc_add_service(svc)!=0){
+			svc_free_service(svc);
+			b->fail=true;
+		}
+	}
+	free(name);
+	if(desc)free(desc);
+	if(pid_file)free(pid_file);
+	if(socket)free(socket);
+}
+
+static void load_depend(struct rbuf*b,bool apply){
+	char*a=get_str(b,true),*d=get_str(b,true);
+	struct service*sa,*sd;
+	if(!a||!d)b->fail=true;
+	else if(apply){
+		if(!(sa=svc_lookup_by_name(a))||!(sd=svc_lookup_by_name(d)))
+			tlog_warn("cached depend %s on %s not found",a,d);
+		else if(!in_list(sa->depends_on,sd)&&svc_add_depend(sa,sd)!=0)
+			tlog_warn("add depend %s failed",d);
+	}
+	if(a)free(a);
+	if(d)free(d);
+}
+
+// the whole file is checked before anything is applied
+static int load_all(const char*data,size_t len,uint64_t hash,bool apply){
+	struct cache_hdr hdr;
+	struct rbuf b={.data=data,.len=len};
+	get(&b,&hdr,sizeof(hdr));
+	if(b.fail||hdr.magic!=CACHE_MAGIC||hdr.version!=CACHE_VERSION)ERET(EINVAL);
+	if(hdr.hash!=hash)ERET(ESTALE);
+	for(uint32_t i=0;i<hdr.services&&!b.fail;i++)load_service(&b,apply);
+	for(uint32_t i=0;i<hdr.depends&&!b.fail;i++)load_depend(&b,apply);
+	if(b.fail||b.off!=b.len)ERET(EINVAL);
+	return 0;
+}
+
+int svc_cache_load(const char*path,uint64_t hash){
+	int fd,r;
+	char*data;
+	ssize_t s;
+	size_t len=0;
+	struct stat st;
+	if(!path)ERET(EINVAL);
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))<0)return -errno;
+	if(fstat(fd,&st)!=0||st.st_size<=0||st.st_size>CACHE_MAX){
+		close(fd);
+		ERET(EINVAL);
+	}
+	if(!(data=malloc(st.st_size))){
+		close(fd);
+		ERET(ENOMEM);
+	}
+	while(len<(size_t)st.st_size){
+		if((s=read(fd,data+len,st.st_size-len))<0&&errno==EINTR)continue;
+		if(s<=0)break;
+		len+=s;
+	}
+	close(fd);
+	if((r=load_all(data,len,hash,false))==0)r=load_all(data,len,hash,true);
+	free(data);
+	if(r==0)tlog_debug("loaded services from cache %s",path);
+	return r;
+}
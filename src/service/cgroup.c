@@ -0,0 +1,239 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdarg.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<limits.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/stat.h>
+#include<sys/inotify.h>
+#include"list.h"
+#include"lock.h"
+#include"logger.h"
+#include"system.h"
+#include"service.h"
+#include"defines.h"
+#include"str.h"
+#include"pathnames.h"
+#define TAG "cgroup"
+
+/*
+ * every service has a cgroup v2 leaf services/NAME, all its executes join it.
+ * cgroup.events and memory.events are watched by inotify in the scheduler loop,
+ * so usage is read when a leaf becomes empty or gets an oom kill, or on request.
+ */
+#define CGROUP_ROOT _PATH_SYS_FS"/cgroup"
+#define CGROUP_BASE CGROUP_ROOT"/services"
+#define CPU_PERIOD 100000
+
+static bool enabled=false;
+static int ifd=-1;
+
+static int cg_path(char*buf,size_t len,struct service*svc,const char*file){
+	char name[NAME_MAX];
+	size_t i;
+	// service names are free form, keep them in one path component
+	for(i=0;svc->name[i]&&i<sizeof(name)-1;i++)
+		name[i]=svc->name[i]=='/'||svc->name[i]=='.'?'_':svc->name[i];
+	name[i]=0;
+	return (size_t)snprintf(
+		buf,len,CGROUP_BASE"/%s%s%s",
+		name,file?"/":"",file?file:""
+	)<len?0:-1;
+}
+
+static int cg_write(const char*path,const char*fmt,...){
+	int fd,r;
+	va_list va;
+	if((fd=open(path,O_WRONLY|O_CLOEXEC))<0)return -1;
+	va_start(va,fmt);
+	r=vdprintf(fd,fmt,va);
+	va_end(va);
+	close(fd);
+	return r<0?-1:0;
+}
+
+// call cb for every "key value" and "key=value" word in a file
+static int cg_read_keys(
+	const char*path,
+	void(*cb)(const char*key,uint64_t val,void*data),
+	void*data
+){
+	FILE*f;
+	char line[512],*p,*k,*v,*save;
+	if(!(f=fopen(path,"re")))return -1;
+	while(fgets(line,sizeof(line),f)){
+		if((p=strchr(line,'='))){
+			// io.stat: MAJ:MIN rbytes=N wbytes=N ...
+			for(k=strtok_r(line," \n",&save);k;k=strtok_r(NULL," \n",&save)){
+				if(!(v=strchr(k,'=')))continue;
+				*v++=0;
+				cb(k,strtoull(v,NULL,10),data);
+			}
+		}else if((v=strchr(line,' '))){
+			*v++=0;
+			cb(line,strtoull(v,NULL,10),data);
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static void cpu_key(const char*key,uint64_t val,void*data){
+	struct svc_usage*u=data;
+	if(strcmp(key,"usage_usec")==0)u->cpu_usec=val;
+	else if(strcmp(key,"user_usec")==0)u->cpu_user_usec=val;
+	else if(strcmp(key,"system_usec")==0)u->cpu_system_usec=val;
+}
+
+static void io_key(const char*key,uint64_t val,void*data){
+	struct svc_usage*u=data;
+	if(strcmp(key,"rbytes")==0)u->io_rbytes+=val;
+	else if(strcmp(key,"wbytes")==0)u->io_wbytes+=val;
+}
+
+static void mem_key(const char*key,uint64_t val,void*data){
+	struct svc_usage*u=data;
+	if(strcmp(key,"oom_kill")==0)u->oom_kills=val;
+}
+
+static void events_key(const char*key,uint64_t val,void*data){
+	struct svc_usage*u=data;
+	if(strcmp(key,"populated")==0)u->populated=val!=0;
+}
+
+static uint64_t cg_read_u64(const char*path){
+	char buf[64]={0};
+	if(read_file(buf,sizeof(buf),false,"%s",path)<=0)return 0;
+	return strtoull(buf,NULL,10);
+}
+
+int svc_cgroup_init(){
+	static const char*ctrls[]={"+cpu","+memory","+io",NULL};
+	if(enabled)return 0;
+	if(access(CGROUP_ROOT"/cgroup.controllers",F_OK)!=0)
+		return trlog_debug(-1,"cgroup v2 is not mounted, accounting disabled");
+	if(mkdir(CGROUP_BASE,0755)!=0&&errno!=EEXIST)
+		return terlog_warn(-1,"create "CGROUP_BASE" failed");
+
+	// some controllers may be missing in kernel, enable what is there
+	for(int i=0;ctrls[i];i++){
+		cg_write(CGROUP_ROOT"/cgroup.subtree_control","%s",ctrls[i]);
+		cg_write(CGROUP_BASE"/cgroup.subtree_control","%s",ctrls[i]);
+	}
+	if((ifd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC))<0)
+		telog_warn("inotify init failed, usage is only read on request");
+	enabled=true;
+	return 0;
+}
+
+int svc_cgroup_fd(){
+	return ifd;
+}
+
+static void cg_watch(struct service*svc){
+	char path[PATH_MAX];
+	if(ifd<0||svc->cgroup_wd[0]>0)return;
+	if(cg_path(path,sizeof(path),svc,"cgroup.events")==0)
+		svc->cgroup_wd[0]=inotify_add_watch(ifd,path,IN_MODIFY);
+	if(cg_path(path,sizeof(path),svc,"memory.events")==0)
+		svc->cgroup_wd[1]=inotify_add_watch(ifd,path,IN_MODIFY);
+}
+
+int svc_cgroup_open(struct service*svc){
+	int fd;
+	char path[PATH_MAX];
+	if(!svc||!svc->name)ERET(EINVAL);
+	if(!enabled)ERET(ENOTSUP);
+	if(cg_path(path,sizeof(path),svc,NULL)!=0)ERET(ENAMETOOLONG);
+	if(mkdir(path,0755)!=0&&errno!=EEXIST)
+		return terlog_warn(-1,"create cgroup %s failed",path);
+
+	// limits may change between runs, write them every time
+	cg_path(path,sizeof(path),svc,"memory.max");
+	if(svc->memory_max>0)cg_write(path,"%lld",(long long)svc->memory_max);
+	else cg_write(path,"max");
+	cg_path(path,sizeof(path),svc,"cpu.max");
+	if(svc->cpu_max>0)cg_write(path,"%lld %d",(long long)svc->cpu_max*CPU_PERIOD/100,CPU_PERIOD);
+	else cg_write(path,"max %d",CPU_PERIOD);
+
+	cg_watch(svc);
+	cg_path(path,sizeof(path),svc,"cgroup.procs");
+	if((fd=open(path,O_WRONLY|O_CLOEXEC))<0)
+		return terlog_warn(-1,"open %s failed",path);
+	return fd;
+}
+
+int svc_cgroup_update(struct service*svc){
+	char path[PATH_MAX];
+	struct svc_usage u;
+	if(!svc||!svc->name)ERET(EINVAL);
+	if(!enabled)ERET(ENOTSUP);
+	if(cg_path(path,sizeof(path),svc,"cgroup.events")!=0)ERET(ENAMETOOLONG);
+	memset(&u,0,sizeof(u));
+	if(cg_read_keys(path,events_key,&u)!=0)return -1;
+	cg_path(path,sizeof(path),svc,"cpu.stat");
+	cg_read_keys(path,cpu_key,&u);
+	cg_path(path,sizeof(path),svc,"io.stat");
+	cg_read_keys(path,io_key,&u);
+	cg_path(path,sizeof(path),svc,"memory.events");
+	cg_read_keys(path,mem_key,&u);
+	cg_path(path,sizeof(path),svc,"memory.current");
+	u.mem_current=cg_read_u64(path);
+	cg_path(path,sizeof(path),svc,"memory.peak");
+	u.mem_peak=cg_read_u64(path);
+	u.valid=true;
+	memcpy(&svc->usage,&u,sizeof(u));
+	return 0;
+}
+
+static void cg_event(struct service*svc,bool memory){
+	char buf[64];
+	bool populated=svc->usage.populated;
+	uint64_t ooms=svc->usage.oom_kills;
+	if(svc_cgroup_update(svc)!=0)return;
+	if(memory&&svc->usage.oom_kills>ooms)tlog_warn(
+		"service %s hit memory limit, %llu processes killed",
+		svc->name,(unsigned long long)(svc->usage.oom_kills-ooms)
+	);
+	if(!memory&&populated&&!svc->usage.populated)tlog_debug(
+		"service %s cgroup empty, cpu %llums, peak memory %s",
+		svc->name,(unsigned long long)svc->usage.cpu_usec/1000,
+		make_readable_str_buf(buf,sizeof(buf),svc->usage.mem_peak,1,0)
+	);
+}
+
+int svc_cgroup_events(){
+	ssize_t r;
+	list*cur,*next;
+	struct inotify_event*e;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	if(ifd<0)ERET(EBADF);
+	while((r=read(ifd,buf,sizeof(buf)))>0){
+		for(char*p=buf;p<buf+r;p+=sizeof(struct inotify_event)+e->len){
+			e=(struct inotify_event*)p;
+			MUTEX_LOCK(services_lock);
+			if((next=list_first(services)))do{
+				cur=next;
+				LIST_DATA_DECLARE(s,cur,struct service*);
+				if(!s||e->wd<=0)continue;
+				if(s->cgroup_wd[0]==e->wd)cg_event(s,false);
+				else if(s->cgroup_wd[1]==e->wd)cg_event(s,true);
+				else continue;
+				break;
+			}while((next=cur->next));
+			MUTEX_UNLOCK(services_lock);
+		}
+	}
+	return 0;
+}
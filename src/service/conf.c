@@ -169,6 +169,10 @@ struct service*svc_conf_parse_service(
 		if(svc->pid_file)free(svc->pid_file);
 		svc->pid_file=t;
 	}
+	if((t=confd_get_string_base(key,"socket",NULL))){
+		if(svc->socket)free(svc->socket);
+		svc->socket=t;
+	}
 	svc->terminal_output_signal=confd_get_boolean_base(key,"termout_signal",svc->terminal_output_signal);
 	svc->stop_on_shutdown=confd_get_boolean_base(key,"stop_on_shutdown",svc->stop_on_shutdown);
 	svc->ignore_failed=confd_get_boolean_base(key,"ignore_failed",svc->ignore_failed);
@@ -176,6 +180,8 @@ struct service*svc_conf_parse_service(
 	svc->auto_restart=confd_get_boolean_base(key,"auto_restart",svc->auto_restart);
 	svc->stdio_syslog=confd_get_boolean_base(key,"stdio_syslog",svc->stdio_syslog);
 	svc->restart_max=confd_get_boolean_base(key,"restart_max",svc->restart_max);
+	svc->memory_max=confd_get_integer_base(key,"memory_max",svc->memory_max);
+	svc->cpu_max=(int)confd_get_integer_base(key,"cpu_max",svc->cpu_max);
 	if(work!=WORK_FAKE){
 		svc_conf_parse_exec(key,"restart",&svc->restart,svc,"restart");
 		svc_conf_parse_exec(key,"reload",&svc->reload,svc,"reload");
@@ -217,11 +223,39 @@ struct service*svc_conf_parse_service(
 }
 
 void svc_conf_parse_services(const char*base){
-	char**ss=confd_ls(base);
-	if(ss){
+	char**ss;
+	uint64_t hash=0;
+	list*parsed=NULL;
+	struct service*svc;
+	char*cache=confd_get_string("service.cache",NULL);
+
+	// same config as last boot, take everything from the cache in one read
+	if(cache&&confd_tree_hash(base,&hash)!=0){
+		telog_warn("hash services config failed");
+		free(cache);
+		cache=NULL;
+	}
+	if(cache){
+		if(svc_cache_load(cache,hash)==0){
+			free(cache);
+			return;
+		}
+		if(errno!=ENOENT)tlog_info("service cache %s outdated",cache);
+		if(!(parsed=list_new(NULL))){
+			free(cache);
+			cache=NULL;
+		}
+	}
+	if((ss=confd_ls(base))){
 		for(size_t i=0;ss[i];i++)
-			svc_conf_parse_service(base,ss[i],NULL);
+			if((svc=svc_conf_parse_service(base,ss[i],NULL))&&parsed)
+				list_obj_add_new_notnull(&parsed,svc);
 		if(ss[0])free(ss[0]);
 		free(ss);
 	}
+	if(cache){
+		svc_cache_save(cache,hash,parsed);
+		free(cache);
+	}
+	if(parsed)list_free_all(parsed,NULL);
 }
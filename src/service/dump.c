@@ -88,7 +88,7 @@ static int _svc_list_dump_simple(int ident,list*svcs){
 
 static int _svc_dump(int ident,struct service*svc){
 	if(!svc)ERET(EINVAL);
-	char prefix[BUFSIZ];
+	char prefix[BUFSIZ],buf[64];
 	int i;
 	for(i=0;i<ident&&i<BUFSIZ-1;i++)prefix[i]=' ';
 	prefix[i+1]=0;
@@ -105,6 +105,23 @@ static int _svc_dump(int ident,struct service*svc){
 	if(svc->restart_delay>0)tlog_debug("%s    restart delay:    %ld",    prefix,svc->restart_delay);
 	tlog_debug("%s    restart retry:    %d/%d",  prefix,svc->retry,svc->restart_max);
 	if(svc->pid_file)tlog_debug("%s    pid file:         %s",     prefix,svc->pid_file);
+	if(svc->socket)tlog_debug("%s    socket:           %s%s",   prefix,svc->socket,svc_socket_pending(svc)?" (waiting)":"");
+	if(svc->memory_max>0)tlog_debug("%s    memory max:       %s",     prefix,make_readable_str_buf(buf,sizeof(buf),svc->memory_max,1,0));
+	if(svc->cpu_max>0)tlog_debug("%s    cpu max:          %d%%",   prefix,svc->cpu_max);
+	if(svc_cgroup_update(svc)==0){
+		tlog_debug("%s    usage:",prefix);
+		tlog_debug("%s        populated:    %s",     prefix,BOOL2STR(svc->usage.populated));
+		tlog_debug("%s        cpu:          %llums (user %llums, system %llums)",prefix,
+			(unsigned long long)svc->usage.cpu_usec/1000,
+			(unsigned long long)svc->usage.cpu_user_usec/1000,
+			(unsigned long long)svc->usage.cpu_system_usec/1000
+		);
+		tlog_debug("%s        memory:       %s",     prefix,make_readable_str_buf(buf,sizeof(buf),svc->usage.mem_current,1,0));
+		if(svc->usage.mem_peak>0)tlog_debug("%s        memory peak:  %s",prefix,make_readable_str_buf(buf,sizeof(buf),svc->usage.mem_peak,1,0));
+		tlog_debug("%s        io read:      %s",     prefix,make_readable_str_buf(buf,sizeof(buf),svc->usage.io_rbytes,1,0));
+		tlog_debug("%s        io write:     %s",     prefix,make_readable_str_buf(buf,sizeof(buf),svc->usage.io_wbytes,1,0));
+		if(svc->usage.oom_kills>0)tlog_debug("%s        oom kills:    %llu",prefix,(unsigned long long)svc->usage.oom_kills);
+	}
 
 	if(svc->depends_on){
 		tlog_debug("%s    depend on:",prefix);
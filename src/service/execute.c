@@ -15,19 +15,45 @@
 #include<string.h>
 #include<stdlib.h>
 #include<pthread.h>
+#include<sched.h>
 #include<sys/un.h>
+#include<sys/mman.h>
 #include<sys/prctl.h>
 #include<sys/socket.h>
+#include<sys/syscall.h>
 #include"confd.h"
 #include"logger.h"
 #include"system.h"
 #include"service.h"
 #include"defines.h"
+#include"trace.h"
 #include"proctitle.h"
 #include"pathnames.h"
 #define TAG "service"
 
 #define EGOTO(err) {r=err;goto end;}
+#define SPAWN_STACK 0x10000
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U<<2)
+#endif
+#ifdef SYS_setresuid32
+#define SYS_SETRESUID SYS_setresuid32
+#define SYS_SETRESGID SYS_setresgid32
+#else
+#define SYS_SETRESUID SYS_setresuid
+#define SYS_SETRESGID SYS_setresgid
+#endif
+
+// activation socket of a command service, same as systemd
+#define LISTEN_FDS_START 3
+
+struct spawn_arg{
+	struct svc_exec*exec;
+	sigset_t mask;
+	int fd,sock,cg;
+	char**envp;
+	char pid_env[32];
+};
 
 static void write_close(int fd,int data){
 	write(fd,&data,sizeof(data));
@@ -59,9 +85,16 @@ static bool init_stdio(struct svc_exec*exec){
 	return true;
 }
 
-static void _run_exec_child(struct svc_exec*exec,int fd){
+// "0" moves the writer, so the child needs no pid and no allocation
+static void join_cgroup(int cg){
+	if(cg>=0&&write(cg,"0",1)!=1)cg=-1;
+}
+
+static void _run_exec_child(struct svc_exec*exec,int fd,int cg){
 	int r=0;
-	close_all_fd((int[]){fd},1);
+	int sock=exec->prop.svc->socket_fd;
+	join_cgroup(cg);
+	close_all_fd((int[]){fd,sock},2);
 	char name[BUFSIZ]={0};
 	snprintf(name,BUFSIZ-1,"Service %s executor",exec->prop.name);
 	prctl(PR_SET_NAME,name);
@@ -78,7 +111,7 @@ static void _run_exec_child(struct svc_exec*exec,int fd){
 			if(!exec->exec.func)EGOTO(EINVAL);
 			write_close(fd,0);
 			if(!init_stdio(exec))EGOTO(errno);
-			close_all_fd(NULL,0);
+			close_all_fd((int[]){sock},1);
 			reset_signals();
 			set_confd_socket(-1);
 			open_socket_logfd_default();
@@ -108,6 +141,106 @@ static void _run_exec_child(struct svc_exec*exec,int fd){
 	_exit(r);
 }
 
+// fds the command should not inherit, the error pipe stays open until execve
+static void spawn_close_fds(int first,int keep){
+	int fd,max_fd;
+	#ifdef SYS_close_range
+	if(syscall(SYS_close_range,first,~0U,CLOSE_RANGE_CLOEXEC)==0)return;
+	#endif
+	if((max_fd=get_max_fd())<0)return;
+	for(fd=first;fd>=0&&fd<=max_fd;fd++)if(fd!=keep)close(fd);
+}
+
+// move the activation socket to LISTEN_FDS_START, out of the way of the error pipe
+static int spawn_pass_socket(struct spawn_arg*a){
+	int fd;
+	if(a->fd==LISTEN_FDS_START){
+		if((fd=fcntl(a->fd,F_DUPFD_CLOEXEC,LISTEN_FDS_START+1))<0)return -1;
+		a->fd=fd;
+	}
+	if(a->sock==LISTEN_FDS_START){
+		if(fcntl(a->sock,F_SETFD,0)<0)return -1;
+	}else if(dup2(a->sock,LISTEN_FDS_START)<0)return -1;
+	snprintf(a->pid_env,sizeof(a->pid_env),"LISTEN_PID=%d",(int)getpid());
+	return 0;
+}
+
+/*
+ * child of spawn_exec, runs on the memory of the caller until execve,
+ * so it must not touch libc state: no malloc, no stdio, no setxid broadcast
+ */
+static int spawn_child(void*data){
+	int r;
+	struct sigaction sa;
+	struct spawn_arg*a=data;
+	struct svc_exec*exec=a->exec;
+	join_cgroup(a->cg);
+
+	// handlers of init must not run here, a default action is safe
+	for(int s=1;s<_NSIG;s++){
+		if(s==SIGKILL||s==SIGSTOP)continue;
+		if(sigaction(s,NULL,&sa)<0||sa.sa_handler==SIG_IGN)continue;
+		sa.sa_handler=SIG_DFL,sa.sa_flags=0;
+		sigaction(s,&sa,NULL);
+	}
+	if(
+		syscall(SYS_SETRESGID,exec->prop.gid,exec->prop.gid,exec->prop.gid)<0||
+		syscall(SYS_SETRESUID,exec->prop.uid,exec->prop.uid,exec->prop.uid)<0
+	)EGOTO(errno);
+	if(!init_stdio(exec))EGOTO(errno);
+	if(a->sock>=0&&spawn_pass_socket(a)!=0)EGOTO(errno);
+	spawn_close_fds(a->sock>=0?LISTEN_FDS_START+1:3,a->fd);
+	sigprocmask(SIG_SETMASK,&a->mask,NULL);
+	execvpe(
+		exec->exec.cmd.path,
+		exec->exec.cmd.args,
+		a->envp?:exec->exec.cmd.environ?:environ
+	);
+	r=errno;
+	end:
+	write(a->fd,&r,sizeof(r));
+	_exit(r);
+}
+
+// share the memory of init until execve, instead of copying all page tables
+static pid_t spawn_exec(struct svc_exec*exec,int fd,int cg){
+	pid_t p;
+	size_t n=0;
+	void*stack;
+	sigset_t all;
+	char**env=exec->exec.cmd.environ?:environ;
+	struct spawn_arg a={.exec=exec,.fd=fd,.cg=cg,.sock=exec->prop.svc->socket_fd};
+
+	// environment gets LISTEN_FDS and LISTEN_PID, the pid is filled by the child
+	if(a.sock>=0){
+		while(env&&env[n])n++;
+		if(!(a.envp=malloc(sizeof(char*)*(n+3))))return -1;
+		if(n>0)memcpy(a.envp,env,sizeof(char*)*n);
+		strcpy(a.pid_env,"LISTEN_PID=0");
+		a.envp[n]="LISTEN_FDS=1",a.envp[n+1]=a.pid_env,a.envp[n+2]=NULL;
+	}
+	stack=mmap(
+		NULL,SPAWN_STACK,PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK,-1,0
+	);
+	if(stack==MAP_FAILED){
+		if(a.envp)free(a.envp);
+		return -1;
+	}
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK,&all,&a.mask);
+	p=clone(
+		spawn_child,(char*)stack+SPAWN_STACK,
+		CLONE_VM|CLONE_VFORK|SIGCHLD,&a
+	);
+	int e=errno;
+	pthread_sigmask(SIG_SETMASK,&a.mask,NULL);
+	munmap(stack,SPAWN_STACK);
+	if(a.envp)free(a.envp);
+	errno=e;
+	return p;
+}
+
 int svc_run_exec(struct svc_exec*exec){
 	if(!exec||!exec->prop.svc)ERET(EINVAL);
 	if(
@@ -117,28 +250,38 @@ int svc_run_exec(struct svc_exec*exec){
 		getegid()!=0
 	)ERET(EPERM);
 	memset(&exec->status,0,sizeof(exec->status));
-	int ps[2];
-	if(pipe(ps)<0)return -errno;
-	pid_t p=fork();
+	int ps[2],cg;
+	bool spawn=exec->prop.type==TYPE_COMMAND&&exec->exec.cmd.path&&exec->exec.cmd.args;
+	if(pipe2(ps,O_CLOEXEC)<0)return -errno;
+	cg=svc_cgroup_open(exec->prop.svc);
+	pid_t p=spawn?spawn_exec(exec,ps[1],cg):fork();
 	if(p<0){
 		int e=errno;
 		close(ps[0]);
 		close(ps[1]);
+		if(cg>=0)close(cg);
 		ERET(e);
 	}
 	if(p==0){
-		_run_exec_child(exec,ps[1]);
+		_run_exec_child(exec,ps[1],cg);
 		return 0;
 	}
 	close(ps[1]);
+	if(cg>=0)close(cg);
 	exec->status.pid=p;
 	time(&exec->status.start);
 	exec->status.active=exec->status.start;
 	exec->status.running=true;
+	trace_async_begin(p,"exec","%s",exec->prop.name);
+	if(exec->prop.timeout>0)svc_timer_arm(TIMER_EXEC,exec,exec->prop.timeout*1000);
 	int e=0;
 	ssize_t re;
 	do{errno=0;re=read(ps[0],&e,sizeof(int));}while((errno==EINTR)&&re<=0);
-	if(re!=sizeof(int)){
+	close(ps[0]);
+
+	// the pipe closes on execve, so no error code means the command is running
+	if(spawn&&re==0&&errno==0)e=0;
+	else if(re!=sizeof(int)){
 		memset(&exec->status,0,sizeof(exec->status));
 		return -(errno==0?EFAULT:errno);
 	}
@@ -165,14 +308,19 @@ int svc_check_exec_timeout(struct svc_exec*exec){
 	if(
 		exec->prop.timeout<=0||
 		!exec->status.running||
-		exec->status.pid<=0||(
-			svc->status!=STATUS_STOPPING&&
-			svc->status!=STATUS_STARTING
-		)
+		exec->status.pid<=0
 	)return 0;
 	time_t cur;
 	time(&cur);
-	if(cur-exec->status.active<exec->prop.timeout)return 0;
+
+	// still running, check again later in case it changes into starting or stopping
+	if(
+		svc->status!=STATUS_STOPPING&&
+		svc->status!=STATUS_STARTING
+	)return svc_timer_arm(TIMER_EXEC,exec,exec->prop.timeout*1000);
+	if(cur-exec->status.active<exec->prop.timeout)return svc_timer_arm(
+		TIMER_EXEC,exec,(exec->prop.timeout-(cur-exec->status.active))*1000
+	);
 	exec->status.active=cur;
 	tlog_notice("Service %s timeout",exec->prop.name);
 	int sig=exec->status.timeout?SIGKILL:SIGTERM;
@@ -184,19 +332,7 @@ int svc_check_exec_timeout(struct svc_exec*exec){
 		if(exec==svc->restart&&exec->status.timeout)service_start(svc);
 	}
 	exec->status.timeout=true;
-	return 0;
-}
 
-int svc_check_all_exec_timeout(){
-	list*cur,*next=list_first(services);
-	if(next)do{
-		cur=next,next=cur->next;
-		LIST_DATA_DECLARE(s,cur,struct service*);
-		if(!s)continue;
-		svc_check_exec_timeout(s->start);
-		svc_check_exec_timeout(s->stop);
-		svc_check_exec_timeout(s->restart);
-		svc_check_exec_timeout(s->reload);
-	}while(next);
-	return 0;
+	// SIGKILL if it is still running after another timeout
+	return svc_timer_arm(TIMER_EXEC,exec,exec->prop.timeout*1000);
 }
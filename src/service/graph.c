@@ -0,0 +1,86 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<errno.h>
+#include<stdbool.h>
+#include"lock.h"
+#include"list.h"
+#include"logger.h"
+#include"service.h"
+#include"defines.h"
+#define TAG "service"
+
+// level of a service while walking the graph
+#define LEVEL_UNSEEN  -2
+#define LEVEL_WALKING -3
+
+// services and depends only change at boot, so the graph is built once and reused
+static bool graph_dirty=true;
+static mutex_t graph_lock=MUTEX_INITIALIZER;
+
+void svc_graph_invalidate(){
+	graph_dirty=true;
+}
+
+// level is the longest depends chain below a service, services of one level never depend on each other
+static int visit(struct service*svc){
+	list*cur,*next;
+	int level=0,l;
+	if(svc->level!=LEVEL_UNSEEN){
+		if(svc->level==LEVEL_WALKING){
+			tlog_error("Depends chain loop detect on %s",svc_get_desc(svc));
+			return -1;
+		}
+		return svc->level;
+	}
+	svc->level=LEVEL_WALKING;
+	if((next=list_first(svc->depends_on)))do{
+		cur=next;
+		if(!cur->data)continue;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if((l=visit(s))<0){
+			level=-1;
+			continue;
+		}
+		if(level>=0&&l+1>level)level=l+1;
+	}while((next=cur->next));
+	svc->level=level;
+	return level;
+}
+
+int svc_graph_update(){
+	list*cur,*next;
+	int levels=0,loops=0;
+	if(!graph_dirty)return 0;
+	MUTEX_LOCK(graph_lock);
+	if(!graph_dirty)goto done;
+	graph_dirty=false;
+	MUTEX_LOCK(services_lock);
+	if((next=list_first(services)))do{
+		cur=next;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if(s)s->level=LEVEL_UNSEEN;
+	}while((next=cur->next));
+	if((next=list_first(services)))do{
+		cur=next;
+		LIST_DATA_DECLARE(s,cur,struct service*);
+		if(!s)continue;
+		if(visit(s)<0)loops++;
+		else if(s->level+1>levels)levels=s->level+1;
+	}while((next=cur->next));
+	MUTEX_UNLOCK(services_lock);
+	tlog_debug("services graph has %d levels, %d services in loops",levels,loops);
+	done:
+	MUTEX_UNLOCK(graph_lock);
+	return 0;
+}
+
+bool svc_in_loop(struct service*svc){
+	svc_graph_update();
+	return svc&&svc->level==-1;
+}
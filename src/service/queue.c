@@ -39,28 +39,27 @@ int add_queue(struct service*svc,enum scheduler_action act){
 		}break;
 		default:;
 	}
+	if(act==SCHED_START&&svc_in_loop(svc)){
+		tlog_error("Service %s depends on itself",svc_get_desc(svc));
+		ERET(ELOOP);
+	}
 	MUTEX_LOCK(queue_lock);
-	if(!(next=list_first(queue)))goto unlock;
-	else do{
-		cur=next;
-		LIST_DATA_DECLARE(s,cur,struct scheduler_work*);
-		if(!s)continue;
-		if(s->service==svc){
-			MUTEX_UNLOCK(queue_lock);
-			ERET(EINPROGRESS);
-		}
-	}while((next=cur->next));
+	if(svc->queued){
+		MUTEX_UNLOCK(queue_lock);
+		ERET(EINPROGRESS);
+	}
 	struct scheduler_work*work=malloc(sizeof(struct scheduler_work));
 	if(!work){
 		telog_error("failed to create work");
 		goto unlock;
 	}
-	work->service=svc,work->action=act;
+	work->service=svc,work->action=act,work->dispatched=false;
 	if(list_obj_add_new_notnull(&queue,work)<0){
 		free(work);
 		telog_error("add work to queue failed");
 		goto unlock;
 	}
+	svc->queued=true;
 	MUTEX_UNLOCK(queue_lock);
 	int e=0;
 	switch(work->action){
@@ -92,7 +91,7 @@ int add_queue(struct service*svc,enum scheduler_action act){
 
 static bool task_can_run(struct scheduler_work*w){
 	list*cur,*next;
-	if(!w||!w->service)return false;
+	if(!w||!w->service||w->dispatched)return false;
 	switch(w->service->status){
 		case STATUS_STARTING:
 		case STATUS_STOPPING:return false;
@@ -133,6 +132,7 @@ static bool task_can_run(struct scheduler_work*w){
 	return true;
 }
 
+// every work with all depends done goes to the workers at once, they run in parallel
 int run_queue(){
 	list*cur,*next;
 	MUTEX_LOCK(queue_lock);
@@ -142,7 +142,8 @@ int run_queue(){
 	}else do{
 		cur=next;
 		LIST_DATA_DECLARE(w,cur,struct scheduler_work*);
-		if(task_can_run(w))pool_add(service_workers,scheduler_worker,w);
+		if(!task_can_run(w))continue;
+		if(pool_add(service_workers,scheduler_worker,w)==0)w->dispatched=true;
 	}while((next=cur->next));
 	MUTEX_UNLOCK(queue_lock);
 	return 0;
@@ -151,14 +152,15 @@ int run_queue(){
 int add_all_stop_queue(){
 	list*cur,*next;
 	MUTEX_LOCK(queue_lock);
-	if(!(next=list_first(queue))){
-		MUTEX_UNLOCK(queue_lock);
-		return -1;
-	}else do{
+
+	// drop pending works, but still queue the stops when nothing was pending
+	if((next=list_first(queue)))do{
 		cur=next,next=cur->next;
 		LIST_DATA_DECLARE(w,cur,struct scheduler_work*);
 		if(!w)continue;
-		if(w->action!=SCHED_STOP)list_obj_del(&queue,cur,free_scheduler_work);
+		if(w->action==SCHED_STOP||w->dispatched)continue;
+		w->service->queued=false;
+		list_obj_del(&queue,cur,free_scheduler_work);
 	}while(next);
 	MUTEX_UNLOCK(queue_lock);
 	if((next=list_first(services)))do{
@@ -8,6 +8,7 @@
 
 #define _GNU_SOURCE
 #include<signal.h>
+#include<stdint.h>
 #include<stdlib.h>
 #include<string.h>
 #include<pthread.h>
@@ -28,9 +29,113 @@ struct pool*service_workers=NULL;
 mutex_t queue_lock;
 list*queue=NULL;
 static pthread_t scheduler;
+static bool started=false;
 static mutex_t lock;
 static int fds[2];
 
+/*
+ * messages go through a bounded multi-producer ring, the socketpair only
+ * carries one wakeup per batch, and messages which find the ring full
+ */
+#define RING_SIZE 512
+#define BATCH_SIZE (RING_SIZE+64)
+
+struct sched_slot{
+	size_t seq;
+	struct scheduler_msg msg;
+};
+
+static struct sched_slot ring[RING_SIZE];
+static size_t ring_head=0,ring_tail=0;
+static bool ring_ready=false,wake_pending=false;
+
+#define LOAD(v) __atomic_load_n(&(v),__ATOMIC_ACQUIRE)
+#define STORE(v,n) __atomic_store_n(&(v),(n),__ATOMIC_RELEASE)
+#define CAS(v,o,n) __atomic_compare_exchange_n(&(v),&(o),(n),false,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED)
+#define XCHG(v,n) __atomic_exchange_n(&(v),(n),__ATOMIC_SEQ_CST)
+
+// lock free, so signal handlers may send messages too
+static bool ring_push(struct scheduler_msg*msg){
+	struct sched_slot*s;
+	size_t pos=LOAD(ring_tail);
+	while(1){
+		s=&ring[pos%RING_SIZE];
+		intptr_t diff=(intptr_t)LOAD(s->seq)-(intptr_t)pos;
+		if(diff==0&&CAS(ring_tail,pos,pos+1))break;
+		else if(diff<0)return false;
+		else if(diff>0)pos=LOAD(ring_tail);
+	}
+	memcpy(&s->msg,msg,sizeof(struct scheduler_msg));
+	STORE(s->seq,pos+1);
+	return true;
+}
+
+// only the scheduler thread pops
+static bool ring_pop(struct scheduler_msg*msg){
+	size_t pos=ring_head;
+	struct sched_slot*s=&ring[pos%RING_SIZE];
+	if(LOAD(s->seq)!=pos+1)return false;
+	memcpy(msg,&s->msg,sizeof(struct scheduler_msg));
+	ring_head=pos+1;
+	STORE(s->seq,pos+RING_SIZE);
+	return true;
+}
+
+static void ring_reset(){
+	for(size_t i=0;i<RING_SIZE;i++)ring[i].seq=i;
+	ring_head=0,ring_tail=0;
+}
+
+// collect everything sent since the last wakeup
+static size_t drain_messages(struct scheduler_msg*batch,bool*closed){
+	ssize_t s;
+	size_t cnt=0,i,n;
+	struct scheduler_msg buf[16];
+
+	// clear before draining, a later sender writes a new wakeup
+	__atomic_store_n(&wake_pending,false,__ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	do{
+		errno=0;
+		if((s=read(fds[0],buf,sizeof(buf)))<0){
+			if(errno==EINTR)continue;
+			if(errno!=EAGAIN)*closed=true;
+			break;
+		}
+		if(s==0){
+			*closed=true;
+			break;
+		}
+		for(n=s/sizeof(struct scheduler_msg),i=0;i<n&&cnt<BATCH_SIZE;i++)
+			if(buf[i].action!=SCHED_UNKNOWN)batch[cnt++]=buf[i];
+	}while(s==sizeof(buf)&&cnt<BATCH_SIZE);
+	while(cnt<BATCH_SIZE&&ring_pop(&batch[cnt]))cnt++;
+
+	// batch is full, come back for the rest without waiting
+	if(cnt>=BATCH_SIZE&&!XCHG(wake_pending,true)){
+		struct scheduler_msg wake={.action=SCHED_UNKNOWN};
+		write(fds[1],&wake,sizeof(wake));
+	}
+	return cnt;
+}
+
+// an action for a service which is already in this batch, with no stop all between
+static bool batch_dup(struct scheduler_msg*batch,size_t i){
+	struct scheduler_msg*m=&batch[i];
+	for(size_t j=i;j>0;j--){
+		struct scheduler_msg*p=&batch[j-1];
+		if(m->action==SCHED_STOP_ALL)switch(p->action){
+			case SCHED_STOP_ALL:return true;
+			case SCHED_TIMER:
+			case SCHED_DONE:continue;
+			default:return false;
+		}
+		if(p->action==SCHED_STOP_ALL)return false;
+		if(p->action==m->action&&p->data.service==m->data.service)return true;
+	}
+	return false;
+}
+
 int free_scheduler_work(void*d){
 	if(d)free((struct scheduler_work*)d);
 	return 0;
@@ -47,6 +152,7 @@ void*scheduler_worker(void*data){
 		LIST_DATA_DECLARE(s,cur,struct scheduler_work*);
 		if(s==w){
 			list_obj_del(&queue,cur,NULL);
+			w->service->queued=false;
 			found=true;
 		}
 	}while(next);
@@ -72,41 +178,11 @@ void*scheduler_worker(void*data){
 		default:;
 	}
 	free_scheduler_work(w);
-	return NULL;
-}
 
-static int seconds_handler(){
-	time_t cur_time;
-	time(&cur_time);
-	list*cur,*next;
-	if((next=list_first(services)))do{
-		cur=next,next=cur->next;
-		LIST_DATA_DECLARE(s,cur,struct service*);
-		if(!s)continue;
-		time_t finish_offset=cur_time-(s->process.finish);
-		time_t update_offset=cur_time-(s->last_update);
-		time_t reset_delay=MAX(1,s->restart_delay)*5;
-		if(
-			s->wait_restart&&
-			s->restart_delay>0&&
-			s->process.finish>0&&
-			finish_offset>(s->restart_delay)
-		){
-			tlog_notice(
-				"Trigger service %s auto restart times %d",
-				svc_get_desc(s),s->retry
-			);
-			s->wait_restart=false;
-			s->last_update=cur_time;
-			add_queue(s,SCHED_START);
-			continue;
-		}
-		if(
-			s->retry>0&&s->last_update>0&&
-			update_offset>reset_delay
-		)s->retry=0,s->last_update=cur_time;
-	}while(next);
-	return 0;
+	// works depending on this one may be ready now
+	struct scheduler_msg m={.action=SCHED_DONE};
+	oper_scheduler(&m);
+	return NULL;
 }
 
 static int scheduler_main(){
@@ -123,41 +199,57 @@ static int scheduler_main(){
 		return -1;
 	}
 	MUTEX_INIT(queue_lock);
+	svc_cgroup_init();
 	fd_set fs;
+	long next;
+	int cfd;
+	size_t cnt;
 	struct timeval tv;
-	struct scheduler_msg msg;
-	bool run=true;
-	while(run){
+	struct scheduler_msg*batch;
+	bool run=true,closed=false;
+	if(!(batch=malloc(sizeof(struct scheduler_msg)*BATCH_SIZE))){
+		telog_crit("failed to alloc message batch");
+		return -1;
+	}
+	while(run&&!closed){
 		FD_ZERO(&fs);
 		FD_SET(fds[0],&fs);
-		tv.tv_sec=1,tv.tv_usec=0;
-		if(select(FD_SETSIZE,&fs,NULL,NULL,&tv)<0){
+		if((cfd=svc_cgroup_fd())>=0)FD_SET(cfd,&fs);
+
+		// sleep until the first deadline, or until someone sends a message
+		if((next=svc_timer_next())>=0)tv.tv_sec=next/1000,tv.tv_usec=next%1000*1000;
+		if(select(FD_SETSIZE,&fs,NULL,NULL,next>=0?&tv:NULL)<0){
 			if(errno==EINTR)continue;
 			perror("select");
 			break;
 		}
-		seconds_handler();
-		run_queue();
+		if(svc_timer_run()>0)run_queue();
+		if(cfd>=0&&FD_ISSET(cfd,&fs))svc_cgroup_events();
 		if(!FD_ISSET(fds[0],&fs))continue;
-		errno=0;
-		ssize_t s=read(fds[0],&msg,sizeof(msg));
-		if(errno==EAGAIN)continue;
-		if(s<0&&errno!=EINTR)break;
-		if(s!=sizeof(msg))continue;
-		switch(msg.action){
-			case SCHED_EXIT:run=false;
-			case SCHED_UNKNOWN:break;
-			case SCHED_CHILD:svc_on_sigchld(msg.data.exit.pid,msg.data.exit.stat);break;
-			case SCHED_START:
-			case SCHED_STOP:
-			case SCHED_RELOAD:
-			case SCHED_RESTART:add_queue(msg.data.service,msg.action);break;
-			case SCHED_STOP_ALL:add_all_stop_queue();
-			default:;
+
+		// handle the whole batch in order, and look at the queue once
+		cnt=drain_messages(batch,&closed);
+		for(size_t i=0;i<cnt;i++){
+			struct scheduler_msg*msg=&batch[i];
+			switch(msg->action){
+				case SCHED_EXIT:run=false;
+				case SCHED_UNKNOWN:
+				case SCHED_TIMER:
+				case SCHED_DONE:break;
+				case SCHED_CHILD:svc_on_sigchld(msg->data.exit.pid,msg->data.exit.stat);break;
+				case SCHED_START:
+				case SCHED_STOP:
+				case SCHED_RELOAD:
+				case SCHED_RESTART:
+					if(!batch_dup(batch,i))add_queue(msg->data.service,msg->action);
+				break;
+				case SCHED_STOP_ALL:if(!batch_dup(batch,i))add_all_stop_queue();
+				default:;
+			}
 		}
-		run_queue();
-		memset(&msg,0,sizeof(struct scheduler_msg));
+		if(cnt>0)run_queue();
 	}
+	free(batch);
 	if(!run){
 		close(fds[0]);
 		close(fds[1]);
@@ -180,18 +272,35 @@ int start_scheduler(){
 	if(getpid()!=1)ERET(EACCES);
 	if(socketpair(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK,0,fds)<0)return -errno;
 	MUTEX_INIT(lock);
+	ring_reset();
+	ring_ready=true;
 	if(pthread_create(&scheduler,NULL,scheduler_thread,NULL)!=0)return -errno;
 	pthread_setname_np(scheduler,NAME);
+	started=true;
 	return 0;
 }
 
 int oper_scheduler(struct scheduler_msg*data){
+	struct scheduler_msg wake={.action=SCHED_UNKNOWN};
+	if(!data)ERET(EINVAL);
+	if(!ring_ready)ERET(ENOTCONN);
+	if(ring_push(data)){
+		// one wakeup for all messages until the scheduler drains them
+		if(XCHG(wake_pending,true))return 0;
+		data=&wake;
+	}
 	MUTEX_LOCK(lock);
 	write(fds[1],data,sizeof(struct scheduler_msg));
 	MUTEX_UNLOCK(lock);
 	return 0;
 }
 
+int scheduler_wakeup(){
+	if(!started||pthread_equal(scheduler,pthread_self()))return 0;
+	struct scheduler_msg m={.action=SCHED_TIMER};
+	return oper_scheduler(&m);
+}
+
 int stop_scheduler(){
 	struct scheduler_msg m;
 	m.action=SCHED_EXIT;
@@ -7,14 +7,19 @@
  */
 
 #define _GNU_SOURCE
+#include<time.h>
 #include<string.h>
 #include<stdlib.h>
+#include<unistd.h>
+#include<sys/un.h>
 #include"lock.h"
 #include"system.h"
 #include"logger.h"
 #include"service.h"
 #include"defines.h"
 #define TAG "service"
+#define STOP_POLL_MS 50
+#define STOP_POLL_RETRY 20
 
 bool auto_restart=false;
 struct service*svc_default,*svc_system,*svc_network;
@@ -37,6 +42,7 @@ int svc_add_depend(struct service*svc,struct service*dep){
 	MUTEX_UNLOCK(svc->lock);
 	MUTEX_UNLOCK(dep->lock);
 	time(&svc->last_update);
+	svc_graph_invalidate();
 	return 0;
 	fail:
 	if(errno==0)errno=ENOMEM;
@@ -55,6 +61,7 @@ int svc_add_service(struct service*svc){
 	int e;
 	list*l=list_new(svc);
 	if(!l)goto fail;
+	svc_graph_invalidate();
 	if(!services){
 		services=l;
 		return 0;
@@ -86,6 +93,18 @@ int svc_set_desc(struct service*svc,char*desc){
 	else return 0;
 }
 
+int svc_set_socket(struct service*svc,char*path){
+	if(!svc)ERET(EINVAL);
+	if(path&&strlen(path)>=sizeof(((struct sockaddr_un*)0)->sun_path))ERET(ENAMETOOLONG);
+	MUTEX_LOCK(svc->lock);
+	if(svc->socket)free(svc->socket);
+	svc->socket=path?strdup(path):NULL;
+	MUTEX_UNLOCK(svc->lock);
+	time(&svc->last_update);
+	if(!svc->socket&&path)ERET(ENOMEM);
+	else return 0;
+}
+
 int svc_set_name(struct service*svc,char*name){
 	if(!svc)ERET(EINVAL);
 	if(strlen(name)>64)ERET(ENAMETOOLONG);
@@ -98,12 +117,16 @@ int svc_set_name(struct service*svc,char*name){
 	else return 0;
 }
 
-int service_wait_all_stop(){
+// services stop in parallel through the queue, dependents before their depends
+int service_wait_all_stop_timeout(long ms){
+	list*cur,*next,*first;
+	bool complete=false,show=false;
+	struct timespec start,now;
+	long pass=0,spent;
 	auto_restart=false;
 	service_stop_all();
-	list*cur,*next,*first;
 	if(!services||!(first=list_first(services)))return 0;
-	bool complete=false,show=false;
+	clock_gettime(CLOCK_MONOTONIC,&start);
 	while(!complete){
 		next=first,complete=true;
 		do{
@@ -115,20 +138,49 @@ int service_wait_all_stop(){
 				case STATUS_STOPPED:
 				case STATUS_FAILED:break;
 				case STATUS_STARTED:
-				case STATUS_RUNNING:service_stop(s);//fallthrough
+				case STATUS_RUNNING:
+					// ask again from time to time, not on every poll
+					if(pass%STOP_POLL_RETRY==0)service_stop(s);
+					//fallthrough
 				case STATUS_STARTING:
 				case STATUS_STOPPING:complete=false;
 			}
 		}while(next);
-		if(!complete){
-			if(!show)tlog_notice("wait all services stop");
-			show=true;
-			xsleep(1);
-		}else tlog_info("all services stopped");
+		if(complete)break;
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		spent=(now.tv_sec-start.tv_sec)*1000+(now.tv_nsec-start.tv_nsec)/1000000;
+		if(ms>=0&&spent>=ms){
+			next=first;
+			do{
+				cur=next,next=cur->next;
+				LIST_DATA_DECLARE(s,cur,struct service*);
+				if(!s)continue;
+				switch(s->status){
+					case STATUS_UNKNOWN:
+					case STATUS_STOPPED:
+					case STATUS_FAILED:break;
+					default:tlog_warn(
+						"service %s still %s",
+						svc_get_desc(s),
+						svc_status_string(s->status)
+					);
+				}
+			}while(next);
+			tlog_warn("services stop timed out after %ldms",spent);
+			ERET(ETIMEDOUT);
+		}
+		if(!show)tlog_notice("wait all services stop");
+		show=true,pass++;
+		usleep(STOP_POLL_MS*1000);
 	}
+	tlog_info("all services stopped");
 	return 0;
 }
 
+int service_wait_all_stop(){
+	return service_wait_all_stop_timeout(-1);
+}
+
 int service_init(){
 	MUTEX_INIT(services_lock);
 	svc_default=svc_create_service("default",WORK_FAKE);
@@ -19,6 +19,8 @@
 #include"logger.h"
 #include"defines.h"
 #include"service.h"
+#include"led_status.h"
+#include"trace.h"
 #define TAG "service"
 
 static int svc_on_exit_main(struct service*svc,bool fail){
@@ -48,7 +50,11 @@ static int svc_on_exit_main(struct service*svc,bool fail){
 					}else if(svc->restart_delay==0){
 						tlog_notice("Trigger service %s auto restart times %d",name,svc->retry);
 						service_start(svc);
-					}else svc->wait_restart=true;
+					}else{
+						svc->wait_restart=true;
+						svc_timer_arm(TIMER_RESTART,svc,svc->restart_delay*1000);
+					}
+					svc_timer_arm(TIMER_RETRY,svc,MAX(1,svc->restart_delay)*5000);
 				}
 				if(svc->retry<0)svc->retry=0;
 			}
@@ -122,7 +128,8 @@ static int svc_exec_on_exit(pid_t p,struct svc_exec*exec,struct service*svc,int
 	int c;
 	MUTEX_LOCK(svc->lock);
 	if(exec)MUTEX_LOCK(exec->lock);
-	bool fail=false;
+	bool fail=false,failed;
+	enum svc_status old=svc->status;
 	if(WIFEXITED(st)){
 		c=WEXITSTATUS(st);
 		status->exit_code=c;
@@ -139,12 +146,18 @@ static int svc_exec_on_exit(pid_t p,struct svc_exec*exec,struct service*svc,int
 	}else goto finish;
 	time(&status->finish);
 	status->running=false;
+	trace_async_end(p,"exec","%s",exec?exec->prop.name:svc->start?svc->start->prop.name:svc->name);
+	if(exec)svc_timer_cancel(TIMER_EXEC,exec);
 	if(!exec)svc_on_exit_main(svc,fail);
 	else if(svc->start==exec)svc_on_exit_start(exec,svc,fail);
 	else if(svc->stop==exec)svc_on_exit_stop(exec,svc);
 	finish:
+	failed=old!=STATUS_FAILED&&svc->status==STATUS_FAILED;
 	MUTEX_UNLOCK(svc->lock);
 	if(exec)MUTEX_UNLOCK(exec->lock);
+
+	// confd is asked outside of the service lock
+	if(failed)led_status("failed");
 	return 0;
 }
 
@@ -17,6 +17,7 @@
 #include"system.h"
 #include"service.h"
 #include"defines.h"
+#include"trace.h"
 #include"pathnames.h"
 #define TAG "service"
 
@@ -83,8 +84,15 @@ int svc_start_service_nodep(struct service*svc){
 	if(check_start_service(svc)!=0)
 		return terlog_warn(errno,"start service %s",name);
 	MUTEX_LOCK(svc->lock);
+	if(svc_socket_pending(svc)){
+		tlog_notice("Service %s waits for connection on %s",name,svc->socket);
+		svc->status=STATUS_STARTED,errno=0;
+		MUTEX_UNLOCK(svc->lock);
+		return 0;
+	}
 	svc->status=STATUS_STARTING;
 	tlog_notice("Starting service %s",name);
+	trace_begin("service","start %s",svc->name);
 	if(svc->mode==WORK_FAKE)goto started;
 	if(!svc->start){
 		errno=ENOTSUP;
@@ -128,25 +136,16 @@ int svc_start_service_nodep(struct service*svc){
 	telog_warn("Start service %s failed",name);
 	svc->status=STATUS_FAILED;
 	done:
+	trace_end("service","start %s",svc->name);
 	MUTEX_UNLOCK(svc->lock);
 	return errno;
 }
 
-static int _svc_start_service(struct service*svc,list*chain){
+// depends graph has no loop below svc, so plain recursion always ends
+static int _svc_start_service(struct service*svc){
 	if(check_start_service(svc)!=0)return -errno;
 	if(svc->depends_on){
 		list*cur,*next;
-		if((next=list_first(chain)))do{
-			cur=next;
-			LIST_DATA_DECLARE(s,cur,struct service*);
-			if(s!=svc)continue;
-			tlog_error(
-				"Depends chain loop detect on %s",
-				svc_get_desc(svc)
-			);
-			ERET(ELOOP);
-		}while((next=cur->next));
-		if(list_push_new(chain,svc)!=0)return -errno;
 		int e=0;
 		if((next=list_first(svc->depends_on)))do{
 			cur=next;
@@ -154,7 +153,7 @@ static int _svc_start_service(struct service*svc,list*chain){
 			LIST_DATA_DECLARE(s,cur,struct service*);
 			if(check_start_service(s)!=0)continue;
 			errno=0;
-			if(_svc_start_service(s,chain)<0){
+			if(_svc_start_service(s)<0){
 				e=errno;
 				telog_error(
 					"Depend %s for %s start failed",
@@ -170,12 +169,10 @@ static int _svc_start_service(struct service*svc,list*chain){
 }
 
 int svc_start_service(struct service*svc){
-	list*l=list_new(NULL);
-	if(!l)return -errno;
-	_svc_start_service(svc,l);
-	int r=errno;
-	list_free_all(l,NULL);
-	return -(errno=r);
+	if(!svc)ERET(EINVAL);
+	if(svc_in_loop(svc))ERET(ELOOP);
+	_svc_start_service(svc);
+	return -errno;
 }
 
 int svc_start_service_by_name(char*name){
@@ -46,7 +46,7 @@ int svc_stop_service_nodep(struct service*svc){
 	tlog_notice("Stopping service %s",name);
 	enum svc_status old=svc->status;
 	svc->status=STATUS_STOPPING;
-	if(svc->mode==WORK_FAKE)goto stopped;
+	if(svc->mode==WORK_FAKE||svc_socket_pending(svc))goto stopped;
 	if(!svc->stop){
 		if(svc->mode==WORK_ONCE)goto stopped;
 		errno=ENOTSUP;
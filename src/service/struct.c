@@ -10,6 +10,7 @@
 #include<errno.h>
 #include<stdlib.h>
 #include<string.h>
+#include<unistd.h>
 #include<libgen.h>
 #include<stdbool.h>
 #include"list.h"
@@ -46,6 +47,7 @@ struct service*svc_new_service(char*name,enum svc_work mode){
 	svc->status=STATUS_STOPPED;
 	svc->stdio_syslog=true;
 	svc->stop_on_shutdown=true;
+	svc->socket_fd=-1;
 	return svc;
 	fail:
 	svc_free_service(svc);
@@ -83,6 +85,7 @@ static void _free_exec_cont(struct svc_exec*exec){
 
 void svc_free_exec(struct svc_exec*exec){
 	if(!exec)return;
+	svc_timer_forget(exec);
 	MUTEX_DESTROY(exec->lock);
 	_xfree(exec->prop.name);
 	_free_exec_cont(exec);
@@ -91,9 +94,12 @@ void svc_free_exec(struct svc_exec*exec){
 
 void svc_free_service(struct service*svc){
 	if(!svc)return;
+	svc_timer_forget(svc);
 	MUTEX_DESTROY(svc->lock);
 	_xfree(svc->name);
 	_xfree(svc->description);
+	_xfree(svc->socket);
+	if(svc->socket_fd>=0)close(svc->socket_fd);
 	list_free_all(svc->depends_on,NULL);
 	list_free_all(svc->depends_of,NULL);
 	svc_free_exec(svc->start);
@@ -0,0 +1,192 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<errno.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include<stdbool.h>
+#include"lock.h"
+#include"logger.h"
+#include"service.h"
+#include"defines.h"
+#include"service_scheduler.h"
+#define TAG "service"
+
+/*
+ * deadlines of all services in a min-heap, the scheduler sleeps until the first one.
+ * arming again bumps the owner sequence, so outdated entries are dropped when popped.
+ */
+struct timer_ent{
+	uint64_t due;
+	unsigned int seq;
+	enum svc_timer_kind kind;
+	void*owner;
+};
+
+static struct timer_ent*heap=NULL;
+static size_t heap_len=0,heap_size=0;
+static mutex_t timer_lock;
+static pid_t heap_pid=0;
+
+static uint64_t now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000+(uint64_t)ts.tv_nsec/1000000;
+}
+
+static unsigned int*owner_seq(enum svc_timer_kind kind,void*owner){
+	switch(kind){
+		case TIMER_RESTART:return &((struct service*)owner)->restart_timer;
+		case TIMER_RETRY:return &((struct service*)owner)->retry_timer;
+		case TIMER_EXEC:return &((struct svc_exec*)owner)->timer;
+		default:return NULL;
+	}
+}
+
+static void heap_swap(size_t a,size_t b){
+	struct timer_ent t=heap[a];
+	heap[a]=heap[b],heap[b]=t;
+}
+
+static void heap_up(size_t i){
+	for(size_t p;i>0&&heap[p=(i-1)/2].due>heap[i].due;i=p)heap_swap(i,p);
+}
+
+static void heap_down(size_t i){
+	for(size_t c;(c=i*2+1)<heap_len;i=c){
+		if(c+1<heap_len&&heap[c+1].due<heap[c].due)c++;
+		if(heap[i].due<=heap[c].due)break;
+		heap_swap(i,c);
+	}
+}
+
+// caller holds timer_lock
+static void heap_remove(size_t i){
+	heap[i]=heap[--heap_len];
+	if(i>=heap_len)return;
+	heap_up(i);
+	heap_down(i);
+}
+
+// caller holds timer_lock
+static bool heap_stale(struct timer_ent*e){
+	unsigned int*seq=owner_seq(e->kind,e->owner);
+	return !seq||*seq!=e->seq;
+}
+
+int svc_timer_arm(enum svc_timer_kind kind,void*owner,time_t delay_ms){
+	bool first;
+	unsigned int*seq;
+	struct timer_ent*e;
+	if(!owner||!(seq=owner_seq(kind,owner)))ERET(EINVAL);
+	MUTEX_LOCK(timer_lock);
+	if(heap_len>=heap_size){
+		size_t s=heap_size?heap_size*2:64;
+		if(!(e=realloc(heap,sizeof(struct timer_ent)*s))){
+			MUTEX_UNLOCK(timer_lock);
+			ERET(ENOMEM);
+		}
+		heap=e,heap_size=s,heap_pid=getpid();
+	}
+	e=&heap[heap_len++];
+	e->due=now_ms()+(uint64_t)MAX(0,delay_ms);
+	e->seq=++*seq,e->kind=kind,e->owner=owner;
+	heap_up(heap_len-1);
+	first=heap[0].owner==owner&&heap[0].kind==kind&&heap[0].seq==*seq;
+	MUTEX_UNLOCK(timer_lock);
+
+	// only wake the scheduler when it sleeps past the new deadline
+	if(first)scheduler_wakeup();
+	return 0;
+}
+
+void svc_timer_cancel(enum svc_timer_kind kind,void*owner){
+	unsigned int*seq;
+	if(!owner||!(seq=owner_seq(kind,owner)))return;
+	MUTEX_LOCK(timer_lock);
+	++*seq;
+	MUTEX_UNLOCK(timer_lock);
+}
+
+void svc_timer_forget(void*owner){
+	// forked executors free services too, but the heap belongs to the scheduler process
+	if(!owner||heap_pid!=getpid())return;
+	MUTEX_LOCK(timer_lock);
+	for(size_t i=0;i<heap_len;)
+		if(heap[i].owner==owner)heap_remove(i);
+		else i++;
+	MUTEX_UNLOCK(timer_lock);
+}
+
+long svc_timer_next(){
+	long r=-1;
+	uint64_t now;
+	MUTEX_LOCK(timer_lock);
+	while(heap_len>0&&heap_stale(&heap[0]))heap_remove(0);
+	if(heap_len>0){
+		now=now_ms();
+		r=heap[0].due>now?(long)(heap[0].due-now):0;
+	}
+	MUTEX_UNLOCK(timer_lock);
+	return r;
+}
+
+static void on_restart(struct service*s){
+	if(!s->wait_restart||s->restart_delay<=0)return;
+	tlog_notice(
+		"Trigger service %s auto restart times %d",
+		svc_get_desc(s),s->retry
+	);
+	s->wait_restart=false;
+	time(&s->last_update);
+	add_queue(s,SCHED_START);
+}
+
+static void on_retry(struct service*s){
+	time_t cur,reset_delay=MAX(1,s->restart_delay)*5,offset;
+	if(s->retry<=0||s->last_update<=0)return;
+	time(&cur);
+
+	// last_update moves on every change, wait again for the rest of the delay
+	if((offset=cur-s->last_update)<=reset_delay){
+		svc_timer_arm(TIMER_RETRY,s,(reset_delay-offset+1)*1000);
+		return;
+	}
+	s->retry=0,s->last_update=cur;
+}
+
+int svc_timer_run(){
+	int cnt=0;
+	uint64_t now=now_ms();
+	struct timer_ent e;
+	while(true){
+		MUTEX_LOCK(timer_lock);
+		while(heap_len>0&&heap_stale(&heap[0]))heap_remove(0);
+		if(heap_len<=0||heap[0].due>now){
+			MUTEX_UNLOCK(timer_lock);
+			break;
+		}
+		e=heap[0];
+		heap_remove(0);
+		MUTEX_UNLOCK(timer_lock);
+
+		// handlers may arm again, so they run without timer_lock
+		switch(e.kind){
+			case TIMER_RESTART:on_restart(e.owner);break;
+			case TIMER_RETRY:on_retry(e.owner);break;
+			case TIMER_EXEC:svc_check_exec_timeout(e.owner);break;
+			default:;
+		}
+		cnt++;
+	}
+	return cnt;
+}
@@ -8,6 +8,7 @@
 
 #define _GNU_SOURCE
 #include<errno.h>
+#include<stdint.h>
 #include<stdlib.h>
 #include<string.h>
 #include<unistd.h>
@@ -19,9 +20,67 @@
 #include"array.h"
 #include"str.h"
 
+/*
+ * builtins are found by a perfect hash built on the first lookup, which
+ * happens in main before any thread exists. the table is a power of two
+ * at least twice the command count, seeds are tried until no two
+ * commands share a slot, so a lookup hashes once and compares once.
+ * the command list depends on build options, building it here keeps
+ * it in step without a generator. the list is scanned as before when
+ * no seed fits.
+ */
+#define CMD_SEEDS 1024
+#define CMD_SLOTS_MAX 4096
+static struct shell_command**cmd_table=NULL;
+static uint32_t cmd_seed=0,cmd_mask=0;
+static bool cmd_ready=false;
+
+static uint32_t cmd_hash(const char*name,uint32_t seed){
+	uint32_t h=0x811C9DC5^seed;
+	for(size_t i=0;i<sizeof(((struct shell_command*)0)->name)&&name[i];i++)
+		h=(h^(unsigned char)name[i])*0x01000193;
+	return h^(h>>15);
+}
+
+static bool cmd_table_try(uint32_t seed){
+	uint32_t slot;
+	struct shell_command*cmd;
+	memset(cmd_table,0,sizeof(struct shell_command*)*(cmd_mask+1));
+	for(int i=0;(cmd=(struct shell_command*)shell_cmds[i]);i++){
+		if(!cmd->enabled)continue;
+		slot=cmd_hash(cmd->name,seed)&cmd_mask;
+		if(cmd_table[slot])return false;
+		cmd_table[slot]=cmd;
+	}
+	cmd_seed=seed;
+	return true;
+}
+
+static void cmd_table_build(void){
+	size_t cnt=0,size=16;
+	cmd_ready=true;
+	while(shell_cmds[cnt])cnt++;
+	while(size<cnt*2)size<<=1;
+	for(;size<=CMD_SLOTS_MAX;size<<=1){
+		if(!(cmd_table=malloc(sizeof(struct shell_command*)*size)))return;
+		cmd_mask=size-1;
+		for(uint32_t seed=0;seed<CMD_SEEDS;seed++)
+			if(cmd_table_try(seed))return;
+		free(cmd_table);
+		cmd_table=NULL;
+	}
+}
+
 struct shell_command*find_internal_cmd(char*name){
 	if(!name||strlen(name)<=0)EPRET(EINVAL);
 	struct shell_command*cmd;
+	if(!cmd_ready)cmd_table_build();
+	if(cmd_table){
+		cmd=cmd_table[cmd_hash(name,cmd_seed)&cmd_mask];
+		if(!cmd||strncmp(cmd->name,name,sizeof(cmd->name))!=0)EPRET(ENOENT);
+		errno=0;
+		return cmd;
+	}
 	for(int i=0;(cmd=(struct shell_command*)shell_cmds[i]);i++){
 		if(!cmd->enabled)continue;
 		if(strncmp(cmd->name,name,sizeof(cmd->name))!=0)continue;
@@ -60,18 +119,30 @@ int invoke_internal_cmd_nofork(struct shell_command*cmd,char**args){
 	return r;
 }
 
+int shell_start_internal(struct shell_command*cmd,char**args,pid_t*pid){
+	int r;
+	size_t cnt=0,n=0;
+	char**envp;
+	if(!cmd)ERET(EINVAL);
+
+	// the child runs as the command, not as init
+	while(environ[cnt])cnt++;
+	if(!(envp=malloc(sizeof(char*)*(cnt+1))))ERET(ENOMEM);
+	for(size_t i=0;i<cnt;i++)
+		if(strncmp(environ[i],"INIT_MAIN=",10)!=0)
+			envp[n++]=environ[i];
+	envp[n]=NULL;
+	r=shell_spawn_pid(_PATH_PROC_SELF"/exe",args,envp,pid);
+	free(envp);
+	return r;
+}
+
 int invoke_internal_cmd(struct shell_command*cmd,bool background,char**args){
 	if(!cmd)ERET(EINVAL);
 	if(cmd->fork){
-		pid_t p=fork();
-		switch(p){
-			case 0:break;
-			case -1:return ret_perror(errno,false,"%s: fork",TAG);
-			default:return background?0:wait_cmd(p);
-		}
-		unsetenv("INIT_MAIN");
-		execv(_PATH_PROC_SELF"/exe",args);
-		return -1;
+		pid_t p;
+		int r=shell_start_internal(cmd,args,&p);
+		return r!=0||background?r:wait_cmd(p);
 	}else return invoke_internal_cmd_nofork(cmd,args);
 }
 
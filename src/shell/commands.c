@@ -15,6 +15,7 @@ DECLARE_MAIN(bootmenu);
 DECLARE_MAIN(cd);
 DECLARE_MAIN(cat);
 DECLARE_MAIN(confctl);
+DECLARE_MAIN(confbench);
 DECLARE_MAIN(confget);
 DECLARE_MAIN(confset);
 DECLARE_MAIN(confdel);
@@ -34,6 +35,7 @@ DECLARE_MAIN(exit);
 DECLARE_MAIN(dumpinput);
 DECLARE_MAIN(findfs);
 DECLARE_MAIN(guiapp);
+DECLARE_MAIN(hash);
 DECLARE_MAIN(help);
 DECLARE_MAIN(hotplug);
 DECLARE_MAIN(init);
@@ -47,6 +49,8 @@ DECLARE_MAIN(loggerctl);
 DECLARE_MAIN(ls);
 DECLARE_MAIN(lsfd);
 DECLARE_MAIN(lsmod);
+DECLARE_MAIN(metrics);
+DECLARE_MAIN(microbench);
 DECLARE_MAIN(modprobe);
 DECLARE_MAIN(mountpoint);
 DECLARE_MAIN(uname);
@@ -87,6 +91,7 @@ const struct shell_command*shell_cmds[]={
 	DECLARE_CMD(true,  arch,        "Print system architecture")
 	DECLARE_CMD(true,  bootmenu,    "Boot Menu")
 	DECLARE_CMD(true,  confctl,     "Control config daemon")
+	DECLARE_CMD(true,  confbench,   "Benchmark config daemon")
 	DECLARE_CMD(true,  confget,     "Get config item")
 	DECLARE_CMD(true,  confset,     "Set config item")
 	DECLARE_CMD(true,  confdel,     "Delete config item")
@@ -106,6 +111,7 @@ const struct shell_command*shell_cmds[]={
 	DECLARE_CMD(true,  loggerctl,   "Control init logger daemon")
 	DECLARE_CMD(true,  dumpenv,     "Dump all environments variables to stdout")
 	DECLARE_CMD(true,  logdumpenv,  "Dump all environments variables to initloggerd")
+	DECLARE_CMD(false, hash,        "Remember or list full paths of commands")
 	DECLARE_CMD(true,  help,        "Show all shell builtin commands")
 	DECLARE_CMD(true,  hotplug,     "Init simple device hotplug notifier")
 	DECLARE_CMD(true,  init,        "Simple init")
@@ -115,6 +121,8 @@ const struct shell_command*shell_cmds[]={
 	DECLARE_CMD(true,  initloggerd, "Launch simple init logger daemon")
 	DECLARE_CMD(true,  ls,          "List directory contents")
 	DECLARE_CMD(false, lsfd,        "List shell open file descriptors")
+	DECLARE_CMD(true,  metrics,     "Print metrics of all daemons")
+	DECLARE_CMD(true,  microbench,  "Benchmark daemon hot paths")
 	DECLARE_CMD(true,  mountpoint,  "Check whether a directory or file is a mountpoint")
 	DECLARE_CMD(true,  uname,       "Print system information")
 	DECLARE_CMD(true,  unlink,      "Remove a directory entry (Direct call)")
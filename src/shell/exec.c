@@ -0,0 +1,252 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_READLINE
+#define _GNU_SOURCE
+#include<errno.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/wait.h>
+#include"shell_internal.h"
+#include"defines.h"
+#include"output.h"
+#include"array.h"
+#include"init.h"
+#include"str.h"
+
+/*
+ * redirections are done on the fds of the shell itself, saved before
+ * and put back after, so a builtin that runs in the shell and a spawned
+ * program see them the same way. a single command runs like before,
+ * stages of a pipeline and background jobs are started without waiting,
+ * builtins that never fork get a forked shell there so a full pipe
+ * cannot block the shell. background jobs are collected before each
+ * line.
+ */
+#define SAVE_MAX 16
+#define JOBS_MAX 64
+
+struct fd_saves{
+	size_t cnt;
+	struct{int fd,saved;}fds[SAVE_MAX];
+};
+
+static pid_t jobs[JOBS_MAX];
+
+void shell_reap_jobs(void){
+	int st;
+	for(size_t i=0;i<JOBS_MAX;i++){
+		if(jobs[i]<=0||waitpid(jobs[i],&st,WNOHANG)==0)continue;
+		if(shell_running)printf("[%d] done\n",jobs[i]);
+		jobs[i]=0;
+	}
+}
+
+static void add_job(pid_t p){
+	for(size_t i=0;i<JOBS_MAX;i++)if(jobs[i]<=0){
+		jobs[i]=p;
+		return;
+	}
+}
+
+static int save_fd(struct fd_saves*s,int fd){
+	for(size_t i=0;i<s->cnt;i++)if(s->fds[i].fd==fd)return 0;
+	if(s->cnt>=SAVE_MAX)ERET(EMFILE);
+	fflush(stdout);
+	fflush(stderr);
+	s->fds[s->cnt].fd=fd;
+	s->fds[s->cnt].saved=fcntl(fd,F_DUPFD_CLOEXEC,10);
+	if(s->fds[s->cnt].saved<0&&errno!=EBADF)return -1;
+	s->cnt++;
+	return 0;
+}
+
+static void restore_fds(struct fd_saves*s){
+	fflush(stdout);
+	fflush(stderr);
+	while(s->cnt>0){
+		s->cnt--;
+		if(s->fds[s->cnt].saved<0)close(s->fds[s->cnt].fd);
+		else{
+			dup2(s->fds[s->cnt].saved,s->fds[s->cnt].fd);
+			close(s->fds[s->cnt].saved);
+		}
+	}
+}
+
+static int move_fd(struct fd_saves*s,int from,int to){
+	if(from==to)return 0;
+	if(save_fd(s,to)<0)return -1;
+	return dup2(from,to)<0?-1:0;
+}
+
+static int apply_redirs(struct fd_saves*s,struct shell_redir*r){
+	int fd,flags,e;
+	for(;r;r=r->next){
+		if(r->type==REDIR_DUP){
+			if(strcmp(r->target,"-")==0){
+				if(save_fd(s,r->fd)<0)goto fail;
+				close(r->fd);
+				continue;
+			}
+			if((fd=parse_int(r->target,-1))<0)
+				return re_printf(1,"%s: %s: bad fd\n",TAG,r->target);
+			if(move_fd(s,fd,r->fd)<0)goto fail;
+			continue;
+		}
+		switch(r->type){
+			case REDIR_IN:flags=O_RDONLY;break;
+			case REDIR_OUT:flags=O_WRONLY|O_CREAT|O_TRUNC;break;
+			case REDIR_APPEND:flags=O_WRONLY|O_CREAT|O_APPEND;break;
+			default:continue;
+		}
+		if((fd=open(r->target,flags|O_CLOEXEC,0666))<0)goto fail;
+		e=move_fd(s,fd,r->fd);
+		close(fd);
+		if(e<0)goto fail;
+	}
+	return 0;
+	fail:
+	return re_err(1,"%s: %s",TAG,r->target);
+}
+
+// start one stage without waiting, exit code of a failed start in *code
+static pid_t start_cmd(char**argv,int*code){
+	pid_t p;
+	struct shell_command*cmd=NULL;
+	if(!contains_of(argv[0],strlen(argv[0]),'/'))cmd=find_internal_cmd(argv[0]);
+	if(cmd&&!cmd->fork){
+		if((p=fork())<0){
+			*code=re_err(126,"%s: fork",TAG);
+			return -1;
+		}
+		if(p==0){
+			int r=invoke_internal_cmd_nofork(cmd,argv);
+			fflush(NULL);
+			_exit(r);
+		}
+		return p;
+	}
+	*code=cmd?shell_start_internal(cmd,argv,&p):shell_start_external(argv,&p);
+	return *code==0?p:-1;
+}
+
+static int run_pipeline(struct shell_pipeline*pl,bool background){
+	struct fd_saves s={0};
+	struct shell_cmd*c;
+	pid_t pids[pl->cnt];
+	int in=-1,pfd[2],code=0,r=0;
+	size_t n=0;
+
+	// a single command in front runs like it always did
+	if(pl->cnt==1&&!background){
+		c=pl->cmds;
+		if((r=apply_redirs(&s,c->redirs))==0&&c->argv)r=run_cmd(c->argv,false);
+		restore_fds(&s);
+		return r;
+	}
+	for(c=pl->cmds;c;c=c->next){
+		pfd[0]=pfd[1]=-1;
+		if(c->next&&pipe2(pfd,O_CLOEXEC)<0){
+			r=re_err(1,"%s: pipe",TAG);
+			break;
+		}
+		pids[n]=-1,code=0;
+		if(in>=0&&move_fd(&s,in,STDIN_FILENO)<0)code=1;
+		if(pfd[1]>=0&&move_fd(&s,pfd[1],STDOUT_FILENO)<0)code=1;
+		if(code==0&&(code=apply_redirs(&s,c->redirs))==0&&c->argv)
+			pids[n]=start_cmd(c->argv,&code);
+		n++;
+		restore_fds(&s);
+		if(in>=0)close(in);
+		if(pfd[1]>=0)close(pfd[1]);
+		in=pfd[0];
+	}
+	if(in>=0)close(in);
+	for(size_t i=0;i<n;i++){
+		if(pids[i]<=0)continue;
+		if(background){
+			add_job(pids[i]);
+			if(shell_running&&i==n-1)printf("[%d]\n",pids[i]);
+		}else if(i==n-1)code=wait_cmd(pids[i]);
+		else wait_cmd(pids[i]);
+	}
+	return r?r:background?0:code;
+}
+
+int shell_eval(const char*src,char**params,int nparams){
+	struct shell_pipeline*pl;
+	struct shell_parser p={
+		.p=src,.expand=false,
+		.params=params,.nparams=nparams,
+	};
+	enum shell_op op=OP_SEQ;
+	if(!src)return 0;
+	shell_reap_jobs();
+
+	// check the syntax of everything first
+	while((pl=shell_parse_pipeline(&p))){
+		op=pl->op;
+		shell_free_pipeline(pl);
+	}
+	if(!p.err&&(op==OP_AND||op==OP_OR)){
+		fprintf(stderr,"%s: syntax error near end of input\n",TAG);
+		p.err=EINVAL;
+	}
+	if(p.err)return exit_code=2;
+
+	p.p=src,p.expand=true,op=OP_SEQ;
+	while((pl=shell_parse_pipeline(&p))){
+		if(
+			op==OP_SEQ||op==OP_BG||
+			(op==OP_AND&&exit_code==0)||
+			(op==OP_OR&&exit_code!=0)
+		)exit_code=run_pipeline(pl,pl->op==OP_BG);
+		op=pl->op;
+		shell_free_pipeline(pl);
+	}
+	if(p.err)exit_code=2;
+	return exit_code;
+}
+
+int shell_run_file(const char*path,char**params,int nparams){
+	int fd,r;
+	char*buf=NULL,*n;
+	size_t len=0,cap=0;
+	ssize_t s;
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))<0)
+		return re_err(127,"%s: %s",TAG,path);
+	for(;;){
+		if(len+4096>cap){
+			if(!(n=realloc(buf,cap+65536))){
+				r=re_err(2,"%s: %s",TAG,path);
+				goto done;
+			}
+			buf=n,cap+=65536;
+		}
+		if((s=read(fd,buf+len,cap-len-1))<0){
+			if(errno==EINTR)continue;
+			r=re_err(2,"%s: %s",TAG,path);
+			goto done;
+		}
+		if(s==0)break;
+		len+=s;
+	}
+	buf[len]=0;
+
+	// the interpreter line is a comment anyway
+	r=shell_eval(buf,params,nparams);
+	done:
+	close(fd);
+	if(buf)free(buf);
+	return r;
+}
+#endif
@@ -6,11 +6,14 @@
  *
  */
 
+#include<errno.h>
 #include<stdio.h>
+#include<stdint.h>
 #include<stdlib.h>
 #include<stdbool.h>
 #include<string.h>
 #include<unistd.h>
+#include<spawn.h>
 #include<sys/stat.h>
 #include"shell_internal.h"
 #include"defines.h"
@@ -31,39 +34,161 @@ static int ext_errno(){
 	}
 }
 
-static int exec_cmd(char*path,char**argv){
+/*
+ * commands are started with posix_spawn, glibc runs it as a vfork like
+ * clone, so a shell inside a big process (the gui, loggerd) does not
+ * copy its page tables for every command. exec failures come back as
+ * the return value instead of from a child.
+ */
+int shell_spawn_pid(const char*path,char**argv,char**envp,pid_t*pid){
 	int r;
-	errno=0;
-	execv(path,argv);
-	if((r=ext_errno())!=0)perror(argv[0]);
-	_exit(r);
+	if((r=posix_spawn(pid,path,NULL,NULL,argv,envp?envp:environ))!=0){
+		errno=r;
+		if((r=ext_errno())!=0)perror(argv[0]);
+		return r;
+	}
+	return 0;
 }
 
-int run_external_cmd(char**argv,bool background){
-	if(!argv||!argv[0])ERET(EINVAL);
-	char cp[PATH_MAX],*paths;
+int shell_spawn(const char*path,char**argv,char**envp,bool background){
+	pid_t p;
+	int r=shell_spawn_pid(path,argv,envp,&p);
+	return r!=0||background?r:wait_cmd(p);
+}
+
+/*
+ * like the hash of bash, a name found in PATH is remembered with its
+ * full path, a change of PATH forgets all of them. a remembered path
+ * that fails stat is forgotten and searched again, so a hit costs no
+ * syscall before the stat every command needs.
+ */
+#define HASH_BUCKETS 64
+struct path_hash{
+	uint32_t hash;
+	unsigned int hits;
+	char*name,*path;
+	struct path_hash*next;
+};
+static struct path_hash*path_table[HASH_BUCKETS];
+static char*path_env=NULL;
+
+static uint32_t name_hash(const char*name){
+	uint32_t h=0x811C9DC5;
+	for(;*name;name++)h=(h^(unsigned char)*name)*0x01000193;
+	return h;
+}
+
+void shell_hash_clear(void){
+	struct path_hash*e,*n;
+	for(size_t i=0;i<HASH_BUCKETS;i++){
+		for(e=path_table[i];e;e=n){
+			n=e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+		}
+		path_table[i]=NULL;
+	}
+}
+
+static const char*get_path_env(void){
+	const char*paths=getenv("PATH");
+	if(!paths)paths=_PATH_DEFAULT_PATH;
+	if(!path_env||strcmp(path_env,paths)!=0){
+		shell_hash_clear();
+		if(path_env)free(path_env);
+		path_env=strdup(paths);
+	}
+	return paths;
+}
+
+static struct path_hash**hash_find(const char*name,uint32_t h){
+	struct path_hash**p=&path_table[h%HASH_BUCKETS];
+	for(;*p;p=&(*p)->next)
+		if((*p)->hash==h&&strcmp((*p)->name,name)==0)break;
+	return p;
+}
+
+void shell_hash_forget(const char*name){
+	struct path_hash**p=hash_find(name,name_hash(name)),*e;
+	if(!(e=*p))return;
+	*p=e->next;
+	free(e->name);
+	free(e->path);
+	free(e);
+}
+
+static void hash_add(const char*name,const char*path){
+	uint32_t h=name_hash(name);
+	struct path_hash*e;
+	if(*hash_find(name,h)||!(e=malloc(sizeof(struct path_hash))))return;
+	memset(e,0,sizeof(struct path_hash));
+	if(!(e->name=strdup(name))||!(e->path=strdup(path))){
+		if(e->name)free(e->name);
+		free(e);
+		return;
+	}
+	e->hash=h;
+	e->next=path_table[h%HASH_BUCKETS];
+	path_table[h%HASH_BUCKETS]=e;
+}
+
+static bool search_path(const char*paths,const char*name,char*cp){
+	bool exists=false;
+	char**ps=args2array((char*)paths,':');
 	memset(cp,0,PATH_MAX);
-	strncpy(cp,argv[0],PATH_MAX-1);
-	if(!contains_of(cp,PATH_MAX,'/')){
-		bool exists=false;
-		if(!(paths=getenv("PATH")))paths=_PATH_DEFAULT_PATH;
-		memset(cp,0,PATH_MAX);
-		char**ps=args2array(paths,':');
-		if(!ps){
-			snprintf(cp,PATH_MAX-1,"%s/%s",paths,argv[0]);
-			exists=access(cp,F_OK)==0;
-		}else{
-			char*p;
-			for(int i=0;(p=ps[i]);i++){
-				snprintf(cp,PATH_MAX-1,"%s/%s",p,argv[0]);
-				if((exists=access(cp,F_OK)==0))break;
-				memset(cp,0,PATH_MAX);
-			}
-			free_args_array(ps);
+	if(!ps){
+		snprintf(cp,PATH_MAX-1,"%s/%s",paths,name);
+		exists=access(cp,F_OK)==0;
+	}else{
+		char*p;
+		for(int i=0;(p=ps[i]);i++){
+			snprintf(cp,PATH_MAX-1,"%s/%s",p,name);
+			if((exists=access(cp,F_OK)==0))break;
+			memset(cp,0,PATH_MAX);
 		}
-		if(!exists)return re_printf(127,"%s: not found\n",argv[0]);
+		free_args_array(ps);
 	}
+	return exists;
+}
+
+int shell_hash_lookup(const char*name,char*cp,bool remember){
+	const char*paths;
+	struct path_hash*e;
+	if(!name||!cp||contains_of(name,strlen(name),'/'))ERET(EINVAL);
+	paths=get_path_env();
+	if((e=*hash_find(name,name_hash(name)))){
+		strncpy(cp,e->path,PATH_MAX-1);
+		cp[PATH_MAX-1]=0;
+		if(remember)e->hits++;
+		return 0;
+	}
+	if(!search_path(paths,name,cp))ERET(ENOENT);
+	hash_add(name,cp);
+	if(remember&&(e=*hash_find(name,name_hash(name))))e->hits++;
+	return 0;
+}
+
+void shell_hash_foreach(void(*cb)(const char*name,const char*path,unsigned int hits)){
+	get_path_env();
+	for(size_t i=0;i<HASH_BUCKETS;i++)
+		for(struct path_hash*e=path_table[i];e;e=e->next)
+			cb(e->name,e->path,e->hits);
+}
+
+int shell_start_external(char**argv,pid_t*pid){
+	if(!argv||!argv[0])ERET(EINVAL);
+	char cp[PATH_MAX];
+	memset(cp,0,PATH_MAX);
+	strncpy(cp,argv[0],PATH_MAX-1);
+	if(!contains_of(cp,PATH_MAX,'/')&&shell_hash_lookup(argv[0],cp,true)!=0)
+		return re_printf(127,"%s: not found\n",argv[0]);
 	struct stat st;
+	if(stat(cp,&st)!=0&&!contains_of(argv[0],strlen(argv[0]),'/')){
+		shell_hash_forget(argv[0]);
+		if(shell_hash_lookup(argv[0],cp,false)!=0)
+			return re_printf(127,"%s: not found\n",argv[0]);
+	}
 	if(stat(cp,&st)!=0){
 		perror(argv[0]);
 		return ext_errno();
@@ -74,10 +199,11 @@ int run_external_cmd(char**argv,bool background){
 		if(errno==0)errno=EACCES;
 		return re_err(ext_errno(),"%s",argv[0]);
 	}
-	pid_t p=fork();
-	switch(p){
-		case -1:return re_err(errno,"%s: fork",TAG);
-		case 0:return exec_cmd(cp,argv);
-		default:return background?0:wait_cmd(p);
-	}
+	return shell_spawn_pid(cp,argv,NULL,pid);
+}
+
+int run_external_cmd(char**argv,bool background){
+	pid_t p;
+	int r=shell_start_external(argv,&p);
+	return r!=0||background?r:wait_cmd(p);
 }
@@ -0,0 +1,296 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#ifdef ENABLE_READLINE
+#define _GNU_SOURCE
+#include<errno.h>
+#include<ctype.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include"shell_internal.h"
+#include"defines.h"
+
+/*
+ * a small subset of sh: words with '' "" and \ quoting, $NAME ${NAME}
+ * $? $$ $# $0-$9 and a leading ~, pipelines with |, the operators ; &&
+ * || & and newline, redirections < > >> N> N< N>&M N<&M and N>&- and
+ * comments. one pipeline is parsed at a time right before it runs, so
+ * $? sees the pipeline in front of it. expansions are not split into
+ * more words. with expand off only the syntax is checked, a whole
+ * line is checked before any of it runs.
+ */
+enum shell_token{
+	T_END,
+	T_ERROR,
+	T_WORD,
+	T_NL,
+	T_SEQ,
+	T_BG,
+	T_PIPE,
+	T_AND,
+	T_OR,
+	T_REDIR,
+};
+
+struct sbuf{
+	char*buf;
+	size_t len,cap;
+};
+
+static bool sb_putc(struct sbuf*sb,char c){
+	char*n;
+	if(sb->len+2>sb->cap){
+		if(!(n=realloc(sb->buf,sb->cap+64)))return false;
+		sb->buf=n,sb->cap+=64;
+	}
+	sb->buf[sb->len++]=c;
+	sb->buf[sb->len]=0;
+	return true;
+}
+
+static bool sb_puts(struct sbuf*sb,const char*s){
+	if(s)while(*s)if(!sb_putc(sb,*s++))return false;
+	return true;
+}
+
+static bool is_meta(char c){
+	switch(c){
+		case 0:case ' ':case '\t':case '\n':
+		case '|':case '&':case ';':case '<':case '>':return true;
+		default:return false;
+	}
+}
+
+static bool is_name(char c,bool first){
+	return c=='_'||isalpha((unsigned char)c)||(!first&&isdigit((unsigned char)c));
+}
+
+// expand the parameter after a $, false for a lone $
+static bool expand_param(struct shell_parser*p,struct sbuf*sb){
+	char name[256],num[16],*v=NULL;
+	const char*s=p->p+1;
+	size_t l=0;
+	bool brace=false;
+	if(*s=='{')brace=true,s++;
+	if(*s=='?'||*s=='$'||*s=='#'||isdigit((unsigned char)*s))name[l++]=*s++;
+	else while(is_name(*s,l==0)&&l<sizeof(name)-1)name[l++]=*s++;
+	if(l==0)return false;
+	if(brace){
+		if(*s!='}')return false;
+		s++;
+	}
+	name[l]=0,p->p=s;
+	if(!p->expand)return true;
+	if(l==1&&!is_name(name[0],true)){
+		switch(name[0]){
+			case '?':snprintf(num,sizeof(num),"%d",exit_code);v=num;break;
+			case '$':snprintf(num,sizeof(num),"%d",getpid());v=num;break;
+			case '#':snprintf(num,sizeof(num),"%d",MAX(p->nparams-1,0));v=num;break;
+			default:if(name[0]-'0'<p->nparams)v=p->params[name[0]-'0'];
+		}
+	}else v=getenv(name);
+	if(!sb_puts(sb,v))p->err=ENOMEM;
+	return true;
+}
+
+// one token, a word goes to sb, a redirection sets *redir
+static enum shell_token next_token(struct shell_parser*p,struct sbuf*sb,struct shell_redir*redir,bool*drop){
+	const char*s;
+	bool quoted=false,expanded=false;
+	char q;
+	sb->len=0;
+	if(sb->buf)sb->buf[0]=0;
+	for(;;){
+		while(*p->p==' '||*p->p=='\t')p->p++;
+		if(*p->p=='\\'&&p->p[1]=='\n'){
+			p->p+=2;
+			continue;
+		}
+		if(*p->p=='#')while(*p->p&&*p->p!='\n')p->p++;
+		break;
+	}
+	s=p->p;
+	switch(*s){
+		case 0:return T_END;
+		case '\n':p->p++;return T_NL;
+		case ';':p->p++;return T_SEQ;
+		case '|':
+			if(s[1]=='|'){p->p+=2;return T_OR;}
+			p->p++;return T_PIPE;
+		case '&':
+			if(s[1]=='&'){p->p+=2;return T_AND;}
+			p->p++;return T_BG;
+		default:;
+	}
+
+	// redirection with an optional fd number in front
+	while(isdigit((unsigned char)*s))s++;
+	if(*s=='<'||*s=='>'){
+		memset(redir,0,sizeof(struct shell_redir));
+		redir->fd=s==p->p?(*s=='<'?0:1):atoi(p->p);
+		if(s[0]=='>'&&s[1]=='>')redir->type=REDIR_APPEND,s+=2;
+		else if(s[1]=='&')redir->type=REDIR_DUP,s+=2;
+		else redir->type=*s=='<'?REDIR_IN:REDIR_OUT,s++;
+		p->p=s;
+		return T_REDIR;
+	}
+
+	*drop=false;
+	if(*p->p=='~'&&(p->p[1]=='/'||is_meta(p->p[1]))){
+		if(p->expand&&!sb_puts(sb,getenv("HOME")))p->err=ENOMEM;
+		p->p++,expanded=true;
+	}
+	while(!is_meta(*p->p)&&!p->err){
+		switch(*p->p){
+			case '\'':
+				quoted=true,p->p++;
+				while(*p->p&&*p->p!='\'')if(!sb_putc(sb,*p->p++))p->err=ENOMEM;
+				if(!*p->p){
+					fprintf(stderr,"%s: unterminated quote\n",TAG);
+					return T_ERROR;
+				}
+				p->p++;
+			break;
+			case '"':
+				quoted=true,q=*p->p++;
+				while(*p->p&&*p->p!=q&&!p->err){
+					if(*p->p=='\\'&&strchr("$`\"\\\n",p->p[1])){
+						if(p->p[1]!='\n'&&!sb_putc(sb,p->p[1]))p->err=ENOMEM;
+						p->p+=2;
+					}else if(*p->p=='$'&&expand_param(p,sb))continue;
+					else if(!sb_putc(sb,*p->p++))p->err=ENOMEM;
+				}
+				if(!*p->p){
+					fprintf(stderr,"%s: unterminated quote\n",TAG);
+					return T_ERROR;
+				}
+				p->p++;
+			break;
+			case '\\':
+				quoted=true,p->p++;
+				if(*p->p=='\n')p->p++;
+				else if(*p->p&&!sb_putc(sb,*p->p++))p->err=ENOMEM;
+			break;
+			case '$':
+				if(expand_param(p,sb)){
+					expanded=true;
+					break;
+				}
+				// fallthrough
+			default:if(!sb_putc(sb,*p->p++))p->err=ENOMEM;
+		}
+	}
+	if(p->err)return T_ERROR;
+
+	// a word that only was an empty expansion is no word
+	*drop=expanded&&!quoted&&sb->len==0;
+	return T_WORD;
+}
+
+static void free_command(struct shell_cmd*cmd){
+	struct shell_redir*r,*n;
+	if(!cmd)return;
+	if(cmd->argv){
+		for(size_t i=0;i<cmd->argc;i++)free(cmd->argv[i]);
+		free(cmd->argv);
+	}
+	for(r=cmd->redirs;r;r=n){
+		n=r->next;
+		if(r->target)free(r->target);
+		free(r);
+	}
+	free(cmd);
+}
+
+void shell_free_pipeline(struct shell_pipeline*pl){
+	struct shell_cmd*c,*n;
+	if(!pl)return;
+	for(c=pl->cmds;c;c=n)n=c->next,free_command(c);
+	free(pl);
+}
+
+static bool add_arg(struct shell_cmd*cmd,const char*word){
+	char**argv;
+	if(!(argv=realloc(cmd->argv,sizeof(char*)*(cmd->argc+2))))return false;
+	cmd->argv=argv;
+	if(!(argv[cmd->argc]=strdup(word)))return false;
+	argv[++cmd->argc]=NULL;
+	return true;
+}
+
+static int syntax_error(struct shell_parser*p,const char*near){
+	fprintf(stderr,"%s: syntax error near %s\n",TAG,near);
+	return p->err=EINVAL;
+}
+
+struct shell_pipeline*shell_parse_pipeline(struct shell_parser*p){
+	struct shell_pipeline*pl=NULL;
+	struct shell_cmd*cmd=NULL,**tail=NULL;
+	struct shell_redir redir,*r,**rt;
+	struct sbuf sb={NULL,0,0};
+	enum shell_token t;
+	bool drop=false,want=false;
+	if(p->err)return NULL;
+
+	// empty statements and blank lines in front
+	do{t=next_token(p,&sb,&redir,&drop);}while(t==T_NL||t==T_SEQ);
+	if(t==T_END)goto done;
+	if(!(pl=calloc(1,sizeof(struct shell_pipeline))))EDONE(p->err=ENOMEM);
+	tail=&pl->cmds;
+	for(;;){
+		switch(t){
+			case T_ERROR:if(!p->err)p->err=EINVAL;goto done;
+			case T_WORD:case T_REDIR:
+				if(!cmd){
+					if(!(cmd=calloc(1,sizeof(struct shell_cmd))))EDONE(p->err=ENOMEM);
+					*tail=cmd,tail=&cmd->next,pl->cnt++;
+				}
+				want=false;
+				if(t==T_WORD){
+					if(!drop&&!add_arg(cmd,sb.buf?sb.buf:""))EDONE(p->err=ENOMEM);
+					break;
+				}
+				if(next_token(p,&sb,&redir,&drop)!=T_WORD){
+					if(!p->err)syntax_error(p,"redirection");
+					goto done;
+				}
+				if(!(r=malloc(sizeof(struct shell_redir))))EDONE(p->err=ENOMEM);
+				*r=redir,r->next=NULL;
+				if(!(r->target=strdup(sb.buf?sb.buf:""))){
+					free(r);
+					EDONE(p->err=ENOMEM);
+				}
+				for(rt=&cmd->redirs;*rt;rt=&(*rt)->next);
+				*rt=r;
+			break;
+			case T_PIPE:
+				if(!cmd)EDONE(syntax_error(p,"|"));
+				cmd=NULL,want=true;
+				do{t=next_token(p,&sb,&redir,&drop);}while(t==T_NL);
+			continue;
+			case T_END:case T_NL:case T_SEQ:case T_BG:case T_AND:case T_OR:
+				if(!cmd||want)EDONE(syntax_error(p,t==T_END?"end of input":"operator"));
+				pl->op=t==T_BG?OP_BG:t==T_AND?OP_AND:t==T_OR?OP_OR:OP_SEQ;
+				if(t==T_END)pl->op=OP_END;
+			goto done;
+			default:EDONE(syntax_error(p,"token"));
+		}
+		t=next_token(p,&sb,&redir,&drop);
+	}
+	done:
+	if(sb.buf)free(sb.buf);
+	if(p->err&&pl){
+		shell_free_pipeline(pl);
+		pl=NULL;
+	}
+	return pl;
+}
+
+#endif
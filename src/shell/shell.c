@@ -14,6 +14,11 @@
 #include<signal.h>
 #include<sys/prctl.h>
 #include<sys/select.h>
+#include<sys/stat.h>
+#include<dirent.h>
+#include<pthread.h>
+#include<string.h>
+#include<time.h>
 #include<readline/readline.h>
 #include<readline/history.h>
 #include"shell_internal.h"
@@ -24,6 +29,8 @@
 #include"getopt.h"
 #include"array.h"
 #include"confd.h"
+#include"lock.h"
+#include"pathnames.h"
 
 #define DEF_PS1 "\\$ "
 
@@ -73,24 +80,20 @@ static void linehandler(char*line){
 		shell_exit(exit_code);
 		return;
 	}
-	char**args;
-	if((args=args2array(line,0))){
-		if(args[0]){
-			if(shell_running){
-				switch(line[0]){
-					case ' ':case '\t':case '\n':break;
-					default:if(
-						!last||
-						strlen(last)!=strlen(line)||
-						strcmp(line,last)!=0
-					)add_history(line);
-				}
-				rl_callback_handler_remove();
+	if(line[strspn(line," \t\n")]){
+		if(shell_running){
+			switch(line[0]){
+				case ' ':case '\t':case '\n':break;
+				default:if(
+					!last||
+					strlen(last)!=strlen(line)||
+					strcmp(line,last)!=0
+				)add_history(line);
 			}
-			exit_code=run_cmd(args,false);
-			removed=true;
+			rl_callback_handler_remove();
 		}
-		free_args_array(args);
+		shell_eval(line,NULL,0);
+		removed=true;
 	}
 	if(last)free(last);
 	last=line;
@@ -101,17 +104,123 @@ static void linehandler(char*line){
 	shell_executing=false;
 }
 
+/*
+ * the programs in PATH are listed by a thread and kept, a completion
+ * only walks that list. a change of PATH or a directory that changed
+ * after the list was made starts a new list, until it is done the
+ * directories are read like before.
+ */
+struct comp_cache{
+	char*path;
+	char**names;
+	size_t cnt;
+	time_t mtime;
+	bool building;
+};
+static struct comp_cache comp={NULL,NULL,0,0,false};
+static mutex_t comp_lock=MUTEX_INITIALIZER;
+
+static void comp_free_names(char**names,size_t cnt){
+	if(!names)return;
+	for(size_t i=0;i<cnt;i++)free(names[i]);
+	free(names);
+}
+
+static time_t path_mtime(const char*paths){
+	struct stat st;
+	time_t t=0;
+	char**x=args2array((char*)paths,':');
+	if(!x)return 0;
+	for(size_t i=0;x[i];i++)
+		if(stat(x[i],&st)==0&&st.st_mtime>t)t=st.st_mtime;
+	free_args_array(x);
+	return t;
+}
+
+static bool comp_add(char***names,size_t*cnt,size_t*cap,const char*name){
+	char**n;
+	if(*cnt>=*cap){
+		if(!(n=realloc(*names,sizeof(char*)*(*cap+256))))return false;
+		*names=n,*cap+=256;
+	}
+	if(!((*names)[*cnt]=strdup(name)))return false;
+	(*cnt)++;
+	return true;
+}
+
+static void*comp_build(void*data){
+	char*paths=data,**x,**names=NULL;
+	size_t cnt=0,cap=0;
+	struct dirent*e;
+	time_t mtime;
+	DIR*d;
+	mtime=path_mtime(paths);
+	if((x=args2array(paths,':'))){
+		for(size_t i=0;x[i];i++){
+			if(!(d=opendir(x[i])))continue;
+			while((e=readdir(d))){
+				switch(e->d_type){
+					case DT_REG:case DT_LNK:break;
+					default:continue;
+				}
+				if(!comp_add(&names,&cnt,&cap,e->d_name))break;
+			}
+			closedir(d);
+		}
+		free_args_array(x);
+	}
+	MUTEX_LOCK(comp_lock);
+	comp_free_names(comp.names,comp.cnt);
+	if(comp.path)free(comp.path);
+	comp.path=paths,comp.names=names;
+	comp.cnt=cnt,comp.mtime=mtime;
+	comp.building=false;
+	MUTEX_UNLOCK(comp_lock);
+	return NULL;
+}
+
+// copy the matches of text if the list is good, else start a new one
+static char**comp_matches(const char*paths,const char*text,size_t len){
+	pthread_t t;
+	char**m=NULL,*p;
+	size_t c=0,cap=0;
+	bool ok;
+	MUTEX_LOCK(comp_lock);
+	ok=comp.path&&strcmp(comp.path,paths)==0&&path_mtime(paths)<=comp.mtime;
+	if(ok){
+		for(size_t i=0;i<comp.cnt;i++)
+			if(strncmp(comp.names[i],text,len)==0&&!comp_add(&m,&c,&cap,comp.names[i]))break;
+		if(comp_add(&m,&c,&cap,"")){
+			free(m[c-1]);
+			m[c-1]=NULL;
+		}
+	}else if(!comp.building&&(p=strdup(paths))){
+		comp.building=true;
+		if(pthread_create(&t,NULL,comp_build,p)==0)pthread_detach(t);
+		else comp.building=false,free(p);
+	}
+	MUTEX_UNLOCK(comp_lock);
+	if(ok&&!m)m=calloc(1,sizeof(char*));
+	return m;
+}
+
 static char*cmd_generator(const char*text,int state){
 	static DIR*d=NULL;
-	static char**x=NULL;
+	static char**x=NULL,**m=NULL;
 	static size_t i,s,len;
 	if(!state){
+		const char*paths=getenv("PATH");
 		if(d)closedir(d);
 		if(x)free_args_array(x);
+		if(m)array_free(m);
+		d=NULL,x=NULL;
 		len=strlen(text);
 		s=0,i=0;
-		x=args2array(getenv("PATH"),':');
-		if(x&&x[i])d=opendir(x[i]);
+		if(!paths)paths=_PATH_DEFAULT_PATH;
+		if(!(m=comp_matches(paths,text,len))){
+			x=args2array((char*)paths,':');
+			if(x&&x[i])d=opendir(x[i]);
+		}
 	}
 	const struct shell_command*cmd;
 	while((cmd=shell_cmds[s])){
@@ -119,6 +228,10 @@ static char*cmd_generator(const char*text,int state){
 		if(!cmd->enabled||!cmd->name[0])continue;
 		if(strncmp(cmd->name,text,len)==0)return strdup(cmd->name);
 	}
+	if(m){
+		if(m[i])return strdup(m[i++]);
+		return NULL;
+	}
 	if(x)for(;;){
 		if(d){
 			struct dirent*e=NULL;
@@ -183,12 +296,20 @@ int initshell_main(int argc,char**argv){
 	if(argc>1){
 		if((o=b_getlopt(argc,argv,so,lo,NULL))!=-1)switch(o){
 			case 'c':
-				linehandler(b_optarg);
-			return exit_code;
+				// like sh -c, the arguments after it are $0 $1 ...
+				return shell_eval(
+					b_optarg,
+					argv+b_optind,
+					argc-b_optind
+				);
 			default:return 2;
 		}
 		if(argc>b_optind&&strcmp(argv[b_optind],"-")==0)b_optind++;
-		if(argc!=b_optind)return re_printf(3,"unsupport script file\n");
+		if(argc!=b_optind)return shell_run_file(
+			argv[b_optind],
+			argv+b_optind,
+			argc-b_optind
+		);
 	}
 	run_shell();
 	return exit_code;
@@ -10,6 +10,7 @@
 #define SHELL_INTERNAL_H
 #include<stdbool.h>
 #include<stddef.h>
+#include<sys/types.h>
 #include"shell.h"
 #define TAG "initshell"
 
@@ -25,9 +26,96 @@ extern int run_cmd(char**args,bool background);
 // src/shelld/external.c: execute external command with args
 extern int run_external_cmd(char**argv,bool background);
 
+// src/shelld/external.c: start a program, wait for it unless background
+extern int shell_spawn(const char*path,char**argv,char**envp,bool background);
+
+// src/shelld/external.c: start a program without waiting, exit code if it cannot start
+extern int shell_spawn_pid(const char*path,char**argv,char**envp,pid_t*pid);
+
+// src/shelld/external.c: find and start an external command without waiting
+extern int shell_start_external(char**argv,pid_t*pid);
+
+// src/shelld/cmd.c: start a forking builtin without waiting
+extern int shell_start_internal(struct shell_command*cmd,char**args,pid_t*pid);
+
+// src/shelld/external.c: find a command in PATH through the hash, cp is PATH_MAX
+extern int shell_hash_lookup(const char*name,char*cp,bool remember);
+
+// src/shelld/external.c: forget a remembered command
+extern void shell_hash_forget(const char*name);
+
+// src/shelld/external.c: forget all remembered commands
+extern void shell_hash_clear(void);
+
+// src/shelld/external.c: list remembered commands
+extern void shell_hash_foreach(void(*cb)(const char*name,const char*path,unsigned int hits));
+
 // src/shelld/replace.c: generate shell prompt string
 extern char*shell_replace(char*dest,char*src,size_t size);
 
+#ifdef ENABLE_READLINE
+enum shell_redir_type{
+	REDIR_IN,
+	REDIR_OUT,
+	REDIR_APPEND,
+	REDIR_DUP,
+};
+
+// N< N> N>> or N>&M, a target of - closes N
+struct shell_redir{
+	int fd;
+	enum shell_redir_type type;
+	char*target;
+	struct shell_redir*next;
+};
+
+// one stage of a pipeline, argv may be NULL with only redirections
+struct shell_cmd{
+	char**argv;
+	size_t argc;
+	struct shell_redir*redirs;
+	struct shell_cmd*next;
+};
+
+// operator after a pipeline
+enum shell_op{
+	OP_END,
+	OP_SEQ,
+	OP_AND,
+	OP_OR,
+	OP_BG,
+};
+
+struct shell_pipeline{
+	struct shell_cmd*cmds;
+	size_t cnt;
+	enum shell_op op;
+};
+
+struct shell_parser{
+	const char*p;
+	bool expand;
+	char**params;
+	int nparams;
+	int err;
+};
+
+// src/shelld/parser.c: parse the next pipeline, NULL at the end or on error
+extern struct shell_pipeline*shell_parse_pipeline(struct shell_parser*p);
+
+// src/shelld/parser.c: free a parsed pipeline
+extern void shell_free_pipeline(struct shell_pipeline*pl);
+
+// src/shelld/exec.c: run a script text, positional params are optional
+extern int shell_eval(const char*src,char**params,int nparams);
+
+// src/shelld/exec.c: run a script file with its arguments
+extern int shell_run_file(const char*path,char**params,int nparams);
+
+// src/shelld/exec.c: collect finished background jobs
+extern void shell_reap_jobs(void);
+#endif
+
 // declare builtin command main
 #define DECLARE_MAIN(name) extern int name##_main(int,char**)
 
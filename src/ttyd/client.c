@@ -7,69 +7,65 @@
  */
 
 #define _GNU_SOURCE
+#include<errno.h>
 #include<string.h>
-#include<sys/un.h>
-#include<sys/socket.h>
 #include"logger.h"
 #include"ttyd_internal.h"
 
-int ttyd=-1;
+static struct ipc_conn ttyd={.fd=-1};
 
 int open_ttyd_socket(bool quiet,char*tag,char*path){
-	if(ttyd>=0)close(ttyd);
-	struct sockaddr_un n={0};
-	n.sun_family=AF_UNIX;
-	strncpy(n.sun_path,path,sizeof(n.sun_path)-1);
-	if((ttyd=socket(AF_UNIX,SOCK_STREAM,0))<0)
-		return quiet?-errno:erlog_error(-errno,tag,"cannot create socket");
-	if(connect(ttyd,(struct sockaddr*)&n,sizeof(n))<0){
-		if(!quiet)elog_error(tag,"cannot connect ttyd socket %s",n.sun_path);
-		close(ttyd);
-		ttyd=-1;
+	int r;
+	ipc_conn_close(&ttyd);
+	if((r=ipc_connect(&ttyd,path,TTYD_MAGIC0,TTYD_MAGIC1))<0){
+		if(!quiet)elog_error(tag,"cannot connect ttyd socket %s",path);
+		ttyd.fd=-1;
+		return r;
 	}
-	return ttyd;
+	return ttyd.fd;
 }
 
 int check_open_ttyd_socket(bool quiet,char*tag,char*path){
-	return ttyd>=0?ttyd:open_ttyd_socket(quiet,tag,path);
+	return ttyd.fd>=0?ttyd.fd:open_ttyd_socket(quiet,tag,path);
 }
 
 int set_ttyd_socket(int fd){
-	return ttyd=fd;
+	if(fd<0)return ttyd.fd=-1;
+	return ipc_conn_init(&ttyd,fd,TTYD_MAGIC0,TTYD_MAGIC1);
 }
 
 void close_ttyd_socket(){
-	if(ttyd<0)return;
-	close(ttyd);
-	ttyd=-1;
+	ipc_conn_close(&ttyd);
 }
 
-static int ttyd_command(enum ttyd_action action,int code){
-	struct ttyd_msg msg;
-	ttyd_internal_send_code(ttyd,action,code);
-	return ttyd_internal_read_msg(ttyd,&msg)&&msg.action==TTYD_OK?0:msg.code;
-}
-
-int ttyd_quit(){return ttyd_command(TTYD_QUIT,0);}
-
-int ttyd_reload(){
-	if(ttyd<0)ERET(ENOTCONN);
+static int ttyd_command(enum ttyd_action action,const char*name){
+	struct ipc_hdr res;
+	if(ttyd.fd<0)ERET(ENOTCONN);
 	errno=0;
-	struct ttyd_msg msg,res;
-	ttyd_internal_init_msg(&msg,TTYD_RELOAD);
-	if(ttyd_internal_send(ttyd,&msg)<0)return -1;
-	if(ttyd_internal_read_msg(ttyd,&res)<0)return -1;
+	if(ipc_call(
+		&ttyd,action,0,
+		name,name?strlen(name)+1:0,
+		&res,NULL,0
+	)<0)return -1;
 	if(res.code>0)errno=res.code;
 	return res.code;
 }
 
-int ttyd_reopen(){
-	if(ttyd<0)ERET(ENOTCONN);
-	errno=0;
-	struct ttyd_msg msg,res;
-	ttyd_internal_init_msg(&msg,TTYD_REOPEN);
-	if(ttyd_internal_send(ttyd,&msg)<0)return -1;
-	if(ttyd_internal_read_msg(ttyd,&res)<0)return -1;
-	if(res.code>0)errno=res.code;
-	return res.code;
+static int ttyd_tty_command(enum ttyd_action action,const char*name){
+	if(!name||!*name)ERET(EINVAL);
+	return ttyd_command(action,name);
 }
+
+// ttyd exits without a reply
+int ttyd_quit(){
+	if(ttyd.fd<0)ERET(ENOTCONN);
+	return ipc_request(&ttyd,TTYD_QUIT,0,NULL,0)?0:-1;
+}
+
+int ttyd_reload(){return ttyd_command(TTYD_RELOAD,NULL);}
+
+int ttyd_add_tty(const char*name){return ttyd_tty_command(TTYD_ADD,name);}
+
+int ttyd_remove_tty(const char*name){return ttyd_tty_command(TTYD_REMOVE,name);}
+
+int ttyd_reopen(){return ttyd_command(TTYD_REOPEN,NULL);}
@@ -0,0 +1,217 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<string.h>
+#include<stdlib.h>
+#include<stdbool.h>
+#include"array.h"
+#include"confd.h"
+#include"logger.h"
+#include"ttyd_internal.h"
+#define TAG "ttyd"
+
+/*
+ * every key ttyd and its workers read of a tty comes from one batch
+ * request, runtime.ttyd.tty.<name> before ttyd.tty.<name>, the result
+ * stays with the tty. two watch connections sit in the epoll loop, a
+ * change under a tty drops its cache, anything else drops all of them
+ * by a new generation. without watches every read fetches again.
+ * workers are forked with the cache of their tty.
+ */
+static const struct tty_conf_key{
+	const char*key;
+	enum conf_type type;
+}tty_keys[TTY_CONF_KEYS]={
+	{"start_msg",   TYPE_BOOLEAN },
+	{"speed",       TYPE_INTEGER },
+	{"clocal",      TYPE_BOOLEAN },
+	{"flow",        TYPE_BOOLEAN },
+	{"clear",       TYPE_BOOLEAN },
+	{"issue",       TYPE_BOOLEAN },
+	{"no_password", TYPE_BOOLEAN },
+	{"username",    TYPE_STRING  },
+	{"login_timeout",TYPE_INTEGER},
+};
+
+static struct tty_data watches[2];
+static bool cached=false;
+static unsigned int generation=1;
+static char*start_msg=NULL;
+static unsigned int start_msg_gen=0;
+static int respawn_max=10,respawn_interval=60;
+static unsigned int respawn_gen=0;
+
+void tty_conf_free(struct tty_data*data){
+	if(!data)return;
+	for(size_t i=0;i<TTY_CONF_KEYS;i++)
+		if(data->conf[i].type==TYPE_STRING&&data->conf[i].value.string)
+			free(data->conf[i].value.string);
+	memset(data->conf,0,sizeof(data->conf));
+	data->conf_gen=0;
+}
+
+static void item_free(struct confd_item*it){
+	if(it->code==0&&it->type==TYPE_STRING&&it->value.string)
+		free(it->value.string);
+}
+
+static void tty_conf_load(struct tty_data*data){
+	char paths[TTY_CONF_KEYS*2][128];
+	struct confd_item items[TTY_CONF_KEYS*2],*use;
+	if(cached&&data->conf_gen==generation)return;
+	tty_conf_free(data);
+	memset(items,0,sizeof(items));
+	for(size_t i=0;i<TTY_CONF_KEYS;i++){
+		snprintf(paths[i],sizeof(paths[i]),"%s.%s.%s",tty_rt_ttys,data->name,tty_keys[i].key);
+		snprintf(paths[i+TTY_CONF_KEYS],sizeof(paths[i]),"%s.%s.%s",tty_conf_ttys,data->name,tty_keys[i].key);
+		items[i].path=paths[i],items[i+TTY_CONF_KEYS].path=paths[i+TTY_CONF_KEYS];
+	}
+	if(confd_get_many(items,ARRLEN(items))!=0){
+		telog_debug("get config of tty %s failed",data->name);
+		return;
+	}
+	for(size_t i=0;i<TTY_CONF_KEYS;i++){
+		use=NULL;
+		if(items[i].code==0&&items[i].type==tty_keys[i].type)use=&items[i];
+		else if(
+			items[i+TTY_CONF_KEYS].code==0&&
+			items[i+TTY_CONF_KEYS].type==tty_keys[i].type
+		)use=&items[i+TTY_CONF_KEYS];
+		if(use){
+			data->conf[i]=*use;
+			data->conf[i].path=NULL;
+			use->type=0;
+		}
+		item_free(&items[i]);
+		item_free(&items[i+TTY_CONF_KEYS]);
+	}
+	data->conf_gen=generation;
+}
+
+static struct confd_item*tty_conf_get(struct tty_data*data,const char*key,enum conf_type type){
+	if(!data||!key)return NULL;
+	for(size_t i=0;i<TTY_CONF_KEYS;i++){
+		if(strcmp(tty_keys[i].key,key)!=0)continue;
+		tty_conf_load(data);
+		return data->conf[i].type==type?&data->conf[i]:NULL;
+	}
+	tlog_warn("tty key %s is not cached",key);
+	return NULL;
+}
+
+bool tty_confd_get_boolean(struct tty_data*data,const char*key,bool def){
+	struct confd_item*it=tty_conf_get(data,key,TYPE_BOOLEAN);
+	return it?it->value.boolean:def;
+}
+
+int64_t tty_confd_get_integer(struct tty_data*data,const char*key,int64_t def){
+	struct confd_item*it=tty_conf_get(data,key,TYPE_INTEGER);
+	return it?it->value.integer:def;
+}
+
+char*tty_confd_get_string(struct tty_data*data,const char*key,char*def){
+	struct confd_item*it=tty_conf_get(data,key,TYPE_STRING);
+	if(!it||!it->value.string)return def;
+	return strdup(it->value.string);
+}
+
+const char*tty_start_msg(void){
+	if(cached&&start_msg_gen==generation)return start_msg;
+	if(start_msg)free(start_msg);
+	start_msg=confd_get_string("ttyd.start_msg",NULL);
+	start_msg_gen=generation;
+	return start_msg;
+}
+
+void tty_respawn_limits(int*max,int*interval){
+	struct confd_item items[]={
+		{.path="ttyd.respawn_max",.type=TYPE_INTEGER},
+		{.path="ttyd.respawn_interval",.type=TYPE_INTEGER},
+	};
+	if(!cached||respawn_gen!=generation){
+		respawn_max=10,respawn_interval=60;
+		if(confd_get_many(items,ARRLEN(items))==0){
+			if(items[0].code==0&&items[0].type==TYPE_INTEGER)
+				respawn_max=(int)items[0].value.integer;
+			if(items[1].code==0&&items[1].type==TYPE_INTEGER)
+				respawn_interval=(int)items[1].value.integer;
+		}
+		respawn_gen=generation;
+	}
+	if(max)*max=respawn_max;
+	if(interval)*interval=respawn_interval;
+}
+
+// name of the tty a changed path belongs to, NULL for anything above
+static const char*changed_tty(const char*path,const char*base,char*name,size_t len){
+	size_t l=strlen(base),n;
+	const char*p;
+	if(strncmp(path,base,l)!=0||path[l]!='.')return NULL;
+	p=path+l+1,n=strcspn(p,".");
+	if(n<=0||n>=len)return NULL;
+	memcpy(name,p,n);
+	name[n]=0;
+	return name;
+}
+
+static void tty_conf_changed(const char*path){
+	struct tty_data*data;
+	char name[64];
+	size_t l=strlen(path);
+
+	// the states ttyd writes itself are no config
+	if(l>6&&strcmp(path+l-6,".state")==0)return;
+	if(
+		(changed_tty(path,tty_rt_ttys,name,sizeof(name))||
+		changed_tty(path,tty_conf_ttys,name,sizeof(name)))
+	){
+		if((data=tty_lookup(name)))data->conf_gen=0;
+		return;
+	}
+	if(++generation==0)generation=1;
+}
+
+static void watch_close(struct tty_data*w){
+	if(w->fd<0)return;
+	epoll_ctl(tty_epoll_fd,EPOLL_CTL_DEL,w->fd,&w->ev);
+	confd_watch_close(w->fd);
+	w->fd=-1;
+	if(cached)tlog_warn("lost config watch, tty config is not cached anymore");
+	cached=false;
+}
+
+void ttyd_epoll_conf(struct tty_data*w){
+	int r;
+	char path[PATH_MAX];
+	enum conf_type type;
+	while((r=confd_watch_read(w->fd,path,sizeof(path),&type,0))>0)
+		tty_conf_changed(path);
+	if(r<0)watch_close(w);
+}
+
+void tty_conf_watch(void){
+	const char*prefixes[ARRLEN(watches)]={"ttyd",tty_rt_ttys};
+	for(size_t i=0;i<ARRLEN(watches);i++){
+		struct tty_data*w=&watches[i];
+		memset(w,0,sizeof(struct tty_data));
+		w->type=FD_CONF;
+		if((w->fd=confd_watch_open(prefixes[i]))<0)continue;
+		w->ev.events=EPOLLIN,w->ev.data.ptr=w;
+		if(epoll_ctl(tty_epoll_fd,EPOLL_CTL_ADD,w->fd,&w->ev)<0){
+			confd_watch_close(w->fd);
+			w->fd=-1;
+		}
+	}
+	cached=watches[0].fd>=0&&watches[1].fd>=0;
+	if(!cached){
+		telog_warn("cannot watch tty config, fetch it every time");
+		for(size_t i=0;i<ARRLEN(watches);i++)watch_close(&watches[i]);
+	}
+}
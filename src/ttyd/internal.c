@@ -10,9 +10,10 @@
 #include<string.h>
 #include<stdlib.h>
 #include<stddef.h>
+#include<stdint.h>
+#include<fnmatch.h>
 #include<stdbool.h>
 #include<sys/ioctl.h>
-#include"list.h"
 #include"confd.h"
 #include"logger.h"
 #include"system.h"
@@ -20,7 +21,15 @@
 #include"ttyd_internal.h"
 #define TAG "ttyd"
 
-list*tty_store=NULL;
+/*
+ * ttys are kept in a table hashed by name. devd tells ttyd about every
+ * tty that comes or goes, a new one is taken when it is configured or
+ * its name matches a pattern of ttyd.hotplug, a gone one is dropped
+ * with its fd. a configured tty that is not there yet stays in the
+ * table and is opened when it shows up.
+ */
+#define TTY_BUCKETS 64
+static struct tty_data*tty_store[TTY_BUCKETS];
 int tty_dev_fd=-1,tty_epoll_fd=-1;
 const char*tty_sock=DEFAULT_TTYD;
 const char*tty_conf_ttys="ttyd.tty";
@@ -45,30 +54,47 @@ void tty_conf_init(){
 	confd_set_string("ttyd.issue","Linux \\r with \\S \\V (\\l)\n\n");
 	confd_set_string("ttyd.issue_file",_PATH_ETC"/issue");
 	confd_set_string("ttyd.start_msg","[press any key to activate this console]\n");
+	confd_set_string("ttyd.hotplug","ttyGS* ttyACM*");
+}
+
+static uint32_t tty_hash(const char*name){
+	uint32_t h=0x811C9DC5;
+	for(;*name;name++)h=(h^(unsigned char)*name)*0x01000193;
+	return h;
+}
+
+struct tty_data*tty_lookup(const char*name){
+	struct tty_data*data;
+	uint32_t h;
+	if(!name)return NULL;
+	h=tty_hash(name);
+	for(data=tty_store[h%TTY_BUCKETS];data;data=data->next)
+		if(data->hash==h&&strcmp(name,data->name)==0)return data;
+	return NULL;
 }
 
 bool tty_exists(const char*name){
-	if(!tty_store||!name||strlen(name)<4||strncmp(name,"tty",3)!=0)return false;
-	list*o=list_first(tty_store);
-	if(o)do{
-		LIST_DATA_DECLARE(data,o,struct tty_data*);
-		if(data&&strcmp(name,data->name)==0)return true;
-	}while((o=o->next));
-	return false;
+	if(!name||strlen(name)<4||strncmp(name,"tty",3)!=0)return false;
+	return tty_lookup(name)!=NULL;
 }
 
 void tty_open(struct tty_data*data){
-	if(!data||data->fd>=0)return;
+	if(!data||data->fd>=0||data->state==TTY_DISABLED)return;
 	data->worker=(pid_t)confd_get_integer_base(tty_rt_tty_clt,data->name,0);
 	if(data->worker>0){
 		if(is_link(_PATH_PROC"/%d/root",data->worker))return;
 		data->worker=0;
 		confd_delete_base(tty_rt_tty_clt,data->name);
 	}
+	if(data->state==TTY_RUNNING)tty_respawn_exited(data);
+	if(data->state==TTY_DISABLED)return;
+	if(data->state==TTY_BACKOFF&&tty_now()<data->retry_at)return;
 	if((data->fd=openat(tty_dev_fd,data->name,O_RDWR|O_NONBLOCK))<0){
 		if(errno==ENOENT)tlog_warn("tty %s not found",data->name);
 		else telog_warn("open tty %s failed",data->name);
+		tty_set_state(data,TTY_MISSING);
 	}else{
+		tty_set_state(data,TTY_WAITING);
 		data->type=FD_TTY;
 		data->ev.events=EPOLLIN;
 		data->ev.data.ptr=data;
@@ -96,11 +122,8 @@ void tty_open(struct tty_data*data){
 		epoll_ctl(tty_epoll_fd,EPOLL_CTL_ADD,data->fd,&data->ev);
 		tlog_info("add watch tty %s",data->name);
 		if(tty_confd_get_boolean(data,"start_msg",true)){
-			char*start_msg=confd_get_string("ttyd.start_msg",NULL);
-			if(start_msg){
-				write(data->fd,start_msg,strlen(start_msg));
-				free(start_msg);
-			}
+			const char*start_msg=tty_start_msg();
+			if(start_msg)write(data->fd,start_msg,strlen(start_msg));
 		}
 	}
 }
@@ -122,8 +145,60 @@ void tty_add(const char*base,const char*name){
 	memset(data,0,sizeof(struct tty_data));
 	strncpy(data->name,name,63);
 	data->fd=-1;
+	data->hash=tty_hash(data->name);
+	data->next=tty_store[data->hash%TTY_BUCKETS];
+	tty_store[data->hash%TTY_BUCKETS]=data;
 	tty_open(data);
-	list_obj_add_new(&tty_store,data);
+}
+
+static bool tty_hotplug_match(const char*name){
+	bool match=false;
+	char*pats,*p,*pat;
+	if(!(pats=confd_get_string("ttyd.hotplug",NULL)))return false;
+	for(p=pats;!match&&(pat=strsep(&p," ,"));)
+		if(*pat&&fnmatch(pat,name,0)==0)match=true;
+	free(pats);
+	return match;
+}
+
+void tty_hotplug_add(const char*name){
+	struct tty_data*data;
+	if(!name||!*name)return;
+	if((data=tty_lookup(name))){
+		tty_respawn_reset(data);
+		tty_open(data);
+		return;
+	}
+	if(confd_get_type_base(tty_conf_ttys,name)==TYPE_KEY){
+		tty_add(tty_conf_ttys,name);
+		return;
+	}
+	if(
+		confd_get_type_base(tty_rt_ttys,name)!=TYPE_KEY&&
+		tty_hotplug_match(name)
+	){
+		tlog_notice("add hotplug tty %s",name);
+		confd_set_boolean_dict(tty_rt_ttys,name,"enabled",true);
+		confd_set_boolean_dict(tty_rt_ttys,name,"start_msg",true);
+	}
+	if(confd_get_type_base(tty_rt_ttys,name)==TYPE_KEY)
+		tty_add(tty_rt_ttys,name);
+}
+
+void tty_remove(const char*name){
+	struct tty_data*data,**p;
+	if(!name||!*name)return;
+	p=&tty_store[tty_hash(name)%TTY_BUCKETS];
+	for(;(data=*p);p=&data->next)if(strcmp(name,data->name)==0)break;
+	if(!data)return;
+	*p=data->next;
+	if(data->fd>=0){
+		epoll_ctl(tty_epoll_fd,EPOLL_CTL_DEL,data->fd,&data->ev);
+		close(data->fd);
+	}
+	tlog_info("remove watch tty %s",data->name);
+	tty_conf_free(data);
+	free(data);
 }
 
 void tty_conf_add_all(){
@@ -151,23 +226,23 @@ void tty_conf_add_all(){
 }
 
 void tty_reopen_all(){
-	if(!tty_store)return;
-	list*o=list_first(tty_store);
-	if(o)do{tty_open(LIST_DATA(o,struct tty_data*));}while((o=o->next));
+	for(size_t i=0;i<TTY_BUCKETS;i++)
+		for(struct tty_data*d=tty_store[i];d;d=d->next)tty_open(d);
 }
 
-bool tty_confd_get_boolean(struct tty_data*data,const char*key,bool def){
-	if(confd_get_type_dict(tty_rt_ttys,data->name,key)==TYPE_BOOLEAN)
-		return confd_get_boolean_dict(tty_rt_ttys,data->name,key,def);
-	if(confd_get_type_dict(tty_conf_ttys,data->name,key)==TYPE_BOOLEAN)
-		return confd_get_boolean_dict(tty_conf_ttys,data->name,key,def);
-	return def;
+void tty_reset_all(){
+	for(size_t i=0;i<TTY_BUCKETS;i++)
+		for(struct tty_data*d=tty_store[i];d;d=d->next)tty_respawn_reset(d);
 }
 
-char*tty_confd_get_string(struct tty_data*data,const char*key,char*def){
-	if(confd_get_type_dict(tty_rt_ttys,data->name,key)==TYPE_STRING)
-		return confd_get_string_dict(tty_rt_ttys,data->name,key,def);
-	if(confd_get_type_dict(tty_conf_ttys,data->name,key)==TYPE_STRING)
-		return confd_get_string_dict(tty_conf_ttys,data->name,key,def);
-	return def;
+// open ttys at the end of their backoff, ms until the next one or -1
+int tty_retry_pending(){
+	time_t now=tty_now(),next=0;
+	for(size_t i=0;i<TTY_BUCKETS;i++)
+		for(struct tty_data*d=tty_store[i];d;d=d->next){
+			if(d->state!=TTY_BACKOFF||d->fd>=0)continue;
+			if(d->retry_at<=now)tty_open(d);
+			else if(next==0||d->retry_at<next)next=d->retry_at;
+		}
+	return next>0?(int)(next-now)*1000:-1;
 }
@@ -15,15 +15,52 @@
 #include<stddef.h>
 #include<string.h>
 #include<unistd.h>
+#include<poll.h>
 #include<shadow.h>
 #include<termios.h>
-#include<sys/select.h>
 #include<sys/utsname.h>
 #include"logger.h"
 #include"version.h"
 #include"ttyd_internal.h"
 #define TAG "login"
 #define USER_LENGTH 32
+#define INPUT_SIZE 256
+
+/*
+ * the tty is raw while asking, input is taken in chunks as it arrives
+ * and the echo of a chunk goes out in one write, so a pasted name and
+ * password survive a slow serial line. what follows the end of the
+ * name stays pending for the password. the wait is a poll without
+ * timeout, or login_timeout seconds of the tty.
+ */
+static char input[INPUT_SIZE];
+static size_t input_pos=0,input_len=0;
+
+static void input_flush(void){
+	tcflush(STDIN_FILENO,TCIFLUSH);
+	input_pos=input_len=0;
+}
+
+// next chunk of input, exits on hangup or timeout
+static size_t input_fill(struct tty_data*data){
+	int r,timeout;
+	ssize_t s;
+	struct pollfd p={.fd=STDIN_FILENO,.events=POLLIN};
+	if(input_pos<input_len)return input_len-input_pos;
+	timeout=(int)tty_confd_get_integer(data,"login_timeout",0);
+	timeout=timeout>0?timeout*1000:-1;
+	do{r=poll(&p,1,timeout);}while(r<0&&errno==EINTR);
+	if(r==0){
+		tlog_debug("%s login timed out",data->name);
+		write(STDOUT_FILENO,"\nLogin timed out\n",17);
+		exit(0);
+	}
+	if(r<0)exit(0);
+	do{s=read(STDIN_FILENO,input,sizeof(input));}while(s<0&&errno==EINTR);
+	if(s<=0)exit(0);
+	input_pos=0,input_len=s;
+	return input_len;
+}
 
 static void print_prompt(){
 	struct utsname u;
@@ -32,90 +69,85 @@ static void print_prompt(){
 	write(STDOUT_FILENO," login: ",8);
 }
 
-static bool _read_username_char(struct tty_data*data,size_t*s,char*buf){
+// one chunk of the name, echo goes to out, true when the line ended
+static bool read_username_chunk(struct tty_data*data,size_t*s,char*buf,char*out,size_t*o){
 	char c;
-	errno=0;
-	ssize_t r=read(STDIN_FILENO,&c,1);
-	if(errno==EAGAIN)return false;
-	if(r<1)exit(0);
-	switch(c){
-		case '\r':
-		case '\n':
-			buf[*s]='\0',data->eol=c;
-			write(STDOUT_FILENO,"\r\n",2);
-		return false;
-		case CTL('H'):
-		case 0x7f:
-			data->attrs.c_cc[VERASE]=c;
-			// fallthrough
-		case CTL('U'):
-			if(*s>0&&*s<USER_LENGTH+1){
-				write(STDOUT_FILENO,"\010 \010",3);
-				buf[--(*s)]=0;
-			}
-		break;
-		case CTL('C'):
-		case CTL('D'):
-			exit(0);
-		default:
-			if(c<' '||*s>=USER_LENGTH)break;
-			write(STDOUT_FILENO,&c,1);
-			buf[(*s)++]=c;
-		break;
+	while(input_pos<input_len){
+		switch((c=input[input_pos++])){
+			case '\r':
+			case '\n':
+				buf[*s]='\0',data->eol=c;
+				out[(*o)++]='\r',out[(*o)++]='\n';
+
+				// a pasted CR LF ends the line once
+				if(c=='\r'&&input_pos<input_len&&input[input_pos]=='\n')input_pos++;
+			return true;
+			case CTL('H'):
+			case 0x7f:
+				data->attrs.c_cc[VERASE]=c;
+				// fallthrough
+			case CTL('U'):
+				if(*s>0&&*s<USER_LENGTH+1){
+					memcpy(out+*o,"\010 \010",3),*o+=3;
+					buf[--(*s)]=0;
+				}
+			break;
+			case CTL('C'):
+			case CTL('D'):
+				if(*o>0)write(STDOUT_FILENO,out,*o);
+				exit(0);
+			default:
+				if(c<' '||*s>=USER_LENGTH)break;
+				out[(*o)++]=c;
+				buf[(*s)++]=c;
+			break;
+		}
 	}
-	return true;
+	return false;
 }
 
 static void _read_username(struct tty_data*data,char*buf){
-	fd_set fs;
-	size_t s=0;
-	struct timeval timeout;
+	bool end=false;
+	size_t s=0,o;
+	char out[INPUT_SIZE*3];
 	print_prompt();
 	memset(buf,0,USER_LENGTH+1);
 	data->eol=0;
-	do{
-		FD_ZERO(&fs);
-		FD_SET(STDIN_FILENO,&fs);
-		timeout.tv_sec=1,timeout.tv_usec=0;
-		int r=select(STDIN_FILENO+1,&fs,NULL,NULL,&timeout);
-		if(r<0)exit(0);
-		if(r==0)continue;
-		while(_read_username_char(data,&s,buf));
-	}while(data->eol==0);
+	while(!end){
+		input_fill(data);
+		o=0,end=read_username_chunk(data,&s,buf,out,&o);
+		if(o>0)write(STDOUT_FILENO,out,o);
+	}
 }
 
 char*tty_read_username(struct tty_data*data){
 	static char buf[USER_LENGTH+1];
-	usleep(100000);
-	tcflush(STDIN_FILENO,TCIFLUSH);
+	input_flush();
 	do{_read_username(data,buf);}while(buf[0]==0);
 	return buf;
 }
 
-static char*tty_read_pass(char*buf,size_t len){
+static char*tty_read_pass(struct tty_data*data,char*buf,size_t len){
 	size_t off=0;
-	ssize_t s;
-	char*p;
+	bool end=false;
+	char c;
 	struct termios tio,oldtio;
 	write(STDOUT_FILENO,"Password: ",10);
-	tcflush(STDOUT_FILENO,TCIFLUSH);
 	tcgetattr(STDIN_FILENO,&oldtio);
 	tio=oldtio,tio.c_lflag&=~(ECHO|ECHOE|ECHOK|ECHONL);
 	tcsetattr(STDIN_FILENO,TCSANOW,&tio);
 	memset(buf,0,len);
-	while(off<len-1){
-		p=buf+off;
-		s=read(STDIN_FILENO,p,len-off-1);
-		if(s<=0)break;
-		if(*p=='\r'||*p=='\n'){
-			*p=0;
-			break;
+	while(!end){
+		input_fill(data);
+		while(!end&&input_pos<input_len){
+			c=input[input_pos++];
+			if(c=='\r'||c=='\n')end=true;
+			else if(off<len-1)buf[off++]=c;
 		}
-		off+=s;
 	}
 	tcsetattr(STDIN_FILENO,TCSANOW,&oldtio);
 	write(STDOUT_FILENO,"\n",1);
-	return (off==0||off>=len)?NULL:buf;
+	return off==0?NULL:buf;
 }
 
 bool tty_ask_pwd(struct tty_data*data,char*username){
@@ -138,7 +170,7 @@ bool tty_ask_pwd(struct tty_data*data,char*username){
 		if(!r)return false;
 		if(!r[0])goto success;
 	}
-	tty_read_pass(pass,BUFSIZ);
+	tty_read_pass(data,pass,BUFSIZ);
 	if(pw){
 		enc=crypt(pass,r);
 		if(!enc||!*enc){
@@ -8,6 +8,7 @@
 
 #define _GNU_SOURCE
 #include<errno.h>
+#include<fcntl.h>
 #include<stdlib.h>
 #include<string.h>
 #include<unistd.h>
@@ -18,29 +19,31 @@
 #include"ttyd_internal.h"
 #define TAG "ttyd"
 
-int ttyd_listen_socket(){
-	int fd,er;
+int ttyd_listen_socket(int fd){
+	int er;
+	struct tty_data*new_data=NULL;
 	struct sockaddr_un un={.sun_family=AF_UNIX};
+
+	// activation socket from initd, already bound and listening
+	if(fd>=0){
+		fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+		if(!(new_data=malloc(sizeof(struct tty_data))))
+			return terlog_error(-errno,"malloc failed");
+		tlog_info("use activation socket %d",fd);
+		goto add;
+	}
 	if(strlen(tty_sock)>=sizeof(un.sun_path))return trlog_error(-ENAMETOOLONG,"invalid socket path");
 	strcpy(un.sun_path,tty_sock);
 	if(access(un.sun_path,F_OK)==0)return trlog_error(-EEXIST,"socket %s exists",un.sun_path);
 	else if(errno!=ENOENT)return terlog_error(-errno,"failed to access %s",un.sun_path);
-	if((fd=socket(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK,0))<0)return terlog_error(-errno,"cannot create socket");
-	struct tty_data*new_data=malloc(sizeof(struct tty_data));
-	if(!new_data){
-		telog_warn("malloc failed");
+	if(!(new_data=malloc(sizeof(struct tty_data))))
+		return terlog_error(-errno,"malloc failed");
+	if((fd=ipc_listen(tty_sock,SOCK_SEQPACKET,16,0600))<0){
+		telog_error("cannot listen socket %s",tty_sock);
 		goto fail;
 	}
-	if(bind(fd,(struct sockaddr*)&un,sizeof(un))<0){
-		telog_error("cannot bind socket");
-		goto fail;
-	}
-	if(listen(fd,1)<0){
-		telog_error("cannot listen socket");
-		goto fail;
-	}
-	chmod(un.sun_path,0600);
 	tlog_info("listen socket %s as %d",tty_sock,fd);
+	add:
 	memset(new_data,0,sizeof(struct tty_data));
 	new_data->fd=fd;
 	new_data->type=FD_SERVER;
@@ -50,57 +53,10 @@ int ttyd_listen_socket(){
 	return fd;
 	fail:
 	er=errno;
-	close(fd);
-	unlink(un.sun_path);
 	if(new_data)free(new_data);
 	ERET(er);
 }
 
-bool ttyd_internal_check_magic(struct ttyd_msg*msg){
-	return msg&&msg->magic0==TTYD_MAGIC0&&msg->magic1==TTYD_MAGIC1;
-}
-
-void ttyd_internal_init_msg(struct ttyd_msg*msg,enum ttyd_action action){
-	if(!msg)return;
-	memset(msg,0,sizeof(struct ttyd_msg));
-	msg->magic0=TTYD_MAGIC0;
-	msg->magic1=TTYD_MAGIC1;
-	msg->action=action;
-}
-
-int ttyd_internal_send(int fd,struct ttyd_msg*msg){
-	if(fd<0)ERET(EINVAL);
-	static size_t xs=sizeof(struct ttyd_msg);
-	return ((size_t)write(fd,msg,xs))==xs?(int)xs:-1;
-}
-
-int ttyd_internal_send_code(int fd,enum ttyd_action action,int code){
-	struct ttyd_msg msg;
-	if(fd<0)ERET(EINVAL);
-	ttyd_internal_init_msg(&msg,action);
-	msg.code=code;
-	return ttyd_internal_send(fd,&msg);
-}
-
-int ttyd_internal_read_msg(int fd,struct ttyd_msg*buff){
-	if(!buff||fd<0)ERET(EINVAL);
-	size_t size=sizeof(struct ttyd_msg),s;
-	memset(buff,0,size);
-	errno=0;
-	while(1){
-		errno=0;
-		s=read(fd,buff,size);
-		if(errno==0)break;
-		switch(errno){
-			case EINTR:continue;
-			case EAGAIN:return 0;
-			default:return -2;
-		}
-	}
-	if(s==0)return EOF;
-	return (s!=size||!(ttyd_internal_check_magic(buff)))?-2:1;
-}
-
 const char*ttyd_action2name(enum ttyd_action action){
 	switch(action){
 		case TTYD_OK:     return "OK";
@@ -108,48 +64,37 @@ const char*ttyd_action2name(enum ttyd_action action){
 		case TTYD_QUIT:   return "Quit";
 		case TTYD_RELOAD: return "Reload";
 		case TTYD_REOPEN: return "Reopen";
+		case TTYD_ADD:    return "Add";
+		case TTYD_REMOVE: return "Remove";
 		default:          return "Unknown";
 	}
 }
 
 void ttyd_epoll_server(struct tty_data*data){
-	int n=accept(data->fd,NULL,NULL);
-	if(n<0){
-		telog_warn("ttyd socket accept failed");
-		epoll_ctl(tty_epoll_fd,EPOLL_CTL_DEL,data->fd,&data->ev);
-		free(data);
-		return;
-	}
 	struct tty_data*new_data=malloc(sizeof(struct tty_data));
 	if(!new_data){
 		telog_warn("malloc failed");
-		close(n);
 		return;
 	}
 	memset(new_data,0,sizeof(struct tty_data));
-	fcntl(n,F_SETFL,O_RDWR|O_NONBLOCK);
-	new_data->fd=n;
+	if(ipc_accept(&new_data->ipc,data->fd,TTYD_MAGIC0,TTYD_MAGIC1)<0){
+		free(new_data);
+		if(errno==EAGAIN||errno==EINTR)return;
+		telog_warn("ttyd socket accept failed");
+		epoll_ctl(tty_epoll_fd,EPOLL_CTL_DEL,data->fd,&data->ev);
+		free(data);
+		return;
+	}
+	new_data->fd=new_data->ipc.fd;
 	new_data->type=FD_CLIENT;
 	new_data->ev.events=EPOLLIN;
 	new_data->ev.data.ptr=new_data;
 	epoll_ctl(tty_epoll_fd,EPOLL_CTL_ADD,new_data->fd,&new_data->ev);
 }
 
-void ttyd_epoll_client(struct tty_data*data){
-	struct ttyd_msg msg,ret;
-	ssize_t s=ttyd_internal_read_msg(data->fd,&msg);
-	if(s<=0){
-		if(s<0){
-			if(errno!=0)telog_warn("ttyd socket %d read failed",data->fd);
-			epoll_ctl(tty_epoll_fd,EPOLL_CTL_DEL,data->fd,&data->ev);
-			close(data->fd);
-			free(data);
-		}
-		return;
-	}
-	ttyd_internal_init_msg(&ret,TTYD_OK);
-	int retdata=0;
-	switch(msg.action){
+static int ttyd_process(struct ipc_hdr*hdr,char*data){
+	errno=0;
+	switch(hdr->action){
 		// command response
 		case TTYD_OK:case TTYD_FAIL:break;
 
@@ -162,6 +107,7 @@ void ttyd_epoll_client(struct tty_data*data){
 		// reload tty from confd
 		case TTYD_RELOAD:
 			tlog_notice("receive reload request");
+			tty_reset_all();
 			tty_conf_add_all();
 			//fallthrough
 
@@ -170,13 +116,38 @@ void ttyd_epoll_client(struct tty_data*data){
 			tty_reopen_all();
 		break;
 
+		// tty hotplug from devd
+		case TTYD_ADD:
+			tlog_debug("receive add tty %s",data);
+			tty_hotplug_add(data);
+		break;
+		case TTYD_REMOVE:
+			tlog_debug("receive remove tty %s",data);
+			tty_remove(data);
+		break;
+
 		// unknown
 		default:telog_warn(
 			"action %s(0x%X) not implemented",
-			ttyd_action2name(msg.action),msg.action
+			ttyd_action2name(hdr->action),hdr->action
 		);
 	}
-	if(retdata==0&&errno!=0)retdata=errno;
-	ret.code=retdata;
-	ttyd_internal_send(data->fd,&ret);
+	return errno;
+}
+
+void ttyd_epoll_client(struct tty_data*data){
+	int r,code;
+	char buf[PATH_MAX];
+	struct ipc_hdr hdr;
+
+	// drain every request already queued, clients may pipeline them
+	while((r=ipc_recv(&data->ipc,&hdr,buf,sizeof(buf)))>0){
+		code=ttyd_process(&hdr,buf);
+		ipc_reply(&data->ipc,&hdr,code==0?TTYD_OK:TTYD_FAIL,code,NULL,0);
+	}
+	if(r==0)return;
+	if(errno!=0)telog_warn("ttyd socket %d read failed",data->fd);
+	epoll_ctl(tty_epoll_fd,EPOLL_CTL_DEL,data->fd,&data->ev);
+	ipc_conn_close(&data->ipc);
+	free(data);
 }
@@ -0,0 +1,88 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#define _GNU_SOURCE
+#include<time.h>
+#include<string.h>
+#include<stdlib.h>
+#include"confd.h"
+#include"logger.h"
+#include"defines.h"
+#include"ttyd_internal.h"
+#define TAG "ttyd"
+
+/*
+ * ttyd only learns a worker is gone when the tty is opened again, a
+ * worker that lived less than TTY_QUICK_EXIT seconds counts as failed.
+ * a failed tty waits 1, 2, 4 up to TTY_BACKOFF_MAX seconds before it is
+ * opened again, ttyd.respawn_max failures within ttyd.respawn_interval
+ * seconds disable it until a reload or hotplug. the state of every tty
+ * is kept in runtime.ttyd.tty.<name>.state.
+ */
+#define TTY_QUICK_EXIT  5
+#define TTY_BACKOFF_MAX 60
+
+static const char*states[]={
+	[TTY_INIT]     = "init",
+	[TTY_WAITING]  = "waiting",
+	[TTY_RUNNING]  = "running",
+	[TTY_BACKOFF]  = "backoff",
+	[TTY_DISABLED] = "disabled",
+	[TTY_MISSING]  = "missing",
+};
+
+time_t tty_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec;
+}
+
+void tty_set_state(struct tty_data*data,enum tty_state state){
+	if(!data||data->state==state)return;
+	data->state=state;
+	confd_set_string_dict(tty_rt_ttys,data->name,"state",(char*)states[state]);
+}
+
+void tty_respawn_reset(struct tty_data*data){
+	if(!data)return;
+	data->fails=0,data->window_fails=0;
+	data->window_start=0,data->retry_at=0;
+	if(data->state==TTY_BACKOFF||data->state==TTY_DISABLED)
+		tty_set_state(data,TTY_INIT);
+}
+
+void tty_respawn_started(struct tty_data*data){
+	data->started=tty_now();
+	tty_set_state(data,TTY_RUNNING);
+}
+
+void tty_respawn_exited(struct tty_data*data){
+	int max,interval;
+	time_t now=tty_now(),delay;
+	if(now-data->started>=TTY_QUICK_EXIT){
+		data->fails=0;
+		tty_set_state(data,TTY_INIT);
+		return;
+	}
+	tty_respawn_limits(&max,&interval);
+	if(data->window_fails==0||now-data->window_start>interval)
+		data->window_start=now,data->window_fails=0;
+	data->fails++,data->window_fails++;
+	if(max>0&&data->window_fails>=max){
+		tlog_warn(
+			"tty %s failed %d times in %d seconds, disabled",
+			data->name,data->window_fails,interval
+		);
+		tty_set_state(data,TTY_DISABLED);
+		return;
+	}
+	delay=MIN((time_t)1<<MIN(data->fails-1,16),TTY_BACKOFF_MAX);
+	tlog_notice("tty %s worker exited early, retry in %ld seconds",data->name,(long)delay);
+	data->retry_at=now+delay;
+	tty_set_state(data,TTY_BACKOFF);
+}
@@ -26,11 +26,14 @@
 #define TAG "ttyd"
 
 static bool protect=false;
+static bool activated=false;
 
 static void signal_handler(int s,siginfo_t*info,void*c __attribute__((unused))){
 	if(info->si_pid<=1&&protect)return;
 	tlog_info("ttyd exiting with signal %d",s);
-	unlink(DEFAULT_TTYD);
+
+	// activation socket stays with initd for the next start
+	if(!activated)unlink(DEFAULT_TTYD);
 	exit(0);
 }
 
@@ -40,10 +43,11 @@ void ttyd_epoll_tty(struct tty_data*data){
 	close(data->fd);
 	memset(&data->ev,0,sizeof(data->ev));
 	data->fd=-1;
+	tty_respawn_started(data);
 	tty_start_worker(data);
 }
 
-int ttyd_thread(){
+int ttyd_thread(int sock){
 	static size_t es=sizeof(struct epoll_event);
 	int r,e=0;
 	open_socket_logfd_default();
@@ -66,12 +70,14 @@ int ttyd_thread(){
 		e=-errno;
 		goto ex;
 	}
-	ttyd_listen_socket();
+	activated=sock>=0;
+	ttyd_listen_socket(sock);
 	tty_conf_init();
+	tty_conf_watch();
 	tty_conf_add_all();
 	memset(evs,0,es*64);
 	while(1){
-		r=epoll_wait(tty_epoll_fd,evs,64,-1);
+		r=epoll_wait(tty_epoll_fd,evs,64,tty_retry_pending());
 		if(r==-1){
 			if(errno==EINTR)continue;
 			telog_error("epoll failed");
@@ -84,6 +90,7 @@ int ttyd_thread(){
 				case FD_TTY:ttyd_epoll_tty(data);break;
 				case FD_SERVER:ttyd_epoll_server(data);break;
 				case FD_CLIENT:ttyd_epoll_client(data);break;
+				case FD_CONF:ttyd_epoll_conf(data);break;
 			}
 		}
 	}
@@ -129,11 +136,11 @@ int ttyd_main(int argc __attribute__((unused)),char**argv __attribute__((unused)
 			default:_exit(0);
 		}
 	}
-	return ttyd_thread();
+	return ttyd_thread(-1);
 }
 
-static int ttyd_startup(struct service*svc __attribute__((unused))){
-	return ttyd_main(0,NULL);
+static int ttyd_startup(struct service*svc){
+	return ttyd_thread(svc->socket_fd);
 }
 
 int register_ttyd(){
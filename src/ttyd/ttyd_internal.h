@@ -8,11 +8,15 @@
 
 #ifndef TTYD_INTERNAL
 #define TTYD_INTERNAL
+#include<time.h>
+#include<stdint.h>
 #include<unistd.h>
 #include<stdbool.h>
 #include<termios.h>
 #include<sys/epoll.h>
+#include"ipc.h"
 #include"ttyd.h"
+#include"confd.h"
 #include"defines.h"
 #include"pathnames.h"
 
@@ -23,7 +27,20 @@ enum tty_fd_type{
 	FD_TTY,
 	FD_SERVER,
 	FD_CLIENT,
+	FD_CONF,
 };
+
+enum tty_state{
+	TTY_INIT,
+	TTY_WAITING,
+	TTY_RUNNING,
+	TTY_BACKOFF,
+	TTY_DISABLED,
+	TTY_MISSING,
+};
+
+// keys of a tty cached from confd, see src/ttyd/conf.c
+#define TTY_CONF_KEYS 9
 struct tty_data{
 	bool init_attr;
 	int fd,speed;
@@ -36,6 +53,14 @@ struct tty_data{
 	char user[64],group[64];
 	char shell[PATH_MAX],home[PATH_MAX];
 	pid_t worker;
+	uint32_t hash;
+	struct tty_data*next;
+	enum tty_state state;
+	time_t started,retry_at,window_start;
+	int fails,window_fails;
+	unsigned int conf_gen;
+	struct confd_item conf[TTY_CONF_KEYS];
+	struct ipc_conn ipc;
 };
 enum ttyd_action{
 	TTYD_OK     =0xAA00,
@@ -43,12 +68,8 @@ enum ttyd_action{
 	TTYD_QUIT   =0xAA02,
 	TTYD_RELOAD =0xAA03,
 	TTYD_REOPEN =0xAA04,
-};
-struct ttyd_msg{
-	unsigned char magic0:8,magic1:8;
-	enum ttyd_action action:16;
-	int code:32;
-	char data[4088];
+	TTYD_ADD    =0xAA05,
+	TTYD_REMOVE =0xAA06,
 };
 extern int tty_dev_fd;
 extern int tty_epoll_fd;
@@ -60,11 +81,27 @@ extern const char*tty_rt_tty_clt;
 extern void tty_conf_init(void);
 extern void tty_conf_add_all(void);
 extern void tty_add(const char*base,const char*name);
+extern void tty_hotplug_add(const char*name);
+extern void tty_remove(const char*name);
 extern void tty_open(struct tty_data*data);
 extern int tty_start_session(struct tty_data*data);
 extern int tty_start_worker(struct tty_data*data);
 extern int tty_speed_convert(int number);
 extern bool tty_exists(const char*name);
+extern struct tty_data*tty_lookup(const char*name);
+extern void tty_conf_watch(void);
+extern void tty_respawn_limits(int*max,int*interval);
+extern time_t tty_now(void);
+extern void tty_set_state(struct tty_data*data,enum tty_state state);
+extern void tty_respawn_reset(struct tty_data*data);
+extern void tty_respawn_started(struct tty_data*data);
+extern void tty_respawn_exited(struct tty_data*data);
+extern void tty_reset_all(void);
+extern int tty_retry_pending(void);
+extern void tty_conf_free(struct tty_data*data);
+extern const char*tty_start_msg(void);
+extern void ttyd_epoll_conf(struct tty_data*data);
+extern int64_t tty_confd_get_integer(struct tty_data*data,const char*key,int64_t def);
 extern bool tty_confd_get_boolean(struct tty_data*data,const char*key,bool def);
 extern char*tty_confd_get_string(struct tty_data*data,const char*key,char*def);
 extern char*tty_issue_replace(char*src,char*dest,size_t dest_len,struct tty_data*data);
@@ -76,11 +113,6 @@ extern bool tty_login(struct tty_data*data);
 extern ssize_t tty_issue_write(int fd,struct tty_data*data);
 extern void ttyd_epoll_client(struct tty_data*data);
 extern void ttyd_epoll_server(struct tty_data*data);
-extern int ttyd_listen_socket();
-extern bool ttyd_internal_check_magic(struct ttyd_msg*msg);
-extern void ttyd_internal_init_msg(struct ttyd_msg*msg,enum ttyd_action action);
-extern int ttyd_internal_send(int fd,struct ttyd_msg*msg);
-extern int ttyd_internal_send_code(int fd,enum ttyd_action action,int code);
-extern int ttyd_internal_read_msg(int fd,struct ttyd_msg*buff);
+extern int ttyd_listen_socket(int fd);
 extern const char*ttyd_action2name(enum ttyd_action action);
 #endif
@@ -44,8 +44,7 @@ static int worker_tty_open(){
 }
 
 static int worker_tty_set_speed(){
-	int sp=confd_get_integer_dict(tty_rt_ttys,data->name,"speed",-1);
-	if(sp<0)sp=confd_get_integer_dict(tty_conf_ttys,data->name,"speed",-1);
+	int sp=(int)tty_confd_get_integer(data,"speed",-1);
 	if(sp<=0)return 0;
 	data->speed=tty_speed_convert(sp);
 	if(data->speed<0)return trlog_warn(0,"invalid speed %d",data->speed);
@@ -165,6 +164,9 @@ static int tty_worker(){
 		puts("\033[H\033[2J\033[3J");
 	if(tty_confd_get_boolean(data,"issue",true))
 		tty_issue_write(STDOUT_FILENO,data);
+
+	// a login prompt is up, ends the boot readahead recording
+	confd_set_boolean("runtime.boot.ready",true);
 	if(tty_login(data)){
 		pid_t p=fork();
 		switch(p){
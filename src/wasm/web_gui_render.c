@@ -10,7 +10,11 @@
 #include<zlib.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 #include<emscripten.h>
+#ifdef __wasm_simd128__
+#include<wasm_simd128.h>
+#endif
 #include<emscripten/websocket.h>
 #include"../../include/frame_protocol.h"
 #include"web_gui_render.h"
@@ -20,6 +24,9 @@ static struct http_hand_websocket websocket;
 static struct{
 	SDL_Surface*screen;
 	size_t bytes,frames;
+	int window;
+	z_stream zs;
+	bool zs_init:1;
 	bool compressed:1;
 	bool all_paused:1;
 	bool video_paused:1;
@@ -40,19 +47,130 @@ enum {
 	LV_KEY_END       = 3,   /*0x03, ETX*/
 };
 
+/*
+ * the screen is 32 bits with red in byte 0, frames are converted a row
+ * at a time: RGBA32 is copied as is, other formats go through a byte
+ * shuffle of 4 pixels per step with wasm simd and a per format loop
+ * for the rest, the format is looked up once per row instead of per pixel
+ */
+typedef void(*row_conv)(char*dst,const char*src,size_t cnt);
+
+#ifdef __wasm_simd128__
+#define SHUF(bsp,r,g,b) wasm_i8x16_const(\
+	r,g,b,-1,(bsp)+(r),(bsp)+(g),(bsp)+(b),-1,\
+	(bsp)*2+(r),(bsp)*2+(g),(bsp)*2+(b),-1,\
+	(bsp)*3+(r),(bsp)*3+(g),(bsp)*3+(b),-1\
+)
+
+// 24 bits pixels need 6 pixels left to load 16 bytes without overread
+#define ROW_SIMD(bsp,r,g,b)\
+	v128_t m=SHUF(bsp,r,g,b);\
+	for(;cnt>=(bsp==3?6:4);cnt-=4,dst+=16,src+=(bsp)*4)\
+		wasm_v128_store(dst,wasm_i8x16_swizzle(wasm_v128_load(src),m));
+#else
+#define ROW_SIMD(bsp,r,g,b)
+#endif
+
+#define ROW_CONV(name,bsp,r,g,b)\
+	static void row_##name(char*dst,const char*src,size_t cnt){\
+		ROW_SIMD(bsp,r,g,b)\
+		for(;cnt>0;cnt--,dst+=4,src+=(bsp))\
+			dst[0]=src[r],dst[1]=src[g],dst[2]=src[b];\
+	}
+ROW_CONV(rgb24,  3,0,1,2)
+ROW_CONV(bgr24,  3,2,1,0)
+ROW_CONV(argb32, 4,1,2,3)
+ROW_CONV(abgr32, 4,3,2,1)
+ROW_CONV(bgra32, 4,2,1,0)
+
+static void row_rgba32(char*dst,const char*src,size_t cnt){
+	memcpy(dst,src,cnt*4);
+}
+
+static row_conv get_row_conv(frame_pixel pixel){
+	switch(pixel){
+		case PIXEL_RGB24:return row_rgb24;
+		case PIXEL_BGR24:return row_bgr24;
+		case PIXEL_ARGB32:return row_argb32;
+		case PIXEL_ABGR32:return row_abgr32;
+		case PIXEL_RGBA32:return row_rgba32;
+		case PIXEL_BGRA32:return row_bgra32;
+		default:return NULL;
+	}
+}
+
+// fill cnt pixels of the screen from offset p with one color
+static void fill_pixels(struct frame_data*d,uint32_t p,const char*src,size_t cnt){
+	uint32_t c=0,*dst=(uint32_t*)((char*)state.screen->pixels+p);
+	pixel_copy(d->pixel,(char*)&c,(char*)src);
+	for(size_t i=0;i<cnt;i++)dst[i]=c;
+}
+
+static void draw_tiles(struct frame_data*d,const char*buf,size_t len){
+	const frame_tile*t;
+	uint8_t bsp=pixel_size(d->pixel);
+	row_conv conv=get_row_conv(d->pixel);
+	if(!conv)return;
+	size_t pos=0,n,cnt,ts=sizeof(frame_tile),rs;
+	while(pos+ts<=len){
+		t=(const frame_tile*)(buf+pos);
+		rs=ts+FRAME_TILE_ALIGN(t->size);
+		if(
+			rs>len-pos||
+			t->x+t->w>state.screen->w||
+			t->y+t->h>state.screen->h
+		){
+			fprintf(stderr,"invalid tile at %zu\n",pos);
+			return;
+		}
+		uint32_t p,x=0,y=0;
+		switch(t->enc){
+			case TILE_RAW:
+				if(t->size<(size_t)t->w*t->h*bsp)break;
+				for(y=0;y<t->h;y++)conv(
+					(char*)state.screen->pixels+
+						((t->y+y)*state.screen->w+t->x)*4,
+					t->data+(size_t)y*t->w*bsp,t->w
+				);
+			break;
+			case TILE_SOLID:
+				if(t->size<bsp)break;
+				for(y=0;y<t->h;y++)fill_pixels(
+					d,((t->y+y)*state.screen->w+t->x)*4,
+					t->data,t->w
+				);
+			break;
+			case TILE_RLE:
+				for(n=0;n+1+bsp<=t->size&&y<t->h;n+=1+bsp){
+					cnt=(uint8_t)t->data[n]+1;
+					while(cnt>0&&y<t->h){
+						size_t c=cnt<(size_t)(t->w-x)?cnt:(size_t)(t->w-x);
+						p=((t->y+y)*state.screen->w+t->x+x)*4;
+						fill_pixels(d,p,t->data+n+1,c);
+						cnt-=c,x+=c;
+						if(x>=t->w)x=0,y++;
+					}
+				}
+			break;
+			default:fprintf(stderr,"unsupported tile encoding %d\n",t->enc);
+		}
+		pos+=rs;
+	}
+}
+
 static int hand_frame(
 	struct http_hand_websocket*h,
 	struct ws_data_hand*hand __attribute__((unused)),
 	const char*rd,size_t len
 ){
 	uint8_t bsp;
-	void*buf=NULL;
+	row_conv conv;
+	char*buf=NULL;
 	static size_t ds=0;
 	static void*zbuf=NULL;
 	size_t ss=sizeof(struct frame_data);
 	struct frame_data*d=(struct frame_data*)rd;
 	if(!state.screen||h!=&websocket)return 0;
-	if(state.all_paused||state.video_paused)return 0;
 	if(!d||len<=ss)return -1;
 	size_t rs=ss+d->size,xs;
 	if(memcmp(d->magic,FRAME_MAGIC,sizeof(d->magic))!=0){
@@ -75,8 +193,9 @@ static int hand_frame(
 		return 0;
 	}
 	if(
-		d->dst_x<=d->src_x||d->dst_y<=d->src_y||
-		d->dst_x>state.screen->w||d->dst_y>state.screen->h
+		d->dst_x<d->src_x||d->dst_y<d->src_y||
+		d->dst_x>=(uint32_t)state.screen->w||
+		d->dst_y>=(uint32_t)state.screen->h
 	){
 		fprintf(
 			stderr,"invalid frame, area out of screen "
@@ -86,40 +205,71 @@ static int hand_frame(
 		);
 		return 0;
 	}
-	if(d->type!=TYPE_RAW){
+	if(d->type!=TYPE_RAW&&d->type!=TYPE_TILE){
 		fprintf(stderr,"unsupported frame type\n");
 		return 0;
 	}
 	bsp=pixel_size(d->pixel);
+	if(!(conv=get_row_conv(d->pixel))){
+		fprintf(stderr,"unsupported pixel format %d\n",d->pixel);
+		return 0;
+	}
 	if(d->compressed){
-		if(d->src_size>ds){
+		// one spare byte lets inflate take the sync flush marker after the data
+		if(d->src_size+1>ds){
 			if(zbuf)free(zbuf);
-			if(!(zbuf=malloc(d->src_size))){
+			if(!(zbuf=malloc(d->src_size+1))){
+				ds=0,zbuf=NULL;
 				fprintf(stderr,"alloc memory for decompress\n");
 				goto out;
 			}
-			ds=d->src_size;
+			ds=d->src_size+1;
 		}
-		uLongf zl=d->src_size;
-		int r=uncompress(zbuf,&zl,(Bytef*)d->frame,d->size);
-		if(r!=Z_OK){
-			fprintf(stderr,"decompress failed: %d\n",r);
-			goto out;
+		if(d->stream){
+			// paused or not, every frame of the stream has to be inflated in order
+			int r;
+			if(!state.zs_init){
+				memset(&state.zs,0,sizeof(state.zs));
+				if(inflateInit(&state.zs)!=Z_OK){
+					fprintf(stderr,"init inflate stream failed\n");
+					goto out;
+				}
+				state.zs_init=true;
+			}else if(d->reset)inflateReset(&state.zs);
+			state.zs.next_in=(Bytef*)d->frame,state.zs.avail_in=d->size;
+			state.zs.next_out=zbuf,state.zs.avail_out=d->src_size+1;
+			r=inflate(&state.zs,Z_SYNC_FLUSH);
+			xs=d->src_size+1-state.zs.avail_out;
+			if((r!=Z_OK&&r!=Z_BUF_ERROR)||state.zs.avail_in!=0||xs!=d->src_size){
+				fprintf(stderr,"inflate stream failed: %d\n",r);
+				goto out;
+			}
+		}else{
+			uLongf zl=d->src_size;
+			int r=uncompress(zbuf,&zl,(Bytef*)d->frame,d->size);
+			if(r!=Z_OK){
+				fprintf(stderr,"decompress failed: %d\n",r);
+				goto out;
+			}
+			xs=zl;
 		}
-		xs=zl,buf=zbuf;
+		buf=zbuf;
 	}else xs=d->size,buf=d->frame;
-	size_t gs=(d->dst_x-d->src_x)*(d->dst_y-d->src_y)*bsp;
-	if(gs!=xs)fprintf(stderr,"buffer size mismatch %zu != %zu\n",gs,xs);
-	if(SDL_MUSTLOCK(screen))SDL_LockSurface(state.screen);
-	uint32_t p,n=0;
-	for(uint32_t y=d->src_y;y<=d->dst_y;y++){
-		p=(y*state.screen->w+d->src_x)*4;
-		for(uint32_t x=d->src_x;x<=d->dst_x;x++){
-			pixel_copy(d->pixel,state.screen->pixels+p,buf+n);
-			p+=4,n+=bsp;
+	if(state.all_paused||state.video_paused)return 0;
+	if(d->type==TYPE_RAW){
+		size_t w=d->dst_x-d->src_x+1,h=d->dst_y-d->src_y+1;
+		if(w*h*bsp!=xs){
+			fprintf(stderr,"buffer size mismatch %zu != %zu\n",w*h*bsp,xs);
+			goto out;
 		}
 	}
-	if(SDL_MUSTLOCK(screen))SDL_UnlockSurface(state.screen);
+	if(SDL_MUSTLOCK(state.screen))SDL_LockSurface(state.screen);
+	if(d->type==TYPE_TILE)draw_tiles(d,buf,xs);
+	else for(uint32_t y=d->src_y;y<=d->dst_y;y++,buf+=(d->dst_x-d->src_x+1)*bsp)conv(
+		(char*)state.screen->pixels+(y*state.screen->w+d->src_x)*4,
+		buf,d->dst_x-d->src_x+1
+	);
+	if(SDL_MUSTLOCK(state.screen))SDL_UnlockSurface(state.screen);
 	SDL_Flip(state.screen);
 	state.frames++;
 	out:ws_send_cmd(h,"FLUSH");
@@ -146,9 +296,10 @@ static int hand_size(
 			return -1;
 		}
 	}else fprintf(stderr,"screen already initialized, skip\n");
+	ws_send_cmd(h,state.compressed?"COMP:STREAM":"COMP:FALSE");
+	ws_send_cmd(h,"TYPE:TILE");
+	if(state.window>0)web_gui_set_window(state.window);
 	web_gui_refresh();
-	ws_send_cmd(h,"COMP:TRUE");
-	ws_send_cmd(h,"TYPE:RAW");
 	return 0;
 }
 
@@ -298,6 +449,7 @@ EMSCRIPTEN_KEEPALIVE void web_gui_initialize(){
 	if(initialized)return;
 	SDL_Init(SDL_INIT_VIDEO);
 	memset(&state,0,sizeof(state));
+	state.compressed=true;
 	websocket.ws=-1;
 	emscripten_set_main_loop(sdl_event_handler,0,0);
 	printf("web gui render initialized\n");
@@ -306,10 +458,20 @@ EMSCRIPTEN_KEEPALIVE void web_gui_initialize(){
 
 EMSCRIPTEN_KEEPALIVE void web_gui_set_compressed(bool compressed){
 	if(compressed!=state.compressed&&websocket.ws>0)
-		ws_send_cmd(&websocket,compressed?"COMP:TRUE":"COMP:FALSE");
+		ws_send_cmd(&websocket,compressed?"COMP:STREAM":"COMP:FALSE");
 	state.compressed=compressed;
 }
 
+// frames the server may send before waiting for FLUSH, 0 for its default
+EMSCRIPTEN_KEEPALIVE void web_gui_set_window(int window){
+	char buf[32];
+	if(window<0)return;
+	state.window=window;
+	if(websocket.ws<0)return;
+	snprintf(buf,sizeof(buf),"WINDOW:%d",window);
+	ws_send_cmd(&websocket,buf);
+}
+
 int main(){
 	web_gui_initialize();
 	return 0;
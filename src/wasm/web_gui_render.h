@@ -18,6 +18,7 @@ extern EMSCRIPTEN_KEEPALIVE void web_gui_set_paused(bool paused);
 extern EMSCRIPTEN_KEEPALIVE void web_gui_set_video_paused(bool paused);
 extern EMSCRIPTEN_KEEPALIVE void web_gui_set_input_paused(bool paused);
 extern EMSCRIPTEN_KEEPALIVE void web_gui_set_compressed(bool compressed);
+extern EMSCRIPTEN_KEEPALIVE void web_gui_set_window(int window);
 extern EMSCRIPTEN_KEEPALIVE void web_gui_disconnect();
 extern EMSCRIPTEN_KEEPALIVE void web_gui_refresh();
 extern EMSCRIPTEN_KEEPALIVE void web_gui_initialize();
@@ -0,0 +1,91 @@
+/*
+ *
+ * Copyright (C) 2021 BigfootACA <bigfoot@classfun.cn>
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ *
+ */
+
+#include<stdio.h>
+#include<stdarg.h>
+#include"../src/compress/lz4.c"
+
+/*
+ * frames of two stored blocks, 64K max block size
+ * a stored block larger than the block size must be refused by both the
+ * one-shot and the streaming decoder instead of overflowing the window
+ */
+#define MAX_BLOCK 0x10000
+
+int logger_printf(enum log_level level,char*tag,const char*fmt,...){
+	(void)level,(void)tag,(void)fmt;
+	return 0;
+}
+
+int return_logger_printf(enum log_level level,int e,char*tag,const char*fmt,...){
+	(void)level,(void)tag,(void)fmt;
+	return e;
+}
+
+static size_t put_block(unsigned char*buf,size_t size){
+	size_t p=0;
+	uint32_t bs=0x80000000|size;
+	for(int i=0;i<4;i++)buf[p++]=bs>>(i*8);
+	for(size_t i=0;i<size;i++)buf[p++]=i&0xFF;
+	return p;
+}
+
+// dependent blocks, so the second one lands after a full history
+static size_t make_frame(unsigned char*buf,size_t size){
+	size_t p=0;
+	static const unsigned char hdr[]={0x04,0x22,0x4D,0x18,0x40,0x40,0x82};
+	memcpy(buf,hdr,sizeof(hdr)),p+=sizeof(hdr);
+	p+=put_block(buf+p,MAX_BLOCK);
+	p+=put_block(buf+p,size);
+	memset(buf+p,0,4),p+=4;
+	return p;
+}
+
+static int check(const char*name,bool ok){
+	printf("%s: %s\n",name,ok?"ok":"FAILED");
+	return ok?0:1;
+}
+
+static bool stream_decode(unsigned char*inp,size_t len,unsigned char*out,size_t cap,size_t*olen){
+	int r;
+	size_t used=0,got=0;
+	struct lz4_stream ls;
+	compress_stream s={.comp=&compressor_lz4,.data=&ls};
+	unlz4_init(&s);
+	r=unlz4_update(&s,inp,len,out,cap,&used,&got);
+	unlz4_finish(&s);
+	*olen=got;
+	return r==0&&s.end;
+}
+
+int main(void){
+	int fail=0;
+	size_t len,olen=0;
+	unsigned char*in=malloc(MAX_BLOCK*3+32),*out=malloc(MAX_BLOCK*3);
+	if(!in||!out)return 1;
+
+	len=make_frame(in,MAX_BLOCK);
+	fail|=check("one-shot full stored blocks",
+		unlz4(in,len,out,MAX_BLOCK*3,NULL,&olen)==0&&
+		olen==MAX_BLOCK*2&&out[MAX_BLOCK*2-1]==((MAX_BLOCK-1)&0xFF)
+	);
+	fail|=check("stream full stored blocks",
+		stream_decode(in,len,out,MAX_BLOCK*3,&olen)&&olen==MAX_BLOCK*2
+	);
+
+	len=make_frame(in,LZ4_BOUND(MAX_BLOCK));
+	fail|=check("one-shot oversized stored block",
+		unlz4(in,len,out,MAX_BLOCK*3,NULL,&olen)!=0
+	);
+	fail|=check("stream oversized stored block",
+		!stream_decode(in,len,out,MAX_BLOCK*3,&olen)
+	);
+	free(in);
+	free(out);
+	return fail;
+}